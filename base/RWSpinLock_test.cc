@@ -23,6 +23,7 @@
 #include <cstdlib>
 
 #include "base/RWSpinLock.h"
+#include "base/distributed_rwlock.h"
 #include <unistd.h>
 
 
@@ -40,7 +41,7 @@ template<typename RWSpinLockT> struct RWSpinLockTest: public testing::Test {
   typedef RWSpinLockT RWSpinLockType;
 };
 
-typedef testing::Types<RWSpinLock
+typedef testing::Types<RWSpinLock, base::DistributedRWLock
 #if 0
 #ifdef RW_SPINLOCK_USE_X86_INTRINSIC_
         , RWTicketSpinLockT<32, true>,
@@ -235,4 +236,56 @@ TEST(RWSpinLock, concurrent_holder_test) {
     << "; upgrades: " << upgrades.load(std::memory_order_acquire);
 }
 
+TEST(DistributedRWLock, Exclusion) {
+  base::DistributedRWLock lock;
+  int64_t a = 0, b = 0;
+  std::atomic<int64_t> bad_reads(0);
+
+  auto go = [&](unsigned id) {
+    for (unsigned i = 0; i < 20000; ++i) {
+      if ((i + id) % 16 == 0) {
+        base::DistributedRWLock::WriteHolder guard(&lock);
+        ++a;
+        std::this_thread::yield();
+        ++b;
+      } else {
+        base::DistributedRWLock::ReadHolder guard(&lock);
+        if (a != b)
+          bad_reads.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_num_threads; ++i) {
+    threads.emplace_back(go, i);
+  }
+  for (auto& t : threads) t.join();
+
+  EXPECT_EQ(0, bad_reads.load());
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(FLAGS_num_threads * 20000 / 16, a);
+  EXPECT_TRUE(lock.try_lock());
+}
+
+template <typename Lock> void BM_ReadMostly(benchmark::State& state) {
+  static Lock lock;
+  static int64_t value = 0;
+
+  unsigned i = 0;
+  int64_t sum = 0;
+  while (state.KeepRunning()) {
+    if ((++i & 1023) == 0) {
+      typename Lock::WriteHolder guard(&lock);
+      ++value;
+    } else {
+      typename Lock::ReadHolder guard(&lock);
+      sum += value;
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK_TEMPLATE(BM_ReadMostly, folly::RWSpinLock)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadMostly, base::DistributedRWLock)->ThreadRange(1, 64)->UseRealTime();
+
 }
\ No newline at end of file
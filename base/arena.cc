@@ -4,12 +4,23 @@
 
 #include "base/arena.h"
 #include <cassert>
+#include <memory>
+#include <utility>
+
+#include "base/memory_account.h"
 
 namespace base {
 
 static const int kBlockSize = 8192;
 
-Arena::Arena() {
+// Limits the memory retained by Rewind() and by the pool of PooledArena.
+static const size_t kMaxFreeBlocks = 128;
+static const size_t kMaxPooledArenas = 16;
+
+// Charged for the blocks of the pooled arenas, including the ones idle in the pools.
+static MemoryAccount arena_pool_account("arena_pool");
+
+Arena::Arena(MemoryAccount* account) : account_(account) {
   blocks_memory_ = 0;
   alloc_ptr_ = NULL;  // First allocation will allocate a block
   alloc_bytes_remaining_ = 0;
@@ -17,7 +28,10 @@ Arena::Arena() {
 
 Arena::~Arena() {
   for (size_t i = 0; i < blocks_.size(); i++) {
-    delete[] blocks_[i];
+    FreeBlock(blocks_[i].ptr, blocks_[i].size);
+  }
+  for (char* block : free_blocks_) {
+    FreeBlock(block, kBlockSize);
   }
 }
 
@@ -40,8 +54,11 @@ char* Arena::AllocateFallback(size_t bytes) {
 }
 
 char* Arena::AllocateAligned(size_t bytes) {
-  const int align = sizeof(void*);    // We'll align to pointer size
-  assert((align & (align-1)) == 0);   // Pointer size should be a power of 2
+  return AllocateAligned(bytes, sizeof(void*));  // We'll align to pointer size
+}
+
+char* Arena::AllocateAligned(size_t bytes, size_t align) {
+  assert((align & (align-1)) == 0);   // Alignment should be a power of 2
   size_t current_mod = reinterpret_cast<uintptr_t>(alloc_ptr_) & (align-1);
   size_t slop = (current_mod == 0 ? 0 : align - current_mod);
   size_t needed = bytes + slop;
@@ -50,21 +67,54 @@ char* Arena::AllocateAligned(size_t bytes) {
     result = alloc_ptr_ + slop;
     alloc_ptr_ += needed;
     alloc_bytes_remaining_ -= needed;
-  } else {
+  } else if (align <= alignof(std::max_align_t)) {
     // AllocateFallback always returned aligned memory
     result = AllocateFallback(bytes);
+  } else {
+    result = AllocateFallback(bytes + align - 1);
+    result += (align - (reinterpret_cast<uintptr_t>(result) & (align-1))) & (align-1);
   }
   assert((reinterpret_cast<uintptr_t>(result) & (align-1)) == 0);
   return result;
 }
 
 char* Arena::AllocateNewBlock(size_t block_bytes) {
-  char* result = new char[block_bytes];
-  blocks_memory_ += block_bytes;
-  blocks_.push_back(result);
+  char* result;
+  if (block_bytes == kBlockSize && !free_blocks_.empty()) {
+    result = free_blocks_.back();
+    free_blocks_.pop_back();
+  } else {
+    result = new char[block_bytes];
+    blocks_memory_ += block_bytes;
+    if (account_)
+      account_->Charge(block_bytes);
+  }
+  blocks_.push_back(Block{result, block_bytes});
   return result;
 }
 
+void Arena::FreeBlock(char* ptr, size_t size) {
+  delete[] ptr;
+  if (account_)
+    account_->Credit(size);
+}
+
+void Arena::Rewind(const Mark& mark) {
+  assert(mark.num_blocks <= blocks_.size());
+  for (size_t i = mark.num_blocks; i < blocks_.size(); ++i) {
+    const Block& block = blocks_[i];
+    if (block.size == kBlockSize && free_blocks_.size() < kMaxFreeBlocks) {
+      free_blocks_.push_back(block.ptr);
+    } else {
+      FreeBlock(block.ptr, block.size);
+      blocks_memory_ -= block.size;
+    }
+  }
+  blocks_.resize(mark.num_blocks);
+  alloc_ptr_ = mark.alloc_ptr;
+  alloc_bytes_remaining_ = mark.alloc_bytes_remaining;
+}
+
 void Arena::Swap(Arena& other) {
   char* tmp = other.alloc_ptr_;
   other.alloc_ptr_ = alloc_ptr_;
@@ -75,9 +125,34 @@ void Arena::Swap(Arena& other) {
   alloc_bytes_remaining_ = s;
 
   blocks_.swap(other.blocks_);
+  free_blocks_.swap(other.free_blocks_);
   s = other.blocks_memory_;
   other.blocks_memory_ = blocks_memory_;
   blocks_memory_ = s;
+
+  std::swap(account_, other.account_);
+}
+
+static thread_local std::vector<std::unique_ptr<Arena>> free_arenas;
+
+static Arena* BorrowArena() {
+  if (free_arenas.empty())
+    return new Arena(&arena_pool_account);
+
+  Arena* res = free_arenas.back().release();
+  free_arenas.pop_back();
+  return res;
+}
+
+PooledArena::PooledArena() : arena_(BorrowArena()), resource_(arena_) {
+}
+
+PooledArena::~PooledArena() {
+  arena_->Reset();
+  if (free_arenas.size() < kMaxPooledArenas)
+    free_arenas.emplace_back(arena_);
+  else
+    delete arena_;
 }
 
 }  // namespace base
@@ -11,11 +11,16 @@
 #include <cassert>
 #include <cstdint>
 
+#include <pmr/polymorphic_allocator.h>
+
 namespace base {
 
+class MemoryAccount;
+
 class Arena {
  public:
-  Arena();
+  // If account is set, the blocks of the arena are charged to it.
+  explicit Arena(MemoryAccount* account = nullptr);
   ~Arena();
 
   // Return a pointer to a newly allocated memory block of "bytes" bytes.
@@ -24,11 +29,31 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Allocate memory aligned to align, which must be a power of 2.
+  char* AllocateAligned(size_t bytes, size_t align);
+
+  // Position of the arena, see Rewind().
+  struct Mark {
+    size_t num_blocks = 0;
+    char* alloc_ptr = nullptr;
+    size_t alloc_bytes_remaining = 0;
+  };
+
+  Mark GetMark() const { return Mark{blocks_.size(), alloc_ptr_, alloc_bytes_remaining_}; }
+
+  // Frees everything that was allocated after mark was taken and invalidates the marks taken
+  // after it. The standard sized blocks are kept and reused by the next allocations.
+  void Rewind(const Mark& mark);
+
+  // Frees all the allocations, keeps the blocks like Rewind().
+  void Reset() { Rewind(Mark{}); }
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena (including space allocated but not yet used for user
   // allocations).
   size_t MemoryUsage() const {
-    return blocks_memory_ + blocks_.capacity() * sizeof(char*);
+    return blocks_memory_ + blocks_.capacity() * sizeof(Block) +
+           free_blocks_.capacity() * sizeof(char*);
   }
 
   void Swap(Arena& other);
@@ -36,17 +61,28 @@ class Arena {
  private:
   char* AllocateFallback(size_t bytes);
   char* AllocateNewBlock(size_t block_bytes);
+  void FreeBlock(char* ptr, size_t size);
 
   // Allocation state
   char* alloc_ptr_;
   size_t alloc_bytes_remaining_;
 
+  struct Block {
+    char* ptr;
+    size_t size;
+  };
+
   // Array of new[] allocated memory blocks
-  std::vector<char*> blocks_;
+  std::vector<Block> blocks_;
+
+  // Standard sized blocks released by Rewind().
+  std::vector<char*> free_blocks_;
 
-  // Bytes of memory in blocks allocated so far
+  // Bytes of memory in blocks allocated so far, including the free ones.
   size_t blocks_memory_;
 
+  MemoryAccount* account_;
+
   // No copying allowed
   Arena(const Arena&);
   void operator=(const Arena&);
@@ -66,6 +102,51 @@ inline char* Arena::Allocate(size_t bytes) {
   return AllocateFallback(bytes);
 }
 
+// pmr adapter that allocates from arena. Deallocations are no-op, the memory is reclaimed
+// by Arena::Rewind or Arena::Reset, hence it suits containers that are built and dropped
+// together with the arena, for example PODArray, ChunkedArray or strings::DeepCopy.
+class ArenaResource : public pmr::memory_resource {
+ public:
+  explicit ArenaResource(Arena* arena) : arena_(arena) {}
+
+  Arena* arena() const { return arena_; }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t align) override {
+    return arena_->AllocateAligned(bytes ? bytes : 1, align);
+  }
+
+  void do_deallocate(void*, size_t, size_t) override {}
+
+  bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ private:
+  Arena* arena_;
+};
+
+// Arena borrowed from the pool of the calling thread, for example for the duration of a
+// request. Upon destruction it is reset and returned to the pool, so the next borrower bumps
+// pointers in the already allocated blocks. Every borrower gets its own arena, therefore
+// it is safe to hold PooledArena across fiber switches but it must be destroyed on the thread
+// that created it.
+class PooledArena {
+ public:
+  PooledArena();
+  ~PooledArena();
+
+  Arena* arena() { return arena_; }
+  pmr::memory_resource* resource() { return &resource_; }
+
+ private:
+  Arena* arena_;
+  ArenaResource resource_;
+
+  PooledArena(const PooledArena&) = delete;
+  void operator=(const PooledArena&) = delete;
+};
+
 }  // namespace base
 
 #endif  // _BASE_UTIL_ARENA_H_
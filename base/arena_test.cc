@@ -7,6 +7,8 @@
 #include <sys/mman.h>
 #include <random>
 
+#include "base/pod_array.h"
+
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "base/walltime.h"
@@ -67,4 +69,78 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+TEST(ArenaTest, Rewind) {
+  Arena arena;
+  char* first = arena.Allocate(100);
+  Arena::Mark mark = arena.GetMark();
+  size_t usage = arena.MemoryUsage();
+
+  char* second = arena.Allocate(10);
+  for (unsigned i = 0; i < 100; ++i) {
+    arena.Allocate(1000);
+  }
+  arena.Allocate(100000);
+  size_t peak = arena.MemoryUsage();
+
+  arena.Rewind(mark);
+  EXPECT_EQ(second, arena.Allocate(10));
+  EXPECT_EQ(first + 100, second);
+
+  // The standard blocks are retained, the large one is freed.
+  EXPECT_LT(arena.MemoryUsage(), peak - 100000 + 1000);
+  for (unsigned i = 0; i < 100; ++i) {
+    arena.Allocate(1000);
+  }
+  EXPECT_LT(arena.MemoryUsage(), peak - 100000 + 1000);
+
+  arena.Reset();
+  EXPECT_GE(arena.MemoryUsage(), usage);
+  arena.Allocate(1);
+}
+
+TEST(ArenaTest, Aligned) {
+  Arena arena;
+  arena.Allocate(1);
+  for (size_t align : {1, 8, 16, 64, 4096}) {
+    char* p = arena.AllocateAligned(3, align);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % align) << align;
+    p = arena.AllocateAligned(10000, align);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % align) << align;
+  }
+}
+
+TEST(ArenaTest, Resource) {
+  Arena arena;
+  ArenaResource mr(&arena);
+  PODArray<uint64_t> arr(&mr);
+  for (unsigned i = 0; i < 10000; ++i) {
+    arr.push_back(i);
+  }
+  EXPECT_EQ(9999, arr.back());
+  EXPECT_GT(arena.MemoryUsage(), 10000 * sizeof(uint64_t));
+
+  ArenaResource mr2(&arena);
+  EXPECT_TRUE(mr.is_equal(mr));
+  EXPECT_FALSE(mr.is_equal(mr2));
+}
+
+TEST(ArenaTest, Pooled) {
+  char* p;
+  {
+    PooledArena pa;
+    p = pa.arena()->Allocate(10);
+    PODArray<int> arr(pa.resource());
+    arr.resize(100);
+  }
+
+  {
+    // Reuses the arena and its block.
+    PooledArena pa;
+    EXPECT_EQ(p, pa.arena()->Allocate(10));
+
+    PooledArena pa2;
+    EXPECT_NE(pa.arena(), pa2.arena());
+  }
+}
+
 }  // namespace base
@@ -0,0 +1,137 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/async_logger.h"
+
+#include "base/macros.h"
+
+namespace base {
+
+using namespace std;
+
+namespace {
+
+constexpr google::LogSeverity kAsyncSeverities[] = {google::GLOG_INFO, google::GLOG_WARNING,
+                                                    google::GLOG_ERROR};
+
+AsyncLogger* async_loggers[arraysize(kAsyncSeverities)] = {nullptr};
+
+}  // namespace
+
+void AsyncLogger::Buffer::Clear() {
+  records.clear();
+  data.clear();
+  flush = false;
+  dropped = 0;
+}
+
+AsyncLogger::AsyncLogger(google::base::Logger* wrapped, size_t max_buffer_size)
+    : wrapped_(wrapped), max_buffer_size_(max_buffer_size) {
+  active_.data.reserve(max_buffer_size);
+  flushing_.data.reserve(max_buffer_size);
+
+  thread_ = thread(&AsyncLogger::RunThread, this);
+  pthread_setname_np(thread_.native_handle(), "async_logger");
+}
+
+AsyncLogger::~AsyncLogger() {
+  {
+    lock_guard<mutex> lk(mu_);
+    stop_ = true;
+  }
+  data_cv_.notify_one();
+  thread_.join();
+}
+
+void AsyncLogger::Write(bool force_flush, time_t timestamp, const char* message,
+                        int message_len) {
+  // glog prefixes the records with their severity.
+  if (message_len > 0 && message[0] == 'F') {
+    Flush();
+    wrapped_->Write(true, timestamp, message, message_len);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lk(mu_);
+    if (active_.data.size() + message_len > max_buffer_size_) {
+      ++active_.dropped;
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    active_.records.push_back(Buffer::Record{timestamp, active_.data.size(), size_t(message_len)});
+    active_.data.append(message, message_len);
+    active_.flush |= force_flush;
+  }
+  data_cv_.notify_one();
+}
+
+void AsyncLogger::Flush() {
+  {
+    unique_lock<mutex> lk(mu_);
+    drained_cv_.wait(lk, [this] { return active_.empty() && !writing_; });
+  }
+  wrapped_->Flush();
+}
+
+google::uint32 AsyncLogger::LogSize() {
+  return wrapped_->LogSize();
+}
+
+void AsyncLogger::RunThread() {
+  unique_lock<mutex> lk(mu_);
+  while (true) {
+    data_cv_.wait(lk, [this] { return !active_.empty() || stop_; });
+    if (active_.empty()) {
+      break;  // stop_ is set and everything was written.
+    }
+
+    swap(active_, flushing_);
+    writing_ = true;
+
+    lk.unlock();
+    WriteBuffer(&flushing_);
+    flushing_.Clear();
+    lk.lock();
+
+    writing_ = false;
+    drained_cv_.notify_all();
+  }
+}
+
+void AsyncLogger::WriteBuffer(Buffer* buf) {
+  for (size_t i = 0; i < buf->records.size(); ++i) {
+    const Buffer::Record& r = buf->records[i];
+    bool last = i + 1 == buf->records.size();
+    wrapped_->Write(last && buf->flush, r.timestamp, buf->data.data() + r.offset, r.len);
+  }
+
+  if (buf->dropped) {
+    string msg = "W async_logger dropped " + to_string(buf->dropped) +
+                 " log records, the log buffer is full\n";
+    wrapped_->Write(true, time(nullptr), msg.data(), msg.size());
+  }
+}
+
+void InstallAsyncLoggers(size_t max_buffer_size) {
+  for (unsigned i = 0; i < arraysize(kAsyncSeverities); ++i) {
+    CHECK(!async_loggers[i]);
+    google::base::Logger* orig = google::base::GetLogger(kAsyncSeverities[i]);
+    async_loggers[i] = new AsyncLogger(orig, max_buffer_size);
+    google::base::SetLogger(kAsyncSeverities[i], async_loggers[i]);
+  }
+}
+
+void UninstallAsyncLoggers() {
+  for (unsigned i = 0; i < arraysize(kAsyncSeverities); ++i) {
+    if (!async_loggers[i])
+      continue;
+    async_loggers[i]->Flush();
+    google::base::SetLogger(kAsyncSeverities[i], async_loggers[i]->wrapped());
+    delete async_loggers[i];
+    async_loggers[i] = nullptr;
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,90 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace base {
+
+/*! \class base::AsyncLogger
+    \brief Decouples LOG() from the disk: wraps a glog file logger and writes its records
+    from a background thread.
+
+    glog formats a record in the logging thread and then calls Write() under its log mutex,
+    Write() only copies the record into a buffer. The writer thread swaps the buffer out and
+    passes its records to the wrapped logger, so a slow disk stalls the writer instead of
+    the IO threads. Records that do not fit into the buffer are dropped; the writer logs how
+    many right after the records that preceded the drop. FATAL records drain the buffer and
+    are written synchronously since the process aborts right after.
+*/
+class AsyncLogger : public google::base::Logger {
+ public:
+  //! Does not take ownership of wrapped.
+  AsyncLogger(google::base::Logger* wrapped, size_t max_buffer_size);
+  ~AsyncLogger();
+
+  void Write(bool force_flush, time_t timestamp, const char* message, int message_len) override;
+
+  //! Blocks until the buffered records were written and flushes the wrapped logger.
+  void Flush() override;
+
+  google::uint32 LogSize() override;
+
+  //! The number of the dropped records.
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  google::base::Logger* wrapped() {
+    return wrapped_;
+  }
+
+ private:
+  struct Buffer {
+    struct Record {
+      time_t timestamp;
+      size_t offset, len;
+    };
+    std::vector<Record> records;
+    std::string data;
+    bool flush = false;
+    uint64_t dropped = 0;  // Dropped after the records of this buffer.
+
+    bool empty() const {
+      return records.empty() && dropped == 0;
+    }
+
+    void Clear();
+  };
+
+  void RunThread();
+  void WriteBuffer(Buffer* buf);
+
+  google::base::Logger* wrapped_;
+  const size_t max_buffer_size_;
+
+  std::mutex mu_;
+  std::condition_variable data_cv_, drained_cv_;
+  Buffer active_, flushing_;  // Guarded by mu_, the writer owns flushing_ while writing_.
+  bool writing_ = false, stop_ = false;
+
+  std::atomic_uint64_t dropped_{0};
+  std::thread thread_;
+};
+
+//! Wraps the file loggers of the INFO, WARNING and ERROR severities with AsyncLoggers.
+//! Called by MainInitGuard with --async_logging.
+void InstallAsyncLoggers(size_t max_buffer_size);
+
+//! Drains the async loggers and restores the original loggers.
+void UninstallAsyncLoggers();
+
+}  // namespace base
@@ -0,0 +1,104 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/async_logger.h"
+
+#include <gmock/gmock.h>
+
+#include "base/gtest.h"
+
+using namespace std;
+using testing::Contains;
+using testing::ElementsAre;
+using testing::HasSubstr;
+
+namespace base {
+
+class FakeLogger : public google::base::Logger {
+ public:
+  void Write(bool force_flush, time_t timestamp, const char* message, int message_len) override {
+    lock_guard<mutex> lk(mu_);
+    records_.emplace_back(message, message_len);
+  }
+
+  void Flush() override {
+    ++flushes_;
+  }
+
+  google::uint32 LogSize() override {
+    return 0;
+  }
+
+  vector<string> records() {
+    lock_guard<mutex> lk(mu_);
+    return records_;
+  }
+
+  unsigned flushes_ = 0;
+
+ private:
+  mutex mu_;
+  vector<string> records_;
+};
+
+class AsyncLoggerTest : public testing::Test {
+ protected:
+  void Write(AsyncLogger* logger, const string& msg) {
+    logger->Write(false, time(nullptr), msg.data(), msg.size());
+  }
+
+  FakeLogger fake_;
+};
+
+TEST_F(AsyncLoggerTest, Order) {
+  AsyncLogger logger(&fake_, 1 << 16);
+  for (unsigned i = 0; i < 100; ++i) {
+    Write(&logger, "I " + to_string(i));
+  }
+  logger.Flush();
+  EXPECT_EQ(1, fake_.flushes_);
+
+  vector<string> records = fake_.records();
+  ASSERT_EQ(100, records.size());
+  for (unsigned i = 0; i < 100; ++i) {
+    EXPECT_EQ("I " + to_string(i), records[i]);
+  }
+  EXPECT_EQ(0, logger.dropped());
+}
+
+TEST_F(AsyncLoggerTest, Drop) {
+  AsyncLogger logger(&fake_, 8);
+  logger.Flush();
+
+  // Everything after the first record may be dropped, depending on how fast the writer drains.
+  for (unsigned i = 0; i < 100; ++i) {
+    Write(&logger, "I 1234");
+  }
+  logger.Flush();
+
+  vector<string> records = fake_.records();
+  uint64_t written = count(records.begin(), records.end(), "I 1234");
+  EXPECT_EQ(100, written + logger.dropped());
+  if (logger.dropped()) {
+    EXPECT_THAT(records, Contains(HasSubstr("dropped")));
+  }
+}
+
+TEST_F(AsyncLoggerTest, Fatal) {
+  AsyncLogger logger(&fake_, 1 << 16);
+  Write(&logger, "E before");
+  Write(&logger, "F fatal");
+
+  // The FATAL record is written synchronously after the buffered ones.
+  EXPECT_THAT(fake_.records(), ElementsAre("E before", "F fatal"));
+}
+
+TEST_F(AsyncLoggerTest, Destroy) {
+  {
+    AsyncLogger logger(&fake_, 1 << 16);
+    Write(&logger, "I last");
+  }
+  EXPECT_THAT(fake_.records(), ElementsAre("I last"));
+}
+
+}  // namespace base
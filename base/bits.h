@@ -4,6 +4,10 @@
 #pragma once
 #include "base/integral_types.h"
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 #include "base/macros.h"
 
 // More info about popcnt:
@@ -59,6 +63,25 @@ class Bits {
     return __builtin_ctzll(n);
   }
 
+  // Returns the index of the k-th set bit of n, 0-indexed, i.e. Select64(n, 0) is
+  // FindLSBSetNonZero64(n). Undefined unless k < CountOnes64(n).
+  static inline unsigned Select64(uint64 n, unsigned k) {
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(1ULL << k, n));
+#else
+    // Skips whole bytes and then clears the lower set bits of the byte with the k-th one.
+    unsigned pos = 0;
+    for (unsigned cnt = CountOnes64(n & 0xFF); cnt <= k; cnt = CountOnes64(n & 0xFF)) {
+      k -= cnt;
+      n >>= 8;
+      pos += 8;
+    }
+    for (; k; --k)
+      n &= n - 1;
+    return pos + __builtin_ctzll(n);
+#endif
+  }
+
   // Fast and straightforward versions with bsr operation.
   // Returns the last set (most significant) bit.
   // For n = 1, returns 0, for last MSB returns 63.
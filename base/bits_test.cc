@@ -78,6 +78,21 @@ TEST(BitsTest, MinMax) {
   EXPECT_EQ(15, mm.max_val);
 }
 
+TEST(BitsTest, Select64) {
+  EXPECT_EQ(0, Bits::Select64(1, 0));
+  EXPECT_EQ(63, Bits::Select64(1ULL << 63, 0));
+
+  uint64 val = 0x8000F00000000102ULL;
+  unsigned expected[] = {1, 8, 44, 45, 46, 47, 63};
+  for (unsigned k = 0; k < arraysize(expected); ++k) {
+    EXPECT_EQ(expected[k], Bits::Select64(val, k));
+  }
+
+  for (unsigned k = 0; k < 64; ++k) {
+    EXPECT_EQ(k, Bits::Select64(~0ULL, k));
+  }
+}
+
 using benchmark::DoNotOptimize;
 
 static void BM_RoundUp64(benchmark::State& state) {
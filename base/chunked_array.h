@@ -3,15 +3,34 @@
 //
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <thread>
+#include <vector>
+
 #include <pmr/polymorphic_allocator.h>
 #include <pmr/vector.h>
 #include "base/pmr.h"
 
 namespace base {
 
+// Fixed size chunks of CHUNK_SIZE elements behind pointers, so the elements never move
+// when the array grows. operator[] costs a divide and a pointer chase, therefore
+// the scans should use the iterators or ForEachChunk, which walk each chunk sequentially and
+// prefetch the start of the next one.
 template<typename T, size_t CHUNK_SIZE = 256> class ChunkedArray {
+  struct Chunk;
+  using ChunkVec = pmr::vector<base::pmr_unique_ptr<Chunk>>;
+
+  template<typename U> class Iterator;
+
  public:
+  using value_type = T;
+  using iterator = Iterator<T>;
+  using const_iterator = Iterator<const T>;
+
   ChunkedArray(pmr::memory_resource* mr = nullptr);
   ChunkedArray(size_t count, pmr::memory_resource* mr = nullptr);
 
@@ -62,7 +81,88 @@ template<typename T, size_t CHUNK_SIZE = 256> class ChunkedArray {
 
   ChunkedArray& operator=(const ChunkedArray& other);
 
+  iterator begin() { return empty() ? end() : iterator(chunk_vec_.data(), EndChunk()); }
+  iterator end() { return iterator(EndChunk(), EndOffset()); }
+  const_iterator begin() const {
+    return empty() ? end() : const_iterator(chunk_vec_.data(), EndChunk());
+  }
+  const_iterator end() const { return const_iterator(EndChunk(), EndOffset()); }
+
+  // Calls cb(T* data, size_t count) for every chunk in order.
+  template<typename Cb> void ForEachChunk(Cb&& cb) {
+    ForEachChunkImpl<T>(0, chunk_vec_.size(), cb);
+  }
+  template<typename Cb> void ForEachChunk(Cb&& cb) const {
+    ForEachChunkImpl<const T>(0, chunk_vec_.size(), cb);
+  }
+
+  // Calls cb(T* data, size_t count) for every chunk from num_threads threads including the
+  // calling one, in no particular order. Each thread takes consecutive chunks, so that the
+  // hardware prefetcher keeps up with it. Returns when all the chunks were visited.
+  template<typename Cb> void ParallelForEachChunk(unsigned num_threads, Cb&& cb) {
+    ParallelForEachChunkImpl<T>(num_threads, cb);
+  }
+  template<typename Cb> void ParallelForEachChunk(unsigned num_threads, Cb&& cb) const {
+    ParallelForEachChunkImpl<const T>(num_threads, cb);
+  }
+
  private:
+  // The number of chunks a thread of ParallelForEachChunk takes at once.
+  static constexpr size_t kChunksPerTask = 16;
+
+  static void PrefetchChunk(const Chunk* chunk) {
+    constexpr size_t kLines = std::min<size_t>(4, (sizeof(Chunk) + 63) / 64);
+    const char* ptr = reinterpret_cast<const char*>(chunk);
+    for (size_t i = 0; i < kLines; ++i) {
+      __builtin_prefetch(ptr + i * 64);
+    }
+  }
+
+  size_t ChunkCount(size_t index) const {
+    return index + 1 == chunk_vec_.size() ? CHUNK_SIZE - last_chunk_left_ : CHUNK_SIZE;
+  }
+
+  // end() points past the last element of the last chunk.
+  const base::pmr_unique_ptr<Chunk>* EndChunk() const {
+    return chunk_vec_.empty() ? chunk_vec_.data() : &chunk_vec_.back();
+  }
+  size_t EndOffset() const { return chunk_vec_.empty() ? 0 : CHUNK_SIZE - last_chunk_left_; }
+
+  template<typename U, typename Cb> void ForEachChunkImpl(size_t from, size_t to, Cb& cb) const {
+    for (size_t i = from; i < to; ++i) {
+      if (i + 1 < chunk_vec_.size())
+        PrefetchChunk(chunk_vec_[i + 1].get());
+      cb(const_cast<U*>(&chunk_vec_[i]->at(0)), ChunkCount(i));
+    }
+  }
+
+  template<typename U, typename Cb> void ParallelForEachChunkImpl(unsigned num_threads,
+                                                                  Cb& cb) const {
+    size_t num_tasks = (chunk_vec_.size() + kChunksPerTask - 1) / kChunksPerTask;
+    num_threads = std::min<size_t>(num_threads, num_tasks);
+    if (num_threads <= 1) {
+      ForEachChunkImpl<U>(0, chunk_vec_.size(), cb);
+      return;
+    }
+
+    std::atomic_size_t next_task{0};
+    auto worker = [&] {
+      for (size_t task = next_task++; task < num_tasks; task = next_task++) {
+        size_t from = task * kChunksPerTask;
+        ForEachChunkImpl<U>(from, std::min(from + kChunksPerTask, chunk_vec_.size()), cb);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; ++i) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
   void AddChunk() {
     pmr::memory_resource* mr = chunk_vec_.get_allocator().resource();
     chunk_vec_.emplace_back(make_pmr_unique<Chunk>(mr));
@@ -98,7 +198,71 @@ template<typename T, size_t CHUNK_SIZE = 256> class ChunkedArray {
   };
 
 
-  pmr::vector<base::pmr_unique_ptr<Chunk>> chunk_vec_;
+  // Walks the elements of a chunk by pointer and switches to the next chunk, prefetching the
+  // one after it, only at the chunk boundary.
+  template<typename U> class Iterator {
+    using ChunkPtr = const base::pmr_unique_ptr<Chunk>*;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::remove_const_t<U>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = U*;
+    using reference = U&;
+
+    Iterator() = default;
+
+    U& operator*() const { return *ptr_; }
+    U* operator->() const { return ptr_; }
+
+    Iterator& operator++() {
+      if (++ptr_ == chunk_end_ && chunk_ != last_)
+        NextChunk();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      ++*this;
+      return tmp;
+    }
+
+    bool operator==(const Iterator& o) const { return ptr_ == o.ptr_; }
+    bool operator!=(const Iterator& o) const { return ptr_ != o.ptr_; }
+
+   private:
+    friend class ChunkedArray;
+
+    // Points to the first element of chunk, last is the last chunk of the array.
+    Iterator(ChunkPtr chunk, ChunkPtr last) : last_(last) { SetChunk(chunk); }
+
+    // Points to the offset element of chunk, used for end().
+    Iterator(ChunkPtr chunk, size_t offset) : chunk_(chunk), last_(chunk) {
+      if (offset) {
+        ptr_ = Data(chunk) + offset;
+        chunk_end_ = Data(chunk) + CHUNK_SIZE;
+      }
+    }
+
+    static U* Data(ChunkPtr chunk) { return const_cast<U*>(&(*chunk)->at(0)); }
+
+    void SetChunk(ChunkPtr chunk) {
+      chunk_ = chunk;
+      ptr_ = Data(chunk);
+      chunk_end_ = ptr_ + CHUNK_SIZE;
+      if (chunk != last_)
+        PrefetchChunk(chunk[1].get());
+    }
+
+    void NextChunk() { SetChunk(chunk_ + 1); }
+
+    U* ptr_ = nullptr;
+    U* chunk_end_ = nullptr;
+    ChunkPtr chunk_ = nullptr;
+    ChunkPtr last_ = nullptr;
+  };
+
+  ChunkVec chunk_vec_;
   size_t last_chunk_left_ = 0;
 };
 
@@ -0,0 +1,119 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/chunked_array.h"
+
+#include <numeric>
+
+#include "base/gtest.h"
+
+namespace base {
+
+class ChunkedArrayTest : public testing::Test {
+ protected:
+  using Array = ChunkedArray<uint64_t, 16>;
+
+  static void Fill(size_t count, Array* arr) {
+    for (size_t i = 0; i < count; ++i)
+      arr->emplace_back(i);
+  }
+};
+
+TEST_F(ChunkedArrayTest, Iterator) {
+  Array arr;
+  EXPECT_TRUE(arr.begin() == arr.end());
+
+  for (size_t count : {1, 15, 16, 17, 32, 100}) {
+    arr.clear();
+    Fill(count, &arr);
+
+    size_t i = 0;
+    for (uint64_t val : arr) {
+      ASSERT_EQ(i, val) << count;
+      ++i;
+    }
+    EXPECT_EQ(count, i);
+
+    const Array& carr = arr;
+    EXPECT_EQ(count * (count - 1) / 2, std::accumulate(carr.begin(), carr.end(), uint64_t(0)));
+    EXPECT_EQ(count, std::distance(carr.begin(), carr.end()));
+  }
+
+  for (auto it = arr.begin(); it != arr.end(); ++it)
+    *it *= 2;
+  EXPECT_EQ(198, arr[99]);
+}
+
+TEST_F(ChunkedArrayTest, ForEachChunk) {
+  Array arr;
+  Fill(40, &arr);
+
+  std::vector<size_t> counts;
+  uint64_t next = 0;
+  arr.ForEachChunk([&](uint64_t* data, size_t count) {
+    counts.push_back(count);
+    for (size_t i = 0; i < count; ++i)
+      EXPECT_EQ(next++, data[i]);
+  });
+  EXPECT_EQ(std::vector<size_t>({16, 16, 8}), counts);
+}
+
+TEST_F(ChunkedArrayTest, ParallelForEachChunk) {
+  constexpr size_t kCount = 10000;
+  Array arr;
+  Fill(kCount, &arr);
+
+  for (unsigned num_threads : {1, 4}) {
+    std::atomic<uint64_t> sum{0}, elements{0};
+    arr.ParallelForEachChunk(num_threads, [&](uint64_t* data, size_t count) {
+      sum += std::accumulate(data, data + count, uint64_t(0));
+      elements += count;
+    });
+    EXPECT_EQ(kCount, elements);
+    EXPECT_EQ(kCount * (kCount - 1) / 2, sum);
+  }
+
+  Array empty;
+  empty.ParallelForEachChunk(4, [](uint64_t*, size_t) { FAIL(); });
+}
+
+constexpr size_t kBenchCount = 1 << 24;
+
+static void BM_ChunkedIndex(benchmark::State& state) {
+  ChunkedArray<uint64_t> arr(kBenchCount);
+  while (state.KeepRunning()) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < arr.size(); ++i)
+      sum += arr[i];
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(state.iterations() * kBenchCount * sizeof(uint64_t));
+}
+BENCHMARK(BM_ChunkedIndex);
+
+static void BM_ChunkedIterate(benchmark::State& state) {
+  ChunkedArray<uint64_t> arr(kBenchCount);
+  while (state.KeepRunning()) {
+    uint64_t sum = 0;
+    for (uint64_t val : arr)
+      sum += val;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(state.iterations() * kBenchCount * sizeof(uint64_t));
+}
+BENCHMARK(BM_ChunkedIterate);
+
+static void BM_ChunkedParallel(benchmark::State& state) {
+  ChunkedArray<uint64_t> arr(kBenchCount);
+  while (state.KeepRunning()) {
+    std::atomic<uint64_t> sum{0};
+    arr.ParallelForEachChunk(state.range(0), [&](uint64_t* data, size_t count) {
+      sum += std::accumulate(data, data + count, uint64_t(0));
+    });
+    benchmark::DoNotOptimize(sum.load());
+  }
+  state.SetBytesProcessed(state.iterations() * kBenchCount * sizeof(uint64_t));
+}
+BENCHMARK(BM_ChunkedParallel)->Arg(1)->Arg(4)->UseRealTime();
+
+}  // namespace base
@@ -0,0 +1,227 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/mpmc_bounded_queue.h"
+
+namespace base {
+
+namespace detail {
+
+// Caches of the calling thread indexed by the pool id. Ids are never reused, hence the slots of
+// the destroyed pools are never accessed again.
+inline std::vector<void*>& ThreadPoolCaches() {
+  static thread_local std::vector<void*> caches;
+  return caches;
+}
+
+inline uint32_t NextPoolId() {
+  static std::atomic_uint32_t next_id{0};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace detail
+
+// Thread-safe pool of default constructed objects, modeled on the magazine allocator
+// and tcmalloc's transfer cache. Every thread keeps 2 magazines of objects, so Get() and
+// Release() usually do not touch shared memory. Full magazines are exchanged between the threads
+// via the lock-free depot. Objects are reused as they are - without re-construction, so
+// the caller should reset their state. If the depot overflows the released objects are deleted.
+//
+// Objects cached by exited threads are freed only by the destructor of the pool.
+// The pool must outlive its objects and the threads must stop using it before it's destroyed.
+template <typename T> class ConcurrentObjectPool {
+ public:
+  static constexpr unsigned kMagazineSize = 16;
+
+  struct Stats {
+    uint64_t hits = 0;        // Get() served from the thread cache.
+    uint64_t misses = 0;      // Get() constructed a new object.
+    uint64_t depot_gets = 0;  // Full magazines taken from the depot.
+    uint64_t depot_puts = 0;  // Full magazines moved to the depot.
+    uint64_t overflows = 0;   // Objects deleted because the depot was full.
+  };
+
+  class Deleter {
+    ConcurrentObjectPool* pool_;
+
+   public:
+    Deleter(ConcurrentObjectPool* pool = nullptr) : pool_(pool) {}
+    void operator()(T* t) { pool_->Release(t); }
+  };
+
+  using unique_ptr = std::unique_ptr<T, Deleter>;
+
+  // depot_magazines must be a power of 2, the depot holds up to depot_magazines * kMagazineSize
+  // objects.
+  explicit ConcurrentObjectPool(size_t depot_magazines = 64)
+      : id_(detail::NextPoolId()), full_(depot_magazines), empty_(depot_magazines) {}
+
+  ~ConcurrentObjectPool();
+
+  T* Get();
+  void Release(T* t);
+
+  unique_ptr make_unique() { return unique_ptr(Get(), Deleter{this}); }
+
+  // Sums the stats of all the threads, the counters are updated with relaxed semantics.
+  Stats GetStats() const;
+
+ private:
+  struct Magazine {
+    unsigned count = 0;
+    T* items[kMagazineSize];
+  };
+
+  // Owned and accessed only by a single thread. The stats are atomic for GetStats().
+  struct Cache {
+    std::unique_ptr<Magazine> loaded, previous;
+    std::atomic<uint64_t> hits{0}, misses{0}, depot_gets{0}, depot_puts{0}, overflows{0};
+
+    static void Inc(std::atomic<uint64_t>* cnt, uint64_t delta = 1) {
+      cnt->store(cnt->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+  };
+
+  Cache* GetCache() {
+    std::vector<void*>& caches = detail::ThreadPoolCaches();
+    if (caches.size() > id_ && caches[id_])
+      return static_cast<Cache*>(caches[id_]);
+    return CreateCache();
+  }
+
+  Cache* CreateCache();
+
+  std::unique_ptr<Magazine> NewEmptyMagazine() {
+    Magazine* res = nullptr;
+    if (empty_.try_dequeue(res))
+      return std::unique_ptr<Magazine>(res);
+    return std::unique_ptr<Magazine>(new Magazine);
+  }
+
+  void RetireEmptyMagazine(std::unique_ptr<Magazine> m) {
+    Magazine* ptr = m.release();
+    if (!empty_.try_enqueue(ptr))
+      delete ptr;
+  }
+
+  static void DeleteObjects(Magazine* m) {
+    for (unsigned i = 0; i < m->count; ++i)
+      delete m->items[i];
+    m->count = 0;
+  }
+
+  const uint32_t id_;
+
+  // The depot.
+  mpmc_bounded_queue<Magazine*> full_, empty_;
+
+  mutable std::mutex mu_;
+  std::vector<std::unique_ptr<Cache>> caches_;
+
+  ConcurrentObjectPool(const ConcurrentObjectPool&) = delete;
+  void operator=(const ConcurrentObjectPool&) = delete;
+};
+
+template <typename T> T* ConcurrentObjectPool<T>::Get() {
+  Cache* cache = GetCache();
+  Magazine* m = cache->loaded.get();
+
+  if (m->count == 0) {
+    if (cache->previous->count > 0) {
+      cache->loaded.swap(cache->previous);
+    } else {
+      Magazine* full = nullptr;
+      if (!full_.try_dequeue(full)) {
+        Cache::Inc(&cache->misses);
+        return new T();
+      }
+      Cache::Inc(&cache->depot_gets);
+      RetireEmptyMagazine(std::move(cache->loaded));
+      cache->loaded.reset(full);
+    }
+    m = cache->loaded.get();
+  }
+
+  Cache::Inc(&cache->hits);
+  return m->items[--m->count];
+}
+
+template <typename T> void ConcurrentObjectPool<T>::Release(T* t) {
+  Cache* cache = GetCache();
+  Magazine* m = cache->loaded.get();
+
+  if (m->count == kMagazineSize) {
+    if (cache->previous->count < kMagazineSize) {
+      cache->loaded.swap(cache->previous);
+    } else {
+      // Both magazines are full, moves the older one to the depot.
+      Magazine* full = cache->previous.get();
+      if (full_.try_enqueue(full)) {
+        cache->previous.release();
+        Cache::Inc(&cache->depot_puts);
+      } else {
+        Cache::Inc(&cache->overflows, full->count);
+        DeleteObjects(full);
+        cache->previous.reset();
+      }
+      cache->previous = std::move(cache->loaded);
+      cache->loaded = NewEmptyMagazine();
+    }
+    m = cache->loaded.get();
+  }
+
+  m->items[m->count++] = t;
+}
+
+template <typename T> auto ConcurrentObjectPool<T>::CreateCache() -> Cache* {
+  Cache* res = new Cache;
+  res->loaded.reset(new Magazine);
+  res->previous.reset(new Magazine);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    caches_.emplace_back(res);
+  }
+
+  std::vector<void*>& caches = detail::ThreadPoolCaches();
+  if (caches.size() <= id_)
+    caches.resize(id_ + 1, nullptr);
+  caches[id_] = res;
+  return res;
+}
+
+template <typename T> auto ConcurrentObjectPool<T>::GetStats() const -> Stats {
+  Stats res;
+  std::lock_guard<std::mutex> lk(mu_);
+  for (const auto& c : caches_) {
+    res.hits += c->hits.load(std::memory_order_relaxed);
+    res.misses += c->misses.load(std::memory_order_relaxed);
+    res.depot_gets += c->depot_gets.load(std::memory_order_relaxed);
+    res.depot_puts += c->depot_puts.load(std::memory_order_relaxed);
+    res.overflows += c->overflows.load(std::memory_order_relaxed);
+  }
+  return res;
+}
+
+template <typename T> ConcurrentObjectPool<T>::~ConcurrentObjectPool() {
+  for (const auto& c : caches_) {
+    DeleteObjects(c->loaded.get());
+    DeleteObjects(c->previous.get());
+  }
+
+  Magazine* m = nullptr;
+  while (full_.try_dequeue(m)) {
+    DeleteObjects(m);
+    delete m;
+  }
+  while (empty_.try_dequeue(m))
+    delete m;
+}
+
+}  // namespace base
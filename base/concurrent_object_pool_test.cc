@@ -0,0 +1,129 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/concurrent_object_pool.h"
+
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace base {
+
+using namespace std;
+
+class ConcurrentObjectPoolTest : public testing::Test {
+};
+
+struct Obj {
+  static atomic_int ref;
+
+  Obj() { ++ref; }
+  ~Obj() { --ref; }
+
+  int val = 0;
+};
+
+atomic_int Obj::ref{0};
+
+using Pool = ConcurrentObjectPool<Obj>;
+
+TEST_F(ConcurrentObjectPoolTest, Reuse) {
+  {
+    Pool pool;
+    Obj* o = pool.Get();
+    o->val = 5;
+    pool.Release(o);
+
+    // Returned as is.
+    Obj* o2 = pool.Get();
+    EXPECT_EQ(o, o2);
+    EXPECT_EQ(5, o2->val);
+    pool.Release(o2);
+
+    {
+      Pool::unique_ptr ptr = pool.make_unique();
+      EXPECT_EQ(o, ptr.get());
+    }
+    Pool::Stats stats = pool.GetStats();
+    EXPECT_EQ(1, stats.misses);
+    EXPECT_EQ(2, stats.hits);
+    EXPECT_EQ(1, Obj::ref);
+  }
+  EXPECT_EQ(0, Obj::ref);
+}
+
+TEST_F(ConcurrentObjectPoolTest, Depot) {
+  {
+    Pool pool(2);
+    constexpr unsigned kNum = Pool::kMagazineSize * 6;
+    vector<Obj*> objs;
+    for (unsigned i = 0; i < kNum; ++i)
+      objs.push_back(pool.Get());
+    for (Obj* o : objs)
+      pool.Release(o);
+
+    // 2 magazines stay in the cache, 2 go to the depot and the rest overflows.
+    Pool::Stats stats = pool.GetStats();
+    EXPECT_EQ(kNum, stats.misses);
+    EXPECT_EQ(2, stats.depot_puts);
+    EXPECT_EQ(kNum - 4 * Pool::kMagazineSize, stats.overflows);
+    EXPECT_EQ(4 * Pool::kMagazineSize, Obj::ref);
+
+    // Another thread takes the depot magazines.
+    thread([&] {
+      for (unsigned i = 0; i < 2 * Pool::kMagazineSize; ++i)
+        objs[i] = pool.Get();
+      EXPECT_EQ(kNum, pool.GetStats().misses);
+      EXPECT_EQ(4 * Pool::kMagazineSize, Obj::ref);
+      for (unsigned i = 0; i < 2 * Pool::kMagazineSize; ++i)
+        pool.Release(objs[i]);
+    }).join();
+
+    stats = pool.GetStats();
+    EXPECT_EQ(2, stats.depot_gets);
+  }
+  EXPECT_EQ(0, Obj::ref);
+}
+
+TEST_F(ConcurrentObjectPoolTest, Threads) {
+  {
+    Pool pool;
+    vector<thread> threads;
+
+    // Objects move between the threads back and forth.
+    for (unsigned t = 0; t < 4; ++t) {
+      threads.emplace_back([&pool, t] {
+        vector<Obj*> objs;
+        for (unsigned iter = 0; iter < 1000; ++iter) {
+          for (unsigned i = 0; i < 20 + t; ++i)
+            objs.push_back(pool.Get());
+          for (Obj* o : objs)
+            pool.Release(o);
+          objs.clear();
+        }
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+
+    Pool::Stats stats = pool.GetStats();
+    EXPECT_EQ(1000 * (20 + 21 + 22 + 23), stats.hits + stats.misses);
+    EXPECT_LT(stats.misses, 1000);
+  }
+  EXPECT_EQ(0, Obj::ref);
+}
+
+static void BM_PoolGetRelease(benchmark::State& state) {
+  static Pool pool;
+  Obj* objs[8];
+  while (state.KeepRunning()) {
+    for (auto& o : objs)
+      o = pool.Get();
+    for (auto o : objs)
+      pool.Release(o);
+  }
+}
+BENCHMARK(BM_PoolGetRelease)->ThreadRange(1, 4);
+
+}  // namespace base
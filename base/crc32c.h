@@ -12,8 +12,17 @@ namespace crc32c {
 // Return the crc32c of concat(A, data[0,n-1]) where init_crc is the
 // crc32c of some string A.  Extend() is often used to maintain the
 // crc32c of a stream of data.
+// Uses the SSE4.2 crc32 instruction on 3 interleaved streams when available.
 extern uint32_t Extend(uint32_t init_crc, const uint8_t* data, size_t n);
 
+// Table based version of Extend() for CPUs without SSE4.2.
+extern uint32_t ExtendPortable(uint32_t init_crc, const uint8_t* data, size_t n);
+
+// Returns the crc32c of concat(A, B) where crc1 is the crc32c of A and crc2 is the crc32c of
+// B and len2 is the length of B. It allows checksumming the chunks of a buffer on
+// different threads. Takes O(log(len2)) time.
+extern uint32_t Combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const uint8_t* data, size_t n) {
   return Extend(0, data, n);
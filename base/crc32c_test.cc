@@ -4,9 +4,11 @@
 
 #include "base/crc32c.h"
 
+#include <random>
+
+#include "base/gtest.h"
 #include "base/integral_types.h"
 #include "strings/stringpiece.h"
-#include <gtest/gtest.h>
 
 namespace crc32c {
 
@@ -62,6 +64,36 @@ TEST(CRC, Extend) {
             Extend(Value("hello "), reinterpret_cast<const uint8*>("world"), 5));
 }
 
+TEST(CRC, Portable) {
+  std::mt19937 rng(7);
+  std::string buf(100000, '\0');
+  for (char& c : buf) {
+    c = rng();
+  }
+  const uint8* ptr = reinterpret_cast<const uint8*>(buf.data());
+
+  // Covers the unaligned heads and the tails of the interleaved streams.
+  for (size_t len : {size_t(0), size_t(7), size_t(255), size_t(768), size_t(24575),
+                     size_t(24576 + 777), buf.size() - 64}) {
+    for (size_t offset = 0; offset < 9; ++offset) {
+      ASSERT_EQ(ExtendPortable(17, ptr + offset, len), Extend(17, ptr + offset, len)) << len;
+    }
+  }
+}
+
+TEST(CRC, Combine) {
+  std::string buf = "hello world, hello crc32c combine";
+  for (size_t split = 0; split <= buf.size(); ++split) {
+    StringPiece a(buf.data(), split), b(buf.data() + split, buf.size() - split);
+    ASSERT_EQ(Value(buf), Combine(Value(a), Value(b), b.size())) << split;
+  }
+
+  std::string big(1 << 20, 'x');
+  StringPiece pc(big);
+  uint32_t head = Value(pc.substr(0, 1000));
+  EXPECT_EQ(Value(pc), Combine(head, Value(pc.substr(1000)), big.size() - 1000));
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = Value("foo");
   ASSERT_NE(crc, Mask(crc));
@@ -70,4 +102,24 @@ TEST(CRC, Mask) {
   ASSERT_EQ(crc, Unmask(Unmask(Mask(Mask(crc)))));
 }
 
-}  // namespace crc32c
\ No newline at end of file
+static void BM_Crc32c(benchmark::State& state) {
+  std::string buf(state.range(0), 'a');
+  const uint8* ptr = reinterpret_cast<const uint8*>(buf.data());
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(Extend(0, ptr, buf.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_Crc32c)->Range(64, 1 << 20);
+
+static void BM_Crc32cPortable(benchmark::State& state) {
+  std::string buf(state.range(0), 'a');
+  const uint8* ptr = reinterpret_cast<const uint8*>(buf.data());
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ExtendPortable(0, ptr, buf.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_Crc32cPortable)->Range(64, 1 << 20);
+
+}  // namespace crc32c
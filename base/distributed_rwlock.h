@@ -0,0 +1,168 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "base/event_count.h"
+#include "base/port.h"
+
+namespace base {
+
+namespace detail {
+
+// Threads get the reader slots round-robin.
+inline unsigned ReaderSlot() {
+  static std::atomic_uint32_t next_slot{0};
+  static thread_local unsigned slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+}  // namespace detail
+
+/* Reader-biased reader-writer lock for read-mostly data. Every reader increments a counter
+   in one of kNumSlots slots, each on its own cache line, so concurrent readers of different
+   threads do not bounce a shared line like they do with folly::RWSpinLock. Writers pay
+   for it: they announce themselves and then wait until all the slots drain. Writers are
+   preferred, new readers back off while a writer is pending. Both sides spin briefly and
+   then park on a futex, so the lock may be held for long.
+
+   A shared lock must be released by the same thread that took it. Not recursive
+   when a writer is pending. Implements the Lockable and SharedLockable concepts and
+   the holders of folly::RWSpinLock, so it can replace it.
+*/
+class DistributedRWLock {
+ public:
+  static constexpr unsigned kNumSlots = 64;
+
+  DistributedRWLock() = default;
+
+  void lock() {
+    writer_ec_.await([this] { return TryAcquireWriter(); });
+    for (Slot& s : slots_) {
+      if (!SpinUntil([&] { return s.readers.load(std::memory_order_seq_cst) == 0; })) {
+        readers_ec_.await([&] { return s.readers.load(std::memory_order_seq_cst) == 0; });
+      }
+    }
+  }
+
+  bool try_lock() {
+    if (!TryAcquireWriter())
+      return false;
+    for (Slot& s : slots_) {
+      if (s.readers.load(std::memory_order_seq_cst) != 0) {
+        unlock();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void unlock() {
+    writer_.store(false, std::memory_order_release);
+    writer_ec_.notifyAll();
+  }
+
+  void lock_shared() {
+    std::atomic_int32_t& readers = slots_[SlotIndex()].readers;
+    while (true) {
+      // seq_cst orders the increment before the load of writer_, while the writer sets writer_
+      // before it scans the slots. Hence at least one of them sees the other.
+      readers.fetch_add(1, std::memory_order_seq_cst);
+      if (PREDICT_TRUE(!writer_.load(std::memory_order_seq_cst)))
+        return;
+
+      Release(&readers);
+      auto no_writer = [this] { return !writer_.load(std::memory_order_acquire); };
+      if (!SpinUntil(no_writer))
+        writer_ec_.await(no_writer);
+    }
+  }
+
+  bool try_lock_shared() {
+    std::atomic_int32_t& readers = slots_[SlotIndex()].readers;
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (PREDICT_TRUE(!writer_.load(std::memory_order_seq_cst)))
+      return true;
+    Release(&readers);
+    return false;
+  }
+
+  void unlock_shared() { Release(&slots_[SlotIndex()].readers); }
+
+  // Downgrades the lock from writer to reader.
+  void unlock_and_lock_shared() {
+    slots_[SlotIndex()].readers.fetch_add(1, std::memory_order_relaxed);
+    unlock();
+  }
+
+  class ReadHolder {
+   public:
+    explicit ReadHolder(DistributedRWLock* lock) : lock_(lock) { lock_->lock_shared(); }
+    explicit ReadHolder(DistributedRWLock& lock) : ReadHolder(&lock) {}
+    ~ReadHolder() { lock_->unlock_shared(); }
+
+   private:
+    DistributedRWLock* lock_;
+
+    ReadHolder(const ReadHolder&) = delete;
+    void operator=(const ReadHolder&) = delete;
+  };
+
+  class WriteHolder {
+   public:
+    explicit WriteHolder(DistributedRWLock* lock) : lock_(lock) { lock_->lock(); }
+    explicit WriteHolder(DistributedRWLock& lock) : WriteHolder(&lock) {}
+    ~WriteHolder() { lock_->unlock(); }
+
+   private:
+    DistributedRWLock* lock_;
+
+    WriteHolder(const WriteHolder&) = delete;
+    void operator=(const WriteHolder&) = delete;
+  };
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic_int32_t readers{0};
+  };
+
+  static unsigned SlotIndex() { return detail::ReaderSlot() % kNumSlots; }
+
+  bool TryAcquireWriter() {
+    return !writer_.load(std::memory_order_relaxed) &&
+           !writer_.exchange(true, std::memory_order_seq_cst);
+  }
+
+  void Release(std::atomic_int32_t* readers) {
+    readers->fetch_sub(1, std::memory_order_seq_cst);
+
+    // A pending writer may be parked on our slot.
+    if (PREDICT_FALSE(writer_.load(std::memory_order_seq_cst)))
+      readers_ec_.notify();
+  }
+
+  template <typename Cond> static bool SpinUntil(Cond cond) {
+    for (unsigned i = 0; i < kSpinLimit; ++i) {
+      if (cond())
+        return true;
+      asm volatile("pause");
+    }
+    return cond();
+  }
+
+  static constexpr unsigned kSpinLimit = 256;
+
+  Slot slots_[kNumSlots];
+
+  alignas(64) std::atomic_bool writer_{false};
+  folly::EventCount writer_ec_;   // Waiters for the writer to leave.
+  folly::EventCount readers_ec_;  // The pending writer waits for the readers to drain.
+
+  DistributedRWLock(const DistributedRWLock&) = delete;
+  void operator=(const DistributedRWLock&) = delete;
+};
+
+}  // namespace base
@@ -105,11 +105,19 @@ class EventCount {
   // (no threads were sleeping).
   bool notify() noexcept;
   bool notifyAll() noexcept;
+
+  // Wakes up to n waiters, for example when n items became available at once.
+  bool notifyN(int n) noexcept;
+
   Key prepareWait() noexcept;
   void cancelWait() noexcept;
   void wait(Key key) noexcept;
   bool wait(Key key, MicrosecondsInt64 now, MicrosecondsInt64 until) noexcept;
 
+  // Returns false if the deadline (GetMonotonicMicros() based) passed before being notified.
+  // Uses an absolute futex timeout, so spurious wakeups do not shift the deadline.
+  bool waitUntil(Key key, MicrosecondsInt64 deadline_usec) noexcept;
+
   /**
    * Wait for condition() to become true.  Will clean up appropriately if
    * condition() throws, and then rethrow.
@@ -125,6 +133,22 @@ class EventCount {
    */
   template <class Condition>
   bool await(Condition condition, MicrosecondsInt64 timeout_usec);
+
+  /**
+   * Like await() but waits until the deadline (GetMonotonicMicros() based) at most.
+   * Returns the last value of condition().
+   */
+  template <class Condition>
+  bool awaitUntil(Condition condition, MicrosecondsInt64 deadline_usec);
+
+  /**
+   * Polls condition() up to spin_count times before parking as await() does. Busy handoffs
+   * rarely park this way and since spinning waiters are not registered, their notifiers
+   * skip the futex syscall as well.
+   */
+  template <class Condition>
+  void spinAwait(Condition condition, unsigned spin_count);
+
  private:
   bool doNotify(int n) noexcept;
   EventCount(const EventCount&) = delete;
@@ -164,6 +188,10 @@ inline bool EventCount::notifyAll() noexcept {
   return doNotify(INT_MAX);
 }
 
+inline bool EventCount::notifyN(int n) noexcept {
+  return n > 0 && doNotify(n);
+}
+
 inline bool EventCount::doNotify(int n) noexcept {
   // Invalidate epoch number so that all waiting threads that are checking it agains their
   // key.epoch_ will have to evaluate their condition again.
@@ -254,29 +282,60 @@ void EventCount::await(Condition condition) {
   }
 }
 
+inline bool EventCount::waitUntil(Key key, MicrosecondsInt64 deadline_usec) noexcept {
+  timespec ts;
+  ts.tv_sec = deadline_usec / 1000000;
+  ts.tv_nsec = (deadline_usec % 1000000) * 1000;
+
+  while ((val_.load(std::memory_order_acquire) >> kEpochShift) == key.epoch_) {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, unlike FUTEX_WAIT.
+    int res = detail::futex(reinterpret_cast<int*>(&val_) + kEpochOffset,
+                            FUTEX_WAIT_BITSET_PRIVATE, key.epoch_, &ts, nullptr,
+                            FUTEX_BITSET_MATCH_ANY);
+    if (res == -1 && errno == ETIMEDOUT) {
+      val_.fetch_add(kSubWaiter, std::memory_order_seq_cst);
+      return false;
+    }
+  }
+  uint64_t prev ATTRIBUTE_UNUSED = val_.fetch_add(kSubWaiter, std::memory_order_seq_cst);
+  assert((prev & kWaiterMask) != 0);
+  return true;
+}
+
 template <class Condition>
 bool EventCount::await(Condition condition, MicrosecondsInt64 timeout_usec) {
   if (condition()) return true;  // fast path
-  // condition() is the only thing that may throw, everything else is
-  // noexcept, so we can hoist the try/catch block outside of the loop
+  return awaitUntil(condition, GetMonotonicMicros() + timeout_usec);
+}
+
+template <class Condition>
+bool EventCount::awaitUntil(Condition condition, MicrosecondsInt64 deadline_usec) {
+  if (condition()) return true;  // fast path
+
   try {
-    MicrosecondsInt64 now = GetMonotonicMicros();
     for (;;) {
       auto key = prepareWait();
       if (condition()) {
         cancelWait();
-        break;
-      } else {
-        if (!wait(key, now, now + timeout_usec))
-          return false;
-        now = 0;
+        return true;
       }
+      if (!waitUntil(key, deadline_usec))
+        break;
     }
   } catch (...) {
     cancelWait();
     throw;
   }
-  return true;
+  return condition();
+}
+
+template <class Condition>
+void EventCount::spinAwait(Condition condition, unsigned spin_count) {
+  for (unsigned i = 0; i < spin_count; ++i) {
+    if (condition()) return;
+    asm volatile("pause");
+  }
+  await(condition);
 }
 
 }  // namespace folly
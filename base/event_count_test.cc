@@ -43,6 +43,11 @@ class Semaphore {
     ec_.notifyAll();
   }
 
+  void up(int n) {
+    value_ += n;
+    ec_.notifyN(n);
+  }
+
   int value() const {
     return value_;
   }
@@ -188,6 +193,71 @@ TEST_F(EventCountTest, WaitTimedOut) {
   ASSERT_TRUE(res);
 }
 
+TEST_F(EventCountTest, NotifyN) {
+  Semaphore sem;
+  EventCount ec;
+  std::atomic<int> done(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 3; ++i) {
+    threads.emplace_back([&] {
+      sem.down();
+      done.fetch_add(1);
+    });
+  }
+
+  ASSERT_FALSE(ec.notifyN(2));
+  ASSERT_FALSE(ec.notifyN(0));
+
+  SleepForMilliseconds(5);
+  sem.up(2);
+  sem.up(1);
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(3, done.load());
+}
+
+TEST_F(EventCountTest, AwaitUntil) {
+  EventCount ec;
+  std::atomic<int> val(0);
+  auto check_positive = [&val]() -> bool { return val > 0; };
+
+  MicrosecondsInt64 start = GetMonotonicMicros();
+  ASSERT_FALSE(ec.awaitUntil(check_positive, start + base::kNumMicrosPerMilli * 10));
+  EXPECT_GE(GetMonotonicMicros() - start, base::kNumMicrosPerMilli * 10);
+  ASSERT_FALSE(ec.awaitUntil(check_positive, start));
+  ASSERT_FALSE(ec.notify());
+
+  bool res = false;
+  t1_.reset(new std::thread([&] {
+    res = ec.awaitUntil(check_positive, GetMonotonicMicros() + base::kNumMicrosPerSecond);
+  }));
+  SleepForMilliseconds(10);
+  val = 1;
+  ec.notifyN(1);
+  t1_->join();
+  ASSERT_TRUE(res);
+  ASSERT_FALSE(ec.notify());
+}
+
+TEST_F(EventCountTest, SpinAwait) {
+  EventCount ec;
+  std::atomic<int> val(0);
+
+  // Satisfied while spinning, hence never registers as a waiter.
+  int polls = 0;
+  ec.spinAwait([&] { return ++polls == 10; }, 100);
+  EXPECT_EQ(10, polls);
+  EXPECT_FALSE(ec.notify());
+
+  // Falls back to parking.
+  t1_.reset(new std::thread([&] { ec.spinAwait([&] { return val > 0; }, 10); }));
+  SleepForMilliseconds(10);
+  val = 1;
+  EXPECT_TRUE(ec.notify());
+  t1_->join();
+}
+
 TEST_F(EventCountTest, Futex) {
   int test_val = 1;
   timespec ts;
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cassert>
 #include <vector>
 #include "base/integral_types.h"
 
@@ -48,6 +49,10 @@ public:
 
   // Returns number of arrays in flat array.
   uint32 size() const { return offsets_.size(); }
+
+  // Start offsets of the arrays in data().
+  const std::vector<uint32>& offsets() const { return offsets_; }
+  const std::vector<T>& data() const { return data_; }
 };
 
 }  // namespace base
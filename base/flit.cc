@@ -0,0 +1,54 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/flit.h"
+
+#ifdef __SSE4_1__
+#include <x86intrin.h>
+#endif
+
+namespace base {
+namespace flit {
+
+size_t DecodeN(const uint8_t* src, const uint8_t* end, size_t max_cnt, uint32_t* dest,
+               const uint8_t** next) {
+  size_t i = 0;
+
+#ifdef __SSE4_1__
+  // A code of a single byte has its LSB set. The leading one byte codes of a word are expanded
+  // at once, the longer codes are parsed one by one.
+  constexpr uint64_t kLsbMask = 0x0101010101010101ULL;
+
+  while (max_cnt - i >= 8 && end - src >= 8) {
+    uint64_t word;
+    std::memcpy(&word, src, sizeof(word));
+
+    uint64_t long_codes = ~word & kLsbMask;
+    unsigned cnt = long_codes ? Bits::FindLSBSetNonZero64(long_codes) / 8 : 8;
+    if (cnt == 0) {
+      src += ParseT(src, dest + i);
+      ++i;
+      continue;
+    }
+
+    // Stores 8 values but advances only by the one byte codes.
+    __m128i bytes = _mm_cvtsi64_si128(word);
+    __m128i lo = _mm_cvtepu8_epi32(bytes);
+    __m128i hi = _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_srli_epi32(lo, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i + 4), _mm_srli_epi32(hi, 1));
+    src += cnt;
+    i += cnt;
+  }
+#endif
+
+  for (; i < max_cnt && src < end; ++i) {
+    src += ParseT(src, dest + i);
+  }
+  *next = src;
+
+  return i;
+}
+
+}  // namespace flit
+}  // namespace base
@@ -227,6 +227,12 @@ inline unsigned Encode32(uint32_t v, uint8_t* dest) {
   return EncodeT<uint32_t>(v, dest);
 }
 
+// Decodes up to max_cnt uint32 values from [src, end) into dest and returns the number of
+// decoded values. *next is set past the last decoded value. Runs of one-byte codes are expanded
+// with SSE. Like ParseT, it may read up to 8 bytes beyond end and assumes the input is valid.
+size_t DecodeN(const uint8_t* src, const uint8_t* end, size_t max_cnt, uint32_t* dest,
+               const uint8_t** next);
+
 template<typename T> struct Traits {
   static_assert(std::numeric_limits<T>::is_integer, "T must be integer");
 
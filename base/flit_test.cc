@@ -161,6 +161,66 @@ uint64_t RandUint64() {
   return rnd_engine() & ((1ULL << bit_len) - 1);
 }
 
+// Mostly small values with a tail of large ones, as in the length codes.
+static uint32_t RandSkewed32() {
+  unsigned bit_len = rnd_engine() % 8 ? (rnd_engine() % 14) + 1 : (rnd_engine() % 32) + 1;
+  return rnd_engine() & ((1ULL << bit_len) - 1);
+}
+
+TEST_F(FlitTest, DecodeN) {
+  vector<uint32_t> input(10000);
+  std::generate(input.begin(), input.end(), RandSkewed32);
+  std::fill(input.begin() + 100, input.begin() + 200, 5);  // A run of one byte codes.
+
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[input.size() * 5 + 8]);
+  uint8_t* end = buf.get();
+  for (uint32_t v : input) {
+    end += flit::Encode32(v, end);
+  }
+
+  vector<uint32_t> output(input.size() + 1);
+  const uint8_t* next = nullptr;
+  ASSERT_EQ(input.size(), flit::DecodeN(buf.get(), end, output.size(), output.data(), &next));
+  EXPECT_EQ(end, next);
+  output.pop_back();
+  EXPECT_EQ(input, output);
+
+  // Stops after max_cnt values.
+  EXPECT_EQ(150, flit::DecodeN(buf.get(), end, 150, output.data(), &next));
+  uint32_t val;
+  next += flit::ParseT(next, &val);
+  EXPECT_EQ(input[150], val);
+}
+
+TEST_F(FlitTest, VarintParseN) {
+  vector<uint32_t> input(10000);
+  std::generate(input.begin(), input.end(), RandSkewed32);
+  std::fill(input.begin() + 100, input.begin() + 200, 5);
+  std::fill(input.begin() + 300, input.begin() + 400, 300);
+
+  string buf;
+  for (uint32_t v : input) {
+    Varint::Append32(&buf, v);
+  }
+  const uint8* begin = reinterpret_cast<const uint8*>(buf.data());
+  const uint8* end = begin + buf.size();
+
+  vector<uint32_t> output(input.size());
+  EXPECT_EQ(end, Varint::ParseN(begin, end, output.data(), output.size()));
+  EXPECT_EQ(input, output);
+
+  // Truncated input.
+  EXPECT_EQ(nullptr, Varint::ParseN(begin, end - 1, output.data(), output.size()));
+  EXPECT_EQ(nullptr, Varint::ParseN(begin, end, output.data(), output.size() + 1));
+
+  // Too long varint.
+  string bad(buf.substr(0, 64));
+  bad.append(6, '\xff');
+  bad.append(32, '\x01');
+  begin = reinterpret_cast<const uint8*>(bad.data());
+  EXPECT_EQ(nullptr, Varint::ParseN(begin, begin + bad.size(), output.data(), 64));
+}
+
 static void FillEncoded(uint8_t* buf, unsigned num) {
   for (unsigned i = 0; i < num; ++i) {
     volatile uint64_t val = RandUint64();
@@ -244,6 +304,39 @@ static void BM_FlitDecodeGold(benchmark::State& state) {
 }
 BENCHMARK(BM_FlitDecodeGold);
 
+static void BM_FlitDecodeLoop(benchmark::State& state) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[kBatchLen * 5 + 8]);
+  uint8_t* end = buf.get();
+  for (unsigned i = 0; i < kBatchLen; ++i) {
+    end += flit::Encode32(RandSkewed32(), end);
+  }
+  uint32_t output[kBatchLen];
+
+  while (state.KeepRunning()) {
+    const uint8_t* rn = buf.get();
+    for (unsigned i = 0; rn < end; ++i) {
+      rn += flit::ParseT(rn, output + i);
+    }
+    sink_result(output[kBatchLen - 1]);
+  }
+}
+BENCHMARK(BM_FlitDecodeLoop);
+
+static void BM_FlitDecodeN(benchmark::State& state) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[kBatchLen * 5 + 8]);
+  uint8_t* end = buf.get();
+  for (unsigned i = 0; i < kBatchLen; ++i) {
+    end += flit::Encode32(RandSkewed32(), end);
+  }
+  uint32_t output[kBatchLen];
+  const uint8_t* next;
+
+  while (state.KeepRunning()) {
+    sink_result(flit::DecodeN(buf.get(), end, kBatchLen, output, &next));
+  }
+}
+BENCHMARK(BM_FlitDecodeN);
+
 static void BM_VarintEncode(benchmark::State& state) {
   uint64 input[kBatchLen];
   for (unsigned i = 0; i < arraysize(input); ++i)
@@ -262,4 +355,38 @@ static void BM_VarintEncode(benchmark::State& state) {
 }
 BENCHMARK(BM_VarintEncode);
 
+static string EncodeVarints(unsigned max_bits) {
+  string res;
+  for (unsigned i = 0; i < kBatchLen; ++i) {
+    Varint::Append32(&res, RandSkewed32() & ((1ULL << max_bits) - 1));
+  }
+  return res;
+}
+
+static void BM_VarintParseLoop(benchmark::State& state) {
+  string buf = EncodeVarints(state.range(0));
+  const uint8* end = reinterpret_cast<const uint8*>(buf.data()) + buf.size();
+  uint32_t output[kBatchLen];
+
+  while (state.KeepRunning()) {
+    const uint8* rn = reinterpret_cast<const uint8*>(buf.data());
+    for (unsigned i = 0; i < kBatchLen; ++i) {
+      rn = Varint::Parse32WithLimit(rn, end, output + i);
+    }
+    sink_result(rn);
+  }
+}
+BENCHMARK(BM_VarintParseLoop)->Arg(7)->Arg(14)->Arg(32);
+
+static void BM_VarintParseN(benchmark::State& state) {
+  string buf = EncodeVarints(state.range(0));
+  const uint8* begin = reinterpret_cast<const uint8*>(buf.data());
+  uint32_t output[kBatchLen];
+
+  while (state.KeepRunning()) {
+    sink_result(Varint::ParseN(begin, begin + buf.size(), output, kBatchLen));
+  }
+}
+BENCHMARK(BM_VarintParseN)->Arg(7)->Arg(14)->Arg(32);
+
 }  // namespace util
@@ -7,6 +7,9 @@
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
 #include <string.h>
+
+// Inlines XXH3 into the batch loops below.
+#define XXH_INLINE_ALL
 #include <xxhash.h>
 
 namespace {
@@ -90,4 +93,23 @@ uint64_t Fingerprint(const char* str, uint32_t len) {
   return 2;
 }
 
+void XXHash3Batch(const absl::string_view* keys, size_t n, uint64_t seed, uint64_t* dest) {
+  constexpr size_t kPrefetchDist = 8;
+
+  size_t i = 0;
+  for (; i + kPrefetchDist < n; ++i) {
+    __builtin_prefetch(keys[i + kPrefetchDist].data());
+    dest[i] = XXH3_64bits_withSeed(keys[i].data(), keys[i].size(), seed);
+  }
+  for (; i < n; ++i) {
+    dest[i] = XXH3_64bits_withSeed(keys[i].data(), keys[i].size(), seed);
+  }
+}
+
+void XXHash3Batch(const uint64_t* keys, size_t n, uint64_t seed, uint64_t* dest) {
+  for (size_t i = 0; i < n; ++i) {
+    dest[i] = XXH3_64bits_withSeed(keys + i, sizeof(uint64_t), seed);
+  }
+}
+
 }  // namespace base
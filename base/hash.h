@@ -7,6 +7,8 @@
 #include <cstdint>
 #include <string>
 
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 
 #define XXH_STATIC_LINKING_ONLY
@@ -29,6 +31,37 @@ inline uint32_t Murmur32(const std::string& str, uint32_t seed = 10) {
 
 uint64_t Fingerprint(const char* str, uint32_t len);
 
+// XXH3, its output is stable since xxhash 0.8.0. Considerably faster than XXH64 and Murmur,
+// especially for short keys.
+inline uint64_t XXHash3_64(const void* data, size_t len, uint64_t seed = 0) {
+  return XXH3_64bits_withSeed(data, len, seed);
+}
+
+inline uint64_t XXHash3_64(absl::string_view str, uint64_t seed = 0) {
+  return XXH3_64bits_withSeed(str.data(), str.size(), seed);
+}
+
+inline absl::uint128 XXHash3_128(const void* data, size_t len, uint64_t seed = 0) {
+  XXH128_hash_t h = XXH3_128bits_withSeed(data, len, seed);
+  return absl::MakeUint128(h.high64, h.low64);
+}
+
+// Hashes n keys into dest, dest[i] == XXHash3_64(keys[i], seed). Overlaps the hashing
+// of consecutive keys and prefetches their data, hence is faster than a loop of single calls.
+void XXHash3Batch(const absl::string_view* keys, size_t n, uint64_t seed, uint64_t* dest);
+void XXHash3Batch(const uint64_t* keys, size_t n, uint64_t seed, uint64_t* dest);
+
+// Maps a hash into [0, num_shards) using its high bits, which is faster than the modulo.
+inline uint32_t ShardOf(uint64_t hash, uint32_t num_shards) {
+  return uint32_t((static_cast<unsigned __int128>(hash) * num_shards) >> 64);
+}
+
+// Stable shard assignment: the same key, seed and number of shards map to the same shard
+// across processes, machines and releases.
+inline uint32_t ShardOf(absl::string_view key, uint32_t num_shards, uint64_t seed = 0) {
+  return ShardOf(XXHash3_64(key, seed), num_shards);
+}
+
 inline uint64_t Fingerprint(const std::string& str) {
   return Fingerprint(str.c_str(), str.size());
 }
@@ -97,6 +130,28 @@ public:
   }
 };
 
+// Streaming XXH3. Its state is large and over-aligned, hence it should be kept on stack.
+class XXHash3Imp {
+  XXH3_state_t state_;
+public:
+  XXHash3Imp(uint64_t seed = 0) noexcept {
+    XXH3_64bits_reset_withSeed(&state_, seed);
+  }
+
+  void update(void const* key, std::size_t len) noexcept {
+    XXH3_64bits_update(&state_, key, len);
+  }
+
+  uint64_t digest() noexcept {
+    return XXH3_64bits_digest(&state_);
+  }
+
+  absl::uint128 digest128() noexcept {
+    XXH128_hash_t h = XXH3_128bits_digest(&state_);
+    return absl::MakeUint128(h.high64, h.low64);
+  }
+};
+
 }  // namespace detail
 
 template <typename ...T> uint32_t XXHash32(const T&... t) {
@@ -111,6 +166,13 @@ template <typename ...T> uint64_t XXHash64(const T&... t) {
   return hasher.digest();
 }
 
+// Streaming XXH3 of the concatenated representations of t... For a single string it equals
+// XXHash3_64(str).
+template <typename ...T> uint64_t XXHash3(const T&... t) {
+  detail::XXHash3Imp hasher;
+  detail::HashAppend(hasher, t...);
+  return hasher.digest();
+}
 
 template <class ...T, size_t... Is>
 uint64_t TupleHashImpl(const std::tuple<T...>& t, std::index_sequence<Is...>) {
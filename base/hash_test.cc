@@ -34,6 +34,69 @@ TEST_F(HashTest, Basic) {
   ASSERT_GT(ids.size(), 10);
 }
 
+TEST_F(HashTest, XXHash3) {
+  // Reference values of the stable XXH3 spec.
+  EXPECT_EQ(0x2D06800538D394C2ULL, XXHash3_64("", 0));
+  EXPECT_EQ(absl::MakeUint128(0x99AA06D3014798D8ULL, 0x6001C324468D497FULL), XXHash3_128("", 0));
+
+  string str(300, 'a');
+  for (size_t i = 0; i < str.size(); ++i)
+    str[i] += i % 26;
+
+  for (size_t len : {1, 3, 8, 17, 129, 240, 241, 300}) {
+    absl::string_view sv(str.data(), len);
+    EXPECT_EQ(XXHash3_64(sv, 7), XXHash3_64(sv.data(), sv.size(), 7));
+
+    detail::XXHash3Imp hasher(7);
+    hasher.update(sv.data(), len / 2);
+    hasher.update(sv.data() + len / 2, len - len / 2);
+    EXPECT_EQ(XXHash3_64(sv, 7), hasher.digest()) << len;
+    EXPECT_EQ(XXHash3_128(sv.data(), len, 7), hasher.digest128()) << len;
+  }
+  EXPECT_EQ(XXHash3_64(str), XXHash3(str));
+  EXPECT_NE(XXHash3_64(str, 1), XXHash3_64(str, 2));
+}
+
+TEST_F(HashTest, XXHash3Batch) {
+  vector<string> strs;
+  vector<absl::string_view> keys;
+  vector<uint64_t> ints;
+  for (unsigned i = 0; i < 100; ++i) {
+    strs.push_back(string(i % 40, 'a' + i % 26));
+    ints.push_back(i * 0x9E3779B97F4A7C15ULL);
+  }
+  for (const auto& s : strs)
+    keys.push_back(s);
+
+  vector<uint64_t> dest(keys.size());
+  XXHash3Batch(keys.data(), keys.size(), 5, dest.data());
+  for (size_t i = 0; i < keys.size(); ++i)
+    EXPECT_EQ(XXHash3_64(keys[i], 5), dest[i]);
+
+  XXHash3Batch(ints.data(), ints.size(), 5, dest.data());
+  for (size_t i = 0; i < ints.size(); ++i)
+    EXPECT_EQ(XXHash3_64(&ints[i], sizeof(uint64_t), 5), dest[i]);
+}
+
+TEST_F(HashTest, ShardOf) {
+  constexpr unsigned kShards = 10;
+  unsigned counts[kShards] = {0};
+  for (unsigned i = 0; i < 100000; ++i) {
+    string key = std::to_string(i);
+    uint32_t shard = ShardOf(key, kShards);
+    ASSERT_LT(shard, kShards);
+    ASSERT_EQ(shard, ShardOf(XXHash3_64(key), kShards));
+    ++counts[shard];
+  }
+  for (unsigned c : counts) {
+    EXPECT_GT(c, 9500);
+    EXPECT_LT(c, 10500);
+  }
+
+  EXPECT_EQ(0, ShardOf(0, 7));
+  EXPECT_EQ(6, ShardOf(~0ULL, 7));
+}
+
 static void BM_MurMur(benchmark::State& state) {
   auto ids = ReadIds();
   uint32 i = 0;
@@ -45,4 +108,26 @@ static void BM_MurMur(benchmark::State& state) {
 }
 BENCHMARK(BM_MurMur);
 
+static void BM_XXHash3(benchmark::State& state) {
+  auto ids = ReadIds();
+  uint32 i = 0;
+  while (state.KeepRunning()) {
+    int j = i++ % ids.size();
+    sink_result(XXHash3_64(ids[j]));
+  }
+}
+BENCHMARK(BM_XXHash3);
+
+static void BM_XXHash3Batch(benchmark::State& state) {
+  auto ids = ReadIds();
+  vector<absl::string_view> keys(ids.begin(), ids.end());
+  vector<uint64_t> dest(keys.size());
+  while (state.KeepRunning()) {
+    XXHash3Batch(keys.data(), keys.size(), 0, dest.data());
+    sink_result(dest.back());
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_XXHash3Batch);
+
 }  // namespace base
@@ -0,0 +1,156 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/hdr_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace base {
+
+namespace {
+
+std::atomic_uint32_t next_shard{0};
+
+// Threads get the shards round-robin, so up to kNumShards threads have a shard each.
+unsigned ThreadShard() {
+  static thread_local unsigned shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+  return shard;
+}
+
+void UpdateMin(uint64_t value, std::atomic<uint64_t>* dest) {
+  uint64_t cur = dest->load(std::memory_order_relaxed);
+  while (value < cur && !dest->compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+  }
+}
+
+void UpdateMax(uint64_t value, std::atomic<uint64_t>* dest) {
+  uint64_t cur = dest->load(std::memory_order_relaxed);
+  while (value > cur && !dest->compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+constexpr unsigned HdrHistogram::kNumBuckets;
+
+void HdrHistogram::Snapshot::Add(uint64_t value, uint64_t count) {
+  if (count == 0)
+    return;
+  buckets_[BucketIndex(value)] += count;
+  count_ += count;
+  sum_ += value * count;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void HdrHistogram::Snapshot::Merge(const Snapshot& other) {
+  for (unsigned b = 0; b < kNumBuckets; ++b) {
+    buckets_[b] += other.buckets_[b];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void HdrHistogram::Snapshot::Subtract(const Snapshot& older) {
+  unsigned first = kNumBuckets, last = 0;
+  for (unsigned b = 0; b < kNumBuckets; ++b) {
+    buckets_[b] -= std::min(buckets_[b], older.buckets_[b]);
+    if (buckets_[b]) {
+      first = std::min(first, b);
+      last = b;
+    }
+  }
+  count_ -= std::min(count_, older.count_);
+  sum_ -= older.sum_;
+
+  if (first == kNumBuckets) {
+    count_ = sum_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+  } else {
+    min_ = std::max(min_, BucketLow(first));
+    max_ = std::min(max_, BucketHigh(last));
+  }
+}
+
+uint64_t HdrHistogram::Snapshot::Percentile(double p) const {
+  if (count_ == 0)
+    return 0;
+
+  // The rank of the percentile value, 1-based.
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(std::min(p, 100.0) / 100 * count_));
+  if (rank >= count_)
+    return max_;
+  uint64_t seen = 0;
+  unsigned b = 0;
+  for (; b < kNumBuckets - 1; ++b) {
+    seen += buckets_[b];
+    if (seen >= rank)
+      break;
+  }
+
+  uint64_t low = BucketLow(b);
+  uint64_t mid = low + (BucketHigh(b) - low) / 2;
+  return std::min(std::max(mid, min_), max_);
+}
+
+HdrHistogram::Shard::Shard() {
+  for (auto& b : buckets)
+    b.store(0, std::memory_order_relaxed);
+}
+
+HdrHistogram::HdrHistogram() {
+  for (auto& s : shards_)
+    s.store(nullptr, std::memory_order_relaxed);
+}
+
+HdrHistogram::~HdrHistogram() {
+  for (auto& s : shards_)
+    delete s.load(std::memory_order_relaxed);
+}
+
+auto HdrHistogram::GetShard() -> Shard* {
+  std::atomic<Shard*>& slot = shards_[ThreadShard() % kNumShards];
+  Shard* res = slot.load(std::memory_order_acquire);
+  if (res)
+    return res;
+
+  // Another thread of the same shard may race with us, the loser frees its copy.
+  Shard* fresh = new Shard;
+  if (slot.compare_exchange_strong(res, fresh, std::memory_order_acq_rel))
+    return fresh;
+  delete fresh;
+  return res;
+}
+
+void HdrHistogram::Add(uint64_t value) {
+  Shard* shard = GetShard();
+  shard->buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  shard->sum.fetch_add(value, std::memory_order_relaxed);
+  UpdateMin(value, &shard->min);
+  UpdateMax(value, &shard->max);
+}
+
+auto HdrHistogram::Read() const -> Snapshot {
+  Snapshot res;
+  for (const auto& slot : shards_) {
+    const Shard* shard = slot.load(std::memory_order_acquire);
+    if (!shard)
+      continue;
+
+    for (unsigned b = 0; b < kNumBuckets; ++b) {
+      uint64_t cnt = shard->buckets[b].load(std::memory_order_relaxed);
+      res.buckets_[b] += cnt;
+      res.count_ += cnt;
+    }
+    res.sum_ += shard->sum.load(std::memory_order_relaxed);
+    res.min_ = std::min(res.min_, shard->min.load(std::memory_order_relaxed));
+    res.max_ = std::max(res.max_, shard->max.load(std::memory_order_relaxed));
+  }
+  return res;
+}
+
+}  // namespace base
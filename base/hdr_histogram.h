@@ -0,0 +1,119 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace base {
+
+// Log-linear (HDR-style) histogram of unsigned integers, for example latencies in usec.
+// Values below 2^kSubBucketBits are counted exactly, every larger power of 2 range is split
+// into 2^kSubBucketBits equal buckets. Therefore a percentile differs from the exact one by less
+// than 2^-kSubBucketBits of its value.
+//
+// Add() is lock-free: it increments relaxed atomic counters in the shard of the calling thread,
+// so the threads recording into the same histogram do not contend. Read() adds up the shards
+// and is consistent up to the concurrent additions.
+class HdrHistogram {
+ public:
+  static constexpr unsigned kSubBucketBits = 5;
+  static constexpr unsigned kNumBuckets = (65 - kSubBucketBits) << kSubBucketBits;
+
+  // Single threaded histogram with the same buckets.
+  class Snapshot {
+   public:
+    Snapshot() : buckets_(kNumBuckets, 0) {}
+
+    void Add(uint64_t value, uint64_t count = 1);
+    void Merge(const Snapshot& other);
+
+    // Removes the values of an older snapshot of the same histogram, leaving the values added
+    // since then. min() and max() become the limits of the lowest and the highest non-empty
+    // buckets, clamped to the previous min() and max().
+    void Subtract(const Snapshot& older);
+
+    uint64_t count() const { return count_; }
+
+    // Wraps around on overflow.
+    uint64_t sum() const { return sum_; }
+
+    // 0 for an empty histogram.
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+
+    double Mean() const { return count_ ? double(sum_) / count_ : 0; }
+
+    // p in [0, 100]. Returns the midpoint of the bucket holding the percentile, clamped to
+    // [min(), max()], max() for the top rank or 0 for an empty histogram.
+    uint64_t Percentile(double p) const;
+
+    // Calls f(lowest_value, highest_value, count) for the non-empty buckets in the increasing
+    // order of values. The limits are inclusive.
+    template <typename F> void ForEachBucket(F&& f) const {
+      for (unsigned b = 0; b < kNumBuckets; ++b) {
+        if (buckets_[b])
+          f(BucketLow(b), BucketHigh(b), buckets_[b]);
+      }
+    }
+
+   private:
+    friend class HdrHistogram;
+
+    std::vector<uint64_t> buckets_;
+    uint64_t count_ = 0, sum_ = 0;
+    uint64_t min_ = UINT64_MAX, max_ = 0;
+  };
+
+  HdrHistogram();
+  ~HdrHistogram();
+
+  void Add(uint64_t value);
+
+  Snapshot Read() const;
+
+  static unsigned BucketIndex(uint64_t value) {
+    if (value < kSubBuckets)
+      return value;
+    unsigned exp = 63 - __builtin_clzll(value);
+    unsigned shift = exp - kSubBucketBits;
+    return ((shift + 1) << kSubBucketBits) + unsigned(value >> shift) - kSubBuckets;
+  }
+
+  static uint64_t BucketLow(unsigned index) {
+    unsigned group = index >> kSubBucketBits;
+    if (group == 0)
+      return index;
+    return uint64_t((index & (kSubBuckets - 1)) + kSubBuckets) << (group - 1);
+  }
+
+  static uint64_t BucketHigh(unsigned index) {
+    unsigned group = index >> kSubBucketBits;
+    return BucketLow(index) + (group ? (uint64_t(1) << (group - 1)) - 1 : 0);
+  }
+
+ private:
+  static constexpr unsigned kSubBuckets = 1 << kSubBucketBits;
+
+  enum { kNumShards = 8 };
+
+  struct Shard {
+    std::atomic<uint64_t> sum{0}, min{UINT64_MAX}, max{0};
+    std::atomic<uint64_t> buckets[kNumBuckets];
+
+    Shard();
+  };
+
+  // Shards are allocated by the first thread that records into them, separately from each
+  // other so that they do not share cache lines.
+  Shard* GetShard();
+
+  std::atomic<Shard*> shards_[kNumShards];
+
+  HdrHistogram(const HdrHistogram&) = delete;
+  void operator=(const HdrHistogram&) = delete;
+};
+
+}  // namespace base
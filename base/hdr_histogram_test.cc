@@ -0,0 +1,124 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/hdr_histogram.h"
+
+#include <algorithm>
+#include <random>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace base {
+
+using namespace std;
+
+class HdrHistogramTest : public testing::Test {
+};
+
+TEST_F(HdrHistogramTest, Buckets) {
+  for (unsigned b = 0; b < HdrHistogram::kNumBuckets; ++b) {
+    uint64_t low = HdrHistogram::BucketLow(b), high = HdrHistogram::BucketHigh(b);
+    ASSERT_LE(low, high);
+    ASSERT_EQ(b, HdrHistogram::BucketIndex(low));
+    ASSERT_EQ(b, HdrHistogram::BucketIndex(high));
+    if (b + 1 < HdrHistogram::kNumBuckets) {
+      ASSERT_EQ(high + 1, HdrHistogram::BucketLow(b + 1));
+    }
+  }
+  EXPECT_EQ(UINT64_MAX, HdrHistogram::BucketHigh(HdrHistogram::kNumBuckets - 1));
+}
+
+TEST_F(HdrHistogramTest, Percentile) {
+  HdrHistogram::Snapshot snap;
+  EXPECT_EQ(0, snap.Percentile(50));
+  EXPECT_EQ(0, snap.min());
+
+  for (uint64_t i = 1; i <= 100000; ++i) {
+    snap.Add(i);
+  }
+  EXPECT_EQ(100000, snap.count());
+  EXPECT_EQ(5000050000ULL, snap.sum());
+  EXPECT_EQ(1, snap.min());
+  EXPECT_EQ(100000, snap.max());
+  EXPECT_EQ(100000, snap.Percentile(100));
+  EXPECT_EQ(1, snap.Percentile(0));
+
+  for (double p : {10.0, 50.0, 90.0, 99.0, 99.9}) {
+    double expected = p * 1000;
+    EXPECT_NEAR(expected, snap.Percentile(p), expected / 32) << p;
+  }
+
+  HdrHistogram::Snapshot exact;
+  exact.Add(7, 3);
+  exact.Add(20);
+  EXPECT_EQ(7, exact.Percentile(75));
+  EXPECT_EQ(20, exact.Percentile(76));
+}
+
+TEST_F(HdrHistogramTest, Subtract) {
+  HdrHistogram hist;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    hist.Add(i);
+  }
+  HdrHistogram::Snapshot older = hist.Read();
+  for (uint64_t i = 0; i < 1000; ++i) {
+    hist.Add(5000 + i % 10);
+  }
+
+  HdrHistogram::Snapshot delta = hist.Read();
+  delta.Subtract(older);
+  EXPECT_EQ(1000, delta.count());
+  EXPECT_EQ(5000 * 1000 + 4500, delta.sum());
+  EXPECT_GE(delta.min(), 4992);
+  EXPECT_LE(delta.min(), 5000);
+  EXPECT_EQ(5009, delta.max());
+  EXPECT_NEAR(5005, delta.Percentile(50), 5005 / 32);
+
+  delta = hist.Read();
+  delta.Subtract(hist.Read());
+  EXPECT_EQ(0, delta.count());
+  EXPECT_EQ(0, delta.max());
+  EXPECT_EQ(0, delta.Percentile(99));
+}
+
+TEST_F(HdrHistogramTest, Concurrent) {
+  HdrHistogram hist;
+  constexpr unsigned kThreads = 12, kPerThread = 100000;
+  vector<thread> threads;
+  for (unsigned i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&hist, i] {
+      for (unsigned j = 0; j < kPerThread; ++j)
+        hist.Add(j * kThreads + i);
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  HdrHistogram::Snapshot snap = hist.Read();
+  EXPECT_EQ(kThreads * kPerThread, snap.count());
+  EXPECT_EQ(0, snap.min());
+  EXPECT_EQ(kThreads * kPerThread - 1, snap.max());
+
+  uint64_t n = kThreads * kPerThread;
+  EXPECT_EQ(n * (n - 1) / 2, snap.sum());
+  EXPECT_NEAR(n / 2, snap.Percentile(50), n / 64);
+
+  HdrHistogram::Snapshot merged;
+  merged.Merge(snap);
+  merged.Merge(snap);
+  EXPECT_EQ(2 * n, merged.count());
+  EXPECT_EQ(snap.Percentile(99), merged.Percentile(99));
+}
+
+static void BM_HdrAdd(benchmark::State& state) {
+  static HdrHistogram hist;
+  uint64_t val = 0;
+  while (state.KeepRunning()) {
+    hist.Add(val++ & 0xFFFF);
+  }
+}
+BENCHMARK(BM_HdrAdd)->ThreadRange(1, 8);
+
+}  // namespace base
@@ -36,6 +36,15 @@ class Histogram {
   double StdDev() const;
   double max() const { return max_;}
   double min() const { return min_;}
+  double sum() const { return sum_;}
+
+  // Calls f(upper_limit, count) for the non-empty buckets in the increasing order of limits.
+  template <typename F> void ForEachBucket(F&& f) const {
+    for (unsigned b = 0; b < buckets_.size() && b < kNumBuckets; ++b) {
+      if (buckets_[b])
+        f(kBucketLimit[b], buckets_[b]);
+    }
+  }
 
   // trim_low_percentile, trim_high_percentile in [0, 100].
   // Returns truncated mean according to http://en.wikipedia.org/wiki/Truncated_mean
@@ -8,11 +8,18 @@
 
 #include "absl/debugging/failure_signal_handler.h"
 #include "absl/debugging/symbolize.h"
+#include "base/async_logger.h"
 #include "base/logging.h"
 #include "base/walltime.h"
 
 // #include <gperftools/malloc_extension.h>
 
+DEFINE_bool(async_logging, false, "If true, the log files are written by background threads "
+                                  "and LOG() does not block on the disk");
+DEFINE_uint32(async_logging_buffer_kb, 4096,
+              "With --async_logging, the KB of records buffered per severity before new ones "
+              "are dropped");
+
 namespace __internal__ {
 
 ModuleInitializer::ModuleInitializer(VoidFunction ftor, bool is_ctor)
@@ -47,6 +54,8 @@ MainInitGuard::MainInitGuard(int* argc, char*** argv, uint32_t flags) {
 
   google::ParseCommandLineFlags(argc, argv, true);
   google::InitGoogleLogging((*argv)[0]);
+  if (FLAGS_async_logging)
+    base::InstallAsyncLoggers(FLAGS_async_logging_buffer_kb * 1024);
 
   absl::InitializeSymbolizer((*argv)[0]);
   absl::FailureSignalHandlerOptions options;
@@ -74,5 +83,6 @@ MainInitGuard::~MainInitGuard() {
 
   __internal__::ModuleInitializer::RunFtors(false);
   base::DestroyJiffiesTimer();
+  base::UninstallAsyncLoggers();
   google::ShutdownGoogleLogging();
 }
@@ -0,0 +1,51 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/memory_account.h"
+
+#include <mutex>
+
+namespace base {
+
+namespace {
+
+// Function statics, so that accounts may be defined in any translation unit.
+std::mutex& RegistryMutex() {
+  static std::mutex mu;
+  return mu;
+}
+
+MemoryAccount*& RegistryHead() {
+  static MemoryAccount* head = nullptr;
+  return head;
+}
+
+}  // namespace
+
+MemoryAccount::MemoryAccount(const char* name) : name_(name) {
+  std::lock_guard<std::mutex> lk(RegistryMutex());
+  MemoryAccount*& head = RegistryHead();
+  next_ = head;
+  if (next_)
+    next_->prev_ = this;
+  head = this;
+}
+
+MemoryAccount::~MemoryAccount() {
+  std::lock_guard<std::mutex> lk(RegistryMutex());
+  if (prev_)
+    prev_->next_ = next_;
+  else
+    RegistryHead() = next_;
+  if (next_)
+    next_->prev_ = prev_;
+}
+
+void MemoryAccount::ForEach(std::function<void(const MemoryAccount&)> cb) {
+  std::lock_guard<std::mutex> lk(RegistryMutex());
+  for (const MemoryAccount* a = RegistryHead(); a; a = a->next_) {
+    cb(*a);
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,140 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+
+#include <pmr/polymorphic_allocator.h>
+
+namespace base {
+
+/* Named counter of the memory held by a subsystem, for example "rpc_envelope_pool" or
+   "arena_pool". Accounts are usually static objects and register themselves in a global
+   registry upon construction, util/stats exports all of them via the "memory_accounts" varz.
+   Subsystems charge the accounts either explicitly or by allocating via AccountingResource or
+   accounting_allocator. Thread-safe, the counters are updated with relaxed semantics.
+*/
+class MemoryAccount {
+ public:
+  // name must outlive the account.
+  explicit MemoryAccount(const char* name);
+  ~MemoryAccount();
+
+  void Charge(size_t bytes) {
+    int64_t cur = bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t peak = peak_.load(std::memory_order_relaxed);
+    while (cur > peak && !peak_.compare_exchange_weak(peak, cur, std::memory_order_relaxed)) {
+    }
+  }
+
+  void Credit(size_t bytes) {
+    bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    allocations_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  const char* name() const { return name_; }
+
+  // Bytes and allocations currently charged.
+  int64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+  int64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+  // Highest value of bytes() so far.
+  int64_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+  // Calls cb for every live account under the registry lock, hence cb must not
+  // create or destroy accounts.
+  static void ForEach(std::function<void(const MemoryAccount&)> cb);
+
+ private:
+  const char* name_;
+  std::atomic<int64_t> bytes_{0}, allocations_{0}, peak_{0};
+
+  MemoryAccount* prev_ = nullptr;
+  MemoryAccount* next_ = nullptr;
+
+  MemoryAccount(const MemoryAccount&) = delete;
+  void operator=(const MemoryAccount&) = delete;
+};
+
+// pmr resource that charges the account for the allocations of its upstream.
+class AccountingResource : public pmr::memory_resource {
+ public:
+  explicit AccountingResource(MemoryAccount* account,
+                              pmr::memory_resource* upstream = pmr::get_default_resource())
+      : account_(account), upstream_(upstream) {}
+
+  MemoryAccount* account() const { return account_; }
+  pmr::memory_resource* upstream() const { return upstream_; }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t align) override {
+    void* res = upstream_->allocate(bytes, align);
+    account_->Charge(bytes);
+    return res;
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t align) override {
+    upstream_->deallocate(p, bytes, align);
+    account_->Credit(bytes);
+  }
+
+  bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ private:
+  MemoryAccount* account_;
+  pmr::memory_resource* upstream_;
+};
+
+// Like counting_allocator but charges a shared account instead of a private counter,
+// so it can be used by the std containers of a subsystem.
+template <typename T> class accounting_allocator {
+ public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  template <typename U> struct rebind { using other = accounting_allocator<U>; };
+
+  explicit accounting_allocator(MemoryAccount* account) noexcept : account_(account) {}
+
+  template <typename U>
+  accounting_allocator(const accounting_allocator<U>& other) noexcept
+      : account_(other.account_) {}
+
+  T* allocate(size_type n) {
+    T* ptr = static_cast<T*>(::operator new(n * sizeof(T)));
+    account_->Charge(n * sizeof(T));
+    return ptr;
+  }
+
+  void deallocate(T* ptr, size_type n) noexcept {
+    ::operator delete(static_cast<void*>(ptr));
+    account_->Credit(n * sizeof(T));
+  }
+
+  MemoryAccount* account() const noexcept { return account_; }
+
+  template <typename U> bool operator==(const accounting_allocator<U>& b) const noexcept {
+    return account_ == b.account_;
+  }
+
+  template <typename U> bool operator!=(const accounting_allocator<U>& b) const noexcept {
+    return account_ != b.account_;
+  }
+
+ private:
+  template <typename U> friend class accounting_allocator;
+
+  MemoryAccount* account_;
+};
+
+}  // namespace base
@@ -0,0 +1,118 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/memory_account.h"
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/arena.h"
+#include "base/gtest.h"
+#include "base/pod_array.h"
+
+namespace base {
+
+class MemoryAccountTest : public testing::Test {
+ protected:
+  static int64_t Find(const char* name) {
+    int64_t res = -1;
+    MemoryAccount::ForEach([&](const MemoryAccount& a) {
+      if (std::string(a.name()) == name)
+        res = a.bytes();
+    });
+    return res;
+  }
+};
+
+TEST_F(MemoryAccountTest, Registry) {
+  EXPECT_EQ(-1, Find("test_account"));
+  {
+    MemoryAccount account("test_account");
+    account.Charge(100);
+    account.Charge(50);
+    account.Credit(100);
+    EXPECT_EQ(50, Find("test_account"));
+    EXPECT_EQ(150, account.peak());
+    EXPECT_EQ(1, account.allocations());
+  }
+  EXPECT_EQ(-1, Find("test_account"));
+
+  // Accounts defined by the library.
+  EXPECT_GE(Find("arena_pool"), 0);
+}
+
+TEST_F(MemoryAccountTest, Resource) {
+  MemoryAccount account("resource");
+  AccountingResource resource(&account);
+  {
+    PODArray<uint8_t> arr(&resource);
+    arr.resize(1000);
+    EXPECT_EQ(arr.allocated_size(), account.bytes());
+  }
+  EXPECT_EQ(0, account.bytes());
+  EXPECT_EQ(0, account.allocations());
+  EXPECT_GE(account.peak(), 1000);
+}
+
+TEST_F(MemoryAccountTest, Allocator) {
+  MemoryAccount account("allocator");
+  {
+    using Alloc = accounting_allocator<std::pair<const int, int>>;
+    std::map<int, int, std::less<int>, Alloc> m{Alloc(&account)};
+    for (int i = 0; i < 100; ++i)
+      m[i] = i;
+    EXPECT_EQ(100, account.allocations());
+
+    std::vector<int, accounting_allocator<int>> v{accounting_allocator<int>(&account)};
+    v.resize(1000);
+    EXPECT_EQ(101, account.allocations());
+    EXPECT_GE(account.bytes(), 4000);
+  }
+  EXPECT_EQ(0, account.bytes());
+}
+
+TEST_F(MemoryAccountTest, Arena) {
+  MemoryAccount account("arena");
+  {
+    Arena arena(&account);
+    arena.Allocate(100);
+    arena.Allocate(10000);
+    EXPECT_EQ(8192 + 10000, account.bytes());
+
+    Arena other;
+    other.Swap(arena);
+    other.Reset();
+    EXPECT_EQ(8192, account.bytes());
+  }
+  EXPECT_EQ(0, account.bytes());
+
+  int64_t pooled = Find("arena_pool");
+  std::thread([&] {
+    PooledArena arena;
+    arena.arena()->Allocate(100);
+    EXPECT_EQ(pooled + 8192, Find("arena_pool"));
+  }).join();
+  EXPECT_EQ(pooled, Find("arena_pool"));
+}
+
+TEST_F(MemoryAccountTest, Threads) {
+  MemoryAccount account("threads");
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (unsigned j = 0; j < 10000; ++j) {
+        account.Charge(16);
+        account.Credit(16);
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(0, account.bytes());
+  EXPECT_EQ(0, account.allocations());
+  EXPECT_LE(account.peak(), 4 * 16);
+}
+
+}  // namespace base
@@ -116,13 +116,86 @@ template <typename T> class mpmc_bounded_queue {
       }
     }
 
-    data = std::forward<T>(reinterpret_cast<T&>(cell->storage));
+    T& item = reinterpret_cast<T&>(cell->storage);
+    data = std::move(item);
+    item.~T();
 
     // Commit transaction, free up the cell.
     cell->sequence.store(pos + buffer_mask_ + 1, std::memory_order_release);
     return true;
   }
 
+  // Moves into the queue up to count items starting from src and claims their cells with
+  // a single CAS. Returns how many items were enqueued, they are the prefix of the range and
+  // only those are moved from.
+  template <typename It> size_t try_enqueue_bulk(It src, size_t count) {
+    size_t pos, num;
+
+    while (true) {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+      num = 0;
+      for (; num < count; ++num) {
+        size_t seq = buffer_[(pos + num) & buffer_mask_].sequence.load(std::memory_order_acquire);
+        if (seq != pos + num)
+          break;
+      }
+      if (num == 0) {
+        intptr_t dif = (intptr_t)buffer_[pos & buffer_mask_].sequence.load(
+                           std::memory_order_acquire) - (intptr_t)pos;
+        if (dif < 0)
+          return 0;  // the queue is full.
+        continue;    // another producer advanced enqueue_pos_.
+      }
+
+      // The free cells can only be taken by claiming their positions, therefore they stay
+      // free if the CAS succeeds.
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + num, std::memory_order_relaxed))
+        break;
+    }
+
+    for (size_t i = 0; i < num; ++i, ++src) {
+      cell_t& cell = buffer_[(pos + i) & buffer_mask_];
+      new (&cell.storage) T(std::move(*src));
+      cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return num;
+  }
+
+  // Dequeues up to count items into the range starting at dest and claims their cells
+  // with a single CAS. Returns the number of dequeued items.
+  template <typename It> size_t try_dequeue_bulk(It dest, size_t count) {
+    size_t pos, num;
+
+    while (true) {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+      num = 0;
+      for (; num < count; ++num) {
+        size_t seq = buffer_[(pos + num) & buffer_mask_].sequence.load(std::memory_order_acquire);
+        if (seq != pos + num + 1)
+          break;
+      }
+      if (num == 0) {
+        intptr_t dif = (intptr_t)buffer_[pos & buffer_mask_].sequence.load(
+                           std::memory_order_acquire) - (intptr_t)(pos + 1);
+        if (dif < 0)
+          return 0;  // the queue is empty.
+        continue;
+      }
+
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + num, std::memory_order_relaxed))
+        break;
+    }
+
+    for (size_t i = 0; i < num; ++i, ++dest) {
+      cell_t& cell = buffer_[(pos + i) & buffer_mask_];
+      T& item = reinterpret_cast<T&>(cell.storage);
+      *dest = std::move(item);
+      item.~T();
+      cell.sequence.store(pos + i + buffer_mask_ + 1, std::memory_order_release);
+    }
+    return num;
+  }
+
   size_t capacity() const { return buffer_mask_ + 1; }
 
  private:
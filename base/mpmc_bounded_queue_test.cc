@@ -4,6 +4,9 @@
 #include "base/mpmc_bounded_queue.h"
 
 #include <memory>
+#include <thread>
+#include <vector>
+
 #include "base/gtest.h"
 #include "base/logging.h"
 
@@ -19,6 +22,7 @@ struct A {
   A() { ++ref; }
   A(const A&) { ++ref; }
   A(A&&) { ++ref; }
+  A& operator=(A&&) = default;
 
   ~A() { --ref; }
 };
@@ -64,4 +68,87 @@ TEST_F(MPMCTest, Dtor) {
   }
 }
 
+TEST_F(MPMCTest, Bulk) {
+  mpmc_bounded_queue<std::unique_ptr<int>> q(8);
+  std::unique_ptr<int> src[10];
+  for (int i = 0; i < 10; ++i)
+    src[i].reset(new int(i));
+
+  ASSERT_EQ(3, q.try_enqueue_bulk(src, 3));
+  ASSERT_EQ(5, q.try_enqueue_bulk(src + 3, 7));
+  EXPECT_FALSE(src[7]);
+  EXPECT_TRUE(src[8]);
+  EXPECT_EQ(0, q.try_enqueue_bulk(src + 8, 2));
+
+  std::unique_ptr<int> dest[10];
+  ASSERT_EQ(2, q.try_dequeue_bulk(dest, 2));
+  ASSERT_EQ(2, q.try_enqueue_bulk(src + 8, 2));
+  ASSERT_EQ(8, q.try_dequeue_bulk(dest + 2, 10));
+  EXPECT_EQ(0, q.try_dequeue_bulk(dest, 10));
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(dest[i]);
+    EXPECT_EQ(i, *dest[i]);
+  }
+}
+
+TEST_F(MPMCTest, DequeueDestroys) {
+  {
+    mpmc_bounded_queue<A> q(4);
+    A a;
+    ASSERT_TRUE(q.try_enqueue(A{}));
+    ASSERT_TRUE(q.try_enqueue(A{}));
+    ASSERT_TRUE(q.try_dequeue(a));
+    std::vector<A> dest(1);
+    ASSERT_EQ(1, q.try_dequeue_bulk(dest.begin(), 2));
+    EXPECT_EQ(2, A::ref);
+  }
+  EXPECT_EQ(0, A::ref);
+}
+
+TEST_F(MPMCTest, BulkThreads) {
+  constexpr unsigned kProducers = 4, kItems = 20000, kBatch = 7;
+  mpmc_bounded_queue<unsigned> q(64);
+  std::atomic<uint64_t> sum{0}, consumed{0};
+
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < kProducers; ++p) {
+    threads.emplace_back([&] {
+      unsigned buf[kBatch];
+      for (unsigned i = 0; i < kItems;) {
+        unsigned len = std::min(kBatch, kItems - i);
+        for (unsigned j = 0; j < len; ++j)
+          buf[j] = i + j;
+        unsigned* next = buf;
+        while (len) {
+          size_t res = q.try_enqueue_bulk(next, len);
+          if (res == 0)
+            std::this_thread::yield();
+          next += res;
+          len -= res;
+          i += res;
+        }
+      }
+    });
+  }
+
+  for (unsigned c = 0; c < 2; ++c) {
+    threads.emplace_back([&] {
+      unsigned buf[kBatch];
+      while (consumed.load(std::memory_order_relaxed) < kProducers * kItems) {
+        size_t res = q.try_dequeue_bulk(buf, kBatch);
+        if (res == 0)
+          std::this_thread::yield();
+        for (size_t j = 0; j < res; ++j)
+          sum.fetch_add(buf[j], std::memory_order_relaxed);
+        consumed.fetch_add(res, std::memory_order_relaxed);
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  EXPECT_EQ(kProducers * kItems, consumed.load());
+  EXPECT_EQ(uint64_t(kProducers) * kItems * (kItems - 1) / 2, sum.load());
+}
+
 }  // namespace base
@@ -0,0 +1,141 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/numa.h"
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "base/logging.h"
+
+namespace base {
+
+using namespace std;
+
+namespace {
+
+bool ReadSysfsLine(const char* path, string* line) {
+  FILE* f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  char buf[1024];
+  bool res = fgets(buf, sizeof(buf), f) != nullptr;
+  fclose(f);
+  if (res) {
+    line->assign(buf);
+    while (!line->empty() && isspace(line->back()))
+      line->pop_back();
+  }
+  return res;
+}
+
+}  // namespace
+
+NumaTopology::NumaTopology(const std::vector<std::string>& node_cpulists) {
+  for (const string& list : node_cpulists) {
+    node_cpus_.emplace_back();
+    CHECK(ParseCpuList(list, &node_cpus_.back())) << list;
+
+    for (unsigned cpu : node_cpus_.back()) {
+      if (cpu >= cpu_node_.size())
+        cpu_node_.resize(cpu + 1, 0);
+      cpu_node_[cpu] = node_cpus_.size() - 1;
+    }
+  }
+}
+
+const NumaTopology& NumaTopology::Get() {
+  static const NumaTopology* topology = [] {
+    vector<string> lists;
+    string online;
+    vector<unsigned> nodes;
+    if (ReadSysfsLine("/sys/devices/system/node/online", &online) &&
+        ParseCpuList(online, &nodes)) {
+      char path[64];
+      for (unsigned node : nodes) {
+        // Nodes without CPUs (memory-only) can not host threads.
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        string list;
+        if (ReadSysfsLine(path, &list) && !list.empty())
+          lists.push_back(std::move(list));
+      }
+    }
+    if (lists.empty()) {
+      unsigned num_cpus = std::max(1U, thread::hardware_concurrency());
+      lists.push_back("0-" + std::to_string(num_cpus - 1));
+    }
+
+    NumaTopology* res = new NumaTopology(lists);
+    VLOG(1) << "NUMA nodes: " << res->num_nodes();
+    return res;
+  }();
+
+  return *topology;
+}
+
+vector<size_t> NumaTopology::SpreadThreads(size_t count) const {
+  vector<size_t> res(count);
+  size_t num_nodes = node_cpus_.size();
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t node = i * num_nodes / count;
+    size_t block_start = (node * count + num_nodes - 1) / num_nodes;
+    const auto& cpus = node_cpus_[node];
+    res[i] = cpus[(i - block_start) % cpus.size()];
+  }
+  return res;
+}
+
+bool NumaTopology::ParseCpuList(const std::string& list, std::vector<unsigned>* cpus) {
+  cpus->clear();
+  const char* p = list.c_str();
+  while (*p) {
+    char* end;
+    unsigned long first = strtoul(p, &end, 10);
+    if (end == p)
+      return false;
+    unsigned long last = first;
+    p = end;
+    if (*p == '-') {
+      ++p;
+      last = strtoul(p, &end, 10);
+      if (end == p || last < first)
+        return false;
+      p = end;
+    }
+    for (unsigned long cpu = first; cpu <= last; ++cpu)
+      cpus->push_back(cpu);
+
+    if (*p == ',') {
+      ++p;
+    } else if (*p) {
+      return false;
+    }
+  }
+  return !cpus->empty();
+}
+
+bool PreferLocalMemory(unsigned node) {
+  constexpr unsigned kMaxNodes = 1024;
+  unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {0};
+  if (node >= kMaxNodes)
+    return false;
+
+  mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, kMaxNodes + 1) != 0) {
+    LOG(WARNING) << "set_mempolicy failed: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace base
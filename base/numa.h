@@ -0,0 +1,59 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace base {
+
+/*! \class base::NumaTopology
+    \brief The NUMA nodes of the machine and their CPUs as sysfs reports them.
+
+    Machines without NUMA support, or without /sys/devices/system/node, are reported as a
+    single node that holds all the CPUs.
+*/
+class NumaTopology {
+ public:
+  //! The topology of this machine, read once.
+  static const NumaTopology& Get();
+
+  //! Builds a topology from the cpulists of its nodes, for tests.
+  explicit NumaTopology(const std::vector<std::string>& node_cpulists);
+
+  unsigned num_nodes() const {
+    return node_cpus_.size();
+  }
+
+  const std::vector<unsigned>& cpus(unsigned node) const {
+    return node_cpus_[node];
+  }
+
+  //! Returns the node of cpu or 0 if the cpu is unknown.
+  unsigned NodeOfCpu(unsigned cpu) const {
+    return cpu < cpu_node_.size() ? cpu_node_[cpu] : 0;
+  }
+
+  //! Places count threads: splits them into contiguous blocks of nearly equal size, one per
+  //! node in order, and spreads each block over the CPUs of its node. Returns the CPU of
+  //! every thread.
+  std::vector<size_t> SpreadThreads(size_t count) const;
+
+  //! Parses the sysfs list format, i.e. "0-3,8,10-11". Returns false on a malformed list.
+  static bool ParseCpuList(const std::string& list, std::vector<unsigned>* cpus);
+
+ private:
+  NumaTopology() = default;
+
+  std::vector<std::vector<unsigned>> node_cpus_;
+  std::vector<unsigned> cpu_node_;
+};
+
+//! Makes the kernel prefer node for the memory that the calling thread allocates from now on.
+//! Together with the first-touch policy it keeps the thread stacks, arenas and buffers of a
+//! thread pinned to node on its local memory. Returns false if the kernel refused.
+bool PreferLocalMemory(unsigned node);
+
+}  // namespace base
@@ -0,0 +1,48 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/numa.h"
+
+#include <gmock/gmock.h>
+
+#include "base/gtest.h"
+
+using namespace std;
+using testing::ElementsAre;
+
+namespace base {
+
+class NumaTest : public testing::Test {
+};
+
+TEST_F(NumaTest, ParseCpuList) {
+  vector<unsigned> cpus;
+  ASSERT_TRUE(NumaTopology::ParseCpuList("0-3,8,10-11", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 3, 8, 10, 11));
+
+  ASSERT_TRUE(NumaTopology::ParseCpuList("5", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(5));
+
+  EXPECT_FALSE(NumaTopology::ParseCpuList("", &cpus));
+  EXPECT_FALSE(NumaTopology::ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(NumaTopology::ParseCpuList("1,a", &cpus));
+}
+
+TEST_F(NumaTest, SpreadThreads) {
+  NumaTopology topology({"0-1,4-5", "2-3,6-7"});
+  ASSERT_EQ(2, topology.num_nodes());
+  EXPECT_EQ(1, topology.NodeOfCpu(6));
+  EXPECT_EQ(0, topology.NodeOfCpu(5));
+
+  EXPECT_THAT(topology.SpreadThreads(4), ElementsAre(0, 1, 2, 3));
+  EXPECT_THAT(topology.SpreadThreads(3), ElementsAre(0, 1, 2));
+  EXPECT_THAT(topology.SpreadThreads(10), ElementsAre(0, 1, 4, 5, 0, 2, 3, 6, 7, 2));
+}
+
+TEST_F(NumaTest, ThisMachine) {
+  const NumaTopology& topology = NumaTopology::Get();
+  ASSERT_GE(topology.num_nodes(), 1);
+  EXPECT_FALSE(topology.cpus(0).empty());
+}
+
+}  // namespace base
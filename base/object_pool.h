@@ -12,7 +12,7 @@ namespace base {
 // If it's out of preallocated objects - fallbacks to new/delete.
 // Does not try to do anything smart. Should be used when we can assume that
 // 99% of use-patterns require at most storage_sz_ objects.
-// The class is not thread-safe.
+// The class is not thread-safe, see ConcurrentObjectPool in base/concurrent_object_pool.h.
 template <typename T>
 class ObjectPool {
   struct Item {
@@ -24,15 +24,47 @@ namespace base {
   * custom memory resource, for example, one that wraps tcmalloc directly.
   */
 
-template<size_t ELEM_SIZE, size_t ALIGNMENT> class PODArrayBase {
+// In-object storage of PODArrayBase, empty unless INLINE_BYTES > 0.
+template<size_t INLINE_BYTES, size_t ALIGNMENT> class PODInlineStorage {
+ protected:
+  char* inline_data() { return inline_buf_; }
+
+ private:
+  alignas(ALIGNMENT) char inline_buf_[INLINE_BYTES];
+};
+
+template<size_t ALIGNMENT> class PODInlineStorage<0, ALIGNMENT> {
+ protected:
+  char* inline_data() { return nullptr; }
+};
+
+// With INLINE_BYTES > 0 the array starts in the in-object buffer and moves to memory allocated
+// from mr on the first growth beyond it. Then c_start_ is never null.
+template<size_t ELEM_SIZE, size_t ALIGNMENT, size_t INLINE_BYTES = 0>
+    class PODArrayBase : protected PODInlineStorage<INLINE_BYTES, ALIGNMENT> {
   static_assert((ALIGNMENT & (ALIGNMENT - 1)) == 0 , "");
+  using PODInlineStorage<INLINE_BYTES, ALIGNMENT>::inline_data;
+
  protected:
   char * c_start_   = nullptr;
   char * c_end_       = nullptr;
   char * c_end_of_storage_ = nullptr; /// Не включает в себя pad_right.
   pmr::memory_resource* mr_;
 
-  PODArrayBase(pmr::memory_resource* mr) : mr_(mr ? mr : pmr::get_default_resource()) {}
+  PODArrayBase(pmr::memory_resource* mr) : mr_(mr ? mr : pmr::get_default_resource()) {
+    if (INLINE_BYTES)
+      set_inline(0);
+  }
+
+  bool is_inline() const {
+    return INLINE_BYTES && c_start_ == const_cast<PODArrayBase*>(this)->inline_data();
+  }
+
+  void set_inline(size_t bytes) {
+    c_start_ = inline_data();
+    c_end_ = c_start_ + bytes;
+    c_end_of_storage_ = c_start_ + INLINE_BYTES;
+  }
 
   void alloc(size_t bytes) {
     bytes = Bits::RoundUp64(bytes);
@@ -41,7 +73,7 @@ template<size_t ELEM_SIZE, size_t ALIGNMENT> class PODArrayBase {
   }
 
   void dealloc() {
-    if (c_start_ == nullptr)
+    if (c_start_ == nullptr || is_inline())
       return;
     mr_->deallocate(c_start_, allocated_size(), ALIGNMENT);
   }
@@ -58,6 +90,8 @@ template<size_t ELEM_SIZE, size_t ALIGNMENT> class PODArrayBase {
   }
 
   void alloc_for_num_elements(size_t num_elements) {
+    if (byte_size(num_elements) <= INLINE_BYTES)
+      return;
     alloc(minimum_memory_for_elements(num_elements));
   }
 
@@ -69,7 +103,8 @@ template<size_t ELEM_SIZE, size_t ALIGNMENT> class PODArrayBase {
     ptrdiff_t sz = c_end_ - c_start_;
     memcpy(new_start, c_start_, sz);
 
-    mr_->deallocate(c_start_, allocated_size(), ALIGNMENT);
+    if (!is_inline())
+      mr_->deallocate(c_start_, allocated_size(), ALIGNMENT);
     c_end_ = new_start + sz;
     c_start_ = new_start;
     c_end_of_storage_ = c_start_ + bytes;
@@ -111,20 +146,52 @@ template<size_t ELEM_SIZE, size_t ALIGNMENT> class PODArrayBase {
 
   void swap(PODArrayBase& other) {
     // must be allocated from the same memory resource.
+    if (is_inline() || other.is_inline())
+      return swap_inline(other);
     std::swap(c_start_, other.c_start_);
     std::swap(c_end_, other.c_end_);
     std::swap(c_end_of_storage_, other.c_end_of_storage_);
   }
 
   pmr::memory_resource* mr() { return mr_; }
+
+ private:
+  // The inline elements are copied since they can not change their owner.
+  void swap_inline(PODArrayBase& other) {
+    if (!is_inline())
+      return other.swap_inline(*this);
+
+    size_t bytes = c_end_ - c_start_;
+    if (other.is_inline()) {
+      char tmp[INLINE_BYTES ? INLINE_BYTES : 1];
+      size_t other_bytes = other.c_end_ - other.c_start_;
+      memcpy(tmp, c_start_, bytes);
+      memcpy(c_start_, other.c_start_, other_bytes);
+      memcpy(other.c_start_, tmp, bytes);
+      c_end_ = c_start_ + other_bytes;
+      other.c_end_ = other.c_start_ + bytes;
+      return;
+    }
+
+    // Takes the heap storage of other and gives it the inline elements.
+    char* start = other.c_start_;
+    char* end = other.c_end_;
+    char* end_of_storage = other.c_end_of_storage_;
+    memcpy(other.inline_data(), c_start_, bytes);
+    other.set_inline(bytes);
+    c_start_ = start;
+    c_end_ = end;
+    c_end_of_storage_ = end_of_storage;
+  }
 };
 
 
-// PODArray
-template <typename T, size_t ALIGNMENT = 16 >
-    class PODArray : public PODArrayBase<sizeof(T), ALIGNMENT> {
+// PODArray. With INLINE_COUNT > 0 the first INLINE_COUNT elements are stored inside the object
+// and the memory resource is used only when the array grows beyond them.
+template <typename T, size_t ALIGNMENT = 16, size_t INLINE_COUNT = 0>
+    class PODArray : public PODArrayBase<sizeof(T), ALIGNMENT, sizeof(T) * INLINE_COUNT> {
  private:
-  typedef PODArrayBase<sizeof(T), ALIGNMENT> ParentClass;
+  typedef PODArrayBase<sizeof(T), ALIGNMENT, sizeof(T) * INLINE_COUNT> ParentClass;
   using ParentClass::c_start_;
   using ParentClass::c_end_;
   using ParentClass::c_end_of_storage_;
@@ -327,9 +394,14 @@ public:
   }
 };
 
-template <typename T, size_t pad_right_>
-void swap(PODArray<T, pad_right_> & lhs, PODArray<T, pad_right_> & rhs) {
+template <typename T, size_t pad_right_, size_t N>
+void swap(PODArray<T, pad_right_, N> & lhs, PODArray<T, pad_right_, N> & rhs) {
   lhs.swap(rhs);
 }
 
+// Small array for the hot paths that create a few elements per record, like the fields of
+// a parsed line. Does not allocate while it has at most N elements.
+template <typename T, size_t N, size_t ALIGNMENT = alignof(T)>
+    using InlinedPODArray = PODArray<T, ALIGNMENT, N>;
+
 }
@@ -10,6 +10,23 @@ namespace base {
 class PodArrayTest {
 };
 
+class CountingResource : public pmr::memory_resource {
+ public:
+  unsigned allocs = 0;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++allocs;
+    return pmr::get_default_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    pmr::get_default_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const pmr::memory_resource& o) const noexcept override { return this == &o; }
+};
+
 
 TEST(BitsTest, Padded) {
   PODArray<uint16, 16> arr;
@@ -32,4 +49,45 @@ TEST(BitsTest, Padded) {
   EXPECT_EQ(2048, arr.capacity());
 }
 
+TEST(BitsTest, Inlined) {
+  CountingResource mr;
+  {
+    InlinedPODArray<uint32_t, 8> arr(&mr);
+    EXPECT_EQ(8, arr.capacity());
+    for (unsigned i = 0; i < 8; ++i)
+      arr.push_back(i);
+    EXPECT_EQ(0, mr.allocs);
+
+    arr.push_back(8);
+    EXPECT_EQ(1, mr.allocs);
+    EXPECT_EQ(16, arr.capacity());
+    for (unsigned i = 0; i < 9; ++i) {
+      ASSERT_EQ(i, arr[i]);
+    }
+
+    InlinedPODArray<uint32_t, 8> small(&mr);
+    small.push_back(100);
+    small.swap(arr);
+    ASSERT_EQ(9, small.size());
+    EXPECT_EQ(8, small.back());
+    ASSERT_EQ(1, arr.size());
+    EXPECT_EQ(100, arr[0]);
+    EXPECT_EQ(8, arr.capacity());
+
+    InlinedPODArray<uint32_t, 8> moved(std::move(arr));
+    ASSERT_EQ(1, moved.size());
+    EXPECT_EQ(100, moved[0]);
+    EXPECT_TRUE(arr.empty());
+
+    uint32_t src[3] = {1, 2, 3};
+    arr.insert(src, src + 3);
+    arr.swap(moved);
+    EXPECT_EQ(3, moved.size());
+    EXPECT_EQ(3, moved.back());
+    EXPECT_EQ(100, arr.front());
+  }
+  EXPECT_EQ(1, mr.allocs);
+  EXPECT_GT(sizeof(InlinedPODArray<uint32_t, 8>), sizeof(PODArray<uint32_t>));
+}
+
 }  // namespace base
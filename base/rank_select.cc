@@ -0,0 +1,294 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/rank_select.h"
+
+#include "base/endian.h"
+#include "base/table_format.h"
+
+namespace base {
+
+using namespace std;
+
+void RankSelectBitVector::Build(const uint64_t* words, uint64_t size) {
+  size_ = size;
+  num_blocks_ = (size + kBlockBits - 1) / kBlockBits;
+  CHECK_LT(num_blocks_, UINT32_MAX);
+
+  blocks_storage_.assign(num_blocks_ * kBlockWords + 1, 0);
+  uint64_t num_words = (size + 63) / 64;
+  uint64_t ones = 0;
+
+  for (uint64_t b = 0; b < num_blocks_; ++b) {
+    uint64_t* block = blocks_storage_.data() + b * kBlockWords;
+    uint64_t counts = 0;
+    unsigned in_block = 0;
+
+    block[0] = ones;
+    for (unsigned w = 0; w < 8; ++w) {
+      uint64_t index = b * 8 + w;
+      uint64_t word = index < num_words ? words[index] : 0;
+      if (index == num_words - 1 && size % 64)
+        word &= (1ULL << (size % 64)) - 1;
+
+      if (w)
+        counts |= uint64_t(in_block) << (9 * (w - 1));
+      block[2 + w] = word;
+      in_block += Bits::CountOnes64(word);
+    }
+
+    block[1] = counts;
+    ones += in_block;
+  }
+  blocks_storage_.back() = ones;
+  ones_ = ones;
+  blocks_ = blocks_storage_.data();
+
+  BuildSamples();
+}
+
+void RankSelectBitVector::SetSampleCounts() {
+  num_samples1_ = (ones_ + kSelectSample - 1) / kSelectSample + 1;
+  num_samples0_ = (size_ - ones_ + kSelectSample - 1) / kSelectSample + 1;
+}
+
+void RankSelectBitVector::BuildSamples() {
+  SetSampleCounts();
+  samples_storage_.assign(num_samples1_ + num_samples0_, 0);
+
+  uint32_t* s1 = samples_storage_.data();
+  uint32_t* s0 = s1 + num_samples1_;
+  uint64_t j1 = 0, j0 = 0;
+
+  // The sample of the j-th one is the block that holds the (j * kSelectSample)-th one.
+  for (uint64_t b = 0; b < num_blocks_; ++b) {
+    uint64_t ones_end = Ones(b + 1);
+    uint64_t zeros_end = min((b + 1) * kBlockBits, size_) - ones_end;
+    for (; j1 + 1 < num_samples1_ && j1 * kSelectSample < ones_end; ++j1)
+      s1[j1] = b;
+    for (; j0 + 1 < num_samples0_ && j0 * kSelectSample < zeros_end; ++j0)
+      s0[j0] = b;
+  }
+
+  // The last samples bound the search of the ones after the last sampled one.
+  uint32_t last = num_blocks_ ? num_blocks_ - 1 : 0;
+  s1[num_samples1_ - 1] = last;
+  s0[num_samples0_ - 1] = last;
+
+  select1_ = s1;
+  select0_ = s0;
+}
+
+uint64_t RankSelectBitVector::Select1(uint64_t k) const {
+  DCHECK_LT(k, ones_);
+
+  // Finds the last block that starts with at most k ones.
+  uint64_t lo = select1_[k / kSelectSample], hi = select1_[k / kSelectSample + 1];
+  while (lo < hi) {
+    uint64_t mid = (lo + hi + 1) / 2;
+    if (Ones(mid) <= k)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  const uint64_t* block = blocks_ + lo * kBlockWords;
+  unsigned rank = k - block[0];
+  unsigned word = 0;
+  while (word < 7 && RelRank(block[1], word + 1) <= rank)
+    ++word;
+  if (word)
+    rank -= RelRank(block[1], word);
+
+  return lo * kBlockBits + word * 64 + Bits::Select64(block[2 + word], rank);
+}
+
+uint64_t RankSelectBitVector::Select0(uint64_t k) const {
+  DCHECK_LT(k, size_ - ones_);
+
+  uint64_t lo = select0_[k / kSelectSample], hi = select0_[k / kSelectSample + 1];
+  while (lo < hi) {
+    uint64_t mid = (lo + hi + 1) / 2;
+    if (Zeros(mid) <= k)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  const uint64_t* block = blocks_ + lo * kBlockWords;
+  unsigned rank = k - Zeros(lo);
+  unsigned word = 0;
+  while (word < 7 && (word + 1) * 64 - RelRank(block[1], word + 1) <= rank)
+    ++word;
+  if (word)
+    rank -= word * 64 - RelRank(block[1], word);
+
+  return lo * kBlockBits + word * 64 + Bits::Select64(~block[2 + word], rank);
+}
+
+void RankSelectBitVector::Serialize(std::string* dest) const {
+  CHECK(blocks_) << "Not built";
+  table_internal::StartTable(TableKind::BIT_VECTOR, sizeof(uint64_t), size_, dest);
+  dest->append(reinterpret_cast<const char*>(blocks_),
+               (num_blocks_ * kBlockWords + 1) * sizeof(uint64_t));
+  table_internal::PadSection(dest);
+
+  dest->append(reinterpret_cast<const char*>(select1_), num_samples1_ * sizeof(uint32_t));
+  dest->append(reinterpret_cast<const char*>(select0_), num_samples0_ * sizeof(uint32_t));
+  table_internal::FinishTable(dest);
+}
+
+bool RankSelectBitVector::Init(const uint8_t* src, size_t size, bool verify_crc) {
+  *this = RankSelectBitVector{};
+
+  if (reinterpret_cast<uintptr_t>(src) % alignof(uint64_t) != 0)
+    return false;
+
+  uint64_t count = 0;
+  const uint8_t* body = table_internal::ParseTable(src, size, TableKind::BIT_VECTOR,
+                                                   sizeof(uint64_t), verify_crc, &count);
+  if (!body)
+    return false;
+
+  size_t body_size = size - (body - src);
+  uint64_t num_blocks = (count + kBlockBits - 1) / kBlockBits;
+  if (num_blocks >= body_size / (kBlockWords * sizeof(uint64_t)) + 1)
+    return false;
+
+  size_t blocks_size =
+      table_internal::AlignUp((num_blocks * kBlockWords + 1) * sizeof(uint64_t));
+  if (blocks_size > body_size)
+    return false;
+
+  const uint64_t* blocks = reinterpret_cast<const uint64_t*>(body);
+  uint64_t ones = blocks[num_blocks * kBlockWords];
+  if (ones > count)
+    return false;
+
+  size_ = count;
+  ones_ = ones;
+  num_blocks_ = num_blocks;
+  SetSampleCounts();
+
+  size_t samples_size = (num_samples1_ + num_samples0_) * sizeof(uint32_t);
+  if (table_internal::AlignUp(samples_size) != body_size - blocks_size) {
+    *this = RankSelectBitVector{};
+    return false;
+  }
+
+  blocks_ = blocks;
+  select1_ = reinterpret_cast<const uint32_t*>(body + blocks_size);
+  select0_ = select1_ + num_samples1_;
+  return true;
+}
+
+void EliasFanoSet::Build(const uint64_t* values, size_t count) {
+  size_ = count;
+  max_ = count ? values[count - 1] : 0;
+
+  // The universe is [0, max_].
+  low_bits_ = 0;
+  if (count && max_ / count > 0)
+    low_bits_ = Bits::Log2Floor64(max_ / count);
+
+  low_storage_.assign(NumLowWords(), 0);
+  uint64_t num_high = count + (max_ >> low_bits_) + 1;
+  vector<uint64_t> high((num_high + 63) / 64, 0);
+  uint64_t mask = low_bits_ ? (1ULL << low_bits_) - 1 : 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t val = values[i];
+    DCHECK(i == 0 || values[i - 1] <= val) << i;
+
+    uint64_t pos = (val >> low_bits_) + i;
+    high[pos / 64] |= 1ULL << (pos % 64);
+
+    if (low_bits_) {
+      uint64_t low = val & mask, bit = i * low_bits_;
+      unsigned shift = bit % 64;
+      low_storage_[bit / 64] |= low << shift;
+      if (shift + low_bits_ > 64)
+        low_storage_[bit / 64 + 1] |= low >> (64 - shift);
+    }
+  }
+
+  low_ = low_storage_.data();
+  high_.Build(high.data(), num_high);
+}
+
+size_t EliasFanoSet::LowerBound(uint64_t val) const {
+  if (size_ == 0 || val > max_)
+    return size_;
+
+  // The values with the high bits h follow the h-th zero, 1-indexed.
+  uint64_t bucket = val >> low_bits_;
+  uint64_t pos = bucket ? high_.Select0(bucket - 1) + 1 : 0;
+  size_t i = pos - bucket;
+  uint64_t low = val & (low_bits_ ? (1ULL << low_bits_) - 1 : 0);
+
+  // The scan stops at the end of the bucket, the values of the next buckets are greater.
+  // It always stops before the end since val <= max_.
+  for (; high_[pos]; ++pos, ++i) {
+    if (Low(i) >= low)
+      break;
+  }
+  return i;
+}
+
+void EliasFanoSet::Serialize(std::string* dest) const {
+  CHECK(low_) << "Not built";
+  table_internal::StartTable(TableKind::ELIAS_FANO, sizeof(uint64_t), size_, dest);
+
+  char buf[8];
+  LittleEndian::Store64(buf, low_bits_);
+  dest->append(buf, sizeof(buf));
+  table_internal::PadSection(dest);
+
+  dest->append(reinterpret_cast<const char*>(low_), NumLowWords() * sizeof(uint64_t));
+  table_internal::PadSection(dest);
+
+  string high;
+  high_.Serialize(&high);
+  dest->append(high);
+  table_internal::FinishTable(dest);
+}
+
+bool EliasFanoSet::Init(const uint8_t* src, size_t size, bool verify_crc) {
+  *this = EliasFanoSet{};
+
+  if (reinterpret_cast<uintptr_t>(src) % alignof(uint64_t) != 0)
+    return false;
+
+  uint64_t count = 0;
+  const uint8_t* body = table_internal::ParseTable(src, size, TableKind::ELIAS_FANO,
+                                                   sizeof(uint64_t), verify_crc, &count);
+  if (!body)
+    return false;
+
+  size_t body_size = size - (body - src);
+  if (body_size < kTableAlignment)
+    return false;
+
+  uint64_t low_bits = LittleEndian::Load64(body);
+  if (low_bits >= 64 || count > body_size * 8)
+    return false;
+
+  size_ = count;
+  low_bits_ = low_bits;
+  size_t low_size = table_internal::AlignUp(NumLowWords() * sizeof(uint64_t));
+
+  // The whole table has been verified already, no need to verify the part of the high bits.
+  size_t high_offset = kTableAlignment + low_size;
+  if (high_offset > body_size ||
+      !high_.Init(body + high_offset, body_size - high_offset, false) ||
+      high_.num_ones() != count) {
+    *this = EliasFanoSet{};
+    return false;
+  }
+
+  low_ = reinterpret_cast<const uint64_t*>(body + kTableAlignment);
+  max_ = count ? (*this)[count - 1] : 0;
+  return true;
+}
+
+}  // namespace base
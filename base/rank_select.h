@@ -0,0 +1,190 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "base/bits.h"
+#include "base/logging.h"
+
+namespace base {
+
+/* Immutable bit vector with O(1) Rank and fast Select, the rank9 layout of
+   "Broadword Implementation of Rank/Select Queries" by S. Vigna.
+
+   The bits are split into blocks of 512 bits. Each block is stored as 10 words: the number of
+   the ones before the block, the 9 bit counts of the ones before each of its words 1..7 and the
+   8 words of the bits themselves. Interleaving the counts with the bits makes Rank touch
+   a single block, at the cost of 25% space. Select looks up a sample of the block of every
+   kSelectSample-th one (zero for Select0), binary searches the blocks between two samples and
+   then selects within a word.
+
+   Serialize writes a BIT_VECTOR table of base/table_format.h, which Init uses in place:
+     body: uint64 blocks[num_blocks * 10 + 1], the last word is the total number of ones.
+           uint32 select1_samples[], uint32 select0_samples[].
+*/
+class RankSelectBitVector {
+ public:
+  static constexpr unsigned kBlockBits = 512;
+  static constexpr unsigned kBlockWords = 10;
+  static constexpr unsigned kSelectSample = 512;
+
+  RankSelectBitVector() = default;
+  RankSelectBitVector(RankSelectBitVector&&) = default;
+  RankSelectBitVector& operator=(RankSelectBitVector&&) = default;
+
+  // Copies size bits from words, the bit i is (words[i / 64] >> (i % 64)) & 1.
+  void Build(const uint64_t* words, uint64_t size);
+
+  // src must be aligned to 8 bytes. Returns false if it does not hold a bit vector.
+  // The select samples are not validated, hence without verify_crc the table must come
+  // from a trusted source. Does not copy the table and must not outlive the buffer.
+  bool Init(const uint8_t* src, size_t size, bool verify_crc = true);
+
+  // Overwrites dest with the serialized bit vector.
+  void Serialize(std::string* dest) const;
+
+  uint64_t size() const { return size_; }
+  uint64_t num_ones() const { return ones_; }
+
+  // The size of the rank and select structures together with the bits.
+  size_t bytes() const {
+    return (num_blocks_ * kBlockWords + 1) * sizeof(uint64_t) +
+           (num_samples1_ + num_samples0_) * sizeof(uint32_t);
+  }
+
+  bool operator[](uint64_t i) const {
+    DCHECK_LT(i, size_);
+    return (blocks_[i / kBlockBits * kBlockWords + 2 + i / 64 % 8] >> (i % 64)) & 1;
+  }
+
+  // Returns the number of ones in [0, i), i <= size().
+  uint64_t Rank1(uint64_t i) const {
+    DCHECK_LE(i, size_);
+    const uint64_t* block = blocks_ + i / kBlockBits * kBlockWords;
+    unsigned word = i / 64 % 8, bit = i % 64;
+
+    // The sentinel block at the end has only the first word.
+    uint64_t res = block[0] + (word ? RelRank(block[1], word) : 0);
+    if (bit)
+      res += Bits::CountOnes64(block[2 + word] << (64 - bit));
+    return res;
+  }
+
+  uint64_t Rank0(uint64_t i) const { return i - Rank1(i); }
+
+  // Returns the position of the k-th one, 0-indexed. k must be less than num_ones().
+  uint64_t Select1(uint64_t k) const;
+
+  // Returns the position of the k-th zero, 0-indexed. k must be less than size() - num_ones().
+  uint64_t Select0(uint64_t k) const;
+
+ private:
+  // The number of the ones in the words before word of a block, word is in [1, 8).
+  static unsigned RelRank(uint64_t counts, unsigned word) {
+    return (counts >> (9 * (word - 1))) & 0x1FF;
+  }
+
+  uint64_t Ones(uint64_t block) const { return blocks_[block * kBlockWords]; }
+  uint64_t Zeros(uint64_t block) const { return block * kBlockBits - Ones(block); }
+
+  void SetSampleCounts();
+
+  // Computes the select samples of the blocks.
+  void BuildSamples();
+
+  uint64_t size_ = 0, ones_ = 0, num_blocks_ = 0;
+  uint64_t num_samples1_ = 0, num_samples0_ = 0;
+
+  const uint64_t* blocks_ = nullptr;
+  const uint32_t* select1_ = nullptr;
+  const uint32_t* select0_ = nullptr;
+
+  // Set by Build, empty if the vector is a view.
+  std::vector<uint64_t> blocks_storage_;
+  std::vector<uint32_t> samples_storage_;
+
+  RankSelectBitVector(const RankSelectBitVector&) = delete;
+  void operator=(const RankSelectBitVector&) = delete;
+};
+
+/* Sorted sequence of integers in Elias-Fano representation, about 2 + log2(universe / size)
+   bits per element, i.e. a few bits for a dense set compared to the 16+ bytes of a hash set.
+
+   The low log2(universe / size) bits of the values are stored packed and the high bits
+   in unary, as the bit vector where the value i sets the bit (value >> low_bits) + i. Access
+   takes a Select1 on that vector and LowerBound a Select0 followed by a scan of a bucket,
+   which holds about a single value.
+
+   Serialize writes an ELIAS_FANO table of base/table_format.h, which Init uses in place:
+     body: uint64 low_bits, padded to kTableAlignment.
+           uint64 low_words[], the packed low bits.
+           The BIT_VECTOR table of the high bits.
+*/
+class EliasFanoSet {
+ public:
+  EliasFanoSet() = default;
+  EliasFanoSet(EliasFanoSet&&) = default;
+  EliasFanoSet& operator=(EliasFanoSet&&) = default;
+
+  // values must be sorted in non-decreasing order.
+  void Build(const uint64_t* values, size_t count);
+
+  void Build(const std::vector<uint64_t>& values) { Build(values.data(), values.size()); }
+
+  // src must be aligned to 8 bytes. Returns false if it does not hold an Elias-Fano set.
+  // Does not copy the table and must not outlive the buffer.
+  bool Init(const uint8_t* src, size_t size, bool verify_crc = true);
+
+  // Overwrites dest with the serialized set.
+  void Serialize(std::string* dest) const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t bytes() const { return NumLowWords() * sizeof(uint64_t) + high_.bytes(); }
+
+  uint64_t operator[](size_t i) const {
+    DCHECK_LT(i, size_);
+    return ((high_.Select1(i) - i) << low_bits_) | Low(i);
+  }
+
+  // Returns the index of the first value that is not less than val, size() if there is none.
+  size_t LowerBound(uint64_t val) const;
+
+  bool Contains(uint64_t val) const {
+    size_t i = LowerBound(val);
+    return i < size_ && (*this)[i] == val;
+  }
+
+ private:
+  uint64_t Low(size_t i) const {
+    if (low_bits_ == 0)
+      return 0;
+    uint64_t bit = i * low_bits_;
+    unsigned shift = bit % 64;
+    const uint64_t* word = low_ + bit / 64;
+
+    // The low words are padded with a word, so reading the next one is safe.
+    uint64_t res = word[0] >> shift;
+    if (shift + low_bits_ > 64)
+      res |= word[1] << (64 - shift);
+    return res & ((1ULL << low_bits_) - 1);
+  }
+
+  size_t NumLowWords() const { return (size_ * low_bits_ + 63) / 64 + 1; }
+
+  RankSelectBitVector high_;
+  const uint64_t* low_ = nullptr;
+  std::vector<uint64_t> low_storage_;
+
+  size_t size_ = 0;
+  uint64_t max_ = 0;
+  unsigned low_bits_ = 0;
+
+  EliasFanoSet(const EliasFanoSet&) = delete;
+  void operator=(const EliasFanoSet&) = delete;
+};
+
+}  // namespace base
@@ -0,0 +1,210 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/rank_select.h"
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/table_format.h"
+
+namespace base {
+
+using namespace std;
+
+class RankSelectTest : public testing::Test {
+ protected:
+  // Copies the table into 64 byte aligned buffer, like a mmap-ed file.
+  const uint8_t* Aligned(const string& table) {
+    buf_.reset(new Cell[table.size() / sizeof(Cell) + 1]);
+    memcpy(buf_.get(), table.data(), table.size());
+    return reinterpret_cast<const uint8_t*>(buf_.get());
+  }
+
+  // Compares bv with the naive rank and select of bits.
+  static void Verify(const vector<bool>& bits, const RankSelectBitVector& bv) {
+    ASSERT_EQ(bits.size(), bv.size());
+
+    uint64_t ones = 0, zeros = 0;
+    for (uint64_t i = 0; i < bits.size(); ++i) {
+      ASSERT_EQ(ones, bv.Rank1(i)) << i;
+      ASSERT_EQ(bits[i], bv[i]) << i;
+      if (bits[i]) {
+        ASSERT_EQ(i, bv.Select1(ones)) << i;
+        ++ones;
+      } else {
+        ASSERT_EQ(i, bv.Select0(zeros)) << i;
+        ++zeros;
+      }
+    }
+    EXPECT_EQ(ones, bv.Rank1(bits.size()));
+    EXPECT_EQ(ones, bv.num_ones());
+  }
+
+  static RankSelectBitVector Build(const vector<bool>& bits) {
+    vector<uint64_t> words((bits.size() + 63) / 64, 0);
+    for (size_t i = 0; i < bits.size(); ++i) {
+      if (bits[i])
+        words[i / 64] |= 1ULL << (i % 64);
+    }
+    RankSelectBitVector bv;
+    bv.Build(words.data(), bits.size());
+    return bv;
+  }
+
+  struct alignas(kTableAlignment) Cell {
+    uint8_t bytes[kTableAlignment];
+  };
+  unique_ptr<Cell[]> buf_;
+};
+
+TEST_F(RankSelectTest, BitVector) {
+  std::mt19937_64 rnd(10);
+
+  // Sizes around the block boundaries, densities from sparse to dense.
+  for (uint64_t size : {0, 1, 63, 64, 511, 512, 513, 5000, 100000}) {
+    for (unsigned percent : {0, 1, 50, 99, 100}) {
+      vector<bool> bits(size);
+      for (size_t i = 0; i < size; ++i)
+        bits[i] = rnd() % 100 < percent;
+
+      SCOPED_TRACE(testing::Message() << size << " " << percent);
+      RankSelectBitVector bv = Build(bits);
+      Verify(bits, bv);
+    }
+  }
+}
+
+TEST_F(RankSelectTest, SerializeBitVector) {
+  vector<bool> bits(3000);
+  for (size_t i = 0; i < bits.size(); i += 7)
+    bits[i] = true;
+
+  string table;
+  Build(bits).Serialize(&table);
+  EXPECT_EQ(0, table.size() % kTableAlignment);
+
+  const uint8_t* src = Aligned(table);
+  RankSelectBitVector bv;
+  ASSERT_TRUE(bv.Init(src, table.size()));
+  Verify(bits, bv);
+
+  EXPECT_FALSE(bv.Init(src, table.size() - kTableAlignment));
+  EXPECT_FALSE(bv.Init(src + 1, table.size() - 1));
+  EXPECT_EQ(0, bv.size());
+
+  PODArrayView<uint64_t> pod;
+  EXPECT_FALSE(pod.Init(src, table.size()));
+
+  buf_[2].bytes[0] ^= 1;
+  EXPECT_FALSE(bv.Init(src, table.size()));
+}
+
+TEST_F(RankSelectTest, EliasFano) {
+  std::mt19937_64 rnd(10);
+
+  vector<uint64_t> values;
+  for (uint64_t val = 0; values.size() < 10000; val += 1 + rnd() % 1000)
+    values.push_back(val);
+
+  EliasFanoSet set;
+  set.Build(values);
+  ASSERT_EQ(values.size(), set.size());
+
+  // About 2 + log2(500) bits per value.
+  EXPECT_LT(set.bytes(), values.size() * 2);
+
+  for (size_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values[i], set[i]) << i;
+  }
+
+  for (unsigned j = 0; j < 10000; ++j) {
+    uint64_t val = rnd() % (values.back() + 10);
+    size_t expected = lower_bound(values.begin(), values.end(), val) - values.begin();
+    ASSERT_EQ(expected, set.LowerBound(val)) << val;
+    ASSERT_EQ(expected < values.size() && values[expected] == val, set.Contains(val));
+  }
+  EXPECT_TRUE(set.Contains(values.back()));
+  EXPECT_FALSE(set.Contains(values.back() + 1));
+
+  // Duplicates and a dense universe with no low bits.
+  set.Build(vector<uint64_t>{0, 0, 1, 3, 3, 3, 4});
+  EXPECT_EQ(0, set.LowerBound(0));
+  EXPECT_EQ(3, set.LowerBound(2));
+  EXPECT_EQ(6, set.LowerBound(4));
+  EXPECT_EQ(7, set.LowerBound(5));
+  EXPECT_EQ(3, set[5]);
+
+  set.Build(vector<uint64_t>{});
+  EXPECT_TRUE(set.empty());
+  EXPECT_FALSE(set.Contains(0));
+
+  set.Build(vector<uint64_t>{1ULL << 62, (1ULL << 63) + 5});
+  EXPECT_EQ((1ULL << 63) + 5, set[1]);
+  EXPECT_TRUE(set.Contains(1ULL << 62));
+  EXPECT_FALSE(set.Contains(5));
+}
+
+TEST_F(RankSelectTest, SerializeEliasFano) {
+  vector<uint64_t> values;
+  for (uint64_t i = 0; i < 5000; ++i)
+    values.push_back(i * i);
+
+  EliasFanoSet set;
+  set.Build(values);
+  string table;
+  set.Serialize(&table);
+
+  const uint8_t* src = Aligned(table);
+  EliasFanoSet view;
+  ASSERT_TRUE(view.Init(src, table.size()));
+  ASSERT_EQ(values.size(), view.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values[i], view[i]);
+  }
+  EXPECT_TRUE(view.Contains(49));
+  EXPECT_FALSE(view.Contains(50));
+
+  EXPECT_FALSE(view.Init(src, table.size() - kTableAlignment));
+  RankSelectBitVector bv;
+  EXPECT_FALSE(bv.Init(src, table.size()));
+
+  set.Build(vector<uint64_t>{});
+  set.Serialize(&table);
+  ASSERT_TRUE(view.Init(Aligned(table), table.size()));
+  EXPECT_TRUE(view.empty());
+}
+
+static void BM_Select1(benchmark::State& state) {
+  std::mt19937_64 rnd(10);
+  vector<uint64_t> words(1 << 16);
+  for (auto& w : words)
+    w = rnd();
+
+  RankSelectBitVector bv;
+  bv.Build(words.data(), words.size() * 64);
+  uint64_t k = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(bv.Select1(k));
+    k = (k + 7919) % bv.num_ones();
+  }
+}
+BENCHMARK(BM_Select1);
+
+static void BM_EliasFanoContains(benchmark::State& state) {
+  std::mt19937_64 rnd(10);
+  vector<uint64_t> values;
+  for (uint64_t val = 0; values.size() < (1 << 20); val += 1 + rnd() % 64)
+    values.push_back(val);
+
+  EliasFanoSet set;
+  set.Build(values);
+  uint64_t val = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(set.Contains(val));
+    val = (val + 7919) % values.back();
+  }
+}
+BENCHMARK(BM_EliasFanoContains);
+
+}  // namespace base
@@ -7,6 +7,8 @@
 
 #include <x86intrin.h>
 
+#include <algorithm>
+
 namespace base {
 
 // Returns 16bit mask saying which byte in p equals to the appropriate byte in cx16.
@@ -15,6 +17,24 @@ inline uint16_t EqualChar16(const void* p, __m128i cx16) {
   return _mm_movemask_epi8(_mm_cmpeq_epi8(cx16, *(const __m128i*)p));
 }
 
+namespace {
+
+template <typename T> void DeltasScalar(T* buffer, size_t length, T prev) {
+  for (size_t i = 0; i < length; ++i) {
+    T curr = buffer[i];
+    buffer[i] = curr - prev;
+    prev = curr;
+  }
+}
+
+template <typename T> void PrefixSumScalar(T* buffer, size_t length, T run) {
+  for (size_t i = 0; i < length; ++i) {
+    run += buffer[i];
+    buffer[i] = run;
+  }
+}
+
+}  // namespace
 
 // Based on https://mischasan.wordpress.com/2011/11/09/the-generic-sse2-loop/
 size_t CountVal8(const uint8_t* ptr, size_t len, char c) {
@@ -50,6 +70,67 @@ size_t CountVal8(const uint8_t* ptr, size_t len, char c) {
   return res;
 }
 
+size_t CountVal(const uint16_t* ptr, size_t len, uint16_t val) {
+  const __m128i vx8 = _mm_set1_epi16(val);
+  size_t res = 0, i = 0;
+
+  for (; i + 8 <= len; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+    res += Bits::CountOnes(_mm_movemask_epi8(_mm_cmpeq_epi16(v, vx8)));
+  }
+  res /= 2;  // 2 mask bits per match.
+
+  for (; i < len; ++i)
+    res += (ptr[i] == val);
+  return res;
+}
+
+size_t CountVal(const uint32_t* ptr, size_t len, uint32_t val) {
+  const __m128i vx4 = _mm_set1_epi32(val);
+  size_t res = 0, i = 0;
+
+  for (; i + 4 <= len; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+    res += Bits::CountOnes(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, vx4))));
+  }
+
+  for (; i < len; ++i)
+    res += (ptr[i] == val);
+  return res;
+}
+
+size_t FindFirstOf(const uint8_t* ptr, size_t len, const char* chars, size_t num_chars) {
+  size_t i = 0;
+  bool in_set[256] = {false};
+  for (size_t j = 0; j < num_chars; ++j)
+    in_set[uint8_t(chars[j])] = true;
+
+  // Up to kMaxChars characters are compared in registers, larger sets use the table.
+  constexpr size_t kMaxChars = 8;
+  if (num_chars <= kMaxChars) {
+    __m128i cx16[kMaxChars];
+    for (size_t j = 0; j < num_chars; ++j)
+      cx16[j] = _mm_set1_epi8(chars[j]);
+
+    for (; i + 16 <= len; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+      __m128i eq = _mm_setzero_si128();
+      for (size_t j = 0; j < num_chars; ++j)
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, cx16[j]));
+
+      unsigned mask = _mm_movemask_epi8(eq);
+      if (mask)
+        return i + __builtin_ctz(mask);
+    }
+  }
+
+  for (; i < len; ++i) {
+    if (in_set[ptr[i]])
+      return i;
+  }
+  return len;
+}
+
 #ifdef __SSE4_1__
 
 // taken from: https://github.com/lemire/FastDifferentialCoding/blob/master/src/fastdelta.c
@@ -82,7 +163,7 @@ void ComputeDeltasInplace(uint32_t* buffer, size_t length, uint32_t starting_poi
 }
 
 void ComputeDeltasInplace(uint16_t* buffer, size_t length, uint16_t starting_point) {
-  __m128i prev = _mm_set1_epi32(starting_point); // starting_point replicated 4 times.
+  __m128i prev = _mm_set1_epi16(starting_point); // starting_point replicated 8 times.
   size_t i = 0;
   __m128i* buf16 = (__m128i*)buffer;
 
@@ -109,6 +190,240 @@ void ComputeDeltasInplace(uint16_t* buffer, size_t length, uint16_t starting_poi
   }
 }
 
+#else
+
+void ComputeDeltasInplace(uint32_t* buffer, size_t length, uint32_t starting_point) {
+  DeltasScalar(buffer, length, starting_point);
+}
+
+void ComputeDeltasInplace(uint16_t* buffer, size_t length, uint16_t starting_point) {
+  DeltasScalar(buffer, length, starting_point);
+}
+
 #endif
 
+void ComputeDeltasInplace(uint64_t* buffer, size_t length, uint64_t starting_point) {
+  __m128i prev = _mm_set1_epi64x(starting_point);
+  __m128i* buf16 = reinterpret_cast<__m128i*>(buffer);
+  size_t i = 0;
+
+  for (; i < length / 2; ++i) {
+    __m128i curr = _mm_loadu_si128(buf16 + i);
+
+    // cur[0], prev[1].
+    __m128i val = _mm_or_si128(_mm_slli_si128(curr, 8), _mm_srli_si128(prev, 8));
+    _mm_storeu_si128(buf16 + i, _mm_sub_epi64(curr, val));
+    prev = curr;
+  }
+
+  DeltasScalar(buffer + 2 * i, length - 2 * i, uint64_t(_mm_cvtsi128_si64(
+                                                   _mm_unpackhi_epi64(prev, prev))));
+}
+
+void PrefixSumInplace(uint32_t* buffer, size_t length, uint32_t starting_point) {
+  __m128i run = _mm_set1_epi32(starting_point);
+  __m128i* buf16 = reinterpret_cast<__m128i*>(buffer);
+  size_t i = 0;
+
+  for (; i < length / 4; ++i) {
+    // Sums in log steps: [a, a+b, b+c, c+d], then [a, a+b, a+b+c, a+b+c+d].
+    __m128i v = _mm_loadu_si128(buf16 + i);
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, run);
+    _mm_storeu_si128(buf16 + i, v);
+    run = _mm_shuffle_epi32(v, 0xff);  // broadcasts the last lane.
+  }
+
+  PrefixSumScalar(buffer + 4 * i, length - 4 * i, uint32_t(_mm_cvtsi128_si32(run)));
+}
+
+void PrefixSumInplace(uint16_t* buffer, size_t length, uint16_t starting_point) {
+  __m128i run = _mm_set1_epi16(starting_point);
+  __m128i* buf16 = reinterpret_cast<__m128i*>(buffer);
+  size_t i = 0;
+
+  for (; i < length / 8; ++i) {
+    __m128i v = _mm_loadu_si128(buf16 + i);
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi16(v, run);
+    _mm_storeu_si128(buf16 + i, v);
+
+    // Broadcasts the last lane: replicates it within the upper half, then copies that half.
+    __m128i hi = _mm_shufflehi_epi16(v, 0xff);
+    run = _mm_unpackhi_epi64(hi, hi);
+  }
+
+  PrefixSumScalar(buffer + 8 * i, length - 8 * i, uint16_t(_mm_extract_epi16(run, 0)));
+}
+
+void PrefixSumInplace(uint64_t* buffer, size_t length, uint64_t starting_point) {
+  __m128i run = _mm_set1_epi64x(starting_point);
+  __m128i* buf16 = reinterpret_cast<__m128i*>(buffer);
+  size_t i = 0;
+
+  for (; i < length / 2; ++i) {
+    __m128i v = _mm_loadu_si128(buf16 + i);
+    v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi64(v, run);
+    _mm_storeu_si128(buf16 + i, v);
+    run = _mm_unpackhi_epi64(v, v);
+  }
+
+  PrefixSumScalar(buffer + 2 * i, length - 2 * i, uint64_t(_mm_cvtsi128_si64(run)));
+}
+
+void ZigZagEncode(const int32_t* src, size_t length, uint32_t* dest) {
+  size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i res = _mm_xor_si128(_mm_slli_epi32(v, 1), _mm_srai_epi32(v, 31));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), res);
+  }
+  for (; i < length; ++i) {
+    dest[i] = (uint32_t(src[i]) << 1) ^ uint32_t(src[i] >> 31);
+  }
+}
+
+void ZigZagEncode(const int64_t* src, size_t length, uint64_t* dest) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+    // SSE2 lacks 64 bit arithmetic shift, sign is all ones for negative values.
+    __m128i sign = _mm_sub_epi64(zero, _mm_srli_epi64(v, 63));
+    __m128i res = _mm_xor_si128(_mm_slli_epi64(v, 1), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), res);
+  }
+  for (; i < length; ++i) {
+    dest[i] = (uint64_t(src[i]) << 1) ^ uint64_t(src[i] >> 63);
+  }
+}
+
+void ZigZagDecode(const uint32_t* src, size_t length, int32_t* dest) {
+  const __m128i one = _mm_set1_epi32(1), zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i sign = _mm_sub_epi32(zero, _mm_and_si128(v, one));
+    __m128i res = _mm_xor_si128(_mm_srli_epi32(v, 1), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), res);
+  }
+  for (; i < length; ++i) {
+    dest[i] = int32_t((src[i] >> 1) ^ -(src[i] & 1));
+  }
+}
+
+void ZigZagDecode(const uint64_t* src, size_t length, int64_t* dest) {
+  const __m128i one = _mm_set1_epi64x(1), zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i sign = _mm_sub_epi64(zero, _mm_and_si128(v, one));
+    __m128i res = _mm_xor_si128(_mm_srli_epi64(v, 1), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), res);
+  }
+  for (; i < length; ++i) {
+    dest[i] = int64_t((src[i] >> 1) ^ -(src[i] & 1));
+  }
+}
+
+void MinMax(const uint32_t* src, size_t length, uint32_t* min, uint32_t* max) {
+  uint32_t mn = UINT32_MAX, mx = 0;
+  size_t i = 0;
+
+#ifdef __SSE4_1__
+  if (length >= 4) {
+    __m128i vmin = _mm_set1_epi32(-1), vmax = _mm_setzero_si128();
+    for (; i + 4 <= length; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      vmin = _mm_min_epu32(vmin, v);
+      vmax = _mm_max_epu32(vmax, v);
+    }
+
+    // Horizontal reduction of the 4 lanes.
+    vmin = _mm_min_epu32(vmin, _mm_shuffle_epi32(vmin, 0x4e));
+    vmin = _mm_min_epu32(vmin, _mm_shuffle_epi32(vmin, 0xb1));
+    vmax = _mm_max_epu32(vmax, _mm_shuffle_epi32(vmax, 0x4e));
+    vmax = _mm_max_epu32(vmax, _mm_shuffle_epi32(vmax, 0xb1));
+    mn = _mm_cvtsi128_si32(vmin);
+    mx = _mm_cvtsi128_si32(vmax);
+  }
+#endif
+
+  for (; i < length; ++i) {
+    mn = std::min(mn, src[i]);
+    mx = std::max(mx, src[i]);
+  }
+  *min = mn;
+  *max = mx;
+}
+
+void MinMax(const uint64_t* src, size_t length, uint64_t* min, uint64_t* max) {
+  uint64_t mn = UINT64_MAX, mx = 0;
+  size_t i = 0;
+
+#ifdef __SSE4_2__
+  if (length >= 2) {
+    // Unsigned comparison via the signed one, with the sign bits flipped.
+    const __m128i flip = _mm_set1_epi64x(int64_t(1ULL << 63));
+    __m128i vmin = _mm_set1_epi64x(INT64_MAX), vmax = _mm_set1_epi64x(INT64_MIN);
+    for (; i + 2 <= length; i += 2) {
+      __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), flip);
+      vmin = _mm_blendv_epi8(vmin, v, _mm_cmpgt_epi64(vmin, v));
+      vmax = _mm_blendv_epi8(vmax, v, _mm_cmpgt_epi64(v, vmax));
+    }
+    vmin = _mm_xor_si128(vmin, flip);
+    vmax = _mm_xor_si128(vmax, flip);
+
+    mn = std::min<uint64_t>(_mm_cvtsi128_si64(vmin),
+                            _mm_cvtsi128_si64(_mm_unpackhi_epi64(vmin, vmin)));
+    mx = std::max<uint64_t>(_mm_cvtsi128_si64(vmax),
+                            _mm_cvtsi128_si64(_mm_unpackhi_epi64(vmax, vmax)));
+  }
+#endif
+
+  for (; i < length; ++i) {
+    mn = std::min(mn, src[i]);
+    mx = std::max(mx, src[i]);
+  }
+  *min = mn;
+  *max = mx;
+}
+
+uint64_t Sum(const uint32_t* src, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t i = 0;
+
+  // Widens the 32 bit lanes into 64 bit accumulators.
+  for (; i + 4 <= length; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+  }
+
+  uint64_t res = _mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+  for (; i < length; ++i)
+    res += src[i];
+  return res;
+}
+
+uint64_t Sum(const uint64_t* src, size_t length) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 2 <= length; i += 2) {
+    acc = _mm_add_epi64(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+  }
+
+  uint64_t res = _mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+  for (; i < length; ++i)
+    res += src[i];
+  return res;
+}
+
 }  // namespace base
@@ -13,9 +13,41 @@ namespace base {
 // Returns how many times val appeared in the range.
 size_t CountVal8(const uint8_t* ptr, size_t len, char val);
 
+// Same as CountVal8 for wider values, but does not access memory outside of the range.
+size_t CountVal(const uint16_t* ptr, size_t len, uint16_t val);
+size_t CountVal(const uint32_t* ptr, size_t len, uint32_t val);
+
+// Returns the index of the first byte in [ptr, ptr+len) that equals one of chars[0..num_chars)
+// or len if there is none.
+size_t FindFirstOf(const uint8_t* ptr, size_t len, const char* chars, size_t num_chars);
+
 // Writes to buffer the successive differences of buffer
 // (buffer[0]-starting_point, buffer[1]-buffer[2], ...)
 void ComputeDeltasInplace(uint32_t * buffer, size_t length, uint32_t starting_point);
 void ComputeDeltasInplace(uint16_t * buffer, size_t length, uint16_t starting_point);
+void ComputeDeltasInplace(uint64_t* buffer, size_t length, uint64_t starting_point);
+
+// The inverse of ComputeDeltasInplace, writes to buffer its running sums
+// (starting_point + buffer[0], starting_point + buffer[0] + buffer[1], ...)
+void PrefixSumInplace(uint32_t* buffer, size_t length, uint32_t starting_point);
+void PrefixSumInplace(uint16_t* buffer, size_t length, uint16_t starting_point);
+void PrefixSumInplace(uint64_t* buffer, size_t length, uint64_t starting_point);
+
+// Maps signed integers to unsigned ones so that values of small magnitude stay small:
+// 0, -1, 1, -2, 2 ... map to 0, 1, 2, 3, 4 ...
+// src and dest can be the same pointer.
+void ZigZagEncode(const int32_t* src, size_t length, uint32_t* dest);
+void ZigZagEncode(const int64_t* src, size_t length, uint64_t* dest);
+void ZigZagDecode(const uint32_t* src, size_t length, int32_t* dest);
+void ZigZagDecode(const uint64_t* src, size_t length, int64_t* dest);
+
+// Reductions. For an empty range min is the maximal value and max is 0.
+void MinMax(const uint32_t* src, size_t length, uint32_t* min, uint32_t* max);
+void MinMax(const uint64_t* src, size_t length, uint64_t* min, uint64_t* max);
+
+uint64_t Sum(const uint32_t* src, size_t length);
+
+// Wraps around on overflow.
+uint64_t Sum(const uint64_t* src, size_t length);
 
 }  // namespace base
@@ -4,6 +4,8 @@
 #include "base/simd.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 #include <gmock/gmock.h>
 
 #include "base/integral_types.h"
@@ -73,6 +75,128 @@ TEST(SimdTest, OverFlow) {
   EXPECT_EQ(30, CountVal8(buf.get() + 2, 30, 1));
 }
 
+TEST(SimdTest, CountVal) {
+  std::vector<uint16_t> v16(37);
+  std::vector<uint32_t> v32(37);
+  for (unsigned i = 0; i < v16.size(); ++i) {
+    v16[i] = v32[i] = i % 3;
+  }
+  for (size_t len = 0; len <= v16.size(); ++len) {
+    size_t expected = std::count(v16.begin(), v16.begin() + len, 2);
+    ASSERT_EQ(expected, CountVal(v16.data(), len, 2)) << len;
+    ASSERT_EQ(expected, CountVal(v32.data(), len, 2)) << len;
+  }
+}
+
+TEST(SimdTest, FindFirstOf) {
+  std::string str(100, 'a');
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(str.data());
+  EXPECT_EQ(str.size(), FindFirstOf(ptr, str.size(), ",;", 2));
+  EXPECT_EQ(0, FindFirstOf(ptr, str.size(), "a", 1));
+  EXPECT_EQ(0, FindFirstOf(ptr, 0, "a", 1));
+
+  for (unsigned pos : {0, 5, 15, 16, 31, 70, 99}) {
+    std::string s = str;
+    s[pos] = ';';
+    ptr = reinterpret_cast<const uint8_t*>(s.data());
+    ASSERT_EQ(pos, FindFirstOf(ptr, s.size(), ",;", 2));
+    ASSERT_EQ(pos, FindFirstOf(ptr, s.size(), "0123456789;", 11));
+    ASSERT_EQ(pos, FindFirstOf(ptr, pos + 1, ";", 1));
+    ASSERT_EQ(pos, FindFirstOf(ptr, pos, ";", 1));
+  }
+}
+
+TEST(SimdTest, PrefixSum) {
+  for (size_t len = 0; len < 40; ++len) {
+    std::vector<uint32_t> v32(len);
+    std::vector<uint16_t> v16(len);
+    std::vector<uint64_t> v64(len);
+    for (unsigned i = 0; i < len; ++i) {
+      v32[i] = v16[i] = i * 7 + 1;
+      v64[i] = (uint64_t(i) << 40) + i * 7 + 1;
+    }
+    auto e32 = v32;
+    auto e16 = v16;
+    auto e64 = v64;
+
+    ComputeDeltasInplace(v32.data(), len, 5);
+    ComputeDeltasInplace(v16.data(), len, 5);
+    ComputeDeltasInplace(v64.data(), len, 5);
+    for (unsigned i = 1; i < len; ++i) {
+      ASSERT_EQ(7, v32[i]);
+      ASSERT_EQ(7, v16[i]);
+      ASSERT_EQ((1ULL << 40) + 7, v64[i]);
+    }
+
+    PrefixSumInplace(v32.data(), len, 5);
+    PrefixSumInplace(v16.data(), len, 5);
+    PrefixSumInplace(v64.data(), len, 5);
+    EXPECT_EQ(e32, v32) << len;
+    EXPECT_EQ(e16, v16) << len;
+    EXPECT_EQ(e64, v64) << len;
+  }
+
+  // Wraps around.
+  uint32_t buf[5] = {UINT32_MAX, 1, 1, UINT32_MAX, 2};
+  PrefixSumInplace(buf, 5, 1);
+  EXPECT_THAT(buf, ElementsAre(0, 1, 2, 1, 3));
+}
+
+TEST(SimdTest, ZigZag) {
+  std::vector<int32_t> s32{0, -1, 1, -2, 2, INT32_MIN, INT32_MAX, -100, 100};
+  std::vector<int64_t> s64{0, -1, 1, -2, 2, INT64_MIN, INT64_MAX, -100, 100};
+  std::vector<uint32_t> u32(s32.size());
+  std::vector<uint64_t> u64(s64.size());
+
+  ZigZagEncode(s32.data(), s32.size(), u32.data());
+  ZigZagEncode(s64.data(), s64.size(), u64.data());
+  EXPECT_THAT(u32, ElementsAre(0, 1, 2, 3, 4, UINT32_MAX, UINT32_MAX - 1, 199, 200));
+  EXPECT_THAT(u64, ElementsAre(0, 1, 2, 3, 4, UINT64_MAX, UINT64_MAX - 1, 199, 200));
+
+  std::vector<int32_t> d32(s32.size());
+  std::vector<int64_t> d64(s64.size());
+  ZigZagDecode(u32.data(), u32.size(), d32.data());
+  ZigZagDecode(u64.data(), u64.size(), d64.data());
+  EXPECT_EQ(s32, d32);
+  EXPECT_EQ(s64, d64);
+
+  // In place.
+  ZigZagEncode(s32.data(), s32.size(), reinterpret_cast<uint32_t*>(s32.data()));
+  EXPECT_EQ(0, memcmp(s32.data(), u32.data(), u32.size() * sizeof(uint32_t)));
+}
+
+TEST(SimdTest, Reductions) {
+  uint32_t mn32, mx32;
+  uint64_t mn64, mx64;
+  MinMax(static_cast<const uint32_t*>(nullptr), 0, &mn32, &mx32);
+  EXPECT_EQ(UINT32_MAX, mn32);
+  EXPECT_EQ(0, mx32);
+  EXPECT_EQ(0, Sum(static_cast<const uint64_t*>(nullptr), 0));
+
+  for (size_t len = 1; len < 20; ++len) {
+    std::vector<uint32_t> v32(len);
+    std::vector<uint64_t> v64(len);
+    for (unsigned i = 0; i < len; ++i) {
+      v32[i] = (i * 2654435761U) ^ 0x80000000;
+      v64[i] = uint64_t(v32[i]) << 32 | i;
+    }
+    MinMax(v32.data(), len, &mn32, &mx32);
+    MinMax(v64.data(), len, &mn64, &mx64);
+    ASSERT_EQ(*std::min_element(v32.begin(), v32.end()), mn32) << len;
+    ASSERT_EQ(*std::max_element(v32.begin(), v32.end()), mx32) << len;
+    ASSERT_EQ(*std::min_element(v64.begin(), v64.end()), mn64) << len;
+    ASSERT_EQ(*std::max_element(v64.begin(), v64.end()), mx64) << len;
+
+    uint64_t sum32 = 0, sum64 = 0;
+    for (unsigned i = 0; i < len; ++i) {
+      sum32 += v32[i];
+      sum64 += v64[i];
+    }
+    ASSERT_EQ(sum32, Sum(v32.data(), len));
+    ASSERT_EQ(sum64, Sum(v64.data(), len));
+  }
+}
+
 using benchmark::DoNotOptimize;
 
 static void BM_Simd(benchmark::State& state) {
@@ -83,6 +207,16 @@ static void BM_Simd(benchmark::State& state) {
 }
 BENCHMARK(BM_Simd)->Range(8, 1 << 16);
 
+static void BM_PrefixSum(benchmark::State& state) {
+  std::vector<uint32_t> buf(state.range(0), 1);
+  while (state.KeepRunning()) {
+    PrefixSumInplace(buf.data(), buf.size(), 0);
+    DoNotOptimize(buf[0]);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size() * sizeof(uint32_t));
+}
+BENCHMARK(BM_PrefixSum)->Range(8, 1 << 16);
+
 static void BM_Plain(benchmark::State& state) {
   std::unique_ptr<uint8[]> buf(new uint8[state.range(0) + 20]);
   while (state.KeepRunning()) {
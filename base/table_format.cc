@@ -0,0 +1,98 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/table_format.h"
+
+#include "base/crc32c.h"
+#include "base/endian.h"
+
+namespace base {
+namespace table_internal {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4c425447;  // "GTBL"
+constexpr uint16_t kVersion = 1;
+
+// Offsets of the header fields.
+enum {
+  kMagicOffset = 0,
+  kVersionOffset = 4,
+  kKindOffset = 6,
+  kElemSizeOffset = 8,
+  kCrcOffset = 12,
+  kCountOffset = 16,
+  kBodySizeOffset = 24,
+  kHeaderFieldsSize = 32
+};
+
+static_assert(kHeaderFieldsSize <= kTableAlignment, "");
+
+}  // namespace
+
+void StartTable(TableKind kind, uint32_t elem_size, uint64_t count, std::string* dest) {
+  dest->assign(kTableAlignment, '\0');
+
+  uint8_t* header = reinterpret_cast<uint8_t*>(&dest->front());
+  LittleEndian::Store32(header + kMagicOffset, kMagic);
+  LittleEndian::Store16(header + kVersionOffset, kVersion);
+  LittleEndian::Store16(header + kKindOffset, uint16_t(kind));
+  LittleEndian::Store32(header + kElemSizeOffset, elem_size);
+  LittleEndian::Store64(header + kCountOffset, count);
+}
+
+void PadSection(std::string* dest) {
+  dest->resize(AlignUp(dest->size()), '\0');
+}
+
+void FinishTable(std::string* dest) {
+  PadSection(dest);
+
+  uint8_t* header = reinterpret_cast<uint8_t*>(&dest->front());
+  size_t body_size = dest->size() - kTableAlignment;
+  uint32_t crc = crc32c::Value(header + kTableAlignment, body_size);
+
+  LittleEndian::Store32(header + kCrcOffset, crc32c::Mask(crc));
+  LittleEndian::Store64(header + kBodySizeOffset, body_size);
+}
+
+const uint8_t* ParseTable(const uint8_t* src, size_t size, TableKind kind, uint32_t elem_size,
+                          bool verify_crc, uint64_t* count) {
+  if (size < kTableAlignment || LittleEndian::Load32(src + kMagicOffset) != kMagic) {
+    VLOG(1) << "Not a table";
+    return nullptr;
+  }
+
+  uint16_t version = LittleEndian::Load16(src + kVersionOffset);
+  if (version != kVersion) {
+    VLOG(1) << "Unsupported table version " << version;
+    return nullptr;
+  }
+
+  if (LittleEndian::Load16(src + kKindOffset) != uint16_t(kind) ||
+      LittleEndian::Load32(src + kElemSizeOffset) != elem_size) {
+    VLOG(1) << "Table type mismatch";
+    return nullptr;
+  }
+
+  const uint8_t* body = src + kTableAlignment;
+  uint64_t body_size = LittleEndian::Load64(src + kBodySizeOffset);
+  if (body_size != size - kTableAlignment) {
+    VLOG(1) << "Table size mismatch " << body_size << " vs " << size - kTableAlignment;
+    return nullptr;
+  }
+
+  if (verify_crc) {
+    uint32_t crc = crc32c::Unmask(LittleEndian::Load32(src + kCrcOffset));
+    if (crc != crc32c::Value(body, body_size)) {
+      VLOG(1) << "Table checksum mismatch";
+      return nullptr;
+    }
+  }
+
+  *count = LittleEndian::Load64(src + kCountOffset);
+  return body;
+}
+
+}  // namespace table_internal
+}  // namespace base
@@ -0,0 +1,193 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+#include "base/flat_arrays_vector.h"
+#include "base/logging.h"
+#include "base/pod_array.h"
+
+/* Versioned binary format of the lookup tables built with PODArray and FlatArraysVec.
+   Tables are serialized offline and used in place via PODArrayView and FlatArraysView,
+   usually over a file opened with ReadonlyFile::Options::use_mmap and ReadView (file/file.h).
+
+   Layout, all integers are little endian and the elements are stored in host order,
+   therefore only little endian hosts are supported:
+     header, kTableAlignment bytes:
+       uint32 magic, uint16 version, uint16 kind, uint32 sizeof(T),
+       uint32 masked crc32c of the body, uint64 count, uint64 body size.
+     body, each section starts at kTableAlignment aligned offset and is zero padded:
+       POD array: T elements[count].
+       Flat arrays: uint32 offsets[count + 1], T elements[offsets[count]].
+
+   mmap returns page aligned memory, hence all the sections of a mapped table are
+   kTableAlignment aligned as well.
+*/
+namespace base {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Tables are stored in host order");
+
+constexpr size_t kTableAlignment = 64;
+
+// BIT_VECTOR and ELIAS_FANO tables are written by base/rank_select.h.
+enum class TableKind : uint16_t { POD_ARRAY = 1, FLAT_ARRAYS = 2, BIT_VECTOR = 3, ELIAS_FANO = 4 };
+
+namespace table_internal {
+
+constexpr size_t AlignUp(size_t sz) {
+  return (sz + kTableAlignment - 1) & ~(kTableAlignment - 1);
+}
+
+// Overwrites dest with the header, the caller appends the body after it.
+void StartTable(TableKind kind, uint32_t elem_size, uint64_t count, std::string* dest);
+
+// Pads dest with zeros to kTableAlignment, so that the next section is aligned.
+void PadSection(std::string* dest);
+
+// Pads the last section and fills the body size and the checksum in the header.
+void FinishTable(std::string* dest);
+
+// Validates the header and optionally the checksum, returns the start of the body
+// or nullptr if src does not hold a table of that kind.
+const uint8_t* ParseTable(const uint8_t* src, size_t size, TableKind kind, uint32_t elem_size,
+                          bool verify_crc, uint64_t* count);
+
+}  // namespace table_internal
+
+// Overwrites dest with the serialized table.
+template <typename T> void SerializePODArray(const T* src, size_t count, std::string* dest) {
+  static_assert(std::is_trivially_copyable<T>::value, "");
+
+  table_internal::StartTable(TableKind::POD_ARRAY, sizeof(T), count, dest);
+  dest->append(reinterpret_cast<const char*>(src), count * sizeof(T));
+  table_internal::FinishTable(dest);
+}
+
+template <typename T, size_t A> void SerializePODArray(const PODArray<T, A>& arr,
+                                                       std::string* dest) {
+  SerializePODArray(arr.data(), arr.size(), dest);
+}
+
+template <typename T> void SerializeFlatArrays(const FlatArraysVec<T>& vec, std::string* dest) {
+  static_assert(std::is_trivially_copyable<T>::value, "");
+
+  const auto& offsets = vec.offsets();
+  const auto& data = vec.data();
+  CHECK_LE(data.size(), UINT32_MAX);
+
+  table_internal::StartTable(TableKind::FLAT_ARRAYS, sizeof(T), offsets.size(), dest);
+  dest->append(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32));
+
+  // The end offset allows computing the length of any array from its neighbouring offsets.
+  uint32 end = data.size();
+  dest->append(reinterpret_cast<const char*>(&end), sizeof(end));
+  table_internal::PadSection(dest);
+
+  dest->append(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+  table_internal::FinishTable(dest);
+}
+
+// Read-only view of a table written by SerializePODArray. Does not copy the elements
+// and must not outlive the buffer.
+template <typename T> class PODArrayView {
+ public:
+  using value_type = T;
+  using const_iterator = const T*;
+
+  // src must be aligned to alignof(T). Returns false if it does not hold a POD array of T.
+  // verify_crc touches all the pages of the table, without it Init takes O(1).
+  bool Init(const uint8_t* src, size_t size, bool verify_crc = true) {
+    uint64_t count = 0;
+    const uint8_t* body = nullptr;
+    if (reinterpret_cast<uintptr_t>(src) % alignof(T) == 0) {
+      body = table_internal::ParseTable(src, size, TableKind::POD_ARRAY, sizeof(T), verify_crc,
+                                        &count);
+    }
+    if (!body || count > (size - (body - src)) / sizeof(T)) {
+      data_ = nullptr;
+      size_ = 0;
+      return false;
+    }
+
+    data_ = reinterpret_cast<const T*>(body);
+    size_ = count;
+    return true;
+  }
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](size_t i) const {
+    DCHECK_LT(i, size_);
+    return data_[i];
+  }
+
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+ private:
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Read-only view of a table written by SerializeFlatArrays, with the same accessors as
+// FlatArraysVec. Does not copy the elements and must not outlive the buffer.
+template <typename T> class FlatArraysView {
+ public:
+  using RangeWrapper = typename FlatArraysVec<T>::RangeWrapper;
+
+  // src must be aligned to alignof(T) and alignof(uint32).
+  // Returns false if it does not hold flat arrays of T. The offsets are not validated,
+  // hence without verify_crc the table must come from a trusted source.
+  bool Init(const uint8_t* src, size_t size, bool verify_crc = true);
+
+  RangeWrapper range(uint32 index) const {
+    DCHECK_LT(index, size_);
+    uint32 start = offsets_[index];
+    return RangeWrapper(data_ + start, offsets_[index + 1] - start);
+  }
+
+  // Returns number of arrays.
+  uint32 size() const { return size_; }
+
+ private:
+  const uint32* offsets_ = nullptr;
+  const T* data_ = nullptr;
+  uint32 size_ = 0;
+};
+
+template <typename T>
+bool FlatArraysView<T>::Init(const uint8_t* src, size_t size, bool verify_crc) {
+  *this = FlatArraysView{};
+
+  constexpr size_t kAlign = std::max(alignof(T), alignof(uint32));
+  if (reinterpret_cast<uintptr_t>(src) % kAlign != 0)
+    return false;
+
+  uint64_t count = 0;
+  const uint8_t* body = table_internal::ParseTable(src, size, TableKind::FLAT_ARRAYS, sizeof(T),
+                                                   verify_crc, &count);
+  if (!body || count >= UINT32_MAX)
+    return false;
+
+  size_t body_size = size - (body - src);
+  size_t offsets_size = table_internal::AlignUp((count + 1) * sizeof(uint32));
+  if (offsets_size > body_size)
+    return false;
+
+  const uint32* offsets = reinterpret_cast<const uint32*>(body);
+  if (offsets[count] * sizeof(T) > body_size - offsets_size)
+    return false;
+
+  offsets_ = offsets;
+  data_ = reinterpret_cast<const T*>(body + offsets_size);
+  size_ = count;
+  return true;
+}
+
+}  // namespace base
@@ -0,0 +1,85 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/table_format.h"
+
+#include "base/gtest.h"
+
+namespace base {
+
+using namespace std;
+
+class TableFormatTest : public testing::Test {
+ protected:
+  // Copies the table into 64 byte aligned buffer, like a mmap-ed file.
+  const uint8_t* Aligned(const string& table) {
+    buf_.reset(new Cell[table.size() / sizeof(Cell) + 1]);
+    memcpy(buf_.get(), table.data(), table.size());
+    return reinterpret_cast<const uint8_t*>(buf_.get());
+  }
+
+  struct alignas(kTableAlignment) Cell {
+    uint8_t bytes[kTableAlignment];
+  };
+  unique_ptr<Cell[]> buf_;
+};
+
+TEST_F(TableFormatTest, PODArray) {
+  PODArray<uint64_t> arr;
+  for (uint64_t i = 0; i < 1000; ++i)
+    arr.push_back(i * i);
+
+  string table;
+  SerializePODArray(arr, &table);
+  EXPECT_EQ(0, table.size() % kTableAlignment);
+
+  const uint8_t* src = Aligned(table);
+  PODArrayView<uint64_t> view;
+  ASSERT_TRUE(view.Init(src, table.size()));
+  ASSERT_EQ(arr.size(), view.size());
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(view.data()) % kTableAlignment);
+  EXPECT_TRUE(std::equal(arr.begin(), arr.end(), view.begin()));
+  EXPECT_EQ(999 * 999, view[999]);
+
+  // Wrong type, size or corrupted data.
+  PODArrayView<uint32_t> view32;
+  EXPECT_FALSE(view32.Init(src, table.size()));
+  EXPECT_FALSE(view.Init(src, table.size() - kTableAlignment));
+  EXPECT_FALSE(view.Init(src + 1, table.size() - 1));
+  EXPECT_TRUE(view.empty());
+
+  buf_[2].bytes[0] ^= 1;
+  EXPECT_FALSE(view.Init(src, table.size()));
+  EXPECT_TRUE(view.Init(src, table.size(), false));
+
+  SerializePODArray<uint64_t>(nullptr, 0, &table);
+  ASSERT_TRUE(view.Init(Aligned(table), table.size()));
+  EXPECT_TRUE(view.empty());
+}
+
+TEST_F(TableFormatTest, FlatArrays) {
+  FlatArraysVec<uint16_t> vec;
+  vector<uint16_t> items;
+  for (unsigned i = 0; i < 100; ++i) {
+    vec.Add(items);
+    items.push_back(i);
+  }
+  vec.Finalize();
+
+  string table;
+  SerializeFlatArrays(vec, &table);
+
+  FlatArraysView<uint16_t> view;
+  ASSERT_TRUE(view.Init(Aligned(table), table.size()));
+  ASSERT_EQ(vec.size(), view.size());
+  for (unsigned i = 0; i < vec.size(); ++i) {
+    auto expected = vec.range(i), actual = view.range(i);
+    ASSERT_EQ(i, actual.end() - actual.begin());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin())) << i;
+  }
+
+  PODArrayView<uint16_t> pod_view;
+  EXPECT_FALSE(pod_view.Init(Aligned(table), table.size()));
+}
+
+}  // namespace base
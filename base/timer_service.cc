@@ -0,0 +1,200 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/timer_service.h"
+
+#include "base/logging.h"
+
+namespace base {
+
+// Referenced by its handle, by the shard while it's not done with it and by the pending
+// cancel request.
+struct TimerService::Timer : public TimerEventInterface {
+  Shard* shard;
+  Tick delta;
+  Callback cb;
+
+  std::atomic_uint32_t refs{2};
+  std::atomic_bool cancelled{false};
+
+  // Links of the inboxes.
+  Timer* next_scheduled = nullptr;
+  Timer* next_cancelled = nullptr;
+
+  // Links of the active list of the shard.
+  Timer* prev_active = nullptr;
+  Timer* next_active = nullptr;
+
+  Timer(Shard* s, Tick d, Callback c) : shard(s), delta(d), cb(std::move(c)) {}
+
+  void execute() override;
+};
+
+struct TimerService::Shard {
+  TimerWheel wheel;
+  size_t active = 0;
+
+  // The timers scheduled on the wheel, allows freeing them upon destruction.
+  Timer* active_head = nullptr;
+
+  void Link(Timer* t) {
+    t->next_active = active_head;
+    if (active_head)
+      active_head->prev_active = t;
+    active_head = t;
+    ++active;
+  }
+
+  void Unlink(Timer* t) {
+    if (t->prev_active)
+      t->prev_active->next_active = t->next_active;
+    else
+      active_head = t->next_active;
+    if (t->next_active)
+      t->next_active->prev_active = t->prev_active;
+    t->prev_active = t->next_active = nullptr;
+    --active;
+  }
+
+  // Lock-free LIFO stacks, the owner takes them as a whole.
+  std::atomic<Timer*> scheduled{nullptr}, cancelled{nullptr};
+
+  // Timers that expired during the current Advance().
+  std::vector<Timer*> expired;
+};
+
+namespace {
+
+template <typename T> void Push(T* t, T* T::*link, std::atomic<T*>* head) {
+  T* old = head->load(std::memory_order_relaxed);
+  do {
+    t->*link = old;
+  } while (!head->compare_exchange_weak(old, t, std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+// Returns the pushed items in the order they were pushed, relinked via link.
+template <typename T> T* TakeAll(T* T::*link, std::atomic<T*>* head) {
+  T* t = head->exchange(nullptr, std::memory_order_acquire);
+  T* res = nullptr;
+  while (t) {
+    T* next = t->*link;
+    t->*link = res;
+    res = t;
+    t = next;
+  }
+  return res;
+}
+
+}  // namespace
+
+void TimerService::Timer::execute() {
+  shard->Unlink(this);
+  shard->expired.push_back(this);
+}
+
+void TimerService::Handle::Cancel() {
+  if (!t_ || t_->cancelled.exchange(true, std::memory_order_acq_rel))
+    return;
+
+  // The request references the timer until the owner applies it.
+  t_->refs.fetch_add(1, std::memory_order_relaxed);
+  Push(t_, &Timer::next_cancelled, &t_->shard->cancelled);
+}
+
+void TimerService::Handle::Reset() {
+  if (t_) {
+    Unref(t_);
+    t_ = nullptr;
+  }
+}
+
+TimerService::TimerService(unsigned num_shards)
+    : num_shards_(num_shards), shards_(new Shard[num_shards]) {
+  CHECK_GT(num_shards, 0);
+}
+
+TimerService::~TimerService() {
+  for (unsigned i = 0; i < num_shards_; ++i) {
+    Shard* shard = &shards_[i];
+    ProcessInbox(shard);
+
+    while (Timer* t = shard->active_head) {
+      t->cancel();
+      shard->Unlink(t);
+      Unref(t);
+    }
+  }
+}
+
+void TimerService::Unref(Timer* t) {
+  if (t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete t;
+}
+
+auto TimerService::Schedule(unsigned shard, Tick delta, Callback cb) -> Handle {
+  DCHECK_LT(shard, num_shards_);
+  DCHECK_GT(delta, 0);
+
+  Shard* s = &shards_[shard];
+  Timer* t = new Timer(s, delta, std::move(cb));
+  Push(t, &Timer::next_scheduled, &s->scheduled);
+  return Handle(t);
+}
+
+void TimerService::ProcessInbox(Shard* shard) {
+  for (Timer* t = TakeAll(&Timer::next_scheduled, &shard->scheduled); t;) {
+    Timer* next = t->next_scheduled;
+    if (t->cancelled.load(std::memory_order_acquire)) {
+      Unref(t);
+    } else {
+      shard->wheel.schedule(t, t->delta);
+      shard->Link(t);
+    }
+    t = next;
+  }
+
+  for (Timer* t = TakeAll(&Timer::next_cancelled, &shard->cancelled); t;) {
+    Timer* next = t->next_cancelled;
+
+    // Inactive timers either expired or are still in the scheduled inbox, which releases them.
+    if (t->active()) {
+      t->cancel();
+      shard->Unlink(t);
+      Unref(t);
+    }
+    Unref(t);  // The reference of the request.
+    t = next;
+  }
+}
+
+size_t TimerService::Advance(unsigned shard, Tick delta) {
+  DCHECK_LT(shard, num_shards_);
+  Shard* s = &shards_[shard];
+
+  ProcessInbox(s);
+  s->wheel.advance(delta);
+
+  size_t res = 0;
+  for (Timer* t : s->expired) {
+    if (!t->cancelled.load(std::memory_order_acquire)) {
+      t->cb();
+      ++res;
+    }
+    t->cb = nullptr;
+    Unref(t);
+  }
+  s->expired.clear();
+
+  return res;
+}
+
+Tick TimerService::now(unsigned shard) const {
+  return shards_[shard].wheel.now();
+}
+
+size_t TimerService::active(unsigned shard) const {
+  return shards_[shard].active;
+}
+
+}  // namespace base
@@ -0,0 +1,104 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "base/wheel_timer.h"
+
+namespace base {
+
+/* Timers sharded over threads, one TimerWheel per shard. Every shard is owned by a single
+   thread, usually an IO thread, that drives it with Advance() - for example from a periodic task
+   of its event loop. Any thread may schedule timers on any shard and cancel them: the requests
+   are pushed into lock-free inboxes of the shard and are applied by its owner on the next
+   Advance(). Hence the callbacks always run on the owner thread. Advance() first collects all
+   the expired timers and only then runs their callbacks, so callbacks may schedule and cancel
+   timers freely.
+
+   Example:
+     TimerService timers(pool.size());
+     // IO thread i:  every tick calls timers.Advance(i, 1);
+     // Any thread:
+     TimerService::Handle h = timers.Schedule(shard, 100, [] { ... });
+     ...
+     h.Cancel();
+*/
+class TimerService {
+  struct Timer;
+  struct Shard;
+
+ public:
+  using Callback = std::function<void()>;
+
+  // Refers to a scheduled timer. Dropping the handle does not cancel the timer.
+  class Handle {
+   public:
+    Handle() = default;
+    Handle(Handle&& o) noexcept : t_(o.t_) { o.t_ = nullptr; }
+    ~Handle() { Reset(); }
+
+    Handle& operator=(Handle&& o) noexcept {
+      if (this != &o) {
+        Reset();
+        std::swap(t_, o.t_);
+      }
+      return *this;
+    }
+
+    // Thread-safe. The callback does not run if the owner applies the cancellation before
+    // the timer expires, which is the case if it did not expire before Cancel() was called.
+    // A concurrent expiry may still run the callback. Cancelling twice is a no-op.
+    void Cancel();
+
+    // Drops the reference to the timer without cancelling it.
+    void Reset();
+
+    explicit operator bool() const { return t_ != nullptr; }
+
+   private:
+    friend class TimerService;
+    explicit Handle(Timer* t) : t_(t) {}
+
+    Timer* t_ = nullptr;
+  };
+
+  explicit TimerService(unsigned num_shards);
+
+  // Frees the pending timers without running them. Should be called after the owner threads
+  // stopped calling Advance() and no other thread uses the service.
+  ~TimerService();
+
+  // Thread-safe. Runs cb on the owner thread of shard, delta ticks of that shard after
+  // the owner applies the request. delta must be positive.
+  Handle Schedule(unsigned shard, Tick delta, Callback cb);
+
+  // Must be called only by the owner thread of the shard. Applies the pending requests,
+  // advances the wheel by delta ticks and runs the expired callbacks.
+  // Returns the number of callbacks that ran.
+  size_t Advance(unsigned shard, Tick delta);
+
+  // Owner thread only: current tick and the number of timers scheduled on the wheel.
+  Tick now(unsigned shard) const;
+  size_t active(unsigned shard) const;
+
+  unsigned num_shards() const { return num_shards_; }
+
+ private:
+  static void Unref(Timer* t);
+
+  // Applies the schedule and the cancel requests of the shard.
+  static void ProcessInbox(Shard* shard);
+
+  unsigned num_shards_;
+  std::unique_ptr<Shard[]> shards_;
+
+  TimerService(const TimerService&) = delete;
+  void operator=(const TimerService&) = delete;
+};
+
+}  // namespace base
@@ -0,0 +1,159 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/timer_service.h"
+
+#include <random>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace base {
+
+using namespace std;
+
+class TimerServiceTest : public testing::Test {
+};
+
+TEST_F(TimerServiceTest, Basic) {
+  TimerService ts(2);
+  int count = 0;
+
+  auto h = ts.Schedule(0, 5, [&] { ++count; });
+  EXPECT_TRUE(h);
+  EXPECT_EQ(0, ts.Advance(0, 4));
+  EXPECT_EQ(1, ts.active(0));
+  EXPECT_EQ(1, ts.Advance(0, 1));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ(0, ts.active(0));
+
+  // Cancelling an expired timer is a no-op.
+  h.Cancel();
+  EXPECT_EQ(0, ts.Advance(0, 10));
+
+  h = ts.Schedule(0, 5, [&] { ++count; });
+  EXPECT_EQ(0, ts.Advance(0, 1));
+  h.Cancel();
+  h.Cancel();
+  EXPECT_EQ(0, ts.Advance(0, 10));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ(0, ts.active(0));
+
+  // Cancelled before the owner applied the request.
+  h = ts.Schedule(1, 1, [&] { ++count; });
+  h.Cancel();
+  EXPECT_EQ(0, ts.Advance(1, 2));
+
+  // The handle can be dropped.
+  ts.Schedule(1, 1, [&] { ++count; });
+  EXPECT_EQ(1, ts.Advance(1, 1));
+  EXPECT_EQ(2, count);
+
+  // Destructor frees the pending timers.
+  ts.Schedule(1, 1000, [&] { ++count; });
+  h = ts.Schedule(1, 1000000, [&] { ++count; });
+  EXPECT_EQ(0, ts.Advance(1, 1));
+}
+
+TEST_F(TimerServiceTest, Batch) {
+  TimerService ts(1);
+  vector<int> fired;
+  vector<TimerService::Handle> handles;
+
+  for (int i = 0; i < 10; ++i) {
+    handles.push_back(ts.Schedule(0, 3, [&, i] {
+      // Callbacks may cancel the timers of the same batch and schedule new ones.
+      if (fired.empty()) {
+        for (auto& h : handles)
+          h.Cancel();
+      }
+      fired.push_back(i);
+      ts.Schedule(0, 1, [&] { fired.push_back(-1); });
+    }));
+  }
+  EXPECT_EQ(1, ts.Advance(0, 3));
+  EXPECT_EQ(1, fired.size());
+  EXPECT_EQ(1, ts.Advance(0, 1));
+  EXPECT_EQ(-1, fired.back());
+}
+
+TEST_F(TimerServiceTest, CrossThread) {
+  constexpr unsigned kShards = 3, kPerThread = 20000;
+  TimerService ts(kShards);
+  atomic_bool done{false};
+  atomic_uint fired{0}, scheduled{0};
+  size_t fired_per_shard[kShards] = {0};
+
+  vector<thread> owners;
+  for (unsigned s = 0; s < kShards; ++s) {
+    owners.emplace_back([&, s] {
+      this_thread::yield();
+      while (!done.load()) {
+        fired_per_shard[s] += ts.Advance(s, 1);
+        this_thread::yield();
+      }
+      fired_per_shard[s] += ts.Advance(s, 100);
+    });
+  }
+
+  vector<thread> producers;
+  atomic_uint cancelled{0};
+  for (unsigned p = 0; p < 2; ++p) {
+    producers.emplace_back([&, p] {
+      default_random_engine re(p);
+      for (unsigned i = 0; i < kPerThread; ++i) {
+        auto h = ts.Schedule(re() % kShards, 1 + re() % 50, [&] { ++fired; });
+        ++scheduled;
+        if (i % 2) {
+          h.Cancel();
+          ++cancelled;
+        }
+      }
+    });
+  }
+  for (auto& t : producers)
+    t.join();
+  done = true;
+  for (auto& t : owners)
+    t.join();
+
+  size_t total = 0;
+  for (unsigned s = 0; s < kShards; ++s) {
+    EXPECT_EQ(0, ts.active(s));
+    total += fired_per_shard[s];
+  }
+  EXPECT_EQ(fired.load(), total);
+
+  // A cancel racing with the expiry may still run the callback.
+  EXPECT_GE(fired.load(), scheduled - cancelled);
+  EXPECT_LE(fired.load(), scheduled);
+}
+
+// Keeps a million timers outstanding while replacing the oldest ones on every iteration.
+static void BM_TimerChurn(benchmark::State& state) {
+  constexpr unsigned kOutstanding = 1 << 20;
+  constexpr unsigned kBatch = 1024;
+  TimerService ts(1);
+  vector<TimerService::Handle> handles(kOutstanding);
+  default_random_engine re;
+  uniform_int_distribution<Tick> dis(1, 100000);
+
+  for (auto& h : handles)
+    h = ts.Schedule(0, dis(re), [] {});
+  ts.Advance(0, 1);
+
+  size_t next = 0;
+  while (state.KeepRunning()) {
+    for (unsigned i = 0; i < kBatch; ++i) {
+      TimerService::Handle& h = handles[next++ % kOutstanding];
+      h.Cancel();
+      h = ts.Schedule(0, dis(re), [] {});
+    }
+    ts.Advance(0, 1);
+  }
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK(BM_TimerChurn);
+
+}  // namespace base
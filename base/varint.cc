@@ -3,10 +3,15 @@
 // Modified by: Roman Gershman (romange@gmail.com)
 //
 
+#include <algorithm>
 #include <string>
 
 #include "base/varint.h"
 
+#ifdef __SSE4_1__
+#include <x86intrin.h>
+#endif
+
 constexpr int Varint::kMax32;
 constexpr int Varint::kMax64;
 using std::string;
@@ -136,6 +141,143 @@ const uint8* Varint::Parse64WithLimit(const uint8* ptr,
   }
 }
 
+#ifdef __SSE4_1__
+
+namespace {
+
+// Masked VByte, see "Vectorized VByte Decoding" by Plaisance, Kurz and Lemire.
+// The continuation bits of 12 bytes select how the leading varints of the window are decoded:
+// up to 8 varints of at most 2 bytes into 16 bit lanes, or up to 4 varints of at most 3 bytes
+// into 32 bit lanes. Longer varints are parsed by the scalar code.
+enum MaskedKind : uint8 { kMaskedScalar = 0, kMasked16, kMasked32 };
+
+struct MaskedEntry {
+  uint8 shuffle[16];
+  uint8 consumed, num, kind;
+};
+
+constexpr unsigned kMaskedBits = 12;
+
+const MaskedEntry* MaskedTable() {
+  static const MaskedEntry* table = [] {
+    MaskedEntry* res = new MaskedEntry[1 << kMaskedBits];
+
+    for (unsigned mask = 0; mask < (1 << kMaskedBits); ++mask) {
+      MaskedEntry& e = res[mask];
+      std::fill(e.shuffle, e.shuffle + 16, 0x80);  // pshufb zeroes the lanes with 0x80.
+
+      // The lengths of the varints that end within the window.
+      uint8 start[kMaskedBits], len[kMaskedBits];
+      unsigned cnt = 0, begin = 0;
+      for (unsigned i = 0; i < kMaskedBits; ++i) {
+        if ((mask & (1 << i)) == 0) {
+          start[cnt] = begin;
+          len[cnt++] = i + 1 - begin;
+          begin = i + 1;
+        }
+      }
+
+      unsigned n16 = 0, n32 = 0;
+      while (n16 < std::min(cnt, 8u) && len[n16] <= 2)
+        ++n16;
+      while (n32 < std::min(cnt, 4u) && len[n32] <= 3)
+        ++n32;
+
+      if (n16 > 4) {
+        e.kind = kMasked16;
+        e.num = n16;
+        for (unsigned j = 0; j < n16; ++j) {
+          for (unsigned k = 0; k < len[j]; ++k)
+            e.shuffle[2 * j + k] = start[j] + k;
+        }
+      } else if (n32 > 0) {
+        e.kind = kMasked32;
+        e.num = n32;
+        for (unsigned j = 0; j < n32; ++j) {
+          for (unsigned k = 0; k < len[j]; ++k)
+            e.shuffle[4 * j + k] = start[j] + k;
+        }
+      } else {
+        e.kind = kMaskedScalar;
+        e.num = 0;
+      }
+      e.consumed = e.num ? start[e.num - 1] + len[e.num - 1] : 0;
+    }
+    return res;
+  }();
+
+  return table;
+}
+
+}  // namespace
+
+const uint8* Varint::ParseN(const uint8* ptr, const uint8* limit, uint32* OUTPUT, size_t n) {
+  const MaskedEntry* table = MaskedTable();
+
+  // Every step stores at most 16 values, so it runs while at least 16 are left.
+  while (n >= 16 && limit - ptr >= 16) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    unsigned mask = _mm_movemask_epi8(in);
+    __m128i* out = reinterpret_cast<__m128i*>(OUTPUT);
+
+    if (mask == 0) {  // 16 single byte varints.
+      _mm_storeu_si128(out, _mm_cvtepu8_epi32(in));
+      _mm_storeu_si128(out + 1, _mm_cvtepu8_epi32(_mm_srli_si128(in, 4)));
+      _mm_storeu_si128(out + 2, _mm_cvtepu8_epi32(_mm_srli_si128(in, 8)));
+      _mm_storeu_si128(out + 3, _mm_cvtepu8_epi32(_mm_srli_si128(in, 12)));
+      ptr += 16;
+      OUTPUT += 16;
+      n -= 16;
+      continue;
+    }
+
+    const MaskedEntry& e = table[mask & ((1 << kMaskedBits) - 1)];
+    __m128i x = _mm_shuffle_epi8(in, _mm_loadu_si128(reinterpret_cast<const __m128i*>(e.shuffle)));
+
+    if (e.kind == kMasked16) {
+      __m128i v = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(0x7f)),
+                               _mm_srli_epi16(_mm_and_si128(x, _mm_set1_epi16(0x7f00)), 1));
+      _mm_storeu_si128(out, _mm_cvtepu16_epi32(v));
+      _mm_storeu_si128(out + 1, _mm_cvtepu16_epi32(_mm_srli_si128(v, 8)));
+    } else if (e.kind == kMasked32) {
+      __m128i v = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x7f)),
+                               _mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7f00)), 1));
+      v = _mm_or_si128(v, _mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7f0000)), 2));
+      _mm_storeu_si128(out, v);
+    } else {
+      ptr = Parse32WithLimit(ptr, limit, OUTPUT);
+      if (ptr == NULL)
+        return NULL;
+      ++OUTPUT;
+      --n;
+      continue;
+    }
+    ptr += e.consumed;
+    OUTPUT += e.num;
+    n -= e.num;
+  }
+
+  for (; n > 0; --n) {
+    ptr = Parse32WithLimit(ptr, limit, OUTPUT++);
+    if (ptr == NULL)
+      return NULL;
+  }
+  return ptr;
+}
+
+#else
+
+const uint8* Varint::ParseN(const uint8* ptr, const uint8* limit, uint32* OUTPUT, size_t n) {
+  for (; n > 0; --n) {
+    ptr = Parse32WithLimit(ptr, limit, OUTPUT++);
+    if (ptr == NULL)
+      return NULL;
+  }
+  return ptr;
+}
+
+#endif
+
 const uint8* Varint::Skip32BackwardSlow(const uint8* ptr, const uint8* base) {
   assert(ptr >= base);
 
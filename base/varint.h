@@ -75,6 +75,12 @@ class Varint {
   static const uint8* Parse64WithLimit(const uint8* ptr, const uint8* limit,
                                       uint64* OUTPUT);
 
+  // Parses n varint32 values from [ptr,limit-1] into OUTPUT, never reading at or beyond limit.
+  // Returns a pointer just past the last value or NULL if fewer than n valid values were found.
+  // Windows of 16 bytes are decoded with SSE shuffles selected by their continuation bits
+  // (Masked VByte), much faster than calling Parse32WithLimit in a loop for small values.
+  static const uint8* ParseN(const uint8* ptr, const uint8* limit, uint32* OUTPUT, size_t n);
+
   // REQUIRES   "ptr" points to the first byte of a varint-encoded value.
   // EFFECTS     Scans until the end of the varint and returns a pointer just
   //             past the last byte. Returns NULL if "ptr" does not point to
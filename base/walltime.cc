@@ -13,6 +13,10 @@
 #include <sys/timerfd.h>
 #include <cstdio>
 
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
 using std::string;
 
 void SleepForMilliseconds(uint32 milliseconds) {
@@ -167,6 +171,82 @@ uint64 GetMonotonicMicrosFast() {
   return ms_long_counter.load(std::memory_order_acquire) * 100;
 }
 
+#ifdef __x86_64__
+
+namespace {
+
+bool HasInvariantTsc() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+    return false;
+
+  // rdtscp is reported by the extended leaf 0x80000001, the invariant TSC by 0x80000007.
+  __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+  if ((edx & (1U << 27)) == 0)
+    return false;
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return (edx & (1U << 8)) != 0;
+}
+
+// Reads the TSC and CLOCK_MONOTONIC as close together as possible. Keeps the tightest of
+// several attempts, so that a preemption in the middle does not skew the calibration.
+void ReadClockPair(uint64* nanos, uint64* cycles) {
+  uint64 best = kuint64max;
+  for (unsigned i = 0; i < 8; ++i) {
+    timespec ts0, ts1;
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    uint64 tsc = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    uint64 t0 = ts0.tv_sec * 1000000000ULL + ts0.tv_nsec;
+    uint64 t1 = ts1.tv_sec * 1000000000ULL + ts1.tv_nsec;
+    if (t1 - t0 < best) {
+      best = t1 - t0;
+      *nanos = t0 + (t1 - t0) / 2;
+      *cycles = tsc;
+    }
+  }
+}
+
+}  // namespace
+
+#endif
+
+auto CycleClock::Calibrate() -> Params {
+  Params res{false, 1000000000ULL, 1.0};
+
+#ifdef __x86_64__
+  if (!HasInvariantTsc()) {
+    LOG(WARNING) << "TSC is not invariant, CycleClock falls back to CLOCK_MONOTONIC";
+    return res;
+  }
+
+  uint64 ns0, c0, ns1, c1;
+  ReadClockPair(&ns0, &c0);
+  SleepMicros(10000);
+  ReadClockPair(&ns1, &c1);
+
+  if (ns1 <= ns0 || c1 <= c0) {
+    LOG(WARNING) << "Could not calibrate TSC, CycleClock falls back to CLOCK_MONOTONIC";
+    return res;
+  }
+
+  double freq = double(c1 - c0) * 1e9 / (ns1 - ns0);
+
+  // Sanity check against broken virtualized TSCs.
+  if (freq < 1e8 || freq > 1e11) {
+    LOG(WARNING) << "Bogus TSC frequency " << freq << ", CycleClock falls back to CLOCK_MONOTONIC";
+    return res;
+  }
+
+  res.use_tsc = true;
+  res.frequency = freq;
+  res.nanos_per_cycle = 1e9 / freq;
+  VLOG(1) << "Calibrated TSC frequency: " << res.frequency;
+#endif
+
+  return res;
+}
+
 void StringAppendStrftime(string* dst,
                           const char* format,
                           time_t when,
@@ -5,6 +5,11 @@
 #pragma once
 
 #include <sys/time.h>
+#include <time.h>
+
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
 
 #include <string>
 
@@ -110,5 +115,91 @@ uint64 GetMonotonicJiffies();
 
 uint64 GetMonotonicMicrosFast();
 
+// Thread-safe monotonic clock for hot-path instrumentation, reads the TSC in a few nanoseconds.
+// The TSC is used only if the CPU reports it as invariant, i.e. ticking at a constant rate
+// regardless of frequency scaling and sleep states. Its rate is calibrated against
+// CLOCK_MONOTONIC upon the first use, which takes a few milliseconds. Otherwise falls back to
+// CLOCK_MONOTONIC and a cycle is a nanosecond.
+// Values of different threads are comparable only if the kernel synchronized the TSCs of all
+// the cores, which is the case on modern single-socket machines.
+class CycleClock {
+ public:
+  static uint64 Now() {
+#ifdef __x86_64__
+    if (params().use_tsc)
+      return __rdtsc();
+#endif
+    return MonotonicNanos();
+  }
+
+  // Like Now() but waits until all the preceding instructions executed, so they are
+  // accounted in the measured interval.
+  static uint64 NowP() {
+#ifdef __x86_64__
+    if (params().use_tsc) {
+      unsigned aux;
+      return __rdtscp(&aux);
+    }
+#endif
+    return MonotonicNanos();
+  }
+
+  // Cycles per second.
+  static uint64 Frequency() { return params().frequency; }
+
+  static uint64 ToNanos(uint64 cycles) { return cycles * params().nanos_per_cycle; }
+  static uint64 ToMicros(uint64 cycles) { return ToNanos(cycles) / 1000; }
+
+  static bool IsTsc() { return params().use_tsc; }
+
+ private:
+  struct Params {
+    bool use_tsc;
+    uint64 frequency;
+    double nanos_per_cycle;
+  };
+
+  static const Params& params() {
+    static const Params params = Calibrate();
+    return params;
+  }
+
+  static Params Calibrate();
+
+  static uint64 MonotonicNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+};
+
+// Adds the lifetime of the scope in nanoseconds to the histogram. Hist is any type with
+// Add(uint64) method, for example base::HdrHistogram, util::VarzLatency or base::Histogram.
+//
+//   static util::VarzLatency parse_latency("parse-latency-ns");
+//   ...
+//   ScopedCycleTimer<util::VarzLatency> timer(&parse_latency);
+template <typename Hist> class ScopedCycleTimer {
+ public:
+  explicit ScopedCycleTimer(Hist* hist) : hist_(hist), start_(CycleClock::Now()) {}
+
+  ~ScopedCycleTimer() {
+    if (hist_)
+      hist_->Add(ElapsedNanos());
+  }
+
+  uint64 ElapsedNanos() const { return CycleClock::ToNanos(CycleClock::Now() - start_); }
+
+  // The interval is not recorded.
+  void Dismiss() { hist_ = nullptr; }
+
+ private:
+  Hist* hist_;
+  uint64 start_;
+
+  ScopedCycleTimer(const ScopedCycleTimer&) = delete;
+  void operator=(const ScopedCycleTimer&) = delete;
+};
+
 }  // namespace base
 
@@ -17,6 +17,7 @@
 
 #include "base/flags.h"
 #include "base/gtest.h"
+#include "base/hdr_histogram.h"
 #include "base/logging.h"
 
 DEFINE_int32(test_sleep_delay_sec, 1, "");
@@ -126,6 +127,36 @@ TEST_F(WalltimeTest, ThreadTime) {
   t1.join();
 }
 
+TEST_F(WalltimeTest, CycleClock) {
+  LOG(INFO) << "CycleClock tsc: " << CycleClock::IsTsc() << ", freq: " << CycleClock::Frequency();
+  EXPECT_GE(CycleClock::Frequency(), 100000000);
+
+  uint64 c0 = CycleClock::Now();
+  MicrosecondsInt64 start = GetMonotonicMicros();
+  SleepForMilliseconds(20);
+  uint64 elapsed = CycleClock::ToMicros(CycleClock::NowP() - c0);
+  MicrosecondsInt64 expected = GetMonotonicMicros() - start;
+
+  EXPECT_GE(elapsed, 19000);
+  EXPECT_NEAR(elapsed, expected, expected / 20 + 100);
+}
+
+TEST_F(WalltimeTest, ScopedCycleTimer) {
+  HdrHistogram hist;
+  {
+    ScopedCycleTimer<HdrHistogram> timer(&hist);
+    SleepForMilliseconds(2);
+  }
+  {
+    ScopedCycleTimer<HdrHistogram> timer(&hist);
+    timer.Dismiss();
+  }
+
+  HdrHistogram::Snapshot snap = hist.Read();
+  ASSERT_EQ(1, snap.count());
+  EXPECT_GE(snap.max(), 1900000);
+}
+
 using benchmark::DoNotOptimize;
 
 static void BM_TimeX4(benchmark::State& state) {
@@ -171,6 +202,13 @@ void BM_ThreadClockById(benchmark::State& state) {
 }
 BENCHMARK(BM_ThreadClockById);
 
+static void BM_CycleClock(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    DoNotOptimize(CycleClock::Now());
+  }
+}
+BENCHMARK(BM_CycleClock);
+
 static void BM_ChronoSteady(benchmark::State& state) {
   while (state.KeepRunning()) {
     DoNotOptimize(steady_clock::now());
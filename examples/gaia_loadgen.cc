@@ -0,0 +1,371 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+// Drives a RESP, HTTP or RPC endpoint and reports the latency distribution.
+//
+// With --rate, requests follow an open-loop schedule and the latency of a request is measured
+// from the time it was scheduled at rather than from the time it was sent. A stalled server
+// delays the sends but not the schedule, so the stall shows up in the latencies of all the
+// requests it delayed (no coordinated omission). Without --rate every connection sends as fast
+// as --pipeline allows.
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <deque>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "base/histogram.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "util/asio/fiber_socket.h"
+#include "util/asio/io_context_pool.h"
+#include "util/proc_stats.h"
+#include "util/rpc/frame_format.h"
+
+DEFINE_string(protocol, "resp", "resp (PING), http (GET --http_path) or rpc (echo envelopes)");
+DEFINE_string(host, "localhost", "Server host");
+DEFINE_string(port, "6380", "Server port");
+DEFINE_uint32(connections, 16, "Total number of connections");
+DEFINE_uint32(pipeline, 1, "Maximal number of requests in flight per connection");
+DEFINE_uint32(rate, 0, "Total requests per second on an open-loop schedule, 0 for closed loop");
+DEFINE_uint32(duration, 10, "Duration of the run in seconds");
+DEFINE_int32(io_threads, 0, "Number of the client threads, 0 for the number of cpus");
+DEFINE_string(http_path, "/", "Path of the http requests");
+DEFINE_uint32(rpc_letter_size, 64, "Size of the rpc request letters");
+DEFINE_int32(server_pid, 0, "If set, reports the cpu that the server process used");
+
+using namespace boost;
+using namespace std;
+using namespace util;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+class Protocol {
+ public:
+  virtual ~Protocol() {}
+
+  virtual void AppendRequest(uint64_t id, string* out) = 0;
+
+  // Returns the size of the reply at the start of buf, 0 if it is incomplete and -1 if it is
+  // malformed.
+  virtual ssize_t ParseReply(const char* buf, size_t len) = 0;
+};
+
+class RespProtocol : public Protocol {
+ public:
+  void AppendRequest(uint64_t id, string* out) final {
+    out->append("*1\r\n$4\r\nPING\r\n");
+  }
+
+  ssize_t ParseReply(const char* buf, size_t len) final;
+};
+
+ssize_t RespProtocol::ParseReply(const char* buf, size_t len) {
+  const char* eol = static_cast<const char*>(memchr(buf, '\n', len));
+  if (!eol)
+    return 0;
+  ssize_t line_len = eol - buf + 1;
+
+  switch (buf[0]) {
+    case '+':
+    case '-':
+    case ':':
+      return line_len;
+    case '$': {
+      int64_t bulk_len;
+      if (!absl::SimpleAtoi(absl::string_view(buf + 1, line_len - 3), &bulk_len))
+        return -1;
+      if (bulk_len < 0)
+        return line_len;
+      ssize_t total = line_len + bulk_len + 2;
+      return ssize_t(len) >= total ? total : 0;
+    }
+    case '*': {
+      int64_t count;
+      if (!absl::SimpleAtoi(absl::string_view(buf + 1, line_len - 3), &count))
+        return -1;
+      ssize_t total = line_len;
+      for (int64_t i = 0; i < count; ++i) {
+        ssize_t res = ParseReply(buf + total, len - total);
+        if (res <= 0)
+          return res;
+        total += res;
+      }
+      return total;
+    }
+  }
+  return -1;
+}
+
+class HttpProtocol : public Protocol {
+ public:
+  void AppendRequest(uint64_t id, string* out) final {
+    out->append("GET ").append(FLAGS_http_path).append(" HTTP/1.1\r\nHost: ");
+    out->append(FLAGS_host).append("\r\n\r\n");
+  }
+
+  // Supports the replies with Content-Length.
+  ssize_t ParseReply(const char* buf, size_t len) final;
+};
+
+ssize_t HttpProtocol::ParseReply(const char* buf, size_t len) {
+  absl::string_view str(buf, len);
+  size_t hdr_end = str.find("\r\n\r\n");
+  if (hdr_end == absl::string_view::npos)
+    return 0;
+
+  absl::string_view headers = str.substr(0, hdr_end);
+  size_t body_len = 0;
+  while (!headers.empty()) {
+    size_t eol = headers.find("\r\n");
+    absl::string_view line = headers.substr(0, eol);
+    headers.remove_prefix(eol == absl::string_view::npos ? headers.size() : eol + 2);
+
+    constexpr absl::string_view kLength = "content-length:";
+    if (absl::StartsWithIgnoreCase(line, kLength)) {
+      line.remove_prefix(kLength.size());
+      if (!absl::SimpleAtoi(absl::StripAsciiWhitespace(line), &body_len))
+        return -1;
+    }
+  }
+
+  size_t total = hdr_end + 4 + body_len;
+  return len >= total ? total : 0;
+}
+
+class RpcProtocol : public Protocol {
+ public:
+  void AppendRequest(uint64_t id, string* out) final {
+    uint8_t buf[rpc::Frame::kMaxByteSize];
+    rpc::Frame frame(id, 0, FLAGS_rpc_letter_size);
+    unsigned sz = frame.Write(buf);
+    out->append(reinterpret_cast<char*>(buf), sz);
+    out->append(FLAGS_rpc_letter_size, 'a');
+  }
+
+  ssize_t ParseReply(const char* buf, size_t len) final;
+
+ private:
+  // Lets Frame::Read decode a frame header from memory.
+  struct MemoryStream {
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+
+    template <typename MBS> size_t read_some(const MBS& bufs, system::error_code& ec) {
+      size_t res = asio::buffer_copy(bufs, asio::buffer(data + pos, size - pos));
+      if (res == 0)
+        ec = asio::error::eof;
+      pos += res;
+      return res;
+    }
+
+    template <typename MBS> size_t read_some(const MBS& bufs);
+  };
+};
+
+ssize_t RpcProtocol::ParseReply(const char* buf, size_t len) {
+  MemoryStream stream{buf, len};
+  rpc::Frame frame;
+  system::error_code ec = frame.Read(&stream);
+  if (ec == asio::error::eof)
+    return 0;
+  if (ec)
+    return -1;
+
+  size_t total = stream.pos + frame.total_size();
+  return len >= total ? total : 0;
+}
+
+unique_ptr<Protocol> CreateProtocol() {
+  if (FLAGS_protocol == "resp")
+    return make_unique<RespProtocol>();
+  if (FLAGS_protocol == "http")
+    return make_unique<HttpProtocol>();
+  if (FLAGS_protocol == "rpc")
+    return make_unique<RpcProtocol>();
+  LOG(FATAL) << "Unknown protocol " << FLAGS_protocol;
+  return nullptr;
+}
+
+struct RunStats {
+  base::Histogram latency_usec;
+  uint64_t requests = 0, errors = 0;
+};
+
+mutex stats_mu;
+RunStats total_stats;  // Guarded by stats_mu.
+
+// Runs a connection in the calling fiber until end.
+void RunConnection(IoContext& cntx, Clock::duration interval, Clock::time_point end,
+                   RunStats* stats) {
+  unique_ptr<Protocol> proto = CreateProtocol();
+  FiberSyncSocket sock(FLAGS_host, FLAGS_port, &cntx);
+  system::error_code ec = sock.ClientWaitToConnect(2000);
+  if (ec) {
+    LOG(ERROR) << "Could not connect: " << ec.message();
+    ++stats->errors;
+    return;
+  }
+
+  // The times the requests in flight were scheduled at.
+  deque<Clock::time_point> inflight;
+  fibers::mutex mu;
+  fibers::condition_variable cv;
+  bool broken = false;
+
+  fibers::fiber reader([&] {
+    string buf;
+    size_t parsed = 0;
+    char chunk[1 << 14];
+
+    while (true) {
+      size_t sz = sock.read_some(asio::buffer(chunk), ec);
+      if (ec)
+        break;
+      buf.append(chunk, sz);
+
+      while (parsed < buf.size()) {
+        ssize_t res = proto->ParseReply(buf.data() + parsed, buf.size() - parsed);
+        if (res < 0) {
+          LOG(ERROR) << "Bad reply: " << buf.substr(parsed, 64);
+          ec = asio::error::invalid_argument;
+          break;
+        }
+        if (res == 0)
+          break;
+        parsed += res;
+
+        std::lock_guard<fibers::mutex> lk(mu);
+        CHECK(!inflight.empty()) << "Unexpected reply";
+        auto usec = chrono::duration_cast<chrono::microseconds>(Clock::now() - inflight.front());
+        stats->latency_usec.Add(usec.count());
+        ++stats->requests;
+        inflight.pop_front();
+        cv.notify_one();
+      }
+      if (ec)
+        break;
+      buf.erase(0, parsed);
+      parsed = 0;
+    }
+
+    std::lock_guard<fibers::mutex> lk(mu);
+    broken = true;
+    cv.notify_one();
+  });
+
+  string req;
+  Clock::time_point next = Clock::now();
+  for (uint64_t id = 1; Clock::now() < end; ++id) {
+    // The schedule does not wait for the replies.
+    if (interval.count()) {
+      next += interval;
+      this_fiber::sleep_until(next);
+    }
+
+    std::unique_lock<fibers::mutex> lk(mu);
+    cv.wait(lk, [&] { return broken || inflight.size() < FLAGS_pipeline; });
+    if (broken)
+      break;
+    inflight.push_back(interval.count() ? next : Clock::now());
+    lk.unlock();
+
+    req.clear();
+    proto->AppendRequest(id, &req);
+    asio::write(sock, asio::buffer(req), ec);
+    if (ec)
+      break;
+  }
+
+  {
+    // Waits for the replies in flight.
+    std::unique_lock<fibers::mutex> lk(mu);
+    if (!cv.wait_for(lk, chrono::seconds(1), [&] { return broken || inflight.empty(); }))
+      stats->errors += inflight.size();
+  }
+
+  if (broken || ec) {
+    LOG(ERROR) << "Connection failed: " << ec.message();
+    ++stats->errors;
+  }
+
+  sock.Shutdown(ec);
+  reader.join();
+}
+
+void PrintReport(const RunStats& stats, double seconds, const ProcessStats& server_start) {
+  const base::Histogram& hist = stats.latency_usec;
+  printf("requests: %lu, errors: %lu, qps: %.0f\n", stats.requests, stats.errors,
+         stats.requests / seconds);
+  printf("latency usec: p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, p99.99 %.0f, max %.0f\n",
+         hist.Percentile(50), hist.Percentile(90), hist.Percentile(99), hist.Percentile(99.9),
+         hist.Percentile(99.99), hist.max());
+
+  if (FLAGS_server_pid) {
+    ProcessStats end = ProcessStats::Read(FLAGS_server_pid);
+    uint64_t cpu_ms = (end.user_cpu_ms + end.system_cpu_ms) -
+                      (server_start.user_cpu_ms + server_start.system_cpu_ms);
+    printf("server cpu: %.2f cores, user %lu ms, system %lu ms\n", cpu_ms / (seconds * 1000),
+           end.user_cpu_ms - server_start.user_cpu_ms,
+           end.system_cpu_ms - server_start.system_cpu_ms);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  MainInitGuard guard(&argc, &argv);
+
+  CHECK_GT(FLAGS_connections, 0);
+  CHECK_GT(FLAGS_pipeline, 0);
+  CreateProtocol();  // Validates the flag.
+
+  IoContextPool pool(FLAGS_io_threads);
+  pool.Run();
+
+  // Every connection runs its share of the rate.
+  Clock::duration interval{0};
+  if (FLAGS_rate) {
+    interval = chrono::duration_cast<Clock::duration>(chrono::duration<double>(
+        double(FLAGS_connections) / FLAGS_rate));
+  }
+
+  ProcessStats server_start;
+  if (FLAGS_server_pid)
+    server_start = ProcessStats::Read(FLAGS_server_pid);
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + chrono::seconds(FLAGS_duration);
+
+  pool.AwaitFiberOnAll([&](unsigned index, IoContext& cntx) {
+    unsigned count = FLAGS_connections / pool.size() + (index < FLAGS_connections % pool.size());
+    vector<RunStats> stats(count);
+    vector<fibers::fiber> fbs;
+    for (unsigned i = 0; i < count; ++i) {
+      fbs.emplace_back(&RunConnection, std::ref(cntx), interval, end, &stats[i]);
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+      fbs[i].join();
+
+      lock_guard<mutex> lk(stats_mu);
+      total_stats.latency_usec.Merge(stats[i].latency_usec);
+      total_stats.requests += stats[i].requests;
+      total_stats.errors += stats[i].errors;
+    }
+  });
+
+  double seconds = chrono::duration<double>(Clock::now() - start).count();
+  pool.Stop();
+
+  PrintReport(total_stats, seconds, server_start);
+
+  return 0;
+}
@@ -28,6 +28,9 @@ DEFINE_string(prefix, "", "");
 DEFINE_string(download, "", "");
 DEFINE_string(access_token, "", "");
 DEFINE_string(upload, "", "");
+DEFINE_uint32(parallel_uploads, 0,
+              "If positive, uploads with a composite upload of that many parallel parts");
+DEFINE_uint32(part_mb, 32, "Size of a composite upload part");
 
 using FileQ = fibers::buffered_channel<string>;
 
@@ -116,7 +119,13 @@ void Run(const GCE& gce, IoContext* context) {
     http::HttpsClientPool api_pool(GCE::kApiDomain, &ssl_cntx, context);
     api_pool.set_connect_timeout(2000);
 
-    file::WriteFile* wfile = CHECKED_GET(OpenGcsWriteFile(upload_path, gce, &api_pool));
+    file::WriteFile* wfile;
+    if (FLAGS_parallel_uploads) {
+      wfile = CHECKED_GET(OpenGcsParallelWriteFile(upload_path, gce, &api_pool,
+                                                   FLAGS_parallel_uploads, FLAGS_part_mb << 20));
+    } else {
+      wfile = CHECKED_GET(OpenGcsWriteFile(upload_path, gce, &api_pool));
+    }
 
     string contents(1 << 16, 'a');
     for (size_t i = 0; i < 100; ++i) {
@@ -7,6 +7,7 @@
 #include "base/init.h"
 #include "base/logging.h"
 
+#include "mr/csv_schema.h"
 #include "mr/local_runner.h"
 #include "mr/mr_main.h"
 
@@ -25,7 +26,28 @@ struct GsodRecord {
   int year;
 };
 
+// The columns of the input rows that the job uses, out of the 31 columns of GSOD.
+struct GsodRow {
+  uint32_t station;
+  int year;
+};
+
 namespace mr3 {
+template <> class RecordTraits<GsodRow> {
+  CsvSchema<GsodRow> schema_ =
+      CsvSchema<GsodRow>().Column(0, &GsodRow::station).Column(2, &GsodRow::year);
+
+ public:
+  // Keeps the columns at their places in the schema.
+  static std::string Serialize(bool is_binary, const GsodRow& rec) {
+    return absl::StrCat(rec.station, ",,", rec.year);
+  }
+
+  bool Parse(bool is_binary, std::string&& tmp, GsodRow* res) {
+    return schema_.Parse(&tmp, res);
+  }
+};
+
 template <> class RecordTraits<GsodRecord> {
   std::vector<char*> cols_;
 
@@ -48,19 +70,9 @@ template <> class RecordTraits<GsodRecord> {
 }  // namespace mr3
 
 class GsodMapper {
-  std::vector<char*> cols_;
-
  public:
-  void Do(string val, mr3::DoContext<GsodRecord>* context) {
-    cols_.clear();
-    string tmp = val;
-    SplitCSVLineWithDelimiter(&val.front(), ',', &cols_);
-    CHECK_EQ(31, cols_.size()) << tmp;
-
-    GsodRecord rec;
-    CHECK(absl::SimpleAtoi(cols_[0], &rec.station));
-    CHECK(absl::SimpleAtoi(cols_[2], &rec.year));
-    context->Write(std::move(rec));
+  void Do(GsodRow row, mr3::DoContext<GsodRecord>* context) {
+    context->Write(GsodRecord{row.station, row.year});
   }
 };
 
@@ -90,9 +102,10 @@ int main(int argc, char** argv) {
 
   Pipeline* pipeline = pm.pipeline();
 
-  StringTable ss = pipeline->ReadText("gsod", inputs).set_skip_header(1);
+  // Only the projected columns of the rows are parsed.
+  PTable<GsodRow> rows = pipeline->ReadText("gsod", inputs).set_skip_header(1).As<GsodRow>();
 
-  PTable<GsodRecord> records = ss.Map<GsodMapper>("MapToGsod");
+  PTable<GsodRecord> records = rows.Map<GsodMapper>("MapToGsod");
   records.Write("gsod_map", pb::WireFormat::TXT)
       .WithModNSharding(10, [](const GsodRecord& r) { return r.year; })
       .AndCompress(pb::Output::GZIP);
@@ -1,5 +1,6 @@
 #include <re2/re2.h>
 
+#include "absl/strings/str_split.h"
 #include "base/logging.h"
 #include "file/file_util.h"
 
@@ -14,6 +15,9 @@ using re2::RE2;
 DEFINE_string(e, "",
               "Regular expression with perl-like syntax.\n"
               "See https://github.com/google/re2/wiki/Syntax for details.");
+DEFINE_string(F, "",
+              "Comma separated literals. The input is searched for them before it's split into "
+              "records, only the records that contain any of them are matched with 'e'.");
 
 class Grepper {
  public:
@@ -43,10 +47,15 @@ int main(int argc, char** argv) {
   for (int i = 1; i < argc; ++i) {
     inputs.push_back(argv[i]);
   }
-  CHECK(!FLAGS_e.empty());
+  CHECK(!FLAGS_e.empty() || !FLAGS_F.empty());
 
   Pipeline* pipeline = pm.pipeline();
-  StringTable st = pipeline->ReadText("read_input", inputs);
+  PInput<string> st = pipeline->ReadText("read_input", inputs);
+  if (!FLAGS_F.empty()) {
+    st.set_literals(absl::StrSplit(FLAGS_F, ',', absl::SkipEmpty()));
+  }
+
+  // An empty 'e' matches all the records.
   StringTable no_output = st.Map<Grepper>("grep", FLAGS_e);
   no_output.Write("null", pb::WireFormat::TXT);
 
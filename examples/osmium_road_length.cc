@@ -3,13 +3,20 @@
   EXAMPLE osmium_road_length
 
   Calculate the length of the road network (everything tagged `highway=*`)
-  from the given OSM file.
+  from the given OSM PBF file.
 
   DEMONSTRATES USE OF:
-  * file input
-  * location indexes and the NodeLocationsForWays handler
+  * splitting a PBF file into blobs that are decoded in parallel
+  * location indexes
   * length calculation on the earth using the haversine function
 
+  The blobs of a PBF file are independent, so they are decoded on several
+  threads. The node locations are added to the index in the order of the
+  blobs and the lengths of the ways are calculated in parallel once all the
+  nodes were read. Like the NodeLocationsForWays handler, this requires a
+  file where all the nodes come before the ways, which is the case for the
+  usual PBF extracts.
+
   SIMPLER EXAMPLES you might want to understand first:
   * osmium_read
   * osmium_count
@@ -20,11 +27,23 @@
 
 */
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cstdlib>  // for std::exit
+#include <deque>
+#include <future>
 #include <iostream> // for std::cout, std::cerr
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <protozero/pbf_reader.hpp>
 
-// Allow any format of input files (XML, PBF, ...)
-#include <osmium/io/pbf_input.hpp>
+// For the PBFDataBlobDecoder that decodes a single blob.
+#include <osmium/io/detail/pbf_decoder.hpp>
 
 // For the osmium::geom::haversine::distance() function
 #include <osmium/geom/haversine.hpp>
@@ -36,63 +55,208 @@
 // This will work for all input files keeping the index in memory.
 #include <osmium/index/map/flex_mem.hpp>
 
-// For the NodeLocationForWays handler
-#include <osmium/handler/node_locations_for_ways.hpp>
-
 // The type of index used. This must match the include file above
 using index_type = osmium::index::map::FlexMem<osmium::unsigned_object_id_type, osmium::Location>;
 
-// The location handler always depends on the index type
-using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
+// A blob with OSM data: its offset in the file and its size.
+struct BlobRange {
+    off_t offset;
+    size_t size;
+};
+
+// Returns the data blobs of the file. Every blob is preceded by a BlobHeader
+// message that has its type and size, and by the size of the header as a
+// 4 byte big endian number.
+std::vector<BlobRange> scan_blobs(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw std::runtime_error{"fstat failed"};
+    }
+
+    std::vector<BlobRange> blobs;
+    std::string header;
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        unsigned char size_buf[4];
+        if (pread(fd, size_buf, 4, offset) != 4) {
+            throw std::runtime_error{"Truncated blob header size"};
+        }
+        size_t header_size = (size_buf[0] << 24) | (size_buf[1] << 16) | (size_buf[2] << 8) |
+                             size_buf[3];
+        header.resize(header_size);
+        if (pread(fd, &header[0], header_size, offset + 4) != ssize_t(header_size)) {
+            throw std::runtime_error{"Truncated blob header"};
+        }
+
+        // BlobHeader: 1 - type, 3 - size of the blob.
+        std::string type;
+        size_t datasize = 0;
+        protozero::pbf_reader pbf{header};
+        while (pbf.next()) {
+            switch (pbf.tag()) {
+                case 1:
+                    type = pbf.get_string();
+                    break;
+                case 3:
+                    datasize = pbf.get_int32();
+                    break;
+                default:
+                    pbf.skip();
+            }
+        }
+
+        offset += 4 + header_size;
+        if (type == "OSMData") {
+            blobs.push_back(BlobRange{offset, datasize});
+        }
+        offset += datasize;
+    }
+
+    return blobs;
+}
+
+osmium::memory::Buffer decode_blob(int fd, BlobRange blob) {
+    std::string data(blob.size, '\0');
+    if (pread(fd, &data[0], blob.size, blob.offset) != ssize_t(blob.size)) {
+        throw std::runtime_error{"Truncated blob"};
+    }
+
+    osmium::io::detail::PBFDataBlobDecoder decoder{std::move(data),
+                                                   osmium::osm_entity_bits::node | osmium::osm_entity_bits::way,
+                                                   osmium::io::read_meta::no};
+    return decoder();
+}
+
+// Adds the node locations to the index, runs on the main thread.
+struct NodeIndexHandler : public osmium::handler::Handler {
 
-// This handler only implements the way() function, we are not interested in
-// any other objects.
+    explicit NodeIndexHandler(index_type& index) : index(index) {
+    }
+
+    index_type& index;
+    size_t num_nodes = 0;
+    size_t num_ways = 0;
+
+    void node(const osmium::Node& node) {
+        index.set(node.positive_id(), node.location());
+        ++num_nodes;
+    }
+
+    void way(const osmium::Way&) {
+        ++num_ways;
+    }
+
+}; // struct NodeIndexHandler
+
+// This handler only implements the way() function. It reads the locations of
+// the nodes from the complete index, so many of them run in parallel.
 struct RoadLengthHandler : public osmium::handler::Handler {
 
+    explicit RoadLengthHandler(const index_type& index) : index(index) {
+    }
+
+    const index_type& index;
     double length = 0;
 
     // If the way has a "highway" tag, find its length and add it to the
-    // overall length.
+    // overall length. The nodes missing from the file are skipped.
     void way(const osmium::Way& way) {
         const char* highway = way.tags()["highway"];
-        if (highway) {
-            length += osmium::geom::haversine::distance(way.nodes());
+        if (!highway) {
+            return;
+        }
+
+        osmium::Location prev;
+        for (const auto& node_ref : way.nodes()) {
+            osmium::Location location = index.get_noexcept(node_ref.positive_ref());
+            if (prev.valid() && location.valid()) {
+                length += osmium::geom::haversine::distance(osmium::geom::Coordinates{prev},
+                                                            osmium::geom::Coordinates{location});
+            }
+            prev = location;
         }
     }
 
 }; // struct RoadLengthHandler
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " OSMFILE\n";
+    if (argc != 2 && argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " OSMFILE [THREADS]\n";
+        std::exit(1);
+    }
+    size_t num_threads = argc == 3 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Can not open " << argv[1] << '\n';
         std::exit(1);
     }
 
     try {
-        // Initialize the reader with the filename from the command line and
-        // tell it to only read nodes and ways.
-        osmium::io::Reader reader{argv[1], osmium::osm_entity_bits::node | osmium::osm_entity_bits::way};
+        const std::vector<BlobRange> blobs = scan_blobs(fd);
 
         // The index to hold node locations.
         index_type index;
 
-        // The location handler will add the node locations to the index and then
-        // to the ways
-        location_handler_type location_handler{index};
+        // Up to num_threads blobs are decoded ahead of the main thread and up to
+        // num_threads buffers of ways are being measured.
+        std::deque<std::future<osmium::memory::Buffer>> decoded;
+        std::deque<std::future<double>> lengths;
+        size_t next = 0;
+        auto decode_next = [&] {
+            decoded.push_back(std::async(std::launch::async, decode_blob, fd, blobs[next++]));
+        };
+        while (next < blobs.size() && decoded.size() < num_threads) {
+            decode_next();
+        }
 
-        // Our handler defined above
-        RoadLengthHandler road_length_handler;
+        double length = 0;
+        bool ways_started = false;
+        while (!decoded.empty()) {
+            osmium::memory::Buffer buffer = decoded.front().get();
+            decoded.pop_front();
+            if (next < blobs.size()) {
+                decode_next();
+            }
 
-        // Apply input data to first the location handler and then our own handler
-        osmium::apply(reader, location_handler, road_length_handler);
+            NodeIndexHandler node_handler{index};
+            osmium::apply(buffer, node_handler);
+            if (node_handler.num_nodes && ways_started) {
+                throw std::runtime_error{"The file must have all the nodes before the ways"};
+            }
+            if (node_handler.num_ways == 0) {
+                continue;
+            }
+
+            // The index is complete and is only read from now on.
+            if (!ways_started) {
+                ways_started = true;
+                index.sort();
+            }
+            if (lengths.size() == num_threads) {
+                length += lengths.front().get();
+                lengths.pop_front();
+            }
+            lengths.push_back(std::async(std::launch::async, [&index, buffer = std::move(buffer)]() mutable {
+                RoadLengthHandler road_length_handler{index};
+                osmium::apply(buffer, road_length_handler);
+                return road_length_handler.length;
+            }));
+        }
+        for (auto& future : lengths) {
+            length += future.get();
+        }
 
         // Output the length. The haversine function calculates it in meters,
         // so we first devide by 1000 to get kilometers.
-        std::cout << "Length: " << road_length_handler.length / 1000 << " km\n";
+        std::cout << "Length: " << length / 1000 << " km\n";
     } catch (const std::exception& e) {
         // All exceptions used by the Osmium library derive from std::exception.
         std::cerr << e.what() << '\n';
         std::exit(1);
     }
+    close(fd);
 }
-
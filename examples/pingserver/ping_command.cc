@@ -9,26 +9,26 @@
 const char PingCommand::kReply[] = "+PONG\r\n";
 using namespace boost;
 
-bool PingCommand::Decode(size_t len) {
+unsigned PingCommand::Decode(size_t len) {
   resp_parser_.WriteCommit(len);
 
   absl::string_view line;
   redis::RespParser::ParseStatus status = resp_parser_.ParseNext(&line);
 
-  bool res = false;
-
+  num_replies_ = 0;
   while (status == redis::RespParser::LINE_FINISHED) {
     VLOG(1) << "Line " << line;
 
-    res = HandleLine(line);
-    if (res)
-      break;
-
+    num_replies_ += HandleLine(line);
     status = resp_parser_.ParseNext(&line);
   }
   resp_parser_.Realign();
 
-  return res;
+  constexpr size_t kReplySize = sizeof(kReply) - 1;
+  while (replies_.size() < num_replies_ * kReplySize)
+    replies_.append(kReply, kReplySize);
+
+  return num_replies_;
 }
 
 bool PingCommand::HandleLine(absl::string_view line) {
@@ -56,7 +56,7 @@ bool PingCommand::HandleLine(absl::string_view line) {
 }
 
 boost::asio::const_buffer PingCommand::reply() const {
-  return boost::asio::buffer(kReply, sizeof(kReply) - 1);
+  return boost::asio::buffer(replies_.data(), num_replies_ * (sizeof(kReply) - 1));
 }
 
 using asio::ip::tcp;
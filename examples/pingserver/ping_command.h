@@ -6,6 +6,7 @@
 
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <string>
 
 #include "examples/pingserver/resp_parser.h"
 
@@ -15,11 +16,16 @@ class PingCommand {
 
   static const char kReply[];
 
+  unsigned num_replies_ = 0;
+  std::string replies_;
+
  public:
   PingCommand() {
   }
 
-  bool Decode(size_t len);
+  // Parses len more bytes of the read buffer. Returns the number of complete PING commands,
+  // several when the client pipelines them. reply() holds the replies to all of them.
+  unsigned Decode(size_t len);
 
   boost::asio::mutable_buffer read_buffer() {
     auto span = resp_parser_.GetDestBuf();
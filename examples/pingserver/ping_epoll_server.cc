@@ -136,18 +136,19 @@ class RedisConnection {
 };
 
 void RedisConnection::Handle(EpollManager* mgr, EpollWrapper* wrapper) {
-  auto rb = cmd_.read_buffer();
   int socket = wrapper->fd();
 
   DVLOG(1) << "Handling socket " << socket;
 
   while (true) {
+    auto rb = cmd_.read_buffer();
     int res = read(socket, rb.data(), rb.size());
     if (res > 0) {
-      if (cmd_.Decode(res)) {  // It has a bug in case of pipelined requests.
+      unsigned num = cmd_.Decode(res);
+      if (num) {
         DVLOG(1) << "Sending PONG to " << socket;
 
-        ping_qps.Inc();
+        ping_qps.IncBy(num);
         int res = write(socket, cmd_.reply().data(), cmd_.reply().size());
         CHECK_GT(res, 0);
         #if 0
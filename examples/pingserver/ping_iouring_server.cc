@@ -7,6 +7,7 @@
 
 #include "util/stats/varz_stats.h"
 #include "util/uring/accept_server.h"
+#include "util/uring/fiber_call.h"
 #include "util/uring/fiber_socket.h"
 #include "util/uring/proactor_pool.h"
 #include "util/uring/uring_fiber_algo.h"
@@ -16,6 +17,7 @@
 
 using namespace boost;
 using namespace util;
+using uring::FiberCall;
 using uring::FiberSocket;
 using uring::Proactor;
 using uring::ProactorPool;
@@ -25,45 +27,157 @@ using IoResult = Proactor::IoResult;
 
 DEFINE_int32(http_port, 8080, "Http port.");
 DEFINE_int32(port, 6380, "Redis port");
-DEFINE_uint32(queue_depth, 256, "");
+DEFINE_uint32(queue_depth, 256, "Size of the submission queue of each io_uring");
+
+// The uring features under benchmark, see scripts/ping_benchmark.sh. Zero-copy send and
+// fixed files are controlled by --uring_send_zc_threshold and --proactor_fixed_files.
+DEFINE_string(recv_mode, "copy", "How the connections receive: copy - recv into the buffer "
+              "of the connection, provided - recv into a buffer that the kernel picks from the "
+              "buffer ring, multishot - a single multishot recv into the buffer ring, fixed - "
+              "read_fixed into a buffer registered with the ring");
+DEFINE_bool(sqpoll, false, "If true, the kernel polls the submission queues");
+DEFINE_uint32(busy_poll_usec, 0, "The proactors busy-poll for that long before sleeping");
+DEFINE_uint32(fixed_buffers, 1024, "Number of the registered buffers of each proactor with "
+                                   "--recv_mode=fixed");
 
 VarzQps ping_qps("ping-qps");
 
+namespace {
+
+enum class RecvMode { COPY, PROVIDED, MULTISHOT, FIXED };
+
+RecvMode recv_mode = RecvMode::COPY;
+
+constexpr size_t kFixedBufSize = 4096;
+
+// Slots of the buffer registered with the ring of this proactor.
+struct FixedBuffers {
+  std::unique_ptr<uint8_t[]> mem;
+  std::vector<unsigned> free_slots;
+
+  void Init(Proactor* p, unsigned count) {
+    mem.reset(new uint8_t[count * kFixedBufSize]);
+    iovec iov{mem.get(), count * kFixedBufSize};
+    int res = p->RegisterBuffers(&iov, 1);
+    LOG_IF(WARNING, res < 0) << "Could not register buffers " << -res;
+    if (res == 0) {
+      for (unsigned i = count; i > 0; --i)
+        free_slots.push_back(i - 1);
+    }
+  }
+};
+
+thread_local FixedBuffers fixed_buffers;
+
+}  // namespace
+
 class PingConnection : public uring::Connection {
  public:
   PingConnection() {}
 
-  void Handle(IoResult res, int32_t payload, Proactor* mgr);
-
-  void StartPolling(int fd, Proactor* mgr);
-
  private:
   void HandleRequests() final;
 
+  // Returns the number of the received bytes or a negative errno, 0 on EOF.
+  ssize_t RecvFixed(unsigned slot);
+
+  // Handles the data received outside of the read buffer of cmd_.
+  bool HandleData(const uint8_t* data, size_t size, AsioStreamAdapter<FiberSocket>* asa);
+  bool Reply(size_t len, AsioStreamAdapter<FiberSocket>* asa);
+
   PingCommand cmd_;
 };
 
+bool PingConnection::Reply(size_t len, AsioStreamAdapter<FiberSocket>* asa) {
+  unsigned num = cmd_.Decode(len);
+  if (num == 0)
+    return true;
+
+  ping_qps.IncBy(num);
+  system::error_code ec;
+  asio::write(*asa, cmd_.reply(), ec);
+  return !ec;
+}
+
+bool PingConnection::HandleData(const uint8_t* data, size_t size,
+                                AsioStreamAdapter<FiberSocket>* asa) {
+  while (size) {
+    auto dest = cmd_.read_buffer();
+    size_t len = std::min(size, dest.size());
+    memcpy(dest.data(), data, len);
+    if (!Reply(len, asa))
+      return false;
+    data += len;
+    size -= len;
+  }
+  return true;
+}
+
+ssize_t PingConnection::RecvFixed(unsigned slot) {
+  FiberCall fc(socket_.proactor());
+  fc->PrepReadFixed(socket_.native_handle(), fixed_buffers.mem.get() + slot * kFixedBufSize,
+                    kFixedBufSize, 0, 0);
+  return fc.Get();
+}
 
 void PingConnection::HandleRequests() {
   system::error_code ec;
 
   AsioStreamAdapter<FiberSocket> asa(socket_);
-  while (true) {
-    size_t res = asa.read_some(cmd_.read_buffer(), ec);
-    if (FiberSocket::IsConnClosed(ec))
-      break;
-
-    CHECK(!ec) << ec << "/" << ec.message();
-    VLOG(1) << "Read " << res << " bytes";
-
-    if (cmd_.Decode(res)) {  // The flow has a bug in case of pipelined requests.
-      ping_qps.Inc();
-      asa.write_some(cmd_.reply(), ec);
-      if (ec) {
+
+  // The modes without the kernel support fall back to the copying recv.
+  RecvMode mode = recv_mode;
+  int fixed_slot = -1;
+  if (mode == RecvMode::FIXED) {
+    if (fixed_buffers.free_slots.empty()) {
+      mode = RecvMode::COPY;
+    } else {
+      fixed_slot = fixed_buffers.free_slots.back();
+      fixed_buffers.free_slots.pop_back();
+    }
+  }
+  std::unique_ptr<uring::MultishotReceiver> receiver;
+  if (mode == RecvMode::MULTISHOT)
+    receiver.reset(new uring::MultishotReceiver(&socket_));
+
+  bool ok = true;
+  while (ok) {
+    switch (mode) {
+      case RecvMode::COPY: {
+        size_t res = asa.read_some(cmd_.read_buffer(), ec);
+        ok = !ec && Reply(res, &asa);
+        break;
+      }
+      case RecvMode::PROVIDED:
+      case RecvMode::MULTISHOT: {
+        auto res = receiver ? receiver->Recv() : socket_.RecvProvided();
+        if (!res) {
+          LOG_IF(WARNING, res.error() != std::errc::connection_aborted)
+              << "Recv error " << res.error().message();
+          ok = false;
+          break;
+        }
+        ok = HandleData(res->data, res->size, &asa);
+        socket_.ReturnProvided(*res);
+        break;
+      }
+      case RecvMode::FIXED: {
+        ssize_t res = RecvFixed(fixed_slot);
+        if (res <= 0) {
+          ok = false;
+          break;
+        }
+        ok = HandleData(fixed_buffers.mem.get() + fixed_slot * kFixedBufSize, res, &asa);
         break;
       }
     }
   }
+  LOG_IF(WARNING, ec && !FiberSocket::IsConnClosed(ec))
+      << "Connection error " << ec << "/" << ec.message();
+
+  receiver.reset();
+  if (fixed_slot >= 0)
+    fixed_buffers.free_slots.push_back(fixed_slot);
   socket_.Shutdown(SHUT_RDWR);
 }
 
@@ -79,8 +193,27 @@ int main(int argc, char* argv[]) {
 
   CHECK_GT(FLAGS_port, 0);
 
+  if (FLAGS_recv_mode == "provided") {
+    recv_mode = RecvMode::PROVIDED;
+  } else if (FLAGS_recv_mode == "multishot") {
+    recv_mode = RecvMode::MULTISHOT;
+  } else if (FLAGS_recv_mode == "fixed") {
+    recv_mode = RecvMode::FIXED;
+  } else {
+    CHECK_EQ("copy", FLAGS_recv_mode);
+  }
+
+  Proactor::Options opts;
+  opts.ring_depth = FLAGS_queue_depth;
+  opts.sqpoll = FLAGS_sqpoll;
+  opts.busy_poll_usec = FLAGS_busy_poll_usec;
+
   ProactorPool pp;
-  pp.Run();
+  pp.Run(opts);
+
+  if (recv_mode == RecvMode::FIXED) {
+    pp.AwaitOnAll([](Proactor* p) { fixed_buffers.Init(p, FLAGS_fixed_buffers); });
+  }
 
   uring::AcceptServer uring_acceptor(&pp);
   uring_acceptor.AddListener(FLAGS_port, new PingListener);
@@ -26,7 +26,7 @@ int main(int argc, char** argv) {
   LOG(INFO) << "Started http server on port " << port;
 
   RespListener resp_listener;
-  resp_listener.Init();
+  resp_listener.Init(&pool);
 
   port = server->AddListener(FLAGS_port, &resp_listener);
   LOG(INFO) << "Started redis server on port " << port;
@@ -15,6 +15,7 @@
 #include "base/logging.h"
 #include "examples/redis/redis_command.h"
 #include "examples/redis/resp_parser.h"
+#include "examples/redis/sharded_keyspace.h"
 
 #define VLOG_CONN(level) VLOG(level) << "[" << conn_id_ << "] "
 
@@ -40,7 +41,6 @@ static_assert(bitmask(FL_DENYOOM, FL_WRITE) == 5, "");
 RespConnectionHandler::RespConnectionHandler(const std::vector<Command>& commands,
                                              util::IoContext* context)
     : ConnectionHandler(context), commands_(commands) {
-  use_flusher_fiber_ = true;
 }
 
 void RespConnectionHandler::OnOpenSocket() {
@@ -52,6 +52,10 @@ void RespConnectionHandler::OnOpenSocket() {
    Example commands: echo -e '*1\r\n$4\r\PING\r\n', echo -e 'PING\r\n',
    echo -e ' \r\n*1\r\n$7\r\nCOMMAND\r\n'
    { echo -e '*2\r\n$4\r\nPING\r\n$3\r\nfoo\r\n';  } | nc  localhost 6379
+
+   Pipelining: all the complete commands in the read buffer are executed one after another
+   and their replies are accumulated in outgoing_buf_. The replies are written with a single
+   vectored write right before the handler blocks on reading the socket again.
 */
 system::error_code RespConnectionHandler::HandleRequest() {
   RespParser parser;
@@ -101,6 +105,11 @@ system::error_code RespConnectionHandler::HandleIoState(RespParser* parser, IoSt
           break;
         }
 
+        // The batch of the buffered commands is over.
+        FlushWrites();
+        if (req_ec_)
+          return req_ec_;
+
         auto dest_buf = parser->GetDestBuf();
         if (dest_buf.size() < 2) {
           LOG(ERROR) << "No write space and read buf is " << parser->ReadBuf().size();
@@ -120,6 +129,9 @@ system::error_code RespConnectionHandler::HandleIoState(RespParser* parser, IoSt
       }
       case IoState::READ_N:
         CHECK(parser->IsReadEof());
+        FlushWrites();
+        if (req_ec_)
+          return req_ec_;
         asio::read(*socket_, bulk_str_, ec);
         if (ec)
           return ec;
@@ -205,6 +217,8 @@ void RespConnectionHandler::HandleCommand() {
   CHECK_GT(num_args_, 0);
 
   DLOG(INFO) << "Command: " << num_args_ << " " << absl::StrJoin(args_, " ");
+
+  // Bounds the memory of a long pipeline.
   if (outgoing_buf_.size() > 100) {
     FlushWrites();
     if (req_ec_)
@@ -238,8 +252,7 @@ void RespConnectionHandler::HandleCommand() {
 }
 
 bool RespConnectionHandler::FlushWrites() {
-  std::unique_lock<fibers::mutex> ul(wr_mu_, std::try_to_lock_t{});
-  if (!ul || outgoing_buf_.empty() || !socket_->is_open())
+  if (outgoing_buf_.empty() || !socket_->is_open())
     return false;
 
   VLOG(1) << "FlushWrites";
@@ -263,7 +276,9 @@ RespListener::RespListener() {
 RespListener::~RespListener() {
 }
 
-void RespListener::Init() {
+void RespListener::Init(util::IoContextPool* pool) {
+  keyspace_.reset(new ShardedKeyspace(pool));
+
   commands_.emplace_back("COMMAND", 0, bitmask(FL_RANDOM, FL_LOADING, FL_STALE));
   commands_.back().SetFunction(
       [this](const auto& args, string* s) { return PrintCommands(args, s); });
@@ -278,6 +293,9 @@ void RespListener::Init() {
   commands_.emplace_back("GET", 2, bitmask(FL_READONLY, FL_FAST));
   commands_.back().SetFunction([this](const auto& args, string* s) { return Get(args, s); });
   commands_.back().SetKeyArgParams(1, 1, 1);
+
+  commands_.emplace_back("DEL", -2, bitmask(FL_WRITE));
+  commands_.back().SetFunction([this](const auto& args, string* s) { return Del(args, s); });
 }
 
 void RespListener::PrintCommands(const Args& args, string* dest) {
@@ -317,25 +335,39 @@ void RespListener::Ping(const Args& args, string* dest) {
 void RespListener::Set(const Args& args, string* dest) {
   VLOG(1) << "Set Handler " << args.size();
 
-  VLOG(1) << args[0] << "|" << args[1] << "|" << args[2];
+  if (args.size() > 3) {
+    *dest = "-ERR syntax error\r\n";
+    return;
+  }
+  keyspace_->Set(args[1], args[2]);
 
   *dest = "+OK\r\n";
 }
 
 void RespListener::Get(const Args& args, std::string* dest) {
-  VLOG(1) << "Set Handler " << args.size();
+  VLOG(1) << "Get Handler " << args.size();
 
-  if (args.size() < 2) {
-    *dest = "-ERR wrong number of arguments for 'set' command\r\n";
-    return;
+  string value;
+  if (keyspace_->Get(args[1], &value)) {
+    absl::StrAppend(dest, "$", value.size(), "\r\n", value, "\r\n");
+  } else {
+    *dest = "$-1\r\n";
   }
-  VLOG(1) << args[0] << "|" << args[1] << "|" << args[2];
+}
 
-  *dest = "+OK\r\n";
+void RespListener::Del(const Args& args, std::string* dest) {
+  VLOG(1) << "Del Handler " << args.size();
+
+  // The keys may belong to different shards, each one is deleted by its owner thread.
+  unsigned deleted = 0;
+  for (size_t i = 1; i < args.size(); ++i) {
+    deleted += keyspace_->Del(args[i]);
+  }
+  absl::StrAppend(dest, ":", deleted, "\r\n");
 }
 
 ConnectionHandler* RespListener::NewConnection(util::IoContext& context) {
-  CHECK(!commands_.empty());
+  CHECK(!commands_.empty() && keyspace_);
 
   return new RespConnectionHandler(commands_, &context);
 }
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include "absl/strings/string_view.h"
 #include "absl/types/variant.h"
 #include "util/asio/connection_handler.h"
@@ -12,6 +14,8 @@ namespace redis {
 
 class RespParser;
 class Command;
+class ShardedKeyspace;
+
 /**
  * @brief Server side handler that talks RESP (REdis Serialization Protocol)
  *
@@ -48,7 +52,6 @@ class RespConnectionHandler : public ::util::ConnectionHandler {
   std::vector<std::string> args_;
 
   std::vector<std::string> outgoing_buf_;
-  ::boost::fibers::mutex wr_mu_;
   std::vector<::boost::asio::const_buffer> write_seq_;
 };
 
@@ -59,7 +62,8 @@ class RespListener : public ::util::ListenerInterface {
   RespListener();
   ~RespListener();
 
-  void Init();
+  // Creates the keyspace with a shard per IoContext of pool.
+  void Init(util::IoContextPool* pool);
 
   util::ConnectionHandler* NewConnection(util::IoContext& context) final;
 
@@ -68,8 +72,10 @@ class RespListener : public ::util::ListenerInterface {
   void Ping(const Args& args, std::string* dest);
   void Set(const Args& args, std::string* dest);
   void Get(const Args& args, std::string* dest);
+  void Del(const Args& args, std::string* dest);
 
   std::vector<Command> commands_;
+  std::unique_ptr<ShardedKeyspace> keyspace_;
 };
 
 }  // namespace redis
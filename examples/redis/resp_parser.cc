@@ -70,7 +70,9 @@ void RespParser::Realign() {
     write_start_ = buf_.data();
     next_read_ = write_start_;
     next_parse_ = write_start_;
-  } else if (kept_len < 64) {
+  } else if (kept_len < 64 || WriteEnd() - write_start_ < kBufSz / 4) {
+    // Small tails are cheap to move, the large ones are moved only when they block the reads
+    // of the following pipelined commands.
     memmove(buf_.data(), next_read_, kept_len);
     next_read_ = buf_.data();
     write_start_ = buf_.data() + kept_len;
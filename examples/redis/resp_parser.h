@@ -9,7 +9,8 @@
 namespace redis {
 
 class RespParser {
-  static constexpr uint16_t kBufSz = 256;
+  // Holds a batch of small pipelined commands.
+  static constexpr uint16_t kBufSz = 2048;
 
  public:
   using Buffer = absl::Span<uint8_t>;
@@ -0,0 +1,51 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "examples/redis/sharded_keyspace.h"
+
+#include "base/hash.h"
+#include "base/logging.h"
+#include "util/asio/io_context_pool.h"
+
+namespace redis {
+
+using std::string;
+
+ShardedKeyspace::ShardedKeyspace(util::IoContextPool* pool)
+    : pool_(pool), shards_(pool->size()) {
+  CHECK_GT(shards_.size(), 0);
+}
+
+unsigned ShardedKeyspace::ShardId(absl::string_view key) const {
+  return base::ShardOf(key, shards_.size());
+}
+
+// The lambdas below capture by reference because Await blocks until they finish.
+void ShardedKeyspace::Set(absl::string_view key, absl::string_view value) {
+  unsigned sid = ShardId(key);
+  Shard& shard = shards_[sid];
+
+  pool_->at(sid).Await([&] { shard[key].assign(value.data(), value.size()); });
+}
+
+bool ShardedKeyspace::Get(absl::string_view key, string* value) {
+  unsigned sid = ShardId(key);
+  const Shard& shard = shards_[sid];
+
+  return pool_->at(sid).Await([&] {
+    auto it = shard.find(key);
+    if (it == shard.end())
+      return false;
+    *value = it->second;
+    return true;
+  });
+}
+
+bool ShardedKeyspace::Del(absl::string_view key) {
+  unsigned sid = ShardId(key);
+  Shard& shard = shards_[sid];
+
+  return pool_->at(sid).Await([&] { return shard.erase(key) > 0; });
+}
+
+}  // namespace redis
@@ -0,0 +1,47 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+
+namespace util {
+class IoContextPool;
+}  // namespace util
+
+namespace redis {
+
+/**
+ * @brief Keyspace partitioned into one shard per IoContext of the pool.
+ *
+ * A shard is accessed only from the thread of its IoContext, so it needs no locks.
+ * Operations on keys of other shards are sent to their IoContext with IoContext::Await,
+ * which suspends the calling fiber until the owner thread replies. The operations on keys of
+ * the calling thread run inline.
+ */
+class ShardedKeyspace {
+ public:
+  explicit ShardedKeyspace(util::IoContextPool* pool);
+
+  void Set(absl::string_view key, absl::string_view value);
+
+  // Returns false if the key does not exist.
+  bool Get(absl::string_view key, std::string* value);
+
+  // Returns true if the key existed.
+  bool Del(absl::string_view key);
+
+  unsigned ShardId(absl::string_view key) const;
+
+ private:
+  using Shard = absl::flat_hash_map<std::string, std::string>;
+
+  util::IoContextPool* pool_;
+  std::vector<Shard> shards_;
+};
+
+}  // namespace redis
@@ -16,10 +16,10 @@
 #include "absl/strings/strip.h"
 #include "file/file_util.h"
 
+#include "mr/aggregation_table.h"
 #include "mr/local_runner.h"
 #include "mr/mr_main.h"
 #include "mr/pipeline.h"
-#include "strings/unique_strings.h"
 
 using namespace std;
 using namespace boost;
@@ -65,21 +65,20 @@ template <> class RecordTraits<WordCount> {
 
 class WordCountTable {
  public:
-  WordCountTable() { word_cnts_.set_empty_key(StringPiece()); }
-  void AddWord(StringPiece word, uint64_t count) { word_cnts_[word] += count; }
+  void AddWord(StringPiece word, uint64_t count) { word_cnts_.Add(word, count); }
 
   void Flush(DoContext<WordCount>* cntx) {
-    for (const auto& k_v : word_cnts_) {
-      cntx->Write(WordCount{string{k_v.first}, k_v.second});
-    }
-    word_cnts_.clear();
+    word_cnts_.ForEach([cntx](StringPiece word, uint64_t count) {
+      cntx->Write(WordCount{string{word}, count});
+    });
+    word_cnts_.Clear();
   }
 
   size_t MemoryUsage() const { return word_cnts_.MemoryUsage(); }
   size_t size() const { return word_cnts_.size(); }
 
  private:
-  StringPieceDenseMap<uint64_t> word_cnts_;
+  AggregationTable<uint64_t> word_cnts_;
 };
 
 class WordSplitter {
@@ -6,6 +6,10 @@
 
 #include <zlib.h>
 #include <lz4.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#include <memory>
 
 #include "base/logging.h"
 
@@ -114,6 +118,53 @@ Status CompressLZ4(int level, const void* src, size_t len, void* dest,
   return Status::OK;
 }
 
+// zstd contexts are expensive to create, so each thread reuses its own ones.
+struct ZstdContexts {
+  ZSTD_CCtx* cctx = nullptr;
+  ZSTD_DCtx* dctx = nullptr;
+
+  ~ZstdContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+};
+
+thread_local ZstdContexts zstd_contexts;
+
+inline ZSTD_CCtx* ZstdCCtx() {
+  if (!zstd_contexts.cctx)
+    zstd_contexts.cctx = CHECK_NOTNULL(ZSTD_createCCtx());
+  return zstd_contexts.cctx;
+}
+
+inline ZSTD_DCtx* ZstdDCtx() {
+  if (!zstd_contexts.dctx)
+    zstd_contexts.dctx = CHECK_NOTNULL(ZSTD_createDCtx());
+  return zstd_contexts.dctx;
+}
+
+inline Status ZstdResult(size_t res, size_t* size) {
+  if (ZSTD_isError(res)) {
+    return Status(StatusCode::INTERNAL_ERROR, ZSTD_getErrorName(res));
+  }
+  *size = res;
+  return Status::OK;
+}
+
+size_t BoundFunctionZstd(size_t len) {
+  return ZSTD_compressBound(len);
+}
+
+Status CompressZstd(int level, const void* src, size_t len, void* dest, size_t* compress_size) {
+  size_t res = ZSTD_compressCCtx(ZstdCCtx(), dest, *compress_size, src, len, level);
+  return ZstdResult(res, compress_size);
+}
+
+Status UncompressZstd(const void* src, size_t len, void* dest, size_t* uncompress_size) {
+  size_t res = ZSTD_decompressDCtx(ZstdDCtx(), dest, *uncompress_size, src, len);
+  return ZstdResult(res, uncompress_size);
+}
+
 }  // namespace
 
 
@@ -126,6 +177,9 @@ UncompressFunction GetUncompress(CompressMethod m) {
     case CompressMethod::kCompressionLZ4:
       return UncompressZ4;
     break;
+    case CompressMethod::kCompressionZstd:
+      return UncompressZstd;
+    break;
     default:;
   }
   return nullptr;
@@ -139,6 +193,9 @@ CompressFunction GetCompress(CompressMethod m) {
     case CompressMethod::kCompressionLZ4:
       return CompressLZ4;
     break;
+    case CompressMethod::kCompressionZstd:
+      return CompressZstd;
+    break;
     default:;
   }
   return nullptr;
@@ -152,9 +209,52 @@ CompressBoundFunction GetCompressBound(list_file::CompressMethod m) {
     case CompressMethod::kCompressionLZ4:
       return BoundFunctionLZ4;
     break;
+    case CompressMethod::kCompressionZstd:
+      return BoundFunctionZstd;
+    break;
     default:;
   }
   return nullptr;
 }
 
+CompressFunction GetZstdDictCompress(const std::string& dict, int level) {
+  std::shared_ptr<ZSTD_CDict> cdict(
+      CHECK_NOTNULL(ZSTD_createCDict(dict.data(), dict.size(), level)), ZSTD_freeCDict);
+
+  return [cdict](int, const void* src, size_t len, void* dest, size_t* compress_size) {
+    size_t res =
+        ZSTD_compress_usingCDict(ZstdCCtx(), dest, *compress_size, src, len, cdict.get());
+    return ZstdResult(res, compress_size);
+  };
+}
+
+UncompressFunction GetZstdDictUncompress(const std::string& dict) {
+  std::shared_ptr<ZSTD_DDict> ddict(CHECK_NOTNULL(ZSTD_createDDict(dict.data(), dict.size())),
+                                    ZSTD_freeDDict);
+
+  return [ddict](const void* src, size_t len, void* dest, size_t* uncompress_size) {
+    size_t res =
+        ZSTD_decompress_usingDDict(ZstdDCtx(), dest, *uncompress_size, src, len, ddict.get());
+    return ZstdResult(res, uncompress_size);
+  };
+}
+
+std::string TrainZstdDict(const std::string& samples, const std::vector<size_t>& sizes,
+                          size_t max_size) {
+  if (sizes.empty())
+    return std::string();
+
+  std::string dict(max_size, '\0');
+  size_t res = ZDICT_trainFromBuffer(&dict.front(), max_size, samples.data(), sizes.data(),
+                                     sizes.size());
+  if (ZDICT_isError(res)) {
+    VLOG(1) << "Could not train zstd dictionary from " << sizes.size()
+            << " samples: " << ZDICT_getErrorName(res);
+    return std::string();
+  }
+  dict.resize(res);
+
+  return dict;
+}
+
 }  // namespace file
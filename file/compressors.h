@@ -6,6 +6,8 @@
 #include "util/status.h"
 #include "file/list_file_format.h"
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace file {
 
@@ -22,4 +24,16 @@ CompressFunction GetCompress(list_file::CompressMethod m);
 
 CompressBoundFunction GetCompressBound(list_file::CompressMethod method);
 
+// Return the zstd functions that use the dictionary dict. The functions keep a digested copy
+// of dict and can be called from several threads at once. The compression level is fixed
+// when the dictionary is digested.
+CompressFunction GetZstdDictCompress(const std::string& dict, int level);
+UncompressFunction GetZstdDictUncompress(const std::string& dict);
+
+// Trains a zstd dictionary of at most max_size bytes from samples, which are concatenated in
+// 'samples' and have the given sizes. Returns an empty string if zstd could not train it,
+// for example if the samples are too few.
+std::string TrainZstdDict(const std::string& samples, const std::vector<size_t>& sizes,
+                          size_t max_size);
+
 }  // namespace file
@@ -20,7 +20,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 
 #include "base/logging.h"
@@ -90,6 +94,9 @@ class LocalFileImpl : public WriteFile {
 
   Status Write(const uint8* buffer, uint64 length) final;
 
+  // Writes the slices with writev(), i.e. without joining them into a single buffer.
+  Status WriteV(const strings::ByteRange* slices, size_t count) final;
+
  protected:
   int fd_ = 0;
   int flags_;
@@ -136,6 +143,48 @@ Status LocalFileImpl::Write(const uint8* buffer, uint64 length) {
   return Status::OK;
 }
 
+Status LocalFileImpl::WriteV(const strings::ByteRange* slices, size_t count) {
+  constexpr unsigned kMaxIov = 64;
+  struct iovec iov[kMaxIov];
+
+  size_t next = 0, skip = 0;  // skip bytes of slices[next] were already written.
+  while (true) {
+    while (next < count && skip == slices[next].size()) {
+      ++next;
+      skip = 0;
+    }
+    if (next == count)
+      break;
+
+    unsigned num_iov = 0;
+    for (size_t i = next; i < count && num_iov < kMaxIov; ++i) {
+      size_t offset = i == next ? skip : 0;
+      iov[num_iov].iov_base = const_cast<uint8*>(slices[i].data()) + offset;
+      iov[num_iov].iov_len = slices[i].size() - offset;
+      ++num_iov;
+    }
+
+    ssize_t written = writev(fd_, iov, num_iov);
+    if (written < 0) {
+      return StatusFileError();
+    }
+
+    // Advances past the written bytes, the last slice might be written partially.
+    for (size_t left = written; left > 0;) {
+      size_t slice_left = slices[next].size() - skip;
+      if (left < slice_left) {
+        skip += left;
+        break;
+      }
+      left -= slice_left;
+      ++next;
+      skip = 0;
+    }
+  }
+
+  return Status::OK;
+}
+
 }  // namespace
 
 WriteFile::WriteFile(StringPiece name)
@@ -143,6 +192,13 @@ WriteFile::WriteFile(StringPiece name)
 
 WriteFile::~WriteFile() { }
 
+Status WriteFile::WriteV(const strings::ByteRange* slices, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    RETURN_IF_ERROR(Write(slices[i].data(), slices[i].size()));
+  }
+  return Status::OK;
+}
+
 
 
 WriteFile* Open(StringPiece file_name, OpenOptions opts) {
@@ -219,6 +275,58 @@ class PosixReadFile final: public ReadonlyFile {
   int Handle() const final { return fd_; };
 };
 
+// mmap() based access.
+class MmapReadFile final : public ReadonlyFile {
+ private:
+  int fd_;
+  const size_t file_size_;
+  bool drop_cache_;
+  uint8* data_;
+
+ public:
+  MmapReadFile(int fd, size_t sz, uint8* data, bool drop)
+      : fd_(fd), file_size_(sz), drop_cache_(drop), data_(data) {}
+
+  virtual ~MmapReadFile() {
+    Close();
+  }
+
+  Status Close() override {
+    if (data_) {
+      munmap(data_, file_size_);
+      data_ = nullptr;
+    }
+    if (fd_) {
+      if (drop_cache_)
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd_);
+      fd_ = 0;
+    }
+    return Status::OK;
+  }
+
+  StatusObject<size_t> Read(size_t offset, const strings::MutableByteRange& range) override {
+    strings::ByteRange view;
+    if (!ReadView(offset, range.size(), &view)) {
+      return Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+    }
+    if (!view.empty())
+      memcpy(range.begin(), view.data(), view.size());
+    return view.size();
+  }
+
+  bool ReadView(size_t offset, size_t length, strings::ByteRange* view) final {
+    if (offset > file_size_)
+      return false;
+    view->reset(data_ + offset, std::min(length, file_size_ - offset));
+    return true;
+  }
+
+  size_t Size() const final { return file_size_; }
+
+  int Handle() const final { return fd_; };
+};
+
 StatusObject<ReadonlyFile*> ReadonlyFile::Open(StringPiece name, const Options& opts) {
   int fd = open(name.data(), O_RDONLY);
   if (fd < 0) {
@@ -230,6 +338,26 @@ StatusObject<ReadonlyFile*> ReadonlyFile::Open(StringPiece name, const Options&
     return StatusFileError();
   }
 
+  if (opts.use_mmap) {
+    uint8* data = nullptr;
+
+    // Empty files can not be mapped.
+    if (sb.st_size > 0) {
+      void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        Status st = StatusFileError();
+        close(fd);
+        return st;
+      }
+      data = reinterpret_cast<uint8*>(addr);
+      if (opts.sequential) {
+        madvise(addr, sb.st_size, MADV_SEQUENTIAL);
+        madvise(addr, sb.st_size, MADV_WILLNEED);
+      }
+    }
+    return new MmapReadFile(fd, sb.st_size, data, opts.drop_cache_on_close);
+  }
+
   int advice = opts.sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL;
   return new PosixReadFile(fd, sb.st_size, advice, opts.drop_cache_on_close);
 }
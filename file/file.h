@@ -26,6 +26,11 @@ class ReadonlyFile {
   struct Options {
     bool sequential = true;
     bool drop_cache_on_close = true;
+
+    // Maps the file into memory instead of reading it with pread(). Such files support
+    // ReadView(). Useful for hot local files that are read repeatedly, possibly by several
+    // processes. Accessing pages that are not cached blocks the calling thread.
+    bool use_mmap = false;
     Options()  {}
   };
 
@@ -37,6 +42,11 @@ class ReadonlyFile {
   virtual util::StatusObject<size_t>
       Read(size_t offset, const strings::MutableByteRange& range) MUST_USE_RESULT = 0;
 
+  // Zero-copy read for files that keep their contents in memory, e.g. memory mapped files.
+  // Sets *view to upto length bytes at offset and returns true. The view is valid until
+  // the file is closed. Returns false if the file does not support it.
+  virtual bool ReadView(size_t offset, size_t length, strings::ByteRange* view) { return false; }
+
   // releases the system handle for this file. Does not delete this.
   virtual util::Status Close() = 0;
 
@@ -74,6 +84,9 @@ class WriteFile {
     return Write(reinterpret_cast<const uint8*>(slice.data()), slice.size());
   }
 
+  //! Writes count slices in order. The default implementation calls Write() for each of them.
+  virtual util::Status WriteV(const strings::ByteRange* slices, size_t count) MUST_USE_RESULT;
+
   //! Returns the file name given during Create(...) call.
   const std::string& create_file_name() const { return create_file_name_; }
 
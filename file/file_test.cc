@@ -6,13 +6,17 @@
 #include <gmock/gmock.h>
 #include <memory>
 
+#include <zlib.h>
+
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "file/file_util.h"
 #include "file/filesource.h"
 #include "file/gzip_file.h"
+#include "file/gzip_source.h"
 #include "file/lz4_file.h"
 #include "file/test_util.h"
+#include "strings/literal_matcher.h"
 
 #include "util/sinksource.h"
 #include "util/zlib_source.h"
@@ -119,6 +123,207 @@ TEST_F(FileTest, CopyFile) {
   EXPECT_EQ("Test", data);
 }
 
+TEST_F(FileTest, MmapRead) {
+  string file_path = base::GetTestTempPath("mmap.txt");
+  file_util::WriteStringToFileOrDie("Test\nFoo\n", file_path);
+
+  ReadonlyFile::Options opts;
+  opts.use_mmap = true;
+  auto res = ReadonlyFile::Open(file_path, opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  EXPECT_EQ(9, file->Size());
+
+  strings::ByteRange view;
+  ASSERT_TRUE(file->ReadView(5, 100, &view));
+  EXPECT_EQ("Foo\n", strings::AsString(strings::FromBuf(view.data(), view.size())));
+  EXPECT_FALSE(file->ReadView(10, 1, &view));
+
+  uint8 buf[4];
+  auto read_res = file->Read(0, strings::MutableByteRange(buf, sizeof(buf)));
+  ASSERT_TRUE(read_res.ok());
+  EXPECT_EQ(4, read_res.obj);
+  EXPECT_EQ("Test", strings::AsString(strings::FromBuf(buf, 4)));
+  ASSERT_TRUE(file->Close().ok());
+
+  // Empty files are not mapped.
+  file_util::WriteStringToFileOrDie("", file_path);
+  res = ReadonlyFile::Open(file_path, opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  file.reset(res.obj);
+  ASSERT_TRUE(file->ReadView(0, 10, &view));
+  EXPECT_TRUE(view.empty());
+}
+
+TEST_F(FileTest, LineReader) {
+  // Lines of different lengths cross the refills of a 2KB buffer. The long ones do not fit it.
+  std::vector<string> expected;
+  string input;
+  for (unsigned i = 0; i < 500; ++i) {
+    size_t len = i % 50 == 0 ? 5000 : (i * 37) % 700;
+    expected.push_back(string(len, 'a' + i % 26));
+    input.append(expected.back()).append(i % 3 ? "\n" : "\r\n");
+  }
+  input.append("last");
+  expected.push_back("last");
+
+  util::StringSource source(input);
+  LineReader lr(&source, DO_NOT_TAKE_OWNERSHIP, 11);
+  std::vector<string> actual;
+  StringPiece line;
+  string scratch;
+  size_t in_scratch = 0;
+  while (lr.Next(&line, &scratch)) {
+    EXPECT_EQ('\0', line.data()[line.size()]);
+    in_scratch += line.data() == scratch.data();
+    actual.push_back(string(line));
+    EXPECT_EQ(actual.size(), lr.line_num());
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(input.size(), lr.position());
+  EXPECT_EQ(10, in_scratch);
+  EXPECT_TRUE(lr.status().ok());
+}
+
+TEST_F(FileTest, LineReaderMatch) {
+  // The matches are within the views, at their boundaries and in the lines that do not fit
+  // the 2KB buffer.
+  std::vector<string> expected;
+  std::vector<uint64> expected_pos;
+  string input;
+  for (unsigned i = 0; i < 3000; ++i) {
+    string line(i % 100 == 0 ? 3000 : (i * 37) % 300, 'a' + i % 26);
+    if (i % 7 == 0) {
+      line.insert(line.size() / 2, i % 2 ? "id-17" : "id-42");
+      expected.push_back(line);
+      expected_pos.push_back(input.size());
+    }
+    input.append(line).append("\n");
+  }
+
+  util::StringSource source(input);
+  LineReader lr(&source, DO_NOT_TAKE_OWNERSHIP, 11);
+  strings::LiteralMatcher matcher({"id-17", "id-42"});
+  std::vector<string> actual;
+  StringPiece line;
+  string scratch;
+  while (lr.NextMatch(matcher, &line, &scratch)) {
+    ASSERT_LT(actual.size(), expected.size());
+    EXPECT_EQ(expected_pos[actual.size()], lr.line_position());
+    actual.push_back(string(line));
+    EXPECT_EQ(7 * actual.size() - 6, lr.line_num());
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(3000, lr.line_num());
+  EXPECT_EQ(input.size(), lr.position());
+  EXPECT_TRUE(lr.status().ok());
+}
+
+// Appends a BGZF member with the given data to dest.
+static void AppendBgzfMember(StringPiece data, string* dest) {
+  uint8_t header[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0};
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  CHECK_EQ(Z_OK, deflateInit2(&zs, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY));
+  string deflated(deflateBound(&zs, data.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = data.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&deflated.front());
+  zs.avail_out = deflated.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+  deflated.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  uint32_t bsize = sizeof(header) + deflated.size() + 8 - 1;
+  CHECK_LT(bsize, 1 << 16);
+  header[16] = bsize & 0xff;
+  header[17] = bsize >> 8;
+
+  uint32_t trailer[2] = {uint32_t(crc32(0, reinterpret_cast<const Bytef*>(data.data()),
+                                        data.size())),
+                         uint32_t(data.size())};
+  dest->append(reinterpret_cast<char*>(header), sizeof(header));
+  dest->append(deflated);
+  dest->append(reinterpret_cast<char*>(trailer), sizeof(trailer));
+}
+
+TEST_F(FileTest, ParallelGzip) {
+  string data = base::RandStr(3 << 20);
+  string bgzf;
+  for (size_t i = 0; i < data.size(); i += 60000) {
+    AppendBgzfMember(StringPiece(data).substr(i, 60000), &bgzf);
+  }
+  AppendBgzfMember(StringPiece(), &bgzf);  // EOF marker.
+
+  string file_path = base::GetTestTempPath("parallel.gz");
+  auto open_source = [&](ListExecutor* executor) {
+    auto res = ReadonlyFile::Open(file_path);
+    CHECK_STATUS(res.status);
+    return std::unique_ptr<util::Source>(Source::Uncompressed(res.obj, executor));
+  };
+  auto read_all = [](util::Source* source, string* dest) {
+    dest->assign((4 << 20), '\0');
+    auto res = source->Read(strings::MutableByteRange(
+        reinterpret_cast<uint8_t*>(&dest->front()), dest->size()));
+    if (res.ok())
+      dest->resize(res.obj);
+    return res.status;
+  };
+
+  file_util::WriteStringToFileOrDie(bgzf, file_path);
+  ThreadExecutor executor(3);
+  std::unique_ptr<util::Source> source = open_source(&executor);
+  ASSERT_TRUE(dynamic_cast<ParallelGzipSource*>(source.get()));
+
+  string actual;
+  ASSERT_TRUE(read_all(source.get(), &actual).ok());
+  EXPECT_TRUE(actual == data);
+  EXPECT_GT(executor.num_tasks(), 1);
+
+  // Without an executor the file is inflated sequentially.
+  source = open_source(nullptr);
+  EXPECT_FALSE(dynamic_cast<ParallelGzipSource*>(source.get()));
+  ASSERT_TRUE(read_all(source.get(), &actual).ok());
+  EXPECT_TRUE(actual == data);
+
+  // Regular gzip streams are not BGZF.
+  util::StringSource gzip_source(string("\x1f\x8b\x08\x00\0\0\0\0\0\xff") + string(10, 'a'));
+  EXPECT_FALSE(ParallelGzipSource::IsBgzfSource(&gzip_source));
+
+  bgzf[100] ^= 0x55;
+  file_util::WriteStringToFileOrDie(bgzf, file_path);
+  source = open_source(&executor);
+  EXPECT_FALSE(read_all(source.get(), &actual).ok());
+}
+
+TEST_F(FileTest, LineReaderViews) {
+  // Lines of the BGZF members are returned from the inflated chunks in place.
+  std::vector<string> expected;
+  string data;
+  for (unsigned i = 0; i < 20000; ++i) {
+    expected.push_back(std::to_string(i * 7919) + string(i % 100, 'x'));
+    data.append(expected.back()).append("\n");
+  }
+  string bgzf;
+  for (size_t i = 0; i < data.size(); i += 60000) {
+    AppendBgzfMember(StringPiece(data).substr(i, 60000), &bgzf);
+  }
+
+  ThreadExecutor executor(2);
+  ParallelGzipSource* source = new ParallelGzipSource(new util::StringSource(bgzf), &executor);
+  LineReader lr(source, TAKE_OWNERSHIP, 12);
+  std::vector<string> actual;
+  StringPiece line;
+  while (lr.Next(&line)) {
+    EXPECT_EQ('\0', line.data()[line.size()]);
+    actual.push_back(string(line));
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(data.size(), lr.position());
+  EXPECT_TRUE(lr.status().ok());
+}
+
 TEST_F(FileTest, UniquePtr) {
   std::unique_ptr<WriteFile> file(Open(base::GetTestTempPath("foo.txt")));
 }
@@ -4,10 +4,13 @@
 
 #include "file/filesource.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "base/logging.h"
 #include "file/file.h"
+#include "file/gzip_source.h"
+#include "strings/literal_matcher.h"
 #include "strings/split.h"
 #include "strings/strip.h"
 #include "util/bzip_source.h"
@@ -20,8 +23,8 @@ using util::Status;
 using util::StatusObject;
 using namespace std;
 
-Source::Source(ReadonlyFile* file)
- : file_(file) {
+Source::Source(ReadonlyFile* file, uint64 offset)
+ : file_(file), offset_(offset) {
 }
 
 Source::~Source() {
@@ -38,15 +41,18 @@ util::StatusObject<size_t> Source::ReadInternal(const strings::MutableByteRange&
 }
 
 
-util::Source* Source::Uncompressed(ReadonlyFile* file) {
+util::Source* Source::Uncompressed(ReadonlyFile* file, ListExecutor* executor) {
   Source* first = new Source(file);
   if (util::ZStdSource::HasValidHeader(first))
     return new util::ZStdSource(first);
 
   if (util::BzipSource::IsBzipSource(first))
     return new util::BzipSource(first);
-  if (util::ZlibSource::IsZlibSource(first))
+  if (util::ZlibSource::IsZlibSource(first)) {
+    if (executor && ParallelGzipSource::IsBgzfSource(first))
+      return new ParallelGzipSource(first, executor);
     return new util::ZlibSource(first);
+  }
   return first;
 }
 
@@ -59,6 +65,10 @@ util::Status Sink::Append(const strings::ByteRange& slice) {
   return file_->Write(slice.data(), slice.size());
 }
 
+util::Status Sink::AppendV(const strings::ByteRange* slices, size_t count) {
+  return file_->WriteV(slices, count);
+}
+
 
 void LineReader::Init(uint32_t buf_log) {
   CHECK(buf_log > 10 && buf_log < 28) << buf_log;
@@ -66,7 +76,6 @@ void LineReader::Init(uint32_t buf_log) {
 
   buf_.reset(new char[page_size_]);
   next_ = end_ = buf_.get();
-  *next_ = '\n';
 }
 
 LineReader::LineReader(const std::string& fl) : ownership_(TAKE_OWNERSHIP) {
@@ -85,84 +94,121 @@ LineReader::~LineReader() {
 }
 
 bool LineReader::Next(StringPiece* result, std::string* scratch) {
-  bool use_scratch = false;
+  line_position_ = position();
+
+  // Common case: the line is inside the view of the source and is returned in place.
+  char* ptr = reinterpret_cast<char*>(memchr(next_, '\n', end_ - next_));
+  if (ptr) {
+    ++line_num_;
+    char* start = next_;
+    next_ = ptr + 1;
+    if (ptr > start && ptr[-1] == '\r')
+      --ptr;
+    *ptr = '\0';
+    *result = StringPiece(start, ptr - start);
+
+    return true;
+  }
+
+  // The line continues in the next views. It is assembled in buf_ or in scratch if it's longer
+  // than half of the buffer.
+  if (scratch == nullptr)
+    scratch = &scratch_;
 
-  const char* const eof_page = buf_.get() + page_size_ - 1;
+  size_t len = 0;
+  bool use_scratch = false;
   while (true) {
-    // Common case: search of EOL.
-    char* ptr =  reinterpret_cast<char*>(rawmemchr(next_, '\n'));
-
-    if (ptr < end_) {  // Found EOL.
-      ++line_num_;
-
-      unsigned delta = 1;
-      if (ptr > next_ && ptr[-1] == '\r') {
-        --ptr;
-        delta = 2;
-      }
-      *ptr = '\0';
-
-      if (use_scratch) {
-        scratch->append(next_, ptr);
-        *result = *scratch;
-      } else {
-        *result = StringPiece(next_, ptr - next_);
-      }
-      next_ = ptr + delta;
+    char* eol = reinterpret_cast<char*>(memchr(next_, '\n', end_ - next_));
+    char* stop = eol ? eol : end_;
+    size_t sz = stop - next_;
 
-      return true;
+    if (!use_scratch && len + sz > page_size_ / 2) {
+      scratch->assign(buf_.get(), len);
+      use_scratch = true;
     }
-
-    if (next_ != end_) {
-      // Our internal buffer was not empty, but we did not find EOL yet.
-      // Now we've reach end of buffer, so we must copy the data to accomodate the broken line.
-      if (!use_scratch) {
-        if (scratch == nullptr)
-          scratch = &scratch_;
-
-        scratch->assign(next_, end_);
-        use_scratch = true;
-      } else {
-        scratch->append(next_, end_);
-      }
-      next_ = end_;
-      if (end_ != eof_page) {
-        // It's EOF since we've read least than page size.
-        line_num_ |= kEofMask;
-        break;
-      }
+    if (use_scratch) {
+      scratch->append(next_, stop);
+    } else {
+      memcpy(buf_.get() + len, next_, sz);
     }
+    len += sz;
+    next_ = stop;
 
-    strings::MutableByteRange range{reinterpret_cast<uint8_t*>(buf_.get()),
-                                    /* -1 to allow sentinel */ page_size_ - 1};
-    auto s = source_->Read(range);
-    if (!s.ok()) {
-      LOG(ERROR) << "LineReader read error " << s.status << " at line " << line_num_;
-      status_ = s.status;
-
-      return false;
+    if (eol) {
+      ++next_;
+      break;
     }
 
-    if (s.obj == 0) {
+    if (!Refill()) {
+      if (!status_.ok())
+        return false;
+
+      // EOF was reached, the assembled data is the last line.
       line_num_ |= kEofMask;
+      if (len == 0)
+        return false;
       break;
     }
-
-    LOG_IF(ERROR, line_num_ & kEofMask) << "LineReader: read data after EOF was reached";
-    next_ = buf_.get();
-    end_ = next_ + s.obj;
-    *end_ = '\n';  // sentinel.
   }
+  ++line_num_;
 
+  bool eof = line_num_ & kEofMask;
   if (use_scratch) {
+    if (!eof && !scratch->empty() && scratch->back() == '\r')
+      scratch->pop_back();
     *result = *scratch;
-    ++line_num_;
+  } else {
+    if (!eof && len && buf_[len - 1] == '\r')
+      --len;
+    buf_[len] = '\0';
+    *result = StringPiece(buf_.get(), len);
+  }
 
-    return true;
+  return true;
+}
+
+bool LineReader::NextMatch(const strings::LiteralMatcher& matcher, StringPiece* result,
+                           std::string* scratch) {
+  while (true) {
+    size_t len = end_ - next_;
+    size_t pos = matcher.Find(StringPiece(next_, len));
+
+    // Skips to the start of the first line with a match or to the line that continues in the
+    // next view, which is checked after it's assembled.
+    size_t scan_len = pos != StringPiece::npos ? pos : len;
+    char* eol = reinterpret_cast<char*>(memrchr(next_, '\n', scan_len));
+    if (eol) {
+      line_num_ += std::count(next_, eol + 1, '\n');
+      next_ = eol + 1;
+    }
+
+    if (!Next(result, scratch))
+      return false;
+    if (pos != StringPiece::npos || matcher.Contains(*result))
+      return true;
   }
+}
 
-  DCHECK(line_num_ & kEofMask);
-  return false;
+bool LineReader::Refill() {
+  auto res = source_->Peek(page_size_);
+  if (!res.ok()) {
+    LOG(ERROR) << "LineReader read error " << res.status << " at line " << line_num();
+    status_ = res.status;
+
+    return false;
+  }
+
+  strings::MutableByteRange view = res.obj;
+  if (view.empty())
+    return false;
+
+  LOG_IF(ERROR, line_num_ & kEofMask) << "LineReader: read data after EOF was reached";
+  source_->Consume(view.size());
+  read_bytes_ += view.size();
+  next_ = reinterpret_cast<char*>(view.begin());
+  end_ = reinterpret_cast<char*>(view.end());
+
+  return true;
 }
 
 CsvReader::CsvReader(const std::string& filename,
@@ -189,9 +235,12 @@ bool CsvReader::Next(std::vector<StringPiece>* result) {
     if (line.empty())
       continue;
     char* ptr = const_cast<char*>(line.data());
-    parts_.clear();
-    SplitCSVLineWithDelimiter(ptr, ',',  &parts_);
-    result->assign(parts_.begin(), parts_.end());
+    SplitCsvLine(ptr, line.size(), ',', '"', result);
+
+    // Keeps the whitespace semantics of SplitCSVLineWithDelimiter.
+    for (StringPiece& field : *result) {
+      field = absl::StripAsciiWhitespace(field);
+    }
 
     return true;
   }
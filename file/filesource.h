@@ -11,20 +11,27 @@
 #include "strings/stringpiece.h"
 #include "util/sinksource.h"
 
+namespace strings {
+class LiteralMatcher;
+}  // namespace strings
+
 namespace file {
+class ListExecutor;
 class ReadonlyFile;
 class WriteFile;
 
 class Source : public util::Source {
  public:
   // File must be open for reading. Source takes ownership over it.
-  Source(ReadonlyFile* file);
+  // Reading starts at the given file offset.
+  Source(ReadonlyFile* file, uint64 offset = 0);
   ~Source();
 
 
   // Returns the source wrapping the file. If the file is compressed, than the stream
   // automatically inflates the compressed data. The returned source owns the file object.
-  static util::Source* Uncompressed(ReadonlyFile* file);
+  // If executor is set, BGZF files are inflated in parallel on it, see ParallelGzipSource.
+  static util::Source* Uncompressed(ReadonlyFile* file, ListExecutor* executor = nullptr);
  private:
   util::StatusObject<size_t> ReadInternal(const strings::MutableByteRange& range) override;
 
@@ -38,6 +45,7 @@ public:
   Sink(WriteFile* file, Ownership ownership) : file_(file), ownership_(ownership) {}
   ~Sink();
   util::Status Append(const strings::ByteRange& slice) override;
+  util::Status AppendV(const strings::ByteRange* slices, size_t count) override;
 
 private:
   WriteFile* file_;
@@ -61,20 +69,41 @@ public:
 
   uint64 line_num() const { return line_num_ & (kEofMask - 1);}
 
+  // Offset in the source of the line that will be returned by the next call to Next().
+  uint64 position() const { return read_bytes_ - (end_ - next_); }
+
+  // Offset in the source of the line returned by the last call to Next() or NextMatch().
+  uint64 line_position() const { return line_position_; }
+
   // Sets the result to point to null-terminated line.
   // Empty lines are also returned.
   // Returns true if new line was found or false if end of stream was reached.
+  // The lines are read from the views of the source (see util::Source::Peek) and are returned
+  // in place. The lines that cross the views are assembled in the internal buffer, only those
+  // longer than half of the buffer are copied into scratch.
+  // The result is valid until the next call.
   bool Next(StringPiece* result, std::string* scratch = nullptr);
 
+  // Same as Next() but returns only the lines that contain a match of matcher. Searches the
+  // views of the source before they are split into lines, so the lines without a match are
+  // skipped at the speed of the matcher. line_num() and position() account for them.
+  bool NextMatch(const strings::LiteralMatcher& matcher, StringPiece* result,
+                 std::string* scratch = nullptr);
+
   util::Status status() const { return status_; }
 
 private:
   void Init(uint32_t buf_log);
 
+  // Peeks the next view of the source into [next_, end_). Returns false at EOF or on error.
+  bool Refill();
+
   util::Source* source_;
   uint64 line_num_ = 0;   // MSB bit means EOF was reached.
-  std::unique_ptr<char[]> buf_;
-  char* next_, *end_;
+  uint64 read_bytes_ = 0;
+  uint64 line_position_ = 0;
+  std::unique_ptr<char[]> buf_;  // Assembles the lines that cross the views.
+  char* next_, *end_;  // Not consumed part of the current view.
 
   Ownership ownership_;
   uint32_t page_size_;
@@ -97,7 +126,6 @@ public:
 
  private:
   std::string scratch_;
-  std::vector<char*> parts_;
 };
 
 }  // namespace file
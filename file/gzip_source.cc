@@ -0,0 +1,254 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "file/gzip_source.h"
+
+#include <zlib.h>
+
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+
+namespace file {
+
+using util::Status;
+using util::StatusCode;
+using util::StatusObject;
+using std::string;
+
+namespace {
+
+constexpr size_t kChunkSize = 1 << 20;
+
+// Fixed part of the gzip header up to XLEN, followed by the extra field.
+constexpr size_t kGzipHeaderSize = 12;
+constexpr size_t kGzipTrailerSize = 8;
+constexpr uint8_t kFlagExtra = 4;
+
+inline bool IsGzipHeader(const uint8_t* hdr) {
+  return hdr[0] == 0x1f && hdr[1] == 0x8b && hdr[2] == Z_DEFLATED && (hdr[3] & kFlagExtra);
+}
+
+inline uint32_t DecodeLE16(const uint8_t* p) { return p[0] | (uint32_t(p[1]) << 8); }
+
+inline uint32_t DecodeLE32(const uint8_t* p) {
+  return DecodeLE16(p) | (DecodeLE16(p + 2) << 16);
+}
+
+Status CorruptedInput(const char* msg) {
+  return Status(StatusCode::IO_ERROR, absl::StrCat("Corrupted BGZF input: ", msg));
+}
+
+// Inflates the concatenated gzip members of src into dest of size expected.
+Status InflateMembers(const string& src, size_t expected, string* dest) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  CHECK_EQ(Z_OK, inflateInit2(&zs, 15 | 16));
+
+  dest->resize(expected);
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+  zs.avail_in = src.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&dest->front());
+  zs.avail_out = expected;
+
+  Status st;
+  while (zs.avail_in > 0) {
+    int zerror = inflate(&zs, Z_NO_FLUSH);
+    if (zerror == Z_STREAM_END) {
+      CHECK_EQ(Z_OK, inflateReset(&zs));
+      continue;
+    }
+    if (zerror != Z_OK) {
+      st = Status(StatusCode::IO_ERROR, absl::StrCat("ZLib error ", zerror, ": ",
+                                                     zs.msg ? zs.msg : ""));
+      break;
+    }
+  }
+  if (st.ok() && zs.avail_out)
+    st = CorruptedInput("members are shorter than their sizes");
+  inflateEnd(&zs);
+
+  return st;
+}
+
+}  // namespace
+
+struct ParallelGzipSource::Chunk {
+  string compressed;
+  string data;
+  size_t pos = 0;  // Offset of the data that is read next.
+  Status status;
+  std::shared_ptr<ListExecutor::Event> done;  // Set while the chunk is inflated.
+};
+
+ParallelGzipSource::ParallelGzipSource(util::Source* sub_source, ListExecutor* executor,
+                                       unsigned max_inflight)
+    : sub_(sub_source), executor_(executor), max_inflight_(max_inflight) {
+  CHECK(executor_);
+  CHECK_GT(max_inflight_, 0);
+}
+
+ParallelGzipSource::~ParallelGzipSource() {
+  for (auto& chunk : chunks_) {
+    if (chunk->done)
+      chunk->done->Wait();
+  }
+}
+
+bool ParallelGzipSource::IsBgzfSource(util::Source* source) {
+  // bgzip writes the "BC" subfield first.
+  uint8_t buf[kGzipHeaderSize + 4];
+  auto res = source->Read(strings::MutableByteRange(buf, sizeof(buf)));
+  if (!res.ok())
+    return false;
+
+  source->Prepend(strings::ByteRange(buf, res.obj));
+
+  return res.obj == sizeof(buf) && IsGzipHeader(buf) && DecodeLE16(buf + 10) >= 6 &&
+         buf[12] == 'B' && buf[13] == 'C' && DecodeLE16(buf + 14) == 2;
+}
+
+StatusObject<size_t> ParallelGzipSource::ReadMember(string* dest, uint32_t* isize) {
+  uint8_t hdr[kGzipHeaderSize];
+  auto res = sub_->Read(strings::MutableByteRange(hdr, sizeof(hdr)));
+  if (!res.ok())
+    return res.status;
+  if (res.obj == 0)
+    return 0;
+  if (res.obj < sizeof(hdr) || !IsGzipHeader(hdr))
+    return CorruptedInput("invalid member header");
+
+  const size_t start = dest->size();
+  const uint32_t xlen = DecodeLE16(hdr + 10);
+  dest->append(reinterpret_cast<const char*>(hdr), sizeof(hdr));
+  dest->resize(start + sizeof(hdr) + xlen);
+
+  uint8_t* extra = reinterpret_cast<uint8_t*>(&(*dest)[start + sizeof(hdr)]);
+  if (xlen) {
+    res = sub_->Read(strings::MutableByteRange(extra, xlen));
+    if (!res.ok())
+      return res.status;
+    if (res.obj < xlen)
+      return CorruptedInput("truncated member header");
+  }
+
+  // Looks for the BC subfield that keeps the member size - 1.
+  size_t member_size = 0;
+  for (uint32_t pos = 0; pos + 4 <= xlen;) {
+    uint32_t slen = DecodeLE16(extra + pos + 2);
+    if (extra[pos] == 'B' && extra[pos + 1] == 'C' && slen == 2 && pos + 6 <= xlen) {
+      member_size = DecodeLE16(extra + pos + 4) + 1;
+      break;
+    }
+    pos += 4 + slen;
+  }
+  if (member_size < sizeof(hdr) + xlen + kGzipTrailerSize)
+    return CorruptedInput("member without a valid block size");
+
+  const size_t rest = member_size - sizeof(hdr) - xlen;
+  dest->resize(start + member_size);
+  uint8_t* next = reinterpret_cast<uint8_t*>(&(*dest)[start + sizeof(hdr) + xlen]);
+  res = sub_->Read(strings::MutableByteRange(next, rest));
+  if (!res.ok())
+    return res.status;
+  if (res.obj < rest)
+    return CorruptedInput("truncated member");
+
+  *isize = DecodeLE32(next + rest - 4);
+
+  return member_size;
+}
+
+void ParallelGzipSource::StartChunk() {
+  std::unique_ptr<Chunk> chunk(new Chunk);
+  size_t expected = 0;
+
+  while (chunk->compressed.size() < kChunkSize) {
+    uint32_t isize = 0;
+    auto res = ReadMember(&chunk->compressed, &isize);
+    if (!res.ok()) {
+      chunk->status = res.status;
+      input_done_ = true;
+      break;
+    }
+    if (res.obj == 0) {
+      input_done_ = true;
+      break;
+    }
+    expected += isize;
+  }
+
+  if (chunk->status.ok()) {
+    if (chunk->compressed.empty())
+      return;
+
+    chunk->done = executor_->NewEvent();
+    executor_->Add([chunk = chunk.get(), expected, done = chunk->done] {
+      chunk->status = InflateMembers(chunk->compressed, expected, &chunk->data);
+      chunk->compressed.clear();
+      chunk->compressed.shrink_to_fit();
+      done->Notify();
+    });
+  }
+  chunks_.push_back(std::move(chunk));
+}
+
+StatusObject<ParallelGzipSource::Chunk*> ParallelGzipSource::NextChunk() {
+  while (true) {
+    while (!input_done_ && chunks_.size() < max_inflight_) {
+      StartChunk();
+    }
+    if (chunks_.empty())
+      return static_cast<Chunk*>(nullptr);
+
+    Chunk* chunk = chunks_.front().get();
+    if (chunk->done) {
+      chunk->done->Wait();
+      chunk->done.reset();
+    }
+    if (!chunk->status.ok())
+      return chunk->status;
+    if (chunk->pos < chunk->data.size())
+      return chunk;
+
+    // Popped only now since the data of the chunk may be referenced by the last view.
+    chunks_.pop_front();
+  }
+}
+
+StatusObject<size_t> ParallelGzipSource::ReadInternal(const strings::MutableByteRange& range) {
+  size_t read = 0;
+
+  while (read < range.size()) {
+    auto res = NextChunk();
+    if (!res.ok())
+      return res.status;
+    Chunk* chunk = res.obj;
+    if (!chunk)
+      break;
+
+    size_t len = std::min(range.size() - read, chunk->data.size() - chunk->pos);
+    memcpy(range.begin() + read, chunk->data.data() + chunk->pos, len);
+    chunk->pos += len;
+    read += len;
+  }
+
+  return read;
+}
+
+StatusObject<strings::MutableByteRange> ParallelGzipSource::PeekInternal(size_t max_size) {
+  auto res = NextChunk();
+  if (!res.ok())
+    return res.status;
+  Chunk* chunk = res.obj;
+  if (!chunk)
+    return strings::MutableByteRange();
+
+  size_t len = std::min(max_size, chunk->data.size() - chunk->pos);
+  uint8_t* data = reinterpret_cast<uint8_t*>(&chunk->data[chunk->pos]);
+  chunk->pos += len;
+  return strings::MutableByteRange(data, len);
+}
+
+}  // namespace file
@@ -0,0 +1,59 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "file/list_executor.h"
+#include "util/sinksource.h"
+
+namespace file {
+
+/*! Inflates BGZF input, as written by bgzip, in parallel.
+
+    BGZF is a multi-member gzip stream whose members keep their compressed size in the
+    extra field of the header, so they can be split without inflating them. The source reads
+    the members in chunks of about 1MB and inflates up to max_inflight chunks at once on
+    the executor. The data is returned in order. Other gzip streams must be read with
+    util::ZlibSource, see IsBgzfSource().
+*/
+class ParallelGzipSource : public util::Source {
+ public:
+  // Takes ownership over sub_source.
+  ParallelGzipSource(util::Source* sub_source, ListExecutor* executor, unsigned max_inflight = 8);
+  ~ParallelGzipSource() override;
+
+  // Returns true if the source starts with a BGZF member. Does not consume the source.
+  static bool IsBgzfSource(util::Source* source);
+
+ private:
+  struct Chunk;
+
+  util::StatusObject<size_t> ReadInternal(const strings::MutableByteRange& range) override;
+
+  // Returns views into the inflated chunks.
+  util::StatusObject<strings::MutableByteRange> PeekInternal(size_t max_size) override;
+
+  // Returns the chunk with the data that is read next or null at the end of the input.
+  // Waits for the chunk to be inflated.
+  util::StatusObject<Chunk*> NextChunk();
+
+  // Reads the members that follow into a new chunk and hands it to the executor.
+  void StartChunk();
+
+  // Appends the next member to dest and sets isize to its uncompressed size.
+  // Returns the size of the member or 0 at the end of the input.
+  util::StatusObject<size_t> ReadMember(std::string* dest, uint32_t* isize);
+
+  std::unique_ptr<util::Source> sub_;
+  ListExecutor* executor_;
+  const unsigned max_inflight_;
+
+  std::deque<std::unique_ptr<Chunk>> chunks_;  // In the order of the input.
+  bool input_done_ = false;
+};
+
+}  // namespace file
@@ -0,0 +1,31 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <functional>
+#include <memory>
+
+namespace file {
+
+// Runs the background tasks of list readers and writers, for example on a thread pool.
+// Keeps the file library independent of a specific threading model. Must be thread-safe.
+class ListExecutor {
+ public:
+  // Notified once by a task and waited on by the reader or the writer, possibly from
+  // another thread.
+  class Event {
+   public:
+    virtual ~Event() {}
+    virtual void Notify() = 0;
+    virtual void Wait() = 0;
+  };
+
+  virtual ~ListExecutor() {}
+
+  // Runs task asynchronously.
+  virtual void Add(std::function<void()> task) = 0;
+  virtual std::unique_ptr<Event> NewEvent() = 0;
+};
+
+}  // namespace file
@@ -6,7 +6,11 @@
 
 #include <crc32c/crc32c.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "base/fixed.h"
+#include "base/hash.h"
 #include "file/compressors.h"
 #include "file/file_util.h"
 #include "file/filesource.h"
@@ -26,20 +30,161 @@ namespace file {
 namespace list_file {
 
 const char kMagicString[] = "LST1";
+const char kIndexMetaKey[] = "__lst_index";
+const char kIndexMagic[] = "LSTX";
+const char kZstdDictMetaKey[] = "__zstd_dict";
+
+void RecordIndex::Add(uint32 block, uint64 first_record, std::string key) {
+  DCHECK(entries_.empty() || entries_.back().block < block);
+  entries_.push_back(Entry{block, first_record, std::move(key)});
+}
+
+// Format: varint64 number of records, varint32 number of entries followed by
+// (varint32 block delta, varint64 first record delta, varint32 key size, key data) per entry.
+// Indices with a key filter end with (varint32 filter size, filter data).
+void RecordIndex::Encode(std::string* dest) const {
+  Varint::Append64(dest, num_records_);
+  Varint::Append32(dest, entries_.size());
+
+  uint32 prev_block = 0;
+  uint64 prev_record = 0;
+  for (const Entry& e : entries_) {
+    Varint::Append32(dest, e.block - prev_block);
+    Varint::Append64(dest, e.first_record - prev_record);
+    Varint::Append32(dest, e.key.size());
+    dest->append(e.key);
+    prev_block = e.block;
+    prev_record = e.first_record;
+  }
+  if (!filter_.empty()) {
+    Varint::Append32(dest, filter_.size());
+    dest->append(filter_);
+  }
+}
+
+bool RecordIndex::Decode(const uint8* ptr, size_t size) {
+  const uint8* end = ptr + size;
+  uint32 count = 0;
+
+  entries_.clear();
+  ptr = Varint::Parse64WithLimit(ptr, end, &num_records_);
+  if (ptr)
+    ptr = Varint::Parse32WithLimit(ptr, end, &count);
+  if (!ptr || count > size)
+    return false;
+
+  entries_.resize(count);
+  uint32 block = 0;
+  uint64 record = 0;
+  for (Entry& e : entries_) {
+    uint32 block_delta = 0, key_size = 0;
+    uint64 record_delta = 0;
+    ptr = Varint::Parse32WithLimit(ptr, end, &block_delta);
+    if (ptr)
+      ptr = Varint::Parse64WithLimit(ptr, end, &record_delta);
+    if (ptr)
+      ptr = Varint::Parse32WithLimit(ptr, end, &key_size);
+    if (!ptr || key_size > size_t(end - ptr))
+      return false;
+
+    block += block_delta;
+    record += record_delta;
+    e.block = block;
+    e.first_record = record;
+    e.key.assign(reinterpret_cast<const char*>(ptr), key_size);
+    ptr += key_size;
+  }
+
+  filter_.clear();
+  if (ptr == end)
+    return true;
+
+  uint32 filter_size = 0;
+  ptr = Varint::Parse32WithLimit(ptr, end, &filter_size);
+  if (!ptr || filter_size != size_t(end - ptr))
+    return false;
+  filter_.assign(reinterpret_cast<const char*>(ptr), filter_size);
+  return true;
+}
+
+bool RecordIndex::MayContain(StringPiece key) const {
+  return filter_.empty() || BloomFilter::MayContain(filter_, BloomFilter::Hash(key));
+}
+
+uint64 BloomFilter::Hash(StringPiece key) {
+  return base::Fingerprint(key.data(), key.size());
+}
+
+void BloomFilter::Build(const std::vector<uint64>& hashes, unsigned bits_per_key,
+                        std::string* dest) {
+  // 0.69 =~ ln(2) minimizes the false positive rate.
+  unsigned probes = std::min(30u, std::max(1u, unsigned(bits_per_key * 0.69)));
+
+  // With few keys the false positive rate is high, we enforce 64 bits at least.
+  size_t bits = std::max<size_t>(64, hashes.size() * bits_per_key);
+  size_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+
+  dest->assign(bytes, '\0');
+  dest->push_back(char(probes));
+  char* array = &dest->front();
+  for (uint64 h : hashes) {
+    uint32 h1 = uint32(h), h2 = uint32(h >> 32);
+    for (unsigned i = 0; i < probes; ++i) {
+      size_t pos = (h1 + uint64(i) * h2) % bits;
+      array[pos / 8] |= (1 << (pos % 8));
+    }
+  }
+}
+
+bool BloomFilter::MayContain(StringPiece filter, uint64 hash) {
+  if (filter.size() < 2)
+    return true;  // Malformed, can not rule out anything.
+
+  const size_t bits = (filter.size() - 1) * 8;
+  const unsigned probes = uint8(filter.back());
+  uint32 h1 = uint32(hash), h2 = uint32(hash >> 32);
+  for (unsigned i = 0; i < probes; ++i) {
+    size_t pos = (h1 + uint64(i) * h2) % bits;
+    if ((filter[pos / 8] & (1 << (pos % 8))) == 0)
+      return false;
+  }
+  return true;
+}
+
+auto RecordIndex::FindRecord(uint64 ordinal) const -> const Entry* {
+  if (ordinal >= num_records_ || entries_.empty())
+    return nullptr;
+
+  auto it = std::upper_bound(entries_.begin(), entries_.end(), ordinal,
+                             [](uint64 val, const Entry& e) { return val < e.first_record; });
+  return it == entries_.begin() ? nullptr : &*(it - 1);
+}
+
+auto RecordIndex::FindKey(StringPiece key) const -> const Entry* {
+  if (entries_.empty())
+    return nullptr;
+
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), key,
+                             [](const Entry& e, StringPiece val) { return e.key < val; });
+  return it == entries_.begin() ? &entries_.front() : &*(it - 1);
+}
 
 class BlockHeader {
   uint8 buf_[kBlockHeaderSize];
 
  public:
-  BlockHeader(RecordType type) { buf_[8] = type; }
+  BlockHeader(RecordType type = kZeroType) { buf_[8] = type; }
+
+  void set_type(RecordType type) { buf_[8] = type; }
 
   void EnableCompression() { buf_[8] |= kCompressedMask; }
 
   void SetCrcAndLength(const uint8* ptr, size_t length);
 
-  Status Write(util::Sink* sink) const {
-    return sink->Append(strings::ByteRange(buf_, kBlockHeaderSize));
-  }
+  strings::ByteRange slice() const { return strings::ByteRange(buf_, kBlockHeaderSize); }
+
+  Status Write(util::Sink* sink) const { return sink->Append(slice()); }
 };
 
 void BlockHeader::SetCrcAndLength(const uint8* ptr, size_t length) {
@@ -68,6 +213,13 @@ namespace {
 // 1 - 1/kCompressReduction of the original size.
 constexpr unsigned kCompressReduction = 8;  // Currently we require 12.5% reduction.
 
+// The size of the reads when the blocks of another file are appended.
+constexpr size_t kCopyBufSize = 1 << 20;
+
+// Limits of the trained zstd dictionaries and of the records kept for training them.
+constexpr size_t kZstdDictMaxSize = 1 << 16;
+constexpr size_t kZstdDictMaxSamples = 100 * kZstdDictMaxSize;
+
 class Varint32Encoder {
   uint8 buf_[Varint::kMax32];
   uint8 sz_ = 0;
@@ -94,6 +246,11 @@ class FileHeader {
     buf_[kMagicStringSize + 1] = meta.empty() ? kNoExtension : kMetaExtension;
   }
 
+  // Size of the written header.
+  size_t size() const {
+    return kListFileHeaderSize + (meta_.empty() ? 0 : 8 + encoder_.size());
+  }
+
   Status Write(util::Sink* sink) {
     strings::ByteRange pc(buf_, sizeof(buf_));
 
@@ -131,10 +288,26 @@ class Lst1Impl : public ListWriter::WriterImpl {
   Status Init(const std::map<string, string>& meta) final;
   Status AddRecord(StringPiece slice) final;
   Status Flush() final;
+  Status Finish() final;
+  Status AppendBlocks(ReadonlyFile* file, size_t begin, size_t end, uint32 block_size) final;
 
  private:
   util::Status EmitPhysicalRecord(list_file::RecordType type, const uint8* ptr, size_t length);
 
+  // Emits all the fragments of an uncompressed record that does not fit into the current
+  // block. Their headers and the slices of the record are passed to the sink in batches,
+  // so large records are not copied before they reach the file.
+  util::Status WriteFragmented(StringPiece record);
+
+  util::Status WriteHeader(const std::map<string, string>& meta);
+
+  // Trains the zstd dictionary from the collected records, writes the header and adds
+  // the records.
+  util::Status FinishDictTraining();
+
+  // Called for each record right before its first part is placed into the current block.
+  void IndexRecord(StringPiece record);
+
   uint32 block_leftover() const { return block_leftover_; }
 
   void AddRecordToArray(StringPiece size_enc, StringPiece record);
@@ -154,6 +327,22 @@ class Lst1Impl : public ListWriter::WriterImpl {
   size_t compress_buf_size_ = 0;
 
   CompressFunction compress_func_;
+
+  // Set if options_.write_index is true.
+  std::unique_ptr<RecordIndex> index_;
+  size_t header_size_ = 0;
+  uint32 block_index_ = 0;  // The index of the current block.
+  bool finished_ = false;
+
+  // Hashes of the record keys if options_.bloom_key is set.
+  std::vector<uint64> key_hashes_;
+
+  // Set while the records for the zstd dictionary are collected. The header is written
+  // with header_meta_ after them.
+  bool train_dict_ = false;
+  std::map<string, string> header_meta_;
+  string dict_samples_;
+  std::vector<size_t> dict_sample_sizes_;
 };
 
 Lst1Impl::Lst1Impl(util::Sink* sink, const ListWriter::Options& opts)
@@ -172,8 +361,17 @@ Lst1Impl::Lst1Impl(util::Sink* sink, const ListWriter::Options& opts)
   }
 
   if (opts.append) {
+    CHECK(!opts.write_index) << "Appended files can not be indexed";
     block_leftover_ = block_size_ - (opts.internal_append_offset % block_size_);
   }
+  if (opts.write_index) {
+    index_.reset(new RecordIndex);
+  }
+  if (opts.use_compression && opts.compress_method == kCompressionZstd &&
+      opts.zstd_dict_records > 0) {
+    CHECK(!opts.append) << "Can not train a dictionary for appended files";
+    train_dict_ = true;
+  }
 }
 
 Lst1Impl::~Lst1Impl() {
@@ -185,11 +383,54 @@ Status Lst1Impl::Init(const std::map<string, string>& meta) {
   if (!options_.append) {
     CHECK_GT(options_.block_size_multiplier, 0);
     CHECK(!init_called_);
-    FileHeader header(options_.block_size_multiplier, meta);
-
-    RETURN_IF_ERROR(header.Write(dest_.get()));
     init_called_ = true;
+    if (train_dict_) {
+      header_meta_ = meta;
+      return Status::OK;
+    }
+    return WriteHeader(meta);
+  }
+  return Status::OK;
+}
+
+Status Lst1Impl::WriteHeader(const std::map<string, string>& meta) {
+  std::map<string, string> index_meta;
+  if (index_) {
+    index_meta = meta;
+    index_meta[kIndexMetaKey] = "1";
+  }
+  FileHeader header(options_.block_size_multiplier, index_ ? index_meta : meta);
+
+  RETURN_IF_ERROR(header.Write(dest_.get()));
+  header_size_ = header.size();
+  return Status::OK;
+}
+
+Status Lst1Impl::FinishDictTraining() {
+  train_dict_ = false;
+
+  string dict = TrainZstdDict(dict_samples_, dict_sample_sizes_, kZstdDictMaxSize);
+  if (dict.empty()) {
+    LOG(WARNING) << "Could not train zstd dictionary from " << dict_sample_sizes_.size()
+                 << " records, compressing without it";
+  } else {
+    VLOG(1) << "Trained zstd dictionary of " << dict.size() << " bytes";
+    compress_func_ = GetZstdDictCompress(dict, options_.compress_level);
+    header_meta_[kZstdDictMetaKey] = std::move(dict);
   }
+  RETURN_IF_ERROR(WriteHeader(header_meta_));
+  header_meta_.clear();
+
+  // AddRecord counts the records again.
+  records_added_ -= dict_sample_sizes_.size();
+  const char* next = dict_samples_.data();
+  for (size_t sz : dict_sample_sizes_) {
+    RETURN_IF_ERROR(AddRecord(StringPiece(next, sz)));
+    next += sz;
+  }
+  string().swap(dict_samples_);
+  std::vector<size_t>().swap(dict_sample_sizes_);
+
   return Status::OK;
 }
 
@@ -217,8 +458,30 @@ inline Status Lst1Impl::FlushArray() {
   return st;
 }
 
+inline void Lst1Impl::IndexRecord(StringPiece record) {
+  if (!index_ || (!index_->entries().empty() && index_->entries().back().block == block_index_))
+    return;
+
+  // records_added_ already counts the record.
+  index_->Add(block_index_, records_added_ - 1,
+              options_.index_key ? options_.index_key(record) : string());
+}
+
 Status Lst1Impl::AddRecord(StringPiece record) {
   CHECK_GT(block_size_, 0) << "ListWriter::Init was not called.";
+  CHECK(!finished_) << "ListWriter::Finish was called.";
+
+  if (train_dict_) {
+    CHECK(init_called_) << "ListWriter::Init was not called.";
+    ++records_added_;
+    dict_samples_.append(record.data(), record.size());
+    dict_sample_sizes_.push_back(record.size());
+    if (dict_sample_sizes_.size() < options_.zstd_dict_records &&
+        dict_samples_.size() < kZstdDictMaxSamples) {
+      return Status::OK;
+    }
+    return FinishDictTraining();
+  }
 
   Varint32Encoder record_size_encoded(record.size());
   const uint32 record_size_total = record_size_encoded.size() + record.size();
@@ -226,9 +489,13 @@ Status Lst1Impl::AddRecord(StringPiece record) {
   // needed since we might fragment the record.
   bool fragmenting = false;
   ++records_added_;
+  if (index_ && options_.bloom_key) {
+    key_hashes_.push_back(BloomFilter::Hash(options_.bloom_key(record)));
+  }
   while (true) {
     if (array_records_ > 0) {
       if (array_next_ + record_size_total <= array_end_) {
+        IndexRecord(record);
         AddRecordToArray(record_size_encoded.slice(), record);
         return Status::OK;
       }
@@ -241,6 +508,7 @@ Status Lst1Impl::AddRecord(StringPiece record) {
       RETURN_IF_ERROR(dest_->Append(ByteRange(kBlockFilling, block_leftover())));
       block_offset_ = 0;
       block_leftover_ = block_size_;
+      ++block_index_;
     }
 
     if (fragmenting) {
@@ -261,14 +529,20 @@ Status Lst1Impl::AddRecord(StringPiece record) {
       // We leave space at the beginning to prepend the header at the end.
       array_next_ = array_store_.get() + kArrayRecordMaxHeaderSize;
       array_end_ = array_store_.get() + block_leftover();
+      IndexRecord(record);
       AddRecordToArray(record_size_encoded.slice(), record);
       return Status::OK;
     }
     if (kBlockHeaderSize + record.size() <= block_leftover()) {
       // We have space for one record in this block but not for the array.
+      IndexRecord(record);
       return EmitPhysicalRecord(kFullType, u8ptr(record), record.size());
     }
     // We must fragment.
+    IndexRecord(record);
+    if (!options_.use_compression)
+      return WriteFragmented(record);
+
     fragmenting = true;
     const size_t fragment_length = block_leftover() - kBlockHeaderSize;
     RETURN_IF_ERROR(EmitPhysicalRecord(kFirstType, u8ptr(record), fragment_length));
@@ -277,7 +551,87 @@ Status Lst1Impl::AddRecord(StringPiece record) {
   return Status(StatusCode::INTERNAL_ERROR, "Should not reach here");
 }
 
-Status Lst1Impl::Flush() { return FlushArray(); }
+Status Lst1Impl::Flush() {
+  if (train_dict_ && init_called_) {
+    RETURN_IF_ERROR(FinishDictTraining());
+  }
+  return FlushArray();
+}
+
+Status Lst1Impl::Finish() {
+  RETURN_IF_ERROR(Flush());
+  if (!index_ || finished_)
+    return Status::OK;
+  finished_ = true;
+
+  index_->set_num_records(records_added_);
+  if (options_.bloom_key) {
+    string filter;
+    BloomFilter::Build(key_hashes_, options_.bloom_bits_per_key, &filter);
+    index_->set_filter(std::move(filter));
+    key_hashes_.clear();
+  }
+  string buf;
+  index_->Encode(&buf);
+
+  // The records end at the current position.
+  uint64 index_offset = header_size_ + uint64(block_index_) * block_size_ + block_offset_;
+  uint8 trailer[kIndexTrailerSize];
+  coding::EncodeFixed64(index_offset, trailer);
+  coding::EncodeFixed32(buf.size(), trailer + 8);
+  coding::EncodeFixed32(list_file::Mask(crc32c::Crc32c(buf.data(), buf.size())), trailer + 12);
+  memcpy(trailer + 16, kIndexMagic, kIndexMagicSize);
+
+  RETURN_IF_ERROR(dest_->Append(strings::ToByteRange(buf)));
+  return dest_->Append(ByteRange(trailer, sizeof trailer));
+}
+
+Status Lst1Impl::AppendBlocks(ReadonlyFile* file, size_t begin, size_t end, uint32 block_size) {
+  CHECK_GT(block_size_, 0) << "ListWriter::Init was not called.";
+  CHECK(!finished_) << "ListWriter::Finish was called.";
+
+  if (block_size != block_size_)
+    return Status(StatusCode::INVALID_ARGUMENT, "Block sizes differ");
+  if (index_)
+    return Status(StatusCode::INVALID_ARGUMENT, "Indexed files can not append blocks");
+  if (options_.use_compression && options_.compress_method == kCompressionZstd &&
+      options_.zstd_dict_records > 0) {
+    return Status(StatusCode::INVALID_ARGUMENT, "Zstd dictionary files can not append blocks");
+  }
+  RETURN_IF_ERROR(FlushArray());
+  if (begin == end)
+    return Status::OK;
+
+  if (block_leftover_ < block_size_) {
+    // Readers skip the rest of a block that starts with a zero header.
+    string padding(block_leftover_, '\0');
+    RETURN_IF_ERROR(dest_->Append(strings::ToByteRange(padding)));
+    block_offset_ = 0;
+    block_leftover_ = block_size_;
+    ++block_index_;
+  }
+
+  std::unique_ptr<uint8[]> buf(new uint8[kCopyBufSize]);
+  for (size_t offset = begin; offset < end;) {
+    size_t size = std::min(kCopyBufSize, end - offset);
+    auto res = file->Read(offset, strings::MutableByteRange(buf.get(), size));
+    if (!res.ok())
+      return res.status;
+    if (res.obj != size)
+      return Status(StatusCode::IO_ERROR, "Truncated list file");
+    RETURN_IF_ERROR(dest_->Append(ByteRange(buf.get(), size)));
+    offset += size;
+  }
+
+  // The last block of the file may be partial, the following records continue it.
+  const size_t copied = end - begin;
+  block_index_ += copied / block_size_;
+  block_offset_ = copied % block_size_;
+  block_leftover_ = block_size_ - block_offset_;
+  bytes_added_ += copied;
+
+  return Status::OK;
+}
 
 Status Lst1Impl::EmitPhysicalRecord(RecordType type, const uint8* ptr, size_t length) {
   DCHECK_LE(kBlockHeaderSize + length, block_leftover());
@@ -313,6 +667,192 @@ Status Lst1Impl::EmitPhysicalRecord(RecordType type, const uint8* ptr, size_t le
   block_leftover_ = block_size_ - block_offset_;
   return Status::OK;
 }
+
+Status Lst1Impl::WriteFragmented(StringPiece record) {
+  constexpr unsigned kMaxFragments = 32;  // Per AppendV() call.
+  static const uint8 kBlockFilling[kBlockHeaderSize] = {0};
+
+  BlockHeader headers[kMaxFragments];
+  ByteRange slices[kMaxFragments * 3];  // The block filling, the header and the payload.
+  RecordType type = kFirstType;
+
+  while (!record.empty()) {
+    unsigned num_slices = 0;
+    for (unsigned i = 0; i < kMaxFragments && !record.empty(); ++i) {
+      if (block_leftover() <= kBlockHeaderSize) {
+        if (block_leftover() > 0)
+          slices[num_slices++] = ByteRange(kBlockFilling, block_leftover());
+        block_offset_ = 0;
+        block_leftover_ = block_size_;
+        ++block_index_;
+      }
+
+      size_t length = std::min<size_t>(record.size(), block_leftover() - kBlockHeaderSize);
+      if (type != kFirstType)
+        type = length == record.size() ? kLastType : kMiddleType;
+      DCHECK(type != kFirstType || length < record.size());
+
+      BlockHeader& header = headers[i];
+      header.set_type(type);
+      header.SetCrcAndLength(u8ptr(record), length);
+      slices[num_slices++] = header.slice();
+      slices[num_slices++] = ByteRange(u8ptr(record), length);
+
+      bytes_added_ += (kBlockHeaderSize + length);
+      block_offset_ += (kBlockHeaderSize + length);
+      block_leftover_ = block_size_ - block_offset_;
+      record.remove_prefix(length);
+      if (type == kFirstType)
+        type = kMiddleType;
+    }
+    RETURN_IF_ERROR(dest_->AppendV(slices, num_slices));
+  }
+  return Status::OK;
+}
+
+// Runs the records added to a batch through the wrapped writer on the executor. Only a
+// single batch is in flight at a time so the records reach the wrapped writer in order.
+class AsyncImpl : public ListWriter::WriterImpl {
+ public:
+  AsyncImpl(ListWriter::WriterImpl* impl, const ListWriter::Options& opts);
+  ~AsyncImpl();
+
+  Status Init(const std::map<string, string>& meta) final;
+  Status AddRecord(StringPiece slice) final;
+  Status Flush() final;
+  Status Finish() final;
+  Status AppendBlocks(ReadonlyFile* file, size_t begin, size_t end, uint32 block_size) final;
+
+ private:
+  struct Batch {
+    string data;
+    std::vector<uint32> sizes;
+    Status status;
+    std::shared_ptr<ListExecutor::Event> done;  // Set while the batch is in flight.
+  };
+
+  // Hands the current batch to the executor after the previous one was written.
+  Status Submit();
+
+  // Waits for the batch to be written and clears it.
+  Status Reclaim(Batch* batch);
+
+  // Waits for all the batches and returns the first error.
+  Status Drain();
+
+  void CopyStats() {
+    bytes_added_ = impl_->bytes_added();
+    compression_savings_ = impl_->compression_savings();
+  }
+
+  std::unique_ptr<ListWriter::WriterImpl> impl_;
+  size_t batch_size_;
+  Batch batch_[2];
+  unsigned current_ = 0;
+  Status status_;  // The first error of the wrapped writer.
+};
+
+AsyncImpl::AsyncImpl(ListWriter::WriterImpl* impl, const ListWriter::Options& opts)
+    : WriterImpl(nullptr, opts), impl_(impl) {
+  batch_size_ = kBlockSizeFactor * std::max<uint8>(1, opts.block_size_multiplier);
+  for (auto& b : batch_) {
+    b.data.reserve(batch_size_);
+  }
+}
+
+AsyncImpl::~AsyncImpl() {
+  CHECK(Drain().ok());
+}
+
+Status AsyncImpl::Init(const std::map<string, string>& meta) {
+  init_called_ = true;
+  return impl_->Init(meta);
+}
+
+Status AsyncImpl::AddRecord(StringPiece slice) {
+  RETURN_IF_ERROR(status_);
+
+  Batch& batch = batch_[current_];
+  batch.data.append(slice.data(), slice.size());
+  batch.sizes.push_back(slice.size());
+  ++records_added_;
+
+  if (batch.data.size() < batch_size_)
+    return Status::OK;
+  return Submit();
+}
+
+Status AsyncImpl::Submit() {
+  Batch& batch = batch_[current_];
+  current_ ^= 1;
+  Status st = Reclaim(&batch_[current_]);
+  if (!st.ok() || batch.sizes.empty()) {
+    batch.data.clear();
+    batch.sizes.clear();
+    return st;
+  }
+
+  batch.done = options_.async_executor->NewEvent();
+  options_.async_executor->Add([this, &batch, done = batch.done] {
+    const char* next = batch.data.data();
+    for (uint32 sz : batch.sizes) {
+      batch.status = impl_->AddRecord(StringPiece(next, sz));
+      if (!batch.status.ok())
+        break;
+      next += sz;
+    }
+    done->Notify();
+  });
+  return st;
+}
+
+Status AsyncImpl::Reclaim(Batch* batch) {
+  if (batch->done) {
+    batch->done->Wait();
+    batch->done.reset();
+
+    CopyStats();
+    if (status_.ok())
+      status_ = batch->status;
+    batch->status = Status::OK;
+  }
+  batch->data.clear();
+  batch->sizes.clear();
+
+  return status_;
+}
+
+Status AsyncImpl::Drain() {
+  Status st = Submit();
+  Status st2 = Reclaim(&batch_[current_ ^ 1]);
+  return st.ok() ? st2 : st;
+}
+
+Status AsyncImpl::Flush() {
+  RETURN_IF_ERROR(Drain());
+  RETURN_IF_ERROR(impl_->Flush());
+  CopyStats();
+
+  return Status::OK;
+}
+
+Status AsyncImpl::Finish() {
+  RETURN_IF_ERROR(Drain());
+  RETURN_IF_ERROR(impl_->Finish());
+  CopyStats();
+
+  return Status::OK;
+}
+
+Status AsyncImpl::AppendBlocks(ReadonlyFile* file, size_t begin, size_t end,
+                               uint32 block_size) {
+  RETURN_IF_ERROR(Drain());
+  RETURN_IF_ERROR(impl_->AppendBlocks(file, begin, end, block_size));
+  CopyStats();
+
+  return Status::OK;
+}
+
 }  // namespace
 
 ListWriter::ListWriter(StringPiece filename, const Options& options) {
@@ -344,6 +884,8 @@ ListWriter::ListWriter(StringPiece filename, const Options& options) {
   WriteFile* file = file::Open(filename, open_options);
 
   impl_.reset(new Lst1Impl(new Sink(file, TAKE_OWNERSHIP), opts));
+  if (opts.async_executor)
+    impl_.reset(new AsyncImpl(impl_.release(), opts));
 }
 
 ListWriter::ListWriter(util::Sink* dest, const Options& options) {
@@ -352,6 +894,19 @@ ListWriter::ListWriter(util::Sink* dest, const Options& options) {
   } else {
     impl_.reset(new Lst1Impl(dest, options));
   }
+  if (options.async_executor)
+    impl_.reset(new AsyncImpl(impl_.release(), options));
+}
+
+Status ListWriter::AppendBlocksFrom(ListReader* reader) {
+  size_t begin = 0, end = 0;
+  std::map<string, string> meta;
+  if (!reader->GetBlockExtent(&begin, &end) || !reader->GetMetaData(&meta))
+    return Status(StatusCode::INVALID_ARGUMENT, "Only LST1 files can append their blocks");
+  if (meta.count(kZstdDictMetaKey))
+    return Status(StatusCode::INVALID_ARGUMENT, "Files with a zstd dictionary can not be appended");
+
+  return impl_->AppendBlocks(reader->file(), begin, end, reader->block_size());
 }
 
 // Adds user provided meta information about the file. Must be called before Init.
@@ -8,6 +8,7 @@
 #include <functional>
 #include <map>
 
+#include "file/list_executor.h"
 #include "file/list_file_format.h"
 #include "file/file.h"
 #include "strings/slice.h"
@@ -15,6 +16,8 @@
 
 namespace file {
 
+class ListReader;
+
 class ListWriter {
  public:
   struct Options {
@@ -25,6 +28,34 @@ class ListWriter {
     bool append = false;
     bool v2 = false;
 
+    // Writes a record index at the end of the file when Finish() is called. It allows readers
+    // to seek to a record by its ordinal. Supported only by LST1 files that are not appended.
+    bool write_index = false;
+
+    // If set together with write_index, the index also keeps the key of the first record
+    // that starts in each block, which allows seeking by key in files whose records are
+    // added in the order of their keys.
+    std::function<std::string(StringPiece record)> index_key;
+
+    // If set together with write_index, the index also keeps a Bloom filter of the keys of
+    // all the records, with bloom_bits_per_key bits per key (1% false positives for 10).
+    // ListReader::MayContain() checks it. The writer keeps 8 bytes per record until Finish().
+    std::function<std::string(StringPiece record)> bloom_key;
+    uint8 bloom_bits_per_key = 10;
+
+    // If set with kCompressionZstd, a zstd dictionary is trained from the first
+    // zstd_dict_records records (or fewer if they are large) and stored in the file meta data
+    // under kZstdDictMetaKey. All the records are compressed with it. These records are kept
+    // in memory and the file header is written after them. Not supported with append.
+    uint32 zstd_dict_records = 0;
+
+    // If set, AddRecord() only copies the records into one of two buffers of the block size.
+    // A full buffer is handed to async_executor, whose task compresses its records and writes
+    // them into the sink while the caller fills the other buffer. AddRecord() blocks only
+    // when the previous buffer is still being written. Flush() and Finish() wait for the
+    // buffers in flight. Errors of the task are returned by the following call.
+    ListExecutor* async_executor = nullptr;
+
     Options() {}
 
     size_t internal_append_offset = 0;
@@ -45,6 +76,18 @@ class ListWriter {
 
   util::Status Flush() { return impl_->Flush(); }
 
+  // Flushes the records and writes the record index if Options::write_index is set.
+  // Records can not be added after Finish().
+  util::Status Finish() { return impl_->Finish(); }
+
+  // Appends the records of the LST1 file of reader by copying its blocks verbatim, without
+  // decoding them. The current block is padded first, so the copied blocks keep their
+  // alignment. The meta data of the file is not copied. Requires the same block size and
+  // is not supported for writers with Options::write_index, LST2 writers and files or
+  // writers with a zstd dictionary. The copied records are counted by bytes_added()
+  // but not by records_added().
+  util::Status AppendBlocksFrom(ListReader* reader);
+
   uint32 records_added() const { return impl_->records_added(); }
   uint64 bytes_added() const { return impl_->bytes_added(); }
   uint64 compression_savings() const { return impl_->compression_savings(); }
@@ -58,6 +101,13 @@ class ListWriter {
     virtual util::Status Init(const std::map<std::string, std::string>& meta) = 0;
     virtual util::Status AddRecord(StringPiece slice) = 0;
     virtual util::Status Flush() = 0;
+    virtual util::Status Finish() { return Flush(); }
+
+    // Copies the blocks in [begin, end) of file, see ListWriter::AppendBlocksFrom().
+    virtual util::Status AppendBlocks(ReadonlyFile* file, size_t begin, size_t end,
+                                      uint32 block_size) {
+      return util::Status(util::StatusCode::NOT_IMPLEMENTED_ERROR, "Not supported");
+    }
 
     uint32 records_added() const { return records_added_; }
     uint64 bytes_added() const { return bytes_added_; }
@@ -9,6 +9,8 @@
 #define _LIST_FILE_FORMAT_H_
 
 #include <map>
+#include <vector>
+
 #include "base/integral_types.h"
 #include "file/file.h"
 #include "util/status.h"
@@ -36,7 +38,8 @@ constexpr uint8 kCompressedMask = 0x10;
 enum CompressMethod : uint8_t {
   kCompressionNone = 0,
   kCompressionZlib = 2,
-  kCompressionLZ4 = 3
+  kCompressionLZ4 = 3,
+  kCompressionZstd = 4,
 };
 
 // The file header is:
@@ -63,6 +66,77 @@ constexpr uint32 kArrayRecordMaxHeaderSize = 5 /*Varint::kMax32*/ + kBlockHeader
 
 extern const char kMagicString[];
 
+// Files written with ListWriter::Options::write_index end with a record index followed by
+// the index trailer:
+//    fixed64 offset of the index in the file, fixed32 index size,
+//    fixed32 masked crc32 of the index, magic string "LSTX".
+// The records end where the index starts. Such files have kIndexMetaKey in their meta data,
+// so the readers of other files never read the trailer.
+extern const char kIndexMetaKey[];
+extern const char kIndexMagic[];
+
+// Meta key of the zstd dictionary that files written with ListWriter::Options::zstd_dict_records
+// use for all their kCompressionZstd records.
+extern const char kZstdDictMetaKey[];
+constexpr uint32 kIndexMagicSize = 4;
+constexpr uint32 kIndexTrailerSize = 8 + 4 + 4 + kIndexMagicSize;
+
+// Bloom filter over record keys, stored as the bit array followed by a byte with the number
+// of probes. Probes are derived from a 64 bit hash of the key with double hashing.
+class BloomFilter {
+ public:
+  static uint64 Hash(StringPiece key);
+
+  // Builds a filter with bits_per_key bits for each of the hashes into dest.
+  static void Build(const std::vector<uint64>& hashes, unsigned bits_per_key, std::string* dest);
+
+  // Returns false if the key with the given hash was not added to the filter.
+  static bool MayContain(StringPiece filter, uint64 hash);
+};
+
+// Maps record ordinals and, optionally, record keys to the blocks where the records start.
+// Has an entry for each block in which at least one record starts.
+class RecordIndex {
+ public:
+  struct Entry {
+    uint32 block = 0;         // Index of the block, the first one starts after the file header.
+    uint64 first_record = 0;  // Ordinal of the first record that starts in the block.
+    std::string key;          // Key of that record, if the writer set Options::index_key.
+  };
+
+  // Blocks must be added in increasing order.
+  void Add(uint32 block, uint64 first_record, std::string key);
+
+  void set_num_records(uint64 num) { num_records_ = num; }
+  uint64 num_records() const { return num_records_; }
+
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  // Bloom filter of the record keys if the writer set Options::bloom_key, otherwise empty.
+  void set_filter(std::string filter) { filter_ = std::move(filter); }
+  const std::string& filter() const { return filter_; }
+
+  // Returns false if the file has a key filter and key was not added to it.
+  bool MayContain(StringPiece key) const;
+
+  void Encode(std::string* dest) const;
+  bool Decode(const uint8* ptr, size_t size);
+
+  // Returns the entry of the block in which the record with the given ordinal starts or null
+  // if the ordinal is past the last record.
+  const Entry* FindRecord(uint64 ordinal) const;
+
+  // Returns the entry of the last block whose first key is less than key or the first entry.
+  // For records added in the order of their keys, the records with keys >= key start in or
+  // after the returned block. Returns null for an empty index.
+  const Entry* FindKey(StringPiece key) const;
+
+ private:
+  std::vector<Entry> entries_;
+  uint64 num_records_ = 0;
+  std::string filter_;
+};
+
 class HeaderParser {
   unsigned offset_ = 0;
   unsigned block_multiplier_ = 0;
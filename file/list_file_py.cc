@@ -8,11 +8,26 @@
    a = list_file_py.Reader('secret.lst')
    for str in a:
      print str
+
+   # Faster, the records of a batch are memoryviews over a single buffer.
+   b = list_file_py.Reader('secret.lst')
+   while True:
+     records = b.read_batch(10000)
+     if not records:
+       break
+     for mv in records:
+       print mv.tobytes()
+
+   # Or the buffer itself with the offsets of the records, record i is
+   # data[offsets[i]:offsets[i + 1]].
+   data, offsets = b.read_batch_raw(10000)
 */
 //
 #include <Python.h>
 #include <structmember.h>
 
+#include <vector>
+
 #include "file/file.h"
 #include "file/list_file.h"
 
@@ -35,6 +50,7 @@ typedef struct {
     PyObject_HEAD
     int number;
     file::ListReader* reader;
+    int busy;  // Set while a batch is read without the GIL.
 } Reader;
 
 static void Reader_dealloc(Reader* self) {
@@ -48,6 +64,7 @@ static PyObject* Reader_new(PyTypeObject* type, PyObject *args, PyObject *kwds)
     return NULL;
 
   self->reader = NULL;
+  self->busy = 0;
 
   return (PyObject *)self;
 }
@@ -84,7 +101,96 @@ static PyObject* Reader_next(PyObject* obj) {
   return res;
 }
 
+// Reads up to n records into one bytes object, the GIL is released during the I/O and
+// the decompression. ends gets the end offset of each record in the buffer.
+static PyObject* ReadBatchBuffer(Reader* self, PyObject* args, std::vector<size_t>* ends) {
+  int n;
+  if (!PyArg_ParseTuple(args, "i", &n))
+    return NULL;
+  if (n <= 0) {
+    PyErr_SetString(PyExc_ValueError, "Batch size must be positive");
+    return NULL;
+  }
+  CHECK_NOTNULL(self->reader);
+
+  // Another thread may call the reader once the GIL is released.
+  if (self->busy) {
+    PyErr_SetString(list_exception, "Reader is used by another thread");
+    return NULL;
+  }
+  self->busy = 1;
+
+  std::string data, record_buf;
+  strings::Slice record;
+  ends->reserve(n);
+
+  Py_BEGIN_ALLOW_THREADS
+  while (ends->size() < size_t(n) && self->reader->ReadRecord(&record, &record_buf)) {
+    data.append(record.data(), record.size());
+    ends->push_back(data.size());
+  }
+  Py_END_ALLOW_THREADS
+
+  self->busy = 0;
+  return PyBytes_FromStringAndSize(data.data(), data.size());
+}
+
+static PyObject* Reader_read_batch(Reader* self, PyObject* args) {
+  std::vector<size_t> ends;
+  PyObject* buf = ReadBatchBuffer(self, args, &ends);
+  if (buf == NULL)
+    return NULL;
+
+  PyObject* res = PyList_New(ends.size());
+  char* data = PyBytes_AS_STRING(buf);
+  for (size_t i = 0; res != NULL && i < ends.size(); ++i) {
+    size_t begin = i ? ends[i - 1] : 0;
+
+    // Each view keeps a reference to the buffer.
+    Py_buffer view;
+    PyBuffer_FillInfo(&view, buf, data + begin, ends[i] - begin, 1, PyBUF_SIMPLE);
+    PyObject* mv = PyMemoryView_FromBuffer(&view);
+    if (mv == NULL) {
+      PyBuffer_Release(&view);
+      Py_CLEAR(res);
+      break;
+    }
+    PyList_SET_ITEM(res, i, mv);
+  }
+  Py_DECREF(buf);
+  return res;
+}
+
+static PyObject* Reader_read_batch_raw(Reader* self, PyObject* args) {
+  std::vector<size_t> ends;
+  PyObject* buf = ReadBatchBuffer(self, args, &ends);
+  if (buf == NULL)
+    return NULL;
+
+  PyObject* offsets = PyList_New(ends.size() + 1);
+  if (offsets == NULL) {
+    Py_DECREF(buf);
+    return NULL;
+  }
+  for (size_t i = 0; i <= ends.size(); ++i) {
+    PyObject* offset = PyInt_FromSsize_t(i ? ends[i - 1] : 0);
+    if (offset == NULL) {
+      Py_DECREF(offsets);
+      Py_DECREF(buf);
+      return NULL;
+    }
+    PyList_SET_ITEM(offsets, i, offset);
+  }
+  return Py_BuildValue("(NN)", buf, offsets);
+}
+
 static PyMethodDef reader_methods[] = {
+    {"read_batch", (PyCFunction)Reader_read_batch, METH_VARARGS,
+     "read_batch(n) -> list of up to n records as memoryviews over a shared buffer, "
+     "empty at the end of the file."},
+    {"read_batch_raw", (PyCFunction)Reader_read_batch_raw, METH_VARARGS,
+     "read_batch_raw(n) -> (data, offsets) of up to n records, record i is "
+     "data[offsets[i]:offsets[i + 1]]."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
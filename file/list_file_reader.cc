@@ -4,7 +4,11 @@
 // Based on LevelDB implementation.
 #include "file/list_file_reader.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
 
 #include "base/flags.h"
 #include "base/varint.h"
@@ -31,19 +35,95 @@ namespace {
 class Lst1Impl : public ListReader::FormatImpl {
  public:
   using FormatImpl::FormatImpl;
+  ~Lst1Impl();
 
   bool ReadHeader(std::map<std::string, std::string>* dest) final;
 
   bool ReadRecord(StringPiece* record, std::string* scratch) final;
 
+  bool SeekToBlock(uint32_t block) final;
+
+  void ReadBufferedRecords(size_t max_records, std::vector<StringPiece>* dest) final;
+
  private:
-  // Return type, or one of the preceding special values
-  unsigned int ReadPhysicalRecord(StringPiece* result);
+  // A physical record parsed by a read-ahead task. Its data is in the raw block
+  // or, if uncompressed, in Block::uncompressed.
+  struct DecodedRecord {
+    unsigned type;
+    bool uncompressed;
+    uint32 offset, length;
+
+    // Set if the reader must report a corruption before returning the record.
+    const char* reason;
+    size_t drop;
+  };
+
+  struct Block {
+    std::unique_ptr<uint8[]> data, uncompress_buf;
+    strings::ByteRange raw;  // The bytes of the block, in data or in the file view.
+    bool last = false;       // The last block of the file.
+
+    std::string uncompressed;
+    std::vector<DecodedRecord> records;
+    size_t header_bytes = 0;
+
+    // Shared with the task since it may still hold it after notifying the reader.
+    std::shared_ptr<ListReader::Executor::Event> done;
+  };
+
+  // Sets data_end of the wrapper if the file has a valid index trailer.
+  void ReadIndexTrailer();
+
+  // Returns the next item of the current array record. Reports a corruption and drops the
+  // rest of the array if the item is invalid.
+  bool NextArrayItem(StringPiece* record);
+
+  // Reads the block at file_offset_ into *dest. Uses a view into the file if it supports
+  // ReadView(), otherwise reads the block into buf.
+  StatusObject<size_t> ReadBlock(uint8* buf, strings::ByteRange* dest);
+
+  // Return type, or one of the preceding special values.
+  // in_fragment is true if the previous physical records started a record that is not finished.
+  unsigned int ReadPhysicalRecord(bool in_fragment, StringPiece* result);
+
+  // Parses the physical record at the beginning of *block, which must be longer than
+  // kBlockHeaderSize, and advances *block past it. Compressed records are uncompressed into
+  // uncompress_buf. Returns the type, kBadRecord or kEndOfBlock. Sets *reason and *drop
+  // for corruptions that must be reported. Called by the read-ahead tasks.
+  unsigned ParseRecord(strings::ByteRange* block, uint8* uncompress_buf, StringPiece* result,
+                       const char** reason, size_t* drop) const;
 
   // 'size' is size of the compressed blob.
-  // Returns true if succeeded. In that case uncompress_buf_ will contain the uncompressed data
+  // Returns true if succeeded. In that case dest will contain the uncompressed data
   // and size will be updated to the uncompressed size.
-  bool Uncompress(const uint8* data_ptr, uint32* size);
+  bool Uncompress(const uint8* data_ptr, uint32* size, uint8* dest) const;
+
+  // ReadPhysicalRecord() for readers with EnableReadAhead().
+  unsigned ReadDecodedRecord(bool in_fragment, StringPiece* result);
+
+  // Reads blocks into ahead_ and adds their decoding tasks until read_ahead_blocks are
+  // pending or the range ends. If force is true, reads a block even if it starts past the range.
+  // Returns false if ahead_ is empty.
+  bool ReadAhead(bool force);
+
+  // Runs on the executor.
+  void DecodeBlock(Block* block) const;
+
+  // Waits for the pending tasks and recycles their blocks.
+  void DrainAhead();
+
+  size_t header_size_ = 0;
+
+  // Set for files with a zstd dictionary.
+  UncompressFunction zstd_dict_uncompress_;
+
+  bool skip_fragments_ = false;  // Set until the first record that starts in the range.
+  bool past_range_ = false;      // Set once the last record of the range was started.
+
+  std::deque<std::unique_ptr<Block>> ahead_;
+  std::unique_ptr<Block> current_;
+  size_t current_record_ = 0;
+  std::vector<std::unique_ptr<Block>> free_blocks_;
 
   // Extend record types with the following special values
   enum {
@@ -53,10 +133,17 @@ class Lst1Impl : public ListReader::FormatImpl {
     // * The record has an invalid CRC (ReadPhysicalRecord reports a drop)
     // * The record is a 0-length record (No drop is reported)
     // * The record is below constructor's initial_offset (No drop is reported)
-    kBadRecord = list_file::kMaxRecordType + 2
+    kBadRecord = list_file::kMaxRecordType + 2,
+
+    // Returned by ParseRecord() for the zero padding at the end of a block.
+    kEndOfBlock = list_file::kMaxRecordType + 3,
   };
 };
 
+Lst1Impl::~Lst1Impl() {
+  DrainAhead();
+}
+
 bool Lst1Impl::ReadHeader(std::map<std::string, std::string>* dest) {
   list_file::HeaderParser parser;
   Status status = parser.Parse(wrapper_->file, dest);
@@ -66,18 +153,121 @@ bool Lst1Impl::ReadHeader(std::map<std::string, std::string>* dest) {
     return false;
   }
 
-  file_offset_ = wrapper_->read_header_bytes = parser.offset();
+  header_size_ = file_offset_ = wrapper_->read_header_bytes = parser.offset();
+  wrapper_->blocks_begin = header_size_;
   wrapper_->block_size = parser.block_multiplier() * list_file::kBlockSizeFactor;
 
   CHECK_GT(wrapper_->block_size, 0);
+  if (dest->count(list_file::kIndexMetaKey)) {
+    ReadIndexTrailer();
+  }
+  auto dict_it = dest->find(list_file::kZstdDictMetaKey);
+  if (dict_it != dest->end()) {
+    zstd_dict_uncompress_ = GetZstdDictUncompress(dict_it->second);
+  }
+
+  // Start from the first block inside the range. The fragments at its beginning belong to
+  // a record started by the previous range.
+  if (wrapper_->range_begin > file_offset_) {
+    size_t bs = wrapper_->block_size;
+    file_offset_ += (wrapper_->range_begin - file_offset_ + bs - 1) / bs * bs;
+    skip_fragments_ = true;
+  }
   backing_store_.reset(new uint8[wrapper_->block_size]);
   uncompress_buf_.reset(new uint8[wrapper_->block_size]);
-  if (file_offset_ >= wrapper_->file->Size()) {
+  if (file_offset_ >= wrapper_->DataEnd()) {
     wrapper_->eof = true;
   }
   return true;
 }
 
+void Lst1Impl::ReadIndexTrailer() {
+  using namespace list_file;
+
+  const size_t fsize = wrapper_->file->Size();
+  uint8 buf[kIndexTrailerSize];
+  if (fsize < file_offset_ + sizeof(buf)) {
+    LOG(WARNING) << "Indexed list file without index trailer";
+    return;
+  }
+
+  auto res = wrapper_->file->Read(fsize - sizeof(buf), strings::MutableByteRange(buf, sizeof(buf)));
+  if (!res.ok() || res.obj != sizeof(buf) ||
+      memcmp(buf + 16, kIndexMagic, kIndexMagicSize) != 0) {
+    // The writer did not call Finish(). The records span the whole file.
+    LOG(WARNING) << "Indexed list file without index trailer " << res.status;
+    return;
+  }
+
+  uint64 index_offset = 0;
+  coding::DecodeFixed64(buf, &index_offset);
+  uint32 index_size = coding::DecodeFixed32(buf + 8);
+  if (index_offset < file_offset_ || index_offset + index_size + sizeof(buf) != fsize) {
+    LOG(WARNING) << "Invalid index trailer, offset " << index_offset << ", size " << index_size;
+    return;
+  }
+  wrapper_->data_end = index_offset;
+  wrapper_->index_size = index_size;
+  wrapper_->index_crc = crc32c::Unmask(coding::DecodeFixed32(buf + 12));
+}
+
+StatusObject<size_t> Lst1Impl::ReadBlock(uint8* buf, strings::ByteRange* dest) {
+  size_t size = std::min<size_t>(wrapper_->block_size, wrapper_->DataEnd() - file_offset_);
+  if (wrapper_->file->ReadView(file_offset_, size, dest))
+    return dest->size();
+
+  auto res = wrapper_->file->Read(file_offset_, strings::MutableByteRange(buf, size));
+  VLOG(2) << "read_size: " << res.obj << ", status: " << res.status;
+  if (res.ok()) {
+    dest->reset(buf, res.obj);
+  }
+  return res;
+}
+
+bool Lst1Impl::SeekToBlock(uint32_t block) {
+  DrainAhead();
+  file_offset_ = header_size_ + size_t(block) * wrapper_->block_size;
+  block_buffer_.clear();
+  array_records_ = 0;
+  array_store_ = StringPiece();
+
+  // The block may start with the tail of a record that started before it.
+  skip_fragments_ = true;
+  past_range_ = false;
+  wrapper_->range_begin = 0;
+  wrapper_->range_end = std::numeric_limits<size_t>::max();
+  wrapper_->eof = file_offset_ >= wrapper_->DataEnd();
+
+  return true;
+}
+
+bool Lst1Impl::NextArrayItem(StringPiece* record) {
+  uint32 item_size = 0;
+  const uint8* aend = reinterpret_cast<const uint8*>(array_store_.end());
+  const uint8* item_ptr = Varint::Parse32WithLimit(u8ptr(array_store_), aend, &item_size);
+  DVLOG(2) << "Array record with size: " << item_size;
+
+  const uint8* next_rec_ptr = item_ptr + item_size;
+  if (item_ptr == nullptr || next_rec_ptr > aend) {
+    wrapper_->ReportCorruption(array_store_.size(), "invalid array record");
+    array_records_ = 0;
+    return false;
+  }
+  wrapper_->read_header_bytes += item_ptr - u8ptr(array_store_);
+  array_store_.remove_prefix(next_rec_ptr - u8ptr(array_store_));
+  *record = StringPiece(strings::charptr(item_ptr), item_size);
+  wrapper_->read_data_bytes += item_size;
+  --array_records_;
+  return true;
+}
+
+void Lst1Impl::ReadBufferedRecords(size_t max_records, std::vector<StringPiece>* dest) {
+  StringPiece record;
+  for (size_t i = 0; i < max_records && array_records_ > 0 && NextArrayItem(&record); ++i) {
+    dest->push_back(record);
+  }
+}
+
 bool Lst1Impl::ReadRecord(StringPiece* record, std::string* scratch) {
   scratch->clear();
   *record = StringPiece();
@@ -85,27 +275,17 @@ bool Lst1Impl::ReadRecord(StringPiece* record, std::string* scratch) {
   StringPiece fragment;
   using namespace list_file;
 
+  if (past_range_)
+    return false;
+
   while (true) {
-    if (array_records_ > 0) {
-      uint32 item_size = 0;
-      const uint8* aend = reinterpret_cast<const uint8*>(array_store_.end());
-      const uint8* item_ptr = Varint::Parse32WithLimit(u8ptr(array_store_), aend, &item_size);
-      DVLOG(2) << "Array record with size: " << item_size;
-
-      const uint8* next_rec_ptr = item_ptr + item_size;
-      if (item_ptr == nullptr || next_rec_ptr > aend) {
-        wrapper_->ReportCorruption(array_store_.size(), "invalid array record");
-        array_records_ = 0;
-      } else {
-        wrapper_->read_header_bytes += item_ptr - u8ptr(array_store_);
-        array_store_.remove_prefix(next_rec_ptr - u8ptr(array_store_));
-        *record = StringPiece(strings::charptr(item_ptr), item_size);
-        wrapper_->read_data_bytes += item_size;
-        --array_records_;
-        return true;
-      }
-    }
-    const unsigned int record_type = ReadPhysicalRecord(&fragment);
+    if (array_records_ > 0 && NextArrayItem(record))
+      return true;
+    const unsigned int record_type = ReadPhysicalRecord(in_fragmented_record, &fragment);
+    if (skip_fragments_ && (record_type == kMiddleType || record_type == kLastType))
+      continue;
+    skip_fragments_ = false;
+
     switch (record_type) {
       case kFullType:
         if (in_fragmented_record) {
@@ -187,21 +367,31 @@ bool Lst1Impl::ReadRecord(StringPiece* record, std::string* scratch) {
   return true;
 }
 
-unsigned int Lst1Impl::ReadPhysicalRecord(StringPiece* result) {
+unsigned int Lst1Impl::ReadPhysicalRecord(bool in_fragment, StringPiece* result) {
   using list_file::kBlockHeaderSize;
+  if (wrapper_->executor)
+    return ReadDecodedRecord(in_fragment, result);
+
   while (true) {
     if (block_buffer_.size() <= kBlockHeaderSize) {
+      if (file_offset_ >= wrapper_->range_end) {
+        // The next block belongs to the following range. We read it only to finish
+        // the record that started in our range.
+        if (!in_fragment) {
+          block_buffer_.clear();
+          return kEof;
+        }
+        past_range_ = true;
+      }
+
       if (!wrapper_->eof) {
-        size_t fsize = wrapper_->file->Size();
-        strings::MutableByteRange mbr(backing_store_.get(), wrapper_->block_size);
-        auto res = wrapper_->file->Read(file_offset_, mbr);
-        VLOG(2) << "read_size: " << res.obj << ", status: " << res.status;
+        size_t fsize = wrapper_->DataEnd();
+        auto res = ReadBlock(backing_store_.get(), &block_buffer_);
         if (!res.ok()) {
           wrapper_->ReportDrop(res.obj, res.status);
           wrapper_->eof = true;
           return kEof;
         }
-        block_buffer_.reset(backing_store_.get(), res.obj);
         file_offset_ += block_buffer_.size();
         if (file_offset_ >= fsize) {
           wrapper_->eof = true;
@@ -218,79 +408,93 @@ unsigned int Lst1Impl::ReadPhysicalRecord(StringPiece* result) {
       }
     }
 
-    // Parse the header
-    const uint8* header = block_buffer_.data();
-    const uint8 type = header[8];
-    uint32 length = coding::DecodeFixed32(header + 4);
     wrapper_->read_header_bytes += kBlockHeaderSize;
 
-    if (length == 0 && type == list_file::kZeroType) {
-      size_t bs = block_buffer_.size();
-      block_buffer_.clear();
-      // Handle the case of when mistakenly written last kBlockHeaderSize bytes as empty record.
-      if (bs != kBlockHeaderSize) {
-        LOG(ERROR) << "Bug reading list file " << bs;
-        return kBadRecord;
-      }
-      continue;
+    const char* reason = nullptr;
+    size_t drop = 0;
+    unsigned type = ParseRecord(&block_buffer_, uncompress_buf_.get(), result, &reason, &drop);
+    if (reason) {
+      wrapper_->ReportCorruption(drop, reason);
     }
+    if (type != kEndOfBlock)
+      return type;
+  }
+}
 
-    if (length + kBlockHeaderSize > block_buffer_.size()) {
-      VLOG(1) << "Invalid length " << length << " file offset " << file_offset_
-              << " block size " << block_buffer_.size() << " type " << int(type);
-      size_t drop_size = block_buffer_.size();
-      block_buffer_.clear();
-      wrapper_->ReportCorruption(drop_size, "bad record length or truncated record at eof.");
-      return kBadRecord;
-    }
+unsigned Lst1Impl::ParseRecord(strings::ByteRange* block, uint8* uncompress_buf,
+                               StringPiece* result, const char** reason, size_t* drop) const {
+  using list_file::kBlockHeaderSize;
 
-    const uint8* data_ptr = header + kBlockHeaderSize;
-    // Check crc
-    if (wrapper_->checksum) {
-      uint32_t expected_crc = crc32c::Unmask(coding::DecodeFixed32(header));
-      // compute crc of the record and the type.
-      uint32_t actual_crc = crc32c::Value(data_ptr - 1, 1 + length);
-      if (actual_crc != expected_crc) {
-        // Drop the rest of the buffer since "length" itself may have
-        // been corrupted and if we trust it, we could find some
-        // fragment of a real log record that just happens to look
-        // like a valid log record.
-        size_t drop_size = block_buffer_.size();
-        block_buffer_.clear();
-        wrapper_->ReportCorruption(drop_size, "checksum mismatch");
-        return kBadRecord;
-      }
-    }
-    uint32 record_size = length + kBlockHeaderSize;
-    block_buffer_.advance(record_size);
+  // Parse the header
+  const uint8* header = block->data();
+  const uint8 type = header[8];
+  uint32 length = coding::DecodeFixed32(header + 4);
 
-    if (type & list_file::kCompressedMask) {
-      if (!Uncompress(data_ptr, &length)) {
-        wrapper_->ReportCorruption(record_size, "Uncompress failed.");
-        return kBadRecord;
-      }
-      data_ptr = uncompress_buf_.get();
+  if (length == 0 && type == list_file::kZeroType) {
+    // The rest of the block is zero padding. Writers pad the blocks when they append the
+    // blocks of another file, see ListWriter::AppendBlocksFrom().
+    block->clear();
+    return kEndOfBlock;
+  }
+
+  if (length + kBlockHeaderSize > block->size()) {
+    VLOG(1) << "Invalid length " << length << " block size " << block->size() << " type "
+            << int(type);
+    *drop = block->size();
+    block->clear();
+    *reason = "bad record length or truncated record at eof.";
+    return kBadRecord;
+  }
+
+  const uint8* data_ptr = header + kBlockHeaderSize;
+  // Check crc
+  if (wrapper_->checksum) {
+    uint32_t expected_crc = crc32c::Unmask(coding::DecodeFixed32(header));
+    // compute crc of the record and the type.
+    uint32_t actual_crc = crc32c::Value(data_ptr - 1, 1 + length);
+    if (actual_crc != expected_crc) {
+      // Drop the rest of the buffer since "length" itself may have
+      // been corrupted and if we trust it, we could find some
+      // fragment of a real log record that just happens to look
+      // like a valid log record.
+      *drop = block->size();
+      block->clear();
+      *reason = "checksum mismatch";
+      return kBadRecord;
     }
+  }
+  uint32 record_size = length + kBlockHeaderSize;
+  block->advance(record_size);
 
-    *result = FromBuf(data_ptr, length);
-    return type & 0xF;
+  if (type & list_file::kCompressedMask) {
+    if (!Uncompress(data_ptr, &length, uncompress_buf)) {
+      *drop = record_size;
+      *reason = "Uncompress failed.";
+      return kBadRecord;
+    }
+    data_ptr = uncompress_buf;
   }
+
+  *result = FromBuf(data_ptr, length);
+  return type & 0xF;
 }
 
-bool Lst1Impl::Uncompress(const uint8* data_ptr, uint32* size) {
+bool Lst1Impl::Uncompress(const uint8* data_ptr, uint32* size, uint8* dest) const {
   uint8 method = *data_ptr++;
   VLOG(2) << "Uncompress " << int(method) << " with size " << *size;
 
   uint32 inp_sz = *size - 1;
 
-  UncompressFunction uncompr_func = GetUncompress(list_file::CompressMethod(method));
+  UncompressFunction uncompr_func = method == list_file::kCompressionZstd && zstd_dict_uncompress_
+                                         ? zstd_dict_uncompress_
+                                         : GetUncompress(list_file::CompressMethod(method));
 
   if (!uncompr_func) {
     LOG(ERROR) << "Could not find uncompress method " << int(method);
     return false;
   }
   size_t uncompress_size = wrapper_->block_size;
-  Status status = uncompr_func(data_ptr, inp_sz, uncompress_buf_.get(), &uncompress_size);
+  Status status = uncompr_func(data_ptr, inp_sz, dest, &uncompress_size);
   if (!status.ok()) {
     VLOG(1) << "Uncompress error: " << status;
     return false;
@@ -300,6 +504,135 @@ bool Lst1Impl::Uncompress(const uint8* data_ptr, uint32* size) {
   return true;
 }
 
+unsigned Lst1Impl::ReadDecodedRecord(bool in_fragment, StringPiece* result) {
+  while (true) {
+    if (current_) {
+      if (current_record_ < current_->records.size()) {
+        const DecodedRecord& rec = current_->records[current_record_++];
+        if (rec.reason) {
+          wrapper_->ReportCorruption(rec.drop, rec.reason);
+        }
+        const uint8* base = rec.uncompressed ? u8ptr(current_->uncompressed) : current_->raw.data();
+        *result = FromBuf(base + rec.offset, rec.length);
+        return rec.type;
+      }
+      free_blocks_.push_back(std::move(current_));
+    }
+
+    if (ahead_.empty()) {
+      if (file_offset_ >= wrapper_->range_end) {
+        // See ReadPhysicalRecord().
+        if (!in_fragment)
+          return kEof;
+        past_range_ = true;
+      }
+      if (!ReadAhead(true))
+        return kEof;
+    }
+
+    current_ = std::move(ahead_.front());
+    ahead_.pop_front();
+    current_->done->Wait();
+    current_record_ = 0;
+    wrapper_->read_header_bytes += current_->header_bytes;
+
+    // Keep the executor busy while we return the records of the current block.
+    ReadAhead(false);
+  }
+}
+
+bool Lst1Impl::ReadAhead(bool force) {
+  const size_t fsize = wrapper_->DataEnd();
+
+  while (!wrapper_->eof && ahead_.size() < wrapper_->read_ahead_blocks &&
+         (force || file_offset_ < wrapper_->range_end)) {
+    force = false;
+
+    std::unique_ptr<Block> block;
+    if (free_blocks_.empty()) {
+      block.reset(new Block);
+      block->data.reset(new uint8[wrapper_->block_size]);
+      block->uncompress_buf.reset(new uint8[wrapper_->block_size]);
+    } else {
+      block = std::move(free_blocks_.back());
+      free_blocks_.pop_back();
+    }
+
+    auto res = ReadBlock(block->data.get(), &block->raw);
+    if (!res.ok()) {
+      wrapper_->ReportDrop(res.obj, res.status);
+      wrapper_->eof = true;
+      free_blocks_.push_back(std::move(block));
+      break;
+    }
+    file_offset_ += res.obj;
+    if (file_offset_ >= fsize || res.obj == 0) {
+      wrapper_->eof = true;
+    }
+    block->last = wrapper_->eof;
+    block->done = wrapper_->executor->NewEvent();
+
+    Block* ptr = block.get();
+    auto done = block->done;
+    ahead_.push_back(std::move(block));
+    wrapper_->executor->Add([this, ptr, done] {
+      DecodeBlock(ptr);
+      done->Notify();
+    });
+  }
+  return !ahead_.empty();
+}
+
+void Lst1Impl::DecodeBlock(Block* block) const {
+  using list_file::kBlockHeaderSize;
+
+  block->uncompressed.clear();
+  block->records.clear();
+  block->header_bytes = 0;
+
+  strings::ByteRange range = block->raw;
+  const uint8* uncompress_buf = block->uncompress_buf.get();
+
+  while (range.size() > kBlockHeaderSize) {
+    block->header_bytes += kBlockHeaderSize;
+
+    DecodedRecord rec{0, false, 0, 0, nullptr, 0};
+    StringPiece data;
+    rec.type = ParseRecord(&range, block->uncompress_buf.get(), &data, &rec.reason, &rec.drop);
+    if (rec.type == kEndOfBlock)
+      break;
+
+    if (data.empty()) {
+      // Bad records have no data.
+    } else if (u8ptr(data) == uncompress_buf) {
+      // The next record reuses uncompress_buf.
+      rec.uncompressed = true;
+      rec.offset = block->uncompressed.size();
+      block->uncompressed.append(data.data(), data.size());
+    } else {
+      rec.offset = u8ptr(data) - block->raw.data();
+    }
+    rec.length = data.size();
+    block->records.push_back(rec);
+  }
+
+  if (block->last && !range.empty() && range.size() <= kBlockHeaderSize) {
+    block->records.push_back(
+        DecodedRecord{kEof, false, 0, 0, "truncated record at end of file", range.size()});
+  }
+}
+
+void Lst1Impl::DrainAhead() {
+  for (auto& block : ahead_) {
+    block->done->Wait();
+    free_blocks_.push_back(std::move(block));
+  }
+  ahead_.clear();
+  if (current_) {
+    free_blocks_.push_back(std::move(current_));
+  }
+}
+
 const uint8* DecodeString(const uint8* ptr, const uint8* end, string* dest) {
   if (ptr == nullptr)
     return nullptr;
@@ -326,6 +659,10 @@ ListReader::ReaderWrapper::~ReaderWrapper() {
   }
 }
 
+size_t ListReader::ReaderWrapper::DataEnd() const {
+  return std::min(file->Size(), data_end);
+}
+
 void ListReader::ReaderWrapper::BadHeader(const Status& st) {
   LOG(ERROR) << "Error reading header " << st;
   ReportDrop(file->Size(), st);
@@ -385,6 +722,23 @@ bool ListReader::ReadHeader() {
   return false;
 }
 
+void ListReader::EnableReadAhead(Executor* executor, unsigned blocks) {
+  CHECK(!impl_) << "EnableReadAhead must be called before reading";
+  CHECK(executor);
+  CHECK_GT(blocks, 0);
+
+  wrapper_->executor = executor;
+  wrapper_->read_ahead_blocks = blocks;
+}
+
+void ListReader::SetRange(size_t offset, size_t length) {
+  CHECK(!impl_) << "SetRange must be called before reading";
+  constexpr size_t kMaxOffset = std::numeric_limits<size_t>::max();
+
+  wrapper_->range_begin = offset;
+  wrapper_->range_end = length > kMaxOffset - offset ? kMaxOffset : offset + length;
+}
+
 bool ListReader::GetMetaData(std::map<std::string, std::string>* meta) {
   if (!ReadHeader())
     return false;
@@ -399,6 +753,96 @@ bool ListReader::ReadRecord(StringPiece* record, std::string* scratch) {
   return impl_->ReadRecord(record, scratch);
 }
 
+bool ListReader::IsFileView(StringPiece record) const {
+  strings::ByteRange view;
+  if (record.empty() || !wrapper_->file->ReadView(0, wrapper_->file->Size(), &view))
+    return false;
+  return u8ptr(record) >= view.begin() && u8ptr(record) + record.size() <= view.end();
+}
+
+bool ListReader::ReadRecords(size_t max_records, std::vector<StringPiece>* records,
+                             std::string* scratch) {
+  records->clear();
+  StringPiece record;
+  if (max_records == 0 || !ReadRecord(&record, scratch))
+    return false;
+
+  records->push_back(record);
+  impl_->ReadBufferedRecords(max_records - 1, records);
+  return true;
+}
+
+bool ListReader::GetBlockExtent(size_t* begin, size_t* end) {
+  if (!ReadHeader() || wrapper_->blocks_begin == 0)
+    return false;
+
+  *begin = wrapper_->blocks_begin;
+  *end = std::max(*begin, wrapper_->DataEnd());
+  return true;
+}
+
+const list_file::RecordIndex* ListReader::GetIndex() {
+  if (!ReadHeader())
+    return nullptr;
+  if (index_ || wrapper_->index_size == 0)
+    return index_.get();
+
+  std::unique_ptr<uint8[]> buf(new uint8[wrapper_->index_size]);
+  strings::MutableByteRange mbr(buf.get(), wrapper_->index_size);
+  auto res = wrapper_->file->Read(wrapper_->data_end, mbr);
+  const uint32 index_size = wrapper_->index_size;
+  wrapper_->index_size = 0;  // We try reading the index only once.
+
+  if (!res.ok() || res.obj != index_size) {
+    wrapper_->ReportDrop(index_size, res.status);
+    return nullptr;
+  }
+
+  if (wrapper_->checksum && crc32c::Value(buf.get(), index_size) != wrapper_->index_crc) {
+    wrapper_->ReportCorruption(index_size, "index checksum mismatch");
+    return nullptr;
+  }
+
+  index_.reset(new list_file::RecordIndex);
+  if (!index_->Decode(buf.get(), index_size)) {
+    index_.reset();
+    wrapper_->ReportCorruption(index_size, "invalid record index");
+  }
+  return index_.get();
+}
+
+bool ListReader::SeekToRecord(uint64_t ordinal) {
+  const list_file::RecordIndex* index = GetIndex();
+  const list_file::RecordIndex::Entry* entry = index ? index->FindRecord(ordinal) : nullptr;
+  if (!entry || !impl_->SeekToBlock(entry->block))
+    return false;
+
+  string scratch;
+  StringPiece record;
+  for (uint64_t i = entry->first_record; i < ordinal; ++i) {
+    if (!impl_->ReadRecord(&record, &scratch))
+      return false;
+  }
+  return true;
+}
+
+bool ListReader::SeekToKey(StringPiece key) {
+  const list_file::RecordIndex* index = GetIndex();
+  const list_file::RecordIndex::Entry* entry = index ? index->FindKey(key) : nullptr;
+
+  return entry && impl_->SeekToBlock(entry->block);
+}
+
+bool ListReader::SeekToBlock(uint32_t block) {
+  return ReadHeader() && impl_->SeekToBlock(block);
+}
+
+bool ListReader::MayContain(StringPiece key) {
+  const list_file::RecordIndex* index = GetIndex();
+
+  return !index || index->MayContain(key);
+}
+
 void ListReader::Reset() {
   impl_.reset();
   wrapper_->Reset();
@@ -4,10 +4,14 @@
 #pragma once
 
 #include <functional>
+#include <limits>
 #include <map>
+#include <memory>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/logging.h"  // For CHECK.
+#include "file/list_executor.h"
 #include "file/list_file_format.h"
 #include "strings/stringpiece.h"
 #include "util/status.h"
@@ -45,6 +49,20 @@ class ListReader {
 
   bool GetMetaData(std::map<std::string, std::string>* meta);
 
+  // Limits the reader to the records that start in the blocks whose offsets are in
+  // [offset, offset + length). Ranges that partition the file read each record exactly once.
+  // Must be called before reading. Supported only by LST1 files.
+  void SetRange(size_t offset, size_t length);
+
+  // Runs the tasks that decode the blocks read ahead by the reader, see EnableReadAhead().
+  using Executor = ListExecutor;
+
+  // Reads up to 'blocks' blocks ahead of the records being returned and verifies
+  // checksums and uncompresses these blocks with executor. The records are returned in the
+  // same order. Must be called before reading, executor must outlive the reader.
+  // Supported only by LST1 files.
+  void EnableReadAhead(Executor* executor, unsigned blocks);
+
   // Read the next record into *record.  Returns true if read
   // successfully, false if we hit end of file. May use
   // "*scratch" as temporary storage.  The contents filled in *record
@@ -52,8 +70,53 @@ class ListReader {
   // reader or the next mutation to *scratch.
   // If invalid record is encountered, read will continue to the next record and
   // will notify reporter about the corruption.
+  // With files opened with ReadonlyFile::Options::use_mmap, the records that are neither
+  // fragmented nor compressed are views into the mapping, see IsFileView().
   bool ReadRecord(StringPiece* record, std::string* scratch);
 
+  // Returns true if record points into the memory of a mapped file. Such records stay valid
+  // until the file is closed, so large records can be kept without copying them.
+  bool IsFileView(StringPiece record) const;
+
+  // Reads up to max_records records into *records, which is cleared first. Small records
+  // that follow the first one in the same LST1 array record are returned as views into
+  // the block buffer, without copying them. The views stay valid until the next mutating
+  // operation on this reader or the next mutation of *scratch. Returns false at the end of file.
+  bool ReadRecords(size_t max_records, std::vector<StringPiece>* records, std::string* scratch);
+
+  // The functions below use the record index of LST1 files written with
+  // ListWriter::Options::write_index. They return false for files without an index.
+
+  // Positions the reader so that the next ReadRecord() returns the record with the given
+  // 0-based ordinal. Only the block in which the record starts is read. Returns false also if
+  // the ordinal is past the last record. Clears the range set with SetRange().
+  bool SeekToRecord(uint64_t ordinal);
+
+  // Positions the reader at the last block whose first record has a key less than key.
+  // Requires a writer with Options::index_key and records added in the order of their keys,
+  // the caller skips the records with smaller keys that precede the requested ones.
+  // Clears the range set with SetRange().
+  bool SeekToKey(StringPiece key);
+
+  // Positions the reader at the first record that starts in the given block of an LST1 file,
+  // see list_file::RecordIndex::Entry. Clears the range set with SetRange().
+  bool SeekToBlock(uint32_t block);
+
+  // Returns the record index of the file or null if it has none.
+  const list_file::RecordIndex* GetIndex();
+
+  // Returns false if the file was written with Options::bloom_key and none of its records has
+  // the given key. Reads only the record index, true if the file has no key filter.
+  bool MayContain(StringPiece key);
+
+  // Sets [begin, end) to the region of an LST1 file that holds its blocks, which start at
+  // begin and have the block size of the file. The region excludes the record index.
+  // Returns false for LST2 files or if the header can not be read.
+  bool GetBlockExtent(size_t* begin, size_t* end);
+
+  ReadonlyFile* file() const { return wrapper_->file; }
+  uint32_t block_size() const { return wrapper_->block_size; }
+
   void Reset();
 
   uint32_t read_header_bytes() const { return wrapper_->read_header_bytes; }
@@ -87,6 +150,23 @@ class ListReader {
     const bool checksum = false;
     uint32_t block_size = 0;
 
+    // Set by SetRange(). Offsets in the file of the first and the last+1 blocks to read.
+    size_t range_begin = 0;
+    size_t range_end = std::numeric_limits<size_t>::max();
+
+    // Set by LST1 files. The offset of their first block.
+    size_t blocks_begin = 0;
+
+    // Set for indexed files. The records end at data_end, where the index starts.
+    size_t data_end = std::numeric_limits<size_t>::max();
+    uint32_t index_size = 0, index_crc = 0;
+
+    size_t DataEnd() const;
+
+    // Set by EnableReadAhead().
+    Executor* executor = nullptr;
+    unsigned read_ahead_blocks = 0;
+
     CorruptionReporter const reporter_;
   };
 
@@ -98,6 +178,14 @@ class ListReader {
     virtual bool ReadHeader(std::map<std::string, std::string>* dest) = 0;
     virtual bool ReadRecord(StringPiece* record, std::string* scratch) = 0;
 
+    // Continues reading from the first record that starts in the given block.
+    // Returns false if the format does not support it.
+    virtual bool SeekToBlock(uint32_t block) { return false; }
+
+    // Appends up to max_records records that follow the last one returned by ReadRecord()
+    // and are stored in the same buffer. They stay valid until the next ReadRecord().
+    virtual void ReadBufferedRecords(size_t max_records, std::vector<StringPiece>* dest) {}
+
    protected:
     size_t file_offset_ = 0;
     uint32_t array_records_ = 0;
@@ -114,6 +202,7 @@ class ListReader {
   bool ReadHeader();
 
   std::map<std::string, std::string> meta_;
+  std::unique_ptr<list_file::RecordIndex> index_;
 
   std::unique_ptr<ReaderWrapper> wrapper_;
   std::unique_ptr<FormatImpl> impl_;
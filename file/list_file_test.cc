@@ -4,6 +4,7 @@
 
 #include "file/list_file.h"
 
+#include <atomic>
 #include <random>
 
 #include <gmock/gmock.h>
@@ -337,6 +338,145 @@ TEST_F(LogTest, RandomRead) {
   ASSERT_EQ("EOF", Read());
 }
 
+TEST_F(LogTest, Ranges) {
+  if (FLAGS_v2)
+    return;
+
+  vector<string> expected;
+  for (int i = 0; i < 300; i++) {
+    expected.push_back(RandomSkewedString(i));
+    Write(expected.back());
+  }
+  FlushWriter();
+  source_.set_contents(dest_->contents());
+  const size_t file_size = dest_->contents().size();
+
+  for (size_t range_size : {size_t(1000), size_t(block_size_), size_t(3 * block_size_ + 17)}) {
+    vector<string> actual;
+    for (size_t offset = 0; offset < file_size; offset += range_size) {
+      ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+      reader.SetRange(offset, range_size);
+
+      std::string scratch;
+      StringPiece record;
+      while (reader.ReadRecord(&record, &scratch)) {
+        actual.push_back(AsString(record));
+      }
+    }
+    EXPECT_EQ(expected, actual) << range_size;
+  }
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, Index) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.use_compression = false;
+  options.write_index = true;
+  options.index_key = [](StringPiece record) { return AsString(record.substr(0, 8)); };
+  SetupWriter(options);
+
+  vector<string> expected;
+  for (int i = 0; i < 2000; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%05d", i);
+    // Every 100th record spans several blocks.
+    expected.push_back(BigString(key, i % 100 == 0 ? 3 * block_size_ : 8 + Skewed(10)));
+    Write(expected.back());
+  }
+  ASSERT_TRUE(writer_->Finish().ok());
+  source_.set_contents(dest_->contents());
+
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  const list_file::RecordIndex* index = reader.GetIndex();
+  ASSERT_TRUE(index != nullptr);
+  EXPECT_EQ(expected.size(), index->num_records());
+  EXPECT_GT(index->entries().size(), 10);
+
+  std::string scratch;
+  StringPiece record;
+  for (uint64_t ordinal : {1999, 0, 1, 100, 101, 777, 1500}) {
+    ASSERT_TRUE(reader.SeekToRecord(ordinal)) << ordinal;
+    ASSERT_TRUE(reader.ReadRecord(&record, &scratch)) << ordinal;
+    EXPECT_EQ(expected[ordinal], AsString(record)) << ordinal;
+  }
+  EXPECT_FALSE(reader.SeekToRecord(expected.size()));
+
+  // The records that follow the last one end at the index.
+  ASSERT_TRUE(reader.SeekToRecord(1998));
+  vector<string> tail;
+  while (reader.ReadRecord(&record, &scratch)) {
+    tail.push_back(AsString(record));
+  }
+  EXPECT_THAT(tail, ElementsAre(expected[1998], expected[1999]));
+
+  ASSERT_TRUE(reader.SeekToKey("key01234"));
+  while (reader.ReadRecord(&record, &scratch) && record.substr(0, 8) < "key01234") {
+  }
+  EXPECT_EQ(expected[1234], AsString(record));
+  EXPECT_EQ(0, DroppedBytes());
+
+  // A full scan does not return the index.
+  ListReader scan(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  vector<string> actual;
+  while (scan.ReadRecord(&record, &scratch)) {
+    actual.push_back(AsString(record));
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, BloomFilter) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.write_index = true;
+  options.bloom_key = [](StringPiece record) { return AsString(record.substr(0, 8)); };
+  SetupWriter(options);
+
+  for (int i = 0; i < 2000; i += 2) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%05d", i);
+    Write(BigString(key, 8 + Skewed(10)));
+  }
+  ASSERT_TRUE(writer_->Finish().ok());
+  source_.set_contents(dest_->contents());
+
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  unsigned false_positives = 0;
+  for (int i = 0; i < 2000; ++i) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%05d", i);
+    if (i % 2 == 0) {
+      EXPECT_TRUE(reader.MayContain(key)) << key;
+    } else {
+      false_positives += reader.MayContain(key);
+    }
+  }
+  EXPECT_LT(false_positives, 30);
+
+  // The filter does not affect reading.
+  std::string scratch;
+  StringPiece record;
+  unsigned count = 0;
+  while (reader.ReadRecord(&record, &scratch)) {
+    ++count;
+  }
+  EXPECT_EQ(1000, count);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, NoIndex) {
+  Write("foo");
+  ASSERT_EQ("foo", Read());
+  EXPECT_TRUE(reader_->GetIndex() == nullptr);
+  EXPECT_FALSE(reader_->SeekToRecord(0));
+  EXPECT_TRUE(reader_->MayContain("bar"));
+}
+
 // Tests of all the error paths in log_reader.cc follow:
 TEST_F(LogTest, ReadError) {
   Write("foo");
@@ -500,6 +640,240 @@ TEST_F(LogTest, Compression) {
 }
 
 
+TEST_F(LogTest, ReadRecords) {
+  vector<string> expected;
+  for (int i = 0; i < 3000; ++i) {
+    expected.push_back(RandomSkewedString(i));
+    Write(expected.back());
+  }
+  FlushWriter();
+  source_.set_contents(dest_->contents());
+
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  vector<string> actual;
+  vector<StringPiece> records;
+  std::string scratch;
+  size_t batches = 0;
+  while (reader.ReadRecords(100, &records, &scratch)) {
+    ASSERT_FALSE(records.empty());
+    ASSERT_LE(records.size(), 100);
+    batches += records.size() > 1;
+    for (StringPiece rec : records) {
+      actual.push_back(AsString(rec));
+    }
+  }
+  EXPECT_TRUE(records.empty());
+  EXPECT_EQ(expected, actual);
+  if (!FLAGS_v2) {
+    EXPECT_GT(batches, 0);
+  }
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, ReadAhead) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.block_size_multiplier = 1;
+  options.use_compression = true;
+  options.compress_method = kCompressionZlib;
+  SetupWriter(options);
+
+  vector<string> expected;
+  for (int i = 0; i < 1000; ++i) {
+    // Compressed, uncompressed and fragmented records.
+    expected.push_back(RandomSkewedString(i));
+    Write(expected.back());
+  }
+  FlushWriter();
+  source_.set_contents(dest_->contents());
+
+  ThreadExecutor executor(3);
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  reader.EnableReadAhead(&executor, 4);
+
+  vector<string> actual;
+  std::string scratch;
+  StringPiece record;
+  while (reader.ReadRecord(&record, &scratch)) {
+    actual.push_back(AsString(record));
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(0, DroppedBytes());
+  EXPECT_GT(executor.num_tasks(), 4);
+
+  // Ranges read the same records.
+  const size_t file_size = dest_->contents().size();
+  actual.clear();
+  for (size_t offset = 0; offset < file_size; offset += 3 * block_size_) {
+    ListReader range_reader(&source_, DO_NOT_TAKE_OWNERSHIP, true, reporter_func());
+    range_reader.SetRange(offset, 3 * block_size_);
+    range_reader.EnableReadAhead(&executor, 2);
+    while (range_reader.ReadRecord(&record, &scratch)) {
+      actual.push_back(AsString(record));
+    }
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, ReadAheadChecksumMismatch) {
+  if (FLAGS_v2)
+    return;
+
+  Write("foo");
+  FlushWriter();
+  IncrementByte(0, 10);
+  source_.set_contents(dest_->contents());
+
+  ThreadExecutor executor(1);
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  reader.EnableReadAhead(&executor, 2);
+
+  std::string scratch;
+  StringPiece record;
+  CaptureStderr();
+  EXPECT_FALSE(reader.ReadRecord(&record, &scratch));
+  EXPECT_FALSE(GetCapturedStderr().empty());
+  EXPECT_EQ(14, DroppedBytes());
+  EXPECT_THAT(ReportMessage(), HasSubstr("checksum mismatch"));
+}
+
+TEST_F(LogTest, AsyncWrite) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.compress_method = kCompressionZlib;
+  options.write_index = true;
+
+  vector<string> expected;
+  util::StringSink* sync_dest = new util::StringSink;
+  ListWriter sync_writer(sync_dest, options);
+  ASSERT_TRUE(sync_writer.Init().ok());
+  for (int i = 0; i < 1000; ++i) {
+    expected.push_back(RandomSkewedString(i));
+    ASSERT_TRUE(sync_writer.AddRecord(expected.back()).ok());
+    if (i == 500)
+      ASSERT_TRUE(sync_writer.Flush().ok());
+  }
+  ASSERT_TRUE(sync_writer.Finish().ok());
+
+  ThreadExecutor executor(2);
+  options.async_executor = &executor;
+  SetupWriter(options);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    Write(expected[i]);
+    if (i == 500)
+      FlushWriter();
+  }
+  EXPECT_EQ(expected.size(), writer_->records_added());
+  ASSERT_TRUE(writer_->Finish().ok());
+
+  // The async writer produces the same file.
+  EXPECT_GT(executor.num_tasks(), 4);
+  EXPECT_EQ(sync_dest->contents(), dest_->contents());
+  EXPECT_EQ(sync_writer.bytes_added(), writer_->bytes_added());
+  EXPECT_EQ(sync_writer.compression_savings(), writer_->compression_savings());
+
+  source_.set_contents(dest_->contents());
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  vector<string> actual;
+  std::string scratch;
+  StringPiece record;
+  while (reader.ReadRecord(&record, &scratch)) {
+    actual.push_back(AsString(record));
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, AppendBlocks) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.compress_method = kCompressionZlib;
+
+  // The source files end with partial blocks, some of their records span blocks.
+  vector<string> expected, sources;
+  for (int j = 0; j < 3; ++j) {
+    util::StringSink* sink = new util::StringSink;
+    ListWriter writer(sink, options);
+    writer.AddMeta("source", std::to_string(j));
+    ASSERT_TRUE(writer.Init().ok());
+    for (int i = 0; i < 200; ++i) {
+      ASSERT_TRUE(writer.AddRecord(RandomSkewedString(j * 200 + i)).ok());
+    }
+    ASSERT_TRUE(writer.Flush().ok());
+    sources.push_back(sink->contents());
+  }
+
+  SetupWriter(options);
+  size_t copied = 0;
+  for (int j = 0; j < 3; ++j) {
+    // The first source is appended at the beginning of a block.
+    for (int i = 0; i < j * 10; ++i) {
+      expected.push_back(BigString(NumberString(i), 1000));
+      Write(expected.back());
+    }
+    for (int i = 0; i < 200; ++i) {
+      expected.push_back(RandomSkewedString(j * 200 + i));
+    }
+    ReadonlyStringFile file(sources[j]);
+    ListReader reader(&file, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+    size_t begin = 0, end = 0;
+    ASSERT_TRUE(reader.GetBlockExtent(&begin, &end));
+    copied += end - begin;
+    ASSERT_TRUE(writer_->AppendBlocksFrom(&reader).ok());
+  }
+  expected.push_back("last");
+  Write(expected.back());
+  FlushWriter();
+  EXPECT_EQ(31, writer_->records_added());
+  EXPECT_GT(writer_->bytes_added(), copied);
+
+  vector<string> actual;
+  string record;
+  while ((record = Read()) != "EOF") {
+    actual.push_back(record);
+  }
+  EXPECT_EQ(expected, actual);
+
+  std::map<string, string> meta;
+  ASSERT_TRUE(reader_->GetMetaData(&meta));
+  EXPECT_EQ(0, meta.count("source"));
+
+  // Ranges and read-ahead readers see the same records.
+  ThreadExecutor executor(2);
+  const size_t file_size = dest_->contents().size();
+  for (size_t range_size : {size_t(block_size_), size_t(3 * block_size_ + 17)}) {
+    actual.clear();
+    for (size_t offset = 0; offset < file_size; offset += range_size) {
+      ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+      reader.SetRange(offset, range_size);
+      reader.EnableReadAhead(&executor, 2);
+
+      std::string scratch;
+      StringPiece record;
+      while (reader.ReadRecord(&record, &scratch)) {
+        actual.push_back(AsString(record));
+      }
+    }
+    EXPECT_EQ(expected, actual) << range_size;
+  }
+  EXPECT_EQ(0, DroppedBytes());
+
+  // Indexed writers can not append blocks.
+  options.write_index = true;
+  ListWriter indexed(new util::StringSink, options);
+  ASSERT_TRUE(indexed.Init().ok());
+  ReadonlyStringFile file(sources[0]);
+  ListReader reader(&file, DO_NOT_TAKE_OWNERSHIP);
+  EXPECT_FALSE(indexed.AppendBlocksFrom(&reader).ok());
+}
+
 TEST_F(LogTest, Zlib) {
   ListWriter::Options options;
   options.block_size_multiplier = 2;
@@ -512,6 +886,170 @@ TEST_F(LogTest, Zlib) {
   ASSERT_EQ(BigString("foo", 1000), Read());
 }
 
+TEST_F(LogTest, Zstd) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.use_compression = true;
+  options.compress_method = kCompressionZstd;
+  SetupWriter(options);
+  Write(BigString("foo", 1000));
+  Write(BigString("bar", 3 * block_size_));
+  FlushWriter();
+
+  ASSERT_EQ(BigString("foo", 1000), Read());
+  ASSERT_EQ(BigString("bar", 3 * block_size_), Read());
+  ASSERT_EQ("EOF", Read());
+  EXPECT_GT(writer_->compression_savings(), 0);
+}
+
+TEST_F(LogTest, ZstdDict) {
+  if (FLAGS_v2)
+    return;
+
+  // Small records that share most of their contents, like serialized messages of one type.
+  vector<string> expected;
+  for (int i = 0; i < 3000; ++i) {
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "{\"user_id\": %d, \"country\": \"%s\", \"event\": \"page_view\", "
+             "\"url\": \"https://example.com/items/%d\", \"ts\": %d}",
+             i * 7919 % 10007, i % 3 ? "US" : "DE", i % 97, 1550000000 + i * 13);
+    expected.push_back(buf);
+  }
+
+  auto write_file = [&](uint32 dict_records) {
+    ListWriter::Options options;
+    options.use_compression = true;
+    options.compress_method = kCompressionZstd;
+    options.zstd_dict_records = dict_records;
+    SetupWriter(options, false);
+    writer_->AddMeta("foo", "bar");
+    CHECK(writer_->Init().ok());
+    for (const string& s : expected) {
+      Write(s);
+    }
+    EXPECT_EQ(expected.size(), writer_->records_added());
+    FlushWriter();
+    return dest_->contents().size();
+  };
+
+  size_t plain_size = write_file(0);
+  size_t dict_size = write_file(1000);
+  EXPECT_LT(dict_size, plain_size);
+  source_.set_contents(dest_->contents());
+
+  ListReader reader(&source_, DO_NOT_TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  std::map<string, string> meta;
+  ASSERT_TRUE(reader.GetMetaData(&meta));
+  EXPECT_EQ("bar", meta["foo"]);
+  EXPECT_GT(meta[kZstdDictMetaKey].size(), 0);
+
+  vector<string> actual;
+  std::string scratch;
+  StringPiece record;
+  while (reader.ReadRecord(&record, &scratch)) {
+    actual.push_back(AsString(record));
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, ZstdDictFlush) {
+  if (FLAGS_v2)
+    return;
+
+  ListWriter::Options options;
+  options.use_compression = true;
+  options.compress_method = kCompressionZstd;
+  options.zstd_dict_records = 1000;
+  SetupWriter(options);
+
+  // Flush() writes the records collected so far, with or without a dictionary.
+  Write(BigString("foo", 1000));
+  ASSERT_EQ(BigString("foo", 1000), Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, Mmap) {
+  if (FLAGS_v2)
+    return;
+
+  vector<string> expected;
+  for (int i = 0; i < 300; i++) {
+    expected.push_back(RandomSkewedString(i));
+    Write(expected.back());
+  }
+  FlushWriter();
+  string file_path = base::GetTestTempPath("mmap.lst");
+  file_util::WriteStringToFileOrDie(dest_->contents(), file_path);
+
+  ReadonlyFile::Options opts;
+  opts.use_mmap = true;
+  for (bool read_ahead : {false, true}) {
+    auto res = ReadonlyFile::Open(file_path, opts);
+    ASSERT_TRUE(res.ok()) << res.status;
+
+    ThreadExecutor executor(2);
+    ListReader reader(res.obj, TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+    if (read_ahead)
+      reader.EnableReadAhead(&executor, 2);
+
+    vector<string> actual;
+    std::string scratch;
+    StringPiece record;
+    while (reader.ReadRecord(&record, &scratch)) {
+      actual.push_back(AsString(record));
+    }
+    EXPECT_EQ(expected, actual);
+  }
+  EXPECT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, LargeRecords) {
+  string file_name = file_util::TempFile::TempFilename("/tmp");
+
+  ListWriter::Options options;
+  options.use_compression = false;
+
+  // The fragments of the large record are written in several vectored writes.
+  const string medium = BigString("medium", 50000), large = BigString("large", 5 << 20);
+  std::unique_ptr<ListWriter> writer(new ListWriter(file_name, options));
+  ASSERT_TRUE(writer->Init().ok());
+  ASSERT_TRUE(writer->AddRecord("small").ok());
+  ASSERT_TRUE(writer->AddRecord(medium).ok());
+  ASSERT_TRUE(writer->AddRecord(large).ok());
+  ASSERT_TRUE(writer->AddRecord("tail").ok());
+  ASSERT_TRUE(writer->Flush().ok());
+  writer.reset();
+
+  ReadonlyFile::Options opts;
+  opts.use_mmap = true;
+  auto res = ReadonlyFile::Open(file_name, opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+
+  ListReader reader(res.obj, TAKE_OWNERSHIP, true /*checksum*/, reporter_func());
+  string scratch;
+  StringPiece record, medium_view;
+  ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+  EXPECT_EQ("small", record);
+
+  // Unfragmented records point into the mapping and outlive the following reads.
+  ASSERT_TRUE(reader.ReadRecord(&medium_view, &scratch));
+  EXPECT_TRUE(reader.IsFileView(medium_view));
+
+  ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+  EXPECT_TRUE(large == record);
+  EXPECT_FALSE(reader.IsFileView(record));
+  ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+  EXPECT_EQ("tail", record);
+  EXPECT_FALSE(reader.ReadRecord(&record, &scratch));
+
+  EXPECT_EQ(medium, medium_view);
+  EXPECT_EQ(0, DroppedBytes());
+}
+
 TEST_F(LogTest, MetaData) {
   SetupWriter(ListWriter::Options(), false);
   string kMetaVal1 = "data1";
@@ -221,6 +221,7 @@ util::Status Lst2Impl::WriteFragmented(StringPiece record) {
     DCHECK_EQ(0, block_offset_);
     rh.size = std::min<uint32_t>(RecordHeader::PayloadSize(block_size_), record.size());
     t = rh.size == record.size() ? kLastType : kMiddleType;
+    rh.flags = t;
   }
   return Status::OK;
 }
@@ -241,22 +242,27 @@ util::Status Lst2Impl::EmitSingleRecord(RecordType type, StringPiece record) {
 util::Status Lst2Impl::EmitPhysicalRecord(strings::ByteRange header, strings::ByteRange record) {
   DCHECK_LE(block_offset_ + header.size() + record.size(), block_size_);
 
-  RETURN_IF_ERROR(dest_->Append(header));
-  RETURN_IF_ERROR(dest_->Append(record));
+  // The record is written from the caller's buffer, together with the header and the filling
+  // of the block.
+  static const uint8_t kBlockFilling[RecordHeader::kSingleSmallSize] = {0};
+  strings::ByteRange slices[3] = {header, record};
+  unsigned num_slices = 2;
 
   block_offset_ += (header.size() + record.size());
 
   if (block_offset_ + RecordHeader::kSingleSmallSize >= block_size_) {
     if (block_offset_ < block_size_) {
-      uint8_t buf[RecordHeader::kSingleSmallSize] = {0};
-      RETURN_IF_ERROR(dest_->Append(strings::ByteRange(buf, block_size_ - block_offset_)));
+      slices[num_slices++] = strings::ByteRange(kBlockFilling, block_size_ - block_offset_);
     }
     block_offset_ = 0;
   }
-  return Status::OK;
+  return dest_->AppendV(slices, num_slices);
 }
 
 bool ReaderImpl::ReadHeader(std::map<std::string, std::string>* dest) {
+  CHECK(wrapper_->range_begin == 0 && wrapper_->range_end == std::numeric_limits<size_t>::max())
+      << "Ranges are not supported by LST2 files";
+
   uint8_t buf[4];
   auto res = wrapper_->file->Read(kMagicStringSize, strings::MutableByteRange(buf, sizeof(buf)));
   if (!res.ok())
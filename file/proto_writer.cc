@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "file/filesource.h"
+#include "file/list_executor.h"
 #include "file/list_file.h"
 #include "strings/stringprintf.h"
 
@@ -23,10 +24,17 @@ namespace gpb = ::google::protobuf;
 
 namespace {
 
+// AddBatch() uses the executor for batches of at least kParallelBytes, each task serializes
+// at least kSliceBytes of them.
+constexpr size_t kParallelBytes = 1 << 20;
+constexpr size_t kSliceBytes = 1 << 18;
+
 inline list_file::CompressMethod CompressType(ListProtoWriter::Options::CompressMethod m) {
   switch (m) {
     case ListProtoWriter::Options::LZ4_COMPRESS:
       return list_file::kCompressionLZ4;
+    case ListProtoWriter::Options::ZSTD_COMPRESS:
+      return list_file::kCompressionZstd;
     default:;
   }
   return list_file::kCompressionZlib;
@@ -71,8 +79,69 @@ ListProtoWriter::~ListProtoWriter() {
 }
 
 util::Status ListProtoWriter::Add(const ::google::protobuf::MessageLite& msg) {
+  return AddBatch({&msg});
+}
+
+util::Status ListProtoWriter::AddBatch(absl::Span<const gpb::MessageLite* const> msgs) {
   CHECK(writer_);
-  CHECK_EQ(dscr_->full_name(), msg.GetTypeName());
+  if (msgs.empty())
+    return Status::OK;
+
+  CHECK_EQ(dscr_->full_name(), msgs.front()->GetTypeName());
+  batch_offsets_.resize(msgs.size() + 1);
+  size_t total = 0;
+  for (size_t i = 0; i < msgs.size(); ++i) {
+    DCHECK_EQ(dscr_->full_name(), msgs[i]->GetTypeName());
+    batch_offsets_[i] = total;
+    total += msgs[i]->ByteSizeLong();
+  }
+  batch_offsets_.back() = total;
+  batch_buf_.resize(total);
+
+  Serialize(msgs);
+
+  for (size_t i = 0; i < msgs.size(); ++i) {
+    RETURN_IF_ERROR(PrepareRecord());
+
+    const uint8* start = batch_buf_.data() + batch_offsets_[i];
+    RETURN_IF_ERROR(
+        writer_->AddRecord(strings::FromBuf(start, batch_offsets_[i + 1] - batch_offsets_[i])));
+  }
+  return Status::OK;
+}
+
+void ListProtoWriter::Serialize(absl::Span<const gpb::MessageLite* const> msgs) {
+  // The sizes were cached by ByteSizeLong().
+  auto serialize = [this, msgs](size_t from, size_t to) {
+    for (size_t i = from; i < to; ++i) {
+      msgs[i]->SerializeWithCachedSizesToArray(batch_buf_.data() + batch_offsets_[i]);
+    }
+  };
+
+  if (!options_.executor || batch_offsets_.back() < kParallelBytes) {
+    serialize(0, msgs.size());
+    return;
+  }
+
+  std::vector<std::shared_ptr<ListExecutor::Event>> events;
+  size_t from = 0;
+  for (size_t i = 1; i <= msgs.size(); ++i) {
+    if (i < msgs.size() && batch_offsets_[i] - batch_offsets_[from] < kSliceBytes)
+      continue;
+    std::shared_ptr<ListExecutor::Event> done = options_.executor->NewEvent();
+    options_.executor->Add([serialize, from, i, done] {
+      serialize(from, i);
+      done->Notify();
+    });
+    events.push_back(std::move(done));
+    from = i;
+  }
+  for (auto& e : events) {
+    e->Wait();
+  }
+}
+
+util::Status ListProtoWriter::PrepareRecord() {
   if (!was_init_) {
     RETURN_IF_ERROR(writer_->Init());
     was_init_ = true;
@@ -85,7 +154,7 @@ util::Status ListProtoWriter::Add(const ::google::protobuf::MessageLite& msg) {
     CreateWriter(GetOutputFileName(base_name_, ++shard_index_));
     RETURN_IF_ERROR(writer_->Init());
   }
-  return writer_->AddRecord(msg.SerializeAsString());
+  return Status::OK;
 }
 
 util::Status ListProtoWriter::Flush() {
@@ -5,10 +5,13 @@
 #define _PROTO_WRITER_H
 
 #include <memory>
+#include <vector>
 
+#include "absl/types/span.h"
 #include "strings/stringpiece.h"
 #include "base/arena.h"
 #include "base/integral_types.h"
+#include "base/pod_array.h"
 #include "util/status.h"
 
 namespace google {
@@ -20,6 +23,7 @@ class MessageLite;
 
 
 namespace file {
+class ListExecutor;
 class ListWriter;
 
 extern const char kProtoSetKey[];
@@ -37,7 +41,7 @@ protected:
 class ListProtoWriter : public BaseProtoWriter {
  public:
   struct Options {
-    enum CompressMethod {ZLIB_COMPRESS = 2, LZ4_COMPRESS = 3} compress_method
+    enum CompressMethod {ZLIB_COMPRESS = 2, LZ4_COMPRESS = 3, ZSTD_COMPRESS = 4} compress_method
           = LZ4_COMPRESS;
     uint8 compress_level = 1;
 
@@ -50,6 +54,10 @@ class ListProtoWriter : public BaseProtoWriter {
     // Whether to append to the existing file or otherwrite it.
     bool append = false;
 
+    // If set, AddBatch() serializes large batches on the executor, in slices that run
+    // in parallel.
+    ListExecutor* executor = nullptr;
+
     Options() {}
   };
 
@@ -61,11 +69,22 @@ class ListProtoWriter : public BaseProtoWriter {
 
   util::Status Add(const ::google::protobuf::MessageLite& msg);
 
+  // Adds the messages in their order. They are serialized into a buffer that is reused
+  // between the calls, each message into a slot of its size, and the records are copied
+  // from there into the list writer. All the messages must have the type of the writer.
+  util::Status AddBatch(absl::Span<const ::google::protobuf::MessageLite* const> msgs);
+
   util::Status Flush();
 
  private:
   void CreateWriter(StringPiece name);
 
+  // Inits the writer and switches to the next shard if needed.
+  util::Status PrepareRecord();
+
+  // Serializes msgs into batch_buf_ at batch_offsets_.
+  void Serialize(absl::Span<const ::google::protobuf::MessageLite* const> msgs);
+
   std::string base_name_;
   bool was_init_ = false;
   uint32 entries_per_shard_ = 0;
@@ -73,6 +92,9 @@ class ListProtoWriter : public BaseProtoWriter {
 
   std::unique_ptr<ListWriter> writer_;
   Options options_;
+
+  base::PODArray<uint8> batch_buf_;
+  std::vector<size_t> batch_offsets_;
 };
 
 std::string GenerateSerializedFdSet(const ::google::protobuf::Descriptor* dscr);
@@ -4,6 +4,8 @@
 #include "file/proto_writer.h"
 #include "file/proto_writer_test.pb.h"
 #include "base/gtest.h"
+#include "file/list_file.h"
+#include "file/test_util.h"
 
 namespace file {
 
@@ -19,6 +21,44 @@ TEST_F(ProtoWriterTest, Basic) {
   ASSERT_TRUE(writer.Add(boo).ok());
 }
 
+TEST_F(ProtoWriterTest, AddBatch) {
+  std::vector<test::Container> items(20000);
+  std::vector<const google::protobuf::MessageLite*> batch;
+  for (size_t i = 0; i < items.size(); ++i) {
+    items[i].mutable_person()->set_name(std::string(i % 200, 'a' + i % 26));
+    items[i].mutable_person()->set_id(i);
+    batch.push_back(&items[i]);
+  }
+
+  ThreadExecutor executor(3);
+  ListProtoWriter::Options options;
+  options.executor = &executor;
+  std::string file_name = base::GetTestTempPath("batch.lst");
+  {
+    ListProtoWriter writer(file_name, test::Container::descriptor(), options);
+    ASSERT_TRUE(writer.AddBatch(absl::MakeSpan(batch).subspan(0, 100)).ok());
+    ASSERT_TRUE(writer.AddBatch(absl::MakeSpan(batch).subspan(100)).ok());
+    ASSERT_TRUE(writer.Flush().ok());
+  }
+  EXPECT_GT(executor.num_tasks(), 2);
+
+  ListReader reader(file_name);
+  std::vector<StringPiece> records;
+  std::string scratch;
+  size_t index = 0, reads = 0;
+  while (reader.ReadRecords(64, &records, &scratch)) {
+    ++reads;
+    ASSERT_LE(records.size(), 64);
+    for (StringPiece rec : records) {
+      ASSERT_LT(index, items.size());
+      EXPECT_EQ(items[index].SerializeAsString(), rec) << index;
+      ++index;
+    }
+  }
+  EXPECT_EQ(items.size(), index);
+  EXPECT_LT(reads, items.size() / 10);
+}
+
 TEST_F(ProtoWriterTest, Empty) {
   ListProtoWriter writer("foo.lst", test::Container::descriptor());
 }
@@ -0,0 +1,268 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "file/sorted_table.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "base/varint.h"
+
+namespace file {
+
+using namespace std;
+using list_file::RecordIndex;
+using strings::AsString;
+using util::Status;
+using util::StatusCode;
+using util::StatusObject;
+
+const char kSortedTableMetaKey[] = "__sorted_table__";
+
+namespace {
+
+// Decodes the entry of record into *key, which holds the key of the previous record, and
+// *value. The key of the first record after a seek is already known, so only its length and
+// suffix are checked.
+bool DecodeEntry(StringPiece record, bool known_key, string* key, StringPiece* value) {
+  const uint8* ptr = reinterpret_cast<const uint8*>(record.data());
+  const uint8* end = ptr + record.size();
+  uint32 shared = 0, unshared = 0;
+  ptr = Varint::Parse32WithLimit(ptr, end, &shared);
+  if (ptr)
+    ptr = Varint::Parse32WithLimit(ptr, end, &unshared);
+  if (!ptr || unshared > size_t(end - ptr) || shared > key->size()) {
+    LOG(ERROR) << "Invalid sorted table entry";
+    return false;
+  }
+
+  StringPiece suffix(reinterpret_cast<const char*>(ptr), unshared);
+  if (known_key) {
+    if (key->size() != shared + unshared || StringPiece(*key).substr(shared) != suffix) {
+      LOG(ERROR) << "Sorted table entry does not match its index key " << *key;
+      return false;
+    }
+  } else {
+    key->resize(shared);
+    key->append(suffix.data(), suffix.size());
+  }
+  *value = StringPiece(suffix.end(), end - ptr - unshared);
+
+  return true;
+}
+
+}  // namespace
+
+SortedTableWriter::SortedTableWriter(util::Sink* sink, const Options& opts) {
+  ListWriter::Options list_opts;
+  SetupOptions(opts, &list_opts);
+  writer_.reset(new ListWriter(sink, list_opts));
+}
+
+SortedTableWriter::SortedTableWriter(StringPiece filename, const Options& opts) {
+  ListWriter::Options list_opts;
+  SetupOptions(opts, &list_opts);
+  writer_.reset(new ListWriter(filename, list_opts));
+}
+
+void SortedTableWriter::SetupOptions(const Options& opts, ListWriter::Options* dest) {
+  *dest = opts.list;
+  CHECK(!dest->append && !dest->v2);
+  CHECK(dest->async_executor == nullptr && dest->zstd_dict_records == 0);
+
+  // The list writer asks for the key while it adds the record.
+  dest->write_index = true;
+  dest->index_key = [this](StringPiece) { return AsString(current_key_); };
+  if (opts.bloom_bits_per_key) {
+    dest->bloom_key = dest->index_key;
+    dest->bloom_bits_per_key = opts.bloom_bits_per_key;
+  }
+}
+
+Status SortedTableWriter::Init() {
+  writer_->AddMeta(kSortedTableMetaKey, "1");
+  return writer_->Init();
+}
+
+Status SortedTableWriter::Add(StringPiece key, StringPiece value) {
+  if (num_entries() > 0 && key <= last_key_) {
+    return Status(StatusCode::INVALID_ARGUMENT, "Keys are not strictly increasing");
+  }
+
+  size_t shared = 0;
+  size_t limit = std::min(key.size(), last_key_.size());
+  while (shared < limit && key[shared] == last_key_[shared])
+    ++shared;
+
+  record_.clear();
+  Varint::Append32(&record_, shared);
+  Varint::Append32(&record_, key.size() - shared);
+  record_.append(key.data() + shared, key.size() - shared);
+  record_.append(value.data(), value.size());
+
+  current_key_ = key;
+  Status st = writer_->AddRecord(record_);
+  last_key_.assign(key.data(), key.size());
+
+  return st;
+}
+
+SortedTable::SortedTable(ReadonlyFile* file) : file_(file) {
+}
+
+SortedTable::~SortedTable() {
+  free_readers_.clear();
+  index_reader_.reset();
+
+  auto st = file_->Close();
+  LOG_IF(WARNING, !st.ok()) << "Error closing sorted table " << st;
+}
+
+StatusObject<SortedTable*> SortedTable::Open(ReadonlyFile* file) {
+  std::unique_ptr<SortedTable> table(new SortedTable(file));
+  RETURN_IF_ERROR(table->ReadIndex());
+
+  return table.release();
+}
+
+StatusObject<SortedTable*> SortedTable::Open(StringPiece filename) {
+  ReadonlyFile::Options opts;
+  opts.use_mmap = true;
+  opts.sequential = false;
+
+  GET_UNLESS_ERROR(file, ReadonlyFile::Open(filename, opts));
+  return Open(file);
+}
+
+Status SortedTable::ReadIndex() {
+  // The corruptions are logged by the reader.
+  index_reader_.reset(new ListReader(file_.get(), DO_NOT_TAKE_OWNERSHIP));
+  if (!index_reader_->GetMetaData(&meta_)) {
+    return Status(StatusCode::IO_ERROR, "Can not read the table header");
+  }
+  if (!meta_.count(kSortedTableMetaKey)) {
+    return Status(StatusCode::PARSE_ERROR, "Not a sorted table");
+  }
+
+  index_ = index_reader_->GetIndex();
+  if (!index_) {
+    return Status(StatusCode::IO_ERROR, "Sorted table without index");
+  }
+  return Status::OK;
+}
+
+auto SortedTable::FindBlock(StringPiece key) const -> const RecordIndex::Entry* {
+  const auto& entries = index_->entries();
+  auto it = std::upper_bound(entries.begin(), entries.end(), key,
+                             [](StringPiece val, const RecordIndex::Entry& e) {
+                               return val < e.key;
+                             });
+  return it == entries.begin() ? nullptr : &*(it - 1);
+}
+
+unique_ptr<ListReader> SortedTable::BorrowReader() const {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!free_readers_.empty()) {
+      unique_ptr<ListReader> res = std::move(free_readers_.back());
+      free_readers_.pop_back();
+      return res;
+    }
+  }
+  return unique_ptr<ListReader>(new ListReader(file_.get(), DO_NOT_TAKE_OWNERSHIP));
+}
+
+void SortedTable::ReturnReader(unique_ptr<ListReader> reader) const {
+  std::lock_guard<std::mutex> lk(mu_);
+  free_readers_.push_back(std::move(reader));
+}
+
+bool SortedTable::Get(StringPiece key, std::string* value) const {
+  if (!index_->MayContain(key))
+    return false;
+  const RecordIndex::Entry* entry = FindBlock(key);
+  if (!entry)
+    return false;
+
+  // The key is among the records that start in the block.
+  const auto& entries = index_->entries();
+  uint64 end = entry + 1 < entries.data() + entries.size() ? entry[1].first_record
+                                                           : index_->num_records();
+
+  unique_ptr<ListReader> reader = BorrowReader();
+  bool found = false;
+  if (reader->SeekToBlock(entry->block)) {
+    string cur_key = entry->key, scratch;
+    StringPiece record, cur_value;
+    for (uint64 i = entry->first_record; i < end; ++i) {
+      if (!reader->ReadRecord(&record, &scratch) ||
+          !DecodeEntry(record, i == entry->first_record, &cur_key, &cur_value)) {
+        break;
+      }
+
+      int cmp = StringPiece(cur_key).compare(key);
+      if (cmp >= 0) {
+        found = cmp == 0;
+        if (found)
+          value->assign(cur_value.data(), cur_value.size());
+        break;
+      }
+    }
+  }
+  ReturnReader(std::move(reader));
+
+  return found;
+}
+
+unique_ptr<SortedTable::Iterator> SortedTable::NewIterator() const {
+  return unique_ptr<Iterator>(new Iterator(this));
+}
+
+SortedTable::Iterator::Iterator(const SortedTable* table)
+    : table_(table), reader_(table->BorrowReader()) {
+}
+
+SortedTable::Iterator::~Iterator() {
+  table_->ReturnReader(std::move(reader_));
+}
+
+void SortedTable::Iterator::SeekToEntry(const RecordIndex::Entry& entry) {
+  valid_ = false;
+  if (!reader_->SeekToBlock(entry.block))
+    return;
+
+  StringPiece record;
+  key_ = entry.key;
+  valid_ = reader_->ReadRecord(&record, &scratch_) && DecodeEntry(record, true, &key_, &value_);
+}
+
+void SortedTable::Iterator::SeekToFirst() {
+  const auto& entries = table_->index_->entries();
+  if (entries.empty()) {
+    valid_ = false;
+    return;
+  }
+  SeekToEntry(entries.front());
+}
+
+void SortedTable::Iterator::Seek(StringPiece key) {
+  const RecordIndex::Entry* entry = table_->FindBlock(key);
+  if (!entry) {
+    SeekToFirst();
+    return;
+  }
+
+  SeekToEntry(*entry);
+  while (valid_ && StringPiece(key_) < key) {
+    Next();
+  }
+}
+
+void SortedTable::Iterator::Next() {
+  DCHECK(valid_);
+
+  StringPiece record;
+  valid_ = reader_->ReadRecord(&record, &scratch_) && DecodeEntry(record, false, &key_, &value_);
+}
+
+}  // namespace file
@@ -0,0 +1,150 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file/list_file.h"
+
+/* Immutable table of key/value entries sorted by key, stored as an indexed LST1 file.
+
+   Every entry is a list record: varint32 shared, varint32 unshared, the unshared suffix of the
+   key and the value. The key is prefix compressed against the key of the previous record.
+   The record index of the file keeps the full key of the first record that starts in each
+   block, which is the sparse block index of the table, and a Bloom filter of all the keys.
+   Reading a block therefore starts from a known key.
+
+   The file meta data has kSortedTableMetaKey, so the table can be told from other list files.
+*/
+namespace file {
+
+extern const char kSortedTableMetaKey[];
+
+class SortedTableWriter {
+ public:
+  struct Options {
+    // Bits per key of the Bloom filter, 0 disables it.
+    uint8 bloom_bits_per_key = 10;
+
+    // Block size and compression. The index related options are set by the writer,
+    // append, async_executor and zstd_dict_records are not supported.
+    ListWriter::Options list;
+
+    Options() {}
+  };
+
+  // Takes ownership over sink.
+  explicit SortedTableWriter(util::Sink* sink, const Options& opts = Options());
+
+  // Overwrites filename.
+  explicit SortedTableWriter(StringPiece filename, const Options& opts = Options());
+
+  // Adds user provided meta information about the file. Must be called before Init.
+  void AddMeta(StringPiece key, StringPiece value) { writer_->AddMeta(key, value); }
+
+  util::Status Init();
+
+  // Keys must be added in strictly increasing order.
+  util::Status Add(StringPiece key, StringPiece value);
+
+  // Writes the index, the table is complete only after it.
+  util::Status Finish() { return writer_->Finish(); }
+
+  uint64 num_entries() const { return writer_->records_added(); }
+
+ private:
+  void SetupOptions(const Options& opts, ListWriter::Options* dest);
+
+  std::unique_ptr<ListWriter> writer_;
+  std::string last_key_;
+  std::string record_;
+  StringPiece current_key_;  // The key of the record being added.
+};
+
+/* Read side of the table. Lookups and iterators may run concurrently, from threads or fibers.
+   Each of them borrows a ListReader over the shared file from a pool, so the table issues
+   only the reads of the file itself: with a file opened with use_mmap the blocks are used
+   in place, a file from OpenFiberReadFile (file/fiber_file.h) reads them without blocking
+   the IO thread.
+*/
+class SortedTable {
+ public:
+  // Reads the index of the table in file and takes ownership of file.
+  static util::StatusObject<SortedTable*> Open(ReadonlyFile* file) MUST_USE_RESULT;
+
+  // Opens filename with use_mmap.
+  static util::StatusObject<SortedTable*> Open(StringPiece filename) MUST_USE_RESULT;
+
+  ~SortedTable();
+
+  // Sets *value to the value of key and returns true if the table has it.
+  bool Get(StringPiece key, std::string* value) const;
+
+  // Returns false if the Bloom filter rules out the key, does not read the file.
+  bool MayContain(StringPiece key) const { return index_->MayContain(key); }
+
+  uint64 size() const { return index_->num_records(); }
+
+  const std::map<std::string, std::string>& meta() const { return meta_; }
+
+  // Iterates over the entries in the order of their keys.
+  class Iterator {
+   public:
+    ~Iterator();
+
+    // Positions at the first entry whose key is not less than key.
+    void Seek(StringPiece key);
+    void SeekToFirst();
+
+    bool Valid() const { return valid_; }
+    void Next();
+
+    // Valid until the iterator moves.
+    StringPiece key() const { return key_; }
+    StringPiece value() const { return value_; }
+
+   private:
+    friend class SortedTable;
+    explicit Iterator(const SortedTable* table);
+
+    // Reads from the start of the block of entry.
+    void SeekToEntry(const list_file::RecordIndex::Entry& entry);
+
+    const SortedTable* table_;
+    std::unique_ptr<ListReader> reader_;
+    std::string key_, scratch_;
+    StringPiece value_;
+    bool valid_ = false;
+  };
+
+  std::unique_ptr<Iterator> NewIterator() const;
+
+ private:
+  explicit SortedTable(ReadonlyFile* file);
+
+  util::Status ReadIndex();
+
+  // Returns the entry of the last block whose first key is not greater than key, or null if
+  // key precedes all of them.
+  const list_file::RecordIndex::Entry* FindBlock(StringPiece key) const;
+
+  std::unique_ptr<ListReader> BorrowReader() const;
+  void ReturnReader(std::unique_ptr<ListReader> reader) const;
+
+  std::unique_ptr<ReadonlyFile> file_;
+  std::unique_ptr<ListReader> index_reader_;  // Owns index_.
+  const list_file::RecordIndex* index_ = nullptr;
+  std::map<std::string, std::string> meta_;
+
+  mutable std::mutex mu_;
+  mutable std::vector<std::unique_ptr<ListReader>> free_readers_;  // Guarded by mu_.
+
+  SortedTable(const SortedTable&) = delete;
+  void operator=(const SortedTable&) = delete;
+};
+
+}  // namespace file
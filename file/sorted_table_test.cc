@@ -0,0 +1,150 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "file/sorted_table.h"
+
+#include <thread>
+
+#include "base/gtest.h"
+#include "file/file_util.h"
+#include "file/test_util.h"
+
+namespace file {
+
+using namespace std;
+using strings::AsString;
+
+class SortedTableTest : public testing::Test {
+ protected:
+  static string Key(unsigned i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user/profile/%08u", i * 2);
+    return buf;
+  }
+
+  static string Value(unsigned i) { return string(i % 50, 'a' + i % 26); }
+
+  // Returns the contents of a table with the keys Key(0), ..., Key(num - 1).
+  static string WriteTable(unsigned num) {
+    util::StringSink* sink = new util::StringSink;
+    SortedTableWriter writer(sink);
+    writer.AddMeta("foo", "bar");
+    CHECK_STATUS(writer.Init());
+    for (unsigned i = 0; i < num; ++i) {
+      CHECK_STATUS(writer.Add(Key(i), Value(i)));
+    }
+    CHECK_STATUS(writer.Finish());
+    return sink->contents();
+  }
+
+  static unique_ptr<SortedTable> OpenTable(string contents) {
+    auto res = SortedTable::Open(new ReadonlyStringFile(std::move(contents)));
+    CHECK(res.ok()) << res.status;
+    return unique_ptr<SortedTable>(res.obj);
+  }
+};
+
+TEST_F(SortedTableTest, Get) {
+  constexpr unsigned kNum = 20000;
+  auto table = OpenTable(WriteTable(kNum));
+  EXPECT_EQ(kNum, table->size());
+  EXPECT_EQ("bar", table->meta().at("foo"));
+
+  string value;
+  for (unsigned i : {0u, 1u, 2u, 999u, 12345u, kNum - 1}) {
+    ASSERT_TRUE(table->Get(Key(i), &value)) << i;
+    EXPECT_EQ(Value(i), value) << i;
+    EXPECT_TRUE(table->MayContain(Key(i)));
+  }
+
+  // Before the first, between two and after the last keys.
+  EXPECT_FALSE(table->Get("a", &value));
+  EXPECT_FALSE(table->Get(Key(10) + "0", &value));
+  EXPECT_FALSE(table->Get("user/profile/00000001", &value));
+  EXPECT_FALSE(table->Get(Key(kNum), &value));
+  EXPECT_FALSE(table->Get("z", &value));
+
+  unsigned false_positives = 0;
+  for (unsigned i = 0; i < 1000; ++i) {
+    false_positives += table->MayContain(Key(i) + "x");
+  }
+  EXPECT_LT(false_positives, 30);
+}
+
+TEST_F(SortedTableTest, Iterator) {
+  constexpr unsigned kNum = 5000;
+  auto table = OpenTable(WriteTable(kNum));
+
+  auto it = table->NewIterator();
+  unsigned count = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ASSERT_EQ(Key(count), it->key());
+    ASSERT_EQ(Value(count), it->value());
+    ++count;
+  }
+  EXPECT_EQ(kNum, count);
+
+  it->Seek(Key(1234));
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(1234), it->key());
+
+  // Positions at the following key.
+  it->Seek(Key(777) + "0");
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(778), it->key());
+
+  it->Seek("a");
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(0), it->key());
+
+  it->Seek("z");
+  EXPECT_FALSE(it->Valid());
+}
+
+TEST_F(SortedTableTest, Concurrent) {
+  constexpr unsigned kNum = 10000;
+  string file_path = base::GetTestTempPath("sorted.sst");
+  file_util::WriteStringToFileOrDie(WriteTable(kNum), file_path);
+
+  auto res = SortedTable::Open(file_path);
+  ASSERT_TRUE(res.ok()) << res.status;
+  unique_ptr<SortedTable> table(res.obj);
+
+  std::atomic_uint errors{0};
+  vector<thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      string value;
+      for (unsigned i = t; i < kNum; i += 7) {
+        if (!table->Get(Key(i), &value) || value != Value(i))
+          ++errors;
+      }
+    });
+  }
+  for (auto& th : threads)
+    th.join();
+  EXPECT_EQ(0, errors);
+}
+
+TEST_F(SortedTableTest, Errors) {
+  SortedTableWriter writer(new util::StringSink);
+  ASSERT_TRUE(writer.Init().ok());
+  ASSERT_TRUE(writer.Add("b", "1").ok());
+  EXPECT_FALSE(writer.Add("b", "2").ok());
+  EXPECT_FALSE(writer.Add("a", "2").ok());
+  ASSERT_TRUE(writer.Add("c", "3").ok());
+  EXPECT_EQ(2, writer.num_entries());
+  ASSERT_TRUE(writer.Finish().ok());
+
+  // A list file that is not a table.
+  util::StringSink* sink = new util::StringSink;
+  ListWriter list(sink);
+  ASSERT_TRUE(list.Init().ok());
+  ASSERT_TRUE(list.AddRecord("foo").ok());
+  ASSERT_TRUE(list.Finish().ok());
+
+  auto res = SortedTable::Open(new ReadonlyStringFile(sink->contents()));
+  EXPECT_FALSE(res.ok());
+}
+
+}  // namespace file
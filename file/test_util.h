@@ -1,8 +1,16 @@
 #ifndef TEST_UTIL_H
 #define TEST_UTIL_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
 #include "file/file.h"
+#include "file/list_executor.h"
 #include "util/sinksource.h"
 
 // When running unittests, get the directory containing the source code.
@@ -63,6 +71,81 @@ class RingSource : public util::Source {
   const std::string& buf_;
 };
 
+// Runs the tasks of a ListExecutor on a few threads.
+class ThreadExecutor : public ListExecutor {
+  class CvEvent : public Event {
+   public:
+    void Notify() final {
+      std::lock_guard<std::mutex> lk(mu_);
+      ready_ = true;
+      cv_.notify_all();
+    }
+
+    void Wait() final {
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [this] { return ready_; });
+    }
+
+   private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool ready_ = false;
+  };
+
+ public:
+  explicit ThreadExecutor(unsigned num_threads) {
+    for (unsigned i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this] { Run(); });
+    }
+  }
+
+  ~ThreadExecutor() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_)
+      t.join();
+  }
+
+  void Add(std::function<void()> task) final {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      tasks_.push_back(std::move(task));
+      ++num_tasks_;
+    }
+    cv_.notify_one();
+  }
+
+  std::unique_ptr<Event> NewEvent() final { return std::unique_ptr<Event>(new CvEvent); }
+
+  unsigned num_tasks() const { return num_tasks_; }
+
+ private:
+  void Run() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> threads_;
+  std::atomic_uint num_tasks_{0};
+  bool stop_ = false;
+};
+
 }  // namespace file
 
 #endif  // TEST_UTIL_H
@@ -0,0 +1,207 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "base/arena.h"
+#include "base/hash.h"
+#include "strings/stringpiece.h"
+
+namespace mr3 {
+
+/*! \class mr3::AggregationTable
+    \brief Hash table that aggregates values by string key, i.e. the state of a grouping or
+    combining operator on a single IO thread.
+
+    Keys of up to kInlineKeySize bytes are stored inside the slots and longer keys are copied
+    into an arena, so aggregating into an existing key never allocates and neither does adding
+    a short key, besides the growth of the table. Uses open addressing with linear probing and a
+    control byte per slot that holds 7 bits of the hash, so most of the probes do not compare
+    the keys. Values are merged with Combine(V old, V added), which must be associative and
+    commutative because the tables of the different threads are merged in arbitrary order.
+    V must be default constructible. Not thread-safe.
+*/
+template <typename V, typename Combine = std::plus<V>> class AggregationTable {
+ public:
+  static constexpr size_t kInlineKeySize = 23;
+
+  explicit AggregationTable(Combine combine = Combine()) : combine_(std::move(combine)) {}
+
+  //! Combines value into the value of key or inserts it if the table does not have key.
+  void Add(StringPiece key, V value);
+
+  //! Returns nullptr if the table does not have key.
+  const V* Find(StringPiece key) const;
+
+  //! Adds all the entries of other and clears it.
+  void Merge(AggregationTable* other);
+
+  //! Calls cb(StringPiece key, const V& value) for every entry, in no particular order.
+  template <typename Cb> void ForEach(Cb&& cb) const;
+
+  //! Removes all the entries and keeps the slots for reuse.
+  void Clear();
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  //! The slots, the control bytes and the arena with the long keys.
+  size_t MemoryUsage() const {
+    return slots_.capacity() * sizeof(Slot) + ctrl_.capacity() + arena_.MemoryUsage();
+  }
+
+ private:
+  // Either the key itself or, if size_ == kLongKey, its pointer and size in the arena.
+  class PackedKey {
+   public:
+    void Set(StringPiece key, base::Arena* arena);
+    StringPiece Get() const;
+
+    bool Equals(StringPiece key) const {
+      if (size_ != kLongKey)
+        return size_ == key.size() && memcmp(buf_, key.data(), key.size()) == 0;
+      return Get() == key;
+    }
+
+   private:
+    static constexpr uint8_t kLongKey = 0xFF;
+
+    char buf_[kInlineKeySize];
+    uint8_t size_ = 0;
+  };
+
+  struct Slot {
+    PackedKey key;
+    V value;
+  };
+
+  static_assert(sizeof(PackedKey) == kInlineKeySize + 1, "");
+
+  // 0 marks an empty slot.
+  static uint8_t Tag(uint64_t hash) { return 0x80 | (hash & 0x7F); }
+
+  // Returns the slot of key or the empty slot where it belongs. The table must not be full.
+  size_t Probe(StringPiece key, uint64_t hash) const;
+
+  void Grow();
+
+  Combine combine_;
+  std::vector<Slot> slots_;
+  std::vector<uint8_t> ctrl_;
+  size_t size_ = 0;
+  base::Arena arena_;
+};
+
+template <typename V, typename C>
+void AggregationTable<V, C>::PackedKey::Set(StringPiece key, base::Arena* arena) {
+  if (key.size() <= kInlineKeySize) {
+    memcpy(buf_, key.data(), key.size());
+    size_ = key.size();
+    return;
+  }
+
+  const char* ptr = arena->Allocate(key.size());
+  memcpy(const_cast<char*>(ptr), key.data(), key.size());
+  uint64_t size = key.size();
+  memcpy(buf_, &ptr, sizeof(ptr));
+  memcpy(buf_ + sizeof(ptr), &size, sizeof(size));
+  size_ = kLongKey;
+}
+
+template <typename V, typename C>
+StringPiece AggregationTable<V, C>::PackedKey::Get() const {
+  if (size_ != kLongKey)
+    return StringPiece(buf_, size_);
+
+  const char* ptr;
+  uint64_t size;
+  memcpy(&ptr, buf_, sizeof(ptr));
+  memcpy(&size, buf_ + sizeof(ptr), sizeof(size));
+  return StringPiece(ptr, size);
+}
+
+template <typename V, typename C>
+size_t AggregationTable<V, C>::Probe(StringPiece key, uint64_t hash) const {
+  size_t mask = slots_.size() - 1;
+  uint8_t tag = Tag(hash);
+  for (size_t i = (hash >> 7) & mask;; i = (i + 1) & mask) {
+    if (ctrl_[i] == 0 || (ctrl_[i] == tag && slots_[i].key.Equals(key)))
+      return i;
+  }
+}
+
+template <typename V, typename C> void AggregationTable<V, C>::Grow() {
+  std::vector<Slot> slots(std::max<size_t>(16, slots_.size() * 2));
+  std::vector<uint8_t> ctrl(slots.size(), 0);
+  slots.swap(slots_);
+  ctrl.swap(ctrl_);
+
+  // The long keys stay in the arena, only the packed keys move.
+  for (size_t i = 0; i < ctrl.size(); ++i) {
+    if (!ctrl[i])
+      continue;
+    uint64_t hash = base::XXHash3_64(slots[i].key.Get());
+    size_t index = Probe(slots[i].key.Get(), hash);
+    ctrl_[index] = ctrl[i];
+    slots_[index].key = slots[i].key;
+    slots_[index].value = std::move(slots[i].value);
+  }
+}
+
+template <typename V, typename C> void AggregationTable<V, C>::Add(StringPiece key, V value) {
+  // Keeps the load factor below 3/4.
+  if ((size_ + 1) * 4 > slots_.size() * 3)
+    Grow();
+
+  uint64_t hash = base::XXHash3_64(key);
+  size_t index = Probe(key, hash);
+  Slot& slot = slots_[index];
+  if (ctrl_[index]) {
+    slot.value = combine_(std::move(slot.value), std::move(value));
+    return;
+  }
+
+  ctrl_[index] = Tag(hash);
+  slot.key.Set(key, &arena_);
+  slot.value = std::move(value);
+  ++size_;
+}
+
+template <typename V, typename C> const V* AggregationTable<V, C>::Find(StringPiece key) const {
+  if (size_ == 0)
+    return nullptr;
+  size_t index = Probe(key, base::XXHash3_64(key));
+  return ctrl_[index] ? &slots_[index].value : nullptr;
+}
+
+template <typename V, typename C> void AggregationTable<V, C>::Merge(AggregationTable* other) {
+  for (size_t i = 0; i < other->ctrl_.size(); ++i) {
+    if (other->ctrl_[i]) {
+      Slot& slot = other->slots_[i];
+      Add(slot.key.Get(), std::move(slot.value));
+    }
+  }
+  other->Clear();
+}
+
+template <typename V, typename C>
+template <typename Cb>
+void AggregationTable<V, C>::ForEach(Cb&& cb) const {
+  for (size_t i = 0; i < ctrl_.size(); ++i) {
+    if (ctrl_[i])
+      cb(slots_[i].key.Get(), slots_[i].value);
+  }
+}
+
+template <typename V, typename C> void AggregationTable<V, C>::Clear() {
+  std::fill(ctrl_.begin(), ctrl_.end(), 0);
+  size_ = 0;
+  arena_.Reset();
+}
+
+}  // namespace mr3
@@ -0,0 +1,83 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/aggregation_table.h"
+
+#include <map>
+
+#include "base/gtest.h"
+
+namespace mr3 {
+
+using namespace std;
+
+class AggregationTableTest : public testing::Test {
+ protected:
+  template <typename Table> static map<string, uint64_t> ToMap(const Table& table) {
+    map<string, uint64_t> res;
+    table.ForEach([&](StringPiece key, uint64_t val) {
+      EXPECT_TRUE(res.emplace(string(key), val).second) << key;
+    });
+    return res;
+  }
+};
+
+TEST_F(AggregationTableTest, Basic) {
+  AggregationTable<uint64_t> table;
+  EXPECT_EQ(nullptr, table.Find("foo"));
+
+  // Keys around the inline size and the empty key.
+  string key23(AggregationTable<uint64_t>::kInlineKeySize, 'a'), key24 = key23 + "b";
+  for (StringPiece key : {StringPiece("foo"), StringPiece(), StringPiece(key23),
+                          StringPiece(key24), StringPiece("foo")}) {
+    table.Add(key, 2);
+  }
+  EXPECT_EQ(4, table.size());
+  EXPECT_EQ(4, *table.Find("foo"));
+  EXPECT_EQ(2, *table.Find(""));
+  EXPECT_EQ(2, *table.Find(key23));
+  EXPECT_EQ(2, *table.Find(key24));
+  EXPECT_EQ(nullptr, table.Find(key23 + "c"));
+  EXPECT_EQ(nullptr, table.Find("fo"));
+
+  table.Clear();
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(nullptr, table.Find("foo"));
+  table.Add(key24, 1);
+  EXPECT_EQ(1, *table.Find(key24));
+}
+
+TEST_F(AggregationTableTest, Grow) {
+  AggregationTable<uint64_t> table;
+  map<string, uint64_t> expected;
+  for (unsigned i = 0; i < 100000; ++i) {
+    string key = to_string(i % 30000);
+    if (i % 3 == 0)
+      key.append(30, 'x');  // Long keys live in the arena.
+    table.Add(key, i);
+    expected[key] += i;
+  }
+  EXPECT_EQ(expected.size(), table.size());
+  EXPECT_EQ(expected, ToMap(table));
+  EXPECT_GT(table.MemoryUsage(), expected.size() * 32);
+}
+
+TEST_F(AggregationTableTest, Merge) {
+  auto max_fn = [](uint64_t a, uint64_t b) { return std::max(a, b); };
+  using MaxTable = AggregationTable<uint64_t, decltype(max_fn)>;
+  MaxTable t1(max_fn), t2(max_fn);
+
+  t1.Add("a", 5);
+  t1.Add("a", 3);
+  t1.Add("a_very_long_key_that_is_not_inline", 1);
+  t2.Add("a", 7);
+  t2.Add("b", 2);
+  t2.Add("a_very_long_key_that_is_not_inline", 4);
+
+  t1.Merge(&t2);
+  EXPECT_TRUE(t2.empty());
+  EXPECT_EQ((map<string, uint64_t>{{"a", 7}, {"b", 2}, {"a_very_long_key_that_is_not_inline", 4}}),
+            ToMap(t1));
+}
+
+}  // namespace mr3
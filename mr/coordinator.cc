@@ -0,0 +1,231 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/coordinator.h"
+
+#include <map>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "base/logging.h"
+#include "file/file_util.h"
+
+#include "mr/impl/dest_file_set.h"
+#include "mr/impl/table_impl.h"
+#include "mr/operator_executor.h"
+#include "mr/ptable.h"
+#include "mr/runner.h"
+
+#include "util/asio/io_context_pool.h"
+#include "util/rpc/channel.h"
+
+DEFINE_uint32(mr_connect_timeout_ms, 5000, "Timeout for connecting to mr3 workers.");
+DEFINE_uint32(mr_task_deadline_ms, 24 * 3600 * 1000,
+              "Deadline for a single operator task running on a worker.");
+
+namespace mr3 {
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+ShardId GetShard(const pb::Input::FileSpec& fspec) {
+  if (fspec.has_shard_id())
+    return ShardId{fspec.shard_id()};
+  return ShardId{fspec.custom_shard_id()};
+}
+
+void SerializeTask(const pb::Task& task, rpc::Envelope* envelope) {
+  envelope->Clear();
+  envelope->letter.resize(task.ByteSizeLong());
+  CHECK(task.SerializeToArray(envelope->letter.data(), envelope->letter.size()));
+}
+
+class RemoteExecutor : public OperatorExecutor {
+ public:
+  RemoteExecutor(IoContextPool* pool, Runner* runner, Coordinator* coordinator)
+      : OperatorExecutor(pool, runner), coordinator_(coordinator) {}
+
+  void Run(const std::vector<const InputBase*>& inputs, detail::TableBase* tb,
+           ShardFileMap* out_files) final;
+
+  // Tasks run until completion on the workers.
+  void Stop() final {}
+
+ protected:
+  void InitInternal() final {}
+
+ private:
+  void SplitFiles(const std::vector<const InputBase*>& inputs, std::vector<pb::Task>* tasks);
+  void SplitShards(const std::vector<const InputBase*>& inputs, std::vector<pb::Task>* tasks);
+
+  Coordinator* coordinator_;
+};
+
+void RemoteExecutor::Run(const std::vector<const InputBase*>& inputs, detail::TableBase* tb,
+                         ShardFileMap* out_files) {
+  const pb::Operator& op = tb->op();
+  LOG_IF(WARNING, !finalized_maps_->empty())
+      << "Frequency maps are not passed to the workers, " << op.op_name()
+      << " will not see them";
+
+  vector<pb::Task> tasks(coordinator_->num_workers());
+  for (size_t w = 0; w < tasks.size(); ++w) {
+    pb::Task& task = tasks[w];
+    task.set_op_name(op.op_name());
+    task.set_file_tag(absl::StrCat("w", w));
+    for (const InputBase* ib : inputs) {
+      pb::Input* input = task.add_input();
+      input->CopyFrom(ib->msg());
+      input->clear_file_spec();
+    }
+  }
+
+  if (op.type() == pb::Operator::GROUP) {
+    SplitShards(inputs, &tasks);
+  } else {
+    SplitFiles(inputs, &tasks);
+  }
+
+  vector<pb::TaskResult> results;
+  coordinator_->RunTasks(tasks, &results);
+
+  for (const pb::TaskResult& res : results) {
+    for (const auto& fspec : res.out_file()) {
+      ShardId sid = GetShard(fspec);
+      out_files->emplace(sid, coordinator_->ShardGlob(op.output(), sid));
+    }
+    for (const auto& metric : res.metric()) {
+      metric_map_[metric.name()] += metric.value();
+    }
+  }
+}
+
+// Assigns each file to the worker with the least number of bytes so far.
+void RemoteExecutor::SplitFiles(const std::vector<const InputBase*>& inputs,
+                                std::vector<pb::Task>* tasks) {
+  vector<size_t> load(tasks->size(), 0);
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (const pb::Input::FileSpec& fspec : inputs[i]->msg().file_spec()) {
+      runner_->ExpandGlob(fspec.url_glob(), [&](size_t sz, const string& file_name) {
+        size_t w = std::min_element(load.begin(), load.end()) - load.begin();
+        load[w] += sz;
+
+        pb::Input::FileSpec* dest = (*tasks)[w].mutable_input(i)->add_file_spec();
+        dest->CopyFrom(fspec);
+        dest->set_url_glob(file_name);
+      });
+    }
+  }
+}
+
+// Joiners must see all the files of a shard, therefore whole shards are distributed between
+// the workers in round-robin manner.
+void RemoteExecutor::SplitShards(const std::vector<const InputBase*>& inputs,
+                                 std::vector<pb::Task>* tasks) {
+  std::map<ShardId, unsigned> shard_to_worker;
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (const pb::Input::FileSpec& fspec : inputs[i]->msg().file_spec()) {
+      CHECK(fspec.has_shard_id() || fspec.has_custom_shard_id())
+          << "Joiner input must be sharded " << fspec.ShortDebugString();
+      shard_to_worker.emplace(GetShard(fspec), 0);
+    }
+  }
+
+  unsigned next = 0;
+  for (auto& k_v : shard_to_worker) {
+    k_v.second = next++ % tasks->size();
+  }
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (const pb::Input::FileSpec& fspec : inputs[i]->msg().file_spec()) {
+      unsigned w = shard_to_worker[GetShard(fspec)];
+      (*tasks)[w].mutable_input(i)->add_file_spec()->CopyFrom(fspec);
+    }
+  }
+}
+
+}  // namespace
+
+Coordinator::Coordinator(IoContextPool* pool, const std::string& data_dir)
+    : pool_(pool), data_dir_(data_dir) {}
+
+Coordinator::~Coordinator() {}
+
+void Coordinator::Connect(const std::vector<std::string>& workers) {
+  CHECK(channels_.empty());
+  CHECK(!workers.empty());
+
+  for (const string& addr : workers) {
+    std::pair<string, string> host_port = absl::StrSplit(addr, ':');
+    CHECK(!host_port.first.empty() && !host_port.second.empty()) << "Bad worker address " << addr;
+
+    channels_.emplace_back(
+        new rpc::Channel(host_port.first, host_port.second, &pool_->GetNextContext()));
+    auto ec = channels_.back()->Connect(FLAGS_mr_connect_timeout_ms);
+    CHECK(!ec) << "Could not connect to worker " << addr << ": " << ec.message();
+  }
+  LOG(INFO) << "Connected to " << channels_.size() << " workers";
+}
+
+std::shared_ptr<OperatorExecutor> Coordinator::CreateExecutor(Runner* runner) {
+  return std::make_shared<RemoteExecutor>(pool_, runner, this);
+}
+
+void Coordinator::RunTasks(const std::vector<pb::Task>& tasks,
+                           std::vector<pb::TaskResult>* results) {
+  CHECK_EQ(tasks.size(), channels_.size());
+
+  vector<rpc::Envelope> envelopes(tasks.size());
+  vector<rpc::Channel::future_code_t> futures(tasks.size());
+
+  for (size_t w = 0; w < tasks.size(); ++w) {
+    bool has_files = false;
+    for (const auto& input : tasks[w].input()) {
+      has_files |= input.file_spec_size() > 0;
+    }
+    if (!has_files)
+      continue;
+
+    SerializeTask(tasks[w], &envelopes[w]);
+    futures[w] = channels_[w]->Send(FLAGS_mr_task_deadline_ms, &envelopes[w]);
+  }
+
+  results->resize(tasks.size());
+  for (size_t w = 0; w < tasks.size(); ++w) {
+    if (!futures[w].valid())
+      continue;
+
+    auto ec = futures[w].get();
+    CHECK(!ec) << "Task " << tasks[w].op_name() << " failed on worker " << w << ": "
+               << ec.message();
+
+    pb::TaskResult& res = (*results)[w];
+    CHECK(res.ParseFromArray(envelopes[w].letter.data(), envelopes[w].letter.size()));
+    CHECK(res.error().empty()) << "Task " << tasks[w].op_name() << " failed on worker " << w
+                               << ": " << res.error();
+  }
+}
+
+void Coordinator::ShutdownWorkers() {
+  pb::Task shutdown;
+
+  for (size_t w = 0; w < channels_.size(); ++w) {
+    rpc::Envelope envelope;
+    SerializeTask(shutdown, &envelope);
+    auto ec = channels_[w]->SendSync(FLAGS_mr_connect_timeout_ms, &envelope);
+    LOG_IF(ERROR, ec) << "Could not shutdown worker " << w << ": " << ec.message();
+  }
+}
+
+std::string Coordinator::ShardGlob(const pb::Output& out, const ShardId& sid) const {
+  pb::Output glob_out(out);
+  glob_out.set_file_tag("*");
+
+  return detail::ShardFilePath(file_util::JoinPath(data_dir_, out.name()), glob_out, sid, -1);
+}
+
+}  // namespace mr3
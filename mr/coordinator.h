@@ -0,0 +1,69 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mr/mr3.pb.h"
+#include "mr/mr_types.h"
+
+namespace util {
+class IoContextPool;
+
+namespace rpc {
+class Channel;
+}  // namespace rpc
+
+}  // namespace util
+
+namespace mr3 {
+
+class OperatorExecutor;
+class Runner;
+
+/*! \class mr3::Coordinator
+    \brief Distributes the pipeline operators between mr3 workers.
+
+    Each worker is a process running the same pipeline binary with WorkerService attached to its
+    Pipeline. The coordinator splits the inputs of every operator between the workers
+    (files for mappers, whole shards for joiners), sends them as pb::Task over util::rpc and
+    merges the returned output files and counters. All the processes must share the same data
+    directory, i.e. it should reside on GCS, S3 or a network file system.
+
+    Currently a failed task fails the whole run, there are no retries.
+*/
+class Coordinator {
+ public:
+  //! data_dir must be the same directory the workers write into.
+  Coordinator(util::IoContextPool* pool, const std::string& data_dir);
+  ~Coordinator();
+
+  //! Connects to the workers, each one is given as "host:port". CHECK-fails if any of them can
+  //! not be reached.
+  void Connect(const std::vector<std::string>& workers);
+
+  size_t num_workers() const { return channels_.size(); }
+
+  //! Returns an executor that runs the operator on the workers.
+  std::shared_ptr<OperatorExecutor> CreateExecutor(Runner* runner);
+
+  //! Runs tasks[i] on worker i and blocks until all of them finish. Tasks without inputs
+  //! are not sent.
+  void RunTasks(const std::vector<pb::Task>& tasks, std::vector<pb::TaskResult>* results);
+
+  //! Tells the workers to leave their Pipeline::Run.
+  void ShutdownWorkers();
+
+  //! Returns the glob that covers the files of the shard written by all the workers.
+  std::string ShardGlob(const pb::Output& out, const ShardId& sid) const;
+
+ private:
+  util::IoContextPool* pool_;
+  std::string data_dir_;
+  std::vector<std::unique_ptr<util::rpc::Channel>> channels_;
+};
+
+}  // namespace mr3
@@ -0,0 +1,115 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include <gmock/gmock.h>
+
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "file/file_util.h"
+#include "mr/coordinator.h"
+#include "mr/pipeline.h"
+#include "mr/test_utils.h"
+#include "mr/worker_service.h"
+
+#include "util/asio/accept_server.h"
+#include "util/asio/io_context_pool.h"
+
+namespace mr3 {
+
+using namespace std;
+using namespace util;
+using testing::ElementsAre;
+using testing::Pair;
+using testing::UnorderedElementsAre;
+
+constexpr unsigned kNumWorkers = 2;
+
+class CoordinatorTest : public testing::Test {
+ protected:
+  void SetUp() final {
+    pool_.reset(new IoContextPool{2});
+    pool_->Run();
+    server_.reset(new AcceptServer(pool_.get()));
+
+    for (unsigned i = 0; i < kNumWorkers; ++i) {
+      workers_[i].reset(new WorkerService);
+      uint16_t port = server_->AddListener(0, workers_[i].get());
+      addrs_.push_back(absl::StrCat("localhost:", port));
+    }
+    server_->Run();
+  }
+
+  void TearDown() final {
+    server_->Stop(true);
+    pool_->Stop();
+  }
+
+  // Every process defines the same pipeline.
+  void Define(Pipeline* pipeline) {
+    pipeline->ReadText("read_bar", vector<string>{"bar1.txt", "bar2.txt"})
+        .Write("new_table", pb::WireFormat::TXT)
+        .WithCustomSharding([](const std::string& rec) { return "shard1"; });
+  }
+
+  void AddInputs(TestRunner* runner) {
+    runner->AddInputRecords("bar1.txt", {"1", "2"});
+    runner->AddInputRecords("bar2.txt", {"3", "4"});
+  }
+
+  std::unique_ptr<IoContextPool> pool_;
+  std::unique_ptr<AcceptServer> server_;
+  std::unique_ptr<WorkerService> workers_[kNumWorkers];
+  vector<string> addrs_;
+};
+
+TEST_F(CoordinatorTest, Map) {
+  // Executors keep thread-local state in the IO threads, therefore each worker must have its
+  // own pool like it has in its own process.
+  std::unique_ptr<IoContextPool> worker_pools[kNumWorkers];
+  std::unique_ptr<Pipeline> worker_pipelines[kNumWorkers];
+  TestRunner worker_runners[kNumWorkers];
+  vector<std::thread> threads;
+
+  for (unsigned i = 0; i < kNumWorkers; ++i) {
+    worker_pools[i].reset(new IoContextPool{1});
+    worker_pools[i]->Run();
+    worker_pipelines[i].reset(new Pipeline(worker_pools[i].get()));
+    Define(worker_pipelines[i].get());
+    AddInputs(&worker_runners[i]);
+    worker_pipelines[i]->set_worker(workers_[i].get());
+
+    threads.emplace_back([&, i] { worker_pipelines[i]->Run(&worker_runners[i]); });
+  }
+
+  Coordinator coordinator(pool_.get(), "/data");
+  coordinator.Connect(addrs_);
+
+  Pipeline pipeline(pool_.get());
+  TestRunner runner;
+  Define(&pipeline);
+  AddInputs(&runner);
+  pipeline.set_coordinator(&coordinator);
+  EXPECT_TRUE(pipeline.Run(&runner));
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_THAT(worker_runners[0].Table("new_table"),
+              ElementsAre(Pair(ShardId{"shard1"}, UnorderedElementsAre("1", "2"))));
+  EXPECT_THAT(worker_runners[1].Table("new_table"),
+              ElementsAre(Pair(ShardId{"shard1"}, UnorderedElementsAre("3", "4"))));
+
+  EXPECT_EQ("fn-calls,4\n"
+            "fn-writes,4\n"
+            "map-input-read_bar,4\n"
+            "parse-errors,0\n",
+            runner.SavedFile(file_util::JoinPath("new_table", "counter_map.csv")));
+  const pb::Input* output = pipeline.mutable_input("new_table");
+  ASSERT_EQ(1, output->file_spec_size());
+  EXPECT_EQ("/data/new_table/shard1-*.txt", output->file_spec(0).url_glob());
+}
+
+}  // namespace mr3
@@ -0,0 +1,92 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "strings/split.h"
+
+namespace mr3 {
+
+/*! \class mr3::CsvSchema
+    \brief Parses the projected columns of CSV or TSV lines straight into the fields of T.
+
+    The columns are declared by their index in the line and the field of T they are parsed
+    into. Lines are split with SplitCsvLine (strings/split.h) and only the declared columns are
+    converted, the others are skipped without being looked at. Integral fields of 32 and 64 bits,
+    float, double and bool are parsed with absl::SimpleAto*, which ignore surrounding spaces,
+    and strings are copied as they are. Intended for the Parse function of RecordTraits<T>:
+
+        template <> class RecordTraits<Row> {
+          CsvSchema<Row> schema_ = CsvSchema<Row>().Column(0, &Row::id).Column(7, &Row::temp);
+         public:
+          bool Parse(bool is_binary, std::string&& tmp, Row* res) {
+            return schema_.Parse(&tmp, res);
+          }
+          ...
+        };
+*/
+template <typename T> class CsvSchema {
+ public:
+  explicit CsvSchema(char delimiter = ',', char quote = '"')
+      : delimiter_(delimiter), quote_(quote) {}
+
+  //! Parses column index into dest->*field.
+  template <typename F> CsvSchema& Column(unsigned index, F T::*field) {
+    columns_.push_back(ColumnSpec{index, [field](StringPiece str, T* dest) {
+                                    return ParseField(str, &(dest->*field));
+                                  }});
+    num_fields_ = std::max(num_fields_, index + 1);
+    return *this;
+  }
+
+  //! Parses the line in place, it's modified by quote unescaping. Returns false if the line
+  //! is too short or if a column can not be parsed, the fields of dest may be partially set.
+  bool Parse(std::string* line, T* dest) {
+    SplitCsvLine(&(*line)[0], line->size(), delimiter_, quote_, &fields_);
+    if (fields_.size() < num_fields_)
+      return false;
+
+    for (const ColumnSpec& col : columns_) {
+      if (!col.parse(fields_[col.index], dest))
+        return false;
+    }
+    return true;
+  }
+
+  size_t num_columns() const { return columns_.size(); }
+
+ private:
+  struct ColumnSpec {
+    unsigned index;
+    std::function<bool(StringPiece, T*)> parse;
+  };
+
+  template <typename I>
+  static std::enable_if_t<std::is_integral<I>::value && !std::is_same<I, bool>::value, bool>
+  ParseField(StringPiece str, I* dest) {
+    return absl::SimpleAtoi(str, dest);
+  }
+
+  static bool ParseField(StringPiece str, bool* dest) { return absl::SimpleAtob(str, dest); }
+  static bool ParseField(StringPiece str, float* dest) { return absl::SimpleAtof(str, dest); }
+  static bool ParseField(StringPiece str, double* dest) { return absl::SimpleAtod(str, dest); }
+
+  static bool ParseField(StringPiece str, std::string* dest) {
+    dest->assign(str.data(), str.size());
+    return true;
+  }
+
+  char delimiter_, quote_;
+  unsigned num_fields_ = 0;
+  std::vector<ColumnSpec> columns_;
+  std::vector<StringPiece> fields_;
+};
+
+}  // namespace mr3
@@ -0,0 +1,61 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/csv_schema.h"
+
+#include "base/gtest.h"
+
+namespace mr3 {
+
+using namespace std;
+
+struct WeatherRow {
+  uint32_t station = 0;
+  int64_t year = 0;
+  double temp = 0;
+  bool fog = false;
+  string name;
+};
+
+class CsvSchemaTest : public testing::Test {
+ protected:
+  CsvSchema<WeatherRow> schema_ = CsvSchema<WeatherRow>()
+                                      .Column(0, &WeatherRow::station)
+                                      .Column(2, &WeatherRow::year)
+                                      .Column(5, &WeatherRow::temp)
+                                      .Column(6, &WeatherRow::fog)
+                                      .Column(3, &WeatherRow::name);
+};
+
+TEST_F(CsvSchemaTest, Parse) {
+  WeatherRow row;
+  string line = "72295, 23174,2019,\"Los Angeles, CA\",ignored, 61.5 ,true,,";
+  ASSERT_TRUE(schema_.Parse(&line, &row));
+  EXPECT_EQ(72295, row.station);
+  EXPECT_EQ(2019, row.year);
+  EXPECT_EQ("Los Angeles, CA", row.name);
+  EXPECT_DOUBLE_EQ(61.5, row.temp);
+  EXPECT_TRUE(row.fog);
+  EXPECT_EQ(5, schema_.num_columns());
+
+  // Too few columns and an unparsable number.
+  line = "1,2,3,4,5,6";
+  EXPECT_FALSE(schema_.Parse(&line, &row));
+  line = "1,2,x,4,5,6,0";
+  EXPECT_FALSE(schema_.Parse(&line, &row));
+  line.clear();
+  EXPECT_FALSE(schema_.Parse(&line, &row));
+}
+
+TEST_F(CsvSchemaTest, Tsv) {
+  CsvSchema<WeatherRow> schema('\t', '\0');
+  schema.Column(1, &WeatherRow::name).Column(0, &WeatherRow::year);
+
+  WeatherRow row;
+  string line = "-7\t\"quoted\"";
+  ASSERT_TRUE(schema.Parse(&line, &row));
+  EXPECT_EQ(-7, row.year);
+  EXPECT_EQ("\"quoted\"", row.name);
+}
+
+}  // namespace mr3
@@ -7,8 +7,12 @@
 #include <string>
 
 #include "absl/container/flat_hash_map.h"
+#include "base/logging.h"
 
+#include "mr/impl/broadcast_map.h"
+#include "mr/impl/cpu_breakdown.h"
 #include "mr/impl/freq_map_wrapper.h"
+#include "mr/impl/sketches.h"
 #include "mr/mr_types.h"
 #include "mr/output.h"
 #include "strings/unique_strings.h"
@@ -20,6 +24,7 @@ class OperatorExecutor;
 
 namespace detail {
 template <typename Handler, typename ToType> class HandlerWrapper;
+template <typename T, typename Parser> class IdentityHandlerWrapper;
 
 void VerifyUnspecifiedSharding(const pb::Output& outp);
 
@@ -56,6 +61,7 @@ class RawContext {
   using InputMetaData = absl::variant<absl::monostate, int64_t, std::string>;
   using FreqMapRegistry =
     absl::flat_hash_map<std::string, detail::FreqMapWrapper>;
+  using BroadcastRegistry = absl::flat_hash_map<std::string, detail::BroadcastMapWrapper>;
 
   RawContext();
 
@@ -83,6 +89,10 @@ class RawContext {
     Write(shard_id, std::move(record));
   }
 
+  void TEST_WriteSorted(const ShardId& shard_id, std::string&& key, std::string&& record) {
+    WriteSorted(shard_id, std::move(key), std::move(record));
+  }
+
   void EmitParseError() { ++metric_map_["parse-errors"]; }
 
   template <class T>
@@ -102,6 +112,33 @@ class RawContext {
     return &ptr->Cast<T>();
   }
 
+  //! Returns the sketch statistic of this IO thread, creating it from args on the first call.
+  //! Sketches share the ids with the frequency maps and are merged the same way.
+  template <class Sketch, typename... Args>
+  Sketch& GetSketchStatistic(const std::string& map_id, Args&&... args) {
+    auto res = freq_maps_.emplace(map_id, detail::FreqMapWrapper());
+    if (res.second) {
+      res.first->second = detail::FreqMapWrapper::FromSketch(Sketch(std::forward<Args>(args)...));
+    }
+    return res.first->second.CastSketch<Sketch>();
+  }
+
+  //! Finds the sketch produced by operators in the previous steps.
+  //! Returns nullptr if the sketch does not exist.
+  template <class Sketch>
+  const Sketch* FindMaterializedSketchStatistic(const std::string& map_id) const {
+    const detail::FreqMapWrapper *ptr = FindMaterializedFreqMapStatisticImpl(map_id);
+    return ptr ? &ptr->CastSketch<Sketch>() : nullptr;
+  }
+
+  //! Finds the broadcast map loaded from the output of a previous operator.
+  //! Returns nullptr if the map does not exist.
+  template <typename K, typename T>
+  const BroadcastMap<K, T>* FindBroadcastMap(const std::string& map_id) const {
+    auto it = CHECK_NOTNULL(broadcast_maps_)->find(map_id);
+    return it == broadcast_maps_->end() ? nullptr : &it->second.Cast<K, T>();
+  }
+
   // Sometimes we run 2 shards per thread, in which case it is important to have these per-fiber
   struct PerFiber {
     std::string file_name;
@@ -111,28 +148,68 @@ class RawContext {
     bool is_binary = false;
   };
 
-  void InitPerFiber();
+  //! Binds the state of the calling fiber. Executors call it before they create handlers on
+  //! the fiber and then update per_fiber directly, which avoids the fiber-local lookup for every
+  //! record. per_fiber must outlive the handlers.
+  void BindPerFiber(PerFiber* per_fiber);
 
+  //! Called once per handler, the contexts keep the pointer.
   const PerFiber *per_fiber() const {
     return per_fiber_.get();
   }
 
+  //! Returns true once per CpuSample::kRate records unless another fiber is in the middle
+  //! of a sampled record.
+  bool ShouldSampleCpu() {
+    return (++cpu_sample_cnt_ & (detail::CpuSample::kRate - 1)) == 0 && !cpu_sample_;
+  }
+
+  void StartCpuSample(detail::CpuSample* sample) { cpu_sample_ = sample; }
+
+  void FinishCpuSample() {
+    cpu_sample_->Commit(&cpu_breakdown_);
+    cpu_sample_ = nullptr;
+  }
+
+  //! Non-null while a sampled record is being handled.
+  detail::CpuSample* cpu_sample() { return cpu_sample_; }
+
+  const detail::CpuBreakdown& cpu_breakdown() const { return cpu_breakdown_; }
+
  private:
   void Write(const ShardId& shard_id, std::string&& record) {
     ++metric_map_["fn-writes"];
     WriteInternal(shard_id, std::move(record));
   }
 
+  void WriteSorted(const ShardId& shard_id, std::string&& key, std::string&& record) {
+    ++metric_map_["fn-writes"];
+    WriteSortedInternal(shard_id, std::move(key), std::move(record));
+  }
+
   const detail::FreqMapWrapper *FindMaterializedFreqMapStatisticImpl(const std::string&) const;
 
   // To allow testing we mark this function as public.
   virtual void WriteInternal(const ShardId& shard_id, std::string&& record) = 0;
 
-  ::boost::fibers::fiber_specific_ptr<PerFiber> per_fiber_;
+  // Called for outputs with sorted shards. key is the sort key of the record.
+  // Contexts that do not sort their outputs ignore it.
+  virtual void WriteSortedInternal(const ShardId& shard_id, std::string&& key,
+                                   std::string&& record) {
+    WriteInternal(shard_id, std::move(record));
+  }
+
+  // Does not own the bound structs.
+  ::boost::fibers::fiber_specific_ptr<PerFiber> per_fiber_{[](PerFiber*) {}};
 
   StringPieceDenseMap<long> metric_map_;
   FreqMapRegistry freq_maps_;
   const FreqMapRegistry* finalized_maps_ = nullptr;
+  const BroadcastRegistry* broadcast_maps_ = nullptr;
+
+  detail::CpuBreakdown cpu_breakdown_;
+  detail::CpuSample* cpu_sample_ = nullptr;
+  unsigned cpu_sample_cnt_ = 0;
 };
 
 class PipelineContext {
@@ -144,6 +221,16 @@ class PipelineContext {
     return raw_->FindMaterializedFreqMapStatistic<T>(map_id);
   }
 
+  template <class Sketch>
+  const Sketch* FindMaterializedSketchStatistic(const std::string& map_id) const {
+    return raw_->FindMaterializedSketchStatistic<Sketch>(map_id);
+  }
+
+  template <typename K, typename T>
+  const BroadcastMap<K, T>* FindBroadcastMap(const std::string& map_id) const {
+    return raw_->FindBroadcastMap<K, T>(map_id);
+  }
+
  private:
   RawContext* raw_;
 };
@@ -152,21 +239,57 @@ class PipelineContext {
 // It's thread-local as well as caching a pointer to the fiber-local part of the RawContext.
 template <typename T> class DoContext {
   template <typename Handler, typename ToType> friend class detail::HandlerWrapper;
+  template <typename U, typename Parser> friend class detail::IdentityHandlerWrapper;
 
  public:
   DoContext(const Output<T>& out, RawContext* context)
       : out_(out), context_(context), context_fiber_local_(context->per_fiber()) {}
 
   template<typename U> void Write(const ShardId& shard_id, U&& u) {
-    context_->Write(shard_id, rt_.Serialize(out_.is_binary(), std::forward<U>(u)));
+    if (fused_sink_) {
+      fused_sink_(T(std::forward<U>(u)));
+      return;
+    }
+
+    // The key is taken before u is moved into the serializer.
+    std::string key;
+    if (out_.is_sorted()) {
+      key = out_.SortKey(u);
+    }
+
+    detail::CpuSample* sample = context_->cpu_sample();
+    if (sample) {
+      sample->Mark(detail::CPU_DO);
+      std::string record = rt_.Serialize(out_.is_binary(), std::forward<U>(u));
+      sample->Mark(detail::CPU_SERIALIZE);
+      WriteRecord(shard_id, std::move(key), std::move(record));
+      sample->Mark(detail::CPU_WRITE);
+      return;
+    }
+    WriteRecord(shard_id, std::move(key),
+                rt_.Serialize(out_.is_binary(), std::forward<U>(u)));
   }
 
   void Write(T& t) {
+    if (fused_sink_) {
+      FuseCopyMaybe(t, std::is_copy_constructible<T>{});
+      return;
+    }
+    if (out_.has_combiner() && CombineCopyMaybe(t, std::is_copy_constructible<T>{}))
+      return;
     ShardId shard_id = out_.Shard(t);
     Write(shard_id, t);
   }
 
   void Write(T&& t) {
+    if (fused_sink_) {
+      fused_sink_(std::move(t));
+      return;
+    }
+    if (out_.has_combiner()) {
+      Combine(std::move(t));
+      return;
+    }
     ShardId shard_id = out_.Shard(t);
     Write(shard_id, std::move(t));
   }
@@ -188,11 +311,71 @@ template <typename T> class DoContext {
   void CloseShard(const ShardId& sid) { raw()->CloseShard(sid); }
 
 private:
+  void Combine(T&& t);
+
+  void WriteRecord(const ShardId& shard_id, std::string&& key, std::string&& record) {
+    if (out_.is_sorted()) {
+      context_->WriteSorted(shard_id, std::move(key), std::move(record));
+    } else {
+      context_->Write(shard_id, std::move(record));
+    }
+  }
+
+  // Non-copyable records passed by lvalue reference bypass the combiner.
+  bool CombineCopyMaybe(const T& t, std::true_type) {
+    Combine(T(t));
+    return true;
+  }
+  bool CombineCopyMaybe(const T& t, std::false_type) { return false; }
+
+  void FuseCopyMaybe(const T& t, std::true_type) { fused_sink_(T(t)); }
+  void FuseCopyMaybe(const T& t, std::false_type) {
+    LOG(FATAL) << "Non-copyable records must be written as rvalues by fused mappers";
+  }
+
+  // Writes all the pre-aggregated records. Called by the handler wrappers when the shard finishes.
+  void FlushCombiner();
 
   Output<T> out_;
   RawContext* context_;
   const RawContext::PerFiber* context_fiber_local_;
   RecordTraits<T> rt_;
+
+  absl::flat_hash_map<std::string, T> combine_table_;
+  size_t combine_merges_ = 0;
+
+  // Set when the output is consumed in-memory by the next mapper of a fused chain.
+  std::function<void(T&&)> fused_sink_;
 };
 
+template <typename T> void DoContext<T>::Combine(T&& t) {
+  std::string key = out_.CombineKey(t);
+  auto it = combine_table_.find(key);
+  if (it != combine_table_.end()) {
+    out_.Combine(&it->second, std::move(t));
+    ++combine_merges_;
+    return;
+  }
+
+  combine_table_.emplace(std::move(key), std::move(t));
+  if (combine_table_.size() >= out_.combine_max_entries()) {
+    context_->Inc("combiner-flushes");
+    FlushCombiner();
+  }
+}
+
+template <typename T> void DoContext<T>::FlushCombiner() {
+  if (combine_table_.empty())
+    return;
+
+  for (auto& k_v : combine_table_) {
+    ShardId shard_id = out_.Shard(k_v.second);
+    Write(shard_id, std::move(k_v.second));
+  }
+  combine_table_.clear();
+
+  context_->IncBy("combiner-merges", combine_merges_);
+  combine_merges_ = 0;
+}
+
 }  // namespace mr3
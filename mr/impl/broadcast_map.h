@@ -0,0 +1,55 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <memory>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/any.h"
+#include "base/logging.h"
+#include "mr/mr_types.h"
+
+namespace mr3 {
+
+//! Read-only table loaded into memory from the whole output of an operator.
+//! Shared by all the IO threads of the operators that follow it.
+template <typename K, typename T> using BroadcastMap = absl::flat_hash_map<K, T>;
+
+namespace detail {
+
+class BroadcastMapWrapper {
+ public:
+  template <typename K, typename T>
+  explicit BroadcastMapWrapper(std::shared_ptr<const BroadcastMap<K, T>> m) : any_(std::move(m)) {}
+
+  BroadcastMapWrapper() {}
+
+  template <typename K, typename T> const BroadcastMap<K, T>& Cast() const {
+    using Ptr = std::shared_ptr<const BroadcastMap<K, T>>;
+    CHECK(typeid(Ptr) == any_.type())
+        << "Mismatch between " << typeid(Ptr).name() << " and " << any_.type().name();
+    return **absl::any_cast<Ptr>(&any_);
+  }
+
+ private:
+  absl::any any_;
+};
+
+//! Builds a broadcast map from the raw records of the operator output.
+class BroadcastBuilderBase {
+ public:
+  virtual ~BroadcastBuilderBase() {}
+
+  //! Returns false if the record could not be parsed.
+  virtual bool Add(bool is_binary, RawRecord&& rr) = 0;
+
+  //! Returns the number of records that were dropped since their key already existed.
+  virtual size_t duplicates() const = 0;
+
+  //! Moves the built map out of the builder.
+  virtual BroadcastMapWrapper Finalize() = 0;
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,459 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/columnar.h"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/unknown_field_set.h>
+
+#include <algorithm>
+
+#include "absl/base/casts.h"
+#include "absl/container/flat_hash_map.h"
+#include "base/flit.h"
+#include "base/logging.h"
+#include "base/varint.h"
+
+namespace mr3 {
+namespace detail {
+
+namespace gpb = ::google::protobuf;
+using namespace std;
+
+namespace {
+
+// Bits of the encoding byte of a column.
+enum : uint8_t { kDictEncoding = 1, kAllPresent = 2, kStringValues = 4 };
+
+bool IsColumn(const gpb::FieldDescriptor* fd) {
+  return !fd->is_repeated() && fd->cpp_type() != gpb::FieldDescriptor::CPPTYPE_MESSAGE;
+}
+
+// The residual column, which has no field, holds serialized messages.
+bool IsStringColumn(const gpb::FieldDescriptor* fd) {
+  return !fd || fd->cpp_type() == gpb::FieldDescriptor::CPPTYPE_STRING;
+}
+
+uint64_t GetIntValue(const gpb::Message& msg, const gpb::FieldDescriptor* fd) {
+  const gpb::Reflection* refl = msg.GetReflection();
+  switch (fd->cpp_type()) {
+    case gpb::FieldDescriptor::CPPTYPE_INT32:
+      return base::ZigZagEncode<int64_t>(refl->GetInt32(msg, fd));
+    case gpb::FieldDescriptor::CPPTYPE_INT64:
+      return base::ZigZagEncode<int64_t>(refl->GetInt64(msg, fd));
+    case gpb::FieldDescriptor::CPPTYPE_UINT32:
+      return refl->GetUInt32(msg, fd);
+    case gpb::FieldDescriptor::CPPTYPE_UINT64:
+      return refl->GetUInt64(msg, fd);
+    case gpb::FieldDescriptor::CPPTYPE_BOOL:
+      return refl->GetBool(msg, fd);
+    case gpb::FieldDescriptor::CPPTYPE_ENUM:
+      return base::ZigZagEncode<int64_t>(refl->GetEnumValue(msg, fd));
+    case gpb::FieldDescriptor::CPPTYPE_FLOAT:
+      return absl::bit_cast<uint32_t>(refl->GetFloat(msg, fd));
+    case gpb::FieldDescriptor::CPPTYPE_DOUBLE:
+      return absl::bit_cast<uint64_t>(refl->GetDouble(msg, fd));
+    default:
+      LOG(FATAL) << "Unsupported column " << fd->full_name();
+  }
+  return 0;
+}
+
+void SetIntValue(uint64_t val, const gpb::FieldDescriptor* fd, gpb::Message* msg) {
+  const gpb::Reflection* refl = msg->GetReflection();
+  switch (fd->cpp_type()) {
+    case gpb::FieldDescriptor::CPPTYPE_INT32:
+      refl->SetInt32(msg, fd, base::ZigZagDecode<int64_t>(val));
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_INT64:
+      refl->SetInt64(msg, fd, base::ZigZagDecode<int64_t>(val));
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_UINT32:
+      refl->SetUInt32(msg, fd, val);
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_UINT64:
+      refl->SetUInt64(msg, fd, val);
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_BOOL:
+      refl->SetBool(msg, fd, val != 0);
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_ENUM:
+      refl->SetEnumValue(msg, fd, base::ZigZagDecode<int64_t>(val));
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_FLOAT:
+      refl->SetFloat(msg, fd, absl::bit_cast<float>(uint32_t(val)));
+      break;
+    case gpb::FieldDescriptor::CPPTYPE_DOUBLE:
+      refl->SetDouble(msg, fd, absl::bit_cast<double>(val));
+      break;
+    default:
+      LOG(FATAL) << "Unsupported column " << fd->full_name();
+  }
+}
+
+size_t PlainSize(uint64_t val) { return Varint::Length64(val); }
+
+size_t PlainSize(const string& val) { return Varint::Length32(val.size()) + val.size(); }
+
+void AppendValue(uint64_t val, string* dest) { Varint::Append64(dest, val); }
+
+void AppendValue(const string& val, string* dest) {
+  Varint::Append32(dest, val.size());
+  dest->append(val);
+}
+
+bool ParseValue(const uint8_t** ptr, const uint8_t* end, uint64_t* val) {
+  *ptr = Varint::Parse64WithLimit(*ptr, end, val);
+  return *ptr != nullptr;
+}
+
+bool ParseValue(const uint8_t** ptr, const uint8_t* end, absl::string_view* val) {
+  uint32_t len = 0;
+  *ptr = Varint::Parse32WithLimit(*ptr, end, &len);
+  if (!*ptr || len > size_t(end - *ptr))
+    return false;
+  *val = absl::string_view(reinterpret_cast<const char*>(*ptr), len);
+  *ptr += len;
+  return true;
+}
+
+// Appends the values plainly or, if it takes less space, as a dictionary of the distinct
+// values in the order of their first appearance followed by the index of each value.
+template <typename T, typename Key> void EncodeValues(const vector<T>& vals, uint8_t* encoding,
+                                                      string* dest) {
+  absl::flat_hash_map<Key, uint32_t> index;
+  vector<uint32_t> ids;
+  ids.reserve(vals.size());
+
+  size_t plain_size = 0, dict_size = 0;
+  for (const T& v : vals) {
+    size_t sz = PlainSize(v);
+    auto res = index.emplace(Key(v), index.size());
+    plain_size += sz;
+    if (res.second)
+      dict_size += sz;
+    dict_size += Varint::Length32(res.first->second);
+    ids.push_back(res.first->second);
+  }
+  dict_size += Varint::Length32(index.size());
+
+  if (dict_size >= plain_size) {
+    for (const T& v : vals) {
+      AppendValue(v, dest);
+    }
+    return;
+  }
+
+  vector<const T*> dict(index.size());
+  for (size_t i = 0; i < vals.size(); ++i) {
+    dict[ids[i]] = &vals[i];
+  }
+
+  *encoding |= kDictEncoding;
+  Varint::Append32(dest, dict.size());
+  for (const T* v : dict) {
+    AppendValue(*v, dest);
+  }
+  for (uint32_t id : ids) {
+    Varint::Append32(dest, id);
+  }
+}
+
+template <typename T> bool DecodeValues(const uint8_t* ptr, const uint8_t* end, uint8_t encoding,
+                                        size_t count, vector<T>* dest) {
+  // Each value or index takes at least a byte.
+  if (count > size_t(end - ptr))
+    return false;
+  dest->resize(count);
+
+  if ((encoding & kDictEncoding) == 0) {
+    for (T& v : *dest) {
+      if (!ParseValue(&ptr, end, &v))
+        return false;
+    }
+    return ptr == end;
+  }
+
+  uint32_t dict_size = 0;
+  ptr = Varint::Parse32WithLimit(ptr, end, &dict_size);
+  if (!ptr || dict_size > size_t(end - ptr))
+    return false;
+
+  vector<T> dict(dict_size);
+  for (T& v : dict) {
+    if (!ParseValue(&ptr, end, &v))
+      return false;
+  }
+  vector<uint32_t> ids(dest->size());
+  ptr = Varint::ParseN(ptr, end, ids.data(), ids.size());
+  if (!ptr)
+    return false;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (ids[i] >= dict_size)
+      return false;
+    (*dest)[i] = dict[ids[i]];
+  }
+  return ptr == end;
+}
+
+inline bool IsPresent(const uint8_t* bitmap, size_t row) {
+  return !bitmap || (bitmap[row / 8] & (1 << (row % 8)));
+}
+
+}  // namespace
+
+struct ColumnarEncoder::Column {
+  const gpb::FieldDescriptor* field = nullptr;  // null for the residual column.
+  string present;                               // A bit per row.
+  size_t num_present = 0;
+
+  vector<uint64_t> ints;
+  vector<string> strs;
+};
+
+ColumnarEncoder::ColumnarEncoder(const gpb::Descriptor* descr)
+    : msg_(gpb::MessageFactory::generated_factory()->GetPrototype(CHECK_NOTNULL(descr))->New()) {
+  for (int i = 0; i < descr->field_count(); ++i) {
+    const gpb::FieldDescriptor* fd = descr->field(i);
+    if (IsColumn(fd)) {
+      columns_.emplace_back();
+      columns_.back().field = fd;
+    }
+  }
+  columns_.emplace_back();  // The residual column.
+}
+
+ColumnarEncoder::~ColumnarEncoder() {}
+
+bool ColumnarEncoder::Add(absl::string_view record) {
+  if (!msg_->ParsePartialFromArray(record.data(), record.size()))
+    return false;
+
+  const gpb::Reflection* refl = msg_->GetReflection();
+  const size_t byte = num_rows_ / 8;
+  const char bit = 1 << (num_rows_ % 8);
+
+  for (Column& col : columns_) {
+    if (col.present.size() == byte)
+      col.present.push_back(0);
+
+    if (col.field) {
+      if (!refl->HasField(*msg_, col.field))
+        continue;
+      if (IsStringColumn(col.field)) {
+        col.strs.push_back(refl->GetString(*msg_, col.field));
+      } else {
+        col.ints.push_back(GetIntValue(*msg_, col.field));
+      }
+      refl->ClearField(msg_.get(), col.field);
+    } else {
+      // The residual column is the last one, all the column fields are cleared by now.
+      string residual = msg_->SerializePartialAsString();
+      if (residual.empty())
+        continue;
+      col.strs.push_back(std::move(residual));
+    }
+    col.present[byte] |= bit;
+    ++col.num_present;
+  }
+  ++num_rows_;
+
+  return true;
+}
+
+string ColumnarEncoder::Flush() {
+  string header, body;
+  size_t num_columns = std::count_if(columns_.begin(), columns_.end(),
+                                     [](const Column& col) { return col.num_present > 0; });
+  Varint::Append32(&header, num_rows_);
+  Varint::Append32(&header, num_columns);
+
+  for (Column& col : columns_) {
+    if (col.num_present) {
+      uint8_t encoding = IsStringColumn(col.field) ? kStringValues : 0;
+      size_t start = body.size();
+
+      if (col.num_present == num_rows_) {
+        encoding |= kAllPresent;
+      } else {
+        body.append(col.present);
+      }
+      if (encoding & kStringValues) {
+        EncodeValues<string, absl::string_view>(col.strs, &encoding, &body);
+      } else {
+        EncodeValues<uint64_t, uint64_t>(col.ints, &encoding, &body);
+      }
+
+      Varint::Append32(&header, col.field ? col.field->number() : 0);
+      header.push_back(encoding);
+      Varint::Append32(&header, body.size() - start);
+    }
+
+    col.present.clear();
+    col.num_present = 0;
+    col.ints.clear();
+    col.strs.clear();
+  }
+  num_rows_ = 0;
+
+  return header.append(body);
+}
+
+struct ColumnarDecoder::Column {
+  const gpb::FieldDescriptor* field = nullptr;  // null for the residual column.
+  const uint8_t* present = nullptr;             // null if all the rows have values.
+  size_t next = 0;
+
+  vector<uint64_t> ints;
+  vector<absl::string_view> strs;
+
+  bool Init(const uint8_t* ptr, const uint8_t* end, uint8_t encoding, uint32_t num_rows);
+};
+
+bool ColumnarDecoder::Column::Init(const uint8_t* ptr, const uint8_t* end, uint8_t encoding,
+                                   uint32_t num_rows) {
+  size_t num_present = num_rows;
+  if ((encoding & kAllPresent) == 0) {
+    size_t bitmap_size = (size_t(num_rows) + 7) / 8;
+    if (bitmap_size > size_t(end - ptr))
+      return false;
+    present = ptr;
+    ptr += bitmap_size;
+
+    num_present = 0;
+    for (size_t i = 0; i < bitmap_size; ++i) {
+      num_present += __builtin_popcount(present[i]);
+    }
+  }
+
+  if (encoding & kStringValues)
+    return DecodeValues(ptr, end, encoding, num_present, &strs);
+  return DecodeValues(ptr, end, encoding, num_present, &ints);
+}
+
+ColumnarDecoder::ColumnarDecoder(const gpb::Descriptor* descr, const vector<string>& fields)
+    : msg_(gpb::MessageFactory::generated_factory()->GetPrototype(CHECK_NOTNULL(descr))->New()) {
+  if (fields.empty())
+    return;
+
+  decode_residual_ = false;
+  for (const string& name : fields) {
+    const gpb::FieldDescriptor* fd = descr->FindFieldByName(name);
+    CHECK(fd) << "Unknown field " << name << " of " << descr->full_name();
+    selected_.push_back(fd->number());
+    decode_residual_ |= !IsColumn(fd);
+  }
+  std::sort(selected_.begin(), selected_.end());
+
+  for (int i = 0; i < descr->field_count(); ++i) {
+    const gpb::FieldDescriptor* fd = descr->field(i);
+    CHECK(!fd->is_required() || IsSelected(fd->number()))
+        << "Required field " << fd->full_name() << " must be read";
+    if (!IsColumn(fd) && !IsSelected(fd->number()))
+      drop_fields_.push_back(fd);
+  }
+}
+
+ColumnarDecoder::~ColumnarDecoder() {}
+
+bool ColumnarDecoder::IsSelected(uint32_t field_number) const {
+  return selected_.empty() ||
+         std::binary_search(selected_.begin(), selected_.end(), field_number);
+}
+
+int64_t ColumnarDecoder::Decode(absl::string_view row_group,
+                                const std::function<void(std::string&&)>& cb) {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(row_group.data());
+  const uint8_t* end = ptr + row_group.size();
+  uint32_t num_rows = 0, num_columns = 0;
+
+  ptr = Varint::Parse32WithLimit(ptr, end, &num_rows);
+  if (ptr)
+    ptr = Varint::Parse32WithLimit(ptr, end, &num_columns);
+  if (!ptr || num_columns > size_t(end - ptr))
+    return -1;
+
+  struct Entry {
+    uint32_t field_number = 0, size = 0;
+    uint8_t encoding = 0;
+  };
+  vector<Entry> entries(num_columns);
+  for (Entry& e : entries) {
+    ptr = Varint::Parse32WithLimit(ptr, end, &e.field_number);
+    if (!ptr || ptr == end)
+      return -1;
+    e.encoding = *ptr++;
+    ptr = Varint::Parse32WithLimit(ptr, end, &e.size);
+    if (!ptr)
+      return -1;
+  }
+
+  // The residual column is decoded first, since parsing it resets the message.
+  const gpb::Descriptor* descr = msg_->GetDescriptor();
+  vector<Column> columns;
+  columns.reserve(entries.size());
+
+  for (const Entry& e : entries) {
+    if (e.size > size_t(end - ptr))
+      return -1;
+    const uint8_t* data = ptr;
+    ptr += e.size;
+
+    const gpb::FieldDescriptor* fd = nullptr;
+    if (e.field_number == 0) {
+      if ((e.encoding & kStringValues) == 0)
+        return -1;
+      if (!decode_residual_)
+        continue;
+    } else {
+      if (!IsSelected(e.field_number))
+        continue;
+
+      // Skips the columns of the fields that were removed or changed their type.
+      fd = descr->FindFieldByNumber(e.field_number);
+      if (!fd || !IsColumn(fd) || IsStringColumn(fd) != bool(e.encoding & kStringValues))
+        continue;
+    }
+
+    columns.emplace_back();
+    columns.back().field = fd;
+    if (!columns.back().Init(data, data + e.size, e.encoding, num_rows))
+      return -1;
+    if (!fd) {
+      std::swap(columns.front(), columns.back());
+    }
+  }
+
+  const gpb::Reflection* refl = msg_->GetReflection();
+  for (uint32_t row = 0; row < num_rows; ++row) {
+    msg_->Clear();
+
+    for (Column& col : columns) {
+      if (!IsPresent(col.present, row))
+        continue;
+
+      size_t index = col.next++;
+      if (col.field == nullptr) {
+        absl::string_view residual = col.strs[index];
+        if (!msg_->ParsePartialFromArray(residual.data(), residual.size()))
+          return -1;
+        for (const gpb::FieldDescriptor* fd : drop_fields_) {
+          refl->ClearField(msg_.get(), fd);
+        }
+        if (!selected_.empty())
+          refl->MutableUnknownFields(msg_.get())->Clear();
+      } else if (IsStringColumn(col.field)) {
+        refl->SetString(msg_.get(), col.field, string(col.strs[index]));
+      } else {
+        SetIntValue(col.ints[index], col.field, msg_.get());
+      }
+    }
+    cb(msg_->SerializePartialAsString());
+  }
+
+  return num_rows;
+}
+
+}  // namespace detail
+}  // namespace mr3
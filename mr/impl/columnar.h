@@ -0,0 +1,86 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace protobuf {
+class Descriptor;
+class FieldDescriptor;
+class Message;
+}  // namespace protobuf
+}  // namespace google
+
+namespace mr3 {
+namespace detail {
+
+/*! Encoding of pb::WireFormat::COLUMNAR records.
+ *
+ *  Each LST record of a COLUMNAR file holds a row group: up to kRowGroupSize consecutive
+ *  protobuf messages stored column by column. Every singular scalar field of the message type
+ *  has its own column: integers, enums, bools and floating point values are stored as varints
+ *  and strings as length-prefixed bytes. A column whose distinct values take less space than
+ *  its rows is dictionary encoded - it stores each distinct value once and a varint index per
+ *  row. The rest of the message (repeated, message and unknown fields) is kept serialized in
+ *  a single residual column. Columns without values in the row group are omitted.
+ *
+ *  The row group starts with a directory of its columns, so a reader that projects a subset
+ *  of the fields skips the other columns without decoding them.
+ */
+class ColumnarEncoder {
+ public:
+  static constexpr size_t kRowGroupSize = 1 << 13;
+
+  explicit ColumnarEncoder(const google::protobuf::Descriptor* descr);
+  ~ColumnarEncoder();
+
+  //! Adds a message serialized in binary format. Returns false if it can not be parsed.
+  bool Add(absl::string_view record);
+
+  size_t num_rows() const { return num_rows_; }
+
+  //! Encodes the added rows into a row group and clears the encoder.
+  std::string Flush();
+
+ private:
+  struct Column;
+
+  std::unique_ptr<google::protobuf::Message> msg_;
+  std::vector<Column> columns_;  // The residual column is the last one.
+  size_t num_rows_ = 0;
+};
+
+class ColumnarDecoder {
+ public:
+  //! Decodes only the given fields, all of them if fields is empty. The required fields of
+  //! the message type must be among the given ones.
+  ColumnarDecoder(const google::protobuf::Descriptor* descr,
+                  const std::vector<std::string>& fields);
+  ~ColumnarDecoder();
+
+  //! Calls cb(std::string&&) with each message of the row group serialized in binary format.
+  //! Returns the number of messages or -1 if the row group is corrupted.
+  int64_t Decode(absl::string_view row_group, const std::function<void(std::string&&)>& cb);
+
+ private:
+  struct Column;
+
+  bool IsSelected(uint32_t field_number) const;
+
+  std::unique_ptr<google::protobuf::Message> msg_;
+  std::vector<uint32_t> selected_;  // Sorted field numbers, empty if all fields are decoded.
+  bool decode_residual_ = true;
+
+  // Fields of the residual column that were not selected.
+  std::vector<const google::protobuf::FieldDescriptor*> drop_fields_;
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,71 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/cpu_breakdown.h"
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "util/asio/io_context.h"
+
+namespace mr3 {
+namespace detail {
+
+using namespace std;
+
+namespace {
+
+const char* const kPhaseNames[CPU_PHASE_NUM] = {"parse", "do", "serialize", "write"};
+
+}  // namespace
+
+void CpuBreakdown::Add(const CpuBreakdown& other) {
+  for (unsigned i = 0; i < CPU_PHASE_NUM; ++i) {
+    cycles[i] += other.cycles[i];
+  }
+  samples += other.samples;
+  preempted += other.preempted;
+}
+
+string CpuBreakdown::ToString() const {
+  uint64_t total = 0;
+  for (unsigned i = 0; i < CPU_PHASE_NUM; ++i) {
+    total += cycles[i];
+  }
+
+  string res;
+  for (unsigned i = 0; i < CPU_PHASE_NUM; ++i) {
+    double pct = total ? cycles[i] * 100.0 / total : 0;
+    absl::StrAppend(&res, kPhaseNames[i], " ", absl::StrFormat("%.1f", pct), "%, ");
+  }
+  absl::StrAppend(&res, samples, " samples, ", preempted, " preempted");
+
+  return res;
+}
+
+util::VarzValue::Map CpuBreakdown::ToVarz() const {
+  util::VarzValue::Map res;
+  for (unsigned i = 0; i < CPU_PHASE_NUM; ++i) {
+    res.emplace_back(absl::StrCat(kPhaseNames[i], "-cycles"), util::VarzValue::FromInt(cycles[i]));
+  }
+  res.emplace_back("samples", util::VarzValue::FromInt(samples));
+  res.emplace_back("preempted", util::VarzValue::FromInt(preempted));
+
+  return res;
+}
+
+CpuSample::CpuSample() : last_(__rdtsc()), switch_epoch_(util::FiberSwitchEpoch()) {}
+
+void CpuSample::Commit(CpuBreakdown* dest) const {
+  if (switch_epoch_ != util::FiberSwitchEpoch()) {
+    ++dest->preempted;
+    return;
+  }
+
+  for (unsigned i = 0; i < CPU_PHASE_NUM; ++i) {
+    dest->cycles[i] += cycles_[i];
+  }
+  ++dest->samples;
+}
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,60 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <x86intrin.h>
+
+#include <string>
+
+#include "util/stats/varz_value.h"
+
+namespace mr3 {
+namespace detail {
+
+enum CpuPhase : unsigned { CPU_PARSE = 0, CPU_DO, CPU_SERIALIZE, CPU_WRITE, CPU_PHASE_NUM };
+
+/*! Accumulates TSC cycles spent in each phase of record handling.
+    Only sampled records are measured, see CpuSample.
+*/
+struct CpuBreakdown {
+  uint64_t cycles[CPU_PHASE_NUM] = {0};
+  uint64_t samples = 0;
+
+  // Samples dropped because the fiber was suspended in the middle.
+  uint64_t preempted = 0;
+
+  void Add(const CpuBreakdown& other);
+
+  std::string ToString() const;
+  util::VarzValue::Map ToVarz() const;
+};
+
+/*! Measures a single record. Each Mark() charges the cycles passed since the previous mark
+    to the given phase, so nested phases are accounted exclusively.
+*/
+class CpuSample {
+ public:
+  //! Once per how many records a sample is taken. Must be a power of 2.
+  static constexpr unsigned kRate = 64;
+
+  CpuSample();
+
+  void Mark(CpuPhase phase) {
+    uint64_t now = __rdtsc();
+    cycles_[phase] += now - last_;
+    last_ = now;
+  }
+
+  //! Adds the sample into dest unless the fiber was suspended since the sample started.
+  //! Time of other fibers would be charged to this record otherwise.
+  void Commit(CpuBreakdown* dest) const;
+
+ private:
+  uint64_t cycles_[CPU_PHASE_NUM] = {0};
+  uint64_t last_;
+  uint64_t switch_epoch_;
+};
+
+}  // namespace detail
+}  // namespace mr3
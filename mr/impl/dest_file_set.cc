@@ -2,18 +2,25 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include <google/protobuf/descriptor.h>
+#include <unistd.h>
 
 #include "mr/impl/dest_file_set.h"
 
 #include "absl/strings/str_cat.h"
 #include "base/hash.h"
 #include "base/logging.h"
+#include "base/varint.h"
 #include "base/walltime.h"
 
 #include "file/file_util.h"
 #include "file/filesource.h"
 #include "file/gzip_file.h"
 #include "file/proto_writer.h"
+#include "mr/impl/columnar.h"
+#include "mr/impl/external_sorter.h"
+#include "mr/impl/memory_budget.h"
+#include "mr/impl/record_batch.h"
+#include "mr/impl/shuffle_store.h"
 
 #include "util/asio/io_context_pool.h"
 #include "util/gce/gcs.h"
@@ -21,9 +28,29 @@
 #include "util/zlib_source.h"
 #include "util/zstd_sinksource.h"
 
+DEFINE_uint32(dest_compress_threads, 0,
+              "Number of threads that compress the output files. 0 means the number of cores.");
+DEFINE_uint32(dest_sort_budget_mb, 64,
+              "Per shard memory budget for sorting the outputs with sorted shards. "
+              "Records above the budget are spilled to disk.");
+DEFINE_string(dest_sort_dir, "/tmp", "Directory for temporary sorted runs of sorted outputs.");
+DEFINE_uint32(dest_gcs_parallel_uploads, 0,
+              "If positive, GCS output files are uploaded as parts over up to this number of "
+              "connections per file and composed when closed. 0 uses a single resumable "
+              "upload per file.");
+DEFINE_uint32(dest_gcs_part_mb, 64, "Part size of the parallel GCS uploads.");
+DEFINE_uint32(dest_max_open_handles, 0,
+              "If positive, the maximal number of shards of a file output that keep their files "
+              "open. The least recently written shard above it closes its file and continues "
+              "in a new part file. 0 keeps all the shards open until the operator finishes.");
+DEFINE_uint32(dest_lst_zstd_dict_records, 1000,
+              "Number of the first records of each ZSTD compressed LST shard that train its "
+              "compression dictionary. 0 disables the dictionaries.");
+
 namespace mr3 {
 
 util::VarzMapAverage5m dest_files("dest-files-set");
+util::VarzMapCount dest_handles("dest-handles");
 
 namespace detail {
 
@@ -35,9 +62,19 @@ namespace {
 
 constexpr size_t kBufLimit = 1 << 16;
 
+// Whether the shards are written as numbered part files.
+bool HasParts(const pb::Output& pb_out) {
+  return pb_out.shard_spec().has_max_raw_size_mb() ||
+         (FLAGS_dest_max_open_handles && !pb_out.in_memory());
+}
+
 string FileName(StringPiece base, const pb::Output& pb_out, int32 sub_shard) {
   string res(base);
-  if (pb_out.shard_spec().has_max_raw_size_mb()) {
+  if (!pb_out.file_tag().empty()) {
+    absl::StrAppend(&res, "-", pb_out.file_tag());
+  }
+
+  if (HasParts(pb_out)) {
     if (sub_shard >= 0) {
       absl::StrAppend(&res, "-", absl::Dec(sub_shard, absl::kZeroPad3));
     } else {
@@ -60,8 +97,15 @@ string FileName(StringPiece base, const pb::Output& pb_out, int32 sub_shard) {
       }
     }
   } else if (pb_out.format().type() == pb::WireFormat::LST) {
-    CHECK(!pb_out.has_compress()) << "Can not set compression on LST files";
+    CHECK(!pb_out.has_compress() || pb_out.compress().type() == pb::Output::ZSTD)
+        << "LST files support only ZSTD compression";
     absl::StrAppend(&res, ".lst");
+  } else if (pb_out.format().type() == pb::WireFormat::BATCH) {
+    CHECK(!pb_out.has_compress()) << "Can not set compression on BATCH files";
+    absl::StrAppend(&res, ".batch");
+  } else if (pb_out.format().type() == pb::WireFormat::COLUMNAR) {
+    CHECK(!pb_out.has_compress()) << "Can not set compression on COLUMNAR files";
+    absl::StrAppend(&res, ".col");
   } else {
     LOG(FATAL) << "Unsupported format for " << pb_out.ShortDebugString();
   }
@@ -76,20 +120,42 @@ class CompressHandle : public DestHandle {
   CompressHandle(DestFileSet* owner, const ShardId& sid);
   ~CompressHandle() override;
 
-  void Write(StringGenCb str) override;
+  void WriteRecords(StringGenCb str) override;
 
   // Closes the handle without blocking.
-  void Close(bool abort_write) override;
+  void CloseFile(bool abort_write) override;
 
  private:
+  // Compression state of the current sub-shard. Accessed only from compress_queue_.
+  struct CompressState {
+    util::StringSink* out_buf = nullptr;
+    unique_ptr<util::Sink> sink;
+  };
+
   void InitCompressSink();
 
   void Open() override;
   void WriteThreadLocal(uint64_t start_usec, string data);
 
+  // Passes the filled raw buffer to compress_queue_. Blocks while the previous buffer
+  // is still being compressed.
+  void SubmitRaw();
+  void CompressThreadLocal(CompressState* state, const string& raw);
+  void FlushCompressed(CompressState* state);
+
+  // Runs f on the io queue after all the buffers that were submitted before.
+  void AddIoOrdered(std::function<void()> f);
+
   size_t start_delta_ = 0;
-  util::StringSink* compress_out_buf_ = nullptr;
-  unique_ptr<util::Sink> compress_sink_;
+
+  // The handle fills raw_buf_ while the previous buffer is compressed in compress_queue_,
+  // which is a single worker of the compression pool. The worker handles the buffers
+  // of the handle one by one and enqueues the compressed chunks into io_queue_ in order.
+  util::fibers_ext::FiberQueue* compress_queue_ = nullptr;
+  unique_ptr<CompressState> compress_state_;
+  string raw_buf_;
+  std::atomic_uint pending_{0};
+  fibers_ext::EventCount pending_ec_;
 
   fibers::mutex zmu_;
 };
@@ -99,16 +165,47 @@ class LstHandle : public DestHandle {
   LstHandle(DestFileSet* owner, const ShardId& sid);
   ~LstHandle();
 
-  void Write(StringGenCb cb) final;
-  void Close(bool abort_write) final;
+  void WriteRecords(StringGenCb cb) final;
+  void CloseFile(bool abort_write) final;
 
  private:
   void Open() override;
+  void AddBatch(std::vector<std::string> vec, size_t batch_size);
 
-  void OpenThreadLocal();
+  void OpenThreadLocal(const std::string& path);
   void CloseThreadLocal(bool abort_write);
 
+  // Writes the rows buffered in columnar_ as a row group.
+  void FlushRowGroup();
+
   std::unique_ptr<file::ListWriter> lst_writer_;
+  fibers::mutex mu_;
+
+  // Set for COLUMNAR outputs, accessed under mu_.
+  std::unique_ptr<ColumnarEncoder> columnar_;
+};
+
+// Keeps the shard of an in-memory output in the shuffle store of the owner. Once the store
+// exceeds its limit, the buffered chunks and all the following ones are passed to a file handle
+// of the shard.
+class MemHandle : public DestHandle {
+ public:
+  MemHandle(DestFileSet* owner, const ShardId& sid);
+  ~MemHandle();
+
+  void WriteRecords(StringGenCb cb) final;
+  void CloseFile(bool abort_write) final;
+
+ private:
+  void Open() override {}
+
+  // Moves the buffered chunks into spill_. Called under mu_.
+  void Spill();
+
+  ShuffleStore* store_;
+  fibers::mutex mu_;
+  std::unique_ptr<ShuffleStore::Shard> shard_;
+  std::unique_ptr<DestHandle> spill_;  // Is not reset once it is set.
 };
 
 CompressHandle::CompressHandle(DestFileSet* owner, const ShardId& sid) : DestHandle(owner, sid) {
@@ -119,11 +216,17 @@ CompressHandle::CompressHandle(DestFileSet* owner, const ShardId& sid) : DestHan
   start_delta_ = rnd() % (kBufLimit - 1);
 
   if (owner->output().has_compress()) {
+    compress_queue_ = CHECK_NOTNULL(owner->compress_pool())->GetQueue(queue_index_);
+    raw_buf_.reserve(kBufLimit);
     InitCompressSink();
   }
 }
 
 CompressHandle::~CompressHandle() {
+  // The compression worker may still enqueue chunks into io_queue_.
+  if (compress_queue_) {
+    compress_queue_->Await([] {});
+  }
   WaitForPendingToFinish();
 }
 
@@ -137,70 +240,87 @@ void CompressHandle::AppendThreadLocal(const std::string& str) {
 
 
 void CompressHandle::InitCompressSink() {
-  compress_out_buf_ = new StringSink;
+  compress_state_.reset(new CompressState);
+  compress_state_->out_buf = new StringSink;
+
   auto level = owner_->output().compress().level();
   if (owner_->output().compress().type() == pb::Output::GZIP) {
-    compress_sink_.reset(new ZlibSink(compress_out_buf_, level));
+    compress_state_->sink.reset(new ZlibSink(compress_state_->out_buf, level));
   } else if (owner_->output().compress().type() == pb::Output::ZSTD) {
-    std::unique_ptr<ZStdSink> zsink{new ZStdSink(compress_out_buf_)};
+    std::unique_ptr<ZStdSink> zsink{new ZStdSink(compress_state_->out_buf)};
     CHECK_STATUS(zsink->Init(level));
-    compress_sink_ = std::move(zsink);
+    compress_state_->sink = std::move(zsink);
   } else {
     LOG(FATAL) << "Unsupported format " << owner_->output().compress().ShortDebugString();
   }
 }
 
 void CompressHandle::Open() {
-  // Do not block on opening the file.
-  io_queue_->Add([this] { this->OpenWriteFileLocal(); });
+  // The sink is released when the file is closed.
+  if (compress_queue_ && !compress_state_) {
+    InitCompressSink();
+  }
+
+  // Do not block on opening the file. The path is captured since full_path_ changes when
+  // the shard rolls over.
+  AddIoOrdered([this, path = full_path_] { this->OpenWriteFileLocal(path); });
+}
+
+void CompressHandle::AddIoOrdered(std::function<void()> f) {
+  if (compress_queue_) {
+    compress_queue_->Add([this, f = std::move(f)] { io_queue_->Add(f); });
+  } else {
+    io_queue_->Add(std::move(f));
+  }
 }
 
-// CompressHandle::Write runs in "other" threads, no necessarily where we write the data into.
-void CompressHandle::Write(StringGenCb cb) {
+// CompressHandle::WriteRecords runs in "other" threads, no necessarily where we write the data into.
+void CompressHandle::WriteRecords(StringGenCb cb) {
   absl::optional<string> tmp_str;
   while (true) {
     tmp_str = cb();
     if (!tmp_str)
       break;
-    raw_size_ += tmp_str->size();
 
-    if (compress_sink_) {
-      this_fiber::yield();
-    }
-
-    // We must lock both the compression and the enquing calls because the order of writing
-    // compressed chunks is important and we need to preserve transactional semantics.
-    // It seems that compressing in the producer thread gives better performance because
-    // the system balances itself: it spends producer CPU on the compression step before
-    // enqueing it into io queue that could be full.
+    // We must lock both the buffering and the enquing calls because the order of writing
+    // chunks is important and we need to preserve transactional semantics.
     std::unique_lock<fibers::mutex> lk(zmu_);
+    raw_size_ += tmp_str->size();
+    owner_->AddRawBytes(tmp_str->size());
+
+    bool preempted = false;
+    auto start = base::GetMonotonicMicrosFast();
+    MemoryBudget* budget = MemoryBudget::ThisThread();
 
-    if (compress_sink_) {
-      strings::ByteRange br = strings::ToByteRange(*tmp_str);
-      auto status = compress_sink_->Append(br);
-      CHECK_STATUS(status);
+    if (compress_queue_) {
+      raw_buf_.append(*tmp_str);
 
-      if (start_delta_ + compress_out_buf_->contents().size() < kBufLimit)
+      // Flushes early when the budget of the writing thread is nearly used.
+      if (raw_buf_.size() < kBufLimit && raw_size_ < raw_limit_ &&
+          !(budget && budget->NearLimit()))
         continue;
 
-      tmp_str->clear();
-      tmp_str->swap(compress_out_buf_->contents());
-      start_delta_ = 0;
+      SubmitRaw();
+    } else {
+      // The chunk is charged until it's written.
+      if (budget)
+        budget->Charge(tmp_str->size());
+      auto cb = [start, this, budget, str = std::move(*tmp_str)]() mutable {
+        size_t sz = str.size();
+        WriteThreadLocal(start, std::move(str));
+        if (budget)
+          budget->Release(sz);
+      };
+
+      preempted = io_queue_->Add(std::move(cb));
     }
 
-    auto start = base::GetMonotonicMicrosFast();
-    auto cb = [start, this, str = std::move(*tmp_str)]() mutable {
-      WriteThreadLocal(start, std::move(str));
-    };
-
-    bool preempted = io_queue_->Add(std::move(cb));
-
     if (raw_size_ >= raw_limit_) {
-      Close(false);
+      CloseFile(false);
       ++sub_shard_;
       raw_size_ = 0;
       full_path_ = owner_->ShardFilePath(sid_, sub_shard_);
-      if (compress_sink_) {
+      if (compress_queue_) {
         InitCompressSink();
       }
       Open();
@@ -217,52 +337,88 @@ void CompressHandle::Write(StringGenCb cb) {
   }
 }
 
-void CompressHandle::WriteThreadLocal(uint64_t start_usec, string data) {
-  dest_files.IncBy("io-deque", base::GetMonotonicMicrosFast() - start_usec);
+void CompressHandle::SubmitRaw() {
+  if (raw_buf_.empty())
+    return;
 
-#if 0
-  if (compress_sink_) {
-    if (data.empty()) {
-      CHECK_STATUS(compress_sink_->Flush());
-    } else {
-      strings::ByteRange br = strings::ToByteRange(data);
-      CHECK_STATUS(compress_sink_->Append(br));
+  // Double buffering: at most one buffer of the handle is compressed at any given time.
+  auto start = base::GetMonotonicMicrosFast();
+  pending_ec_.await([this] { return pending_.load(std::memory_order_acquire) == 0; });
+  dest_files.IncBy("compress-wait", base::GetMonotonicMicrosFast() - start);
+
+  // The buffer is charged until it's compressed.
+  MemoryBudget* budget = MemoryBudget::ThisThread();
+  if (budget)
+    budget->Charge(raw_buf_.size());
+
+  pending_.fetch_add(1, std::memory_order_acq_rel);
+  auto cb = [this, budget, state = compress_state_.get(), raw = std::move(raw_buf_)] {
+    CompressThreadLocal(state, raw);
+    if (budget)
+      budget->Release(raw.size());
+    pending_.fetch_sub(1, std::memory_order_acq_rel);
+    pending_ec_.notify();
+  };
+  compress_queue_->Add(std::move(cb));
+
+  raw_buf_.clear();  // a moved-from string is valid but unspecified.
+  raw_buf_.reserve(kBufLimit);
+}
 
-      if (start_delta_ + compress_out_buf_->contents().size() < kBufLimit)
-        return;
-    }
+void CompressHandle::CompressThreadLocal(CompressState* state, const string& raw) {
+  CHECK_STATUS(state->sink->Append(strings::ToByteRange(raw)));
 
-    data.clear();
-    data.swap(compress_out_buf_->contents());
-    start_delta_ = 0;
+  if (start_delta_ + state->out_buf->contents().size() >= kBufLimit) {
+    FlushCompressed(state);
   }
-#endif
+}
+
+void CompressHandle::FlushCompressed(CompressState* state) {
+  auto& buf = state->out_buf->contents();
+  if (buf.empty())
+    return;
+
+  auto start = base::GetMonotonicMicrosFast();
+  auto cb = [start, this, str = std::move(buf)]() mutable {
+    WriteThreadLocal(start, std::move(str));
+  };
+  io_queue_->Add(std::move(cb));
+
+  buf.clear();
+  start_delta_ = 0;
+}
+
+void CompressHandle::WriteThreadLocal(uint64_t start_usec, string data) {
+  dest_files.IncBy("io-deque", base::GetMonotonicMicrosFast() - start_usec);
+
   AppendThreadLocal(data);
 }
 
-void CompressHandle::Close(bool abort_write) {
+void CompressHandle::CloseFile(bool abort_write) {
   VLOG(1) << "CompressHandle::Close";
 
-  if (!abort_write) {
-    if (compress_sink_) {
-      CHECK_STATUS(compress_sink_->Flush());
-
-      auto& buf = compress_out_buf_->contents();
-      if (!buf.empty()) {
-        auto start = base::GetMonotonicMicrosFast();
-        auto cb = [start, this, str = std::move(buf)]() mutable {
-          WriteThreadLocal(start, std::move(str));  // Flush and write.
-        };
-        io_queue_->Add(std::move(cb));
-      }
+  if (compress_queue_) {
+    if (!abort_write) {
+      SubmitRaw();
     }
+    raw_buf_.clear();
+
+    // The state is released by the worker after it compresses all the pending buffers.
+    auto cb = [this, abort_write, state = compress_state_.release()] {
+      std::unique_ptr<CompressState> guard(state);
+      if (!abort_write) {
+        CHECK_STATUS(state->sink->Flush());
+        FlushCompressed(state);
+      }
+    };
+    compress_queue_->Add(std::move(cb));
   }
 
   // TODO: to handle abort_write by changing WriteFile interface to allow optionally drop
   // the pending writes.
   // I do not block on Close to allow fast iteration when closing all the files.
   // During queues shutdown they will block until this handler runs.
-  io_queue_->Add([this] {
+  AddIoOrdered([this] {
     if (write_file_) {
       VLOG(1) << "Closing file " << write_file_->create_file_name();
       CHECK(write_file_->Close());
@@ -273,6 +429,14 @@ void CompressHandle::Close(bool abort_write) {
 }
 
 LstHandle::LstHandle(DestFileSet* owner, const ShardId& sid) : DestHandle(owner, sid) {
+  if (owner->output().format().type() == pb::WireFormat::COLUMNAR) {
+    const string& type_name = owner->output().type_name();
+    const auto* descr =
+        google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
+    CHECK(descr) << "COLUMNAR output " << owner->output().name()
+                 << " requires a protobuf type, got '" << type_name << "'";
+    columnar_.reset(new ColumnarEncoder(descr));
+  }
 }
 
 LstHandle::~LstHandle() {
@@ -280,45 +444,103 @@ LstHandle::~LstHandle() {
   WaitForPendingToFinish();
 }
 
-void LstHandle::Write(StringGenCb cb) {
+void LstHandle::WriteRecords(StringGenCb cb) {
   absl::optional<string> tmp_str;
   std::vector<string> str_vec;
   constexpr size_t kBufSize = 2048;
   str_vec.reserve(kBufSize);
+  size_t batch_size = 0;
 
   while (true) {
     tmp_str = cb();
     if (!tmp_str)
       break;
+    batch_size += tmp_str->size();
     str_vec.push_back(std::move(*tmp_str));
     if (str_vec.size() >= kBufSize) {
-      io_queue_->Add([this, vec = std::move(str_vec)] {
-        for (const auto& v : vec) {
-          CHECK_STATUS(lst_writer_->AddRecord(v));
-        }
-      });
-      CHECK_EQ(str_vec.capacity(), kBufSize);  // move does not deallocate the storage.
+      AddBatch(std::move(str_vec), batch_size);
+      str_vec.clear();  // a moved-from vector is valid but unspecified.
+      str_vec.reserve(kBufSize);
+      batch_size = 0;
     }
   }
-  io_queue_->Add([this, vec = std::move(str_vec)] {
+  AddBatch(std::move(str_vec), batch_size);
+}
+
+void LstHandle::AddBatch(std::vector<std::string> vec, size_t batch_size) {
+  if (vec.empty())
+    return;
+
+  // Batches and sub-shard switches must be enqueued in the same order they are accounted.
+  std::lock_guard<fibers::mutex> lk(mu_);
+  if (columnar_) {
+    MemoryBudget* budget = MemoryBudget::ThisThread();
     for (const auto& v : vec) {
-      CHECK_STATUS(lst_writer_->AddRecord(v));
+      CHECK(columnar_->Add(v)) << "Could not parse a record of " << owner_->output().name();
+      if (columnar_->num_rows() >= ColumnarEncoder::kRowGroupSize ||
+          (budget && budget->NearLimit()))
+        FlushRowGroup();
     }
+  } else {
+    // The batch is charged until it's written.
+    MemoryBudget* budget = MemoryBudget::ThisThread();
+    if (budget)
+      budget->Charge(batch_size);
+    io_queue_->Add([this, budget, batch_size, vec = std::move(vec)] {
+      for (const auto& v : vec) {
+        CHECK_STATUS(lst_writer_->AddRecord(v));
+      }
+      if (budget)
+        budget->Release(batch_size);
+    });
+  }
+
+  raw_size_ += batch_size;
+  owner_->AddRawBytes(batch_size);
+  if (raw_size_ >= raw_limit_) {
+    CloseFile(false);
+    ++sub_shard_;
+    raw_size_ = 0;
+    full_path_ = owner_->ShardFilePath(sid_, sub_shard_);
+    Open();
+  }
+}
+
+void LstHandle::FlushRowGroup() {
+  if (columnar_->num_rows() == 0)
+    return;
+
+  MemoryBudget* budget = MemoryBudget::ThisThread();
+  string row_group = columnar_->Flush();
+  if (budget)
+    budget->Charge(row_group.size());
+  io_queue_->Add([this, budget, row_group = std::move(row_group)] {
+    CHECK_STATUS(lst_writer_->AddRecord(row_group));
+    if (budget)
+      budget->Release(row_group.size());
   });
 }
 
 void LstHandle::Open() {
-  CHECK(!owner_->output().has_compress());
-  io_queue_->Add([this] { this->OpenThreadLocal(); });
+  CHECK(!owner_->output().has_compress() || owner_->output().format().type() == pb::WireFormat::LST);
+  io_queue_->Add([this, path = full_path_] { this->OpenThreadLocal(path); });
 }
 
-void LstHandle::OpenThreadLocal() {
-  OpenWriteFileLocal();
+void LstHandle::OpenThreadLocal(const std::string& path) {
+  OpenWriteFileLocal(path);
 
   namespace gpb = google::protobuf;
 
+  // Records are compressed inside the list file, one by one.
+  file::ListWriter::Options opts;
+  if (owner_->output().has_compress()) {
+    opts.compress_method = list_file::kCompressionZstd;
+    opts.compress_level = owner_->output().compress().level();
+    opts.zstd_dict_records = FLAGS_dest_lst_zstd_dict_records;
+  }
+
   util::Sink* fs = new file::Sink{write_file_, DO_NOT_TAKE_OWNERSHIP};
-  lst_writer_.reset(new file::ListWriter{fs});
+  lst_writer_.reset(new file::ListWriter{fs, opts});
   if (!owner_->output().type_name().empty()) {
     lst_writer_->AddMeta(file::kProtoTypeKey, owner_->output().type_name());
 
@@ -338,16 +560,111 @@ void LstHandle::CloseThreadLocal(bool abort_write) {
   CHECK(write_file_->Close());
 }
 
-void LstHandle::Close(bool abort_write) {
+void LstHandle::CloseFile(bool abort_write) {
+  // Called either under mu_ when the sub-shard rolls over or after all the writes.
+  if (columnar_) {
+    if (abort_write) {
+      columnar_->Flush();
+    } else {
+      FlushRowGroup();
+    }
+  }
   io_queue_->Add([this, abort_write] { this->CloseThreadLocal(abort_write); });
 }
 
+MemHandle::MemHandle(DestFileSet* owner, const ShardId& sid)
+    : DestHandle(owner, sid), store_(CHECK_NOTNULL(owner->shuffle_store())),
+      shard_(new ShuffleStore::Shard) {
+  shard_->type = owner->output().format().type();
+  shard_->type_name = owner->output().type_name();
+}
+
+MemHandle::~MemHandle() {
+  spill_.reset();
+  WaitForPendingToFinish();
+}
+
+void MemHandle::WriteRecords(StringGenCb cb) {
+  std::unique_lock<fibers::mutex> lk(mu_);
+  absl::optional<string> tmp_str;
+  while (!spill_ && (tmp_str = cb())) {
+    size_t sz = tmp_str->size();
+    shard_->bytes += sz;
+    shard_->chunks.push_back(std::move(*tmp_str));
+    if (!store_->Charge(sz))
+      Spill();
+  }
+
+  // cb is exhausted unless the shard is spilled.
+  DestHandle* spill = spill_.get();
+  lk.unlock();
+
+  if (spill)
+    ForwardRecords(spill, std::move(cb));
+}
+
+void MemHandle::Spill() {
+  VLOG(1) << "Spilling " << owner_->ShardFilePath(sid_, -1) << " with " << shard_->bytes
+          << " bytes into files";
+  spill_ = owner_->CreateFileHandle(sid_);
+
+  size_t pos = 0;
+  ForwardRecords(spill_.get(), [this, &pos]() -> absl::optional<std::string> {
+    if (pos == shard_->chunks.size())
+      return absl::nullopt;
+    return std::move(shard_->chunks[pos++]);
+  });
+  store_->Release(shard_->bytes, true);
+  shard_.reset();
+}
+
+void MemHandle::CloseFile(bool abort_write) {
+  std::lock_guard<fibers::mutex> lk(mu_);
+  if (spill_) {
+    spill_->Close(abort_write);
+    return;
+  }
+
+  if (abort_write) {
+    store_->Release(shard_->bytes, false);
+  } else {
+    // Spilled chunks are accounted by the file handle.
+    owner_->AddRawBytes(shard_->bytes);
+    store_->Publish(owner_->ShardFilePath(sid_, -1), std::move(shard_));
+  }
+  shard_.reset();
+}
+
 }  // namespace
 
+std::string EncodeSortedRecord(absl::string_view key, absl::string_view record) {
+  string res;
+  res.reserve(key.size() + record.size() + Varint::kMax32);
+  Varint::Append32(&res, key.size());
+  res.append(key.data(), key.size()).append(record.data(), record.size());
+  return res;
+}
+
+std::string ShardFilePath(const std::string& root_dir, const pb::Output& out, const ShardId& key,
+                          int32 sub_shard) {
+  string shard_name = key.ToString(absl::StrCat(out.name(), "-", "shard"));
+  string file_name = FileName(shard_name, out, sub_shard);
+
+  return file_util::JoinPath(root_dir, file_name);
+}
+
 DestFileSet::DestFileSet(const std::string& root_dir, const pb::Output& out,
                          util::IoContextPool* pool, fibers_ext::FiberQueueThreadPool* fq)
-    : root_dir_(root_dir), pb_out_(out), io_pool_(*pool), fq_(*fq) {
+    : root_dir_(root_dir), pb_out_(out), io_pool_(*pool), fq_(*fq),
+      max_open_handles_(FLAGS_dest_max_open_handles) {
   is_gcs_dest_ = util::IsGcsPath(root_dir_);
+
+  // Compression is CPU-heavy and would stall the IO threads that run the handlers.
+  // A separate pool is used since its workers block on fq_ queues when writing.
+  // LST outputs compress their records in the list writer.
+  if (pb_out_.has_compress() && pb_out_.format().type() == pb::WireFormat::TXT) {
+    compress_pool_.reset(new fibers_ext::FiberQueueThreadPool(FLAGS_dest_compress_threads, 16));
+  }
 }
 
 DestFileSet::~DestFileSet() {
@@ -360,38 +677,93 @@ DestHandle* DestFileSet::GetOrCreate(const ShardId& sid) {
   auto it = dest_files_.find(sid);
   if (it == dest_files_.end()) {
     std::unique_ptr<DestHandle> dh;
-
-    bool is_local_fs = !is_gcs_dest_;
-    if (is_local_fs) {
-      string shard_name = sid.ToString(absl::string_view{});
-      absl::string_view dir_name = file_util::DirName(shard_name);
-      if (dir_name.size() != shard_name.size()) {  // If dir name is present in a shard name.
-        string sub_dir = file_util::JoinPath(root_dir_, dir_name);
-        CHECK_STATUS(file_util::CreateSubDirIfNeeded(sub_dir)) << sub_dir;
-      }
-    }
-    if (pb_out_.format().type() == pb::WireFormat::LST) {
-      dh = std::make_unique<LstHandle>(this, sid);
-    } else if (pb_out_.format().type() == pb::WireFormat::TXT) {
-      dh = std::make_unique<CompressHandle>(this, sid);
+    if (shuffle_store_) {
+      dh = std::make_unique<MemHandle>(this, sid);
+    } else if (max_open_handles_) {
+      dh = NewFileHandle(sid);
+      dh->budgeted_ = true;
     } else {
-      LOG(FATAL) << "Unsupported format " << pb_out_.format().ShortDebugString();
-    }
-    if (pb_out_.shard_spec().has_max_raw_size_mb()) {
-      dh->set_raw_limit(size_t(1U << 20) * pb_out_.shard_spec().max_raw_size_mb());
+      dh = CreateFileHandle(sid);
     }
-
-    dh->Open();
     VLOG(1) << "Open destination shard " << dh->full_path();
 
     auto res = dest_files_.emplace(sid, std::move(dh));
     CHECK(res.second);
     it = res.first;
+    handles_created_.fetch_add(1, std::memory_order_relaxed);
   }
 
   return it->second.get();
 }
 
+std::unique_ptr<DestHandle> DestFileSet::CreateFileHandle(const ShardId& sid) {
+  std::unique_ptr<DestHandle> dh = NewFileHandle(sid);
+  dh->Open();
+
+  return dh;
+}
+
+std::unique_ptr<DestHandle> DestFileSet::NewFileHandle(const ShardId& sid) {
+  std::unique_ptr<DestHandle> dh;
+
+  bool is_local_fs = !is_gcs_dest_;
+  if (is_local_fs) {
+    string shard_name = sid.ToString(absl::string_view{});
+    absl::string_view dir_name = file_util::DirName(shard_name);
+    if (dir_name.size() != shard_name.size()) {  // If dir name is present in a shard name.
+      string sub_dir = file_util::JoinPath(root_dir_, dir_name);
+      CHECK_STATUS(file_util::CreateSubDirIfNeeded(sub_dir)) << sub_dir;
+    }
+  }
+  if (pb_out_.format().type() == pb::WireFormat::LST ||
+      pb_out_.format().type() == pb::WireFormat::BATCH ||
+      pb_out_.format().type() == pb::WireFormat::COLUMNAR) {
+    dh = std::make_unique<LstHandle>(this, sid);
+  } else if (pb_out_.format().type() == pb::WireFormat::TXT) {
+    dh = std::make_unique<CompressHandle>(this, sid);
+  } else {
+    LOG(FATAL) << "Unsupported format " << pb_out_.format().ShortDebugString();
+  }
+  if (pb_out_.shard_spec().has_max_raw_size_mb()) {
+    dh->set_raw_limit(size_t(1U << 20) * pb_out_.shard_spec().max_raw_size_mb());
+  }
+
+  return dh;
+}
+
+void DestFileSet::TouchHandle(DestHandle* dh) {
+  std::lock_guard<fibers::mutex> lk(lru_mu_);
+  if (dh->in_lru_) {
+    open_lru_.splice(open_lru_.begin(), open_lru_, dh->lru_pos_);
+  } else {
+    dh->lru_pos_ = open_lru_.insert(open_lru_.begin(), dh);
+    dh->in_lru_ = true;
+  }
+
+  // The handles that are being written are skipped, hence the budget may be exceeded by
+  // the shards that are written concurrently.
+  for (size_t attempts = open_lru_.size(); open_lru_.size() > max_open_handles_ && attempts;
+       --attempts) {
+    DestHandle* victim = open_lru_.back();
+    if (!victim->TryEvict()) {
+      open_lru_.splice(open_lru_.begin(), open_lru_, victim->lru_pos_);
+      continue;
+    }
+    open_lru_.pop_back();
+    victim->in_lru_ = false;
+    handles_evicted_.fetch_add(1, std::memory_order_relaxed);
+    dest_handles.Inc("evicted");
+  }
+}
+
+void DestFileSet::ReleaseHandle(DestHandle* dh) {
+  std::lock_guard<fibers::mutex> lk(lru_mu_);
+  if (dh->in_lru_) {
+    open_lru_.erase(dh->lru_pos_);
+    dh->in_lru_ = false;
+  }
+}
+
 void DestFileSet::CloseAllHandles(bool abort_write) {
   std::lock_guard<fibers::mutex> lk(handles_mu_);
 
@@ -400,19 +772,35 @@ void DestFileSet::CloseAllHandles(bool abort_write) {
   // However it may start asynchronous operations that will live after this function exits.
   // This is why we need DestHandle to be shared_ptr - to guard it against destruction during
   // async ops.
-  for (auto& k_v : dest_files_) {
-    if (k_v.second)  // Can be null if was closed in the middle
-      k_v.second->Close(abort_write);
+  if (pb_out_.sorted()) {
+    // Sorted handles sort their shards when they close, hence we close them in parallel.
+    std::vector<fibers::fiber> closers;
+    for (auto& k_v : dest_files_) {
+      if (!k_v.second)
+        continue;
+      IoContext& io_context = io_pool_.at(closers.size() % io_pool_.size());
+      closers.push_back(io_context.LaunchFiber(
+          [dh = k_v.second.get(), abort_write] { dh->Close(abort_write); }));
+    }
+    for (auto& fb : closers) {
+      fb.join();
+    }
+  } else {
+    for (auto& k_v : dest_files_) {
+      if (k_v.second)  // Can be null if was closed in the middle
+        k_v.second->Close(abort_write);
+    }
   }
 
   dest_files_.clear();  // This blocks until all the pending operations finish.
+
+  LOG_IF(INFO, handles_evicted_.load(std::memory_order_relaxed))
+      << "Output " << pb_out_.name() << " evicted " << handles_evicted() << " and reopened "
+      << handles_reopened() << " handles";
 }
 
 std::string DestFileSet::ShardFilePath(const ShardId& key, int32 sub_shard) const {
-  string shard_name = key.ToString(absl::StrCat(pb_out_.name(), "-", "shard"));
-  string file_name = FileName(shard_name, pb_out_, sub_shard);
-
-  return file_util::JoinPath(root_dir_, file_name);
+  return detail::ShardFilePath(root_dir_, pb_out_, key, sub_shard);
 }
 
 void DestFileSet::CloseHandle(const ShardId& sid) {
@@ -450,6 +838,13 @@ DestHandle::DestHandle(DestFileSet* owner, const ShardId& sid) : owner_(owner),
   queue_index_ = base::Murmur32(full_path_, 120577U);
   io_queue_ = owner_->pool()->GetQueue(queue_index_);
 
+  if (owner_->output().sorted()) {
+    string prefix = file_util::JoinPath(
+        FLAGS_dest_sort_dir,
+        absl::StrCat(file_util::GetNameFromPath(full_path_), "-", getpid()));
+    sorter_.reset(new ExternalSorter(prefix, size_t(FLAGS_dest_sort_budget_mb) << 20));
+  }
+
   if (owner_->is_gcs_dest()) {
     size_t net_index = queue_index_ % owner_->io_pool()->size();
 
@@ -461,6 +856,149 @@ DestHandle::DestHandle(DestFileSet* owner, const ShardId& sid) : owner_(owner),
 }
 
 DestHandle::~DestHandle() {
+  DCHECK(!in_lru_);
+}
+
+void DestHandle::Write(StringGenCb cb) {
+  if (!sorter_) {
+    if (!budgeted_) {
+      WriteRecords(std::move(cb));
+      return;
+    }
+
+    owner_->TouchHandle(this);
+    std::lock_guard<fibers::mutex> lk(open_mu_);
+    EnsureOpen();
+    WriteRecords(std::move(cb));
+    return;
+  }
+
+  std::lock_guard<fibers::mutex> lk(sort_mu_);
+  absl::optional<string> tmp_str;
+  while ((tmp_str = cb())) {
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(tmp_str->data());
+    const uint8_t* end = ptr + tmp_str->size();
+    uint32_t key_len = 0;
+
+    ptr = Varint::Parse32WithLimit(ptr, end, &key_len);
+    CHECK(ptr && key_len <= size_t(end - ptr))
+        << "Records of sorted outputs must be written with a sort key";
+    const char* key = reinterpret_cast<const char*>(ptr);
+    sorter_->Add(string(key, key_len), 0, string(key + key_len, end - ptr - key_len));
+  }
+}
+
+void DestHandle::Close(bool abort_write) {
+  std::unique_lock<fibers::mutex> open_lk(open_mu_, std::defer_lock);
+  if (budgeted_) {
+    // Only the sorted shards are written at this point.
+    if (sorter_ && !abort_write)
+      owner_->TouchHandle(this);
+    open_lk.lock();
+
+    // An evicted handle has closed its file already. The shards that were never written
+    // still create their file, like the handles without the budget.
+    if (!file_open_ && (abort_write || (files_opened_ && !sorter_))) {
+      sorter_.reset();
+      owner_->ReleaseHandle(this);
+      return;
+    }
+    EnsureOpen();
+  }
+
+  if (sorter_) {
+    std::lock_guard<fibers::mutex> lk(sort_mu_);
+    if (!abort_write) {
+      WriteSorted();
+    }
+    sorter_.reset();  // Deletes the spilled runs.
+  }
+  CloseFile(abort_write);
+
+  if (budgeted_) {
+    file_open_ = false;
+    owner_->ReleaseHandle(this);
+  }
+}
+
+void DestHandle::EnsureOpen() {
+  if (file_open_)
+    return;
+
+  // The shard continues in the next part file after the eviction.
+  if (files_opened_++) {
+    ++sub_shard_;
+    raw_size_ = 0;
+    full_path_ = owner_->ShardFilePath(sid_, sub_shard_);
+    owner_->handles_reopened_.fetch_add(1, std::memory_order_relaxed);
+    dest_handles.Inc("reopened");
+  }
+  Open();
+  file_open_ = true;
+}
+
+bool DestHandle::TryEvict() {
+  std::unique_lock<fibers::mutex> lk(open_mu_, std::try_to_lock);
+  if (!lk.owns_lock())
+    return false;
+
+  if (file_open_) {
+    VLOG(1) << "Evicting " << full_path_;
+    CloseFile(false);
+    file_open_ = false;
+  }
+  return true;
+}
+
+// Passes the sorted records to WriteRecords in the same chunks that BufferedWriter produces
+// for unsorted outputs.
+void DestHandle::WriteSorted() {
+  constexpr size_t kChunkLimit = 1 << 13;
+  const pb::WireFormat::Type type = owner_->output().format().type();
+
+  vector<string> items;
+  string buffer;
+  size_t chunk_size = 0, pos = 0;
+
+  StringGenCb gen_cb = [&]() -> absl::optional<std::string> {
+    if (type == pb::WireFormat::LST || type == pb::WireFormat::COLUMNAR) {
+      if (pos == items.size())
+        return absl::nullopt;
+      return std::move(items[pos++]);
+    }
+    if (buffer.empty())
+      return absl::nullopt;
+
+    string res;
+    res.swap(buffer);
+    return res;
+  };
+
+  auto flush = [&] {
+    if (!chunk_size)
+      return;
+    WriteRecords(gen_cb);
+    items.clear();
+    pos = chunk_size = 0;
+  };
+
+  sorter_->Merge([&](absl::string_view key, uint32_t index, RawRecord&& rr) {
+    chunk_size += rr.size() + 1;
+    switch (type) {
+      case pb::WireFormat::LST:
+      case pb::WireFormat::COLUMNAR:
+        items.push_back(std::move(rr));
+        break;
+      case pb::WireFormat::BATCH:
+        AppendToBatch(rr, &buffer);
+        break;
+      default:
+        buffer.append(rr).append("\n");
+    }
+    if (chunk_size >= kChunkLimit)
+      flush();
+  });
+  flush();
 }
 
 void DestHandle::WaitForPendingToFinish() {
@@ -485,18 +1023,25 @@ void DestHandle::GcsWriteFiber(IoContext* io_context) {
   net_queue_->Run();
 }
 
-void DestHandle::OpenWriteFileLocal() {
-  VLOG(1) << "Creating file " << full_path_;
+void DestHandle::OpenWriteFileLocal(const std::string& path) {
+  VLOG(1) << "Creating file " << path;
 
   if (is_gcs()) {
-    write_file_ =
-        CHECKED_GET(OpenGcsWriteFile(full_path_, *owner_->gce(), owner_->GetGceApiPool()));
+    if (FLAGS_dest_gcs_parallel_uploads) {
+      write_file_ = CHECKED_GET(OpenGcsParallelWriteFile(path, *owner_->gce(),
+                                                         owner_->GetGceApiPool(),
+                                                         FLAGS_dest_gcs_parallel_uploads,
+                                                         size_t(FLAGS_dest_gcs_part_mb) << 20));
+    } else {
+      write_file_ =
+          CHECKED_GET(OpenGcsWriteFile(path, *owner_->gce(), owner_->GetGceApiPool()));
+    }
   } else {
     // I can not use OpenFiberWriteFile here since it supports only synchronous semantics of
     // writing data (i.e. Write(StringPiece) where ownership stays with owner).
     // To support asynchronous writes we need to design an abstract class AsyncWriteFile
     // which should take ownership over data chunks that are passed to it for writing.
-    write_file_ = file::Open(full_path_);
+    write_file_ = file::Open(path);
   }
   CHECK(write_file_);
 }
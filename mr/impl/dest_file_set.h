@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <list>
+
 #include "absl/container/flat_hash_map.h"
 #include "absl/types/optional.h"
 #include "mr/mr3.pb.h"
@@ -28,11 +31,27 @@ namespace mr3 {
 namespace detail {
 
 class DestHandle;
+class ExternalSorter;
+class ShuffleStore;
+
+//! Returns the full path of the shard file under root_dir.
+//! if sub_shard is < 0, returns the glob of all files corresponding to this shard.
+std::string ShardFilePath(const std::string& root_dir, const pb::Output& out, const ShardId& key,
+                          int32 sub_shard);
+
+//! Outputs with sorted shards pass each record to DestHandle::Write prefixed with its sort key.
+std::string EncodeSortedRecord(absl::string_view key, absl::string_view record);
 
 /*! Designed to be process-central data structure holding all the destination handles during
  *  the operator execution.
+ *
+ *  With --dest_max_open_handles, at most that many file handles keep their files open. The least
+ *  recently written handle is evicted when the budget is exceeded: its file is flushed and closed
+ *  and the next write to its shard opens the next part file of the shard.
  */
 class DestFileSet {
+  friend class DestHandle;
+
   const std::string root_dir_;
   const pb::Output& pb_out_;
 
@@ -54,12 +73,29 @@ class DestFileSet {
   /// with DestFileSet.
   DestHandle* GetOrCreate(const ShardId& key);
 
+  //! Creates a handle that writes the shard into files, also for in-memory outputs.
+  //! The caller owns the handle.
+  std::unique_ptr<DestHandle> CreateFileHandle(const ShardId& key);
+
   util::fibers_ext::FiberQueueThreadPool* pool() { return &fq_; }
 
+  //! Returns the pool that compresses the output off the IO threads or null if the output
+  //! is not compressed.
+  util::fibers_ext::FiberQueueThreadPool* compress_pool() { return compress_pool_.get(); }
+
   std::vector<ShardId> GetShards() const;
 
   size_t HandleCount() const;
 
+  //! Lock-free counters for the status pages.
+  size_t handles_created() const { return handles_created_.load(std::memory_order_relaxed); }
+  size_t handles_evicted() const { return handles_evicted_.load(std::memory_order_relaxed); }
+  size_t handles_reopened() const { return handles_reopened_.load(std::memory_order_relaxed); }
+  uint64_t raw_bytes() const { return raw_bytes_.load(std::memory_order_relaxed); }
+
+  //! Called by the handles with the size of the data they got before compression.
+  void AddRawBytes(size_t sz) { raw_bytes_.fetch_add(sz, std::memory_order_relaxed); }
+
   /// Closes the handle but leaves it in the map.
   /// GatherAll will still return it.
   void CloseHandle(const ShardId& key);
@@ -79,6 +115,10 @@ class DestFileSet {
 
   const util::GCE* gce() const { return gce_; }
 
+  //! Set by the runner for in-memory outputs, the handles keep their shards in the store.
+  void set_shuffle_store(ShuffleStore* store) { shuffle_store_ = store; }
+  ShuffleStore* shuffle_store() { return shuffle_store_; }
+
   bool is_gcs_dest() const { return is_gcs_dest_; }
 
   util::IoContextPool* io_pool() { return &io_pool_; }
@@ -86,15 +126,36 @@ class DestFileSet {
  private:
   typedef absl::flat_hash_map<ShardId, std::unique_ptr<DestHandle>> HandleMap;
 
+  // Creates a file handle without opening its file.
+  std::unique_ptr<DestHandle> NewFileHandle(const ShardId& key);
+
+  // Marks dh as the most recently written handle and evicts the least recent ones above the
+  // budget. Must be called without holding the open_mu_ of any handle.
+  void TouchHandle(DestHandle* dh);
+
+  // Removes the closed handle from the open handles.
+  void ReleaseHandle(DestHandle* dh);
+
+  // Must outlive the handles since they enqueue into it until they are destroyed.
+  std::unique_ptr<util::fibers_ext::FiberQueueThreadPool> compress_pool_;
   HandleMap dest_files_;
   mutable ::boost::fibers::mutex handles_mu_;
 
   const util::GCE* gce_ = nullptr;
   PoolAccessorCb pool_accessor_;
+  ShuffleStore* shuffle_store_ = nullptr;
 
   util::IoContextPool& io_pool_;
   util::fibers_ext::FiberQueueThreadPool& fq_;
   bool is_gcs_dest_ = false;
+
+  // Handles with open files, the most recently written first. Used only with the budget.
+  std::list<DestHandle*> open_lru_;
+  ::boost::fibers::mutex lru_mu_;
+  size_t max_open_handles_;
+
+  std::atomic<size_t> handles_created_{0}, handles_evicted_{0}, handles_reopened_{0};
+  std::atomic<uint64_t> raw_bytes_{0};
 };
 
 /*! \class mr3::detail::DestHandle
@@ -115,10 +176,12 @@ class DestHandle {
 
   //! Writes 0 or many string records according to what cb returns.
   //! When cb is out of records, it will returns absl::nullopt.
-  virtual void Write(StringGenCb cb) = 0;
+  //! For sorted outputs the records are buffered until the handle is closed.
+  void Write(StringGenCb cb);
 
   // Thread-safe. Called from multiple threads/do_contexts.
-  virtual void Close(bool abort_write) = 0;
+  // Does not block unless the output is sorted, in which case it sorts the whole shard.
+  void Close(bool abort_write);
 
   void set_raw_limit(size_t raw_limit) { raw_limit_ = raw_limit; }
   const std::string full_path() const { return full_path_; }
@@ -134,8 +197,17 @@ class DestHandle {
 
   virtual void Open() = 0;
 
+  // Format specific implementations of Write and Close.
+  virtual void WriteRecords(StringGenCb cb) = 0;
+  virtual void CloseFile(bool abort_write) = 0;
+
   // Called only from IO thread.
-  void OpenWriteFileLocal();
+  void OpenWriteFileLocal(const std::string& path);
+
+  // Passes the records to the format specific writer of dest, bypassing its sorter.
+  static void ForwardRecords(DestHandle* dest, StringGenCb cb) {
+    dest->WriteRecords(std::move(cb));
+  }
 
   DestFileSet* owner_;
   ShardId sid_;
@@ -155,6 +227,28 @@ class DestHandle {
   std::unique_ptr<util::fibers_ext::FiberQueue> net_queue_;
   util::IoContext* net_context_ = nullptr;
   ::boost::fibers::fiber net_fiber_;
+
+ private:
+  // Writes all the sorted records and empties the sorter.
+  void WriteSorted();
+
+  // Opens the file of a budgeted handle if it is closed. Called under open_mu_.
+  void EnsureOpen();
+
+  // Closes the file unless the handle is being written. Called under DestFileSet::lru_mu_.
+  bool TryEvict();
+
+  // Set for the handles of DestFileSet::GetOrCreate under the open-handle budget. Their file
+  // is opened by the first write and open_mu_ serializes the writes with the eviction.
+  bool budgeted_ = false;
+  bool file_open_ = false, in_lru_ = false;
+  unsigned files_opened_ = 0;
+  std::list<DestHandle*>::iterator lru_pos_;
+  ::boost::fibers::mutex open_mu_;
+
+  // Set for sorted outputs.
+  std::unique_ptr<ExternalSorter> sorter_;
+  ::boost::fibers::mutex sort_mu_;
 };
 
 }  // namespace detail
@@ -0,0 +1,178 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/external_sorter.h"
+
+#include <boost/fiber/operations.hpp>
+#include <queue>
+
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "base/varint.h"
+#include "file/file.h"
+#include "file/list_file.h"
+
+namespace mr3 {
+namespace detail {
+
+using namespace std;
+using namespace boost;
+
+namespace {
+
+constexpr unsigned kYieldPeriod = 1000;
+
+inline void AppendEntry(absl::string_view key, uint32_t index, const RawRecord& record,
+                        string* dest) {
+  dest->clear();
+  Varint::Append32(dest, key.size());
+  dest->append(key.data(), key.size());
+  Varint::Append32(dest, index);
+  dest->append(record);
+}
+
+}  // namespace
+
+class ExternalSorter::RunReader {
+ public:
+  RunReader(const string& file_name, unsigned run_id)
+      : reader_(file_name, true), run_id_(run_id) {}
+
+  // Returns false when the run is exhausted.
+  bool Next();
+
+  unsigned run_id() const { return run_id_; }
+  Entry& current() { return current_; }
+
+ private:
+  file::ListReader reader_;
+  unsigned run_id_;
+  string scratch_;
+  Entry current_;
+};
+
+bool ExternalSorter::RunReader::Next() {
+  StringPiece rec;
+  if (!reader_.ReadRecord(&rec, &scratch_))
+    return false;
+
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(rec.data());
+  const uint8_t* end = ptr + rec.size();
+  uint32_t key_len = 0;
+
+  ptr = Varint::Parse32WithLimit(ptr, end, &key_len);
+  CHECK(ptr && ptr + key_len <= end) << "Corrupted run record";
+  current_.key.assign(reinterpret_cast<const char*>(ptr), key_len);
+  ptr += key_len;
+
+  ptr = Varint::Parse32WithLimit(ptr, end, &current_.index);
+  CHECK(ptr) << "Corrupted run record";
+  current_.record.assign(reinterpret_cast<const char*>(ptr), end - ptr);
+
+  return true;
+}
+
+ExternalSorter::ExternalSorter(const std::string& scratch_prefix, size_t mem_budget)
+    : scratch_prefix_(scratch_prefix), mem_budget_(mem_budget) {}
+
+ExternalSorter::~ExternalSorter() { DeleteRuns(); }
+
+void ExternalSorter::Add(std::string key, uint32_t index, RawRecord&& record) {
+  buffer_bytes_ += key.size() + record.size() + sizeof(Entry);
+  buffer_.push_back(Entry{std::move(key), index, std::move(record)});
+
+  if (buffer_bytes_ >= mem_budget_) {
+    Spill();
+  }
+}
+
+void ExternalSorter::SortBuffer() {
+  std::stable_sort(buffer_.begin(), buffer_.end(),
+                   [](const Entry& l, const Entry& r) { return l.key < r.key; });
+}
+
+void ExternalSorter::Spill() {
+  if (buffer_.empty())
+    return;
+
+  SortBuffer();
+
+  string file_name = absl::StrCat(scratch_prefix_, "-", run_files_.size(), ".lst");
+  VLOG(1) << "Spilling " << buffer_.size() << " records into " << file_name;
+
+  file::ListWriter writer(file_name);
+  CHECK_STATUS(writer.Init());
+
+  string tmp;
+  for (size_t i = 0; i < buffer_.size(); ++i) {
+    const Entry& e = buffer_[i];
+    AppendEntry(e.key, e.index, e.record, &tmp);
+    CHECK_STATUS(writer.AddRecord(tmp));
+
+    if (i % kYieldPeriod == 0) {
+      this_fiber::yield();
+    }
+  }
+  CHECK_STATUS(writer.Flush());
+
+  run_files_.push_back(std::move(file_name));
+  buffer_.clear();
+  buffer_bytes_ = 0;
+}
+
+void ExternalSorter::Merge(MergeCb cb) {
+  if (run_files_.empty()) {  // Fast path - everything fits in memory.
+    SortBuffer();
+    for (Entry& e : buffer_) {
+      cb(e.key, e.index, std::move(e.record));
+    }
+    buffer_.clear();
+    buffer_bytes_ = 0;
+    return;
+  }
+
+  Spill();
+
+  vector<unique_ptr<RunReader>> readers;
+  auto greater = [](RunReader* l, RunReader* r) {
+    int res = l->current().key.compare(r->current().key);
+    return res > 0 || (res == 0 && l->run_id() > r->run_id());
+  };
+  priority_queue<RunReader*, vector<RunReader*>, decltype(greater)> heap(greater);
+
+  for (unsigned i = 0; i < run_files_.size(); ++i) {
+    readers.emplace_back(new RunReader(run_files_[i], i));
+    if (readers.back()->Next()) {
+      heap.push(readers.back().get());
+    }
+  }
+
+  uint64_t cnt = 0;
+  while (!heap.empty()) {
+    RunReader* top = heap.top();
+    heap.pop();
+
+    Entry& e = top->current();
+    cb(e.key, e.index, std::move(e.record));
+
+    if (top->Next()) {
+      heap.push(top);
+    }
+    if (++cnt % kYieldPeriod == 0) {
+      this_fiber::yield();
+    }
+  }
+
+  readers.clear();
+  DeleteRuns();
+}
+
+void ExternalSorter::DeleteRuns() {
+  for (const auto& fn : run_files_) {
+    LOG_IF(WARNING, !file::Delete(fn)) << "Could not delete " << fn;
+  }
+  run_files_.clear();
+}
+
+}  // namespace detail
+}  // namespace mr3
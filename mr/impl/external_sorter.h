@@ -0,0 +1,62 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "mr/mr_types.h"
+
+namespace mr3 {
+namespace detail {
+
+/*! \class mr3::detail::ExternalSorter
+    \brief Sorts (key, input index, record) entries in bounded memory.
+
+    Entries are buffered in memory until their total size passes the memory budget. Then they
+    are sorted and spilled into a compressed LST run file. Merge() iterates over all the entries
+    in key order by k-way merging the runs. Entries with equal keys preserve their insertion
+    order. Not thread-safe, designed to be used by a single fiber.
+*/
+class ExternalSorter {
+ public:
+  using MergeCb = std::function<void(absl::string_view key, uint32_t index, RawRecord&& record)>;
+
+  //! Run files are created as <scratch_prefix>-<run>.lst.
+  ExternalSorter(const std::string& scratch_prefix, size_t mem_budget);
+  ~ExternalSorter();
+
+  void Add(std::string key, uint32_t index, RawRecord&& record);
+
+  //! Passes all the added entries to cb in key order and deletes the run files.
+  //! The sorter is empty afterwards.
+  void Merge(MergeCb cb);
+
+  size_t spilled_runs() const { return run_files_.size(); }
+
+ private:
+  struct Entry {
+    std::string key;
+    uint32_t index;
+    RawRecord record;
+  };
+
+  class RunReader;
+
+  void SortBuffer();
+  void Spill();
+  void DeleteRuns();
+
+  const std::string scratch_prefix_;
+  const size_t mem_budget_;
+
+  std::vector<Entry> buffer_;
+  size_t buffer_bytes_ = 0;
+  std::vector<std::string> run_files_;
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -19,6 +19,16 @@ public:
 
   FreqMapWrapper() {}
 
+  //! Wraps a sketch statistic, i.e. HyperLogLog, CountMinSketch or TDigest.
+  //! Sketch must provide Merge(const Sketch&).
+  template <class Sketch> static FreqMapWrapper FromSketch(Sketch&& sketch) {
+    using S = std::decay_t<Sketch>;
+    FreqMapWrapper res;
+    res.any_ = S(std::forward<Sketch>(sketch));
+    res.extra_functions_.reset(new SketchFunctionsImpl<S>);
+    return res;
+  }
+
   bool has_value() const { return any_.has_value(); }
   std::type_info type() const;
   void Add(const FreqMapWrapper& other);
@@ -32,6 +42,15 @@ public:
     return *absl::any_cast<FrequencyMap<T>>(&any_);
   }
 
+  template <class Sketch> Sketch& CastSketch() {
+    CheckType(typeid(Sketch));
+    return *absl::any_cast<Sketch>(&any_);
+  }
+  template <class Sketch> const Sketch& CastSketch() const {
+    CheckType(typeid(Sketch));
+    return *absl::any_cast<Sketch>(&any_);
+  }
+
 private:
   class ExtraFunctions {
   public:
@@ -53,6 +72,20 @@ private:
     }
   };
 
+  template <class Sketch>
+  class SketchFunctionsImpl : public ExtraFunctions {
+  public:
+    void Add(const FreqMapWrapper& other, FreqMapWrapper *that) override {
+      if (!other.has_value())
+        return;
+      if (!that->has_value()) { // Sketches have parameters, so we copy the first one.
+        that->any_ = other.CastSketch<Sketch>();
+        return;
+      }
+      that->CastSketch<Sketch>().Merge(other.CastSketch<Sketch>());
+    }
+  };
+
   static ExtraFunctions *ExtraFuncsFromNullablePair(const FreqMapWrapper*, const FreqMapWrapper*);
   void CheckType(const std::type_info& t) const;
 
@@ -0,0 +1,212 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/input_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "base/hash.h"
+#include "base/logging.h"
+#include "file/fiber_file.h"
+#include "file/file_util.h"
+
+namespace mr3 {
+namespace detail {
+
+using namespace std;
+using util::Status;
+using util::StatusObject;
+
+namespace {
+
+constexpr char kTmpSuffix[] = ".tmp";
+
+}  // namespace
+
+class InputCache::FillFile : public file::ReadonlyFile {
+ public:
+  FillFile(InputCache* cache, string name, string tmp_path, file::ReadonlyFile* remote,
+           file::WriteFile* dest)
+      : cache_(cache), name_(std::move(name)), tmp_path_(std::move(tmp_path)), remote_(remote),
+        dest_(dest) {}
+
+  ~FillFile() final {
+    if (dest_)
+      Abort();
+  }
+
+  StatusObject<size_t> Read(size_t offset, const strings::MutableByteRange& range) final {
+    auto res = remote_->Read(offset, range);
+    if (res.ok() && dest_) {
+      Append(offset, range.data(), res.obj);
+    }
+    return res;
+  }
+
+  Status Close() final;
+
+  size_t Size() const final { return remote_->Size(); }
+
+  int Handle() const final { return remote_->Handle(); }
+
+ private:
+  void Append(size_t offset, const uint8_t* data, size_t len);
+  void Abort();
+
+  InputCache* cache_;
+  const string name_, tmp_path_;
+  std::unique_ptr<file::ReadonlyFile> remote_;
+  file::WriteFile* dest_;
+  size_t written_ = 0;
+};
+
+Status InputCache::FillFile::Close() {
+  Status st = remote_->Close();
+  if (!dest_)
+    return st;
+
+  bool complete = st.ok() && written_ == remote_->Size();
+  bool closed = dest_->Close();  // deletes dest_.
+  dest_ = nullptr;
+
+  if (complete && closed) {
+    cache_->Commit(name_, tmp_path_, written_);
+  } else {
+    file::Delete(tmp_path_);
+  }
+  return st;
+}
+
+void InputCache::FillFile::Append(size_t offset, const uint8_t* data, size_t len) {
+  // A gap means the object is not read sequentially, so the copy can not be completed.
+  if (offset > written_) {
+    Abort();
+    return;
+  }
+  if (offset + len <= written_)
+    return;
+
+  size_t skip = written_ - offset;
+  Status st = dest_->Write(data + skip, len - skip);
+  if (!st.ok()) {
+    LOG(WARNING) << "Could not write " << tmp_path_ << ": " << st;
+    Abort();
+    return;
+  }
+  written_ += len - skip;
+}
+
+void InputCache::FillFile::Abort() {
+  dest_->Close();
+  dest_ = nullptr;
+  file::Delete(tmp_path_);
+}
+
+InputCache::InputCache(const std::string& dir, size_t max_bytes,
+                       util::fibers_ext::FiberQueueThreadPool* fq_pool)
+    : dir_(dir), max_bytes_(max_bytes), fq_pool_(fq_pool) {
+  if (!file::Exists(dir_)) {
+    CHECK(file_util::RecursivelyCreateDir(dir_, 0750)) << "Could not create dir " << dir_;
+  }
+
+  // Reuses the objects cached by the previous runs, the most recently modified first.
+  std::vector<file_util::StatShort> files = file_util::StatFiles(file_util::JoinPath(dir_, "*"));
+  std::sort(files.begin(), files.end(), [](const auto& l, const auto& r) {
+    return l.last_modified > r.last_modified;
+  });
+
+  for (const auto& fs : files) {
+    if (absl::EndsWith(fs.name, kTmpSuffix)) {
+      file::Delete(fs.name);  // Left by an interrupted run.
+      continue;
+    }
+    string name{file_util::GetNameFromPath(fs.name)};
+    lru_.push_back(Entry{name, size_t(fs.size)});
+    entries_.emplace(name, std::prev(lru_.end()));
+    stats_.cached_bytes += fs.size;
+  }
+
+  std::lock_guard<std::mutex> lk(mu_);
+  EvictLocked();
+  LOG(INFO) << "Input cache " << dir_ << " has " << lru_.size() << " objects, "
+            << stats_.cached_bytes << " bytes";
+}
+
+string InputCache::EntryName(const std::string& path, const std::string& generation) const {
+  return absl::StrCat(absl::Hex(base::Fingerprint(path), absl::kZeroPad16), "-", generation);
+}
+
+string InputCache::Lookup(const std::string& path, const std::string& generation) {
+  string name = EntryName(path, generation);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = entries_.find(name);
+  if (it == entries_.end()) {
+    ++stats_.misses;
+    return string{};
+  }
+
+  lru_.splice(lru_.begin(), lru_, it->second);
+  ++stats_.hits;
+  stats_.saved_bytes += it->second->size;
+
+  return file_util::JoinPath(dir_, name);
+}
+
+file::ReadonlyFile* InputCache::Fill(const std::string& path, const std::string& generation,
+                                     file::ReadonlyFile* remote) {
+  string name = EntryName(path, generation);
+  string tmp_path = file_util::JoinPath(dir_, absl::StrCat(name, ".", tmp_seq_++, kTmpSuffix));
+
+  auto res = file::OpenFiberWriteFile(tmp_path, fq_pool_);
+  if (!res.ok()) {
+    LOG(WARNING) << "Could not create " << tmp_path << ": " << res.status;
+    return remote;
+  }
+
+  return new FillFile(this, std::move(name), std::move(tmp_path), remote, res.obj);
+}
+
+void InputCache::Commit(const std::string& name, const std::string& tmp_path, size_t size) {
+  string path = file_util::JoinPath(dir_, name);
+
+  std::lock_guard<std::mutex> lk(mu_);
+  if (entries_.count(name)) {  // Was filled concurrently by another reader.
+    file::Delete(tmp_path);
+    return;
+  }
+
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Could not rename " << tmp_path << " into " << path;
+    file::Delete(tmp_path);
+    return;
+  }
+
+  lru_.push_front(Entry{name, size});
+  entries_.emplace(name, lru_.begin());
+  stats_.cached_bytes += size;
+  EvictLocked();
+}
+
+void InputCache::EvictLocked() {
+  while (stats_.cached_bytes > max_bytes_ && !lru_.empty()) {
+    const Entry& entry = lru_.back();
+    VLOG(1) << "Evicting " << entry.name << " of " << entry.size << " bytes";
+
+    file::Delete(file_util::JoinPath(dir_, entry.name));
+    stats_.cached_bytes -= entry.size;
+    entries_.erase(entry.name);
+    lru_.pop_back();
+  }
+}
+
+auto InputCache::GetStats() const -> Stats {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+}  // namespace detail
+}  // namespace mr3
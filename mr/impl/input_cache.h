@@ -0,0 +1,82 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "file/file.h"
+
+namespace util {
+namespace fibers_ext {
+class FiberQueueThreadPool;
+}  // namespace fibers_ext
+}  // namespace util
+
+namespace mr3 {
+namespace detail {
+
+/*! \class mr3::detail::InputCache
+    \brief LRU cache of remote input objects on a local disk.
+
+    An object is identified by its path and generation, so a rewritten object is never served
+    from a stale copy. Objects are cached while they are read: Fill() wraps the remote file
+    and copies every byte it reads into a temporary file, which enters the cache when the
+    object was read sequentially up to its end. Objects that are left the least recently used
+    are deleted when the cache grows beyond its size cap. The files that are found in the
+    cache directory on startup are reused. Thread-safe.
+*/
+class InputCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0, misses = 0;
+    uint64_t saved_bytes = 0;  // Bytes served from the cache instead of the remote storage.
+    uint64_t cached_bytes = 0;
+  };
+
+  InputCache(const std::string& dir, size_t max_bytes,
+             util::fibers_ext::FiberQueueThreadPool* fq_pool);
+
+  //! Returns the local path of the cached object or an empty string if it is not cached.
+  std::string Lookup(const std::string& path, const std::string& generation);
+
+  //! Takes ownership of remote and returns a file that fills the cache while it's read.
+  //! Returns remote itself if the temporary file can not be created.
+  file::ReadonlyFile* Fill(const std::string& path, const std::string& generation,
+                           file::ReadonlyFile* remote);
+
+  Stats GetStats() const;
+
+ private:
+  class FillFile;
+
+  struct Entry {
+    std::string name;
+    size_t size;
+  };
+
+  std::string EntryName(const std::string& path, const std::string& generation) const;
+
+  // Moves the complete temporary file into the cache.
+  void Commit(const std::string& name, const std::string& tmp_path, size_t size);
+
+  // Deletes the least recently used entries until the cache fits max_bytes_.
+  void EvictLocked();
+
+  const std::string dir_;
+  const size_t max_bytes_;
+  util::fibers_ext::FiberQueueThreadPool* fq_pool_;
+
+  mutable std::mutex mu_;
+  std::list<Entry> lru_;  // The most recently used entries are at the front.
+  absl::flat_hash_map<std::string, std::list<Entry>::iterator> entries_;
+  Stats stats_;
+  std::atomic_uint tmp_seq_{0};
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,52 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/input_filter.h"
+
+#include <sstream>
+
+#include "base/logging.h"
+#include "util/plang/plang_parser.hh"
+#include "util/plang/plang_program.h"
+#include "util/plang/plang_scanner.h"
+
+namespace mr3 {
+namespace detail {
+
+namespace gpb = ::google::protobuf;
+
+InputFilter::InputFilter(const std::string& expr, const std::string& type_name) {
+  std::unique_ptr<plang::Expr> parsed;
+  std::istringstream istr(expr);
+  plang::Scanner scanner(&istr);
+  plang::Parser parser(&scanner, &parsed);
+  CHECK_EQ(0, parser.parse()) << "Could not parse input filter " << expr;
+  CHECK(parsed) << "Empty input filter";
+
+  if (type_name.empty()) {
+    program_.reset(new plang::Program(*parsed, line_.GetDescriptor()));
+    return;
+  }
+
+  const gpb::Descriptor* descr = gpb::DescriptorPool::generated_pool()->FindMessageTypeByName(
+      type_name);
+  CHECK(descr) << "Input filter requires type " << type_name << " to be linked into the binary";
+  msg_.reset(gpb::MessageFactory::generated_factory()->GetPrototype(descr)->New());
+  program_.reset(new plang::Program(*parsed, descr));
+}
+
+InputFilter::~InputFilter() {}
+
+bool InputFilter::Match(StringPiece record) {
+  if (!msg_) {
+    line_.set_line(record.data(), record.size());
+    return program_->Eval(line_);
+  }
+
+  if (!msg_->ParseFromArray(record.data(), record.size()))
+    return true;
+  return program_->Eval(*msg_);
+}
+
+}  // namespace detail
+}  // namespace mr3
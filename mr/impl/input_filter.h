@@ -0,0 +1,49 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "mr/mr3.pb.h"
+#include "strings/stringpiece.h"
+
+namespace google {
+namespace protobuf {
+class Message;
+}  // namespace protobuf
+}  // namespace google
+
+namespace plang {
+class Program;
+}  // namespace plang
+
+namespace mr3 {
+namespace detail {
+
+/*! Compiled plang expression that is evaluated on the input records before they are passed
+    to the operators. Records of LST files are parsed as messages of type_name,
+    which must be linked into the binary. Text records are seen as pb::TextLine messages,
+    i.e. the expression refers to the record as "line".
+
+    Not thread-safe, each IO thread compiles its own filter.
+*/
+class InputFilter {
+ public:
+  //! Dies if expr can not be parsed. Empty type_name means text records.
+  InputFilter(const std::string& expr, const std::string& type_name);
+  ~InputFilter();
+
+  //! Returns true if the record should be processed. Records that can not be parsed
+  //! are passed through, so that the operators report them as parse errors.
+  bool Match(StringPiece record);
+
+ private:
+  std::unique_ptr<plang::Program> program_;
+  std::unique_ptr<::google::protobuf::Message> msg_;  // Not set for text records.
+  pb::TextLine line_;
+};
+
+}  // namespace detail
+}  // namespace mr3
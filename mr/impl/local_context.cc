@@ -5,6 +5,7 @@
 #include "mr/impl/local_context.h"
 
 #include "base/walltime.h"
+#include "mr/impl/record_batch.h"
 #include "util/asio/io_context.h"
 
 namespace mr3 {
@@ -21,7 +22,7 @@ class BufferedWriter {
 
  public:
   // dh not owned by BufferedWriter.
-  BufferedWriter(DestHandle* dh, bool is_binary);
+  BufferedWriter(DestHandle* dh, pb::WireFormat::Type type);
 
   BufferedWriter(const BufferedWriter&) = delete;
   ~BufferedWriter();
@@ -35,7 +36,7 @@ class BufferedWriter {
 
   void operator=(const BufferedWriter&) = delete;
 
-  bool is_binary_;
+  pb::WireFormat::Type type_;
 
   string buffer_;
   vector<string> items_;
@@ -45,8 +46,8 @@ class BufferedWriter {
   DestHandle::StringGenCb str_cb_;
 };
 
-BufferedWriter::BufferedWriter(DestHandle* dh, bool is_binary) : dh_(dh), is_binary_(is_binary) {
-  if (is_binary) {
+BufferedWriter::BufferedWriter(DestHandle* dh, pb::WireFormat::Type type) : dh_(dh), type_(type) {
+  if (type == pb::WireFormat::LST || type == pb::WireFormat::COLUMNAR) {
     str_cb_ = [this]() -> absl::optional<std::string> {
       if (items_.empty()) {
         return absl::nullopt;
@@ -55,7 +56,7 @@ BufferedWriter::BufferedWriter(DestHandle* dh, bool is_binary) : dh_(dh), is_bin
       items_.pop_back();
       return val;
     };
-  } else {
+  } else {  // TXT and BATCH pass the whole buffer as a single item.
     str_cb_ = [this]() -> absl::optional<std::string> {
       return buffer_.empty() ? absl::nullopt : absl::optional<std::string>{std::move(buffer_)};
     };
@@ -75,10 +76,16 @@ void BufferedWriter::Flush() {
 
 void BufferedWriter::Write(string&& val) {
   buffered_size_ += (val.size() + 1);
-  if (is_binary_) {
-    items_.push_back(std::move(val));
-  } else {
-    buffer_.append(val).append("\n");
+  switch (type_) {
+    case pb::WireFormat::LST:
+    case pb::WireFormat::COLUMNAR:
+      items_.push_back(std::move(val));
+      break;
+    case pb::WireFormat::BATCH:
+      AppendToBatch(val, &buffer_);
+      break;
+    default:
+      buffer_.append(val).append("\n");
   }
 
   VLOG_IF(2, ++writes_ % 1000 == 0) << "BufferedWrite " << writes_;
@@ -106,12 +113,21 @@ void LocalContext::WriteInternal(const ShardId& shard_id, std::string&& record)
   auto it = custom_shard_files_.find(shard_id);
   if (it == custom_shard_files_.end()) {
     DestHandle* res = mgr_->GetOrCreate(shard_id);
-    bool is_binary = mgr_->output().format().type() == pb::WireFormat::LST;
-    it = custom_shard_files_.emplace(shard_id, new BufferedWriter{res, is_binary}).first;
+    pb::WireFormat::Type type = mgr_->output().format().type();
+
+    // Sorted handles need the records one by one, as they are passed in LST.
+    if (mgr_->output().sorted())
+      type = pb::WireFormat::LST;
+    it = custom_shard_files_.emplace(shard_id, new BufferedWriter{res, type}).first;
   }
   it->second->Write(std::move(record));
 }
 
+void LocalContext::WriteSortedInternal(const ShardId& shard_id, std::string&& key,
+                                       std::string&& record) {
+  WriteInternal(shard_id, EncodeSortedRecord(key, record));
+}
+
 void LocalContext::Flush() {
   for (auto& k_v : custom_shard_files_) {
     k_v.second->Flush();
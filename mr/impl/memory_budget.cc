@@ -0,0 +1,101 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/memory_budget.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "util/asio/io_context_pool.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_uint32(mr_memory_budget_mb, 0,
+              "Memory budget of the buffers of a run, split between the IO threads. "
+              "Readers pause and output files are flushed early when a thread is near its "
+              "budget. 0 disables the accounting.");
+
+namespace mr3 {
+namespace detail {
+
+using namespace std;
+
+namespace {
+
+std::mutex budgets_mu;
+const util::IoContextPool* budgets_pool = nullptr;
+
+// Budgets are never deleted since charges may outlive the run that created them.
+vector<unique_ptr<MemoryBudget>> budgets, retired_budgets;
+
+util::VarzValue::Map GetBudgetStats() {
+  util::VarzValue::Map res;
+
+  std::lock_guard<std::mutex> lk(budgets_mu);
+  for (size_t i = 0; i < budgets.size(); ++i) {
+    const MemoryBudget& mb = *budgets[i];
+    util::VarzValue::Map thread_stats;
+    thread_stats.emplace_back("used", util::VarzValue::FromInt(mb.used()));
+    thread_stats.emplace_back("peak", util::VarzValue::FromInt(mb.peak()));
+    thread_stats.emplace_back("limit", util::VarzValue::FromInt(mb.limit()));
+    thread_stats.emplace_back("waits", util::VarzValue::FromInt(mb.waits()));
+    thread_stats.emplace_back("wait-usec", util::VarzValue::FromInt(mb.wait_usec()));
+    res.emplace_back(absl::StrCat("io", i), std::move(thread_stats));
+  }
+  return res;
+}
+
+util::VarzFunction budget_varz("mr-memory-budget", GetBudgetStats);
+
+}  // namespace
+
+thread_local MemoryBudget* MemoryBudget::this_thread_ = nullptr;
+
+void MemoryBudget::Charge(size_t bytes) {
+  size_t used = used_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = peak_.load(std::memory_order_relaxed);
+  while (used > peak && !peak_.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+  }
+}
+
+void MemoryBudget::Release(size_t bytes) {
+  size_t prev = used_.fetch_sub(bytes, std::memory_order_relaxed);
+  DCHECK_GE(prev, bytes);
+  release_ec_.notifyAll();
+}
+
+void MemoryBudget::AddWait(uint64_t usec) {
+  waits_.fetch_add(1, std::memory_order_relaxed);
+  wait_usec_.fetch_add(usec, std::memory_order_relaxed);
+}
+
+void MemoryBudget::Setup(util::IoContextPool* pool) {
+  if (FLAGS_mr_memory_budget_mb == 0)
+    return;
+
+  std::unique_lock<std::mutex> lk(budgets_mu);
+  if (budgets_pool != pool || budgets.size() != pool->size()) {
+    size_t limit = (size_t(FLAGS_mr_memory_budget_mb) << 20) / pool->size();
+    for (auto& mb : budgets) {
+      retired_budgets.push_back(std::move(mb));
+    }
+    budgets.clear();
+    for (size_t i = 0; i < pool->size(); ++i) {
+      budgets.emplace_back(new MemoryBudget(limit));
+    }
+    budgets_pool = pool;
+    LOG(INFO) << "Memory budget of " << limit << " bytes per IO thread";
+  }
+  lk.unlock();
+
+  // Assigned on every call since another pool may have been created at the same address.
+  pool->AwaitOnAll([](unsigned index, util::IoContext&) {
+    std::lock_guard<std::mutex> lk(budgets_mu);
+    this_thread_ = budgets[index].get();
+  });
+}
+
+}  // namespace detail
+}  // namespace mr3
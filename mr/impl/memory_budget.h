@@ -0,0 +1,79 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "base/walltime.h"
+#include "util/fibers/event_count.h"
+
+namespace util {
+class IoContextPool;
+}  // namespace util
+
+namespace mr3 {
+namespace detail {
+
+/*! \class mr3::detail::MemoryBudget
+    \brief Accounts the memory that the components of a run buffer on a single IO thread.
+
+    --mr_memory_budget_mb is split evenly between the IO threads of the pool. Components charge
+    the bytes they buffer and release them, possibly from another thread, once the bytes are
+    consumed. Producers call AwaitBelowLimit() before they buffer more data, components that can
+    flush or spill check NearLimit() to do it early. Thread-safe.
+*/
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t limit) : limit_(limit) {}
+
+  void Charge(size_t bytes);
+  void Release(size_t bytes);
+
+  bool OverLimit() const { return used() >= limit_; }
+
+  //! True when 7/8 of the budget are used.
+  bool NearLimit() const { return used() >= limit_ - limit_ / 8; }
+
+  //! Blocks the calling fiber while the budget is exceeded and stop() returns false.
+  //! stop() is evaluated whenever bytes are released, it lets the producer proceed when
+  //! nothing it waits for can release the budget.
+  template <typename Pred> void AwaitBelowLimit(Pred&& stop);
+
+  size_t used() const { return used_.load(std::memory_order_relaxed); }
+  size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+  size_t limit() const { return limit_; }
+  uint64_t waits() const { return waits_.load(std::memory_order_relaxed); }
+  uint64_t wait_usec() const { return wait_usec_.load(std::memory_order_relaxed); }
+
+  //! Creates the budgets of the IO threads of pool if --mr_memory_budget_mb is set.
+  //! Must be called from a non-IO thread, does nothing for the pool that was already set up.
+  static void Setup(util::IoContextPool* pool);
+
+  //! Returns the budget of the calling IO thread or null if the budgets are disabled.
+  static MemoryBudget* ThisThread() { return this_thread_; }
+
+ private:
+  void AddWait(uint64_t usec);
+
+  const size_t limit_;
+  std::atomic<size_t> used_{0}, peak_{0};
+  std::atomic<uint64_t> waits_{0}, wait_usec_{0};
+  util::fibers_ext::EventCount release_ec_;
+
+  static thread_local MemoryBudget* this_thread_;
+};
+
+template <typename Pred> void MemoryBudget::AwaitBelowLimit(Pred&& stop) {
+  if (!OverLimit() || stop())
+    return;
+
+  uint64_t start = base::GetMonotonicMicrosFast();
+  release_ec_.await([&] { return !OverLimit() || stop(); });
+  AddWait(base::GetMonotonicMicrosFast() - start);
+}
+
+}  // namespace detail
+}  // namespace mr3
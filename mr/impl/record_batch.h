@@ -0,0 +1,43 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include "absl/strings/string_view.h"
+#include "base/varint.h"
+
+namespace mr3 {
+namespace detail {
+
+/*! Encoding of pb::WireFormat::BATCH records.
+ *
+ *  Each LST record of a BATCH file holds many serialized records, each prefixed with its
+ *  Varint32 length. It amortizes the per-record framing, checksumming and buffer management
+ *  of the LST layer for operator-to-operator edges.
+ */
+inline void AppendToBatch(absl::string_view record, std::string* batch) {
+  Varint::Append32(batch, record.size());
+  batch->append(record.data(), record.size());
+}
+
+//! Calls cb(absl::string_view) for each record in the batch, the views point into batch.
+//! Returns the number of records or -1 if the batch is corrupted.
+template <typename Cb> int64_t ParseBatch(absl::string_view batch, Cb&& cb) {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(batch.data());
+  const uint8_t* end = ptr + batch.size();
+  int64_t cnt = 0;
+
+  while (ptr < end) {
+    uint32_t len = 0;
+    ptr = Varint::Parse32WithLimit(ptr, end, &len);
+    if (!ptr || len > size_t(end - ptr))
+      return -1;
+    cb(absl::string_view(reinterpret_cast<const char*>(ptr), len));
+    ptr += len;
+    ++cnt;
+  }
+  return cnt;
+}
+
+}  // namespace detail
+}  // namespace mr3
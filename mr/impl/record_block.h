@@ -0,0 +1,90 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace mr3 {
+namespace detail {
+
+/*! Consecutive records of an input that a reading fiber hands to its map fiber at once.
+ *
+ *  The records are stored back to back in a single buffer and are returned as views into it,
+ *  so once the buffer has grown a block costs no allocations per record. Blocks come from
+ *  a RecordBlockPool and return to it when their last reference is released.
+ */
+class RecordBlock {
+ public:
+  //! pos is the position of the record in its input, the records of a block have
+  //! consecutive positions.
+  void Add(uint64_t pos, absl::string_view record) {
+    if (ends_.empty())
+      first_pos_ = pos;
+    data_.append(record.data(), record.size());
+    ends_.push_back(data_.size());
+  }
+
+  size_t size() const { return ends_.size(); }
+  size_t bytes() const { return data_.size(); }
+
+  absl::string_view operator[](size_t i) const {
+    size_t begin = i ? ends_[i - 1] : 0;
+    return absl::string_view(data_.data() + begin, ends_[i] - begin);
+  }
+
+  uint64_t position(size_t i) const { return first_pos_ + i; }
+
+  void Clear() {
+    data_.clear();
+    ends_.clear();
+  }
+
+ private:
+  std::string data_;
+  std::vector<size_t> ends_;
+  uint64_t first_pos_ = 0;
+};
+
+using RecordBlockPtr = std::shared_ptr<RecordBlock>;
+
+//! Recycles the blocks of a reading fiber. Not thread-safe, the blocks must be released
+//! on the thread of the pool and before the pool is destroyed.
+class RecordBlockPool {
+ public:
+  RecordBlockPtr Get() {
+    RecordBlock* block;
+    if (free_.empty()) {
+      block = new RecordBlock;
+    } else {
+      block = free_.back().release();
+      free_.pop_back();
+    }
+    return RecordBlockPtr(block, [this](RecordBlock* b) { Recycle(b); });
+  }
+
+  size_t free_blocks() const { return free_.size(); }
+
+ private:
+  // The buffers of the blocks with oversized records are not kept.
+  static constexpr size_t kMaxPooledBytes = 1 << 20;
+  static constexpr size_t kMaxFreeBlocks = 64;
+
+  void Recycle(RecordBlock* block) {
+    if (block->bytes() > kMaxPooledBytes || free_.size() >= kMaxFreeBlocks) {
+      delete block;
+      return;
+    }
+    block->Clear();
+    free_.emplace_back(block);
+  }
+
+  std::vector<std::unique_ptr<RecordBlock>> free_;
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,32 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <cmath>
+
+#include "absl/strings/string_view.h"
+#include "base/hash.h"
+#include "base/integral_types.h"
+
+namespace mr3 {
+namespace detail {
+
+//! Returns the hash threshold of the sample of the given rate. Items are sampled by the hash
+//! of their key, so the sample is the same on every run, and the sample of a lower rate is
+//! a subset of the sample of a higher one.
+inline uint64_t SampleThreshold(double rate) {
+  double val = std::ldexp(rate, 64);
+  return val >= double(kuint64max) ? kuint64max : uint64_t(val);
+}
+
+inline uint64_t SampleHash(absl::string_view key) {
+  return base::Fingerprint(key.data(), key.size());
+}
+
+inline bool InSample(absl::string_view key, uint64_t threshold) {
+  return threshold == kuint64max || SampleHash(key) < threshold;
+}
+
+}  // namespace detail
+}  // namespace mr3
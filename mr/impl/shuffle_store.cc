@@ -0,0 +1,56 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/shuffle_store.h"
+
+#include "base/logging.h"
+
+namespace mr3 {
+namespace detail {
+
+using namespace std;
+
+void ShuffleStore::Release(size_t bytes, bool spilled) {
+  used_.fetch_sub(bytes, std::memory_order_relaxed);
+  if (spilled) {
+    lock_guard<mutex> lk(mu_);
+    ++spilled_shards_;
+  }
+}
+
+void ShuffleStore::Publish(const std::string& path, std::unique_ptr<Shard> shard) {
+  VLOG(1) << "Keeping " << path << " in memory, " << shard->bytes << " bytes";
+
+  lock_guard<mutex> lk(mu_);
+  auto res = shards_.emplace(path, std::move(shard));
+  CHECK(res.second) << "Shard " << path << " was already stored";
+}
+
+auto ShuffleStore::Find(const std::string& path) const -> const Shard* {
+  lock_guard<mutex> lk(mu_);
+  auto it = shards_.find(path);
+
+  return it == shards_.end() ? nullptr : it->second.get();
+}
+
+void ShuffleStore::Clear() {
+  lock_guard<mutex> lk(mu_);
+  for (const auto& k_v : shards_) {
+    used_.fetch_sub(k_v.second->bytes, std::memory_order_relaxed);
+  }
+  shards_.clear();
+}
+
+auto ShuffleStore::GetStats() const -> Stats {
+  Stats res;
+  res.bytes = used_.load(std::memory_order_relaxed);
+
+  lock_guard<mutex> lk(mu_);
+  res.shards = shards_.size();
+  res.spilled_shards = spilled_shards_;
+
+  return res;
+}
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,71 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "mr/mr3.pb.h"
+
+namespace mr3 {
+namespace detail {
+
+/*! \class mr3::detail::ShuffleStore
+    \brief Keeps the shards of in-memory outputs (Output::InMemory) of a LocalRunner.
+
+    A shard is stored under the path of its shard file as the chunks that its destination
+    handle received: records for LST and COLUMNAR outputs, newline terminated buffers for TXT
+    and record batches for BATCH outputs. The handles charge the bytes they buffer while the
+    operator runs; once the store exceeds its limit they write their shards into files instead.
+    Stored shards are kept until Clear() since any later operator may read them. Thread-safe.
+*/
+class ShuffleStore {
+ public:
+  struct Shard {
+    pb::WireFormat::Type type;
+    std::string type_name;
+    std::vector<std::string> chunks;
+    size_t bytes = 0;
+  };
+
+  struct Stats {
+    uint64_t shards = 0, spilled_shards = 0;
+    uint64_t bytes = 0;
+  };
+
+  explicit ShuffleStore(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  //! Charges bytes that a handle buffers. Returns false if the store exceeds its limit.
+  bool Charge(size_t bytes) {
+    return used_.fetch_add(bytes, std::memory_order_relaxed) + bytes <= max_bytes_;
+  }
+
+  //! Releases the bytes of a shard that was dropped or written into files.
+  void Release(size_t bytes, bool spilled);
+
+  //! Stores the shard under path. Its bytes must have been charged.
+  void Publish(const std::string& path, std::unique_ptr<Shard> shard);
+
+  //! Returns the shard stored under path or null. The shard stays valid until Clear().
+  const Shard* Find(const std::string& path) const;
+
+  void Clear();
+
+  Stats GetStats() const;
+
+ private:
+  const size_t max_bytes_;
+  std::atomic<size_t> used_{0};
+
+  mutable std::mutex mu_;
+  absl::flat_hash_map<std::string, std::unique_ptr<Shard>> shards_;
+  uint64_t spilled_shards_ = 0;
+};
+
+}  // namespace detail
+}  // namespace mr3
@@ -0,0 +1,214 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/impl/sketches.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "base/logging.h"
+
+namespace mr3 {
+
+namespace {
+
+// Finalizer of MurmurHash3. absl::Hash does not guarantee well distributed high bits.
+inline uint64_t Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+}  // namespace
+
+HyperLogLog::HyperLogLog(unsigned precision) : precision_(precision) {
+  CHECK(precision >= 4 && precision <= 18) << precision;
+  registers_.resize(1U << precision);
+}
+
+void HyperLogLog::AddHash(uint64_t hash) {
+  hash = Mix(hash);
+  uint64_t index = hash >> (64 - precision_);
+  uint64_t rest = hash << precision_;
+  unsigned max_rank = 64 - precision_ + 1;
+  uint8_t rank = rest ? std::min<unsigned>(__builtin_clzll(rest) + 1, max_rank) : max_rank;
+  registers_[index] = std::max(registers_[index], rank);
+}
+
+uint64_t HyperLogLog::Estimate() const {
+  double m = registers_.size();
+  double sum = 0;
+  unsigned zeros = 0;
+  for (uint8_t r : registers_) {
+    sum += std::ldexp(1.0, -r);
+    zeros += (r == 0);
+  }
+
+  double alpha = 0.7213 / (1 + 1.079 / m);
+  double estimate = alpha * m * m / sum;
+
+  // Linear counting is more accurate for small cardinalities.
+  if (estimate <= 2.5 * m && zeros) {
+    estimate = m * std::log(m / zeros);
+  }
+  return std::llround(estimate);
+}
+
+void HyperLogLog::Merge(const HyperLogLog& other) {
+  CHECK_EQ(precision_, other.precision_);
+  for (size_t i = 0; i < registers_.size(); ++i) {
+    registers_[i] = std::max(registers_[i], other.registers_[i]);
+  }
+}
+
+CountMinSketch::CountMinSketch(unsigned width, unsigned depth) : width_(width), depth_(depth) {
+  CHECK_GT(width, 0);
+  CHECK_GT(depth, 0);
+  counters_.resize(size_t(width) * depth);
+}
+
+size_t CountMinSketch::Index(unsigned row, uint64_t hash) const {
+  // Derives the row hashes from two halves of a single hash (Kirsch-Mitzenmacher).
+  uint64_t h1 = uint32_t(hash), h2 = (hash >> 32) | 1;
+  return size_t(row) * width_ + (h1 + row * h2) % width_;
+}
+
+void CountMinSketch::AddHash(uint64_t hash, uint64_t count) {
+  hash = Mix(hash);
+  for (unsigned i = 0; i < depth_; ++i) {
+    counters_[Index(i, hash)] += count;
+  }
+  total_count_ += count;
+}
+
+uint64_t CountMinSketch::EstimateHash(uint64_t hash) const {
+  hash = Mix(hash);
+  uint64_t res = counters_[Index(0, hash)];
+  for (unsigned i = 1; i < depth_; ++i) {
+    res = std::min(res, counters_[Index(i, hash)]);
+  }
+  return res;
+}
+
+void CountMinSketch::Merge(const CountMinSketch& other) {
+  CHECK_EQ(width_, other.width_);
+  CHECK_EQ(depth_, other.depth_);
+  for (size_t i = 0; i < counters_.size(); ++i) {
+    counters_[i] += other.counters_[i];
+  }
+  total_count_ += other.total_count_;
+}
+
+TDigest::TDigest(double compression) : compression_(compression) {
+  CHECK_GT(compression, 1);
+}
+
+void TDigest::Add(double val, double weight) {
+  if (total_weight() == 0) {
+    min_ = max_ = val;
+  } else {
+    min_ = std::min(min_, val);
+    max_ = std::max(max_, val);
+  }
+
+  buffer_.push_back(Centroid{val, weight});
+  buffer_weight_ += weight;
+  if (buffer_.size() >= 8 * compression_) {
+    Compress();
+  }
+}
+
+void TDigest::Merge(const TDigest& other) {
+  CHECK_EQ(compression_, other.compression_);
+  if (other.total_weight() == 0)
+    return;
+
+  if (total_weight() == 0) {
+    min_ = other.min_;
+    max_ = other.max_;
+  } else {
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  buffer_.insert(buffer_.end(), other.centroids_.begin(), other.centroids_.end());
+  buffer_.insert(buffer_.end(), other.buffer_.begin(), other.buffer_.end());
+  buffer_weight_ += other.total_weight();
+  Compress();
+}
+
+void TDigest::Compress() {
+  if (buffer_.empty())
+    return;
+
+  buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+  std::sort(buffer_.begin(), buffer_.end(),
+            [](const Centroid& l, const Centroid& r) { return l.mean < r.mean; });
+
+  total_weight_ += buffer_weight_;
+  buffer_weight_ = 0;
+  centroids_.clear();
+
+  // A centroid may grow while its weight stays below the bound at its quantile.
+  // The bound is smaller near the tails, hence they are more accurate.
+  Centroid cur = buffer_.front();
+  double weight_so_far = 0;
+  for (size_t i = 1; i < buffer_.size(); ++i) {
+    const Centroid& next = buffer_[i];
+    double q = (weight_so_far + cur.weight + next.weight / 2) / total_weight_;
+    double limit = 4 * total_weight_ * q * (1 - q) / compression_;
+
+    if (cur.weight + next.weight <= limit) {
+      cur.weight += next.weight;
+      cur.mean += (next.mean - cur.mean) * next.weight / cur.weight;
+    } else {
+      weight_so_far += cur.weight;
+      centroids_.push_back(cur);
+      cur = next;
+    }
+  }
+  centroids_.push_back(cur);
+  buffer_.clear();
+}
+
+double TDigest::Quantile(double q) const {
+  if (!buffer_.empty()) {
+    TDigest copy(*this);
+    copy.Compress();
+    return copy.Quantile(q);
+  }
+
+  if (centroids_.empty())
+    return 0;
+  if (centroids_.size() == 1)
+    return centroids_.front().mean;
+
+  // Interpolates between the centers of the adjacent centroids.
+  double target = std::min(std::max(q, 0.0), 1.0) * total_weight_;
+  const Centroid& first = centroids_.front();
+  if (target < first.weight / 2) {
+    return min_ + (first.mean - min_) * target / (first.weight / 2);
+  }
+
+  double center = first.weight / 2;
+  for (size_t i = 1; i < centroids_.size(); ++i) {
+    const Centroid& prev = centroids_[i - 1];
+    const Centroid& cur = centroids_[i];
+    double next_center = center + (prev.weight + cur.weight) / 2;
+    if (target < next_center) {
+      return prev.mean + (cur.mean - prev.mean) * (target - center) / (next_center - center);
+    }
+    center = next_center;
+  }
+
+  const Centroid& last = centroids_.back();
+  double tail = total_weight_ - center;
+  if (tail <= 0)
+    return max_;
+  return last.mean + (max_ - last.mean) * std::min(1.0, (target - center) / tail);
+}
+
+}  // namespace mr3
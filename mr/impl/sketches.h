@@ -0,0 +1,100 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/hash/hash.h"
+
+namespace mr3 {
+
+/*! Approximate statistics with a fixed memory footprint. Each IO thread fills its own
+    instance and the instances are merged when the operator finishes, similarly to
+    FrequencyMap. Instances are merged only with instances that were constructed with the same
+    parameters. Hash values are stable only within a single process.
+*/
+
+//! Estimates the number of distinct items. Uses 2^precision bytes, the standard error
+//! is about 1.04 / sqrt(2^precision), i.e. 0.8% for the default precision.
+class HyperLogLog {
+ public:
+  explicit HyperLogLog(unsigned precision = 14);
+
+  template <typename T> void Add(const T& val) { AddHash(absl::Hash<T>{}(val)); }
+  void AddHash(uint64_t hash);
+
+  uint64_t Estimate() const;
+
+  void Merge(const HyperLogLog& other);
+
+  unsigned precision() const { return precision_; }
+
+ private:
+  unsigned precision_;
+  std::vector<uint8_t> registers_;
+};
+
+//! Estimates the counts of items. Never underestimates, the overestimation is at most
+//! e / width * total_count with probability 1 - exp(-depth).
+class CountMinSketch {
+ public:
+  explicit CountMinSketch(unsigned width = 1 << 14, unsigned depth = 4);
+
+  template <typename T> void Add(const T& val, uint64_t count = 1) {
+    AddHash(absl::Hash<T>{}(val), count);
+  }
+  void AddHash(uint64_t hash, uint64_t count = 1);
+
+  template <typename T> uint64_t Estimate(const T& val) const {
+    return EstimateHash(absl::Hash<T>{}(val));
+  }
+  uint64_t EstimateHash(uint64_t hash) const;
+
+  void Merge(const CountMinSketch& other);
+
+  uint64_t total_count() const { return total_count_; }
+
+ private:
+  size_t Index(unsigned row, uint64_t hash) const;
+
+  unsigned width_, depth_;
+  uint64_t total_count_ = 0;
+  std::vector<uint64_t> counters_;  // depth_ rows of width_ counters.
+};
+
+//! Estimates quantiles of a distribution, i.e. latencies. Keeps about 2 * compression centroids.
+//! The accuracy is better near the tails, which is where the quantiles are usually asked.
+class TDigest {
+ public:
+  explicit TDigest(double compression = 100);
+
+  void Add(double val, double weight = 1);
+
+  //! q must be in [0, 1]. Returns 0 if the digest is empty.
+  double Quantile(double q) const;
+
+  void Merge(const TDigest& other);
+
+  double total_weight() const { return total_weight_ + buffer_weight_; }
+  double min() const { return min_; }
+  double max() const { return max_; }
+
+ private:
+  struct Centroid {
+    double mean;
+    double weight;
+  };
+
+  // Merges buffer_ into centroids_.
+  void Compress();
+
+  double compression_;
+  std::vector<Centroid> centroids_;  // Sorted by mean.
+  std::vector<Centroid> buffer_;     // Added values that were not merged yet.
+  double total_weight_ = 0, buffer_weight_ = 0;
+  double min_ = 0, max_ = 0;
+};
+
+}  // namespace mr3
@@ -4,6 +4,8 @@
 #pragma once
 
 #include <functional>
+#include <utility>
+#include <vector>
 
 #include "base/type_traits.h"
 #include "mr/do_context.h"
@@ -57,6 +59,28 @@ base::void_t<decltype(&Handler::OnShardStart)> NotifyShardStartMaybe(Handler* h,
 
 template <typename Handler> void NotifyShardStartMaybe(Handler*, const ShardId&, char) {}
 
+template <typename Handler, typename ToType>
+base::void_t<decltype(&Handler::OnGroupFinish)> GroupFinishCallMaybe(Handler* h,
+                                                                      DoContext<ToType>* cntx,
+                                                                      int) {
+  h->OnGroupFinish(cntx);
+};
+
+template <typename Handler, typename ToType>
+void GroupFinishCallMaybe(Handler* h, DoContext<ToType>* cntx, char c) {}
+
+//! A joiner handler declares "static constexpr bool kMergeableShards = true" if its output
+//! stays correct when each shard is split into parts that are handled independently,
+//! i.e. with OnShardStart/OnShardFinish called per part, possibly in different fibers.
+template <typename Handler, typename = void> struct IsMergeable : std::false_type {};
+
+template <typename Handler>
+struct IsMergeable<Handler, base::void_t<decltype(Handler::kMergeableShards)>>
+    : std::integral_constant<bool, Handler::kMergeableShards> {};
+
+//! Extracts the grouping key from a raw record. Used by the sorted grouping mode of the joiner.
+using RawKeyFn = std::function<std::string(bool is_binary, const RawRecord& rr)>;
+
 /// Optionally set type_name if RecordTraits<OutType>::TypeName() exists.
 template <typename OutType>
 base::void_t<decltype(&RecordTraits<OutType>::TypeName)> WriteTypeNameMaybe(pb::Output* outp, int) {
@@ -106,20 +130,29 @@ class HandlerWrapperBase {
 
   RawSinkCb Get(size_t index) const { return raw_fn_vec_[index]; }
 
+  // Set only for mappers that implement DoBatch. Replaces Get(0) when not empty.
+  const RawBatchCb& GetBatch() const { return raw_batch_fn_; }
+
   size_t Size() const { return raw_fn_vec_.size(); }
 
   // Called by joiner_executor, or sometimes by handler via DoContext.
   virtual void SetGroupingShard(const ShardId& sid) = 0;
   virtual void OnShardFinish() {}
 
+  // Called by joiner_executor in sorted grouping mode after the last record of each key.
+  virtual void OnGroupFinish() {}
+
  protected:
   template <typename F> void AddFn(F&& f) { raw_fn_vec_.emplace_back(std::forward<F>(f)); }
+  template <typename F> void SetBatchFn(F&& f) { raw_batch_fn_ = std::forward<F>(f); }
 
  private:
   std::vector<RawSinkCb> raw_fn_vec_;
+  RawBatchCb raw_batch_fn_;
 };
 
-template <typename T> class DefaultParser {
+//! Parses records with RecordTraits<T>. mr_pb.h specializes it for protobuf messages.
+template <typename T, typename = void> class DefaultParser {
   RecordTraits<T> rt_;
   static_assert(std::is_copy_constructible<RecordTraits<T>>::value,
                 "RecordTraits must be copyable");
@@ -132,16 +165,137 @@ template <typename T> class DefaultParser {
   }
 };
 
+//! Parses the records of a broadcast table and indexes them by key_fn.
+//! The first record of each key is kept.
+template <typename K, typename T, typename KeyFn>
+class BroadcastBuilder : public BroadcastBuilderBase {
+  std::shared_ptr<BroadcastMap<K, T>> map_{std::make_shared<BroadcastMap<K, T>>()};
+  DefaultParser<T> parser_;
+  KeyFn key_fn_;
+  size_t duplicates_ = 0;
+
+ public:
+  explicit BroadcastBuilder(KeyFn key_fn) : key_fn_(std::move(key_fn)) {}
+
+  bool Add(bool is_binary, RawRecord&& rr) final {
+    T val;
+    if (!parser_(is_binary, std::move(rr), &val))
+      return false;
+
+    K key = key_fn_(val);
+    if (!map_->emplace(std::move(key), std::move(val)).second)
+      ++duplicates_;
+    return true;
+  }
+
+  size_t duplicates() const final { return duplicates_; }
+
+  BroadcastMapWrapper Finalize() final {
+    return BroadcastMapWrapper{std::shared_ptr<const BroadcastMap<K, T>>(std::move(map_))};
+  }
+};
+
+//! The record that a parser fills and that is passed to the handler afterwards.
+//! Records live on the stack unless the parser owns their memory, i.e. allocates them on an
+//! arena with Allocate() and reclaims it with Release().
+template <typename T, typename Parser, typename = void> class ParsedRecord {
+  T val_;
+
+ public:
+  explicit ParsedRecord(Parser*) {}
+  T* get() { return &val_; }
+};
+
+template <typename T, typename Parser>
+class ParsedRecord<T, Parser, base::void_t<decltype(std::declval<Parser&>().Allocate())>> {
+  Parser* parser_;
+  T* val_;
+
+ public:
+  explicit ParsedRecord(Parser* parser) : parser_(parser), val_(parser->Allocate()) {}
+  ParsedRecord(const ParsedRecord&) = delete;
+  ~ParsedRecord() { parser_->Release(val_); }
+
+  T* get() { return val_; }
+};
+
+//! Parsers that own their records also support parsing into the records of the previous
+//! batch, which keeps their allocated fields.
+template <typename Parser, typename = void> struct ReusesRecords : std::false_type {};
+template <typename Parser>
+struct ReusesRecords<Parser, base::void_t<decltype(std::declval<Parser&>().Allocate())>>
+    : std::true_type {};
+
 template <typename FromType, typename Parser, typename DoFn, typename ToType>
 void ParseAndDo(Parser* parser, DoContext<ToType>* context, DoFn&& do_fn, RawRecord&& rr) {
-  FromType tmp_rec;
+  RawContext* raw = context->raw();
+  absl::optional<CpuSample> sample;
+  if (raw->ShouldSampleCpu()) {
+    sample.emplace();
+    raw->StartCpuSample(&sample.value());
+  }
+
+  ParsedRecord<FromType, Parser> tmp_rec(parser);
   bool is_binary = context->is_binary();
-  bool parse_ok = (*parser)(is_binary, std::move(rr), &tmp_rec);
+  bool parse_ok = (*parser)(is_binary, std::move(rr), tmp_rec.get());
+
+  if (sample)
+    sample->Mark(CPU_PARSE);
 
   if (parse_ok) {
-    do_fn(std::move(tmp_rec), context);
+    do_fn(std::move(*tmp_rec.get()), context);
   } else {
-    context->raw()->EmitParseError();
+    raw->EmitParseError();
+  }
+
+  if (sample) {
+    sample->Mark(CPU_DO);
+    raw->FinishCpuSample();
+  }
+}
+
+/// Parses the batch into vals and calls do_fn once with the records that were parsed.
+/// vals is owned by the caller and keeps its capacity between the batches. If the parser
+/// reuses records, vals also keeps the records themselves.
+template <typename FromType, typename Parser, typename DoFn, typename ToType>
+void ParseAndDoBatch(Parser* parser, DoContext<ToType>* context, DoFn&& do_fn,
+                     absl::Span<RawRecord> records, std::vector<FromType>* vals) {
+  RawContext* raw = context->raw();
+  absl::optional<CpuSample> sample;
+  if (raw->ShouldSampleCpu()) {
+    sample.emplace();
+    raw->StartCpuSample(&sample.value());
+  }
+
+  bool is_binary = context->is_binary();
+  size_t count = 0;
+  if (!ReusesRecords<Parser>::value) {
+    vals->clear();
+  }
+  for (auto& rr : records) {
+    if (count == vals->size()) {
+      vals->emplace_back();
+    }
+    if ((*parser)(is_binary, std::move(rr), &(*vals)[count])) {
+      ++count;
+    } else {
+      if (!ReusesRecords<Parser>::value) {
+        vals->pop_back();
+      }
+      raw->EmitParseError();
+    }
+  }
+
+  if (sample)
+    sample->Mark(CPU_PARSE);
+
+  if (count) {
+    do_fn(absl::MakeSpan(vals->data(), count), context);
+  }
+
+  if (sample) {
+    sample->Mark(CPU_DO);
+    raw->FinishCpuSample();
   }
 }
 
@@ -165,7 +319,12 @@ template <typename Handler, typename ToType> class HandlerWrapper : public Handl
   }
 
   // We pass 0 into 3rd argument so compiler will prefer 'int' resolution if possible.
-  void OnShardFinish() final { FinishCallMaybe(&h_.value(), &do_ctx_, 0); }
+  void OnShardFinish() final {
+    FinishCallMaybe(&h_.value(), &do_ctx_, 0);
+    do_ctx_.FlushCombiner();
+  }
+
+  void OnGroupFinish() final { GroupFinishCallMaybe(&h_.value(), &do_ctx_, 0); }
 
   /// Add DoFn into processing pipeline. This DoFn may accept any free FnInputType instead of
   /// FromType as long as FromType can be moved into it. We create a wrapping handler
@@ -181,9 +340,84 @@ template <typename Handler, typename ToType> class HandlerWrapper : public Handl
     });
   }
 
+  /// Sets the batch entry point for mappers that implement
+  /// DoBatch(absl::Span<FromType>, DoContext<ToType>*).
+  template <typename FromType, typename FnInputType>
+  void AddBatch(void (Handler::*ptr)(absl::Span<FnInputType>, DoContext<ToType>*)) {
+    static_assert(std::is_same<std::remove_const_t<FnInputType>, FromType>::value,
+                  "MapperType::DoBatch must accept absl::Span of the type accepted by Do");
+
+    SetBatchFn([this, ptr, parser = DefaultParser<FromType>{},
+                vals = std::vector<FromType>{}](absl::Span<RawRecord> records) mutable {
+      ParseAndDoBatch<FromType>(&parser, &do_ctx_,
+                                [this, ptr](absl::Span<FromType> span, DoContext<ToType>* cntx) {
+                                  ((*h_).*ptr)(span, cntx);
+                                },
+                                records, &vals);
+    });
+  }
+
   void AddFromFactory(const RawSinkMethodFactory<Handler, ToType>& f) {
     AddFn(f(&h_.value(), &do_ctx_));
   }
+
+  /// Returns DoFn that accepts already parsed records. Used by fused mappers.
+  template <typename FromType, typename FnInputType>
+  std::function<void(FromType&&)> TypedFn(void (Handler::*ptr)(FnInputType, DoContext<ToType>*)) {
+    return [this, ptr](FromType&& val) { ((*h_).*ptr)(std::move(val), &do_ctx_); };
+  }
+
+  //! Redirects all the writes of the handler into sink instead of the output.
+  void SetFusedSink(std::function<void(ToType&&)> sink) { do_ctx_.fused_sink_ = std::move(sink); }
+};
+
+template <typename Handler, typename FromType, typename ToType>
+base::void_t<decltype(&Handler::DoBatch)> AddBatchMaybe(HandlerWrapper<Handler, ToType>* w,
+                                                         int) {
+  w->template AddBatch<FromType>(&Handler::DoBatch);
+}
+
+template <typename Handler, typename FromType, typename ToType>
+void AddBatchMaybe(HandlerWrapper<Handler, ToType>* w, char) {}
+
+template <typename ToType>
+using FusedFactory =
+    std::function<HandlerWrapperBase*(RawContext* context, std::function<void(ToType&&)> sink)>;
+
+/*! Runs two consecutive mappers in the same pass. Records written by the upstream mapper
+    are moved directly into Handler::Do without being serialized.
+*/
+template <typename Handler, typename FromType, typename ToType>
+class FusedHandlerWrapper : public HandlerWrapperBase {
+  HandlerWrapper<Handler, ToType> downstream_;
+  std::unique_ptr<HandlerWrapperBase> upstream_;
+
+ public:
+  template <typename... Args>
+  FusedHandlerWrapper(const Output<ToType>& out, RawContext* raw_context,
+                      const FusedFactory<FromType>& upstream_factory, Args&&... args)
+      : downstream_(out, raw_context, std::forward<Args>(args)...) {
+    upstream_.reset(
+        upstream_factory(raw_context, downstream_.template TypedFn<FromType>(&Handler::Do)));
+    for (size_t i = 0; i < upstream_->Size(); ++i) {
+      AddFn(upstream_->Get(i));
+    }
+    // The batch is consumed by the first mapper of the chain.
+    SetBatchFn(upstream_->GetBatch());
+  }
+
+  // Fused chains consist only of mappers, the upstream mappers do not have outputs.
+  void SetGroupingShard(const ShardId& sid) final { downstream_.SetGroupingShard(sid); }
+
+  // Upstream mappers flush first since they may still write into the downstream.
+  void OnShardFinish() final {
+    upstream_->OnShardFinish();
+    downstream_.OnShardFinish();
+  }
+
+  void SetFusedSink(std::function<void(ToType&&)> sink) {
+    downstream_.SetFusedSink(std::move(sink));
+  }
 };
 
 template <typename T, typename Parser = DefaultParser<T>>
@@ -195,9 +429,9 @@ class IdentityHandlerWrapper : public HandlerWrapperBase {
   IdentityHandlerWrapper(const Output<T>& out, Parser parser, RawContext* raw_context)
       : do_ctx_(out, raw_context), parser_(std::move(parser)) {
     AddFn([this](RawRecord&& rr) {
-      T val;
-      if (parser_(do_ctx_.is_binary(), std::move(rr), &val)) {
-        do_ctx_.Write(std::move(val));
+      ParsedRecord<T, Parser> val(&parser_);
+      if (parser_(do_ctx_.is_binary(), std::move(rr), val.get())) {
+        do_ctx_.Write(std::move(*val.get()));
       } else {
         do_ctx_.raw()->EmitParseError();
       }
@@ -205,6 +439,8 @@ class IdentityHandlerWrapper : public HandlerWrapperBase {
   }
 
   void SetGroupingShard(const ShardId& sid) final {}
+
+  void OnShardFinish() final { do_ctx_.FlushCombiner(); }
 };
 
 class TableBase : public std::enable_shared_from_this<TableBase> {
@@ -225,6 +461,12 @@ class TableBase : public std::enable_shared_from_this<TableBase> {
   // that will use the handler. DO NOT SHARE THE HANDLER BETWEEN FIBERS.
   HandlerWrapperBase* CreateHandler(RawContext* context);
 
+  //! Non-empty if the joiner groups its inputs by key. Index corresponds to the handler input.
+  const std::vector<RawKeyFn>& group_sort_keys() const { return group_sort_keys_; }
+
+  //! True if the joiner handler declared kMergeableShards.
+  bool mergeable_shards() const { return mergeable_shards_; }
+
  protected:
   TableBase(pb::Operator op, Pipeline* owner) : op_(std::move(op)), pipeline_(owner) {}
   virtual ~TableBase() = 0;
@@ -238,7 +480,13 @@ class TableBase : public std::enable_shared_from_this<TableBase> {
   }
 
   void CheckFailIdentity() const;
+
+  //! True if the table is a mapper without output. Such mapper is fused with its consumers.
+  bool IsFusableMap() const {
+    return !is_identity_ && op_.type() == pb::Operator::MAP && !op_.has_output();
+  }
   static void ValidateGroupInputOrDie(const TableBase* other);
+  static void ValidateSortKeysOrDie(const std::string& name, size_t num_keys, size_t num_inputs);
 
   pb::Operator CreateMapOp(const std::string& name) const;
 
@@ -256,6 +504,10 @@ class TableBase : public std::enable_shared_from_this<TableBase> {
 
   std::function<HandlerWrapperBase*(RawContext* context)> handler_factory_;
   bool is_identity_ = true;
+
+ protected:
+  std::vector<RawKeyFn> group_sort_keys_;
+  bool mergeable_shards_ = false;
 };
 
 // I need TableImplT because I bind TableBase functions to output object contained in the class.
@@ -281,13 +533,26 @@ template <typename OutT> class TableImplT : public TableBase {
   template <typename MapType, typename FromType, typename... Args>
   static std::shared_ptr<TableImplT<OutT>> AsMapFrom(const std::string& name,
                                                      TableImplT<FromType>* ptr, Args&&... args) {
+    if (ptr->IsFusableMap()) {
+      return AsFusedMapFrom<MapType>(name, ptr, std::forward<Args>(args)...);
+    }
+
     pb::Operator map_op = ptr->CreateMapOp(name);
     auto result = std::make_shared<TableImplT<OutT>>(std::move(map_op), ptr->pipeline());
     result->SetHandlerFactory([& out = result->output_, args...](RawContext* raw_ctxt) {
       auto* ptr = new HandlerWrapper<MapType, OutT>(out, raw_ctxt, args...);
       ptr->template Add<FromType>(&MapType::Do);
+      AddBatchMaybe<MapType, FromType>(ptr, 0);
       return ptr;
     });
+    result->fused_factory_ = [& out = result->output_, args...](
+                                 RawContext* raw_ctxt, std::function<void(OutT&&)> sink) {
+      auto* ptr = new HandlerWrapper<MapType, OutT>(out, raw_ctxt, args...);
+      ptr->template Add<FromType>(&MapType::Do);
+      AddBatchMaybe<MapType, FromType>(ptr, 0);
+      ptr->SetFusedSink(std::move(sink));
+      return ptr;
+    };
 
     return result;
   }
@@ -298,6 +563,32 @@ template <typename OutT> class TableImplT : public TableBase {
     return result;
   }
 
+  // Mapping over a mapper without output. Both run in the same pass of the upstream operator.
+  template <typename MapType, typename FromType, typename... Args>
+  static std::shared_ptr<TableImplT<OutT>> AsFusedMapFrom(const std::string& name,
+                                                          TableImplT<FromType>* ptr,
+                                                          Args&&... args) {
+    pb::Operator map_op = ptr->op();
+    map_op.set_op_name(name);
+
+    // Upstream table is not registered in the pipeline, hence we extend its lifetime.
+    auto upstream = std::static_pointer_cast<TableImplT<FromType>>(ptr->shared_from_this());
+    auto result = std::make_shared<TableImplT<OutT>>(std::move(map_op), ptr->pipeline());
+
+    using Wrapper = FusedHandlerWrapper<MapType, FromType, OutT>;
+    result->SetHandlerFactory([& out = result->output_, upstream, args...](RawContext* raw_ctxt) {
+      return new Wrapper(out, raw_ctxt, upstream->fused_factory_, args...);
+    });
+    result->fused_factory_ = [& out = result->output_, upstream, args...](
+                                 RawContext* raw_ctxt, std::function<void(OutT&&)> sink) {
+      auto* ptr = new Wrapper(out, raw_ctxt, upstream->fused_factory_, args...);
+      ptr->SetFusedSink(std::move(sink));
+      return ptr;
+    };
+
+    return result;
+  }
+
   template <typename U> std::shared_ptr<TableImplT<U>> Rebind() const {
     CheckFailIdentity();
     auto result = std::make_shared<TableImplT<U>>(op(), pipeline());
@@ -310,6 +601,14 @@ template <typename OutT> class TableImplT : public TableBase {
     return HandlerBinding<Handler, ToType>::template Create<OutT>(this, ptr);
   }
 
+  template <typename Handler, typename ToType, typename U, typename KeyFn>
+  HandlerBinding<Handler, ToType> BindWith(EmitMemberFn<U, Handler, ToType> ptr,
+                                           KeyFn&& key_fn) const {
+    auto res = HandlerBinding<Handler, ToType>::template Create<OutT>(this, ptr);
+    res.template SetSortKey<OutT>(std::forward<KeyFn>(key_fn));
+    return res;
+  }
+
   template <typename GrouperType, typename... Args>
   static std::shared_ptr<TableImplT<OutT>> AsGroup(
       const std::string& name,
@@ -321,14 +620,21 @@ template <typename OutT> class TableImplT : public TableBase {
     op.set_type(pb::Operator::GROUP);
 
     std::vector<RawSinkMethodFactory<GrouperType, OutT>> factories;
+    std::vector<RawKeyFn> sort_keys;
 
     for (auto& arg : mapper_bindings) {
       ValidateGroupInputOrDie(arg.tbase());
       op.add_input_name(arg.tbase()->op().output().name());
       factories.push_back(arg.factory());
+      if (arg.sort_key()) {
+        sort_keys.push_back(arg.sort_key());
+      }
     }
+    ValidateSortKeysOrDie(name, sort_keys.size(), factories.size());
 
     auto result = std::make_shared<TableImplT<OutT>>(std::move(op), owner);
+    result->group_sort_keys_ = std::move(sort_keys);
+    result->mergeable_shards_ = IsMergeable<GrouperType>::value;
     result->SetHandlerFactory(
         [& out = result->output_, factories = std::move(factories), args...](RawContext* raw_ctxt) {
           auto* ptr = new HandlerWrapper<GrouperType, OutT>(out, raw_ctxt, args...);
@@ -342,6 +648,7 @@ template <typename OutT> class TableImplT : public TableBase {
 
  private:
   Output<OutT> output_;
+  FusedFactory<OutT> fused_factory_;  // Set only for mappers.
 };
 
 template <typename Handler, typename ToType> class HandlerBinding {
@@ -364,12 +671,28 @@ template <typename Handler, typename ToType> class HandlerBinding {
     return res;
   }
 
+  /// Sets the grouping key of the bound input. The key is computed from FromType records
+  /// before they are sorted, therefore each record is parsed twice.
+  template <typename FromType, typename KeyFn> void SetSortKey(KeyFn&& key_fn) {
+    static_assert(base::is_invocable_r<std::string, KeyFn, const FromType&>::value, "");
+
+    sort_key_ = [key_fn = std::forward<KeyFn>(key_fn), parser = DefaultParser<FromType>{}](
+                    bool is_binary, const RawRecord& rr) mutable {
+      FromType tmp_rec;
+      if (!parser(is_binary, RawRecord(rr), &tmp_rec))
+        return std::string{};  // The record will fail parsing again when it is handled.
+      return std::string(key_fn(tmp_rec));
+    };
+  }
+
   const TableBase* tbase() const { return tbase_; }
   RawSinkMethodFactory<Handler, ToType> factory() const { return setup_func_; }
+  const RawKeyFn& sort_key() const { return sort_key_; }
 
  private:
   const TableBase* tbase_;
   RawSinkMethodFactory<Handler, ToType> setup_func_;
+  RawKeyFn sort_key_;
 };
 
 }  // namespace detail
@@ -3,14 +3,28 @@
 //
 #include "mr/joiner_executor.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/fiber/buffered_channel.hpp>
+#include <queue>
+
+#include "absl/strings/str_cat.h"
 #include "base/logging.h"
 #include "base/walltime.h"
+#include "file/file_util.h"
+#include "mr/impl/external_sorter.h"
 #include "mr/impl/table_impl.h"
 #include "mr/pipeline.h"
 #include "mr/runner.h"
 #include "util/asio/io_context_pool.h"
 #include "util/stats/varz_stats.h"
 
+DEFINE_uint32(join_sort_budget_mb, 512,
+              "Per IO thread memory budget for sorted grouping in joiners. "
+              "Records above the budget are spilled to disk.");
+DEFINE_string(join_spill_dir, "/tmp", "Directory for temporary sorted runs of joiners.");
+
 namespace mr3 {
 
 using namespace boost;
@@ -26,6 +40,23 @@ ShardId GetShard(const pb::Input::FileSpec& fspec) {
   return ShardId{fspec.custom_shard_id()};
 }
 
+constexpr size_t kMergeQueueSize = 64;  // Must be a power of 2.
+
+// A sorted shard file that is read by its own fiber during the merge.
+struct MergeStream {
+  uint32_t index;  // handler input.
+  unsigned id;     // breaks the ties between the files of the same input.
+  bool is_binary;
+
+  fibers::buffered_channel<RawRecord> queue{kMergeQueueSize};
+  fibers::fiber reader;
+
+  RawRecord record;
+  string key, prev_key;
+
+  MergeStream(uint32_t i, unsigned sid, bool binary) : index(i), id(sid), is_binary(binary) {}
+};
+
 }  // namespace
 
 JoinerExecutor::JoinerExecutor(util::IoContextPool* pool, Runner* runner)
@@ -43,27 +74,56 @@ void JoinerExecutor::Run(const std::vector<const InputBase*>& inputs, detail::Ta
   util::VarzFunction varz_func("joiner", [this] { return GetStats(); });
 
   CheckInputs(inputs);
+  StartProgress(&tb->op());
 
   // ProcessInputQ uses runner_ immediately when starts.
   runner_->OperatorStart(&tb->op());
 
   pool_->AwaitOnAll([&](unsigned index, IoContext&) {
+    SetIoIndex(index);
     per_io_.reset(new PerIoStruct(index));
-    per_io_->raw_context.reset(runner_->CreateContext());
+    per_io_->raw_context.reset(runner_->CreateContext(&tb->op()));
     per_io_->process_fd.emplace_back(&JoinerExecutor::ProcessInputQ, this, tb);
   });
 
+  // Sub-shards of mergeable handlers are dispatched separately, so that a single
+  // oversized shard is spread over all the IO threads.
+  bool split_sub_shards = tb->mergeable_shards() && tb->group_sort_keys().empty();
+
   std::map<ShardId, std::vector<IndexedInput>> shard_inputs;
+  std::vector<ShardInput> sub_shard_inputs;
   for (uint32_t i = 0; i < inputs.size(); ++i) {
     const pb::Input& input = inputs[i]->msg();
+    bool has_sub_shards = inputs[i]->linked_outp()->shard_spec().has_max_raw_size_mb();
+    bool is_sorted = inputs[i]->linked_outp()->sorted();
+
     for (const auto& fspec : input.file_spec()) {
       ShardId sid = GetShard(fspec);
-      shard_inputs[sid].emplace_back(IndexedInput{i, &fspec, &input.format()});
+      if (split_sub_shards && has_sub_shards) {
+        runner_->ExpandGlob(fspec.url_glob(), [&](size_t sz, const string& file_name) {
+          sub_shard_inputs.emplace_back(
+              sid, std::vector<IndexedInput>{IndexedInput{i, &fspec, &input.format(), file_name}});
+        });
+      } else {
+        shard_inputs[sid].emplace_back(
+            IndexedInput{i, &fspec, &input.format(), fspec.url_glob(), is_sorted});
+      }
     }
   }
 
   LOG(INFO) << "Started joining on " << tb->op().op_name() << " with " << shard_inputs.size()
-            << " shards";
+            << " shards and " << sub_shard_inputs.size() << " sub-shards";
+  progress_.inputs_total = shard_inputs.size() + sub_shard_inputs.size();
+  progress_.inputs_expanded = true;
+
+  // Pushing sub-shards first since they are usually the largest.
+  for (auto& si : sub_shard_inputs) {
+    VLOG(1) << "Pushing sub-shard " << si.second.front().file_name;
+
+    channel_op_status st = input_q_.push(std::move(si));
+    CHECK_EQ(channel_op_status::success, st);
+  }
+
   for (auto& k_v : shard_inputs) {
     VLOG(1) << "Pushing shard " << k_v.first;
 
@@ -78,14 +138,16 @@ void JoinerExecutor::Run(const std::vector<const InputBase*>& inputs, detail::Ta
     FinalizeContext(per_io_->raw_context.get());
     per_io_.reset();
   });
+  MergeFreqMaps();
 
   const string& op_name = tb->op().op_name();
   LOG_IF(WARNING, parse_errors_ > 0) << op_name << " had " << parse_errors_.load() << " errors";
   for (const auto& k_v : metric_map_) {
     LOG(INFO) << op_name << "-" << k_v.first << ": " << k_v.second;
   }
+  LOG(INFO) << op_name << " cpu breakdown: " << cpu_breakdown_.ToString();
 
-  runner_->OperatorEnd(out_files);
+  runner_->OperatorEnd(&tb->op(), out_files);
 }
 
 void JoinerExecutor::CheckInputs(const std::vector<const InputBase*>& inputs) {
@@ -123,7 +185,8 @@ void JoinerExecutor::ProcessInputQ(detail::TableBase* tb) {
   RawContext *raw_context = per_io_->raw_context.get();
   RegisterContext(raw_context);
 
-  raw_context->InitPerFiber();
+  RawContext::PerFiber per_fiber;
+  raw_context->BindPerFiber(&per_fiber);
 
   std::unique_ptr<detail::HandlerWrapperBase> handler_wrapper{tb->CreateHandler(raw_context)};
 
@@ -133,28 +196,192 @@ void JoinerExecutor::ProcessInputQ(detail::TableBase* tb) {
       break;
 
     CHECK_EQ(channel_op_status::success, st);
-    SetCurrentShard(shard_input.first, raw_context);
+    SetCurrentShard(shard_input.first, &per_fiber);
     handler_wrapper->SetGroupingShard(shard_input.first);
 
     VLOG(1) << "Processing shard " << shard_input.first;
 
-    for (const IndexedInput& ii : shard_input.second) {
-      CHECK_LT(ii.index, handler_wrapper->Size());
-      RawSinkCb emit_cb = handler_wrapper->Get(ii.index);
-      bool is_binary = detail::IsBinary(ii.wf->type());
-
-      SetFileName(is_binary, ii.fspec->url_glob(), raw_context);
-      SetMetaData(*ii.fspec, raw_context);
-      uint64_t cnt = runner_->ProcessInputFile(ii.fspec->url_glob(), ii.wf->type(), emit_cb);
-      raw_context->IncBy("fn-calls", cnt);
+    if (!tb->group_sort_keys().empty()) {
+      bool all_sorted = std::all_of(shard_input.second.begin(), shard_input.second.end(),
+                                    [](const IndexedInput& ii) { return ii.is_sorted; });
+      if (all_sorted) {
+        ProcessMergedShard(*tb, shard_input, handler_wrapper.get(), &per_fiber);
+      } else {
+        ProcessSortedShard(*tb, shard_input, handler_wrapper.get(), &per_fiber);
+      }
+    } else {
+      for (const IndexedInput& ii : shard_input.second) {
+        CHECK_LT(ii.index, handler_wrapper->Size());
+        RawSinkCb emit_cb = handler_wrapper->Get(ii.index);
+        bool is_binary = detail::IsBinary(ii.wf->type());
+
+        SetFileName(is_binary, ii.file_name, &per_fiber);
+        SetMetaData(*ii.fspec, &per_fiber);
+        uint64_t cnt = runner_->ProcessInputFile(ii.file_name, ii.wf->type(), emit_cb);
+        raw_context->IncBy("fn-calls", cnt);
+        progress_.records[per_io_->index].fetch_add(cnt, std::memory_order_relaxed);
+      }
     }
     auto start = base::GetMonotonicMicrosFast();
     handler_wrapper->OnShardFinish();
     finish_shard_latency_sum_.fetch_add(base::GetMonotonicMicrosFast() - start,
                                         std::memory_order_relaxed);
     finish_shard_latency_cnt_.fetch_add(1, std::memory_order_acq_rel);
+    progress_.inputs_done.fetch_add(1, std::memory_order_relaxed);
   }
   VLOG(1) << "ProcessInputQ finished processing";
 }
 
+void JoinerExecutor::ProcessSortedShard(const detail::TableBase& tb, const ShardInput& shard_input,
+                                        detail::HandlerWrapperBase* handler_wrapper,
+                                        RawContext::PerFiber* per_fiber) {
+  RawContext* raw_context = per_io_->raw_context.get();
+  const auto& sort_keys = tb.group_sort_keys();
+
+  string prefix = file_util::JoinPath(
+      FLAGS_join_spill_dir, absl::StrCat(tb.op().op_name(), "-", getpid(), "-", per_io_->index));
+  detail::ExternalSorter sorter(prefix, size_t(FLAGS_join_sort_budget_mb) << 20);
+
+  // Records from each input are keyed with their input index, so that the handler receives them
+  // through the same callbacks as in the unsorted mode.
+  for (const IndexedInput& ii : shard_input.second) {
+    CHECK_LT(ii.index, handler_wrapper->Size());
+    bool is_binary = detail::IsBinary(ii.wf->type());
+    const detail::RawKeyFn& key_fn = sort_keys[ii.index];
+
+    auto add_cb = [&](RawRecord&& rr) {
+      sorter.Add(key_fn(is_binary, rr), ii.index, std::move(rr));
+    };
+    uint64_t cnt = runner_->ProcessInputFile(ii.file_name, ii.wf->type(), add_cb);
+    raw_context->IncBy("fn-calls", cnt);
+    progress_.records[per_io_->index].fetch_add(cnt, std::memory_order_relaxed);
+  }
+
+  if (sorter.spilled_runs()) {
+    raw_context->IncBy("join-spilled-runs", sorter.spilled_runs());
+  }
+
+  vector<RawSinkCb> emit_cbs(handler_wrapper->Size());
+  vector<bool> binary_inputs(emit_cbs.size());
+  for (const IndexedInput& ii : shard_input.second) {
+    emit_cbs[ii.index] = handler_wrapper->Get(ii.index);
+    binary_inputs[ii.index] = detail::IsBinary(ii.wf->type());
+  }
+  SetFileName(false, shard_input.first.ToString(tb.op().op_name()), per_fiber);
+
+  bool has_group = false;
+  string group_key;
+  auto merge_cb = [&](absl::string_view key, uint32_t index, RawRecord&& rr) {
+    if (!has_group || key != group_key) {
+      if (has_group)
+        handler_wrapper->OnGroupFinish();
+      group_key.assign(key.data(), key.size());
+      has_group = true;
+    }
+    SetIsBinary(binary_inputs[index], per_fiber);
+    emit_cbs[index](std::move(rr));
+  };
+  sorter.Merge(merge_cb);
+
+  if (has_group) {
+    handler_wrapper->OnGroupFinish();
+  }
+}
+
+void JoinerExecutor::ProcessMergedShard(const detail::TableBase& tb, const ShardInput& shard_input,
+                                        detail::HandlerWrapperBase* handler_wrapper,
+                                        RawContext::PerFiber* per_fiber) {
+  RawContext* raw_context = per_io_->raw_context.get();
+  const auto& sort_keys = tb.group_sort_keys();
+
+  vector<unique_ptr<MergeStream>> streams;
+  uint64_t cnt = 0;
+
+  // Each input may consist of several sorted files, e.g. one per worker.
+  for (const IndexedInput& ii : shard_input.second) {
+    CHECK_LT(ii.index, handler_wrapper->Size());
+    pb::WireFormat::Type type = ii.wf->type();
+
+    runner_->ExpandGlob(ii.file_name, [&](size_t sz, const string& file_name) {
+      streams.emplace_back(new MergeStream(ii.index, streams.size(), detail::IsBinary(type)));
+      MergeStream* ms = streams.back().get();
+
+      ms->reader = fibers::fiber([this, ms, file_name, type, &cnt] {
+        this_fiber::properties<IoFiberProperties>().set_name("MergeReader");
+        cnt += runner_->ProcessInputFile(file_name, type, [ms](RawRecord&& rr) {
+          channel_op_status st = ms->queue.push(std::move(rr));
+          CHECK_EQ(channel_op_status::success, st);
+        });
+        ms->queue.close();
+      });
+    });
+  }
+
+  uint64_t unsorted = 0;
+  auto next = [&](MergeStream* ms) {
+    if (ms->queue.pop(ms->record) != channel_op_status::success)
+      return false;
+    ms->prev_key.swap(ms->key);
+    ms->key = sort_keys[ms->index](ms->is_binary, ms->record);
+    unsorted += (ms->key < ms->prev_key);
+    return true;
+  };
+
+  auto greater = [](const MergeStream* l, const MergeStream* r) {
+    int res = l->key.compare(r->key);
+    if (res)
+      return res > 0;
+    return l->index > r->index || (l->index == r->index && l->id > r->id);
+  };
+  priority_queue<MergeStream*, vector<MergeStream*>, decltype(greater)> heap(greater);
+
+  for (auto& ms : streams) {
+    if (next(ms.get()))
+      heap.push(ms.get());
+  }
+
+  vector<RawSinkCb> emit_cbs(handler_wrapper->Size());
+  for (const IndexedInput& ii : shard_input.second) {
+    emit_cbs[ii.index] = handler_wrapper->Get(ii.index);
+  }
+  SetFileName(false, shard_input.first.ToString(tb.op().op_name()), per_fiber);
+
+  // Records of the same key arrive ordered by the input index, as in ProcessSortedShard.
+  bool has_group = false;
+  string group_key;
+  while (!heap.empty()) {
+    MergeStream* top = heap.top();
+    heap.pop();
+
+    if (!has_group || top->key != group_key) {
+      if (has_group)
+        handler_wrapper->OnGroupFinish();
+      group_key = top->key;
+      has_group = true;
+    }
+    SetIsBinary(top->is_binary, per_fiber);
+    emit_cbs[top->index](std::move(top->record));
+
+    if (next(top))
+      heap.push(top);
+  }
+
+  if (has_group) {
+    handler_wrapper->OnGroupFinish();
+  }
+
+  for (auto& ms : streams) {
+    ms->reader.join();
+  }
+
+  raw_context->IncBy("fn-calls", cnt);
+  progress_.records[per_io_->index].fetch_add(cnt, std::memory_order_relaxed);
+  raw_context->Inc("join-merged-shards");
+  if (unsorted) {
+    LOG(ERROR) << "Shard " << shard_input.first.ToString(tb.op().op_name()) << " had "
+               << unsorted << " records out of the order of the join key";
+    raw_context->IncBy("join-unsorted-records", unsorted);
+  }
+}
+
 }  // namespace mr3
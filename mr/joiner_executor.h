@@ -15,6 +15,8 @@ class JoinerExecutor : public OperatorExecutor {
     uint32_t index;
     const pb::Input::FileSpec* fspec;
     const pb::WireFormat* wf;
+    std::string file_name;  // either fspec->url_glob() or a single sub-shard file.
+    bool is_sorted = false;   // True if the shard files are sorted, see Output::WithSortKey.
   };
 
   using ShardInput = std::pair<ShardId, std::vector<IndexedInput>>;
@@ -34,6 +36,18 @@ class JoinerExecutor : public OperatorExecutor {
 
   void ProcessInputQ(detail::TableBase* tb);
 
+  // Groups the shard records by the table sort keys using external sort and passes them
+  // to the handler key by key.
+  void ProcessSortedShard(const detail::TableBase& tb, const ShardInput& shard_input,
+                          detail::HandlerWrapperBase* handler_wrapper,
+                          RawContext::PerFiber* per_fiber);
+
+  // Same as ProcessSortedShard but for inputs with sorted shards. Streams the shard files
+  // with a k-way merge using memory that does not depend on the shard size.
+  void ProcessMergedShard(const detail::TableBase& tb, const ShardInput& shard_input,
+                          detail::HandlerWrapperBase* handler_wrapper,
+                          RawContext::PerFiber* per_fiber);
+
   void JoinerFiber();
 
   ::boost::fibers::unbuffered_channel<ShardInput> input_q_;
@@ -3,26 +3,46 @@
 //
 #include "mr/local_runner.h"
 
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <boost/fiber/condition_variable.hpp>
+#include <deque>
+#include <google/protobuf/descriptor.h>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "base/histogram.h"
 #include "base/logging.h"
 #include "base/walltime.h"
 #include "file/fiber_file.h"
 #include "file/file_util.h"
 #include "file/filesource.h"
+#include "file/list_file_format.h"
 #include "file/list_file_reader.h"
+#include "file/proto_writer.h"
 #include "mr/do_context.h"
+#include "mr/impl/columnar.h"
+#include "mr/impl/input_cache.h"
+#include "mr/impl/input_filter.h"
 #include "mr/impl/local_context.h"
+#include "mr/impl/record_batch.h"
+#include "mr/impl/shuffle_store.h"
+#include "strings/literal_matcher.h"
 #include "util/asio/io_context_pool.h"
 #include "util/aws/aws.h"
 #include "util/aws/s3.h"
+#include "util/bzip_source.h"
 #include "util/fibers/fiberqueue_threadpool.h"
 #include "util/gce/gcs.h"
 #include "util/http/https_client_pool.h"
 #include "util/stats/varz_stats.h"
 #include "util/zlib_source.h"
+#include "util/zstd_sinksource.h"
 
 namespace mr3 {
 
@@ -33,8 +53,44 @@ DEFINE_bool(local_runner_raw_shortcut_read, false,
 DEFINE_uint32(cloud_connect_deadline_ms, 2000,
               "Deadline in milliseconds when connecting to "
               "cloud storage");
+DEFINE_uint32(local_runner_cloud_prewarm, 0,
+              "Number of connections to the GCS api that every IO thread opens when it "
+              "initializes its GCS state, ahead of the first requests.");
+DEFINE_uint32(local_runner_cloud_max_idle_ms, 0,
+              "If positive, pooled cloud connections that were idle for longer are closed "
+              "instead of being reused.");
 DEFINE_string(local_runner_s3_region, "us-east-1",
               "Region where bucket is located. We should eliminate this flag at some point");
+DEFINE_string(local_runner_gcs_cache_dir, "",
+              "If set, GCS inputs are cached in this local directory and are read from there "
+              "as long as their generation does not change.");
+DEFINE_uint64(local_runner_gcs_cache_mb, 100 << 10, "Size cap of the GCS input cache.");
+DEFINE_uint64(local_runner_shuffle_mb, 1 << 10,
+              "Memory cap of the shards of in-memory outputs. Shards that are written when "
+              "the cap is exceeded go into files.");
+DEFINE_bool(local_runner_mmap_inputs, false,
+            "If true, local input files are memory mapped instead of being read with a prefetch "
+            "on the fiber queue pool. Page faults block the IO threads, so it suits hot files "
+            "that are usually in the page cache.");
+DEFINE_uint32(local_runner_lst_read_ahead, 0,
+              "If positive, the number of blocks of LST inputs that are read ahead and "
+              "uncompressed on a dedicated thread pool while their records are processed.");
+DEFINE_bool(local_runner_parallel_gzip, false,
+            "If true, BGZF text inputs (written by bgzip) are inflated in parallel on the "
+            "decoding thread pool of LST inputs. Other gzip inputs are inflated sequentially.");
+DEFINE_uint32(local_runner_gcs_read_ahead, 0,
+              "If positive, GCS inputs are read with up to this number of concurrent range "
+              "requests of --local_runner_gcs_read_window_mb each instead of a single stream.");
+DEFINE_uint32(local_runner_gcs_read_window_mb, 8, "Size of the GCS read-ahead windows.");
+DEFINE_uint32(local_runner_s3_read_ahead, 0,
+              "If positive, S3 inputs are read with up to this number of concurrent range "
+              "requests of --local_runner_s3_read_window_mb each instead of a single stream.");
+DEFINE_uint32(local_runner_s3_read_window_mb, 8, "Size of the S3 read-ahead windows.");
+DEFINE_uint32(local_runner_list_parallelism, 8,
+              "Number of fibers that list the '/' separated sub-prefixes of recursive gs:// and "
+              "s3:// globs concurrently. 1 lists them with a single paginated request. "
+              "Local globs list their directories and stat their files with as many "
+              "concurrent tasks on the file thread pool.");
 
 using namespace util;
 using namespace boost;
@@ -46,6 +102,135 @@ namespace {
 
 using namespace intrusive;
 
+// Decodes the blocks read ahead by ListReader on a FiberQueueThreadPool. The waiting IO fiber
+// does not block its thread.
+class FiberDecodeExecutor : public file::ListReader::Executor {
+  class DoneEvent : public Event {
+   public:
+    void Notify() final { done_.Notify(); }
+    void Wait() final { done_.Wait(); }
+
+   private:
+    fibers_ext::Done done_;
+  };
+
+ public:
+  explicit FiberDecodeExecutor(unsigned num_threads) : pool_(num_threads, 256) {}
+
+  void Add(std::function<void()> task) final { pool_.Add(std::move(task)); }
+  std::unique_ptr<Event> NewEvent() final { return std::make_unique<DoneEvent>(); }
+
+  void Shutdown() { pool_.Shutdown(); }
+
+ private:
+  fibers_ext::FiberQueueThreadPool pool_;
+};
+
+// Lists a single prefix and reports its sub-prefixes with the callback.
+using ListDirFn = std::function<Status(const string& prefix,
+                                       std::function<void(absl::string_view)> prefix_cb)>;
+
+// Lists the tree under root breadth first with 'parallelism' fibers of the calling thread.
+// Every fiber lists with its own ListDirFn returned by make_lister.
+Status ParallelList(const string& root, unsigned parallelism,
+                    std::function<ListDirFn()> make_lister) {
+  std::deque<string> pending{root};
+  unsigned active = 0;
+  Status status;
+  fibers::mutex mu;
+  fibers::condition_variable cv;
+
+  auto worker = [&] {
+    ListDirFn list_dir = make_lister();
+    auto prefix_cb = [&](absl::string_view sub) {
+      std::lock_guard<fibers::mutex> lk(mu);
+      pending.emplace_back(sub);
+      cv.notify_one();
+    };
+
+    std::unique_lock<fibers::mutex> lk(mu);
+    while (true) {
+      cv.wait(lk, [&] { return !pending.empty() || active == 0; });
+      if (pending.empty())
+        break;
+      string prefix = std::move(pending.front());
+      pending.pop_front();
+      ++active;
+      lk.unlock();
+
+      Status st = list_dir(prefix, prefix_cb);
+
+      lk.lock();
+      --active;
+      if (!st.ok() && status.ok()) {
+        status = st;
+        pending.clear();
+      }
+      if (pending.empty() && active == 0)
+        cv.notify_all();
+    }
+  };
+
+  std::vector<fibers::fiber> fibers;
+  for (unsigned i = 1; i < parallelism; ++i) {
+    fibers.emplace_back(worker);
+  }
+  worker();
+  for (auto& f : fibers) {
+    f.join();
+  }
+  return status;
+}
+
+bool HasWildcard(absl::string_view s) {
+  return s.find_first_of("*?[") != absl::string_view::npos;
+}
+
+struct DirEntry {
+  string name;
+  unsigned char type;  // DT_xxx, DT_UNKNOWN on file systems that do not report it.
+};
+
+// Returns the entries of dir besides "." and "..". An empty dir denotes the current directory.
+vector<DirEntry> ReadDir(const string& dir) {
+  vector<DirEntry> res;
+  DIR* dirp = opendir(dir.empty() ? "." : dir.c_str());
+  if (!dirp) {
+    VLOG(1) << "Could not open " << dir << ": " << strerror(errno);
+    return res;
+  }
+  while (struct dirent* entry = readdir(dirp)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    res.push_back(DirEntry{entry->d_name, entry->d_type});
+  }
+  closedir(dirp);
+  return res;
+}
+
+// Passes the records either as owned strings or as views into the read buffers, for
+// ProcessInputRange and ProcessInputRangeViews respectively. The readers give it what they
+// have, so a record is copied only if the consumer wants a string and the reader does not
+// own one.
+struct RecordSink {
+  RawSinkCb owned;
+  RawViewCb view;
+
+  void operator()(string&& record) const {
+    if (view)
+      view(record);
+    else
+      owned(std::move(record));
+  }
+
+  void operator()(StringPiece record) const {
+    if (view)
+      view(record);
+    else
+      owned(string(record));
+  }
+};
+
 }  // namespace
 
 ostream& operator<<(ostream& os, const file::FiberReadOptions::Stats& stats) {
@@ -58,37 +243,84 @@ struct LocalRunner::Impl {
  public:
   Impl(IoContextPool* p, const string& d)
       : io_pool_(p), data_dir(d), fq_pool_(0, 128),
-        varz_stats_("local-runner", [this] { return GetStats(); }) {
+        shuffle_store_(size_t(FLAGS_local_runner_shuffle_mb) << 20), varz_stats_("local-runner", [this] { return GetStats(); }) {
+    if (!FLAGS_local_runner_gcs_cache_dir.empty()) {
+      input_cache_.reset(new detail::InputCache(FLAGS_local_runner_gcs_cache_dir,
+                                                FLAGS_local_runner_gcs_cache_mb << 20, &fq_pool_));
+    }
+    if (FLAGS_local_runner_lst_read_ahead || FLAGS_local_runner_parallel_gzip) {
+      decode_executor_.reset(new FiberDecodeExecutor(0));
+    }
   }
 
-  uint64_t ProcessText(const string& fname, file::ReadonlyFile* fd, RawSinkCb cb);
-  uint64_t ProcessLst(file::ReadonlyFile* fd, RawSinkCb cb);
+  // Reads a local, cloud or in-memory input.
+  size_t ProcessRange(const string& filename, pb::WireFormat::Type type, const ReadOptions& opts,
+                      RecordSink cb);
 
-  /// Called from the main thread orchestrating the pipeline run.
+  uint64_t ProcessText(const string& fname, file::ReadonlyFile* fd, const ReadOptions& opts,
+                       RecordSink cb);
+  // Processes LST, BATCH and COLUMNAR files.
+  uint64_t ProcessLst(file::ReadonlyFile* fd, pb::WireFormat::Type type, const ReadOptions& opts,
+                      RecordSink cb);
+
+  // Reads a shard of an in-memory output.
+  uint64_t ProcessShuffled(const detail::ShuffleStore::Shard& shard, const ReadOptions& opts,
+                           RecordSink cb);
+
+  // Wraps cb with skipping of opts.skip_records and with the filter of opts, if set.
+  // type_name is the protobuf type of the records, empty for text records.
+  RecordSink WrapSink(const ReadOptions& opts, const string& type_name, RecordSink cb);
+
+  /// Called from the main thread orchestrating the pipeline run. Several operators may be
+  /// active at once, each one writes into its own DestFileSet.
   void Start(const pb::Operator* op);
 
   /// Called from the main thread orchestrating the pipeline run.
-  void End(ShardFileMap* out_files);
+  void End(const pb::Operator* op, ShardFileMap* out_files);
 
   /// The functions below are called from IO threads.
   void ExpandGCS(absl::string_view glob, ExpandCb cb);
   void ExpandS3(absl::string_view glob, ExpandCb cb);
 
+  // Walks the directories of the glob and stats its files concurrently on fq_pool_.
+  // Like for GCS, a glob ending with "**" matches all the files under its prefix.
+  void ExpandLocal(const string& glob, ExpandCb cb);
+
   StatusObject<file::ReadonlyFile*> OpenLocalFile(const std::string& filename,
                                                   file::FiberReadOptions::Stats* stats);
 
-  StatusObject<file::ReadonlyFile*> OpenGcsFile(const std::string& filename);
+  // Serves the object from the input cache if it's enabled and has the current generation.
+  // Sets from_cache to true in that case, stats are filled only for the cached reads.
+  StatusObject<file::ReadonlyFile*> OpenGcsFile(const std::string& filename,
+                                                file::FiberReadOptions::Stats* stats,
+                                                bool* from_cache);
   StatusObject<file::ReadonlyFile*> OpenS3File(const std::string& filename);
 
+  // Returns true if the local file can be read from the middle, i.e. it is an uncompressed
+  // text file or an LST1 file.
+  bool IsSplittable(const std::string& filename, pb::WireFormat::Type type);
+
   void ShutDown();
 
-  RawContext* NewContext();
+  const detail::ShuffleStore& shuffle_store() const { return shuffle_store_; }
+
+  RawContext* NewContext(const pb::Operator* op);
+  OutputProgress GetOutputProgress(const pb::Operator* op) const;
 
   void Break() {
     stop_signal_.store(true, std::memory_order_seq_cst);
   }
 
   void SaveFile(absl::string_view fn, absl::string_view data);
+  bool LoadFile(absl::string_view fn, std::string* data);
+
+  // Called from IO threads.
+  void SetReadAheadScale(unsigned scale) {
+    if (!per_thread_) {
+      per_thread_.reset(new PerThread);
+    }
+    per_thread_->read_ahead_scale = std::max(1U, scale);
+  }
 
   class Source;
 
@@ -101,9 +333,11 @@ struct LocalRunner::Impl {
   IoContextPool* io_pool_;
   string data_dir;
   fibers_ext::FiberQueueThreadPool fq_pool_;
+  std::unique_ptr<detail::InputCache> input_cache_;
+  detail::ShuffleStore shuffle_store_;
+  std::unique_ptr<FiberDecodeExecutor> decode_executor_;
   std::atomic_bool stop_signal_{false};
   std::atomic_ulong file_cache_hit_bytes_{0}, input_cloud_conn_{0};
-  const pb::Operator* current_op_ = nullptr;
 
   fibers::mutex cloud_mu_;
   std::unique_ptr<GCE> gce_handle_;
@@ -113,6 +347,10 @@ struct LocalRunner::Impl {
     vector<unique_ptr<GCS>> gcs_handles;
 
     base::Histogram record_fetch_hist;
+    unsigned read_ahead_scale = 1;
+
+    // Compiled input filters keyed by type name and expression.
+    absl::flat_hash_map<string, unique_ptr<detail::InputFilter>> input_filters;
 
     absl::optional<asio::ssl::context> ssl_context;
     absl::optional<HttpsClientPool> api_conn_pool;
@@ -137,7 +375,7 @@ struct LocalRunner::Impl {
   util::VarzFunction varz_stats_;
 
   mutable std::mutex dest_mgr_mu_;
-  std::unique_ptr<DestFileSet> dest_mgr_;
+  absl::flat_hash_map<const pb::Operator*, std::unique_ptr<DestFileSet>> dest_mgr_;
 
   friend class Source;
 };
@@ -149,7 +387,7 @@ class LocalRunner::Impl::Source {
 
   Status Open();
 
-  size_t Process(pb::WireFormat::Type type, RawSinkCb cb);
+  size_t Process(pb::WireFormat::Type type, const ReadOptions& opts, const RecordSink& cb);
 
  private:
   LocalRunner::Impl* impl_;
@@ -166,8 +404,9 @@ Status LocalRunner::Impl::Source::Open() {
   StatusObject<file::ReadonlyFile*> fl_res;
 
   if (IsGcsPath(fname_)) {
-    type_ = GCS;
-    fl_res = impl_->OpenGcsFile(fname_);
+    bool from_cache = false;
+    fl_res = impl_->OpenGcsFile(fname_, &stats_, &from_cache);
+    type_ = from_cache ? LOCAL : GCS;
   } else if (util::IsS3Path(fname_)) {
     type_ = S3;
     fl_res = impl_->OpenS3File(fname_);
@@ -181,16 +420,19 @@ Status LocalRunner::Impl::Source::Open() {
   return fl_res.status;
 }
 
-size_t LocalRunner::Impl::Source::Process(pb::WireFormat::Type type, RawSinkCb cb) {
+size_t LocalRunner::Impl::Source::Process(pb::WireFormat::Type type, const ReadOptions& opts,
+                                         const RecordSink& cb) {
   LOG(INFO) << "Processing file " << fname_;
 
   size_t cnt = 0;
   switch (type) {
     case pb::WireFormat::TXT:
-      cnt = impl_->ProcessText(fname_, rd_file_.release(), cb);
+      cnt = impl_->ProcessText(fname_, rd_file_.release(), opts, cb);
       break;
     case pb::WireFormat::LST:
-      cnt = impl_->ProcessLst(rd_file_.release(), cb);
+    case pb::WireFormat::BATCH:
+    case pb::WireFormat::COLUMNAR:
+      cnt = impl_->ProcessLst(rd_file_.release(), type, opts, cb);
       break;
     default:
       LOG(FATAL) << "Not implemented " << pb::WireFormat::Type_Name(type);
@@ -218,6 +460,12 @@ void LocalRunner::Impl::PerThread::SetupGce(IoContext* io_context) {
   api_conn_pool.emplace(GCE::kApiDomain, &ssl_context.value(), io_context);
   api_conn_pool->set_connect_timeout(FLAGS_cloud_connect_deadline_ms);
   api_conn_pool->set_retry_count(3);
+  api_conn_pool->set_max_idle_msec(FLAGS_local_runner_cloud_max_idle_ms);
+  if (FLAGS_local_runner_cloud_prewarm) {
+    unsigned connected = api_conn_pool->Prewarm(FLAGS_local_runner_cloud_prewarm);
+    LOG_IF(WARNING, connected < FLAGS_local_runner_cloud_prewarm)
+        << "Prewarmed only " << connected << " GCS connections";
+  }
 }
 
 auto LocalRunner::Impl::GetGcsHandle() -> unique_ptr<GCS, handle_keeper> {
@@ -261,24 +509,124 @@ VarzValue::Map LocalRunner::Impl::GetStats() const {
 
   map.emplace_back("input-cloud-connections", VarzValue::FromInt(input_cloud_conn_.load()));
   map.emplace_back("total-cloud-connections", VarzValue::FromInt(total_cloud_connections.load()));
+  if (input_cache_) {
+    detail::InputCache::Stats cache_stats = input_cache_->GetStats();
+    uint64_t lookups = cache_stats.hits + cache_stats.misses;
+    map.emplace_back("gcs-cache-hits", VarzValue::FromInt(cache_stats.hits));
+    map.emplace_back("gcs-cache-hit-ratio",
+                     VarzValue::FromDouble(lookups ? double(cache_stats.hits) / lookups : 0));
+    map.emplace_back("gcs-cache-saved-bytes", VarzValue::FromInt(cache_stats.saved_bytes));
+    map.emplace_back("gcs-cache-bytes", VarzValue::FromInt(cache_stats.cached_bytes));
+  }
+  detail::ShuffleStore::Stats shuffle_stats = shuffle_store_.GetStats();
+  map.emplace_back("shuffle-shards", VarzValue::FromInt(shuffle_stats.shards));
+  map.emplace_back("shuffle-spilled-shards", VarzValue::FromInt(shuffle_stats.spilled_shards));
+  map.emplace_back("shuffle-bytes", VarzValue::FromInt(shuffle_stats.bytes));
   map.emplace_back("stats-latency", VarzValue::FromInt(base::GetMonotonicMicrosFast() - start));
 
   return map;
 }
 
-uint64_t LocalRunner::Impl::ProcessText(const string& fname, file::ReadonlyFile* fd, RawSinkCb cb) {
-  std::unique_ptr<util::Source> src(file::Source::Uncompressed(fd));
+RecordSink LocalRunner::Impl::WrapSink(const ReadOptions& opts, const string& type_name,
+                                      RecordSink cb) {
+  if (opts.skip_records == 0 && opts.filter.empty() && opts.literals.empty())
+    return cb;
+
+  std::shared_ptr<strings::LiteralMatcher> matcher;
+  if (!opts.literals.empty())
+    matcher = std::make_shared<strings::LiteralMatcher>(opts.literals);
+
+  detail::InputFilter* filter = nullptr;
+  if (!opts.filter.empty()) {
+    auto& ptr = per_thread_->input_filters[absl::StrCat(type_name, "|", opts.filter)];
+    if (!ptr) {
+      ptr.reset(new detail::InputFilter(opts.filter, type_name));
+    }
+    filter = ptr.get();
+  }
+
+  // Shared by the both kinds of the callbacks, only one of them is set.
+  auto accept = [filter, matcher = std::move(matcher), skip = opts.skip_records,
+                 skipped = 0U](StringPiece record) mutable {
+    if (skipped < skip) {
+      ++skipped;
+      return false;
+    }
+    if (matcher && !matcher->Contains(record))
+      return false;
+    return !filter || filter->Match(record);
+  };
+
+  RecordSink res;
+  if (cb.view) {
+    res.view = [accept = std::move(accept), view = std::move(cb.view)](StringPiece rr) mutable {
+      if (accept(rr))
+        view(rr);
+    };
+  } else {
+    res.owned = [accept = std::move(accept), owned = std::move(cb.owned)](RawRecord&& rr) mutable {
+      if (accept(rr))
+        owned(std::move(rr));
+    };
+  }
+  return res;
+}
+
+uint64_t LocalRunner::Impl::ProcessText(const string& fname, file::ReadonlyFile* fd,
+                                        const ReadOptions& opts, RecordSink cb) {
+  const FileRange& range = opts.range;
+
+  // The lines are searched for the literals before they are split, so the header lines are
+  // dropped here instead of in the sink.
+  std::unique_ptr<strings::LiteralMatcher> matcher;
+  unsigned skip_lines = 0;
+  if (opts.literals.empty()) {
+    cb = WrapSink(opts, string{}, std::move(cb));
+  } else {
+    matcher.reset(new strings::LiteralMatcher(opts.literals));
+    ReadOptions sink_opts = opts;
+    sink_opts.skip_records = 0;
+    sink_opts.literals.clear();
+    skip_lines = opts.skip_records;
+    cb = WrapSink(sink_opts, string{}, std::move(cb));
+  }
+
+  // Ranges are read from the byte preceding them. This way if the range starts at a new line,
+  // the first line we skip is empty. Otherwise we skip the tail of the line that belongs to
+  // the previous range.
+  size_t src_offset = range.offset ? range.offset - 1 : 0;
+  file::ListExecutor* gzip_executor =
+      FLAGS_local_runner_parallel_gzip ? decode_executor_.get() : nullptr;
+  std::unique_ptr<util::Source> src(src_offset ? new file::Source(fd, src_offset)
+                                               : file::Source::Uncompressed(fd, gzip_executor));
   uint64_t cnt = 0;
 
   file::LineReader lr(src.release(), TAKE_OWNERSHIP);
   StringPiece result;
   string scratch;
 
+  if (range.offset) {
+    lr.Next(&result, &scratch);
+  }
+
+  // Lines that start inside the range belong to it, even if they end beyond it.
+  auto in_range = [&](uint64_t pos) { return src_offset + pos - range.offset < range.length; };
+  auto next_line = [&] {
+    if (!matcher)
+      return lr.Next(&result, &scratch);
+
+    // NextMatch may skip past the end of the range.
+    return lr.NextMatch(*matcher, &result, &scratch) && in_range(lr.line_position());
+  };
+
+  uint64_t first_line = lr.line_num();
+  while (skip_lines && in_range(lr.position()) && lr.Next(&result, &scratch))
+    --skip_lines;
+
   uint64_t start = base::GetMonotonicMicrosFast();
-  while (!stop_signal_.load(std::memory_order_relaxed) && lr.Next(&result, &scratch)) {
+  while (!stop_signal_.load(std::memory_order_relaxed) && in_range(lr.position()) &&
+         next_line()) {
     if (!FLAGS_local_runner_raw_shortcut_read) {
-      string record{result};
-
       if (VLOG_IS_ON(1)) {
         int64_t delta = base::GetMonotonicMicrosFast() - start;
         if (delta > 5)  // Filter out uninteresting fast Next calls.
@@ -286,7 +634,7 @@ uint64_t LocalRunner::Impl::ProcessText(const string& fname, file::ReadonlyFile*
       }
       VLOG_IF(2, cnt % 1000 == 0) << "Read " << cnt << " items";
 
-      cb(std::move(record));
+      cb(result);
       start = base::GetMonotonicMicrosFast();
     }
 
@@ -294,6 +642,9 @@ uint64_t LocalRunner::Impl::ProcessText(const string& fname, file::ReadonlyFile*
       this_fiber::yield();
     }
   }
+  // The lines without the literals were not returned by the reader.
+  if (matcher)
+    cnt = lr.line_num() - first_line;
   VLOG(1) << "ProcessText Read " << cnt << " items from " << fname;
 
   CHECK_STATUS(lr.status()) << "Line reader failed on file " << fname;
@@ -301,7 +652,8 @@ uint64_t LocalRunner::Impl::ProcessText(const string& fname, file::ReadonlyFile*
   return cnt;
 }
 
-uint64_t LocalRunner::Impl::ProcessLst(file::ReadonlyFile* fd, RawSinkCb cb) {
+uint64_t LocalRunner::Impl::ProcessLst(file::ReadonlyFile* fd, pb::WireFormat::Type type,
+                                       const ReadOptions& opts, RecordSink cb) {
   file::ListReader::CorruptionReporter error_fn = [](size_t bytes, const util::Status& status) {
     LOG(FATAL) << "Lost " << bytes << " bytes, status: " << status;
   };
@@ -312,14 +664,103 @@ uint64_t LocalRunner::Impl::ProcessLst(file::ReadonlyFile* fd, RawSinkCb cb) {
 #else
   file::ListReader list_reader(fd, TAKE_OWNERSHIP, true, error_fn);
 #endif
+  list_reader.SetRange(opts.range.offset, opts.range.length);
+  if (FLAGS_local_runner_lst_read_ahead) {
+    list_reader.EnableReadAhead(decode_executor_.get(), FLAGS_local_runner_lst_read_ahead);
+  }
+
+  // Filters and columnar files parse the records as protobuf messages of the type written
+  // in the file header.
+  const bool is_columnar = type == pb::WireFormat::COLUMNAR;
+  string type_name;
+  if (!opts.filter.empty() || is_columnar) {
+    std::map<std::string, std::string> meta;
+    if (!list_reader.GetMetaData(&meta))
+      return 0;
+
+    auto it = meta.find(file::kProtoTypeKey);
+    CHECK(it != meta.end()) << "Input filter and COLUMNAR format require LST files with "
+                               "protobuf type";
+    type_name = it->second;
+  }
+  cb = WrapSink(opts, type_name, std::move(cb));
+
+  std::unique_ptr<detail::ColumnarDecoder> columnar;
+  if (is_columnar) {
+    const auto* descr =
+        google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
+    CHECK(descr) << "COLUMNAR input requires type " << type_name
+                 << " to be linked into the binary";
+    columnar.reset(new detail::ColumnarDecoder(descr, opts.columns));
+  }
+  // The decoder builds each record, hence it passes them as strings.
+  auto decoded_cb = [&cb](string&& rr) { cb(std::move(rr)); };
+  const unsigned yield_freq = type == pb::WireFormat::LST ? 1000 : (is_columnar ? 1 : 10);
 
   string scratch;
   StringPiece record;
   uint64_t cnt = 0;
+  uint64_t yield_cnt = 0;
   while (list_reader.ReadRecord(&record, &scratch)) {
-    cb(string(record));
-    ++cnt;
-    if (cnt % 1000 == 0) {
+    if (type == pb::WireFormat::BATCH) {
+      int64_t res = detail::ParseBatch(record, cb);
+      CHECK_GE(res, 0) << "Corrupted record batch";
+      cnt += res;
+    } else if (columnar) {
+      int64_t res = columnar->Decode(record, decoded_cb);
+      CHECK_GE(res, 0) << "Corrupted row group";
+      cnt += res;
+    } else {
+      cb(record);
+      ++cnt;
+    }
+    if (++yield_cnt % yield_freq == 0) {
+      this_fiber::yield();
+      if (stop_signal_.load(std::memory_order_relaxed)) {
+        break;
+      }
+    }
+  }
+  return cnt;
+}
+
+// The chunks are in the form the destination handles got them, see detail::ShuffleStore.
+uint64_t LocalRunner::Impl::ProcessShuffled(const detail::ShuffleStore::Shard& shard,
+                                            const ReadOptions& opts, RecordSink cb) {
+  if (!per_thread_) {
+    per_thread_.reset(new PerThread);
+  }
+  cb = WrapSink(opts, shard.type_name, std::move(cb));
+
+  // TXT and BATCH chunks hold many records.
+  const bool is_buffer = shard.type == pb::WireFormat::TXT || shard.type == pb::WireFormat::BATCH;
+  const unsigned yield_freq = is_buffer ? 1 : 1000;
+
+  uint64_t cnt = 0, yield_cnt = 0;
+  for (const string& chunk : shard.chunks) {
+
+    switch (shard.type) {
+      case pb::WireFormat::TXT:
+        for (size_t pos = 0; pos < chunk.size();) {
+          size_t next = chunk.find('\n', pos);
+          if (next == string::npos)
+            next = chunk.size();
+          cb(StringPiece(chunk).substr(pos, next - pos));
+          pos = next + 1;
+          ++cnt;
+        }
+        break;
+      case pb::WireFormat::BATCH: {
+        int64_t res = detail::ParseBatch(chunk, cb);
+        CHECK_GE(res, 0) << "Corrupted record batch";
+        cnt += res;
+        break;
+      }
+      default:  // LST and COLUMNAR shards keep their records as is.
+        cb(StringPiece(chunk));
+        ++cnt;
+    }
+    if (++yield_cnt % yield_freq == 0) {
       this_fiber::yield();
       if (stop_signal_.load(std::memory_order_relaxed)) {
         break;
@@ -330,16 +771,20 @@ uint64_t LocalRunner::Impl::ProcessLst(file::ReadonlyFile* fd, RawSinkCb cb) {
 }
 
 void LocalRunner::Impl::Start(const pb::Operator* op) {
-  CHECK(!dest_mgr_);
-  current_op_ = op;
   string out_dir = file_util::JoinPath(data_dir, op->output().name());
   if (util::IsGcsPath(out_dir)) {
   } else if (!file::Exists(out_dir)) {
     CHECK(file_util::RecursivelyCreateDir(out_dir, 0750)) << "Could not create dir " << out_dir;
   }
 
-  lock_guard<mutex> lk(dest_mgr_mu_);
-  dest_mgr_.reset(new DestFileSet(out_dir, op->output(), io_pool_, &fq_pool_));
+  DestFileSet* dest_files = new DestFileSet(out_dir, op->output(), io_pool_, &fq_pool_);
+  if (op->output().in_memory()) {
+    dest_files->set_shuffle_store(&shuffle_store_);
+  }
+  std::unique_lock<mutex> lk(dest_mgr_mu_);
+  auto res = dest_mgr_.emplace(op, dest_files);
+  CHECK(res.second) << "Operator " << op->op_name() << " has already started";
+  lk.unlock();
 
   if (util::IsGcsPath(out_dir)) {
     io_pool_->AwaitFiberOnAll([this](IoContext&) { LazyGcsInit(); });
@@ -350,22 +795,23 @@ void LocalRunner::Impl::Start(const pb::Operator* op) {
       return &opt_pool.value();
     };
 
-    dest_mgr_->set_gce(gce_handle_.get(), api_pool_cb);
+    dest_files->set_gce(gce_handle_.get(), api_pool_cb);
   }
 }
 
-void LocalRunner::Impl::End(ShardFileMap* out_files) {
-  CHECK(dest_mgr_);
+void LocalRunner::Impl::End(const pb::Operator* op, ShardFileMap* out_files) {
+  std::unique_lock<mutex> lk(dest_mgr_mu_);
+  auto it = dest_mgr_.find(op);
+  CHECK(it != dest_mgr_.end());
+  std::unique_ptr<DestFileSet> dest_files = std::move(it->second);
+  dest_mgr_.erase(it);
+  lk.unlock();
 
-  auto shards = dest_mgr_->GetShards();
+  auto shards = dest_files->GetShards();
   for (const ShardId& sid : shards) {
-    out_files->emplace(sid, dest_mgr_->ShardFilePath(sid, -1));
+    out_files->emplace(sid, dest_files->ShardFilePath(sid, -1));
   }
-  dest_mgr_->CloseAllHandles(stop_signal_.load(std::memory_order_acquire));
-
-  lock_guard<mutex> lk(dest_mgr_mu_);
-  dest_mgr_.reset();
-  current_op_ = nullptr;
+  dest_files->CloseAllHandles(stop_signal_.load(std::memory_order_acquire));
 }
 
 void LocalRunner::Impl::ExpandGCS(absl::string_view glob, ExpandCb cb) {
@@ -386,12 +832,128 @@ void LocalRunner::Impl::ExpandGCS(absl::string_view glob, ExpandCb cb) {
     path.remove_suffix(1);
   }
 
+  if (recursive && FLAGS_local_runner_list_parallelism > 1) {
+    auto make_lister = [&]() -> ListDirFn {
+      std::shared_ptr<GCS> gcs = GetGcsHandle();
+      return [gcs, bucket, &cb2](const string& prefix, auto prefix_cb) {
+        return gcs->ListDir(bucket, prefix, cb2, std::move(prefix_cb));
+      };
+    };
+    CHECK_STATUS(ParallelList(string(path), FLAGS_local_runner_list_parallelism, make_lister));
+    return;
+  }
+
   auto gcs = GetGcsHandle();
   bool fs_mode = !recursive;
   auto status = gcs->List(bucket, path, fs_mode, cb2);
   CHECK_STATUS(status);
 }
 
+void LocalRunner::Impl::ExpandLocal(const string& glob, ExpandCb cb) {
+  // glob(3) expands the tilde and there is nothing to walk without wildcards.
+  if (absl::StartsWith(glob, "~") || !HasWildcard(glob)) {
+    for (const auto& v : file_util::StatFiles(glob)) {
+      if (S_ISREG(v.st_mode))
+        cb(v.size, v.name);
+    }
+    return;
+  }
+
+  // The components up to the first wildcard make the root directory, every directory
+  // under it at depth d is matched against patterns[d].
+  vector<string> patterns = absl::StrSplit(glob, '/', absl::SkipEmpty());
+  string root = glob.front() == '/' ? "/" : "";
+  size_t fixed = 0;
+  while (!HasWildcard(patterns[fixed])) {
+    root = file_util::JoinPath(root, patterns[fixed++]);
+  }
+  patterns.erase(patterns.begin(), patterns.begin() + fixed);
+
+  bool recursive = absl::EndsWith(glob, "**");
+  if (recursive) {
+    patterns.back().pop_back();
+  }
+
+  size_t offset = root.empty() ? 0 : root.size() + (root.back() == '/' ? 0 : 1);
+  auto depth = [&](const string& dir) -> size_t {
+    if (dir.size() <= root.size())
+      return 0;
+    return std::count(dir.begin() + offset, dir.end(), '/') + 1;
+  };
+
+  auto list_dir = [&](const string& dir, std::function<void(absl::string_view)> prefix_cb) {
+    size_t level = depth(dir);
+    bool match_all = level >= patterns.size();  // Under a directory matched by "**".
+    bool files_match = match_all || level + 1 == patterns.size();
+    bool descend = match_all || !files_match || recursive;
+
+    vector<DirEntry> entries = fq_pool_.Await([&] { return ReadDir(dir); });
+
+    // Symlinks and the entries of unknown type are resolved by stat.
+    vector<string> to_stat;
+    for (const DirEntry& e : entries) {
+      if (!match_all && fnmatch(patterns[level].c_str(), e.name.c_str(), FNM_PERIOD) != 0)
+        continue;
+      string path = file_util::JoinPath(dir, e.name);
+      if (e.type == DT_DIR) {
+        if (descend)
+          prefix_cb(path);
+      } else if (e.type != DT_REG || files_match) {
+        to_stat.push_back(std::move(path));
+      }
+    }
+
+    // A directory with many files is stat'ed in batches by several fibers.
+    constexpr size_t kStatBatch = 256;
+    size_t next = 0;
+    auto stat_worker = [&] {
+      while (next < to_stat.size()) {
+        size_t start = next;
+        next = std::min(next + kStatBatch, to_stat.size());
+        vector<file_util::StatShort> stats = fq_pool_.Await([&, start, end = next] {
+          vector<file_util::StatShort> res;
+          struct stat statbuf;
+          for (size_t i = start; i < end; ++i) {
+            const char* path = to_stat[i].c_str();
+            if (lstat(path, &statbuf) != 0)
+              continue;
+
+            // Symlinked directories are not followed under "**", they may form cycles.
+            if (S_ISLNK(statbuf.st_mode) &&
+                (stat(path, &statbuf) != 0 || (match_all && S_ISDIR(statbuf.st_mode))))
+              continue;
+            res.push_back(file_util::StatShort{std::move(to_stat[i]), statbuf.st_mtime,
+                                               statbuf.st_size, statbuf.st_mode});
+          }
+          return res;
+        });
+
+        for (const auto& v : stats) {
+          if (S_ISREG(v.st_mode) && files_match) {
+            cb(v.size, v.name);
+          } else if (S_ISDIR(v.st_mode) && descend) {
+            prefix_cb(v.name);
+          }
+        }
+      }
+    };
+
+    size_t batches = (to_stat.size() + kStatBatch - 1) / kStatBatch;
+    vector<fibers::fiber> stat_fibers;
+    for (size_t i = 1; i < std::min<size_t>(FLAGS_local_runner_list_parallelism, batches); ++i) {
+      stat_fibers.emplace_back(stat_worker);
+    }
+    stat_worker();
+    for (auto& f : stat_fibers) {
+      f.join();
+    }
+    return Status::OK;
+  };
+
+  CHECK_STATUS(ParallelList(root, std::max(1U, FLAGS_local_runner_list_parallelism),
+                            [&]() -> ListDirFn { return list_dir; }));
+}
+
 void LocalRunner::Impl::ExpandS3(absl::string_view glob, ExpandCb cb) {
   absl::string_view bucket, path;
 
@@ -419,19 +981,63 @@ void LocalRunner::Impl::ExpandS3(absl::string_view glob, ExpandCb cb) {
   pool.set_connect_timeout(FLAGS_cloud_connect_deadline_ms);
 
   S3Bucket s3{*aws_handle_, &pool};
+  if (recursive && FLAGS_local_runner_list_parallelism > 1) {
+    // S3Bucket takes a pool handle per request, so the fibers can share it.
+    auto make_lister = [&]() -> ListDirFn {
+      return [&](const string& prefix, auto prefix_cb) {
+        return s3.ListDir(prefix, cb2, std::move(prefix_cb));
+      };
+    };
+    CHECK_STATUS(ParallelList(string(path), FLAGS_local_runner_list_parallelism, make_lister));
+    return;
+  }
+
   bool fs_mode = !recursive;
 
   auto status = s3.List(path, fs_mode, cb2);
   CHECK_STATUS(status);
 }
 
-StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenGcsFile(const std::string& filename) {
+StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenGcsFile(
+    const std::string& filename, file::FiberReadOptions::Stats* stats, bool* from_cache) {
   CHECK(IsGcsPath(filename));
   LazyGcsInit();
 
   input_cloud_conn_.fetch_add(1, std::memory_order_relaxed);
   auto pt = per_thread_.get();
-  return OpenGcsReadFile(filename, *gce_handle_, &pt->api_conn_pool.value());
+  auto open_remote = [&](string* generation) {
+    if (FLAGS_local_runner_gcs_read_ahead) {
+      return OpenGcsReadAheadFile(filename, *gce_handle_, &pt->api_conn_pool.value(),
+                                  FLAGS_local_runner_gcs_read_ahead,
+                                  size_t(FLAGS_local_runner_gcs_read_window_mb) << 20, generation);
+    }
+    return OpenGcsReadFile(filename, *gce_handle_, &pt->api_conn_pool.value(),
+                           file::ReadonlyFile::Options{}, generation);
+  };
+  if (!input_cache_)
+    return open_remote(nullptr);
+
+  // The object is opened anyway to learn its current generation.
+  string generation;
+  auto res = open_remote(&generation);
+  if (!res.ok() || generation.empty())
+    return res;
+
+  string cached = input_cache_->Lookup(filename, generation);
+  if (!cached.empty()) {
+    auto local_res = OpenLocalFile(cached, stats);
+    if (local_res.ok()) {
+      std::unique_ptr<file::ReadonlyFile> remote(res.obj);
+      CHECK_STATUS(remote->Close());
+      input_cloud_conn_.fetch_sub(1, std::memory_order_acq_rel);
+      *from_cache = true;
+
+      return local_res;
+    }
+    LOG(WARNING) << "Could not open cached " << cached << ": " << local_res.status;
+  }
+
+  return input_cache_->Fill(filename, generation, res.obj);
 }
 
 StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenS3File(const std::string& filename) {
@@ -446,12 +1052,41 @@ StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenS3File(const std::strin
   if (!pt->api_conn_pool) {
     IoContext* io_context = io_pool_->GetThisContext();
     pt->api_conn_pool.emplace(domain, &pt->ssl_context.value(), io_context);
+    pt->api_conn_pool->set_max_idle_msec(FLAGS_local_runner_cloud_max_idle_ms);
   } else {
     CHECK_EQ(domain, pt->api_conn_pool->domain()) << "Only a single bucket supported right now";
   }
+  if (FLAGS_local_runner_s3_read_ahead) {
+    return OpenS3ReadAheadFile(path, *aws_handle_, &pt->api_conn_pool.value(),
+                               FLAGS_local_runner_s3_read_ahead,
+                               size_t(FLAGS_local_runner_s3_read_window_mb) << 20);
+  }
   return OpenS3ReadFile(path, *aws_handle_, &pt->api_conn_pool.value());
 }
 
+bool LocalRunner::Impl::IsSplittable(const std::string& filename, pb::WireFormat::Type type) {
+  file::FiberReadOptions::Stats stats;
+  auto res = OpenLocalFile(filename, &stats);
+  if (!res.ok()) {
+    return false;
+  }
+
+  if (type == pb::WireFormat::TXT) {
+    file::Source src(res.obj);
+    return !util::ZStdSource::HasValidHeader(&src) && !util::BzipSource::IsBzipSource(&src) &&
+           !util::ZlibSource::IsZlibSource(&src);
+  }
+
+  // LST and BATCH files can be split unless they are in LST2 format.
+  std::unique_ptr<file::ReadonlyFile> fd(res.obj);
+  uint8_t buf[file::list_file::kMagicStringSize];
+  auto read_res = fd->Read(0, strings::MutableByteRange(buf, sizeof(buf)));
+  CHECK_STATUS(fd->Close());
+
+  return read_res.ok() && read_res.obj == sizeof(buf) &&
+         memcmp(buf, file::list_file::kMagicString, sizeof(buf)) == 0;
+}
+
 StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenLocalFile(
     const std::string& filename, file::FiberReadOptions::Stats* stats) {
   if (!per_thread_) {
@@ -459,8 +1094,15 @@ StatusObject<file::ReadonlyFile*> LocalRunner::Impl::OpenLocalFile(
   }
   CHECK(!IsGcsPath(filename));
 
+  if (FLAGS_local_runner_mmap_inputs) {
+    file::ReadonlyFile::Options opts;
+    opts.use_mmap = true;
+    opts.drop_cache_on_close = false;  // Other readers may need the pages.
+    return file::ReadonlyFile::Open(filename, opts);
+  }
+
   file::FiberReadOptions opts;
-  opts.prefetch_size = FLAGS_local_runner_prefetch_size;
+  opts.prefetch_size = size_t(FLAGS_local_runner_prefetch_size) * per_thread_->read_ahead_scale;
   opts.stats = stats;
 
   return file::OpenFiberReadFile(filename, &fq_pool_, opts);
@@ -480,7 +1122,7 @@ void LocalRunner::Impl::LazyGcsInit() {
 
   gce_handle_.reset(new GCE);
   CHECK_STATUS(gce_handle_->Init());
-  CHECK_STATUS(gce_handle_->RefreshAccessToken(io_context).status);
+  CHECK_STATUS(gce_handle_->StartTokenRefresh(io_context));
 }
 
 void LocalRunner::Impl::LazyAwsInit() {
@@ -501,6 +1143,15 @@ void LocalRunner::Impl::LazyAwsInit() {
 
 void LocalRunner::Impl::ShutDown() {
   fq_pool_.Shutdown();
+  if (decode_executor_) {
+    decode_executor_->Shutdown();
+  }
+
+  detail::ShuffleStore::Stats shuffle_stats = shuffle_store_.GetStats();
+  LOG_IF(INFO, shuffle_stats.shards + shuffle_stats.spilled_shards)
+      << "In-memory shards " << shuffle_stats.shards << ", spilled "
+      << shuffle_stats.spilled_shards << ", " << shuffle_stats.bytes << " bytes";
+  shuffle_store_.Clear();
 
   auto cb_per_thread = [](IoContext&) {
     if (per_thread_) {
@@ -515,12 +1166,32 @@ void LocalRunner::Impl::ShutDown() {
 
   auto cached_bytes = file_cache_hit_bytes_.load();
   LOG_IF(INFO, cached_bytes) << "File cached hit bytes " << cached_bytes;
+
+  if (input_cache_) {
+    detail::InputCache::Stats cache_stats = input_cache_->GetStats();
+    LOG(INFO) << "GCS input cache hits/misses " << cache_stats.hits << "/" << cache_stats.misses
+              << ", saved " << cache_stats.saved_bytes << " bytes";
+  }
 }
 
-RawContext* LocalRunner::Impl::NewContext() {
-  CHECK_NOTNULL(current_op_);
+RawContext* LocalRunner::Impl::NewContext(const pb::Operator* op) {
+  lock_guard<mutex> lk(dest_mgr_mu_);
+  auto it = dest_mgr_.find(op);
+  CHECK(it != dest_mgr_.end()) << "Operator " << op->op_name() << " was not started";
 
-  return new detail::LocalContext(dest_mgr_.get());
+  return new detail::LocalContext(it->second.get());
+}
+
+auto LocalRunner::Impl::GetOutputProgress(const pb::Operator* op) const -> OutputProgress {
+  OutputProgress res;
+
+  lock_guard<mutex> lk(dest_mgr_mu_);
+  auto it = dest_mgr_.find(op);
+  if (it != dest_mgr_.end()) {
+    res.shards = it->second->handles_created();
+    res.raw_bytes = it->second->raw_bytes();
+  }
+  return res;
 }
 
 void LocalRunner::Impl::SaveFile(absl::string_view fn, absl::string_view data) {
@@ -539,6 +1210,39 @@ void LocalRunner::Impl::SaveFile(absl::string_view fn, absl::string_view data) {
   });
 }
 
+bool LocalRunner::Impl::LoadFile(absl::string_view fn, std::string* data) {
+  bool res = false;
+  io_pool_->GetNextContext().AwaitSafe([&] {
+    std::string full_fn = file_util::JoinPath(data_dir, fn);
+    StatusObject<file::ReadonlyFile*> fl_res;
+    if (util::IsGcsPath(full_fn)) {
+      LazyGcsInit();
+      fl_res = OpenGcsReadFile(full_fn, *gce_handle_, &per_thread_->api_conn_pool.value());
+    } else {
+      if (!file::Exists(full_fn))
+        return;
+      fl_res = file::ReadonlyFile::Open(full_fn);
+    }
+    if (!fl_res.ok()) {
+      VLOG(1) << "Could not open " << full_fn << ": " << fl_res.status;
+      return;
+    }
+
+    std::unique_ptr<file::ReadonlyFile> fl(fl_res.obj);
+    data->resize(fl->Size());
+    res = true;
+    if (!data->empty()) {
+      strings::MutableByteRange range(reinterpret_cast<uint8_t*>(&data->front()), data->size());
+      auto read_res = fl->Read(0, range);
+      CHECK_STATUS(read_res.status) << full_fn;
+      CHECK_EQ(data->size(), read_res.obj) << full_fn;
+    }
+    CHECK_STATUS(fl->Close());
+  });
+
+  return res;
+}
+
 /* LocalRunner implementation
 ********************************************/
 
@@ -560,45 +1264,95 @@ void LocalRunner::OperatorStart(const pb::Operator* op) {
   impl_->Start(op);
 }
 
-RawContext* LocalRunner::CreateContext() {
-  return impl_->NewContext();
+RawContext* LocalRunner::CreateContext(const pb::Operator* op) {
+  return impl_->NewContext(op);
+}
+
+void LocalRunner::OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) {
+  VLOG(1) << "LocalRunner::OperatorEnd " << op->op_name();
+  impl_->End(op, out_files);
 }
 
-void LocalRunner::OperatorEnd(ShardFileMap* out_files) {
-  VLOG(1) << "LocalRunner::OperatorEnd";
-  impl_->End(out_files);
+auto LocalRunner::GetOutputProgress(const pb::Operator* op) -> OutputProgress {
+  return impl_->GetOutputProgress(op);
 }
 
 void LocalRunner::ExpandGlob(const std::string& glob, ExpandCb cb) {
+  // Shards of in-memory outputs are referenced by the path of their shard file.
+  if (const auto* shard = impl_->shuffle_store().Find(glob)) {
+    cb(shard->bytes, glob);
+    return;
+  }
+
   if (util::IsGcsPath(glob)) {
     impl_->ExpandGCS(glob, cb);
   } else if (util::IsS3Path(glob)) {
     impl_->ExpandS3(glob, cb);
   } else {
-    std::vector<file_util::StatShort> paths = file_util::StatFiles(glob);
-    for (const auto& v : paths) {
-      if (v.st_mode & S_IFREG) {
-        cb(v.size, v.name);
-      }
-    }
+    impl_->ExpandLocal(glob, cb);
   }
 }
 
 // Read file and fill queue. This function must be fiber-friendly.
 size_t LocalRunner::ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                                      RawSinkCb cb) {
-  Impl::Source src(impl_.get(), filename);
+  return ProcessInputRange(filename, type, ReadOptions{}, std::move(cb));
+}
+
+void LocalRunner::SplitInputFile(const std::string& filename, size_t file_size,
+                                 pb::WireFormat::Type type, size_t max_range_size,
+                                 std::vector<FileRange>* out_ranges) {
+  // Cloud files are read as a stream, therefore we do not split them.
+  if (file_size <= max_range_size || util::IsGcsPath(filename) || util::IsS3Path(filename))
+    return;
+
+  if (impl_->shuffle_store().Find(filename))
+    return;
+
+  if (!impl_->IsSplittable(filename, type))
+    return;
+
+  for (size_t offset = 0; offset < file_size; offset += max_range_size) {
+    out_ranges->push_back(FileRange{offset, std::min(max_range_size, file_size - offset)});
+  }
+}
+
+size_t LocalRunner::Impl::ProcessRange(const string& filename, pb::WireFormat::Type type,
+                                       const ReadOptions& opts, RecordSink cb) {
+  if (const auto* shard = shuffle_store().Find(filename)) {
+    return ProcessShuffled(*shard, opts, std::move(cb));
+  }
+
+  Source src(this, filename);
 
   CHECK_STATUS(src.Open()) << filename;
-  size_t cnt = src.Process(type, std::move(cb));
+  size_t cnt = src.Process(type, opts, cb);
 
   return cnt;
 }
 
+size_t LocalRunner::ProcessInputRange(const std::string& filename, pb::WireFormat::Type type,
+                                      const ReadOptions& opts, RawSinkCb cb) {
+  return impl_->ProcessRange(filename, type, opts, RecordSink{std::move(cb), nullptr});
+}
+
+size_t LocalRunner::ProcessInputRangeViews(const std::string& filename, pb::WireFormat::Type type,
+                                           const ReadOptions& opts, RawViewCb cb) {
+  return impl_->ProcessRange(filename, type, opts, RecordSink{nullptr, std::move(cb)});
+}
+
+void LocalRunner::SetReadAheadScale(unsigned scale) {
+  impl_->SetReadAheadScale(scale);
+}
+
 void LocalRunner::SaveFile(absl::string_view fn, absl::string_view data) {
   impl_->SaveFile(fn, data);
 }
 
+bool LocalRunner::LoadFile(absl::string_view fn, std::string* data) {
+  return impl_->LoadFile(fn, data);
+}
+
 void LocalRunner::Stop() {
   CHECK_NOTNULL(impl_)->Break();
 }
@@ -27,9 +27,11 @@ class LocalRunner : public Runner {
   void OperatorStart(const pb::Operator* op) final;
 
   // Must be thread-safe. Called from multiple threads in pipeline_executor.
-  RawContext* CreateContext() final;
+  RawContext* CreateContext(const pb::Operator* op) final;
 
-  void OperatorEnd(ShardFileMap* out_files) final;
+  void OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) final;
+
+  OutputProgress GetOutputProgress(const pb::Operator* op) final;
 
   // For GCS, if glob ends with "**", expands it recursively.
   void ExpandGlob(const std::string& glob, ExpandCb cb) final;
@@ -38,7 +40,23 @@ class LocalRunner : public Runner {
   size_t ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                           RawSinkCb cb) final;
 
+  // Splits uncompressed local text files on line boundaries and LST files on block boundaries.
+  void SplitInputFile(const std::string& filename, size_t file_size, pb::WireFormat::Type type,
+                      size_t max_range_size, std::vector<FileRange>* out_ranges) final;
+
+  // Input filters are compiled once per IO thread.
+  size_t ProcessInputRange(const std::string& filename, pb::WireFormat::Type type,
+                           const ReadOptions& opts, RawSinkCb cb) final;
+
+  // Passes views into the read buffers of the text and LST files.
+  size_t ProcessInputRangeViews(const std::string& filename, pb::WireFormat::Type type,
+                                const ReadOptions& opts, RawViewCb cb) final;
+
+  // Scales local_runner_prefetch_size for the local files opened by the calling IO thread.
+  void SetReadAheadScale(unsigned scale) final;
+
   void SaveFile(absl::string_view fn, absl::string_view data);
+  bool LoadFile(absl::string_view fn, std::string* data) final;
 
   void Stop();
 
@@ -4,22 +4,31 @@
 
 #include "mr/local_runner.h"
 #include <gmock/gmock.h>
+#include "absl/strings/str_cat.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "mr/do_context.h"
+#include "mr/impl/input_cache.h"
 
 #include "file/filesource.h"
 #include "file/file_util.h"
 #include "file/test_util.h"
 #include "file/filesource.h"
 #include "util/asio/io_context_pool.h"
+#include "util/fibers/fiberqueue_threadpool.h"
 #include "util/plang/addressbook.pb.h"
 #include "util/zlib_source.h"
 
+DECLARE_uint32(dest_max_open_handles);
+DECLARE_uint32(dest_sort_budget_mb);
+DECLARE_string(dest_sort_dir);
+DECLARE_uint64(local_runner_shuffle_mb);
+
 namespace mr3 {
 using namespace util;
 using namespace std;
 
+using testing::ElementsAre;
 using testing::EndsWith;
 using testing::Pair;
 using testing::UnorderedElementsAre;
@@ -40,10 +49,10 @@ class LocalRunnerTest : public testing::Test {
     pool_.reset();
   }
 
-  void Start(pb::WireFormat::Type type) {
+  void Start(pb::WireFormat::Type type, const string& name = "w1") {
     op_.set_op_name("op");
     auto* out = op_.mutable_output();
-    out->set_name("w1");
+    out->set_name(name);
     out->mutable_format()->set_type(type);
     runner_->OperatorStart(&op_);
   }
@@ -72,11 +81,11 @@ const ShardId kShard0{0}, kShard1{1};
 TEST_F(LocalRunnerTest, Basic) {
   ShardFileMap out_files;
   Start(pb::WireFormat::TXT);
-  std::unique_ptr<RawContext> context{runner_->CreateContext()};
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
   context->TEST_Write(kShard0, "foo");
 
   context->Flush();
-  runner_->OperatorEnd(&out_files);
+  runner_->OperatorEnd(&op_, &out_files);
 
   ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "shard-0000.txt")));
 
@@ -91,7 +100,7 @@ TEST_F(LocalRunnerTest, MaxShardSize) {
   op_.mutable_output()->mutable_compress()->set_type(pb::Output::GZIP);
   op_.mutable_output()->mutable_shard_spec()->set_max_raw_size_mb(1);
 
-  std::unique_ptr<RawContext> context{runner_->CreateContext()};
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
   std::default_random_engine rd(10);
 
   for (unsigned i = 0; i < 2000; ++i) {
@@ -106,7 +115,7 @@ TEST_F(LocalRunnerTest, MaxShardSize) {
   context->Flush();
 
   ShardFileMap out_files;
-  runner_->OperatorEnd(&out_files);
+  runner_->OperatorEnd(&op_, &out_files);
   ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "shard-0000-*.txt.gz")));
   std::vector<string> expanded;
   runner_->ExpandGlob(out_files.begin()->second,
@@ -118,6 +127,34 @@ TEST_F(LocalRunnerTest, MaxShardSize) {
   }
 }
 
+TEST_F(LocalRunnerTest, MaxShardSizeLst) {
+  Start(pb::WireFormat::LST);
+  op_.mutable_output()->mutable_shard_spec()->set_max_raw_size_mb(1);
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  for (unsigned i = 0; i < 3000; ++i) {
+    context->TEST_Write(kShard0, string(1000, 'a' + i % 26));
+  }
+  context->Flush();
+
+  ShardFileMap out_files;
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "shard-0000-*.lst")));
+
+  std::vector<string> expanded;
+  runner_->ExpandGlob(out_files.begin()->second,
+                      [&](size_t sz, auto& s) { expanded.push_back(s); });
+  EXPECT_THAT(expanded, UnorderedElementsAre(EndsWith("shard-0000-000.lst"),
+                                             EndsWith("shard-0000-001.lst"),
+                                             EndsWith("shard-0000-002.lst")));
+
+  size_t records = 0;
+  for (const string& str : expanded) {
+    records += runner_->ProcessInputFile(str, pb::WireFormat::LST, [](string&&) {});
+  }
+  EXPECT_EQ(3000, records);
+}
+
 TEST_F(LocalRunnerTest, Lst) {
   ShardFileMap out_files;
   Start(pb::WireFormat::LST);
@@ -125,25 +162,200 @@ TEST_F(LocalRunnerTest, Lst) {
   tutorial::Address addr;
   addr.set_street("forrest");
 
-  std::unique_ptr<RawContext> context{runner_->CreateContext()};
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
   context->TEST_Write(kShard0, addr.SerializeAsString());
 
   context->Flush();
-  runner_->OperatorEnd(&out_files);
+  runner_->OperatorEnd(&op_, &out_files);
   ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "w1/w1-shard-0000.lst")));
 }
 
 
+TEST_F(LocalRunnerTest, Filter) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::TXT);
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  context->TEST_Write(kShard0, "header");
+  for (unsigned i = 0; i < 100; ++i) {
+    context->TEST_Write(kShard0, absl::StrCat(i % 10 ? "bar" : "foo", i));
+  }
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_EQ(1, out_files.size());
+
+  Runner::ReadOptions opts;
+  opts.skip_records = 1;
+  opts.filter = "line rlike 'foo'";
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputRange(out_files.begin()->second, pb::WireFormat::TXT, opts,
+                                          [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(101, cnt);
+  EXPECT_EQ(10, records.size());
+  EXPECT_EQ("foo0", records.front());
+}
+
+TEST_F(LocalRunnerTest, Literals) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::TXT);
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  context->TEST_Write(kShard0, "header foo");
+  for (unsigned i = 0; i < 100; ++i) {
+    context->TEST_Write(kShard0, absl::StrCat(i % 10 ? "bar" : "foo", i));
+  }
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_EQ(1, out_files.size());
+
+  // The header is dropped before the search and the filter applies after it.
+  Runner::ReadOptions opts;
+  opts.skip_records = 1;
+  opts.literals = {"foo", "bar7"};
+  opts.filter = "line rlike '[0-5]$'";
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputRange(out_files.begin()->second, pb::WireFormat::TXT, opts,
+                                          [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(101, cnt);
+  EXPECT_THAT(records, ElementsAre("foo0", "foo10", "foo20", "foo30", "foo40", "foo50", "foo60",
+                                   "foo70", "bar71", "bar72", "bar73", "bar74", "bar75", "foo80",
+                                   "foo90"));
+}
+
+TEST_F(LocalRunnerTest, FilterLst) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::LST);
+  op_.mutable_output()->set_type_name("tutorial.Address");
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  tutorial::Address addr;
+  for (unsigned i = 0; i < 100; ++i) {
+    addr.set_street(i % 4 ? "elm" : "forrest");
+    context->TEST_Write(kShard0, addr.SerializeAsString());
+  }
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_EQ(1, out_files.size());
+
+  Runner::ReadOptions opts;
+  opts.filter = "street = 'forrest'";
+  size_t matched = 0;
+  size_t cnt = runner_->ProcessInputRange(out_files.begin()->second, pb::WireFormat::LST, opts,
+                                          [&](string&& s) {
+                                            ASSERT_TRUE(addr.ParseFromString(s));
+                                            EXPECT_EQ("forrest", addr.street());
+                                            ++matched;
+                                          });
+  EXPECT_EQ(100, cnt);
+  EXPECT_EQ(25, matched);
+}
+
+TEST_F(LocalRunnerTest, Views) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::LST);
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  context->TEST_Write(kShard0, "header");
+  for (unsigned i = 0; i < 100; ++i) {
+    context->TEST_Write(kShard0, absl::StrCat(i % 10 ? "bar" : "foo", i));
+  }
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_EQ(1, out_files.size());
+
+  // The views pass the same records as the strings.
+  Runner::ReadOptions opts;
+  opts.skip_records = 1;
+  opts.literals = {"foo"};
+  vector<string> records, views;
+  size_t cnt = runner_->ProcessInputRange(out_files.begin()->second, pb::WireFormat::LST, opts,
+                                          [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(101, cnt);
+  cnt = runner_->ProcessInputRangeViews(out_files.begin()->second, pb::WireFormat::LST, opts,
+                                        [&](StringPiece s) { views.emplace_back(s); });
+  EXPECT_EQ(101, cnt);
+  EXPECT_EQ(10, views.size());
+  EXPECT_EQ(records, views);
+}
+
+TEST_F(LocalRunnerTest, Batch) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::BATCH);
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  vector<string> expected;
+  for (unsigned i = 0; i < 5000; ++i) {
+    expected.push_back(std::to_string(i));
+    context->TEST_Write(kShard0, string(expected.back()));
+  }
+  context->TEST_Write(kShard0, string{});  // empty records are preserved.
+  expected.push_back(string{});
+
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "w1/w1-shard-0000.batch")));
+
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputFile(out_files.begin()->second, pb::WireFormat::BATCH,
+                                         [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(expected.size(), cnt);
+  EXPECT_EQ(expected, records);
+}
+
+TEST_F(LocalRunnerTest, Columnar) {
+  ShardFileMap out_files;
+  Start(pb::WireFormat::COLUMNAR);
+  op_.mutable_output()->set_type_name("tutorial.Person");
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  vector<string> expected;
+  tutorial::Person person;
+  for (unsigned i = 0; i < 10000; ++i) {  // More than a single row group.
+    person.Clear();
+    person.set_name(absl::StrCat("name", i % 7));
+    person.set_id(int64_t(i) - 5000);
+    person.set_dval(i * 0.5);
+    if (i % 3 == 0)
+      person.set_email(absl::StrCat("mail", i));
+    if (i % 5 == 0)
+      person.add_tag("tag");
+    expected.push_back(person.SerializeAsString());
+    context->TEST_Write(kShard0, string(expected.back()));
+  }
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "w1/w1-shard-0000.col")));
+
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputFile(out_files.begin()->second, pb::WireFormat::COLUMNAR,
+                                         [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(expected.size(), cnt);
+  EXPECT_THAT(records, UnorderedElementsAreArray(expected));
+
+  Runner::ReadOptions opts;
+  opts.columns = {"name", "id", "dval"};
+  size_t with_id = 0;
+  cnt = runner_->ProcessInputRange(out_files.begin()->second, pb::WireFormat::COLUMNAR, opts,
+                                   [&](string&& s) {
+                                     ASSERT_TRUE(person.ParseFromString(s));
+                                     EXPECT_FALSE(person.has_email());
+                                     EXPECT_EQ(0, person.tag_size());
+                                     with_id += person.id() >= -5000 && person.id() < 5000;
+                                   });
+  EXPECT_EQ(expected.size(), cnt);
+  EXPECT_EQ(expected.size(), with_id);
+}
+
 TEST_F(LocalRunnerTest, Subdir) {
   ShardFileMap out_files;
   Start(pb::WireFormat::TXT);
 
-  std::unique_ptr<RawContext> context{runner_->CreateContext()};
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
   const ShardId subdir_shard{"foo/bar/zed"};
   context->TEST_Write(subdir_shard, "zed is dead, baby");
 
   context->Flush();
-  runner_->OperatorEnd(&out_files);
+  runner_->OperatorEnd(&op_, &out_files);
   ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(subdir_shard, "w1/foo/bar/zed.txt")));
 }
 
@@ -158,18 +370,211 @@ auto KeyMatch(const vector<ShardId>& arr) {
 TEST_F(LocalRunnerTest, CloseShard) {
   ShardFileMap out_files;
   Start(pb::WireFormat::TXT);
-  std::unique_ptr<RawContext> context{runner_->CreateContext()};
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
   context->TEST_Write(kShard0, "foo");
   context->CloseShard(kShard0);
   context->TEST_Write(kShard1, "bar");
 
   context->Flush();
-  runner_->OperatorEnd(&out_files);
+  runner_->OperatorEnd(&op_, &out_files);
   vector<ShardId> shards{kShard0, kShard1};
 
   ASSERT_THAT(out_files, KeyMatch(shards));
 }
 
+TEST_F(LocalRunnerTest, MaxOpenHandles) {
+  google::FlagSaver fs;
+  FLAGS_dest_max_open_handles = 2;
+
+  Start(pb::WireFormat::LST);
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+
+  // Every flush writes all the shards, so each one is evicted before it is written again.
+  constexpr unsigned kShards = 5;
+  for (unsigned round = 0; round < 2; ++round) {
+    for (unsigned i = 0; i < kShards; ++i) {
+      context->TEST_Write(ShardId{i}, absl::StrCat("rec", round, "-", i));
+    }
+    context->Flush();
+  }
+
+  ShardFileMap out_files;
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_EQ(kShards, out_files.size());
+
+  for (unsigned i = 0; i < kShards; ++i) {
+    const string& glob = out_files[ShardId{i}];
+    ASSERT_THAT(glob, EndsWith("-*.lst"));
+
+    vector<string> expanded;
+    runner_->ExpandGlob(glob, [&](size_t sz, auto& s) { expanded.push_back(s); });
+    EXPECT_EQ(2, expanded.size()) << glob;
+
+    vector<string> records;
+    for (const string& fl : expanded) {
+      runner_->ProcessInputFile(fl, pb::WireFormat::LST,
+                                [&](string&& s) { records.push_back(std::move(s)); });
+    }
+    EXPECT_THAT(records, UnorderedElementsAre(absl::StrCat("rec0-", i), absl::StrCat("rec1-", i)));
+  }
+}
+
+TEST_F(LocalRunnerTest, ExpandLocalGlob) {
+  string root = base::GetTestTempPath("glob");
+  for (const char* dir : {"a", "a/sub", "b"}) {
+    CHECK_STATUS(file_util::CreateSubDirIfNeeded(file_util::JoinPath(root, dir)));
+  }
+  for (unsigned i = 0; i < 600; ++i) {
+    file_util::WriteStringToFileOrDie("", absl::StrCat(root, "/b/f", i, ".dat"));
+  }
+  file_util::WriteStringToFileOrDie("1", root + "/a/x.txt");
+  file_util::WriteStringToFileOrDie("22", root + "/b/y.txt");
+  file_util::WriteStringToFileOrDie("333", root + "/a/sub/z.txt");
+
+  auto expand = [&](const string& glob) {
+    vector<pair<string, size_t>> res;
+    runner_->ExpandGlob(glob, [&](size_t sz, const string& s) { res.emplace_back(s, sz); });
+    return res;
+  };
+
+  EXPECT_THAT(expand(root + "/*/*.txt"),
+              UnorderedElementsAre(Pair(root + "/a/x.txt", 1), Pair(root + "/b/y.txt", 2)));
+  EXPECT_THAT(expand(root + "/a/**"), UnorderedElementsAre(Pair(root + "/a/x.txt", 1),
+                                                           Pair(root + "/a/sub/z.txt", 3)));
+  EXPECT_EQ(600, expand(root + "/b/*.dat").size());
+  EXPECT_EQ(603, expand(root + "/**").size());
+  EXPECT_THAT(expand(root + "/b/y.txt"), ElementsAre(Pair(root + "/b/y.txt", 2)));
+}
+
+TEST_F(LocalRunnerTest, InMemory) {
+  op_.mutable_output()->set_in_memory(true);
+  Start(pb::WireFormat::TXT, "mem");
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  context->TEST_Write(kShard0, "foo");
+  context->TEST_Write(kShard0, "");
+  context->TEST_Write(kShard1, "bar");
+  context->Flush();
+
+  ShardFileMap out_files;
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "shard-0000.txt"),
+                                              MatchShard(kShard1, "shard-0001.txt")));
+  EXPECT_FALSE(file::Exists(out_files[kShard0]));
+
+  vector<string> expanded;
+  runner_->ExpandGlob(out_files[kShard0], [&](size_t sz, auto& s) { expanded.push_back(s); });
+  EXPECT_THAT(expanded, UnorderedElementsAre(out_files[kShard0]));
+
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputFile(out_files[kShard0], pb::WireFormat::TXT,
+                                         [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(2, cnt);
+  EXPECT_THAT(records, UnorderedElementsAre("foo", ""));
+}
+
+TEST_F(LocalRunnerTest, InMemorySpill) {
+  google::FlagSaver fs;
+  FLAGS_local_runner_shuffle_mb = 0;  // Every shard is spilled into files.
+  runner_->Shutdown();
+  runner_.reset(new LocalRunner{pool_.get(), base::GetTestTempDir()});
+  runner_->Init();
+
+  op_.mutable_output()->set_in_memory(true);
+  Start(pb::WireFormat::LST, "spill");
+
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  vector<string> expected;
+  for (unsigned i = 0; i < 1000; ++i) {
+    expected.push_back(absl::StrCat("rec", i));
+    context->TEST_Write(kShard0, string(expected.back()));
+  }
+  context->Flush();
+
+  ShardFileMap out_files;
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "shard-0000.lst")));
+  EXPECT_TRUE(file::Exists(out_files[kShard0]));
+
+  vector<string> records;
+  size_t cnt = runner_->ProcessInputFile(out_files[kShard0], pb::WireFormat::LST,
+                                         [&](string&& s) { records.push_back(std::move(s)); });
+  EXPECT_EQ(expected.size(), cnt);
+  EXPECT_THAT(records, UnorderedElementsAreArray(expected));
+}
+
+TEST_F(LocalRunnerTest, Sorted) {
+  google::FlagSaver fs;
+  FLAGS_dest_sort_budget_mb = 0;  // Spills every record into its own run.
+  FLAGS_dest_sort_dir = base::GetTestTempDir();
+
+  ShardFileMap out_files;
+  op_.mutable_output()->set_sorted(true);
+  Start(pb::WireFormat::TXT);
+  std::unique_ptr<RawContext> context{runner_->CreateContext(&op_)};
+  for (const char* key : {"c", "a", "d", "b", "a"}) {
+    context->TEST_WriteSorted(kShard0, key, absl::StrCat(key, "1"));
+  }
+
+  context->Flush();
+  runner_->OperatorEnd(&op_, &out_files);
+  ASSERT_THAT(out_files, UnorderedElementsAre(MatchShard(kShard0, "w1/w1-shard-0000.txt")));
+
+  string contents;
+  ASSERT_TRUE(file_util::ReadFileToString(out_files.begin()->second, &contents));
+  EXPECT_EQ("a1\na1\nb1\nc1\nd1\n", contents);
+}
+
+// Reads the whole file through the cache and closes it.
+static string ReadThrough(detail::InputCache* cache, const string& path, const string& gen) {
+  auto res = file::ReadonlyFile::Open(path);
+  CHECK(res.ok()) << res.status;
+  std::unique_ptr<file::ReadonlyFile> fl(cache->Fill(path, gen, res.obj));
+
+  string contents;
+  std::array<uint8_t, 7> buf;
+  while (true) {
+    auto read_res = fl->Read(contents.size(), strings::MutableByteRange(buf));
+    CHECK(read_res.ok()) << read_res.status;
+    if (read_res.obj == 0)
+      break;
+    contents.append(reinterpret_cast<const char*>(buf.data()), read_res.obj);
+  }
+  CHECK_STATUS(fl->Close());
+
+  return contents;
+}
+
+TEST_F(LocalRunnerTest, InputCache) {
+  string dir = file_util::JoinPath(base::GetTestTempDir(), "input_cache");
+  string obj1 = file_util::JoinPath(base::GetTestTempDir(), "obj1.txt");
+  string obj2 = file_util::JoinPath(base::GetTestTempDir(), "obj2.txt");
+  file_util::WriteStringToFileOrDie("first object\n", obj1);
+  file_util::WriteStringToFileOrDie("second object\n", obj2);
+
+  fibers_ext::FiberQueueThreadPool fq_pool(1, 16);
+  detail::InputCache cache(dir, 20, &fq_pool);
+  EXPECT_EQ("", cache.Lookup(obj1, "1"));
+  EXPECT_EQ("first object\n", ReadThrough(&cache, obj1, "1"));
+
+  string cached = cache.Lookup(obj1, "1");
+  ASSERT_FALSE(cached.empty());
+  string contents;
+  ASSERT_TRUE(file_util::ReadFileToString(cached, &contents));
+  EXPECT_EQ("first object\n", contents);
+  EXPECT_EQ("", cache.Lookup(obj1, "2"));  // A new generation is not served from the cache.
+
+  // Both objects do not fit into 20 bytes, so the least recently used one is evicted.
+  EXPECT_EQ("second object\n", ReadThrough(&cache, obj2, "1"));
+  EXPECT_EQ("", cache.Lookup(obj1, "1"));
+  EXPECT_FALSE(cache.Lookup(obj2, "1").empty());
+
+  detail::InputCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(14, stats.cached_bytes);
+}
+
 using benchmark::DoNotOptimize;
 
 static void BM_ReadTextAndPassIt(benchmark::State& state) {
@@ -3,10 +3,14 @@
 //
 #include "mr/mapper_executor.h"
 
+#include <array>
+
 #include "absl/strings/str_cat.h"
 #include "base/histogram.h"
 #include "base/logging.h"
 #include "base/walltime.h"
+#include "mr/impl/memory_budget.h"
+#include "mr/impl/sample.h"
 #include "mr/impl/table_impl.h"
 #include "mr/ptable.h"
 
@@ -16,6 +20,19 @@
 
 DEFINE_uint32(map_limit, 0, "");
 DEFINE_uint32(map_io_read_factor, 2, "");
+DEFINE_uint32(map_split_mb, 256,
+              "Input files larger than this are split into ranges that are mapped independently "
+              "by the IO threads. 0 disables splitting.");
+DEFINE_uint32(map_batch_size, 64, "Maximal number of records passed to a single DoBatch call.");
+DEFINE_bool(map_adaptive_read, true,
+            "If true, the number of reading fibers per IO thread and their read-ahead "
+            "are adjusted at runtime, starting from map_io_read_factor.");
+DEFINE_uint32(map_io_read_factor_max, 8,
+              "Maximal number of reading fibers per IO thread when map_adaptive_read is on.");
+DEFINE_uint32(map_adaptive_period_ms, 500, "How often the adaptive reading is adjusted.");
+DEFINE_bool(map_stream_inputs, false,
+            "If true, input files are passed to the readers as the globs are expanded instead "
+            "of after the expansion, bigger first. Useful with globs over millions of objects.");
 
 namespace mr3 {
 
@@ -25,8 +42,14 @@ using namespace util;
 
 using fibers::channel_op_status;
 
+namespace {
+
+constexpr unsigned kMaxReadAheadScale = 16;
+
+}  // namespace
+
 MapperExecutor::MapperExecutor(util::IoContextPool* pool, Runner* runner)
-    : OperatorExecutor(pool, runner) {
+    : OperatorExecutor(pool, runner), read_control_(pool->size()) {
 }
 
 MapperExecutor::~MapperExecutor() {
@@ -54,17 +77,24 @@ void MapperExecutor::Stop() {
 }
 
 void MapperExecutor::SetupPerIoThread(unsigned index, detail::TableBase* tb) {
+  SetIoIndex(index);
+
   auto* ptr = new PerIoStruct(index);
-  ptr->raw_context.reset(runner_->CreateContext());
+  ptr->raw_context.reset(runner_->CreateContext(&tb->op()));
   RegisterContext(ptr->raw_context.get());
 
   per_io_.reset(ptr);
 
   CHECK_GT(FLAGS_map_io_read_factor, 0);
-  per_io_->process_fd.resize(FLAGS_map_io_read_factor);
+  if (FLAGS_map_adaptive_read) {
+    read_control_.reset(new ReadControl);
+    read_control_->active = FLAGS_map_io_read_factor;
+    read_control_->fiber = fibers::fiber{&MapperExecutor::ControlFiber, this, tb};
+  }
 
-  for (auto& fbr : per_io_->process_fd) {
-    fbr = fibers::fiber{&MapperExecutor::IOReadFiber, this, tb};
+  per_io_->process_fd.resize(FLAGS_map_io_read_factor);
+  for (unsigned i = 0; i < per_io_->process_fd.size(); ++i) {
+    per_io_->process_fd[i] = fibers::fiber{&MapperExecutor::IOReadFiber, this, tb, i};
   }
 }
 
@@ -72,7 +102,15 @@ void MapperExecutor::Run(const std::vector<const InputBase*>& inputs, detail::Ta
                          ShardFileMap* out_files) {
   const string& op_name = tb->op().op_name();
 
-  util::VarzFunction varz_func("mapper-executor", [this] { return GetStats(); });
+  util::VarzFunction varz_func("mapper-executor", [this] {
+    util::VarzValue::Map res = GetStats();
+    if (FLAGS_map_adaptive_read) {
+      res.emplace_back("read-control", GetReadControlStats());
+    }
+    return res;
+  });
+  run_start_usec_ = base::GetMonotonicMicrosFast();
+  StartProgress(&tb->op());
 
   file_name_q_.reset(new FileNameQueue{16});
   runner_->OperatorStart(&tb->op());
@@ -87,21 +125,36 @@ void MapperExecutor::Run(const std::vector<const InputBase*>& inputs, detail::Ta
       break;
   }
 
+  progress_.inputs_expanded = true;
   file_name_q_->close();
 
   // Use AwaitFiberOnAll because Shutdown() blocks the callback.
   pool_->AwaitFiberOnAllSerially([&](IoContext&) {
+    if (read_control_) {
+      // Wakes up the parked readers so that they help with the remaining files.
+      std::unique_lock<fibers::mutex> lk(read_control_->mu);
+      read_control_->stopped = true;
+      lk.unlock();
+      read_control_->cv.notify_all();
+      read_control_->fiber.join();
+
+      VLOG(1) << "Read control finished with " << read_control_->active << " readers, "
+              << "read-ahead scale " << read_control_->read_ahead_scale;
+    }
     per_io_->Shutdown();
     FinalizeContext(per_io_->raw_context.get());
     per_io_.reset();
+    read_control_.reset();
   });
+  MergeFreqMaps();
 
   LOG_IF(WARNING, parse_errors_ > 0) << op_name << " had " << parse_errors_.load() << " errors";
   for (const auto& k_v : metric_map_) {
     LOG(INFO) << op_name << "-" << k_v.first << ": " << k_v.second;
   }
+  LOG(INFO) << op_name << " cpu breakdown: " << cpu_breakdown_.ToString();
 
-  runner_->OperatorEnd(out_files);
+  runner_->OperatorEnd(&tb->op(), out_files);
   file_name_q_.reset();
 }
 
@@ -110,44 +163,127 @@ void MapperExecutor::PushInput(const InputBase* input) {
   CHECK(input->msg().has_format());
 
   vector<FileInput> files;
+  size_t split_size = size_t(FLAGS_map_split_mb) << 20;
+  bool stream = FLAGS_map_stream_inputs;
+
+  auto emit = [&](FileInput fl) {
+    if (!stream) {
+      files.push_back(std::move(fl));
+      return;
+    }
+    progress_.inputs_total.fetch_add(1, std::memory_order_relaxed);
+    progress_.bytes_total.fetch_add(fl.file_size, std::memory_order_relaxed);
+    PushFile(std::move(fl));
+  };
+
   pool_->GetNextContext().AwaitSafe([&] {
     const pb::Input* pb_input = &input->msg();
     for (int i = 0; i < pb_input->file_spec_size(); ++i) {
       const pb::Input::FileSpec& file_spec = pb_input->file_spec(i);
+
+      // The callback may be called by several listing fibers, hence the local ranges.
       runner_->ExpandGlob(file_spec.url_glob(), [&](size_t sz, const auto& str) {
-        files.push_back(FileInput{pb_input, size_t(i), sz, str});
+        vector<Runner::FileRange> ranges;
+        if (split_size) {
+          runner_->SplitInputFile(str, sz, pb_input->format().type(), split_size, &ranges);
+        }
+
+        if (ranges.empty()) {
+          emit(FileInput{pb_input, size_t(i), sz, str});
+          return;
+        }
+        // Ranges are pulled from the shared queue by the IO threads that are idle,
+        // so a large file no longer makes a tail handled by a single thread.
+        for (const auto& range : ranges) {
+          emit(FileInput{pb_input, size_t(i), range.length, str, true, range});
+        }
       });
     }
   });
 
+  if (stream) {
+    LOG(INFO) << "Expanded input " << input->msg().name();
+    return;
+  }
+
   // Sort - bigger sizes first to reduce the variance of the reading phase.
-  std::sort(files.begin(), files.end(),
-            [](const auto& l, auto& r) { return l.file_size > r.file_size; });
+  // Ranges of the same file keep their order.
+  std::stable_sort(files.begin(), files.end(),
+                   [](const auto& l, auto& r) { return l.file_size > r.file_size; });
 
   LOG(INFO) << "Running on input " << input->msg().name() << " with " << files.size() << " files";
-  for (const auto& fl_name : files) {
-    channel_op_status st = file_name_q_->push(fl_name);
-    if (st != channel_op_status::closed) {
-      CHECK_EQ(channel_op_status::success, st);
-    }
+  size_t total_size = 0;
+  for (const auto& fl : files) {
+    total_size += fl.file_size;
+  }
+  progress_.inputs_total.fetch_add(files.size(), std::memory_order_relaxed);
+  progress_.bytes_total.fetch_add(total_size, std::memory_order_relaxed);
+
+  for (auto& fl : files) {
+    PushFile(std::move(fl));
   }
 }
 
-void MapperExecutor::IOReadFiber(detail::TableBase* tb) {
+void MapperExecutor::PushFile(FileInput fl) {
+  channel_op_status st = file_name_q_->push(std::move(fl));
+  if (st != channel_op_status::closed) {
+    CHECK_EQ(channel_op_status::success, st);
+  }
+}
+
+void MapperExecutor::IOReadFiber(detail::TableBase* tb, unsigned reader_index) {
   this_fiber::properties<IoFiberProperties>().set_name("IOReadFiber");
 
   PerIoStruct* aux_local = per_io_.get();
   FileInput file_input;
   uint64_t cnt = 0;
 
+  // The records are passed in blocks that return to the pool once the map fiber processes
+  // them, hence the pool must outlive the queue.
+  detail::RecordBlockPool block_pool;
+
   // contains items pushed from the IORead fiber but not yet processed by MapFiber.
-  RecordQueue record_q(256);
+  RecordQueue record_q(16);
+  size_t queued_records = 0;
+  detail::MemoryBudget* budget = detail::MemoryBudget::ThisThread();
+
+  if (read_control_) {
+    auto& queues = read_control_->queues;
+    if (queues.size() <= reader_index)
+      queues.resize(reader_index + 1);
+    queues[reader_index] = &record_q;
+  }
 
-  fibers::fiber map_fd(&MapperExecutor::MapFiber, &record_q, tb);
+  fibers::fiber map_fd(&MapperExecutor::MapFiber, this, &record_q, &queued_records, tb,
+                       reader_index);
+
+  // The queue depth is sampled for the progress page. Readers of the same thread add up
+  // the changes of their depth.
+  std::atomic<uint64_t>& thread_records = progress_.records[aux_local->index];
+  std::atomic<uint64_t>& thread_queued = progress_.queued[aux_local->index];
+  uint64_t reported_depth = 0;
+  auto report_depth = [&](uint64_t depth) {
+    thread_queued.fetch_add(depth - reported_depth, std::memory_order_relaxed);
+    reported_depth = depth;
+  };
+
+  // The records are copied from the buffers of the reader into a block, which is pushed
+  // when it is full and before the end of the file.
+  constexpr size_t kBlockRecords = 32;
+  constexpr size_t kBlockBytes = 1 << 16;
+  detail::RecordBlockPtr block;
+  auto flush_block = [&] {
+    if (!block)
+      return;
+    queued_records += block->size();
+    record_q.Push(std::move(block));
+  };
 
   VLOG(1) << "Starting MapFiber on " << tb->op().output().DebugString();
 
   while (!aux_local->stop_early) {
+    WaitForActive(reader_index);
+
     channel_op_status st = file_name_q_->pop(file_input);
     if (st == channel_op_status::closed)
       break;
@@ -160,16 +296,52 @@ void MapperExecutor::IOReadFiber(detail::TableBase* tb) {
     record_q.Push(op, 0, file_input.file_name);
     record_q.Push(Record::METADATA, &pb_input->file_spec(file_input.spec_index));
 
-    auto cb = [&, skip = pb_input->skip_header(),
-               file_record_cnt = uint64_t{0}](string&& s) mutable {
-      if (file_record_cnt++ < skip)
+    // The header is skipped only by the first range of the file. The runner skips it
+    // before applying the filter. Positions of the records are relative to the range
+    // and count only the records that passed the filter.
+    Runner::ReadOptions read_opts;
+    read_opts.range = file_input.range;
+    if (!file_input.is_range || file_input.range.offset == 0)
+      read_opts.skip_records = pb_input->skip_header();
+    read_opts.filter = pb_input->filter();
+    read_opts.columns.assign(pb_input->column().begin(), pb_input->column().end());
+    read_opts.literals.assign(pb_input->literal().begin(), pb_input->literal().end());
+
+    double record_rate = pb_input->sample().record_rate();
+    uint64_t sample_threshold = detail::SampleThreshold(record_rate);
+
+    auto cb = [&, file_record_cnt = uint64_t{0}](absl::string_view s) mutable {
+      if (record_rate < 1 && !detail::InSample(s, sample_threshold))
         return;
-      record_q.Push(Record::RECORD, file_record_cnt - 1 - skip, std::move(s));
+      if (file_record_cnt % 256 == 0)
+        report_depth(queued_records);
+
+      // Pauses reading while the map fibers consume the queued records. The reader proceeds
+      // if the queue drains while the budget is still held by other components.
+      if (budget) {
+        if (budget->OverLimit())
+          flush_block();
+        budget->AwaitBelowLimit([&] { return record_q.SizeGuess() == 0; });
+        budget->Charge(s.size());
+      }
+      if (!block)
+        block = block_pool.Get();
+      block->Add(file_record_cnt++, s);
+      if (block->size() >= kBlockRecords || block->bytes() >= kBlockBytes)
+        flush_block();
       aux_local->raw_context->Inc("fn-calls");
+      thread_records.fetch_add(1, std::memory_order_relaxed);
     };
 
-    size_t records_read =
-        runner_->ProcessInputFile(file_input.file_name, input_type, std::move(cb));
+    uint64_t start = base::GetMonotonicMicrosFast();
+    size_t records_read = runner_->ProcessInputRangeViews(file_input.file_name, input_type,
+                                                          read_opts, std::move(cb));
+    flush_block();
+    if (file_input.is_range)
+      aux_local->raw_context->Inc("map-input-ranges");
+    aux_local->read_busy_usec += base::GetMonotonicMicrosFast() - start;
+    progress_.inputs_done.fetch_add(1, std::memory_order_relaxed);
+    progress_.bytes_done.fetch_add(file_input.file_size, std::memory_order_relaxed);
 
     cnt += records_read;
     aux_local->raw_context->IncBy("map-input-" + pb_input->name(), records_read);
@@ -181,11 +353,105 @@ void MapperExecutor::IOReadFiber(detail::TableBase* tb) {
   record_q.StartClosing();
 
   map_fd.join();
+  report_depth(0);
 
+  if (read_control_) {
+    read_control_->queues[reader_index] = nullptr;
+  }
   VLOG(1) << "IOReadFiber after OnShardFinish";
 }
 
-void MapperExecutor::MapFiber(RecordQueue* record_q, detail::TableBase* tb) {
+void MapperExecutor::WaitForActive(unsigned reader_index) {
+  ReadControl* ctl = read_control_.get();
+  if (!ctl)
+    return;
+
+  std::unique_lock<fibers::mutex> lk(ctl->mu);
+  ctl->cv.wait(lk, [&] { return ctl->stopped || reader_index < ctl->active; });
+}
+
+void MapperExecutor::ControlFiber(detail::TableBase* tb) {
+  this_fiber::properties<IoFiberProperties>().set_name("ReadControl");
+
+  ReadControl* ctl = read_control_.get();
+  const unsigned max_readers = std::max(FLAGS_map_io_read_factor, FLAGS_map_io_read_factor_max);
+  const auto period = chrono::milliseconds(FLAGS_map_adaptive_period_ms);
+  uint64_t last_ts = base::GetMonotonicMicrosFast(), last_wait = 0;
+
+  std::unique_lock<fibers::mutex> lk(ctl->mu);
+  while (!ctl->cv.wait_for(lk, period, [ctl] { return ctl->stopped; })) {
+    size_t used = 0, capacity = 0;
+    for (size_t i = 0; i < std::min<size_t>(ctl->active, ctl->queues.size()); ++i) {
+      if (ctl->queues[i]) {
+        used += ctl->queues[i]->SizeGuess();
+        capacity += ctl->queues[i]->Capacity();
+      }
+    }
+
+    uint64_t now = base::GetMonotonicMicrosFast();
+    uint64_t elapsed = (now - last_ts) * ctl->active;
+    double wait_ratio = elapsed ? double(ctl->map_wait_usec - last_wait) / elapsed : 0;
+    last_ts = now;
+    last_wait = ctl->map_wait_usec;
+
+    if (capacity == 0)  // The readers have finished.
+      continue;
+    double occupancy = double(used) / capacity;
+
+    if (occupancy < 0.25 && wait_ratio > 0.25) {
+      // Map fibers starve, therefore reading is the bottleneck. Reading from more files at once
+      // hides the latency of the cloud storage and a longer read-ahead helps the local disks.
+      if (ctl->active == max_readers && ctl->read_ahead_scale == kMaxReadAheadScale)
+        continue;
+
+      if (ctl->read_ahead_scale < kMaxReadAheadScale) {
+        ctl->read_ahead_scale *= 2;
+        runner_->SetReadAheadScale(ctl->read_ahead_scale);
+      }
+      if (ctl->active < max_readers) {
+        unsigned index = ctl->active++;
+        if (index == per_io_->process_fd.size()) {
+          per_io_->process_fd.emplace_back(&MapperExecutor::IOReadFiber, this, tb, index);
+        }
+        ctl->cv.notify_all();
+      }
+      ++ctl->increases;
+    } else if (occupancy > 0.75 && wait_ratio < 0.05 && ctl->active > 1) {
+      // Records pile up, mapping is the bottleneck. Fewer readers use less memory for buffers.
+      --ctl->active;
+      ctl->read_ahead_scale = std::max(1U, ctl->read_ahead_scale / 2);
+      runner_->SetReadAheadScale(ctl->read_ahead_scale);
+      ++ctl->decreases;
+    } else {
+      continue;
+    }
+
+    VLOG(1) << "Read control: occupancy " << occupancy << ", map wait ratio " << wait_ratio
+            << ", readers " << ctl->active << ", read-ahead scale " << ctl->read_ahead_scale;
+  }
+}
+
+util::VarzValue::Map MapperExecutor::GetReadControlStats() {
+  util::VarzValue::Map res;
+
+  pool_->AwaitFiberOnAllSerially([&](IoContext&) {
+    ReadControl* ctl = read_control_.get();
+    if (!ctl || !per_io_)
+      return;
+
+    util::VarzValue::Map thread_stats;
+    thread_stats.emplace_back("readers", util::VarzValue::FromInt(ctl->active));
+    thread_stats.emplace_back("read-ahead-scale", util::VarzValue::FromInt(ctl->read_ahead_scale));
+    thread_stats.emplace_back("increases", util::VarzValue::FromInt(ctl->increases));
+    thread_stats.emplace_back("decreases", util::VarzValue::FromInt(ctl->decreases));
+    res.emplace_back(absl::StrCat("io", per_io_->index), std::move(thread_stats));
+  });
+
+  return res;
+}
+
+void MapperExecutor::MapFiber(RecordQueue* record_q, size_t* queued_records,
+                              detail::TableBase* tb, unsigned reader_index) {
   auto& props = this_fiber::properties<IoFiberProperties>();
   props.set_name("MapFiber");
   props.SetNiceLevel(IoFiberProperties::MAX_NICE_LEVEL);
@@ -193,7 +459,8 @@ void MapperExecutor::MapFiber(RecordQueue* record_q, detail::TableBase* tb) {
   PerIoStruct* aux_local = per_io_.get();
   RawContext* raw_context = aux_local->raw_context.get();
 
-  raw_context->InitPerFiber();
+  RawContext::PerFiber per_fiber;
+  raw_context->BindPerFiber(&per_fiber);
 
   std::unique_ptr<detail::HandlerWrapperBase> handler{
       tb->CreateHandler(aux_local->raw_context.get())};
@@ -201,69 +468,127 @@ void MapperExecutor::MapFiber(RecordQueue* record_q, detail::TableBase* tb) {
 
   CHECK(raw_context);
 
-  Record record;
+  // The blocks are popped in batches, a wait is accounted once per batch.
+  constexpr size_t kPopBatch = 4;
+  std::array<Record, kPopBatch> records;
+  size_t num_records = 0, record_index = 0;
   uint64_t record_num = 0;
   RawSinkCb cb = handler->Get(0);
   base::Histogram hist;
+  detail::MemoryBudget* budget = detail::MemoryBudget::ThisThread();
+
+  // Mappers that implement DoBatch get the records in batches. The batch is flushed before
+  // the file or the metadata of the input change. input_pos() during the call is the position
+  // of the first record in the batch. The strings of the batch and the scratch record keep
+  // their capacity, so parsing a record usually allocates nothing.
+  const RawBatchCb& batch_cb = handler->GetBatch();
+  vector<RawRecord> batch;
+  size_t batch_len = 0, batch_pos = 0;
+  auto flush_batch = [&] {
+    if (batch_len == 0)
+      return;
+    SetPosition(batch_pos, &per_fiber);
+    batch_cb(absl::MakeSpan(batch.data(), batch_len));
+    batch_len = 0;
+  };
+  RawRecord scratch;
 
   while (true) {
-    bool is_open = record_q->Pop(record);
-    if (!is_open)
-      break;
+    if (record_index == num_records) {
+      record_index = 0;
+      num_records = record_q->TryPopBulk(records.begin(), kPopBatch);
+      if (!num_records) {
+        uint64_t wait_start = base::GetMonotonicMicrosFast();
+        num_records = record_q->PopBulk(records.begin(), kPopBatch);
+
+        // Waits of parked readers do not show the utilization, hence they are not counted.
+        ReadControl* ctl = read_control_.get();
+        if (ctl && reader_index < ctl->active) {
+          uint64_t wait = base::GetMonotonicMicrosFast() - wait_start;
+          ctl->map_wait_usec += std::min<uint64_t>(wait, FLAGS_map_adaptive_period_ms * 1000);
+        }
+      }
+      if (!num_records)
+        break;
+    }
+    Record& record = records[record_index++];
 
-    if (record.op != Record::RECORD) {
+    if (record.op != Record::BLOCK) {
+      flush_batch();
       switch (record.op) {
         case Record::BINARY_FORMAT: {
           auto* rec = absl::get_if<pair<size_t, string>>(&record.payload);
           CHECK(rec);
-          SetFileName(true, rec->second, raw_context);
+          SetFileName(true, rec->second, &per_fiber);
           break;
         }
         case Record::TEXT_FORMAT: {
           auto* rec = absl::get_if<pair<size_t, string>>(&record.payload);
           CHECK(rec);
-          SetFileName(false, rec->second, raw_context);
+          SetFileName(false, rec->second, &per_fiber);
           break;
         }
         case Record::METADATA:
-          SetMetaData(*absl::get<const pb::Input::FileSpec*>(record.payload), raw_context);
+          SetMetaData(*absl::get<const pb::Input::FileSpec*>(record.payload), &per_fiber);
           break;
 
         case Record::UNDEFINED:
-        case Record::RECORD:
+        case Record::BLOCK:
           LOG(FATAL) << "Should not happen: " << record.op;
       }
 
       continue;
     }
 
-    ++record_num;
+    // The block leaves the queue, its memory is accounted by the handler from now on.
+    detail::RecordBlockPtr block = std::move(absl::get<detail::RecordBlockPtr>(record.payload));
+    *queued_records -= block->size();
+    if (budget)
+      budget->Release(block->bytes());
 
-    auto now = base::GetMonotonicMicrosFast();
-    if (record_num % 100 == 0) {
-      VLOG_IF(1, now - props.resume_ts() >= 100000) << "MapFiber CallStats: " << hist.ToString();
+    for (size_t i = 0; i < block->size(); ++i) {
+      ++record_num;
 
-      hist.Clear();
-      this_fiber::yield();
-    }
-
-    // TODO: to pass it as argument to Runner::ProcessInputFile.
-    if (FLAGS_map_limit && record_num > FLAGS_map_limit) {
-      continue;
-    }
+      auto now = base::GetMonotonicMicrosFast();
+      if (record_num % 100 == 0) {
+        VLOG_IF(1, now - props.resume_ts() >= 100000) << "MapFiber CallStats: "
+                                                      << hist.ToString();
 
-    VLOG_IF(1, record_num % 1000 == 0) << "Num maps " << record_num;
+        hist.Clear();
+        this_fiber::yield();
+      }
 
-    auto& pos_payload = absl::get<pair<size_t, string>>(record.payload);
-    SetPosition(pos_payload.first, raw_context);
+      // TODO: to pass it as argument to Runner::ProcessInputFile.
+      if (FLAGS_map_limit && record_num > FLAGS_map_limit) {
+        continue;
+      }
 
-    cb(std::move(pos_payload.second));
-    if (VLOG_IS_ON(1)) {
-      auto delta = base::GetMonotonicMicrosFast() - now;
-      hist.Add(delta);
+      VLOG_IF(1, record_num % 1000 == 0) << "Num maps " << record_num;
+
+      if (batch_cb) {
+        if (batch_len == 0)
+          batch_pos = block->position(i);
+        if (batch_len == batch.size())
+          batch.emplace_back();
+        absl::string_view src = (*block)[i];
+        batch[batch_len++].assign(src.data(), src.size());
+        if (batch_len >= std::max(1U, FLAGS_map_batch_size))
+          flush_batch();
+        continue;
+      }
+      SetPosition(block->position(i), &per_fiber);
+
+      absl::string_view src = (*block)[i];
+      scratch.assign(src.data(), src.size());
+      cb(std::move(scratch));
+      if (VLOG_IS_ON(1)) {
+        auto delta = base::GetMonotonicMicrosFast() - now;
+        hist.Add(delta);
+      }
     }
   }
 
+  flush_batch();
   handler->OnShardFinish();
   VLOG(1) << "MapFiber finished " << record_num;
 }
@@ -4,8 +4,11 @@
 #pragma once
 
 #include <boost/fiber/buffered_channel.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/mutex.hpp>
 #include <functional>
 
+#include "mr/impl/record_block.h"
 #include "mr/operator_executor.h"
 #include "util/fibers/simple_channel.h"
 
@@ -17,14 +20,20 @@ class MapperExecutor : public OperatorExecutor {
     size_t spec_index;
     size_t file_size;
     ::std::string file_name;
+
+    // Set if the file is split into ranges that are mapped independently.
+    bool is_range = false;
+    Runner::FileRange range;
   };
   using FileNameQueue = ::boost::fibers::buffered_channel<FileInput>;
 
   struct Record {
-    enum Operand { UNDEFINED, BINARY_FORMAT, TEXT_FORMAT, METADATA, RECORD} op = UNDEFINED;
+    enum Operand { UNDEFINED, BINARY_FORMAT, TEXT_FORMAT, METADATA, BLOCK} op = UNDEFINED;
 
-    // either file spec or <pos,record> pair.
-    absl::variant<const pb::Input::FileSpec*, ::std::pair<size_t, ::std::string>> payload;
+    // either file spec, <pos,file name> pair or a block of records.
+    absl::variant<const pb::Input::FileSpec*, ::std::pair<size_t, ::std::string>,
+                  detail::RecordBlockPtr>
+        payload;
 
     Record() = default;
 
@@ -33,10 +42,29 @@ class MapperExecutor : public OperatorExecutor {
 
     Record(Operand op2, const pb::Input::FileSpec* fspec)
       : op(op2), payload(fspec) {}
+
+    explicit Record(detail::RecordBlockPtr block) : op(BLOCK), payload(::std::move(block)) {}
   };
 
   using RecordQueue = util::fibers_ext::SimpleChannel<Record>;
 
+  // Per IO thread state of the adaptive reading, see ControlFiber.
+  struct ReadControl {
+    ::boost::fibers::mutex mu;
+    ::boost::fibers::condition_variable cv;
+
+    unsigned active = 0;       // Number of reading fibers that may pull input files.
+    unsigned read_ahead_scale = 1;
+    bool stopped = false;
+
+    // Indexed by the reading fiber, reset when the fiber exits.
+    std::vector<RecordQueue*> queues;
+    uint64_t map_wait_usec = 0;  // Time the map fibers waited for records.
+    unsigned increases = 0, decreases = 0;
+
+    ::boost::fibers::fiber fiber;
+  };
+
  public:
   MapperExecutor(util::IoContextPool* pool, Runner* runner);
   ~MapperExecutor();
@@ -51,17 +79,33 @@ class MapperExecutor : public OperatorExecutor {
   void InitInternal() final;
 
   void PushInput(const InputBase*);
+  void PushFile(FileInput fl);
 
   // Input managing fiber that reads files from disk and pumps data into record_q.
-  // One per IO thread.
-  void IOReadFiber(detail::TableBase* tb);
+  // Several per IO thread, reader_index is the index of the fiber within the thread.
+  void IOReadFiber(detail::TableBase* tb, unsigned reader_index);
+
+  // Wakes up periodically and adjusts the number of active IOReadFibers of the IO thread
+  // and their read-ahead. The adjustments are based on the occupancy of the record queues
+  // and on the time the map fibers wait for records.
+  void ControlFiber(detail::TableBase* tb);
+
+  // Blocks the reading fiber while its index is beyond the number of active readers.
+  void WaitForActive(unsigned reader_index);
+
+  util::VarzValue::Map GetReadControlStats();
 
   // index - io thread index.
   void SetupPerIoThread(unsigned index, detail::TableBase* tb);
 
-  static void MapFiber(RecordQueue* record_q, detail::TableBase* tb);
+  // queued_records counts the records of the blocks in record_q, the map fiber subtracts
+  // the blocks it pops.
+  void MapFiber(RecordQueue* record_q, size_t* queued_records, detail::TableBase* tb,
+                unsigned reader_index);
 
   std::unique_ptr<FileNameQueue> file_name_q_;
+
+  PerIoPtr<ReadControl> read_control_;
 };
 
 }  // namespace mr3
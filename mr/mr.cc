@@ -76,6 +76,12 @@ void TableBase::ValidateGroupInputOrDie(const TableBase* other) {
                                         "output. Did you forget to call .Write(..) on it?";
 }
 
+void TableBase::ValidateSortKeysOrDie(const std::string& name, size_t num_keys,
+                                      size_t num_inputs) {
+  CHECK(num_keys == 0 || num_keys == num_inputs)
+      << "Join '" << name << "' must bind either all or none of its inputs with a sort key";
+}
+
 }  // namespace detail
 
 namespace {
@@ -102,9 +108,9 @@ RawContext::RawContext() {
 
 RawContext::~RawContext() {}
 
-void RawContext::InitPerFiber() {
+void RawContext::BindPerFiber(PerFiber* per_fiber) {
   CHECK(!per_fiber_.get());
-  per_fiber_.reset(new PerFiber);
+  per_fiber_.reset(per_fiber);
 }
 
 const detail::FreqMapWrapper *
@@ -139,6 +145,20 @@ void OutputBase::SetShardSpec(pb::ShardSpec::Type st, unsigned modn) {
   }
 }
 
+void OutputBase::SetMaxRawSize(unsigned max_raw_size_mb) {
+  CHECK(out_->has_shard_spec()) << "Sharding must be defined before the size limit. \n"
+                                << out_->ShortDebugString();
+  CHECK_GT(max_raw_size_mb, 0);
+  CHECK(!out_->sorted()) << "Sorted outputs can not be split into sub-shards";
+  out_->mutable_shard_spec()->set_max_raw_size_mb(max_raw_size_mb);
+}
+
+void OutputBase::SetSorted() {
+  CHECK(!out_->shard_spec().has_max_raw_size_mb())
+      << "Sorted outputs can not be split into sub-shards";
+  out_->set_sorted(true);
+}
+
 void OutputBase::FailUndefinedShard() const {
   LOG(FATAL) << "Sharding function for output " << out_->ShortDebugString() << " is not defined.\n"
              << "Did you forget to call .With<Some>Sharding()?";
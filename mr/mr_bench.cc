@@ -0,0 +1,266 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+// Measures the overhead of the mr3 framework on synthetic inputs. Runs canonical pipelines
+// with trivial handlers through LocalRunner and reports their throughput, the time of each
+// operator and the peak RSS of the process. Inputs are generated with a fixed seed, so runs
+// with the same flags process the same records.
+//
+#include <sys/resource.h>
+
+#include <iostream>
+#include <random>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "base/hash.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "file/file.h"
+#include "file/file_util.h"
+#include "file/list_file.h"
+
+#include "mr/local_runner.h"
+#include "mr/mr_main.h"
+#include "mr/pipeline.h"
+
+DEFINE_string(bench_dir, "/tmp/mr_bench", "Directory for the generated inputs and the outputs.");
+DEFINE_string(bench_format, "txt", "Format of the inputs and the outputs: txt or lst.");
+DEFINE_string(bench_pipelines, "identity,reshard,group,join",
+              "Comma separated pipelines to run: identity (a map that passes its records), "
+              "reshard (modn sharding by key without a map), group (count per key) and "
+              "join (count per key joined with a table of one record per key).");
+DEFINE_uint64(bench_records, 1000000, "Number of input records.");
+DEFINE_uint32(bench_record_len, 100, "Length of each input record in bytes.");
+DEFINE_uint32(bench_files, 8, "Number of input files.");
+DEFINE_uint32(bench_keys, 100000, "Number of distinct keys of the records.");
+DEFINE_uint32(bench_modn, 16, "Number of output shards.");
+DEFINE_uint64(bench_seed, 42, "Seed of the generated inputs.");
+
+using namespace mr3;
+using namespace std;
+
+namespace {
+
+constexpr char kFactsName[] = "facts";
+constexpr char kDimsName[] = "dims";
+
+absl::string_view Key(absl::string_view rec) {
+  return rec.substr(0, rec.find('\t'));
+}
+
+unsigned KeyShard(const string& rec) {
+  absl::string_view key = Key(rec);
+  return base::Fingerprint(key.data(), key.size());
+}
+
+bool IsLst() {
+  return FLAGS_bench_format == "lst";
+}
+
+pb::WireFormat::Type OutputFormat() {
+  return IsLst() ? pb::WireFormat::LST : pb::WireFormat::TXT;
+}
+
+class FileGenerator {
+ public:
+  explicit FileGenerator(const string& path) {
+    if (IsLst()) {
+      lst_.reset(new file::ListWriter(path));
+      CHECK_STATUS(lst_->Init());
+    } else {
+      txt_ = file::Open(path);
+      CHECK(txt_) << path;
+    }
+  }
+
+  void Add(const string& rec) {
+    bytes_ += rec.size();
+    if (lst_) {
+      CHECK_STATUS(lst_->AddRecord(rec));
+      return;
+    }
+    buf_.append(rec).push_back('\n');
+    if (buf_.size() > (1 << 20))
+      FlushTxt();
+  }
+
+  uint64_t Close() {
+    if (lst_) {
+      CHECK_STATUS(lst_->Flush());
+      lst_.reset();
+    } else {
+      FlushTxt();
+      CHECK(txt_->Close());
+    }
+    return bytes_;
+  }
+
+ private:
+  void FlushTxt() {
+    CHECK_STATUS(txt_->Write(buf_));
+    buf_.clear();
+  }
+
+  std::unique_ptr<file::ListWriter> lst_;
+  file::WriteFile* txt_ = nullptr;
+  string buf_;
+  uint64_t bytes_ = 0;
+};
+
+// Writes the facts as "key<tab>payload" records padded to bench_record_len and the dims as
+// one "key<tab>value" record per key. Returns the bytes of the facts.
+uint64_t GenerateInputs(const string& input_dir) {
+  CHECK(file_util::RecursivelyCreateDir(input_dir, 0750));
+  CHECK_GT(FLAGS_bench_files, 0);
+  CHECK_GT(FLAGS_bench_keys, 0);
+
+  std::mt19937_64 rnd(FLAGS_bench_seed);
+  std::uniform_int_distribution<uint32_t> key_dist(0, FLAGS_bench_keys - 1);
+  std::uniform_int_distribution<int> char_dist('a', 'z');
+  const char* ext = IsLst() ? ".lst" : ".txt";
+
+  uint64_t bytes = 0;
+  for (unsigned i = 0; i < FLAGS_bench_files; ++i) {
+    FileGenerator gen(file_util::JoinPath(input_dir, absl::StrCat(kFactsName, "-", i, ext)));
+    uint64_t count = FLAGS_bench_records / FLAGS_bench_files +
+                     (i < FLAGS_bench_records % FLAGS_bench_files);
+    string rec;
+    for (uint64_t j = 0; j < count; ++j) {
+      rec = absl::StrCat("k", key_dist(rnd), "\t");
+      while (rec.size() < FLAGS_bench_record_len) {
+        rec.push_back(char_dist(rnd));
+      }
+      gen.Add(rec);
+    }
+    bytes += gen.Close();
+  }
+
+  FileGenerator dims(file_util::JoinPath(input_dir, absl::StrCat(kDimsName, ext)));
+  for (unsigned k = 0; k < FLAGS_bench_keys; ++k) {
+    dims.Add(absl::StrCat("k", k, "\tv", k));
+  }
+  dims.Close();
+
+  return bytes;
+}
+
+class IdentityMapper {
+ public:
+  void Do(string val, DoContext<string>* context) { context->Write(std::move(val)); }
+};
+
+class CountJoiner {
+  absl::flat_hash_map<string, uint64_t> counts_;
+
+ public:
+  void On(string rec, DoContext<string>* context) { ++counts_[string(Key(rec))]; }
+
+  void OnShardFinish(DoContext<string>* context) {
+    for (const auto& k_v : counts_) {
+      context->Write(absl::StrCat(k_v.first, "\t", k_v.second));
+    }
+    counts_.clear();
+  }
+};
+
+class DimJoiner {
+  absl::flat_hash_map<string, string> dims_;
+  absl::flat_hash_map<string, uint64_t> counts_;
+
+ public:
+  void OnDim(string rec, DoContext<string>* context) {
+    absl::string_view key = Key(rec);
+    dims_[string(key)] = string(rec.substr(std::min(key.size() + 1, rec.size())));
+  }
+
+  void OnFact(string rec, DoContext<string>* context) { ++counts_[string(Key(rec))]; }
+
+  void OnShardFinish(DoContext<string>* context) {
+    for (const auto& k_v : counts_) {
+      context->Write(absl::StrCat(k_v.first, "\t", dims_[k_v.first], "\t", k_v.second));
+    }
+    counts_.clear();
+    dims_.clear();
+  }
+};
+
+StringTable Read(Pipeline* pipeline, const string& name, const string& glob) {
+  return IsLst() ? pipeline->ReadLst(name, glob) : pipeline->ReadText(name, glob);
+}
+
+void DefinePipeline(const string& name, const string& input_dir, Pipeline* pipeline) {
+  const char* ext = IsLst() ? ".lst" : ".txt";
+  string facts_glob = file_util::JoinPath(input_dir, absl::StrCat(kFactsName, "-*", ext));
+  StringTable facts = Read(pipeline, kFactsName, facts_glob);
+
+  if (name == "identity") {
+    facts.Map<IdentityMapper>("identity_map")
+        .Write("identity_out", OutputFormat())
+        .WithModNSharding(FLAGS_bench_modn, [](const string& rec) {
+          return unsigned(base::Fingerprint(rec));
+        });
+    return;
+  }
+
+  facts.Write("facts_by_key", OutputFormat()).WithModNSharding(FLAGS_bench_modn, KeyShard);
+  if (name == "reshard")
+    return;
+
+  PTable<string> res;
+  if (name == "group") {
+    res = pipeline->Join<CountJoiner>("group_count", {facts.BindWith(&CountJoiner::On)});
+  } else if (name == "join") {
+    string dims_glob = file_util::JoinPath(input_dir, absl::StrCat(kDimsName, ext));
+    StringTable dims = Read(pipeline, kDimsName, dims_glob);
+    dims.Write("dims_by_key", OutputFormat()).WithModNSharding(FLAGS_bench_modn, KeyShard);
+
+    res = pipeline->Join<DimJoiner>(
+        "dim_join", {dims.BindWith(&DimJoiner::OnDim), facts.BindWith(&DimJoiner::OnFact)});
+  } else {
+    LOG(FATAL) << "Unknown pipeline " << name;
+  }
+  res.Write(absl::StrCat(name, "_out"), OutputFormat());
+}
+
+long PeakRssMb() {
+  struct rusage usage;
+  CHECK_EQ(0, getrusage(RUSAGE_SELF, &usage));
+  return usage.ru_maxrss >> 10;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  PipelineMain pm(&argc, &argv);
+
+  string input_dir = file_util::JoinPath(FLAGS_bench_dir, "input");
+  uint64_t start = base::GetMonotonicMicrosFast();
+  uint64_t input_bytes = GenerateInputs(input_dir);
+  LOG(INFO) << "Generated " << FLAGS_bench_records << " records, " << input_bytes << " bytes in "
+            << (base::GetMonotonicMicrosFast() - start) / 1000 << "ms";
+
+  cout << "pipeline\tseconds\trecords/s\tMB/s\tpeak_rss_mb\n";
+  for (absl::string_view name : absl::StrSplit(FLAGS_bench_pipelines, ',', absl::SkipEmpty())) {
+    pm.ResetPipeline();
+    Pipeline* pipeline = pm.pipeline();
+    DefinePipeline(string(name), input_dir, pipeline);
+
+    string out_dir = file_util::JoinPath(FLAGS_bench_dir, absl::StrCat("out_", name));
+    LocalRunner* runner = pm.StartLocalRunner(out_dir, false);
+
+    start = base::GetMonotonicMicrosFast();
+    CHECK(pipeline->Run(runner));
+    double seconds = (base::GetMonotonicMicrosFast() - start) * 1e-6;
+
+    cout << name << "\t" << seconds << "\t" << uint64_t(FLAGS_bench_records / seconds) << "\t"
+         << (input_bytes >> 20) / seconds << "\t" << PeakRssMb() << "\n";
+    for (const auto& k_v : pipeline->GetOperatorTimes()) {
+      cout << name << "/" << k_v.first << "\t" << k_v.second * 1e-6 << "\n";
+    }
+  }
+
+  return 0;
+}
@@ -4,19 +4,30 @@
 
 #include "mr/mr_main.h"
 
+#include "absl/strings/str_split.h"
 #include "base/init.h"
 
 #include "file/file_util.h"
 
+#include "mr/coordinator.h"
 #include "mr/local_runner.h"
+#include "mr/worker_service.h"
 #include "util/asio/accept_server.h"
 #include "util/asio/io_context_pool.h"
+#include "util/http/http_common.h"
 #include "util/sentry/sentry.h"
 
 namespace mr3 {
 
 DEFINE_int32(http_port, 8080, "Port number.");
+DEFINE_int32(mr_worker_port, -1,
+             "If non-negative, the process runs as mr3 worker that listens on this port and "
+             "executes the operators sent by the coordinator.");
+DEFINE_string(mr_workers, "",
+              "Comma separated list of host:port mr3 workers. If set, the pipeline operators "
+              "run on the workers.");
 
+using namespace std;
 using namespace util;
 
 PipelineMain::PipelineMain() {
@@ -30,30 +41,60 @@ PipelineMain::PipelineMain(int* argc, char*** argv) : guard_(new MainInitGuard{a
 void PipelineMain::ResetPipeline() {
   pipeline_.reset(new Pipeline(pool_.get()));
   runner_.reset();
+  coordinator_.reset();
+
+  if (worker_) {
+    pipeline_->set_worker(worker_.get());
+  }
 }
 
 void PipelineMain::Init() {
   pool_.reset(new IoContextPool);
   pool_->Run();
   util::EnableSentry(&pool_->GetNextContext());
+  if (FLAGS_mr_worker_port >= 0) {
+    CHECK(FLAGS_mr_workers.empty()) << "A process can not be both mr3 worker and coordinator";
+    worker_.reset(new WorkerService);
+  }
   ResetPipeline();
 
   acc_server_.reset(new AcceptServer(pool_.get()));
   if (FLAGS_http_port >= 0) {
+    auto progress_cb = [this](const http::QueryArgs& args, http::HttpHandler::SendFunction* send) {
+      http::StringResponse resp = http::MakeStringResponse(boost::beast::http::status::ok);
+      resp.body() = pipeline_->ProgressPage();
+      http::SetMime(http::kHtmlMime, &resp);
+      return send->Invoke(std::move(resp));
+    };
+    http_listener_.RegisterCb("/progress", false, progress_cb);
+
     uint16_t port = acc_server_->AddListener(FLAGS_http_port, &http_listener_);
     LOG(INFO) << "Started http server on port " << port;
   }
+  if (worker_) {
+    uint16_t port = acc_server_->AddListener(FLAGS_mr_worker_port, worker_.get());
+    LOG(INFO) << "Started mr3 worker on port " << port;
+  }
   acc_server_->Run();
 }
 
 PipelineMain::~PipelineMain() {
+  coordinator_.reset();
   acc_server_->Stop(true);
   pool_->Stop();
 }
 
 LocalRunner* PipelineMain::StartLocalRunner(const std::string& root_dir, bool stop_on_break) {
   CHECK(!runner_);
-  runner_.reset(new LocalRunner(pool_.get(), file_util::ExpandPath(root_dir)));
+  string data_dir = file_util::ExpandPath(root_dir);
+  runner_.reset(new LocalRunner(pool_.get(), data_dir));
+
+  if (!FLAGS_mr_workers.empty()) {
+    vector<string> workers = absl::StrSplit(FLAGS_mr_workers, ',', absl::SkipEmpty());
+    coordinator_.reset(new Coordinator(pool_.get(), data_dir));
+    coordinator_->Connect(workers);
+    pipeline_->set_coordinator(coordinator_.get());
+  }
   if (stop_on_break) {
     acc_server_->TriggerOnBreakSignal([this] {
       pipeline_->Stop();
@@ -14,7 +14,9 @@ class AcceptServer;
 
 namespace mr3 {
 
+class Coordinator;
 class LocalRunner;
+class WorkerService;
 
 class PipelineMain {
 public:
@@ -32,6 +34,8 @@ public:
   void ResetPipeline();
   util::AcceptServer* accept_server() { return acc_server_.get(); }
 
+  //! Creates the runner writing into root_dir. If --mr_workers is set, also connects
+  //! to the workers and runs the pipeline operators on them.
   LocalRunner* StartLocalRunner(const std::string& root_dir, bool stop_on_break = true);
 
 private:
@@ -44,6 +48,8 @@ private:
   std::unique_ptr<util::AcceptServer> acc_server_;
   util::http::Listener<> http_listener_;
   std::unique_ptr<LocalRunner> runner_;
+  std::unique_ptr<WorkerService> worker_;
+  std::unique_ptr<Coordinator> coordinator_;
 };
 
 }  // namespace mr3
@@ -4,9 +4,13 @@
 
 #pragma once
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/message.h>
 
+#include <memory>
+
 #include "mr/do_context.h"
+#include "mr/impl/table_impl.h"
 
 namespace mr3 {
 
@@ -36,4 +40,49 @@ class RecordTraits<PB, std::enable_if_t<std::is_base_of<google::protobuf::Messag
     return msg.GetTypeName();
   }
 };
+
+namespace detail {
+
+/*! Parses protobuf records into messages allocated on an arena, so that their nested fields
+    do not go through the allocator record by record. The arena is reset once it grows
+    beyond kResetSize while none of its messages is passed to a handler. Handlers that keep
+    a record must move it into their own message, which copies it off the arena.
+    Copies of the parser start with an empty arena. Used for the message types that are
+    arena enabled (cc_enable_arenas), the rest are parsed with RecordTraits.
+*/
+template <typename PB>
+class DefaultParser<PB,
+                    std::enable_if_t<std::is_base_of<google::protobuf::Message, PB>::value &&
+                                     google::protobuf::Arena::is_arena_constructable<PB>::value>> {
+ public:
+  static constexpr size_t kResetSize = 1 << 20;
+
+  DefaultParser() = default;
+  DefaultParser(const DefaultParser&) {}
+
+  bool operator()(bool is_binary, RawRecord&& rr, PB* res) {
+    res->Clear();
+    return PB_Serializer::From(is_binary, std::move(rr), res);
+  }
+
+  PB* Allocate() {
+    if (!arena_) {
+      arena_.reset(new google::protobuf::Arena);
+    }
+    ++live_;
+    return google::protobuf::Arena::CreateMessage<PB>(arena_.get());
+  }
+
+  void Release(PB*) {
+    if (--live_ == 0 && arena_->SpaceAllocated() > kResetSize) {
+      arena_->Reset();
+    }
+  }
+
+ private:
+  std::unique_ptr<google::protobuf::Arena> arena_;
+  unsigned live_ = 0;
+};
+
+}  // namespace detail
 }  // namespace mr3
@@ -9,6 +9,7 @@
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "file/file_util.h"
+#include "mr/impl/sample.h"
 #include "mr/mr_pb.h"
 #include "mr/pipeline.h"
 #include "mr/test_utils.h"
@@ -21,6 +22,10 @@ using namespace std;
 
 DECLARE_uint32(io_context_threads);
 DECLARE_uint32(map_io_read_factor);
+DECLARE_uint32(join_sort_budget_mb);
+DECLARE_string(join_spill_dir);
+DECLARE_uint32(pipeline_max_concurrent_ops);
+DECLARE_uint32(mr_memory_budget_mb);
 
 namespace mr3 {
 
@@ -255,6 +260,98 @@ TEST_F(MrTest, MapAB) {
   EXPECT_THAT(*int_map, UnorderedElementsAre(Pair(1, 1), Pair(2, 1), Pair(3, 1), Pair(4, 1)));
 }
 
+TEST_F(MrTest, FusedMap) {
+  vector<string> elements{"1", "2", "3", "4"};
+
+  runner_.AddInputRecords("bar.txt", elements);
+  PTable<IntVal> itable = pipeline_->ReadText("read_bar", "bar.txt").As<IntVal>();
+
+  // Map1 does not have an output, therefore it runs in the same pass with IntMap.
+  MetaCheck meta_check;
+  PTable<IntVal> final_table =
+      itable.Map<StrValMapper>("Map1", &meta_check).Map<IntMapper>("IntMap");
+  final_table.Write("final_table", pb::WireFormat::TXT).WithModNSharding(7, [](const IntVal&) {
+    return 10;
+  });
+
+  pipeline_->Run(&runner_);
+  EXPECT_THAT(meta_check.input_files, UnorderedElementsAre("bar.txt"));
+  EXPECT_THAT(runner_.Table("final_table"), ElementsAre(MatchShard(3, elements)));
+  EXPECT_EQ("fn-calls,4\n"
+            "fn-writes,4\n"
+            "map-input-read_bar,4\n"
+            "parse-errors,0\n",
+            runner_.SavedFile(file_util::JoinPath("final_table", "counter_map.csv")));
+}
+
+class BatchMapper {
+ public:
+  explicit BatchMapper(vector<size_t>* batch_sizes) : batch_sizes_(batch_sizes) {}
+
+  // Not called, since the whole input is handled by DoBatch.
+  void Do(IntVal iv, mr3::DoContext<IntVal>* cntx) { LOG(FATAL) << "Should not be called"; }
+
+  void DoBatch(absl::Span<IntVal> span, mr3::DoContext<IntVal>* cntx) {
+    batch_sizes_->push_back(span.size());
+    for (auto& iv : span) {
+      iv.val *= 2;
+      cntx->Write(std::move(iv));
+    }
+  }
+
+ private:
+  vector<size_t>* batch_sizes_;
+};
+
+TEST_F(MrTest, DoBatch) {
+  vector<string> elements;
+  for (unsigned i = 0; i < 100; ++i)
+    elements.push_back(absl::StrCat(i));
+  elements.push_back("foo");  // Parse error, skipped by the batch.
+
+  runner_.AddInputRecords("bar.txt", elements);
+  vector<size_t> batch_sizes;
+  PTable<IntVal> itable = pipeline_->ReadText("read_bar", "bar.txt").As<IntVal>();
+  itable.Map<BatchMapper>("BatchMap", &batch_sizes)
+      .Write("batch_table", pb::WireFormat::TXT)
+      .WithModNSharding(7, [](const IntVal&) { return 10; });
+
+  pipeline_->Run(&runner_);
+
+  vector<string> expected;
+  for (unsigned i = 0; i < 100; ++i)
+    expected.push_back(absl::StrCat(i * 2));
+
+  EXPECT_THAT(runner_.Table("batch_table"), ElementsAre(MatchShard(3, expected)));
+  EXPECT_THAT(batch_sizes, ElementsAre(64, 36));
+  EXPECT_EQ("fn-calls,101\n"
+            "fn-writes,100\n"
+            "map-input-read_bar,101\n"
+            "parse-errors,1\n",
+            runner_.SavedFile(file_util::JoinPath("batch_table", "counter_map.csv")));
+}
+
+TEST_F(MrTest, CpuSample) {
+  detail::CpuBreakdown breakdown;
+  pool_->GetNextContext().AwaitSafe([&] {
+    detail::CpuSample sample;
+    sample.Mark(detail::CPU_PARSE);
+    sample.Mark(detail::CPU_WRITE);
+    sample.Commit(&breakdown);
+
+    // Samples spanning a fiber switch are dropped.
+    detail::CpuSample preempted;
+    fibers::fiber fb([] {});
+    fb.join();
+    preempted.Mark(detail::CPU_DO);
+    preempted.Commit(&breakdown);
+  });
+
+  EXPECT_EQ(1, breakdown.samples);
+  EXPECT_EQ(1, breakdown.preempted);
+  EXPECT_EQ(0, breakdown.cycles[detail::CPU_DO]);
+}
+
 class StrJoiner {
   absl::flat_hash_map<int, int> counts_;
 
@@ -271,6 +368,101 @@ class StrJoiner {
   }
 };
 
+TEST_F(MrTest, Incremental) {
+  runner_.AddInputRecords("inc1.txt", {"1", "2"});
+  runner_.AddInputRecords("inc2.txt", {"3"});
+
+  auto run = [&](const vector<string>& globs) {
+    Pipeline pipeline(pool_.get());
+    pipeline.set_incremental(true);
+    pipeline.ReadText("read_inc", globs)
+        .Write("inc_out", pb::WireFormat::TXT)
+        .WithCustomSharding([](const std::string& rec) { return "shard1"; });
+    EXPECT_TRUE(pipeline.Run(&runner_));
+  };
+
+  run({"inc1.txt"});
+  EXPECT_THAT(runner_.Table("inc_out"), ElementsAre(MatchShard("shard1", {"1", "2"})));
+
+  // Only the new file is processed.
+  run({"inc1.txt", "inc2.txt"});
+  EXPECT_THAT(runner_.Table("inc_out"), ElementsAre(MatchShard("shard1", {"3"})));
+  EXPECT_EQ("inc1.txt,2\ninc2.txt,1\n",
+            runner_.SavedFile(file_util::JoinPath("inc_out", "input_manifest.csv")));
+
+  // Nothing new, the operator is skipped.
+  run({"inc1.txt", "inc2.txt"});
+  EXPECT_THAT(runner_.Table("inc_out"), ElementsAre(MatchShard("shard1", {"3"})));
+}
+
+TEST_F(MrTest, Sample) {
+  vector<string> globs;
+  vector<string> expected;
+  uint64_t threshold = detail::SampleThreshold(0.5);
+  for (unsigned i = 0; i < 8; ++i) {
+    string name = absl::StrCat("sample", i, ".txt");
+    runner_.AddInputRecords(name, {absl::StrCat(i)});
+    globs.push_back(name);
+    if (detail::InSample(name, threshold))
+      expected.push_back(absl::StrCat(i));
+  }
+  ASSERT_FALSE(expected.empty());
+
+  pipeline_->ReadText("read_sample", globs)
+      .set_sample(0.5)
+      .Write("sample_out", pb::WireFormat::TXT)
+      .WithCustomSharding([](const std::string& rec) { return "shard1"; });
+  EXPECT_TRUE(pipeline_->Run(&runner_));
+
+  EXPECT_THAT(runner_.Table("sample_out"), ElementsAre(MatchShard("shard1", expected)));
+  EXPECT_FALSE(
+      runner_.SavedFile(file_util::JoinPath("sample_out", "counter_map_estimated.csv")).empty());
+}
+
+TEST_F(MrTest, SampleRecords) {
+  vector<string> records;
+  for (unsigned i = 0; i < 1000; ++i) {
+    records.push_back(absl::StrCat(i));
+  }
+  runner_.AddInputRecords("sample_records.txt", records);
+
+  pipeline_->ReadText("read_sample", "sample_records.txt")
+      .set_sample(1, 0.1)
+      .Write("sample_out", pb::WireFormat::TXT)
+      .WithCustomSharding([](const std::string& rec) { return "shard1"; });
+  pipeline_->Run(&runner_);
+
+  const auto& shards = runner_.Table("sample_out");
+  ASSERT_EQ(1U, shards.size());
+  size_t count = shards.begin()->second.size();
+  EXPECT_GT(count, 50);
+  EXPECT_LT(count, 150);
+}
+
+TEST_F(MrTest, MemoryBudget) {
+  // The records exceed the budget many times, therefore the reader pauses until they are
+  // mapped.
+  vector<string> records;
+  for (unsigned i = 0; i < 64; ++i) {
+    records.push_back(string(1 << 16, 'a' + i % 26));
+  }
+  runner_.AddInputRecords("budget.txt", records);
+
+  uint32_t prev_budget = FLAGS_mr_memory_budget_mb;
+  FLAGS_mr_memory_budget_mb = 1;
+  pipeline_->ReadText("read_budget", "budget.txt")
+      .Write("budget_out", pb::WireFormat::TXT)
+      .WithCustomSharding([](const std::string& rec) { return "shard1"; });
+  EXPECT_TRUE(pipeline_->Run(&runner_));
+  FLAGS_mr_memory_budget_mb = prev_budget;
+
+  EXPECT_THAT(runner_.Table("budget_out"), ElementsAre(MatchShard("shard1", records)));
+}
+
+TEST_F(MrTest, ProgressPage) {
+  EXPECT_THAT(pipeline_->ProgressPage(), testing::HasSubstr("No pipeline is running"));
+}
+
 TEST_F(MrTest, Join) {
   vector<string> stream1{"1", "2", "3", "4"}, stream2{"2", "3"};
 
@@ -302,6 +494,172 @@ TEST_F(MrTest, Join) {
             runner_.SavedFile(file_util::JoinPath("joinw", "counter_map.csv")));
 }
 
+TEST_F(MrTest, ConcurrentOps) {
+  vector<string> stream1{"1", "2", "3", "4"}, stream2{"2", "3"};
+
+  runner_.AddInputRecords("stream1.txt", stream1);
+  runner_.AddInputRecords("stream2.txt", stream2);
+
+  // ss1 and ss2 are independent and run concurrently, the join waits for both.
+  PTable<IntVal> itable1 = pipeline_->ReadText("read1", "stream1.txt").As<IntVal>();
+  PTable<IntVal> itable2 = pipeline_->ReadText("read2", "stream2.txt").As<IntVal>();
+  itable1.Write("ss1", pb::WireFormat::TXT).WithModNSharding(3, [](const IntVal& iv) {
+    return iv.val;
+  });
+
+  itable2.Write("ss2", pb::WireFormat::TXT).WithModNSharding(3, [](const IntVal& iv) {
+    return iv.val;
+  });
+
+  PTable<string> res = pipeline_->Join(
+      "join_tables", {itable1.BindWith(&StrJoiner::On1), JoinInput(itable2, &StrJoiner::On2)});
+
+  res.Write("joinw", pb::WireFormat::TXT);
+
+  uint32_t prev_ops = FLAGS_pipeline_max_concurrent_ops;
+  FLAGS_pipeline_max_concurrent_ops = 2;
+  EXPECT_TRUE(pipeline_->Run(&runner_));
+  FLAGS_pipeline_max_concurrent_ops = prev_ops;
+
+  EXPECT_THAT(runner_.Table("ss1"), UnorderedElementsAre(MatchShard(0, {"3"}),
+                                                         MatchShard(1, {"1", "4"}),
+                                                         MatchShard(2, {"2"})));
+  EXPECT_THAT(runner_.Table("joinw"),
+              UnorderedElementsAre(MatchShard(0, {"3:11"}), MatchShard(1, {"1:1", "4:1"}),
+                                   MatchShard(2, {"2:11"})));
+}
+
+// Emits per-record results, therefore can handle parts of the same shard independently.
+class FilterJoiner {
+ public:
+  static constexpr bool kMergeableShards = true;
+
+  void On1(IntVal&& iv, DoContext<string>* out) { out->Write(absl::StrCat(iv.val, ":1")); }
+
+  void On2(IntVal&& iv, DoContext<string>* out) { out->Write(absl::StrCat(iv.val, ":2")); }
+};
+
+TEST_F(MrTest, MergeableJoin) {
+  vector<string> stream1{"1", "2", "3", "4"}, stream2{"2", "3"};
+
+  runner_.AddInputRecords("stream1.txt", stream1);
+  runner_.AddInputRecords("stream2.txt", stream2);
+
+  PTable<IntVal> itable1 = pipeline_->ReadText("read1", "stream1.txt").As<IntVal>();
+  PTable<IntVal> itable2 = pipeline_->ReadText("read2", "stream2.txt").As<IntVal>();
+  itable1.Write("ss1", pb::WireFormat::TXT)
+      .WithModNSharding(3, [](const IntVal& iv) { return iv.val; })
+      .WithMaxRawSize(1);
+  itable2.Write("ss2", pb::WireFormat::TXT).WithModNSharding(3, [](const IntVal& iv) {
+    return iv.val;
+  });
+
+  PTable<string> res = pipeline_->Join(
+      "join_tables", {itable1.BindWith(&FilterJoiner::On1), itable2.BindWith(&FilterJoiner::On2)});
+  res.Write("joinw", pb::WireFormat::TXT);
+
+  pipeline_->Run(&runner_);
+  EXPECT_THAT(runner_.Table("joinw"),
+              UnorderedElementsAre(MatchShard(0, {"3:1", "3:2"}), MatchShard(1, {"1:1", "4:1"}),
+                                   MatchShard(2, {"2:1", "2:2"})));
+}
+
+// Expects its inputs to be grouped by key, therefore holds the state of a single key.
+class SortedJoiner {
+  int key_ = -1;
+  int count_ = 0;
+  set<int> finished_;
+
+ public:
+  void On1(IntVal&& iv, DoContext<string>* out) { Add(iv.val, 1); }
+
+  void On2(IntVal&& iv, DoContext<string>* out) { Add(iv.val, 10); }
+
+  void OnGroupFinish(DoContext<string>* cntx) {
+    cntx->Write(absl::StrCat(key_, ":", count_));
+    count_ = 0;
+  }
+
+ private:
+  void Add(int key, int cnt) {
+    if (key != key_) {
+      CHECK(finished_.insert(key).second) << "Key " << key << " was not grouped";
+      key_ = key;
+    }
+    count_ += cnt;
+  }
+};
+
+TEST_F(MrTest, SortedJoin) {
+  vector<string> stream1{"1", "2", "3", "4", "1"}, stream2{"3", "2", "3"};
+
+  runner_.AddInputRecords("stream1.txt", stream1);
+  runner_.AddInputRecords("stream2.txt", stream2);
+
+  PTable<IntVal> itable1 = pipeline_->ReadText("read1", "stream1.txt").As<IntVal>();
+  PTable<IntVal> itable2 = pipeline_->ReadText("read2", "stream2.txt").As<IntVal>();
+  itable1.Write("ss1", pb::WireFormat::TXT).WithModNSharding(3, [](const IntVal& iv) {
+    return iv.val;
+  });
+  itable2.Write("ss2", pb::WireFormat::TXT).WithModNSharding(3, [](const IntVal& iv) {
+    return iv.val;
+  });
+
+  auto key_fn = [](const IntVal& iv) { return std::to_string(iv.val); };
+  PTable<string> res = pipeline_->Join("join_sorted", {itable1.BindWith(&SortedJoiner::On1, key_fn),
+                                                       itable2.BindWith(&SortedJoiner::On2, key_fn)});
+  res.Write("joinw", pb::WireFormat::TXT);
+
+  // Zero budget spills every record into its own run.
+  uint32_t prev_budget = FLAGS_join_sort_budget_mb;
+  FLAGS_join_sort_budget_mb = 0;
+  FLAGS_join_spill_dir = base::GetTestTempDir();
+  pipeline_->Run(&runner_);
+  FLAGS_join_sort_budget_mb = prev_budget;
+
+  EXPECT_THAT(runner_.Table("joinw"),
+              UnorderedElementsAre(MatchShard(0, {"3:21"}), MatchShard(1, {"1:2", "4:1"}),
+                                   MatchShard(2, {"2:11"})));
+  EXPECT_EQ("fn-calls,8\n"
+            "fn-writes,4\n"
+            "join-spilled-runs,8\n"
+            "parse-errors,0\n",
+            runner_.SavedFile(file_util::JoinPath("joinw", "counter_map.csv")));
+}
+
+TEST_F(MrTest, MergeJoin) {
+  vector<string> stream1{"4", "1", "3", "2", "1"}, stream2{"3", "2", "3"};
+
+  runner_.AddInputRecords("stream1.txt", stream1);
+  runner_.AddInputRecords("stream2.txt", stream2);
+
+  auto key_fn = [](const IntVal& iv) { return std::to_string(iv.val); };
+  auto shard_fn = [](const IntVal& iv) { return iv.val; };
+
+  PTable<IntVal> itable1 = pipeline_->ReadText("read1", "stream1.txt").As<IntVal>();
+  PTable<IntVal> itable2 = pipeline_->ReadText("read2", "stream2.txt").As<IntVal>();
+  itable1.Write("ss1", pb::WireFormat::TXT).WithModNSharding(3, shard_fn).WithSortKey(key_fn);
+  itable2.Write("ss2", pb::WireFormat::TXT).WithModNSharding(3, shard_fn).WithSortKey(key_fn);
+
+  PTable<string> res = pipeline_->Join("join_merged", {itable1.BindWith(&SortedJoiner::On1, key_fn),
+                                                       itable2.BindWith(&SortedJoiner::On2, key_fn)});
+  res.Write("joinw", pb::WireFormat::TXT);
+  pipeline_->Run(&runner_);
+
+  EXPECT_THAT(runner_.Table("ss1"),
+              UnorderedElementsAre(Pair(ShardId{0}, ElementsAre("3")),
+                                   Pair(ShardId{1}, ElementsAre("1", "1", "4")),
+                                   Pair(ShardId{2}, ElementsAre("2"))));
+  EXPECT_THAT(runner_.Table("joinw"),
+              UnorderedElementsAre(MatchShard(0, {"3:21"}), MatchShard(1, {"1:2", "4:1"}),
+                                   MatchShard(2, {"2:11"})));
+  EXPECT_EQ("fn-calls,8\n"
+            "fn-writes,4\n"
+            "join-merged-shards,3\n"
+            "parse-errors,0\n",
+            runner_.SavedFile(file_util::JoinPath("joinw", "counter_map.csv")));
+}
+
 TEST_F(MrTest, MetadataPerFiber) {
   google::FlagSaver fs;
 
@@ -440,6 +798,120 @@ TEST_F(MrTest, FreqMapThroughCtor) {
   EXPECT_THAT(runner_.Table("str3"), ElementsAre(MatchShard(1, elements_with_counts)));
 }
 
+class SketchMapper {
+ public:
+  void Do(IntVal iv, mr3::DoContext<IntVal>* ctx) {
+    ctx->raw()->GetSketchStatistic<HyperLogLog>("distinct", 10).Add(iv.val % 100);
+    ctx->raw()->GetSketchStatistic<CountMinSketch>("counts").Add(iv.val % 100);
+    ctx->raw()->GetSketchStatistic<TDigest>("latency").Add(iv.val);
+    ctx->Write(std::move(iv));
+  }
+};
+
+TEST_F(MrTest, Sketches) {
+  vector<string> elements;
+  for (unsigned i = 0; i < 1000; ++i)
+    elements.push_back(absl::StrCat(i));
+  runner_.AddInputRecords("bar.txt", elements);
+
+  PTable<IntVal> itable = pipeline_->ReadText("read_bar", "bar.txt").As<IntVal>();
+  itable.Map<SketchMapper>("sketch").Write("sketch_table", pb::WireFormat::TXT);
+  pipeline_->Run(&runner_);
+
+  const HyperLogLog* hll = pipeline_->GetSketch<HyperLogLog>("distinct");
+  ASSERT_TRUE(hll);
+  EXPECT_EQ(10, hll->precision());
+  EXPECT_NEAR(100, hll->Estimate(), 5);
+
+  const CountMinSketch* cms = pipeline_->GetSketch<CountMinSketch>("counts");
+  ASSERT_TRUE(cms);
+  EXPECT_EQ(1000, cms->total_count());
+  EXPECT_EQ(10, cms->Estimate(42));
+
+  const TDigest* digest = pipeline_->GetSketch<TDigest>("latency");
+  ASSERT_TRUE(digest);
+  EXPECT_EQ(1000, digest->total_weight());
+  EXPECT_NEAR(500, digest->Quantile(0.5), 10);
+  EXPECT_NEAR(990, digest->Quantile(0.99), 3);
+  EXPECT_EQ(0, digest->Quantile(0));
+  EXPECT_EQ(999, digest->Quantile(1));
+}
+
+TEST_F(MrTest, SketchMerge) {
+  HyperLogLog hll1, hll2;
+  TDigest digest1, digest2;
+  for (unsigned i = 0; i < 50000; ++i) {
+    hll1.Add(i);
+    hll2.Add(i + 25000);
+    digest1.Add(i);
+    digest2.Add(i + 50000);
+  }
+  hll1.Merge(hll2);
+  EXPECT_NEAR(75000, hll1.Estimate(), 75000 * 0.03);
+
+  digest1.Merge(digest2);
+  EXPECT_EQ(100000, digest1.total_weight());
+  EXPECT_NEAR(50000, digest1.Quantile(0.5), 500);
+  EXPECT_NEAR(99900, digest1.Quantile(0.999), 30);
+
+  CountMinSketch cms1(256, 4), cms2(256, 4);
+  for (unsigned i = 0; i < 1000; ++i) {
+    cms1.Add(i);
+    cms2.Add(i % 10, 2);
+  }
+  cms1.Merge(cms2);
+  EXPECT_GE(cms1.Estimate(7), 201);
+  EXPECT_LE(cms1.Estimate(7), 201 + 3000 * 2.72 / 256);
+}
+
+static constexpr char kDimMap[] = "dim_map";
+
+// Looks up every record in a broadcast map keyed by the last digit of the dimension records.
+class BroadcastMapper {
+ public:
+  BroadcastMapper(PipelineContext* ctx) : dim_(ctx->FindBroadcastMap<int, IntVal>(kDimMap)) {}
+
+  void Do(IntVal iv, DoContext<string>* cntx) {
+    auto it = dim_->find(iv.val);
+    if (it == dim_->end()) {
+      cntx->raw()->Inc("not-found");
+      return;
+    }
+    cntx->Write(absl::StrCat(iv.val, ":", it->second.val));
+  }
+
+ private:
+  const BroadcastMap<int, IntVal>* const dim_;
+};
+
+TEST_F(MrTest, BroadcastJoin) {
+  runner_.AddInputRecords("dim.txt", {"11", "12", "22"});
+  runner_.AddInputRecords("fact.txt", {"1", "2", "3", "1"});
+
+  PTable<IntVal> dim = pipeline_->ReadText("read_dim", "dim.txt").As<IntVal>();
+  dim.Write("dim", pb::WireFormat::LST).WithModNSharding(2, [](const IntVal& iv) {
+    return iv.val;
+  });
+  dim.Broadcast(kDimMap, [](const IntVal& iv) { return iv.val % 10; });
+
+  PTable<IntVal> fact = pipeline_->ReadText("read_fact", "fact.txt").As<IntVal>();
+  PTable<string> res = fact.Map<BroadcastMapper>("enrich");
+  res.Write("enriched", pb::WireFormat::TXT).WithModNSharding(1, [](const string&) { return 0; });
+
+  pipeline_->Run(&runner_);
+
+  const BroadcastMap<int, IntVal>* dim_map = pipeline_->GetBroadcastMap<int, IntVal>(kDimMap);
+  ASSERT_TRUE(dim_map);
+  EXPECT_EQ(2, dim_map->size());
+  EXPECT_THAT(runner_.Table("enriched"), ElementsAre(MatchShard(0, {"1:11", "2:12", "1:11"})));
+  EXPECT_EQ("fn-calls,4\n"
+            "fn-writes,3\n"
+            "map-input-read_fact,4\n"
+            "not-found,1\n"
+            "parse-errors,0\n",
+            runner_.SavedFile(file_util::JoinPath("enriched", "counter_map.csv")));
+}
+
 class AddressMapper {
  public:
   void Do(string str, DoContext<tutorial::Address>* out) {
@@ -497,6 +969,62 @@ TEST_F(MrTest, Scope) {
   EXPECT_THAT(runner_.Table("w1"), UnorderedElementsAre(MatchShard(1, stream1)));
 }
 
+struct WordCnt {
+  string word;
+  int cnt;
+};
+
+template <> class RecordTraits<WordCnt> {
+ public:
+  static std::string Serialize(bool is_binary, const WordCnt& wc) {
+    return absl::StrCat(wc.word, ":", wc.cnt);
+  }
+
+  bool Parse(bool is_binary, std::string&& tmp, WordCnt* res) {
+    size_t pos = tmp.find(':');
+    if (pos == string::npos)
+      return false;
+    res->word = tmp.substr(0, pos);
+    return safe_strto32(tmp.substr(pos + 1), &res->cnt);
+  }
+};
+
+class WordCntMapper {
+ public:
+  void Do(string val, DoContext<WordCnt>* cntx) { cntx->Write(WordCnt{std::move(val), 1}); }
+};
+
+TEST_F(MrTest, Combiner) {
+  vector<string> elements{"a", "b", "a", "c", "a", "b"};
+  runner_.AddInputRecords("bar.txt", elements);
+
+  auto word_fn = [](const WordCnt& wc) { return wc.word; };
+  auto merge_fn = [](WordCnt* dest, WordCnt&& src) { dest->cnt += src.cnt; };
+
+  PTable<WordCnt> words = pipeline_->ReadText("read_bar", "bar.txt").Map<WordCntMapper>("words");
+  words.Write("combined", pb::WireFormat::TXT)
+      .WithCustomSharding(word_fn)
+      .WithCombiner(word_fn, merge_fn);
+
+  PTable<WordCnt> bounded =
+      pipeline_->ReadText("read_bar2", "bar.txt").Map<WordCntMapper>("bounded_words");
+  bounded.Write("bounded", pb::WireFormat::TXT)
+      .WithCustomSharding(word_fn)
+      .WithCombiner(word_fn, merge_fn, 3);
+
+  pipeline_->Run(&runner_);
+
+  EXPECT_THAT(runner_.Table("combined"),
+              UnorderedElementsAre(MatchShard("a", {"a:3"}), MatchShard("b", {"b:2"}),
+                                   MatchShard("c", {"c:1"})));
+
+  // The table is flushed when it reaches 3 distinct keys.
+  EXPECT_THAT(runner_.Table("bounded"),
+              UnorderedElementsAre(MatchShard("a", {"a:2", "a:1"}), MatchShard("b", {"b:1", "b:1"}),
+                                   MatchShard("c", {"c:1"})));
+  EXPECT_EQ(3 + 5, runner_.write_calls);
+}
+
 static void BM_ShardAndWrite(benchmark::State& state) {
   IoContextPool pool(1);
   pool.Run();
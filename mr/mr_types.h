@@ -4,9 +4,11 @@
 #pragma once
 
 #include <functional>
+#include <map>
 #include <string>
 
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "absl/types/variant.h"
 
 namespace mr3 {
@@ -20,6 +22,12 @@ using RawRecord = ::std::string;
 
 typedef std::function<void(RawRecord&& record)> RawSinkCb;
 
+// Gets a record that is valid only during the call, see Runner::ProcessInputRangeViews.
+typedef std::function<void(absl::string_view record)> RawViewCb;
+
+// Consumes a batch of records, the callee may move them out of the span.
+typedef std::function<void(absl::Span<RawRecord> records)> RawBatchCb;
+
 template <typename Handler, typename ToType>
 using RawSinkMethodFactory = std::function<RawSinkCb(Handler* handler, DoContext<ToType>* context)>;
 
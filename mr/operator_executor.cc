@@ -3,6 +3,8 @@
 //
 #include "mr/operator_executor.h"
 
+#include "absl/strings/str_cat.h"
+#include "base/integral_types.h"
 #include "base/logging.h"
 #include "base/walltime.h"
 
@@ -12,10 +14,38 @@ namespace mr3 {
 using namespace boost;
 using namespace std;
 
+namespace {
+
+void MergeRegistry(RawContext::FreqMapRegistry* src, RawContext::FreqMapRegistry* dest) {
+  for (auto& k_v : *src) {
+    auto it = dest->find(k_v.first);
+    if (it == dest->end()) {
+      dest->emplace(k_v.first, std::move(k_v.second));
+    } else {
+      it->second.Add(k_v.second);
+    }
+  }
+  src->clear();
+}
+
+}  // namespace
+
 OperatorExecutor::PerIoStruct::PerIoStruct(unsigned i) : index(i) {
 }
 
-thread_local std::unique_ptr<OperatorExecutor::PerIoStruct> OperatorExecutor::per_io_;
+thread_local unsigned OperatorExecutor::io_index_ = kuint32max;
+
+OperatorExecutor::OperatorExecutor(util::IoContextPool* pool, Runner* runner)
+    : pool_(pool), runner_(runner), per_io_(pool->size()) {
+  progress_.num_threads = pool->size();
+  progress_.records.reset(new std::atomic<uint64_t>[pool->size()]());
+  progress_.queued.reset(new std::atomic<uint64_t>[pool->size()]());
+}
+
+void OperatorExecutor::StartProgress(const pb::Operator* op) {
+  progress_.start_usec = base::GetMonotonicMicrosFast();
+  progress_.op = op;
+}
 
 void OperatorExecutor::PerIoStruct::Shutdown() {
   VLOG(1) << "PerIoStruct::ShutdownStart";
@@ -27,36 +57,62 @@ void OperatorExecutor::PerIoStruct::Shutdown() {
 
 void OperatorExecutor::RegisterContext(RawContext* context) {
   context->finalized_maps_ = finalized_maps_;
+  context->broadcast_maps_ = broadcast_maps_;
 }
 
 void OperatorExecutor::FinalizeContext(RawContext* raw_context) {
   raw_context->Flush();
 
   raw_context->UpdateMetricMap(&metric_map_);
+  cpu_breakdown_.Add(raw_context->cpu_breakdown());
 
-  // Merge frequency maps. We aggregate counters for all the contexts.
-  for (auto& k_v : raw_context->freq_maps_) {
-    auto& any = freq_maps_[k_v.first];
-    any.Add(k_v.second);
+  // Frequency maps are merged by MergeFreqMaps(), off the serial finalization.
+  if (!raw_context->freq_maps_.empty())
+    thread_freq_maps_.push_back(std::move(raw_context->freq_maps_));
+}
+
+void OperatorExecutor::MergeFreqMaps() {
+  auto& maps = thread_freq_maps_;
+
+  // Pairwise tree reduction: every round merges maps[i + step] into maps[i] for all i in
+  // parallel on the IO threads, so n maps are merged in log2(n) rounds.
+  for (size_t step = 1; step < maps.size(); step *= 2) {
+    vector<fibers::fiber> mergers;
+    for (size_t i = 0; i + step < maps.size(); i += 2 * step) {
+      util::IoContext& io_context = pool_->at(mergers.size() % pool_->size());
+      mergers.push_back(io_context.LaunchFiber(
+          [src = &maps[i + step], dest = &maps[i]] { MergeRegistry(src, dest); }));
+    }
+    for (auto& fb : mergers) {
+      fb.join();
+    }
+  }
+
+  if (!maps.empty()) {
+    MergeRegistry(&maps.front(), &freq_maps_);
   }
+  maps.clear();
 }
 
-void OperatorExecutor::Init(const RawContext::FreqMapRegistry& prev_maps) {
+void OperatorExecutor::Init(const RawContext::FreqMapRegistry& prev_maps,
+                            const RawContext::BroadcastRegistry& broadcast_maps) {
   finalized_maps_ = &prev_maps;
+  broadcast_maps_ = &broadcast_maps;
   InitInternal();
 }
 
-void OperatorExecutor::SetMetaData(const pb::Input::FileSpec& fs, RawContext* context) {
+void OperatorExecutor::SetMetaData(const pb::Input::FileSpec& fs,
+                                   RawContext::PerFiber* per_fiber) {
   using FS = pb::Input::FileSpec;
   switch (fs.metadata_case()) {
     case FS::METADATA_NOT_SET:
-      context->per_fiber_->metadata.emplace<absl::monostate>();
+      per_fiber->metadata.emplace<absl::monostate>();
     break;
     case FS::kStrval:
-      context->per_fiber_->metadata = fs.strval();
+      per_fiber->metadata = fs.strval();
     break;
     case FS::kI64Val:
-      context->per_fiber_->metadata = fs.i64val();
+      per_fiber->metadata = fs.i64val();
     break;
     default:
       LOG(FATAL) << "Invalid file spec tag " << fs.ShortDebugString();
@@ -75,6 +131,8 @@ util::VarzValue::Map OperatorExecutor::GetStats() {
   //       we spent per shard.
 
   MetricMap metric_map;
+  detail::CpuBreakdown cpu_total;
+  util::VarzValue::Map cpu_per_thread, busy_per_thread;
 
   pool_->AwaitFiberOnAllSerially([&, me = shared_from_this()](util::IoContext& io) {
     VLOG(1) << "MapperExecutor::GetStats CB";
@@ -85,6 +143,18 @@ util::VarzValue::Map OperatorExecutor::GetStats() {
     if (aux_local) {
       if (aux_local->raw_context) {
         aux_local->raw_context->UpdateMetricMap(&metric_map);
+
+        const detail::CpuBreakdown& cpu = aux_local->raw_context->cpu_breakdown();
+        cpu_total.Add(cpu);
+        cpu_per_thread.emplace_back(absl::StrCat("io", aux_local->index), cpu.ToVarz());
+      }
+
+      // Percentage of the run time the read fibers of the thread were busy.
+      uint64_t elapsed = start - run_start_usec_;
+      if (run_start_usec_ && elapsed && !aux_local->process_fd.empty()) {
+        uint64_t pct = aux_local->read_busy_usec * 100 / (elapsed * aux_local->process_fd.size());
+        busy_per_thread.emplace_back(absl::StrCat("io", aux_local->index),
+                                     util::VarzValue::FromInt(pct));
       }
     }
   });
@@ -94,6 +164,12 @@ util::VarzValue::Map OperatorExecutor::GetStats() {
   for (const auto& k_v : metric_map) {
     res.emplace_back(k_v.first, util::VarzValue::FromInt(k_v.second));
   }
+  res.emplace_back("cpu-breakdown", cpu_total.ToString());
+  res.emplace_back("cpu-per-thread", std::move(cpu_per_thread));
+  if (!busy_per_thread.empty()) {
+    res.emplace_back("read-busy-pct-per-thread", std::move(busy_per_thread));
+  }
+
   return res;
 }
 
@@ -3,6 +3,8 @@
 //
 #pragma once
 
+#include <atomic>
+
 #include <boost/fiber/mutex.hpp>
 
 #include "mr/impl/table_impl.h"
@@ -26,12 +28,12 @@ class InputBase;
 */
 class OperatorExecutor : public std::enable_shared_from_this<OperatorExecutor> {
  public:
-  OperatorExecutor(util::IoContextPool* pool, Runner* runner)
-    : pool_(pool), runner_(runner) {}
+  OperatorExecutor(util::IoContextPool* pool, Runner* runner);
 
   virtual ~OperatorExecutor() {}
 
-  void Init(const RawContext::FreqMapRegistry& prev_maps);
+  void Init(const RawContext::FreqMapRegistry& prev_maps,
+            const RawContext::BroadcastRegistry& broadcast_maps);
 
   virtual void Run(const std::vector<const InputBase*>& inputs,
                    detail::TableBase* ss, ShardFileMap* out_files) = 0;
@@ -42,7 +44,51 @@ class OperatorExecutor : public std::enable_shared_from_this<OperatorExecutor> {
   const RawContext::FreqMapRegistry& GetFreqMaps() const { return freq_maps_; }
   const MetricMap& GetCounterMap() const { return metric_map_; }
 
+  //! Sampled CPU breakdown of the operator, aggregated over all IO threads.
+  const detail::CpuBreakdown& GetCpuBreakdown() const { return cpu_breakdown_; }
+
+  //! Progress of the running operator for the status pages. Executors update it with relaxed
+  //! atomics, therefore it can be read from any thread at any time.
+  struct Progress {
+    const pb::Operator* op = nullptr;  // Set once the executor runs.
+    uint64_t start_usec = 0;
+
+    // Input files or ranges for mappers, shards for joiners.
+    std::atomic<uint64_t> inputs_total{0}, inputs_done{0};
+    std::atomic<uint64_t> bytes_total{0}, bytes_done{0};  // Tracked only by mappers.
+    std::atomic_bool inputs_expanded{false};  // Set once the totals are final.
+
+    // Records read and records waiting in the record queues, per IO thread.
+    unsigned num_threads = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> records, queued;
+  };
+
+  const Progress& progress() const { return progress_; }
+
 protected:
+  //! Behaves as a thread-local unique_ptr that is separate for each executor, so that
+  //! several operators can run on the same IoContextPool at once. IO threads must call
+  //! SetIoIndex before accessing it, other threads see it as null.
+  template <typename T> class PerIoPtr {
+   public:
+    explicit PerIoPtr(unsigned num_threads) : arr_(num_threads) {}
+
+    T* get() const { return io_index_ < arr_.size() ? arr_[io_index_].get() : nullptr; }
+    T* operator->() const { return get(); }
+    explicit operator bool() const { return get() != nullptr; }
+
+    void reset(T* t = nullptr) {
+      CHECK_LT(io_index_, arr_.size());
+      arr_[io_index_].reset(t);
+    }
+
+   private:
+    std::vector<std::unique_ptr<T>> arr_;
+  };
+
+  // Called from IO threads.
+  static void SetIoIndex(unsigned index) { io_index_ = index; }
+
   struct PerIoStruct {
     unsigned index;
     std::vector<::boost::fibers::fiber> process_fd;
@@ -50,6 +96,7 @@ protected:
 
     long *records_read_ptr = nullptr; // To avoid always looking up "fn-calls", used only by mapper.
     bool stop_early = false; // Used only by mapper.
+    uint64_t read_busy_usec = 0;  // Time spent by read fibers on their inputs, used only by mapper.
 
     PerIoStruct(unsigned i);
 
@@ -61,25 +108,37 @@ protected:
   /// Called from all IO threads once they finished running the operator.
   void FinalizeContext(RawContext* context);
 
+  /// Merges the frequency maps of the finalized contexts into freq_maps_. Called after
+  /// all the IO threads have finalized their contexts.
+  void MergeFreqMaps();
+
   util::VarzValue::Map GetStats();
 
-  static void SetFileName(bool is_binary, const std::string& file_name, RawContext* context) {
-    context->per_fiber_->is_binary = is_binary;
-    context->per_fiber_->file_name = file_name;
+  // The setters update the state bound with RawContext::BindPerFiber by the calling fiber.
+  static void SetFileName(bool is_binary, const std::string& file_name,
+                          RawContext::PerFiber* per_fiber) {
+    per_fiber->is_binary = is_binary;
+    per_fiber->file_name = file_name;
   }
 
-  static void SetMetaData(const pb::Input::FileSpec& fs, RawContext* context);
+  static void SetIsBinary(bool is_binary, RawContext::PerFiber* per_fiber) {
+    per_fiber->is_binary = is_binary;
+  }
 
-  static void SetPosition(size_t pos, RawContext* context) {
-    context->per_fiber_->input_pos = pos;
+  static void SetMetaData(const pb::Input::FileSpec& fs, RawContext::PerFiber* per_fiber);
+
+  static void SetPosition(size_t pos, RawContext::PerFiber* per_fiber) {
+    per_fiber->input_pos = pos;
   }
 
-  static void SetCurrentShard(ShardId shard, RawContext* context) {
-    context->per_fiber_->current_shard = std::move(shard);
+  static void SetCurrentShard(ShardId shard, RawContext::PerFiber* per_fiber) {
+    per_fiber->current_shard = std::move(shard);
   }
 
   virtual void InitInternal() = 0;
 
+  void StartProgress(const pb::Operator* op);
+
   util::IoContextPool* pool_;
   Runner* runner_;
 
@@ -87,11 +146,19 @@ protected:
   /// Performance is negligible since it's used only for final aggregation.
   MetricMap metric_map_;
   std::atomic<uint64_t> parse_errors_{0};
+  uint64_t run_start_usec_ = 0;  // Set by executors that track read_busy_usec.
+  detail::CpuBreakdown cpu_breakdown_;
 
   RawContext::FreqMapRegistry freq_maps_;
+  std::vector<RawContext::FreqMapRegistry> thread_freq_maps_;  // Filled by FinalizeContext.
   const RawContext::FreqMapRegistry* finalized_maps_;
+  const RawContext::BroadcastRegistry* broadcast_maps_ = nullptr;
+
+  PerIoPtr<PerIoStruct> per_io_;
+  Progress progress_;
 
-  static thread_local std::unique_ptr<PerIoStruct> per_io_;
+ private:
+  static thread_local unsigned io_index_;
 };
 
 }  // namespace mr3
@@ -13,11 +13,16 @@ namespace mr3 {
 
 namespace detail {
   template <typename OutT> class TableImplT;
-  inline bool IsBinary(pb::WireFormat::Type tp) { return tp == pb::WireFormat::LST; }
+  inline bool IsBinary(pb::WireFormat::Type tp) {
+    return tp == pb::WireFormat::LST || tp == pb::WireFormat::BATCH ||
+           tp == pb::WireFormat::COLUMNAR;
+  }
 }
 
 class OutputBase {
  public:
+  static constexpr size_t kDefaultCombineEntries = 1 << 16;
+
   pb::Output* mutable_msg() { return out_; }
   const pb::Output& msg() const { return *out_; }
 
@@ -30,6 +35,8 @@ class OutputBase {
 
   void SetCompress(pb::Output::CompressType ct, int level);
   void SetShardSpec(pb::ShardSpec::Type st, unsigned modn = 0);
+  void SetMaxRawSize(unsigned max_raw_size_mb);
+  void SetSorted();
   void FailUndefinedShard() const;
 };
 
@@ -38,10 +45,19 @@ template <typename T> class Output : public OutputBase {
 
   using CustomShardingFunc = std::function<std::string(const T&)>;
   using ModNShardingFunc = std::function<unsigned(const T&)>;
+  using CombineKeyFunc = std::function<std::string(const T&)>;
+  using CombineMergeFunc = std::function<void(T* dest, T&& src)>;
+  using SortKeyFunc = std::function<std::string(const T&)>;
 
   absl::variant<absl::monostate, ShardId, ModNShardingFunc, CustomShardingFunc> shard_op_;
   unsigned modn_ = 0;
 
+  CombineKeyFunc combine_key_;
+  CombineMergeFunc combine_merge_;
+  size_t combine_max_entries_ = 0;
+
+  SortKeyFunc sort_key_;
+
   struct Visitor {
     const T& t_;
     unsigned modn_;
@@ -79,6 +95,70 @@ template <typename T> class Output : public OutputBase {
 
   Output& AndCompress(pb::Output::CompressType ct, int level = -10000);
 
+  /** @brief Splits each shard into numbered sub-shard files of at most max_raw_size_mb
+   *  uncompressed bytes. Must be called after the sharding is defined.
+   *
+   *  Joiners whose handler declares kMergeableShards process sub-shards of the same shard
+   *  in parallel.
+   */
+  Output& WithMaxRawSize(unsigned max_raw_size_mb) {
+    SetMaxRawSize(max_raw_size_mb);
+    return *this;
+  }
+
+  /** @brief Pre-aggregates records in the producing fiber before they are serialized.
+   *
+   *  key_fn returns the combining key of a record and merge_fn(dest, src) folds src into dest.
+   *  Records with the same key must belong to the same shard. Each fiber keeps at most
+   *  max_entries distinct keys and flushes the table when it fills up or when the shard
+   *  finishes. Records written with an explicit shard id bypass the combiner.
+   */
+  template <typename K, typename M>
+  Output& WithCombiner(K&& key_fn, M&& merge_fn, size_t max_entries = kDefaultCombineEntries) {
+    static_assert(base::is_invocable_r<std::string, K, const T&>::value, "");
+    static_assert(base::is_invocable<M, T*, T&&>::value, "");
+
+    combine_key_ = std::forward<K>(key_fn);
+    combine_merge_ = std::forward<M>(merge_fn);
+    combine_max_entries_ = max_entries;
+
+    return *this;
+  }
+
+  /** @brief Sorts the records of each shard file by key_fn, using an external sort when
+   *  the shard does not fit into memory. The keys are compared as byte strings.
+   *
+   *  A joiner that binds all its inputs with the same key streams the shards of sorted
+   *  inputs instead of sorting them again.
+   */
+  template <typename U> Output& WithSortKey(U&& key_fn) {
+    static_assert(base::is_invocable_r<std::string, U, const T&>::value, "");
+    sort_key_ = std::forward<U>(key_fn);
+    SetSorted();
+
+    return *this;
+  }
+
+  /** @brief Keeps the shards in memory of LocalRunner and passes them to the consuming
+   *  operators without writing them into files.
+   *
+   *  When the in-memory shards exceed --local_runner_shuffle_mb, the shards that are still
+   *  written go into files as usual. Not supported with remote workers or incremental runs.
+   */
+  Output& InMemory() {
+    out_->set_in_memory(true);
+    return *this;
+  }
+
+  bool is_sorted() const { return bool(sort_key_); }
+  std::string SortKey(const T& t) const { return sort_key_(t); }
+
+  bool has_combiner() const { return combine_max_entries_ > 0; }
+  size_t combine_max_entries() const { return combine_max_entries_; }
+
+  std::string CombineKey(const T& t) const { return combine_key_(t); }
+  void Combine(T* dest, T&& src) const { combine_merge_(dest, std::move(src)); }
+
   ShardId Shard(const T& t) const {
     auto res = absl::visit(Visitor{t, modn_}, shard_op_);
     if (absl::holds_alternative<absl::monostate>(res)) {
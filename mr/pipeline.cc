@@ -3,18 +3,56 @@
 //
 #include "mr/pipeline.h"
 
+#include <algorithm>
+#include <ctime>
+
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/fiber.hpp>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
 #include "base/logging.h"
+#include "base/walltime.h"
 #include "file/file_util.h"
 
+#include "mr/coordinator.h"
+#include "mr/impl/memory_budget.h"
+#include "mr/impl/sample.h"
 #include "mr/joiner_executor.h"
 #include "mr/mapper_executor.h"
+#include "mr/worker_service.h"
+#include "util/html/sorted_table.h"
+
+DEFINE_uint32(pipeline_max_concurrent_ops, 1,
+              "Maximal number of independent operators that run concurrently. "
+              "1 runs the operators one by one in the order of their definition.");
 
 namespace mr3 {
 using namespace boost;
 using namespace std;
 using namespace util;
 
+namespace {
+
+constexpr char kManifestName[] = "input_manifest.csv";
+
+void AddFileSpecs(const ShardFileMap& out_files,
+                  google::protobuf::RepeatedPtrField<pb::Input::FileSpec>* dest) {
+  for (const auto& k_v : out_files) {
+    auto* fs = dest->Add();
+    fs->set_url_glob(k_v.second);
+    if (absl::holds_alternative<uint32_t>(k_v.first)) {
+      fs->set_shard_id(absl::get<uint32_t>(k_v.first));
+    } else {
+      fs->set_custom_shard_id(absl::get<string>(k_v.first));
+    }
+  }
+}
+
+}  // namespace
+
 Pipeline::InputSpec::InputSpec(const std::vector<std::string>& globs) {
   for (const auto& s : globs) {
     pb::Input::FileSpec fspec;
@@ -50,7 +88,7 @@ PInput<std::string> Pipeline::Read(const std::string& name, pb::WireFormat::Type
 
   using StringImpl = detail::TableImplT<string>;
 
-  shared_ptr<StringImpl> ptr = StringImpl::AsRead(std::move(op), this);
+  std::shared_ptr<StringImpl> ptr = StringImpl::AsRead(std::move(op), this);
 
   return PInput<std::string>(std::move(ptr), inp_ptr.get());
 }
@@ -63,36 +101,142 @@ void Pipeline::Stop() {
 
   if (executor_)
     executor_->Stop();
+  for (const auto& executor : running_executors_) {
+    executor->Stop();
+  }
 }
 
-bool Pipeline::Run(Runner* runner) {
-  CHECK(!tables_.empty());
+string Pipeline::ProgressPage() {
+  using util::html::SortedTable;
+
+  std::vector<std::shared_ptr<OperatorExecutor>> executors;
+  Runner* runner;
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    executors = running_executors_;
+    if (executor_)
+      executors.push_back(executor_);
+    runner = runner_;
+  }
 
-  for (const auto& sptr : tables_) {
-    const pb::Operator& op = sptr->op();
+  string res = SortedTable::HtmlStart();
+  if (!runner) {
+    res.append("No pipeline is running");
+    return res;
+  }
 
-    if (op.input_name_size() == 0) {
-      LOG(INFO) << "No inputs for " << op.op_name() << ", skipping";
+  uint64_t now = base::GetMonotonicMicrosFast();
+  string thread_rows;
+  SortedTable::StartTable({"Operator", "Elapsed, s", "Inputs", "Input bytes", "Done, %", "ETA, s",
+                           "Records", "Output shards", "Output bytes"},
+                          &res);
+
+  for (const auto& executor : executors) {
+    const OperatorExecutor::Progress& progress = executor->progress();
+    if (!progress.op)
       continue;
+
+    const string& op_name = progress.op->op_name();
+    double elapsed = (now - progress.start_usec) * 1e-6;
+    uint64_t inputs_total = progress.inputs_total, inputs_done = progress.inputs_done;
+    uint64_t bytes_total = progress.bytes_total, bytes_done = progress.bytes_done;
+
+    // Joiners do not know the sizes of their shards.
+    double done = bytes_total ? double(bytes_done) / bytes_total
+                              : (inputs_total ? double(inputs_done) / inputs_total : 0);
+    string eta = "-";
+    if (progress.inputs_expanded && done > 0) {
+      eta = absl::StrCat(int64_t(elapsed * (1 - done) / done));
     }
 
-    if (stopped_) {
-      break;
+    uint64_t records = 0;
+    for (unsigned i = 0; i < progress.num_threads; ++i) {
+      uint64_t thread_records = progress.records[i].load(std::memory_order_relaxed);
+      records += thread_records;
+      SortedTable::Row({op_name, absl::StrCat("io", i), absl::StrCat(thread_records),
+                        absl::StrCat(int64_t(elapsed > 0 ? thread_records / elapsed : 0)),
+                        absl::StrCat(progress.queued[i].load(std::memory_order_relaxed))},
+                       &thread_rows);
     }
 
-    // We lock due to protect again Stop() breaks.
-    std::unique_lock<fibers::mutex> lk(mu_);
-    switch (op.type()) {
-      case pb::Operator::GROUP:
-        executor_ = std::make_shared<JoinerExecutor>(pool_, runner);
+    Runner::OutputProgress out = runner->GetOutputProgress(progress.op);
+    string expanded = progress.inputs_expanded ? "" : "+";
+    SortedTable::Row({op_name, absl::StrCat(int64_t(elapsed)),
+                      absl::StrCat(inputs_done, "/", inputs_total, expanded),
+                      absl::StrCat(bytes_done, "/", bytes_total, expanded),
+                      absl::StrCat(int64_t(done * 100)), eta, absl::StrCat(records),
+                      absl::StrCat(out.shards), absl::StrCat(out.raw_bytes)},
+                     &res);
+  }
+  SortedTable::EndTable(&res);
+
+  SortedTable::StartTable({"Operator", "Thread", "Records", "Records/s", "Queued records"}, &res);
+  res.append(thread_rows);
+  SortedTable::EndTable(&res);
+
+  return res;
+}
+
+std::map<std::string, uint64_t> Pipeline::GetOperatorTimes() {
+  std::lock_guard<fibers::mutex> lk(mu_);
+  return op_times_;
+}
+
+bool Pipeline::Run(Runner* runner) {
+  CHECK(!tables_.empty());
+  CHECK(broadcast_specs_.empty() || (!coordinator_ && !worker_))
+      << "Broadcast maps are not supported with remote workers";
+  CHECK(!incremental_ || (!coordinator_ && !worker_))
+      << "Incremental runs are not supported with remote workers";
+  for (const auto& sptr : tables_) {
+    CHECK(!sptr->op().output().in_memory() || (!coordinator_ && !worker_ && !incremental_))
+        << "In-memory output " << sptr->op().output().name()
+        << " is not supported with remote workers or incremental runs";
+  }
+  if (incremental_) {
+    run_tag_ = absl::StrCat("t", time(nullptr));
+  }
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    runner_ = runner;
+    op_times_.clear();
+  }
+  detail::MemoryBudget::Setup(pool_);
+
+  if (worker_) {
+    worker_->Serve(this, runner);
+    runner->Shutdown();
+
+    return !stopped_.load();
+  }
+  SampleInputs(runner);
+
+  if (FLAGS_pipeline_max_concurrent_ops > 1 && !coordinator_) {
+    RunConcurrent(runner);
+  } else {
+    for (const auto& sptr : tables_) {
+      const pb::Operator& op = sptr->op();
+
+      if (op.input_name_size() == 0) {
+        LOG(INFO) << "No inputs for " << op.op_name() << ", skipping";
+        continue;
+      }
+
+      if (stopped_) {
         break;
-      default:
-        executor_ = std::make_shared<MapperExecutor>(pool_, runner);
+      }
+
+      // We lock due to protect again Stop() breaks.
+      std::unique_lock<fibers::mutex> lk(mu_);
+      executor_ = coordinator_ ? coordinator_->CreateExecutor(runner) : CreateExecutor(op, runner);
+      executor_->Init(freq_maps_, broadcast_maps_);
+      lk.unlock();
+      ProcessTable(sptr.get(), runner);
     }
+  }
 
-    executor_->Init(freq_maps_);
-    lk.unlock();
-    ProcessTable(sptr.get());
+  if (coordinator_) {
+    coordinator_->ShutdownWorkers();
   }
 
   VLOG(1) << "Saving counter maps";
@@ -103,15 +247,37 @@ bool Pipeline::Run(Runner* runner) {
     }
 
     runner->SaveFile(file_util::JoinPath(name_and_map.first, "counter_map.csv"), to_write);
+
+    auto it = sample_fraction_.find(name_and_map.first);
+    if (it == sample_fraction_.end())
+      continue;
+
+    to_write.clear();
+    for (const auto& k_v : name_and_map.second) {
+      absl::StrAppend(&to_write, k_v.first, ",", int64_t(k_v.second / it->second), "\n");
+    }
+    runner->SaveFile(file_util::JoinPath(name_and_map.first, "counter_map_estimated.csv"),
+                     to_write);
   }
 
   VLOG(1) << "Before Runner::Shutdown";
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    runner_ = nullptr;
+  }
   runner->Shutdown();
 
   return !stopped_.load();
 }
 
-void Pipeline::ProcessTable(detail::TableBase* tbl) {
+void Pipeline::ProcessTable(detail::TableBase* tbl, Runner* runner) {
+  ShardFileMap out_files;
+  RunOperator(tbl, executor_.get(), runner, &out_files);
+  ApplyResults(tbl->op(), *executor_, out_files, runner);
+}
+
+void Pipeline::RunOperator(detail::TableBase* tbl, OperatorExecutor* executor, Runner* runner,
+                           ShardFileMap* out_files) {
   const pb::Operator& op = tbl->op();
   std::vector<const InputBase*> inputs;
   string input_names;
@@ -126,34 +292,441 @@ void Pipeline::ProcessTable(detail::TableBase* tbl) {
   // TODO: To allow skipping of the pipeline - i.e. partial dry run mode. For that we need to
   // scan output directory of each operator for shard files and populate shards from there.
   // In addition we must save freq maps on disk to allow loading them during dry run.
+  string manifest;
+  std::vector<std::unique_ptr<InputBase>> delta_inputs;
+  if (incremental_) {
+    manifest = SelectNewFiles(op, runner, &inputs, &delta_inputs);
+    if (inputs.empty()) {
+      LOG(INFO) << op.op_name() << " has no new input files, skipping";
+      return;
+    }
+    tbl->mutable_op()->mutable_output()->set_file_tag(run_tag_);
+  }
+
   LOG(INFO) << op.op_name() << " started on inputs [" << input_names << "]";
-  ShardFileMap out_files;
-  executor_->Run(inputs, tbl, &out_files);
+  uint64_t start = base::GetMonotonicMicrosFast();
+  executor->Run(inputs, tbl, out_files);
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    op_times_[op.op_name()] = base::GetMonotonicMicrosFast() - start;
+  }
+
+  LOG(INFO) << op.op_name() << " finished run with " << out_files->size() << " output files";
+
+  // The manifest is not updated by the broken runs, so their files are processed again.
+  if (!manifest.empty() && !stopped_) {
+    runner->SaveFile(file_util::JoinPath(op.output().name(), kManifestName), manifest);
+  }
+}
+
+string Pipeline::SelectNewFiles(const pb::Operator& op, Runner* runner,
+                                std::vector<const InputBase*>* inputs,
+                                std::vector<std::unique_ptr<InputBase>>* delta_inputs) {
+  string manifest_fn = file_util::JoinPath(op.output().name(), kManifestName);
+  string manifest;
+
+  // Each line holds "file,size". A file that changed appears again with its new size.
+  absl::flat_hash_map<string, size_t> processed;
+  if (runner->LoadFile(manifest_fn, &manifest)) {
+    for (absl::string_view line : absl::StrSplit(manifest, '\n', absl::SkipEmpty())) {
+      size_t pos = line.rfind(',');
+      size_t sz = 0;
+      CHECK(pos != absl::string_view::npos && absl::SimpleAtoi(line.substr(pos + 1), &sz))
+          << "Corrupted manifest " << manifest_fn << ": " << line;
+      processed[string(line.substr(0, pos))] = sz;
+    }
+  }
+
+  size_t prev_size = manifest.size(), num_files = 0;
+  std::vector<const InputBase*> selected;
+
+  // Outputs of the upstream operators already hold only their new shard files.
+  for (const InputBase* input : *inputs) {
+    if (input->linked_outp()) {
+      selected.push_back(input);
+      num_files += input->msg().file_spec_size();
+      continue;
+    }
+
+    delta_inputs->emplace_back(new InputBase(input->msg().name(), input->msg().format().type()));
+    pb::Input* delta = delta_inputs->back()->mutable_msg();
+    delta->CopyFrom(input->msg());
+    delta->clear_file_spec();
+
+    pool_->GetNextContext().AwaitSafe([&] {
+      for (const auto& file_spec : input->msg().file_spec()) {
+        runner->ExpandGlob(file_spec.url_glob(), [&](size_t sz, const string& name) {
+          auto res = processed.emplace(name, sz);
+          if (!res.second) {
+            if (res.first->second == sz)
+              return;
+            res.first->second = sz;
+          }
+
+          pb::Input::FileSpec* fs = delta->add_file_spec();
+          fs->CopyFrom(file_spec);
+          fs->set_url_glob(name);
+          absl::StrAppend(&manifest, name, ",", sz, "\n");
+        });
+      }
+    });
+    LOG(INFO) << op.op_name() << " has " << delta->file_spec_size() << " new files in "
+              << delta->name();
+
+    selected.push_back(delta_inputs->back().get());
+    num_files += delta->file_spec_size();
+  }
+
+  // Mappers can not run on empty inputs, joiners keep them since they bind inputs by index.
+  if (op.type() != pb::Operator::GROUP) {
+    selected.erase(std::remove_if(selected.begin(), selected.end(),
+                                  [](const InputBase* ib) {
+                                    return ib->msg().file_spec_size() == 0;
+                                  }),
+                   selected.end());
+  }
+  if (num_files == 0)
+    selected.clear();
+  inputs->swap(selected);
+
+  return manifest.size() > prev_size ? manifest : string{};
+}
+
+void Pipeline::SampleInputs(Runner* runner) {
+  bool has_sample = sample_.has_file_rate() || sample_.has_record_rate();
+
+  for (auto& k_v : inputs_) {
+    InputBase* input = k_v.second.get();
+    pb::Input* msg = input->mutable_msg();
+    if (input->linked_outp() || (!msg->has_sample() && !has_sample))
+      continue;
 
-  LOG(INFO) << op.op_name() << " finished run with " << out_files.size() << " output files";
+    if (!msg->has_sample())
+      msg->mutable_sample()->CopyFrom(sample_);
+    const pb::Input::Sample& sample = msg->sample();
+    CHECK(sample.file_rate() > 0 && sample.file_rate() <= 1) << msg->name();
+    CHECK(sample.record_rate() > 0 && sample.record_rate() <= 1) << msg->name();
+    CHECK(!incremental_) << "Sampled inputs are not supported in the incremental mode";
+
+    double fraction = sample.record_rate();
+    if (sample.file_rate() < 1) {
+      uint64_t threshold = detail::SampleThreshold(sample.file_rate());
+      google::protobuf::RepeatedPtrField<pb::Input::FileSpec> selected;
+      size_t total_bytes = 0, sampled_bytes = 0;
+
+      // If no file falls into the sample, the file with the lowest hash is taken.
+      pb::Input::FileSpec lowest;
+      uint64_t lowest_hash = kuint64max;
+      size_t lowest_size = 0;
+
+      pool_->GetNextContext().AwaitSafe([&] {
+        for (const auto& file_spec : msg->file_spec()) {
+          runner->ExpandGlob(file_spec.url_glob(), [&](size_t sz, const string& name) {
+            total_bytes += sz;
+            uint64_t hash = detail::SampleHash(name);
+            if (hash < threshold) {
+              sampled_bytes += sz;
+              pb::Input::FileSpec* fs = selected.Add();
+              fs->CopyFrom(file_spec);
+              fs->set_url_glob(name);
+            } else if (hash < lowest_hash) {
+              lowest_hash = hash;
+              lowest_size = sz;
+              lowest.CopyFrom(file_spec);
+              lowest.set_url_glob(name);
+            }
+          });
+        }
+      });
+
+      if (selected.empty() && lowest_hash != kuint64max) {
+        selected.Add()->CopyFrom(lowest);
+        sampled_bytes = lowest_size;
+      }
+      LOG(INFO) << "Sampled " << selected.size() << " files of " << msg->name() << " with "
+                << sampled_bytes << " out of " << total_bytes << " bytes";
+
+      msg->mutable_file_spec()->Swap(&selected);
+      if (total_bytes)
+        fraction *= double(sampled_bytes) / total_bytes;
+    }
+
+    if (fraction < 1)
+      sample_fraction_[msg->name()] = fraction;
+  }
+}
 
+void Pipeline::ApplyResults(const pb::Operator& op, const OperatorExecutor& executor,
+                            const ShardFileMap& out_files, Runner* runner) {
   // Fill the corresponsing input with sharded files.
   auto it = inputs_.find(op.output().name());
   CHECK(it != inputs_.end());
   auto& inp_ptr = it->second;
 
-  for (const auto& k_v : out_files) {
-    auto* fs = inp_ptr->mutable_msg()->add_file_spec();
-    fs->set_url_glob(k_v.second);
-    if (absl::holds_alternative<uint32_t>(k_v.first)) {
-      fs->set_shard_id(absl::get<uint32_t>(k_v.first));
-    } else {
-      fs->set_custom_shard_id(absl::get<string>(k_v.first));
-    }
-  }
+  AddFileSpecs(out_files, inp_ptr->mutable_msg()->mutable_file_spec());
+  LoadBroadcastMaps(*inp_ptr, runner);
 
-  for (const auto& k_v : executor_->GetFreqMaps()) {
+  for (const auto& k_v : executor.GetFreqMaps()) {
     auto res = freq_maps_.emplace(k_v.first, k_v.second);
     CHECK(res.second) << "Frequency map " << k_v.first
                       << " was created more than once across the pipeline run.";
   }
 
-  metric_maps_[op.output().name()] = executor_->GetCounterMap();
+  metric_maps_[op.output().name()] = executor.GetCounterMap();
+
+  // The sampled inputs remain sampled downstream. An operator that joins inputs of different
+  // fractions is extrapolated by the smallest one.
+  double fraction = 1;
+  for (const auto& input_name : op.input_name()) {
+    auto fr_it = sample_fraction_.find(input_name);
+    if (fr_it != sample_fraction_.end())
+      fraction = std::min(fraction, fr_it->second);
+  }
+
+  if (fraction < 1) {
+    sample_fraction_[op.output().name()] = fraction;
+    LOG(INFO) << op.op_name() << " ran on " << fraction << " of its full input, estimates:";
+    for (const auto& k_v : executor.GetCounterMap()) {
+      LOG(INFO) << op.op_name() << "-" << k_v.first << ": " << int64_t(k_v.second / fraction);
+    }
+  }
+}
+
+void Pipeline::RunConcurrent(Runner* runner) {
+  struct OpState {
+    detail::TableBase* tbl;
+    std::vector<size_t> deps;  // Indices of the operators that produce the inputs.
+    std::shared_ptr<OperatorExecutor> executor;
+    ShardFileMap out_files;
+    bool started = false, finished = false, applied = false;
+  };
+
+  std::vector<OpState> ops;
+  absl::flat_hash_map<string, size_t> producers;
+  for (const auto& sptr : tables_) {
+    const pb::Operator& op = sptr->op();
+    if (op.input_name_size() == 0) {
+      LOG(INFO) << "No inputs for " << op.op_name() << ", skipping";
+      continue;
+    }
+
+    OpState st;
+    st.tbl = sptr.get();
+    for (const auto& input_name : op.input_name()) {
+      auto it = producers.find(input_name);
+      if (it != producers.end())
+        st.deps.push_back(it->second);
+    }
+    producers[op.output().name()] = ops.size();
+    ops.push_back(std::move(st));
+  }
+
+  auto is_ready = [&](const OpState& st) {
+    for (size_t dep : st.deps) {
+      if (!ops[dep].applied)
+        return false;
+    }
+    return true;
+  };
+
+  // Frequency and broadcast maps are added to the registries that the running executors
+  // read, therefore operators that produce them are applied only when nothing else runs.
+  auto has_maps = [&](const OpState& st) {
+    return !st.executor->GetFreqMaps().empty() ||
+           broadcast_specs_.count(st.tbl->op().output().name()) > 0;
+  };
+
+  LOG(INFO) << "Running " << ops.size() << " operators, up to "
+            << FLAGS_pipeline_max_concurrent_ops << " at once";
+
+  fibers::condition_variable cv;
+  unsigned running = 0, num_finished = 0;
+  size_t num_applied = 0;
+  std::vector<fibers::fiber> op_fibers;
+
+  std::unique_lock<fibers::mutex> lk(mu_);
+  while (num_applied < ops.size()) {
+    unsigned seen_finished = num_finished;
+    bool barrier = false;
+
+    for (auto& st : ops) {
+      if (!st.finished || st.applied)
+        continue;
+      if (running > 0 && has_maps(st)) {
+        barrier = true;
+        continue;
+      }
+
+      // No operator starts meanwhile, hence running stays zero if the maps are applied.
+      st.applied = true;
+      ++num_applied;
+      lk.unlock();
+      ApplyResults(st.tbl->op(), *st.executor, st.out_files, runner);
+      lk.lock();
+    }
+
+    if (stopped_ && running == 0)
+      break;
+
+    // The barrier lets the running operators drain before their registries change.
+    for (size_t i = 0; i < ops.size() && !barrier && !stopped_; ++i) {
+      OpState& st = ops[i];
+      if (running >= FLAGS_pipeline_max_concurrent_ops)
+        break;
+      if (st.started || !is_ready(st))
+        continue;
+
+      st.started = true;
+      st.executor = CreateExecutor(st.tbl->op(), runner);
+      st.executor->Init(freq_maps_, broadcast_maps_);
+      running_executors_.push_back(st.executor);
+      ++running;
+
+      op_fibers.emplace_back([&, op_state = &st] {
+        RunOperator(op_state->tbl, op_state->executor.get(), runner, &op_state->out_files);
+
+        std::lock_guard<fibers::mutex> lk2(mu_);
+        op_state->finished = true;
+        --running;
+        ++num_finished;
+        auto it = std::find(running_executors_.begin(), running_executors_.end(),
+                            op_state->executor);
+        running_executors_.erase(it);
+        cv.notify_one();
+      });
+    }
+
+    if (num_applied == ops.size())
+      break;
+
+    // Operators are defined after their inputs, so that the first operator that did not start
+    // is ready once nothing runs and all the finished ones are applied.
+    if (running > 0) {
+      cv.wait(lk, [&] { return num_finished != seen_finished; });
+    }
+  }
+  lk.unlock();
+
+  for (auto& fb : op_fibers) {
+    fb.join();
+  }
+}
+
+void Pipeline::AddBroadcast(const detail::TableBase* tbl, const std::string& map_id,
+                            std::unique_ptr<detail::BroadcastBuilderBase> builder) {
+  const pb::Operator& op = tbl->op();
+  CHECK(op.has_output()) << "Table '" << op.op_name()
+                         << "' does not produce output. Did you forget to call .Write(..) on it?";
+
+  for (const auto& k_v : broadcast_specs_) {
+    for (const auto& spec : k_v.second) {
+      CHECK_NE(spec.map_id, map_id) << "Broadcast map " << map_id << " already exists";
+    }
+  }
+  broadcast_specs_[op.output().name()].push_back(BroadcastSpec{map_id, std::move(builder)});
+}
+
+void Pipeline::LoadBroadcastMaps(const InputBase& input, Runner* runner) {
+  auto it = broadcast_specs_.find(input.msg().name());
+  if (it == broadcast_specs_.end())
+    return;
+
+  const pb::Input& pb_input = input.msg();
+  pb::WireFormat::Type input_type = pb_input.format().type();
+  bool is_binary = detail::IsBinary(input_type);
+  size_t records = 0, parse_errors = 0;
+
+  // Runner reads the files in IO threads. All the broadcast maps of the input are built
+  // in a single pass.
+  pool_->GetNextContext().AwaitSafe([&] {
+    vector<string> files;
+    for (const auto& file_spec : pb_input.file_spec()) {
+      runner->ExpandGlob(file_spec.url_glob(),
+                         [&](size_t sz, const string& name) { files.push_back(name); });
+    }
+
+    for (const auto& file_name : files) {
+      records += runner->ProcessInputFile(file_name, input_type, [&](RawRecord&& rr) {
+        for (auto& spec : it->second) {
+          parse_errors += !spec.builder->Add(is_binary, RawRecord(rr));
+        }
+      });
+    }
+  });
+
+  LOG_IF(WARNING, parse_errors > 0) << "Broadcast of " << pb_input.name() << " had "
+                                    << parse_errors << " parse errors";
+  for (auto& spec : it->second) {
+    LOG_IF(WARNING, spec.builder->duplicates() > 0)
+        << "Broadcast map " << spec.map_id << " dropped " << spec.builder->duplicates()
+        << " records with duplicate keys";
+    broadcast_maps_.emplace(spec.map_id, spec.builder->Finalize());
+  }
+  LOG(INFO) << "Loaded " << records << " records of " << pb_input.name() << " into "
+            << it->second.size() << " broadcast maps";
+  broadcast_specs_.erase(it);
+}
+
+std::shared_ptr<OperatorExecutor> Pipeline::CreateExecutor(const pb::Operator& op,
+                                                          Runner* runner) {
+  switch (op.type()) {
+    case pb::Operator::GROUP:
+      return std::make_shared<JoinerExecutor>(pool_, runner);
+    default:
+      return std::make_shared<MapperExecutor>(pool_, runner);
+  }
+}
+
+void Pipeline::RunTask(const pb::Task& task, Runner* runner, pb::TaskResult* result) {
+  detail::TableBase* tbl = nullptr;
+  for (const auto& sptr : tables_) {
+    if (sptr->op().op_name() == task.op_name()) {
+      tbl = sptr.get();
+      break;
+    }
+  }
+
+  if (!tbl) {
+    result->set_error(absl::StrCat("Unknown operator ", task.op_name()));
+    return;
+  }
+
+  const pb::Operator& op = tbl->op();
+  if (op.input_name_size() != task.input_size()) {
+    result->set_error(absl::StrCat("Inputs mismatch for ", task.op_name()));
+    return;
+  }
+
+  // Task inputs hold only the files assigned to this worker.
+  std::vector<std::unique_ptr<InputBase>> task_inputs;
+  std::vector<const InputBase*> inputs;
+  for (const auto& input : task.input()) {
+    const InputBase* orig = CheckedInput(input.name());
+    task_inputs.emplace_back(new InputBase(input.name(), input.format().type(),
+                                           orig->linked_outp()));
+    task_inputs.back()->mutable_msg()->CopyFrom(input);
+    inputs.push_back(task_inputs.back().get());
+  }
+  tbl->mutable_op()->mutable_output()->set_file_tag(task.file_tag());
+
+  std::unique_lock<fibers::mutex> lk(mu_);
+  executor_ = CreateExecutor(op, runner);
+  executor_->Init(freq_maps_, broadcast_maps_);
+  lk.unlock();
+
+  ShardFileMap out_files;
+  executor_->Run(inputs, tbl, &out_files);
+  LOG(INFO) << op.op_name() << " finished task with " << out_files.size() << " output files";
+
+  AddFileSpecs(out_files, result->mutable_out_file());
+  for (const auto& k_v : executor_->GetCounterMap()) {
+    auto* metric = result->add_metric();
+    metric->set_name(k_v.first);
+    metric->set_value(k_v.second);
+  }
+
+  LOG_IF(WARNING, !executor_->GetFreqMaps().empty())
+      << "Frequency maps of " << op.op_name() << " are not sent back to the coordinator";
 }
 
 pb::Input* Pipeline::mutable_input(const std::string& name) {
@@ -165,4 +738,25 @@ pb::Input* Pipeline::mutable_input(const std::string& name) {
 
 Runner::~Runner() {}
 
+size_t Runner::ProcessInputRange(const std::string& filename, pb::WireFormat::Type type,
+                                 const ReadOptions& opts, RawSinkCb cb) {
+  CHECK(opts.range.whole_file()) << "Runner does not split input files, can not process "
+                                 << filename;
+  CHECK(opts.filter.empty() && opts.literals.empty()) << "Runner does not support input filters";
+
+  return ProcessInputFile(filename, type,
+                          [&, skipped = 0U](RawRecord&& rr) mutable {
+                            if (skipped < opts.skip_records) {
+                              ++skipped;
+                              return;
+                            }
+                            cb(std::move(rr));
+                          });
+}
+
+size_t Runner::ProcessInputRangeViews(const std::string& filename, pb::WireFormat::Type type,
+                                      const ReadOptions& opts, RawViewCb cb) {
+  return ProcessInputRange(filename, type, opts, [&](RawRecord&& rr) { cb(rr); });
+}
+
 }  // namespace mr3
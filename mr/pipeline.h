@@ -13,8 +13,10 @@ class IoContextPool;
 }  // namespace util
 
 namespace mr3 {
+class Coordinator;
 class Runner;
 class OperatorExecutor;
+class WorkerService;
 
 template <typename T> class PInput : public PTable<T> {
   friend class Pipeline;
@@ -28,6 +30,49 @@ template <typename T> class PInput : public PTable<T> {
     return *this;
   }
 
+  //! Drops the input records that do not match the plang expression before they are parsed
+  //! and passed to the mapper, e.g. "line rlike 'error'" for text inputs or
+  //! "street = 'forrest'" for LST files of protobuf messages. Applied after skip_header.
+  PInput<T>& set_filter(const std::string& expr) {
+    input_->mutable_msg()->set_filter(expr);
+    return *this;
+  }
+
+  //! Drops the input records that contain none of the literals, which must not contain '\n'.
+  //! Text inputs are searched before they are split into lines, so that the lines without
+  //! a match cost about as much as a memchr over them. Applied after skip_header and before
+  //! the filter.
+  PInput<T>& set_literals(const std::vector<std::string>& literals) {
+    auto* literal = input_->mutable_msg()->mutable_literal();
+    literal->Clear();
+    for (const auto& str : literals) {
+      *literal->Add() = str;
+    }
+    return *this;
+  }
+
+  //! Runs the pipeline on a deterministic sample of the input: on file_rate of its files,
+  //! chosen by the hash of the file name, and on record_rate of their records, chosen by
+  //! the hash of the record. The counters of the operators are also reported extrapolated
+  //! to the full input.
+  PInput<T>& set_sample(double file_rate, double record_rate = 1) {
+    auto* sample = input_->mutable_msg()->mutable_sample();
+    sample->set_file_rate(file_rate);
+    sample->set_record_rate(record_rate);
+    return *this;
+  }
+
+  //! Decodes only the given fields of COLUMNAR inputs, the others are left unset in
+  //! the records. Must include the required fields of the message type.
+  PInput<T>& set_columns(const std::vector<std::string>& fields) {
+    auto* column = input_->mutable_msg()->mutable_column();
+    column->Clear();
+    for (const auto& field : fields) {
+      *column->Add() = field;
+    }
+    return *this;
+  }
+
  private:
   InputBase* input_;
 };
@@ -41,6 +86,8 @@ template <typename T> class PInput : public PTable<T> {
 */
 class Pipeline {
   friend class detail::TableBase;
+  friend class WorkerService;
+  template <typename T> friend class PTable;
 
  public:
   explicit Pipeline(util::IoContextPool* pool);
@@ -79,9 +126,19 @@ class Pipeline {
     return ReadLst(name, std::vector<std::string>{glob});
   }
 
+  //! Reads files written with pb::WireFormat::COLUMNAR as serialized protobuf messages.
+  PInput<std::string> ReadColumnar(const std::string& name, const InputSpec& input_spec) {
+    return Read(name, pb::WireFormat::COLUMNAR, input_spec);
+  }
+
   /**
    * @brief Runs the pipeline and blocks the current thread.
    *
+   * With --pipeline_max_concurrent_ops > 1 operators that do not depend on each other's
+   * outputs run concurrently and share the IO pool. Only input dependencies are tracked,
+   * therefore an operator that uses frequency or broadcast maps of another operator must also
+   * read (directly or transitively) the output of that operator.
+   *
    * @param runner
    * @return true if the pipeline has successfully finished, false if it was stopped in the middle.
    */
@@ -90,6 +147,34 @@ class Pipeline {
   //! Stops/breaks the run.
   void Stop();
 
+  //! Returns the html page with the progress of the running operators: their inputs done
+  //! out of the expanded ones, the records read per IO thread, the records queued for
+  //! the handlers, the outputs written so far and the estimated time to finish.
+  std::string ProgressPage();
+
+  //! Returns the wall time of each operator of the last run in microseconds.
+  std::map<std::string, uint64_t> GetOperatorTimes();
+
+  //! Runs the operators on remote workers instead of the local process.
+  void set_coordinator(Coordinator* coordinator) { coordinator_ = coordinator; }
+
+  //! Turns the pipeline into a worker: Run() serves the operator tasks of a remote coordinator.
+  void set_worker(WorkerService* worker) { worker_ = worker; }
+
+  /*! In the incremental mode every operator records the pipeline input files it processed,
+      with their sizes, in the manifest of its output directory. Later runs pass to the
+      operator only the files that are new or whose size has changed, and write the outputs
+      into additional shard files tagged with the run. The downstream operators process only
+      these new shard files. Operators without new inputs are skipped.
+  */
+  void set_incremental(bool incremental) { incremental_ = incremental; }
+
+  //! Samples every pipeline input that does not set its own sample, see PInput::set_sample.
+  void set_sample(double file_rate, double record_rate = 1) {
+    sample_.set_file_rate(file_rate);
+    sample_.set_record_rate(record_rate);
+  }
+
   template <typename GrouperType, typename Out, typename... Args>
   PTable<Out> Join(const std::string& name,
                    std::initializer_list<detail::HandlerBinding<GrouperType, Out>> mapper_bindings,
@@ -104,12 +189,67 @@ class Pipeline {
       return nullptr;
     return &it->second.Cast<T>();
   }
+
+  //! Returns the merged sketch statistic, i.e. HyperLogLog, CountMinSketch or TDigest.
+  template <class Sketch>
+  const Sketch* GetSketch(const std::string& map_id) const {
+    auto it = freq_maps_.find(map_id);
+    if (it == freq_maps_.end())
+      return nullptr;
+    return &it->second.CastSketch<Sketch>();
+  }
+
+  template <typename K, typename T>
+  const BroadcastMap<K, T>* GetBroadcastMap(const std::string& map_id) const {
+    auto it = broadcast_maps_.find(map_id);
+    if (it == broadcast_maps_.end())
+      return nullptr;
+    return &it->second.Cast<K, T>();
+  }
+
  private:
+  struct BroadcastSpec {
+    std::string map_id;
+    std::unique_ptr<detail::BroadcastBuilderBase> builder;
+  };
+
   PInput<std::string> Read(const std::string& name, pb::WireFormat::Type format,
                            const InputSpec& globs);
 
   const InputBase* CheckedInput(const std::string& name) const;
-  void ProcessTable(detail::TableBase* tbl);
+  void ProcessTable(detail::TableBase* tbl, Runner* runner);
+
+  // Runs tbl with executor and fills out_files with the output shards.
+  void RunOperator(detail::TableBase* tbl, OperatorExecutor* executor, Runner* runner,
+                   ShardFileMap* out_files);
+
+  // Replaces the pipeline inputs of the operator with the files missing in its manifest.
+  // New inputs are owned by delta_inputs. Returns the manifest lines of the new files.
+  std::string SelectNewFiles(const pb::Operator& op, Runner* runner,
+                             std::vector<const InputBase*>* inputs,
+                             std::vector<std::unique_ptr<InputBase>>* delta_inputs);
+
+  // Replaces the files of the sampled pipeline inputs with their sample.
+  void SampleInputs(Runner* runner);
+
+  // Publishes the results of the finished operator: its output files, metrics, frequency and
+  // broadcast maps. The registries must not be read by running executors meanwhile.
+  void ApplyResults(const pb::Operator& op, const OperatorExecutor& executor,
+                    const ShardFileMap& out_files, Runner* runner);
+
+  // Schedules the operators according to their input dependencies.
+  void RunConcurrent(Runner* runner);
+
+  void AddBroadcast(const detail::TableBase* tbl, const std::string& map_id,
+                    std::unique_ptr<detail::BroadcastBuilderBase> builder);
+
+  // Builds the broadcast maps of the operator output once it's computed.
+  void LoadBroadcastMaps(const InputBase& input, Runner* runner);
+
+  std::shared_ptr<OperatorExecutor> CreateExecutor(const pb::Operator& op, Runner* runner);
+
+  // Runs a single operator task on behalf of a coordinator.
+  void RunTask(const pb::Task& task, Runner* runner, pb::TaskResult* result);
 
   util::IoContextPool* pool_;
   absl::flat_hash_map<std::string, std::unique_ptr<InputBase>> inputs_;
@@ -117,10 +257,26 @@ class Pipeline {
 
   ::boost::fibers::mutex mu_;
   std::shared_ptr<OperatorExecutor> executor_;  // guarded by mu_
+  std::vector<std::shared_ptr<OperatorExecutor>> running_executors_;  // guarded by mu_
+  Runner* runner_ = nullptr;  // guarded by mu_, set during Run().
+  std::map<std::string, uint64_t> op_times_;  // guarded by mu_
   std::atomic_bool stopped_{false};
 
+  Coordinator* coordinator_ = nullptr;
+  WorkerService* worker_ = nullptr;
+  bool incremental_ = false;
+  std::string run_tag_;  // Tags the output files of the incremental runs.
+  pb::Input::Sample sample_;
+
+  // Maps input name to the fraction of the full input it holds, if it was sampled.
+  absl::flat_hash_map<std::string, double> sample_fraction_;
+
   RawContext::FreqMapRegistry freq_maps_;
   std::map<std::string, MetricMap> metric_maps_;
+
+  // Maps output name to the broadcast maps built from it.
+  absl::flat_hash_map<std::string, std::vector<BroadcastSpec>> broadcast_specs_;
+  RawContext::BroadcastRegistry broadcast_maps_;
 };
 
  template <typename GrouperType, typename OutT, typename... Args>
@@ -133,6 +289,16 @@ PTable<OutT> Pipeline::Join
   return PTable<OutT>{res};
 }
 
+template <typename OutT>
+template <typename KeyFn>
+void PTable<OutT>::Broadcast(const std::string& map_id, KeyFn&& key_fn) const {
+  using KeyType = std::decay_t<decltype(key_fn(std::declval<const OutT&>()))>;
+  using Builder = detail::BroadcastBuilder<KeyType, OutT, std::decay_t<KeyFn>>;
+
+  std::unique_ptr<detail::BroadcastBuilderBase> builder{new Builder(std::forward<KeyFn>(key_fn))};
+  impl_->pipeline()->AddBroadcast(impl_.get(), map_id, std::move(builder));
+}
+
 template <typename U, typename Joiner, typename Out, typename S>
 detail::HandlerBinding<Joiner, Out> JoinInput(const PTable<U>& tbl,
                                               EmitMemberFn<S, Joiner, Out> ptr) {
@@ -81,6 +81,24 @@ template <typename OutT> class PTable {
     return impl_->BindWith(ptr);
   }
 
+  /// Binds the table to the joiner in sorted grouping mode. The joiner receives the records
+  /// of each shard ordered by key_fn and Handler::OnGroupFinish(DoContext*), if defined, is called
+  /// after the last record of every key. Records are sorted externally, spilling to disk
+  /// when needed, so that the handler only needs to keep a state of a single key.
+  /// All the inputs of the joiner must be bound with a key.
+  template <typename Handler, typename ToType, typename U, typename KeyFn>
+  detail::HandlerBinding<Handler, ToType> BindWith(EmitMemberFn<U, Handler, ToType> ptr,
+                                                   KeyFn&& key_fn) const {
+    return impl_->BindWith(ptr, std::forward<KeyFn>(key_fn));
+  }
+
+  /// Loads all the records of the table into a read-only in-memory map once the table is
+  /// computed. The map is shared by all IO threads of the following operators that can find it
+  /// with PipelineContext::FindBroadcastMap<K, OutT>(map_id), where K is the type returned by
+  /// key_fn. This allows joining a large table with a small one in a plain Map, without sharding
+  /// both of them. The table must be written before it is broadcast.
+  template <typename KeyFn> void Broadcast(const std::string& map_id, KeyFn&& key_fn) const;
+
   template <typename U> PTable<U> As() const { return PTable<U>{impl_->template Rebind<U>()}; }
 
   PTable<rapidjson::Document> AsJson() const { return As<rapidjson::Document>(); }
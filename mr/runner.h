@@ -3,6 +3,9 @@
 //
 #pragma once
 
+#include <limits>
+#include <vector>
+
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "mr/mr3.pb.h"
@@ -26,15 +29,27 @@ class Runner {
   virtual void Shutdown() = 0;
 
   // It's guaranteed that op will live until OperatorEnd is called.
+  // Independent operators of the pipeline may run concurrently, therefore the calls below
+  // identify the operator they refer to.
   virtual void OperatorStart(const pb::Operator* op) = 0;
 
   // Must be thread-safe. Called from multiple threads in operator_executors.
-  virtual RawContext* CreateContext() = 0;
+  virtual RawContext* CreateContext(const pb::Operator* op) = 0;
+
+  virtual void OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) = 0;
 
-  virtual void OperatorEnd(ShardFileMap* out_files) = 0;
+  struct OutputProgress {
+    size_t shards = 0;       // Output shard files opened so far.
+    uint64_t raw_bytes = 0;  // Bytes written into them, before compression.
+  };
+
+  // Returns the progress of the outputs of a running operator. Called by the status pages,
+  // therefore must be thread-safe and must not block.
+  virtual OutputProgress GetOutputProgress(const pb::Operator* op) { return OutputProgress{}; }
 
   using ExpandCb = std::function<void(size_t file_size, const std::string&)>;
 
+  // cb is called as the files are listed, possibly by several fibers of the calling thread.
   virtual void ExpandGlob(const std::string& glob, ExpandCb cb) = 0;
 
   // Read file and fill queue. This function must be fiber-friendly.
@@ -42,7 +57,61 @@ class Runner {
   virtual size_t ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                                   RawSinkCb cb) = 0;
 
+  // Byte range of an input file. Each record belongs to the range it starts in
+  // (for LST files - the range its block starts in), so a set of ranges that covers the file
+  // processes every record exactly once.
+  struct FileRange {
+    size_t offset = 0;
+    size_t length = std::numeric_limits<size_t>::max();  // Whole file by default.
+
+    bool whole_file() const { return offset == 0 && length == std::numeric_limits<size_t>::max(); }
+  };
+
+  struct ReadOptions {
+    FileRange range;
+
+    // Number of the first records of the range to drop.
+    unsigned skip_records = 0;
+
+    // plang expression, records that do not match it are dropped after skip_records.
+    std::string filter;
+
+    // Fields decoded from COLUMNAR files, all of them if empty.
+    std::vector<std::string> columns;
+
+    // If not empty, records that contain none of the literals are dropped after skip_records
+    // and before filter.
+    std::vector<std::string> literals;
+  };
+
+  // Splits the input file into ranges of about max_range_size bytes that are processed
+  // independently by ProcessInputRange. Runners that can not split the file
+  // leave out_ranges empty. Must be fiber-friendly.
+  virtual void SplitInputFile(const std::string& filename, size_t file_size,
+                              pb::WireFormat::Type type, size_t max_range_size,
+                              std::vector<FileRange>* out_ranges) {}
+
+  // Processes the records of a range returned by SplitInputFile, or of the whole file,
+  // according to opts. Returns number of records read, including the dropped ones.
+  // The default implementation supports only skip_records for whole files.
+  virtual size_t ProcessInputRange(const std::string& filename, pb::WireFormat::Type type,
+                                   const ReadOptions& opts, RawSinkCb cb);
+
+  // Same as ProcessInputRange but cb gets views into the buffers of the reader, so the callers
+  // that keep the records copy them once into their own storage. The default implementation
+  // passes the records of ProcessInputRange.
+  virtual size_t ProcessInputRangeViews(const std::string& filename, pb::WireFormat::Type type,
+                                        const ReadOptions& opts, RawViewCb cb);
+
+  // Multiplies the default read-ahead of the files that the calling IO thread opens afterwards.
+  // Used by the executors to adapt the reading to the storage. Runners may ignore it.
+  virtual void SetReadAheadScale(unsigned scale) {}
+
   virtual void SaveFile(absl::string_view fn, absl::string_view data) = 0;
+
+  // Reads a file saved with SaveFile, possibly by a previous run.
+  // Returns false if the file does not exist.
+  virtual bool LoadFile(absl::string_view fn, std::string* data) = 0;
 };
 
 }  // namespace mr3
@@ -2,6 +2,9 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include "mr/test_utils.h"
+
+#include <algorithm>
+
 #include "base/logging.h"
 
 namespace mr3 {
@@ -22,6 +25,12 @@ void TestContext::WriteInternal(const ShardId& shard_id, string&& record) {
   outp_ss_.s_out[shard_id].push_back(record);
 }
 
+void TestContext::WriteSortedInternal(const ShardId& shard_id, string&& key, string&& record) {
+  lock_guard<fibers::mutex> lk(outp_ss_.mu);
+  CHECK(!outp_ss_.is_finished);
+  outp_ss_.sorted_out[shard_id].emplace_back(std::move(key), std::move(record));
+}
+
 void TestContext::Flush() {
   runner_->parse_errors += metric_map()["parse-errors"];
   runner_->write_calls += metric_map()["fn-writes"];
@@ -31,18 +40,22 @@ void TestRunner::Init() {}
 
 void TestRunner::Shutdown() {}
 
-RawContext* TestRunner::CreateContext() {
-  CHECK(!op_->output().name().empty());
-  last_out_name_ = op_->output().name();
-  auto& res = out_tables_[last_out_name_];
-  if (!res)
+RawContext* TestRunner::CreateContext(const pb::Operator* op) {
+  CHECK(!op->output().name().empty());
+
+  std::lock_guard<std::mutex> lk(mu_);
+  // A table that was finished by a previous run gets new shard files.
+  auto& res = out_tables_[op->output().name()];
+  if (!res || res->is_finished)
     res.reset(new OutputShardSet);
 
   return new TestContext(this, res.get());
 }
 
 void TestRunner::ExpandGlob(const string& glob, ExpandCb cb) {
+  std::unique_lock<std::mutex> lk(mu_);
   auto it = input_fs_.find(glob);
+  lk.unlock();
   CHECK(it != input_fs_.end()) << "Missing test file " << glob;
 
   if (it != input_fs_.end()) {
@@ -50,24 +63,40 @@ void TestRunner::ExpandGlob(const string& glob, ExpandCb cb) {
   }
 }
 
-void TestRunner::OperatorEnd(ShardFileMap* out_files) {
-  auto it = out_tables_.find(last_out_name_);
+void TestRunner::OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) {
+  const string& out_name = op->output().name();
+
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = out_tables_.find(out_name);
   CHECK(it != out_tables_.end());
   it->second->is_finished = true;
 
+  for (auto& k_v : it->second->sorted_out) {
+    auto& entries = k_v.second;
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const auto& l, const auto& r) { return l.first < r.first; });
+    auto& dest = it->second->s_out[k_v.first];
+    for (auto& e : entries) {
+      dest.push_back(std::move(e.second));
+    }
+  }
+  it->second->sorted_out.clear();
+
   for (const auto& k_v : it->second->s_out) {
-    string name = last_out_name_ + "/" + k_v.first.ToString("shard");
+    string name = out_name + "/" + k_v.first.ToString("shard");
     out_files->emplace(k_v.first, name);
     input_fs_[name] = k_v.second;
   }
-  op_ = nullptr;
 }
 
 // Read file and fill queue. This function must be fiber-friendly.
 size_t TestRunner::ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                                     RawSinkCb cb) {
+  std::unique_lock<std::mutex> lk(mu_);
   auto it = input_fs_.find(filename);
   CHECK(it != input_fs_.end());
+  lk.unlock();
+
   for (const auto& str : it->second) {
     cb(string{str});
   }
@@ -76,6 +105,7 @@ size_t TestRunner::ProcessInputFile(const std::string& filename, pb::WireFormat:
 }
 
 const ShardedOutput& TestRunner::Table(const std::string& tb_name) const {
+  std::lock_guard<std::mutex> lk(mu_);
   auto it = out_tables_.find(tb_name);
   CHECK(it != out_tables_.end()) << "Missing table file " << tb_name;
 
@@ -3,7 +3,9 @@
 //
 #pragma once
 
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include <boost/fiber/mutex.hpp>
 
@@ -39,6 +41,9 @@ class TestRunner;
 
 struct OutputShardSet {
   ShardedOutput s_out;
+
+  // (key, record) pairs of sorted outputs. Moved into s_out when the operator ends.
+  std::unordered_map<ShardId, std::vector<std::pair<std::string, std::string>>> sorted_out;
   bool is_finished = false;
   ::boost::fibers::mutex mu;
 };
@@ -51,6 +56,7 @@ class TestContext : public RawContext {
   TestContext(TestRunner* runner, OutputShardSet* outp) : runner_(runner), outp_ss_(*outp) {}
 
   void WriteInternal(const ShardId& shard_id, std::string&& record);
+  void WriteSortedInternal(const ShardId& shard_id, std::string&& key, std::string&& record);
   void Flush() final;
   void CloseShard(const ShardId& sid) {}
 };
@@ -61,7 +67,7 @@ class TestRunner : public Runner {
 
   void Shutdown() final;
 
-  RawContext* CreateContext() final;
+  RawContext* CreateContext(const pb::Operator* op) final;
 
   void ExpandGlob(const std::string& glob, ExpandCb cb) final;
 
@@ -69,10 +75,11 @@ class TestRunner : public Runner {
   size_t ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                           RawSinkCb cb) final;
 
-  void OperatorStart(const pb::Operator* op) final { op_ = op; }
-  void OperatorEnd(ShardFileMap* out_files) final;
+  void OperatorStart(const pb::Operator* op) final {}
+  void OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) final;
 
   void AddInputRecords(const std::string& fl, const std::vector<std::string>& records) {
+    std::lock_guard<std::mutex> lk(mu_);
     std::copy(records.begin(), records.end(), std::back_inserter(input_fs_[fl]));
   }
 
@@ -80,17 +87,26 @@ class TestRunner : public Runner {
     out_files_[fn] = std::string(data);
   }
 
+  bool LoadFile(absl::string_view fn, std::string* data) final {
+    auto it = out_files_.find(fn);
+    if (it == out_files_.end())
+      return false;
+    *data = it->second;
+    return true;
+  }
+
   const ShardedOutput& Table(const std::string& tb_name) const;
   const std::string& SavedFile(const std::string& fn) const;
 
   std::atomic_int parse_errors{0}, write_calls{0};
 
  private:
-  const pb::Operator* op_ = nullptr;
-  absl::flat_hash_map<std::string, std::vector<std::string>> input_fs_;
-  absl::flat_hash_map<std::string, std::unique_ptr<OutputShardSet>> out_tables_;
+  // Guards input_fs_ and out_tables_. Operators that run concurrently read the inputs
+  // while others add their outputs, hence the node based maps that keep references stable.
+  mutable std::mutex mu_;
+  std::unordered_map<std::string, std::vector<std::string>> input_fs_;
+  std::unordered_map<std::string, std::unique_ptr<OutputShardSet>> out_tables_;
   absl::flat_hash_map<std::string, std::string> out_files_;
-  std::string last_out_name_;
 };
 
 class EmptyRunner : public Runner {
@@ -107,19 +123,20 @@ class EmptyRunner : public Runner {
 
   void Shutdown() final {}
 
-  RawContext* CreateContext() final { return new Context; }
+  RawContext* CreateContext(const pb::Operator* op) final { return new Context; }
 
   void ExpandGlob(const std::string& glob, ExpandCb cb) final {
     cb(0, glob);
   }
 
   void OperatorStart(const pb::Operator* op) final {}
-  void OperatorEnd(ShardFileMap* out_files) final  {}
+  void OperatorEnd(const pb::Operator* op, ShardFileMap* out_files) final  {}
 
   size_t ProcessInputFile(const std::string& filename, pb::WireFormat::Type type,
                           RawSinkCb cb) final;
 
   void SaveFile(absl::string_view, absl::string_view) final {}
+  bool LoadFile(absl::string_view, std::string*) final { return false; }
 };
 
 }  // namespace mr3
@@ -0,0 +1,75 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "mr/worker_service.h"
+
+#include "base/logging.h"
+#include "mr/pipeline.h"
+
+namespace mr3 {
+
+using namespace std;
+using namespace boost;
+using namespace util;
+
+class WorkerService::Bridge : public rpc::ConnectionBridge {
+ public:
+  explicit Bridge(WorkerService* owner) : owner_(owner) {}
+
+  void HandleEnvelope(rpc::RpcId rpc_id, rpc::Envelope* input, EnvelopeWriter writer) final;
+
+ private:
+  WorkerService* owner_;
+};
+
+void WorkerService::Bridge::HandleEnvelope(rpc::RpcId rpc_id, rpc::Envelope* input,
+                                           EnvelopeWriter writer) {
+  PendingTask pending;
+  pb::TaskResult result;
+
+  if (pending.task.ParseFromArray(input->letter.data(), input->letter.size())) {
+    auto future = pending.result.get_future();
+
+    // Blocks until Serve picks up the task.
+    if (owner_->task_q_.push(&pending) == fibers::channel_op_status::success) {
+      result = future.get();
+    } else {
+      result.set_error("Worker is shutting down");
+    }
+  } else {
+    result.set_error("Could not parse the task");
+  }
+
+  rpc::Envelope envelope = rpc::EnvelopePool::Get();
+  envelope.letter.resize(result.ByteSizeLong());
+  CHECK(result.SerializeToArray(envelope.letter.data(), envelope.letter.size()));
+  writer(std::move(envelope));
+}
+
+WorkerService::WorkerService() {}
+
+WorkerService::~WorkerService() { task_q_.close(); }
+
+void WorkerService::Serve(Pipeline* pipeline, Runner* runner) {
+  LOG(INFO) << "Serving mr3 tasks";
+
+  PendingTask* pending = nullptr;
+  while (task_q_.pop(pending) == fibers::channel_op_status::success) {
+    const pb::Task& task = pending->task;
+    if (task.op_name().empty()) {
+      pending->result.set_value(pb::TaskResult{});
+      break;
+    }
+
+    LOG(INFO) << "Running task " << task.op_name() << "/" << task.file_tag();
+    pb::TaskResult result;
+    pipeline->RunTask(task, runner, &result);
+    pending->result.set_value(std::move(result));
+  }
+
+  LOG(INFO) << "Finished serving mr3 tasks";
+}
+
+rpc::ConnectionBridge* WorkerService::CreateConnectionBridge() { return new Bridge(this); }
+
+}  // namespace mr3
@@ -0,0 +1,47 @@
+// Copyright 2019, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/fiber/future.hpp>
+#include <boost/fiber/unbuffered_channel.hpp>
+
+#include "mr/mr3.pb.h"
+#include "util/rpc/rpc_connection.h"
+
+namespace mr3 {
+
+class Pipeline;
+class Runner;
+
+/*! \class mr3::WorkerService
+    \brief RPC service that runs pipeline operators on behalf of mr3::Coordinator.
+
+    The service should be added to the AcceptServer of the worker process. Once attached to
+    the pipeline, Pipeline::Run does not run the operators by itself but serves the tasks that
+    the coordinator sends until it receives the shutdown request.
+    Tasks run one by one in the thread that called Pipeline::Run.
+*/
+class WorkerService : public util::rpc::ServiceInterface {
+ public:
+  WorkerService();
+  ~WorkerService();
+
+  //! Blocks until the coordinator shuts the worker down.
+  void Serve(Pipeline* pipeline, Runner* runner);
+
+ protected:
+  util::rpc::ConnectionBridge* CreateConnectionBridge() final;
+
+ private:
+  class Bridge;
+
+  struct PendingTask {
+    pb::Task task;
+    ::boost::fibers::promise<pb::TaskResult> result;
+  };
+
+  ::boost::fibers::unbuffered_channel<PendingTask*> task_q_;
+};
+
+}  // namespace mr3
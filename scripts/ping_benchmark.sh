@@ -0,0 +1,64 @@
+#!/bin/bash
+# Compares the ping servers of examples/pingserver under the same RESP PING load.
+# Runs from the build directory: scripts/ping_benchmark.sh [clients] [pipeline] [requests]
+# Needs redis-benchmark. Prints the QPS, the server CPU time per request and the tail latency
+# of every variant.
+
+CLIENTS=${1:-50}
+PIPELINE=${2:-1}
+REQUESTS=${3:-1000000}
+PORT=${PORT:-6380}
+HZ=$(getconf CLK_TCK)
+
+# name|command line of the server.
+VARIANTS=(
+  "epoll|./ping_epoll_server --port=$PORT"
+  "asio|./ping_server --port=$PORT"
+  "uring|./ping_iouring_server --port=$PORT"
+  "uring_provided|./ping_iouring_server --port=$PORT --recv_mode=provided"
+  "uring_multishot|./ping_iouring_server --port=$PORT --recv_mode=multishot"
+  "uring_fixed|./ping_iouring_server --port=$PORT --recv_mode=fixed --proactor_fixed_files=1024"
+  "uring_sqpoll|./ping_iouring_server --port=$PORT --sqpoll"
+  "uring_busy|./ping_iouring_server --port=$PORT --busy_poll_usec=50"
+  "uring_zc|./ping_iouring_server --port=$PORT --uring_send_zc_threshold=1"
+)
+
+# Prints utime + stime of the process in clock ticks.
+cpu_ticks() {
+  awk '{print $14 + $15}' /proc/$1/stat
+}
+
+run_variant() {
+  local name=$1 cmd=$2
+  $cmd --logtostderr=0 > /dev/null 2>&1 &
+  local pid=$!
+  sleep 1
+  if ! kill -0 $pid 2>/dev/null; then
+    printf "%-18s failed to start\n" $name
+    return
+  fi
+
+  local start=$(cpu_ticks $pid)
+  local out=$(redis-benchmark -p $PORT -t ping_mbulk -c $CLIENTS -P $PIPELINE -n $REQUESTS \
+              --precision 3 2>/dev/null)
+  local end=$(cpu_ticks $pid)
+  kill $pid
+  wait $pid 2>/dev/null
+
+  local qps=$(echo "$out" | awk '/requests per second/ {print $1; exit}')
+
+  # The latency lines are "<percent>% <= <msec> milliseconds".
+  percentile() {
+    echo "$out" | awk -v p=$1 '/% <= / { sub("%", "", $1); if ($1 >= p) { print $3; exit } }'
+  }
+  local usec_per_req=$(echo "$start $end" | awk -v hz=$HZ -v n=$REQUESTS \
+                       '{printf "%.2f", ($2 - $1) * 1e6 / hz / n}')
+
+  printf "%-18s %12s %14s %10s %10s\n" $name "$qps" $usec_per_req \
+         "$(percentile 99)" "$(percentile 99.9)"
+}
+
+printf "%-18s %12s %14s %10s %10s\n" variant qps "cpu_usec/req" "p99_ms" "p99.9_ms"
+for v in "${VARIANTS[@]}"; do
+  run_variant "${v%%|*}" "${v#*|}"
+done
@@ -5,6 +5,10 @@
 #include <string.h>
 #include "strings/stringpiece.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace strings {
 
 CharSet::CharSet() {
@@ -18,4 +22,290 @@ CharSet::CharSet(StringPiece characters) {
   }
 }
 
+namespace {
+
+// Decodes the UTF-8 sequence at the start of [p, end). Returns its length or 0 if it's invalid.
+inline unsigned DecodeUtf8(const uint8* p, const uint8* end, char32_t* cp) {
+  uint8 c = *p;
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+
+  unsigned len;
+  char32_t res, min;
+  if ((c & 0xE0) == 0xC0) {
+    len = 2;
+    res = c & 0x1F;
+    min = 0x80;
+  } else if ((c & 0xF0) == 0xE0) {
+    len = 3;
+    res = c & 0x0F;
+    min = 0x800;
+  } else if ((c & 0xF8) == 0xF0) {
+    len = 4;
+    res = c & 0x07;
+    min = 0x10000;
+  } else {
+    return 0;
+  }
+
+  if (end - p < ptrdiff_t(len))
+    return 0;
+  for (unsigned i = 1; i < len; ++i) {
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+    res = (res << 6) | (p[i] & 0x3F);
+  }
+  if (res < min || res > 0x10FFFF || (res >= 0xD800 && res <= 0xDFFF))
+    return 0;
+
+  *cp = res;
+  return len;
+}
+
+bool IsValidUtf8Scalar(const uint8* p, const uint8* end) {
+  char32_t cp;
+  while (p < end) {
+    unsigned len = DecodeUtf8(p, end, &cp);
+    if (len == 0)
+      return false;
+    p += len;
+  }
+  return true;
+}
+
+#ifdef __AVX2__
+
+// The error classes of the pairs of consecutive bytes, see "Validating UTF-8 In Less Than
+// One Instruction Per Byte" by John Keiser and Daniel Lemire.
+constexpr uint8 kTooShort = 1 << 0;    // 11______ 0_______ or 11______ 11______
+constexpr uint8 kTooLong = 1 << 1;     // 0_______ 10______
+constexpr uint8 kOverlong3 = 1 << 2;   // 11100000 100_____
+constexpr uint8 kTooLarge = 1 << 3;    // 11110100 1001____ and above
+constexpr uint8 kSurrogate = 1 << 4;   // 11101101 101_____
+constexpr uint8 kOverlong2 = 1 << 5;   // 1100000_ 10______
+constexpr uint8 kTooLarge1000 = 1 << 6;  // 11110101 1000____ and above
+constexpr uint8 kOverlong4 = 1 << 6;   // 11110000 1000____
+constexpr uint8 kTwoConts = 1 << 7;    // 10______ 10______
+constexpr uint8 kCarry = kTooShort | kTooLong | kTwoConts;
+
+// Looks up the nibbles of x in the 16 entry table.
+inline __m256i Lookup16(__m256i x, uint8 t0, uint8 t1, uint8 t2, uint8 t3, uint8 t4, uint8 t5,
+                        uint8 t6, uint8 t7, uint8 t8, uint8 t9, uint8 t10, uint8 t11,
+                        uint8 t12, uint8 t13, uint8 t14, uint8 t15) {
+  const __m256i table = _mm256_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12,
+                                         t13, t14, t15, t0, t1, t2, t3, t4, t5, t6, t7, t8, t9,
+                                         t10, t11, t12, t13, t14, t15);
+  return _mm256_shuffle_epi8(table, x);
+}
+
+inline __m256i HighNibbles(__m256i x) {
+  return _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0F));
+}
+
+// The input shifted by n bytes towards the end, with the last bytes of prev shifted in.
+template <int n> inline __m256i Prev(__m256i input, __m256i prev) {
+  return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - n);
+}
+
+// Returns non-zero bytes for the errors in input with respect to the block before it.
+inline __m256i CheckBlock(__m256i input, __m256i prev_input) {
+  const __m256i prev1 = Prev<1>(input, prev_input);
+
+  __m256i byte_1_high = Lookup16(
+      HighNibbles(prev1), kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+      kTooLong, kTwoConts, kTwoConts, kTwoConts, kTwoConts, kTooShort | kOverlong2, kTooShort,
+      kTooShort | kOverlong3 | kSurrogate, kTooShort | kTooLarge | kTooLarge1000 | kOverlong4);
+
+  constexpr uint8 kLarge = kCarry | kTooLarge | kTooLarge1000;
+  __m256i byte_1_low = Lookup16(
+      _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)),
+      kCarry | kOverlong3 | kOverlong2 | kOverlong4, kCarry | kOverlong2, kCarry, kCarry,
+      kCarry | kTooLarge, kLarge, kLarge, kLarge, kLarge, kLarge, kLarge, kLarge, kLarge,
+      kLarge | kSurrogate, kLarge, kLarge);
+
+  constexpr uint8 kCont = kTooLong | kOverlong2 | kTwoConts;
+  __m256i byte_2_high = Lookup16(
+      HighNibbles(input), kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooShort, kTooShort, kCont | kOverlong3 | kTooLarge1000 | kOverlong4,
+      kCont | kOverlong3 | kTooLarge, kCont | kSurrogate | kTooLarge,
+      kCont | kSurrogate | kTooLarge, kTooShort, kTooShort, kTooShort, kTooShort);
+
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  // The third and the fourth bytes of the sequences must be continuations, which the
+  // lookups above classify as kTwoConts errors.
+  __m256i third = _mm256_subs_epu8(Prev<2>(input, prev_input), _mm256_set1_epi8(0xE0 - 0x80));
+  __m256i fourth = _mm256_subs_epu8(Prev<3>(input, prev_input), _mm256_set1_epi8(0xF0 - 0x80));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(0x80));
+
+  return _mm256_xor_si256(must23, special);
+}
+
+// Non-zero if the block ends with an incomplete sequence.
+inline __m256i IsIncomplete(__m256i input) {
+  const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       -1, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+  return _mm256_subs_epu8(input, max);
+}
+
+bool IsValidUtf8Avx2(const uint8* p, const uint8* end) {
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+
+  auto process = [&](__m256i input) {
+    if (_mm256_movemask_epi8(input) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+    } else {
+      error = _mm256_or_si256(error, CheckBlock(input, prev_input));
+      prev_incomplete = IsIncomplete(input);
+    }
+    prev_input = input;
+  };
+
+  for (; end - p >= 32; p += 32) {
+    process(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  }
+
+  // The zero padding is ASCII, hence it also reveals the truncated sequences.
+  alignas(32) uint8 tail[32] = {0};
+  memcpy(tail, p, end - p);
+  process(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+  error = _mm256_or_si256(error, prev_incomplete);
+
+  return _mm256_testz_si256(error, error);
+}
+
+#endif
+
+}  // namespace
+
+size_t AsciiPrefixLength(StringPiece str) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+
+#ifdef __AVX2__
+  for (; end - p >= 32; p += 32) {
+    uint32 mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    if (mask)
+      return p - str.data() + __builtin_ctz(mask);
+  }
+#endif
+
+  for (; end - p >= 8; p += 8) {
+    uint64 word;
+    memcpy(&word, p, 8);
+    word &= 0x8080808080808080ULL;
+    if (word)
+      return p - str.data() + __builtin_ctzll(word) / 8;
+  }
+  for (; p < end; ++p) {
+    if (uint8(*p) >= 0x80)
+      break;
+  }
+  return p - str.data();
+}
+
+bool IsValidUtf8(StringPiece str) {
+  size_t ascii = AsciiPrefixLength(str);
+  const uint8* p = reinterpret_cast<const uint8*>(str.data()) + ascii;
+  const uint8* end = reinterpret_cast<const uint8*>(str.data()) + str.size();
+  if (p == end)
+    return true;
+
+#ifdef __AVX2__
+  if (end - p >= 32)
+    return IsValidUtf8Avx2(p, end);
+#endif
+  return IsValidUtf8Scalar(p, end);
+}
+
+bool Utf8ToUtf16(StringPiece src, std::u16string* dest) {
+  // Every UTF-8 sequence produces at most as many UTF-16 code units as its length.
+  dest->resize(src.size());
+  char16_t* out = &(*dest)[0];
+  const uint8* p = reinterpret_cast<const uint8*>(src.data());
+  const uint8* end = p + src.size();
+
+  while (p < end) {
+#ifdef __AVX2__
+    // Widens the ASCII runs 16 bytes at a time.
+    if (end - p >= 16) {
+      __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      if (_mm_movemask_epi8(chars) == 0) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi16(chars));
+        p += 16;
+        out += 16;
+        continue;
+      }
+    }
+#endif
+    char32_t cp;
+    unsigned len = DecodeUtf8(p, end, &cp);
+    if (len == 0)
+      return false;
+    p += len;
+
+    if (cp < 0x10000) {
+      *out++ = cp;
+    } else {
+      cp -= 0x10000;
+      *out++ = 0xD800 + (cp >> 10);
+      *out++ = 0xDC00 + (cp & 0x3FF);
+    }
+  }
+
+  dest->resize(out - dest->data());
+  return true;
+}
+
+bool Utf16ToUtf8(const char16_t* src, size_t len, std::string* dest) {
+  // Every UTF-16 code unit produces at most 3 bytes, surrogate pairs produce 4.
+  dest->resize(len * 3);
+  char* out = &(*dest)[0];
+  const char16_t* end = src + len;
+
+  while (src < end) {
+#ifdef __AVX2__
+    // Narrows the ASCII runs 16 code units at a time.
+    if (end - src >= 16) {
+      __m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      if (_mm256_testz_si256(units, _mm256_set1_epi16(0xFF80))) {
+        __m128i chars = _mm_packus_epi16(_mm256_castsi256_si128(units),
+                                         _mm256_extracti128_si256(units, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+        src += 16;
+        out += 16;
+        continue;
+      }
+    }
+#endif
+    char32_t cp = *src++;
+    if (cp < 0x80) {
+      *out++ = cp;
+    } else if (cp < 0x800) {
+      *out++ = 0xC0 | (cp >> 6);
+      *out++ = 0x80 | (cp & 0x3F);
+    } else if (cp < 0xD800 || cp > 0xDFFF) {
+      *out++ = 0xE0 | (cp >> 12);
+      *out++ = 0x80 | ((cp >> 6) & 0x3F);
+      *out++ = 0x80 | (cp & 0x3F);
+    } else {
+      if (cp > 0xDBFF || src == end || *src < 0xDC00 || *src > 0xDFFF)
+        return false;
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (*src++ - 0xDC00);
+      *out++ = 0xF0 | (cp >> 18);
+      *out++ = 0x80 | ((cp >> 12) & 0x3F);
+      *out++ = 0x80 | ((cp >> 6) & 0x3F);
+      *out++ = 0x80 | (cp & 0x3F);
+    }
+  }
+
+  dest->resize(out - dest->data());
+  return true;
+}
+
 }  // namespace strings
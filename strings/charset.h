@@ -19,6 +19,8 @@
 #ifndef STRINGS_CHARSET_H_
 #define STRINGS_CHARSET_H_
 
+#include <string>
+
 #include "base/integral_types.h"
 #include "strings/stringpiece.h"
 
@@ -84,6 +86,28 @@ class CharSet {
   }
 };
 
+// UTF-8 routines. They process 32 bytes at a time with AVX2 when it's available
+// and fall back to scalar code otherwise.
+
+// Returns the length of the longest prefix of str that consists of ASCII characters.
+size_t AsciiPrefixLength(StringPiece str);
+
+inline bool IsAscii(StringPiece str) {
+  return AsciiPrefixLength(str) == str.size();
+}
+
+// Returns true if str is valid UTF-8, i.e. has no truncated sequences, overlong encodings,
+// surrogates or code points above U+10FFFF. Uses the lookup algorithm of Keiser and Lemire.
+bool IsValidUtf8(StringPiece str);
+
+// Converts src to UTF-16 (native endianness) into dest. Returns false if src is not
+// valid UTF-8, the contents of dest are undefined then.
+bool Utf8ToUtf16(StringPiece src, std::u16string* dest);
+
+// Converts UTF-16 into UTF-8. Returns false on unpaired surrogates, the contents of dest
+// are undefined then.
+bool Utf16ToUtf8(const char16_t* src, size_t len, std::string* dest);
+
 }  // namespace strings
 
 #endif  // STRINGS_CHARSET_H_
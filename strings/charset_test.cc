@@ -0,0 +1,138 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "strings/charset.h"
+
+#include <random>
+
+#include "base/gtest.h"
+
+using namespace std;
+
+namespace strings {
+
+class CharsetTest : public testing::Test {
+ protected:
+  // Validates with the byte ranges of RFC 3629.
+  static bool Reference(const string& s) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(s.data());
+    const uint8_t* end = p + s.size();
+    auto cont = [&](size_t i, uint8_t lo = 0x80, uint8_t hi = 0xBF) {
+      return p + i < end && p[i] >= lo && p[i] <= hi;
+    };
+
+    while (p < end) {
+      uint8_t c = *p;
+      size_t len;
+      if (c < 0x80) {
+        len = 1;
+      } else if (c >= 0xC2 && c <= 0xDF) {
+        len = cont(1) ? 2 : 0;
+      } else if (c >= 0xE0 && c <= 0xEF) {
+        uint8_t lo = c == 0xE0 ? 0xA0 : 0x80, hi = c == 0xED ? 0x9F : 0xBF;
+        len = cont(1, lo, hi) && cont(2) ? 3 : 0;
+      } else if (c >= 0xF0 && c <= 0xF4) {
+        uint8_t lo = c == 0xF0 ? 0x90 : 0x80, hi = c == 0xF4 ? 0x8F : 0xBF;
+        len = cont(1, lo, hi) && cont(2) && cont(3) ? 4 : 0;
+      } else {
+        len = 0;
+      }
+      if (len == 0)
+        return false;
+      p += len;
+    }
+    return true;
+  }
+};
+
+TEST_F(CharsetTest, Ascii) {
+  EXPECT_EQ(0, AsciiPrefixLength(""));
+  EXPECT_TRUE(IsAscii("hello"));
+  string s(100, 'a');
+  for (size_t i = 0; i < s.size(); ++i) {
+    string t = s;
+    t[i] = '\xC3';
+    EXPECT_EQ(i, AsciiPrefixLength(t));
+  }
+}
+
+TEST_F(CharsetTest, Validate) {
+  EXPECT_TRUE(IsValidUtf8(""));
+  EXPECT_TRUE(IsValidUtf8("ascii"));
+  EXPECT_TRUE(IsValidUtf8("\xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D"));  // Hebrew.
+  EXPECT_TRUE(IsValidUtf8("\xE2\x82\xAC \xF0\x9F\x98\x80"));     // Euro sign and emoji.
+  EXPECT_TRUE(IsValidUtf8("\xF4\x8F\xBF\xBF"));                  // U+10FFFF.
+
+  const char* kInvalid[] = {
+      "\x80",              // Lone continuation.
+      "\xC3",              // Truncated.
+      "\xC0\xAF",          // Overlong.
+      "\xE0\x80\xAF",      // Overlong.
+      "\xF0\x80\x80\xAF",  // Overlong.
+      "\xED\xA0\x80",      // Surrogate.
+      "\xF4\x90\x80\x80",  // Above U+10FFFF.
+      "\xF8\x88\x80\x80\x80",
+      "\xFF",
+  };
+
+  // The prefixes move the invalid sequences across the block boundaries.
+  for (size_t prefix = 0; prefix < 70; ++prefix) {
+    for (const char* invalid : kInvalid) {
+      string s = string(prefix, 'a') + "\xD7\xA9" + invalid + string(prefix % 7, 'b');
+      EXPECT_FALSE(IsValidUtf8(s)) << prefix << " " << invalid;
+    }
+    string s = string(prefix, 'a') + "\xF0\x9F\x98\x80";
+    EXPECT_TRUE(IsValidUtf8(s));
+    s.pop_back();
+    EXPECT_FALSE(IsValidUtf8(s));
+  }
+}
+
+TEST_F(CharsetTest, ValidateRandom) {
+  std::mt19937 rng(10);
+  const char* kPieces[] = {"a", "bc", "\xD7\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",
+                           "\x80", "\xC3", "\xED\xA0\x80", "\xF4\x90", "\xE0\x9F\xBF"};
+  for (unsigned iter = 0; iter < 20000; ++iter) {
+    string s;
+    unsigned num = rng() % 60;
+    for (unsigned i = 0; i < num; ++i) {
+      // The invalid pieces are rare so that most strings are valid.
+      unsigned piece = rng() % 100;
+      s += kPieces[piece < 95 ? piece % 5 : 5 + piece % 5];
+    }
+    ASSERT_EQ(Reference(s), IsValidUtf8(s)) << iter;
+  }
+}
+
+TEST_F(CharsetTest, Transcode) {
+  u16string u16;
+  string u8;
+  string input = "abc \xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D \xE2\x82\xAC \xF0\x9F\x98\x80" +
+                 string(40, 'x') + "\xC3\xA9";
+  ASSERT_TRUE(Utf8ToUtf16(input, &u16));
+  EXPECT_EQ(u"abc שלום € \U0001F600" + u16string(40, u'x') + u"é",
+            u16);
+  ASSERT_TRUE(Utf16ToUtf8(u16.data(), u16.size(), &u8));
+  EXPECT_EQ(input, u8);
+
+  EXPECT_FALSE(Utf8ToUtf16("ab\xC3", &u16));
+  const char16_t kUnpaired[] = {u'a', 0xD800, u'b'};
+  EXPECT_FALSE(Utf16ToUtf8(kUnpaired, 3, &u8));
+  EXPECT_FALSE(Utf16ToUtf8(kUnpaired, 2, &u8));
+  const char16_t kLow[] = {0xDC00};
+  EXPECT_FALSE(Utf16ToUtf8(kLow, 1, &u8));
+}
+
+static void BM_IsValidUtf8(benchmark::State& state) {
+  string s;
+  while (s.size() < 4096) {
+    s += "some ascii text \xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D \xE2\x82\xAC ";
+  }
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(IsValidUtf8(s));
+  }
+  state.SetBytesProcessed(state.iterations() * s.size());
+}
+BENCHMARK(BM_IsValidUtf8);
+
+}  // namespace strings
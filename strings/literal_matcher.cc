@@ -0,0 +1,122 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "strings/literal_matcher.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace strings {
+
+using namespace std;
+
+namespace {
+
+// Rough ranking of how often a byte appears in text and log files, higher is more frequent.
+unsigned Frequency(uint8_t c) {
+  static const char kLetters[] = "etaoinsrhldcumfpgwybvkxjqz";  // By their English frequency.
+
+  if (c == ' ')
+    return 255;
+  if (c >= 'a' && c <= 'z')
+    return 220 - 4 * (strchr(kLetters, c) - kLetters);
+  if (c >= '0' && c <= '9')
+    return c <= '2' ? 190 : 170;
+  if (c >= 'A' && c <= 'Z')
+    return 140 - 2 * (strchr(kLetters, c - 'A' + 'a') - kLetters);
+  if (c == '\t' || (c && strchr(".,:;-_/=\"'()[]", c)))
+    return 160;
+  if (c > 32 && c < 127)
+    return 60;
+  return 20;
+}
+
+}  // namespace
+
+LiteralMatcher::LiteralMatcher(const vector<string>& literals) {
+  memset(group_index_, 0, sizeof(group_index_));
+
+  for (const string& lit : literals) {
+    CHECK(!lit.empty());
+    CHECK_EQ(string::npos, lit.find('\n')) << lit;
+
+    unsigned offset = 0;
+    for (unsigned i = 1; i < lit.size(); ++i) {
+      if (Frequency(lit[i]) < Frequency(lit[offset]))
+        offset = i;
+    }
+
+    uint8_t anchor = lit[offset];
+    if (group_index_[anchor] == 0) {
+      groups_.emplace_back();
+      anchors_.push_back(anchor);
+      group_index_[anchor] = groups_.size();
+    }
+    groups_[group_index_[anchor] - 1].push_back(Literal{lit, offset});
+  }
+  CHECK_LT(groups_.size(), 256);
+}
+
+size_t LiteralMatcher::Verify(StringPiece text, size_t pos, unsigned group) const {
+  for (const Literal& lit : groups_[group]) {
+    if (pos < lit.anchor_offset)
+      continue;
+    size_t start = pos - lit.anchor_offset;
+    if (start + lit.str.size() <= text.size() &&
+        memcmp(text.data() + start, lit.str.data(), lit.str.size()) == 0) {
+      return start;
+    }
+  }
+  return npos;
+}
+
+size_t LiteralMatcher::FindScalar(StringPiece text, size_t from) const {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(text.data());
+  for (size_t i = from; i < text.size(); ++i) {
+    unsigned group = group_index_[ptr[i]];
+    if (group) {
+      size_t res = Verify(text, i, group - 1);
+      if (res != npos)
+        return res;
+    }
+  }
+  return npos;
+}
+
+size_t LiteralMatcher::Find(StringPiece text) const {
+  size_t i = 0;
+
+#ifdef __SSE2__
+  size_t num = anchors_.size();
+  if (num && num <= kMaxAnchors) {
+    __m128i ax16[kMaxAnchors];
+    for (size_t j = 0; j < num; ++j)
+      ax16[j] = _mm_set1_epi8(anchors_[j]);
+
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(text.data());
+    for (; i + 16 <= text.size(); i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+      __m128i eq = _mm_cmpeq_epi8(v, ax16[0]);
+      for (size_t j = 1; j < num; ++j)
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, ax16[j]));
+
+      // Verifies the candidates in their order.
+      for (unsigned mask = _mm_movemask_epi8(eq); mask; mask &= mask - 1) {
+        size_t pos = i + __builtin_ctz(mask);
+        size_t res = Verify(text, pos, group_index_[ptr[pos]] - 1);
+        if (res != npos)
+          return res;
+      }
+    }
+  }
+#endif
+
+  return FindScalar(text, i);
+}
+
+}  // namespace strings
@@ -0,0 +1,51 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "strings/stringpiece.h"
+
+namespace strings {
+
+// Finds occurrences of any of a small set of literals, i.e. the IDs that a grep looks for.
+// Every literal is anchored at its rarest byte according to the rough byte frequencies of text
+// and logs. The text is scanned 16 bytes at a time for the anchor bytes and the literals are
+// compared only at the candidate positions, so the scan runs at about memchr speed as long as
+// the anchors are rare. Up to kMaxAnchors distinct anchors are compared in SSE registers,
+// more of them use a table lookup per byte.
+//
+// This class is thread-compatible.
+class LiteralMatcher {
+ public:
+  static constexpr size_t kMaxAnchors = 8;
+  static constexpr size_t npos = StringPiece::npos;
+
+  // Literals must not be empty and must not contain '\n', so that a match never crosses lines.
+  explicit LiteralMatcher(const std::vector<std::string>& literals);
+
+  // Returns the offset of the match whose anchor comes first in text or npos. The match lies
+  // on the first line of text that contains any of the literals.
+  size_t Find(StringPiece text) const;
+
+  bool Contains(StringPiece text) const { return Find(text) != npos; }
+
+ private:
+  struct Literal {
+    std::string str;
+    unsigned anchor_offset;
+  };
+
+  // Returns the start of a literal of group whose anchor is text[pos], or npos.
+  size_t Verify(StringPiece text, size_t pos, unsigned group) const;
+
+  size_t FindScalar(StringPiece text, size_t from) const;
+
+  std::vector<std::vector<Literal>> groups_;  // Literals grouped by their anchor.
+  std::string anchors_;                       // The anchor byte of every group.
+  uint8_t group_index_[256];                  // Group of an anchor byte + 1, 0 for others.
+};
+
+}  // namespace strings
@@ -0,0 +1,92 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "strings/literal_matcher.h"
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+using namespace std;
+
+namespace strings {
+
+class LiteralMatcherTest : public testing::Test {
+ protected:
+  // The leftmost match of any literal.
+  static size_t Reference(StringPiece text, const vector<string>& literals) {
+    size_t res = StringPiece::npos;
+    for (const string& lit : literals)
+      res = std::min(res, text.find(lit));
+    return res;
+  }
+};
+
+TEST_F(LiteralMatcherTest, Basic) {
+  LiteralMatcher matcher({"user_4711", "Q", "zzz"});
+
+  EXPECT_EQ(LiteralMatcher::npos, matcher.Find(""));
+  EXPECT_EQ(LiteralMatcher::npos, matcher.Find("user_4712 zz"));
+  EXPECT_EQ(0, matcher.Find("Q"));
+  EXPECT_EQ(4, matcher.Find("abc user_4711 zzz"));
+  EXPECT_EQ(39, matcher.Find(string(39, 'y') + "zzzz"));
+
+  // A match at the end of the text, after the vectorized part.
+  string text(100, 'a');
+  EXPECT_FALSE(matcher.Contains(text));
+  text.replace(91, 9, "user_4711");
+  EXPECT_EQ(91, matcher.Find(text));
+}
+
+TEST_F(LiteralMatcherTest, Random) {
+  std::mt19937 rng(10);
+  auto rand_str = [&](size_t len, const char* alphabet, size_t alpha_len) {
+    string res(len, ' ');
+    for (char& c : res)
+      c = alphabet[rng() % alpha_len];
+    return res;
+  };
+  const char kAlphabet[] = "abcdefgh0123 ";
+
+  // Up to 20 literals, more than kMaxAnchors of them exercise the scalar search.
+  for (unsigned iter = 0; iter < 300; ++iter) {
+    vector<string> literals(1 + iter % 20);
+    for (string& lit : literals)
+      lit = rand_str(1 + rng() % 6, kAlphabet, sizeof(kAlphabet) - 1);
+    LiteralMatcher matcher(literals);
+
+    for (unsigned j = 0; j < 20; ++j) {
+      string text = rand_str(rng() % 300, kAlphabet, sizeof(kAlphabet) - 1);
+      size_t expected = Reference(text, literals);
+      size_t pos = matcher.Find(text);
+      ASSERT_EQ(expected == StringPiece::npos, pos == StringPiece::npos) << text;
+      if (pos != StringPiece::npos) {
+        // The match may start after the leftmost one but it's a match of some literal.
+        bool is_match = false;
+        for (const string& lit : literals)
+          is_match |= StringPiece(text).substr(pos, lit.size()) == lit;
+        EXPECT_TRUE(is_match) << text << " " << pos;
+        EXPECT_GE(pos, expected);
+      }
+    }
+  }
+}
+
+static void BM_LiteralMatcher(benchmark::State& state) {
+  string text;
+  while (text.size() < (1 << 20))
+    text.append("2020-05-01 12:00:01 INFO request served in 15ms for user 12345\n");
+  vector<string> literals;
+  for (unsigned i = 0; i < state.range(0); ++i)
+    literals.push_back("user-" + std::to_string(1000 + i));
+  LiteralMatcher matcher(literals);
+
+  while (state.KeepRunning()) {
+    CHECK_EQ(LiteralMatcher::npos, matcher.Find(text));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_LiteralMatcher)->Arg(1)->Arg(4)->Arg(16);
+
+}  // namespace strings
@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <float.h>          // for DBL_DIG and FLT_DIG
 #include <math.h>           // for HUGE_VAL
+#include <cmath>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,7 @@
 #include "strings/stringprintf.h"
 
 #include "absl/strings/ascii.h"
+#include "absl/strings/charconv.h"
 
 using absl::ascii_isspace;
 using absl::ascii_toupper;
@@ -428,29 +430,140 @@ void u64tostr(uint64 val, size_t out_len, char *out_buf, unsigned base) {
   out_buf[to_copy] = '\0';
 }
 
-bool safe_strtof(StringPiece str, float* value) {
-  char* endptr;
-  *value = strtof(str.data(), &endptr);
-  if (endptr != str.data()) {
-    while (endptr < str.end() && ascii_isspace(*endptr)) ++endptr;
+namespace {
+
+// Powers of 10 that are exactly representable, see FastParse().
+template <typename T> struct ExactPowers;
+
+template <> struct ExactPowers<double> {
+  static constexpr int kMaxExp = 22;
+  static constexpr uint64 kMaxMantissa = 1ULL << 53;
+  static constexpr double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                      1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                      1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+};
+
+template <> struct ExactPowers<float> {
+  static constexpr int kMaxExp = 10;
+  static constexpr uint64 kMaxMantissa = 1ULL << 24;
+  static constexpr float kPow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                     1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+};
+
+constexpr double ExactPowers<double>::kPow10[];
+constexpr float ExactPowers<float>::kPow10[];
+
+inline bool IsDigit(char c) {
+  return unsigned(c - '0') < 10;
+}
+
+// Parses [-]digits[.digits][(e|E)[+-]digits] spanning the whole range. Succeeds only if
+// both the mantissa and the power of 10 are exactly representable in T. Then a single
+// IEEE multiplication or division gives the correctly rounded result (Clinger's algorithm).
+template <typename T> bool FastParse(const char* ptr, const char* end, T* value) {
+  bool negative = ptr < end && *ptr == '-';
+  ptr += negative;
+
+  uint64 mantissa = 0;
+  int digits = 0, exp10 = 0;
+  const char* start = ptr;
+
+  for (; ptr < end && IsDigit(*ptr); ++ptr) {
+    mantissa = mantissa * 10 + (*ptr - '0');
+    digits += (mantissa != 0);
   }
-  // Ignore range errors from strtod/strtof.
-  // The values it returns on underflow and
-  // overflow are the right fallback in a
-  // robust setting.
-  return !str.empty() && endptr == str.end();
+  if (ptr < end && *ptr == '.') {
+    const char* frac = ++ptr;
+    for (; ptr < end && IsDigit(*ptr); ++ptr) {
+      mantissa = mantissa * 10 + (*ptr - '0');
+      digits += (mantissa != 0);
+    }
+    exp10 = frac - ptr;
+    if (ptr - start == 1)  // Just a dot.
+      return false;
+  }
+  if (ptr == start || digits > 19)
+    return false;
+
+  if (ptr < end && (*ptr | 0x20) == 'e') {
+    ++ptr;
+    bool negative_exp = ptr < end && *ptr == '-';
+    ptr += (ptr < end && (*ptr == '-' || *ptr == '+'));
+    if (ptr == end)
+      return false;
+
+    int exp = 0;
+    for (; ptr < end && IsDigit(*ptr) && exp < 10000; ++ptr) {
+      exp = exp * 10 + (*ptr - '0');
+    }
+    exp10 += negative_exp ? -exp : exp;
+  }
+
+  using P = ExactPowers<T>;
+  if (ptr != end || mantissa > P::kMaxMantissa || exp10 < -P::kMaxExp || exp10 > P::kMaxExp)
+    return false;
+
+  T res = T(mantissa);
+  res = exp10 < 0 ? res / P::kPow10[-exp10] : res * P::kPow10[exp10];
+  *value = negative ? -res : res;
+  return true;
 }
 
-bool safe_strtod(StringPiece str, double* value) {
-  char* endptr;
-  *value = strtod(str.data(), &endptr);
-  if (endptr != str.data()) {
-    while (endptr < str.end() && ascii_isspace(*endptr)) ++endptr;
+template <typename T> bool ParseFloat(StringPiece str, T* value) {
+  const char* ptr = str.data();
+  const char* end = ptr + str.size();
+  while (ptr < end && ascii_isspace(*ptr))
+    ++ptr;
+  while (end > ptr && ascii_isspace(end[-1]))
+    --end;
+
+  // Like strtod, but unlike from_chars, accepts the plus sign.
+  if (ptr + 1 < end && *ptr == '+' && ptr[1] != '-')
+    ++ptr;
+
+  if (FastParse(ptr, end, value))
+    return true;
+
+  absl::from_chars_result res = absl::from_chars(ptr, end, *value);
+  if (res.ec == std::errc::result_out_of_range) {
+    // Ignore range errors, the values strtod returns on underflow and
+    // overflow are the right fallback in a robust setting.
+    if (std::abs(*value) == numeric_limits<T>::max())
+      *value = std::copysign(numeric_limits<T>::infinity(), *value);
+  } else if (res.ec != std::errc()) {
+    return false;
   }
-  // Ignore range errors from strtod.  The values it
-  // returns on underflow and overflow are the right
-  // fallback in a robust setting.
-  return !str.empty() && endptr == str.end();
+  return ptr < end && res.ptr == end;
+}
+
+template <typename T> size_t ParseFloatBatch(const StringPiece* strs, size_t n, T* values) {
+  size_t res = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (ParseFloat(strs[i], values + i)) {
+      ++res;
+    } else {
+      values[i] = numeric_limits<T>::quiet_NaN();
+    }
+  }
+  return res;
+}
+
+}  // namespace
+
+bool safe_strtof(StringPiece str, float* value) {
+  return ParseFloat(str, value);
+}
+
+bool safe_strtod(StringPiece str, double* value) {
+  return ParseFloat(str, value);
+}
+
+size_t safe_strtod_batch(const StringPiece* strs, size_t n, double* values) {
+  return ParseFloatBatch(strs, n, values);
+}
+
+size_t safe_strtof_batch(const StringPiece* strs, size_t n, float* values) {
+  return ParseFloatBatch(strs, n, values);
 }
 
 
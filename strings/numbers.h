@@ -52,9 +52,17 @@ void u64tostr(uint64 val, size_t out_len, char *buf, unsigned base);
 // Convert strings to floating point values.
 // Leading and trailing spaces are allowed.
 // Values may be rounded on over- and underflow.
+// The parsing is locale independent and correctly rounded. Decimals with at most 19
+// significant digits and small exponents take an exact fast path, the rest are parsed
+// by absl::from_chars. str does not have to be null-terminated.
 bool safe_strtof(StringPiece str, float* value);
 bool safe_strtod(StringPiece str, double* value);
 
+// Parses n strings into values, for example a column of a CSV file. The values of the
+// strings that fail to parse are set to NaN. Returns the number of the parsed strings.
+size_t safe_strtod_batch(const StringPiece* strs, size_t n, double* values);
+size_t safe_strtof_batch(const StringPiece* strs, size_t n, float* values);
+
 
 char* FastHex64ToBuffer(uint64 i, char* buffer);
 
@@ -4,6 +4,9 @@
 #include "strings/numbers.h"
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <random>
+
 class NumberTest : public testing::Test {};
 
 TEST_F(NumberTest, u64tostr) {
@@ -28,3 +31,90 @@ TEST_F(NumberTest, u64tostr) {
 
 
 }
+
+TEST_F(NumberTest, strtod) {
+  double d;
+  EXPECT_TRUE(safe_strtod("1.5", &d));
+  EXPECT_EQ(1.5, d);
+  EXPECT_TRUE(safe_strtod(" -12.25e1 ", &d));
+  EXPECT_EQ(-122.5, d);
+  EXPECT_TRUE(safe_strtod("+.5", &d));
+  EXPECT_EQ(0.5, d);
+  EXPECT_TRUE(safe_strtod("5.", &d));
+  EXPECT_EQ(5, d);
+  EXPECT_TRUE(safe_strtod("-0", &d));
+  EXPECT_TRUE(std::signbit(d));
+  EXPECT_TRUE(safe_strtod("1e400", &d));
+  EXPECT_EQ(HUGE_VAL, d);
+  EXPECT_TRUE(safe_strtod("-inf", &d));
+  EXPECT_EQ(-HUGE_VAL, d);
+  EXPECT_TRUE(safe_strtod("nan", &d));
+  EXPECT_TRUE(std::isnan(d));
+  EXPECT_TRUE(safe_strtod("0.1000000000000000055511151231257827", &d));
+  EXPECT_EQ(0.1, d);
+  EXPECT_TRUE(safe_strtod("2.2250738585072011e-308", &d));
+  EXPECT_EQ(2.2250738585072011e-308, d);
+
+  for (const char* s : {"", " ", ".", "-", "+-1", "1e", "1e+", "1x", "e5", "1 2", "--1"}) {
+    EXPECT_FALSE(safe_strtod(s, &d)) << s;
+  }
+
+  // Does not read past the end of the string.
+  const char kNum[] = "12345";
+  EXPECT_TRUE(safe_strtod(StringPiece(kNum, 2), &d));
+  EXPECT_EQ(12, d);
+
+  float f;
+  EXPECT_TRUE(safe_strtof("1.1", &f));
+  EXPECT_EQ(1.1f, f);
+  EXPECT_TRUE(safe_strtof("16777217", &f));
+  EXPECT_EQ(16777216.0f, f);
+  EXPECT_TRUE(safe_strtof("1.00000017881393432617187499", &f));  // Double rounding trap.
+  EXPECT_EQ(1.0000001192092896f, f);
+}
+
+TEST_F(NumberTest, strtodRandom) {
+  std::mt19937_64 rng(10);
+  char buf[64];
+  for (unsigned i = 0; i < 100000; ++i) {
+    double expected;
+    switch (i % 3) {
+      case 0:
+        expected = double(rng() % 10000000) / 1000;
+        snprintf(buf, sizeof(buf), "%.3f", expected);
+        break;
+      case 1:
+        expected = double(rng() % 1000000) * 1e-4;
+        snprintf(buf, sizeof(buf), "%.4g", expected);
+        break;
+      default:
+        uint64 bits = rng();
+        memcpy(&expected, &bits, sizeof(bits));
+        if (std::isnan(expected))
+          continue;
+        snprintf(buf, sizeof(buf), "%.17g", expected);
+    }
+
+    double d;
+    ASSERT_TRUE(safe_strtod(buf, &d)) << buf;
+    ASSERT_EQ(strtod(buf, nullptr), d) << buf;
+
+    float f;
+    ASSERT_TRUE(safe_strtof(buf, &f)) << buf;
+    ASSERT_EQ(strtof(buf, nullptr), f) << buf;
+  }
+}
+
+TEST_F(NumberTest, strtodBatch) {
+  std::vector<StringPiece> strs{"1", "x", "2.5", ""};
+  double d[4];
+  EXPECT_EQ(2, safe_strtod_batch(strs.data(), strs.size(), d));
+  EXPECT_EQ(1, d[0]);
+  EXPECT_TRUE(std::isnan(d[1]));
+  EXPECT_EQ(2.5, d[2]);
+  EXPECT_TRUE(std::isnan(d[3]));
+
+  float f[4];
+  EXPECT_EQ(2, safe_strtof_batch(strs.data(), strs.size(), f));
+  EXPECT_EQ(2.5f, f[2]);
+}
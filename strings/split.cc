@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <immintrin.h>
 #include <iterator>
 #include <limits>
 #include "base/integral_types.h"
@@ -68,3 +69,119 @@ void SplitCSVLineWithDelimiter(char* line, char delimiter,
     assert(*line == '\0' || *line == delimiter);
   }
 }
+
+namespace {
+
+constexpr size_t kBlockSize = 64;
+
+// Bit i is set iff block[i] == c.
+inline uint64_t CharMask(const char* block, char c) {
+#ifdef __AVX2__
+  const __m256i v = _mm256_set1_epi8(c);
+  const __m256i* src = reinterpret_cast<const __m256i*>(block);
+  uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(src), v));
+  uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(src + 1), v));
+  return lo | (uint64_t(hi) << 32);
+#else
+  const __m128i v = _mm_set1_epi8(c);
+  const __m128i* src = reinterpret_cast<const __m128i*>(block);
+  uint64_t res = 0;
+  for (unsigned i = 0; i < 4; ++i) {
+    uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(src + i), v));
+    res |= uint64_t(m) << (i * 16);
+  }
+  return res;
+#endif
+}
+
+// Bit i of the result is the parity of bits 0..i of x, i.e. it's set for the characters
+// between an opening quote (inclusive) and its closing quote (exclusive).
+inline uint64_t PrefixXor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Returns the unquoted value of the field [start, end) that starts with quote.
+StringPiece Unquote(char* start, char* end, char quote) {
+  char* val = start + 1;
+  char* closing = static_cast<char*>(memchr(val, quote, end - val));
+  if (!closing)
+    return StringPiece(val, end - val);
+  if (closing + 1 == end || closing[1] != quote)
+    return StringPiece(val, closing - val);
+
+  // Slow path: compacts the escaped quotes.
+  char* dest = closing;
+  for (char* src = closing; src < end;) {
+    if (*src == quote) {
+      if (src + 1 == end || src[1] != quote)
+        break;
+      ++src;
+    }
+    *dest++ = *src++;
+  }
+  return StringPiece(val, dest - val);
+}
+
+template <bool kQuoted>
+void SplitCsvLineImpl(char* line, size_t size, char delimiter, char quote,
+                      std::vector<StringPiece>* fields) {
+  char* field = line;
+  auto add_field = [&](char* end) {
+    if (kQuoted && field < end && *field == quote) {
+      fields->push_back(Unquote(field, end, quote));
+    } else {
+      fields->push_back(StringPiece(field, end - field));
+    }
+    field = end + 1;
+  };
+
+  uint64_t inside = 0;  // All ones if the previous block ended inside quotes.
+  char tail[kBlockSize];
+
+  for (size_t offset = 0; offset < size; offset += kBlockSize) {
+    const char* block = line + offset;
+    size_t len = size - offset;
+    if (len < kBlockSize) {
+      memcpy(tail, block, len);
+      memset(tail + len, 0, kBlockSize - len);
+      block = tail;
+    }
+
+    uint64_t delims = CharMask(block, delimiter);
+    if (kQuoted) {
+      uint64_t quoted = PrefixXor(CharMask(block, quote)) ^ inside;
+      inside = uint64_t(int64_t(quoted) >> 63);
+      delims &= ~quoted;
+    }
+    if (len < kBlockSize)
+      delims &= (1ULL << len) - 1;
+
+    // The fields handled here precede the current position, hence unquoting them in place
+    // does not affect the masks of the blocks that follow.
+    while (delims) {
+      add_field(line + offset + __builtin_ctzll(delims));
+      delims &= delims - 1;
+    }
+  }
+  add_field(line + size);
+}
+
+}  // namespace
+
+void SplitCsvLine(char* line, size_t size, char delimiter, char quote,
+                  vector<StringPiece>* fields) {
+  fields->clear();
+  if (size == 0)
+    return;
+
+  if (quote)
+    SplitCsvLineImpl<true>(line, size, delimiter, quote, fields);
+  else
+    SplitCsvLineImpl<false>(line, size, delimiter, quote, fields);
+}
@@ -3,8 +3,25 @@
 //
 #pragma once
 
+#include <vector>
+
 #include "absl/strings/str_split.h"
+#include "strings/stringpiece.h"
 
 
 void SplitCSVLineWithDelimiter(char* line, char delimiter,
                                std::vector<char*>* cols);
+
+// Splits the line of size bytes into fields separated by delimiter. The line is scanned
+// 64 bytes at a time with SSE2/AVX2 compares, the delimiters inside quotes are masked out
+// with a prefix xor of the quote mask like in simdcsv. A field that starts with quote ends
+// at its closing quote, may contain delimiters and escapes quotes by doubling them.
+// The characters between the closing quote and the delimiter are ignored. RFC 4180 does not
+// allow quotes inside unquoted fields, here they toggle the quoting too. Escaped quotes
+// are unescaped in place, hence the line must be writable. Pass quote = '\0' to disable
+// quoting, for example for TSV. Unlike SplitCSVLineWithDelimiter does not strip whitespace.
+//
+// fields are cleared and then point into the line, so the same vector can be reused for all
+// the lines without allocations. An empty line has no fields.
+void SplitCsvLine(char* line, size_t size, char delimiter, char quote,
+                  std::vector<StringPiece>* fields);
@@ -0,0 +1,147 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "strings/split.h"
+
+#include <random>
+
+#include "base/gtest.h"
+
+using namespace std;
+
+class SplitTest : public testing::Test {
+ protected:
+  vector<string> Split(string line, char delim = ',', char quote = '"') {
+    buf_ = std::move(line);
+    SplitCsvLine(&buf_.front(), buf_.size(), delim, quote, &fields_);
+    return vector<string>(fields_.begin(), fields_.end());
+  }
+
+  // Char by char splitting with the same semantics.
+  static vector<string> Reference(const string& line, char delim, char quote) {
+    vector<string> raw(1);
+    bool inside = false;
+    for (char c : line) {
+      if (c == quote)
+        inside = !inside;
+      if (c == delim && !inside)
+        raw.emplace_back();
+      else
+        raw.back().push_back(c);
+    }
+
+    vector<string> res;
+    for (const string& f : raw) {
+      if (f.empty() || f[0] != quote) {
+        res.push_back(f);
+        continue;
+      }
+      string val;
+      for (size_t i = 1; i < f.size(); ++i) {
+        if (f[i] == quote) {
+          if (i + 1 == f.size() || f[i + 1] != quote)
+            break;
+          ++i;
+        }
+        val.push_back(f[i]);
+      }
+      res.push_back(val);
+    }
+    return res;
+  }
+
+  string buf_;
+  vector<StringPiece> fields_;
+};
+
+TEST_F(SplitTest, Basic) {
+  EXPECT_TRUE(Split("").empty());
+  EXPECT_EQ(vector<string>({"a"}), Split("a"));
+  EXPECT_EQ(vector<string>({"a", "bc", ""}), Split("a,bc,"));
+  EXPECT_EQ(vector<string>({"", "", ""}), Split(",,"));
+  EXPECT_EQ(vector<string>({" a ", " b"}), Split(" a , b"));
+  EXPECT_EQ(vector<string>({"a", "b,c"}), Split("a\tb,c", '\t'));
+}
+
+TEST_F(SplitTest, Quotes) {
+  EXPECT_EQ(vector<string>({"a,b", "c"}), Split("\"a,b\",c"));
+  EXPECT_EQ(vector<string>({"a\"b", ""}), Split("\"a\"\"b\","));
+  EXPECT_EQ(vector<string>({"\"", "x"}), Split("\"\"\"\",x"));
+  EXPECT_EQ(vector<string>({"", "ab"}), Split("\"\",\"ab\"junk"));
+  EXPECT_EQ(vector<string>({"unterminated,x"}), Split("\"unterminated,x"));
+
+  // Disabled quoting.
+  EXPECT_EQ(vector<string>({"\"a", "b\""}), Split("\"a\tb\"", '\t', '\0'));
+}
+
+TEST_F(SplitTest, LongLines) {
+  // The quoted fields cross the block boundaries.
+  string line;
+  vector<string> expected;
+  for (unsigned i = 0; i < 50; ++i) {
+    string val(i * 7, 'a' + i % 26);
+    if (i % 3 == 0) {
+      line += "\"" + val + ",\"\"x\"";
+      val += ",\"x";
+    } else {
+      line += val;
+    }
+    line.push_back(',');
+    expected.push_back(val);
+  }
+  expected.emplace_back();
+
+  EXPECT_EQ(expected, Split(line));
+  EXPECT_EQ(expected, Reference(line, ',', '"'));
+}
+
+TEST_F(SplitTest, Random) {
+  std::mt19937 rng(10);
+  const char kAlphabet[] = "ab,\"\t";
+
+  for (unsigned iter = 0; iter < 2000; ++iter) {
+    string line(rng() % 300, 'a');
+    for (char& c : line)
+      c = kAlphabet[rng() % (sizeof(kAlphabet) - 1)];
+    if (line.empty())
+      continue;
+
+    ASSERT_EQ(Reference(line, ',', '"'), Split(line)) << line;
+    ASSERT_EQ(Reference(line, '\t', '\0'), Split(line, '\t', '\0')) << line;
+  }
+}
+
+static string MakeCsvLine() {
+  string line;
+  for (unsigned i = 0; i < 20; ++i) {
+    line += i % 4 == 0 ? "\"quoted, value\"" : "field" + std::to_string(i * 12345);
+    line.push_back(',');
+  }
+  line.pop_back();
+  return line;
+}
+
+static void BM_SplitCsvLine(benchmark::State& state) {
+  string line = MakeCsvLine();
+  vector<StringPiece> fields;
+  while (state.KeepRunning()) {
+    SplitCsvLine(&line.front(), line.size(), ',', '"', &fields);
+    benchmark::DoNotOptimize(fields.data());
+  }
+  state.SetBytesProcessed(state.iterations() * line.size());
+}
+BENCHMARK(BM_SplitCsvLine);
+
+static void BM_SplitCSVLineWithDelimiter(benchmark::State& state) {
+  string line = MakeCsvLine();
+  string buf;
+  vector<char*> cols;
+  while (state.KeepRunning()) {
+    buf = line;  // Splitting mutates the line.
+    cols.clear();
+    SplitCSVLineWithDelimiter(&buf.front(), ',', &cols);
+    benchmark::DoNotOptimize(cols.data());
+  }
+  state.SetBytesProcessed(state.iterations() * line.size());
+}
+BENCHMARK(BM_SplitCSVLineWithDelimiter);
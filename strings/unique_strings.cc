@@ -3,6 +3,11 @@
 //
 #include "strings/unique_strings.h"
 
+#include <new>
+
+#include "base/hash.h"
+#include "base/logging.h"
+
 std::pair<StringPiece, bool> UniqueStrings::Insert(StringPiece source) {
   auto it = db_.find(source);
   if (it != db_.end())
@@ -16,4 +21,146 @@ std::pair<StringPiece, bool> UniqueStrings::Insert(StringPiece source) {
   StringPiece val(str, source.size());
   db_.insert(val);
   return std::make_pair(val, true);
-}
\ No newline at end of file
+}
+
+// Allocated in the arena of the shard, the string follows the header.
+struct ConcurrentUniqueStrings::Entry {
+  uint64_t hash;
+  size_t size;
+
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  StringPiece str() const { return StringPiece(data(), size); }
+};
+
+struct ConcurrentUniqueStrings::Table {
+  size_t mask;
+  std::unique_ptr<std::atomic<const Entry*>[]> slots;
+
+  explicit Table(size_t capacity)
+      : mask(capacity - 1), slots(new std::atomic<const Entry*>[capacity]) {
+    for (size_t i = 0; i < capacity; ++i)
+      slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  const Entry* Find(uint64_t hash, StringPiece str) const {
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const Entry* e = slots[i].load(std::memory_order_acquire);
+      if (!e || (e->hash == hash && e->str() == str))
+        return e;
+    }
+  }
+
+  // Does not check for duplicates.
+  void Add(const Entry* entry) {
+    size_t i = entry->hash & mask;
+    while (slots[i].load(std::memory_order_relaxed))
+      i = (i + 1) & mask;
+    slots[i].store(entry, std::memory_order_release);
+  }
+};
+
+// Aligned to avoid false sharing between the locks of the neighbouring shards.
+struct alignas(64) ConcurrentUniqueStrings::Shard {
+  std::atomic<Table*> table{nullptr};
+
+  mutable std::mutex mu;  // Guards the fields below.
+  base::Arena arena;
+  size_t size = 0;
+
+  // Readers may still hold the tables that were replaced by Grow(), so they are freed only
+  // with the interner. Their total capacity is less than the capacity of the current table.
+  std::vector<std::unique_ptr<Table>> tables;
+
+  const Entry* Find(uint64_t hash, StringPiece str) const {
+    return table.load(std::memory_order_acquire)->Find(hash, str);
+  }
+
+  void Grow();
+};
+
+void ConcurrentUniqueStrings::Shard::Grow() {
+  const Table* cur = tables.back().get();
+  Table* next = new Table((cur->mask + 1) * 2);
+  for (size_t i = 0; i <= cur->mask; ++i) {
+    const Entry* e = cur->slots[i].load(std::memory_order_relaxed);
+    if (e)
+      next->Add(e);
+  }
+  tables.emplace_back(next);
+  table.store(next, std::memory_order_release);
+}
+
+ConcurrentUniqueStrings::ConcurrentUniqueStrings(unsigned num_shards)
+    : shards_(new Shard[num_shards]), shard_mask_(num_shards - 1) {
+  CHECK_EQ(0, num_shards & shard_mask_) << "num_shards must be a power of 2";
+  for (unsigned i = 0; i < num_shards; ++i) {
+    shards_[i].tables.emplace_back(new Table(64));
+    shards_[i].table.store(shards_[i].tables.back().get(), std::memory_order_release);
+  }
+}
+
+ConcurrentUniqueStrings::~ConcurrentUniqueStrings() {
+}
+
+static inline uint64_t InternHash(StringPiece str) {
+  return base::XXHash3_64(str.data(), str.size());
+}
+
+std::pair<StringPiece, bool> ConcurrentUniqueStrings::Insert(StringPiece source) {
+  uint64_t hash = InternHash(source);
+
+  // The slots use the low bits of the hash, the shards use the high ones.
+  Shard& shard = shards_[(hash >> 48) & shard_mask_];
+  const Entry* e = shard.Find(hash, source);
+  if (e)
+    return std::make_pair(e->str(), false);
+
+  std::lock_guard<std::mutex> lk(shard.mu);
+  e = shard.Find(hash, source);
+  if (e)
+    return std::make_pair(e->str(), false);
+
+  // Keeps the load factor below 1/2.
+  Table* table = shard.table.load(std::memory_order_relaxed);
+  if ((shard.size + 1) * 2 > table->mask + 1) {
+    shard.Grow();
+    table = shard.table.load(std::memory_order_relaxed);
+  }
+
+  char* ptr = shard.arena.AllocateAligned(sizeof(Entry) + source.size());
+  Entry* entry = new (ptr) Entry{hash, source.size()};
+  if (!source.empty())
+    memcpy(ptr + sizeof(Entry), source.data(), source.size());
+
+  table->Add(entry);
+  ++shard.size;
+
+  return std::make_pair(entry->str(), true);
+}
+
+StringPiece ConcurrentUniqueStrings::Find(StringPiece source) const {
+  uint64_t hash = InternHash(source);
+  const Entry* e = shards_[(hash >> 48) & shard_mask_].Find(hash, source);
+  return e ? e->str() : StringPiece();
+}
+
+size_t ConcurrentUniqueStrings::size() const {
+  size_t res = 0;
+  for (unsigned i = 0; i <= shard_mask_; ++i) {
+    std::lock_guard<std::mutex> lk(shards_[i].mu);
+    res += shards_[i].size;
+  }
+  return res;
+}
+
+size_t ConcurrentUniqueStrings::MemoryUsage() const {
+  size_t res = 0;
+  for (unsigned i = 0; i <= shard_mask_; ++i) {
+    const Shard& shard = shards_[i];
+    std::lock_guard<std::mutex> lk(shard.mu);
+    res += shard.arena.MemoryUsage();
+    for (const auto& t : shard.tables)
+      res += (t->mask + 1) * sizeof(std::atomic<const Entry*>);
+  }
+  return res;
+}
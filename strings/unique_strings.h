@@ -4,13 +4,20 @@
 #ifndef UNIQUE_STRINGS_H
 #define UNIQUE_STRINGS_H
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <sparsehash/dense_hash_map>
 
+#include "absl/container/flat_hash_map.h"
 #include "base/arena.h"
 #include "base/counting_allocator.h"
+#include "base/hash.h"
 #include "strings/stringpiece.h"
 #include "strings/hash.h"
 
@@ -47,6 +54,41 @@ private:
   SSet db_;
 };
 
+// Thread-safe interner shared by all threads. Strings are hashed into one of num_shards
+// shards, each with its own arena and lock-free open-addressing table. Lookups of the strings
+// that are already interned never lock, only the insertions lock their shard.
+// The returned StringPieces stay valid until the interner is destroyed.
+class ConcurrentUniqueStrings {
+ public:
+  // num_shards must be a power of 2.
+  explicit ConcurrentUniqueStrings(unsigned num_shards = 16);
+  ~ConcurrentUniqueStrings();
+
+  StringPiece Get(StringPiece source) {
+    return Insert(source).first;
+  }
+
+  // Same semantics as UniqueStrings::Insert.
+  std::pair<StringPiece, bool> Insert(StringPiece source);
+
+  // Returns an empty StringPiece with nullptr data if source was not interned.
+  StringPiece Find(StringPiece source) const;
+
+  size_t size() const;
+  size_t MemoryUsage() const;
+
+ private:
+  struct Entry;
+  struct Table;
+  struct Shard;
+
+  std::unique_ptr<Shard[]> shards_;
+  unsigned shard_mask_;
+
+  ConcurrentUniqueStrings(const ConcurrentUniqueStrings&) = delete;
+  void operator=(const ConcurrentUniqueStrings&) = delete;
+};
+
 template<typename M> class ArenaMapBase {
 protected:
   typedef M SMap;
@@ -182,5 +224,105 @@ public:
 
 };
 
+// Key with its precomputed StringPieceFlatMap::Hash, allows looking up and inserting
+// without rehashing the string.
+struct HashedStringPiece {
+  StringPiece str;
+  size_t hash;
+};
+
+struct StringPieceFlatHash {
+  using is_transparent = void;
+
+  size_t operator()(StringPiece s) const { return base::XXHash3_64(s); }
+  size_t operator()(const HashedStringPiece& h) const { return h.hash; }
+};
+
+struct StringPieceFlatEq {
+  using is_transparent = void;
+
+  static StringPiece str(StringPiece s) { return s; }
+  static StringPiece str(const HashedStringPiece& h) { return h.str; }
+
+  template<typename U, typename V> bool operator()(const U& a, const V& b) const {
+    return str(a) == str(b);
+  }
+};
+
+// StringPieceMap on top of absl::flat_hash_map. Keys are copied into the arena only upon
+// insertion, lookups are heterogeneous and may pass precomputed hashes.
+template<typename T> class StringPieceFlatMap
+    : public ArenaMapBase<absl::flat_hash_map<StringPiece, T, StringPieceFlatHash,
+                                              StringPieceFlatEq>> {
+  typedef ArenaMapBase<absl::flat_hash_map<StringPiece, T, StringPieceFlatHash,
+                                           StringPieceFlatEq>> Parent;
+public:
+  using typename Parent::value_type;
+  using typename Parent::iterator;
+  using typename Parent::const_iterator;
+  using Parent::map_;
+  using Parent::find;
+
+  static size_t Hash(StringPiece key) { return StringPieceFlatHash{}(key); }
+
+  iterator find(StringPiece key, size_t hash) { return map_.find(HashedStringPiece{key, hash}); }
+  const_iterator find(StringPiece key, size_t hash) const {
+    return map_.find(HashedStringPiece{key, hash});
+  }
+
+  // hash must be equal to Hash(key).
+  template<typename... Args> std::pair<iterator, bool> emplace_hashed(
+      StringPiece key, size_t hash, Args&&... args) {
+    bool inserted = false;
+    auto it = map_.lazy_emplace(HashedStringPiece{key, hash}, [&](const auto& ctor) {
+      inserted = true;
+      ctor(std::piecewise_construct, std::forward_as_tuple(this->AllocateStr(key)),
+           std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+    return std::make_pair(it, inserted);
+  }
+
+  std::pair<iterator, bool> insert(const value_type& val) {
+    return emplace_hashed(val.first, Hash(val.first), val.second);
+  }
+
+  std::pair<iterator, bool> emplace(StringPiece key, T&& val) {
+    return emplace_hashed(key, Hash(key), std::move(val));
+  }
+
+  std::pair<iterator, bool> emplace(StringPiece key, const T& val) {
+    return emplace_hashed(key, Hash(key), val);
+  }
+
+  T& operator[](StringPiece key) {
+    return emplace_hashed(key, Hash(key)).first->second;
+  }
+
+  // Looks up n keys at once, dest[i] points to the value of keys[i] or is nullptr if
+  // keys[i] is absent. Hashes all the keys and prefetches their groups before probing,
+  // so that the cache misses of the different keys overlap.
+  void FindBatch(const StringPiece* keys, size_t n, T** dest) {
+    constexpr size_t kBatch = 16;
+    uint64_t hashes[kBatch];
+
+    for (size_t start = 0; start < n; start += kBatch) {
+      size_t cnt = std::min(kBatch, n - start);
+      base::XXHash3Batch(keys + start, cnt, 0, hashes);
+      for (size_t i = 0; i < cnt; ++i)
+        map_.prefetch(HashedStringPiece{keys[start + i], hashes[i]});
+      for (size_t i = 0; i < cnt; ++i) {
+        auto it = map_.find(HashedStringPiece{keys[start + i], hashes[i]});
+        dest[start + i] = it == map_.end() ? nullptr : &it->second;
+      }
+    }
+  }
+
+  void reserve(size_t n) { map_.reserve(n); }
+
+  // The slots and a control byte per slot of the table in addition to the keys in the arena.
+  size_t MemoryUsage() const {
+    return this->arena_.MemoryUsage() + map_.capacity() * (sizeof(value_type) + 1);
+  }
+};
 
 #endif  // UNIQUE_STRINGS_H
@@ -4,6 +4,8 @@
 #include "strings/unique_strings.h"
 #include <gtest/gtest.h>
 
+#include <thread>
+
 using std::string;
 
 class UniqueStringsTest : public testing::Test {
@@ -40,3 +42,112 @@ TEST_F(UniqueStringsTest, DenseMap) {
 
   EXPECT_EQ(3, unique["r3"]);
 }
+
+TEST_F(UniqueStringsTest, FlatMap) {
+  StringPieceFlatMap<int> map;
+  string r1("r1");
+  map[r1] = 1;
+  map["r2"] = 2;
+  EXPECT_TRUE(map.insert(StringPieceFlatMap<int>::value_type("r3", 3)).second);
+  EXPECT_FALSE(map.emplace("r3", 4).second);
+  EXPECT_EQ(3, map.size());
+
+  // The keys are copied into the arena.
+  r1[0] = 'x';
+  auto it = map.find("r1");
+  ASSERT_TRUE(it != map.end());
+  EXPECT_EQ(1, it->second);
+  EXPECT_EQ("r1", it->first);
+  EXPECT_TRUE(map.find("x1") == map.end());
+
+  size_t hash = StringPieceFlatMap<int>::Hash("r2");
+  EXPECT_EQ(2, map.find("r2", hash)->second);
+  auto res = map.emplace_hashed("r4", StringPieceFlatMap<int>::Hash("r4"), 4);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(4, map["r4"]);
+  EXPECT_GT(map.MemoryUsage(), 4 * sizeof(StringPieceFlatMap<int>::value_type));
+
+  std::vector<string> strs;
+  for (unsigned i = 0; i < 100; ++i) {
+    strs.push_back("k" + std::to_string(i));
+    if (i % 2 == 0)
+      map[strs.back()] = i;
+  }
+  std::vector<StringPiece> keys(strs.begin(), strs.end());
+  std::vector<int*> vals(keys.size());
+  map.FindBatch(keys.data(), keys.size(), vals.data());
+  for (unsigned i = 0; i < 100; ++i) {
+    if (i % 2 == 0) {
+      ASSERT_TRUE(vals[i] != nullptr);
+      EXPECT_EQ(i, *vals[i]);
+    } else {
+      EXPECT_TRUE(vals[i] == nullptr);
+    }
+  }
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+}
+
+TEST_F(UniqueStringsTest, Concurrent) {
+  ConcurrentUniqueStrings unique(4);
+  EXPECT_TRUE(unique.Find("foo").data() == nullptr);
+
+  auto res = unique.Insert("foo");
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ("foo", res.first);
+
+  string str("foo");
+  StringPiece foo = unique.Get(str);
+  EXPECT_EQ(res.first.data(), foo.data());
+  EXPECT_EQ(foo.data(), unique.Find("foo").data());
+  EXPECT_FALSE(unique.Insert("foo").second);
+
+  StringPiece empty = unique.Get("");
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.data(), unique.Find("").data());
+  EXPECT_EQ(2, unique.size());
+
+  // Forces the tables to grow, the handles stay valid.
+  std::vector<StringPiece> handles;
+  for (unsigned i = 0; i < 10000; ++i) {
+    handles.push_back(unique.Get("str" + std::to_string(i)));
+  }
+  for (unsigned i = 0; i < 10000; ++i) {
+    string s = "str" + std::to_string(i);
+    ASSERT_EQ(s, handles[i]);
+    ASSERT_EQ(handles[i].data(), unique.Find(s).data());
+  }
+  EXPECT_EQ(10002, unique.size());
+  EXPECT_EQ(foo.data(), unique.Find("foo").data());
+  EXPECT_GT(unique.MemoryUsage(), 10000 * 8);
+}
+
+TEST_F(UniqueStringsTest, ConcurrentThreads) {
+  constexpr unsigned kThreads = 4, kStrings = 5000;
+  ConcurrentUniqueStrings unique;
+  std::vector<std::vector<StringPiece>> handles(kThreads);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      // Every thread interns the same strings in a different order.
+      for (unsigned i = 0; i < kStrings; ++i) {
+        unsigned j = (i * (t + 1) * 7919) % kStrings;
+        handles[t].push_back(unique.Get("s" + std::to_string(j)));
+        if (i % 100 == 0)
+          std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  EXPECT_EQ(kStrings, unique.size());
+  for (unsigned t = 0; t < kThreads; ++t) {
+    for (unsigned i = 0; i < kStrings; ++i) {
+      unsigned j = (i * (t + 1) * 7919) % kStrings;
+      ASSERT_EQ(unique.Find("s" + std::to_string(j)).data(), handles[t][i].data());
+    }
+  }
+}
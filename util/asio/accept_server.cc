@@ -8,8 +8,12 @@
 #include "base/logging.h"
 #include "base/walltime.h"
 #include "util/asio/io_context_pool.h"
+#include "util/asio/periodic_task.h"
 #include "util/asio/yield.h"
 #include "util/fibers/fibers_ext.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_VARZ(VarzCount, rejected_connections);
 
 namespace util {
 
@@ -192,8 +196,28 @@ void AcceptServer::AcceptInIOThread(ListenerWrapper* wrapper) {
   // Here accessing wrapper might be unsafe.
 }
 
+void AcceptServer::EnableLoadShedding(uint32_t max_lag_ms) {
+  CHECK(!was_run_);
+  CHECK_GT(max_lag_ms, 0);
+  max_lag_ms_ = max_lag_ms;
+}
+
+LoopLagMonitor* AcceptServer::NextMonitor() {
+  unsigned start = next_monitor_.fetch_add(1, std::memory_order_relaxed);
+  for (unsigned i = 0; i < lag_monitors_.size(); ++i) {
+    LoopLagMonitor* monitor = lag_monitors_[(start + i) % lag_monitors_.size()];
+    if (!monitor->overloaded())
+      return monitor;
+  }
+  return nullptr;
+}
+
 auto AcceptServer::AcceptConnection(ListenerWrapper* wrapper) -> AcceptResult {
-  IoContext& io_cntx = pool_->GetNextContext();
+  LoopLagMonitor* monitor = nullptr;
+  if (!lag_monitors_.empty()) {
+    monitor = NextMonitor();
+  }
+  IoContext& io_cntx = monitor ? monitor->context() : pool_->GetNextContext();
 
   system::error_code ec;
   tcp::socket sock(io_cntx.raw_context());
@@ -206,13 +230,31 @@ auto AcceptServer::AcceptConnection(ListenerWrapper* wrapper) -> AcceptResult {
   DCHECK(sock.is_open()) << sock.native_handle();
   VLOG(1) << "Accepted socket " << sock.remote_endpoint() << "/" << sock.native_handle();
 
+  // Accepting and closing keeps the backlog from queueing connections that would time out.
+  if (!lag_monitors_.empty() && !monitor) {
+    rejected_connections.Inc();
+    wrapper->listener->RejectConnection(sock);
+    sock.close(ec);
+    return AcceptResult(nullptr, asio::error::try_again);
+  }
+
   ConnectionHandler* conn = wrapper->listener->NewConnection(io_cntx);
   conn->Init(std::move(sock));
+  conn->lag_monitor_ = monitor;
 
   return AcceptResult(conn, ec);
 }
 
 void AcceptServer::Run() {
+  if (max_lag_ms_ && lag_monitors_.empty()) {
+    constexpr auto kHeartbeat = std::chrono::milliseconds(10);
+    for (size_t i = 0; i < pool_->size(); ++i) {
+      IoContext& cntx = pool_->at(i);
+      lag_monitors_.push_back(new LoopLagMonitor(&cntx, kHeartbeat, max_lag_ms_ * 1000));
+      cntx.AttachCancellable(lag_monitors_.back());
+    }
+  }
+
   if (!listeners_.empty()) {
     ref_bc_.Add(listeners_.size());
 
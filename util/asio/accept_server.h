@@ -16,6 +16,7 @@ namespace util {
 
 class IoContextPool;
 class IoContext;
+class LoopLagMonitor;
 
 class AcceptServer {
  public:
@@ -43,6 +44,12 @@ class AcceptServer {
 
   void TriggerOnBreakSignal(std::function<void()> f) { on_break_hook_ = std::move(f); }
 
+  // Sheds load once the IO loops lag more than max_lag_ms behind their heartbeat: new
+  // connections go to the contexts that keep up and are rejected via
+  // ListenerInterface::RejectConnection when none does. Handlers can check
+  // ConnectionHandler::overloaded() to fail requests fast. Must be called before Run().
+  void EnableLoadShedding(uint32_t max_lag_ms);
+
  private:
   using acceptor = ::boost::asio::ip::tcp::acceptor;
   using endpoint = ::boost::asio::ip::tcp::endpoint;
@@ -57,6 +64,9 @@ class AcceptServer {
 
   AcceptResult AcceptConnection(ListenerWrapper* listener);
 
+  // Returns the monitor of the next context that does not lag or null if all of them lag.
+  LoopLagMonitor* NextMonitor();
+
   IoContextPool* pool_;
 
   struct ListenerWrapper {
@@ -73,6 +83,11 @@ class AcceptServer {
   fibers_ext::BlockingCounter ref_bc_;
   std::vector<ListenerWrapper> listeners_;
 
+  // One per pool context if load shedding is enabled, owned by the contexts.
+  std::vector<LoopLagMonitor*> lag_monitors_;
+  std::atomic_uint32_t next_monitor_{0};
+  uint32_t max_lag_ms_ = 0;
+
   // Called if a termination signal has been caught (SIGTERM/SIGINT).
   std::function<void()> on_break_hook_;
   bool was_run_ = false;
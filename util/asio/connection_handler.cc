@@ -9,6 +9,7 @@
 
 #include "base/logging.h"
 #include "util/asio/io_context.h"
+#include "util/asio/periodic_task.h"
 #include "util/fibers/event_count.h"
 #include "util/stats/varz_stats.h"
 
@@ -139,6 +140,10 @@ ConnectionHandler::ConnectionHandler(IoContext* context) noexcept : io_context_(
 ConnectionHandler::~ConnectionHandler() {
 }
 
+bool ConnectionHandler::overloaded() const {
+  return lag_monitor_ && lag_monitor_->overloaded();
+}
+
 void ConnectionHandler::Init(asio::ip::tcp::socket&& sock) {
   CHECK(!socket_ && sock.is_open());
   ip::tcp::no_delay nd(true);
@@ -17,6 +17,7 @@ namespace util {
 class IoContextPool;
 class IoContext;
 class AcceptServer;
+class LoopLagMonitor;
 
 namespace detail {
 using namespace ::boost::intrusive;
@@ -61,6 +62,10 @@ class ConnectionHandler {
     return io_context_;
   }
 
+  //! True if the AcceptServer sheds load and the IO loop of this connection lags behind.
+  //! HandleRequest() may then reply with a fast error instead of doing the work.
+  bool overloaded() const;
+
   friend void intrusive_ptr_add_ref(ConnectionHandler* ctx) noexcept {
     ctx->use_count_.fetch_add(1, std::memory_order_relaxed);
   }
@@ -116,6 +121,7 @@ class ConnectionHandler {
   void RunInIOThread();
 
   std::atomic<std::uint32_t> use_count_{0};
+  const LoopLagMonitor* lag_monitor_ = nullptr;
 };
 
 /**
@@ -132,6 +138,11 @@ class ListenerInterface {
   // Creates a dedicated handler for a new connection.
   virtual ConnectionHandler* NewConnection(IoContext& context) = 0;
 
+  // Called instead of NewConnection when the AcceptServer sheds load because all the IO loops
+  // lag. May write a short error reply, the socket is closed right after.
+  virtual void RejectConnection(::boost::asio::ip::tcp::socket& sock) {
+  }
+
   // Called by AcceptServer when shutting down start and before all connections are closed.
   virtual void PreShutdown() {
   }
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/fiber/mutex.hpp>
 
 #include "util/asio/yield.h"
 
@@ -44,6 +45,16 @@ class FiberSocketImpl {
   // https://www.boost.org/doc/libs/1_69_0/doc/html/boost_asio/reference/SyncWriteStream.html
   template <typename BS> size_t write_some(const BS& bufs, error_code& ec);
 
+  // Coalesces the writes into a batch of up to capacity bytes, 0 disables it.
+  // See FiberSyncSocket::set_write_batch.
+  void set_write_batch(size_t capacity);
+
+  // Sends the batched writes. Blocks the calling fiber.
+  error_code Flush();
+
+  // See FiberSyncSocket::SendFile.
+  error_code SendFile(int fd, uint64_t offset, size_t length);
+
   next_layer_type::native_handle_type native_handle() { return sock_.native_handle(); }
 
   bool is_open() const { return is_open_; }
@@ -59,6 +70,9 @@ class FiberSocketImpl {
 
   error_code status() const { return status_;}
 
+  // Bytes that were received but not read yet.
+  size_t read_buffered() const { return rslice_.size(); }
+
   // For debugging.
   next_layer_type& next_layer() { return sock_; }
 
@@ -76,6 +90,29 @@ class FiberSocketImpl {
   void ClientWorker();
 
   void WakeWorker();
+
+  // Server sockets borrow rbuf_ from the pool of their thread only while it holds data.
+  template <typename MBS> size_t PooledRead(const MBS& bufs, error_code& ec);
+  void BorrowRbuf();
+  void ReleaseRbuf();
+
+  struct WriteBatch {
+    ::boost::fibers::mutex mu;  // Serializes the flushes.
+    std::unique_ptr<uint8_t[]> buf;
+    size_t capacity, size = 0;
+    bool flush_posted = false;
+    FiberSocketImpl* owner;  // null once the socket is shut down.
+
+    WriteBatch(size_t cap, FiberSocketImpl* o) : buf(new uint8_t[cap]), capacity(cap), owner(o) {}
+  };
+
+  template <typename BS> size_t BatchWrite(const BS& bufs, error_code& ec);
+  template <typename BS> size_t WriteDirect(const BS& bufs, error_code& ec);
+
+  // Flushes the batch once the writing fiber yields to the IO loop.
+  void PostFlush();
+  error_code FlushBatch(bool non_blocking);
+
   error_code Reconnect(const std::string& hname, const std::string& service);
   void SetStatus(const error_code& ec, const char* where);
 
@@ -85,6 +122,7 @@ class FiberSocketImpl {
   // from the same thread.
   bool is_open_ = true, keep_alive_ = false;
   enum State { READ_IDLE, READ_ACTIVE } read_state_ = READ_IDLE;
+  bool pooled_rbuf_;
 
   size_t rbuf_size_;
   next_layer_type sock_;
@@ -97,6 +135,9 @@ class FiberSocketImpl {
   // Stuff related to client sockets.
   struct ClientData;
   std::unique_ptr<ClientData> clientsock_data_;
+
+  // Shared with the posted flushes that may outlive the socket.
+  std::shared_ptr<WriteBatch> wbatch_;
 };
 
 template <typename MBS> size_t FiberSocketImpl::read_some(const MBS& bufs, error_code& ec) {
@@ -105,6 +146,8 @@ template <typename MBS> size_t FiberSocketImpl::read_some(const MBS& bufs, error
     size_t copied = asio::buffer_copy(bufs, rslice_);
     if (rslice_.size() == copied) {
       rslice_ = asio::mutable_buffer(rbuf_.get(), 0);
+      if (pooled_rbuf_)
+        ReleaseRbuf();
     } else {
       rslice_ += copied;
     }
@@ -119,11 +162,19 @@ template <typename MBS> size_t FiberSocketImpl::read_some(const MBS& bufs, error
     return 0;
   }
 
+  if (pooled_rbuf_) {
+    return PooledRead(bufs, ec);
+  }
+
   size_t user_size = asio::buffer_size(bufs);
   auto new_seq = make_buffer_seq(bufs, asio::mutable_buffer(rbuf_.get(), rbuf_size_));
 
   size_t read_size = sock_.read_some(new_seq, ec);
   if (ec == asio::error::would_block) {
+    // The peer may wait for the batched replies before it sends more.
+    if (wbatch_ && wbatch_->size) {
+      Flush();
+    }
     read_state_ = READ_ACTIVE;
     read_size = sock_.async_read_some(new_seq, fibers_ext::yield[ec]);
     read_state_ = READ_IDLE;
@@ -141,7 +192,50 @@ template <typename MBS> size_t FiberSocketImpl::read_some(const MBS& bufs, error
   return read_size;
 }
 
+template <typename MBS> size_t FiberSocketImpl::PooledRead(const MBS& bufs, error_code& ec) {
+  using namespace boost;
+  size_t user_size = asio::buffer_size(bufs);
+  size_t read_size;
+
+  while (true) {
+    BorrowRbuf();
+    auto new_seq = make_buffer_seq(bufs, asio::mutable_buffer(rbuf_.get(), rbuf_size_));
+    read_size = sock_.read_some(new_seq, ec);
+    if (ec != asio::error::would_block)
+      break;
+
+    // Waits for the readiness without holding the buffer.
+    ReleaseRbuf();
+    if (wbatch_ && wbatch_->size) {
+      Flush();
+    }
+    read_state_ = READ_ACTIVE;
+    sock_.async_wait(next_layer_type::wait_read, fibers_ext::yield[ec]);
+    read_state_ = READ_IDLE;
+    if (ec)
+      break;
+  }
+
+  if (ec) {
+    SetStatus(ec, "read_some");
+  }
+  if (read_size > user_size) {
+    rslice_ = asio::mutable_buffer(rbuf_.get(), read_size - user_size);
+    read_size = user_size;
+  } else {
+    ReleaseRbuf();
+  }
+  return read_size;
+}
+
 template <typename BS> size_t FiberSocketImpl::write_some(const BS& bufs, error_code& ec) {
+  if (wbatch_) {
+    return BatchWrite(bufs, ec);
+  }
+  return WriteDirect(bufs, ec);
+}
+
+template <typename BS> size_t FiberSocketImpl::WriteDirect(const BS& bufs, error_code& ec) {
   size_t res = sock_.write_some(bufs, ec);
   if (ec == ::boost::asio::error::would_block) {
     return sock_.async_write_some(bufs, fibers_ext::yield[ec]);
@@ -149,6 +243,32 @@ template <typename BS> size_t FiberSocketImpl::write_some(const BS& bufs, error_
   return res;
 }
 
+template <typename BS> size_t FiberSocketImpl::BatchWrite(const BS& bufs, error_code& ec) {
+  using namespace boost;
+
+  if (status_ || !is_open_) {
+    ec = status_ ? status_ : asio::error::broken_pipe;
+    return 0;
+  }
+
+  // The caller may reuse bufs once we return, so they are copied into the batch.
+  size_t sz = asio::buffer_size(bufs);
+  if (wbatch_->size + sz > wbatch_->capacity) {
+    ec = Flush();
+    if (ec)
+      return 0;
+
+    if (sz > wbatch_->capacity)
+      return WriteDirect(bufs, ec);
+  }
+
+  asio::buffer_copy(asio::mutable_buffer(wbatch_->buf.get() + wbatch_->size, sz), bufs);
+  wbatch_->size += sz;
+  PostFlush();
+
+  return sz;
+}
+
 }  // namespace detail
 
 
@@ -0,0 +1,205 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/asio/dns_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/asio/io_context.h"
+#include "util/asio/yield.h"
+#include "util/fibers/fibers_ext.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_uint32(dns_cache_ttl_sec, 60, "How long the client sockets reuse the resolved addresses "
+                                     "of a host, 0 resolves on each connect");
+DEFINE_uint32(dns_cache_negative_ttl_sec, 5, "How long the client sockets reuse a failure to "
+                                             "resolve a host");
+
+namespace util {
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+
+namespace {
+
+DnsCache::Endpoints ToEndpoints(const tcp::resolver::results_type& results) {
+  DnsCache::Endpoints res;
+  for (const auto& entry : results) {
+    res.push_back(entry.endpoint());
+  }
+  return res;
+}
+
+VarzValue::Map GetDnsStats() {
+  DnsCache::Stats stats = DnsCache::Instance().GetStats();
+
+  VarzValue::Map res;
+  res.emplace_back("hits", VarzValue::FromInt(stats.hits));
+  res.emplace_back("negative-hits", VarzValue::FromInt(stats.negative_hits));
+  res.emplace_back("misses", VarzValue::FromInt(stats.misses));
+  res.emplace_back("refreshes", VarzValue::FromInt(stats.refreshes));
+  res.emplace_back("errors", VarzValue::FromInt(stats.errors));
+  res.emplace_back("entries", VarzValue::FromInt(stats.entries));
+  return res;
+}
+
+VarzFunction dns_cache_varz("dns-cache", GetDnsStats);
+
+}  // namespace
+
+struct DnsCache::Pending {
+  fibers_ext::Done done;
+  system::error_code ec;
+  Endpoints endpoints;
+  std::atomic_uint next{1};  // The rotation of the next waiter, the resolver gets 0.
+};
+
+// Never destroyed, the sockets may reconnect during the shutdown.
+DnsCache& DnsCache::Instance() {
+  static DnsCache* cache = new DnsCache;
+  return *cache;
+}
+
+system::error_code DnsCache::Resolve(IoContext* cntx, const string& host, const string& service,
+                                     Endpoints* res) {
+  res->clear();
+
+  string key = absl::StrCat(host, ":", service);
+  uint64_t now = GetMonotonicMicros();
+  std::shared_ptr<Pending> pending;
+  bool refresh = false;
+
+  std::unique_lock<std::mutex> lk(mu_);
+  Entry& entry = entries_[key];
+  if (entry.pending) {  // Another fiber resolves the host.
+    pending = entry.pending;
+    lk.unlock();
+
+    pending->done.Wait();
+    const Endpoints& src = pending->endpoints;
+    if (!src.empty()) {
+      size_t start = pending->next.fetch_add(1, std::memory_order_relaxed) % src.size();
+      std::rotate_copy(src.begin(), src.begin() + start, src.end(), std::back_inserter(*res));
+    }
+    return pending->ec;
+  }
+
+  if (now < entry.expire_usec) {
+    if (entry.ec) {
+      ++stats_.negative_hits;
+      return entry.ec;
+    }
+    ++stats_.hits;
+    Rotate(&entry, res);
+
+    if (now >= entry.refresh_usec && !entry.refreshing) {
+      entry.refreshing = refresh = true;
+      ++stats_.refreshes;
+    }
+    lk.unlock();
+
+    if (refresh)
+      StartRefresh(cntx, key, host, service);
+    return system::error_code{};
+  }
+
+  ++stats_.misses;
+  pending = entry.pending = std::make_shared<Pending>();
+  lk.unlock();
+
+  // It seems that resolver waits for 10s and ignores cancel command.
+  tcp::resolver resolver(cntx->raw_context());
+  system::error_code ec;
+  auto results = resolver.async_resolve(tcp::v4(), host, service, fibers_ext::yield[ec]);
+  if (ec) {
+    VLOG(1) << "Resolver error " << ec << " for " << key;
+  } else {
+    pending->endpoints = ToEndpoints(results);
+  }
+  pending->ec = ec;
+
+  lk.lock();
+  Store(key, GetMonotonicMicros(), ec, pending->endpoints);
+  entries_[key].pending.reset();
+  lk.unlock();
+  *res = pending->endpoints;
+
+  pending->done.Notify();
+  return ec;
+}
+
+auto DnsCache::GetStats() const -> Stats {
+  std::lock_guard<std::mutex> lk(mu_);
+  Stats res = stats_;
+  res.entries = entries_.size();
+
+  return res;
+}
+
+void DnsCache::Clear() {
+  std::lock_guard<std::mutex> lk(mu_);
+
+  // The pending entries are needed by the fibers that resolve them.
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto next = std::next(it);
+    if (!it->second.pending)
+      entries_.erase(it);
+    it = next;
+  }
+}
+
+void DnsCache::Store(const string& key, uint64_t now, const system::error_code& ec,
+                     Endpoints endpoints) {
+  Entry& entry = entries_[key];
+  entry.refreshing = false;
+  if (ec) {
+    ++stats_.errors;
+
+    // A failed refresh keeps the addresses until they expire.
+    if (!entry.ec && now < entry.expire_usec)
+      return;
+  }
+
+  uint64_t ttl_usec = uint64_t(ec ? FLAGS_dns_cache_negative_ttl_sec : FLAGS_dns_cache_ttl_sec) *
+                      1000000;
+  entry.ec = ec;
+  entry.endpoints = std::move(endpoints);
+  entry.expire_usec = now + ttl_usec;
+  entry.refresh_usec = now + ttl_usec / 4 * 3;
+}
+
+void DnsCache::Rotate(Entry* entry, Endpoints* res) {
+  const Endpoints& src = entry->endpoints;
+  if (src.empty())
+    return;
+
+  size_t start = entry->next++ % src.size();
+  std::rotate_copy(src.begin(), src.begin() + start, src.end(), std::back_inserter(*res));
+}
+
+// The resolver lives in its completion handler. If cntx stops before the handler runs,
+// the entry is resolved again by the first lookup after it expires.
+void DnsCache::StartRefresh(IoContext* cntx, const string& key, const string& host,
+                            const string& service) {
+  auto resolver = std::make_shared<tcp::resolver>(cntx->raw_context());
+  resolver->async_resolve(
+      tcp::v4(), host, service,
+      [this, key, resolver](const system::error_code& ec, tcp::resolver::results_type results) {
+        VLOG_IF(1, ec) << "Resolver error " << ec << " while refreshing " << key;
+        Endpoints endpoints;
+        if (!ec)
+          endpoints = ToEndpoints(results);
+
+        std::lock_guard<std::mutex> lk(mu_);
+        Store(key, GetMonotonicMicros(), ec, std::move(endpoints));
+      });
+}
+
+}  // namespace util
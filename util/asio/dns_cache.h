@@ -0,0 +1,80 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+namespace util {
+
+class IoContext;
+
+/**
+ * @brief Process-wide cache of the IPv4 addresses of host:service pairs, shared by the client
+ * sockets so that reconnect storms do not resolve the same host over and over.
+ *
+ * The addresses are kept for --dns_cache_ttl_sec and the failures for
+ * --dns_cache_negative_ttl_sec. A lookup of an entry in the last quarter of its ttl returns the
+ * cached addresses and refreshes them in the background. Concurrent misses of the same host
+ * wait for a single resolution. Each lookup rotates the addresses by one, so the clients that
+ * connect to the first address spread over all of them. Thread-safe, exported via "dns-cache"
+ * varz.
+ */
+class DnsCache {
+ public:
+  using Endpoints = std::vector<::boost::asio::ip::tcp::endpoint>;
+
+  struct Stats {
+    uint64_t hits = 0, negative_hits = 0, misses = 0, refreshes = 0, errors = 0;
+    size_t entries = 0;
+  };
+
+  static DnsCache& Instance();
+
+  //! Fills res with the addresses of host:service. Blocks the calling fiber, which must run in
+  //! cntx, if the entry is missing or expired.
+  ::boost::system::error_code Resolve(IoContext* cntx, const std::string& host,
+                                      const std::string& service, Endpoints* res);
+
+  Stats GetStats() const;
+
+  //! Drops all the entries.
+  void Clear();
+
+ private:
+  DnsCache() = default;
+
+  struct Pending;
+
+  struct Entry {
+    Endpoints endpoints;
+    ::boost::system::error_code ec;
+    uint64_t expire_usec = 0, refresh_usec = 0;
+    unsigned next = 0;  // The rotation of the next lookup.
+    bool refreshing = false;
+
+    // Set while the entry is resolved, the misses wait for it.
+    std::shared_ptr<Pending> pending;
+  };
+
+  // Requires mu_.
+  void Store(const std::string& key, uint64_t now, const ::boost::system::error_code& ec,
+             Endpoints endpoints);
+  void Rotate(Entry* entry, Endpoints* res);
+
+  void StartRefresh(IoContext* cntx, const std::string& key, const std::string& host,
+                    const std::string& service);
+
+  mutable std::mutex mu_;
+  absl::flat_hash_map<std::string, Entry> entries_;
+  Stats stats_;
+};
+
+}  // namespace util
@@ -0,0 +1,96 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/asio/dns_cache.h"
+
+#include <boost/fiber/fiber.hpp>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/asio/io_context_pool.h"
+
+DECLARE_uint32(dns_cache_ttl_sec);
+
+namespace util {
+
+using namespace std;
+using namespace boost;
+
+class DnsCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    pool_.reset(new IoContextPool{1});
+    pool_->Run();
+    DnsCache::Instance().Clear();
+  }
+
+  void TearDown() override {
+    pool_->Stop();
+    FLAGS_dns_cache_ttl_sec = 60;
+  }
+
+  system::error_code Resolve(const string& host, DnsCache::Endpoints* res) {
+    IoContext& cntx = pool_->GetNextContext();
+    return cntx.AwaitSafe(
+        [&] { return DnsCache::Instance().Resolve(&cntx, host, "80", res); });
+  }
+
+  std::unique_ptr<IoContextPool> pool_;
+};
+
+TEST_F(DnsCacheTest, Hits) {
+  DnsCache::Stats before = DnsCache::Instance().GetStats();
+
+  DnsCache::Endpoints res;
+  ASSERT_FALSE(Resolve("127.0.0.1", &res));
+  ASSERT_EQ(1, res.size());
+  EXPECT_EQ("127.0.0.1", res[0].address().to_string());
+  EXPECT_EQ(80, res[0].port());
+
+  ASSERT_FALSE(Resolve("127.0.0.1", &res));
+  EXPECT_EQ(1, res.size());
+
+  DnsCache::Stats after = DnsCache::Instance().GetStats();
+  EXPECT_EQ(before.misses + 1, after.misses);
+  EXPECT_EQ(before.hits + 1, after.hits);
+  EXPECT_EQ(1, after.entries);
+}
+
+TEST_F(DnsCacheTest, Negative) {
+  DnsCache::Stats before = DnsCache::Instance().GetStats();
+
+  DnsCache::Endpoints res;
+  EXPECT_TRUE(Resolve("no such host", &res));
+  EXPECT_TRUE(res.empty());
+  EXPECT_TRUE(Resolve("no such host", &res));
+
+  DnsCache::Stats after = DnsCache::Instance().GetStats();
+  EXPECT_EQ(before.misses + 1, after.misses);
+  EXPECT_EQ(before.negative_hits + 1, after.negative_hits);
+  EXPECT_EQ(before.errors + 1, after.errors);
+}
+
+TEST_F(DnsCacheTest, Disabled) {
+  FLAGS_dns_cache_ttl_sec = 0;
+  DnsCache::Stats before = DnsCache::Instance().GetStats();
+
+  // The concurrent misses share the resolution.
+  IoContext& cntx = pool_->GetNextContext();
+  cntx.AwaitSafe([&] {
+    DnsCache::Endpoints res1, res2;
+    fibers::fiber other(
+        [&] { EXPECT_FALSE(DnsCache::Instance().Resolve(&cntx, "127.0.0.1", "80", &res2)); });
+    EXPECT_FALSE(DnsCache::Instance().Resolve(&cntx, "127.0.0.1", "80", &res1));
+    other.join();
+    EXPECT_EQ(res1, res2);
+  });
+
+  DnsCache::Endpoints res;
+  ASSERT_FALSE(Resolve("127.0.0.1", &res));
+
+  DnsCache::Stats after = DnsCache::Instance().GetStats();
+  EXPECT_EQ(before.misses + 2, after.misses);
+  EXPECT_EQ(before.hits, after.hits);
+}
+
+}  // namespace util
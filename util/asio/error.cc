@@ -22,6 +22,8 @@ class gaia_error_category : public system::error_category {
         return "bad header";
       case gaia_error::invalid_version:
         return "invalid header version";
+      case gaia_error::bad_letter:
+        return "could not uncompress the letter";
       default:
         return absl::StrCat("gaia.util error(", ev, ")");
     }
@@ -10,6 +10,7 @@ namespace util {
 enum class gaia_error {
   bad_header = 1,
   invalid_version = 2,
+  bad_letter = 3,
 };
 
 ::boost::system::error_code
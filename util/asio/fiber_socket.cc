@@ -3,13 +3,21 @@
 //
 #include "util/asio/fiber_socket.h"
 
+#include <sys/sendfile.h>
+
 #include <boost/asio/connect.hpp>
 #include <chrono>
+#include <unordered_map>
 
 #include "absl/base/attributes.h"
 #include "base/logging.h"
+#include "util/asio/dns_cache.h"
 #include "util/asio/io_context.h"
 #include "util/fibers/event_count.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_bool(asio_rbuf_pool, true, "If true, the server sockets borrow their read buffers from "
+                                  "a per-thread pool only while the buffers hold data");
 
 #define VSOCK(verbosity) VLOG(verbosity) << "sock[" << native_handle() << "] "
 #define DVSOCK(verbosity) DVLOG(verbosity) << "sock[" << native_handle() << "] "
@@ -28,6 +36,67 @@ template <typename Duration> uint32_t ms_duration(const Duration& d) {
 
 using socket_t = FiberSocketImpl::next_layer_type;
 
+namespace {
+
+// Idle read buffers of an IO thread by their size.
+class RbufPool {
+ public:
+  using Buffer = std::unique_ptr<uint8_t[]>;
+
+  Buffer Get(size_t size);
+  void Return(size_t size, Buffer buf);
+
+  static VarzValue::Map GetStats();
+
+ private:
+  static constexpr size_t kMaxFree = 1024;  // per size.
+
+  std::unordered_map<size_t, std::vector<Buffer>> free_;
+};
+
+std::atomic_long rbuf_allocated{0}, rbuf_in_use{0}, rbuf_borrows{0};
+thread_local RbufPool* rbuf_pool = nullptr;
+
+VarzFunction rbuf_pool_varz("asio-rbuf-pool", &RbufPool::GetStats);
+
+constexpr size_t RbufPool::kMaxFree;
+
+auto RbufPool::Get(size_t size) -> Buffer {
+  rbuf_in_use.fetch_add(1, std::memory_order_relaxed);
+  rbuf_borrows.fetch_add(1, std::memory_order_relaxed);
+
+  auto it = free_.find(size);
+  if (it != free_.end() && !it->second.empty()) {
+    Buffer res = std::move(it->second.back());
+    it->second.pop_back();
+    return res;
+  }
+
+  rbuf_allocated.fetch_add(1, std::memory_order_relaxed);
+  return Buffer(new uint8_t[size]);
+}
+
+void RbufPool::Return(size_t size, Buffer buf) {
+  rbuf_in_use.fetch_sub(1, std::memory_order_relaxed);
+
+  std::vector<Buffer>& free_list = free_[size];
+  if (free_list.size() < kMaxFree) {
+    free_list.push_back(std::move(buf));
+  } else {
+    rbuf_allocated.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+VarzValue::Map RbufPool::GetStats() {
+  VarzValue::Map res;
+  res.emplace_back("allocated", VarzValue::FromInt(rbuf_allocated.load()));
+  res.emplace_back("in_use", VarzValue::FromInt(rbuf_in_use.load()));
+  res.emplace_back("borrows", VarzValue::FromInt(rbuf_borrows.load()));
+  return res;
+}
+
+}  // namespace
+
 struct FiberSocketImpl::ClientData {
   fibers::fiber worker;
   fibers::condition_variable_any cv_st;
@@ -47,10 +116,16 @@ FiberSocketImpl::~FiberSocketImpl() {
 
   error_code ec;
   Shutdown(ec);
+  if (pooled_rbuf_) {
+    rslice_ = asio::mutable_buffer();  // Drops the data that was not read.
+    ReleaseRbuf();
+  }
 }
 
 FiberSocketImpl::FiberSocketImpl(socket_t&& sock, size_t rbuf_size)
-    : rbuf_size_(rbuf_size), sock_(std::move(sock)), rbuf_(new uint8_t[rbuf_size]) {
+    : pooled_rbuf_(FLAGS_asio_rbuf_pool), rbuf_size_(rbuf_size), sock_(std::move(sock)) {
+  if (!pooled_rbuf_)
+    rbuf_.reset(new uint8_t[rbuf_size]);
 }
 
 // Creates a client socket.
@@ -58,6 +133,12 @@ FiberSocketImpl::FiberSocketImpl(const std::string& hname, const std::string& po
                                  size_t rbuf_size)
     : FiberSocketImpl(socket_t(cntx->raw_context()), rbuf_size) {
   VLOG(1) << "FiberSocketImpl::FiberSocketImpl " << sock_.native_handle();
+
+  // The client worker reads ahead into rbuf_ in the background.
+  if (pooled_rbuf_) {
+    pooled_rbuf_ = false;
+    rbuf_.reset(new uint8_t[rbuf_size]);
+  }
   hname_ = hname;
   port_ = port;
   io_cntx_ = cntx;
@@ -67,6 +148,7 @@ FiberSocketImpl::FiberSocketImpl(const std::string& hname, const std::string& po
 void FiberSocketImpl::Shutdown(error_code& ec) {
   if (!is_open_)
     return;
+
   auto handle = sock_.native_handle();
   auto cb = [&] {
     if (!is_open_) {
@@ -74,6 +156,12 @@ void FiberSocketImpl::Shutdown(error_code& ec) {
       return;
     }
 
+    // The peer may not read anymore, so the batch gets only what the socket takes right away.
+    if (wbatch_ && wbatch_->mu.try_lock()) {
+      FlushBatch(true);
+      wbatch_->mu.unlock();
+    }
+
     is_open_ = false;
     sock_.cancel(ec);
     sock_.shutdown(socket_t::shutdown_both, ec);
@@ -86,6 +174,12 @@ void FiberSocketImpl::Shutdown(error_code& ec) {
         clientsock_data_->worker.join();
       DVSOCK(1) << "Worker Joined";
     }
+
+    if (wbatch_) {
+      // Waits for a flush that the cancel aborted and detaches the posted ones.
+      std::lock_guard<fibers::mutex> lk(wbatch_->mu);
+      wbatch_->owner = nullptr;
+    }
   };
 
   if (clientsock_data_) {
@@ -96,6 +190,128 @@ void FiberSocketImpl::Shutdown(error_code& ec) {
   }
 }
 
+void FiberSocketImpl::BorrowRbuf() {
+  if (rbuf_)
+    return;
+  if (!rbuf_pool)
+    rbuf_pool = new RbufPool;
+  rbuf_ = rbuf_pool->Get(rbuf_size_);
+}
+
+void FiberSocketImpl::ReleaseRbuf() {
+  if (!rbuf_)
+    return;
+  DCHECK_EQ(0, rslice_.size());
+
+  if (!rbuf_pool)
+    rbuf_pool = new RbufPool;
+  rbuf_pool->Return(rbuf_size_, std::move(rbuf_));
+  rslice_ = asio::mutable_buffer();
+}
+
+void FiberSocketImpl::set_write_batch(size_t capacity) {
+  if (wbatch_) {
+    Flush();
+    wbatch_->owner = nullptr;
+    wbatch_.reset();
+  }
+  if (capacity)
+    wbatch_ = std::make_shared<WriteBatch>(capacity, this);
+}
+
+auto FiberSocketImpl::Flush() -> error_code {
+  if (!wbatch_)
+    return error_code{};
+
+  std::shared_ptr<WriteBatch> batch = wbatch_;
+  std::lock_guard<fibers::mutex> lk(batch->mu);
+  return batch->owner ? FlushBatch(false) : error_code{};
+}
+
+auto FiberSocketImpl::SendFile(int fd, uint64_t offset, size_t length) -> error_code {
+  // The response header is usually batched and must precede the file.
+  error_code ec = Flush();
+  if (ec || status_)
+    return status_ ? status_ : ec;
+
+  off_t off = offset;
+  while (length) {
+    ssize_t res = ::sendfile(sock_.native_handle(), fd, &off, length);
+    if (res > 0) {
+      length -= res;
+      continue;
+    }
+    if (res == 0) {
+      ec = asio::error::eof;  // The file is shorter than expected.
+      break;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN) {
+      ec = error_code(errno, system::system_category());
+      break;
+    }
+    sock_.async_wait(next_layer_type::wait_write, fibers_ext::yield[ec]);
+    if (ec)
+      break;
+  }
+
+  if (ec) {
+    SetStatus(ec, "sendfile");
+  }
+  return ec;
+}
+
+void FiberSocketImpl::PostFlush() {
+  if (wbatch_->flush_posted)
+    return;
+  wbatch_->flush_posted = true;
+
+  // Runs in the IO loop, i.e. after the writing fiber yielded or blocked.
+  asio::post(sock_.get_executor(), [batch = wbatch_] {
+    batch->flush_posted = false;
+    if (!batch->owner || !batch->size || !batch->mu.try_lock())
+      return;
+
+    // The loop can not block, a fiber finishes what the socket did not take.
+    bool done = !batch->owner->FlushBatch(true) && batch->size == 0;
+    batch->mu.unlock();
+    if (!done) {
+      fibers::fiber([batch] {
+        std::lock_guard<fibers::mutex> lk(batch->mu);
+        if (batch->owner)
+          batch->owner->FlushBatch(false);
+      }).detach();
+    }
+  });
+}
+
+// Requires wbatch_->mu.
+auto FiberSocketImpl::FlushBatch(bool non_blocking) -> error_code {
+  WriteBatch* batch = wbatch_.get();
+  error_code ec;
+
+  while (batch->size && !status_) {
+    // Appends during an async write land past the buffer it sends.
+    asio::const_buffer cbuf(batch->buf.get(), batch->size);
+    size_t written = sock_.write_some(cbuf, ec);
+    if (ec == asio::error::would_block) {
+      if (non_blocking)
+        return error_code{};
+      written = sock_.async_write_some(cbuf, fibers_ext::yield[ec]);
+    }
+    if (ec) {
+      SetStatus(ec, "flush");
+      break;
+    }
+
+    batch->size -= written;
+    memmove(batch->buf.get(), batch->buf.get() + written, batch->size);
+  }
+
+  return status_ ? status_ : ec;
+}
+
 void FiberSocketImpl::SetStatus(const error_code& ec, const char* where) {
   status_ = ec;
   if (ec) {
@@ -221,14 +437,11 @@ system::error_code FiberSocketImpl::Reconnect(const std::string& hname,
 
   auto& asio_io_cntx = clientsock_data_->io_cntx->raw_context();
 
-  tcp::resolver resolver(asio_io_cntx);
-
-  system::error_code ec;
-
   VSOCK(1) << "Before AsyncResolve " << is_open();
 
-  // It seems that resolver waits for 10s and ignores cancel command.
-  auto results = resolver.async_resolve(tcp::v4(), hname, service, fibers_ext::yield[ec]);
+  DnsCache::Endpoints results;
+  system::error_code ec =
+      DnsCache::Instance().Resolve(clientsock_data_->io_cntx, hname, service, &results);
   if (ec) {
     VLOG(1) << "Resolver error " << ec;
     return ec;
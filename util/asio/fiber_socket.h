@@ -59,6 +59,22 @@ class FiberSyncSocket {
   // implementing it.
   template <typename BS> size_t write_some(const BS& bufs);
 
+  // Coalesces small writes: write_some copies the buffers into a batch of up to capacity bytes
+  // that goes out with one syscall when the writing fiber yields to the IO loop, before
+  // read_some blocks, when the batch fills or on Flush(). 0 disables the batching.
+  // Requires the writes to run in the IoContext thread.
+  void set_write_batch(size_t capacity) { impl_->set_write_batch(capacity); }
+
+  // Sends the batched writes, blocks the calling fiber.
+  error_code Flush() { return impl_->Flush(); }
+
+  // Sends length bytes of the file fd starting at offset with sendfile(2), the file pages go
+  // to the socket without a copy through userspace. Flushes the batched writes before.
+  // Blocks the calling fiber.
+  error_code SendFile(int fd, uint64_t offset, size_t length) {
+    return impl_->SendFile(fd, offset, length);
+  }
+
   auto native_handle() { return impl_->native_handle(); }
 
   bool is_open() const { return impl_ && impl_->is_open(); }
@@ -76,6 +92,9 @@ class FiberSyncSocket {
 
   error_code status() const { return impl_->status(); }
 
+  // Bytes that the background reader of a client socket received but were not read yet.
+  size_t read_buffered() const { return impl_->read_buffered(); }
+
   // To support socket requirements.
   next_layer_type& next_layer() { return impl_->next_layer(); }
   lowest_layer_type& lowest_layer() { return impl_->next_layer().lowest_layer(); }
@@ -81,6 +81,32 @@ TEST_F(SocketTest, Move) {
 
 }
 
+TEST_F(SocketTest, WriteBatch) {
+  system::error_code ec;
+  h2::request<h2::string_body> req{h2::verb::get, "/", 11};
+
+  sock_->context().AwaitSafe([&] {
+    sock_->set_write_batch(1 << 12);
+
+    // The response proves that the read flushed the batched request.
+    size_t written = h2::write(*sock_, req, ec);
+    EXPECT_GT(written, 0);
+    size_t sz = ReadResp(ec);
+    EXPECT_FALSE(ec);
+    EXPECT_GT(sz, 0);
+
+    // Explicit flush.
+    written = h2::write(*sock_, req, ec);
+    EXPECT_GT(written, 0);
+    EXPECT_FALSE(sock_->Flush());
+    sz = ReadResp(ec);
+    EXPECT_FALSE(ec);
+    EXPECT_GT(sz, 0);
+
+    sock_->set_write_batch(0);
+  });
+}
+
 TEST_F(SocketTest, StarvedRead) {
   fibers_ext::Done done;
   listener_.RegisterCb("/null", false,  // does not send anything.
@@ -0,0 +1,214 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/asio/fiber_trace.h"
+
+#include <execinfo.h>
+#include <signal.h>
+
+#include <thread>
+#include <vector>
+
+#include "absl/debugging/symbolize.h"
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_bool(io_fiber_trace, false, "If true, traces the fiber switches of the IO threads, "
+                                   "see the fiber-sched varz");
+DEFINE_uint32(io_fiber_long_run_ms, 50, "With --io_fiber_trace, logs the stack of the fibers "
+                                        "that run longer than that without yielding");
+
+namespace util {
+
+using namespace std;
+
+namespace {
+
+std::mutex tracers_mu;
+std::vector<FiberTracer*>* tracers = nullptr;  // Guarded by tracers_mu.
+
+thread_local FiberTracer* this_tracer = nullptr;
+
+// Real-time signals are not used by the rest of the process.
+inline int StackSignal() {
+  return SIGRTMIN + 2;
+}
+
+VarzValue::Map GetTraceStats() {
+  return FiberTracer::GetStats();
+}
+
+VarzFunction fiber_sched_varz("fiber-sched", GetTraceStats);
+
+}  // namespace
+
+constexpr unsigned FiberTracer::kMaxFrames;
+
+FiberTracer::FiberTracer() : tid_(pthread_self()) {
+}
+
+FiberTracer* FiberTracer::ThisThread() {
+  if (!FLAGS_io_fiber_trace)
+    return nullptr;
+
+  if (this_tracer)
+    return this_tracer;
+
+  this_tracer = new FiberTracer;
+
+  lock_guard<mutex> lk(tracers_mu);
+  if (!tracers) {
+    tracers = new vector<FiberTracer*>;
+
+    // backtrace() allocates on its first call, which is not allowed in the signal handler.
+    void* frames[2];
+    backtrace(frames, 2);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &FiberTracer::SampleStack;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    CHECK_EQ(0, sigaction(StackSignal(), &sa, nullptr));
+
+    if (FLAGS_io_fiber_long_run_ms)
+      std::thread(&FiberTracer::Watchdog).detach();
+  }
+  tracers->push_back(this_tracer);
+
+  return this_tracer;
+}
+
+void FiberTracer::OnYield(const std::string& name, uint64_t run_usec) {
+  slice_start_.store(0, std::memory_order_relaxed);
+
+  bool long_run = FLAGS_io_fiber_long_run_ms && run_usec >= FLAGS_io_fiber_long_run_ms * 1000;
+  string report;
+  if (long_run) {
+    uint64_t slice_start = base::GetMonotonicMicrosFast() - run_usec;
+    report = absl::StrCat(name, " ran for ", run_usec / 1000, "ms without yielding");
+
+    // The watchdog sampled the slice if it was running long enough.
+    string stack = SymbolizeSample(slice_start);
+    if (!stack.empty())
+      absl::StrAppend(&report, ", sampled at:\n", stack);
+    LOG(WARNING) << report;
+  }
+
+  lock_guard<mutex> lk(mu_);
+  FiberStats& stats = fiber_stats_[name];
+  ++stats.runs;
+  stats.run_usec += run_usec;
+  stats.max_run_usec = std::max(stats.max_run_usec, run_usec);
+  if (long_run) {
+    ++long_runs_;
+    last_long_run_ = std::move(report);
+  }
+}
+
+void FiberTracer::OnResume(uint64_t now, uint64_t delay_usec) {
+  slice_start_.store(now, std::memory_order_relaxed);
+
+  lock_guard<mutex> lk(mu_);
+  delay_hist_.Add(delay_usec);
+}
+
+string FiberTracer::SymbolizeSample(uint64_t slice_start) {
+  int num = num_frames_.exchange(0, std::memory_order_acquire);
+
+  // GetMonotonicMicrosFast has 100usec precision.
+  if (num == 0 || frames_slice_ + 1000 < slice_start)
+    return string{};
+
+  string res;
+  char buf[512];
+
+  // The first frames are the signal handler.
+  for (int i = 2; i < num; ++i) {
+    const char* symbol = absl::Symbolize(frames_[i], buf, sizeof(buf)) ? buf : "(unknown)";
+    absl::StrAppend(&res, "  @ ", absl::Hex(frames_[i]), " ", symbol, "\n");
+  }
+  return res;
+}
+
+void FiberTracer::SampleStack(int sig) {
+  FiberTracer* me = this_tracer;
+  if (!me || me->num_frames_.load(std::memory_order_relaxed))
+    return;
+
+  me->frames_slice_ = me->slice_start_.load(std::memory_order_relaxed);
+  me->num_frames_.store(backtrace(me->frames_, kMaxFrames), std::memory_order_release);
+}
+
+void FiberTracer::Watchdog() {
+  const uint64_t threshold_usec = FLAGS_io_fiber_long_run_ms * 1000;
+
+  while (true) {
+    this_thread::sleep_for(chrono::microseconds(threshold_usec / 2));
+    uint64_t now = base::GetMonotonicMicrosFast();
+
+    lock_guard<mutex> lk(tracers_mu);
+    for (FiberTracer* tracer : *tracers) {
+      uint64_t start = tracer->slice_start_.load(std::memory_order_relaxed);
+      if (start && now > start + threshold_usec && tracer->sampled_slice_ != start) {
+        tracer->sampled_slice_ = start;
+        pthread_kill(tracer->tid_, StackSignal());
+      }
+    }
+  }
+}
+
+VarzValue::Map FiberTracer::GetStats() {
+  unordered_map<string, FiberStats> fiber_stats;
+  base::Histogram delay_hist;
+  uint64_t long_runs = 0;
+  string last_long_run;
+
+  {
+    lock_guard<mutex> lk(tracers_mu);
+    if (!tracers)
+      return VarzValue::Map{};
+
+    for (FiberTracer* tracer : *tracers) {
+      lock_guard<mutex> lk2(tracer->mu_);
+      for (const auto& k_v : tracer->fiber_stats_) {
+        FiberStats& dest = fiber_stats[k_v.first];
+        dest.runs += k_v.second.runs;
+        dest.run_usec += k_v.second.run_usec;
+        dest.max_run_usec = std::max(dest.max_run_usec, k_v.second.max_run_usec);
+      }
+      delay_hist.Merge(tracer->delay_hist_);
+      long_runs += tracer->long_runs_;
+      if (!tracer->last_long_run_.empty())
+        last_long_run = tracer->last_long_run_;
+    }
+  }
+
+  VarzValue::Map fibers;
+  for (const auto& k_v : fiber_stats) {
+    VarzValue::Map stats;
+    stats.emplace_back("runs", VarzValue::FromInt(k_v.second.runs));
+    stats.emplace_back("run_ms", VarzValue::FromInt(k_v.second.run_usec / 1000));
+    stats.emplace_back("max_run_ms", VarzValue::FromInt(k_v.second.max_run_usec / 1000));
+    fibers.emplace_back(k_v.first.empty() ? "unnamed" : k_v.first, std::move(stats));
+  }
+
+  VarzValue::Map delay;
+  delay.emplace_back("count", VarzValue::FromInt(delay_hist.count()));
+  delay.emplace_back("p50", VarzValue::FromDouble(delay_hist.Percentile(50)));
+  delay.emplace_back("p99", VarzValue::FromDouble(delay_hist.Percentile(99)));
+  delay.emplace_back("max", VarzValue::FromDouble(delay_hist.max()));
+
+  VarzValue::Map res;
+  res.emplace_back("fibers", std::move(fibers));
+  res.emplace_back("sched_delay_usec", std::move(delay));
+  res.emplace_back("long_runs", VarzValue::FromInt(long_runs));
+  res.emplace_back("last_long_run", VarzValue(std::move(last_long_run)));
+
+  return res;
+}
+
+}  // namespace util
@@ -0,0 +1,82 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/histogram.h"
+#include "util/stats/varz_value.h"
+
+namespace util {
+
+/**
+ * @brief Scheduler tracing of an IO thread, enabled with --io_fiber_trace.
+ *
+ * The AsioScheduler reports every fiber switch: the run time of the fiber that yields is
+ * accumulated per fiber name and the time the resumed fiber waited in the ready queue since it
+ * was awakened goes into a histogram. A watchdog thread samples the stack of an IO thread
+ * whose fiber runs longer than --io_fiber_long_run_ms without yielding, the sample is logged
+ * together with the run once the fiber yields. The stats of all the IO threads are exported
+ * as the "fiber-sched" varz on the status page.
+ */
+class FiberTracer {
+ public:
+  struct FiberStats {
+    uint64_t runs = 0, run_usec = 0, max_run_usec = 0;
+  };
+
+  //! Returns the tracer of the calling IO thread or null if the tracing is disabled.
+  //! Registers the tracer on the first call.
+  static FiberTracer* ThisThread();
+
+  //! The fiber name ran run_usec since it was resumed.
+  void OnYield(const std::string& name, uint64_t run_usec);
+
+  //! A fiber is resumed at now after it waited delay_usec in the ready queue.
+  void OnResume(uint64_t now, uint64_t delay_usec);
+
+  //! The thread blocks (slice_start == 0) or starts running a fiber at slice_start.
+  void SetSliceStart(uint64_t slice_start) {
+    slice_start_.store(slice_start, std::memory_order_relaxed);
+  }
+
+  static VarzValue::Map GetStats();
+
+ private:
+  FiberTracer();
+
+  static void Watchdog();
+  static void SampleStack(int sig);
+
+  std::string SymbolizeSample(uint64_t slice_start);
+
+  static constexpr unsigned kMaxFrames = 32;
+
+  pthread_t tid_;
+
+  // When the current fiber was resumed, 0 while the thread is idle or in the dispatcher.
+  std::atomic_uint64_t slice_start_{0};
+
+  // Written by the signal handler in the IO thread.
+  void* frames_[kMaxFrames];
+  std::atomic_int num_frames_{0};
+  uint64_t frames_slice_ = 0;
+
+  // Accessed by the watchdog thread only.
+  uint64_t sampled_slice_ = 0;
+
+  std::mutex mu_;
+  std::unordered_map<std::string, FiberStats> fiber_stats_;
+  base::Histogram delay_hist_;
+  uint64_t long_runs_ = 0;
+  std::string last_long_run_;
+};
+
+}  // namespace util
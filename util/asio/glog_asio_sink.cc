@@ -10,7 +10,7 @@ using namespace ::std;
 
 using namespace fibers;
 
-GlogAsioSink::GlogAsioSink() : msg_q_(64) {
+GlogAsioSink::GlogAsioSink(size_t queue_size) : msg_q_(queue_size) {
 }
 
 GlogAsioSink::~GlogAsioSink() noexcept {
@@ -34,6 +34,7 @@ void GlogAsioSink::Run() {
   }
 
   LOG_IF(INFO, lost_messages_ > 0) << "GlogAsioSink lost " << lost_messages_ << " lost messages ";
+  LOG_IF(INFO, dropped() > 0) << "GlogAsioSink dropped " << dropped() << " messages";
 }
 
 void GlogAsioSink::Cancel() {
@@ -52,12 +53,13 @@ void GlogAsioSink::send(google::LogSeverity severity, const char* full_filename,
     return;
 
   // string creation might have potential performance impact.
-  channel_op_status st = msg_q_.push_wait_for(
-      Item{full_filename, base_filename, severity, line, *tm_time, string{message, message_len}},
-      100us);
+  // Never waits for the consumer: the logging thread may be in a latency sensitive path and
+  // the consumer may be stuck on the network.
+  channel_op_status st = msg_q_.try_push(
+      Item{full_filename, base_filename, severity, line, *tm_time, string{message, message_len}});
 
   if (st != channel_op_status::success) {
-    ++lost_messages_;
+    dropped_.fetch_add(1, std::memory_order_relaxed);
   }
   RAW_VLOG(1, "GlogAsioSink::SendExit : %d", int(st));
 }
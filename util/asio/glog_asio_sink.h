@@ -14,7 +14,8 @@ namespace util {
 
 class GlogAsioSink : public IoContext::Cancellable, ::google::LogSink {
  public:
-  GlogAsioSink();
+  // queue_size must be a power of 2.
+  explicit GlogAsioSink(size_t queue_size = 64);
   ~GlogAsioSink() noexcept;
 
   void Run() override;
@@ -22,6 +23,9 @@ class GlogAsioSink : public IoContext::Cancellable, ::google::LogSink {
 
   void WaitTillRun();
 
+  // Number of messages dropped because the queue was full.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
  protected:
   struct Item {
     const char* full_filename;
@@ -33,7 +37,7 @@ class GlogAsioSink : public IoContext::Cancellable, ::google::LogSink {
   };
   ::boost::fibers::buffered_channel<Item> msg_q_;
 
-  unsigned lost_messages_ = 0;
+  std::atomic_uint lost_messages_{0};
 
   virtual bool ShouldIgnore(google::LogSeverity severity, const char* full_filename, int line) {
     return false;
@@ -50,6 +54,7 @@ class GlogAsioSink : public IoContext::Cancellable, ::google::LogSink {
   void WaitTillSent() override;
 
   std::atomic_bool run_started_{false};
+  std::atomic<uint64_t> dropped_{0};
   fibers_ext::EventCount ec_;
 };
 
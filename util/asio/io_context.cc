@@ -13,7 +13,9 @@
 #include <glog/raw_logging.h>
 
 #include "base/walltime.h"
+#include "util/asio/fiber_trace.h"
 #include "util/asio/io_context.h"
+#include "util/mimalloc_resource.h"
 
 namespace util {
 
@@ -39,6 +41,8 @@ constexpr unsigned DISPATCH_LEVEL = IoFiberProperties::NUM_NICE_LEVELS;
 constexpr unsigned NOTIFY_GUARD_SHIFT = 16;
 constexpr chrono::steady_clock::time_point STEADY_PT_MAX = chrono::steady_clock::time_point::max();
 
+thread_local uint64_t fiber_switch_epoch = 0;
+
 inline int64_t delta_micros(const chrono::steady_clock::time_point tp) {
   static_assert(8 == sizeof(chrono::steady_clock::time_point), "");
   return chrono::duration_cast<chrono::microseconds>(tp - chrono::steady_clock::now()).count();
@@ -59,6 +63,7 @@ class AsioScheduler final : public fibers::algo::algorithm_with_properties<IoFib
   std::size_t switch_cnt_{0};
 
   fibers::context* main_loop_ctx_ = nullptr;
+  FiberTracer* tracer_;  // null unless --io_fiber_trace.
   chrono::steady_clock::time_point suspend_tp_ = STEADY_PT_MAX;
 
   enum : uint8_t { LOOP_RUN_ONE = 1, MAIN_LOOP_SUSPEND = 2, MAIN_LOOP_FINISHED = 4 };
@@ -67,7 +72,8 @@ class AsioScheduler final : public fibers::algo::algorithm_with_properties<IoFib
  public:
   //[asio_rr_ctor
   AsioScheduler(const std::shared_ptr<asio::io_context>& io_svc)
-      : io_context_(io_svc), suspend_timer_(new asio::steady_timer(*io_svc)) {}
+      : io_context_(io_svc), suspend_timer_(new asio::steady_timer(*io_svc)),
+        tracer_(FiberTracer::ThisThread()) {}
 
   ~AsioScheduler();
 
@@ -175,6 +181,9 @@ class AsioScheduler final : public fibers::algo::algorithm_with_properties<IoFib
     }
   }
   void WaitTillFibersSuspend();
+
+  // Accounts the slice of the active fiber and the ready-queue delay of ctx it switches to.
+  void TraceSwitch(fibers::context* ctx, uint64_t now);
 };
 
 AsioScheduler::~AsioScheduler() {}
@@ -318,6 +327,8 @@ fibers::context* AsioScheduler::pick_next() noexcept {
     RAW_VLOG(2, "Switching from %x to %x switch_cnt(%d)", short_id(), short_id(ctx), switch_cnt_);
     DCHECK(ctx != fibers::context::active());
 
+    if (tracer_)
+      TraceSwitch(ctx, now);
     IoFiberPropertiesMgr{ctx->get_properties()}.set_resume_ts(now);
 
     // Checking if we want to resume to main loop prematurely to preserve responsiveness
@@ -344,6 +355,7 @@ fibers::context* AsioScheduler::pick_next() noexcept {
     }
 
     RAW_VLOG(3, "pick_next: %x", short_id(ctx));
+    ++fiber_switch_epoch;
 
     return ctx;
   }
@@ -357,14 +369,40 @@ fibers::context* AsioScheduler::pick_next() noexcept {
 
     RAW_VLOG(2, "Switching from ", short_id(), " to dispatch ", short_id(ctx),
              ", mask: ", unsigned(mask_));
+    if (tracer_)
+      TraceSwitch(ctx, now);
+    ++fiber_switch_epoch;
     return ctx;
   }
 
   RAW_VLOG(2, "pick_next: null");
+  if (tracer_)
+    TraceSwitch(nullptr, now);
 
   return nullptr;
 }
 
+void AsioScheduler::TraceSwitch(fibers::context* ctx, uint64_t now) {
+  // The main loop and the dispatcher block in run_one or run the scheduler hooks,
+  // their time is not a fiber slice.
+  fibers::context* active = fibers::context::active();
+  if (active != main_loop_ctx_ && !active->is_context(fibers::type::dispatcher_context)) {
+    auto* props = static_cast<IoFiberProperties*>(active->get_properties());
+    if (props && props->resume_ts()) {
+      tracer_->OnYield(props->name(), now - props->resume_ts());
+      IoFiberPropertiesMgr{props}.set_resume_ts(0);  // Accounts the slice once.
+    }
+  }
+
+  if (!ctx || ctx == main_loop_ctx_ || ctx->is_context(fibers::type::dispatcher_context)) {
+    tracer_->SetSliceStart(0);
+    return;
+  }
+
+  auto& props = static_cast<IoFiberProperties&>(*ctx->get_properties());
+  tracer_->OnResume(now, now > props.awaken_ts() ? now - props.awaken_ts() : 0);
+}
+
 void AsioScheduler::notify() noexcept {
   uint32_t seq = notify_guard_.fetch_add(1, std::memory_order_acq_rel);
 
@@ -409,6 +447,33 @@ void IoFiberProperties::SetNiceLevel(unsigned p) {
   }
 }
 
+IoContext::IoContext()
+    : context_ptr_(std::make_shared<io_context>()), tq_(new TaskQueue(256)) {}
+
+void IoContext::TaskQueue::Drain(io_context* cntx) {
+  // Disarm before dequeuing: a task enqueued after the last dequeue posts a new handler.
+  armed.exchange(false, std::memory_order_acq_rel);
+
+  // Runs at most a queue-full so that a stream of submissions does not starve the loop.
+  size_t limit = queue.capacity();
+  size_t cnt = 0;
+  Tasklet task;
+  while (cnt < limit && queue.try_dequeue(task)) {
+    task();
+    ++cnt;
+  }
+
+  if (cnt) {
+    tasks.fetch_add(cnt, std::memory_order_relaxed);
+    batches.fetch_add(1, std::memory_order_relaxed);
+    avail.notifyAll();
+  }
+
+  if (cnt == limit && !armed.exchange(true, std::memory_order_acq_rel)) {
+    asio::post(*cntx, [this, cntx] { Drain(cntx); });
+  }
+}
+
 void IoContext::StartLoop(BlockingCounter* bc) {
   // I do not use use_scheduling_algorithm because I want to retain access to the scheduler.
   // fibers::use_scheduling_algorithm<AsioScheduler>(io_ptr);
@@ -419,6 +484,7 @@ void IoContext::StartLoop(BlockingCounter* bc) {
   CHECK(fibers::context::active()->is_context(fibers::type::main_context));
 
   thread_id_ = this_thread::get_id();
+  InitThreadHeap();
 
   io_context& io_cntx = *context_ptr_;
 
@@ -443,6 +509,7 @@ void IoContext::StartLoop(BlockingCounter* bc) {
     }
     io_cntx.restart();
   }
+  DestroyThreadHeap();
 }
 
 void IoContext::Stop() {
@@ -468,4 +535,6 @@ void IoContext::Stop() {
   VLOG(1) << "AsioIoContext stopped";
 }
 
+uint64_t FiberSwitchEpoch() { return fiber_switch_epoch; }
+
 }  // namespace util
@@ -7,9 +7,14 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/post.hpp>
 
+#include <memory>
 #include <thread>
 
+#include "base/function2.hpp"
+#include "base/mpmc_bounded_queue.h"
+#include "util/fibers/event_count.h"
 #include "util/fibers/fibers_ext.h"
+#include "util/fibers/pooled_stack.h"
 
 namespace util {
 
@@ -92,7 +97,7 @@ class IoContext {
     virtual void Cancel() = 0;
   };
 
-  IoContext() : context_ptr_(std::make_shared<io_context>()) {}
+  IoContext();
 
   // We use shared_ptr because of the shared ownership with the fibers scheduler.
   typedef std::shared_ptr<io_context> ptr_t;
@@ -101,8 +106,16 @@ class IoContext {
 
   io_context& raw_context() { return *context_ptr_; }
 
+  //! Runs f asynchronously in the io-context fiber, see asio_ext::Async. The calls from other
+  //! threads go through a lock-free task queue that the loop drains in batches, so they do not
+  //! contend on the io_context mutex and a burst of them wakes the loop once. They block
+  //! the calling fiber while the queue is full.
   template <typename Func> void Async(Func&& f) {
-    asio_ext::Async(*context_ptr_, std::forward<Func>(f));
+    if (InContextThread()) {
+      asio_ext::Async(*context_ptr_, std::forward<Func>(f));
+    } else {
+      AsyncRemote(std::forward<Func>(f));
+    }
   }
 
   template <typename Func, typename... Args> void AsyncFiber(Func&& f, Args&&... args) {
@@ -110,7 +123,9 @@ class IoContext {
     // So I just copy them into capture.
     // We forward captured variables so we need lambda to be mutable.
     Async([f = std::forward<Func>(f), args...]() mutable {
-      ::boost::fibers::fiber(std::forward<Func>(f), std::forward<Args>(args)...).detach();
+      ::boost::fibers::fiber(std::allocator_arg, fibers_ext::PooledStackAllocator(),
+                             std::forward<Func>(f), std::forward<Args>(args)...)
+          .detach();
     });
   }
 
@@ -120,7 +135,18 @@ class IoContext {
     if (InContextThread()) {
       return f();
     }
-    return asio_ext::Await(*context_ptr_, std::forward<Func>(f));
+
+    fibers_ext::Done done;
+    using ResultType = decltype(f());
+    detail::ResultMover<ResultType> mover;
+
+    AsyncRemote([&, f = std::forward<Func>(f), done]() mutable {
+      mover.Apply(f);
+      done.Notify();
+    });
+
+    done.Wait();
+    return std::move(mover).get();
   }
 
   // Please note that this function uses Await, therefore can not be used inside Ring0
@@ -128,7 +154,10 @@ class IoContext {
   template <typename... Args> boost::fibers::fiber LaunchFiber(Args&&... args) {
     ::boost::fibers::fiber fb;
     // It's safe to use & capture since we await before returning.
-    Await([&] { fb = boost::fibers::fiber(std::forward<Args>(args)...); });
+    Await([&] {
+      fb = boost::fibers::fiber(std::allocator_arg, fibers_ext::PooledStackAllocator(),
+                                std::forward<Args>(args)...);
+    });
     return fb;
   }
 
@@ -154,6 +183,10 @@ class IoContext {
 
   bool InContextThread() const { return std::this_thread::get_id() == thread_id_; }
 
+  //! The number of the remote Async calls and of the batches that the loop ran them in.
+  uint64_t remote_tasks() const { return tq_->tasks.load(std::memory_order_relaxed); }
+  uint64_t remote_batches() const { return tq_->batches.load(std::memory_order_relaxed); }
+
   // Attaches user processes that should live along IoContext. IoContext will shut them down via
   // Cancel() call right before closing its IO loop.
   // Takes ownership over Cancellable runner. Runs it in a dedicated fiber in IoContext thread.
@@ -168,11 +201,54 @@ class IoContext {
  private:
   void StartLoop(fibers_ext::BlockingCounter* bc);
 
+  template <typename Func> void AsyncRemote(Func&& f);
+
   using CancellablePair = std::pair<std::unique_ptr<Cancellable>, ::boost::fibers::fiber>;
 
+  // We use fu2 function to allow moveable semantics.
+  using Tasklet =
+      fu2::function_base<true /*owns*/, false /*non-copyable*/, fu2::capacity_default,
+                         false /* non-throwing*/, false /* strong exceptions guarantees*/, void()>;
+
+  // Heap-allocated so that IoContext stays movable.
+  struct TaskQueue {
+    base::mpmc_bounded_queue<Tasklet> queue;
+
+    // Set while a drain handler is posted to the io_context.
+    std::atomic_bool armed{false};
+    fibers_ext::EventCount avail;
+    std::atomic_uint64_t tasks{0}, batches{0};
+
+    explicit TaskQueue(size_t capacity) : queue(capacity) {}
+
+    // Runs the queued tasks in the context thread.
+    void Drain(io_context* cntx);
+  };
+
   ptr_t context_ptr_;
+  std::unique_ptr<TaskQueue> tq_;
   std::thread::id thread_id_;
   std::vector<CancellablePair> cancellable_arr_;
 };
 
+template <typename Func> void IoContext::AsyncRemote(Func&& f) {
+  TaskQueue* tq = tq_.get();
+  while (!tq->queue.try_enqueue(std::forward<Func>(f))) {
+    fibers_ext::EventCount::Key key = tq->avail.prepareWait();
+    if (tq->queue.try_enqueue(std::forward<Func>(f)))
+      break;
+    tq->avail.wait(key.epoch());
+  }
+
+  // Only the first submission of a batch posts the drain handler.
+  if (!tq->armed.exchange(true, std::memory_order_acq_rel)) {
+    io_context* cntx = context_ptr_.get();
+    ::boost::asio::post(*cntx, [tq, cntx] { tq->Drain(cntx); });
+  }
+}
+
+// Returns the number of fiber switches done by IoContext scheduler in the calling thread.
+// If the value did not change between two points, the current fiber was not suspended.
+uint64_t FiberSwitchEpoch();
+
 }  // namespace util
@@ -10,12 +10,16 @@
 #include <boost/fiber/scheduler.hpp>
 
 #include "base/logging.h"
+#include "base/numa.h"
 #include "base/pthread_utils.h"
 
 using namespace boost;
 using std::thread;
 
 DEFINE_uint32(io_context_threads, 0, "Number of io threads in the pool");
+DEFINE_bool(io_context_numa, false, "If true and no cpus are given, spreads the io threads "
+                                    "evenly over the NUMA nodes and allocates their memory on "
+                                    "the local node");
 
 namespace util {
 
@@ -27,8 +31,12 @@ IoContextPool::IoContextPool(size_t pool_size, std::vector<size_t> cpus) {
         FLAGS_io_context_threads > 0 ? FLAGS_io_context_threads : thread::hardware_concurrency();
   }
   if (cpus.empty()) {
-    for (size_t i = 0; i < pool_size; ++i)
-      cpus.push_back(i);
+    if (FLAGS_io_context_numa) {
+      cpus = base::NumaTopology::Get().SpreadThreads(pool_size);
+    } else {
+      for (size_t i = 0; i < pool_size; ++i)
+        cpus.push_back(i);
+    }
   }
   CHECK_EQ(pool_size, cpus.size());
   cpu_idx_arr_ = std::move(cpus);
@@ -41,6 +49,12 @@ IoContextPool::~IoContextPool() { Stop(); }
 void IoContextPool::WrapLoop(size_t index, fibers_ext::BlockingCounter* bc) {
   context_indx_ = index;
 
+  // The thread is pinned right after it starts, before the loop allocates anything.
+  if (FLAGS_io_context_numa) {
+    size_t cpu = cpu_idx_arr_[index] % thread::hardware_concurrency();
+    base::PreferLocalMemory(base::NumaTopology::Get().NodeOfCpu(cpu));
+  }
+
   auto& context = context_arr_[index];
   VLOG(1) << "Starting io thread " << index;
 
@@ -22,6 +22,10 @@ namespace util {
  *
  *  The main entry for launching asynchronous processes across all IO threads. For single thread
  *  manager see IoContext class.
+ *
+ *  Pools of at least kBroadcastTreeMin contexts pass the OnAll calls along a tree: the caller
+ *  posts to context 0 and each context posts to its kBroadcastFanout children before it runs
+ *  the task. The calls of a caller still reach each context in the order they were made.
  */
 class IoContextPool {
   template <typename Func, typename... Args>
@@ -31,6 +35,9 @@ class IoContextPool {
  public:
   using io_context = ::boost::asio::io_context;
 
+  static constexpr unsigned kBroadcastTreeMin = 16;
+  static constexpr unsigned kBroadcastFanout = 4;
+
   IoContextPool(const IoContextPool&) = delete;
   void operator=(const IoContextPool&) = delete;
 
@@ -65,13 +72,9 @@ class IoContextPool {
    * The 'func' must accept IoContext& as its argument.
    */
   template <typename Func, AcceptArgsCheck<Func, IoContext&> = 0> void AsyncOnAll(Func&& func) {
-    CheckRunningState();
-    for (unsigned i = 0; i < size(); ++i) {
-      IoContext& context = context_arr_[i];
-      // func must be copied, it can not be moved, because we dsitribute it into multiple
-      // IoContexts.
-      context.Async([&context, func] () mutable { func(context); });
-    }
+    AsyncOnAll([func = std::forward<Func>(func)](unsigned, IoContext& context) mutable {
+      func(context);
+    });
   }
 
   /*! @brief Runs func in all IO threads asynchronously.
@@ -83,9 +86,14 @@ class IoContextPool {
   template <typename Func, AcceptArgsCheck<Func, unsigned, IoContext&> = 0>
   void AsyncOnAll(Func&& func) {
     CheckRunningState();
+    if (size() >= kBroadcastTreeMin) {
+      PostSubtree(0, std::forward<Func>(func));
+      return;
+    }
     for (unsigned i = 0; i < size(); ++i) {
       IoContext& context = context_arr_[i];
-      // Copy func on purpose, see above.
+      // func must be copied, it can not be moved, because we dsitribute it into multiple
+      // IoContexts.
       context.Async([&context, i, func] () mutable { func(i, context); });
     }
   }
@@ -206,6 +214,18 @@ class IoContextPool {
   IoContext* GetThisContext();
 
  private:
+  // Runs func in context i after forwarding its copies to the children of i. The tree has no
+  // cycles, so the contexts waiting for a full task queue of a child do not deadlock.
+  template <typename Func> void PostSubtree(unsigned i, Func func) {
+    context_arr_[i].Async([this, i, func = std::move(func)]() mutable {
+      unsigned end = std::min<size_t>(size(), (i + 1) * kBroadcastFanout + 1);
+      for (unsigned child = i * kBroadcastFanout + 1; child < end; ++child) {
+        PostSubtree(child, func);
+      }
+      func(i, context_arr_[i]);
+    });
+  }
+
   void WrapLoop(size_t index, fibers_ext::BlockingCounter* bc);
   void CheckRunningState();
 
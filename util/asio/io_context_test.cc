@@ -1,6 +1,8 @@
 // Copyright 2018, Beeri 15.  All rights reserved.
 // Author: Roman Gershman (romange@gmail.com)
 //
+#include <gmock/gmock.h>
+
 #include <boost/asio.hpp>
 #include <chrono>
 
@@ -8,6 +10,7 @@
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "base/walltime.h"
+#include "util/asio/fiber_trace.h"
 #include "util/asio/glog_asio_sink.h"
 #include "util/asio/io_context_pool.h"
 
@@ -16,9 +19,12 @@ using namespace boost;
 using namespace asio;
 using namespace std::chrono_literals;
 
+DECLARE_bool(io_fiber_trace);
+
 namespace util {
 
 using fibers_ext::short_id;
+using testing::ElementsAre;
 
 namespace {
 
@@ -332,6 +338,93 @@ TEST_F(IoContextTest, AwaitOnAll) {
   }
 }
 
+TEST_F(IoContextTest, AwaitOnAllTree) {
+  constexpr unsigned kPoolSz = IoContextPool::kBroadcastTreeMin + 5;
+  IoContextPool pool(kPoolSz);
+  pool.Run();
+
+  // The calls reach every context once and in order.
+  std::vector<std::vector<unsigned>> calls(kPoolSz);
+  for (unsigned j = 0; j < 10; ++j) {
+    pool.AsyncOnAll([&, j](unsigned index, IoContext&) { calls[index].push_back(j); });
+  }
+  std::atomic_uint cnt{0};
+  pool.AwaitOnAll([&](IoContext&) { ++cnt; });
+  EXPECT_EQ(kPoolSz, cnt);
+
+  for (unsigned i = 0; i < kPoolSz; ++i) {
+    EXPECT_THAT(calls[i], ElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 8, 9)) << i;
+  }
+  pool.Stop();
+}
+
+TEST_F(IoContextTest, RemoteAsync) {
+  IoContext& cntx = pool_->GetNextContext();
+  constexpr unsigned kThreads = 4, kTasks = 10000;
+
+  // Written only in the context thread.
+  unsigned last[kThreads] = {0};
+  bool ordered = true;
+
+  std::thread ts[kThreads];
+  for (unsigned i = 0; i < kThreads; ++i) {
+    ts[i] = std::thread([&, i] {
+      for (unsigned j = 1; j <= kTasks; ++j) {
+        cntx.Async([&, i, j] {
+          ordered &= (last[i] + 1 == j);
+          last[i] = j;
+        });
+      }
+    });
+  }
+  for (unsigned i = 0; i < kThreads; ++i) {
+    ts[i].join();
+  }
+
+  // Await goes through the same queue, so it runs after all the tasks above.
+  cntx.Await([&] {
+    for (unsigned i = 0; i < kThreads; ++i)
+      EXPECT_EQ(kTasks, last[i]);
+  });
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(kThreads * kTasks + 1, cntx.remote_tasks());
+  EXPECT_LE(cntx.remote_batches(), cntx.remote_tasks());
+}
+
+TEST_F(IoContextTest, FiberTrace) {
+  FLAGS_io_fiber_trace = true;
+  IoContextPool pool(1);
+  pool.Run();
+  FLAGS_io_fiber_trace = false;
+
+  // Starves the thread for longer than --io_fiber_long_run_ms.
+  pool.GetNextContext().AwaitSafe([] {
+    this_fiber::properties<IoFiberProperties>().set_name("busy");
+    uint64_t start = base::GetMonotonicMicrosFast();
+    while (base::GetMonotonicMicrosFast() < start + 60000) {
+    }
+  });
+  pool.Stop();
+
+  auto find = [](const VarzValue::Map& map, const std::string& key) -> const VarzValue* {
+    for (const auto& k_v : map) {
+      if (k_v.first == key)
+        return &k_v.second;
+    }
+    return nullptr;
+  };
+
+  VarzValue::Map stats = FiberTracer::GetStats();
+  const VarzValue* long_runs = find(stats, "long_runs");
+  ASSERT_TRUE(long_runs);
+  EXPECT_GE(long_runs->num, 1);
+
+  const VarzValue* busy = find(find(stats, "fibers")->key_value_array, "busy");
+  ASSERT_TRUE(busy);
+  EXPECT_GE(find(busy->key_value_array, "max_run_ms")->num, 50);
+  EXPECT_NE(std::string::npos, find(stats, "last_long_run")->str.find("busy"));
+}
+
 TEST_F(IoContextTest, PlainFiberYield) {
   fibers::use_scheduling_algorithm<RRAlgo>();
   bool stop = false;
@@ -10,6 +10,8 @@
 
 namespace util {
 
+using namespace std;
+
 DEFINE_VARZ(VarzCount, task_hang_times);
 
 void PeriodicTask::Cancel() {
@@ -71,4 +73,26 @@ void PeriodicWorkerTask::Cancel() {
   VLOG(1) << "PeriodicWorkerTask::Cancel end";
 }
 
+void LoopLagMonitor::Run() {
+  using Clock = PeriodicTask::timer_t::clock_type;
+
+  // Mirrors PeriodicTask's schedule to know when each heartbeat was due.
+  Clock::time_point last = Clock::now();
+  pt_.Start([this, last](int ticks) mutable {
+    auto late = Clock::now() - (last + period_);
+    last += period_ * ticks;
+
+    int64_t sample = chrono::duration_cast<chrono::microseconds>(late).count();
+    sample = std::max<int64_t>(0, sample);
+    lag_usec_.store((uint64_t(lag_usec()) * 3 + sample) / 4, std::memory_order_relaxed);
+  });
+
+  done_.Wait();
+  pt_.Cancel();
+}
+
+void LoopLagMonitor::Cancel() {
+  done_.Notify();
+}
+
 }  // namespace util
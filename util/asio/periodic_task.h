@@ -137,5 +137,32 @@ class PeriodicWorkerTask {
   unsigned number_skips_ = 0;
 };
 
+// Heartbeat of an IoContext loop: measures by how much a periodic task fires late, i.e. for how
+// long the handlers and the fibers of the loop delay a new event. Runs as a Cancellable of the
+// context, see IoContext::AttachCancellable.
+class LoopLagMonitor : public IoContext::Cancellable {
+ public:
+  LoopLagMonitor(IoContext* cntx, PeriodicTask::duration_t period, uint32_t max_lag_usec)
+      : cntx_(*cntx), pt_(*cntx, period), period_(period), max_lag_usec_(max_lag_usec) {}
+
+  void Run() final;
+  void Cancel() final;
+
+  // Smoothed lag of the last heartbeats. Thread-safe.
+  uint32_t lag_usec() const { return lag_usec_.load(std::memory_order_relaxed); }
+
+  bool overloaded() const { return lag_usec() > max_lag_usec_; }
+
+  IoContext& context() { return cntx_; }
+
+ private:
+  IoContext& cntx_;
+  PeriodicTask pt_;
+  PeriodicTask::duration_t period_;
+  uint32_t max_lag_usec_;
+  std::atomic_uint32_t lag_usec_{0};
+  fibers_ext::Done done_;
+};
+
 }  // namespace util
 
@@ -126,4 +126,26 @@ TEST_F(PeriodicTest, Thread) {
   EXPECT_FALSE(err.empty());
 }
 
+TEST_F(PeriodicTest, LoopLag) {
+  IoContext& cntx = pool_.GetNextContext();
+  LoopLagMonitor* monitor = new LoopLagMonitor(&cntx, milliseconds(1), 5000);
+  cntx.AttachCancellable(monitor);
+  SleepForMilliseconds(10);
+  EXPECT_FALSE(monitor->overloaded()) << monitor->lag_usec();
+
+  // Stalls the loop, the heartbeat after the stall fires late.
+  cntx.Async([] {
+    auto start = steady_clock::now();
+    while (steady_clock::now() - start < milliseconds(40)) {
+    }
+  });
+
+  bool overloaded = false;
+  for (unsigned i = 0; i < 100 && !overloaded; ++i) {
+    overloaded = monitor->overloaded();
+    SleepForMilliseconds(1);
+  }
+  EXPECT_TRUE(overloaded);
+}
+
 }  // namespace util
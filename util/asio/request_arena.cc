@@ -0,0 +1,57 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/asio/request_arena.h"
+
+#include <vector>
+
+namespace util {
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kMaxPooled = 32;
+
+struct BufferPool {
+  vector<char*> buffers;
+
+  ~BufferPool() {
+    for (char* buf : buffers)
+      delete[] buf;
+  }
+};
+
+thread_local BufferPool buffer_pool;
+
+char* GetBuffer() {
+  if (buffer_pool.buffers.empty())
+    return new char[RequestArena::kInlineSize];
+
+  char* res = buffer_pool.buffers.back();
+  buffer_pool.buffers.pop_back();
+  return res;
+}
+
+}  // namespace
+
+RequestArena::RequestArena()
+    : buf_(GetBuffer()), mr_(buf_, kInlineSize, ::pmr::get_default_resource()) {
+}
+
+RequestArena::~RequestArena() {
+  mr_.release();
+
+  // The arena may die on another thread than it was created, its buffer then moves there.
+  if (buffer_pool.buffers.size() < kMaxPooled)
+    buffer_pool.buffers.push_back(buf_);
+  else
+    delete[] buf_;
+}
+
+size_t RequestArena::PooledBuffers() {
+  return buffer_pool.buffers.size();
+}
+
+}  // namespace util
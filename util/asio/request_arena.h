@@ -0,0 +1,40 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <pmr/monotonic_buffer_resource.h>
+
+namespace util {
+
+/**
+ * @brief Monotonic memory resource of a single server request, so that the temporary
+ * allocations of its handler are pointer bumps that are released at once with the arena.
+ *
+ * The first kInlineSize bytes come from a buffer of the per-thread pool, the rest from
+ * the default resource in growing chunks. The pool keeps a few buffers per thread, hence
+ * a server that handles a request at a time on each connection does not allocate them.
+ * Not thread-safe, like pmr::monotonic_buffer_resource.
+ */
+class RequestArena {
+ public:
+  static constexpr size_t kInlineSize = 8 << 10;
+
+  RequestArena();
+  ~RequestArena();
+
+  RequestArena(const RequestArena&) = delete;
+  void operator=(const RequestArena&) = delete;
+
+  pmr::memory_resource* resource() { return &mr_; }
+
+  //! The number of the inline buffers that the pool of the calling thread holds.
+  static size_t PooledBuffers();
+
+ private:
+  char* buf_;
+  pmr::monotonic_buffer_resource mr_;
+};
+
+}  // namespace util
@@ -0,0 +1,37 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/asio/request_arena.h"
+
+#include <pmr/vector.h>
+
+#include "base/gtest.h"
+
+namespace util {
+
+class RequestArenaTest : public testing::Test {};
+
+TEST_F(RequestArenaTest, Pool) {
+  {
+    RequestArena warmup1, warmup2;
+  }
+  size_t pooled = RequestArena::PooledBuffers();
+  ASSERT_GE(pooled, 2);
+
+  {
+    RequestArena arena;
+    EXPECT_EQ(pooled - 1, RequestArena::PooledBuffers());
+
+    // Grows beyond the inline buffer.
+    pmr::vector<int> vec(arena.resource());
+    for (int i = 0; i < 100000; ++i)
+      vec.push_back(i);
+    EXPECT_EQ(99999, vec.back());
+
+    RequestArena nested;
+    EXPECT_EQ(pooled - 2, RequestArena::PooledBuffers());
+  }
+  EXPECT_EQ(pooled, RequestArena::PooledBuffers());
+}
+
+}  // namespace util
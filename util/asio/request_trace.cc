@@ -0,0 +1,429 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/asio/request_trace.h"
+
+#include <boost/fiber/fss.hpp>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_double(trace_sample_rate, 0, "The fraction of the requests that start a trace, "
+                                    "see the request-trace varz and /tracez");
+DEFINE_uint32(trace_flush_ms, 1000, "How often the spans that the threads recorded are moved "
+                                    "into the buffer that /tracez serves");
+DEFINE_uint32(trace_keep_spans, 10000, "/tracez serves that many last spans");
+
+namespace util {
+
+using namespace std;
+using trace::SpanRecord;
+
+namespace {
+
+// Single producer ring: the owner thread pushes without locks and the collector drains it
+// under Collector::mu. A push reuses the slot of the span kCapacity spans back even if that one
+// was not drained yet. Like a seqlock, the collector detects the slots that were overwritten
+// while it copied them by reading claimed_ after the copy and discards them.
+class SpanRing {
+ public:
+  static constexpr unsigned kCapacity = 1024;
+
+  void Push(const SpanRecord& record) {
+    uint64_t index = claimed_.load(memory_order_relaxed);
+    claimed_.store(index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slots_[index % kCapacity] = record;
+    committed_.store(index + 1, memory_order_release);
+  }
+
+  // Appends the spans pushed since the last call to dest. Returns the number of the spans
+  // that were overwritten before they were drained.
+  uint64_t Drain(deque<SpanRecord>* dest);
+
+  uint64_t pushed() const { return committed_.load(memory_order_relaxed); }
+
+  // Set once the owner thread exits, the collector deletes the ring after draining it.
+  atomic_bool orphaned{false};
+
+ private:
+  SpanRecord slots_[kCapacity];
+  atomic_uint64_t claimed_{0}, committed_{0};
+  uint64_t tail_ = 0;
+};
+
+constexpr unsigned SpanRing::kCapacity;
+
+uint64_t SpanRing::Drain(deque<SpanRecord>* dest) {
+  uint64_t end = committed_.load(memory_order_acquire);
+  uint64_t dropped = 0;
+  if (end - tail_ > kCapacity) {
+    dropped = end - tail_ - kCapacity;
+    tail_ = end - kCapacity;
+  }
+
+  size_t start = dest->size();
+  for (uint64_t i = tail_; i < end; ++i) {
+    dest->push_back(slots_[i % kCapacity]);
+  }
+
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t claimed = claimed_.load(memory_order_relaxed);
+  if (claimed > tail_ + kCapacity) {
+    uint64_t overwritten = std::min(claimed - kCapacity, end) - tail_;
+    dest->erase(dest->begin() + start, dest->begin() + start + overwritten);
+    dropped += overwritten;
+  }
+  tail_ = end;
+
+  return dropped;
+}
+
+struct Collector {
+  mutex mu;
+  vector<SpanRing*> rings;
+  deque<SpanRecord> spans;
+  uint64_t retired_pushes = 0;  // Of the deleted rings.
+  uint64_t dropped = 0;
+
+  // Converts CycleClock to wall time.
+  uint64_t anchor_micros = GetCurrentTimeMicros();
+  uint64_t anchor_cycles = base::CycleClock::Now();
+
+  Collector() { std::thread(&Collector::Run, this).detach(); }
+
+  void Run() {
+    while (true) {
+      this_thread::sleep_for(chrono::milliseconds(std::max(FLAGS_trace_flush_ms, 10u)));
+      lock_guard<mutex> lk(mu);
+      Flush();
+    }
+  }
+
+  // Requires mu.
+  void Flush();
+
+  uint64_t ToWallMicros(uint64_t cycles) const {
+    if (cycles >= anchor_cycles)
+      return anchor_micros + base::CycleClock::ToMicros(cycles - anchor_cycles);
+    return anchor_micros - base::CycleClock::ToMicros(anchor_cycles - cycles);
+  }
+};
+
+void Collector::Flush() {
+  for (size_t i = 0; i < rings.size();) {
+    SpanRing* ring = rings[i];
+    bool orphaned = ring->orphaned.load(memory_order_acquire);
+    dropped += ring->Drain(&spans);
+    if (orphaned) {
+      retired_pushes += ring->pushed();
+      delete ring;
+      rings[i] = rings.back();
+      rings.pop_back();
+    } else {
+      ++i;
+    }
+  }
+
+  while (spans.size() > FLAGS_trace_keep_spans) {
+    spans.pop_front();
+  }
+}
+
+atomic<Collector*> collector_ptr{nullptr};
+
+// Created by the first span that ends, so the processes that do not trace have no flusher.
+Collector& GetCollector() {
+  static Collector* collector = [] {
+    Collector* res = new Collector;
+    collector_ptr.store(res, memory_order_release);
+    return res;
+  }();
+  return *collector;
+}
+
+struct ThreadRing {
+  SpanRing* ring = nullptr;
+
+  ~ThreadRing() {
+    if (ring)
+      ring->orphaned.store(true, memory_order_release);
+  }
+};
+
+thread_local ThreadRing this_ring;
+
+SpanRing* ThisRing() {
+  if (this_ring.ring)
+    return this_ring.ring;
+
+  SpanRing* ring = new SpanRing;
+  Collector& collector = GetCollector();
+  lock_guard<mutex> lk(collector.mu);
+  collector.rings.push_back(ring);
+  this_ring.ring = ring;
+  return ring;
+}
+
+// xorshift64*, seeded per thread.
+uint64_t NextRandom() {
+  static thread_local uint64_t state = 0;
+  if (state == 0) {
+    state = base::CycleClock::Now() ^ (hash<thread::id>{}(this_thread::get_id()) << 1) ^ 1;
+  }
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+uint64_t NewId() {
+  uint64_t id;
+  do {
+    id = NextRandom();
+  } while (id == 0);
+  return id;
+}
+
+// The scopes of the calling thread that are current for some fiber. While there are none,
+// TraceScope::Current() does not touch the fiber-local storage.
+thread_local unsigned active_scopes = 0;
+
+// The innermost scope of the fiber.
+boost::fibers::fiber_specific_ptr<TraceScope> current_scope{[](TraceScope*) {}};
+
+bool ParseHex(absl::string_view str, uint64_t* dest) {
+  uint64_t res = 0;
+  for (char c : str) {
+    unsigned digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    res = (res << 4) | digit;
+  }
+  *dest = res;
+  return true;
+}
+
+void AppendJsonString(absl::string_view str, string* dest) {
+  dest->push_back('"');
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      dest->push_back('\\');
+      dest->push_back(c);
+    } else if (c < 0x20) {
+      absl::StrAppendFormat(dest, "\\u%04x", c);
+    } else {
+      dest->push_back(c);
+    }
+  }
+  dest->push_back('"');
+}
+
+VarzValue::Map GetTraceStats() {
+  return trace::GetStats();
+}
+
+VarzFunction request_trace_varz("request-trace", GetTraceStats);
+
+}  // namespace
+
+string TraceContext::ToTraceparent() const {
+  return absl::StrFormat("00-%016x%016x-%016x-01", 0, trace_id, span_id);
+}
+
+TraceContext TraceContext::FromTraceparent(absl::string_view value) {
+  // version "-" trace-id "-" parent-id "-" flags, later versions may append fields.
+  TraceContext res;
+  if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-' ||
+      value.substr(0, 2) == "ff")
+    return res;
+
+  uint64_t high, low, span_id, flags;
+  if (!ParseHex(value.substr(3, 16), &high) || !ParseHex(value.substr(19, 16), &low) ||
+      !ParseHex(value.substr(36, 16), &span_id) || !ParseHex(value.substr(53, 2), &flags))
+    return res;
+
+  if ((flags & 1) == 0 || span_id == 0)
+    return res;
+
+  // Our trace ids are 64 bit, the lower half of the 128 bit ids identifies them well enough.
+  res.trace_id = low ? low : high;
+  res.span_id = res.trace_id ? span_id : 0;
+  return res;
+}
+
+TraceSpan& TraceSpan::operator=(TraceSpan&& other) noexcept {
+  if (this != &other) {
+    End();
+    ctx_ = other.ctx_;
+    parent_id_ = other.parent_id_;
+    start_ = other.start_;
+    name_ = other.name_;
+    kind_ = other.kind_;
+    annotation_size_ = other.annotation_size_;
+    memcpy(annotation_, other.annotation_, annotation_size_);
+    other.ctx_ = TraceContext{};
+  }
+  return *this;
+}
+
+TraceSpan TraceSpan::Start(const char* name, Kind kind, TraceContext parent, bool may_sample) {
+  TraceSpan res;
+  if (!parent) {
+    if (!may_sample || FLAGS_trace_sample_rate <= 0)
+      return res;
+    if (FLAGS_trace_sample_rate < 1 &&
+        (NextRandom() >> 11) * 0x1.0p-53 >= FLAGS_trace_sample_rate)
+      return res;
+    parent.trace_id = NewId();
+  }
+
+  res.ctx_.trace_id = parent.trace_id;
+  res.ctx_.span_id = NewId();
+  res.parent_id_ = parent.span_id;
+  res.start_ = base::CycleClock::Now();
+  res.name_ = name;
+  res.kind_ = kind;
+  return res;
+}
+
+TraceSpan TraceSpan::StartChild(const char* name, Kind kind, bool may_sample) {
+  return Start(name, kind, TraceScope::Current(), may_sample);
+}
+
+void TraceSpan::Annotate(absl::string_view text) {
+  if (!ctx_)
+    return;
+  annotation_size_ = std::min<size_t>(text.size(), kMaxAnnotation);
+  memcpy(annotation_, text.data(), annotation_size_);
+}
+
+void TraceSpan::Record() {
+  SpanRecord record;
+  record.trace_id = ctx_.trace_id;
+  record.span_id = ctx_.span_id;
+  record.parent_id = parent_id_;
+  record.start_cycles = start_;
+  record.end_cycles = base::CycleClock::Now();
+  record.name = name_;
+  record.kind = kind_;
+  record.annotation_size = annotation_size_;
+  memcpy(record.annotation, annotation_, annotation_size_);
+
+  ThisRing()->Push(record);
+  ctx_ = TraceContext{};
+}
+
+void TraceScope::Enter() {
+  if (!span_->sampled())
+    return;
+
+  prev_ = current_scope.get();
+  current_scope.reset(this);
+  ++active_scopes;
+  entered_ = true;
+}
+
+TraceScope::~TraceScope() {
+  if (entered_) {
+    current_scope.reset(prev_);
+    --active_scopes;
+  }
+}
+
+TraceContext TraceScope::Current() {
+  if (active_scopes == 0)
+    return TraceContext{};
+
+  const TraceScope* scope = current_scope.get();
+  return scope ? scope->span_->context() : TraceContext{};
+}
+
+namespace trace {
+
+vector<SpanRecord> CollectSpans(uint64_t trace_id) {
+  vector<SpanRecord> res;
+  Collector* collector = collector_ptr.load(memory_order_acquire);
+  if (!collector)
+    return res;
+
+  lock_guard<mutex> lk(collector->mu);
+  collector->Flush();
+  for (const SpanRecord& span : collector->spans) {
+    if (trace_id == 0 || span.trace_id == trace_id)
+      res.push_back(span);
+  }
+  return res;
+}
+
+void AppendZipkinJson(const vector<SpanRecord>& spans, string* dest) {
+  static const char* const kKinds[] = {nullptr, "CLIENT", "SERVER"};
+  const Collector* collector = collector_ptr.load(memory_order_acquire);
+  string service;
+  AppendJsonString(base::ProgramBaseName(), &service);
+
+  dest->push_back('[');
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const SpanRecord& span = spans[i];
+    if (i > 0)
+      dest->append(",\n");
+    absl::StrAppendFormat(dest, "{\"traceId\":\"%016x\",\"id\":\"%016x\"", span.trace_id,
+                          span.span_id);
+    if (span.parent_id)
+      absl::StrAppendFormat(dest, ",\"parentId\":\"%016x\"", span.parent_id);
+    dest->append(",\"name\":");
+    AppendJsonString(span.name, dest);
+    if (kKinds[span.kind])
+      absl::StrAppend(dest, ",\"kind\":\"", kKinds[span.kind], "\"");
+
+    uint64_t duration = base::CycleClock::ToMicros(span.end_cycles - span.start_cycles);
+    absl::StrAppend(dest, ",\"timestamp\":", collector->ToWallMicros(span.start_cycles),
+                    ",\"duration\":", std::max<uint64_t>(duration, 1),
+                    ",\"localEndpoint\":{\"serviceName\":", service, "}");
+    if (span.annotation_size) {
+      dest->append(",\"tags\":{\"annotation\":");
+      AppendJsonString(absl::string_view(span.annotation, span.annotation_size), dest);
+      dest->push_back('}');
+    }
+    dest->push_back('}');
+  }
+  dest->append("]\n");
+}
+
+VarzValue::Map GetStats() {
+  uint64_t recorded = 0, dropped = 0;
+  size_t buffered = 0;
+  if (Collector* collector = collector_ptr.load(memory_order_acquire)) {
+    lock_guard<mutex> lk(collector->mu);
+    recorded = collector->retired_pushes;
+    for (const SpanRing* ring : collector->rings) {
+      recorded += ring->pushed();
+    }
+    buffered = collector->spans.size();
+    dropped = collector->dropped;
+  }
+
+  VarzValue::Map res;
+  res.emplace_back("sample-rate", VarzValue::FromDouble(FLAGS_trace_sample_rate));
+  res.emplace_back("recorded", VarzValue::FromInt(recorded));
+  res.emplace_back("dropped", VarzValue::FromInt(dropped));
+  res.emplace_back("buffered", VarzValue::FromInt(buffered));
+  return res;
+}
+
+}  // namespace trace
+}  // namespace util
@@ -0,0 +1,146 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "util/stats/varz_value.h"
+
+namespace util {
+
+/**
+ * @brief Identifies a span of a sampled trace. Requests that are not traced have an empty
+ * context, i.e. trace_id == 0.
+ */
+struct TraceContext {
+  uint64_t trace_id = 0;
+  uint64_t span_id = 0;
+
+  explicit operator bool() const { return trace_id != 0; }
+
+  //! The value of the W3C traceparent header, "00-<trace id>-<span id>-01".
+  std::string ToTraceparent() const;
+
+  //! Returns an empty context unless value is a traceparent header with the sampled flag.
+  static TraceContext FromTraceparent(absl::string_view value);
+};
+
+/**
+ * @brief A span of a sampled request, recorded when it ends.
+ *
+ * The spans of a thread go into its ring buffer, which is lock-free for the recording thread,
+ * and a background thread moves them every --trace_flush_ms into the process-wide buffer of
+ * the last --trace_keep_spans spans. The timestamps come from base::CycleClock. /tracez on the
+ * status page serves them in Zipkin v2 JSON format and the "request-trace" varz counts them.
+ *
+ * A span that is not sampled is empty: starting and ending it takes a few branches, so the
+ * spans can be started on the hot paths.
+ */
+class TraceSpan {
+ public:
+  enum Kind : uint8_t { LOCAL = 0, CLIENT = 1, SERVER = 2 };
+
+  //! The annotation of a span is truncated to that many characters.
+  static constexpr unsigned kMaxAnnotation = 47;
+
+  TraceSpan() = default;
+  TraceSpan(TraceSpan&& other) noexcept { *this = std::move(other); }
+  TraceSpan& operator=(TraceSpan&& other) noexcept;
+
+  ~TraceSpan() { End(); }
+
+  //! Starts a child span of parent. If parent is empty and may_sample is set, starts a new
+  //! trace with the probability --trace_sample_rate, otherwise the span is empty.
+  //! name must outlive the process, i.e. be a string literal.
+  static TraceSpan Start(const char* name, Kind kind, TraceContext parent, bool may_sample);
+
+  //! Starts a child span of the current span of the calling fiber, see TraceScope.
+  static TraceSpan StartChild(const char* name, Kind kind, bool may_sample = false);
+
+  //! Records the span into the ring of the calling thread. Does nothing if the span is empty
+  //! or has already ended.
+  void End() {
+    if (ctx_)
+      Record();
+  }
+
+  //! Attaches text to the span, for example the path of an http request.
+  void Annotate(absl::string_view text);
+
+  bool sampled() const { return bool(ctx_); }
+  const TraceContext& context() const { return ctx_; }
+
+ private:
+  void Record();
+
+  TraceContext ctx_;
+  uint64_t parent_id_ = 0;
+  uint64_t start_ = 0;
+  const char* name_ = nullptr;
+  Kind kind_ = LOCAL;
+  uint8_t annotation_size_ = 0;
+  char annotation_[kMaxAnnotation];
+};
+
+/**
+ * @brief Makes a span current for the calling fiber during the lifetime of the scope, so the
+ * spans that the fiber starts meanwhile are its children. Empty spans do not touch the
+ * fiber-local state. Scopes must be nested within a fiber.
+ */
+class TraceScope {
+ public:
+  //! span must not move while the scope lives.
+  explicit TraceScope(TraceSpan* span) : span_(span) { Enter(); }
+
+  //! Starts a span that ends with the scope, see TraceSpan::Start.
+  TraceScope(const char* name, TraceSpan::Kind kind, TraceContext parent, bool may_sample)
+      : own_span_(TraceSpan::Start(name, kind, parent, may_sample)), span_(&own_span_) {
+    Enter();
+  }
+
+  ~TraceScope();
+
+  TraceSpan& span() { return *span_; }
+
+  //! The context of the innermost scope of the calling fiber, empty if it has none.
+  static TraceContext Current();
+
+ private:
+  void Enter();
+
+  TraceSpan own_span_;
+  TraceSpan* span_;
+  TraceScope* prev_ = nullptr;  // The scope that this one shadows.
+  bool entered_ = false;
+
+  TraceScope(const TraceScope&) = delete;
+  void operator=(const TraceScope&) = delete;
+};
+
+namespace trace {
+
+struct SpanRecord {
+  uint64_t trace_id, span_id, parent_id;
+  uint64_t start_cycles, end_cycles;
+  const char* name;
+  TraceSpan::Kind kind;
+  uint8_t annotation_size;
+  char annotation[TraceSpan::kMaxAnnotation];
+};
+
+//! Moves the spans that the threads recorded into the process-wide buffer and returns the
+//! buffered spans of trace_id or all of them if it is 0, the oldest first.
+std::vector<SpanRecord> CollectSpans(uint64_t trace_id = 0);
+
+//! Appends spans as a Zipkin v2 JSON array.
+void AppendZipkinJson(const std::vector<SpanRecord>& spans, std::string* dest);
+
+//! The counters of the "request-trace" varz.
+VarzValue::Map GetStats();
+
+}  // namespace trace
+}  // namespace util
@@ -0,0 +1,164 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/asio/request_trace.h"
+
+#include <boost/fiber/fiber.hpp>
+#include <boost/fiber/operations.hpp>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+DECLARE_double(trace_sample_rate);
+
+namespace util {
+
+using namespace std;
+using namespace boost;
+using trace::SpanRecord;
+
+class RequestTraceTest : public testing::Test {
+ protected:
+  void SetUp() override { FLAGS_trace_sample_rate = 1; }
+
+  void TearDown() override { FLAGS_trace_sample_rate = 0; }
+};
+
+TEST_F(RequestTraceTest, Traceparent) {
+  TraceContext ctx{0x0123456789abcdef, 0xfedcba9876543210ULL};
+  string header = ctx.ToTraceparent();
+  EXPECT_EQ("00-00000000000000000123456789abcdef-fedcba9876543210-01", header);
+
+  TraceContext parsed = TraceContext::FromTraceparent(header);
+  EXPECT_EQ(ctx.trace_id, parsed.trace_id);
+  EXPECT_EQ(ctx.span_id, parsed.span_id);
+
+  // Not sampled, bad version, uppercase hex and truncated.
+  EXPECT_FALSE(TraceContext::FromTraceparent(
+      "00-00000000000000000123456789abcdef-fedcba9876543210-00"));
+  EXPECT_FALSE(TraceContext::FromTraceparent(
+      "ff-00000000000000000123456789abcdef-fedcba9876543210-01"));
+  EXPECT_FALSE(TraceContext::FromTraceparent(
+      "00-00000000000000000123456789ABCDEF-fedcba9876543210-01"));
+  EXPECT_FALSE(TraceContext::FromTraceparent("00-0123456789abcdef-fedcba9876543210-01"));
+  EXPECT_FALSE(TraceContext::FromTraceparent(
+      "00-00000000000000000000000000000000-fedcba9876543210-01"));
+}
+
+TEST_F(RequestTraceTest, Sampling) {
+  FLAGS_trace_sample_rate = 0;
+  TraceSpan span = TraceSpan::Start("root", TraceSpan::SERVER, TraceContext{}, true);
+  EXPECT_FALSE(span.sampled());
+
+  // A sampled parent is always followed.
+  TraceContext parent{42, 7};
+  span = TraceSpan::Start("child", TraceSpan::SERVER, parent, false);
+  ASSERT_TRUE(span.sampled());
+  EXPECT_EQ(42, span.context().trace_id);
+  EXPECT_NE(7, span.context().span_id);
+
+  FLAGS_trace_sample_rate = 1;
+  EXPECT_FALSE(TraceSpan::Start("root", TraceSpan::LOCAL, TraceContext{}, false).sampled());
+  EXPECT_TRUE(TraceSpan::Start("root", TraceSpan::LOCAL, TraceContext{}, true).sampled());
+
+  FLAGS_trace_sample_rate = 0.25;
+  unsigned sampled = 0;
+  for (unsigned i = 0; i < 4000; ++i) {
+    TraceSpan root = TraceSpan::Start("root", TraceSpan::LOCAL, TraceContext{}, true);
+    sampled += root.sampled();
+  }
+  EXPECT_GT(sampled, 800);
+  EXPECT_LT(sampled, 1200);
+}
+
+TEST_F(RequestTraceTest, Scopes) {
+  EXPECT_FALSE(TraceScope::Current());
+
+  TraceContext root_ctx, child_ctx;
+  {
+    TraceScope root("root", TraceSpan::SERVER, TraceContext{}, true);
+    root.span().Annotate("/path");
+    root_ctx = root.span().context();
+    ASSERT_TRUE(root_ctx);
+    EXPECT_EQ(root_ctx.span_id, TraceScope::Current().span_id);
+
+    // The context is per fiber.
+    fibers::fiber other([&] {
+      EXPECT_FALSE(TraceScope::Current());
+      TraceScope scope("other", TraceSpan::LOCAL, TraceContext{}, false);
+      EXPECT_FALSE(TraceScope::Current());
+    });
+
+    TraceSpan child = TraceSpan::StartChild("child", TraceSpan::CLIENT);
+    child_ctx = child.context();
+    {
+      TraceScope child_scope(&child);
+      EXPECT_EQ(child_ctx.span_id, TraceScope::Current().span_id);
+      this_fiber::yield();
+    }
+    EXPECT_EQ(root_ctx.span_id, TraceScope::Current().span_id);
+    other.join();
+  }
+  EXPECT_FALSE(TraceScope::Current());
+
+  vector<SpanRecord> spans = trace::CollectSpans(root_ctx.trace_id);
+  ASSERT_EQ(2, spans.size());
+
+  // The child ends first.
+  EXPECT_STREQ("child", spans[0].name);
+  EXPECT_EQ(child_ctx.span_id, spans[0].span_id);
+  EXPECT_EQ(root_ctx.span_id, spans[0].parent_id);
+  EXPECT_EQ(TraceSpan::CLIENT, spans[0].kind);
+  EXPECT_STREQ("root", spans[1].name);
+  EXPECT_EQ(0, spans[1].parent_id);
+  EXPECT_LE(spans[1].start_cycles, spans[0].start_cycles);
+  EXPECT_GE(spans[1].end_cycles, spans[0].end_cycles);
+
+  string json;
+  trace::AppendZipkinJson(spans, &json);
+  EXPECT_NE(string::npos, json.find("\"kind\":\"SERVER\""));
+  EXPECT_NE(string::npos, json.find("\"tags\":{\"annotation\":\"/path\"}"));
+  char parent[64];
+  snprintf(parent, sizeof(parent), "\"parentId\":\"%016lx\"", root_ctx.span_id);
+  EXPECT_NE(string::npos, json.find(parent)) << json;
+}
+
+TEST_F(RequestTraceTest, Threads) {
+  constexpr unsigned kSpans = 100;
+  TraceContext parent{1234, 1};
+
+  // The rings of the exited threads are drained before they are deleted.
+  vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (unsigned i = 0; i < kSpans; ++i) {
+        TraceSpan::Start("work", TraceSpan::LOCAL, parent, false);
+      }
+    });
+  }
+  for (auto& th : threads)
+    th.join();
+
+  EXPECT_EQ(4 * kSpans, trace::CollectSpans(parent.trace_id).size());
+}
+
+TEST_F(RequestTraceTest, Overflow) {
+  TraceContext parent{5678, 1};
+  for (unsigned i = 0; i < 3000; ++i) {
+    TraceSpan::Start("work", TraceSpan::LOCAL, parent, false);
+  }
+
+  vector<SpanRecord> spans = trace::CollectSpans(parent.trace_id);
+  EXPECT_GT(spans.size(), 0);
+  EXPECT_LE(spans.size(), 1024);
+
+  int64_t dropped = 0;
+  for (const auto& k_v : trace::GetStats()) {
+    if (k_v.first == "dropped")
+      dropped = k_v.second.num;
+  }
+  EXPECT_GE(dropped, 3000 - 1024);
+}
+
+}  // namespace util
@@ -12,6 +12,7 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "base/logging.h"
+#include "util/http/https_client.h"
 
 namespace util {
 
@@ -21,30 +22,22 @@ namespace h2 = beast::http;
 
 namespace {
 
-void HMAC(absl::string_view key, absl::string_view msg, char dest[SHA256_DIGEST_LENGTH]) {
-  HMAC_CTX* hmac = HMAC_CTX_new();
-
-  CHECK_EQ(1, HMAC_CTX_reset(hmac));
-  CHECK_EQ(1, HMAC_Init_ex(hmac, reinterpret_cast<const uint8_t*>(key.data()), key.size(),
-                           EVP_sha256(), NULL));
-
-  CHECK_EQ(1, HMAC_Update(hmac, reinterpret_cast<const uint8_t*>(msg.data()), msg.size()));
-
-  uint8_t* ptr = reinterpret_cast<uint8_t*>(dest);
-  unsigned len = 32;
-  CHECK_EQ(1, HMAC_Final(hmac, ptr, &len));
-  HMAC_CTX_free(hmac);
-  CHECK_EQ(len, 32);
+void HmacSha256(absl::string_view key, absl::string_view msg, char dest[SHA256_DIGEST_LENGTH]) {
+  // The one-shot variant does not allocate a context per call.
+  unsigned len = 0;
+  CHECK(HMAC(EVP_sha256(), key.data(), key.size(), reinterpret_cast<const uint8_t*>(msg.data()),
+             msg.size(), reinterpret_cast<uint8_t*>(dest), &len));
+  CHECK_EQ(len, SHA256_DIGEST_LENGTH);
 }
 
 string GetSignatureKey(absl::string_view key, absl::string_view datestamp, absl::string_view region,
                        absl::string_view service) {
   char sign[32];
   absl::string_view sign_key{sign, sizeof(sign)};
-  HMAC(absl::StrCat("AWS4", key), datestamp, sign);
-  HMAC(sign_key, region, sign);
-  HMAC(sign_key, service, sign);
-  HMAC(sign_key, "aws4_request", sign);
+  HmacSha256(absl::StrCat("AWS4", key), datestamp, sign);
+  HmacSha256(sign_key, region, sign);
+  HmacSha256(sign_key, service, sign);
+  HmacSha256(sign_key, "aws4_request", sign);
 
   return string(sign_key);
 }
@@ -73,48 +66,43 @@ constexpr char kAlgo[] = "AWS4-HMAC-SHA256";
 
 namespace detail {
 
-void Sha256String(absl::string_view str, char out[65]) {
-  unsigned char hash[SHA256_DIGEST_LENGTH];
-
-#if 0
-  EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
-  CHECK(mdctx);
-
-	CHECK_EQ(1, EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL));
-
-	CHECK_EQ(1, EVP_DigestUpdate(mdctx, str.data(), str.size()));
-
-  unsigned int len = 0;
-	CHECK_EQ(1, EVP_DigestFinal_ex(mdctx, hash, &len));
-  CHECK_EQ(SHA256_DIGEST_LENGTH, len);
+void Sha256Hasher::Reset() {
+  CHECK_EQ(1, SHA256_Init(&ctx_));
+}
 
-	EVP_MD_CTX_free(mdctx);
+void Sha256Hasher::Update(absl::string_view str) {
+  SHA256_Update(&ctx_, str.data(), str.size());
+}
 
-#else
-  SHA256_CTX sha256;
-  SHA256_Init(&sha256);
-  SHA256_Update(&sha256, str.data(), str.size());
-  SHA256_Final(hash, &sha256);
-#endif
+void Sha256Hasher::Update(const ::boost::beast::multi_buffer& mb) {
+  for (const auto& e : mb.cdata()) {
+    SHA256_Update(&ctx_, e.data(), e.size());
+  }
+}
 
+void Sha256Hasher::Finalize(char out[65]) {
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  SHA256_Final(hash, &ctx_);
   Hexify(reinterpret_cast<const char*>(hash), SHA256_DIGEST_LENGTH, out);
+  Reset();
 }
 
-void Sha256String(const ::boost::beast::multi_buffer& mb, char out[65]) {
-  unsigned char hash[SHA256_DIGEST_LENGTH];
-  SHA256_CTX sha256;
-  SHA256_Init(&sha256);
+void Sha256String(absl::string_view str, char out[65]) {
+  Sha256Hasher hasher;
+  hasher.Update(str);
+  hasher.Finalize(out);
+}
 
-  for (const auto& e: mb.cdata()) {
-    SHA256_Update(&sha256, e.data(), e.size());
-  }
-  SHA256_Final(hash, &sha256);
-  Hexify(reinterpret_cast<const char*>(hash), SHA256_DIGEST_LENGTH, out);
+void Sha256String(const ::boost::beast::multi_buffer& mb, char out[65]) {
+  Sha256Hasher hasher;
+  hasher.Update(mb);
+  hasher.Finalize(out);
 }
 
 }  // namespace detail
 
 const char AWS::kHashEmpty[] = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+const char AWS::kUnsignedPayload[] = "UNSIGNED-PAYLOAD";
 
 ::boost::asio::ssl::context AWS::CheckedSslContext() {
   system::error_code ec;
@@ -132,6 +120,7 @@ const char AWS::kHashEmpty[] = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934c
   if (ec) {
     LOG(FATAL) << "Could not load certificates file" << ec;
   }
+  http::EnableClientSessionCache(&cntx);
 
   return cntx;
 }
@@ -154,23 +143,41 @@ Status AWS::Init() {
   struct tm tm_s;
   CHECK(&tm_s == gmtime_r(&now, &tm_s));
 
-  CHECK_GT(strftime(date_str_, arraysize(date_str_), "%Y%m%d", &tm_s), 0);
-  sign_key_ = GetSignatureKey(secret_, date_str_, region_id_, service_);
-
-  credential_scope_ = absl::StrCat(date_str_, "/", region_id_, "/", service_, "/", "aws4_request");
+  char date_str[16];
+  CHECK_GT(strftime(date_str, arraysize(date_str), "%Y%m%d", &tm_s), 0);
+  GetSignKey(date_str);
 
   return Status::OK;
 }
 
-// TODO: to support date refreshes - i.e. to update sign_key_, credential_scope_
-// if the current has changed.
-void AWS::Sign(absl::string_view domain, absl::string_view sha256,
+auto AWS::GetSignKey(absl::string_view date) const -> std::shared_ptr<const SignKey> {
+  std::shared_ptr<const SignKey> res = std::atomic_load(&sign_key_);
+  if (res && date == res->date)
+    return res;
+
+  std::lock_guard<fibers::mutex> lk(mu_);
+  res = sign_key_;  // Another fiber could derive it while we waited.
+  if (res && date == res->date)
+    return res;
+
+  CHECK_LT(date.size(), sizeof(SignKey::date));
+  auto key = std::make_shared<SignKey>();
+  memcpy(key->date, date.data(), date.size());
+  key->date[date.size()] = '\0';
+  key->key = GetSignatureKey(secret_, date, region_id_, service_);
+  key->credential_scope = absl::StrCat(date, "/", region_id_, "/", service_, "/", "aws4_request");
+  VLOG(1) << "Derived the signing key for " << key->credential_scope;
+
+  res = std::move(key);
+  std::atomic_store(&sign_key_, res);
+
+  return res;
+}
+
+void AWS::Sign(absl::string_view domain, absl::string_view sha256, time_t now,
                ::boost::beast::http::header<true, ::boost::beast::http::fields>* header) const {
   header->set(h2::field::host, domain);
 
-  // We show consider to pass it via argument to make the function test-friendly.
-  time_t now = time(nullptr);  // Must be recent (upto 900sec skew is allowed vs amazon servers).
-
   struct tm tm_s;
   CHECK(&tm_s == gmtime_r(&now, &tm_s));
 
@@ -179,55 +186,69 @@ void AWS::Sign(absl::string_view domain, absl::string_view sha256,
   CHECK_GT(strftime(amz_date, arraysize(amz_date), "%Y%m%dT%H%M00Z", &tm_s), 0);
   VLOG(1) << "Time now: " << now;
 
+  // The date prefix of amz_date must match the date of the credential scope.
+  std::shared_ptr<const SignKey> sign_key = GetSignKey(absl::string_view{amz_date, 8});
+
   header->set("x-amz-date", amz_date);
   header->set("x-amz-content-sha256", sha256);
 
-  string canonical_headers = absl::StrCat("host", ":", domain, "\n");
+  string canonical_headers;
+  canonical_headers.reserve(domain.size() + sha256.size() + 64);
+  absl::StrAppend(&canonical_headers, "host", ":", domain, "\n");
   absl::StrAppend(&canonical_headers, "x-amz-content-sha256", ":", sha256, "\n");
   absl::StrAppend(&canonical_headers, "x-amz-date", ":", amz_date, "\n");
 
   string auth_header =
       AuthHeader(absl_sv(header->method_string()), canonical_headers, absl_sv(header->target()),
-                 sha256, amz_date);
+                 sha256, amz_date, *sign_key);
 
   header->set(h2::field::authorization, auth_header);
 }
 
 string AWS::AuthHeader(absl::string_view method, absl::string_view headers,
                        absl::string_view target, absl::string_view content_sha256,
-                       absl::string_view amz_date) const {
+                       absl::string_view amz_date, const SignKey& sign_key) const {
   size_t pos = target.find('?');
   absl::string_view url = target.substr(0, pos);
-  absl::string_view query_string;
-  string canonical_querystring;
+  absl::string_view canonical_querystring;
+  string sorted_querystring;
 
   if (pos != string::npos) {
-    query_string = target.substr(pos + 1);
-
-    // We must sign query string with params in alphabetical order
-    vector<absl::string_view> params = absl::StrSplit(query_string, "&", absl::SkipWhitespace{});
-    sort(params.begin(), params.end());
-    canonical_querystring = absl::StrJoin(params, "&");
+    canonical_querystring = target.substr(pos + 1);
+
+    // We must sign query string with params in alphabetical order.
+    // Most requests have a single parameter that is already canonical.
+    if (canonical_querystring.find('&') != absl::string_view::npos) {
+      vector<absl::string_view> params =
+          absl::StrSplit(canonical_querystring, "&", absl::SkipWhitespace{});
+      sort(params.begin(), params.end());
+      sorted_querystring = absl::StrJoin(params, "&");
+      canonical_querystring = sorted_querystring;
+    }
   }
 
-  string canonical_request = absl::StrCat(method, "\n", url, "\n", canonical_querystring, "\n");
-  string signed_headers = "host;x-amz-content-sha256;x-amz-date";
-  absl::StrAppend(&canonical_request, headers, "\n", signed_headers, "\n", content_sha256);
+  constexpr char kSignedHeaders[] = "host;x-amz-content-sha256;x-amz-date";
+
+  string canonical_request;
+  canonical_request.reserve(method.size() + target.size() + headers.size() +
+                            content_sha256.size() + sizeof(kSignedHeaders) + 8);
+  absl::StrAppend(&canonical_request, method, "\n", url, "\n", canonical_querystring, "\n");
+  absl::StrAppend(&canonical_request, headers, "\n", kSignedHeaders, "\n", content_sha256);
   VLOG(1) << "CanonicalRequest:\n" << canonical_request << "\n-------------------\n";
 
   char hexdigest[65];
   detail::Sha256String(canonical_request, hexdigest);
 
   string string_to_sign =
-      absl::StrCat(kAlgo, "\n", amz_date, "\n", credential_scope_, "\n", hexdigest);
+      absl::StrCat(kAlgo, "\n", amz_date, "\n", sign_key.credential_scope, "\n", hexdigest);
 
   char signature[SHA256_DIGEST_LENGTH];
-  HMAC(sign_key_, string_to_sign, signature);
+  HmacSha256(sign_key.key, string_to_sign, signature);
   Hexify(signature, SHA256_DIGEST_LENGTH, hexdigest);
 
   string authorization_header =
-      absl::StrCat(kAlgo, " Credential=", access_key_, "/", credential_scope_,
-                   ",SignedHeaders=", signed_headers, ",Signature=", hexdigest);
+      absl::StrCat(kAlgo, " Credential=", access_key_, "/", sign_key.credential_scope,
+                   ",SignedHeaders=", kSignedHeaders, ",Signature=", hexdigest);
 
   return authorization_header;
 }
@@ -9,6 +9,8 @@
 #include <boost/beast/core/multi_buffer.hpp>
 #include <boost/beast/http/message.hpp>
 #include <boost/fiber/mutex.hpp>
+#include <memory>
+#include <openssl/sha.h>
 
 #include "absl/strings/string_view.h"
 #include "util/status.h"
@@ -29,6 +31,12 @@ class AWS {
   // See: https://docs.aws.amazon.com/general/latest/gr/s3.html
   //
   void Sign(absl::string_view domain, absl::string_view body_hash256,
+            ::boost::beast::http::header<true, ::boost::beast::http::fields>* header) const {
+    Sign(domain, body_hash256, time(nullptr), header);
+  }
+
+  //! Signs the request as if it was sent at 'now'.
+  void Sign(absl::string_view domain, absl::string_view body_hash256, time_t now,
             ::boost::beast::http::header<true, ::boost::beast::http::fields>* header) const;
 
   void SignEmpty(absl::string_view domain,
@@ -36,27 +44,58 @@ class AWS {
     return Sign(domain, absl::string_view{kHashEmpty, 64}, header);
   }
 
+  //! Signs the request without hashing its payload. Should be used only over https.
+  void SignUnsigned(
+      absl::string_view domain,
+      ::boost::beast::http::header<true, ::boost::beast::http::fields>* header) const {
+    return Sign(domain, kUnsignedPayload, header);
+  }
+
   static ::boost::asio::ssl::context CheckedSslContext();
 
+  static const char kHashEmpty[];  // SHA-256 of the empty payload.
+  static const char kUnsignedPayload[];
+
  private:
+  // The signing key is derived from the secret, the date, the region and the service,
+  // so it changes once a day.
+  struct SignKey {
+    char date[16];
+    std::string key, credential_scope;
+  };
 
-  static const char kHashEmpty[];
+  // Returns the key for date, derives it if the date has changed.
+  std::shared_ptr<const SignKey> GetSignKey(absl::string_view date) const;
 
   std::string AuthHeader(absl::string_view method, absl::string_view headers,
                          absl::string_view target, absl::string_view content_sha256,
-                         absl::string_view amz_date) const;
+                         absl::string_view amz_date, const SignKey& sign_key) const;
 
   std::string region_id_, service_, secret_, access_key_;
 
+  // Guards the derivation of sign_key_, which is read with atomic_load.
   mutable ::boost::fibers::mutex mu_;
-  mutable std::string sign_key_;
-
-  std::string credential_scope_;
-  char date_str_[32];
+  mutable std::shared_ptr<const SignKey> sign_key_;
 };
 
 namespace detail {
 
+//! Incremental SHA-256 of a payload that is appended piece by piece.
+class Sha256Hasher {
+ public:
+  Sha256Hasher() { Reset(); }
+
+  void Reset();
+  void Update(absl::string_view str);
+  void Update(const ::boost::beast::multi_buffer& mb);
+
+  //! Writes the hex digest of the data so far to out and resets the hasher.
+  void Finalize(char out[65]);
+
+ private:
+  SHA256_CTX ctx_;
+};
+
 void Sha256String(absl::string_view str, char out[65]);
 void Sha256String(const ::boost::beast::multi_buffer& mb, char out[65]);
 
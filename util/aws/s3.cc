@@ -11,6 +11,9 @@
 #include <boost/beast/http/dynamic_body.hpp>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/string_body.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <deque>
 
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
@@ -29,6 +32,10 @@
 namespace util {
 
 DEFINE_uint32(s3_upload_buf_mb, 5, "Upload buffer size in MB. must be at least 5MB");
+DEFINE_uint32(s3_upload_inflight, 4, "Maximal number of parts of a file that are uploaded at once.");
+DEFINE_bool(s3_sign_payload, false,
+            "If true, upload parts are signed with their SHA-256, hashed while the part is "
+            "filled. Otherwise they are sent with UNSIGNED-PAYLOAD and rely on TLS integrity.");
 
 using file::ReadonlyFile;
 using http::HttpsClientPool;
@@ -72,6 +79,8 @@ inline void SetRange(size_t from, size_t to, h2::fields* flds) {
   flds->set(h2::field::range, std::move(tmp));
 }
 
+constexpr unsigned kMaxRangeRetries = 3;
+
 inline const char* as_char(const xmlChar* var) {
   return reinterpret_cast<const char*>(var);
 }
@@ -121,6 +130,64 @@ class S3ReadFile : public ReadonlyFile {
   size_t size_ = 0, offs_ = 0;
 };
 
+/*! Reads the object with concurrent range requests of window_size bytes. Up to max_inflight
+    windows that follow the read offset are requested at once, each over its own connection
+    of the pool, and are consumed in order. A read at another offset drops the windows and
+    restarts the read-ahead there. The dropped requests are completed rather than aborted so
+    their connections return to the pool without a reconnect.
+*/
+class S3ReadAheadFile : public ReadonlyFile {
+ public:
+  using error_code = ::boost::system::error_code;
+
+  S3ReadAheadFile(const AWS& aws, HttpsClientPool* pool, absl::string_view key_path,
+                  unsigned max_inflight, size_t window_size);
+
+  ~S3ReadAheadFile() final;
+
+  StatusObject<size_t> Read(size_t offset, const strings::MutableByteRange& range) final;
+
+  Status Close() final;
+
+  size_t Size() const final {
+    return size_;
+  }
+
+  int Handle() const final {
+    return -1;
+  }
+
+  // Fetches the size of the object.
+  Status Open();
+
+ private:
+  struct Window {
+    size_t offset = 0, size = 0;
+    std::unique_ptr<uint8_t[]> data;
+    Status status;
+    fibers::fiber fb;
+  };
+
+  // Requests the windows that follow the last one until max_inflight_ are in flight.
+  void ReadAhead();
+
+  // Waits for the windows and drops them.
+  void DropWindows();
+
+  // Reads the range [offset, offset + size) of the object into dest.
+  Status FetchRange(size_t offset, size_t size, uint8_t* dest);
+
+  const AWS& aws_;
+  HttpsClientPool* pool_;
+  string url_;
+  const unsigned max_inflight_;
+  const size_t window_size_;
+
+  std::deque<std::unique_ptr<Window>> windows_;  // In the order of their offsets.
+  size_t next_offset_ = 0;  // Offset of the window that is requested next.
+  size_t size_ = 0;
+};
+
 class S3WriteFile : public file::WriteFile {
  public:
   /**
@@ -141,16 +208,28 @@ class S3WriteFile : public file::WriteFile {
  private:
   size_t FillBuf(const uint8* buffer, size_t length);
 
+  // Starts uploading body_mb_ as the next part once less than --s3_upload_inflight parts are
+  // uploaded.
   Status Upload();
 
+  Status UploadPart(const h2::request<h2::dynamic_body>& req, size_t id);
+
+  void JoinUploads();
+
   const AWS& aws_;
 
   string upload_id_;
   beast::multi_buffer body_mb_;
+  detail::Sha256Hasher body_hash_;  // With --s3_sign_payload.
   size_t uploaded_ = 0;
   HttpsClientPool* pool_;
   std::vector<string> parts_;
   std::vector<fibers::fiber> uploads_;
+
+  fibers::mutex mu_;
+  fibers::condition_variable cv_;
+  unsigned inflight_ = 0;
+  Status status_;  // The first error of the part uploads.
 };
 
 S3ReadFile::~S3ReadFile() {
@@ -286,6 +365,186 @@ Status S3ReadFile::Close() {
   return Status::OK;
 }
 
+S3ReadAheadFile::S3ReadAheadFile(const AWS& aws, HttpsClientPool* pool,
+                                 absl::string_view key_path, unsigned max_inflight,
+                                 size_t window_size)
+    : aws_(aws), pool_(pool), url_(absl::StrCat("/", key_path)), max_inflight_(max_inflight),
+      window_size_(window_size) {
+  CHECK_GT(max_inflight_, 0);
+  CHECK_GT(window_size_, 0);
+}
+
+S3ReadAheadFile::~S3ReadAheadFile() {
+  DropWindows();
+}
+
+Status S3ReadAheadFile::Open() {
+  h2::request<h2::empty_body> req{h2::verb::head, url_, 11};
+  aws_.SignEmpty(pool_->domain(), &req);
+
+  HttpsClientPool::ClientHandle handle = pool_->GetHandle();
+  system::error_code ec = handle->Send(req);
+  if (ec) {
+    return ToStatus(ec);
+  }
+
+  // HEAD responses have no body.
+  h2::response_parser<h2::empty_body> parser;
+  parser.skip(true);
+  ec = handle->ReadHeader(&parser);
+  if (ec) {
+    return ToStatus(ec);
+  }
+  if (!parser.keep_alive()) {
+    handle->schedule_reconnect();
+  }
+
+  const auto& msg = parser.get();
+  if (msg.result() != h2::status::ok) {
+    LOG(INFO) << "OpenError: " << msg.reason();
+
+    return Status(StatusCode::IO_ERROR, string(msg.reason()));
+  }
+
+  auto content_len_it = msg.find(h2::field::content_length);
+  if (content_len_it == msg.end() ||
+      !absl::SimpleAtoi(absl_sv(content_len_it->value()), &size_)) {
+    return Status(StatusCode::PARSE_ERROR, "Object has no content length");
+  }
+  VLOG(1) << "Opened " << url_ << " of size " << size_;
+
+  return Status::OK;
+}
+
+StatusObject<size_t> S3ReadAheadFile::Read(size_t offset, const strings::MutableByteRange& range) {
+  CHECK(!range.empty());
+  CHECK(pool_->io_context().InContextThread());
+
+  // Drops the windows that were consumed.
+  while (!windows_.empty() && windows_.front()->offset + windows_.front()->size <= offset) {
+    windows_.front()->fb.join();
+    windows_.pop_front();
+  }
+
+  if (windows_.empty() ? offset != next_offset_ : offset < windows_.front()->offset) {
+    VLOG(1) << "Random read of " << url_ << " at " << offset;
+    DropWindows();
+    next_offset_ = offset;
+  }
+
+  size_t read = 0;
+  while (read < range.size() && offset + read < size_) {
+    ReadAhead();
+
+    Window* window = windows_.front().get();
+    window->fb.join();
+    RETURN_IF_ERROR(window->status);
+
+    size_t pos = offset + read - window->offset;
+    size_t len = std::min(range.size() - read, window->size - pos);
+    memcpy(range.data() + read, window->data.get() + pos, len);
+    read += len;
+
+    if (pos + len == window->size)
+      windows_.pop_front();
+  }
+
+  return read;
+}
+
+void S3ReadAheadFile::ReadAhead() {
+  while (windows_.size() < max_inflight_ && next_offset_ < size_) {
+    std::unique_ptr<Window> window(new Window);
+    window->offset = next_offset_;
+    window->size = std::min(window_size_, size_ - next_offset_);
+    window->data.reset(new uint8_t[window->size]);
+    next_offset_ += window->size;
+
+    Window* ptr = window.get();
+    ptr->fb = fibers::fiber([this, ptr] {
+      ptr->status = FetchRange(ptr->offset, ptr->size, ptr->data.get());
+    });
+    windows_.push_back(std::move(window));
+  }
+}
+
+void S3ReadAheadFile::DropWindows() {
+  for (auto& window : windows_) {
+    window->fb.join();
+  }
+  windows_.clear();
+}
+
+Status S3ReadAheadFile::FetchRange(size_t offset, size_t size, uint8_t* dest) {
+  size_t read = 0;
+
+  for (unsigned iters = 0; read < size; ++iters) {
+    if (iters == kMaxRangeRetries) {
+      return Status(StatusCode::IO_ERROR, absl::StrCat("Could not read ", url_, " at ",
+                                                       offset + read));
+    }
+
+    h2::request<h2::empty_body> req{h2::verb::get, url_, 11};
+    SetRange(offset + read, offset + size, &req);
+    aws_.SignEmpty(pool_->domain(), &req);
+
+    HttpsClientPool::ClientHandle handle = pool_->GetHandle();
+    system::error_code ec = handle->Send(req);
+    if (ec) {
+      VLOG(1) << "Error sending to socket " << handle->native_handle() << " " << ec;
+      handle->schedule_reconnect();
+      continue;
+    }
+
+    S3ReadFile::Parser parser;
+    parser.body_limit(kuint64max);
+    ec = handle->ReadHeader(&parser);
+    if (ec) {
+      handle->schedule_reconnect();
+      continue;
+    }
+    if (!parser.keep_alive()) {
+      handle->schedule_reconnect();
+    }
+
+    if (parser.get().result() != h2::status::partial_content) {
+      LOG(ERROR) << "Range error: " << parser.get();
+      handle->schedule_reconnect();
+
+      return Status(StatusCode::IO_ERROR, string(parser.get().reason()));
+    }
+
+    while (read < size && !parser.is_done()) {
+      auto& body = parser.get().body();
+      body.data = dest + read;
+      body.size = size - read;
+
+      ec = handle->Read(&parser);
+      read = size - body.size;
+
+      if (ec && ec != h2::error::need_buffer) {
+        VLOG(1) << "Range of " << url_ << " interrupted at " << offset + read << ": " << ec;
+        break;
+      }
+    }
+
+    if (!parser.is_done()) {
+      // We prefer reconnecting to draining.
+      handle->schedule_reconnect();
+    } else if (read < size) {
+      return Status(StatusCode::IO_ERROR, absl::StrCat("Object ", url_, " was truncated"));
+    }
+  }
+
+  return Status::OK;
+}
+
+Status S3ReadAheadFile::Close() {
+  DropWindows();
+
+  return Status::OK;
+}
+
 S3WriteFile::S3WriteFile(absl::string_view name, const AWS& aws, string upload_id,
                          HttpsClientPool* pool)
     : file::WriteFile(name), aws_(aws), upload_id_(std::move(upload_id)),
@@ -296,17 +555,14 @@ bool S3WriteFile::Close() {
   CHECK(pool_->io_context().InContextThread());
 
   auto status = Upload();
+  JoinUploads();
+  if (status.ok())
+    status = status_;
   if (!status.ok()) {
     LOG(ERROR) << "Error uploading " << status;
     return false;
   }
 
-  VLOG(1) << "Joining with " << uploads_.size() << " fibers";
-  for (auto& f : uploads_) {
-    f.join();
-  }
-  uploads_.clear();
-
   if (parts_.empty())
     return true;
 
@@ -374,7 +630,8 @@ Status S3WriteFile::Write(const uint8* buffer, uint64 length) {
     RETURN_IF_ERROR(Upload());
   }
 
-  return Status::OK;
+  std::lock_guard<fibers::mutex> lk(mu_);
+  return status_;
 }
 
 size_t S3WriteFile::FillBuf(const uint8* buffer, size_t length) {
@@ -387,6 +644,9 @@ size_t S3WriteFile::FillBuf(const uint8* buffer, size_t length) {
   }
   CHECK_EQ(offs, prepare_size);
   body_mb_.commit(prepare_size);
+  if (FLAGS_s3_sign_payload) {
+    body_hash_.Update(absl::string_view{reinterpret_cast<const char*>(buffer), prepare_size});
+  }
 
   return offs;
 }
@@ -396,12 +656,14 @@ Status S3WriteFile::Upload() {
   if (body_size == 0)
     return Status::OK;
 
-  string url("/");
-  char sha256[65];
+  std::unique_lock<fibers::mutex> lk(mu_);
+  cv_.wait(lk, [this] { return inflight_ < FLAGS_s3_upload_inflight || !status_.ok(); });
+  if (!status_.ok())
+    return status_;
+  ++inflight_;
+  lk.unlock();
 
-  // TODO: To figure out why SHA256 is so slow.
-  //detail::Sha256String(body_mb_, sha256);
-  const char* kFakeSha = "UNSIGNED-PAYLOAD";
+  string url("/");
   strings::AppendEncodedUrl(create_file_name_, &url);
   absl::StrAppend(&url, "?uploadId=", upload_id_);
   absl::StrAppend(&url, "&partNumber=", parts_.size() + 1);
@@ -412,41 +674,72 @@ Status S3WriteFile::Upload() {
   req.body() = std::move(body_mb_);
   req.prepare_payload();
 
-  aws_.Sign(pool_->domain(), absl::string_view{kFakeSha}, &req);
+  if (FLAGS_s3_sign_payload) {
+    char sha256[65];
+    body_hash_.Finalize(sha256);
+    aws_.Sign(pool_->domain(), absl::string_view{sha256, 64}, &req);
+  } else {
+    aws_.SignUnsigned(pool_->domain(), &req);
+  }
 
-  auto up_cb = [this, req = std::move(req), id = parts_.size()] {
-    VLOG(2) << "StartUpCb";
-    h2::response<h2::string_body> resp;
-    HttpsClientPool::ClientHandle handle = pool_->GetHandle();
+  parts_.emplace_back();
 
-    VLOG(2) << "BeforeSendUpCb";
-    uint64_t start = base::GetMonotonicMicrosFast();
-    system::error_code ec = handle->Send(req, &resp);
-    CHECK(!ec) << "Error sending to socket " << handle->native_handle() << " " << ec;
+  // We run it immediately
+  fibers::fiber fb(fibers::launch::dispatch, [this, req = std::move(req), id = parts_.size() - 1] {
+    Status st = UploadPart(req, id);
+
+    std::lock_guard<fibers::mutex> lk(mu_);
+    if (!st.ok() && status_.ok())
+      status_ = st;
+    --inflight_;
+    cv_.notify_all();
+  });
+  uploads_.emplace_back(std::move(fb));
+
+  return Status::OK;
+}
 
-    VLOG(2) << "Upload: " << resp;
-    CHECK(resp.result() == h2::status::ok) << "S3WriteFile::Upload: " << resp;
+Status S3WriteFile::UploadPart(const h2::request<h2::dynamic_body>& req, size_t id) {
+  VLOG(2) << "StartUpCb";
+  h2::response<h2::string_body> resp;
+  HttpsClientPool::ClientHandle handle = pool_->GetHandle();
 
-    VLOG(1) << "S3Upload tool " << base::GetMonotonicMicrosFast() - start << " micros";
+  VLOG(2) << "BeforeSendUpCb";
+  uint64_t start = base::GetMonotonicMicrosFast();
+  system::error_code ec = handle->Send(req, &resp);
+  if (ec) {
+    LOG(ERROR) << "Error sending to socket " << handle->native_handle() << " " << ec;
+    return ToStatus(ec);
+  }
 
-    auto it = resp.find(h2::field::etag);
-    CHECK(it != resp.end());
+  VLOG(2) << "Upload: " << resp;
+  if (!resp.keep_alive()) {
+    handle->schedule_reconnect();
+  }
+  if (resp.result() != h2::status::ok) {
+    LOG(ERROR) << "S3WriteFile::Upload: " << resp;
+    return Status(StatusCode::IO_ERROR, string(resp.reason()));
+  }
 
-    parts_[id] = string(it->value());
+  VLOG(1) << "S3Upload tool " << base::GetMonotonicMicrosFast() - start << " micros";
 
-    if (!resp.keep_alive()) {
-      handle->schedule_reconnect();
-    }
-  };
-  parts_.emplace_back();
+  auto it = resp.find(h2::field::etag);
+  if (it == resp.end())
+    return Status(StatusCode::IO_ERROR, "Upload response has no etag");
 
-  // We run it immediately
-  fibers::fiber fb(fibers::launch::dispatch, std::move(up_cb));
-  uploads_.emplace_back(std::move(fb));
+  parts_[id] = string(it->value());
 
   return Status::OK;
 }
 
+void S3WriteFile::JoinUploads() {
+  VLOG(1) << "Joining with " << uploads_.size() << " fibers";
+  for (auto& f : uploads_) {
+    f.join();
+  }
+  uploads_.clear();
+}
+
 // ******************** Helper utilities
 
 inline xmlDocPtr XmlRead(absl::string_view xml) {
@@ -532,27 +825,48 @@ std::vector<std::string> ParseXmlListBuckets(absl::string_view xml_resp) {
   return res;
 }
 
-void ParseXmlListObj(absl::string_view xml_obj, S3Bucket::ListObjectCb cb) {
+string ParseXmlListObj(absl::string_view xml_obj, S3Bucket::ListObjectCb cb,
+                       S3Bucket::ListPrefixCb prefix_cb) {
   xmlDocPtr doc = XmlRead(xml_obj);
   CHECK(doc);
 
   xmlNodePtr root = xmlDocGetRootElement(doc);
   CHECK_STREQ("ListBucketResult", as_char(root->name));
 
+  bool truncated = false;
+  string next_marker, last_key;
   for (xmlNodePtr child = root->children; child; child = child->next) {
     if (child->type == XML_ELEMENT_NODE) {
       xmlNodePtr grand = child->children;
       if (!strcmp(as_char(child->name), "IsTruncated")) {
         CHECK(grand && grand->type == XML_TEXT_NODE);
-        CHECK_STREQ("false", as_char(grand->content)) << "TBD";
-      } else if (!strcmp(as_char(child->name), "Marker")) {
+        truncated = !strcmp("true", as_char(grand->content));
+      } else if (!strcmp(as_char(child->name), "NextMarker")) {
+        CHECK(grand && grand->type == XML_TEXT_NODE);
+        next_marker = as_char(grand->content);
       } else if (!strcmp(as_char(child->name), "Contents")) {
         auto sz_name = ParseXmlObjContents(child);
         cb(sz_name.first, sz_name.second);
+        last_key = string(sz_name.second);
+      } else if (!strcmp(as_char(child->name), "CommonPrefixes")) {
+        for (; grand; grand = grand->next) {
+          if (grand->type == XML_ELEMENT_NODE && !strcmp(as_char(grand->name), "Prefix")) {
+            CHECK(grand->children && grand->children->type == XML_TEXT_NODE);
+            const char* prefix = as_char(grand->children->content);
+            if (prefix_cb)
+              prefix_cb(prefix);
+            last_key = prefix;
+          }
+        }
       }
     }
   }
   xmlFreeDoc(doc);
+
+  // NextMarker is returned only with a delimiter, otherwise the last key continues the listing.
+  if (!truncated)
+    return string{};
+  return next_marker.empty() ? last_key : next_marker;
 }
 
 }  // namespace detail
@@ -563,6 +877,16 @@ S3Bucket::S3Bucket(const AWS& aws, http::HttpsClientPool* pool) : aws_(aws), poo
 }
 
 auto S3Bucket::List(absl::string_view glob, bool fs_mode, ListObjectCb cb) -> ListObjectResult {
+  return ListInternal(glob, fs_mode, std::move(cb), nullptr);
+}
+
+auto S3Bucket::ListDir(absl::string_view prefix, ListObjectCb cb, ListPrefixCb prefix_cb)
+    -> ListObjectResult {
+  return ListInternal(prefix, true, std::move(cb), std::move(prefix_cb));
+}
+
+auto S3Bucket::ListInternal(absl::string_view glob, bool fs_mode, ListObjectCb cb,
+                            ListPrefixCb prefix_cb) -> ListObjectResult {
   HttpsClientPool::ClientHandle handle = pool_->GetHandle();
 
   string url{"/?"};
@@ -577,25 +901,36 @@ auto S3Bucket::List(absl::string_view glob, bool fs_mode, ListObjectCb cb) -> Li
     strings::AppendEncodedUrl("/", &url);
   }
 
-  h2::request<h2::empty_body> req{h2::verb::get, url, 11};
-  h2::response<h2::string_body> resp;
+  string marker;
+  while (true) {
+    string target = url;
+    if (!marker.empty()) {
+      target.append("&marker=");
+      strings::AppendEncodedUrl(marker, &target);
+    }
 
-  aws_.SignEmpty(pool_->domain(), &req);
-  VLOG(1) << "Req: " << req;
+    h2::request<h2::empty_body> req{h2::verb::get, target, 11};
+    h2::response<h2::string_body> resp;
 
-  system::error_code ec = handle->Send(req, &resp);
+    aws_.SignEmpty(pool_->domain(), &req);
+    VLOG(1) << "Req: " << req;
 
-  if (ec) {
-    return ToStatus(ec);
-  }
+    system::error_code ec = handle->Send(req, &resp);
 
-  if (resp.result() != h2::status::ok) {
-    LOG(INFO) << "ListError: " << resp;
+    if (ec) {
+      return ToStatus(ec);
+    }
 
-    return Status(StatusCode::IO_ERROR, string(resp.reason()));
+    if (resp.result() != h2::status::ok) {
+      LOG(INFO) << "ListError: " << resp;
+
+      return Status(StatusCode::IO_ERROR, string(resp.reason()));
+    }
+    VLOG(1) << "ListResp: " << resp;
+    marker = detail::ParseXmlListObj(resp.body(), cb, prefix_cb);
+    if (marker.empty())
+      break;
   }
-  VLOG(1) << "ListResp: " << resp;
-  detail::ParseXmlListObj(resp.body(), std::move(cb));
 
   return Status::OK;
 }
@@ -656,6 +991,18 @@ StatusObject<file::ReadonlyFile*> OpenS3ReadFile(absl::string_view key_path, con
   return fl.release();
 }
 
+StatusObject<file::ReadonlyFile*> OpenS3ReadAheadFile(absl::string_view key_path, const AWS& aws,
+                                                      http::HttpsClientPool* pool,
+                                                      unsigned max_inflight, size_t window_size) {
+  CHECK(pool);
+
+  std::unique_ptr<S3ReadAheadFile> fl(
+      new S3ReadAheadFile(aws, pool, key_path, max_inflight, window_size));
+  RETURN_IF_ERROR(fl->Open());
+
+  return fl.release();
+}
+
 StatusObject<file::WriteFile*> OpenS3WriteFile(absl::string_view key_path, const AWS& aws,
                                                http::HttpsClientPool* pool) {
   string url("/");
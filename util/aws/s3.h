@@ -28,6 +28,9 @@ class S3Bucket {
   //! Called with (size, key_name) pairs.
   using ListObjectCb = std::function<void(size_t, absl::string_view)>;
 
+  //! Called with the sub-prefixes ("directories") of a listed prefix, including the trailing '/'.
+  using ListPrefixCb = std::function<void(absl::string_view)>;
+
   //! Constructs S3 bucket handler.
   //! pool should point to the bucket dns we are working with since S3 has bucket centric API.
   S3Bucket(const AWS& aws, http::HttpsClientPool* pool);
@@ -39,15 +42,23 @@ class S3Bucket {
    *  we are going to list.
    *  glob contains the object prefix path not including the bucket part.
    *  if fs_mode is true returns all paths upto the delimeter '/'.
+   *  Pages through the results, cb is called as each page arrives.
    */
   ListObjectResult List(absl::string_view glob, bool fs_mode, ListObjectCb cb);
 
+  //! Lists the objects directly under prefix with cb and its sub-prefixes with prefix_cb.
+  //! Allows splitting a large listing into independent listings of the sub-prefixes.
+  ListObjectResult ListDir(absl::string_view prefix, ListObjectCb cb, ListPrefixCb prefix_cb);
+
   static bool SplitToBucketPath(absl::string_view input, absl::string_view* bucket,
                                 absl::string_view* path);
 
   static std::string ToFullPath(absl::string_view bucket, absl::string_view key_path);
 
  private:
+  ListObjectResult ListInternal(absl::string_view glob, bool fs_mode, ListObjectCb cb,
+                                ListPrefixCb prefix_cb);
+
   const AWS& aws_;
   http::HttpsClientPool* pool_;
 };
@@ -72,7 +83,23 @@ StatusObject<file::ReadonlyFile*> OpenS3ReadFile(
     const file::ReadonlyFile::Options& opts = file::ReadonlyFile::Options{});
 
 /**
- * @brief Opens a new GCS file for writes.
+ * @brief Opens an s3 object for reading with concurrent range requests.
+ *
+ * The object is read in windows of window_size bytes, up to max_inflight windows that follow
+ * the read offset are requested at once over separate connections of 'pool'. Reads at other
+ * offsets restart the read-ahead there and reuse the pooled connections. Holds up to
+ * max_inflight windows in memory. Must be used from the IO thread that manages 'pool'.
+ */
+StatusObject<file::ReadonlyFile*> OpenS3ReadAheadFile(absl::string_view key_path, const AWS& aws,
+                                                      http::HttpsClientPool* pool,
+                                                      unsigned max_inflight, size_t window_size);
+
+/**
+ * @brief Opens a new S3 file for writes.
+ *
+ * The file is written with a multipart upload of --s3_upload_buf_mb parts. Up to
+ * --s3_upload_inflight parts are uploaded at once over separate connections of 'pool',
+ * Close completes the upload.
  *
  * Must be called from the IO thread that manages 'pool'. All accesses to this file
  * must be done from the same IO thread.
@@ -92,7 +119,10 @@ bool IsS3Path(absl::string_view path);
 namespace detail {
 
 std::vector<std::string> ParseXmlListBuckets(absl::string_view xml_obj);
-void ParseXmlListObj(absl::string_view xml_obj, S3Bucket::ListObjectCb cb);
+
+//! Returns the marker of the next page or an empty string if the listing is complete.
+std::string ParseXmlListObj(absl::string_view xml_obj, S3Bucket::ListObjectCb cb,
+                            S3Bucket::ListPrefixCb prefix_cb = nullptr);
 
 }  // namespace detail
 
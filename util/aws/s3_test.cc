@@ -4,6 +4,7 @@
 #include "util/aws/s3.h"
 
 #include <gmock/gmock.h>
+#include <boost/beast/http/empty_body.hpp>
 
 #include "base/gtest.h"
 #include "base/logging.h"
@@ -114,6 +115,40 @@ TEST_F(S3Test, ParseListObjResp) {
   EXPECT_THAT(res, ElementsAre(Pair(183600, "a1"), Pair(13611950, "a2"), Pair(26171024, "a3")));
 }
 
+TEST_F(S3Test, ParseListObjPage) {
+  const char* kPage = R"(<?xml version="1.0" encoding="UTF-8"?>
+<ListBucketResult xmlns="http://s3.amazonaws.com/doc/2006-03-01/">
+	<Name>bucketname</Name>
+	<Prefix>logs/</Prefix>
+	<NextMarker>logs/b/</NextMarker>
+	<IsTruncated>true</IsTruncated>
+	<Contents>
+		<Key>logs/a1</Key>
+		<Size>10</Size>
+	</Contents>
+	<CommonPrefixes>
+		<Prefix>logs/a/</Prefix>
+	</CommonPrefixes>
+	<CommonPrefixes>
+		<Prefix>logs/b/</Prefix>
+	</CommonPrefixes>
+</ListBucketResult>
+)";
+  vector<pair<size_t, string>> res;
+  vector<string> prefixes;
+
+  string marker = detail::ParseXmlListObj(
+      kPage, [&](size_t sz, absl::string_view name) { res.emplace_back(sz, string(name)); },
+      [&](absl::string_view prefix) { prefixes.emplace_back(prefix); });
+
+  EXPECT_EQ("logs/b/", marker);
+  EXPECT_THAT(res, ElementsAre(Pair(10, "logs/a1")));
+  EXPECT_THAT(prefixes, ElementsAre("logs/a/", "logs/b/"));
+
+  // The complete listing has no next page.
+  EXPECT_EQ("", detail::ParseXmlListObj(kListObjRes, [](size_t, absl::string_view) {}));
+}
+
 TEST_F(S3Test, Sha256) {
 	char buf[130];
 
@@ -129,6 +164,60 @@ TEST_F(S3Test, Sha256) {
 	EXPECT_STREQ(kTestExpected, buf);
 }
 
+TEST_F(S3Test, Sha256Hasher) {
+  char buf[65], expected[65];
+  string str(1000, 'x');
+  detail::Sha256String(str, expected);
+
+  detail::Sha256Hasher hasher;
+  for (size_t i = 0; i < str.size(); i += 300) {
+    hasher.Update(absl::string_view{str}.substr(i, 300));
+  }
+  hasher.Finalize(buf);
+  EXPECT_STREQ(expected, buf);
+
+  // Finalize resets the hasher.
+  hasher.Finalize(buf);
+  EXPECT_STREQ(AWS::kHashEmpty, buf);
+}
+
+class AwsSignTest : public testing::Test {
+ protected:
+  using Request = ::boost::beast::http::request<::boost::beast::http::empty_body>;
+
+  static void SetUpTestCase() {
+    setenv("AWS_ACCESS_KEY_ID", "AKIDEXAMPLE", 1);
+    setenv("AWS_SECRET_ACCESS_KEY", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY", 1);
+  }
+
+  static string Signature(const Request& req) {
+    string auth(req[::boost::beast::http::field::authorization]);
+    size_t pos = auth.find("Signature=");
+    return pos == string::npos ? string{} : auth.substr(pos + 10);
+  }
+};
+
+TEST_F(AwsSignTest, Sign) {
+  AWS aws("us-east-1", "s3");
+  ASSERT_TRUE(aws.Init().ok());
+
+  Request req{::boost::beast::http::verb::get, "/?prefix=a&delimiter=%2F", 11};
+  aws.Sign("bucket.s3.amazonaws.com", AWS::kHashEmpty, 1440938160, &req);  // 20150830T123600Z
+  EXPECT_EQ("20150830T123600Z", req["x-amz-date"]);
+  EXPECT_EQ("99c031eaf48ea6242631f1852fdacc74a9e5b186db23194a1817733ba3bbc28c", Signature(req));
+  EXPECT_THAT(string(req[::boost::beast::http::field::authorization]),
+              HasSubstr("Credential=AKIDEXAMPLE/20150830/us-east-1/s3/aws4_request,"));
+
+  // The key is derived again for the next day.
+  aws.Sign("bucket.s3.amazonaws.com", AWS::kHashEmpty, 1440979200, &req);  // 20150831T000000Z
+  EXPECT_EQ("a5e44eeca624c11a4fc69e97d05fe91a448d0f29d859a6299b766ef9d835b5f4", Signature(req));
+  EXPECT_THAT(string(req[::boost::beast::http::field::authorization]),
+              HasSubstr("/20150831/us-east-1/s3/aws4_request,"));
+
+  aws.SignUnsigned("bucket.s3.amazonaws.com", &req);
+  EXPECT_EQ(AWS::kUnsignedPayload, req["x-amz-content-sha256"]);
+}
+
 void BM_Sha256(benchmark::State& state) {
 	string str(1024, 'a');
 	char buf[65];
@@ -139,4 +228,20 @@ void BM_Sha256(benchmark::State& state) {
 }
 BENCHMARK(BM_Sha256);
 
+void BM_Sign(benchmark::State& state) {
+  setenv("AWS_ACCESS_KEY_ID", "AKIDEXAMPLE", 1);
+  setenv("AWS_SECRET_ACCESS_KEY", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY", 1);
+  AWS aws("us-east-1", "s3");
+  CHECK(aws.Init().ok());
+
+  ::boost::beast::http::request<::boost::beast::http::empty_body> req{
+      ::boost::beast::http::verb::get, "/path/to/object", 11};
+  req.set(::boost::beast::http::field::range, "bytes=0-65535");
+
+  while (state.KeepRunning()) {
+    aws.SignEmpty("bucket.s3.amazonaws.com", &req);
+  }
+}
+BENCHMARK(BM_Sign);
+
 }  // namespace util
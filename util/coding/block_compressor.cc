@@ -6,8 +6,12 @@
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include <zstd.h>
+#include <zdict.h>
+
+#include <algorithm>
 
 #include "base/logging.h"
+#include "util/fibers/fiberqueue_threadpool.h"
 
 namespace util {
 
@@ -15,6 +19,13 @@ using strings::ByteRange;
 using strings::MutableByteRange;
 using std::ostream;
 
+#define HANDLE ((ZSTD_CCtx*)zstd_cntx_)
+
+#define CHECK_ZSTDERR(res) do { auto foo = (res); \
+    CHECK(!ZSTD_isError(foo)) << ZSTD_getErrorName(foo); } while(false)
+
+namespace {
+
 ostream& operator<<(ostream& os, const ZSTD_parameters& p) {
   os << "wlog: " << p.cParams.windowLog << ", clog: " << p.cParams.chainLog << ", strategy: "
      << p.cParams.strategy << ", slog: " << p.cParams.searchLog << ", cntflag: "
@@ -22,40 +33,147 @@ ostream& operator<<(ostream& os, const ZSTD_parameters& p) {
   return os;
 }
 
+constexpr unsigned kMaxPooledCntx = 4;
 
-#define HANDLE ((ZSTD_CCtx*)zstd_cntx_)
+// Free contexts of the current thread.
+struct CntxPool {
+  std::vector<ZSTD_CCtx*> cctx;
+  std::vector<ZSTD_DCtx*> dctx;
 
-#define CHECK_ZSTDERR(res) do { auto foo = (res); \
-    CHECK(!ZSTD_isError(foo)) << ZSTD_getErrorName(foo); } while(false)
+  ~CntxPool();
+};
+
+thread_local CntxPool cntx_pool;
+
+// Compressors that are destroyed after the thread's pool (i.e. static objects) free their
+// contexts directly.
+thread_local bool cntx_pool_destroyed = false;
+
+CntxPool::~CntxPool() {
+  for (ZSTD_CCtx* c : cctx)
+    ZSTD_freeCCtx(c);
+  for (ZSTD_DCtx* d : dctx)
+    ZSTD_freeDCtx(d);
+  cntx_pool_destroyed = true;
+}
+
+template<typename Cntx> Cntx* AcquireCntx(std::vector<Cntx*>* pool, Cntx* (*create_fn)()) {
+  if (cntx_pool_destroyed || pool->empty())
+    return create_fn();
+  Cntx* res = pool->back();
+  pool->pop_back();
+  return res;
+}
+
+template<typename Cntx> void ReleaseCntx(Cntx* cntx, std::vector<Cntx*>* pool,
+                                         size_t (*free_fn)(Cntx*)) {
+  if (cntx_pool_destroyed || pool->size() >= kMaxPooledCntx) {
+    free_fn(cntx);
+  } else {
+    pool->push_back(cntx);
+  }
+}
+
+ZSTD_compressionParameters BlockCParams(int level) {
+  ZSTD_compressionParameters params = ZSTD_getCParams(level, 0, 0);
+
+  // To have 128KB window size we need to set twice more:
+  // effective windowSize = 2^windowLog - block_size.
+  params.windowLog = BlockCompressor::BLOCK_SIZE_LOG + 1;
+  params.hashLog = std::min<unsigned>(params.hashLog, BlockCompressor::BLOCK_SIZE_LOG - 2);
+  return params;
+}
+
+}  // namespace
+
+ZstdDict::ZstdDict(strings::ByteRange content, int level) : level_(level) {
+  cdict_ = ZSTD_createCDict_advanced(content.data(), content.size(), ZSTD_dlm_byCopy,
+                                     ZSTD_dct_auto, BlockCParams(level), ZSTD_defaultCMem);
+  CHECK(cdict_) << "Invalid dictionary";
+  ddict_ = ZSTD_createDDict(content.data(), content.size());
+  CHECK(ddict_);
+
+  id_ = ZSTD_getDictID_fromDDict((const ZSTD_DDict*)ddict_);
+}
+
+ZstdDict::~ZstdDict() {
+  ZSTD_freeCDict((ZSTD_CDict*)cdict_);
+  ZSTD_freeDDict((ZSTD_DDict*)ddict_);
+}
+
+std::string ZstdDict::Train(const std::vector<strings::ByteRange>& samples, size_t max_size) {
+  std::string buf;
+  std::vector<size_t> sizes;
+  for (const auto& sample : samples) {
+    buf.append(reinterpret_cast<const char*>(sample.data()), sample.size());
+    sizes.push_back(sample.size());
+  }
+
+  std::string res(max_size, '\0');
+  size_t sz = ZDICT_trainFromBuffer(&res.front(), max_size, buf.data(), sizes.data(),
+                                    sizes.size());
+  if (ZDICT_isError(sz)) {
+    VLOG(1) << "Could not train dictionary: " << ZDICT_getErrorName(sz);
+    return std::string();
+  }
+  res.resize(sz);
+
+  return res;
+}
 
 BlockCompressor::BlockCompressor() {
-  zstd_cntx_ = ZSTD_createCCtx();
+  zstd_cntx_ = AcquireCntx(&cntx_pool.cctx, &ZSTD_createCCtx);
 }
 
+struct BlockCompressor::Job {
+  std::unique_ptr<uint8_t[]> input, output;
+  size_t input_size, output_size = 0;
+  fibers_ext::Done done;
+};
+
 BlockCompressor::~BlockCompressor() {
-  ZSTD_freeCCtx(HANDLE);
+  // The jobs reference their buffers.
+  for (auto& job : jobs_) {
+    job->done.Wait();
+  }
+  ReleaseCntx(HANDLE, &cntx_pool.cctx, &ZSTD_freeCCtx);
 }
 
 void BlockCompressor::Start() {
   CHECK(compressed_bufs_.empty() && compressed_blocks_.empty());
 
-  ZSTD_parameters params{ZSTD_getCParams(6, 0, 0), ZSTD_frameParameters()};
+  pos_ = 0;
+  compress_block_size_ = ZSTD_compressBound(BLOCK_SIZE);
+  parallel_ = pool_ != nullptr;
+
+  if (parallel_) {
+    CHECK_GT(max_inflight_, 0);
+    submitted_ = 0;
+    if (!cur_input_)
+      cur_input_.reset(new uint8_t[BLOCK_SIZE + 1]);
+    cur_buf_ = cur_input_.get();
+    return;
+  }
 
-  // To have 128KB window size we need to set twice more:
-  // effective windowSize = 2^windowLog - block_size.
-  params.cParams.windowLog = BLOCK_SIZE_LOG + 1;
-  params.cParams.hashLog = BLOCK_SIZE_LOG - 2;
+  size_t res;
+  if (dict_) {
+    VLOG(1) << "Starting with dictionary " << dict_->id();
+
+    res = ZSTD_compressBegin_usingCDict_advanced(HANDLE, (const ZSTD_CDict*)dict_->cdict_,
+                                                 ZSTD_frameParameters(), ZSTD_CONTENTSIZE_UNKNOWN);
+  } else {
+    ZSTD_parameters params{BlockCParams(level_), ZSTD_frameParameters()};
 
-  VLOG(1) << "Starting with " << params;
+    VLOG(1) << "Starting with " << params;
 
-  size_t res = ZSTD_compressBegin_advanced(HANDLE, nullptr, 0, params, ZSTD_CONTENTSIZE_UNKNOWN);
+    res = ZSTD_compressBegin_advanced(HANDLE, nullptr, 0, params, ZSTD_CONTENTSIZE_UNKNOWN);
+  }
   CHECK_ZSTDERR(res);
 
   if (!double_buf_) {
     double_buf_.reset(new uint8_t[BLOCK_SIZE * 2 + 1]);
   }
-  pos_ = 0;
-  compress_block_size_ = ZSTD_compressBound(BLOCK_SIZE);
+  cur_buf_ = double_buf_.get() + (BLOCK_SIZE + 1) * cur_buf_index_;
 }
 
 void BlockCompressor::Add(strings::ByteRange br) {
@@ -101,6 +219,18 @@ void BlockCompressor::CompressInternal(bool finalize_frame) {
   if (!finalize_frame && pos_ == 0)
     return;
 
+  if (parallel_) {
+    // Finalize writes an empty frame if nothing was added, like the serial mode.
+    if (pos_ > 0 || submitted_ == 0)
+      SubmitJob();
+
+    if (finalize_frame) {
+      while (!jobs_.empty())
+        PopJob();
+    }
+    return;
+  }
+
   std::unique_ptr<uint8_t[]> cbuf(new uint8_t[compress_block_size_]);
 
   auto func = finalize_frame ? ZSTD_compressEnd : ZSTD_compressContinue;
@@ -114,7 +244,70 @@ void BlockCompressor::CompressInternal(bool finalize_frame) {
   VLOG(1) << "Compressed from " << pos_ << " to " << res;
 
   cur_buf_index_ ^= 1;
+  cur_buf_ = double_buf_.get() + (BLOCK_SIZE + 1) * cur_buf_index_;
+  pos_ = 0;
+}
+
+void BlockCompressor::SubmitJob() {
+  std::unique_ptr<Job> job(new Job);
+  job->input = std::move(cur_input_);
+  job->input_size = pos_;
+  job->output.reset(new uint8_t[compress_block_size_]);
+
+  Job* ptr = job.get();
+  size_t capacity = compress_block_size_;
+  auto dict = dict_;
+  int level = level_;
+
+  pool_->Add([ptr, capacity, dict, level] {
+    ZSTD_CCtx* cntx = AcquireCntx(&cntx_pool.cctx, &ZSTD_createCCtx);
+    size_t res;
+    if (dict) {
+      res = ZSTD_compress_usingCDict_advanced(cntx, ptr->output.get(), capacity,
+                                              ptr->input.get(), ptr->input_size,
+                                              (const ZSTD_CDict*)dict->cdict_,
+                                              ZSTD_frameParameters());
+    } else {
+      ZSTD_parameters params{BlockCParams(level), ZSTD_frameParameters()};
+      res = ZSTD_compress_advanced(cntx, ptr->output.get(), capacity, ptr->input.get(),
+                                   ptr->input_size, nullptr, 0, params);
+    }
+    CHECK_ZSTDERR(res);
+    ReleaseCntx(cntx, &cntx_pool.cctx, &ZSTD_freeCCtx);
+
+    ptr->output_size = res;
+    ptr->done.Notify();
+  });
+
+  jobs_.push_back(std::move(job));
+  ++submitted_;
   pos_ = 0;
+
+  // One more block can be filled while max_inflight_ are being compressed.
+  while (jobs_.size() > max_inflight_) {
+    PopJob();
+  }
+
+  if (free_inputs_.empty()) {
+    cur_input_.reset(new uint8_t[BLOCK_SIZE + 1]);
+  } else {
+    cur_input_ = std::move(free_inputs_.back());
+    free_inputs_.pop_back();
+  }
+  cur_buf_ = cur_input_.get();
+}
+
+void BlockCompressor::PopJob() {
+  Job* job = jobs_.front().get();
+  job->done.Wait();
+
+  compressed_blocks_.emplace_back(job->output.get(), job->output_size);
+  compressed_bufs_.push_back(std::move(job->output));
+  compressed_size_ += job->output_size;
+  VLOG(1) << "Compressed frame from " << job->input_size << " to " << job->output_size;
+
+  free_inputs_.push_back(std::move(job->input));
+  jobs_.pop_front();
 }
 
 
@@ -147,11 +340,11 @@ void BlockCompressor::ClearCompressedData() {
 #define HANDLE ((ZSTD_DCtx*)zstd_dcntx_)
 
 BlockDecompressor::BlockDecompressor() {
-  zstd_dcntx_ = ZSTD_createDCtx();
+  zstd_dcntx_ = AcquireCntx(&cntx_pool.dctx, &ZSTD_createDCtx);
 }
 
 BlockDecompressor::~BlockDecompressor() {
-  ZSTD_freeDCtx(HANDLE);
+  ReleaseCntx(HANDLE, &cntx_pool.dctx, &ZSTD_freeDCtx);
 }
 
 int32_t BlockDecompressor::Decompress(strings::ByteRange br, uint32_t* consumed) {
@@ -164,7 +357,13 @@ int32_t BlockDecompressor::Decompress(strings::ByteRange br, uint32_t* consumed)
     CHECK_LE(params.windowSize, BLOCK_SIZE * 2);
     frame_state_ = 1;
 
-    CHECK_EQ(0, ZSTD_decompressBegin(HANDLE));
+    if (dict_) {
+      CHECK(params.dictID == 0 || params.dictID == dict_->id()) << params.dictID;
+      CHECK_ZSTDERR(ZSTD_decompressBegin_usingDDict(HANDLE, (const ZSTD_DDict*)dict_->ddict_));
+    } else {
+      CHECK_EQ(0, params.dictID) << "Dictionary is required";
+      CHECK_EQ(0, ZSTD_decompressBegin(HANDLE));
+    }
     if (!buf_) {
       buf_.reset(new uint8_t[BLOCK_SIZE*2]);
     }
@@ -177,23 +376,25 @@ int32_t BlockDecompressor::Decompress(strings::ByteRange br, uint32_t* consumed)
 
   frame_state_ ^= 1;  // flip buffer index.
 
-  while (sz > 0) {
+  uint8_t* dest = buf_.get() + BLOCK_SIZE * frame_state_;
+
+  // Newer zstd versions may split a compressed block into several zstd blocks,
+  // so we decompress all of them until br is exhausted.
+  while (sz > 0 && decompress_size_ < BLOCK_SIZE) {
     if (sz > br.size()) {
+      if (decompress_size_ > 0)
+        break;
       frame_state_ ^= 1;  // revert buffer index.
       return -sz;
     }
 
-    size_t res = ZSTD_decompressContinue(HANDLE, buf_.get() + BLOCK_SIZE * frame_state_, BLOCK_SIZE,
-                                         br.data(), sz);
+    size_t res = ZSTD_decompressContinue(HANDLE, dest + decompress_size_,
+                                         BLOCK_SIZE - decompress_size_, br.data(), sz);
     CHECK_ZSTDERR(res);
     *consumed += sz;
     br.advance(sz);
     sz = ZSTD_nextSrcSizeToDecompress(HANDLE);
-
-    if (res > 0) {
-      decompress_size_ = res;
-      break;
-    }
+    decompress_size_ += res;
   }
 
   if (sz == 0) {
@@ -3,7 +3,9 @@
 //
 #pragma once
 
+#include <deque>
 #include <memory>
+#include <string>
 #include <vector>
 #include "strings/range.h"
 
@@ -19,14 +21,65 @@
 */
 namespace util {
 
+namespace fibers_ext {
+class FiberQueueThreadPool;
+}  // namespace fibers_ext
+
+// Prebuilt zstd dictionary that can be shared by many compressors and decompressors,
+// possibly from different threads. Digesting the dictionary happens once in the constructor.
+class ZstdDict {
+ public:
+  // content is the raw dictionary, for example produced by Train. The compression tables are
+  // built for the given level and BlockCompressor's window.
+  explicit ZstdDict(strings::ByteRange content, int level = 6);
+  ZstdDict(const ZstdDict&) = delete;
+
+  ~ZstdDict();
+
+  // Trains a dictionary of at most max_size bytes over the sample blocks.
+  // Returns an empty string if the samples are not enough to train.
+  static std::string Train(const std::vector<strings::ByteRange>& samples, size_t max_size);
+
+  int level() const { return level_; }
+
+  // The id that is written into the frames compressed with this dictionary.
+  uint32_t id() const { return id_; }
+
+ private:
+  friend class BlockCompressor;
+  friend class BlockDecompressor;
+
+  void* cdict_ = nullptr;
+  void* ddict_ = nullptr;
+  int level_;
+  uint32_t id_;
+};
+
 class BlockCompressor {
  public:
   enum { BLOCK_SIZE_LOG = 17, BLOCK_SIZE = 1 << BLOCK_SIZE_LOG };
 
+  // Compression contexts are taken from a small per-thread pool and returned there
+  // on destruction, so short-lived compressors do not allocate them.
   BlockCompressor();
 
   ~BlockCompressor();
 
+  // Both take effect from the next frame. With a dictionary its level is used.
+  void set_level(int level) { level_ = level; }
+  void SetDict(std::shared_ptr<const ZstdDict> dict) { dict_ = std::move(dict); }
+
+  // Compresses every block as an independent zstd frame on the pool's workers instead of
+  // a single frame on the caller's thread. compressed_blocks() keeps the original order, one
+  // frame per block, and BlockDecompressor reads them as consecutive frames.
+  // At most max_inflight blocks are compressed at a time, Add blocks when all of them are busy.
+  // Blocks do not reference their predecessors, so the ratio is slightly lower.
+  // Takes effect from the next frame.
+  void SetThreadPool(fibers_ext::FiberQueueThreadPool* pool, unsigned max_inflight = 4) {
+    pool_ = pool;
+    max_inflight_ = max_inflight;
+  }
+
   void Add(uint8_t b) {
     if (compress_block_size_ == 0) {
       Start();
@@ -70,18 +123,23 @@ class BlockCompressor {
   void ClearCompressedData();
 
  private:
+  struct Job;
+
   void Start();
   void CompressInternal(bool finalize_frame);
 
-  const uint8_t* buf_start() const {
-    return double_buf_.get() + (BLOCK_SIZE + 1) * cur_buf_index_;
-  }
+  // Parallel mode: sends the current block to the pool and switches to a free buffer.
+  void SubmitJob();
 
-  uint8_t* buf_start() {
-    return double_buf_.get() + (BLOCK_SIZE + 1) * cur_buf_index_;
-  }
+  // Waits for the oldest job and appends its frame to compressed_blocks_.
+  void PopJob();
+
+  const uint8_t* buf_start() const { return cur_buf_; }
+  uint8_t* buf_start() { return cur_buf_; }
 
   void* zstd_cntx_ = nullptr;
+  std::shared_ptr<const ZstdDict> dict_;
+  int level_ = 6;
   size_t compress_block_size_ = 0;
   size_t pos_ = 0;
 
@@ -90,6 +148,16 @@ class BlockCompressor {
   size_t compressed_size_ = 0;
   std::unique_ptr<uint8_t[]> double_buf_;
   unsigned cur_buf_index_ = 0; // 0 or 1
+  uint8_t* cur_buf_ = nullptr;
+
+  fibers_ext::FiberQueueThreadPool* pool_ = nullptr;
+  unsigned max_inflight_ = 0;
+  bool parallel_ = false;  // Whether the current frame set is compressed by pool_.
+  size_t submitted_ = 0;
+
+  std::deque<std::unique_ptr<Job>> jobs_;
+  std::unique_ptr<uint8_t[]> cur_input_;
+  std::vector<std::unique_ptr<uint8_t[]>> free_inputs_;
 };
 
 class BlockDecompressor {
@@ -100,6 +168,11 @@ class BlockDecompressor {
 
   ~BlockDecompressor();
 
+  // Required to decompress the frames compressed with a dictionary, takes effect
+  // from the next frame.
+  void SetDict(std::shared_ptr<const ZstdDict> dict) { dict_ = std::move(dict); }
+
+  // br should start with a block from BlockCompressor::compressed_blocks().
   // Returns 0 if decompression of the frame is ended, 1 if it's still going.
   // In any case "*consumed" will hold how many bytes were consumed from br.
   // If negative number is returned - then last portion of br is too small to decompress
@@ -111,6 +184,7 @@ class BlockDecompressor {
 
  private:
   void* zstd_dcntx_ = nullptr;
+  std::shared_ptr<const ZstdDict> dict_;
   unsigned frame_state_ = 2;  // bit 1 for init state; bit 0 - which block to write to.
   std::unique_ptr<uint8_t[]> buf_;
   size_t decompress_size_ = 0;
@@ -7,6 +7,7 @@
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "strings/stringpiece.h"
+#include "util/fibers/fiberqueue_threadpool.h"
 
 namespace util {
 
@@ -66,5 +67,95 @@ TEST_F(BlockCompressorTest, Unaligned) {
   EXPECT_EQ(0, bdc_.Decompress(bc_.compressed_blocks().front(), &consumed));
 }
 
+TEST_F(BlockCompressorTest, Dict) {
+  std::vector<string> samples;
+  for (unsigned i = 0; i < 1000; ++i) {
+    samples.push_back("{\"id\": " + std::to_string(i * 7) + ", \"name\": \"user" +
+                      std::to_string(i % 13) + "\", \"country\": \"" +
+                      (i % 2 ? "Israel" : "Portugal") + "\", \"score\": " +
+                      std::to_string(i % 101) + "}");
+  }
+  std::vector<ByteRange> ranges;
+  for (const auto& s : samples)
+    ranges.push_back(ToByteRange(s));
+
+  string content = ZstdDict::Train(ranges, 4096);
+  ASSERT_FALSE(content.empty());
+  auto dict = std::make_shared<ZstdDict>(ToByteRange(content));
+  EXPECT_NE(0, dict->id());
+
+  const string& inp = samples[5];
+  bc_.Add(ToByteRange(inp));
+  bc_.Finalize();
+  size_t plain_size = bc_.compressed_size();
+
+  // Many short-lived objects reuse the pooled contexts and share the dictionary.
+  for (unsigned i = 0; i < 10; ++i) {
+    BlockCompressor bc;
+    BlockDecompressor bdc;
+    bc.SetDict(dict);
+    bdc.SetDict(dict);
+
+    bc.Add(ToByteRange(inp));
+    bc.Finalize();
+    ASSERT_LT(bc.compressed_size(), plain_size);
+
+    uint32_t consumed = 0;
+    string actual;
+    for (const auto& range : bc.compressed_blocks()) {
+      int32_t res = bdc.Decompress(range, &consumed);
+      ASSERT_GE(res, 0);
+      ASSERT_EQ(range.size(), consumed);
+      auto block = bdc.GetDecompressedBlock();
+      actual.append(reinterpret_cast<const char*>(block.data()), block.size());
+    }
+    EXPECT_EQ(inp, actual);
+  }
+}
+
+TEST_F(BlockCompressorTest, ThreadPool) {
+  fibers_ext::FiberQueueThreadPool pool(3);
+
+  string inp;
+  for (unsigned i = 0; i < 20; ++i) {
+    inp.append(base::RandStr(BlockCompressor::BLOCK_SIZE / 4));
+    inp.append(BlockCompressor::BLOCK_SIZE / 2, 'a' + i);
+  }
+  inp.append("tail");
+
+  bc_.SetThreadPool(&pool, 2);
+  bc_.Add(ToByteRange(inp));
+  bc_.Finalize();
+
+  const auto& cb = bc_.compressed_blocks();
+  ASSERT_EQ(inp.size() / BlockCompressor::BLOCK_SIZE + 1, cb.size());
+  EXPECT_LT(bc_.compressed_size(), inp.size() / 2);
+
+  // Every block is a frame of its own.
+  string actual;
+  for (const auto& range : cb) {
+    uint32_t consumed = 0;
+    ASSERT_EQ(0, bdc_.Decompress(range, &consumed));
+    ASSERT_EQ(range.size(), consumed);
+    auto block = bdc_.GetDecompressedBlock();
+    actual.append(reinterpret_cast<const char*>(block.data()), block.size());
+  }
+  EXPECT_TRUE(inp == actual);
+
+  // The zero-copy API works with the pool buffers as well.
+  bc_.ClearCompressedData();
+  auto dest = bc_.BlockBuffer();
+  memcpy(dest.data(), inp.data(), dest.size());
+  ASSERT_TRUE(bc_.Commit(dest.size()));
+  bc_.Finalize();
+  ASSERT_EQ(1, bc_.compressed_blocks().size());
+
+  uint32_t consumed = 0;
+  ASSERT_EQ(0, bdc_.Decompress(bc_.compressed_blocks().front(), &consumed));
+  EXPECT_EQ(BlockCompressor::BLOCK_SIZE, bdc_.GetDecompressedBlock().size());
+
+  pool.Shutdown();
+}
+
 }  // namespace util
 
@@ -0,0 +1,323 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+// Compression ratio and throughput of the util/coding codecs over synthetic datasets.
+// Run with
+//   coding_bench --bench --benchmark_format=json
+// Every benchmark reports the throughput of the raw (uncompressed) bytes and "ratio" counter
+// that equals raw size divided by the compressed size. Datasets are generated with a fixed
+// seed, hence the runs are comparable across the codec changes.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+#include "util/coding/block_compressor.h"
+#include "util/coding/double_compressor.h"
+#include "util/coding/set_encoder.h"
+
+namespace util {
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kNumInts = 1 << 20;
+constexpr unsigned kSeqLen = 16;
+
+enum IntDataset { UNIFORM, ZIPF, SORTED, DICT_SEQ, NUM_INT_DATASETS };
+enum DoubleDataset { PRICES, SENSOR, NUM_DOUBLE_DATASETS };
+
+const char* const kIntNames[] = {"uniform", "zipf", "sorted", "dict_seq"};
+const char* const kDoubleNames[] = {"prices", "sensor"};
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1).
+class Zipf {
+ public:
+  explicit Zipf(unsigned n) : cdf_(n) {
+    double sum = 0;
+    for (unsigned i = 0; i < n; ++i) {
+      sum += 1.0 / (i + 1);
+      cdf_[i] = sum;
+    }
+    for (auto& v : cdf_)
+      v /= sum;
+  }
+
+  template <typename RE> unsigned operator()(RE& re) {
+    double p = uniform_real_distribution<double>(0, 1)(re);
+    return std::lower_bound(cdf_.begin(), cdf_.end() - 1, p) - cdf_.begin();
+  }
+
+ private:
+  vector<double> cdf_;
+};
+
+// Fills dest with kSeqLen sorted unique values of gen(), as SeqEncoder expects its sets.
+template <typename Gen> void FillSet(Gen&& gen, uint32_t* dest) {
+  uint32_t* end = dest;
+  while (end != dest + kSeqLen) {
+    uint32_t val = gen();
+    if (std::find(dest, end, val) == end)
+      *end++ = val;
+  }
+  std::sort(dest, end);
+}
+
+// The datasets consist of kSeqLen sized sets. For DICT_SEQ they are drawn from a small number
+// of distinct sets over a small alphabet.
+vector<uint32_t> MakeInts(IntDataset ds) {
+  default_random_engine re(42);
+  vector<uint32_t> res(kNumInts);
+
+  switch (ds) {
+    case UNIFORM: {
+      uniform_int_distribution<uint32_t> dis(0, (1 << 20) - 1);
+      for (size_t i = 0; i < res.size(); i += kSeqLen)
+        FillSet([&] { return dis(re); }, res.data() + i);
+    } break;
+    case ZIPF: {
+      Zipf zipf(1 << 16);
+      for (size_t i = 0; i < res.size(); i += kSeqLen)
+        FillSet([&] { return zipf(re) * 7919; }, res.data() + i);
+    } break;
+    case SORTED: {
+      uniform_int_distribution<uint32_t> dis(1, 16);
+      uint32_t next = 1 << 24;
+      for (auto& v : res) {
+        next += dis(re);
+        v = next;
+      }
+    } break;
+    case DICT_SEQ: {
+      uniform_int_distribution<uint32_t> symb(0, 999);
+      vector<uint32_t> sets(1000 * kSeqLen);
+      for (size_t i = 0; i < sets.size(); i += kSeqLen)
+        FillSet([&] { return symb(re) * 1000003; }, sets.data() + i);
+      Zipf zipf(1000);
+      for (size_t i = 0; i < res.size(); i += kSeqLen) {
+        const uint32_t* set = sets.data() + zipf(re) * kSeqLen;
+        std::copy(set, set + kSeqLen, res.data() + i);
+      }
+    } break;
+    default:
+      LOG(FATAL) << "Unknown dataset " << ds;
+  }
+  return res;
+}
+
+vector<double> MakeDoubles(DoubleDataset ds) {
+  default_random_engine re(42);
+  vector<double> res(kNumInts / 2);
+
+  if (ds == PRICES) {
+    // Random walk with cent granularity.
+    uniform_int_distribution<int> step(-20, 20);
+    int64_t cents = 10000;
+    for (auto& v : res) {
+      cents = std::max<int64_t>(1, cents + step(re));
+      v = cents / 100.0;
+    }
+  } else {
+    // Smooth signal plus full precision noise.
+    normal_distribution<double> noise(0, 1e-3);
+    for (size_t i = 0; i < res.size(); ++i) {
+      res[i] = 20.5 + sin(i / 500.0) + noise(re);
+    }
+  }
+  return res;
+}
+
+const vector<uint32_t>& IntData(int ds) {
+  static vector<uint32_t> data[NUM_INT_DATASETS];
+  if (data[ds].empty())
+    data[ds] = MakeInts(IntDataset(ds));
+  return data[ds];
+}
+
+const vector<double>& DoubleData(int ds) {
+  static vector<double> data[NUM_DOUBLE_DATASETS];
+  if (data[ds].empty())
+    data[ds] = MakeDoubles(DoubleDataset(ds));
+  return data[ds];
+}
+
+void SetResult(size_t raw, size_t compressed, benchmark::State* state) {
+  state->SetBytesProcessed(state->iterations() * raw);
+  state->counters["ratio"] = double(raw) / std::max<size_t>(compressed, 1);
+}
+
+void SeqEncode(const vector<uint32_t>& src, SeqEncoder<4>* encoder) {
+  for (size_t i = 0; i < src.size(); i += kSeqLen) {
+    encoder->Add(src.data() + i, kSeqLen);
+  }
+  encoder->Flush();
+}
+
+size_t CompressedSize(const vector<strings::ByteRange>& blocks) {
+  size_t res = 0;
+  for (const auto& br : blocks)
+    res += br.size();
+  return res;
+}
+
+// Args: dataset, RawCoding.
+void BM_SeqEncode(benchmark::State& state) {
+  const auto& src = IntData(state.range(0));
+  state.SetLabel(kIntNames[state.range(0)]);
+  size_t compressed = 0;
+
+  while (state.KeepRunning()) {
+    SeqEncoder<4> encoder;
+    encoder.SetRawCoding(SeqEncoderBase::RawCoding(state.range(1)));
+    SeqEncode(src, &encoder);
+    compressed = CompressedSize(encoder.compressed_blocks());
+  }
+  SetResult(src.size() * sizeof(uint32_t), compressed, &state);
+}
+
+void BM_SeqDecode(benchmark::State& state) {
+  const auto& src = IntData(state.range(0));
+  state.SetLabel(kIntNames[state.range(0)]);
+
+  SeqEncoder<4> encoder;
+  encoder.SetRawCoding(SeqEncoderBase::RawCoding(state.range(1)));
+  SeqEncode(src, &encoder);
+  string dict;
+  bool has_dict = encoder.GetDictSerialized(&dict);
+  const auto& blocks = encoder.compressed_blocks();
+
+  while (state.KeepRunning()) {
+    SeqDecoder<4> decoder;
+    if (has_dict)
+      decoder.SetDict(reinterpret_cast<const uint8_t*>(dict.data()), dict.size());
+    size_t count = 0;
+    for (const auto& br : blocks) {
+      uint32_t consumed = 0;
+      CHECK_GE(decoder.Decompress(br, &consumed), 0);
+      for (auto page = decoder.GetNextIntPage(); !page.empty(); page = decoder.GetNextIntPage())
+        count += page.size();
+    }
+    CHECK_EQ(src.size(), count);
+  }
+  SetResult(src.size() * sizeof(uint32_t), CompressedSize(blocks) + dict.size(), &state);
+}
+
+void SeqArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"dataset", "raw_coding"});
+  for (int ds = 0; ds < NUM_INT_DATASETS; ++ds) {
+    for (int rc : {SeqEncoderBase::RAW_ZSTD, SeqEncoderBase::RAW_PFOR}) {
+      b->Args({ds, rc});
+    }
+  }
+}
+
+void DoubleEncode(const vector<double>& src, vector<uint8_t>* dest) {
+  DoubleCompressor dc;
+  size_t size = 0;
+  for (size_t i = 0; i < src.size(); i += DoubleCompressor::BLOCK_MAX_LEN) {
+    uint32_t len = std::min<size_t>(src.size() - i, DoubleCompressor::BLOCK_MAX_LEN);
+    dest->resize(size + DoubleCompressor::COMMIT_MAX_SIZE);
+    size += dc.Commit(src.data() + i, len, dest->data() + size);
+  }
+  dest->resize(size);
+}
+
+// Args: dataset.
+void BM_DoubleEncode(benchmark::State& state) {
+  const auto& src = DoubleData(state.range(0));
+  state.SetLabel(kDoubleNames[state.range(0)]);
+  vector<uint8_t> buf;
+
+  while (state.KeepRunning()) {
+    DoubleEncode(src, &buf);
+  }
+  SetResult(src.size() * sizeof(double), buf.size(), &state);
+}
+
+void BM_DoubleDecode(benchmark::State& state) {
+  const auto& src = DoubleData(state.range(0));
+  state.SetLabel(kDoubleNames[state.range(0)]);
+  vector<uint8_t> buf;
+  DoubleEncode(src, &buf);
+
+  DoubleDecompressor dd;
+  std::unique_ptr<double[]> dest(new double[DoubleDecompressor::BLOCK_MAX_LEN]);
+
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    for (const uint8_t* next = buf.data(); next < buf.data() + buf.size();) {
+      uint32_t sz = DoubleDecompressor::BlockSize(next);
+      int32_t res = dd.Decompress(next, sz, dest.get());
+      CHECK_GT(res, 0);
+      count += res;
+      next += sz;
+    }
+    CHECK_EQ(src.size(), count);
+  }
+  SetResult(src.size() * sizeof(double), buf.size(), &state);
+}
+
+// The integer datasets are compressed as their little endian bytes.
+void BlockEncode(const vector<uint32_t>& src, int level, BlockCompressor* bc) {
+  bc->set_level(level);
+  bc->Add(strings::ByteRange(reinterpret_cast<const uint8_t*>(src.data()),
+                             src.size() * sizeof(uint32_t)));
+  bc->Finalize();
+}
+
+// Args: dataset, zstd level.
+void BM_BlockEncode(benchmark::State& state) {
+  const auto& src = IntData(state.range(0));
+  state.SetLabel(kIntNames[state.range(0)]);
+  size_t compressed = 0;
+
+  while (state.KeepRunning()) {
+    BlockCompressor bc;
+    BlockEncode(src, state.range(1), &bc);
+    compressed = bc.compressed_size();
+  }
+  SetResult(src.size() * sizeof(uint32_t), compressed, &state);
+}
+
+void BM_BlockDecode(benchmark::State& state) {
+  const auto& src = IntData(state.range(0));
+  state.SetLabel(kIntNames[state.range(0)]);
+  BlockCompressor bc;
+  BlockEncode(src, state.range(1), &bc);
+
+  while (state.KeepRunning()) {
+    BlockDecompressor bdc;
+    size_t size = 0;
+    for (const auto& br : bc.compressed_blocks()) {
+      uint32_t consumed = 0;
+      CHECK_GE(bdc.Decompress(br, &consumed), 0);
+      size += bdc.GetDecompressedBlock().size();
+    }
+    CHECK_EQ(src.size() * sizeof(uint32_t), size);
+  }
+  SetResult(src.size() * sizeof(uint32_t), bc.compressed_size(), &state);
+}
+
+void BlockArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"dataset", "level"});
+  for (int ds = 0; ds < NUM_INT_DATASETS; ++ds) {
+    for (int level : {1, 3, 6, 9, 19}) {
+      b->Args({ds, level});
+    }
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_SeqEncode)->Apply(SeqArgs);
+BENCHMARK(BM_SeqDecode)->Apply(SeqArgs);
+BENCHMARK(BM_DoubleEncode)->DenseRange(0, NUM_DOUBLE_DATASETS - 1)->ArgNames({"dataset"});
+BENCHMARK(BM_DoubleDecode)->DenseRange(0, NUM_DOUBLE_DATASETS - 1)->ArgNames({"dataset"});
+BENCHMARK(BM_BlockEncode)->Apply(BlockArgs);
+BENCHMARK(BM_BlockDecode)->Apply(BlockArgs);
+
+}  // namespace util
@@ -9,6 +9,8 @@
 #include <lz4.h>
 #include <shuffle.h>
 
+#include "absl/base/casts.h"
+
 #include "base/bits.h"
 #include "base/endian.h"
 #include "base/logging.h"
@@ -30,6 +32,10 @@ static inline unsigned DecimalCost(unsigned dec_len) {
 constexpr uint8_t kRawBit = 1 << 7;
 constexpr uint8_t kHasExceptionsBit = 1 << 6;
 
+// Noisy series that do not normalize into decimals. Consecutive values share sign, exponent
+// and high mantissa bits, so their xor has long runs of zero bit planes.
+constexpr uint8_t kXorBit = 1 << 5;
+
 double FromPositive(int64_t significand, int exponent) {
   while (significand % 10 == 0) {
     significand /= 10;
@@ -202,7 +208,7 @@ uint32_t DoubleCompressor::Commit(const double* src, uint32_t count, uint8_t* de
 
   unsigned normal_cnt = NormalizeDecimals(count, src);
   if (normal_cnt < count / 2) {
-    return WriteRawDoubles(src, count, dest);
+    return WriteXorDoubles(src, count, dest);
   }
   VLOG(1) << "Cost: " << cost << " normalized count: " << normal_cnt;
 
@@ -224,7 +230,7 @@ uint32_t DoubleCompressor::Commit(const double* src, uint32_t count, uint8_t* de
                               kByteSize, LZ4_COMPRESSBOUND(kByteSize), 3 /* level */);
   CHECK_GT(res, 0);
   if ((res + 8 * exc_count) * 1.1 > kByteSize) {
-    return WriteRawDoubles(src, count, dest);
+    return WriteXorDoubles(src, count, dest);
   }
 
   aux_->header.lz4_size = res;
@@ -281,6 +287,34 @@ uint32_t DoubleCompressor::WriteRawDoubles(const double* src, uint32_t count, ui
   return sz + 3;
 }
 
+uint32_t DoubleCompressor::WriteXorDoubles(const double* src, uint32_t count, uint8_t* dest) {
+  uint64_t* xored = reinterpret_cast<uint64_t*>(aux_->normalized);
+  uint64_t prev = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    uint64_t cur = absl::bit_cast<uint64_t>(src[i]);
+    xored[i] = cur ^ prev;
+    prev = cur;
+  }
+
+  // dest serves as temporary buffer like in Commit.
+  uint8_t* shuffle_buf = reinterpret_cast<uint8_t*>(aux_->dec);
+  bitshuffle2(aux_->normalized, count, shuffle_buf, dest);
+
+  const unsigned kByteSize = sizeof(uint64_t) * count;
+  char* next = reinterpret_cast<char*>(dest) + 3;
+  int res = LZ4_compress_fast(reinterpret_cast<const char*>(shuffle_buf), next,
+                              kByteSize, LZ4_COMPRESSBOUND(kByteSize), 3 /* level */);
+  CHECK_GT(res, 0);
+  VLOG(1) << "Xor compressed " << kByteSize << " to " << res;
+
+  if (res * 1.1 > kByteSize) {
+    return WriteRawDoubles(src, count, dest);
+  }
+
+  *dest = kXorBit;
+  LittleEndian::Store16(dest + 1, res);
+  return res + 3;
+}
 
 int32_t  DoubleDecompressor::Decompress(const uint8_t* src, uint32_t src_len, double* dest) {
   if (src_len < 3 || LittleEndian::Load16(src + 1) != src_len - 3)
@@ -296,17 +330,34 @@ int32_t  DoubleDecompressor::Decompress(const uint8_t* src, uint32_t src_len, do
     memcpy(dest, src, src_len);
     return src_len / sizeof(double);
   }
-  CHECK_GT(src_len, DoubleCompressor::DECIMAL_HEADER_MAX_SIZE);
 
   if (!aux_)
     aux_.reset(new Aux);
+  constexpr size_t kMaxSize = DoubleCompressor::BLOCK_MAX_BYTES;
+
+  if ((flags & kXorBit) != 0) {
+    int res = LZ4_decompress_safe(reinterpret_cast<const char*>(src),
+                                  reinterpret_cast<char*>(aux_->z4buf), src_len, kMaxSize);
+    CHECK_GT(res, 0);
+    CHECK_EQ(0, res % 8);
+    bitunshuffle2(aux_->z4buf, res, reinterpret_cast<uint8_t*>(dest));
+
+    unsigned count = res / 8;
+    uint64_t prev = 0;
+    for (unsigned i = 0; i < count; ++i) {
+      prev ^= absl::bit_cast<uint64_t>(dest[i]);
+      dest[i] = absl::bit_cast<double>(prev);
+    }
+    return count;
+  }
+
+  CHECK_GT(src_len, DoubleCompressor::DECIMAL_HEADER_MAX_SIZE);
 
   DoubleCompressor::DecimalHeader dh;
   uint32 read = dh.Parse(flags, src);
   src_len -= read;
 
   CHECK_LE(dh.lz4_size, src_len);
-  constexpr size_t kMaxSize = DoubleCompressor::BLOCK_MAX_BYTES;
 
   src += read;
   src_len -= dh.lz4_size;
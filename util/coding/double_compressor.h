@@ -36,6 +36,10 @@ class DoubleCompressor {
   uint32_t Optimize(const ExponentMap& em);
   uint32_t WriteRawDoubles(const double* src, uint32_t sz, uint8_t* dest);
 
+  // XORs each double with its predecessor and compresses the bitshuffled result.
+  // Falls back to raw doubles if it does not compress.
+  uint32_t WriteXorDoubles(const double* src, uint32_t sz, uint8_t* dest);
+
   struct __attribute__((aligned(4))) Decimal {
     int64_t val;
     int16_t exp;
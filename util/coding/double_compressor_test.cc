@@ -4,6 +4,9 @@
 #include "util/coding/double_compressor.h"
 #include <gmock/gmock.h>
 
+#include <cmath>
+#include <random>
+
 #include "base/logging.h"
 #include "util/math/float2decimal.h"
 
@@ -78,4 +81,25 @@ TEST_F(DoubleCompressorTest, BigExp) {
   ASSERT_EQ(128, res);
 }
 
+// Noisy sensor readings do not normalize into decimals.
+TEST_F(DoubleCompressorTest, Xor) {
+  std::default_random_engine re;
+  std::normal_distribution<double> noise(0, 1e-6);
+
+  std::vector<double> inp;
+  for (unsigned i = 0; i < 4096; ++i) {
+    inp.push_back(20.5 + sin(i / 500.0) + noise(re));
+  }
+
+  unsigned sz = dc_.Commit(inp.data(), inp.size(), buf_);
+  EXPECT_EQ(sz, DoubleDecompressor::BlockSize(buf_));
+  EXPECT_LT(sz, inp.size() * sizeof(double) * 3 / 4);
+
+  int res = dd_.Decompress(buf_, sz, actual_);
+  ASSERT_EQ(inp.size(), res);
+  for (unsigned i = 0; i < inp.size(); ++i) {
+    ASSERT_EQ(inp[i], actual_[i]) << i;
+  }
+}
+
 }  // namespace util
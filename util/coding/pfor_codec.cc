@@ -0,0 +1,317 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/coding/pfor_codec.h"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/varint.h"
+
+namespace util {
+namespace pfor {
+
+/* Block layout:
+     header byte: bit width in bits 0-5, kDeltaFlag if the block stores deltas.
+     varint32 frame of reference (minimum of the stored values).
+     exception count byte.
+     16 * width bytes of packed values in 4 interleaved lanes: lane j packs the integers
+     4k + j, k = 0..31, so the k-th 128 bit vector of the input is shifted in as a whole.
+     exception positions, one byte each.
+     exception high bits (value >> width) as varints.
+*/
+namespace {
+
+constexpr uint8_t kDeltaFlag = 0x40;
+constexpr uint8_t kWidthMask = 0x3f;
+
+constexpr unsigned kVecPerBlock = kBlockSize / 4;
+
+using UnpackFn = void (*)(const uint8_t* src, uint32_t* dest);
+using PackFn = void (*)(const uint32_t* src, uint8_t* dest);
+
+inline unsigned BitWidth(uint32_t v) { return v ? 32 - __builtin_clz(v) : 0; }
+
+inline uint32_t ZigZag(uint32_t v) { return (v << 1) ^ uint32_t(int32_t(v) >> 31); }
+
+inline uint32_t UnZigZag(uint32_t v) { return (v >> 1) ^ -(v & 1); }
+
+template <unsigned B> void Pack(const uint32_t* src, uint8_t* dest) {
+  if (B == 0)
+    return;
+
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  __m128i* out = reinterpret_cast<__m128i*>(dest);
+  __m128i acc = _mm_setzero_si128();
+  unsigned shift = 0;
+
+  for (unsigned k = 0; k < kVecPerBlock; ++k) {
+    __m128i v = _mm_loadu_si128(in + k);
+    acc = _mm_or_si128(acc, _mm_slli_epi32(v, shift));
+    if (shift + B >= 32) {
+      _mm_storeu_si128(out++, acc);
+      acc = shift + B > 32 ? _mm_srli_epi32(v, 32 - shift) : _mm_setzero_si128();
+      shift = shift + B - 32;
+    } else {
+      shift += B;
+    }
+  }
+}
+
+template <unsigned B> void Unpack(const uint8_t* src, uint32_t* dest) {
+  __m128i* out = reinterpret_cast<__m128i*>(dest);
+  if (B == 0) {
+    for (unsigned k = 0; k < kVecPerBlock; ++k)
+      _mm_storeu_si128(out + k, _mm_setzero_si128());
+    return;
+  }
+
+  const __m128i mask = _mm_set1_epi32(uint32_t((1ULL << B) - 1));
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  __m128i w = _mm_loadu_si128(in);
+  unsigned shift = 0;
+
+  for (unsigned k = 0; k < kVecPerBlock; ++k) {
+    __m128i v = _mm_srli_epi32(w, shift);
+    if (shift + B > 32) {
+      w = _mm_loadu_si128(++in);
+      v = _mm_or_si128(v, _mm_slli_epi32(w, 32 - shift));
+      shift = shift + B - 32;
+    } else if (shift + B == 32) {
+      shift = 0;
+      if (k + 1 < kVecPerBlock)
+        w = _mm_loadu_si128(++in);
+    } else {
+      shift += B;
+    }
+    _mm_storeu_si128(out + k, _mm_and_si128(v, mask));
+  }
+}
+
+template <size_t... I> const PackFn* PackTable(std::index_sequence<I...>) {
+  static const PackFn table[] = {&Pack<I>...};
+  return table;
+}
+
+template <size_t... I> const UnpackFn* UnpackTable(std::index_sequence<I...>) {
+  static const UnpackFn table[] = {&Unpack<I>...};
+  return table;
+}
+
+const PackFn* const kPack = PackTable(std::make_index_sequence<33>());
+const UnpackFn* const kUnpack = UnpackTable(std::make_index_sequence<33>());
+
+struct Choice {
+  uint32_t ref = 0;
+  unsigned width = 32;
+  size_t cost = SIZE_MAX;
+};
+
+// Chooses the width that minimizes the packed size plus the exceptions' size.
+// Every exception is priced as the widest one, it is exact for the common case of a few
+// outliers of similar magnitude and keeps the search linear.
+Choice Analyze(const uint32_t* vals) {
+  Choice res;
+  res.ref = vals[0];
+  for (unsigned i = 1; i < kBlockSize; ++i) {
+    res.ref = std::min(res.ref, vals[i]);
+  }
+
+  // Two interleaved histograms break the store to load dependency on repeated widths.
+  uint8_t hist2[2][33] = {{0}};
+  for (unsigned i = 0; i < kBlockSize; i += 2) {
+    ++hist2[0][BitWidth(vals[i] - res.ref)];
+    ++hist2[1][BitWidth(vals[i + 1] - res.ref)];
+  }
+
+  unsigned max_w = 32;
+  while (max_w > 0 && hist2[0][max_w] + hist2[1][max_w] == 0)
+    --max_w;
+
+  size_t ref_cost = Varint::Length32(res.ref);
+  unsigned num_exc = 0;
+  for (unsigned b = max_w + 1; b-- > 0;) {
+    size_t cost = ref_cost + b * 16 + num_exc * (1 + (max_w - b + 6) / 7);
+    if (cost <= res.cost) {
+      res.cost = cost;
+      res.width = b;
+    }
+    num_exc += hist2[0][b] + hist2[1][b];
+  }
+  return res;
+}
+
+uint8_t* EncodeBlock(const uint32_t* src, uint32_t prev, uint8_t* dest) {
+  uint32_t delta[kBlockSize], low[kBlockSize];
+  delta[0] = src[0] - prev;
+  for (unsigned i = 1; i < kBlockSize; ++i) {
+    delta[i] = src[i] - src[i - 1];
+  }
+
+  Choice raw = Analyze(src), dlt = Analyze(delta);
+  const bool use_delta = dlt.cost < raw.cost;
+  const Choice& choice = use_delta ? dlt : raw;
+  const uint32_t* vals = use_delta ? delta : src;
+  const unsigned b = choice.width;
+  const uint32_t mask = uint32_t((1ULL << b) - 1);
+
+  uint8_t exc_pos[kBlockSize];
+  uint32_t exc_val[kBlockSize];
+  unsigned num_exc = 0;
+
+  for (unsigned i = 0; i < kBlockSize; ++i) {
+    uint32_t v = vals[i] - choice.ref;
+    low[i] = v & mask;
+    if (b < 32 && (v >> b)) {
+      exc_pos[num_exc] = i;
+      exc_val[num_exc++] = v >> b;
+    }
+  }
+
+  *dest++ = b | (use_delta ? kDeltaFlag : 0);
+  dest = Varint::Encode32(dest, choice.ref);
+  *dest++ = num_exc;
+  kPack[b](low, dest);
+  dest += 16 * b;
+
+  memcpy(dest, exc_pos, num_exc);
+  dest += num_exc;
+  for (unsigned j = 0; j < num_exc; ++j) {
+    dest = Varint::Encode32(dest, exc_val[j]);
+  }
+
+  return dest;
+}
+
+// Adds ref to dest with a running prefix sum seeded with prev. Returns the last value.
+uint32_t PrefixSum(uint32_t ref, uint32_t prev, uint32_t* dest) {
+  __m128i* io = reinterpret_cast<__m128i*>(dest);
+  const __m128i ref_v = _mm_set1_epi32(ref);
+  __m128i run = _mm_set1_epi32(prev);
+
+  for (unsigned k = 0; k < kVecPerBlock; ++k) {
+    __m128i v = _mm_add_epi32(_mm_loadu_si128(io + k), ref_v);
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, run);
+    run = _mm_shuffle_epi32(v, 0xff);
+    _mm_storeu_si128(io + k, v);
+  }
+  return dest[kBlockSize - 1];
+}
+
+void AddRef(uint32_t ref, uint32_t* dest) {
+  __m128i* io = reinterpret_cast<__m128i*>(dest);
+  const __m128i ref_v = _mm_set1_epi32(ref);
+
+  for (unsigned k = 0; k < kVecPerBlock; ++k) {
+    _mm_storeu_si128(io + k, _mm_add_epi32(_mm_loadu_si128(io + k), ref_v));
+  }
+}
+
+// Returns the pointer past the block or null if it is malformed.
+const uint8_t* DecodeBlock(const uint8_t* src, const uint8_t* end, uint32_t* prev,
+                           uint32_t* dest) {
+  if (src >= end)
+    return nullptr;
+
+  uint8_t hdr = *src++;
+  unsigned b = hdr & kWidthMask;
+  uint32_t ref;
+
+  if (b > 32 || (hdr & ~(kWidthMask | kDeltaFlag)))
+    return nullptr;
+  src = Varint::Parse32WithLimit(src, end, &ref);
+  if (!src || src >= end)
+    return nullptr;
+
+  unsigned num_exc = *src++;
+  if (num_exc > kBlockSize || (num_exc && b == 32) || end - src < 16 * b + num_exc)
+    return nullptr;
+
+  kUnpack[b](src, dest);
+  src += 16 * b;
+
+  const uint8_t* exc_pos = src;
+  src += num_exc;
+  for (unsigned j = 0; j < num_exc; ++j) {
+    uint32_t high;
+    src = Varint::Parse32WithLimit(src, end, &high);
+    if (!src || exc_pos[j] >= kBlockSize)
+      return nullptr;
+    dest[exc_pos[j]] |= high << b;
+  }
+
+  if (hdr & kDeltaFlag) {
+    *prev = PrefixSum(ref, *prev, dest);
+  } else {
+    AddRef(ref, dest);
+    *prev = dest[kBlockSize - 1];
+  }
+
+  return src;
+}
+
+}  // namespace
+
+size_t Encode(const uint32_t* src, size_t cnt, uint8_t* dest) {
+  CHECK_LE(cnt, UINT32_MAX);
+
+  uint8_t* next = Varint::Encode32(dest, cnt);
+  uint32_t prev = 0;
+  size_t i = 0;
+
+  for (; i + kBlockSize <= cnt; i += kBlockSize) {
+    next = EncodeBlock(src + i, prev, next);
+    prev = src[i + kBlockSize - 1];
+  }
+
+  for (; i < cnt; ++i) {
+    next = Varint::Encode32(next, ZigZag(src[i] - prev));
+    prev = src[i];
+  }
+
+  return next - dest;
+}
+
+int64_t DecodedCount(const uint8_t* src, size_t size) {
+  uint32_t cnt;
+  if (!Varint::Parse32WithLimit(src, src + size, &cnt))
+    return -1;
+  return cnt;
+}
+
+bool Decode(const uint8_t* src, size_t size, uint32_t* dest) {
+  const uint8_t* end = src + size;
+  uint32_t cnt;
+  src = Varint::Parse32WithLimit(src, end, &cnt);
+  if (!src)
+    return false;
+
+  uint32_t prev = 0;
+  size_t i = 0;
+  for (; i + kBlockSize <= cnt; i += kBlockSize) {
+    src = DecodeBlock(src, end, &prev, dest + i);
+    if (!src)
+      return false;
+  }
+
+  size_t tail = cnt - i;
+  src = Varint::ParseN(src, end, dest + i, tail);
+  if (!src)
+    return false;
+
+  for (; i < cnt; ++i) {
+    prev += UnZigZag(dest[i]);
+    dest[i] = prev;
+  }
+
+  return src == end;
+}
+
+}  // namespace pfor
+}  // namespace util
@@ -0,0 +1,37 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// Patched frame-of-reference codec for 32 bit integers.
+// The input is split into blocks of kBlockSize integers. Each block is optionally delta coded,
+// reduced by its minimum and bit-packed with the width that minimizes the block size. The values
+// that do not fit into that width are stored as exceptions and patched back after unpacking.
+// The blocks are packed in 4 interleaved 32bit lanes, so both encoding and decoding
+// run with SSE2 shifts and masks. The last incomplete block is stored as zigzag-delta varints.
+namespace pfor {
+
+constexpr unsigned kBlockSize = 128;
+
+// Upper bound on the size written by Encode.
+constexpr size_t MaxEncodedSize(size_t cnt) {
+  return 5 + (cnt / kBlockSize) * (kBlockSize * 4 + 7) + (cnt % kBlockSize) * 5;
+}
+
+// dest must have at least MaxEncodedSize(cnt) bytes. Returns number of bytes written.
+size_t Encode(const uint32_t* src, size_t cnt, uint8_t* dest);
+
+// Returns the number of integers encoded in src or -1 if the header is malformed.
+int64_t DecodedCount(const uint8_t* src, size_t size);
+
+// dest must have room for DecodedCount(src, size) integers.
+// Returns false if src is malformed.
+bool Decode(const uint8_t* src, size_t size, uint32_t* dest);
+
+}  // namespace pfor
+}  // namespace util
@@ -0,0 +1,131 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/coding/pfor_codec.h"
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace util {
+namespace pfor {
+
+using namespace std;
+
+class PForTest : public testing::Test {
+ protected:
+  // Returns the encoded size.
+  size_t Roundtrip(const vector<uint32_t>& src) {
+    buf_.resize(MaxEncodedSize(src.size()));
+    size_t sz = Encode(src.data(), src.size(), buf_.data());
+    EXPECT_LE(sz, buf_.size());
+    EXPECT_EQ(src.size(), DecodedCount(buf_.data(), sz));
+
+    vector<uint32_t> dest(src.size());
+    EXPECT_TRUE(Decode(buf_.data(), sz, dest.data()));
+    EXPECT_EQ(src, dest);
+
+    return sz;
+  }
+
+  vector<uint8_t> buf_;
+  default_random_engine re_;
+};
+
+TEST_F(PForTest, Small) {
+  EXPECT_EQ(1, Roundtrip({}));
+  Roundtrip({1, 2, 3, 6, 7, 8});
+  Roundtrip({10, 5, 0, UINT32_MAX, 7});
+}
+
+TEST_F(PForTest, Widths) {
+  for (unsigned b = 0; b <= 32; ++b) {
+    uniform_int_distribution<uint64_t> dis(0, (1ULL << b) - 1);
+    vector<uint32_t> v(kBlockSize * 3 + 17);
+    for (auto& val : v)
+      val = dis(re_);
+    size_t sz = Roundtrip(v);
+    ASSERT_LE(sz, 1 + 3 * (7 + 16 * b) + 17 * 5) << b;
+  }
+}
+
+TEST_F(PForTest, SortedDelta) {
+  vector<uint32_t> v(kBlockSize * 100);
+  uniform_int_distribution<uint32_t> dis(0, 15);
+  uint32_t next = 1 << 30;
+  for (auto& val : v) {
+    next += dis(re_);
+    val = next;
+  }
+
+  // 4 bits per delta.
+  size_t sz = Roundtrip(v);
+  EXPECT_LT(sz, v.size() / 2 + 100 * 8);
+}
+
+TEST_F(PForTest, Exceptions) {
+  vector<uint32_t> v(kBlockSize * 10);
+  uniform_int_distribution<uint32_t> dis(0, 127);
+  for (auto& val : v)
+    val = dis(re_);
+  for (size_t i = 0; i < v.size(); i += 37)
+    v[i] = UINT32_MAX - i;
+
+  size_t sz = Roundtrip(v);
+
+  // 7 bit frames with patched outliers.
+  EXPECT_LT(sz, v.size() * 7 / 8 + v.size() / 37 * 6 + 10 * 7);
+}
+
+TEST_F(PForTest, Malformed) {
+  vector<uint32_t> v(kBlockSize + 5, 1000);
+  buf_.resize(MaxEncodedSize(v.size()));
+  size_t sz = Encode(v.data(), v.size(), buf_.data());
+
+  vector<uint32_t> dest(v.size());
+  EXPECT_FALSE(Decode(buf_.data(), sz - 1, dest.data()));
+  EXPECT_FALSE(Decode(buf_.data(), 3, dest.data()));
+  EXPECT_EQ(-1, DecodedCount(buf_.data(), 0));
+}
+
+static void BM_PForDecode(benchmark::State& state) {
+  vector<uint32_t> v(1 << 16);
+  default_random_engine re;
+  uniform_int_distribution<uint32_t> dis(0, state.range(0));
+  uint32_t next = 0;
+  for (auto& val : v) {
+    next += dis(re);
+    val = next;
+  }
+  vector<uint8_t> buf(MaxEncodedSize(v.size()));
+  size_t sz = Encode(v.data(), v.size(), buf.data());
+
+  while (state.KeepRunning()) {
+    CHECK(Decode(buf.data(), sz, v.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * v.size() * sizeof(uint32_t));
+}
+BENCHMARK(BM_PForDecode)->Arg(15)->Arg(1000)->Arg(1 << 20);
+
+static void BM_PForEncode(benchmark::State& state) {
+  vector<uint32_t> v(1 << 16);
+  default_random_engine re;
+  uniform_int_distribution<uint32_t> dis(0, state.range(0));
+  uint32_t next = 0;
+  for (auto& val : v) {
+    next += dis(re);
+    val = next;
+  }
+  vector<uint8_t> buf(MaxEncodedSize(v.size()));
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(Encode(v.data(), v.size(), buf.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * v.size() * sizeof(uint32_t));
+}
+BENCHMARK(BM_PForEncode)->Arg(15)->Arg(1000);
+
+}  // namespace pfor
+}  // namespace util
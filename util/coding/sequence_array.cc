@@ -6,6 +6,8 @@
 #define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
 
+#include <cstring>
+
 #include "base/endian.h"
 #include "base/flit.h"
 #include "base/logging.h"
@@ -28,6 +30,15 @@ inline size_t GetContentSizeChecked(const uint8_t* src, uint32_t size) {
   return content_size;
 }
 
+/* Mappable layout, all integers are little endian:
+     uint32 kMappableMagic, uint32 reserved, uint64 count.
+     uint64 offsets[count + 1] - prefix sums of the lengths, offsets[count] is the data size.
+     data bytes.
+   Offsets are 8 byte aligned if the buffer is.
+*/
+constexpr uint32_t kMappableMagic = 0x4d415153;  // "SQAM"
+constexpr size_t kMappableHeaderSize = 16;
+
 }  // namespace
 
 size_t SequenceArray::GetMaxSerializedSize() const {
@@ -79,12 +90,12 @@ void SequenceArray::SerializeFrom(const uint8_t* src, uint32_t count) {
   CHECK(!ZSTD_isError(res)) << ZSTD_getErrorName(res);
   CHECK_EQ(res, len_content_size);
 
+  // Every value takes at least a byte.
   const uint8_t* next = len_buf.get();
-  while (next < len_buf.get() + res) {
-    uint32_t val;
-    next += flit::ParseT(next, &val);
-    len_.push_back(val);
-  }
+  size_t prev_size = len_.size();
+  len_.resize(prev_size + res);
+  size_t cnt = flit::DecodeN(next, next + res, res, len_.data() + prev_size, &next);
+  len_.resize(prev_size + cnt);
   CHECK_EQ(next, len_buf.get() + res);
   uint32_t buf_sz = count - 4 - len_sz;
   src += len_sz;
@@ -96,6 +107,59 @@ void SequenceArray::SerializeFrom(const uint8_t* src, uint32_t count) {
   CHECK_EQ(buf_content_size, res);
 }
 
+size_t SequenceArray::GetMappableSize() const {
+  return kMappableHeaderSize + (len_.size() + 1) * sizeof(uint64_t) + data_.size();
+}
+
+size_t SequenceArray::SerializeMappable(uint8* dest) const {
+  LittleEndian::Store32(dest, kMappableMagic);
+  LittleEndian::Store32(dest + 4, 0);
+  LittleEndian::Store64(dest + 8, len_.size());
+
+  uint8* next = dest + kMappableHeaderSize;
+  uint64_t offset = 0;
+  for (const uint32_t val : len_) {
+    LittleEndian::Store64(next, offset);
+    next += sizeof(uint64_t);
+    offset += val;
+  }
+  DCHECK_EQ(offset, data_.size());
+  LittleEndian::Store64(next, offset);
+  next += sizeof(uint64_t);
+
+  if (!data_.empty())
+    memcpy(next, data_.data(), data_.size());
+
+  return next + data_.size() - dest;
+}
+
+bool SequenceArrayView::Init(const uint8* src, size_t size) {
+  *this = SequenceArrayView{};
+
+  if (size < kMappableHeaderSize + sizeof(uint64_t) ||
+      LittleEndian::Load32(src) != kMappableMagic) {
+    return false;
+  }
+
+  uint64_t count = LittleEndian::Load64(src + 8);
+  size_t max_count = (size - kMappableHeaderSize) / sizeof(uint64_t) - 1;
+  if (count > max_count)
+    return false;
+
+  const uint8* offsets = src + kMappableHeaderSize;
+  const uint8* data = offsets + (count + 1) * sizeof(uint64_t);
+  if (LittleEndian::Load64(data - sizeof(uint64_t)) != size_t(src + size - data))
+    return false;
+
+  offsets_ = offsets;
+  data_ = data;
+  count_ = count;
+  return true;
+}
+
+size_t SequenceArrayView::data_size() const {
+  return offsets_ ? LittleEndian::Load64(offsets_ + count_ * sizeof(uint64_t)) : 0;
+}
 
 }  // namespace util
 
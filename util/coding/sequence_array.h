@@ -3,6 +3,8 @@
 //
 #pragma once
 
+#include "base/endian.h"
+#include "base/logging.h"
 #include "base/pod_array.h"
 #include "strings/range.h"
 
@@ -67,6 +69,68 @@ class SequenceArray {
   size_t GetMaxSerializedSize() const;
   size_t SerializeTo(uint8* dest) const;
   void SerializeFrom(const uint8_t* src, uint32_t count);
+
+  // Uncompressed layout that is accessed in place by SequenceArrayView, for example straight
+  // from a mmap-ed file. SerializeMappable writes exactly GetMappableSize() bytes.
+  size_t GetMappableSize() const;
+  size_t SerializeMappable(uint8* dest) const;
+};
+
+// Read-only view over a buffer written by SequenceArray::SerializeMappable.
+// Init validates the header only, hence it takes O(1) regardless of the array size.
+// Sequences are accessed in O(1) by index via the stored prefix offsets.
+// The buffer must outlive the view.
+class SequenceArrayView {
+ public:
+  class Iterator {
+    const uint8* data_;
+    const uint8* poff_;
+
+   public:
+    Iterator(const uint8* data, const uint8* poff) : data_(data), poff_(poff) {
+    }
+
+    strings::ByteRange operator*() const {
+      uint64 start = LittleEndian::Load64(poff_);
+      uint64 next = LittleEndian::Load64(poff_ + sizeof(uint64));
+      return strings::ByteRange(data_ + start, next - start);
+    }
+
+    Iterator& operator++() {
+      poff_ += sizeof(uint64);
+      return *this;
+    }
+
+    bool operator==(const Iterator& o) const {
+      return poff_ == o.poff_;
+    }
+
+    bool operator!=(const Iterator& o) const {
+      return !(*this == o);
+    }
+  };
+
+  typedef Iterator const_iterator;
+
+  // Returns false if src does not start with a mappable SequenceArray of exactly size bytes.
+  bool Init(const uint8* src, size_t size);
+
+  bool empty() const { return count_ == 0; }
+  size_t size() const { return count_; }
+  size_t data_size() const;
+
+  strings::ByteRange operator[](size_t index) const {
+    DCHECK_LT(index, count_);
+    return *Iterator(data_, offsets_ + index * sizeof(uint64));
+  }
+
+  const_iterator begin() const { return Iterator(data_, offsets_); }
+  const_iterator end() const { return Iterator(data_, offsets_ + count_ * sizeof(uint64)); }
+
+ private:
+  const uint8* offsets_ = nullptr;
+  const uint8* data_ = nullptr;
+  size_t count_ = 0;
 };
 
 
@@ -17,6 +17,7 @@
 
 #include "strings/join.h"
 #include "base/flit.h"
+#include "util/coding/pfor_codec.h"
 
 #ifndef IS_LITTLE_ENDIAN
 #error this file assumes little endian architecture
@@ -446,25 +447,57 @@ void SeqEncoderBase::AnalyzePreDict() {
 void SeqEncoderBase::CompressRawLit(bool final) {
   DCHECK_EQ(state_, NO_LIT_DICT);
 
-  size_t csz1 = ZSTD_compressBound(lit_data_.size());
-
-  compress_data_.reserve(csz1);
-  size_t res = ZSTD_compress(compress_data_.begin(), csz1,
-                             lit_data_.data(), lit_data_.size(), 1);
-  CHECK(!ZSTD_isError(res)) << ZSTD_getErrorName(res);
-  VLOG(1) << "CompressRawLit: from " << lit_data_.size() << " to " << res;
-
-  BlockHeader bh;
-  bh.flags = (final ? BlockHeader::kFinalBit : 0);
+  // The decoder inflates each block into SEQ_BLOCK_SIZE buffer.
+  const uint8_t* src = lit_data_.data();
+  size_t left = lit_data_.size();
+  do {
+    uint32_t sz = std::min<size_t>(left, SEQ_BLOCK_SIZE);
+    left -= sz;
 
-  bh.sequence_size_comprs = res;
+    BlockHeader bh;
+    bh.flags = (final && left == 0 ? BlockHeader::kFinalBit : 0);
+    bh.sequence_size_comprs = CompressRawBlock(src, sz, &bh.flags);
 
-  AddCompressedBuf(bh);
+    AddCompressedBuf(bh);
+    src += sz;
+  } while (left > 0);
 
   lit_data_.clear();
   len_code_.clear();
 }
 
+uint32_t SeqEncoderBase::CompressRawBlock(const uint8_t* src, uint32_t size, uint8_t* flags) {
+  size_t csz1 = ZSTD_compressBound(size);
+  size_t pfor_sz = SIZE_MAX;
+  bool use_pfor = literal_size_ == 4 && raw_coding_ != RAW_ZSTD;
+
+  if (use_pfor) {
+    uint32_t cnt = size / sizeof(uint32_t);
+    compress_data_.reserve(std::max(csz1, pfor::MaxEncodedSize(cnt)));
+    pfor_sz = pfor::Encode(reinterpret_cast<const uint32_t*>(src), cnt, compress_data_.begin());
+    if (raw_coding_ == RAW_PFOR) {
+      *flags |= BlockHeader::kPForBit;
+      return pfor_sz;
+    }
+    tmp_space_.reserve(pfor_sz);
+    memcpy(tmp_space_.data(), compress_data_.data(), pfor_sz);
+  } else {
+    compress_data_.reserve(csz1);
+  }
+
+  size_t res = ZSTD_compress(compress_data_.begin(), csz1, src, size, 1);
+  CHECK_ZSTDERR(res);
+  VLOG(1) << "CompressRawBlock: from " << size << " to " << res << "/" << pfor_sz;
+
+  if (pfor_sz < res) {
+    memcpy(compress_data_.data(), tmp_space_.data(), pfor_sz);
+    *flags |= BlockHeader::kPForBit;
+    res = pfor_sz;
+  }
+
+  return res;
+}
+
 void SeqEncoderBase::CompressFlitSequences(bool final) {
   DCHECK_EQ(state_, LIT_DICT);
   CHECK_LT(len_code_.size(), kLenLimit);
@@ -649,15 +682,16 @@ void SeqEncoderBase::AnalyzeSequenceDict() {
     CHECK(it != seq_map_.end());
     const EntryVal& ev = it->second;
 
+    // Dictionary references do not take space in lit_data_ but still count towards kLenLimit.
+    if (dest_index + 1 == kLenLimit ||
+        (ev.ref_cnt < 2 && len + lit_data_.size() > SEQ_BLOCK_SIZE)) {
+      len_code_.resize_assume_reserved(dest_index);
+      CompressFlitSequences(false);
+      dest_index = 0;
+    }
+
     // Copy into dict_seq_ entries with larger reference count first.
     if (ev.ref_cnt < 2) {
-      if (len + lit_data_.size() > SEQ_BLOCK_SIZE ||
-        dest_index >= kLenLimit) {
-        len_code_.resize_assume_reserved(dest_index);
-        CompressFlitSequences(false);
-        dest_index = 0;
-      }
-
       lit_data_.insert(ref_entry.begin(), ref_entry.end());
       ++inline_index;
 
@@ -683,7 +717,8 @@ bool SeqEncoderBase::PrepareForSymbAvailability(uint32_t cnt) {
   DCHECK(lit_data_.capacity() == SEQ_BLOCK_SIZE || lit_data_.capacity() == MAX_BATCH_SIZE);
   DCHECK(!seq_map_.empty() || lit_data_.capacity() == SEQ_BLOCK_SIZE);
 
-  if (cnt * sizeof(SymbId) + lit_data_.size() > lit_data_.capacity()) {
+  if (cnt * sizeof(SymbId) + lit_data_.size() > lit_data_.capacity() ||
+      len_code_.size() + 1 >= kLenLimit) {
     if (!seq_map_.empty()) {
       // Decide whether to use sequence dictionary.
       AnalyzeSequenceDict();
@@ -790,7 +825,12 @@ template <size_t INT_SIZE> void SeqEncoder<INT_SIZE>::Add(const UT* src, unsigne
         finished = AddDictEncoded(src, cnt);
       break;
       case NO_LIT_DICT:
-        LOG(FATAL) << "TBD";
+        if (added_bytes + lit_data_.size() > lit_data_.capacity()) {
+          CompressRawLit(false);
+        }
+        memcpy(lit_data_.end(), src, added_bytes);
+        lit_data_.resize_assume_reserved(lit_data_.size() + added_bytes);
+        finished = true;
       break;
     }
   } while (!finished);
@@ -952,12 +992,15 @@ int SeqDecoderBase::Decompress(strings::ByteRange br, uint32_t* consumed) {
 
     next_flit_ptr_ = data_buf_.data() + zstd_cntx_->offset();
     uint32_t sz;
+
+    // The block has no literal data when all its sequences reference the dictionary.
+    const uint8_t* seq_end = br.data() + bh_.sequence_size_comprs;
     while (true) {
       sz = ZSTD_nextSrcSizeToDecompress(zstd_cntx_->context);
-      CHECK_LE(sz, br.size());
-      if (sz == 0) {
+      if (sz == 0 || br.data() == seq_end) {
         break;
       }
+      CHECK_LE(br.data() + sz, seq_end);
 
       size_t res = ZSTD_decompressContinue(zstd_cntx_->context, next_flit_ptr_,
                                            SEQ_BLOCK_SIZE, br.data(), sz);
@@ -979,6 +1022,15 @@ int SeqDecoderBase::Decompress(strings::ByteRange br, uint32_t* consumed) {
       zstd_cntx_->start |= 2;
       DCHECK(bh_.flags & BlockHeader::kFinalBit);
     }
+  } else if (bh_.flags & BlockHeader::kPForBit) {
+    int64_t cnt = pfor::DecodedCount(br.data(), bh_.sequence_size_comprs);
+    CHECK_GE(cnt, 0);
+    CHECK_LE(cnt * sizeof(uint32_t), data_buf_.capacity());
+
+    bool res = pfor::Decode(br.data(), bh_.sequence_size_comprs,
+                            reinterpret_cast<uint32_t*>(data_buf_.data()));
+    CHECK(res) << "Corrupted pfor block";
+    data_buf_.resize_assume_reserved(cnt * sizeof(uint32_t));
   } else {
     size_t res = ZSTD_decompress(data_buf_.data(), data_buf_.capacity(), br.data(),
                                  bh_.sequence_size_comprs);
@@ -986,6 +1038,7 @@ int SeqDecoderBase::Decompress(strings::ByteRange br, uint32_t* consumed) {
     data_buf_.resize_assume_reserved(res);
   }
 
+  raw_offset_ = 0;
   *consumed += total_sz;
   read_header_ = false;
   return (bh_.flags & BlockHeader::kFinalBit) ? 0 : 1;
@@ -998,12 +1051,8 @@ void SeqDecoderBase::DecompressCodes(const uint8_t* src) {
                                bh_.byte_len_size_comprs);
   CHECK(!ZSTD_isError(res)) << ZSTD_getErrorName(res);
 
-  uint8_t* next = code_buf_.data(), *end = next + res;
-  size_t index = 0;
-  while (next < end && index < len_code_.size()) {
-    next += flit::ParseT(next, &len_code_[index]);
-    index++;
-  }
+  const uint8_t* next = code_buf_.data(), *end = next + res;
+  size_t index = flit::DecodeN(next, end, len_code_.size(), len_code_.data(), &next);
   CHECK_EQ(index, len_code_.size());
   CHECK_EQ(next, end);
 }
@@ -1039,7 +1088,6 @@ void SeqDecoderBase::InflateSequences() {
 
 
 template<size_t INT_SIZE> SeqDecoder<INT_SIZE>::SeqDecoder() {
-  int_buf_.reserve(SEQ_BLOCK_SIZE / INT_SIZE);
 }
 
 template<size_t INT_SIZE> auto SeqDecoder<INT_SIZE>::GetNextIntPage() -> IntRange {
@@ -1055,13 +1103,43 @@ template<size_t INT_SIZE> auto SeqDecoder<INT_SIZE>::GetNextIntPage() -> IntRang
     return res;
   }
 
-  next_int_ptr_ = int_buf_.data();
+  // Allocated lazily, GetNextInts does not need it.
+  int_buf_.reserve(SEQ_BLOCK_SIZE / INT_SIZE);
 
-  InflateSequences();
+  IntRange res = InflateInto(int_buf_.data(), int_buf_.capacity());
+  int_buf_.resize_assume_reserved(res.size());
+
+  return res;
+}
+
+template<size_t INT_SIZE> auto SeqDecoder<INT_SIZE>::GetNextInts(UT* dest, size_t capacity)
+    -> IntRange {
+  if (!(bh_.flags & BlockHeader::kDictBit)) {
+    CHECK_EQ(0, data_buf_.size() % INT_SIZE);
+
+    size_t left = data_buf_.size() > raw_offset_ ? data_buf_.size() - raw_offset_ : 0;
+    size_t sz = std::min(left / INT_SIZE, capacity);
+    memcpy(dest, data_buf_.data() + raw_offset_, sz * INT_SIZE);
+    raw_offset_ += sz * INT_SIZE;
+
+    return IntRange(dest, sz);
+  }
 
-  int_buf_.resize_assume_reserved(next_int_ptr_ - int_buf_.data());
+  IntRange res = InflateInto(dest, capacity);
+  CHECK(!res.empty() || next_seq_id_ == len_code_.size())
+      << "capacity " << capacity << " does not fit sequence " << next_seq_id_;
+
+  return res;
+}
+
+template<size_t INT_SIZE> auto SeqDecoder<INT_SIZE>::InflateInto(UT* dest, size_t capacity)
+    -> IntRange {
+  next_int_ptr_ = dest;
+  int_end_ = dest + capacity;
+
+  InflateSequences();
 
-  return IntRange(int_buf_.data(), next_int_ptr_);
+  return IntRange(dest, next_int_ptr_);
 }
 
 template<size_t INT_SIZE> void SeqDecoder<INT_SIZE>::SetLitDict(strings::ByteRange br) {
@@ -1073,11 +1151,10 @@ template<size_t INT_SIZE> void SeqDecoder<INT_SIZE>::SetLitDict(strings::ByteRan
 
 
 template<size_t INT_SIZE> bool SeqDecoder<INT_SIZE>::AddFlitSeq(strings::ByteRange src) {
-  size_t sz = next_int_ptr_ - int_buf_.begin();
-  if (sz >= int_buf_.capacity())
+  if (next_int_ptr_ >= int_end_)
     return false;
 
-  uint32_t left_capacity = int_buf_.capacity() - sz;
+  uint32_t left_capacity = int_end_ - next_int_ptr_;
   uint32_t expanded =
       internal::DeflateFlitAndMap(
         src.data(), src.size(),
@@ -87,7 +87,8 @@ template<typename T> class LiteralDict : public LiteralDictBase {
 
 
 struct BlockHeader {
-  enum { kDictBit = 0x1, kFinalBit = 0x2, kDictSeqBit = 0x4 };
+  // kPForBit - raw literals are encoded with pfor codec instead of zstd.
+  enum { kDictBit = 0x1, kFinalBit = 0x2, kDictSeqBit = 0x4, kPForBit = 0x8 };
 
   uint8_t flags;  // use dictionary.
 
@@ -113,6 +114,11 @@ struct BlockHeader {
 
 class SeqEncoderBase {
  public:
+  // How literals are encoded when there is no literal dictionary.
+  // RAW_AUTO chooses per block the smaller of zstd and pfor. pfor applies only to 4 byte
+  // integers, 8 byte integers always use zstd.
+  enum RawCoding : uint8_t { RAW_AUTO, RAW_ZSTD, RAW_PFOR };
+
   SeqEncoderBase();
 
   virtual ~SeqEncoderBase();
@@ -128,6 +134,8 @@ class SeqEncoderBase {
 
   void DisableSeqDictionary() { disable_seq_dict_ = true; }
 
+  void SetRawCoding(RawCoding rc) { raw_coding_ = rc; }
+
   uint32 Cost() const;
 
   void Flush();
@@ -144,9 +152,12 @@ class SeqEncoderBase {
   // Empties lit_data_  buffer.
   void CompressFlitSequences(bool final);
 
-  // Compress raw literals as is.
+  // Compress raw literals as is, into blocks of at most SEQ_BLOCK_SIZE raw bytes.
   void CompressRawLit(bool final);
 
+  // Writes pfor or zstd encoding of the raw block into compress_data_, returns its size.
+  uint32_t CompressRawBlock(const uint8_t* src, uint32_t size, uint8_t* flags);
+
   void AddCompressedBuf(const BlockHeader& bh);
 
   void AnalyzeSequenceDict();
@@ -173,6 +184,7 @@ class SeqEncoderBase {
   std::vector<strings::ByteRange> compressed_blocks_;
 
   bool disable_seq_dict_ = false;
+  RawCoding raw_coding_ = RAW_AUTO;
   uint32_t literal_size_; // Single literal size (4 or 8 bytes).
 
   /*
@@ -279,6 +291,9 @@ class SeqDecoderBase {
   uint32_t next_seq_id_ = 0;
   uint8_t* next_flit_ptr_;
 
+  // Bytes of data_buf_ consumed by GetNextInts from a raw block.
+  uint32_t raw_offset_ = 0;
+
   struct Zstd;
   std::unique_ptr<Zstd> zstd_cntx_;
 };
@@ -305,13 +320,23 @@ template<size_t INT_SIZE> class SeqDecoder: public SeqDecoderBase {
   */
   IntRange GetNextIntPage();
 
+  // Pull based alternative to GetNextIntPage that inflates into the caller's buffer.
+  // Sequences are decoded lazily and only as many as fit into dest, so the consumer can stop
+  // early and the decoder does not allocate its own page. Returns an empty range when
+  // the current block is exhausted. capacity must fit the longest sequence
+  // (up to 1 << 14 integers) and the two page functions must not be mixed for the same block.
+  IntRange GetNextInts(UT* dest, size_t capacity);
+
  private:
   void SetLitDict(strings::ByteRange br) override;
   bool AddFlitSeq(strings::ByteRange src) override;
 
+  IntRange InflateInto(UT* dest, size_t capacity);
+
   base::PODArray<UT> lit_dict_, int_buf_;
 
   UT* next_int_ptr_;
+  UT* int_end_;
 };
 
 namespace internal {
@@ -4,12 +4,14 @@
 
 #include "util/coding/set_encoder.h"
 
+#include <algorithm>
 #include <random>
 #include <gmock/gmock.h>
 
 #include "base/endian.h"
 #include "base/gtest.h"
 #include "base/logging.h"
+#include "strings/stringpiece.h"
 
 using testing::ElementsAre;
 using testing::ElementsAreArray;
@@ -141,6 +143,85 @@ TYPED_TEST(SetEncoderTest, Basic) {
   EXPECT_TRUE(page.empty());
 }
 
+TYPED_TEST(SetEncoderTest, RawBlocks) {
+  if (!TestFixture::use_sequence) {
+    this->encoder_.DisableSeqDictionary();
+  }
+  std::default_random_engine re;
+  std::uniform_int_distribution<uint32_t> dis(0, 1 << 20);
+
+  std::vector<typename TestFixture::type_t> expected;
+  for (unsigned i = 0; i < 100000; ++i) {
+    this->arr_.clear();
+    for (unsigned j = 0; j < 10; ++j) {
+      this->arr_.push_back(dis(re));
+    }
+    this->encoder_.Add(this->arr_.data(), this->arr_.size());
+    expected.insert(expected.end(), this->arr_.begin(), this->arr_.end());
+  }
+  this->encoder_.Flush();
+
+  string dic_enc;
+  ASSERT_FALSE(this->encoder_.GetDictSerialized(&dic_enc));
+
+  const auto& cb_vec = this->encoder_.compressed_blocks();
+  ASSERT_GT(cb_vec.size(), 1);
+
+  std::vector<typename TestFixture::type_t> actual;
+  for (unsigned i = 0; i < cb_vec.size(); ++i) {
+    uint32_t consumed = 0;
+    int res = this->decoder_.Decompress(cb_vec[i], &consumed);
+    ASSERT_EQ(i + 1 == cb_vec.size() ? 0 : 1, res);
+    ASSERT_EQ(cb_vec[i].size(), consumed);
+
+    for (auto page = this->decoder_.GetNextIntPage(); !page.empty();
+         page = this->decoder_.GetNextIntPage()) {
+      actual.insert(actual.end(), page.begin(), page.end());
+    }
+  }
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(SeqEncoderPFor, Sorted) {
+  for (auto rc : {SeqEncoderBase::RAW_AUTO, SeqEncoderBase::RAW_PFOR}) {
+    SeqEncoder<4> encoder;
+    SeqDecoder<4> decoder;
+    encoder.SetRawCoding(rc);
+    encoder.DisableSeqDictionary();
+
+    // Unique timestamps are not dictionary friendly but their deltas are narrow.
+    std::vector<uint32_t> src(1000);
+    uint32_t next = 1500000000;
+    for (unsigned i = 0; i < 100; ++i) {
+      for (auto& val : src) {
+        next += 1 + next % 7;
+        val = next;
+      }
+      encoder.Add(src.data(), src.size());
+    }
+    encoder.Flush();
+
+    const auto& cb_vec = encoder.compressed_blocks();
+    ASSERT_EQ(4, cb_vec.size());
+    EXPECT_LT(encoder.Cost(), 100000 / 2);  // Less than 4 bits per integer.
+
+    uint32_t last = 1500000000;
+    for (unsigned i = 0; i < cb_vec.size(); ++i) {
+      EXPECT_TRUE(cb_vec[i][2] & BlockHeader::kPForBit);
+      uint32_t consumed = 0;
+      ASSERT_EQ(i + 1 == cb_vec.size() ? 0 : 1, decoder.Decompress(cb_vec[i], &consumed));
+
+      auto page = decoder.GetNextIntPage();
+      ASSERT_FALSE(page.empty());
+      for (uint32_t val : page) {
+        ASSERT_EQ(last + 1 + last % 7, val);
+        last = val;
+      }
+    }
+    EXPECT_EQ(next, last);
+  }
+}
+
 TYPED_TEST(SetEncoderTest, Dict) {
   if (!TestFixture::use_sequence) {
     this->encoder_.DisableSeqDictionary();
@@ -251,4 +332,153 @@ TYPED_TEST(SetEncoderTest, FewBlocks) {
   ASSERT_EQ(cb_vec[i].size(), consumed);
 }
 
+TYPED_TEST(SetEncoderTest, GetNextInts) {
+  using type_t = typename TestFixture::type_t;
+  if (!TestFixture::use_sequence) {
+    return;
+  }
+
+  uint32_t next = 0;
+  for (unsigned i = 0; i < 5000; ++i) {
+    this->arr_.clear();
+
+    for (unsigned j = 0; j < 50; ++j) {
+      this->arr_.push_back((1 << 20) + next);
+      next = (next + (j + 1)) % 12101;
+    }
+    this->encoder_.Add(this->arr_.data(), this->arr_.size());
+  }
+  this->encoder_.Flush();
+
+  string dic_enc;
+  ASSERT_TRUE(this->encoder_.GetDictSerialized(&dic_enc));
+  const auto& cb_vec = this->encoder_.compressed_blocks();
+  const uint8_t* dict_ptr = reinterpret_cast<const uint8_t*>(dic_enc.data());
+
+  SeqDecoder<sizeof(type_t)> streaming;
+  this->decoder_.SetDict(dict_ptr, dic_enc.size());
+  streaming.SetDict(dict_ptr, dic_enc.size());
+
+  std::vector<type_t> expected, actual;
+  type_t buf[120];
+  for (unsigned i = 0; i < cb_vec.size(); ++i) {
+    uint32_t consumed = 0;
+    ASSERT_LE(0, this->decoder_.Decompress(cb_vec[i], &consumed));
+    ASSERT_LE(0, streaming.Decompress(cb_vec[i], &consumed));
+
+    for (auto page = this->decoder_.GetNextIntPage(); !page.empty();
+         page = this->decoder_.GetNextIntPage()) {
+      expected.insert(expected.end(), page.begin(), page.end());
+    }
+
+    // Only whole sequences are returned, up to 2 of them fit into buf.
+    for (auto page = streaming.GetNextInts(buf, arraysize(buf)); !page.empty();
+         page = streaming.GetNextInts(buf, arraysize(buf))) {
+      ASSERT_LE(page.size(), 100);
+      ASSERT_EQ(0, page.size() % 50);
+      actual.insert(actual.end(), page.begin(), page.end());
+    }
+  }
+  EXPECT_EQ(250000, expected.size());
+  EXPECT_EQ(expected, actual);
+
+  // Raw blocks are copied out page by page.
+  SeqEncoder<sizeof(type_t)> raw_encoder;
+  SeqDecoder<sizeof(type_t)> raw_decoder;
+  expected.clear();
+  actual.clear();
+  for (unsigned i = 0; i < 1000; ++i) {
+    expected.push_back(i * 7919);
+  }
+  raw_encoder.Add(expected.data(), expected.size());
+  raw_encoder.Flush();
+  ASSERT_EQ(1, raw_encoder.compressed_blocks().size());
+
+  uint32_t consumed = 0;
+  ASSERT_EQ(0, raw_decoder.Decompress(raw_encoder.compressed_blocks()[0], &consumed));
+  for (auto page = raw_decoder.GetNextInts(buf, arraysize(buf)); !page.empty();
+       page = raw_decoder.GetNextInts(buf, arraysize(buf))) {
+    actual.insert(actual.end(), page.begin(), page.end());
+  }
+  EXPECT_EQ(expected, actual);
+}
+
+// More than 64K sequences that reference the sequence dictionary and have no literal bytes.
+TEST(SeqEncoderDict, ManyRefs) {
+  SeqEncoder<4> encoder;
+  SeqDecoder<4> decoder;
+  vector<uint32_t> sets[3] = {{1, 5, 9, 20}, {2, 3, 4}, {7, 100, 1000, 5000, 6000}};
+  vector<uint32_t> expected;
+  for (unsigned i = 0; i < 200000; ++i) {
+    const auto& set = sets[i % 3];
+    encoder.Add(set.data(), set.size());
+    expected.insert(expected.end(), set.begin(), set.end());
+  }
+  encoder.Flush();
+
+  string dict;
+  ASSERT_TRUE(encoder.GetDictSerialized(&dict));
+  decoder.SetDict(reinterpret_cast<const uint8_t*>(dict.data()), dict.size());
+
+  const auto& cb_vec = encoder.compressed_blocks();
+  ASSERT_GT(cb_vec.size(), 1);
+
+  vector<uint32_t> actual;
+  for (unsigned i = 0; i < cb_vec.size(); ++i) {
+    uint32_t consumed = 0;
+    ASSERT_EQ(i + 1 == cb_vec.size() ? 0 : 1, decoder.Decompress(cb_vec[i], &consumed));
+    ASSERT_EQ(cb_vec[i].size(), consumed);
+    for (auto page = decoder.GetNextIntPage(); !page.empty(); page = decoder.GetNextIntPage()) {
+      actual.insert(actual.end(), page.begin(), page.end());
+    }
+  }
+  ASSERT_EQ(expected.size(), actual.size());
+
+  // Sets are decoded in their dictionary order.
+  auto it = actual.begin();
+  for (unsigned i = 0; i < 200000; ++i) {
+    std::sort(it, it + sets[i % 3].size());
+    it += sets[i % 3].size();
+  }
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(SequenceArray, Mappable) {
+  SequenceArray sa;
+  vector<string> expected{"foo", "", "bar", string(1000, 'x'), "a"};
+  for (const auto& s : expected) {
+    sa.Add(s.data(), s.data() + s.size());
+  }
+
+  vector<uint64_t> buf(sa.GetMappableSize() / 8 + 1);
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(buf.data());
+  size_t sz = sa.SerializeMappable(ptr);
+  ASSERT_EQ(sa.GetMappableSize(), sz);
+
+  SequenceArrayView view;
+  ASSERT_TRUE(view.Init(ptr, sz));
+  ASSERT_EQ(expected.size(), view.size());
+  EXPECT_EQ(sa.data_size(), view.data_size());
+  for (size_t i = expected.size(); i-- > 0;) {
+    EXPECT_EQ(strings::ToByteRange(expected[i]), view[i]);
+  }
+
+  auto it = sa.begin();
+  for (strings::ByteRange br : view) {
+    ASSERT_TRUE(it != sa.end());
+    EXPECT_EQ(*it, br);
+    ++it;
+  }
+
+  EXPECT_FALSE(view.Init(ptr, sz - 1));
+  EXPECT_FALSE(view.Init(ptr, 10));
+  EXPECT_TRUE(view.empty());
+
+  sa.clear();
+  sz = sa.SerializeMappable(ptr);
+  ASSERT_TRUE(view.Init(ptr, sz));
+  EXPECT_TRUE(view.empty());
+  EXPECT_TRUE(view.begin() == view.end());
+}
+
 }  // namespace util
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <boost/fiber/context.hpp>
+#include <chrono>
 
 #include "base/macros.h"
 
@@ -65,12 +66,19 @@ class EventCount {
 
   void wait(uint32_t epoch) noexcept;
 
+  // Like wait() but returns false if tp passed without a notification.
+  bool wait_until(uint32_t epoch, std::chrono::steady_clock::time_point tp) noexcept;
+
   /**
    * Wait for condition() to become true.  Will clean up appropriately if
    * condition() throws. Returns true if had to preempt using wait_queue.
    */
   template <typename Condition> bool await(Condition condition);
 
+  // Waits for condition() to become true until tp. Returns the last value of condition().
+  template <typename Condition>
+  bool await_until(Condition condition, std::chrono::steady_clock::time_point tp);
+
  private:
   friend class Key;
 
@@ -174,6 +182,30 @@ inline void EventCount::wait(uint32_t epoch) noexcept {
   }
 }
 
+inline bool EventCount::wait_until(uint32_t epoch,
+                                   std::chrono::steady_clock::time_point tp) noexcept {
+  if ((val_.load(std::memory_order_acquire) >> kEpochShift) != epoch)
+    return true;
+
+  auto* active_ctx = ::boost::fibers::context::active();
+
+  spinlock_lock_t lk{wait_queue_splk_};
+  if ((val_.load(std::memory_order_acquire) >> kEpochShift) != epoch)
+    return true;
+
+  // Same as boost::fibers::condition_variable_any: twstatus tells notify() that the waiter
+  // has a timeout and which of us wins the race is decided by should_switch().
+  active_ctx->wait_link(wait_queue_);
+  active_ctx->twstatus.store(reinterpret_cast<std::intptr_t>(this), std::memory_order_release);
+  if (!active_ctx->wait_until(tp, lk)) {
+    lk.lock();
+    wait_queue_.remove(*active_ctx);
+    lk.unlock();
+    return false;
+  }
+  return true;
+}
+
 // Returns true if had to preempt, false if no preemption happenned.
 template <typename Condition> bool EventCount::await(Condition condition) {
   if (condition())
@@ -193,5 +225,17 @@ template <typename Condition> bool EventCount::await(Condition condition) {
   return preempt;
 }
 
+template <typename Condition>
+bool EventCount::await_until(Condition condition, std::chrono::steady_clock::time_point tp) {
+  while (!condition()) {
+    Key key = prepareWait();
+    if (condition())
+      return true;
+    if (!wait_until(key.epoch(), tp))
+      return condition();
+  }
+  return true;
+}
+
 }  // namespace fibers_ext
 }  // namespace util
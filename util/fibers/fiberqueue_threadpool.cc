@@ -14,56 +14,108 @@ using namespace std;
 FiberQueue::FiberQueue(unsigned queue_size) : queue_(queue_size) {
 }
 
+bool FiberQueue::Pop(Item* item, bool* is_closed) {
+  if (queue_.try_dequeue(*item)) {
+    push_ec_.notify();
+    return true;
+  }
+
+  if (is_closed_.load(std::memory_order_acquire)) {
+    *is_closed = true;
+    return true;
+  }
+  return false;
+}
+
+void FiberQueue::Execute(Item* item) {
+  uint64_t now = base::CycleClock::Now();
+  uint64_t wait_usec = now > item->ts ? base::CycleClock::ToMicros(now - item->ts) : 0;
+  wait_usec_.Add(wait_usec);
+  if (on_slow_ && wait_usec > slow_usec_)
+    on_slow_();
+
+  try {
+    item->func();
+  } catch (std::exception& e) {
+    // std::exception_ptr p = std::current_exception();
+    LOG(FATAL) << "Exception " << e.what();
+  }
+}
+
 void FiberQueue::Run() {
   bool is_closed = false;
-  CbFunc func;
+  Item item;
 
-  auto cb = [&] {
-    if (queue_.try_dequeue(func)) {
-      push_ec_.notify();
-      return true;
-    }
-
-    if (is_closed_.load(std::memory_order_acquire)) {
-      is_closed = true;
-      return true;
-    }
-    return false;
-  };
+  auto cb = [&] { return Pop(&item, &is_closed); };
 
   while (true) {
     pull_ec_.await(cb);
 
     if (is_closed)
       break;
-    try {
-      func();
-    } catch (std::exception& e) {
-      // std::exception_ptr p = std::current_exception();
-      LOG(FATAL) << "Exception " << e.what();
-    }
+    Execute(&item);
   }
 }
 
+bool FiberQueue::RunUntilIdle(uint32_t idle_ms) {
+  bool is_closed = false;
+  Item item;
+
+  auto cb = [&] { return Pop(&item, &is_closed); };
+
+  while (true) {
+    auto tp = chrono::steady_clock::now() + chrono::milliseconds(idle_ms);
+    if (!pull_ec_.await_until(cb, tp))
+      return false;
+
+    if (is_closed)
+      return true;
+    Execute(&item);
+  }
+}
+
+auto FiberQueue::GetStats() const -> Stats {
+  Stats res;
+  res.wait_usec = wait_usec_.Read();
+  res.full_count = full_count_.load(std::memory_order_relaxed);
+  return res;
+}
+
 void FiberQueue::Shutdown() {
   is_closed_.store(true, memory_order_seq_cst);
   pull_ec_.notify();
 }
 
-FiberQueueThreadPool::FiberQueueThreadPool(unsigned num_threads, unsigned queue_size) {
+FiberQueueThreadPool::FiberQueueThreadPool(unsigned num_threads, unsigned queue_size)
+    : FiberQueueThreadPool(Options{num_threads, queue_size}) {
+}
+
+FiberQueueThreadPool::FiberQueueThreadPool(const Options& opts) : opts_(opts) {
+  unsigned num_threads = opts.num_threads;
   if (num_threads == 0) {
     num_threads = std::thread::hardware_concurrency();
   }
   worker_size_ = num_threads;
-  workers_.reset(new Worker[num_threads]);
+  max_workers_ = std::max<size_t>(num_threads, opts.max_threads);
+  workers_.reset(new Worker[max_workers_]);
+
+  for (size_t i = 0; i < max_workers_; ++i) {
+    FiberQueue* q = new FiberQueue(opts.queue_size);
+    if (max_workers_ > worker_size_) {
+      q->slow_usec_ = opts.grow_wait_usec;
+      q->on_slow_ = [this] { Grow(false); };
+    }
+    workers_[i].q.reset(q);
+  }
 
   for (unsigned i = 0; i < num_threads; ++i) {
     string name = absl::StrCat("fq_pool", i);
 
     auto fn = std::bind(&FiberQueueThreadPool::WorkerFunction, this, i);
-    workers_[i].q.reset(new FiberQueue(queue_size));
     workers_[i].tid = base::StartThread(name.c_str(), fn);
+    workers_[i].state = RUNNING;
   }
+  active_.store(num_threads, memory_order_release);
 }
 
 FiberQueueThreadPool::~FiberQueueThreadPool() {
@@ -76,14 +128,20 @@ void FiberQueueThreadPool::Shutdown() {
   if (!workers_)
     return;
 
-  for (size_t i = 0; i < worker_size_; ++i) {
+  {
+    std::lock_guard<std::mutex> lk(grow_mu_);
+    shutting_down_ = true;
+  }
+
+  for (size_t i = 0; i < max_workers_; ++i) {
     workers_[i].q->is_closed_.store(true, memory_order_seq_cst);
     workers_[i].q->pull_ec_.notifyAll();
   }
 
-  for (size_t i = 0; i < worker_size_; ++i) {
+  for (size_t i = 0; i < max_workers_; ++i) {
     auto& w = workers_[i];
-    pthread_join(w.tid, nullptr);
+    if (w.tid)
+      pthread_join(w.tid, nullptr);
   }
 
   workers_.reset();
@@ -104,5 +162,83 @@ void FiberQueueThreadPool::WorkerFunction(unsigned index) {
   VLOG(1) << "FiberQueueThreadPool::Exit";
 }
 
+void FiberQueueThreadPool::ElasticWorkerFunction(unsigned index) {
+  FiberQueue* q = workers_[index].q.get();
+  while (!q->RunUntilIdle(opts_.idle_ms)) {
+    if (Retire(index))
+      break;
+  }
+  VLOG(1) << "FiberQueueThreadPool::Exit elastic " << index;
+}
+
+std::vector<FiberQueue::Stats> FiberQueueThreadPool::GetStats() const {
+  std::vector<FiberQueue::Stats> res(max_workers_);
+  for (size_t i = 0; i < max_workers_; ++i) {
+    res[i] = workers_[i].q->GetStats();
+  }
+  return res;
+}
+
+bool FiberQueueThreadPool::Grow(bool force) {
+  if (active_.load(memory_order_relaxed) >= max_workers_)
+    return false;
+
+  uint64_t now = GetMonotonicMicros();
+  if (!force && now < last_grow_usec_.load(memory_order_relaxed) + opts_.grow_wait_usec)
+    return false;
+
+  std::lock_guard<std::mutex> lk(grow_mu_);
+  unsigned index = active_.load(memory_order_relaxed);
+  if (shutting_down_ || index >= max_workers_)
+    return false;
+
+  Worker& w = workers_[index];
+
+  // A retiring worker has not exited yet and continues to run.
+  if (w.state == STOPPED) {
+    if (w.tid)
+      pthread_join(w.tid, nullptr);  // It has released grow_mu_ for the last time.
+    string name = absl::StrCat("fq_pool", index);
+    auto fn = std::bind(&FiberQueueThreadPool::ElasticWorkerFunction, this, index);
+    w.tid = base::StartThread(name.c_str(), fn);
+  }
+  w.state = RUNNING;
+  w.accepting.store(true, memory_order_seq_cst);
+  last_grow_usec_.store(now, memory_order_relaxed);
+  active_.store(index + 1, memory_order_release);
+  VLOG(1) << "FiberQueueThreadPool grows to " << index + 1 << " workers";
+
+  return true;
+}
+
+bool FiberQueueThreadPool::Retire(unsigned index) {
+  Worker& w = workers_[index];
+  {
+    std::lock_guard<std::mutex> lk(grow_mu_);
+
+    // Only the last worker retires, so that the active workers stay a prefix.
+    if (!shutting_down_ && active_.load(memory_order_relaxed) != index + 1)
+      return false;
+    w.state = RETIRING;
+    w.accepting.store(false, memory_order_seq_cst);
+    if (!shutting_down_)
+      active_.store(index, memory_order_release);
+  }
+
+  // Producers that have seen accepting before we reset it may still add tasks.
+  while (w.producers.load(memory_order_seq_cst) != 0) {
+    this_thread::yield();
+  }
+  bool closed = w.q->RunUntilIdle(0);
+
+  std::lock_guard<std::mutex> lk(grow_mu_);
+  if (w.state == RUNNING && !closed)  // Grow() revived us meanwhile.
+    return false;
+
+  w.state = STOPPED;
+  VLOG(1) << "FiberQueueThreadPool shrinks to " << index << " workers";
+  return true;
+}
+
 }  // namespace fibers_ext
 }  // namespace util
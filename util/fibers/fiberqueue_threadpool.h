@@ -3,7 +3,12 @@
 //
 #pragma once
 
+#include <mutex>
+#include <vector>
+
+#include "base/hdr_histogram.h"
 #include "base/mpmc_bounded_queue.h"
+#include "base/walltime.h"
 #include "util/fibers/fibers_ext.h"
 
 namespace util {
@@ -29,6 +34,7 @@ class FiberQueue {
       pull_ec_.notify();
       return true;
     }
+    full_count_.fetch_add(1, std::memory_order_relaxed);
     return false;
   }
 
@@ -86,21 +92,68 @@ class FiberQueue {
 
   void Run();
 
+  // Like Run() but also returns when the queue stays empty for idle_ms. Returns true if the
+  // queue was shut down.
+  bool RunUntilIdle(uint32_t idle_ms);
+
+  struct Stats {
+    base::HdrHistogram::Snapshot wait_usec;  // From the submission till the start of a task.
+    uint64_t full_count = 0;                 // How many times TryAdd found the queue full.
+  };
+
+  Stats GetStats() const;
+
  private:
   typedef std::function<void()> CbFunc;
 
+  struct Item {
+    CbFunc func;
+    uint64_t ts = 0;  // base::CycleClock at the submission.
+
+    Item() = default;
+
+    // Implicit, so that try_enqueue constructs the item only if it has a free cell.
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Item>::value>>
+    Item(F&& f) : func(std::forward<F>(f)), ts(base::CycleClock::Now()) {
+    }
+  };
 
-  using FuncQ = base::mpmc_bounded_queue<CbFunc>;
+  // Pull condition of the consumer loops.
+  bool Pop(Item* item, bool* is_closed);
+  void Execute(Item* item);
+
+  using FuncQ = base::mpmc_bounded_queue<Item>;
   FuncQ queue_;
 
   EventCount push_ec_, pull_ec_;
   std::atomic_bool is_closed_{false};
+
+  base::HdrHistogram wait_usec_;
+  std::atomic<uint64_t> full_count_{0};
+
+  // Set by an elastic FiberQueueThreadPool, called when a task waited longer than slow_usec_.
+  std::function<void()> on_slow_;
+  uint64_t slow_usec_ = 0;
 };
 
 // This thread pool has a global fiber-friendly queue for incoming tasks.
 class FiberQueueThreadPool {
  public:
+  struct Options {
+    unsigned num_threads = 0;  // Fixed workers, hardware_concurrency() if 0.
+    unsigned queue_size = 128;
+
+    // Elastic sizing. When a task waited longer than grow_wait_usec in its queue or all the
+    // queues are full, the pool starts another worker, up to max_threads. The workers above
+    // num_threads exit after idle_ms without tasks. They serve only Add() without index,
+    // so that the pinned tasks keep their order. Disabled if max_threads <= num_threads.
+    unsigned max_threads = 0;
+    uint32_t grow_wait_usec = 2000;
+    uint32_t idle_ms = 5000;
+  };
+
   explicit FiberQueueThreadPool(unsigned num_threads = 0, unsigned queue_size = 128);
+  explicit FiberQueueThreadPool(const Options& opts);
   ~FiberQueueThreadPool();
 
   template <typename F> auto Await(F&& f) -> decltype(f()) {
@@ -132,6 +185,11 @@ class FiberQueueThreadPool {
   }
 
   template <typename F> void Add(F&& f) {
+    if (max_workers_ > worker_size_) {
+      AddElastic(std::forward<F>(f));
+      return;
+    }
+
     size_t start = next_index_.fetch_add(1, std::memory_order_relaxed) % worker_size_;
     Worker& main_w = workers_[start];
     while (true) {
@@ -161,6 +219,12 @@ class FiberQueueThreadPool {
 
   void Shutdown();
 
+  // Number of the running workers.
+  unsigned thread_count() const { return active_.load(std::memory_order_relaxed); }
+
+  // Stats of the fixed queues followed by the queues of the elastic workers.
+  std::vector<FiberQueue::Stats> GetStats() const;
+
  private:
   size_t wrapped_idx(size_t i) { return i < worker_size_ ? i : i - worker_size_; }
 
@@ -174,17 +238,70 @@ class FiberQueueThreadPool {
     return false;
   }
 
+  template <typename F> void AddElastic(F&& f) {
+    size_t start = next_index_.fetch_add(1, std::memory_order_relaxed);
+
+    // The elastic workers may retire, hence we wait on the fixed ones.
+    Worker& main_w = workers_[start % worker_size_];
+    while (true) {
+      EventCount::Key key = main_w.q->push_ec_.prepareWait();
+      size_t active = active_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < active; ++i) {
+        size_t index = (start + i) % active;
+        if (index < worker_size_ ? workers_[index].q->TryAdd(std::forward<F>(f))
+                                 : TryAddElastic(index, std::forward<F>(f))) {
+          return;
+        }
+      }
+      if (!Grow(true))
+        main_w.q->push_ec_.wait(key.epoch());
+    }
+  }
+
+  template <typename F> bool TryAddElastic(size_t index, F&& f) {
+    Worker& w = workers_[index];
+
+    // Pairs with Retire(): either it sees our increment or we see that accepting is off.
+    w.producers.fetch_add(1, std::memory_order_seq_cst);
+    bool res = w.accepting.load(std::memory_order_seq_cst) && w.q->TryAdd(std::forward<F>(f));
+    w.producers.fetch_sub(1, std::memory_order_release);
+    return res;
+  }
+
   void WorkerFunction(unsigned index);
+  void ElasticWorkerFunction(unsigned index);
+
+  // Starts the next elastic worker. Unless force is set, at most once per grow_wait_usec.
+  // Returns true if a worker was added.
+  bool Grow(bool force);
+
+  // Returns true if the elastic worker at index should exit.
+  bool Retire(unsigned index);
+
+  enum WorkerState : uint8_t { STOPPED, RUNNING, RETIRING };
 
   struct Worker {
-    pthread_t tid;
+    pthread_t tid = 0;
     std::unique_ptr<FiberQueue> q;
+
+    // Used by the elastic workers only.
+    std::atomic_bool accepting{false};
+    std::atomic_uint producers{0};
+    WorkerState state = STOPPED;  // Guarded by grow_mu_.
   };
 
   std::unique_ptr<Worker[]> workers_;
-  size_t worker_size_;
+  size_t worker_size_;  // The fixed workers.
+  size_t max_workers_;
+  Options opts_;
 
   std::atomic_ulong next_index_{0};
+
+  // Prefix of workers_ that accepts the tasks.
+  std::atomic_uint active_{0};
+  std::atomic<uint64_t> last_grow_usec_{0};
+  std::mutex grow_mu_;
+  bool shutting_down_ = false;  // Guarded by grow_mu_.
 };
 
 }  // namespace fibers_ext
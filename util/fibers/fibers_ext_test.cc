@@ -1,11 +1,15 @@
 // Copyright 2019, Beeri 15.  All rights reserved.
 // Author: Roman Gershman (romange@gmail.com)
 //
+#include <gmock/gmock.h>
+
 #include "base/gtest.h"
 #include "base/walltime.h"
 
 #include "util/asio/io_context_pool.h"
 #include "util/fibers/fiberqueue_threadpool.h"
+#include "util/fibers/mpmc_channel.h"
+#include "util/fibers/pooled_stack.h"
 #include "util/fibers/simple_channel.h"
 
 using namespace boost;
@@ -45,6 +49,66 @@ TEST_F(FibersTest, SimpleChannel) {
   fb.join();
 }
 
+TEST_F(FibersTest, SimpleChannelBulk) {
+  SimpleChannel<int> channel(4);
+  int src[6] = {1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(3, channel.TryPushBulk(src, 6));  // Holds capacity - 1 items.
+
+  int dest[6] = {0};
+  fibers::fiber fb(fibers::launch::post, [&] { channel.PushBulk(src + 3, 3); });
+  EXPECT_EQ(3, channel.PopBulk(dest, 6));
+  fb.join();
+  EXPECT_EQ(3, channel.PopBulk(dest + 3, 6));
+  EXPECT_THAT(dest, testing::ElementsAre(1, 2, 3, 4, 5, 6));
+
+  SimpleChannel<int> spin_channel(64, 1000);
+  std::thread producer([&] {
+    std::vector<int> batch;
+    for (int i = 0; i < 1000; ++i) {
+      batch.push_back(i);
+      if (batch.size() == 16 || i == 999) {
+        spin_channel.PushBulk(batch.begin(), batch.size());
+        batch.clear();
+      }
+    }
+    spin_channel.StartClosing();
+  });
+
+  int sum = 0;
+  while (size_t count = spin_channel.PopBulk(dest, 6)) {
+    for (size_t i = 0; i < count; ++i)
+      sum += dest[i];
+  }
+  producer.join();
+  EXPECT_EQ(999 * 1000 / 2, sum);
+}
+
+TEST_F(FibersTest, MPMCChannel) {
+  MPMCChannel<int> channel(4);
+  int src[6] = {1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(4, channel.TryPushBulk(src, 6));
+  EXPECT_FALSE(channel.TryPush(7));
+
+  int dest[6] = {0};
+  fibers::fiber fb(fibers::launch::post, [&] { channel.PushBulk(src + 4, 2); });
+  EXPECT_EQ(3, channel.PopBulk(dest, 3));
+  fb.join();
+  EXPECT_EQ(3, channel.PopBulk(dest + 3, 6));
+  EXPECT_THAT(dest, testing::ElementsAre(1, 2, 3, 4, 5, 6));
+
+  std::thread producer([&] {
+    for (int i = 0; i < 1000; ++i)
+      channel.Push(i);
+    channel.StartClosing();
+  });
+
+  int val = 0, sum = 0;
+  while (channel.Pop(val))
+    sum += val;
+  producer.join();
+  EXPECT_EQ(999 * 1000 / 2, sum);
+}
+
 TEST_F(FibersTest, EventCount) {
   EventCount ec;
   bool signal = false;
@@ -94,6 +158,64 @@ TEST_F(FibersTest, FQTP) {
   }
 }
 
+TEST_F(FibersTest, FQTPElastic) {
+  FiberQueueThreadPool::Options opts;
+  opts.num_threads = 1;
+  opts.queue_size = 4;
+  opts.max_threads = 4;
+  opts.grow_wait_usec = 100;
+  opts.idle_ms = 20;
+  FiberQueueThreadPool pool(opts);
+  EXPECT_EQ(1, pool.thread_count());
+
+  // Tasks pinned to a worker keep their order.
+  std::vector<unsigned> order;
+  for (unsigned i = 0; i < 100; ++i) {
+    pool.Add(0, [&order, i] { order.push_back(i); });
+  }
+  pool.Await(0, [] {});
+  ASSERT_EQ(100, order.size());
+  for (unsigned i = 0; i < 100; ++i) {
+    ASSERT_EQ(i, order[i]);
+  }
+
+  const unsigned kTasks = 40;
+  BlockingCounter bc(kTasks);
+  for (unsigned i = 0; i < kTasks; ++i) {
+    pool.Add([bc]() mutable {
+      SleepForMilliseconds(2);
+      bc.Dec();
+    });
+  }
+  EXPECT_GT(pool.thread_count(), 1);
+  bc.Wait();
+
+  for (unsigned i = 0; i < 100 && pool.thread_count() > 1; ++i) {
+    SleepForMilliseconds(10);
+  }
+  EXPECT_EQ(1, pool.thread_count());
+
+  std::vector<FiberQueue::Stats> stats = pool.GetStats();
+  ASSERT_EQ(4, stats.size());
+  uint64_t count = 0;
+  for (const auto& s : stats) {
+    count += s.wait_usec.count();
+  }
+  EXPECT_EQ(kTasks + 101, count);
+  EXPECT_GT(stats[0].wait_usec.max(), 100);
+
+  // The pool grows again after shrinking.
+  BlockingCounter bc2(kTasks);
+  for (unsigned i = 0; i < kTasks; ++i) {
+    pool.Add([bc2]() mutable {
+      SleepForMilliseconds(1);
+      bc2.Dec();
+    });
+  }
+  EXPECT_GT(pool.thread_count(), 1);
+  bc2.Wait();
+}
+
 TEST_F(FibersTest, SimpleChannelDone) {
   SimpleChannel<std::function<void()>> s(2);
   std::thread t([&] {
@@ -147,5 +269,52 @@ TEST_F(FibersTest, FiberQueue) {
   EXPECT_GT(delay, 0);  //
 }
 
+TEST_F(FibersTest, PooledStack) {
+  PooledStackAllocator::ReleaseCached();
+  const PooledStackAllocator::Stats& stats = PooledStackAllocator::ThisThreadStats();
+  uint64_t mapped = stats.mapped, reused = stats.reused;
+
+  constexpr unsigned kIters = 100;
+  unsigned sum = 0;
+  for (unsigned i = 0; i < kIters; ++i) {
+    fibers::fiber fb(std::allocator_arg, PooledStackAllocator(16 << 10), [&sum, i] {
+      char buf[8 << 10];
+      memset(buf, i, sizeof(buf));
+      sum += buf[i];
+    });
+    fb.join();
+  }
+  EXPECT_EQ(kIters * (kIters - 1) / 2, sum);
+
+  // Every fiber but the first reuses the stack of the previous one.
+  EXPECT_EQ(1, stats.mapped - mapped);
+  EXPECT_EQ(kIters - 1, stats.reused - reused);
+  EXPECT_EQ(1, stats.cached);
+
+  // Fibers that run together need their own stacks.
+  std::vector<fibers::fiber> fbs;
+  for (unsigned i = 0; i < 4; ++i) {
+    fbs.emplace_back(std::allocator_arg, PooledStackAllocator(16 << 10),
+                     [] { this_fiber::yield(); });
+  }
+  EXPECT_LE(4, stats.peak_in_use);
+  for (auto& fb : fbs)
+    fb.join();
+  EXPECT_EQ(4, stats.cached);
+  EXPECT_EQ(4, stats.mapped - mapped);
+
+  PooledStackAllocator::ReleaseCached();
+  EXPECT_EQ(0, stats.cached);
+}
+
+TEST_F(FibersTest, PooledStackGuard) {
+  PooledStackAllocator alloc(4096);
+  boost::context::stack_context sctx = alloc.allocate();
+  char* bottom = static_cast<char*>(sctx.sp) - alloc.stack_size();
+  bottom[0] = 1;
+  EXPECT_DEATH(bottom[-1] = 1, "");
+  alloc.deallocate(sctx);
+}
+
 }  // namespace fibers_ext
 }  // namespace util
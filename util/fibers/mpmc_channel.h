@@ -0,0 +1,143 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include "base/mpmc_bounded_queue.h"
+
+#include "util/fibers/event_count.h"
+
+namespace util {
+namespace fibers_ext {
+
+/*!
+  \brief Multi producer - multi consumer thread-safe, fiber-friendly bounded channel.
+
+  Any number of fibers from any threads can push and pop. The blocking calls suspend the fiber
+  upon empty/full conditions instead of spinning. The bulk calls claim multiple cells with
+  a single CAS and issue a single notification per batch.
+*/
+template <typename T> class MPMCChannel {
+ public:
+  // n must be a power of 2.
+  explicit MPMCChannel(size_t n) : q_(n) {}
+
+  //! Non blocking push.
+  template <typename U> bool TryPush(U&& val) noexcept {
+    if (q_.try_enqueue(std::forward<U>(val))) {
+      pop_ec_.notify();
+      return true;
+    }
+    return false;
+  }
+
+  //! Non blocking pop.
+  bool TryPop(T& dest) noexcept {
+    if (q_.try_dequeue(dest)) {
+      push_ec_.notify();
+      return true;
+    }
+    return false;
+  }
+
+  //! Blocking push.
+  template <typename U> void Push(U&& val) noexcept {
+    push_ec_.await([&] { return TryPush(std::forward<U>(val)); });
+  }
+
+  // Blocking call. Returns false if channel is closed and empty, true otherwise with the popped
+  // value.
+  bool Pop(T& dest);
+
+  //! Non blocking bulk push of up to count items starting from src.
+  //! Returns how many items were pushed, they are moved from.
+  template <typename It> size_t TryPushBulk(It src, size_t count) noexcept {
+    size_t res = q_.try_enqueue_bulk(src, count);
+    Notify(res, &pop_ec_);
+    return res;
+  }
+
+  //! Non blocking bulk pop of up to count items into dest. Returns how many items were popped.
+  template <typename It> size_t TryPopBulk(It dest, size_t count) noexcept {
+    size_t res = q_.try_dequeue_bulk(dest, count);
+    Notify(res, &push_ec_);
+    return res;
+  }
+
+  //! Blocking bulk push, returns after all count items were pushed.
+  template <typename It> void PushBulk(It src, size_t count) noexcept;
+
+  //! Blocking bulk pop. Waits until at least one item is available and pops up to count items.
+  //! Returns 0 if the channel is closed and empty.
+  template <typename It> size_t PopBulk(It dest, size_t count);
+
+  /*! Signals the consumers that the channel is going to be closed.
+      Consumers may still pop the existing items until Pop() returns false.
+      Should not be called concurrently with pushes. Does not block.
+  */
+  void StartClosing();
+
+  bool IsClosing() const { return is_closing_.load(std::memory_order_relaxed); }
+
+  size_t Capacity() const { return q_.capacity(); }
+
+ private:
+  // Wakes up a single waiter for a single item and all of them for a batch.
+  static void Notify(size_t count, EventCount* ec) noexcept {
+    if (count == 1)
+      ec->notify();
+    else if (count > 1)
+      ec->notifyAll();
+  }
+
+  base::mpmc_bounded_queue<T> q_;
+  std::atomic_bool is_closing_{false};
+
+  EventCount push_ec_, pop_ec_;
+};
+
+template <typename T> bool MPMCChannel<T>::Pop(T& dest) {
+  bool res = false;
+  pop_ec_.await([&] {
+    res = TryPop(dest);
+    return res || is_closing_.load(std::memory_order_acquire);
+  });
+
+  // The items pushed before StartClosing() must not be lost.
+  return res || TryPop(dest);
+}
+
+template <typename T>
+template <typename It>
+void MPMCChannel<T>::PushBulk(It src, size_t count) noexcept {
+  while (count) {
+    size_t pushed = 0;
+    push_ec_.await([&] {
+      pushed = TryPushBulk(src, count);
+      return pushed > 0;
+    });
+    std::advance(src, pushed);
+    count -= pushed;
+  }
+}
+
+template <typename T>
+template <typename It>
+size_t MPMCChannel<T>::PopBulk(It dest, size_t count) {
+  size_t res = 0;
+  pop_ec_.await([&] {
+    res = TryPopBulk(dest, count);
+    return res > 0 || is_closing_.load(std::memory_order_acquire);
+  });
+
+  return res ? res : TryPopBulk(dest, count);
+}
+
+template <typename T> void MPMCChannel<T>::StartClosing() {
+  // Full barrier, StartClosing performance does not matter.
+  is_closing_.store(true, std::memory_order_seq_cst);
+  pop_ec_.notifyAll();
+}
+
+}  // namespace fibers_ext
+}  // namespace util
@@ -0,0 +1,123 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/fibers/pooled_stack.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "base/logging.h"
+
+DEFINE_uint32(fiber_stack_size, 128 << 10, "Stack size of the fibers launched by the IO threads, "
+              "without the guard page. The default is the default of boost.context");
+DEFINE_uint32(fiber_stack_cache, 64, "Maximal number of free fiber stacks of each size that a "
+              "thread keeps for reuse");
+
+namespace util {
+namespace fibers_ext {
+
+namespace {
+
+// The free stacks of the thread, by their mapped size. Few sizes are used, so a vector is
+// enough.
+struct StackCache {
+  struct Bucket {
+    size_t size;
+    std::vector<void*> stacks;
+  };
+
+  std::vector<Bucket> buckets;
+  PooledStackAllocator::Stats stats;
+
+  std::vector<void*>& Get(size_t size) {
+    for (auto& b : buckets) {
+      if (b.size == size)
+        return b.stacks;
+    }
+    buckets.push_back(Bucket{size, {}});
+    return buckets.back().stacks;
+  }
+
+  ~StackCache() {
+    for (auto& b : buckets) {
+      for (void* ptr : b.stacks)
+        munmap(ptr, b.size);
+    }
+  }
+};
+
+thread_local StackCache stack_cache;
+
+size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+}  // namespace
+
+PooledStackAllocator::PooledStackAllocator() : PooledStackAllocator(FLAGS_fiber_stack_size) {}
+
+PooledStackAllocator::PooledStackAllocator(size_t stack_size) {
+  size_t page_size = PageSize();
+  stack_size_ = std::max((stack_size + page_size - 1) / page_size, size_t(1)) * page_size;
+}
+
+boost::context::stack_context PooledStackAllocator::allocate() {
+  // One guard page below the stack, which grows down.
+  size_t size = stack_size_ + PageSize();
+  StackCache& cache = stack_cache;
+  std::vector<void*>& stacks = cache.Get(size);
+
+  void* ptr;
+  if (stacks.empty()) {
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+      throw std::bad_alloc();
+    CHECK_EQ(0, mprotect(ptr, PageSize(), PROT_NONE));
+    ++cache.stats.mapped;
+  } else {
+    ptr = stacks.back();
+    stacks.pop_back();
+    --cache.stats.cached;
+    ++cache.stats.reused;
+  }
+  cache.stats.peak_in_use = std::max(++cache.stats.in_use, cache.stats.peak_in_use);
+
+  boost::context::stack_context sctx;
+  sctx.size = size;
+  sctx.sp = static_cast<char*>(ptr) + size;
+  return sctx;
+}
+
+void PooledStackAllocator::deallocate(boost::context::stack_context& sctx) noexcept {
+  void* ptr = static_cast<char*>(sctx.sp) - sctx.size;
+  StackCache& cache = stack_cache;
+  std::vector<void*>& stacks = cache.Get(sctx.size);
+  --cache.stats.in_use;
+
+  if (stacks.size() < FLAGS_fiber_stack_cache) {
+    stacks.push_back(ptr);
+    ++cache.stats.cached;
+  } else {
+    munmap(ptr, sctx.size);
+  }
+}
+
+auto PooledStackAllocator::ThisThreadStats() -> const Stats& { return stack_cache.stats; }
+
+void PooledStackAllocator::ReleaseCached() {
+  StackCache& cache = stack_cache;
+  for (auto& b : cache.buckets) {
+    for (void* ptr : b.stacks)
+      munmap(ptr, b.size);
+    b.stacks.clear();
+  }
+  cache.stats.cached = 0;
+}
+
+}  // namespace fibers_ext
+}  // namespace util
@@ -0,0 +1,54 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/context/stack_context.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+namespace fibers_ext {
+
+/**
+ * @brief Stack allocator for boost fibers that caches the stacks of finished fibers per thread.
+ *
+ * The stacks are mmapped with a guard page below them, like boost's protected_fixedsize_stack,
+ * but a finished fiber returns its stack to the cache of the thread it finished on instead of
+ * unmapping it. Servers that launch a fiber per connection or per request then reuse warm
+ * stacks without syscalls or page faults. A thread caches up to --fiber_stack_cache stacks of
+ * each size and unmaps the rest.
+ */
+class PooledStackAllocator {
+ public:
+  //! Per-thread counters of the stacks allocated by the thread.
+  struct Stats {
+    uint64_t mapped = 0;    // stacks that were mmapped.
+    uint64_t reused = 0;    // allocations served from the cache.
+    int64_t in_use = 0;     // may be negative if fibers migrate between threads.
+    int64_t peak_in_use = 0;
+    uint64_t cached = 0;
+  };
+
+  //! Uses --fiber_stack_size.
+  PooledStackAllocator();
+
+  //! stack_size does not include the guard page and is rounded up to a whole number of pages.
+  explicit PooledStackAllocator(size_t stack_size);
+
+  boost::context::stack_context allocate();
+  void deallocate(boost::context::stack_context& sctx) noexcept;
+
+  size_t stack_size() const { return stack_size_; }
+
+  static const Stats& ThisThreadStats();
+
+  //! Unmaps the stacks cached by the calling thread.
+  static void ReleaseCached();
+
+ private:
+  size_t stack_size_;
+};
+
+}  // namespace fibers_ext
+}  // namespace util
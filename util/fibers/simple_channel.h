@@ -21,19 +21,31 @@ namespace fibers_ext {
   can pull the records. It has optional blocking interface that suspends blocked fibers upon
   empty/full conditions. This class designed to be pretty efficient by reducing the contention
   on its synchronization primitives to minimum.
+
+  The bulk calls move multiple items with a single notification. If spin_count is set,
+  the blocking pops poll the queue up to spin_count times before suspending, which saves
+  the park/unpark roundtrip when the producer thread is about to push. Do not spin when both
+  end-points run in the same thread. For multiple consumer threads use MPMCChannel.
 */
 template <typename T> class SimpleChannel {
   typedef ::boost::fibers::context::wait_queue_t wait_queue_t;
   using spinlock_lock_t = ::boost::fibers::detail::spinlock_lock;
 
  public:
-  SimpleChannel(size_t n) : q_(n) {}
+  explicit SimpleChannel(size_t n, unsigned spin_count = 0) : q_(n), spin_count_(spin_count) {}
 
   template <typename... Args> void Push(Args&&... recordArgs) noexcept;
 
   // Blocking call. Returns false if channel is closed, true otherwise with the popped value.
   bool Pop(T& dest);
 
+  //! Blocking bulk push, returns after all count items starting from src were pushed.
+  template <typename It> void PushBulk(It src, size_t count) noexcept;
+
+  //! Blocking bulk pop. Waits until at least one item is available and pops up to count items
+  //! into dest. Returns 0 if the channel is closed and empty.
+  template <typename It> size_t PopBulk(It dest, size_t count);
+
   /*! /brief Should be called only from the producer side.
 
       Signals the consumers that the channel is going to be close.
@@ -47,15 +59,23 @@ template <typename T> class SimpleChannel {
   //! Non blocking push.
   template <typename... Args> bool TryPush(Args&&... args) noexcept {
     if (q_.write(std::forward<Args>(args)...)) {
-      if (++throttled_pushes_ > q_.capacity() / 3) {
-        pop_ec_.notify();
-        throttled_pushes_ = 0;
-      }
+      OnPushed(1);
       return true;
     }
     return false;
   }
 
+  //! Non blocking bulk push of up to count items starting from src.
+  //! Returns how many items were pushed, they are moved from.
+  template <typename It> size_t TryPushBulk(It src, size_t count) noexcept {
+    size_t res = 0;
+    for (; res < count && q_.write(std::move(*src)); ++res) {
+      ++src;
+    }
+    OnPushed(res);
+    return res;
+  }
+
   //! Non blocking pop.
   bool TryPop(T& val) {
     if (q_.read(val)) {
@@ -65,12 +85,47 @@ template <typename T> class SimpleChannel {
     return false;
   }
 
+  //! Non blocking bulk pop of up to count items into dest. Returns how many items were popped.
+  template <typename It> size_t TryPopBulk(It dest, size_t count) {
+    size_t res = 0;
+    for (; res < count && q_.read(*dest); ++res) {
+      ++dest;
+    }
+
+    // Like TryPop, wakes up the producers once the queue is drained.
+    if (res < count)
+      push_ec_.notify();
+    return res;
+  }
+
   bool IsClosing() const { return is_closing_.load(std::memory_order_relaxed); }
 
+  //! Approximate number of items in the channel. Can be called from any thread.
+  size_t SizeGuess() const { return q_.sizeGuess(); }
+  size_t Capacity() const { return q_.capacity(); }
+
  private:
-  unsigned throttled_pushes_ = 0;
+  void OnPushed(size_t count) noexcept {
+    throttled_pushes_ += count;
+    if (count && throttled_pushes_ > q_.capacity() / 3) {
+      pop_ec_.notify();
+      throttled_pushes_ = 0;
+    }
+  }
+
+  // Polls the queue before the consumer suspends.
+  void Spin() const {
+    for (unsigned i = 0; i < spin_count_; ++i) {
+      if (!q_.isEmpty() || is_closing_.load(std::memory_order_relaxed))
+        return;
+      asm volatile("pause");
+    }
+  }
+
+  size_t throttled_pushes_ = 0;
 
   folly::ProducerConsumerQueue<T> q_;
+  const unsigned spin_count_;
   std::atomic_bool is_closing_{false};
 
   // Event counts provide almost negligible contention during fast-path (a single atomic add).
@@ -96,6 +151,8 @@ template <typename T> bool SimpleChannel<T>::Pop(T& dest) {
   if (TryPop(dest))  // fast path
     return true;
 
+  Spin();
+
   while (true) {
     EventCount::Key key = pop_ec_.prepareWait();
     if (TryPop(dest)) {
@@ -110,6 +167,46 @@ template <typename T> bool SimpleChannel<T>::Pop(T& dest) {
   }
 }
 
+template <typename T>
+template <typename It>
+void SimpleChannel<T>::PushBulk(It src, size_t count) noexcept {
+  while (true) {
+    size_t pushed = TryPushBulk(src, count);
+    std::advance(src, pushed);
+    count -= pushed;
+    if (!count)
+      break;
+
+    EventCount::Key key = push_ec_.prepareWait();
+    pushed = TryPushBulk(src, count);
+    std::advance(src, pushed);
+    count -= pushed;
+    if (!count)
+      break;
+    if (!pushed)
+      push_ec_.wait(key.epoch());
+  }
+}
+
+template <typename T>
+template <typename It>
+size_t SimpleChannel<T>::PopBulk(It dest, size_t count) {
+  size_t res = TryPopBulk(dest, count);  // fast path
+  if (res || !count)
+    return res;
+
+  Spin();
+  while (true) {
+    EventCount::Key key = pop_ec_.prepareWait();
+    res = TryPopBulk(dest, count);
+    if (res || is_closing_.load(std::memory_order_acquire)) {
+      return res ? res : TryPopBulk(dest, count);
+    }
+
+    pop_ec_.wait(key.epoch());
+  }
+}
+
 template <typename T> void SimpleChannel<T>::StartClosing() {
   // Full barrier, StartClosing performance does not matter.
   is_closing_.store(true, std::memory_order_seq_cst);
@@ -52,6 +52,7 @@ StatusObject<HttpsClientPool::ClientHandle> ApiSenderBase::SendGeneric(unsigned
   HttpsClientPool::ClientHandle handle;
 
   uint64_t start = base::GetMonotonicMicrosFast();
+  uint32_t token_version = gce_.access_token_version();
 
   // for now we may increase num_iterations indefinitely in some cases.
   // TODO: to refine this logic.
@@ -79,11 +80,14 @@ StatusObject<HttpsClientPool::ClientHandle> ApiSenderBase::SendGeneric(unsigned
     }
 
     if (ec == asio::error::no_permission) {
-      auto token_res = gce_.RefreshAccessToken(&pool_->io_context());
-      if (!token_res.ok())
-        return token_res.status;
-
-      AddBearer(token_res.obj, &req);
+      // Refreshes only if nobody has published a new token since we built the request.
+      if (token_version == gce_.access_token_version()) {
+        auto token_res = gce_.RefreshAccessToken(&pool_->io_context());
+        if (!token_res.ok())
+          return token_res.status;
+      }
+      token_version = gce_.access_token_version();
+      AddBearer(gce_.access_token(), &req);
     } else if (ec == asio::error::try_again) {
       ++num_iterations;
       LOG(INFO) << "RespIter " << iters << ": socket " << handle->native_handle() << " retrying";
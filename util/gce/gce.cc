@@ -13,6 +13,9 @@
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/string_body.hpp>
 #include <boost/beast/http/write.hpp>  // for operator<<
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <boost/fiber/operations.hpp>
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
@@ -21,9 +24,11 @@
 #include "absl/strings/str_split.h"
 #include "absl/strings/strip.h"
 #include "base/logging.h"
+#include "base/walltime.h"
 #include "file/file_util.h"
 #include "file/filesource.h"
 #include "util/asio/fiber_socket.h"
+#include "util/asio/io_context.h"
 #include "util/http/https_client.h"
 
 namespace util {
@@ -213,8 +218,17 @@ util::Status GCE::ReadDevCreds(const std::string& root_path) {
 }
 
 std::string GCE::access_token() const {
-  std::lock_guard<fibers::mutex> lk(mu_);
-  return access_token_;
+  std::shared_ptr<const string> token = std::atomic_load(&access_token_);
+  return token ? *token : string{};
+}
+
+void GCE::PublishToken(std::string token, int64_t expires_in_sec) const {
+  std::atomic_store(&access_token_, std::shared_ptr<const string>(new string(std::move(token))));
+
+  int64_t expiry = expires_in_sec > 0 ? base::GetMonotonicMicrosFast() + expires_in_sec * 1000000
+                                      : 0;
+  token_expiry_usec_.store(expiry, std::memory_order_relaxed);
+  token_version_.fetch_add(1, std::memory_order_acq_rel);
 }
 
 StatusObject<std::string> GCE::RefreshAccessToken(IoContext* context) const {
@@ -281,26 +295,142 @@ util::StatusObject<std::string> GCE::ParseTokenResponse(std::string&& response)
   }
 
   string access_token, token_type;
+  int64_t expires_in = 0;
   for (auto it = doc.MemberBegin(); it != doc.MemberEnd(); ++it) {
     if (it->name == "access_token") {
       access_token = it->value.GetString();
     } else if (it->name == "token_type") {
       token_type = it->value.GetString();
+    } else if (it->name == "expires_in" && it->value.IsInt64()) {
+      expires_in = it->value.GetInt64();
     }
   }
   if (token_type != "Bearer" || access_token.empty()) {
     return Status(absl::StrCat("Bad json response: ", doc.GetString()));
   }
 
-  std::lock_guard<fibers::mutex> lk(mu_);
-  access_token_ = access_token;
+  PublishToken(access_token, expires_in);
 
   return access_token;
 }
 
 void GCE::Test_InjectAcessToken(std::string access_token) {
-  std::lock_guard<fibers::mutex> lk(mu_);
-  access_token_.swap(access_token);
+  PublishToken(std::move(access_token), 0);
+}
+
+static constexpr int64_t kRefreshAheadSec = 300;
+static constexpr unsigned kMaxRefreshBackoffSec = 30;
+
+// Shared by GCE and its refresher because either of them can be destroyed first.
+struct GCE::RefreshState {
+  fibers::mutex mu;
+  fibers::condition_variable cv;
+  const GCE* gce = nullptr;
+  bool cancelled = false, refreshing = false;
+};
+
+// Renews the token when kRefreshAheadSec remain until its expiry, or at the half of its
+// lifetime for the short-lived tokens. Failures are retried with exponential backoff while
+// the old token is still valid.
+class GCE::TokenRefresher final : public IoContext::Cancellable {
+ public:
+  TokenRefresher(std::shared_ptr<RefreshState> state, IoContext* context)
+      : state_(std::move(state)), context_(context) {}
+
+  void Run() final;
+  void Cancel() final;
+
+ private:
+  // Returns the delay until the next refresh or -1 if the expiry is unknown.
+  int64_t NextRefreshUsec(int64_t lifetime_usec) const;
+
+  std::shared_ptr<RefreshState> state_;
+  IoContext* context_;
+};
+
+int64_t GCE::TokenRefresher::NextRefreshUsec(int64_t lifetime_usec) const {
+  int64_t expiry = state_->gce->token_expiry_usec_.load(std::memory_order_relaxed);
+  if (expiry == 0)
+    return -1;  // E.g. an injected token.
+
+  int64_t ahead = std::min<int64_t>(kRefreshAheadSec * 1000000, lifetime_usec / 2);
+  return std::max<int64_t>(expiry - ahead - base::GetMonotonicMicrosFast(), 0);
+}
+
+void GCE::TokenRefresher::Run() {
+  this_fiber::properties<IoFiberProperties>().set_name("TokenRefresher");
+
+  RefreshState& st = *state_;
+  auto cancelled = [&st] { return st.cancelled; };
+  std::unique_lock<fibers::mutex> lk(st.mu);
+  if (st.cancelled)
+    return;
+
+  unsigned backoff_sec = 1;
+  int64_t lifetime_usec =
+      st.gce->token_expiry_usec_.load(std::memory_order_relaxed) - base::GetMonotonicMicrosFast();
+  int64_t delay_usec = NextRefreshUsec(lifetime_usec);
+
+  while (delay_usec >= 0) {
+    if (st.cv.wait_for(lk, chrono::microseconds(delay_usec), cancelled))
+      return;
+
+    st.refreshing = true;
+    const GCE* gce = st.gce;
+    lk.unlock();
+    int64_t start = base::GetMonotonicMicrosFast();
+    auto res = gce->RefreshAccessToken(context_);
+    lk.lock();
+
+    if (res.ok()) {
+      backoff_sec = 1;
+      lifetime_usec = gce->token_expiry_usec_.load(std::memory_order_relaxed) - start;
+      delay_usec = NextRefreshUsec(lifetime_usec);
+      VLOG(1) << "Refreshed the access token, next refresh in " << delay_usec / 1000000 << "s";
+    } else {
+      LOG(WARNING) << "Could not refresh the access token: " << res.status << ", retrying in "
+                   << backoff_sec << "s";
+      delay_usec = backoff_sec * 1000000LL;
+      backoff_sec = std::min(backoff_sec * 2, kMaxRefreshBackoffSec);
+    }
+
+    // ~GCE waits for the refresh to finish before it resets st.gce.
+    st.refreshing = false;
+    st.cv.notify_all();
+  }
+  LOG(INFO) << "The token expiry is unknown, stopping the background refresh";
+}
+
+void GCE::TokenRefresher::Cancel() {
+  std::lock_guard<fibers::mutex> lk(state_->mu);
+  state_->cancelled = true;
+  state_->cv.notify_all();
+}
+
+GCE::~GCE() {
+  if (!refresh_state_)
+    return;
+
+  std::unique_lock<fibers::mutex> lk(refresh_state_->mu);
+  refresh_state_->cancelled = true;
+  refresh_state_->cv.notify_all();
+  refresh_state_->cv.wait(lk, [this] { return !refresh_state_->refreshing; });
+  refresh_state_->gce = nullptr;
+}
+
+Status GCE::StartTokenRefresh(IoContext* context) {
+  if (access_token().empty()) {
+    auto res = context->AwaitSafe([&] { return RefreshAccessToken(context); });
+    if (!res.ok())
+      return res.status;
+  }
+
+  CHECK(!refresh_state_) << "StartTokenRefresh was already called";
+  refresh_state_ = std::make_shared<RefreshState>();
+  refresh_state_->gce = this;
+
+  context->AttachCancellable(new TokenRefresher(refresh_state_, context));
+  return Status::OK;
 }
 
 }  // namespace util
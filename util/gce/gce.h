@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <boost/asio/ssl.hpp>
 #include <boost/fiber/mutex.hpp>
 #include <memory>
@@ -19,6 +20,7 @@ class GCE {
   using error_code = ::boost::system::error_code;
 
   GCE() = default;
+  ~GCE();
 
   Status Init();
 
@@ -39,7 +41,20 @@ class GCE {
   //! Must be called after RefreshAccessToken has been called.
   std::string access_token() const;
 
+  //! Changes every time a new access token is published. Allows the handles to refresh
+  //! their cached authorization headers and to skip the refresh on 401 if another fiber
+  //! has already published a new token.
+  uint32_t access_token_version() const {
+    return token_version_.load(std::memory_order_acquire);
+  }
+
   StatusObject<std::string> RefreshAccessToken(IoContext* context) const;
+
+  //! Fetches the token if it was not fetched yet and starts a background fiber in context
+  //! that renews it ahead of its expiry, so that the request fibers do not stall on
+  //! 401 responses. The fiber is stopped with the IoContext or when GCE is destroyed.
+  Status StartTokenRefresh(IoContext* context);
+
   bool is_prod_env() const { return is_prod_env_; }
 
   void Test_InjectAcessToken(std::string access_token);
@@ -48,11 +63,19 @@ class GCE {
   util::Status ParseDefaultConfig();
   util::Status ReadDevCreds(const std::string& root_path);
   util::StatusObject<std::string> ParseTokenResponse(std::string&& response) const;
+  void PublishToken(std::string token, int64_t expires_in_sec) const;
+
+  struct RefreshState;
+  class TokenRefresher;
 
   std::string project_id_, client_id_, client_secret_, account_id_, refresh_token_;
 
-  mutable ::boost::fibers::mutex mu_;
-  mutable std::string access_token_;
+  // Published with atomic_store so that readers on all the IO threads never block.
+  mutable std::shared_ptr<const std::string> access_token_;
+  mutable std::atomic_uint32_t token_version_{0};
+  mutable std::atomic<int64_t> token_expiry_usec_{0};  // GetMonotonicMicrosFast() clock.
+
+  std::shared_ptr<RefreshState> refresh_state_;
 
   std::unique_ptr<SslContext> ssl_ctx_;
   bool is_prod_env_ = false;
@@ -130,8 +130,7 @@ Status GCS::Connect(unsigned msec) {
     return ToStatus(ec);
   }
 
-  string token = gce_.access_token();
-  access_token_header_ = absl::StrCat("Bearer ", token);
+  UpdateTokenHeader();
 
   VLOG(1) << "GCS::Connect OK " << native_handle();
 
@@ -191,6 +190,16 @@ auto GCS::ListBuckets() -> ListBucketResult {
 
 auto GCS::List(absl::string_view bucket, absl::string_view prefix, bool fs_mode, ListObjectCb cb)
     -> ListObjectResult {
+  return ListInternal(bucket, prefix, fs_mode, std::move(cb), nullptr);
+}
+
+auto GCS::ListDir(absl::string_view bucket, absl::string_view prefix, ListObjectCb cb,
+                  ListPrefixCb prefix_cb) -> ListObjectResult {
+  return ListInternal(bucket, prefix, true, std::move(cb), std::move(prefix_cb));
+}
+
+auto GCS::ListInternal(absl::string_view bucket, absl::string_view prefix, bool fs_mode,
+                       ListObjectCb cb, ListPrefixCb prefix_cb) -> ListObjectResult {
   CHECK(!bucket.empty());
   VLOG(1) << "GCS::List " << native_handle();
 
@@ -220,26 +229,36 @@ auto GCS::List(absl::string_view bucket, absl::string_view prefix, bool fs_mode,
       return Status(StatusCode::PARSE_ERROR, "Could not parse json response");
     }
 
+    // With a delimiter a page may hold only prefixes, so a missing "items" does not end
+    // the listing.
     auto it = doc.FindMember("items");
-    if (it == doc.MemberEnd())
-      break;
-
-    const auto& val = it->value;
-    CHECK(val.IsArray());
-    auto array = val.GetArray();
+    if (it != doc.MemberEnd()) {
+      const auto& val = it->value;
+      CHECK(val.IsArray());
+      auto array = val.GetArray();
+
+      for (size_t i = 0; i < array.Size(); ++i) {
+        const auto& item = array[i];
+        auto it = item.FindMember("name");
+        CHECK(it != item.MemberEnd());
+        absl::string_view key_name(it->value.GetString(), it->value.GetStringLength());
+        it = item.FindMember("size");
+        CHECK(it != item.MemberEnd());
+        absl::string_view sz_str(it->value.GetString(), it->value.GetStringLength());
+        size_t item_size = 0;
+        CHECK(absl::SimpleAtoi(sz_str, &item_size));
+        cb(item_size, key_name);
+      }
+    }
 
-    for (size_t i = 0; i < array.Size(); ++i) {
-      const auto& item = array[i];
-      auto it = item.FindMember("name");
-      CHECK(it != item.MemberEnd());
-      absl::string_view key_name(it->value.GetString(), it->value.GetStringLength());
-      it = item.FindMember("size");
-      CHECK(it != item.MemberEnd());
-      absl::string_view sz_str(it->value.GetString(), it->value.GetStringLength());
-      size_t item_size = 0;
-      CHECK(absl::SimpleAtoi(sz_str, &item_size));
-      cb(item_size, key_name);
+    it = doc.FindMember("prefixes");
+    if (prefix_cb && it != doc.MemberEnd()) {
+      CHECK(it->value.IsArray());
+      for (const auto& val : it->value.GetArray()) {
+        prefix_cb(absl::string_view(val.GetString(), val.GetStringLength()));
+      }
     }
+
     it = doc.FindMember("nextPageToken");
     if (it == doc.MemberEnd()) {
       break;
@@ -291,18 +310,33 @@ Status GCS::PrepareConnection() {
 
 
 
-Status GCS::RefreshToken(Request* req) {
-  auto res = gce_.RefreshAccessToken(&io_context_);
-  if (!res.ok())
-    return res.status;
+bool GCS::UpdateTokenHeader() {
+  uint32_t version = gce_.access_token_version();
+  if (version == token_version_ && !access_token_header_.empty())
+    return false;
 
-  access_token_header_ = absl::StrCat("Bearer ", res.obj);
+  token_version_ = version;
+  access_token_header_ = absl::StrCat("Bearer ", gce_.access_token());
+  return true;
+}
+
+Status GCS::RefreshToken(Request* req) {
+  // Another handle or the background refresher might have renewed the token already.
+  if (!UpdateTokenHeader()) {
+    auto res = gce_.RefreshAccessToken(&io_context_);
+    if (!res.ok())
+      return res.status;
+    UpdateTokenHeader();
+  }
   req->set(h2::field::authorization, access_token_header_);
 
   return Status::OK;
 }
 
 template <typename RespBody> Status GCS::SendWithToken(Request* req, Response<RespBody>* resp) {
+  if (UpdateTokenHeader())
+    req->set(h2::field::authorization, access_token_header_);
+
   for (unsigned i = 0; i < 2; ++i) {  // Iterate for possible token refresh.
     VLOG(1) << "HttpReq" << i << ": " << *req << ", socket " << native_handle();
 
@@ -57,6 +57,14 @@ class GCS {
   ListObjectResult List(absl::string_view bucket, absl::string_view prefix, bool fs_mode,
                         ListObjectCb cb);
 
+  //! Called with the sub-prefixes ("directories") of a listed prefix, including the trailing '/'.
+  using ListPrefixCb = std::function<void(absl::string_view)>;
+
+  //! Lists the files directly under the prefix with cb and its sub-prefixes with prefix_cb.
+  //! Allows splitting a large listing into independent listings of the sub-prefixes.
+  ListObjectResult ListDir(absl::string_view bucket, absl::string_view prefix, ListObjectCb cb,
+                           ListPrefixCb prefix_cb);
+
   ReadObjectResult Read(absl::string_view bucket, absl::string_view path, size_t ofs,
                         const strings::MutableByteRange& range);
 
@@ -79,6 +87,9 @@ class GCS {
 
   util::Status RefreshToken(Request* req);
 
+  ListObjectResult ListInternal(absl::string_view bucket, absl::string_view prefix, bool fs_mode,
+                                ListObjectCb cb, ListPrefixCb prefix_cb);
+
   std::string BuildGetObjUrl(absl::string_view bucket, absl::string_view path);
   util::Status PrepareConnection();
 
@@ -87,7 +98,11 @@ class GCS {
 
   uint32_t native_handle();
 
+  //! Rebuilds access_token_header_ if GCE has published a new token since.
+  bool UpdateTokenHeader();
+
   std::string access_token_header_;
+  uint32_t token_version_ = 0;
   std::unique_ptr<http::HttpsClient> https_client_;
 };
 
@@ -107,6 +122,17 @@ bool IsGcsPath(absl::string_view path);
 StatusObject<file::WriteFile*> OpenGcsWriteFile(
     absl::string_view full_path, const GCE& gce, http::HttpsClientPool* pool);
 
+/**
+ * @brief Opens a new GCS file for writes that uploads its parts in parallel.
+ *
+ * Every part_size bytes are uploaded as a temporary object over a separate connection of
+ * 'pool', up to max_inflight at once. Close composes the parts into the object and deletes
+ * them. The threading requirements are those of OpenGcsWriteFile.
+ */
+StatusObject<file::WriteFile*> OpenGcsParallelWriteFile(
+    absl::string_view full_path, const GCE& gce, http::HttpsClientPool* pool,
+    unsigned max_inflight, size_t part_size);
+
 
 /**
  * @brief Opens read-only, GCS-backed file.
@@ -118,9 +144,23 @@ StatusObject<file::WriteFile*> OpenGcsWriteFile(
  * @param gce
  * @param pool
  * @param opts
+ * @param generation - if not null, filled with the generation of the object that is read.
  * @return StatusObject<file::ReadonlyFile*>
  */
 StatusObject<file::ReadonlyFile*> OpenGcsReadFile(
     absl::string_view full_path, const GCE& gce, http::HttpsClientPool* pool,
-    const file::ReadonlyFile::Options& opts = file::ReadonlyFile::Options{});
+    const file::ReadonlyFile::Options& opts = file::ReadonlyFile::Options{},
+    std::string* generation = nullptr);
+/**
+ * @brief Opens read-only, GCS-backed file that reads ahead with concurrent range requests.
+ *
+ * The object is read in windows of window_size bytes, up to max_inflight windows that follow
+ * the read offset are requested at once over separate connections of 'pool'. Reads at other
+ * offsets restart the read-ahead there and reuse the pooled connections. Holds up to
+ * max_inflight windows in memory. The threading requirements are those of OpenGcsReadFile.
+ */
+StatusObject<file::ReadonlyFile*> OpenGcsReadAheadFile(
+    absl::string_view full_path, const GCE& gce, http::HttpsClientPool* pool,
+    unsigned max_inflight, size_t window_size, std::string* generation = nullptr);
+
 }  // namespace util
@@ -3,8 +3,12 @@
 //
 #include "util/gce/gcs.h"
 
+#include <rapidjson/document.h>
+
 #include <boost/beast/http/buffer_body.hpp>
 #include <boost/beast/http/parser.hpp>
+#include <boost/fiber/fiber.hpp>
+#include <deque>
 
 #include "base/logging.h"
 #include "strings/escaping.h"
@@ -20,9 +24,12 @@ using namespace ::std;
 namespace h2 = beast::http;
 using file::ReadonlyFile;
 using http::HttpsClientPool;
+namespace rj = rapidjson;
 
 namespace {
 
+constexpr unsigned kMaxRangeRetries = 3;
+
 string BuildGetObjUrl(absl::string_view bucket, absl::string_view obj_path) {
   string read_obj_url{"/storage/v1/b/"};
   absl::StrAppend(&read_obj_url, bucket, "/o/");
@@ -64,9 +71,12 @@ class GcsReadFile : public ReadonlyFile, private detail::ApiSenderBufferBody {
 
   Status Open();
 
+  const string& generation() const { return generation_; }
+
  private:
   const string read_obj_url_;
   HttpsClientPool::ClientHandle https_handle_;
+  string generation_;
 
   size_t size_ = 0,offs_ = 0;
 };
@@ -96,6 +106,11 @@ Status GcsReadFile::Open() {
       size_ = content_sz;
     }
   }
+
+  auto generation_it = msg.find("x-goog-generation");
+  if (generation_it != msg.end()) {
+    generation_ = string(detail::absl_sv(generation_it->value()));
+  }
   https_handle_ = std::move(handle_res.obj);
   return Status::OK;
 }
@@ -179,11 +194,238 @@ Status GcsReadFile::Close() {
   return Status::OK;
 }
 
+/*! Reads the object with concurrent range requests of window_size bytes. Up to max_inflight
+    windows that follow the read offset are requested at once, each over its own connection
+    of the pool, and are consumed in order. A read at another offset drops the windows and
+    restarts the read-ahead there. The dropped requests are completed rather than aborted so
+    their connections return to the pool without a reconnect.
+*/
+class GcsReadAheadFile : public ReadonlyFile {
+ public:
+  using error_code = ::boost::system::error_code;
+
+  GcsReadAheadFile(const GCE& gce, HttpsClientPool* pool, absl::string_view bucket,
+                   absl::string_view obj_path, unsigned max_inflight, size_t window_size);
+
+  ~GcsReadAheadFile() final;
+
+  StatusObject<size_t> Read(size_t offset, const strings::MutableByteRange& range) final;
+
+  Status Close() final;
+
+  size_t Size() const final { return size_; }
+
+  int Handle() const final { return -1; }
+
+  // Fetches the size and the generation of the object.
+  Status Open();
+
+  const string& generation() const { return generation_; }
+
+ private:
+  struct Window {
+    size_t offset = 0, size = 0;
+    std::unique_ptr<uint8_t[]> data;
+    Status status;
+    fibers::fiber fb;
+  };
+
+  // Requests the windows that follow the last one until max_inflight_ are in flight.
+  void ReadAhead();
+
+  // Waits for the windows and drops them.
+  void DropWindows();
+
+  // Reads the range [offset, offset + size) of the object into dest.
+  Status FetchRange(size_t offset, size_t size, uint8_t* dest);
+
+  const GCE& gce_;
+  HttpsClientPool* pool_;
+  string bucket_, obj_path_, read_obj_url_;
+  const unsigned max_inflight_;
+  const size_t window_size_;
+
+  std::deque<std::unique_ptr<Window>> windows_;  // In the order of their offsets.
+  size_t next_offset_ = 0;  // Offset of the window that is requested next.
+  size_t size_ = 0;
+  string generation_;
+};
+
+GcsReadAheadFile::GcsReadAheadFile(const GCE& gce, HttpsClientPool* pool,
+                                   absl::string_view bucket, absl::string_view obj_path,
+                                   unsigned max_inflight, size_t window_size)
+    : gce_(gce), pool_(pool), bucket_(bucket), obj_path_(obj_path),
+      read_obj_url_(BuildGetObjUrl(bucket, obj_path)), max_inflight_(max_inflight),
+      window_size_(window_size) {
+  CHECK_GT(max_inflight_, 0);
+  CHECK_GT(window_size_, 0);
+}
+
+GcsReadAheadFile::~GcsReadAheadFile() {
+  DropWindows();
+}
+
+Status GcsReadAheadFile::Open() {
+  string url = absl::StrCat("/storage/v1/b/", bucket_, "/o/");
+  strings::AppendEncodedUrl(obj_path_, &url);
+  absl::StrAppend(&url, "?fields=size,generation");
+
+  auto req = detail::PrepareGenericRequest(h2::verb::get, url, gce_.access_token());
+  detail::ApiSenderBufferBody sender("stat", gce_, pool_);
+  auto res = sender.SendGeneric(3, std::move(req));
+  if (!res.ok())
+    return res.status;
+
+  auto* parser = sender.parser();
+  string json(1024, '\0');
+  auto& body = parser->get().body();
+  body.data = &json.front();
+  body.size = json.size();
+
+  error_code ec = res.obj->Read(parser);
+  if (ec && ec != h2::error::need_buffer)
+    return detail::ToStatus(ec);
+  if (!parser->is_done()) {
+    res.obj->schedule_reconnect();
+    return Status(StatusCode::PARSE_ERROR, "Object metadata is too long");
+  }
+  json.resize(json.size() - body.size);
+
+  rj::Document doc;
+  doc.Parse(json.data(), json.size());
+  if (doc.HasParseError() || !doc.IsObject())
+    return Status(StatusCode::PARSE_ERROR, "Could not parse object metadata");
+
+  auto it = doc.FindMember("size");
+  if (it == doc.MemberEnd() || !it->value.IsString() ||
+      !absl::SimpleAtoi(absl::string_view(it->value.GetString(), it->value.GetStringLength()),
+                        &size_)) {
+    return Status(StatusCode::PARSE_ERROR, "Object metadata has no size");
+  }
+
+  it = doc.FindMember("generation");
+  if (it != doc.MemberEnd() && it->value.IsString()) {
+    generation_.assign(it->value.GetString(), it->value.GetStringLength());
+  }
+  VLOG(1) << "Opened " << obj_path_ << " of size " << size_ << ", generation " << generation_;
+
+  return Status::OK;
+}
+
+StatusObject<size_t> GcsReadAheadFile::Read(size_t offset, const strings::MutableByteRange& range) {
+  CHECK(!range.empty());
+  CHECK(pool_->io_context().InContextThread());
+
+  // Drops the windows that were consumed.
+  while (!windows_.empty() && windows_.front()->offset + windows_.front()->size <= offset) {
+    windows_.front()->fb.join();
+    windows_.pop_front();
+  }
+
+  if (windows_.empty() ? offset != next_offset_ : offset < windows_.front()->offset) {
+    VLOG(1) << "Random read of " << obj_path_ << " at " << offset;
+    DropWindows();
+    next_offset_ = offset;
+  }
+
+  size_t read = 0;
+  while (read < range.size() && offset + read < size_) {
+    ReadAhead();
+
+    Window* window = windows_.front().get();
+    window->fb.join();
+    RETURN_IF_ERROR(window->status);
+
+    size_t pos = offset + read - window->offset;
+    size_t len = std::min(range.size() - read, window->size - pos);
+    memcpy(range.data() + read, window->data.get() + pos, len);
+    read += len;
+
+    if (pos + len == window->size)
+      windows_.pop_front();
+  }
+
+  return read;
+}
+
+void GcsReadAheadFile::ReadAhead() {
+  while (windows_.size() < max_inflight_ && next_offset_ < size_) {
+    std::unique_ptr<Window> window(new Window);
+    window->offset = next_offset_;
+    window->size = std::min(window_size_, size_ - next_offset_);
+    window->data.reset(new uint8_t[window->size]);
+    next_offset_ += window->size;
+
+    Window* ptr = window.get();
+    ptr->fb = fibers::fiber([this, ptr] {
+      ptr->status = FetchRange(ptr->offset, ptr->size, ptr->data.get());
+    });
+    windows_.push_back(std::move(window));
+  }
+}
+
+void GcsReadAheadFile::DropWindows() {
+  for (auto& window : windows_) {
+    window->fb.join();
+  }
+  windows_.clear();
+}
+
+Status GcsReadAheadFile::FetchRange(size_t offset, size_t size, uint8_t* dest) {
+  size_t read = 0;
+
+  for (unsigned iters = 0; read < size; ++iters) {
+    if (iters == kMaxRangeRetries) {
+      return Status(StatusCode::IO_ERROR, absl::StrCat("Could not read ", obj_path_, " at ",
+                                                       offset + read));
+    }
+
+    auto req = detail::PrepareGenericRequest(h2::verb::get, read_obj_url_, gce_.access_token());
+    SetRange(offset + read, offset + size, &req);
+
+    detail::ApiSenderBufferBody sender("read_range", gce_, pool_);
+    auto res = sender.SendGeneric(3, std::move(req));
+    if (!res.ok())
+      return res.status;
+
+    auto* parser = sender.parser();
+    while (read < size && !parser->is_done()) {
+      auto& body = parser->get().body();
+      body.data = dest + read;
+      body.size = size - read;
+
+      error_code ec = res.obj->Read(parser);
+      read = size - body.size;
+
+      if (ec && ec != h2::error::need_buffer) {
+        VLOG(1) << "Range of " << obj_path_ << " interrupted at " << offset + read << ": " << ec;
+        break;
+      }
+    }
+
+    if (!parser->is_done()) {
+      // We prefer reconnecting to draining.
+      res.obj->schedule_reconnect();
+    } else if (read < size) {
+      return Status(StatusCode::IO_ERROR, absl::StrCat("Object ", obj_path_, " was truncated"));
+    }
+  }
+
+  return Status::OK;
+}
+
+Status GcsReadAheadFile::Close() {
+  DropWindows();
+
+  return Status::OK;
+}
+
 }  // namespace
 
 StatusObject<ReadonlyFile*> OpenGcsReadFile(absl::string_view full_path, const GCE& gce,
                                             HttpsClientPool* pool,
-                                            const ReadonlyFile::Options& opts) {
+                                            const ReadonlyFile::Options& opts,
+                                            string* generation) {
   CHECK(opts.sequential && pool);
   CHECK(IsGcsPath(full_path));
 
@@ -194,6 +436,27 @@ StatusObject<ReadonlyFile*> OpenGcsReadFile(absl::string_view full_path, const G
 
   std::unique_ptr<GcsReadFile> fl(new GcsReadFile(gce, pool, std::move(read_obj_url)));
   RETURN_IF_ERROR(fl->Open());
+  if (generation) {
+    *generation = fl->generation();
+  }
+
+  return fl.release();
+}
+
+StatusObject<ReadonlyFile*> OpenGcsReadAheadFile(absl::string_view full_path, const GCE& gce,
+                                                 HttpsClientPool* pool, unsigned max_inflight,
+                                                 size_t window_size, string* generation) {
+  CHECK(pool);
+
+  absl::string_view bucket, obj_path;
+  CHECK(GCS::SplitToBucketPath(full_path, &bucket, &obj_path));
+
+  std::unique_ptr<GcsReadAheadFile> fl(
+      new GcsReadAheadFile(gce, pool, bucket, obj_path, max_inflight, window_size));
+  RETURN_IF_ERROR(fl->Open());
+  if (generation) {
+    *generation = fl->generation();
+  }
 
   return fl.release();
 }
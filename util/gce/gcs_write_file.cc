@@ -8,8 +8,12 @@
 #include "util/gce/gcs.h"
 
 #include <boost/beast/http/dynamic_body.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/fiber.hpp>
+#include <boost/fiber/mutex.hpp>
 #include <boost/fiber/operations.hpp>
 
+#include "absl/strings/str_replace.h"
 #include "absl/strings/strip.h"
 #include "base/logging.h"
 #include "base/walltime.h"
@@ -40,6 +44,11 @@ using http::HttpsClientPool;
 
 namespace {
 
+constexpr char kPartSuffix[] = ".mr3-part-";
+
+// GCS composes up to 32 objects in a single request.
+constexpr size_t kMaxComposeSources = 32;
+
 //! [from, to) limited range out of total. If total is < 0 then it's unknown.
 string ContentRangeHeader(size_t from, size_t to, ssize_t total) {
   CHECK_LE(from, to);
@@ -221,6 +230,245 @@ auto GcsWriteFile::PrepareRequest(size_t to, ssize_t total) -> Request {
   return req;
 }
 
+/*! Uploads the parts of the file in parallel, each part as a temporary object, and composes
+    them into the destination object on Close. At most max_inflight requests run at once,
+    so the file holds up to max_inflight + 1 parts in memory. A file that fits a single part
+    is uploaded with a single request.
+*/
+class GcsParallelWriteFile : public WriteFile {
+ public:
+  GcsParallelWriteFile(absl::string_view name, const GCE& gce, HttpsClientPool* pool,
+                       unsigned max_inflight, size_t part_size);
+
+  bool Close() final;
+
+  bool Open() final;
+
+  Status Write(const uint8* buffer, uint64 length) final;
+
+ private:
+  using Request = detail::ApiSenderBase::Request;
+
+  // Starts uploading body_mb_ as the next part.
+  void StartPart();
+
+  // Runs fn in a new fiber once less than max_inflight_ fibers run.
+  void Launch(std::function<Status()> fn);
+  void JoinAll();
+
+  Status ComposeParts();
+  string NewTempObject();
+
+  Status Send(const char* name, Request req);
+  Status UploadObject(const string& obj_path, beast::multi_buffer body);
+  Status ComposeObjects(const std::vector<string>& srcs, const string& dest);
+  Status DeleteObject(const string& obj_path);
+
+  const GCE& gce_;
+  HttpsClientPool* pool_;
+  const unsigned max_inflight_;
+  const size_t part_size_;
+  string bucket_, obj_path_;
+
+  beast::multi_buffer body_mb_;
+  std::vector<string> parts_;         // In the order of the file.
+  std::vector<string> temp_objects_;  // Parts and the intermediate composed objects.
+  std::vector<fibers::fiber> fibers_;
+
+  fibers::mutex mu_;
+  fibers::condition_variable cv_;
+  unsigned inflight_ = 0;
+  Status status_;  // The first error of the launched requests.
+};
+
+GcsParallelWriteFile::GcsParallelWriteFile(absl::string_view name, const GCE& gce,
+                                           HttpsClientPool* pool, unsigned max_inflight,
+                                           size_t part_size)
+    : WriteFile(name), gce_(gce), pool_(pool), max_inflight_(max_inflight),
+      part_size_(part_size) {
+  CHECK_GT(max_inflight_, 0);
+  CHECK_GT(part_size_, 0);
+
+  absl::string_view bucket, obj_path;
+  CHECK(GCS::SplitToBucketPath(name, &bucket, &obj_path));
+  bucket_ = string(bucket);
+  obj_path_ = string(obj_path);
+}
+
+bool GcsParallelWriteFile::Open() {
+  LOG(FATAL) << "Should not be called";
+
+  return true;
+}
+
+Status GcsParallelWriteFile::Write(const uint8* buffer, uint64 length) {
+  CHECK(pool_->io_context().InContextThread());
+
+  while (length) {
+    size_t len = std::min<size_t>(length, part_size_ - body_mb_.size());
+    body_mb_.commit(asio::buffer_copy(body_mb_.prepare(len), asio::buffer(buffer, len)));
+    buffer += len;
+    length -= len;
+
+    if (body_mb_.size() == part_size_)
+      StartPart();
+  }
+
+  std::lock_guard<fibers::mutex> lk(mu_);
+  return status_;
+}
+
+bool GcsParallelWriteFile::Close() {
+  CHECK(pool_->io_context().InContextThread());
+
+  Status st;
+  if (parts_.empty()) {
+    st = UploadObject(obj_path_, std::move(body_mb_));
+  } else {
+    if (body_mb_.size())
+      StartPart();
+    JoinAll();
+    st = status_;
+    if (st.ok())
+      st = ComposeParts();
+
+    for (const string& obj : temp_objects_) {
+      Launch([this, obj] {
+        Status del_st = DeleteObject(obj);
+        LOG_IF(WARNING, !del_st.ok()) << "Could not delete " << obj << ": " << del_st;
+        return Status::OK;
+      });
+    }
+    JoinAll();
+  }
+
+  if (st.ok()) {
+    VLOG(1) << "Closed file " << create_file_name() << " of " << parts_.size() << " parts";
+  } else {
+    LOG(ERROR) << "Error closing GCS file " << create_file_name() << ", status " << st;
+  }
+  delete this;
+
+  return st.ok();
+}
+
+void GcsParallelWriteFile::StartPart() {
+  parts_.push_back(NewTempObject());
+  Launch([this, obj = parts_.back(), body = std::move(body_mb_)]() mutable {
+    return UploadObject(obj, std::move(body));
+  });
+  body_mb_ = beast::multi_buffer{};
+}
+
+void GcsParallelWriteFile::Launch(std::function<Status()> fn) {
+  std::unique_lock<fibers::mutex> lk(mu_);
+  cv_.wait(lk, [this] { return inflight_ < max_inflight_; });
+  ++inflight_;
+  lk.unlock();
+
+  fibers_.emplace_back([this, fn = std::move(fn)] {
+    Status st = fn();
+
+    std::lock_guard<fibers::mutex> lk(mu_);
+    if (!st.ok() && status_.ok())
+      status_ = st;
+    --inflight_;
+    cv_.notify_all();
+  });
+}
+
+void GcsParallelWriteFile::JoinAll() {
+  for (auto& fb : fibers_) {
+    fb.join();
+  }
+  fibers_.clear();
+}
+
+string GcsParallelWriteFile::NewTempObject() {
+  temp_objects_.push_back(absl::StrCat(obj_path_, kPartSuffix, temp_objects_.size()));
+  return temp_objects_.back();
+}
+
+// Composes the parts level by level, since a single request is limited by kMaxComposeSources.
+Status GcsParallelWriteFile::ComposeParts() {
+  std::vector<string> srcs = parts_;
+
+  while (srcs.size() > kMaxComposeSources) {
+    std::vector<string> next;
+    for (size_t i = 0; i < srcs.size(); i += kMaxComposeSources) {
+      size_t end = std::min(srcs.size(), i + kMaxComposeSources);
+      std::vector<string> group(srcs.begin() + i, srcs.begin() + end);
+      next.push_back(NewTempObject());
+      Launch([this, group = std::move(group), dest = next.back()] {
+        return ComposeObjects(group, dest);
+      });
+    }
+    JoinAll();
+    RETURN_IF_ERROR(status_);
+    srcs.swap(next);
+  }
+
+  return ComposeObjects(srcs, obj_path_);
+}
+
+Status GcsParallelWriteFile::Send(const char* name, Request req) {
+  if (FLAGS_gcs_dry_write)
+    return Status::OK;
+
+  uint64_t start = GetMonotonicMicrosFast();
+  ApiSenderDynamicBody sender(name, gce_, pool_);
+  Status st = sender.SendGeneric(3, std::move(req)).status;
+
+  detail::gcs_writes->Inc();
+  detail::gcs_latency->IncBy(name, GetMonotonicMicrosFast() - start);
+
+  return st;
+}
+
+Status GcsParallelWriteFile::UploadObject(const string& obj_path, beast::multi_buffer body) {
+  string url = absl::StrCat("/upload/storage/v1/b/", bucket_, "/o?uploadType=media&name=");
+  strings::AppendEncodedUrl(obj_path, &url);
+
+  Request req = detail::PrepareGenericRequest(h2::verb::post, url, gce_.access_token());
+  req.body() = std::move(body);
+  req.set(h2::field::content_type, http::kBinMime);
+  req.prepare_payload();
+
+  VLOG(1) << "Uploading " << obj_path << " of " << req.body().size() << " bytes";
+  return Send("write_part", std::move(req));
+}
+
+Status GcsParallelWriteFile::ComposeObjects(const std::vector<string>& srcs, const string& dest) {
+  string url = absl::StrCat("/storage/v1/b/", bucket_, "/o/");
+  strings::AppendEncodedUrl(dest, &url);
+  url.append("/compose");
+
+  string body = R"({"sourceObjects":[)";
+  for (size_t i = 0; i < srcs.size(); ++i) {
+    string name = absl::StrReplaceAll(srcs[i], {{"\\", "\\\\"}, {"\"", "\\\""}});
+    absl::StrAppend(&body, i ? "," : "", R"({"name":")", name, R"("})");
+  }
+  absl::StrAppend(&body, R"(],"destination":{"contentType":")", http::kBinMime, R"("}})");
+
+  Request req = detail::PrepareGenericRequest(h2::verb::post, url, gce_.access_token());
+  req.body().commit(
+      asio::buffer_copy(req.body().prepare(body.size()), asio::buffer(body.data(), body.size())));
+  req.set(h2::field::content_type, http::kJsonMime);
+  req.prepare_payload();
+
+  return Send("compose", std::move(req));
+}
+
+Status GcsParallelWriteFile::DeleteObject(const string& obj_path) {
+  string url = absl::StrCat("/storage/v1/b/", bucket_, "/o/");
+  strings::AppendEncodedUrl(obj_path, &url);
+
+  Request req = detail::PrepareGenericRequest(h2::verb::delete_, url, gce_.access_token());
+  req.prepare_payload();
+
+  return Send("delete", std::move(req));
+}
+
 auto ApiSenderDynamicBody::SendRequestIterative(const Request& req, http::HttpsClient* client)
     -> error_code {
   system::error_code ec = client->Send(req);
@@ -243,8 +491,9 @@ auto ApiSenderDynamicBody::SendRequestIterative(const Request& req, http::HttpsC
   const auto& msg = parser_->get();
   VLOG(1) << "HeaderResp(" << client->native_handle() << "): " << msg;
 
-  // 308 or http ok are both good responses.
-  if (msg.result() == h2::status::ok || msg.result() == h2::status::permanent_redirect) {
+  // 308 or http ok are both good responses. Deletes respond with no content.
+  if (msg.result() == h2::status::ok || msg.result() == h2::status::permanent_redirect ||
+      msg.result() == h2::status::no_content) {
     return error_code{};  // all is good.
   }
 
@@ -308,4 +557,13 @@ StatusObject<file::WriteFile*> OpenGcsWriteFile(absl::string_view full_path, con
   return new GcsWriteFile(full_path, gce, std::move(upload_id), pool);
 }
 
+StatusObject<file::WriteFile*> OpenGcsParallelWriteFile(absl::string_view full_path,
+                                                        const GCE& gce,
+                                                        http::HttpsClientPool* pool,
+                                                        unsigned max_inflight, size_t part_size) {
+  CHECK(pool->io_context().InContextThread());
+
+  return new GcsParallelWriteFile(full_path, gce, pool, max_inflight, part_size);
+}
+
 }  // namespace util
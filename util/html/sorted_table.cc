@@ -3,6 +3,9 @@
 //
 #include "util/html/sorted_table.h"
 
+#include <algorithm>
+
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_join.h"
 
 namespace util {
@@ -20,6 +23,18 @@ struct THFormatter {
 };
 
 const char kCdnPrefix[] = "https://cdn.jsdelivr.net/gh/romange/gaia/util/html";
+
+// Numbers go before the other strings.
+bool CellLess(const string& a, const string& b) {
+  double da, db;
+  bool na = absl::SimpleAtod(a, &da), nb = absl::SimpleAtod(b, &db);
+  if (na && nb)
+    return da < db;
+  if (na != nb)
+    return na;
+  return a < b;
+}
+
 }  // namespace
 
 string SortedTable::HtmlStart() {
@@ -81,5 +96,134 @@ void SortedTable::Row(const std::vector<StringPiece>& row, std::string* dest) {
   absl::StrAppend(dest, "<tr>\n", absl::StrJoin(row, "\n", THFormatter{"td"}), "</tr>\n");
 }
 
+TableStream::TableStream(FlushCb flush_cb, size_t chunk_size)
+    : flush_cb_(std::move(flush_cb)), chunk_size_(chunk_size) {
+  buf_.reserve(chunk_size + 256);
+}
+
+void TableStream::Append(StringPiece html) {
+  buf_.append(html.data(), html.size());
+  MaybeFlush();
+}
+
+void TableStream::StartTable(const std::vector<StringPiece>& header) {
+  SortedTable::StartTable(header, &buf_);
+  MaybeFlush();
+}
+
+void TableStream::Row(const std::vector<StringPiece>& row) {
+  SortedTable::Row(row, &buf_);
+  MaybeFlush();
+}
+
+void TableStream::EndTable() {
+  Append("</tbody></table>\n");
+}
+
+void TableStream::MaybeFlush() {
+  if (buf_.size() >= chunk_size_)
+    Flush();
+}
+
+bool TableStream::Flush() {
+  if (ok_ && !buf_.empty()) {
+    ok_ = flush_cb_(buf_);
+  }
+  buf_.clear();
+
+  return ok_;
+}
+
+bool TablePage::ParseArg(StringPiece key, StringPiece value) {
+  if (key == "offset")
+    return absl::SimpleAtoi(value, &offset);
+  if (key == "limit")
+    return absl::SimpleAtoi(value, &limit) && limit > 0;
+  if (key == "sort")
+    return absl::SimpleAtoi(value, &sort_column);
+  if (key == "desc") {
+    descending = value != "0";
+    return true;
+  }
+  return false;
+}
+
+std::vector<size_t> TablePage::Select(const Rows& rows) const {
+  std::vector<size_t> res;
+  if (offset >= rows.size())
+    return res;
+  size_t end = offset + std::min(limit, rows.size() - offset);
+
+  res.resize(rows.size());
+  for (size_t i = 0; i < res.size(); ++i)
+    res[i] = i;
+
+  if (sort_column >= 0) {
+    size_t col = sort_column;
+
+    // The rows without the column go last, ties keep the order of the snapshot.
+    auto less = [&](size_t a, size_t b) {
+      const auto& ra = rows[a];
+      const auto& rb = rows[b];
+      if (col >= ra.size() || col >= rb.size()) {
+        return col < ra.size() || (col >= rb.size() && a < b);
+      }
+      if (CellLess(ra[col], rb[col]))
+        return !descending;
+      if (CellLess(rb[col], ra[col]))
+        return descending;
+      return a < b;
+    };
+    std::partial_sort(res.begin(), res.begin() + end, res.end(), less);
+  }
+  res.resize(end);
+  res.erase(res.begin(), res.begin() + offset);
+
+  return res;
+}
+
+void TablePage::Render(const std::vector<StringPiece>& header, const Rows& rows,
+                       StringPiece url, TableStream* dest) const {
+  auto link = [&](size_t off, int col, bool desc) {
+    string res = absl::StrCat(url, "?offset=", off, "&limit=", limit);
+    if (col >= 0)
+      absl::StrAppend(&res, "&sort=", col, "&desc=", int(desc));
+    return res;
+  };
+
+  // Clicking a column sorts by it, the second click reverses the order.
+  std::vector<string> th(header.size());
+  std::vector<StringPiece> th_ref(header.size());
+  for (size_t i = 0; i < header.size(); ++i) {
+    bool desc = int(i) == sort_column && !descending;
+    th[i] = absl::StrCat("<a href='", link(0, i, desc), "'>", header[i], "</a>");
+    th_ref[i] = th[i];
+  }
+  dest->StartTable(th_ref);
+
+  std::vector<StringPiece> cells;
+  for (size_t index : Select(rows)) {
+    const auto& row = rows[index];
+    cells.assign(row.begin(), row.end());
+    dest->Row(cells);
+    if (!dest->ok())
+      return;
+  }
+  dest->EndTable();
+
+  size_t last = std::min(offset + limit, rows.size());
+  dest->Append(absl::StrCat("<div>Rows ", std::min(offset + 1, last), "-", last, " of ",
+                            rows.size()));
+  if (offset > 0) {
+    dest->Append(absl::StrCat(" <a href='", link(offset > limit ? offset - limit : 0,
+                                                 sort_column, descending), "'>prev</a>"));
+  }
+  if (last < rows.size()) {
+    dest->Append(absl::StrCat(" <a href='", link(last, sort_column, descending),
+                              "'>next</a>"));
+  }
+  dest->Append("</div>\n");
+}
+
 }  // namespace html
 }  // namespace util
@@ -1,7 +1,12 @@
 // Copyright 2018, Beeri 15.  All rights reserved.
 // Author: Roman Gershman (romange@gmail.com)
 //
+#pragma once
+
+#include <functional>
+#include <string>
 #include <vector>
+
 #include "strings/stringpiece.h"
 
 namespace util {
@@ -18,6 +23,65 @@ class SortedTable {
   static void EndTable(std::string* dest);
 };
 
+/* Renders html incrementally into a buffer of about chunk_size bytes. Every full buffer is
+   passed to flush_cb, which usually writes it as a chunk of a chunked http response, so
+   the memory of a page does not depend on the number of its rows.
+*/
+class TableStream {
+ public:
+  // Returns false if the output failed, the following calls do nothing then.
+  using FlushCb = std::function<bool(StringPiece chunk)>;
+
+  explicit TableStream(FlushCb flush_cb, size_t chunk_size = 1 << 14);
+
+  void Append(StringPiece html);
+
+  void StartTable(const std::vector<StringPiece>& header);
+  void Row(const std::vector<StringPiece>& row);
+
+  // Ends the table without the client side pager.
+  void EndTable();
+
+  // Passes the rest of the buffer to flush_cb. Returns false if the output failed.
+  bool Flush();
+
+  bool ok() const { return ok_; }
+
+ private:
+  void MaybeFlush();
+
+  FlushCb flush_cb_;
+  size_t chunk_size_;
+  std::string buf_;
+  bool ok_ = true;
+};
+
+/* Server side sorting and pagination of a table. The caller takes a snapshot of the rows,
+   only the rows of the requested page are ordered and rendered: selecting them costs
+   O(n log(offset + limit)) comparisons.
+*/
+struct TablePage {
+  using Rows = std::vector<std::vector<std::string>>;
+
+  size_t offset = 0;
+  size_t limit = 100;
+  int sort_column = -1;  // Negative for the order of the snapshot.
+  bool descending = false;
+
+  // Parses one of the query args "offset", "limit", "sort" and "desc".
+  // Returns false if the arg is not one of them or its value is malformed.
+  bool ParseArg(StringPiece key, StringPiece value);
+
+  // Returns the indices of the rows of the page in their order. The cells that are numbers
+  // are compared as numbers.
+  std::vector<size_t> Select(const Rows& rows) const;
+
+  // Renders the table of the page followed by the links to the neighbouring pages.
+  // url is the path of the page, the links reproduce the sorting args.
+  void Render(const std::vector<StringPiece>& header, const Rows& rows, StringPiece url,
+              TableStream* dest) const;
+};
+
 /*
 std::string SortedTable::Start(const Container& header) {
   std::string res(
@@ -0,0 +1,430 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/http/hpack.h"
+
+namespace util {
+namespace http {
+namespace hpack {
+
+using namespace std;
+
+namespace {
+
+struct StaticEntry {
+  absl::string_view name, value;
+};
+
+// RFC 7541, Appendix A. Index 1 is at position 0.
+constexpr StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr unsigned kStaticSize = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+
+struct HuffmanCode {
+  uint32_t code;
+  uint8_t len;
+};
+
+// RFC 7541, Appendix B. EOS is not included since it must not be encoded.
+constexpr HuffmanCode kHuffmanCodes[256] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28},
+    {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24},
+    {0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28},
+    {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28}, {0xffffff4, 28},
+    {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8},
+    {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+    {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7},
+    {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7},
+    {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7},
+    {0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6}, {0x7ffd, 15},
+    {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5},
+    {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+    {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20},
+    {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22},
+    {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+    {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22},
+    {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23},
+    {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+    {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22},
+    {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+    {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23},
+    {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+    {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20},
+    {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+    {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26},
+    {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26},
+    {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+    {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20},
+    {0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+    {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24},
+    {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26},
+    {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+    {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+};
+
+// Binary decoding tree of the huffman code. Leaves hold ~symbol.
+class HuffmanTree {
+ public:
+  HuffmanTree() {
+    nodes_.push_back(Node{});
+    for (unsigned sym = 0; sym < 256; ++sym) {
+      const HuffmanCode& hc = kHuffmanCodes[sym];
+
+      unsigned cur = 0;
+      for (int bit = hc.len - 1; bit > 0; --bit) {
+        unsigned b = (hc.code >> bit) & 1;
+        if (nodes_[cur].child[b] == 0) {
+          nodes_[cur].child[b] = nodes_.size();
+          nodes_.push_back(Node{});
+        }
+        cur = nodes_[cur].child[b];
+      }
+      nodes_[cur].child[hc.code & 1] = ~int32_t(sym);
+    }
+  }
+
+  // Returns the next node or a leaf (negative) or 0 if the code is invalid.
+  int32_t Next(int32_t node, unsigned bit) const { return nodes_[node].child[bit]; }
+
+ private:
+  struct Node {
+    int32_t child[2] = {0, 0};
+  };
+
+  vector<Node> nodes_;
+};
+
+const HuffmanTree& GetHuffmanTree() {
+  static HuffmanTree tree;
+  return tree;
+}
+
+// Reads the primitives of a header block.
+class BlockReader {
+ public:
+  explicit BlockReader(absl::string_view block)
+      : ptr_(reinterpret_cast<const uint8_t*>(block.data())), end_(ptr_ + block.size()) {}
+
+  bool empty() const { return ptr_ == end_; }
+  uint8_t peek() const { return *ptr_; }
+
+  bool ReadInteger(unsigned prefix_bits, uint64_t* res);
+  bool ReadString(string* dest);
+
+ private:
+  const uint8_t* ptr_;
+  const uint8_t* end_;
+};
+
+bool BlockReader::ReadInteger(unsigned prefix_bits, uint64_t* res) {
+  if (ptr_ == end_)
+    return false;
+
+  const uint8_t mask = (1u << prefix_bits) - 1;
+  uint64_t val = *ptr_++ & mask;
+  if (val < mask) {
+    *res = val;
+    return true;
+  }
+
+  for (unsigned shift = 0; shift < 56; shift += 7) {
+    if (ptr_ == end_)
+      return false;
+    uint8_t b = *ptr_++;
+    val += uint64_t(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      *res = val;
+      return true;
+    }
+  }
+  return false;  // Overflow.
+}
+
+bool BlockReader::ReadString(string* dest) {
+  if (ptr_ == end_)
+    return false;
+  bool huffman = *ptr_ & 0x80;
+  uint64_t len;
+  if (!ReadInteger(7, &len) || len > uint64_t(end_ - ptr_))
+    return false;
+
+  absl::string_view src(reinterpret_cast<const char*>(ptr_), len);
+  ptr_ += len;
+  dest->clear();
+  if (huffman)
+    return HuffmanDecode(src, dest);
+  dest->assign(src.data(), src.size());
+  return true;
+}
+
+void EncodeString(absl::string_view src, string* dest) {
+  size_t huff_len = HuffmanEncodedLength(src);
+  if (huff_len < src.size()) {
+    EncodeInteger(huff_len, 7, 0x80, dest);
+    HuffmanEncode(src, dest);
+  } else {
+    EncodeInteger(src.size(), 7, 0, dest);
+    dest->append(src.data(), src.size());
+  }
+}
+
+}  // namespace
+
+void EncodeInteger(uint64_t value, unsigned prefix_bits, uint8_t first_byte_flags,
+                   string* dest) {
+  const uint8_t mask = (1u << prefix_bits) - 1;
+  if (value < mask) {
+    dest->push_back(char(first_byte_flags | value));
+    return;
+  }
+  dest->push_back(char(first_byte_flags | mask));
+  value -= mask;
+  while (value >= 0x80) {
+    dest->push_back(char(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  dest->push_back(char(value));
+}
+
+void EncodeField(absl::string_view name, absl::string_view value, string* dest) {
+  unsigned name_index = 0;
+  for (unsigned i = 0; i < kStaticSize; ++i) {
+    if (kStaticTable[i].name != name)
+      continue;
+    if (kStaticTable[i].value == value) {
+      EncodeInteger(i + 1, 7, 0x80, dest);  // Indexed header field.
+      return;
+    }
+    if (!name_index)
+      name_index = i + 1;
+  }
+
+  // Credentials are marked as never indexed so that intermediaries do not index them either.
+  uint8_t flags = name == "authorization" || name == "proxy-authorization" ? 0x10 : 0;
+  EncodeInteger(name_index, 4, flags, dest);
+  if (!name_index)
+    EncodeString(name, dest);
+  EncodeString(value, dest);
+}
+
+size_t HuffmanEncodedLength(absl::string_view src) {
+  uint64_t bits = 0;
+  for (unsigned char c : src) {
+    bits += kHuffmanCodes[c].len;
+  }
+  return (bits + 7) / 8;
+}
+
+void HuffmanEncode(absl::string_view src, string* dest) {
+  uint64_t acc = 0;  // Holds less than 8 pending bits before adding a code.
+  unsigned acc_bits = 0;
+  for (unsigned char c : src) {
+    const HuffmanCode& hc = kHuffmanCodes[c];
+    acc = (acc << hc.len) | hc.code;
+    acc_bits += hc.len;
+    while (acc_bits >= 8) {
+      acc_bits -= 8;
+      dest->push_back(char(acc >> acc_bits));
+    }
+  }
+  if (acc_bits) {
+    // Pads with the most significant bits of EOS, i.e. with ones.
+    dest->push_back(char((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+  }
+}
+
+bool HuffmanDecode(absl::string_view src, string* dest) {
+  const HuffmanTree& tree = GetHuffmanTree();
+  int32_t node = 0;
+  unsigned pending_bits = 0;  // Bits since the last decoded symbol.
+  bool all_ones = true;
+
+  for (unsigned char c : src) {
+    for (int i = 7; i >= 0; --i) {
+      unsigned bit = (c >> i) & 1;
+      node = tree.Next(node, bit);
+      if (node == 0)
+        return false;
+      ++pending_bits;
+      all_ones &= bit;
+      if (node < 0) {
+        dest->push_back(char(~node));
+        node = 0;
+        pending_bits = 0;
+        all_ones = true;
+      }
+    }
+  }
+
+  return pending_bits < 8 && all_ones;
+}
+
+Decoder::Decoder(uint32_t max_table_size)
+    : capacity_(max_table_size), max_table_size_(max_table_size) {
+}
+
+bool Decoder::Decode(absl::string_view block, vector<HeaderField>* dest) {
+  BlockReader reader(block);
+  bool fields_started = false;
+  uint64_t index;
+
+  while (!reader.empty()) {
+    uint8_t b = reader.peek();
+
+    if (b & 0x80) {  // Indexed header field.
+      if (!reader.ReadInteger(7, &index))
+        return false;
+      const HeaderField* field = Lookup(index);
+      if (!field)
+        return false;
+      dest->push_back(*field);
+      fields_started = true;
+      continue;
+    }
+
+    if ((b & 0xe0) == 0x20) {  // Dynamic table size update.
+      if (fields_started || !reader.ReadInteger(5, &index) || index > max_table_size_)
+        return false;
+      capacity_ = index;
+      Evict(capacity_);
+      continue;
+    }
+
+    // Literal, with incremental indexing if 0x40 is set, otherwise without indexing
+    // or never indexed.
+    bool indexing = b & 0x40;
+    if (!reader.ReadInteger(indexing ? 6 : 4, &index))
+      return false;
+
+    HeaderField field;
+    if (index) {
+      const HeaderField* name_field = Lookup(index);
+      if (!name_field)
+        return false;
+      field.name = name_field->name;
+    } else if (!reader.ReadString(&field.name)) {
+      return false;
+    }
+    if (!reader.ReadString(&field.value))
+      return false;
+
+    dest->push_back(field);
+    if (indexing)
+      Insert(std::move(field));
+    fields_started = true;
+  }
+
+  return true;
+}
+
+const HeaderField* Decoder::Lookup(uint64_t index) const {
+  static const vector<HeaderField>* static_fields = [] {
+    auto* res = new vector<HeaderField>;
+    for (const auto& e : kStaticTable) {
+      res->emplace_back(e.name, e.value);
+    }
+    return res;
+  }();
+
+  if (index == 0)
+    return nullptr;
+  if (index <= kStaticSize)
+    return &(*static_fields)[index - 1];
+  index -= kStaticSize + 1;
+  return index < table_.size() ? &table_[index] : nullptr;
+}
+
+void Decoder::Insert(HeaderField field) {
+  uint32_t size = field.name.size() + field.value.size() + 32;
+  if (size > capacity_) {
+    // RFC 7541, section 4.4: an entry larger than the table empties it.
+    Evict(0);
+    return;
+  }
+  Evict(capacity_ - size);
+  table_.push_front(std::move(field));
+  table_size_ += size;
+}
+
+void Decoder::Evict(uint32_t capacity) {
+  while (table_size_ > capacity) {
+    const HeaderField& f = table_.back();
+    table_size_ -= f.name.size() + f.value.size() + 32;
+    table_.pop_back();
+  }
+}
+
+}  // namespace hpack
+}  // namespace http
+}  // namespace util
@@ -0,0 +1,72 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace util {
+namespace http {
+
+// HPACK header compression for HTTP/2 (RFC 7541).
+namespace hpack {
+
+struct HeaderField {
+  std::string name, value;
+
+  HeaderField() = default;
+  HeaderField(absl::string_view n, absl::string_view v) : name(n), value(v) {}
+};
+
+// Appends the field to the header block in dest. Uses the static table for the names
+// and the fields that it contains, and literals without indexing otherwise, so the encoder
+// does not keep a dynamic table and does not depend on the peer's table size.
+// Strings are huffman-coded when it makes them shorter. name must be lowercase.
+void EncodeField(absl::string_view name, absl::string_view value, std::string* dest);
+
+// Appends the integer with the prefix of prefix_bits bits, OR'ing first_byte_flags into
+// the first byte.
+void EncodeInteger(uint64_t value, unsigned prefix_bits, uint8_t first_byte_flags,
+                   std::string* dest);
+
+size_t HuffmanEncodedLength(absl::string_view src);
+void HuffmanEncode(absl::string_view src, std::string* dest);
+
+// Appends the decoded string to dest. Returns false on malformed input, including padding
+// that is longer than 7 bits or is not a prefix of EOS.
+bool HuffmanDecode(absl::string_view src, std::string* dest);
+
+// Decodes header blocks of one connection. The blocks must be passed in the order they
+// were received since they share the dynamic table.
+class Decoder {
+ public:
+  // max_table_size is SETTINGS_HEADER_TABLE_SIZE that we advertise to the peer.
+  explicit Decoder(uint32_t max_table_size = 4096);
+
+  // Decodes a complete header block and appends its fields to dest.
+  // Returns false on malformed input, the connection must be closed with COMPRESSION_ERROR
+  // then since the dynamic table is out of sync.
+  bool Decode(absl::string_view block, std::vector<HeaderField>* dest);
+
+  // The size of the dynamic table as defined in RFC 7541, section 4.1.
+  uint32_t table_size() const { return table_size_; }
+  size_t table_entries() const { return table_.size(); }
+
+ private:
+  const HeaderField* Lookup(uint64_t index) const;
+  void Insert(HeaderField field);
+  void Evict(uint32_t capacity);
+
+  std::deque<HeaderField> table_;  // The newest entry is at the front.
+  uint32_t table_size_ = 0;
+  uint32_t capacity_;              // Set by the dynamic table size updates.
+  const uint32_t max_table_size_;
+};
+
+}  // namespace hpack
+}  // namespace http
+}  // namespace util
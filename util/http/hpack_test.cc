@@ -0,0 +1,149 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/http/hpack.h"
+
+#include "absl/strings/escaping.h"
+#include "base/gtest.h"
+
+namespace util {
+namespace http {
+namespace hpack {
+
+using namespace std;
+
+class HpackTest : public testing::Test {
+ protected:
+  static string Unhex(absl::string_view s) { return absl::HexStringToBytes(s); }
+
+  static vector<pair<string, string>> Decode(Decoder* decoder, absl::string_view hex) {
+    vector<HeaderField> fields;
+    EXPECT_TRUE(decoder->Decode(Unhex(hex), &fields));
+    vector<pair<string, string>> res;
+    for (const auto& f : fields) {
+      res.emplace_back(f.name, f.value);
+    }
+    return res;
+  }
+};
+
+using Fields = vector<pair<string, string>>;
+
+TEST_F(HpackTest, Integer) {
+  string buf;
+  EncodeInteger(10, 5, 0, &buf);
+  EXPECT_EQ("0a", absl::BytesToHexString(buf));
+
+  buf.clear();
+  EncodeInteger(1337, 5, 0xe0, &buf);  // RFC 7541, C.1.2.
+  EXPECT_EQ("ff9a0a", absl::BytesToHexString(buf));
+}
+
+TEST_F(HpackTest, Huffman) {
+  string buf;
+  HuffmanEncode("www.example.com", &buf);
+  EXPECT_EQ("f1e3c2e5f23a6ba0ab90f4ff", absl::BytesToHexString(buf));
+  EXPECT_EQ(buf.size(), HuffmanEncodedLength("www.example.com"));
+
+  string decoded;
+  ASSERT_TRUE(HuffmanDecode(buf, &decoded));
+  EXPECT_EQ("www.example.com", decoded);
+
+  string all;
+  for (unsigned i = 0; i < 256; ++i) {
+    all.push_back(char(i));
+  }
+  buf.clear();
+  decoded.clear();
+  HuffmanEncode(all, &buf);
+  ASSERT_TRUE(HuffmanDecode(buf, &decoded));
+  EXPECT_EQ(all, decoded);
+
+  // The padding must be ones and shorter than a byte.
+  decoded.clear();
+  EXPECT_FALSE(HuffmanDecode(Unhex("f1e3c2e5f23a6ba0ab90f4fe"), &decoded));
+  decoded.clear();
+  EXPECT_FALSE(HuffmanDecode(Unhex("f1e3c2e5f23a6ba0ab90f4ffff"), &decoded));
+}
+
+// RFC 7541, C.4: requests with huffman coding that share the dynamic table.
+TEST_F(HpackTest, DecodeRequests) {
+  Decoder decoder;
+
+  Fields expected{{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                  {":authority", "www.example.com"}};
+  EXPECT_EQ(expected, Decode(&decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff"));
+  EXPECT_EQ(57, decoder.table_size());
+
+  expected.emplace_back("cache-control", "no-cache");
+  EXPECT_EQ(expected, Decode(&decoder, "828684be5886a8eb10649cbf"));
+  EXPECT_EQ(110, decoder.table_size());
+
+  expected = Fields{{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                    {":authority", "www.example.com"}, {"custom-key", "custom-value"}};
+  EXPECT_EQ(expected, Decode(&decoder, "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"));
+  EXPECT_EQ(164, decoder.table_size());
+  EXPECT_EQ(3, decoder.table_entries());
+}
+
+// RFC 7541, C.6: responses that evict entries from a 256 bytes table.
+TEST_F(HpackTest, DecodeResponsesEviction) {
+  Decoder decoder(256);
+
+  Fields expected{{":status", "302"}, {"cache-control", "private"},
+                  {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                  {"location", "https://www.example.com"}};
+  EXPECT_EQ(expected, Decode(&decoder, "3fe1014882640258"
+                                       "85aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1b"
+                                       "ff6e919d29ad171863c78f0b97c8e9ae82ae43d3"));
+  EXPECT_EQ(222, decoder.table_size());
+
+  expected[0].second = "307";
+  EXPECT_EQ(expected, Decode(&decoder, "4883640effc1c0bf"));
+  EXPECT_EQ(222, decoder.table_size());
+
+  expected = Fields{{":status", "200"}, {"cache-control", "private"},
+                    {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+                    {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+                    {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+  EXPECT_EQ(expected,
+            Decode(&decoder, "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77"
+                             "ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587"
+                             "316065c003ed4ee5b1063d5007"));
+  EXPECT_EQ(215, decoder.table_size());
+  EXPECT_EQ(3, decoder.table_entries());
+}
+
+TEST_F(HpackTest, Malformed) {
+  Decoder decoder(256);
+  vector<HeaderField> fields;
+
+  EXPECT_FALSE(decoder.Decode(Unhex("be"), &fields));          // Index past the tables.
+  EXPECT_FALSE(decoder.Decode(Unhex("418cf1e3c2"), &fields));  // Truncated string.
+  EXPECT_FALSE(decoder.Decode(Unhex("3fe201"), &fields));      // Table size above the limit.
+  EXPECT_FALSE(decoder.Decode(Unhex("823fe101"), &fields));    // Size update after a field.
+}
+
+TEST_F(HpackTest, EncodeRoundtrip) {
+  string block;
+  EncodeField(":method", "GET", &block);
+  EncodeField(":path", "/storage/v1/b/bucket/o?prefix=a", &block);
+  EncodeField(":authority", "www.googleapis.com", &block);
+  EncodeField("authorization", "Bearer ya29.token", &block);
+  EncodeField("x-goog-custom", "1", &block);
+
+  // The indexed :method and the never-indexed authorization.
+  EXPECT_EQ('\x82', block[0]);
+  EXPECT_NE(string::npos, block.find("\x1f\x08"));
+
+  Decoder decoder;
+  Fields expected{{":method", "GET"}, {":path", "/storage/v1/b/bucket/o?prefix=a"},
+                  {":authority", "www.googleapis.com"}, {"authorization", "Bearer ya29.token"},
+                  {"x-goog-custom", "1"}};
+  EXPECT_EQ(expected, Decode(&decoder, absl::BytesToHexString(block)));
+  EXPECT_EQ(0, decoder.table_size());
+}
+
+}  // namespace hpack
+}  // namespace http
+}  // namespace util
@@ -0,0 +1,702 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/http/http2_client.h"
+
+#include <algorithm>
+#include <boost/asio/write.hpp>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "util/asio/io_context.h"
+#include "util/http/https_client.h"
+
+namespace util {
+namespace http {
+
+using namespace boost;
+using namespace std;
+
+namespace {
+
+constexpr char kPort[] = "443";
+constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr unsigned char kAlpn[] = {2, 'h', '2'};
+
+// RFC 7540, section 11.2.
+enum FrameType : uint8_t {
+  DATA = 0,
+  HEADERS = 1,
+  PRIORITY = 2,
+  RST_STREAM = 3,
+  SETTINGS = 4,
+  PUSH_PROMISE = 5,
+  PING = 6,
+  GOAWAY = 7,
+  WINDOW_UPDATE = 8,
+  CONTINUATION = 9,
+};
+
+enum FrameFlags : uint8_t {
+  END_STREAM = 0x1,
+  ACK = 0x1,
+  END_HEADERS = 0x4,
+  PADDED = 0x8,
+  PRIORITY_FLAG = 0x20,
+};
+
+enum SettingId : uint16_t {
+  SETTINGS_HEADER_TABLE_SIZE = 1,
+  SETTINGS_ENABLE_PUSH = 2,
+  SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+  SETTINGS_INITIAL_WINDOW_SIZE = 4,
+  SETTINGS_MAX_FRAME_SIZE = 5,
+};
+
+enum Http2Error : uint32_t {
+  NO_ERROR = 0,
+  PROTOCOL_ERROR = 1,
+  FLOW_CONTROL_ERROR = 3,
+  FRAME_SIZE_ERROR = 6,
+  REFUSED_STREAM = 7,
+  CANCEL = 8,
+  COMPRESSION_ERROR = 9,
+};
+
+constexpr size_t kFrameHeaderSize = 9;
+constexpr uint32_t kMaxFrameSize = 1 << 14;  // We do not raise SETTINGS_MAX_FRAME_SIZE.
+
+// Receive windows. Window updates are sent once half of a window is consumed.
+constexpr uint32_t kStreamRecvWindow = 1 << 20;
+constexpr uint32_t kConnRecvWindow = 16 << 20;
+constexpr uint32_t kDefaultWindow = 65535;
+constexpr int64_t kMaxWindow = (1u << 31) - 1;
+
+// Connection-specific fields that HTTP/2 forbids, RFC 7540, section 8.1.2.2.
+constexpr absl::string_view kSkippedFields[] = {"connection",        "host",
+                                                "keep-alive",        "proxy-connection",
+                                                "transfer-encoding", "upgrade"};
+
+inline uint32_t ReadBE32(const char* p) {
+  const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+  return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | u[3];
+}
+
+inline void AppendBE32(uint32_t val, string* dest) {
+  char buf[4] = {char(val >> 24), char(val >> 16), char(val >> 8), char(val)};
+  dest->append(buf, 4);
+}
+
+void AppendFrameHeader(uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id,
+                       string* dest) {
+  char buf[5] = {char(length >> 16), char(length >> 8), char(length), char(type), char(flags)};
+  dest->append(buf, 5);
+  AppendBE32(stream_id, dest);
+}
+
+void AppendSetting(uint16_t id, uint32_t val, string* dest) {
+  dest->push_back(char(id >> 8));
+  dest->push_back(char(id));
+  AppendBE32(val, dest);
+}
+
+// Strips the padding of DATA and HEADERS frames.
+bool StripPadding(uint8_t flags, absl::string_view* payload) {
+  if ((flags & PADDED) == 0)
+    return true;
+  if (payload->empty())
+    return false;
+  uint8_t pad = (*payload)[0];
+  if (pad >= payload->size())
+    return false;
+  payload->remove_prefix(1);
+  payload->remove_suffix(pad);
+  return true;
+}
+
+inline system::error_code ProtocolError() {
+  return system::errc::make_error_code(system::errc::protocol_error);
+}
+
+}  // namespace
+
+Http2Client::Http2Client(absl::string_view host, IoContext* io_context,
+                         ::boost::asio::ssl::context* ssl_ctx)
+    : io_context_(*io_context), ssl_cntx_(*ssl_ctx), host_name_(host) {
+}
+
+Http2Client::~Http2Client() {
+  Shutdown();
+  if (read_fiber_.joinable())
+    read_fiber_.join();
+}
+
+auto Http2Client::Connect(unsigned msec) -> error_code {
+  CHECK(io_context_.InContextThread());
+  CHECK(!client_);
+
+  client_.reset(new SslStream(FiberSyncSocket{host_name_, kPort, &io_context_}, ssl_cntx_));
+  client_->next_layer().set_keep_alive(true);
+
+  SSL* ssl = client_->native_handle();
+  CHECK_EQ(1, SSL_set_tlsext_host_name(ssl, host_name_.c_str()));
+  CHECK_EQ(0, SSL_set_alpn_protos(ssl, kAlpn, sizeof(kAlpn)));  // Returns 0 on success.
+
+  error_code ec = SslConnect(client_.get(), msec);
+  if (!ec) {
+    const unsigned char* proto = nullptr;
+    unsigned proto_len = 0;
+    SSL_get0_alpn_selected(ssl, &proto, &proto_len);
+    if (absl::string_view(reinterpret_cast<const char*>(proto), proto_len) != "h2") {
+      LOG(WARNING) << host_name_ << " did not negotiate h2";
+      ec = asio::error::no_protocol_option;
+    }
+  }
+
+  if (ec) {
+    VLOG(1) << "Error connecting " << ec << ", socket " << native_handle();
+    status_ = ec;
+    return ec;
+  }
+
+  string preface(kPreface, sizeof(kPreface) - 1);
+  string settings;
+  AppendSetting(SETTINGS_ENABLE_PUSH, 0, &settings);
+  AppendSetting(SETTINGS_INITIAL_WINDOW_SIZE, kStreamRecvWindow, &settings);
+  AppendFrameHeader(settings.size(), SETTINGS, 0, 0, &preface);
+  preface.append(settings);
+  AppendFrameHeader(4, WINDOW_UPDATE, 0, 0, &preface);
+  AppendBE32(kConnRecvWindow - kDefaultWindow, &preface);
+
+  ec = WriteFrames(preface);
+  if (ec) {
+    status_ = ec;
+    return ec;
+  }
+
+  read_buf_.resize(kMaxFrameSize * 4);
+  read_fiber_ = fibers::fiber(&Http2Client::ReadFiber, this);
+
+  return ec;
+}
+
+void Http2Client::Shutdown() {
+  if (!client_ || !client_->next_layer().is_open())
+    return;
+
+  if (!status_)
+    status_ = asio::error::operation_aborted;
+
+  error_code ec;
+  client_->next_layer().Shutdown(ec);
+}
+
+auto Http2Client::Send(const Request& req, Response* resp) -> error_code {
+  namespace h2 = beast::http;
+  CHECK(io_context_.InContextThread());
+  if (!client_)
+    return asio::error::not_connected;
+
+  string block;
+  hpack::EncodeField(":method", absl::string_view(req.method_string().data(),
+                                                  req.method_string().size()), &block);
+  hpack::EncodeField(":scheme", "https", &block);
+  hpack::EncodeField(":authority", host_name_, &block);
+  hpack::EncodeField(":path", absl::string_view(req.target().data(), req.target().size()),
+                     &block);
+
+  string name;
+  for (const auto& field : req) {
+    name.assign(field.name_string().data(), field.name_string().size());
+    absl::AsciiStrToLower(&name);
+    if (std::find(std::begin(kSkippedFields), std::end(kSkippedFields), name) !=
+        std::end(kSkippedFields))
+      continue;
+    hpack::EncodeField(name, absl::string_view(field.value().data(), field.value().size()),
+                       &block);
+  }
+
+  const string& body = req.body();
+  if (!body.empty() && req.find(h2::field::content_length) == req.end()) {
+    hpack::EncodeField("content-length", absl::StrCat(body.size()), &block);
+  }
+
+  Stream stream;
+  stream.resp = resp;
+
+  std::unique_lock<fibers::mutex> lk(mu_);
+  slot_cv_.wait(lk, [this] {
+    return !accepts_streams() || active_streams() < max_concurrent_streams_;
+  });
+  if (status_)
+    return status_;
+  if (goaway_)
+    return asio::error::try_again;
+
+  ++opening_;
+  lk.unlock();
+
+  uint32_t stream_id;
+  error_code ec;
+  {
+    std::lock_guard<fibers::mutex> wlk(write_mu_);
+
+    lk.lock();
+    --opening_;
+    if (status_)
+      return status_;
+
+    stream_id = next_stream_id_;
+    next_stream_id_ += 2;
+    stream.send_window = peer_initial_window_;
+    streams_.emplace(stream_id, &stream);
+    lk.unlock();
+
+    ec = WriteHeaders(stream_id, block, body.empty());
+  }
+
+  if (!ec && !body.empty())
+    ec = WriteBody(stream_id, &stream, body);
+
+  lk.lock();
+  if (ec) {
+    Fail(ec);
+    lk.unlock();
+    Shutdown();
+    return stream.ec;
+  }
+  stream.cv.wait(lk, [&] { return stream.done; });
+
+  return stream.ec;
+}
+
+auto Http2Client::WriteHeaders(uint32_t stream_id, const string& block, bool end_stream)
+    -> error_code {
+  string frames;
+  uint8_t flags = end_stream ? END_STREAM : 0;
+  size_t pos = 0;
+  do {
+    size_t len = std::min<size_t>(block.size() - pos, peer_max_frame_size_);
+    bool last = pos + len == block.size();
+    uint8_t type = pos == 0 ? HEADERS : CONTINUATION;
+    AppendFrameHeader(len, type, flags | (last ? END_HEADERS : 0), stream_id, &frames);
+    frames.append(block, pos, len);
+    flags = 0;
+    pos += len;
+  } while (pos < block.size());
+
+  return WriteLocked(frames);
+}
+
+auto Http2Client::WriteBody(uint32_t stream_id, Stream* stream, absl::string_view body)
+    -> error_code {
+  std::unique_lock<fibers::mutex> lk(mu_);
+
+  while (!body.empty()) {
+    window_cv_.wait(lk, [&] {
+      return stream->done || status_ || (stream->send_window > 0 && conn_send_window_ > 0);
+    });
+
+    if (status_)
+      return status_;
+    if (stream->done) {
+      if (stream->ec)
+        return error_code{};  // The stream was reset.
+
+      // The peer responded before reading the whole body, we stop sending it.
+      lk.unlock();
+      string code;
+      AppendBE32(CANCEL, &code);
+      WriteFrame(RST_STREAM, 0, stream_id, code);
+      return error_code{};
+    }
+
+    int64_t window = std::min(stream->send_window, conn_send_window_);
+    size_t len = std::min<size_t>({body.size(), size_t(window), peer_max_frame_size_});
+    stream->send_window -= len;
+    conn_send_window_ -= len;
+    lk.unlock();
+
+    bool last = len == body.size();
+    error_code ec = WriteFrame(DATA, last ? END_STREAM : 0, stream_id, body.substr(0, len));
+    if (ec)
+      return ec;
+    body.remove_prefix(len);
+    lk.lock();
+  }
+
+  return error_code{};
+}
+
+auto Http2Client::WriteFrames(const string& frames) -> error_code {
+  std::lock_guard<fibers::mutex> lk(write_mu_);
+  return WriteLocked(frames);
+}
+
+auto Http2Client::WriteLocked(const string& frames) -> error_code {
+  error_code ec;
+  asio::write(*client_, asio::buffer(frames), ec);
+  return ec;
+}
+
+auto Http2Client::WriteFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                             absl::string_view payload) -> error_code {
+  // A single buffer becomes a single TLS record.
+  string frame;
+  frame.reserve(kFrameHeaderSize + payload.size());
+  AppendFrameHeader(payload.size(), type, flags, stream_id, &frame);
+  frame.append(payload.data(), payload.size());
+
+  return WriteFrames(frame);
+}
+
+void Http2Client::ReadFiber() {
+  VLOG(1) << "Start ReadFiber on socket " << native_handle();
+
+  FrameHeader hdr;
+  absl::string_view payload;
+  error_code ec;
+
+  while (true) {
+    ec = ReadFrame(&hdr, &payload);
+    if (!ec)
+      ec = HandleFrame(hdr, payload);
+    if (!ec)
+      continue;
+
+    if (ec == ProtocolError()) {
+      LOG(WARNING) << "Protocol error from " << host_name_ << ", frame type " << int(hdr.type);
+      string goaway;
+      AppendBE32(0, &goaway);
+      AppendBE32(PROTOCOL_ERROR, &goaway);
+      WriteFrame(GOAWAY, 0, 0, goaway);
+    }
+    break;
+  }
+  VLOG(1) << "Finish ReadFiber on socket " << native_handle() << ": " << ec.message();
+
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    Fail(ec);
+  }
+  Shutdown();
+}
+
+auto Http2Client::ReadFrame(FrameHeader* hdr, absl::string_view* payload) -> error_code {
+  size_t need = kFrameHeaderSize;
+  bool has_header = false;
+  error_code ec;
+
+  while (true) {
+    size_t avail = read_end_ - read_begin_;
+    const char* p = &read_buf_[read_begin_];
+    if (!has_header && avail >= kFrameHeaderSize) {
+      hdr->length = (uint32_t(uint8_t(p[0])) << 16) | (uint32_t(uint8_t(p[1])) << 8) |
+                    uint8_t(p[2]);
+      hdr->type = p[3];
+      hdr->flags = p[4];
+      hdr->stream_id = ReadBE32(p + 5) & 0x7fffffff;
+      if (hdr->length > kMaxFrameSize)
+        return ProtocolError();
+      need += hdr->length;
+      has_header = true;
+    }
+
+    if (has_header && avail >= need) {
+      *payload = absl::string_view(p + kFrameHeaderSize, hdr->length);
+      read_begin_ += need;
+      return ec;
+    }
+
+    if (read_begin_ + need > read_buf_.size()) {
+      memmove(&read_buf_[0], p, avail);
+      read_begin_ = 0;
+      read_end_ = avail;
+    }
+
+    size_t sz = client_->read_some(
+        asio::buffer(&read_buf_[read_end_], read_buf_.size() - read_end_), ec);
+    if (ec)
+      return ec;
+    read_end_ += sz;
+  }
+}
+
+auto Http2Client::HandleFrame(const FrameHeader& hdr, absl::string_view payload) -> error_code {
+  // A header block must be contiguous, RFC 7540, section 6.10.
+  if (continued_stream_ && (hdr.type != CONTINUATION || hdr.stream_id != continued_stream_))
+    return ProtocolError();
+
+  switch (hdr.type) {
+    case DATA:
+      return HandleData(hdr, payload);
+
+    case HEADERS:
+      return HandleHeaders(hdr, payload);
+
+    case CONTINUATION:
+      if (!continued_stream_)
+        return ProtocolError();
+      header_block_.append(payload.data(), payload.size());
+      if (hdr.flags & END_HEADERS)
+        return HandleHeaderBlock(hdr.stream_id, continued_end_stream_);
+      return error_code{};
+
+    case RST_STREAM: {
+      if (hdr.stream_id == 0 || payload.size() != 4)
+        return ProtocolError();
+      uint32_t code = ReadBE32(payload.data());
+      VLOG(1) << "Stream " << hdr.stream_id << " was reset with " << code;
+
+      std::lock_guard<fibers::mutex> lk(mu_);
+      CloseStream(hdr.stream_id, code == REFUSED_STREAM ? asio::error::try_again
+                                                        : asio::error::connection_reset);
+      return error_code{};
+    }
+
+    case SETTINGS:
+      return HandleSettings(hdr, payload);
+
+    case PING:
+      if (hdr.stream_id != 0 || payload.size() != 8)
+        return ProtocolError();
+      if (hdr.flags & ACK)
+        return error_code{};
+      return WriteFrame(PING, ACK, 0, payload);
+
+    case GOAWAY:
+      return HandleGoAway(payload);
+
+    case WINDOW_UPDATE:
+      return HandleWindowUpdate(hdr, payload);
+
+    case PUSH_PROMISE:
+      return ProtocolError();  // We disabled the push.
+
+    default:
+      return error_code{};  // PRIORITY and the unknown frames are ignored.
+  }
+}
+
+auto Http2Client::HandleData(const FrameHeader& hdr, absl::string_view payload) -> error_code {
+  if (hdr.stream_id == 0 || !StripPadding(hdr.flags, &payload))
+    return ProtocolError();
+
+  string updates;
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+
+    // The padding counts against the flow-control windows as well.
+    conn_recv_unacked_ += hdr.length;
+    if (conn_recv_unacked_ >= kConnRecvWindow / 2) {
+      AppendFrameHeader(4, WINDOW_UPDATE, 0, 0, &updates);
+      AppendBE32(conn_recv_unacked_, &updates);
+      conn_recv_unacked_ = 0;
+    }
+
+    auto it = streams_.find(hdr.stream_id);
+    if (it != streams_.end()) {
+      Stream* stream = it->second;
+      stream->resp->body().append(payload.data(), payload.size());
+
+      if (hdr.flags & END_STREAM) {
+        CloseStream(hdr.stream_id, error_code{});
+      } else {
+        stream->recv_unacked += hdr.length;
+        if (stream->recv_unacked >= kStreamRecvWindow / 2) {
+          AppendFrameHeader(4, WINDOW_UPDATE, 0, hdr.stream_id, &updates);
+          AppendBE32(stream->recv_unacked, &updates);
+          stream->recv_unacked = 0;
+        }
+      }
+    }
+  }
+
+  return updates.empty() ? error_code{} : WriteFrames(updates);
+}
+
+auto Http2Client::HandleHeaders(const FrameHeader& hdr, absl::string_view payload)
+    -> error_code {
+  if (hdr.stream_id == 0 || !StripPadding(hdr.flags, &payload))
+    return ProtocolError();
+
+  if (hdr.flags & PRIORITY_FLAG) {
+    if (payload.size() < 5)
+      return ProtocolError();
+    payload.remove_prefix(5);
+  }
+
+  header_block_.assign(payload.data(), payload.size());
+  bool end_stream = hdr.flags & END_STREAM;
+  if (hdr.flags & END_HEADERS)
+    return HandleHeaderBlock(hdr.stream_id, end_stream);
+
+  continued_stream_ = hdr.stream_id;
+  continued_end_stream_ = end_stream;
+  return error_code{};
+}
+
+auto Http2Client::HandleHeaderBlock(uint32_t stream_id, bool end_stream) -> error_code {
+  continued_stream_ = 0;
+
+  // The block is decoded even if the stream is gone since it updates the dynamic table.
+  std::vector<hpack::HeaderField> fields;
+  if (!decoder_.Decode(header_block_, &fields)) {
+    LOG(WARNING) << "Could not decode the header block from " << host_name_;
+    return ProtocolError();
+  }
+
+  std::lock_guard<fibers::mutex> lk(mu_);
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end())
+    return error_code{};
+
+  Response* resp = it->second->resp;
+  for (const auto& field : fields) {
+    if (field.name == ":status") {
+      unsigned status = 0;
+      if (!absl::SimpleAtoi(field.value, &status)) {
+        CloseStream(stream_id, ProtocolError());
+        return error_code{};
+      }
+      if (status < 200)
+        return error_code{};  // An informational response, the final one follows.
+      resp->result(status);
+      resp->version(20);
+    } else if (!field.name.empty() && field.name[0] != ':') {
+      resp->insert(field.name, field.value);
+    }
+  }
+
+  if (end_stream)
+    CloseStream(stream_id, error_code{});
+
+  return error_code{};
+}
+
+auto Http2Client::HandleSettings(const FrameHeader& hdr, absl::string_view payload)
+    -> error_code {
+  if (hdr.stream_id != 0 || payload.size() % 6 != 0)
+    return ProtocolError();
+  if (hdr.flags & ACK)
+    return error_code{};
+
+  {
+    std::lock_guard<fibers::mutex> lk(mu_);
+    for (size_t i = 0; i < payload.size(); i += 6) {
+      uint16_t id = (uint16_t(uint8_t(payload[i])) << 8) | uint8_t(payload[i + 1]);
+      uint32_t val = ReadBE32(payload.data() + i + 2);
+
+      switch (id) {
+        case SETTINGS_MAX_CONCURRENT_STREAMS:
+          max_concurrent_streams_ = val;
+          break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: {
+          if (val > kMaxWindow)
+            return ProtocolError();
+          int64_t delta = int64_t(val) - peer_initial_window_;
+          for (auto& id_stream : streams_) {
+            id_stream.second->send_window += delta;
+          }
+          peer_initial_window_ = val;
+          break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+          if (val < kMaxFrameSize || val >= (1u << 24))
+            return ProtocolError();
+          peer_max_frame_size_ = val;
+          break;
+        default:
+          // Our encoder does not use the dynamic table so SETTINGS_HEADER_TABLE_SIZE does
+          // not matter.
+          break;
+      }
+    }
+    slot_cv_.notify_all();
+    window_cv_.notify_all();
+  }
+
+  return WriteFrame(SETTINGS, ACK, 0, absl::string_view{});
+}
+
+auto Http2Client::HandleGoAway(absl::string_view payload) -> error_code {
+  if (payload.size() < 8)
+    return ProtocolError();
+
+  uint32_t last_stream_id = ReadBE32(payload.data()) & 0x7fffffff;
+  uint32_t code = ReadBE32(payload.data() + 4);
+  LOG_IF(WARNING, code != NO_ERROR) << "GOAWAY from " << host_name_ << " with error " << code
+                                    << ": " << payload.substr(8);
+
+  std::lock_guard<fibers::mutex> lk(mu_);
+  goaway_ = true;
+
+  // The streams above last_stream_id were not processed and can be retried.
+  std::vector<uint32_t> unprocessed;
+  for (const auto& id_stream : streams_) {
+    if (id_stream.first > last_stream_id)
+      unprocessed.push_back(id_stream.first);
+  }
+  for (uint32_t id : unprocessed) {
+    CloseStream(id, asio::error::try_again);
+  }
+  slot_cv_.notify_all();
+
+  return error_code{};
+}
+
+auto Http2Client::HandleWindowUpdate(const FrameHeader& hdr, absl::string_view payload)
+    -> error_code {
+  if (payload.size() != 4)
+    return ProtocolError();
+  uint32_t increment = ReadBE32(payload.data()) & 0x7fffffff;
+
+  std::lock_guard<fibers::mutex> lk(mu_);
+  if (hdr.stream_id == 0) {
+    conn_send_window_ += increment;
+    if (increment == 0 || conn_send_window_ > kMaxWindow)
+      return ProtocolError();
+  } else {
+    auto it = streams_.find(hdr.stream_id);
+    if (it != streams_.end())
+      it->second->send_window += increment;
+  }
+  window_cv_.notify_all();
+
+  return error_code{};
+}
+
+void Http2Client::CloseStream(uint32_t stream_id, error_code ec) {
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end())
+    return;
+
+  Stream* stream = it->second;
+  streams_.erase(it);
+
+  stream->ec = ec;
+  stream->done = true;
+  stream->cv.notify_one();
+  slot_cv_.notify_one();
+  window_cv_.notify_all();  // The stream might be waiting to send its body.
+}
+
+void Http2Client::Fail(error_code ec) {
+  if (!status_)
+    status_ = ec;
+
+  for (auto& id_stream : streams_) {
+    Stream* stream = id_stream.second;
+    stream->ec = status_;
+    stream->done = true;
+    stream->cv.notify_one();
+  }
+  streams_.clear();
+  slot_cv_.notify_all();
+  window_cv_.notify_all();
+}
+
+}  // namespace http
+}  // namespace util
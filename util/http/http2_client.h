@@ -0,0 +1,142 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/fiber.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <unordered_map>
+
+#include "absl/strings/string_view.h"
+#include "util/http/hpack.h"
+#include "util/http/ssl_stream.h"
+
+namespace util {
+class IoContext;
+
+namespace http {
+
+/*! @brief HTTP/2 client connection that multiplexes concurrent requests on streams.
+ *
+ * Negotiates "h2" with ALPN over TLS. Send() can be called concurrently by many fibers
+ * of the IoContext thread: each call opens a stream and blocks only its own fiber while
+ * a reader fiber demultiplexes the responses. Unlike HttpsClient the connection does not
+ * reconnect, once status() is set it must be replaced.
+ */
+class Http2Client {
+ public:
+  using error_code = ::boost::system::error_code;
+  using Request = ::boost::beast::http::request<::boost::beast::http::string_body>;
+  using Response = ::boost::beast::http::response<::boost::beast::http::string_body>;
+
+  Http2Client(absl::string_view host, IoContext* io_context, ::boost::asio::ssl::context* ssl_ctx);
+  Http2Client(const Http2Client&) = delete;
+  ~Http2Client();
+
+  //! Connects, negotiates h2 and sends the connection preface. Can be called once.
+  error_code Connect(unsigned msec);
+
+  /*! @brief Sends the request on a new stream and reads its response.
+   *
+   * Blocks the calling fiber until a stream slot is available under the peer's
+   * SETTINGS_MAX_CONCURRENT_STREAMS and the response completes.
+   * Returns asio::error::try_again when the peer refused the stream or is going away
+   * before processing it, the request can be safely retried on another connection.
+   */
+  error_code Send(const Request& req, Response* resp);
+
+  //! Closes the connection, the pending requests fail with operation_aborted.
+  void Shutdown();
+
+  //! Whether new streams can be opened: the connection is healthy and the peer did not
+  //! send GOAWAY.
+  bool accepts_streams() const { return !status_ && !goaway_; }
+
+  unsigned active_streams() const { return streams_.size() + opening_; }
+
+  uint32_t max_concurrent_streams() const { return max_concurrent_streams_; }
+
+  error_code status() const { return status_; }
+
+  int32_t native_handle() { return client_ ? client_->next_layer().native_handle() : -1; }
+
+ private:
+  struct Stream {
+    Response* resp;
+    int64_t send_window;
+    uint32_t recv_unacked = 0;  // Received DATA bytes not returned with WINDOW_UPDATE.
+    bool done = false;
+    error_code ec;
+    ::boost::fibers::condition_variable cv;
+  };
+
+  struct FrameHeader {
+    uint32_t length;
+    uint8_t type, flags;
+    uint32_t stream_id;
+  };
+
+  void ReadFiber();
+  error_code ReadFrame(FrameHeader* hdr, absl::string_view* payload);
+  error_code HandleFrame(const FrameHeader& hdr, absl::string_view payload);
+  error_code HandleData(const FrameHeader& hdr, absl::string_view payload);
+  error_code HandleHeaders(const FrameHeader& hdr, absl::string_view payload);
+  error_code HandleHeaderBlock(uint32_t stream_id, bool end_stream);
+  error_code HandleSettings(const FrameHeader& hdr, absl::string_view payload);
+  error_code HandleGoAway(absl::string_view payload);
+  error_code HandleWindowUpdate(const FrameHeader& hdr, absl::string_view payload);
+
+  // Must be called under write_mu_.
+  error_code WriteHeaders(uint32_t stream_id, const std::string& block, bool end_stream);
+  error_code WriteBody(uint32_t stream_id, Stream* stream, absl::string_view body);
+
+  // Writes the frames atomically with respect to the other writers.
+  error_code WriteFrames(const std::string& frames);
+  error_code WriteLocked(const std::string& frames);
+  error_code WriteFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                        absl::string_view payload);
+
+  // Completes the stream and releases its slot. Must be called under mu_.
+  void CloseStream(uint32_t stream_id, error_code ec);
+  void Fail(error_code ec);
+
+  IoContext& io_context_;
+  ::boost::asio::ssl::context& ssl_cntx_;
+  std::string host_name_;
+  std::unique_ptr<SslStream> client_;
+
+  hpack::Decoder decoder_;
+
+  std::string read_buf_;
+  size_t read_begin_ = 0, read_end_ = 0;
+
+  // The header block that continues with CONTINUATION frames.
+  std::string header_block_;
+  uint32_t continued_stream_ = 0;
+  bool continued_end_stream_ = false;
+
+  ::boost::fibers::fiber read_fiber_;
+
+  // Guards the state below. write_mu_ keeps the frames of a header block together and the
+  // streams opened in the order of their ids. Lock order: write_mu_ then mu_.
+  ::boost::fibers::mutex mu_, write_mu_;
+  ::boost::fibers::condition_variable slot_cv_, window_cv_;
+
+  std::unordered_map<uint32_t, Stream*> streams_;
+  unsigned opening_ = 0;  // Streams that reserved a slot but were not sent yet.
+  uint32_t next_stream_id_ = 1;
+
+  uint32_t max_concurrent_streams_ = 100;  // Until the peer's SETTINGS arrive.
+  uint32_t peer_initial_window_ = 65535, peer_max_frame_size_ = 1 << 14;
+  int64_t conn_send_window_ = 65535;
+  uint32_t conn_recv_unacked_ = 0;
+
+  bool goaway_ = false;
+  error_code status_;
+};
+
+}  // namespace http
+}  // namespace util
@@ -0,0 +1,101 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/http/http2_client_pool.h"
+
+#include "base/logging.h"
+#include "util/http/http2_client.h"
+
+namespace util {
+
+namespace http {
+
+void Http2ClientPool::HandleGuard::operator()(Http2Client* client) {
+  CHECK(client);
+  CHECK(pool_);
+
+  std::lock_guard<::boost::fibers::mutex> lk(pool_->mu_);
+  CHECK_GT(pool_->existing_handles_, 0);
+  --pool_->existing_handles_;
+
+  for (auto& conn : pool_->conns_) {
+    if (conn.client.get() == client) {
+      CHECK_GT(conn.handles, 0);
+      --conn.handles;
+      break;
+    }
+  }
+  pool_->RemoveIdleFailed();
+  pool_->released_cv_.notify_one();
+}
+
+Http2ClientPool::Http2ClientPool(const std::string& domain, ::boost::asio::ssl::context* ssl_ctx,
+                                 IoContext* io_cntx)
+    : ssl_cntx_(*ssl_ctx), io_cntx_(*io_cntx), domain_(domain) {}
+
+Http2ClientPool::~Http2ClientPool() {
+  CHECK_EQ(0, existing_handles_);
+}
+
+void Http2ClientPool::RemoveIdleFailed() {
+  for (size_t i = 0; i < conns_.size();) {
+    Http2Client* client = conns_[i].client.get();
+    if (conns_[i].handles == 0 && !client->accepts_streams()) {
+      VLOG(1) << "Deleting client " << client->native_handle() << " due to " << client->status();
+      std::swap(conns_[i], conns_.back());
+      conns_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+auto Http2ClientPool::GetHandle() -> ClientHandle {
+  std::unique_lock<::boost::fibers::mutex> lk(mu_);
+
+  while (true) {
+    RemoveIdleFailed();
+
+    Connection* best = nullptr;
+    for (auto& conn : conns_) {
+      Http2Client* client = conn.client.get();
+      if (client->accepts_streams() && conn.handles < client->max_concurrent_streams() &&
+          (!best || conn.handles < best->handles)) {
+        best = &conn;
+      }
+    }
+
+    if (best) {
+      ++best->handles;
+      ++existing_handles_;
+      return ClientHandle(best->client.get(), HandleGuard{this});
+    }
+
+    if (conns_.size() + connecting_ < max_connections_)
+      break;
+
+    released_cv_.wait(lk);
+  }
+
+  VLOG(1) << "Creating a new http2 client";
+  ++connecting_;
+  lk.unlock();
+
+  std::unique_ptr<Http2Client> client(new Http2Client{domain_, &io_cntx_, &ssl_cntx_});
+  auto ec = client->Connect(connect_msec_);
+  LOG_IF(WARNING, ec) << "Http2ClientPool: Could not connect " << ec;
+
+  lk.lock();
+  --connecting_;
+  Http2Client* res = client.get();
+  conns_.push_back(Connection{std::move(client), 1});
+  ++existing_handles_;
+
+  // The waiters can share the new connection.
+  released_cv_.notify_all();
+
+  return ClientHandle{res, HandleGuard{this}};
+}
+
+}  // namespace http
+}  // namespace util
@@ -0,0 +1,92 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/asio/ssl/context.hpp>
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <memory>
+#include <vector>
+
+namespace util {
+
+class IoContext;
+
+namespace http {
+
+class Http2Client;
+
+/*! @brief IoContext specific pool of HTTP/2 connections to a single host.
+ *
+ * Same interface as HttpsClientPool, but handles share the connections: each handle
+ * reserves a stream on a connection, so up to SETTINGS_MAX_CONCURRENT_STREAMS handles are
+ * multiplexed on one connection and the pool opens at most max_connections connections.
+ */
+class Http2ClientPool {
+ public:
+  class HandleGuard {
+   public:
+    HandleGuard(Http2ClientPool* pool = nullptr) : pool_(pool) {}
+
+    void operator()(Http2Client* client);
+
+   private:
+    Http2ClientPool* pool_;
+  };
+
+  using ClientHandle = std::unique_ptr<Http2Client, HandleGuard>;
+
+  Http2ClientPool(const std::string& domain, ::boost::asio::ssl::context* ssl_ctx,
+                  IoContext* io_cntx);
+
+  ~Http2ClientPool();
+
+  /*! @brief Returns a handle to the least loaded connection that has a free stream.
+   *
+   * Must be called withing IoContext thread. Opens a new connection if all of them are
+   * busy, and blocks the calling fiber until a handle is released if there are already
+   * max_connections connections. Like HttpsClientPool, returns the handle of a failed
+   * connection if the connect fails, its Send() returns the error.
+   * Note that all allocated handles must be destroyed before destroying their parent pool.
+   */
+  ClientHandle GetHandle();
+
+  void set_connect_timeout(unsigned msec) { connect_msec_ = msec; }
+
+  void set_max_connections(unsigned cnt) { max_connections_ = cnt; }
+
+  IoContext& io_context() { return io_cntx_; }
+
+  //! Number of existing handles created by this pool.
+  unsigned handles_count() const { return existing_handles_; }
+
+  unsigned connections_count() const { return conns_.size(); }
+
+  const std::string domain() const { return domain_; }
+
+ private:
+  using SslContext = ::boost::asio::ssl::context;
+
+  struct Connection {
+    std::unique_ptr<Http2Client> client;
+    unsigned handles = 0;
+  };
+
+  // Deletes the connections that can not take new streams and have no handles.
+  void RemoveIdleFailed();
+
+  SslContext& ssl_cntx_;
+  IoContext& io_cntx_;
+  std::string domain_;
+  unsigned connect_msec_ = 1000, max_connections_ = 4;
+  unsigned existing_handles_ = 0, connecting_ = 0;
+
+  std::vector<Connection> conns_;
+
+  ::boost::fibers::mutex mu_;
+  ::boost::fibers::condition_variable released_cv_;
+};
+
+}  // namespace http
+}  // namespace util
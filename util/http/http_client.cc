@@ -13,6 +13,7 @@
 
 #include "base/logging.h"
 #include "util/asio/fiber_socket.h"
+#include "util/asio/request_trace.h"
 #include "util/asio/yield.h"
 
 namespace util {
@@ -46,6 +47,12 @@ system::error_code Client::Connect(StringPiece host, StringPiece service) {
   req.body().assign(body.begin(), body.end());
   req.prepare_payload();
 
+  TraceScope trace_scope("http-client", TraceSpan::CLIENT, TraceScope::Current(), true);
+  if (trace_scope.span().sampled()) {
+    req.set("traceparent", trace_scope.span().context().ToTraceparent());
+    trace_scope.span().Annotate(url);
+  }
+
   system::error_code ec;
 
   // Send the HTTP request to the remote host.
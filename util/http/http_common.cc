@@ -6,10 +6,14 @@
 
 #include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
 #include "base/flags.h"
 #include "base/logging.h"
 #include "strings/stringpiece.h"
+#include "util/zlib_source.h"
+#include "util/zstd_sinksource.h"
 
 namespace util {
 namespace http {
@@ -35,6 +39,70 @@ void HandleVModule(StringPiece str) {
   }
 }
 
+// Fast levels since the responses are compressed inline by the IO threads.
+constexpr unsigned kGzipLevel = 3;
+constexpr int kZstdLevel = 3;
+
+// The output buffers keep their capacity between the responses up to this size.
+constexpr size_t kMaxRetainedOutput = 1 << 20;
+
+struct Compressors {
+  StringSink* gzip_out = new StringSink;  // Owned by gzip.
+  ZlibSink gzip{gzip_out, kGzipLevel};
+
+  StringSink* zstd_out = new StringSink;  // Owned by zstd.
+  ZStdSink zstd{zstd_out};
+};
+
+Compressors* ThreadCompressors() {
+  static thread_local std::unique_ptr<Compressors> compressors;
+  if (!compressors) {
+    compressors.reset(new Compressors);
+  }
+  return compressors.get();
+}
+
+// Parses "bytes=first-last", "bytes=first-" or "bytes=-suffix". Returns false if spec is not
+// a single byte range, otherwise sets *satisfiable and the range it resolves to.
+bool ParseByteRange(StringPiece spec, uint64_t size, uint64_t* offset, uint64_t* length,
+                    bool* satisfiable) {
+  if (!absl::ConsumePrefix(&spec, "bytes="))
+    return false;
+  spec = absl::StripAsciiWhitespace(spec);
+
+  size_t dash = spec.find('-');
+  if (dash == StringPiece::npos || spec.find(',') != StringPiece::npos)
+    return false;
+
+  StringPiece first = spec.substr(0, dash), last = spec.substr(dash + 1);
+  uint64_t a = 0, b = 0;
+  if (first.empty()) {
+    if (!absl::SimpleAtoi(last, &b))
+      return false;
+    *satisfiable = b > 0 && size > 0;
+    b = std::min(b, size);
+    *offset = size - b;
+    *length = b;
+    return true;
+  }
+
+  if (!absl::SimpleAtoi(first, &a) || (!last.empty() && (!absl::SimpleAtoi(last, &b) || b < a)))
+    return false;
+
+  *satisfiable = a < size;
+  if (*satisfiable) {
+    b = last.empty() ? size - 1 : std::min(b, size - 1);
+    *offset = a;
+    *length = b - a + 1;
+  }
+  return true;
+}
+
+Status Compress(StringPiece src, Sink* sink) {
+  RETURN_IF_ERROR(sink->Append(strings::ToByteRange(src)));
+  return sink->Flush();
+}
+
 }  // namespace
 
 const char kHtmlMime[] = "text/html";
@@ -143,5 +211,95 @@ h2::response<h2::string_body> ParseFlagz(const QueryArgs& args) {
   return ec;
 }
 
+void PrepareFileResponse(StringPiece range, FileResponse* resp, uint64_t* offset,
+                         uint64_t* length) {
+  uint64_t size = resp->body().size();
+  *offset = 0;
+  *length = size;
+  resp->set(h2::field::accept_ranges, "bytes");
+
+  bool satisfiable = false;
+  if (!range.empty() && resp->result() == h2::status::ok &&
+      ParseByteRange(range, size, offset, length, &satisfiable)) {
+    if (satisfiable) {
+      resp->result(h2::status::partial_content);
+      resp->set(h2::field::content_range,
+                absl::StrCat("bytes ", *offset, "-", *offset + *length - 1, "/", size));
+    } else {
+      resp->result(h2::status::range_not_satisfiable);
+      resp->set(h2::field::content_range, absl::StrCat("bytes */", size));
+      *offset = *length = 0;
+    }
+  }
+  resp->content_length(*length);
+}
+
+unsigned ParseAcceptEncoding(StringPiece header) {
+  unsigned res = 0;
+  for (StringPiece item : absl::StrSplit(header, ',', absl::SkipWhitespace())) {
+    StringPiece coding = item.substr(0, item.find(';'));
+    StringPiece params = item.substr(coding.size());
+    coding = absl::StripAsciiWhitespace(coding);
+
+    size_t q_pos = params.find("q=");
+    double q = 1;
+    if (q_pos != StringPiece::npos &&
+        absl::SimpleAtod(absl::StripAsciiWhitespace(params.substr(q_pos + 2)), &q) && q <= 0)
+      continue;
+
+    if (absl::EqualsIgnoreCase(coding, "gzip") || absl::EqualsIgnoreCase(coding, "x-gzip")) {
+      res |= kEncodingGzip;
+    } else if (absl::EqualsIgnoreCase(coding, "zstd")) {
+      res |= kEncodingZstd;
+    } else if (coding == "*") {
+      res |= kEncodingGzip | kEncodingZstd;
+    }
+  }
+  return res;
+}
+
+bool CompressResponse(unsigned encodings, size_t min_size, StringResponse* resp) {
+  string& body = resp->body();
+  if (!encodings || body.size() < min_size || resp->count(h2::field::content_encoding))
+    return false;
+
+  Compressors* cmp = ThreadCompressors();
+  StringSink* out;
+  Status st;
+  const char* coding;
+
+  // zstd is preferred, it compresses faster and better than gzip.
+  if (encodings & kEncodingZstd) {
+    out = cmp->zstd_out;
+    out->contents().clear();
+    st = cmp->zstd.Init(kZstdLevel);
+    if (st.ok())
+      st = Compress(body, &cmp->zstd);
+    coding = "zstd";
+  } else {
+    out = cmp->gzip_out;
+    out->contents().clear();
+    cmp->gzip.Reset();
+    st = Compress(body, &cmp->gzip);
+    coding = "gzip";
+  }
+
+  bool compressed = false;
+  if (!st.ok()) {
+    LOG(ERROR) << "Could not compress the response with " << coding << ": " << st;
+  } else if (out->contents().size() < body.size()) {
+    body.swap(out->contents());
+    resp->set(h2::field::content_encoding, coding);
+    resp->set(h2::field::vary, "Accept-Encoding");
+    compressed = true;
+  }
+
+  out->contents().clear();
+  if (out->contents().capacity() > kMaxRetainedOutput) {
+    string{}.swap(out->contents());
+  }
+  return compressed;
+}
+
 }  // namespace http
 }  // namespace util
@@ -46,10 +46,42 @@ QueryArgs SplitQuery(absl::string_view query);
 StringResponse ParseFlagz(const QueryArgs& args);
 
 StringResponse BuildStatusPage(const QueryArgs& args, const char* resource_prefix);
+
+// All the varz in Prometheus text exposition format.
+StringResponse BuildMetricsPage();
+
+// The recent history of the numeric varz, see util/stats/varz_history.h. The args are
+// name=<prefix of the series>, window=<seconds> and o=json.
+StringResponse BuildVarzHistoryPage(const QueryArgs& args);
 StringResponse ProfilezHandler(const QueryArgs& args);
 
 using FileResponse = ::boost::beast::http::response<::boost::beast::http::file_body>;
 ::boost::system::error_code LoadFileResponse(absl::string_view fname, FileResponse* resp);
 
+// Resolves range, the value of Range header of the request, against the size of the file:
+// a satisfiable single byte range turns resp into 206 with Content-Range, an unsatisfiable
+// one into 416. Other ranges are ignored and the whole file is sent.
+// Sets Content-Length and returns the part of the file to send in [*offset, *offset + *length).
+void PrepareFileResponse(absl::string_view range, FileResponse* resp, uint64_t* offset,
+                         uint64_t* length);
+
+// Bitmask of the content codings that a client accepts.
+enum ContentEncoding : unsigned { kEncodingGzip = 1, kEncodingZstd = 2 };
+
+// Parses the value of Accept-Encoding header, the codings with q=0 are excluded.
+unsigned ParseAcceptEncoding(absl::string_view header);
+
+// Compresses the body of resp with zstd or gzip, whichever of them encodings has first, if
+// the body is at least min_size bytes long and is not encoded yet. The compressors are kept
+// per thread and are reused by all the responses of the thread.
+// Returns true if resp was compressed.
+bool CompressResponse(unsigned encodings, size_t min_size, StringResponse* resp);
+
+// Only the string bodies are compressed, the rest are sent as is.
+template <typename Body>
+bool CompressResponse(unsigned, size_t, ::boost::beast::http::response<Body>*) {
+  return false;
+}
+
 }  // namespace http
 }  // namespace util
@@ -10,6 +10,7 @@
 #include "absl/strings/str_split.h"
 #include "base/logging.h"
 #include "strings/stringpiece.h"
+#include "util/asio/request_trace.h"
 #include "util/asio/yield.h"
 #include "util/http/status_page.h"
 
@@ -24,6 +25,8 @@ using fibers_ext::yield;
 
 namespace {
 
+constexpr size_t kPipelineBatchSize = 1 << 14;
+
 inline system::error_code to_asio(system::error_code ec) {
   if (ec == h2::error::end_of_stream)
     return asio::error::eof;
@@ -57,6 +60,21 @@ void FilezHandler(const QueryArgs& args, HttpHandler::SendFunction* send) {
   return send->Invoke(std::move(fresp));
 }
 
+// The buffered spans in Zipkin v2 JSON, only of the trace given by the "trace" argument if set.
+void TracezHandler(const QueryArgs& args, HttpHandler::SendFunction* send) {
+  uint64_t trace_id = 0;
+  for (const auto& k_v : args) {
+    if (k_v.first == "trace") {
+      trace_id = strtoull(string(k_v.second).c_str(), nullptr, 16);
+    }
+  }
+
+  StringResponse resp = MakeStringResponse(h2::status::ok);
+  SetMime(kJsonMime, &resp);
+  trace::AppendZipkinJson(trace::CollectSpans(trace_id), &resp.body());
+  send->Invoke(std::move(resp));
+}
+
 }  // namespace
 
 HttpHandler::HttpHandler(const ListenerBase* lb, IoContext* cntx)
@@ -65,20 +83,50 @@ HttpHandler::HttpHandler(const ListenerBase* lb, IoContext* cntx)
   resource_prefix_ = "https://cdn.jsdelivr.net/gh/romange/gaia/util/http";
 }
 
-system::error_code HttpHandler::HandleRequest() {
-  beast::flat_buffer buffer;
-  RequestType request;
+void HttpHandler::OnOpenSocket() {
+  // The batch goes out once the connection fiber runs out of buffered requests and blocks
+  // on reading, so the responses to pipelined requests share one write.
+  if (registry_ && registry_->pipelined_) {
+    socket_->set_write_batch(kPipelineBatchSize);
+  }
+}
 
+system::error_code HttpHandler::HandleRequest() {
   system::error_code ec;
 
-  h2::read(*socket_, buffer, request, ec);
+  // The parser appends to the message, so it is cleared but keeps its capacity.
+  request_.clear();
+  request_.body().clear();
+  h2::read(*socket_, buffer_, request_, ec);
   if (ec) {
     return to_asio(ec);
   }
-  VLOG(1) << "Full Url: " << request.target();
+  VLOG(1) << "Full Url: " << request_.target();
 
+  TraceContext parent;
+  auto trace_it = request_.find("traceparent");
+  if (trace_it != request_.end()) {
+    parent = TraceContext::FromTraceparent(as_absl(trace_it->value()));
+  }
+  TraceScope trace_scope("http-server", TraceSpan::SERVER, parent, true);
+  trace_scope.span().Annotate(as_absl(request_.target()));
+
+  // The arena is released after the handler has sent the response.
+  RequestArena arena;
   SendFunction send(*socket_);
-  HandleRequestInternal(request, &send);
+  send.set_memory_resource(arena.resource());
+  if (registry_ && registry_->compress_min_size_) {
+    auto it = request_.find(h2::field::accept_encoding);
+    if (it != request_.end()) {
+      send.EnableCompression(ParseAcceptEncoding(as_absl(it->value())),
+                             registry_->compress_min_size_);
+    }
+  }
+  auto range_it = request_.find(h2::field::range);
+  if (range_it != request_.end()) {
+    send.set_range(as_absl(range_it->value()));
+  }
+  HandleRequestInternal(request_, &send);
 
   VLOG(1) << "HandleRequestEnd: " << send.ec;
 
@@ -104,6 +152,14 @@ void HttpHandler::HandleRequestInternal(const RequestType& request, SendFunction
     return send->Invoke(BuildStatusPage(args, resource_prefix_));
   }
 
+  if (path == "/metrics") {
+    return send->Invoke(BuildMetricsPage());
+  }
+
+  if (path == "/varzh") {
+    return send->Invoke(BuildVarzHistoryPage(args));
+  }
+
   if (path == "/flagz") {
     h2::response<h2::string_body> resp(h2::status::ok, request.version());
     if (Authorize(args)) {
@@ -124,6 +180,11 @@ void HttpHandler::HandleRequestInternal(const RequestType& request, SendFunction
     return;
   }
 
+  if (path == "/tracez") {
+    TracezHandler(args, send);
+    return;
+  }
+
   if (registry_) {
     auto it = registry_->cb_map_.find(path);
     if (it == registry_->cb_map_.end() || (it->second.is_protected && !Authorize(args))) {
@@ -3,6 +3,9 @@
 //
 #pragma once
 
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/chunk_encode.hpp>
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/serializer.hpp>
 #include <boost/beast/http/string_body.hpp>
@@ -10,6 +13,7 @@
 
 #include "strings/unique_strings.h"
 #include "util/asio/connection_handler.h"
+#include "util/asio/request_arena.h"
 #include "util/http/http_common.h"
 
 namespace util {
@@ -29,10 +33,28 @@ struct SendLambda {
   explicit SendLambda(FiberSyncStream& stream) : stream_(stream) {
   }
 
+  // The string responses of at least min_size bytes are compressed with one of encodings.
+  void EnableCompression(unsigned encodings, size_t min_size) {
+    encodings_ = encodings;
+    compress_min_size_ = min_size;
+  }
+
+  // The value of Range header of the request, file responses send only that range.
+  // Must outlive the call.
+  void set_range(absl::string_view range) { range_ = range; }
+
+  // The arena of the request, released once the response has been sent. The handlers
+  // allocate their temporary parsing and formatting buffers there.
+  pmr::memory_resource* memory_resource() const { return mr_; }
+  void set_memory_resource(pmr::memory_resource* mr) { mr_ = mr; }
+
   template <typename Body>
   void Invoke(Response<Body>&& msg) {
     // Determine if we should close the connection after
     // close_ = msg.need_eof();
+    if (encodings_) {
+      CompressResponse(encodings_, compress_min_size_, &msg);
+    }
 
     // We need the serializer here because the serializer requires
     // a non-const file_body, and the message oriented version of
@@ -42,6 +64,50 @@ struct SendLambda {
 
     ::boost::beast::http::write(stream_, sr, ec);
   }
+
+  // Streams a response whose body is not known upfront: StartChunked() sends the header of
+  // msg with chunked transfer encoding, every WriteChunk() sends a part of the body and
+  // EndChunks() completes it. The body of msg is ignored. Returns false once ec is set.
+  bool StartChunked(StringResponse&& msg) {
+    msg.body().clear();
+    msg.chunked(true);
+    ::boost::beast::http::response_serializer<::boost::beast::http::string_body> sr{msg};
+    ::boost::beast::http::write_header(stream_, sr, ec);
+    return !ec;
+  }
+
+  bool WriteChunk(absl::string_view data) {
+    if (!ec && !data.empty()) {
+      auto buf = ::boost::asio::buffer(data.data(), data.size());
+      ::boost::asio::write(stream_, ::boost::beast::http::make_chunk(buf), ec);
+    }
+    return !ec;
+  }
+
+  bool EndChunks() {
+    if (!ec)
+      ::boost::asio::write(stream_, ::boost::beast::http::make_chunk_last(), ec);
+    return !ec;
+  }
+
+  // The file is sent with FiberSyncStream::SendFile after the header, so its contents never
+  // pass through userspace buffers.
+  void Invoke(FileResponse&& msg) {
+    uint64_t offset, length;
+    PrepareFileResponse(range_, &msg, &offset, &length);
+
+    ::boost::beast::http::response_serializer<::boost::beast::http::file_body> sr{msg};
+    ::boost::beast::http::write_header(stream_, sr, ec);
+    if (!ec && length) {
+      ec = stream_.SendFile(msg.body().file().native_handle(), offset, length);
+    }
+  }
+
+ private:
+  unsigned encodings_ = 0;
+  size_t compress_min_size_ = 0;
+  absl::string_view range_;
+  pmr::memory_resource* mr_ = pmr::get_default_resource();
 };
 
 // Should be one per process. Represents http server interface.
@@ -57,12 +123,22 @@ class ListenerBase : public ListenerInterface {
   // Returns true if a callback was registered.
   bool RegisterCb(StringPiece path, bool protect, RequestCb cb);
 
+  // In pipelined mode the responses to the requests that a client sent back-to-back are
+  // coalesced into a single socket write. Applies to the connections accepted afterwards.
+  void set_pipelined(bool flag) { pipelined_ = flag; }
+
+  // String responses of at least min_size bytes are compressed for the clients that accept
+  // gzip or zstd. 0 disables the compression.
+  void set_compress_min_size(size_t min_size) { compress_min_size_ = min_size; }
+
  private:
   struct CbInfo {
     bool is_protected;
     RequestCb cb;
   };
   StringPieceMap<CbInfo> cb_map_;
+  bool pipelined_ = false;
+  size_t compress_min_size_ = 4096;
 };
 
 class HttpHandler : public ConnectionHandler {
@@ -80,10 +156,16 @@ class HttpHandler : public ConnectionHandler {
   virtual bool Authorize(const QueryArgs& args) const { return true; }
 
  private:
+  void OnOpenSocket() override;
 
   void HandleRequestInternal(const RequestType& req, SendFunction* send);
 
   const ListenerBase* registry_;
+
+  // Both persist across the requests of the connection: buffer_ may hold the next pipelined
+  // requests and request_ keeps its allocations.
+  ::boost::beast::flat_buffer buffer_;
+  RequestType request_;
 };
 
 // http Listener + handler factory. By default creates HttpHandler.
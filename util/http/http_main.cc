@@ -61,6 +61,31 @@ int main(int argc, char** argv) {
   };
   listener.RegisterCb("/table", false, table_cb);
 
+  // A large table is sorted and paginated on the server and streamed chunk by chunk.
+  auto big_table_cb = [](const http::QueryArgs& args, http::HttpHandler::SendFunction* send) {
+    html::TablePage page;
+    for (const auto& k_v : args) {
+      page.ParseArg(k_v.first, k_v.second);
+    }
+
+    html::TablePage::Rows rows(100000);
+    for (size_t i = 0; i < rows.size(); ++i) {
+      rows[i] = {absl::StrCat("conn", i), absl::StrCat(i % 977), absl::StrCat(i * 7 % 1000)};
+    }
+
+    http::StringResponse resp = http::MakeStringResponse(h2::status::ok);
+    http::SetMime(http::kHtmlMime, &resp);
+    if (!send->StartChunked(std::move(resp)))
+      return;
+
+    html::TableStream stream([send](StringPiece chunk) { return send->WriteChunk(chunk); });
+    stream.Append(html::SortedTable::HtmlStart());
+    page.Render({"Name", "Col1", "Col2"}, rows, "/big_table", &stream);
+    if (stream.Flush())
+      send->EndChunks();
+  };
+  listener.RegisterCb("/big_table", false, big_table_cb);
+
 
   uint16_t port = server.AddListener(FLAGS_port, &listener);
   LOG(INFO) << "Listening on port " << port;
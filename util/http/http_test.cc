@@ -1,21 +1,30 @@
 // Copyright 2018, Beeri 15.  All rights reserved.
 // Author: Roman Gershman (romange@gmail.com)
 //
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
 #include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/http/read.hpp>
+#include <boost/beast/http/write.hpp>
 
+#include <pmr/vector.h>
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
 
+#include "absl/strings/str_cat.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 
 #include "util/asio/accept_server.h"
 #include "util/asio/asio_utils.h"
+#include "util/asio/fiber_socket.h"
 #include "util/asio/io_context_pool.h"
+#include "util/html/sorted_table.h"
 #include "util/http/http_client.h"
 #include "util/http/http_testing.h"
 #include "util/http/beast_rj_utils.h"
+#include "util/stats/varz_stats.h"
+#include "util/zlib_source.h"
 
 namespace util {
 namespace http {
@@ -57,6 +66,237 @@ TEST_F(HttpTest, Client) {
   EXPECT_FALSE(client.IsConnected());
 }
 
+TEST_F(HttpTest, Pipelined) {
+  listener_.set_pipelined(true);
+  listener_.RegisterCb("/ping", false, [](const QueryArgs& args, HttpHandler::SendFunction* send) {
+    StringResponse resp = MakeStringResponse(h2::status::ok);
+    resp.body() = "pong";
+    send->Invoke(std::move(resp));
+  });
+
+  IoContext& io_context = pool_->GetNextContext();
+  FiberSyncSocket socket("localhost", std::to_string(port_), &io_context);
+  ASSERT_FALSE(socket.ClientWaitToConnect(1000));
+
+  constexpr unsigned kNumRequests = 10;
+  string requests;
+  for (unsigned i = 0; i < kNumRequests; ++i) {
+    requests.append("GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  }
+
+  io_context.AwaitSafe([&] {
+    system::error_code ec;
+    asio::write(socket, asio::buffer(requests), ec);
+    ASSERT_FALSE(ec) << ec.message();
+
+    // All the requests arrive with one write, none of them may be lost.
+    beast::flat_buffer buffer;
+    for (unsigned i = 0; i < kNumRequests; ++i) {
+      h2::response<h2::string_body> resp;
+      h2::read(socket, buffer, resp, ec);
+      ASSERT_FALSE(ec) << ec.message();
+      EXPECT_EQ(h2::status::ok, resp.result());
+      EXPECT_EQ("pong", resp.body());
+    }
+  });
+}
+
+TEST_F(HttpTest, Compression) {
+  EXPECT_EQ(kEncodingGzip | kEncodingZstd, ParseAcceptEncoding("gzip, deflate, br, zstd"));
+  EXPECT_EQ(kEncodingGzip, ParseAcceptEncoding("zstd;q=0, GZIP;q=0.5"));
+  EXPECT_EQ(0, ParseAcceptEncoding("identity"));
+
+  const string kBody(1 << 16, 'a');
+  listener_.RegisterCb("/big", false, [&](const QueryArgs& args, HttpHandler::SendFunction* send) {
+    StringResponse resp = MakeStringResponse(h2::status::ok);
+    resp.body() = kBody;
+    send->Invoke(std::move(resp));
+  });
+
+  IoContext& io_context = pool_->GetNextContext();
+  FiberSyncSocket socket("localhost", std::to_string(port_), &io_context);
+  ASSERT_FALSE(socket.ClientWaitToConnect(1000));
+
+  io_context.AwaitSafe([&] {
+    system::error_code ec;
+    beast::flat_buffer buffer;
+
+    // The compressor of the thread is reused by the consecutive responses.
+    for (unsigned i = 0; i < 2; ++i) {
+      h2::request<h2::string_body> req{h2::verb::get, "/big", 11};
+      req.set(h2::field::accept_encoding, "gzip");
+      h2::write(socket, req, ec);
+      ASSERT_FALSE(ec) << ec.message();
+
+      h2::response<h2::string_body> resp;
+      h2::read(socket, buffer, resp, ec);
+      ASSERT_FALSE(ec) << ec.message();
+      EXPECT_EQ("gzip", resp[h2::field::content_encoding]);
+      ASSERT_LT(resp.body().size(), kBody.size());
+
+      ZlibSource source(new StringSource(resp.body()));
+      string decompressed(kBody.size() + 1, '\0');
+      auto res = source.Read(strings::MutableByteRange(
+          reinterpret_cast<uint8_t*>(&decompressed[0]), decompressed.size()));
+      ASSERT_TRUE(res.ok()) << res.status;
+      decompressed.resize(res.obj);
+      EXPECT_EQ(kBody, decompressed);
+    }
+
+    h2::request<h2::string_body> req{h2::verb::get, "/big", 11};
+    h2::write(socket, req, ec);
+    ASSERT_FALSE(ec) << ec.message();
+
+    h2::response<h2::string_body> resp;
+    h2::read(socket, buffer, resp, ec);
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_EQ(0, resp.count(h2::field::content_encoding));
+    EXPECT_EQ(kBody, resp.body());
+  });
+}
+
+TEST_F(HttpTest, ChunkedTable) {
+  html::TablePage::Rows rows;
+  for (unsigned i = 0; i < 5000; ++i) {
+    rows.push_back({absl::StrCat("conn", i), absl::StrCat(i % 100)});
+  }
+
+  size_t num_chunks = 0;
+  listener_.RegisterCb("/table", false, [&](const QueryArgs& args, HttpHandler::SendFunction* send) {
+    html::TablePage page;
+    for (const auto& k_v : args) {
+      page.ParseArg(k_v.first, k_v.second);
+    }
+
+    send->StartChunked(MakeStringResponse(h2::status::ok));
+    html::TableStream stream([&](StringPiece chunk) {
+      ++num_chunks;
+      return send->WriteChunk(chunk);
+    }, 1024);
+    page.Render({"Name", "Value"}, rows, "/table", &stream);
+    stream.Flush();
+    send->EndChunks();
+  });
+
+  IoContext& io_context = pool_->GetNextContext();
+  Client client(&io_context);
+  ASSERT_FALSE(client.Connect("localhost", std::to_string(port_)));
+
+  Client::Response res;
+  ASSERT_FALSE(client.Send(h2::verb::get, "/table?offset=10&limit=50&sort=1&desc=1", &res));
+  EXPECT_TRUE(res.chunked());
+  EXPECT_GT(num_chunks, 2);
+
+  // Rows 11-60 ordered by the descending value: the values 99 come first, then 98.
+  string body = beast::buffers_to_string(res.body().data());
+  EXPECT_NE(string::npos, body.find("Rows 11-60 of 5000")) << body;
+  EXPECT_NE(string::npos, body.find("<td>conn1099</td>"));
+  EXPECT_NE(string::npos, body.find("<td>conn98</td>"));
+  EXPECT_EQ(string::npos, body.find("<td>conn99</td>"));
+  EXPECT_NE(string::npos, body.find("/table?offset=60&limit=50&sort=1&desc=1"));
+
+  // The connection is usable after the chunked response.
+  ASSERT_FALSE(client.Send(h2::verb::get, "/table?offset=4990", &res));
+  body = beast::buffers_to_string(res.body().data());
+  EXPECT_NE(string::npos, body.find("<td>conn4999</td>"));
+  EXPECT_EQ(string::npos, body.find("next</a>"));
+}
+
+TEST_F(HttpTest, FileRange) {
+  const char kFileName[] = "/tmp/http_test_file.txt";
+  string contents;
+  for (unsigned i = 0; i < 100000; ++i) {
+    contents.append(to_string(i));
+  }
+  FILE* f = fopen(kFileName, "w");
+  ASSERT_TRUE(f);
+  ASSERT_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), f));
+  fclose(f);
+
+  IoContext& io_context = pool_->GetNextContext();
+  FiberSyncSocket socket("localhost", std::to_string(port_), &io_context);
+  ASSERT_FALSE(socket.ClientWaitToConnect(1000));
+
+  auto get = [&](const char* range, h2::response<h2::string_body>* resp) {
+    h2::request<h2::string_body> req{h2::verb::get, string("/filez?file=") + kFileName, 11};
+    if (range)
+      req.set(h2::field::range, range);
+    system::error_code ec;
+    beast::flat_buffer buffer;
+    h2::write(socket, req, ec);
+    ASSERT_FALSE(ec) << ec.message();
+    h2::read(socket, buffer, *resp, ec);
+    ASSERT_FALSE(ec) << ec.message();
+  };
+
+  io_context.AwaitSafe([&] {
+    h2::response<h2::string_body> resp;
+    get(nullptr, &resp);
+    EXPECT_EQ(h2::status::ok, resp.result());
+    EXPECT_EQ(contents, resp.body());
+
+    resp = {};
+    get("bytes=10-19", &resp);
+    EXPECT_EQ(h2::status::partial_content, resp.result());
+    EXPECT_EQ(contents.substr(10, 10), resp.body());
+    EXPECT_EQ(absl::StrCat("bytes 10-19/", contents.size()), resp[h2::field::content_range]);
+
+    resp = {};
+    get("bytes=-5", &resp);
+    EXPECT_EQ(h2::status::partial_content, resp.result());
+    EXPECT_EQ(contents.substr(contents.size() - 5), resp.body());
+
+    resp = {};
+    get(absl::StrCat("bytes=", contents.size(), "-").c_str(), &resp);
+    EXPECT_EQ(h2::status::range_not_satisfiable, resp.result());
+    EXPECT_TRUE(resp.body().empty());
+  });
+  unlink(kFileName);
+}
+
+TEST_F(HttpTest, Metrics) {
+  VarzCount requests("test_requests");
+  VarzMapCount errors("test-errors");
+  VarzHistogram latency("test_latency");
+  requests.IncBy(5);
+  errors.Inc("a\"b");
+  latency.Add(3);
+  latency.Add(1000);
+
+  IoContext& io_context = pool_->GetNextContext();
+  Client client(&io_context);
+  ASSERT_FALSE(client.Connect("localhost", std::to_string(port_)));
+
+  Client::Response res;
+  ASSERT_FALSE(client.Send(h2::verb::get, "/metrics", &res));
+  string body = beast::buffers_to_string(res.body().data());
+  EXPECT_NE(string::npos, body.find("# TYPE test_requests counter\ntest_requests 5\n")) << body;
+  EXPECT_NE(string::npos, body.find("test_errors{key=\"a\\\"b\"} 1\n"));
+  EXPECT_NE(string::npos, body.find("# TYPE test_latency histogram\n"));
+  EXPECT_NE(string::npos, body.find("test_latency_bucket{le=\"+Inf\"} 2\n"));
+  EXPECT_NE(string::npos, body.find("test_latency_count 2\n"));
+}
+
+TEST_F(HttpTest, RequestArena) {
+  listener_.RegisterCb("/arena", false, [](const QueryArgs& args, HttpHandler::SendFunction* send) {
+    pmr::memory_resource* mr = send->memory_resource();
+    pmr::vector<int> vec(mr);
+    for (int i = 0; i < 10000; ++i)
+      vec.push_back(i);
+
+    StringResponse resp = MakeStringResponse(h2::status::ok);
+    resp.body() = absl::StrCat(mr != pmr::get_default_resource(), " ", vec.size());
+    send->Invoke(std::move(resp));
+  });
+
+  IoContext& io_context = pool_->GetNextContext();
+  Client client(&io_context);
+  ASSERT_FALSE(client.Connect("localhost", std::to_string(port_)));
+
+  Client::Response res;
+  ASSERT_FALSE(client.Send(h2::verb::get, "/arena", &res));
+  EXPECT_EQ("1 10000", beast::buffers_to_string(res.body().data()));
+}
 
 void AddToMB(const char* str, beast::multi_buffer* dest) {
   size_t sz = strlen(str);
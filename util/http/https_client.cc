@@ -4,6 +4,9 @@
 
 #include "util/http/https_client.h"
 
+#include <mutex>
+
+#include "absl/container/flat_hash_map.h"
 #include "base/logging.h"
 #include "util/asio/io_context.h"
 
@@ -29,6 +32,62 @@ namespace h2 = beast::http;
 namespace {
 constexpr const char kPort[] = "443";
 
+// The last session of every server name, holds a reference to each.
+struct SessionCache {
+  std::mutex mu;
+  absl::flat_hash_map<string, SSL_SESSION*> sessions;
+
+  ~SessionCache() {
+    for (const auto& k_v : sessions)
+      SSL_SESSION_free(k_v.second);
+  }
+};
+
+void FreeSessionCache(void* parent, void* ptr, CRYPTO_EX_DATA* ad, int idx, long argl,
+                      void* argp) {
+  delete static_cast<SessionCache*>(ptr);
+}
+
+int SessionCacheIndex() {
+  static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, &FreeSessionCache);
+  return index;
+}
+
+SessionCache* GetSessionCache(SSL_CTX* ssl_cntx) {
+  return static_cast<SessionCache*>(SSL_CTX_get_ex_data(ssl_cntx, SessionCacheIndex()));
+}
+
+// Called by openssl once the handshake (or, for TLS 1.3, a ticket) establishes a session.
+int OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  const char* host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  SessionCache* cache = GetSessionCache(SSL_get_SSL_CTX(ssl));
+  if (!host || !cache)
+    return 0;
+
+  std::lock_guard<std::mutex> lk(cache->mu);
+  SSL_SESSION*& cached = cache->sessions[host];
+  if (cached)
+    SSL_SESSION_free(cached);
+  cached = session;
+
+  return 1;  // Takes the reference.
+}
+
+void ResumeSession(SSL* ssl, const string& host) {
+  SessionCache* cache = GetSessionCache(SSL_get_SSL_CTX(ssl));
+  if (!cache)
+    return;
+
+  std::lock_guard<std::mutex> lk(cache->mu);
+  auto it = cache->sessions.find(host);
+
+  // Openssl falls back to the full handshake if the server does not accept the session.
+  if (it != cache->sessions.end())
+    SSL_set_session(ssl, it->second);
+}
+
+}  // namespace
+
 ::boost::system::error_code SslConnect(SslStream* stream, unsigned ms) {
   system::error_code ec;
   for (unsigned i = 0; i < 2; ++i) {
@@ -44,7 +103,8 @@ constexpr const char kPort[] = "443";
     if (!ec) {
       auto* cipher = SSL_get_current_cipher(stream->native_handle());
       VLOG(1) << "SSL handshake success " << i << ", chosen " << SSL_CIPHER_get_name(cipher) << "/"
-              << SSL_CIPHER_get_version(cipher);
+              << SSL_CIPHER_get_version(cipher) << ", resumed "
+              << SSL_session_reused(stream->native_handle());
     }
     return ec;
   }
@@ -52,8 +112,6 @@ constexpr const char kPort[] = "443";
   return ec;
 }
 
-}  // namespace
-
 SslContextResult CreateClientSslContext(absl::string_view cert_string) {
   system::error_code ec;
   asio::ssl::context cntx{asio::ssl::context::tlsv12_client};
@@ -78,10 +136,24 @@ SslContextResult CreateClientSslContext(absl::string_view cert_string) {
   constexpr char kCiphers[] = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256";
   CHECK_EQ(1, SSL_CTX_set_cipher_list(ssl_cntx, kCiphers));
   CHECK_EQ(1, SSL_CTX_set_ecdh_auto(ssl_cntx, 1));
+  EnableClientSessionCache(&cntx);
 
   return SslContextResult(std::move(cntx));
 }
 
+void EnableClientSessionCache(asio::ssl::context* cntx) {
+  SSL_CTX* ssl_cntx = cntx->native_handle();
+  if (GetSessionCache(ssl_cntx))
+    return;
+
+  CHECK_EQ(1, SSL_CTX_set_ex_data(ssl_cntx, SessionCacheIndex(), new SessionCache));
+
+  // Openssl does not look up client sessions by itself, ResumeSession() sets them.
+  SSL_CTX_set_session_cache_mode(ssl_cntx,
+                                 SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_cntx, &OnNewSession);
+}
+
 HttpsClient::HttpsClient(absl::string_view host, IoContext* context,
                          ::boost::asio::ssl::context* ssl_ctx)
     : io_context_(*context), ssl_cntx_(*ssl_ctx), host_name_(host) {
@@ -119,6 +191,7 @@ auto HttpsClient::InitSslClient() -> error_code {
 
       LOG(FATAL) << "Could not set hostname: " << buf;
     }
+    ResumeSession(client_->native_handle(), host_name_);
 
     ec = SslConnect(client_.get(), reconnect_msec_);
     if (!ec) {
@@ -130,6 +203,18 @@ auto HttpsClient::InitSslClient() -> error_code {
   return ec;
 }
 
+bool HttpsClient::session_reused() const {
+  return client_ && SSL_session_reused(client_->native_handle());
+}
+
+bool HttpsClient::IsIdleHealthy() const {
+  if (status() || tmp_buffer_.size())
+    return false;
+
+  const FiberSyncSocket& sock = client_ ? client_->next_layer() : *socket_;
+  return sock.read_buffered() == 0;
+}
+
 auto HttpsClient::DrainResponse(h2::response_parser<h2::buffer_body>* parser) -> error_code {
   if (parser->is_done())
     return error_code{};
@@ -165,6 +250,47 @@ auto HttpsClient::DrainResponse(h2::response_parser<h2::buffer_body>* parser) ->
   return error_code{};
 }
 
+auto HttpsClient::StreamBody(DownloadParser* parser, Sink* sink, size_t chunk_size,
+                             ResponseHeader* header) -> error_code {
+  *header = parser->get().base();
+  if (h2::to_status_class(header->result()) != h2::status_class::successful) {
+    VLOG(1) << "Download failed with status " << header->result_int();
+    return HandleError(DrainResponse(parser));
+  }
+
+  // Used unless the sink provides its own buffer.
+  std::unique_ptr<uint8_t[]> scratch(new uint8_t[chunk_size]);
+  auto& body = parser->get().body();
+  error_code ec;
+
+  while (!parser->is_done()) {
+    Sink::WritableBuffer buf =
+        sink->GetAppendBuffer(1, Sink::WritableBuffer(scratch.get(), chunk_size), chunk_size);
+    body.data = buf.data();
+    body.size = std::min(buf.size(), chunk_size);
+    size_t capacity = body.size;
+
+    ec = Read(parser);  // Decreases body.size by the size of the body part it has read.
+    if (IsError(ec))
+      return ec;
+
+    size_t sz = capacity - body.size;
+    if (sz == 0)
+      continue;
+
+    Status st = sink->Append(buf.subpiece(0, sz));
+    if (!st.ok()) {
+      LOG(ERROR) << "Download sink failed: " << st;
+
+      // The rest of the body is not read, so the connection can not be reused.
+      reconnect_needed_ = true;
+      return asio::error::operation_aborted;
+    }
+  }
+
+  return error_code{};
+}
+
 bool HttpsClient::HandleWriteError(const error_code& ec) {
   if (!ec)
     return true;
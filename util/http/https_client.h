@@ -12,8 +12,10 @@
 #include <boost/beast/http/write.hpp>
 
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "absl/types/variant.h"
 #include "util/http/ssl_stream.h"
+#include "util/sinksource.h"
 
 namespace util {
 class IoContext;
@@ -25,6 +27,13 @@ namespace http {
 using SslContextResult = absl::variant<::boost::system::error_code, ::boost::asio::ssl::context>;
 SslContextResult CreateClientSslContext(absl::string_view cert_string);
 
+/*! @brief Caches the TLS sessions of cntx per server name, so that new connections to the same
+ *         host resume them with an abbreviated handshake.
+ *
+ * Called by CreateClientSslContext(). The cache is owned by the context and is thread-safe.
+ */
+void EnableClientSessionCache(::boost::asio::ssl::context* cntx);
+
 class HttpsClient {
  public:
   using error_code = ::boost::system::error_code;
@@ -63,6 +72,26 @@ class HttpsClient {
   error_code DrainResponse(
       ::boost::beast::http::response_parser<::boost::beast::http::buffer_body>* parser);
 
+  using ResponseHeader = ::boost::beast::http::response_header<>;
+
+  //! The default size of the chunks passed to the sink by Download().
+  static constexpr size_t kDownloadChunkSize = 1 << 16;
+
+  /*! @brief Sends http request and streams the body of a successful response into sink,
+   *         in chunks of up to chunk_size bytes.
+   *
+   *  The body is read into the buffer of sink->GetAppendBuffer() and the next chunk is read
+   *  only after sink->Append() returns, so a download of any size takes constant memory and
+   *  a slow sink throttles the connection. Sends and reads the header with retries like
+   *  Send(req, resp). If the status is not 2xx, drains the body and returns success,
+   *  the caller checks header->result(). If the sink fails, logs its status, schedules
+   *  a reconnect and returns operation_aborted. Use CallbackSink to consume the chunks
+   *  with a callback.
+   */
+  template <typename Req>
+  error_code Download(const Req& req, Sink* sink, ResponseHeader* header,
+                      size_t chunk_size = kDownloadChunkSize);
+
   SslStream* client() { return client_.get(); }
 
   void schedule_reconnect() { reconnect_needed_ = true; }
@@ -76,6 +105,16 @@ class HttpsClient {
 
   ::boost::asio::ssl::context& ssl_context() { return ssl_cntx_; }
 
+  //! True if the last handshake resumed a cached session.
+  bool session_reused() const;
+
+  /*! @brief Returns false if the idle connection can not be reused.
+   *
+   * An idle connection should not receive anything, so the unread bytes are usually the
+   * close_notify alert of a server that closed it. Does not block.
+   */
+  bool IsIdleHealthy() const;
+
   error_code status() const {
     namespace err = ::boost::asio::error;
 
@@ -99,6 +138,12 @@ class HttpsClient {
 
   error_code InitSslClient();
 
+  using DownloadParser = ::boost::beast::http::response_parser<::boost::beast::http::buffer_body>;
+
+  // Reads the body after the header has been read into parser.
+  error_code StreamBody(DownloadParser* parser, Sink* sink, size_t chunk_size,
+                        ResponseHeader* header);
+
   IoContext& io_context_;
   ::boost::asio::ssl::context& ssl_cntx_;
 
@@ -114,7 +159,8 @@ class HttpsClient {
   uint32_t retry_cnt_ = 1;
 };
 
-// ::boost::system::error_code SslConnect(SslStream* stream, unsigned msec);
+//! Connects the underlying socket and performs the client handshake.
+::boost::system::error_code SslConnect(SslStream* stream, unsigned msec);
 
 template <typename Req, typename Resp>
 auto HttpsClient::Send(const Req& req, Resp* resp) -> error_code {
@@ -139,6 +185,26 @@ auto HttpsClient::Send(const Req& req, Resp* resp) -> error_code {
   return HandleError(ec);
 }
 
+template <typename Req>
+auto HttpsClient::Download(const Req& req, Sink* sink, ResponseHeader* header, size_t chunk_size)
+    -> error_code {
+  // The parser can not be reset, hence a new one for each attempt.
+  absl::optional<DownloadParser> parser;
+  error_code ec;
+
+  for (uint32_t i = 0; i < retry_cnt_; ++i) {
+    ec = Send(req);
+    if (IsError(ec))  // Send already retries.
+      break;
+
+    parser.emplace().body_limit(kuint64max);
+    ec = ReadHeader(&*parser);
+    if (!IsError(ec))
+      return StreamBody(&*parser, sink, chunk_size, header);
+  }
+  return ec;
+}
+
 template <typename Req> auto HttpsClient::Send(const Req& req) -> error_code {
   error_code ec;
   for (uint32_t i = 0; i < retry_cnt_; ++i) {
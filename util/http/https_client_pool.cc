@@ -3,7 +3,11 @@
 //
 #include "util/http/https_client_pool.h"
 
+#include <boost/fiber/fiber.hpp>
+#include <vector>
+
 #include "base/logging.h"
+#include "base/walltime.h"
 #include "util/http/https_client.h"
 
 namespace util {
@@ -21,7 +25,7 @@ void HttpsClientPool::HandleGuard::operator()(HttpsClient* client) {
     delete client;
   } else {
     CHECK(pool_);
-    pool_->available_handles_.emplace_back(client);
+    pool_->available_handles_.push_back(IdleClient{client, base::GetMonotonicMicrosFast()});
   }
 }
 
@@ -30,20 +34,27 @@ HttpsClientPool::HttpsClientPool(const std::string& domain, ::boost::asio::ssl::
     : ssl_cntx_(*ssl_ctx), io_cntx_(*io_cntx), domain_(domain) {}
 
 HttpsClientPool::~HttpsClientPool() {
-  for (auto* ptr : available_handles_) {
-    delete ptr;
+  for (const auto& idle : available_handles_) {
+    delete idle.client;
   }
 }
 
 auto HttpsClientPool::GetHandle() -> ClientHandle {
+  uint64_t now = max_idle_msec_ ? base::GetMonotonicMicrosFast() : 0;
+
   while (!available_handles_.empty()) {
     // Pulling the oldest handles first.
-    std::unique_ptr<HttpsClient> ptr{std::move(available_handles_.front())};
+    IdleClient idle = available_handles_.front();
+    std::unique_ptr<HttpsClient> ptr{idle.client};
 
     available_handles_.pop_front();
 
-    if (ptr->status()) {
-      continue;  // we just throw a connection with error status.
+    // We just throw a connection that the server closed or that was idle for too long.
+    if (!ptr->IsIdleHealthy() ||
+        (max_idle_msec_ && now > idle.since_usec + max_idle_msec_ * 1000ULL)) {
+      VLOG(1) << "Dropping idle https client " << ptr->native_handle();
+      --existing_handles_;
+      continue;
     }
 
     VLOG(1) << "Reusing https client " << ptr->native_handle();
@@ -55,15 +66,47 @@ auto HttpsClientPool::GetHandle() -> ClientHandle {
   // available_handles_ are empty - create a new connection.
   VLOG(1) << "Creating a new https client";
 
+  return ClientHandle{Connect(), HandleGuard{this}};
+}
+
+unsigned HttpsClientPool::Prewarm(unsigned count) {
+  if (available_handles_.size() >= count)
+    return available_handles_.size();
+
+  // Seeds the session cache of the ssl context. The handle returns to the pool right away.
+  if (available_handles_.empty()) {
+    GetHandle();
+  }
+
+  std::vector<::boost::fibers::fiber> fibers;
+  std::vector<HttpsClient*> clients(count - available_handles_.size());
+  for (auto& client : clients) {
+    fibers.emplace_back([this, &client] { client = Connect(); });
+  }
+  for (auto& fb : fibers) {
+    fb.join();
+  }
+
+  // Like a released handle, a client that failed to connect is deleted.
+  for (HttpsClient* client : clients) {
+    HandleGuard{this}(client);
+  }
+  VLOG(1) << "Prewarmed " << available_handles_.size() << " connections to " << domain_;
+
+  return available_handles_.size();
+}
+
+HttpsClient* HttpsClientPool::Connect() {
   std::unique_ptr<HttpsClient> client(new HttpsClient{domain_, &io_cntx_, &ssl_cntx_});
   client->set_retry_count(retry_cnt_);
 
   auto ec = client->Connect(connect_msec_);
 
   LOG_IF(WARNING, ec) << "HttpsClientPool: Could not connect " << ec;
+  resumed_connects_ += client->session_reused();
   ++existing_handles_;
 
-  return ClientHandle{client.release(), HandleGuard{this}};
+  return client.release();
 }
 
 }  // namespace http
@@ -45,11 +45,22 @@ class HttpsClientPool {
    */
   ClientHandle GetHandle();
 
+  /*! @brief Opens connections ahead of demand until the pool has count idle ones.
+   *
+   * Must be called withing IoContext thread. The first connection does the full handshake
+   * and the rest are opened concurrently and resume its session. Blocks the calling fiber.
+   * Returns the number of the idle connections.
+   */
+  unsigned Prewarm(unsigned count);
+
   void set_connect_timeout(unsigned msec) { connect_msec_ = msec; }
 
   //! Sets number of retries for https client handles.
   void set_retry_count(uint32_t cnt) { retry_cnt_ = cnt; }
 
+  //! Connections that were idle for longer are closed instead of being reused. 0 - no limit.
+  void set_max_idle_msec(unsigned msec) { max_idle_msec_ = msec; }
+
   IoContext& io_context() { return io_cntx_; }
 
   //! Number of existing handles created by this pool.
@@ -57,16 +68,27 @@ class HttpsClientPool {
 
   const std::string domain() const { return domain_; }
 
+  //! Number of connections that resumed a cached TLS session.
+  unsigned resumed_count() const { return resumed_connects_; }
+
  private:
   using SslContext = ::boost::asio::ssl::context;
 
+  struct IdleClient {
+    HttpsClient* client;
+    uint64_t since_usec;
+  };
+
+  HttpsClient* Connect();
+
   SslContext& ssl_cntx_;
   IoContext& io_cntx_;
   std::string domain_;
-  unsigned connect_msec_ = 1000, retry_cnt_ = 1;
+  unsigned connect_msec_ = 1000, retry_cnt_ = 1, max_idle_msec_ = 0;
   int existing_handles_ = 0;
+  unsigned resumed_connects_ = 0;
 
-  std::deque<HttpsClient*> available_handles_;  // Using queue to allow round-robin access.
+  std::deque<IdleClient> available_handles_;  // Using queue to allow round-robin access.
 };
 
 }  // namespace http
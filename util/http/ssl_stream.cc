@@ -27,7 +27,7 @@ Engine::Engine(SSL_CTX* context) : ssl_(::SSL_new(context)) {
   ::SSL_set_mode(ssl_, SSL_MODE_RELEASE_BUFFERS);
 
   ::BIO* int_bio = 0;
-  ::BIO_new_bio_pair(&int_bio, 0, &ext_bio_, 0);
+  ::BIO_new_bio_pair(&int_bio, kBioSize, &ext_bio_, kBioSize);
   ::SSL_set_bio(ssl_, int_bio, int_bio);
 }
 
@@ -168,6 +168,10 @@ void Engine::AdvanceRead(size_t sz) {
   CHECK_EQ(sz, BIO_nread(ext_bio_, nullptr, sz));
 }
 
+bool Engine::HasBufferedInput() const {
+  return ::SSL_pending(ssl_) > 0 || ::BIO_ctrl_pending(::SSL_get_rbio(ssl_)) > 0;
+}
+
 const system::error_code& Engine::map_error_code(system::error_code& ec) const {
   // We only want to map the error::eof code.
   if (ec != asio::error::eof)
@@ -210,6 +214,33 @@ void SslStream::handshake(Impl::handshake_type type, error_code& ec) {
   IoLoop(cb, ec);
 }
 
+size_t SslStream::ReadBuffered(asio::mutable_buffer buf) {
+  using asio::ssl::detail::engine;
+  size_t res = 0;
+
+  while (buf.size() > 0 && engine_.HasBufferedInput()) {
+    error_code ec;
+    size_t sz = 0;
+    want op_code = engine_.read(buf, ec, sz);
+
+    // The errors and the partial records are left to the next read_some.
+    if (ec || op_code == engine::want_input_and_retry)
+      break;
+
+    // For example, a post-handshake message that needs a response.
+    if (op_code == engine::want_output || op_code == engine::want_output_and_retry) {
+      IoHandler(op_code, ec);
+      if (ec)
+        break;
+    } else if (sz == 0) {
+      break;
+    }
+    res += sz;
+    buf += sz;
+  }
+  return res;
+}
+
 void SslStream::IoHandler(want op_code, system::error_code& ec) {
   using asio::ssl::detail::engine;
   DVLOG(1) << "io_fun::start";
@@ -232,16 +263,21 @@ void SslStream::IoHandler(want op_code, system::error_code& ec) {
 
       DVLOG(2) << "engine::want_output"
                << (op_code == engine::want_output_and_retry ? "_and_retry" : "");
-      engine_.GetReadBuf(&cbuf);
+    {
+      std::lock_guard<fibers::mutex> lk(output_mu_);
 
-      // Get output data from the engine and write it to the underlying
-      // transport.
+      // Get output data from the engine and write it to the underlying transport.
+      // Another fiber might have flushed it while we waited for the lock.
+      engine_.GetReadBuf(&cbuf);
+      if (cbuf.size() == 0)
+        break;
 
       asio::write(next_layer_, cbuf, ec);
       if (!ec) {
         engine_.AdvanceRead(cbuf.size());
       }
       break;
+    }
 
     default:;
   }
@@ -5,6 +5,10 @@
 #pragma once
 
 #include <boost/asio/ssl/stream.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <cstring>
+#include <memory>
+
 #include "util/asio/fiber_socket.h"
 
 namespace util {
@@ -17,6 +21,10 @@ class Engine {
   using verify_mode = ::boost::asio::ssl::verify_mode;
   using want = ::boost::asio::ssl::detail::engine::want;
 
+  // The size of each side of the BIO pair between SSL and the socket. It holds several TLS
+  // records, so a socket read fetches several of them and a write flushes several at once.
+  static constexpr size_t kBioSize = 64 * 1024;
+
   // Construct a new engine for the specified context.
   explicit Engine(SSL_CTX* context);
 
@@ -56,6 +64,9 @@ class Engine {
   void GetReadBuf(boost::asio::const_buffer* cbuf);
   void AdvanceRead(size_t sz);
 
+  //! True if the engine holds decrypted data or received bytes that it has not processed yet.
+  bool HasBufferedInput() const;
+
   // Map an error::eof code returned by the underlying transport according to
   // the type and state of the SSL session. Returns a const reference to the
   // error code object, suitable for passing to a completion handler.
@@ -90,6 +101,12 @@ class Engine {
 
 }  // namespace detail
 
+// Supports one reading fiber and one writing fiber running concurrently, like HTTP/2
+// connections need. Renegotiation is not supported in that mode.
+//
+// write_some gathers the small buffers of a sequence into a single TLS record and read_some
+// decrypts the records it has already received until the buffer fills up, so the records
+// of a socket read do not need a read_some call each.
 class SslStream {
   using Impl = ::boost::asio::ssl::stream<FiberSyncSocket>;
 
@@ -97,6 +114,9 @@ class SslStream {
   SslStream& operator=(const SslStream&) = delete;
 
  public:
+  // Maximal plaintext size of a TLS record.
+  static constexpr size_t kMaxRecordPlaintext = 16 * 1024;
+
   using next_layer_type = Impl::next_layer_type;
   using lowest_layer_type = Impl::lowest_layer_type;
   using error_code = boost::system::error_code;
@@ -117,14 +137,15 @@ class SslStream {
   template <typename MBS> size_t read_some(const MBS& bufs, error_code& ec) {
     namespace a = ::boost::asio;
 
+    a::mutable_buffer buffer =
+        a::detail::buffer_sequence_adapter<a::mutable_buffer, MBS>::first(bufs);
     auto cb = [&](detail::Engine& eng, error_code& ec, size_t& bytes_transferred) {
-      a::mutable_buffer buffer =
-          a::detail::buffer_sequence_adapter<a::mutable_buffer, MBS>::first(bufs);
-
       return eng.read(buffer, ec, bytes_transferred);
     };
 
     size_t res = IoLoop(cb, ec);
+    if (!ec && res > 0)
+      res += ReadBuffered(buffer + res);
     last_err_ = ec;
     return res;
   }
@@ -137,9 +158,8 @@ class SslStream {
   //! https://www.boost.org/doc/libs/1_69_0/doc/html/boost_asio/reference/SyncWriteStream.html
   template <typename BS> size_t write_some(const BS& bufs, error_code& ec) {
     namespace a = ::boost::asio;
+    a::const_buffer buffer = Gather(bufs);
     auto cb = [&](detail::Engine& eng, error_code& ec, size_t& bytes_transferred) {
-      a::const_buffer buffer = a::detail::buffer_sequence_adapter<a::const_buffer, BS>::first(bufs);
-
       return eng.write(buffer, ec, bytes_transferred);
     };
 
@@ -170,12 +190,50 @@ class SslStream {
 
   void IoHandler(want op_code, boost::system::error_code& ec);
 
+  // Returns the first buffer of bufs unless it is smaller than a record and others follow.
+  // Then copies the buffers into wbuf_, up to a record.
+  template <typename BS> ::boost::asio::const_buffer Gather(const BS& bufs);
+
+  // Decrypts into buf what the engine has already received, does not read from the socket.
+  size_t ReadBuffered(::boost::asio::mutable_buffer buf);
+
   detail::Engine engine_;
   FiberSyncSocket next_layer_;
 
+  // Both the reader and the writer may flush the output of the engine, writes to the socket
+  // yield so they must not interleave.
+  ::boost::fibers::mutex output_mu_;
+
   error_code last_err_;
+
+  // Used by the writing fiber only.
+  std::unique_ptr<char[]> wbuf_;
 };
 
+template <typename BS> ::boost::asio::const_buffer SslStream::Gather(const BS& bufs) {
+  namespace a = ::boost::asio;
+  auto it = a::buffer_sequence_begin(bufs);
+  auto end = a::buffer_sequence_end(bufs);
+  if (it == end)
+    return a::const_buffer{};
+
+  a::const_buffer first = *it;
+  if (first.size() >= kMaxRecordPlaintext || std::next(it) == end)
+    return first;
+
+  if (!wbuf_)
+    wbuf_.reset(new char[kMaxRecordPlaintext]);
+
+  size_t len = 0;
+  for (; it != end && len < kMaxRecordPlaintext; ++it) {
+    a::const_buffer src = *it;
+    size_t sz = std::min(src.size(), kMaxRecordPlaintext - len);
+    memcpy(wbuf_.get() + len, src.data(), sz);
+    len += sz;
+  }
+  return a::const_buffer{wbuf_.get(), len};
+}
+
 template <typename Operation>
 std::size_t SslStream::IoLoop(const Operation& op, boost::system::error_code& ec) {
   using engine = ::boost::asio::ssl::detail::engine;
@@ -56,6 +56,30 @@ TEST_F(SslStreamTest, BIO_s_bio_ZeroCopy) {
   BIO_free(bio2);
 }
 
+// The engine reads from the socket into several records worth of space and detects the
+// received bytes that SSL has not consumed yet by the pending size of the internal side.
+TEST_F(SslStreamTest, BIO_s_bio_Pending) {
+  BIO *int_bio, *ext_bio;
+  constexpr size_t kSize = detail::Engine::kBioSize;
+  ASSERT_EQ(1, BIO_new_bio_pair(&int_bio, kSize, &ext_bio, kSize));
+
+  char* buf = nullptr;
+  ASSERT_EQ(kSize, BIO_nwrite0(ext_bio, &buf));
+  EXPECT_EQ(0, BIO_ctrl_pending(int_bio));
+
+  memset(buf, 'a', 3 * SslStream::kMaxRecordPlaintext);
+  EXPECT_EQ(3 * SslStream::kMaxRecordPlaintext,
+            BIO_nwrite(ext_bio, nullptr, 3 * SslStream::kMaxRecordPlaintext));
+  EXPECT_EQ(3 * SslStream::kMaxRecordPlaintext, BIO_ctrl_pending(int_bio));
+
+  char dest[100];
+  EXPECT_EQ(sizeof(dest), BIO_read(int_bio, dest, sizeof(dest)));
+  EXPECT_EQ(3 * SslStream::kMaxRecordPlaintext - sizeof(dest), BIO_ctrl_pending(int_bio));
+
+  BIO_free(int_bio);
+  BIO_free(ext_bio);
+}
+
 }  // namespace http
 
 }  // namespace util
@@ -3,9 +3,16 @@
 //
 #include "util/http/status_page.h"
 
+#include <algorithm>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/str_replace.h"
 #include "base/walltime.h"
 #include "util/proc_stats.h"
+#include "util/stats/proc_sampler.h"
+#include "util/stats/varz_history.h"
 #include "util/stats/varz_stats.h"
 
 namespace util {
@@ -33,6 +40,55 @@ string StatusLine(const string& name, const string& val) {
   res.append(name).append(":<span class='key_text'>").append(val).append("</span></div>\n");
   return res;
 }
+
+// The series names come from the varz maps and may hold any characters.
+void AppendJsonString(absl::string_view str, string* dest) {
+  dest->push_back('"');
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      dest->push_back('\\');
+      dest->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      absl::StrAppendFormat(dest, "\\u%04x", c);
+    } else {
+      dest->push_back(c);
+    }
+  }
+  dest->push_back('"');
+}
+
+void AppendHtmlEscaped(absl::string_view str, string* dest) {
+  for (char c : str) {
+    switch (c) {
+      case '<':
+        dest->append("&lt;");
+        break;
+      case '>':
+        dest->append("&gt;");
+        break;
+      case '&':
+        dest->append("&amp;");
+        break;
+      default:
+        dest->push_back(c);
+    }
+  }
+}
+
+// Inline svg polyline of the values, scaled to the box.
+void AppendSparkline(const vector<double>& values, string* dest) {
+  constexpr unsigned kWidth = 160, kHeight = 24;
+  absl::StrAppend(dest, "<svg width='", kWidth, "' height='", kHeight,
+                  "'><polyline fill='none' stroke='#36c' points='");
+  auto minmax = std::minmax_element(values.begin(), values.end());
+  double lo = *minmax.first, range = *minmax.second - lo;
+  double step = values.size() > 1 ? double(kWidth) / (values.size() - 1) : 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    double y = range > 0 ? (values[i] - lo) / range : 0.5;
+    absl::StrAppendFormat(dest, "%.1f,%.1f ", i * step, (1 - y) * (kHeight - 2) + 1);
+  }
+  dest->append("'/></svg>");
+}
 }  // namespace
 
 StringResponse BuildStatusPage(const QueryArgs& args, const char* resource_prefix) {
@@ -88,6 +144,18 @@ StringResponse BuildStatusPage(const QueryArgs& args, const char* resource_prefi
   a += StatusLine("Uptime", GetTimerString(time(NULL) - start_time));
   a += StatusLine("Render Latency", absl::StrCat(delta_ms, " ms"));
 
+  // The full series are under proc-stats.
+  if (ProcStatsSampler* sampler = ProcStatsSampler::global()) {
+    vector<ProcStatsSampler::Sample> samples = sampler->GetSamples();
+    if (samples.size() > 1) {
+      auto rates = ProcStatsSampler::Rates::Between(samples[samples.size() - 2], samples.back());
+      a += StatusLine("RSS", absl::StrCat(samples.back().proc.vm_rss / 1024, " MB"));
+      a += StatusLine("CPU", absl::StrFormat("%.1f%% user, %.1f%% sys, %.1f%% steal",
+                                             rates.user_cpu, rates.system_cpu, rates.steal_cpu));
+      a += StatusLine("Major Faults", absl::StrFormat("%.1f/s", rates.major_faults));
+    }
+  }
+
   a += R"(</div>
 </body>
 <script>
@@ -102,5 +170,85 @@ document.querySelector('.left_panel').innerHTML = JsonToHTML(json_text1);
   return response;
 }
 
+StringResponse BuildMetricsPage() {
+  // The page of the previous scrape is a good estimate, so the body is formatted in place
+  // without growing it.
+  static thread_local size_t last_size = 1 << 14;
+
+  StringResponse response(h2::status::ok, 11);
+  response.set(field::content_type, "text/plain; version=0.0.4");
+
+  string& body = response.body();
+  body.reserve(last_size + last_size / 8);
+  VarzListNode::FormatPrometheus(&body);
+  last_size = body.size();
+
+  return response;
+}
+
+StringResponse BuildVarzHistoryPage(const QueryArgs& args) {
+  StringResponse response(h2::status::ok, 11);
+  VarzHistory* history = VarzHistory::global();
+  if (!history) {
+    response.result(h2::status::not_found);
+    response.set(field::content_type, kTextMime);
+    response.body() = "The varz history is disabled, see --varz_history_sec\n";
+    return response;
+  }
+
+  absl::string_view prefix;
+  unsigned window_sec = history->window_sec();
+  bool output_json = false;
+  for (const auto& k_v : args) {
+    if (k_v.first == "name") {
+      prefix = k_v.second;
+    } else if (k_v.first == "window") {
+      if (!absl::SimpleAtoi(k_v.second, &window_sec) || window_sec == 0)
+        window_sec = history->window_sec();
+    } else if (k_v.first == "o" && k_v.second == "json") {
+      output_json = true;
+    }
+  }
+
+  vector<VarzHistory::Series> series = history->Query(prefix, window_sec);
+  string& body = response.body();
+
+  if (output_json) {
+    absl::StrAppend(&body, "{\"interval_sec\": ", history->interval_sec(),
+                    ", \"window_sec\": ", window_sec, ", \"series\": [");
+    for (size_t i = 0; i < series.size(); ++i) {
+      const VarzHistory::Series& s = series[i];
+      body.append(i ? ",\n{\"name\": " : "\n{\"name\": ");
+      AppendJsonString(s.name, &body);
+      absl::StrAppend(&body, ", \"last\": ", s.values.back(), ", \"rate_1m\": ", s.Rate(60),
+                      ", \"rate\": ", s.Rate(window_sec), ", \"times\": [",
+                      absl::StrJoin(s.time_ms, ","), "], \"values\": [",
+                      absl::StrJoin(s.values, ","), "]}");
+    }
+    body.append("]}\n");
+    response.set(field::content_type, kJsonMime);
+    return response;
+  }
+
+  body = "<!DOCTYPE html>\n<html><head>\n"
+         "<meta http-equiv='Content-Type' content='text/html; charset=UTF-8'/>\n</head>\n<body>\n";
+  absl::StrAppend(&body, "<div>", series.size(), " series over the last ", window_sec,
+                  " seconds, sampled every ", history->interval_sec(), " seconds</div>\n");
+  body.append("<table><tr><th>Name</th><th>Last</th><th>Rate/s 1m</th><th>Rate/s</th>"
+              "<th>Trend</th></tr>\n");
+  for (const VarzHistory::Series& s : series) {
+    body.append("<tr><td>");
+    AppendHtmlEscaped(s.name, &body);
+    absl::StrAppendFormat(&body, "</td><td>%g</td><td>%.3g</td><td>%.3g</td><td>",
+                          s.values.back(), s.Rate(60), s.Rate(window_sec));
+    AppendSparkline(s.values, &body);
+    body.append("</td></tr>\n");
+  }
+  body.append("</table>\n</body></html>\n");
+
+  response.set(field::content_type, kHtmlMime);
+  return response;
+}
+
 }  // namespace http
 }  // namespace util
@@ -2,6 +2,9 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include "util/math/float2decimal.h"
+
+#include <cmath>
+
 #include "base/logging.h"
 
 #define FAST_DTOA_UNREACHABLE() __builtin_unreachable();
@@ -689,6 +692,59 @@ char* FormatBuffer(char* buf, int k, int n) {
   return AppendExponent(buf, n - 1);
 }
 
+// Integers below 2^53 are exact doubles whose neighbours are at most 1 apart, so their
+// integer form is also their shortest round-trip representation.
+static constexpr double kMaxExactInteger = 9007199254740992.0;
+
+// Writes the decimal digits of 0 < val < 2^53.
+static char* FormatInteger(uint64_t val, char* dest) {
+  if (val < 100000000) {
+    unsigned len = base::CountDecimalDigit32(val);
+    SetDigits(val, len, dest);
+    return dest + len;
+  }
+
+  uint32_t hi = val / 100000000;
+  uint32_t lo = val % 100000000;
+  unsigned len = base::CountDecimalDigit32(hi);
+  SetDigits(hi, len, dest);
+  dest += len;
+
+  // SetDigits does not write the leading zeros of lo.
+  std::memset(dest, '0', 8);
+  SetDigits(lo, 8, dest);
+  return dest + 8;
+}
+
+char* ToStringBatch(const double* values, size_t n, char separator, char* dest) {
+  for (size_t i = 0; i < n; ++i) {
+    double v = values[i];
+
+    // Zeros take the ToString path because of the sign of -0.
+    int64_t iv = std::abs(v) < kMaxExactInteger ? static_cast<int64_t>(v) : 0;
+    if (iv != 0 && static_cast<double>(iv) == v) {
+      if (iv < 0) {
+        *dest++ = '-';
+      }
+      dest = FormatInteger(iv < 0 ? -iv : iv, dest);
+    } else {
+      dest = ToString(v, dest);
+    }
+    *dest++ = separator;
+  }
+
+  // Removes the last separator.
+  return n ? dest - 1 : dest;
+}
+
+void AppendBatch(const double* values, size_t n, char separator, std::string* dest) {
+  size_t start = dest->size();
+  dest->resize(start + n * (kMaxToStringLen + 1));
+  char* begin = &(*dest)[0];
+  char* end = ToStringBatch(values, n, separator, begin + start);
+  dest->resize(end - begin);
+}
+
 }  // namespace dtoa
 
 }  // namespace util
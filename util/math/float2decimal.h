@@ -41,6 +41,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <string>
 #include <utility>
 
 #include "util/math/ieeefloat.h"
@@ -52,6 +53,18 @@ namespace dtoa {
 
 template <typename Float> char* ToString(Float value, char* dest);
 
+// The maximal length of the output of ToString.
+constexpr unsigned kMaxToStringLen = 25;
+
+// Writes values[0], separator, values[1], ..., values[n - 1] each formatted like ToString and
+// returns the end of the output. dest should point to at least n * (kMaxToStringLen + 1) bytes.
+// Integral values below 2^53 skip Grisu and are printed directly, which makes the typical
+// columns of counts and ids several times faster.
+char* ToStringBatch(const double* values, size_t n, char separator, char* dest);
+
+// Appends the output of ToStringBatch to dest.
+void AppendBatch(const double* values, size_t n, char separator, std::string* dest);
+
 // TODO: to implement it.
 // Any non-special float number will have at most 17 significant decimal digits.
 // See https://en.wikipedia.org/wiki/Double-precision_floating-point_format#IEEE_754_double-precision_binary_floating-point_format:_binary64
@@ -7,6 +7,8 @@
 #include <random>
 #include <double-conversion/double-conversion.h>
 
+#include "absl/strings/str_cat.h"
+
 #include "base/gtest.h"
 #include "strings/stringpiece.h"
 
@@ -368,6 +370,41 @@ TEST_F(Float2DecimalTest, Decimal) {
   EXPECT_EQ(-739761, val);
 }
 
+TEST_F(Float2DecimalTest, Batch) {
+  const double kMax = 9007199254740992.0;  // 2^53
+  std::vector<double> vals = {0.0, -0.0, 1, -1, 10, 100, 12345678, 123456789, -987654321012,
+                              99999999, 100000000, 100000001, kMax - 1, -(kMax - 1), kMax,
+                              kMax * 2, 1e21, 1e22, 0.5, -73.9761, 1e-7,
+                              std::numeric_limits<double>::quiet_NaN(),
+                              std::numeric_limits<double>::infinity(),
+                              -std::numeric_limits<double>::infinity(),
+                              std::numeric_limits<double>::max(),
+                              std::numeric_limits<double>::denorm_min()};
+  std::mt19937_64 rnd(10);
+  for (unsigned i = 0; i < 1000; ++i) {
+    vals.push_back(static_cast<int64_t>(rnd() >> (i % 64)) * (i % 2 ? 1 : -1));
+    vals.push_back(IEEEFloat<double>(rnd()).value);
+  }
+
+  std::string expected;
+  char buf[32];
+  for (size_t i = 0; i < vals.size(); ++i) {
+    if (i)
+      expected.push_back(',');
+    expected.append(buf, dtoa::ToString(vals[i], buf));
+  }
+
+  std::string batch("prefix");
+  dtoa::AppendBatch(vals.data(), vals.size(), ',', &batch);
+  EXPECT_EQ("prefix" + expected, batch);
+
+  batch.clear();
+  dtoa::AppendBatch(vals.data(), 0, ',', &batch);
+  EXPECT_EQ("", batch);
+  dtoa::AppendBatch(vals.data() + 2, 1, ',', &batch);
+  EXPECT_EQ("1", batch);
+}
+
 static void BM_LoopSingle(benchmark::State& state) {
   int const min_exp = 0;
   int const max_exp = (1 << 8) - 1; // exclusive!
@@ -427,6 +464,59 @@ static void BM_LoopDouble(benchmark::State& state) {
 }
 BENCHMARK(BM_LoopDouble)->Arg(1 << 10);
 
+// Half of the values are integral, like the typical counters in text outputs.
+static std::vector<double> MixedDoubles(size_t count) {
+  RandomDoubles rng;
+  std::vector<double> vals(count);
+  for (size_t i = 0; i < count; ++i) {
+    vals[i] = i % 2 ? rng() : static_cast<double>(rng.random_() % 10000000);
+  }
+  return vals;
+}
+
+static void BM_DoubleSingleValue(benchmark::State& state) {
+  std::vector<double> vals = MixedDoubles(state.range(0));
+  std::string dest;
+  char buf[32];
+  while (state.KeepRunning()) {
+    dest.clear();
+    for (double v : vals) {
+      dest.append(buf, dtoa::ToString(v, buf));
+      dest.push_back(',');
+    }
+    benchmark::DoNotOptimize(dest.data());
+  }
+  state.SetItemsProcessed(state.iterations() * vals.size());
+}
+BENCHMARK(BM_DoubleSingleValue)->Arg(1 << 10);
+
+static void BM_DoubleBatch(benchmark::State& state) {
+  std::vector<double> vals = MixedDoubles(state.range(0));
+  std::string dest;
+  while (state.KeepRunning()) {
+    dest.clear();
+    dtoa::AppendBatch(vals.data(), vals.size(), ',', &dest);
+    benchmark::DoNotOptimize(dest.data());
+  }
+  state.SetItemsProcessed(state.iterations() * vals.size());
+}
+BENCHMARK(BM_DoubleBatch)->Arg(1 << 10);
+
+// absl prints 6 significant digits, so it does not round-trip, but is a common baseline.
+static void BM_DoubleStrCat(benchmark::State& state) {
+  std::vector<double> vals = MixedDoubles(state.range(0));
+  std::string dest;
+  while (state.KeepRunning()) {
+    dest.clear();
+    for (double v : vals) {
+      absl::StrAppend(&dest, v, ",");
+    }
+    benchmark::DoNotOptimize(dest.data());
+  }
+  state.SetItemsProcessed(state.iterations() * vals.size());
+}
+BENCHMARK(BM_DoubleStrCat)->Arg(1 << 10);
+
 static void BM_DoubleDecimal(benchmark::State& state) {
   uint64_t bits = 0;
 
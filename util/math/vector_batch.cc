@@ -0,0 +1,207 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/math/vector_batch.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+#include "util/math/matrix3x3-inl.h"
+
+namespace util {
+namespace math {
+
+static_assert(sizeof(Vector2_d) == 2 * sizeof(double), "Vector2_d must be x, y");
+
+static inline const double* Coords(const Vector2_d* v) {
+  return reinterpret_cast<const double*>(v);
+}
+
+static inline double* Coords(Vector2_d* v) { return reinterpret_cast<double*>(v); }
+
+#ifdef __AVX2__
+
+// Returns the sums of adjacent pairs of the 4 points in lo and hi, i.e. of x * x' and y * y'
+// of 4 consecutive points in order.
+static inline __m256d PairSums(__m256d lo, __m256d hi) {
+  // hadd interleaves the 128 bit lanes: lo[01], hi[01], lo[23], hi[23].
+  return _mm256_permute4x64_pd(_mm256_hadd_pd(lo, hi), 0xD8);
+}
+
+static inline __m256d PairDiffs(__m256d lo, __m256d hi) {
+  return _mm256_permute4x64_pd(_mm256_hsub_pd(lo, hi), 0xD8);
+}
+
+#endif
+
+void Transform(const Matrix3x3_d& m, const Vector2_d* src, size_t n, Vector2_d* dest) {
+  const double* s = Coords(src);
+  double* d = Coords(dest);
+  size_t i = 0;
+
+#ifdef __AVX2__
+  // Two points per register: x0 y0 x1 y1.
+  __m256d col_x = _mm256_setr_pd(m(0, 0), m(1, 0), m(0, 0), m(1, 0));
+  __m256d col_y = _mm256_setr_pd(m(0, 1), m(1, 1), m(0, 1), m(1, 1));
+  __m256d shift = _mm256_setr_pd(m(0, 2), m(1, 2), m(0, 2), m(1, 2));
+  for (; i + 2 <= n; i += 2) {
+    __m256d v = _mm256_loadu_pd(s + 2 * i);
+    __m256d xx = _mm256_movedup_pd(v);
+    __m256d yy = _mm256_permute_pd(v, 0xF);
+    __m256d res = _mm256_add_pd(_mm256_mul_pd(xx, col_x), _mm256_mul_pd(yy, col_y));
+    _mm256_storeu_pd(d + 2 * i, _mm256_add_pd(res, shift));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    double x = s[2 * i], y = s[2 * i + 1];
+    d[2 * i] = m(0, 0) * x + m(0, 1) * y + m(0, 2);
+    d[2 * i + 1] = m(1, 0) * x + m(1, 1) * y + m(1, 2);
+  }
+}
+
+void Transform(const Matrix3x3_d& m, const double* x, const double* y, const double* z,
+               size_t n, double* dx, double* dy, double* dz) {
+  size_t i = 0;
+
+#ifdef __AVX2__
+  __m256d mm[3][3];
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      mm[r][c] = _mm256_set1_pd(m(r, c));
+    }
+  }
+
+  for (; i + 4 <= n; i += 4) {
+    __m256d vx = _mm256_loadu_pd(x + i);
+    __m256d vy = _mm256_loadu_pd(y + i);
+    __m256d vz = _mm256_loadu_pd(z + i);
+    __m256d res[3];
+    for (int r = 0; r < 3; ++r) {
+      res[r] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(mm[r][0], vx),
+                                           _mm256_mul_pd(mm[r][1], vy)),
+                             _mm256_mul_pd(mm[r][2], vz));
+    }
+    _mm256_storeu_pd(dx + i, res[0]);
+    _mm256_storeu_pd(dy + i, res[1]);
+    _mm256_storeu_pd(dz + i, res[2]);
+  }
+#endif
+
+  for (; i < n; ++i) {
+    double vx = x[i], vy = y[i], vz = z[i];
+    dx[i] = m(0, 0) * vx + m(0, 1) * vy + m(0, 2) * vz;
+    dy[i] = m(1, 0) * vx + m(1, 1) * vy + m(1, 2) * vz;
+    dz[i] = m(2, 0) * vx + m(2, 1) * vy + m(2, 2) * vz;
+  }
+}
+
+void DotProd(const Vector2_d* a, const Vector2_d* b, size_t n, double* dest) {
+  const double* pa = Coords(a);
+  const double* pb = Coords(b);
+  size_t i = 0;
+
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    __m256d lo = _mm256_mul_pd(_mm256_loadu_pd(pa + 2 * i), _mm256_loadu_pd(pb + 2 * i));
+    __m256d hi = _mm256_mul_pd(_mm256_loadu_pd(pa + 2 * i + 4), _mm256_loadu_pd(pb + 2 * i + 4));
+    _mm256_storeu_pd(dest + i, PairSums(lo, hi));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    dest[i] = pa[2 * i] * pb[2 * i] + pa[2 * i + 1] * pb[2 * i + 1];
+  }
+}
+
+void CrossProd(const Vector2_d* a, const Vector2_d* b, size_t n, double* dest) {
+  const double* pa = Coords(a);
+  const double* pb = Coords(b);
+  size_t i = 0;
+
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    // x * y' and y * x'.
+    __m256d lo = _mm256_mul_pd(_mm256_loadu_pd(pa + 2 * i),
+                               _mm256_permute_pd(_mm256_loadu_pd(pb + 2 * i), 0x5));
+    __m256d hi = _mm256_mul_pd(_mm256_loadu_pd(pa + 2 * i + 4),
+                               _mm256_permute_pd(_mm256_loadu_pd(pb + 2 * i + 4), 0x5));
+    _mm256_storeu_pd(dest + i, PairDiffs(lo, hi));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    dest[i] = pa[2 * i] * pb[2 * i + 1] - pa[2 * i + 1] * pb[2 * i];
+  }
+}
+
+void Norm(const Vector2_d* src, size_t n, double* dest) {
+  const double* s = Coords(src);
+  size_t i = 0;
+
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    __m256d lo = _mm256_loadu_pd(s + 2 * i);
+    __m256d hi = _mm256_loadu_pd(s + 2 * i + 4);
+    __m256d norm2 = PairSums(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi));
+    _mm256_storeu_pd(dest + i, _mm256_sqrt_pd(norm2));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    dest[i] = std::sqrt(s[2 * i] * s[2 * i] + s[2 * i + 1] * s[2 * i + 1]);
+  }
+}
+
+void Norm(const double* x, const double* y, size_t n, double* dest) {
+  size_t i = 0;
+
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    __m256d vx = _mm256_loadu_pd(x + i);
+    __m256d vy = _mm256_loadu_pd(y + i);
+    __m256d norm2 = _mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy));
+    _mm256_storeu_pd(dest + i, _mm256_sqrt_pd(norm2));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    dest[i] = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+  }
+}
+
+double PathLength(const Vector2_d* points, size_t n) {
+  if (n < 2)
+    return 0;
+
+  const double* s = Coords(points);
+  size_t num_segments = n - 1;
+  size_t i = 0;
+  double length = 0;
+
+#ifdef __AVX2__
+  // Segments i, ..., i + 3 are the differences between the points shifted by one.
+  __m256d sum = _mm256_setzero_pd();
+  for (; i + 4 <= num_segments; i += 4) {
+    __m256d lo = _mm256_sub_pd(_mm256_loadu_pd(s + 2 * i + 2), _mm256_loadu_pd(s + 2 * i));
+    __m256d hi = _mm256_sub_pd(_mm256_loadu_pd(s + 2 * i + 6), _mm256_loadu_pd(s + 2 * i + 4));
+    __m256d norm2 = PairSums(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi));
+    sum = _mm256_add_pd(sum, _mm256_sqrt_pd(norm2));
+  }
+  double parts[4];
+  _mm256_storeu_pd(parts, sum);
+  length = (parts[0] + parts[1]) + (parts[2] + parts[3]);
+#endif
+
+  for (; i < num_segments; ++i) {
+    double dx = s[2 * i + 2] - s[2 * i], dy = s[2 * i + 3] - s[2 * i + 1];
+    length += std::sqrt(dx * dx + dy * dy);
+  }
+  return length;
+}
+
+}  // namespace math
+}  // namespace util
@@ -0,0 +1,44 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <cstddef>
+
+#include "util/math/matrix3x3.h"
+#include "util/math/vector2.h"
+
+// Kernels that apply the same operation to arrays of points, vectorized with AVX2 when the build
+// enables it. The arrays of Vector2_d are used as is, i.e. as interleaved x, y coordinates.
+// The 3D kernels work on parallel coordinate arrays (structure of arrays) because
+// the interleaved Vector3 layout does not fit the vector registers.
+// The output arrays may be the same as the input ones but must not partially overlap them.
+namespace util {
+namespace math {
+
+// dest[i] = m * (src[i], 1), i.e. the affine transform whose linear part is the upper left 2x2
+// block of m and the translation is the third column. The last row of m is ignored.
+void Transform(const Matrix3x3_d& m, const Vector2_d* src, size_t n, Vector2_d* dest);
+
+// (dx[i], dy[i], dz[i]) = m * (x[i], y[i], z[i]).
+void Transform(const Matrix3x3_d& m, const double* x, const double* y, const double* z,
+               size_t n, double* dx, double* dy, double* dz);
+
+// dest[i] = a[i].DotProd(b[i]).
+void DotProd(const Vector2_d* a, const Vector2_d* b, size_t n, double* dest);
+
+// dest[i] = a[i].CrossProd(b[i]).
+void CrossProd(const Vector2_d* a, const Vector2_d* b, size_t n, double* dest);
+
+// dest[i] = src[i].Norm().
+void Norm(const Vector2_d* src, size_t n, double* dest);
+
+// dest[i] = sqrt(x[i]^2 + y[i]^2).
+void Norm(const double* x, const double* y, size_t n, double* dest);
+
+// Returns the length of the polyline points[0], ..., points[n - 1], i.e. the sum of
+// the distances between the consecutive points.
+double PathLength(const Vector2_d* points, size_t n);
+
+}  // namespace math
+}  // namespace util
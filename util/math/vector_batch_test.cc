@@ -0,0 +1,167 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/math/vector_batch.h"
+
+#include <random>
+
+#include "base/gtest.h"
+#include "util/math/matrix3x3-inl.h"
+#include "util/math/vector2-inl.h"
+
+namespace util {
+namespace math {
+
+using namespace std;
+
+class VectorBatchTest : public testing::Test {
+ protected:
+  // Sizes that exercise the vector loops and their tails.
+  static constexpr size_t kSizes[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 33};
+
+  static vector<Vector2_d> RandomPoints(size_t n) {
+    uniform_real_distribution<double> dist(-100, 100);
+    vector<Vector2_d> res;
+    for (size_t i = 0; i < n; ++i) {
+      res.emplace_back(dist(rnd_), dist(rnd_));
+    }
+    return res;
+  }
+
+  static mt19937 rnd_;
+};
+
+// The scalar code may use fused multiply-add, so the results can differ in the last bits.
+#define EXPECT_CLOSE(expected, actual) \
+  EXPECT_NEAR(expected, actual, 1e-12 * (1 + std::abs(expected)))
+
+constexpr size_t VectorBatchTest::kSizes[];
+mt19937 VectorBatchTest::rnd_(10);
+
+TEST_F(VectorBatchTest, Transform2) {
+  Matrix3x3_d m(1, 2, 3, -4, 5, 6, 0, 0, 1);
+  for (size_t n : kSizes) {
+    vector<Vector2_d> src = RandomPoints(n), dest(n);
+    Transform(m, src.data(), n, dest.data());
+    for (size_t i = 0; i < n; ++i) {
+      Vector3_d expected = m * Vector3_d(src[i].x(), src[i].y(), 1);
+      EXPECT_CLOSE(expected.x(), dest[i].x()) << n << " " << i;
+      EXPECT_CLOSE(expected.y(), dest[i].y()) << n << " " << i;
+    }
+
+    // In place.
+    Transform(m, src.data(), n, src.data());
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ(dest[i], src[i]);
+    }
+  }
+}
+
+TEST_F(VectorBatchTest, Transform3) {
+  Matrix3x3_d m(1, 2, 3, -4, 5, 6, 7, -8, 9);
+  for (size_t n : kSizes) {
+    vector<Vector2_d> xy = RandomPoints(n), zw = RandomPoints(n);
+    vector<double> x, y, z, dx(n), dy(n), dz(n);
+    for (size_t i = 0; i < n; ++i) {
+      x.push_back(xy[i].x());
+      y.push_back(xy[i].y());
+      z.push_back(zw[i].x());
+    }
+    Transform(m, x.data(), y.data(), z.data(), n, dx.data(), dy.data(), dz.data());
+    for (size_t i = 0; i < n; ++i) {
+      Vector3_d expected = m * Vector3_d(x[i], y[i], z[i]);
+      EXPECT_CLOSE(expected.x(), dx[i]);
+      EXPECT_CLOSE(expected.y(), dy[i]);
+      EXPECT_CLOSE(expected.z(), dz[i]);
+    }
+  }
+}
+
+TEST_F(VectorBatchTest, Products) {
+  for (size_t n : kSizes) {
+    vector<Vector2_d> a = RandomPoints(n), b = RandomPoints(n);
+    vector<double> dot(n), cross(n), norm(n), norm_soa(n), x, y;
+    DotProd(a.data(), b.data(), n, dot.data());
+    CrossProd(a.data(), b.data(), n, cross.data());
+    Norm(a.data(), n, norm.data());
+    for (const auto& v : a) {
+      x.push_back(v.x());
+      y.push_back(v.y());
+    }
+    Norm(x.data(), y.data(), n, norm_soa.data());
+
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_CLOSE(a[i].DotProd(b[i]), dot[i]) << n << " " << i;
+      EXPECT_CLOSE(a[i].CrossProd(b[i]), cross[i]) << n << " " << i;
+      EXPECT_CLOSE(a[i].Norm(), norm[i]) << n << " " << i;
+      EXPECT_CLOSE(a[i].Norm(), norm_soa[i]) << n << " " << i;
+    }
+  }
+}
+
+TEST_F(VectorBatchTest, PathLength) {
+  for (size_t n : kSizes) {
+    vector<Vector2_d> points = RandomPoints(n);
+    double expected = 0;
+    for (size_t i = 1; i < n; ++i) {
+      expected += (points[i] - points[i - 1]).Norm();
+    }
+    EXPECT_NEAR(expected, PathLength(points.data(), n), 1e-9) << n;
+  }
+
+  Vector2_d square[] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}, {0, 0}, {3, 4}};
+  EXPECT_DOUBLE_EQ(9, PathLength(square, 6));
+}
+
+static void BM_Transform2(benchmark::State& state) {
+  vector<Vector2_d> points(state.range(0), Vector2_d(1, 2));
+  Matrix3x3_d m(1, 2, 3, -4, 5, 6, 0, 0, 1);
+  while (state.KeepRunning()) {
+    Transform(m, points.data(), points.size(), points.data());
+    benchmark::DoNotOptimize(points.data());
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_Transform2)->Arg(1 << 12);
+
+static void BM_TransformScalar(benchmark::State& state) {
+  vector<Vector2_d> points(state.range(0), Vector2_d(1, 2));
+  Matrix3x3_d m(1, 2, 3, -4, 5, 6, 0, 0, 1);
+  while (state.KeepRunning()) {
+    for (auto& p : points) {
+      Vector3_d v = m * Vector3_d(p.x(), p.y(), 1);
+      p.Set(v.x(), v.y());
+    }
+    benchmark::DoNotOptimize(points.data());
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_TransformScalar)->Arg(1 << 12);
+
+static void BM_PathLength(benchmark::State& state) {
+  vector<Vector2_d> points(state.range(0), Vector2_d(1, 2));
+  for (size_t i = 0; i < points.size(); ++i)
+    points[i].Set(i, i % 7);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(PathLength(points.data(), points.size()));
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_PathLength)->Arg(1 << 12);
+
+static void BM_PathLengthScalar(benchmark::State& state) {
+  vector<Vector2_d> points(state.range(0), Vector2_d(1, 2));
+  for (size_t i = 0; i < points.size(); ++i)
+    points[i].Set(i, i % 7);
+  while (state.KeepRunning()) {
+    double length = 0;
+    for (size_t i = 1; i < points.size(); ++i)
+      length += (points[i] - points[i - 1]).Norm();
+    benchmark::DoNotOptimize(length);
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_PathLengthScalar)->Arg(1 << 12);
+
+}  // namespace math
+}  // namespace util
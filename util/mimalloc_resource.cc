@@ -0,0 +1,93 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/mimalloc_resource.h"
+
+#include <mimalloc.h>
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_bool(mi_thread_heap, false, "If true, every IO thread allocates its thread-affine "
+            "buffers from its own mimalloc heap");
+
+namespace util {
+
+namespace {
+
+thread_local MiMallocResource* thread_resource = nullptr;
+
+// The resources are never deleted, because the blocks that they allocated may be freed
+// after their thread exits.
+std::mutex resources_mu;
+std::vector<MiMallocResource*> resources;
+
+VarzValue::Map GetHeapStats() {
+  VarzValue::Map res;
+  std::lock_guard<std::mutex> lk(resources_mu);
+  for (size_t i = 0; i < resources.size(); ++i) {
+    const auto& stats = resources[i]->stats();
+    VarzValue::Map heap;
+    heap.emplace_back("allocs", VarzValue::FromInt(stats.allocs.load(std::memory_order_relaxed)));
+    heap.emplace_back("frees", VarzValue::FromInt(stats.frees.load(std::memory_order_relaxed)));
+    heap.emplace_back("bytes_in_use",
+                      VarzValue::FromInt(stats.bytes_in_use.load(std::memory_order_relaxed)));
+    res.emplace_back(absl::StrCat("heap", i), std::move(heap));
+  }
+  return res;
+}
+
+VarzFunction mi_heap_varz("mi-heaps", GetHeapStats);
+
+}  // namespace
+
+void* MiMallocResource::do_allocate(std::size_t bytes, std::size_t alignment) {
+  void* res = heap_ ? mi_heap_malloc_aligned(heap_, bytes, alignment)
+                    : mi_malloc_aligned(bytes, alignment);
+  if (!res)
+    throw std::bad_alloc();
+
+  stats_.allocs.fetch_add(1, std::memory_order_relaxed);
+  stats_.bytes_in_use.fetch_add(bytes, std::memory_order_relaxed);
+  return res;
+}
+
+void MiMallocResource::do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+  stats_.frees.fetch_add(1, std::memory_order_relaxed);
+  stats_.bytes_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+  mi_free(ptr);
+}
+
+void InitThreadHeap() {
+  if (!FLAGS_mi_thread_heap || thread_resource)
+    return;
+
+  mi_heap_t* heap = mi_heap_new();
+  CHECK(heap);
+  thread_resource = new MiMallocResource(heap);
+
+  std::lock_guard<std::mutex> lk(resources_mu);
+  resources.push_back(thread_resource);
+}
+
+void DestroyThreadHeap() {
+  if (!thread_resource)
+    return;
+
+  mi_heap_delete(thread_resource->heap_);
+
+  // Frees of the existing blocks still go through the resource.
+  thread_resource->heap_ = nullptr;
+  thread_resource = nullptr;
+}
+
+pmr::memory_resource* ThreadMemoryResource() {
+  return thread_resource ? thread_resource : pmr::get_default_resource();
+}
+
+}  // namespace util
@@ -0,0 +1,65 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <pmr/polymorphic_allocator.h>
+
+#include <atomic>
+#include <cstddef>
+
+struct mi_heap_s;
+
+namespace util {
+
+/**
+ * @brief pmr resource that allocates from a mimalloc heap of the owning thread.
+ *
+ * Only the thread that created the heap may allocate from the resource. Any thread may
+ * deallocate: mi_free puts the blocks freed by other threads on the delayed free list of
+ * their page, which the owner collects without locks.
+ */
+class MiMallocResource : public pmr::memory_resource {
+ public:
+  struct Stats {
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<int64_t> bytes_in_use{0};  // by the requested sizes.
+  };
+
+  //! nullptr heap allocates from the default heap of the calling thread.
+  explicit MiMallocResource(mi_heap_s* heap) : heap_(heap) {}
+
+  mi_heap_s* heap() const { return heap_; }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  friend void DestroyThreadHeap();
+
+  void* do_allocate(std::size_t bytes, std::size_t alignment) final;
+  void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) final;
+
+  bool do_is_equal(const pmr::memory_resource& o) const noexcept final {
+    // All mimalloc blocks are freed the same way.
+    return dynamic_cast<const MiMallocResource*>(&o) != nullptr;
+  }
+
+  mi_heap_s* heap_;
+  Stats stats_;
+};
+
+//! With --mi_thread_heap creates the mimalloc heap of the calling thread. Proactor and IoContext
+//! call it when their loop starts.
+void InitThreadHeap();
+
+//! Deletes the heap of the calling thread. The blocks that are still allocated move to
+//! the default heap of the thread and stay valid.
+void DestroyThreadHeap();
+
+//! Returns the resource over the heap of the calling thread or pmr::get_default_resource()
+//! if the thread has none. Thread-affine subsystems should allocate their buffers from it.
+//! The memory of the two must not be mixed, e.g. by swapping buffers between containers that
+//! were created with different resources.
+pmr::memory_resource* ThreadMemoryResource();
+
+}  // namespace util
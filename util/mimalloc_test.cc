@@ -6,12 +6,18 @@
 #include <mimalloc.h>
 #include <sys/mman.h>  // mmap
 
+#include <thread>
+
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "absl/strings/str_cat.h"
+#include "base/pod_array.h"
+#include "util/mimalloc_resource.h"
 
 using namespace std;
 
+DECLARE_bool(mi_thread_heap);
+
 namespace util {
 
 static void StatsPrint(const char* msg, void* arg) {
@@ -130,6 +136,36 @@ TEST_F(MimallocTest, Heap) {
   mi_stats_print_out(&StatsPrint, nullptr);
 }
 
+TEST_F(MimallocTest, ThreadResource) {
+  EXPECT_EQ(pmr::get_default_resource(), ThreadMemoryResource());
+
+  FLAGS_mi_thread_heap = true;
+  InitThreadHeap();
+  auto* mr = dynamic_cast<MiMallocResource*>(ThreadMemoryResource());
+  ASSERT_TRUE(mr);
+
+  base::PODArray<uint8_t> arr(mr);
+  arr.resize(1000);
+  EXPECT_TRUE(mi_heap_check_owned(mr->heap(), arr.data()));
+  EXPECT_EQ(1, mr->stats().allocs);
+  EXPECT_EQ(arr.allocated_size(), mr->stats().bytes_in_use);
+
+  // Frees from other threads go to the delayed free lists of the heap.
+  void* ptr = mr->allocate(128, 16);
+  std::thread([&] { mr->deallocate(ptr, 128, 16); }).join();
+  mi_heap_collect(mr->heap(), false);
+  EXPECT_EQ(1, mr->stats().frees);
+
+  // The blocks of the deleted heap stay valid.
+  DestroyThreadHeap();
+  FLAGS_mi_thread_heap = false;
+  EXPECT_EQ(pmr::get_default_resource(), ThreadMemoryResource());
+  arr.resize(5000);
+  arr[4999] = 1;
+  arr = base::PODArray<uint8_t>(mr);
+  EXPECT_EQ(0, mr->stats().bytes_in_use);
+}
+
 TEST_F(MimallocTest, HeapLargeAlloc) {
   mi_heap_t* heap = mi_heap_new();
   void* ptr = mi_heap_malloc(heap, 1 << 25);  // 32MB
@@ -6,10 +6,19 @@
 #include <google/protobuf/reflection.h>
 #include <google/protobuf/repeated_field.h>
 #include <rapidjson/error/en.h>
+#include <rapidjson/internal/dtoa.h>
 #include <rapidjson/reader.h>
-#include <rapidjson/writer.h>
 
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/inlined_vector.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/types/optional.h"
@@ -26,151 +35,341 @@ namespace util {
 namespace {
 
 typedef gpb::FieldDescriptor FD;
-using RapidWriter =
-    rj::Writer<rj::StringBuffer, rj::UTF8<>, rj::UTF8<>, rj::CrtAllocator, rj::kWriteNanAndInfFlag>;
 
-void PrintValue(const gpb::Message& msg, const Pb2JsonOptions& options,
-                const gpb::FieldDescriptor* fd, const gpb::Reflection* refl, RapidWriter* res);
-void PrintRepeated(const gpb::Message& msg, const Pb2JsonOptions& options,
-                   const gpb::FieldDescriptor* fd, const gpb::Reflection* refl, RapidWriter* res);
+// Escapes like rapidjson::Writer: the control characters, quotes and backslashes.
+// The rest, including non-ASCII characters, are copied as is.
+inline bool NeedsEscape(char c) {
+  return uint8_t(c) < 0x20 || c == '"' || c == '\\';
+}
 
-void Pb2JsonInternal(const ::google::protobuf::Message& msg, const Pb2JsonOptions& options,
-                     RapidWriter* res) {
-  const gpb::Descriptor* descr = msg.GetDescriptor();
-  const gpb::Reflection* refl = msg.GetReflection();
-  res->StartObject();
+void AppendEscapedChar(char c, string* dest) {
+  static constexpr char kHex[] = "0123456789ABCDEF";
+  char buf[6] = {'\\', c, 0, 0, 0, 0};
+  unsigned len = 2;
+
+  switch (c) {
+    case '\b':
+      buf[1] = 'b';
+      break;
+    case '\f':
+      buf[1] = 'f';
+      break;
+    case '\n':
+      buf[1] = 'n';
+      break;
+    case '\r':
+      buf[1] = 'r';
+      break;
+    case '\t':
+      buf[1] = 't';
+      break;
+    case '"':
+    case '\\':
+      break;
+    default:
+      memcpy(buf + 1, "u00", 3);
+      buf[4] = kHex[uint8_t(c) >> 4];
+      buf[5] = kHex[c & 0xF];
+      len = 6;
+  }
+  dest->append(buf, len);
+}
+
+// Appends the quoted and escaped str. Copies the runs of the characters that do not need
+// escaping as a whole, finding their ends 16 bytes at a time.
+void AppendJsonString(absl::string_view str, string* dest) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+
+  dest->push_back('"');
+  while (p < end) {
+    const char* run = p;
+#ifdef __SSE2__
+    const __m128i kMaxCtrl = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, kMaxCtrl), kMaxCtrl);
+      __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+      __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+      unsigned mask = _mm_movemask_epi8(_mm_or_si128(ctrl, _mm_or_si128(quote, slash)));
+      if (mask) {
+        p += __builtin_ctz(mask);
+        break;
+      }
+    }
+#endif
+    while (p < end && !NeedsEscape(*p))
+      ++p;
+    dest->append(run, p - run);
+    if (p == end)
+      break;
+    AppendEscapedChar(*p++, dest);
+  }
+  dest->push_back('"');
+}
+
+template <typename T> void AppendInt(T val, string* dest) {
+  char buf[absl::numbers_internal::kFastToBufferSize];
+  char* end = absl::numbers_internal::FastIntToBuffer(val, buf);
+  dest->append(buf, end - buf);
+}
+
+// Follows rapidjson::Writer with kWriteNanAndInfFlag and 9 max decimal places.
+void AppendDouble(double d, string* dest) {
+  if (std::isnan(d)) {
+    dest->append("NaN");
+  } else if (std::isinf(d)) {
+    dest->append(d < 0 ? "-Infinity" : "Infinity");
+  } else {
+    char buf[32];
+    char* end = rj::internal::dtoa(d, buf, 9);
+    dest->append(buf, end - buf);
+  }
+}
+
+void AppendFloat(float f, string* dest) {
+  char buf[40];
+  int sz = absl::SNPrintF(buf, sizeof(buf), "%.7g", f);
+  dest->append(buf, sz);
+}
+
+void AppendBool(bool b, string* dest) {
+  dest->append(b ? "true" : "false");
+}
+
+// Appends the elements of the repeated field separated by commas.
+template <FD::CppType t, typename F>
+void AppendArr(const gpb::Message& msg, const FD* fd, const gpb::Reflection* refl, F f,
+               string* dest) {
+  using CppType = typename pb::FD_Traits_t<t>;
+  const auto& arr = refl->GetRepeatedFieldRef<CppType>(msg, fd);
+  bool first = true;
+  for (const auto& val : arr) {
+    if (!first)
+      dest->push_back(',');
+    first = false;
+    f(val, dest);
+  }
+}
+
+}  // namespace
+
+struct Pb2JsonPrinter::Field {
+  // How to print the field, resolved from its type and the options.
+  enum Kind : uint8_t { DEFAULT, BOOL_AS_INT, ENUM_AS_INT };
+
+  const FD* fd;
+  string key;  // Quoted, escaped and followed by the colon.
+  Kind kind = DEFAULT;
+  Plan* child = nullptr;  // The plan of the message fields, resolved upon the first use.
+};
+
+struct Pb2JsonPrinter::Plan {
+  std::vector<Field> fields;
+};
+
+Pb2JsonPrinter::Pb2JsonPrinter(const Pb2JsonOptions& options) : options_(options) {
+}
+
+Pb2JsonPrinter::~Pb2JsonPrinter() {
+}
+
+auto Pb2JsonPrinter::GetPlan(const gpb::Descriptor* descr) -> Plan* {
+  auto& plan = plans_[descr];
+  if (plan)
+    return plan.get();
+
+  plan.reset(new Plan);
   for (int i = 0; i < descr->field_count(); ++i) {
-    const gpb::FieldDescriptor* fd = descr->field(i);
+    const FD* fd = descr->field(i);
+    const string& fname = options_.field_name_cb ? options_.field_name_cb(*fd) : fd->name();
+    if (fname.empty())
+      continue;
+
+    Field field;
+    field.fd = fd;
+    AppendJsonString(fname, &field.key);
+    field.key.push_back(':');
+
+    if (fd->cpp_type() == FD::CPPTYPE_BOOL && options_.bool_as_int && options_.bool_as_int(*fd))
+      field.kind = Field::BOOL_AS_INT;
+
+    // Repeated enums are always printed by name.
+    if (fd->cpp_type() == FD::CPPTYPE_ENUM && options_.enum_as_ints && !fd->is_repeated())
+      field.kind = Field::ENUM_AS_INT;
+    plan->fields.push_back(std::move(field));
+  }
+
+  return plan.get();
+}
+
+void Pb2JsonPrinter::Print(const gpb::Message& msg, string* dest) {
+  PrintMessage(msg, GetPlan(msg.GetDescriptor()), dest);
+}
+
+void Pb2JsonPrinter::PrintMessage(const gpb::Message& msg, Plan* plan, string* dest) {
+  const gpb::Reflection* refl = msg.GetReflection();
+  bool first = true;
+
+  dest->push_back('{');
+  for (Field& field : plan->fields) {
+    const FD* fd = field.fd;
     bool is_set = (fd->is_repeated() && refl->FieldSize(msg, fd) > 0) || fd->is_required() ||
                   (fd->is_optional() && refl->HasField(msg, fd));
     if (!is_set)
       continue;
 
-    const string& fname = options.field_name_cb ? options.field_name_cb(*fd) : fd->name();
-    if (fname.empty())
-      continue;
-    res->Key(fname.c_str(), fname.size());
+    if (!first)
+      dest->push_back(',');
+    first = false;
+    dest->append(field.key);
+
     if (fd->is_repeated()) {
-      PrintRepeated(msg, options, fd, refl, res);
+      PrintRepeated(msg, &field, dest);
     } else {
-      PrintValue(msg, options, fd, refl, res);
+      PrintValue(msg, &field, dest);
     }
   }
-  res->EndObject();
+  dest->push_back('}');
 }
 
-void PrintValue(const gpb::Message& msg, const Pb2JsonOptions& options,
-                const gpb::FieldDescriptor* fd, const gpb::Reflection* refl, RapidWriter* res) {
+void Pb2JsonPrinter::PrintValue(const gpb::Message& msg, Field* field, string* dest) {
+  const FD* fd = field->fd;
+  const gpb::Reflection* refl = msg.GetReflection();
+
   switch (fd->cpp_type()) {
     case FD::CPPTYPE_INT32:
-      res->Int(refl->GetInt32(msg, fd));
+      AppendInt(refl->GetInt32(msg, fd), dest);
       break;
     case FD::CPPTYPE_UINT32:
-      res->Uint(refl->GetUInt32(msg, fd));
+      AppendInt(refl->GetUInt32(msg, fd), dest);
       break;
     case FD::CPPTYPE_INT64:
-      res->Int64(refl->GetInt64(msg, fd));
+      AppendInt(refl->GetInt64(msg, fd), dest);
       break;
     case FD::CPPTYPE_UINT64:
-      res->Uint64(refl->GetUInt64(msg, fd));
+      AppendInt(refl->GetUInt64(msg, fd), dest);
+      break;
+    case FD::CPPTYPE_FLOAT:
+      AppendFloat(refl->GetFloat(msg, fd), dest);
       break;
-    case FD::CPPTYPE_FLOAT: {
-      float fval = refl->GetFloat(msg, fd);
-      char buf[40];
-      int sz = absl::SNPrintF(buf, sizeof(buf), "%.7g", fval);
-      res->RawValue(buf, sz, rj::kNumberType);
-    } break;
     case FD::CPPTYPE_DOUBLE:
-      res->Double(refl->GetDouble(msg, fd));
+      AppendDouble(refl->GetDouble(msg, fd), dest);
       break;
     case FD::CPPTYPE_STRING: {
       string scratch;
       const string& value = refl->GetStringReference(msg, fd, &scratch);
-      res->String(value.c_str(), value.size());
+      AppendJsonString(value, dest);
     } break;
     case FD::CPPTYPE_BOOL: {
       bool b = refl->GetBool(msg, fd);
+
       // Unfortunate hack in our company code.
-      if (options.bool_as_int && options.bool_as_int(*fd)) {
-        res->Int(int(b));
+      if (field->kind == Field::BOOL_AS_INT) {
+        dest->push_back(b ? '1' : '0');
       } else {
-        res->Bool(b);
+        AppendBool(b, dest);
       }
     } break;
-
     case FD::CPPTYPE_ENUM:
-      if (options.enum_as_ints) {
-        res->Int(refl->GetEnum(msg, fd)->number());
+      if (field->kind == Field::ENUM_AS_INT) {
+        AppendInt(refl->GetEnum(msg, fd)->number(), dest);
       } else {
-        const auto& tmp = refl->GetEnum(msg, fd)->name();
-        res->String(tmp.c_str(), tmp.size());
+        AppendJsonString(refl->GetEnum(msg, fd)->name(), dest);
       }
       break;
     case FD::CPPTYPE_MESSAGE:
-      Pb2JsonInternal(refl->GetMessage(msg, fd), options, res);
+      if (!field->child)
+        field->child = GetPlan(fd->message_type());
+      PrintMessage(refl->GetMessage(msg, fd), field->child, dest);
       break;
     default:
       LOG(FATAL) << "Not supported field " << fd->cpp_type_name();
   }
 }
 
-template <FD::CppType t, typename Cb>
-void UnwindArr(const gpb::Message& msg, const gpb::FieldDescriptor* fd, const gpb::Reflection* refl,
-               Cb cb) {
-  using CppType = typename pb::FD_Traits_t<t>;
-  const auto& arr = refl->GetRepeatedFieldRef<CppType>(msg, fd);
-  std::for_each(std::begin(arr), std::end(arr), cb);
-}
+void Pb2JsonPrinter::PrintRepeated(const gpb::Message& msg, Field* field, string* dest) {
+  const FD* fd = field->fd;
+  const gpb::Reflection* refl = msg.GetReflection();
+
+  auto append_int = [](auto val, string* dest) { AppendInt(val, dest); };
 
-void PrintRepeated(const gpb::Message& msg, const Pb2JsonOptions& options,
-                   const gpb::FieldDescriptor* fd, const gpb::Reflection* refl, RapidWriter* res) {
-  res->StartArray();
+  dest->push_back('[');
   switch (fd->cpp_type()) {
     case FD::CPPTYPE_INT32:
-      UnwindArr<FD::CPPTYPE_INT32>(msg, fd, refl, [res](auto val) { res->Int(val); });
+      AppendArr<FD::CPPTYPE_INT32>(msg, fd, refl, append_int, dest);
       break;
     case FD::CPPTYPE_UINT32:
-      UnwindArr<FD::CPPTYPE_UINT32>(msg, fd, refl, [res](auto val) { res->Uint(val); });
+      AppendArr<FD::CPPTYPE_UINT32>(msg, fd, refl, append_int, dest);
       break;
     case FD::CPPTYPE_INT64:
-      UnwindArr<FD::CPPTYPE_INT64>(msg, fd, refl, [res](auto val) { res->Int64(val); });
+      AppendArr<FD::CPPTYPE_INT64>(msg, fd, refl, append_int, dest);
       break;
     case FD::CPPTYPE_UINT64:
-      UnwindArr<FD::CPPTYPE_UINT64>(msg, fd, refl, [res](auto val) { res->Uint64(val); });
+      AppendArr<FD::CPPTYPE_UINT64>(msg, fd, refl, append_int, dest);
       break;
     case FD::CPPTYPE_FLOAT:
-      UnwindArr<FD::CPPTYPE_FLOAT>(msg, fd, refl, [res](auto val) { res->Double(val); });
+      AppendArr<FD::CPPTYPE_FLOAT>(msg, fd, refl, AppendDouble, dest);
       break;
     case FD::CPPTYPE_DOUBLE:
-      UnwindArr<FD::CPPTYPE_DOUBLE>(msg, fd, refl, [res](auto val) { res->Double(val); });
-      break;
-    case FD::CPPTYPE_STRING:
-      UnwindArr<FD::CPPTYPE_STRING>(
-          msg, fd, refl, [res](const string& val) { res->String(val.c_str(), val.size()); });
+      AppendArr<FD::CPPTYPE_DOUBLE>(msg, fd, refl, AppendDouble, dest);
       break;
+    case FD::CPPTYPE_STRING: {
+      string scratch;
+      int sz = refl->FieldSize(msg, fd);
+      for (int i = 0; i < sz; ++i) {
+        if (i)
+          dest->push_back(',');
+        AppendJsonString(refl->GetRepeatedStringReference(msg, fd, i, &scratch), dest);
+      }
+    } break;
     case FD::CPPTYPE_BOOL:
-      UnwindArr<FD::CPPTYPE_BOOL>(msg, fd, refl, [res](auto val) { res->Bool(val); });
+      AppendArr<FD::CPPTYPE_BOOL>(msg, fd, refl, AppendBool, dest);
       break;
-
     case FD::CPPTYPE_ENUM: {
       int sz = refl->FieldSize(msg, fd);
       for (int i = 0; i < sz; ++i) {
-        const gpb::EnumValueDescriptor* edescr = refl->GetRepeatedEnum(msg, fd, i);
-        const string& name = edescr->name();
-        res->String(name.c_str(), name.size());
+        if (i)
+          dest->push_back(',');
+        AppendJsonString(refl->GetRepeatedEnum(msg, fd, i)->name(), dest);
       }
     } break;
     case FD::CPPTYPE_MESSAGE: {
-      const auto& arr = refl->GetRepeatedFieldRef<gpb::Message>(msg, fd);
-      std::unique_ptr<gpb::Message> scratch_space(arr.NewMessage());
-      for (int i = 0; i < arr.size(); ++i) {
-        Pb2JsonInternal(arr.Get(i, scratch_space.get()), options, res);
+      if (!field->child)
+        field->child = GetPlan(fd->message_type());
+      int sz = refl->FieldSize(msg, fd);
+      for (int i = 0; i < sz; ++i) {
+        if (i)
+          dest->push_back(',');
+        PrintMessage(refl->GetRepeatedMessage(msg, fd, i), field->child, dest);
       }
     } break;
     default:
       LOG(FATAL) << "Not supported field " << fd->cpp_type_name();
   }
-  res->EndArray();
+  dest->push_back(']');
+}
+
+namespace {
+
+// Looks up the fields by their json keys without copying the keys. Caches the lookup tables
+// of the generated messages, their descriptors are never destroyed.
+const FD* FindField(const gpb::Descriptor* descr, absl::string_view name) {
+  if (descr->file()->pool() != gpb::DescriptorPool::generated_pool())
+    return descr->FindFieldByName(string(name));
+
+  using FieldMap = absl::flat_hash_map<absl::string_view, const FD*>;
+  static thread_local absl::flat_hash_map<const gpb::Descriptor*, FieldMap> cache;
+
+  FieldMap& fields = cache[descr];
+  if (fields.empty()) {
+    for (int i = 0; i < descr->field_count(); ++i) {
+      const FD* fd = descr->field(i);
+      fields.emplace(fd->name(), fd);
+    }
+  }
+  auto it = fields.find(name);
+  return it == fields.end() ? nullptr : it->second;
 }
 
 class PbHandler {
@@ -239,7 +438,7 @@ class PbHandler {
 
   absl::InlinedVector<Object, 16> stack_;
   const gpb::FieldDescriptor* field_ = nullptr;
-  string key_name_;
+  absl::string_view key_name_;  // Points into the in-situ parsed json.
 
   unsigned disabled_level_ = 0;
 };
@@ -249,13 +448,10 @@ bool PbHandler::Key(const Ch* str, size_t len, bool copy) {
     return true;
   }
 
-  key_name_.assign(str, len);
+  key_name_ = absl::string_view(str, len);
 
   DCHECK(!stack_.empty());
-  auto& obj = stack_.back();
-
-  const auto& msg = *obj.msg;
-  field_ = msg.GetDescriptor()->FindFieldByName(key_name_);
+  field_ = FindField(stack_.back().msg->GetDescriptor(), key_name_);
 
   return field_ != nullptr || opts_.skip_unknown_fields;
 }
@@ -264,10 +460,8 @@ bool PbHandler::String(const Ch* str, size_t len, bool) {
   DCHECK(!stack_.empty());
   auto& obj = stack_.back();
 
-  const string str_val(str, len);
-
   if (obj.arr_ref) {
-    obj.GetArray<FD::CPPTYPE_STRING>().Add(str_val);
+    obj.GetArray<FD::CPPTYPE_STRING>().Add(string(str, len));
     return true;
   }
 
@@ -276,10 +470,11 @@ bool PbHandler::String(const Ch* str, size_t len, bool) {
 
   switch (field_->cpp_type()) {
     case FD::CPPTYPE_STRING:
-      obj.refl->SetString(obj.msg, field_, str_val);
+      obj.refl->SetString(obj.msg, field_, string(str, len));
       break;
     case FD::CPPTYPE_ENUM: {
-      const gpb::EnumValueDescriptor* ev = field_->enum_type()->FindValueByName(str_val);
+      const gpb::EnumValueDescriptor* ev =
+          field_->enum_type()->FindValueByName(string(str, len));
       if (!ev)
         return false;
       obj.refl->SetEnum(obj.msg, field_, ev);
@@ -452,7 +647,7 @@ bool PbHandler::Uint(unsigned i) {
       err_msg = absl::StrCat("Unexpected Uint type ", field_->cpp_type_name());
       return false;
   }
-  key_name_.clear();
+  key_name_ = absl::string_view();
 
   return true;
 }
@@ -476,7 +671,7 @@ bool PbHandler::Int64(int64_t i) {
     default:
       return false;
   }
-  key_name_.clear();
+  key_name_ = absl::string_view();
 
   return true;
 }
@@ -500,7 +695,7 @@ bool PbHandler::Uint64(uint64_t i) {
       err_msg = absl::StrCat("Unexpected Uint64 type ", field_->cpp_type_name());
       return false;
   }
-  key_name_.clear();
+  key_name_ = absl::string_view();
 
   return true;
 }
@@ -524,7 +719,7 @@ bool PbHandler::Double(double i) {
       err_msg = absl::StrCat("Unexpected Double type ", field_->cpp_type_name());
       return false;
   }
-  key_name_.clear();
+  key_name_ = absl::string_view();
 
   return true;
 }
@@ -683,7 +878,7 @@ bool PbHandler::EndArray(size_t elementCount) {
     DCHECK(obj.arr_ref);
     obj.arr_ref.reset();
     field_ = nullptr;
-    key_name_.clear();
+    key_name_ = absl::string_view();
   }
   return true;
 }
@@ -691,19 +886,31 @@ bool PbHandler::EndArray(size_t elementCount) {
 }  // namespace
 
 std::string Pb2Json(const ::google::protobuf::Message& msg, const Pb2JsonOptions& options) {
-  rj::StringBuffer sb;
-  RapidWriter rw(sb);
-  rw.SetMaxDecimalPlaces(9);
-
-  Pb2JsonInternal(msg, options, &rw);
-  return string(sb.GetString(), sb.GetSize());
+  // Without callbacks the options are plain flags, so the plans of the generated messages
+  // can be cached for all the calls of the thread. Dynamic descriptors may be destroyed,
+  // as well as the callbacks, hence those are planned per call.
+  if (!options.field_name_cb && !options.bool_as_int &&
+      msg.GetDescriptor()->file()->pool() == gpb::DescriptorPool::generated_pool()) {
+    static thread_local Pb2JsonPrinter by_name;
+    static thread_local Pb2JsonPrinter by_number([] {
+      Pb2JsonOptions opts;
+      opts.enum_as_ints = true;
+      return opts;
+    }());
+    return (options.enum_as_ints ? by_number : by_name).Print(msg);
+  }
+  return Pb2JsonPrinter(options).Print(msg);
 }
 
 Status Json2Pb(std::string json, ::google::protobuf::Message* msg, const Json2PbOptions& opts) {
+  return Json2PbInsitu(&json.front(), msg, opts);
+}
+
+Status Json2PbInsitu(char* json, ::google::protobuf::Message* msg, const Json2PbOptions& opts) {
   rj::Reader reader;
 
   PbHandler h(opts, msg);
-  rj::InsituStringStream stream(&json.front());
+  rj::InsituStringStream stream(json);
 
   rj::ParseResult pr = reader.Parse<rj::kParseInsituFlag | rj::kParseTrailingCommasFlag>(stream, h);
   if (pr.IsError()) {
@@ -4,7 +4,9 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 #include <google/protobuf/message.h>
 
@@ -26,14 +28,54 @@ struct Pb2JsonOptions {
 std::string Pb2Json(const ::google::protobuf::Message& msg,
                     const Pb2JsonOptions& options = Pb2JsonOptions());
 
+// Prints messages as json like Pb2Json. Upon the first use of a message type compiles its
+// printing plan: the fields with their json keys already escaped and the options resolved.
+// Hence the callbacks of the options are called once per field rather than per message.
+// Descriptors must outlive the printer. Not thread-safe.
+class Pb2JsonPrinter {
+ public:
+  explicit Pb2JsonPrinter(const Pb2JsonOptions& options = Pb2JsonOptions());
+  ~Pb2JsonPrinter();
+
+  // Appends the json of msg to dest.
+  void Print(const ::google::protobuf::Message& msg, std::string* dest);
+
+  std::string Print(const ::google::protobuf::Message& msg) {
+    std::string res;
+    Print(msg, &res);
+    return res;
+  }
+
+ private:
+  struct Field;
+  struct Plan;
+
+  Plan* GetPlan(const ::google::protobuf::Descriptor* descr);
+  void PrintMessage(const ::google::protobuf::Message& msg, Plan* plan, std::string* dest);
+  void PrintValue(const ::google::protobuf::Message& msg, Field* field, std::string* dest);
+  void PrintRepeated(const ::google::protobuf::Message& msg, Field* field, std::string* dest);
+
+  Pb2JsonOptions options_;
+  std::unordered_map<const ::google::protobuf::Descriptor*, std::unique_ptr<Plan>> plans_;
+
+  Pb2JsonPrinter(const Pb2JsonPrinter&) = delete;
+  void operator=(const Pb2JsonPrinter&) = delete;
+};
+
 struct Json2PbOptions {
   bool skip_unknown_fields;
 
   Json2PbOptions(bool sk = true) : skip_unknown_fields(sk) {}
 };
 
+// Parses json into msg field by field with the SAX api of rapidjson, no DOM is built.
 Status Json2Pb(std::string json, ::google::protobuf::Message* msg, const Json2PbOptions& options);
 
+// Like Json2Pb but parses the null-terminated json in place, which overwrites it.
+// Avoids copying the input when the caller owns a mutable buffer, like the one of LineReader.
+Status Json2PbInsitu(char* json, ::google::protobuf::Message* msg,
+                     const Json2PbOptions& options = Json2PbOptions());
+
 inline Status Json2Pb(std::string json, ::google::protobuf::Message* msg,
                       bool skip_unknown_fields = true) {
   return Json2Pb(std::move(json), msg, Json2PbOptions(skip_unknown_fields));
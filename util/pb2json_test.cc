@@ -166,6 +166,101 @@ TEST_F(Pb2JsonTest, Options) {
   EXPECT_EQ(R"({"bval":1})", res);
 }
 
+TEST_F(Pb2JsonTest, EscapeLong) {
+  // The special characters fall on the different offsets of the 16 byte chunks.
+  Person person;
+  string name, expected;
+  for (unsigned i = 0; i < 100; ++i) {
+    string run(i % 19, 'a' + i % 26);
+    name += run;
+    expected += run;
+    switch (i % 4) {
+      case 0:
+        name += '\n';
+        expected += "\\n";
+        break;
+      case 1:
+        name += '"';
+        expected += "\\\"";
+        break;
+      case 2:
+        name += '\x1f';
+        expected += "\\u001F";
+        break;
+      default:
+        name += "\xD7\xA9";  // Non-ASCII characters are not escaped.
+        expected += "\xD7\xA9";
+    }
+  }
+  person.set_name(name);
+  person.set_id(1);
+
+  EXPECT_EQ(absl::StrCat(R"({"name":")", expected, R"(","id":1,"dval":0.0})"), Pb2Json(person));
+}
+
+TEST_F(Pb2JsonTest, Printer) {
+  AddressBook book;
+  book.add_ts(-5);
+  book.add_ts(6);
+  book.add_tmp(std::numeric_limits<uint64_t>::max());
+  Person* p = book.add_person();
+  p->set_name("a");
+  p->set_id(1);
+  p->mutable_account()->add_activity_id(7);
+  p = book.add_person();
+  p->set_name("b");
+  p->set_id(2);
+  (*book.mutable_ids())[3] = "c";
+
+  const char kBook[] = R"({"person":[{"name":"a","id":1,"account":{"activity_id":[7]},)"
+                       R"("dval":0.0},{"name":"b","id":2,"dval":0.0}],"ts":[-5,6],)"
+                       R"("tmp":[18446744073709551615],"ids":[{"key":3,"value":"c"}]})";
+  EXPECT_EQ(kBook, Pb2Json(book));
+
+  Pb2JsonOptions options;
+  unsigned calls = 0;
+  options.field_name_cb = [&](const FieldDescriptor& fd) {
+    ++calls;
+    return fd.name() == "ts" ? string() : fd.name();
+  };
+
+  // The printer appends and calls the callbacks once per field.
+  Pb2JsonPrinter printer(options);
+  string res("x");
+  printer.Print(book, &res);
+  printer.Print(book, &res);
+  const char kNoTs[] = R"({"person":[{"name":"a","id":1,"account":{"activity_id":[7]},)"
+                       R"("dval":0.0},{"name":"b","id":2,"dval":0.0}],)"
+                       R"("tmp":[18446744073709551615],"ids":[{"key":3,"value":"c"}]})";
+  EXPECT_EQ(absl::StrCat("x", kNoTs, kNoTs), res);
+  unsigned num_fields = AddressBook::descriptor()->field_count() +
+                        Person::descriptor()->field_count() +
+                        BankAccount::descriptor()->field_count() + 2 /* map entry */;
+  EXPECT_EQ(num_fields, calls);
+}
+
+static void BM_Pb2Json(benchmark::State& state) {
+  AddressBook book;
+  for (unsigned i = 0; i < 10; ++i) {
+    Person* p = book.add_person();
+    p->set_name(absl::StrCat("some person name ", i));
+    p->set_id(i * 1000);
+    p->set_email("person@example.com");
+    p->set_dval(i * 1.5);
+    p->add_tag("tag");
+    p->add_phone()->set_number("+1-555-0100");
+  }
+
+  Pb2JsonPrinter printer;
+  string res;
+  while (state.KeepRunning()) {
+    res.clear();
+    printer.Print(book, &res);
+  }
+  state.SetBytesProcessed(state.iterations() * res.size());
+}
+BENCHMARK(BM_Pb2Json);
+
 TEST_F(Pb2JsonTest, ParseBasic) {
   Person person;
   auto status =
@@ -226,6 +321,48 @@ TEST_F(Pb2JsonTest, ParseRepeated) {
   )"));
 }
 
+TEST_F(Pb2JsonTest, ParseInsitu) {
+  Person person;
+  person.set_name("Ro\"man");
+  person.set_id(5);
+  person.set_dval(1.5);
+  person.add_tag("a");
+  person.add_phone()->set_number("1");
+  person.mutable_account()->set_bank_name("Leumi");
+
+  string json = Pb2Json(person);
+  Person parsed;
+  ASSERT_THAT(Json2PbInsitu(&json.front(), &parsed), StatusOk());
+  EXPECT_EQ(person.DebugString(), parsed.DebugString());
+
+  // The keys are looked up without copying them, also the unknown ones.
+  char kUnknown[] = R"({"id": 7, "unknown": [1, 2], "name": "x"})";
+  ASSERT_THAT(Json2PbInsitu(kUnknown, &parsed), StatusOk());
+  EXPECT_EQ(7, parsed.id());
+  EXPECT_EQ("x", parsed.name());
+}
+
+static void BM_Json2Pb(benchmark::State& state) {
+  AddressBook book;
+  for (unsigned i = 0; i < 10; ++i) {
+    Person* p = book.add_person();
+    p->set_name(absl::StrCat("some person name ", i));
+    p->set_id(i * 1000);
+    p->set_email("person@example.com");
+    p->add_tag("tag");
+  }
+  const string json = Pb2Json(book);
+  string buf;
+
+  while (state.KeepRunning()) {
+    buf = json;
+    book.Clear();
+    benchmark::DoNotOptimize(Json2PbInsitu(&buf.front(), &book));
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_Json2Pb);
+
 TEST_F(Pb2JsonTest, Unknown) {
   JsonParse parse;
   Json2PbOptions opts(true);
@@ -139,6 +139,18 @@ public:
     return lit;
   }
 
+  ExprValue value() const {
+    switch (val_type_) {
+    case ValType::UINT64:
+      return ExprValue::fromUInt(val_.uval);
+    case ValType::SINT64:
+      return ExprValue::fromInt(val_.signed_val);
+    case ValType::DOUBLE:
+      break;
+    }
+    return ExprValue::fromDouble(val_.dval);
+  }
+
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override {
     switch (val_type_) {
     case ValType::UINT64:
@@ -163,6 +175,7 @@ public:
 
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
   const std::string& val() const { return val_; }
+  Type type() const { return type_; }
 private:
   Type type_;
 };
@@ -191,6 +204,9 @@ public:
   ~FunctionTerm();
 
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+
+  const std::string& name() const { return name_; }
+  const ArgList& args() const { return args_; }
 };
 
 class IsDefFun : public Expr {
@@ -198,6 +214,8 @@ class IsDefFun : public Expr {
 public:
   IsDefFun(const std::string& name) : name_(name) {};
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+
+  const std::string& name() const { return name_; }
 };
 
 bool EvaluateBoolExpr(const Expr& e, const gpb::Message& msg);
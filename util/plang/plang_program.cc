@@ -0,0 +1,505 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/plang/plang_program.h"
+
+#include <forward_list>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/reflection.h>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_split.h"
+#include "base/logging.h"
+#include "strings/hash.h"
+
+namespace plang {
+
+using std::string;
+
+namespace {
+
+typedef gpb::FieldDescriptor FD;
+typedef std::vector<const FD*> FieldPath;
+typedef absl::InlinedVector<ExprValue, 4> Values;
+typedef absl::InlinedVector<const gpb::Message*, 4> Messages;
+
+// Reflection may copy a string into the buffer we pass instead of returning a reference to
+// the field. Such copies are kept here so that they outlive the next reflection call.
+class StringStore {
+ public:
+  StringPiece Get(const gpb::Message& msg, const FD* fd) {
+    return Keep(msg.GetReflection()->GetStringReference(msg, fd, &tmp_));
+  }
+
+  StringPiece GetRepeated(const gpb::Message& msg, const FD* fd, int index) {
+    return Keep(msg.GetReflection()->GetRepeatedStringReference(msg, fd, index, &tmp_));
+  }
+
+  void Clear() { copies_.clear(); }
+
+ private:
+  StringPiece Keep(const string& s) {
+    if (&s != &tmp_)
+      return s;
+    copies_.push_front(std::move(tmp_));
+    return copies_.front();
+  }
+
+  string tmp_;
+  std::forward_list<string> copies_;
+};
+
+ExprValue GetValue(const gpb::Message& msg, const FD* fd, StringStore* store) {
+  const gpb::Reflection* refl = msg.GetReflection();
+
+  switch (fd->cpp_type()) {
+    case FD::CPPTYPE_INT32:
+      return ExprValue::fromInt(refl->GetInt32(msg, fd));
+    case FD::CPPTYPE_UINT32:
+      return ExprValue::fromUInt(refl->GetUInt32(msg, fd));
+    case FD::CPPTYPE_INT64:
+      return ExprValue::fromInt(refl->GetInt64(msg, fd));
+    case FD::CPPTYPE_UINT64:
+      return ExprValue::fromUInt(refl->GetUInt64(msg, fd));
+    case FD::CPPTYPE_STRING:
+      return ExprValue(store->Get(msg, fd));
+    case FD::CPPTYPE_FLOAT:
+      return ExprValue::fromDouble(refl->GetFloat(msg, fd));
+    case FD::CPPTYPE_DOUBLE:
+      return ExprValue::fromDouble(refl->GetDouble(msg, fd));
+    case FD::CPPTYPE_BOOL:
+      return ExprValue::fromInt(refl->GetBool(msg, fd));
+    case FD::CPPTYPE_ENUM:
+      return ExprValue(refl->GetEnum(msg, fd));
+    default:
+      LOG(FATAL) << "Not supported yet " << fd->cpp_type_name();
+  }
+  return ExprValue{};
+}
+
+template <typename T, typename F>
+void AppendNumbers(const gpb::Message& msg, const FD* fd, F f, Values* dest) {
+  for (T val : msg.GetReflection()->GetRepeatedFieldRef<T>(msg, fd)) {
+    dest->push_back(f(val));
+  }
+}
+
+void AppendRepeated(const gpb::Message& msg, const FD* fd, StringStore* store, Values* dest) {
+  switch (fd->cpp_type()) {
+    case FD::CPPTYPE_INT32:
+      AppendNumbers<int32>(msg, fd, ExprValue::fromInt, dest);
+      return;
+    case FD::CPPTYPE_UINT32:
+      AppendNumbers<uint32>(msg, fd, ExprValue::fromUInt, dest);
+      return;
+    case FD::CPPTYPE_INT64:
+      AppendNumbers<int64>(msg, fd, ExprValue::fromInt, dest);
+      return;
+    case FD::CPPTYPE_UINT64:
+      AppendNumbers<uint64>(msg, fd, ExprValue::fromUInt, dest);
+      return;
+    case FD::CPPTYPE_FLOAT:
+      AppendNumbers<float>(msg, fd, ExprValue::fromDouble, dest);
+      return;
+    case FD::CPPTYPE_DOUBLE:
+      AppendNumbers<double>(msg, fd, ExprValue::fromDouble, dest);
+      return;
+    case FD::CPPTYPE_BOOL:
+      AppendNumbers<bool>(msg, fd, ExprValue::fromInt, dest);
+      return;
+    default:
+      break;
+  }
+
+  const gpb::Reflection* refl = msg.GetReflection();
+  int size = refl->FieldSize(msg, fd);
+  for (int i = 0; i < size; ++i) {
+    if (fd->cpp_type() == FD::CPPTYPE_STRING) {
+      dest->push_back(ExprValue(store->GetRepeated(msg, fd, i)));
+    } else {
+      CHECK_EQ(FD::CPPTYPE_ENUM, fd->cpp_type()) << "Not supported repeated "
+                                                 << fd->cpp_type_name();
+      dest->push_back(ExprValue(refl->GetRepeatedEnum(msg, fd, i)));
+    }
+  }
+}
+
+// Returns the message that holds the last field of a path without repeated messages.
+const gpb::Message& Parent(const gpb::Message& msg, const FieldPath& path) {
+  const gpb::Message* res = &msg;
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    res = &res->GetReflection()->GetMessage(*res, path[i]);
+  }
+  return *res;
+}
+
+// Sets dest to all the messages that hold the last field of path.
+void CollectParents(const gpb::Message& msg, const FieldPath& path, Messages* dest) {
+  Messages next;
+  dest->assign(1, &msg);
+
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    const FD* fd = path[i];
+    next.clear();
+    for (const gpb::Message* parent : *dest) {
+      const gpb::Reflection* refl = parent->GetReflection();
+      if (!fd->is_repeated()) {
+        next.push_back(&refl->GetMessage(*parent, fd));
+        continue;
+      }
+      int size = refl->FieldSize(*parent, fd);
+      for (int j = 0; j < size; ++j) {
+        next.push_back(&refl->GetRepeatedMessage(*parent, fd, j));
+      }
+    }
+    dest->swap(next);
+  }
+}
+
+void AppendValues(const gpb::Message& msg, const FieldPath& path, bool repeated,
+                  StringStore* store, Values* dest) {
+  const FD* fd = path.back();
+  if (!repeated) {
+    dest->push_back(GetValue(Parent(msg, path), fd, store));
+    return;
+  }
+
+  Messages parents;
+  CollectParents(msg, path, &parents);
+  for (const gpb::Message* parent : parents) {
+    if (fd->is_repeated()) {
+      AppendRepeated(*parent, fd, store, dest);
+    } else {
+      dest->push_back(GetValue(*parent, fd, store));
+    }
+  }
+}
+
+bool IsSet(const gpb::Message& msg, const FD* fd) {
+  const gpb::Reflection* refl = msg.GetReflection();
+  return fd->is_repeated() ? refl->FieldSize(msg, fd) > 0 : refl->HasField(msg, fd);
+}
+
+bool IsDefined(const gpb::Message& msg, const FieldPath& path, bool repeated) {
+  if (!repeated)
+    return IsSet(Parent(msg, path), path.back());
+
+  Messages parents;
+  CollectParents(msg, path, &parents);
+  for (const gpb::Message* parent : parents) {
+    if (IsSet(*parent, path.back()))
+      return true;
+  }
+  return false;
+}
+
+ExprValue HashValue(const ExprValue& val) {
+  CHECK_EQ(ExprValue::CPPTYPE_STRING, val.type);
+  return ExprValue::fromUInt(std::hash<StringPiece>()(val.val.str));
+}
+
+}  // namespace
+
+struct Program::Node {
+  enum Kind { CONST, PRED, NOT, AND, OR };
+
+  Kind kind;
+  uint32_t arg;  // The constant or the index into preds_.
+  std::unique_ptr<Node> left, right;
+
+  explicit Node(Kind k, uint32_t a = 0) : kind(k), arg(a) {}
+};
+
+struct Program::Scratch : public StringStore {};
+
+Program::Program(const Expr& expr, const gpb::Descriptor* descr) : descr_(descr) {
+  CHECK(descr);
+
+  std::unique_ptr<Node> root = CompileBool(expr);
+  Emit(*root);
+
+  // A jump that lands on a jump of the same kind takes it as well, hence go there directly.
+  for (Instr& instr : code_) {
+    if (instr.op != Instr::JUMP_IF_FALSE && instr.op != Instr::JUMP_IF_TRUE)
+      continue;
+    while (instr.arg < code_.size() && code_[instr.arg].op == instr.op) {
+      instr.arg = code_[instr.arg].arg;
+    }
+  }
+}
+
+Program::~Program() {}
+
+auto Program::CompileBool(const Expr& expr) -> std::unique_ptr<Node> {
+  if (const IsDefFun* def = dynamic_cast<const IsDefFun*>(&expr)) {
+    Pred pred;
+    pred.op = Pred::DEF;
+    pred.left.kind = Operand::FIELD;
+    pred.left.path = ResolvePath(def->name(), true, &pred.left.repeated);
+    return AddPred(std::move(pred));
+  }
+
+  const BinOp* bin_op = dynamic_cast<const BinOp*>(&expr);
+  CHECK(bin_op) << "Not a bool expression";
+
+  Pred pred;
+  switch (bin_op->type()) {
+    case BinOp::NOT: {
+      std::unique_ptr<Node> child = CompileBool(bin_op->left());
+      if (child->kind == Node::CONST) {
+        child->arg = !child->arg;
+        return child;
+      }
+      if (child->kind == Node::NOT)
+        return std::move(child->left);
+      std::unique_ptr<Node> res(new Node(Node::NOT));
+      res->left = std::move(child);
+      return res;
+    }
+    case BinOp::AND:
+    case BinOp::OR: {
+      // The operand value that decides the result on its own.
+      uint32_t decisive = bin_op->type() == BinOp::OR;
+      std::unique_ptr<Node> left = CompileBool(bin_op->left());
+      std::unique_ptr<Node> right = CompileBool(bin_op->right());
+
+      // The expressions are free of side effects, hence both operands may be folded.
+      if (left->kind == Node::CONST)
+        return left->arg == decisive ? std::move(left) : std::move(right);
+      if (right->kind == Node::CONST)
+        return right->arg == decisive ? std::move(right) : std::move(left);
+
+      std::unique_ptr<Node> res(new Node(decisive ? Node::OR : Node::AND));
+      res->left = std::move(left);
+      res->right = std::move(right);
+      return res;
+    }
+    case BinOp::EQ:
+      pred.op = Pred::EQ;
+      break;
+    case BinOp::LT:
+      pred.op = Pred::LT;
+      break;
+    case BinOp::LE:
+      pred.op = Pred::LE;
+      break;
+    case BinOp::RLIKE:
+      pred.op = Pred::RLIKE;
+      break;
+  }
+
+  pred.left = CompileScalar(bin_op->left());
+  pred.right = CompileScalar(bin_op->right());
+
+  if (pred.right.kind == Operand::CONST) {
+    if (pred.left.kind == Operand::CONST) {
+      return std::unique_ptr<Node>(
+          new Node(Node::CONST, Compare(pred, pred.left.value, pred.right.value)));
+    }
+    if (pred.op == Pred::RLIKE) {
+      StringPiece pattern = pred.right.value.val.str;
+      CHECK_EQ(ExprValue::CPPTYPE_STRING, pred.right.value.type);
+      pred.regex.reset(new std::regex(pattern.begin(), pattern.end()));
+    }
+  }
+
+  return AddPred(std::move(pred));
+}
+
+auto Program::AddPred(Pred pred) -> std::unique_ptr<Node> {
+  preds_.push_back(std::move(pred));
+  return std::unique_ptr<Node>(new Node(Node::PRED, preds_.size() - 1));
+}
+
+auto Program::CompileScalar(const Expr& expr) -> Operand {
+  Operand res;
+
+  if (const NumericLiteral* literal = dynamic_cast<const NumericLiteral*>(&expr)) {
+    res.value = literal->value();
+    return res;
+  }
+
+  if (const StringTerm* term = dynamic_cast<const StringTerm*>(&expr)) {
+    if (term->type() == StringTerm::CONST) {
+      strings_.push_back(term->val());
+      res.value = ExprValue(StringPiece(strings_.back()));
+    } else {
+      res.kind = Operand::FIELD;
+      res.path = ResolvePath(term->val(), false, &res.repeated);
+    }
+    return res;
+  }
+
+  const FunctionTerm* func = dynamic_cast<const FunctionTerm*>(&expr);
+  CHECK(func) << "Not a scalar expression";
+  CHECK_EQ("hash", func->name()) << "Unknown function";
+  CHECK_EQ(1, func->args().size()) << "hash() accepts a single argument";
+
+  res = CompileScalar(*func->args().front());
+  if (res.kind == Operand::CONST) {
+    res.value = HashValue(res.value);
+  } else {
+    CHECK_EQ(Operand::FIELD, res.kind) << "hash() accepts a single string";
+    res.kind = Operand::HASH;
+  }
+  return res;
+}
+
+auto Program::ResolvePath(const string& path, bool allow_message, bool* repeated) const
+    -> std::vector<const FD*> {
+  std::vector<const FD*> res;
+  const gpb::Descriptor* descr = descr_;
+  *repeated = false;
+
+  for (absl::string_view part : absl::StrSplit(path, '.')) {
+    CHECK(descr != nullptr) << res.back()->name() << " is not a message.";
+    const FD* fd = descr->FindFieldByName(string(part));
+    CHECK(fd != nullptr) << "Could not find field " << part << " in " << descr->full_name();
+
+    res.push_back(fd);
+    *repeated |= fd->is_repeated();
+    descr = fd->message_type();
+  }
+  CHECK(allow_message || descr == nullptr) << path << " is a message.";
+
+  return res;
+}
+
+void Program::Emit(const Node& node) {
+  switch (node.kind) {
+    case Node::CONST:
+      code_.push_back(Instr{Instr::CONST, node.arg});
+      break;
+    case Node::PRED:
+      code_.push_back(Instr{Instr::PRED, node.arg});
+      break;
+    case Node::NOT:
+      Emit(*node.left);
+      code_.push_back(Instr{Instr::NOT, 0});
+      break;
+    case Node::AND:
+    case Node::OR: {
+      Emit(*node.left);
+      size_t jump = code_.size();
+      code_.push_back(
+          Instr{node.kind == Node::AND ? Instr::JUMP_IF_FALSE : Instr::JUMP_IF_TRUE, 0});
+      Emit(*node.right);
+      code_[jump].arg = code_.size();
+      break;
+    }
+  }
+}
+
+bool Program::Eval(const gpb::Message& msg) const {
+  DCHECK_EQ(descr_, msg.GetDescriptor());
+
+  Scratch scratch;
+  bool acc = false;
+  for (uint32_t pc = 0; pc < code_.size();) {
+    pc = Execute(pc, msg, &acc, &scratch);
+  }
+  return acc;
+}
+
+void Program::EvalBatch(const gpb::Message* const* msgs, size_t count, bool* res) const {
+  // Message after message rather than instruction after instruction over the batch. Reflection
+  // dominates the predicates, so the latter just adds dispatch overhead and cache misses.
+  Scratch scratch;
+  for (size_t i = 0; i < count; ++i) {
+    DCHECK_EQ(descr_, msgs[i]->GetDescriptor());
+
+    bool acc = false;
+    for (uint32_t pc = 0; pc < code_.size();) {
+      pc = Execute(pc, *msgs[i], &acc, &scratch);
+    }
+    res[i] = acc;
+    scratch.Clear();
+  }
+}
+
+uint32_t Program::Execute(uint32_t pc, const gpb::Message& msg, bool* acc,
+                          Scratch* scratch) const {
+  const Instr& instr = code_[pc];
+  switch (instr.op) {
+    case Instr::CONST:
+      *acc = instr.arg;
+      break;
+    case Instr::PRED:
+      *acc = EvalPred(preds_[instr.arg], msg, scratch);
+      break;
+    case Instr::NOT:
+      *acc = !*acc;
+      break;
+    case Instr::JUMP_IF_FALSE:
+      if (!*acc)
+        return instr.arg;
+      break;
+    case Instr::JUMP_IF_TRUE:
+      if (*acc)
+        return instr.arg;
+      break;
+  }
+  return pc + 1;
+}
+
+bool Program::EvalPred(const Pred& pred, const gpb::Message& msg, Scratch* scratch) const {
+  if (pred.op == Pred::DEF)
+    return IsDefined(msg, pred.left.path, pred.left.repeated);
+
+  auto append = [&](const Operand& operand, Values* dest) {
+    switch (operand.kind) {
+      case Operand::CONST:
+        dest->push_back(operand.value);
+        break;
+      case Operand::FIELD:
+        AppendValues(msg, operand.path, operand.repeated, scratch, dest);
+        break;
+      case Operand::HASH: {
+        // Like FunctionTerm, hashes the first value of a repeated field.
+        Values vals;
+        AppendValues(msg, operand.path, operand.repeated, scratch, &vals);
+        if (!vals.empty())
+          dest->push_back(HashValue(vals.front()));
+        break;
+      }
+    }
+  };
+
+  Values left, right;
+  append(pred.left, &left);
+  if (left.empty())
+    return false;
+  append(pred.right, &right);
+
+  for (const ExprValue& l : left) {
+    for (const ExprValue& r : right) {
+      if (Compare(pred, l, r))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool Program::Compare(const Pred& pred, const ExprValue& left, const ExprValue& right) {
+  switch (pred.op) {
+    case Pred::EQ:
+      return left.Equal(right);
+    case Pred::LT:
+      return left.Less(right);
+    case Pred::LE:
+      return left.Less(right) || left.Equal(right);
+    case Pred::RLIKE:
+      if (!pred.regex)
+        return left.RLike(right);
+      CHECK_EQ(ExprValue::CPPTYPE_STRING, left.type);
+      return std::regex_match(left.val.str.begin(), left.val.str.end(), *pred.regex);
+    case Pred::DEF:
+      break;
+  }
+  LOG(FATAL) << "Unexpected predicate " << int(pred.op);
+  return false;
+}
+
+}  // namespace plang
@@ -0,0 +1,107 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "util/plang/plang.h"
+
+namespace google {
+namespace protobuf {
+class Descriptor;
+class FieldDescriptor;
+}  // namespace protobuf
+}  // namespace google
+
+namespace plang {
+
+/* Bool expression compiled for messages of a single type.
+
+   Field paths are resolved into FieldDescriptor chains once, constant subexpressions are
+   folded, constant regex patterns are compiled once and the boolean structure is flattened
+   into bytecode with short-circuit jumps. Evaluation goes without std::function callbacks
+   and does not allocate unless the expression refers to repeated fields.
+
+   The semantics are those of EvaluateBoolExpr: a comparison holds if it holds for some pair
+   of the values of its operands, def() holds if the field is set in some of the messages
+   on its path. Eval functions are const and thread-safe.
+*/
+class Program {
+ public:
+  // Dies if expr is not a bool expression or refers to fields that descr does not have.
+  // expr is not referenced after the construction.
+  Program(const Expr& expr, const gpb::Descriptor* descr);
+  ~Program();
+
+  // msg must be of type descriptor().
+  bool Eval(const gpb::Message& msg) const;
+
+  // Sets res[i] to Eval(*msgs[i]) for i in [0, count). Reuses the evaluation state across
+  // the messages.
+  void EvalBatch(const gpb::Message* const* msgs, size_t count, bool* res) const;
+
+  const gpb::Descriptor* descriptor() const { return descr_; }
+
+  // Number of bytecode instructions, 1 if the whole expression was folded into a constant.
+  size_t code_size() const { return code_.size(); }
+
+ private:
+  struct Node;
+  struct Scratch;
+
+  // Scalar operand of a predicate.
+  struct Operand {
+    enum Kind : uint8_t { CONST, FIELD, HASH };
+
+    Kind kind = CONST;
+    bool repeated = false;  // Whether path may yield more than one value.
+    ExprValue value;        // CONST.
+    std::vector<const gpb::FieldDescriptor*> path;  // FIELD and HASH.
+  };
+
+  struct Pred {
+    enum Op : uint8_t { EQ, LT, LE, RLIKE, DEF };
+
+    Op op;
+    Operand left, right;  // right is not used by DEF.
+
+    // RLIKE with a constant pattern.
+    std::unique_ptr<std::regex> regex;
+  };
+
+  // The machine has a single bool accumulator, AND and OR jump over their right operand
+  // if the left one decides the result.
+  struct Instr {
+    enum Op : uint8_t { CONST, PRED, NOT, JUMP_IF_FALSE, JUMP_IF_TRUE };
+
+    Op op;
+    uint32_t arg;  // The constant, the index into preds_ or the jump target.
+  };
+
+  std::unique_ptr<Node> CompileBool(const Expr& expr);
+  std::unique_ptr<Node> AddPred(Pred pred);
+  Operand CompileScalar(const Expr& expr);
+  std::vector<const gpb::FieldDescriptor*> ResolvePath(const std::string& path,
+                                                       bool allow_message, bool* repeated) const;
+  void Emit(const Node& node);
+
+  // Executes the instruction at pc, returns the next pc.
+  uint32_t Execute(uint32_t pc, const gpb::Message& msg, bool* acc, Scratch* scratch) const;
+  bool EvalPred(const Pred& pred, const gpb::Message& msg, Scratch* scratch) const;
+  static bool Compare(const Pred& pred, const ExprValue& left, const ExprValue& right);
+
+  const gpb::Descriptor* descr_;
+  std::vector<Instr> code_;
+  std::vector<Pred> preds_;
+  std::deque<std::string> strings_;  // Backs the string constants, hence deque.
+
+  Program(const Program&) = delete;
+  void operator=(const Program&) = delete;
+};
+
+}  // namespace plang
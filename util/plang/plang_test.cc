@@ -3,11 +3,12 @@
 //
 #include "util/plang/plang.h"
 
+#include "base/gtest.h"
 #include "base/logging.h"
 #include "util/plang/addressbook.pb.h"
+#include "util/plang/plang_program.h"
 #include "util/plang/plang_scanner.h"
 #include "util/plang/plang_parser.hh"
-#include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
 namespace plang {
@@ -32,7 +33,24 @@ protected:
 
   bool eval(const ::google::protobuf::Message &msg) {
     CHECK(res_val_);
-    return EvaluateBoolExpr(*res_val_, msg);
+    bool res = EvaluateBoolExpr(*res_val_, msg);
+
+    // The compiled program must agree with the interpreter.
+    Program program(*res_val_, msg.GetDescriptor());
+    EXPECT_EQ(res, program.Eval(msg));
+
+    const ::google::protobuf::Message* batch[] = {&msg};
+    bool batch_res = !res;
+    program.EvalBatch(batch, 1, &batch_res);
+    EXPECT_EQ(res, batch_res);
+
+    return res;
+  }
+
+  std::unique_ptr<Program> compile(const std::string& val,
+                                   const ::google::protobuf::Message &msg) {
+    CHECK_EQ(0, parse(val));
+    return std::unique_ptr<Program>(new Program(*res_val_, msg.GetDescriptor()));
   }
 
   const Expr& get_parsed() {
@@ -315,4 +333,128 @@ TEST_F(PlangTest, Precedence) {
   EXPECT_EQ(BinOp::LT, n121.type());
 }
 
+TEST_F(PlangTest, Program) {
+  Person person;
+  person.set_name("Roman");
+  person.set_id(6);
+  person.add_tag("a");
+  person.add_tag("b");
+  person.mutable_account()->add_activity_id(7);
+
+  std::unique_ptr<Program> program = compile("\"Foo\" = \"Bar\"", person);
+  EXPECT_EQ(1, program->code_size());
+  EXPECT_FALSE(program->Eval(person));
+
+  program = compile("1 = 1 or name = 'Foo'", person);
+  EXPECT_EQ(1, program->code_size());
+  EXPECT_TRUE(program->Eval(person));
+
+  program = compile("not not id = 6 and 1 = 1", person);
+  EXPECT_EQ(1, program->code_size());
+  EXPECT_TRUE(program->Eval(person));
+
+  program = compile("hash('Roman') = hash(name)", person);
+  EXPECT_TRUE(program->Eval(person));
+
+  // Repeated fields of every type, the interpreter does not support all of them.
+  program = compile("tag = 'b'", person);
+  EXPECT_TRUE(program->Eval(person));
+  program = compile("tag = 'c'", person);
+  EXPECT_FALSE(program->Eval(person));
+  program = compile("account.activity_id = 7 and def(tag)", person);
+  EXPECT_TRUE(program->Eval(person));
+  program = compile("name rlike 'R.*' and tag rlike 'b+'", person);
+  EXPECT_TRUE(program->Eval(person));
+}
+
+TEST_F(PlangTest, ProgramBatch) {
+  std::vector<Person> persons(150);
+  for (size_t i = 0; i < persons.size(); ++i) {
+    persons[i].set_id(i);
+    persons[i].set_name(i % 3 ? "Roman" : "Anna");
+    if (i % 5 == 0)
+      persons[i].add_phone()->set_number("1");
+  }
+
+  std::vector<const ::google::protobuf::Message*> msgs;
+  for (const Person& p : persons)
+    msgs.push_back(&p);
+
+  for (const char* expr : {"id > 10 and name = 'Anna' or phone.number = '1'",
+                           "(id < 100 or name = 'Roman') and not def(phone)"}) {
+    std::unique_ptr<Program> program = compile(expr, persons[0]);
+    std::unique_ptr<bool[]> res(new bool[msgs.size()]);
+    program->EvalBatch(msgs.data(), msgs.size(), res.get());
+
+    for (size_t i = 0; i < persons.size(); ++i) {
+      EXPECT_EQ(EvaluateBoolExpr(get_parsed(), persons[i]), res[i]) << expr << " " << i;
+    }
+  }
+}
+
+const char kBenchExpr[] = "(id > 10 and name = 'Anna') or account.bank_name = 'hapoalim'";
+
+static void FillBenchPersons(std::vector<Person>* persons) {
+  persons->resize(1024);
+  for (size_t i = 0; i < persons->size(); ++i) {
+    Person& p = (*persons)[i];
+    p.set_id(i);
+    p.set_name(i % 3 ? kNameVal : "Anna");
+    p.mutable_account()->set_bank_name(i % 7 ? "leumi" : kBankVal);
+  }
+}
+
+static std::unique_ptr<Expr> ParseBenchExpr() {
+  std::istringstream istr(kBenchExpr);
+  Scanner scanner(&istr);
+  std::unique_ptr<Expr> expr;
+  Parser parser(&scanner, &expr);
+  CHECK_EQ(0, parser.parse());
+  return expr;
+}
+
+static void BM_Interpret(benchmark::State& state) {
+  std::vector<Person> persons;
+  FillBenchPersons(&persons);
+  std::unique_ptr<Expr> expr = ParseBenchExpr();
+
+  while (state.KeepRunning()) {
+    for (const Person& p : persons)
+      benchmark::DoNotOptimize(EvaluateBoolExpr(*expr, p));
+  }
+  state.SetItemsProcessed(state.iterations() * persons.size());
+}
+BENCHMARK(BM_Interpret);
+
+static void BM_Program(benchmark::State& state) {
+  std::vector<Person> persons;
+  FillBenchPersons(&persons);
+  Program program(*ParseBenchExpr(), Person::descriptor());
+
+  while (state.KeepRunning()) {
+    for (const Person& p : persons)
+      benchmark::DoNotOptimize(program.Eval(p));
+  }
+  state.SetItemsProcessed(state.iterations() * persons.size());
+}
+BENCHMARK(BM_Program);
+
+static void BM_ProgramBatch(benchmark::State& state) {
+  std::vector<Person> persons;
+  FillBenchPersons(&persons);
+  Program program(*ParseBenchExpr(), Person::descriptor());
+
+  std::vector<const ::google::protobuf::Message*> msgs;
+  for (const Person& p : persons)
+    msgs.push_back(&p);
+  std::unique_ptr<bool[]> res(new bool[msgs.size()]);
+
+  while (state.KeepRunning()) {
+    program.EvalBatch(msgs.data(), msgs.size(), res.get());
+    benchmark::DoNotOptimize(res[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * persons.size());
+}
+BENCHMARK(BM_ProgramBatch);
+
 }  // namespace plang
@@ -5,7 +5,12 @@
 
 #include <google/protobuf/compiler/importer.h>
 
+#include <atomic>
+#include <map>
+#include <thread>
+
 #include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
 #include "base/flags.h"
 #include "base/hash.h"
 #include "base/logging.h"
@@ -14,6 +19,7 @@
 #include "file/proto_writer.h"
 #include "util/pb2json.h"
 #include "util/plang/plang_parser.hh"
+#include "util/plang/plang_program.h"
 #include "util/plang/plang_scanner.h"
 #include "util/pprint/pprint_utils.h"
 
@@ -40,6 +46,9 @@ namespace gpc = gpb::compiler;
 
 using strings::AsString;
 
+// Whole records are buffered up to this size before they are passed to the output callback.
+constexpr size_t kOutputChunkSize = 1 << 16;
+
 class ErrorCollector : public gpc::MultiFileErrorCollector {
   void AddError(const string& filenname, int line, int column, const string& message) {
     std::cerr << "Error File : " << filenname << " : " << message << std::endl;
@@ -102,9 +111,11 @@ class FilePrinter::PrintTask {
 
   void InitShared(SharedData d) {
     shared_data_ = d;
+    if (d->expr && local_msg_)
+      program_.reset(new plang::Program(*d->expr, local_msg_->GetDescriptor()));
   }
 
-  PrintTask(const gpb::Message* to_clone, const Pb2JsonOptions& opts) : options_(opts) {
+  PrintTask(const gpb::Message* to_clone, const Pb2JsonOptions& opts) : json_printer_(opts) {
     if (to_clone) {
       local_msg_.reset(to_clone->New());
     }
@@ -116,37 +127,63 @@ class FilePrinter::PrintTask {
   }
 
   void operator()(const std::string& obj) {
+    Process(obj);
+  }
+
+  void Process(StringPiece obj) {
+    string* dest = shared_data_->output ? shared_data_->output : &text_;
+    text_.clear();
+
     if (FLAGS_raw) {
-      std::lock_guard<mutex> lock(shared_data_->m);
-      std::cout << absl::Utf8SafeCEscape(obj) << "\n";
+      absl::StrAppend(dest, absl::Utf8SafeCEscape(obj), "\n");
+      Write();
       return;
     }
-    CHECK(local_msg_->ParseFromString(obj));
-    if (shared_data_->expr && !plang::EvaluateBoolExpr(*shared_data_->expr, *local_msg_))
+    CHECK(local_msg_->ParseFromArray(obj.data(), obj.size()));
+    if (program_ && !program_->Eval(*local_msg_))
       return;
 
     if (ShouldSkip(*local_msg_, fd_path_))
       return;
-    std::lock_guard<mutex> lock(shared_data_->m);
 
     if (FLAGS_sizes) {
+      auto lock = Lock();
       shared_data_->size_summarizer->AddSizes(*local_msg_);
       return;
     }
 
+    // Formats outside of the lock.
     if (FLAGS_json) {
-      string str = Pb2Json(*local_msg_, options_);
-      std::cout << str << "\n";
+      json_printer_.Print(*local_msg_, dest);
+      dest->push_back('\n');
     } else {
-      shared_data_->printer->Output(*local_msg_);
+      shared_data_->printer->Output(*local_msg_, dest);
     }
+    Write();
   }
 
  private:
+  // Locks the shared data unless the records are processed sequentially.
+  std::unique_lock<mutex> Lock() {
+    if (shared_data_->output)
+      return std::unique_lock<mutex>();
+    return std::unique_lock<mutex>(shared_data_->m);
+  }
+
+  // Writes the text formatted by the concurrent task.
+  void Write() {
+    if (!shared_data_->output) {
+      std::lock_guard<mutex> lock(shared_data_->m);
+      std::cout << text_;
+    }
+  }
+
   std::unique_ptr<gpb::Message> local_msg_;
+  std::unique_ptr<plang::Program> program_;
   FdPath fd_path_;
   SharedData shared_data_;
-  Pb2JsonOptions options_;
+  Pb2JsonPrinter json_printer_;
+  string text_;
 };
 
 FilePrinter::FilePrinter() {}
@@ -172,11 +209,18 @@ void FilePrinter::Init(const string& fname) {
     CHECK(!FLAGS_sizes);
   }
 
-  pool_.reset(new TaskPool("pool", 10));
-
   shared_data_.size_summarizer = size_summarizer_.get();
   shared_data_.printer = printer_.get();
   shared_data_.expr = test_expr_.get();
+
+  if (output_cb_) {
+    shared_data_.output = &output_;
+    inline_task_.reset(new PrintTask(descr_msg_.get(), options_));
+    inline_task_->InitShared(&shared_data_);
+    return;
+  }
+
+  pool_.reset(new TaskPool("pool", 10));
   pool_->SetSharedData(&shared_data_);
   pool_->Launch(descr_msg_.get(), options_);
 
@@ -200,6 +244,10 @@ Status FilePrinter::Run() {
       break;
     if (FLAGS_count) {
       ++count_;
+    } else if (inline_task_) {
+      inline_task_->Process(record);
+      if (output_.size() >= kOutputChunkSize)
+        FlushOutput();
     } else {
       if (FLAGS_parallel) {
         pool_->RunTask(AsString(record));
@@ -208,6 +256,11 @@ Status FilePrinter::Run() {
       }
     }
   }
+
+  if (output_cb_) {
+    FlushOutput();
+    return Status::OK;
+  }
   pool_->WaitForTasksToComplete();
 
   if (size_summarizer_.get())
@@ -215,6 +268,84 @@ Status FilePrinter::Run() {
   return Status::OK;
 }
 
+void FilePrinter::FlushOutput() {
+  if (!output_.empty()) {
+    output_cb_(output_);
+    output_.clear();
+  }
+}
+
+ParallelFilePrinter::ParallelFilePrinter(unsigned num_threads)
+    : num_threads_(num_threads ? num_threads : std::thread::hardware_concurrency()) {
+}
+
+Status ParallelFilePrinter::Run(const std::vector<std::string>& files) {
+  struct WorkerState {
+    uint64_t count = 0;
+    std::map<string, size_t> sizes;
+  };
+
+  std::vector<WorkerState> states(std::min<size_t>(std::max(num_threads_, 1u), files.size()));
+  std::atomic_size_t next_file{0};
+  mutex output_mu, load_mu;
+  Status status;
+
+  auto print_cb = [&](const string& chunk) {
+    std::lock_guard<mutex> lock(output_mu);
+    std::cout << chunk;
+  };
+
+  auto worker = [&](WorkerState* state) {
+    for (size_t i = next_file.fetch_add(1, std::memory_order_relaxed); i < files.size();
+         i = next_file.fetch_add(1, std::memory_order_relaxed)) {
+      ListReaderPrinter printer;
+      printer.SetOutput(print_cb);
+      {
+        std::lock_guard<mutex> lock(load_mu);
+        printer.Init(files[i]);
+      }
+
+      Status st = printer.Run();
+      if (!st.ok()) {
+        LOG(ERROR) << "Error printing " << files[i] << ": " << st;
+        std::lock_guard<mutex> lock(output_mu);
+        if (status.ok())
+          status = st;
+      }
+
+      state->count += printer.count();
+      if (printer.size_summarizer()) {
+        for (const auto& k_v : printer.size_summarizer()->GetSizes())
+          state->sizes[k_v.first] += k_v.second;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < states.size(); ++i) {
+    threads.emplace_back(worker, &states[i]);
+  }
+  if (!states.empty())
+    worker(&states[0]);
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::map<string, size_t> sizes;
+  for (const WorkerState& state : states) {
+    count_ += state.count;
+    for (const auto& k_v : state.sizes)
+      sizes[k_v.first] += k_v.second;
+  }
+  if (FLAGS_sizes) {
+    for (const auto& k_v : sizes)
+      std::cout << k_v.first << " - " << k_v.second << "\n";
+    std::cout << "\n";
+  }
+
+  return status;
+}
+
 
 void ListReaderPrinter::LoadFile(const std::string& fname) {
   auto corrupt_cb = [this](size_t bytes, const util::Status& status) { st_ = status; };
@@ -7,6 +7,7 @@
 #include <google/protobuf/text_format.h>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "strings/stringpiece.h"
 #include "util/plang/plang.h"
@@ -31,6 +32,7 @@ class FilePrinter {
 
   using FieldPrinterFactory = std::function<::google::protobuf::TextFormat::FieldValuePrinter*(
       const FieldDescriptor& fd)>;
+  using OutputCb = std::function<void(const std::string&)>;
 
   FilePrinter();
   virtual ~FilePrinter();
@@ -50,6 +52,18 @@ class FilePrinter {
     field_printer_cb_ = pred;
   }
 
+  // Makes the printer process the records in the calling thread and pass their output to cb,
+  // in order and in chunks of whole records, instead of printing it to stdout. Run does not
+  // print the size summary then, see size_summarizer(). Must be called before Init.
+  void SetOutput(OutputCb cb) {
+    output_cb_ = std::move(cb);
+  }
+
+  // Set if --sizes is on. Valid only after Init was called.
+  const SizeSummarizer* size_summarizer() const {
+    return size_summarizer_.get();
+  }
+
   // Valid only after Init was called.
   const Descriptor* GetDescriptor() const;
 
@@ -74,11 +88,17 @@ class FilePrinter {
     const plang::Expr* expr = nullptr;
     const Printer* printer = nullptr;
     SizeSummarizer* size_summarizer = nullptr;
+
+    // Set when the records are processed sequentially, no locking is needed then.
+    std::string* output = nullptr;
   };
 
   using TaskPool = util::SingleProducerTaskPool<PrintTask>;
 
+  void FlushOutput();
+
   std::unique_ptr<TaskPool> pool_;
+  std::unique_ptr<PrintTask> inline_task_;  // Used instead of pool_ if output_cb_ is set.
   std::unique_ptr<Printer> printer_;
   std::unique_ptr<SizeSummarizer> size_summarizer_;
   std::unique_ptr<plang::Expr> test_expr_;
@@ -91,6 +111,8 @@ class FilePrinter {
       FieldPrinterType;
 
   FieldPrinterFactory field_printer_cb_;
+  OutputCb output_cb_;
+  std::string output_;
   uint64_t count_ = 0;
 };
 
@@ -106,5 +128,29 @@ class ListReaderPrinter final : public FilePrinter {
   util::Status st_;
 };
 
+/* Prints list files on a pool of worker threads, every worker prints whole files one after
+   another. The records of a file are printed in order and in chunks of whole records, but
+   the chunks of different files interleave. Counts and size summaries are collected per
+   file and are merged at the end, only writing to stdout takes a lock. Files are opened
+   one at a time since the descriptor pools they load their types into are shared.
+*/
+class ParallelFilePrinter {
+ public:
+  // 0 means a thread per cpu.
+  explicit ParallelFilePrinter(unsigned num_threads = 0);
+
+  // Returns the first error, the remaining files are still printed. Prints the merged size
+  // summary if --sizes is set.
+  util::Status Run(const std::vector<std::string>& files);
+
+  uint64_t count() const {
+    return count_;
+  }
+
+ private:
+  unsigned num_threads_;
+  uint64_t count_ = 0;
+};
+
 }  // namespace pprint
 }  // namespace util
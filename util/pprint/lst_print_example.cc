@@ -21,6 +21,7 @@ DECLARE_string(csv);
 DECLARE_bool(sizes);
 DECLARE_bool(raw);
 DECLARE_bool(count);
+DECLARE_bool(parallel);
 
 using namespace util;
 using std::string;
@@ -41,16 +42,24 @@ int main(int argc, char** argv) {
 
   size_t count = 0;
 
-  // const Reflection* reflection = msg->GetReflection();
-  for (int i = 1; i < argc; ++i) {
-    StringPiece path(argv[i]);
-    LOG(INFO) << "Opening " << path;
-
-    pprint::ListReaderPrinter printer;
-    printer.Init(argv[i]);
-    auto st = printer.Run();
+  if (FLAGS_parallel && argc > 2) {
+    // Prints the files concurrently, each one in order.
+    pprint::ParallelFilePrinter printer;
+    auto st = printer.Run(std::vector<string>(argv + 1, argv + argc));
     CHECK_STATUS(st);
-    count += printer.count();
+    count = printer.count();
+  } else {
+    // const Reflection* reflection = msg->GetReflection();
+    for (int i = 1; i < argc; ++i) {
+      StringPiece path(argv[i]);
+      LOG(INFO) << "Opening " << path;
+
+      pprint::ListReaderPrinter printer;
+      printer.Init(argv[i]);
+      auto st = printer.Run();
+      CHECK_STATUS(st);
+      count += printer.count();
+    }
   }
   if (FLAGS_count)
     std::cout << "Count: " << count << std::endl;
@@ -265,21 +265,20 @@ Printer::Printer(const gpb::Descriptor* descriptor, FieldPrinterPredicate pred)
 
 }
 
-void Printer::Output(const gpb::Message& msg) const {
-  string text_output;
+void Printer::Output(const gpb::Message& msg, string* dest) const {
   if (fds_.empty()) {
+    string text_output;
     CHECK(printer_.PrintToString(msg, &text_output));
-    std::cout << type_name_ << " {" << (FLAGS_short ? " " : "\n")
-              << text_output << "}\n";
+    absl::StrAppend(dest, type_name_, " {", (FLAGS_short ? " " : "\n"), text_output, "}\n");
   } else {
-    PrintValueRecur(0, "", false, msg);
+    PrintValueRecur(0, "", false, msg, dest);
   }
 }
 
 void Printer::PrintValueRecur(size_t path_index, const string& prefix,
-                              bool has_value, const gpb::Message& msg) const {
+                              bool has_value, const gpb::Message& msg, string* dest) const {
   CHECK_LT(path_index, fds_.size());
-  auto cb_fun = [path_index, this, has_value, &prefix, &msg](
+  auto cb_fun = [path_index, this, has_value, &prefix, &msg, dest](
     // num_items - #items in leaf repeated field. if given (!-1): aggregate all values: "xx,yy,.."
     // item_index - item index in leaf repeated field. if given (!-1): print line with this item.
     const gpb::Message& parent, const gpb::FieldDescriptor* fd, int item_index, int num_items) {
@@ -312,9 +311,9 @@ void Printer::PrintValueRecur(size_t path_index, const string& prefix,
     bool next_has_value = has_value | !val.empty();
     if (path_index + 1 == fds_.size()) {
       if (next_has_value)
-        cout << next_val << std::endl;
+        absl::StrAppend(dest, next_val, "\n");
     } else {
-      PrintValueRecur(path_index + 1, next_val, next_has_value, msg);
+      PrintValueRecur(path_index + 1, next_val, next_has_value, msg, dest);
     }
   };
   fds_[path_index].ExtractValue(msg, cb_fun);
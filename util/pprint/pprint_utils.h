@@ -82,14 +82,16 @@ class Printer {
   // void ExtractValueRecur(const gpb::Message& msg, const FdPath& fd_path, uint32 index, ValueCb
   // cb);
   void PrintValueRecur(size_t path_index, const std::string& prefix, bool has_value,
-                       const gpb::Message& msg) const;
+                       const gpb::Message& msg, std::string* dest) const;
 
  public:
   using FieldPrinterPredicate =
       std::function<gpb::TextFormat::FieldValuePrinter*(const gpb::FieldDescriptor& fd)>;
 
   explicit Printer(const gpb::Descriptor* descriptor, FieldPrinterPredicate pred = nullptr);
-  void Output(const gpb::Message& msg) const;
+
+  // Appends the text of msg to dest.
+  void Output(const gpb::Message& msg, std::string* dest) const;
 };
 
 struct PrintBqSchemaOptions {
@@ -1,14 +1,32 @@
 #include "util/pprint/pprint_utils.h"
 
+#include "base/flags.h"
 #include "util/pprint/pprint_utils_test.pb.h"
 #include <gtest/gtest.h>
 
+DECLARE_string(csv);
+
 namespace util {
 namespace pprint {
 
 class PprintUtilsTest : public testing::Test {
 };
 
+TEST_F(PprintUtilsTest, PrinterOutput) {
+  SimpleString msg;
+  msg.set_simple("ori");
+
+  std::string text = "prefix\n";
+  Printer(msg.GetDescriptor()).Output(msg, &text);
+  EXPECT_EQ("prefix\nSimpleString {\n  simple: \"ori\"\n}\n", text);
+
+  FLAGS_csv = "simple";
+  text.clear();
+  Printer(msg.GetDescriptor()).Output(msg, &text);
+  FLAGS_csv.clear();
+  EXPECT_EQ("\"ori\"\n", text);
+}
+
 TEST_F(PprintUtilsTest, SizeSummarizerSimpleString) {
   SimpleString m1;
   m1.set_simple("ori");
@@ -4,11 +4,13 @@
 #include "util/proc_stats.h"
 
 #include <mutex>
+#include <string>
 #include "base/walltime.h"
 #include "strings/stringpiece.h"
 #include "strings/numbers.h"
 #include "strings/strip.h"
 
+#include <dirent.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -49,9 +51,10 @@ static void InitCpuInfo() {
   fclose(f);
 }
 
-ProcessStats ProcessStats::Read() {
+ProcessStats ProcessStats::Read(int pid) {
   ProcessStats stats;
-  FILE* f = fopen("/proc/self/status", "r");
+  std::string dir = pid ? "/proc/" + std::to_string(pid) : std::string("/proc/self");
+  FILE* f = fopen((dir + "/status").c_str(), "r");
   if (f == nullptr)
     return stats;
   char* line = nullptr;
@@ -59,10 +62,14 @@ ProcessStats ProcessStats::Read() {
   while (getline(&line, &len, f) != -1) {
     if (!strncmp(line, "VmPeak:", 7)) stats.vm_peak = ParseLeadingUDec32Value(line + 8, 0);
     else if (!strncmp(line, "VmSize:", 7)) stats.vm_size = ParseLeadingUDec32Value(line + 8, 0);
-    else if (!strncmp(line, "VmRSS:", 6)) stats.vm_size = ParseLeadingUDec32Value(line + 7, 0);
+    else if (!strncmp(line, "VmRSS:", 6)) stats.vm_rss = ParseLeadingUDec32Value(line + 7, 0);
+    else if (!strncmp(line, "voluntary_ctxt_switches:", 24))
+      stats.voluntary_ctx_switches = strtoull(line + 24, nullptr, 10);
+    else if (!strncmp(line, "nonvoluntary_ctxt_switches:", 27))
+      stats.involuntary_ctx_switches = strtoull(line + 27, nullptr, 10);
   }
   fclose(f);
-  f = fopen("/proc/self/stat", "r");
+  f = fopen((dir + "/stat").c_str(), "r");
   if (f) {
     long jiffies_per_second = sysconf(_SC_CLK_TCK);
     uint64 start_since_boot = 0;
@@ -72,7 +79,32 @@ ProcessStats ProcessStats::Read() {
       fprintf(stderr, "Buffer is too small %lu\n", sizeof buf);
     } else {
       StringPiece str(buf, bytes_read);
-      size_t pos = find_nth(str, ' ', 20);
+      size_t pos = find_nth(str, ' ', 8);
+      if (pos != StringPiece::npos) {
+        stats.minor_faults = ParseLeadingUDec64Value(str.data() + pos + 1, 0);
+      }
+      pos = find_nth(str, ' ', 10);
+      if (pos != StringPiece::npos) {
+        stats.major_faults = ParseLeadingUDec64Value(str.data() + pos + 1, 0);
+      }
+
+      pos = find_nth(str, ' ', 12);
+      if (pos != StringPiece::npos) {
+        stats.user_cpu_ms = ParseLeadingUDec64Value(str.data() + pos + 1, 0) * 1000 /
+                            jiffies_per_second;
+      }
+      pos = find_nth(str, ' ', 13);
+      if (pos != StringPiece::npos) {
+        stats.system_cpu_ms = ParseLeadingUDec64Value(str.data() + pos + 1, 0) * 1000 /
+                              jiffies_per_second;
+      }
+
+      pos = find_nth(str, ' ', 18);
+      if (pos != StringPiece::npos) {
+        stats.num_threads = ParseLeadingUDec32Value(str.data() + pos + 1, 0);
+      }
+
+      pos = find_nth(str, ' ', 20);
       if (pos != StringPiece::npos) {
         start_since_boot = ParseLeadingUDec64Value(str.data() + pos + 1, 0);
         start_since_boot /= jiffies_per_second;
@@ -93,10 +125,68 @@ ProcessStats ProcessStats::Read() {
       }
     }
   }
+
+  // Readable only by the owner of the process.
+  f = fopen((dir + "/io").c_str(), "r");
+  if (f) {
+    while (getline(&line, &len, f) != -1) {
+      if (!strncmp(line, "read_bytes:", 11))
+        stats.io_read_bytes = strtoull(line + 11, nullptr, 10);
+      else if (!strncmp(line, "write_bytes:", 12))
+        stats.io_write_bytes = strtoull(line + 12, nullptr, 10);
+    }
+    fclose(f);
+  }
   free(line);
   return stats;
 }
 
+void ThreadStats::ReadAll(int pid, std::vector<ThreadStats>* dest) {
+  dest->clear();
+  std::string dir = pid ? "/proc/" + std::to_string(pid) : std::string("/proc/self");
+  dir.append("/task");
+  DIR* tasks = opendir(dir.c_str());
+  if (tasks == nullptr)
+    return;
+
+  long jiffies_per_second = sysconf(_SC_CLK_TCK);
+  char buf[512];
+  while (struct dirent* entry = readdir(tasks)) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+    FILE* f = fopen((dir + "/" + entry->d_name + "/stat").c_str(), "r");
+    if (f == nullptr)  // The thread has exited.
+      continue;
+    size_t bytes_read = fread(buf, 1, sizeof buf - 1, f);
+    fclose(f);
+    buf[bytes_read] = '\0';
+
+    // "tid (comm) state ...", comm may contain spaces and parentheses.
+    StringPiece str(buf, bytes_read);
+    size_t open = str.find('(');
+    size_t close = str.rfind(')');
+    if (open == StringPiece::npos || close == StringPiece::npos || close < open)
+      continue;
+
+    ThreadStats ts;
+    ts.tid = atoi(buf);
+    ts.name = std::string(str.substr(open + 1, close - open - 1));
+
+    // utime and stime are the fields 14 and 15, the state is the field 3.
+    str.remove_prefix(close + 1);
+    size_t pos = find_nth(str, ' ', 11);
+    if (pos == StringPiece::npos)
+      continue;
+    char* end = nullptr;
+    uint64 utime = strtoull(str.data() + pos + 1, &end, 10);
+    uint64 stime = strtoull(end, nullptr, 10);
+    ts.user_cpu_ms = utime * 1000 / jiffies_per_second;
+    ts.system_cpu_ms = stime * 1000 / jiffies_per_second;
+    dest->push_back(std::move(ts));
+  }
+  closedir(tasks);
+}
+
 namespace sys {
 
 unsigned int NumCPUs() {
@@ -104,6 +194,35 @@ unsigned int NumCPUs() {
   return CPU_NUM;
 }
 
+bool ReadCpuTimes(CpuTimes* dest) {
+  FILE* f = fopen("/proc/stat", "r");
+  if (f == nullptr)
+    return false;
+
+  char line[256];
+  bool res = false;
+
+  // cpu  user nice system idle iowait irq softirq steal ...
+  if (fgets(line, sizeof line, f) && !strncmp(line, "cpu ", 4)) {
+    uint64 vals[8] = {0};
+    char* next = line + 4;
+    for (unsigned i = 0; i < 8; ++i) {
+      vals[i] = strtoull(next, &next, 10);
+    }
+    dest->total_ms = dest->steal_ms = dest->iowait_ms = 0;
+    long jiffies_per_second = sysconf(_SC_CLK_TCK);
+    for (uint64 v : vals)
+      dest->total_ms += v;
+    dest->total_ms = dest->total_ms * 1000 / jiffies_per_second;
+    dest->iowait_ms = vals[4] * 1000 / jiffies_per_second;
+    dest->steal_ms = vals[7] * 1000 / jiffies_per_second;
+    res = true;
+  }
+  fclose(f);
+
+  return res;
+}
+
 }  // namespace sys
 
 }  // namespace util
@@ -5,6 +5,8 @@
 #define PROC_STATUS_H
 
 #include <ostream>
+#include <string>
+#include <vector>
 
 #include "base/integral_types.h"
 
@@ -18,11 +20,47 @@ struct ProcessStats {
   // Start time of the process in seconds since epoch.
   uint64 start_time_seconds = 0;
 
-  static ProcessStats Read();
+  // CPU time of the process in user and kernel mode.
+  uint64 user_cpu_ms = 0;
+  uint64 system_cpu_ms = 0;
+
+  uint64 voluntary_ctx_switches = 0;
+  uint64 involuntary_ctx_switches = 0;
+  uint64 minor_faults = 0;
+  uint64 major_faults = 0;
+  uint32 num_threads = 0;
+
+  // Bytes that the process caused to be fetched from or sent to the storage layer.
+  uint64 io_read_bytes = 0;
+  uint64 io_write_bytes = 0;
+
+  static ProcessStats Read() { return Read(0); }
+
+  // Reads the stats of the process pid, 0 for this process.
+  static ProcessStats Read(int pid);
+};
+
+struct ThreadStats {
+  int tid = 0;
+  std::string name;
+  uint64 user_cpu_ms = 0;
+  uint64 system_cpu_ms = 0;
+
+  // Reads the stats of all threads of the process pid, 0 for this process.
+  static void ReadAll(int pid, std::vector<ThreadStats>* dest);
 };
 
 namespace sys {
   unsigned int NumCPUs();
+
+  // System-wide CPU time summed over all cpus, from /proc/stat.
+  struct CpuTimes {
+    uint64 total_ms = 0;
+    uint64 iowait_ms = 0;
+    uint64 steal_ms = 0;  // Time a hypervisor ran other guests.
+  };
+
+  bool ReadCpuTimes(CpuTimes* dest);
 }  // namespace sys
 
 }  // namespace util
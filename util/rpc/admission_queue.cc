@@ -0,0 +1,163 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/admission_queue.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/stats/varz_stats.h"
+
+namespace util {
+namespace rpc {
+
+namespace {
+
+std::mutex& QueuesMutex() {
+  static std::mutex mu;
+  return mu;
+}
+
+// Live admission queues, guarded by QueuesMutex().
+std::vector<const AdmissionQueue*>& Queues() {
+  static std::vector<const AdmissionQueue*> queues;
+  return queues;
+}
+
+VarzValue::Map AdmissionVarz() {
+  static const char* const kQueueUsec[] = {"high_queue_p99_usec", "normal_queue_p99_usec",
+                                           "bulk_queue_p99_usec"};
+  VarzValue::Map res;
+
+  std::lock_guard<std::mutex> lk(QueuesMutex());
+  for (const AdmissionQueue* q : Queues()) {
+    AdmissionQueue::Stats stats = q->GetStats();
+
+    VarzValue::Map items;
+    items.emplace_back("running", VarzValue::FromInt(stats.running));
+    items.emplace_back("queued", VarzValue::FromInt(stats.queued));
+    items.emplace_back("admitted", VarzValue::FromInt(stats.admitted));
+    items.emplace_back("rejected", VarzValue::FromInt(stats.rejected));
+    items.emplace_back("expired", VarzValue::FromInt(stats.expired));
+    for (unsigned i = 0; i < AdmissionQueue::kNumPriorities; ++i) {
+      if (stats.queue_usec[i].count()) {
+        items.emplace_back(kQueueUsec[i],
+                           VarzValue::FromDouble(stats.queue_usec[i].Percentile(99)));
+      }
+    }
+    res.emplace_back(q->name(), VarzValue(std::move(items)));
+  }
+  return res;
+}
+
+VarzFunction rpc_admission("rpc_admission", &AdmissionVarz);
+
+}  // namespace
+
+constexpr unsigned AdmissionQueue::kNumPriorities;
+
+AdmissionQueue::AdmissionQueue(std::string name, const Options& opts)
+    : name_(std::move(name)), opts_(opts) {
+  CHECK_GT(opts_.max_concurrency, 0);
+
+  std::lock_guard<std::mutex> lk(QueuesMutex());
+  Queues().push_back(this);
+}
+
+AdmissionQueue::~AdmissionQueue() {
+  {
+    std::lock_guard<std::mutex> lk(QueuesMutex());
+    auto& queues = Queues();
+    queues.erase(std::find(queues.begin(), queues.end(), this));
+  }
+
+  DCHECK_EQ(0, stats_.running);
+  DCHECK_EQ(0, stats_.queued);
+}
+
+auto AdmissionQueue::Admit(unsigned priority, uint64_t deadline_usec) -> Ticket {
+  priority = std::min(priority, kNumPriorities - 1);
+
+  std::unique_lock<std::mutex> lk(mu_);
+  if (stats_.running < opts_.max_concurrency) {
+    ++stats_.running;
+    ++stats_.admitted;
+    return Ticket(this);
+  }
+
+  if (opts_.max_queued && stats_.queued >= opts_.max_queued) {
+    ++stats_.rejected;
+    return Ticket{};
+  }
+
+  Waiter waiter;
+  waiter.enqueued_usec = base::GetMonotonicMicrosFast();
+  waiter.deadline_usec = deadline_usec;
+  queues_[priority].push_back(&waiter);
+  ++stats_.queued;
+  lk.unlock();
+
+  // Release() hands over the slot of a finished call, so stats_.running stays the same.
+  waiter.done.Wait();
+
+  return waiter.admitted ? Ticket(this) : Ticket{};
+}
+
+auto AdmissionQueue::PopNext(unsigned* priority) -> Waiter* {
+  for (unsigned i = 0; i < kNumPriorities; ++i) {
+    auto& q = queues_[i];
+    if (q.empty())
+      continue;
+
+    *priority = i;
+    Waiter* res;
+    bool overloaded = opts_.lifo_after_usec &&
+        base::GetMonotonicMicrosFast() - q.front()->enqueued_usec > opts_.lifo_after_usec;
+    if (overloaded) {
+      res = q.back();
+      q.pop_back();
+    } else {
+      res = q.front();
+      q.pop_front();
+    }
+    --stats_.queued;
+    return res;
+  }
+  return nullptr;
+}
+
+void AdmissionQueue::Release() {
+  std::lock_guard<std::mutex> lk(mu_);
+
+  unsigned priority;
+  while (Waiter* waiter = PopNext(&priority)) {
+    uint64_t now = base::GetMonotonicMicrosFast();
+
+    // The waiter may return and destroy itself once notified, so we notify through a copy
+    // of its Done and do not touch it afterwards.
+    fibers_ext::Done done = waiter->done;
+    if (waiter->deadline_usec && now >= waiter->deadline_usec) {
+      ++stats_.expired;
+      done.Notify();
+      continue;
+    }
+
+    ++stats_.admitted;
+    stats_.queue_usec[priority].Add(now - waiter->enqueued_usec);
+    waiter->admitted = true;
+    done.Notify();
+    return;
+  }
+
+  --stats_.running;
+}
+
+auto AdmissionQueue::GetStats() const -> Stats {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,108 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "base/histogram.h"
+#include "util/fibers/fibers_ext.h"
+
+namespace util {
+namespace rpc {
+
+// Bounds the number of the calls of a service that run at once, see
+// ServiceInterface::set_admission(). The calls above the limit wait in a queue per priority
+// class and are admitted by the calls that finish, the higher classes first. Within a class the
+// oldest call is admitted first unless the class is overloaded, i.e. its oldest call has waited
+// longer than lifo_after_usec. Then the newest ones are admitted first, since they still have
+// time left to finish. The queued calls whose deadlines pass are dropped when their turn comes.
+// Thread-safe, the calls may come from all the IO threads. Exported via "rpc_admission" varz.
+class AdmissionQueue {
+ public:
+  enum Priority : uint8_t { HIGH = 0, NORMAL = 1, BULK = 2 };
+  static constexpr unsigned kNumPriorities = 3;
+
+  struct Options {
+    uint32_t max_concurrency = 64;
+
+    // The calls that find that many calls queued are rejected, 0 means no limit.
+    uint32_t max_queued = 0;
+
+    // 0 keeps the queues FIFO.
+    uint32_t lifo_after_usec = 0;
+  };
+
+  struct Stats {
+    uint64_t admitted = 0, rejected = 0, expired = 0;
+    uint32_t running = 0, queued = 0;
+    base::Histogram queue_usec[kNumPriorities];  // Of the calls that had to wait.
+  };
+
+  // Returned by Admit(), the call runs until the ticket is destroyed.
+  class Ticket {
+   public:
+    Ticket() = default;
+    Ticket(Ticket&& other) noexcept : queue_(other.queue_) { other.queue_ = nullptr; }
+    ~Ticket() {
+      if (queue_)
+        queue_->Release();
+    }
+
+    Ticket& operator=(Ticket&& other) noexcept {
+      std::swap(queue_, other.queue_);
+      return *this;
+    }
+
+    // False if the call was rejected or expired in the queue.
+    explicit operator bool() const { return queue_ != nullptr; }
+
+   private:
+    friend class AdmissionQueue;
+
+    explicit Ticket(AdmissionQueue* q) : queue_(q) {}
+
+    AdmissionQueue* queue_ = nullptr;
+  };
+
+  AdmissionQueue(std::string name, const Options& opts);
+  ~AdmissionQueue();
+
+  AdmissionQueue(const AdmissionQueue&) = delete;
+  void operator=(const AdmissionQueue&) = delete;
+
+  // Blocks the calling fiber until the call may run. deadline_usec is in
+  // base::GetMonotonicMicrosFast() units, 0 if the call has none. Priorities beyond BULK
+  // are treated as BULK.
+  Ticket Admit(unsigned priority, uint64_t deadline_usec);
+
+  const std::string& name() const { return name_; }
+
+  Stats GetStats() const;
+
+ private:
+  struct Waiter {
+    fibers_ext::Done done;
+    uint64_t enqueued_usec;
+    uint64_t deadline_usec;
+    bool admitted = false;
+  };
+
+  // Passes the slot of a finished call to the next waiter.
+  void Release();
+
+  // Requires mu_. Returns null if no call waits.
+  Waiter* PopNext(unsigned* priority);
+
+  const std::string name_;
+  const Options opts_;
+
+  mutable std::mutex mu_;
+  std::deque<Waiter*> queues_[kNumPriorities];
+  Stats stats_;
+};
+
+}  // namespace rpc
+}  // namespace util
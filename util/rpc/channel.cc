@@ -8,8 +8,10 @@
 #include "util/rpc/channel.h"
 
 #include "base/logging.h"
+#include "base/walltime.h"
 #include "util/asio/asio_utils.h"
 #include "util/rpc/frame_format.h"
+#include "util/rpc/letter_codec.h"
 #include "util/rpc/rpc_envelope.h"
 
 namespace util {
@@ -22,6 +24,18 @@ DEFINE_uint32(rpc_client_pending_limit, 1 << 17,
 DEFINE_uint32(rpc_client_queue_size, 128,
               "The size of the outgoing batch queue that contains envelopes waiting to send.");
 
+DEFINE_bool(rpc_send_deadline, false,
+            "Tells the servers how long the calls wait for their responses, so they skip "
+            "the expired ones. Requires servers that support deadline frames.");
+
+DEFINE_bool(rpc_send_trace, false,
+            "Propagates the sampled traces of the calls to the servers, see --trace_sample_rate. "
+            "Requires servers that support trace frames.");
+
+DEFINE_uint32(rpc_stream_window, 0,
+              "If positive, SendAndReadStream lets the server send at most that many envelopes "
+              "ahead of the stream callback. Requires servers that support window updates.");
+
 using namespace boost;
 using namespace std;
 using asio::ip::tcp;
@@ -59,6 +73,10 @@ auto Channel::Connect(uint32_t ms) -> error_code {
 
   IoContext& context = socket_->context();
   context.Await([this] {
+    Frame::Compression compression = ConfiguredCompression();
+    if (compression != Frame::NONE)
+      control_frames_.push_back(Frame::Hello(compression));
+
     read_fiber_ = fibers::fiber(&Channel::ReadFiber, this);
     flush_fiber_ = fibers::fiber(&Channel::FlushFiber, this);
   });
@@ -125,6 +143,11 @@ auto Channel::Send(uint32 deadline_msec, Envelope* envelope) -> future_code_t {
 
   outgoing_buf_.emplace_back(SendItem(id, PendingCall{std::move(p), envelope}));
   outgoing_buf_.back().second.expiry_event = std::move(ev);
+  outgoing_buf_.back().second.span = TraceSpan::StartChild("rpc-client", TraceSpan::CLIENT, true);
+  if (FLAGS_rpc_send_deadline) {
+    outgoing_buf_.back().second.deadline_usec =
+        base::GetMonotonicMicrosFast() + deadline_msec * 1000ULL;
+  }
   outgoing_buf_size_.store(outgoing_buf_.size(), std::memory_order_relaxed);
 
   OutgoingBufUnlock(lock_exclusive);
@@ -154,6 +177,8 @@ auto Channel::SendAndReadStream(Envelope* msg, MessageCallback cb) -> error_code
   RpcId id = next_send_rpc_id_++;
 
   outgoing_buf_.emplace_back(SendItem(id, PendingCall{std::move(p), msg, std::move(cb)}));
+  outgoing_buf_.back().second.window = FLAGS_rpc_stream_window;
+  outgoing_buf_.back().second.span = TraceSpan::StartChild("rpc-stream", TraceSpan::CLIENT, true);
   outgoing_buf_size_.store(outgoing_buf_.size(), std::memory_order_relaxed);
 
   OutgoingBufUnlock(exclusive);
@@ -199,7 +224,9 @@ void Channel::FlushFiber() {
     if (!socket_->is_open())
       break;
 
-    if (outgoing_buf_size_.load(std::memory_order_acquire) == 0 || !send_mu_.try_lock())
+    bool has_sends =
+        outgoing_buf_size_.load(std::memory_order_acquire) > 0 || !control_frames_.empty();
+    if (!has_sends || !send_mu_.try_lock())
       continue;
     VLOG(1) << "FlushFiber::FlushSendsGuarded";
     FlushSendsGuarded();
@@ -229,7 +256,7 @@ auto Channel::FlushSends() -> error_code {
 auto Channel::FlushSendsGuarded() -> error_code {
   error_code ec;
   // This function runs only in IOContext thread. Therefore only
-  if (outgoing_buf_.empty())
+  if (outgoing_buf_.empty() && control_frames_.empty())
     return ec;
 
   ec = socket_->status();
@@ -243,16 +270,52 @@ auto Channel::FlushSendsGuarded() -> error_code {
     RWSpinLock::ReadHolder holder(buf_lock_);  // protect outgoing_buf_ against Send path
 
     size_t count = outgoing_buf_.size();
-    write_seq_.resize(count * 3);
-    frame_buf_.resize(count);
+    Frame::Compression compression = compression_.load(std::memory_order_relaxed);
+    write_seq_.clear();
+    compressed_letters_.resize(count);
+    frame_buf_.resize(count * 4 + control_frames_.size());
+    size_t frame_index = 0;
+    auto write_frame = [&](const Frame& f) {
+      uint8_t* buf = frame_buf_[frame_index++].data();
+      write_seq_.push_back(asio::buffer(buf, f.Write(buf)));
+    };
+
+    for (const Frame& f : control_frames_) {
+      write_frame(f);
+    }
+    control_frames_.clear();
+
     for (size_t i = 0; i < count; ++i) {
       auto& p = outgoing_buf_[i];
-      Frame f(p.first, p.second.envelope->header.size(), p.second.envelope->letter.size());
-      size_t sz = f.Write(frame_buf_[i].data());
 
-      write_seq_[3 * i] = asio::buffer(frame_buf_[i].data(), sz);
-      write_seq_[3 * i + 1] = asio::buffer(p.second.envelope->header);
-      write_seq_[3 * i + 2] = asio::buffer(p.second.envelope->letter);
+      // Opens the window of the stream before the server starts it.
+      if (p.second.window) {
+        write_frame(Frame::WindowUpdate(p.first, p.second.window, true));
+      }
+
+      if (p.second.deadline_usec) {
+        uint64_t now = base::GetMonotonicMicrosFast();
+        uint64_t left = p.second.deadline_usec > now ? p.second.deadline_usec - now : 0;
+        write_frame(Frame::Deadline(p.first, (left + 999) / 1000));
+      }
+
+      const TraceContext& trace = p.second.span.context();
+      if (trace && FLAGS_rpc_send_trace) {
+        write_frame(Frame::Trace(p.first, Frame::TRACE_ID, trace.trace_id));
+        write_frame(Frame::Trace(p.first, Frame::TRACE_PARENT, trace.span_id));
+      }
+
+      // The caller owns the envelope and may resend it, so we compress into a side buffer.
+      const BufferType& letter = p.second.envelope->letter;
+      BufferType& compressed = compressed_letters_[i];
+      bool compress = CompressLetter(compression, letter, &compressed);
+      const BufferType& wire_letter = compress ? compressed : letter;
+
+      Frame f(p.first, p.second.envelope->header.size(), wire_letter.size());
+      f.compression = compress ? compression : Frame::NONE;
+      write_frame(f);
+      write_seq_.push_back(asio::buffer(p.second.envelope->header));
+      write_seq_.push_back(asio::buffer(wire_letter));
     }
 
     // Fill the pending call before the socket.Write() because otherwise in case it blocks
@@ -291,6 +354,7 @@ void Channel::ExpirePending(RpcId id) {
   // The order is important to eliminate interrupts.
   EcPromise pr = std::move(it->second.promise);
   this->pending_calls_.erase(it);
+  pending_calls_size_.fetch_sub(1, std::memory_order_relaxed);
   pr.set_value(asio::error::timed_out);
 }
 
@@ -315,28 +379,34 @@ auto Channel::ReadEnvelope() -> error_code {
 
   VLOG(2) << "Got rpc_id " << f.rpc_id << " from socket " << socket_->native_handle();
 
+  if (f.type == Frame::HELLO) {
+    VLOG(1) << "Compression " << int(f.compression) << " for " << socket_->native_handle();
+    compression_.store(f.compression, std::memory_order_relaxed);
+    return ec;
+  }
+
   auto it = pending_calls_.find(f.rpc_id);
   if (it == pending_calls_.end()) {
     // It might happens if for some reason we flushed pending_calls_ or the rpc has expired and
     //  the envelope reached us afterwards. We just consume it.
     VLOG(1) << "Unknown id " << f.rpc_id;
 
-    Envelope envelope(f.header_size, f.letter_size);
+    Envelope envelope = EnvelopePool::Get();
 
     // ReadEnvelope is called via Channel::Apply, so no need to call it here.
-    asio::read(*socket_, envelope.buf_seq(), ec);
+    ec = ReadEnvelopeBody(f, socket_.get(), &envelope, &compressed_);
+    EnvelopePool::Recycle(&envelope);
     return ec;
   }
 
   // -- NO interrupt section begin
   PendingCall& call = it->second;
   Envelope* env = call.envelope;
-  env->Resize(f.header_size, f.letter_size);
   bool is_stream = static_cast<bool>(call.cb);
 
   if (is_stream) {
     VLOG(1) << "Processing stream";
-    asio::read(*socket_, env->buf_seq(), ec);
+    ec = ReadEnvelopeBody(f, socket_.get(), env, &compressed_);
     if (!ec) {
       HandleStreamResponse(f.rpc_id);
     }
@@ -345,13 +415,14 @@ auto Channel::ReadEnvelope() -> error_code {
   }
 
   fibers::promise<error_code> promise = std::move(call.promise);
+  TraceSpan span = std::move(call.span);  // Ends once the response is read.
   // We erase before reading from the socket/setting promise because pending_calls_ might change
   // when we resume after IO and 'it' will be invalidated.
   pending_calls_.erase(it);
   pending_calls_size_.fetch_sub(1, std::memory_order_relaxed);
   // -- NO interrupt section end
 
-  asio::read(*socket_, env->buf_seq(), ec);
+  ec = ReadEnvelopeBody(f, socket_.get(), env, &compressed_);
   promise.set_value(ec);
 
   return ec;
@@ -364,8 +435,14 @@ void Channel::HandleStreamResponse(RpcId rpc_id) {
   }
   PendingCall& call = it->second;
   error_code ec = call.cb(*call.envelope);
-  if (!ec)
+  if (!ec) {
+    // Returns the credit in batches of half a window.
+    if (call.window && ++call.consumed >= (call.window + 1) / 2) {
+      control_frames_.push_back(Frame::WindowUpdate(rpc_id, call.consumed, false));
+      call.consumed = 0;
+    }
     return;
+  }
 
   // eof - means successful finish of stream receival.
   if (ec == error::eof) {
@@ -377,6 +454,7 @@ void Channel::HandleStreamResponse(RpcId rpc_id) {
   // set_value might context switch and invalidate 'it'.
   auto promise = std::move(call.promise);
   pending_calls_.erase(it);
+  pending_calls_size_.fetch_sub(1, std::memory_order_relaxed);
   promise.set_value(ec);
 }
 
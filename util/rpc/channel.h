@@ -12,6 +12,7 @@
 
 #include "util/asio/fiber_socket.h"
 #include "util/asio/periodic_task.h"
+#include "util/asio/request_trace.h"
 
 #include "util/rpc/frame_format.h"
 #include "util/rpc/rpc_envelope.h"
@@ -43,11 +44,14 @@ class Channel {
 
   // Blocks at least for 'ms' milliseconds to connect to the host.
   // Should be called once during the initialization phase before sending the requests.
+  // With --rpc_compression also negotiates the compression of the letters.
   error_code Connect(uint32_t ms);
 
   // Thread-safe function.
   // Sends the envelope and returns the future to the response status code.
   // Future is realized when response is received and serialized into the same envelope.
+  // With --rpc_send_deadline the server learns the deadline and drops the call once it expires.
+  // The call is a span of the trace of the calling fiber, see util/asio/request_trace.h.
   // Send() might block therefore it should not be called directly from IoContext loop (post).
   future_code_t Send(uint32_t deadline_msec, Envelope* envelope);
 
@@ -62,11 +66,22 @@ class Channel {
   // MessageCallback should return True if more items are expected in the stream.
   // i.e. Envelope should contain stream-related information to allow MessageCallback to
   // decide whether more envelopes should come.
+  // With --rpc_stream_window the server blocks the stream once it is that many envelopes
+  // ahead of the callback, so a slow callback does not make the server buffer the stream.
   error_code SendAndReadStream(Envelope* msg, MessageCallback cb);
 
   // Blocks the calling fiber until all the background processes finish.
   void Shutdown();
 
+  // The calls that were sent or queued and did not finish yet.
+  size_t OutstandingCalls() const {
+    return pending_calls_size_.load(std::memory_order_relaxed) +
+           outgoing_buf_size_.load(std::memory_order_relaxed);
+  }
+
+  // The status of the connection, the socket reconnects in the background after errors.
+  error_code status() const { return socket_->status(); }
+
  private:
   void ReadFiber();
   void FlushFiber();
@@ -126,6 +141,13 @@ class Channel {
 
     MessageCallback cb;  // for Stream response.
 
+    // Stream flow control: the credit granted to the server and the envelopes consumed since
+    // it was last returned.
+    uint32_t window = 0, consumed = 0;
+
+    uint64_t deadline_usec = 0;  // Sent to the server with --rpc_send_deadline.
+    TraceSpan span;  // Ends with the call, sent to the server with --rpc_send_trace.
+
     PendingCall(EcPromise p, Envelope* env, MessageCallback mcb = MessageCallback{})
       : promise(std::move(p)), envelope(env), cb(std::move(mcb)) {
     }
@@ -144,6 +166,15 @@ class Channel {
   std::vector<SendItem> outgoing_buf_;  // protected by buf_lock_.
   std::atomic_ulong outgoing_buf_size_{0};
 
+  // HELLO and the credit returned by ReadFiber, flushed before the sends.
+  // Accessed from IoContext thread only.
+  std::vector<Frame> control_frames_;
+
+  // Negotiated with the server, NONE until it answers our HELLO.
+  std::atomic<Frame::Compression> compression_{Frame::NONE};
+  BufferType compressed_;  // Used by ReadFiber.
+  std::vector<BufferType> compressed_letters_;  // Used by FlushSendsGuarded.
+
   boost::fibers::fiber read_fiber_, flush_fiber_;
   boost::fibers::mutex send_mu_;  // protects FlushSendsGuarded.
 
@@ -0,0 +1,261 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/channel_pool.h"
+
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/mutex.hpp>
+
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_VARZ(VarzCount, rpc_hedged_calls);
+
+namespace util {
+namespace rpc {
+
+using namespace boost;
+using namespace std;
+
+struct ChannelPool::HedgedCall {
+  fibers::mutex mu;
+  fibers::condition_variable cv;
+  Envelope envelopes[2];
+  error_code last_ec;
+  int winner = -1;
+  unsigned launched = 1, finished = 0;
+};
+
+bool ChannelPool::Endpoint::healthy(uint64_t now) const {
+  if (ejected_until > now)
+    return false;
+
+  for (const auto& channel : channels) {
+    if (!channel->status())
+      return true;
+  }
+  return false;
+}
+
+ChannelPool::ChannelPool(const vector<string>& endpoints, const Options& opts, IoContext* cntx)
+    : cntx_(*cntx), opts_(opts), endpoints_(endpoints.size()), rand_(random_device{}()) {
+  CHECK(!endpoints.empty());
+  CHECK_GT(opts.connections_per_endpoint, 0);
+
+  for (size_t i = 0; i < endpoints.size(); ++i) {
+    size_t pos = endpoints[i].rfind(':');
+    CHECK_NE(string::npos, pos) << "Expected host:port, got " << endpoints[i];
+
+    Endpoint& ep = endpoints_[i];
+    ep.host = endpoints[i].substr(0, pos);
+    ep.port = endpoints[i].substr(pos + 1);
+    for (unsigned j = 0; j < opts.connections_per_endpoint; ++j) {
+      ep.channels.emplace_back(new Channel(ep.host, ep.port, cntx));
+    }
+  }
+}
+
+ChannelPool::~ChannelPool() {
+  Shutdown();
+
+  // Shutdown cancels the pending calls, the attempts finish right after.
+  attempts_.Wait();
+}
+
+auto ChannelPool::Connect() -> error_code {
+  vector<fibers::fiber> fbs;
+  vector<error_code> ecs(endpoints_.size() * opts_.connections_per_endpoint);
+
+  unsigned index = 0;
+  for (Endpoint& ep : endpoints_) {
+    for (auto& channel : ep.channels) {
+      fbs.emplace_back([&, ch = channel.get(), res = &ecs[index++]] {
+        *res = ch->Connect(opts_.connect_msec);
+      });
+    }
+  }
+  for (auto& fb : fbs) {
+    fb.join();
+  }
+
+  error_code ec;
+  index = 0;
+  bool connected = false;
+  for (const Endpoint& ep : endpoints_) {
+    bool ep_connected = false;
+    for (unsigned j = 0; j < ep.channels.size(); ++j, ++index) {
+      if (ecs[index])
+        ec = ecs[index];
+      else
+        ep_connected = true;
+    }
+    LOG_IF(WARNING, !ep_connected) << "Could not connect to " << ep.host << ":" << ep.port;
+    connected |= ep_connected;
+  }
+
+  return connected ? error_code{} : ec;
+}
+
+auto ChannelPool::PickChannel(const Endpoint* exclude) -> Pick {
+  DCHECK(cntx_.InContextThread());
+
+  uint64_t now = base::GetMonotonicMicrosFast();
+  candidates_.clear();
+  for (Endpoint& ep : endpoints_) {
+    if (&ep == exclude || !ep.healthy(now))
+      continue;
+    for (auto& channel : ep.channels) {
+      if (!channel->status())
+        candidates_.emplace_back(&ep, channel.get());
+    }
+  }
+
+  // Nothing is healthy, it is better to try than to fail all the calls.
+  if (candidates_.empty()) {
+    for (Endpoint& ep : endpoints_) {
+      if (&ep == exclude)
+        continue;
+      for (auto& channel : ep.channels) {
+        candidates_.emplace_back(&ep, channel.get());
+      }
+    }
+  }
+
+  if (candidates_.empty())
+    return Pick{nullptr, nullptr};
+
+  auto less_loaded = [](const Pick& a, const Pick& b) {
+    return a.second->OutstandingCalls() < b.second->OutstandingCalls();
+  };
+
+  if (opts_.policy == LEAST_OUTSTANDING || candidates_.size() <= 2) {
+    return *std::min_element(candidates_.begin(), candidates_.end(), less_loaded);
+  }
+
+  uniform_int_distribution<size_t> dist(0, candidates_.size() - 1);
+  const Pick& a = candidates_[dist(rand_)];
+  const Pick& b = candidates_[dist(rand_)];
+  return less_loaded(b, a) ? b : a;
+}
+
+void ChannelPool::Report(Endpoint* ep, error_code ec) {
+  if (!ec) {
+    ep->failures = 0;
+    return;
+  }
+
+  if (++ep->failures < opts_.max_failures)
+    return;
+
+  LOG(WARNING) << "Ejecting " << ep->host << ":" << ep->port << " for " << opts_.eject_msec
+               << "ms after " << ep->failures << " failures, last: " << ec.message();
+  ep->failures = 0;
+  ep->ejected_until = base::GetMonotonicMicrosFast() + opts_.eject_msec * 1000ULL;
+}
+
+auto ChannelPool::SendSync(uint32_t deadline_msec, Envelope* envelope) -> error_code {
+  if (hedge_delay_usec_ && endpoints_.size() > 1)
+    return SendHedged(deadline_msec, envelope);
+
+  Pick pick = PickChannel();
+  uint64_t start = base::GetMonotonicMicrosFast();
+  error_code ec = pick.second->SendSync(deadline_msec, envelope);
+  Report(pick.first, ec);
+  if (!ec && opts_.hedge)
+    RecordLatency(base::GetMonotonicMicrosFast() - start);
+  return ec;
+}
+
+// The attempts run in their own fibers on copies of the envelope because the loser may still
+// be in flight when SendSync returns.
+auto ChannelPool::SendHedged(uint32_t deadline_msec, Envelope* envelope) -> error_code {
+  auto call = std::make_shared<HedgedCall>();
+  auto copy_request = [&](Envelope* dest) {
+    dest->header.assign(envelope->header);
+    dest->letter.assign(envelope->letter);
+  };
+
+  Pick primary = PickChannel();
+  copy_request(&call->envelopes[0]);
+  RunAttempt(deadline_msec, primary, 0, call);
+
+  std::unique_lock<fibers::mutex> lk(call->mu);
+  auto primary_finished = [&] { return call->finished > 0; };
+  if (!call->cv.wait_for(lk, chrono::microseconds(hedge_delay_usec_), primary_finished)) {
+    Pick hedge = PickChannel(primary.first);
+    if (hedge.second) {
+      rpc_hedged_calls.Inc();
+      copy_request(&call->envelopes[1]);
+      call->launched = 2;
+      RunAttempt(deadline_msec, hedge, 1, call);
+    }
+  }
+
+  call->cv.wait(lk, [&] { return call->winner >= 0 || call->finished == call->launched; });
+  if (call->winner < 0)
+    return call->last_ec;
+
+  envelope->Swap(&call->envelopes[call->winner]);
+  return error_code{};
+}
+
+void ChannelPool::RunAttempt(uint32_t deadline_msec, Pick pick, unsigned index,
+                             std::shared_ptr<HedgedCall> call) {
+  attempts_.Add(1);
+  fibers::fiber([this, deadline_msec, pick, index, call = std::move(call)] {
+    uint64_t start = base::GetMonotonicMicrosFast();
+    error_code ec = pick.second->SendSync(deadline_msec, &call->envelopes[index]);
+    Report(pick.first, ec);
+    if (!ec)
+      RecordLatency(base::GetMonotonicMicrosFast() - start);
+
+    std::unique_lock<fibers::mutex> lk(call->mu);
+    ++call->finished;
+    if (ec)
+      call->last_ec = ec;
+    else if (call->winner < 0)
+      call->winner = index;
+    call->cv.notify_one();
+    lk.unlock();
+
+    attempts_.Dec();
+  }).detach();
+}
+
+void ChannelPool::RecordLatency(uint64_t usec) {
+  latencies_.Add(usec);
+  if (latencies_.count() < opts_.hedge_window)
+    return;
+
+  hedge_delay_usec_ = std::max<uint64_t>(1, latencies_.Percentile(opts_.hedge_percentile));
+  VLOG(1) << "Hedging calls after " << hedge_delay_usec_ << "us";
+  latencies_.Clear();
+}
+
+auto ChannelPool::SendAndReadStream(Envelope* msg, Channel::MessageCallback cb) -> error_code {
+  Pick pick = PickChannel();
+  error_code ec = pick.second->SendAndReadStream(msg, std::move(cb));
+  Report(pick.first, ec);
+  return ec;
+}
+
+void ChannelPool::Shutdown() {
+  for (Endpoint& ep : endpoints_) {
+    for (auto& channel : ep.channels) {
+      channel->Shutdown();
+    }
+  }
+}
+
+unsigned ChannelPool::healthy_endpoints() const {
+  uint64_t now = base::GetMonotonicMicrosFast();
+  unsigned res = 0;
+  for (const Endpoint& ep : endpoints_) {
+    res += ep.healthy(now);
+  }
+  return res;
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,95 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <random>
+
+#include "base/histogram.h"
+#include "util/fibers/fibers_ext.h"
+#include "util/rpc/channel.h"
+
+namespace util {
+namespace rpc {
+
+// Spreads the rpc calls over several backends with a few Channels to each.
+// Every call goes to the healthy channel with the fewest outstanding calls, either among all of
+// them or among two random ones, so a slow backend accumulates outstanding calls and gets less
+// traffic. Channels reconnect in the background. Endpoints that fail max_failures calls in a row
+// are ejected for eject_msec. If all endpoints are ejected, the pool uses them anyway.
+// With hedge, a SendSync call that did not finish within hedge_percentile of the recent call
+// latencies is sent again to another endpoint and the first successful response wins. Hedge only
+// idempotent calls, both of the attempts may run on the servers.
+// IoContext specific: must be used from the fibers of its IoContext.
+class ChannelPool {
+ public:
+  using error_code = Channel::error_code;
+
+  enum Policy { LEAST_OUTSTANDING, POWER_OF_TWO };
+
+  struct Options {
+    unsigned connections_per_endpoint = 2;
+    Policy policy = POWER_OF_TWO;
+    uint32_t connect_msec = 1000;
+    uint32_t max_failures = 5;
+    uint32_t eject_msec = 2000;
+
+    bool hedge = false;
+    double hedge_percentile = 95;
+    unsigned hedge_window = 1000;  // The number of the calls the hedge delay is measured over.
+  };
+
+  // endpoints are "host:port" strings.
+  ChannelPool(const std::vector<std::string>& endpoints, const Options& opts, IoContext* cntx);
+  ~ChannelPool();
+
+  // Connects all the channels in parallel. Returns the last error if no endpoint connected.
+  error_code Connect();
+
+  // Same as Channel::SendSync.
+  error_code SendSync(uint32_t deadline_msec, Envelope* envelope);
+
+  // Same as Channel::SendAndReadStream.
+  error_code SendAndReadStream(Envelope* msg, Channel::MessageCallback cb);
+
+  void Shutdown();
+
+  // The number of endpoints that are connected and not ejected.
+  unsigned healthy_endpoints() const;
+
+ private:
+  struct Endpoint {
+    std::string host, port;
+    std::vector<std::unique_ptr<Channel>> channels;
+    unsigned failures = 0;
+    uint64_t ejected_until = 0;  // monotonic usec.
+
+    bool healthy(uint64_t now) const;
+  };
+
+  using Pick = std::pair<Endpoint*, Channel*>;
+
+  struct HedgedCall;
+
+  // Skips the channels of exclude. Returns {nullptr, nullptr} if no other channel is left.
+  Pick PickChannel(const Endpoint* exclude = nullptr);
+  void Report(Endpoint* ep, error_code ec);
+
+  error_code SendHedged(uint32_t deadline_msec, Envelope* envelope);
+  void RunAttempt(uint32_t deadline_msec, Pick pick, unsigned index,
+                  std::shared_ptr<HedgedCall> call);
+  void RecordLatency(uint64_t usec);
+
+  IoContext& cntx_;
+  Options opts_;
+  std::vector<Endpoint> endpoints_;
+  std::vector<Pick> candidates_;  // Used by PickChannel.
+  std::minstd_rand rand_;
+
+  base::Histogram latencies_;   // usec of the successful calls.
+  uint64_t hedge_delay_usec_ = 0;  // 0 until hedge_window calls were measured.
+  fibers_ext::BlockingCounter attempts_{0};  // The running hedged attempts.
+};
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,70 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <functional>
+
+#include "util/asio/request_arena.h"
+#include "util/rpc/rpc_envelope.h"
+
+namespace util {
+namespace rpc {
+
+// Also defined in frame_format.h. Seems to work.
+typedef uint64_t RpcId;
+
+// ConnectionBridge is responsible to abstract higher level server-app logic and to provide
+// an interface that allows to map Envelope to ServiceInterface methods.
+// ConnectionBridge is a single-fiber creature, so currently only one caller fiber can
+// use it simultaneusly.
+// ConnectionBridge can be asynchronous, i.e. it's main calling function HandleEnvelope
+// can exit before it finishes writing to EnvelopeWriter.
+class ConnectionBridge {
+ public:
+  typedef std::function<void(Envelope&&)> EnvelopeWriter;
+
+  virtual ~ConnectionBridge() {}
+
+  // Is called once from the connection thread before HandleEnvelope is being called.
+  // Is intended to finalize the setup for the bridge inside its intended thread.
+  virtual void InitInThread() {}
+
+  // Main entry function that handles the input envelope and is responsible for
+  // writing the results via writer.
+  // HandleEnvelope first reads the input and if everything is parsed fine, it writes
+  // back one or more envelopes via the writer. Specifics of the protocol are defined
+  // in the derived class. Since HandleEnvelope can be asynchronous,
+  // the caller should make sure the writer is valid through the call.
+  // Writing back *input or envelopes from EnvelopePool::Get() avoids allocating buffers.
+  virtual void HandleEnvelope(RpcId rpc_id, Envelope* input,
+                              EnvelopeWriter writer) = 0;
+
+  // The priority class of the call, an AdmissionQueue::Priority that the bridge usually reads
+  // from its header. Used only by the services with ServiceInterface::set_admission().
+  virtual unsigned Priority(const Envelope& input) { return 1; }
+
+  // In case HandleEnvelope is asynchronous, waits for all the issued calls to finish.
+  // HandleEnvelope should not be called after calling Join().
+  virtual void Join() {};
+
+  // The time until which the client waits for the call that HandleEnvelope handles,
+  // in base::GetMonotonicMicrosFast() units, or 0 if it did not tell. Valid during
+  // HandleEnvelope, asynchronous bridges should copy it. Long handlers can stop once it
+  // passes, the server drops the envelopes that are written afterwards anyway.
+  uint64_t deadline_usec() const { return deadline_usec_; }
+
+  // The arena of the call that HandleEnvelope handles, for its temporary parsing and
+  // formatting allocations. Is released once the bridge destroys the writer of the call,
+  // so asynchronous bridges should copy the pointer and may use it until then.
+  pmr::memory_resource* memory_resource() const { return memory_resource_; }
+
+ private:
+  friend class RpcConnectionHandler;
+
+  uint64_t deadline_usec_ = 0;
+  pmr::memory_resource* memory_resource_ = pmr::get_default_resource();
+};
+
+}  // namespace rpc
+}  // namespace util
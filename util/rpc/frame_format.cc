@@ -48,10 +48,9 @@ uint8_t Frame::DecodeStart(const uint8_t* src, ::boost::system::error_code& ec)
     return 0;
   }
 
-  if (src[4] >> 4 != 0) {  // version check
-    ec = make_error_code(gaia_error::invalid_version);
-    return 0;
-  }
+  type = Type((src[4] >> 4) & 3);
+  compression = Compression(src[4] >> 6);
+
   rpc_id = UNALIGNED_LOAD64(src + 4);
   rpc_id >>= 8;
 
@@ -72,7 +71,8 @@ unsigned Frame::Write(uint8* dest) const {
   DCHECK_LT(msg_bytes_minus1, 4);
   DCHECK_LT(cntrl_bytes_minus1, 4);
 
-  uint64_t version = cntrl_bytes_minus1 | (msg_bytes_minus1 << 2) | (0 << 4);
+  uint64_t version =
+      cntrl_bytes_minus1 | (msg_bytes_minus1 << 2) | (type << 4) | (compression << 6);
 
   LittleEndian::Store64(dest, (rpc_id << 8) | version);
   dest += 8;
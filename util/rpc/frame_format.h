@@ -19,13 +19,30 @@ namespace rpc {
 /*
   Frame structure:
     header str ("URPC") - 4 bytes
-    uint8 version + control size length + message size length 1 byte (4bits + 2bits + 2bits)
+    uint8 compression + frame type + control size length + message size length 1 byte
+      (2bits + 2bits + 2bits + 2bits)
     uint56 rpc_id - LE56
     header_size - LE of control size length
     message size - LE on message size length
     BLOB char[header_size + message_size]:
       PB - control packet of size header_size
       PB - message request of size message_size
+
+  WINDOW_UPDATE frames carry no BLOB. They grant the server message size more envelopes
+  for the stream of rpc_id, see Channel::SendAndReadStream. The frame that opens the window
+  of a stream has header size 1 and precedes the request.
+
+  HELLO frames carry no BLOB either. A client sends one with the compression it wants when it
+  connects and the server answers with the compression it accepts (NONE if it does not).
+  Afterwards both sides may compress the letters of DATA frames with it, see letter_codec.h.
+
+  DEADLINE frames carry no BLOB. They precede the request of rpc_id and tell the server
+  that the client waits for message size more milliseconds.
+
+  TRACE frames are DEADLINE frames with a compression other than NONE, which deadlines do not
+  use. They precede the request of rpc_id too and carry a 64 bit id in header size (lower half)
+  and message size (upper half): the trace of the request with TRACE_ID and the span of
+  the client call with TRACE_PARENT, see util/asio/request_trace.h.
 */
 
 // Also defined in rpc_connection.h. Seems to work.
@@ -37,23 +54,67 @@ class Frame {
  public:
   typedef ::boost::asio::ip::tcp::socket socket_t;
 
+  enum Type : uint8_t { DATA = 0, WINDOW_UPDATE = 1, HELLO = 2, DEADLINE = 3 };
+  enum Compression : uint8_t { NONE = 0, LZ4 = 1, ZSTD = 2, ZSTD_DICT = 3 };
+
   RpcId rpc_id;
   uint32_t header_size;
   uint32_t letter_size;
+  Type type = DATA;
+  Compression compression = NONE;
 
   Frame() : rpc_id(1), header_size(0), letter_size(0) {}
   Frame(RpcId r, uint32_t cs, uint32_t ms) : rpc_id(r), header_size(cs), letter_size(ms) {}
 
+  static Frame WindowUpdate(RpcId r, uint32_t credit, bool open) {
+    Frame res(r, open, credit);
+    res.type = WINDOW_UPDATE;
+    return res;
+  }
+
+  static Frame Hello(Compression c) {
+    Frame res(0, 0, 0);
+    res.type = HELLO;
+    res.compression = c;
+    return res;
+  }
+
+  static Frame Deadline(RpcId r, uint32_t msec) {
+    Frame res(r, 0, msec);
+    res.type = DEADLINE;
+    return res;
+  }
+
+  enum TracePart : uint8_t { TRACE_ID = 1, TRACE_PARENT = 2 };
+
+  static Frame Trace(RpcId r, TracePart part, uint64_t id) {
+    Frame res(r, uint32_t(id), uint32_t(id >> 32));
+    res.type = DEADLINE;
+    res.compression = Compression(part);
+    return res;
+  }
+
+  bool is_deadline() const { return type == DEADLINE && compression == NONE; }
+  bool is_trace() const { return type == DEADLINE && compression != NONE; }
+  TracePart trace_part() const { return TracePart(compression); }
+  uint64_t trace_value() const { return (uint64_t(letter_size) << 32) | header_size; }
+
+  bool is_window_update() const { return type == WINDOW_UPDATE; }
+  bool opens_window() const { return header_size != 0; }
+  uint32_t credit() const { return letter_size; }
+
   enum { kMinByteSize = 4 + 1 + 7 + 2, kMaxByteSize = 4 + 1 + 7 + 4 * 2 };
 
   bool operator==(const Frame& other) const {
     return other.rpc_id == rpc_id && other.header_size == header_size &&
-           other.letter_size == letter_size;
+           other.letter_size == letter_size && other.type == type &&
+           other.compression == compression;
   }
 
   // friend std::ostream& operator<<(std::ostream& o, const Frame& frame);
 
-  uint32 total_size() const { return header_size + letter_size; }
+  // The size of the BLOB that follows the frame.
+  uint32 total_size() const { return type == DATA ? header_size + letter_size : 0; }
 
   // dest must be at least kMaxByteSize size.
   // Returns the exact number of bytes written to the buffer (less or equal to kMaxByteSize).
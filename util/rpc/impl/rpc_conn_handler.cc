@@ -8,9 +8,15 @@
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "base/walltime.h"
 
 #include "util/asio/asio_utils.h"
 #include "util/asio/io_context.h"
+#include "util/rpc/letter_codec.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_VARZ(VarzCount, rpc_expired_calls);
+DEFINE_VARZ(VarzCount, rpc_rejected_calls);
 
 namespace util {
 namespace rpc {
@@ -24,15 +30,21 @@ using fibers_ext::yield;
 
 constexpr size_t kRpcPoolSize = 32;
 
-RpcConnectionHandler::RpcConnectionHandler(ConnectionBridge* bridge, IoContext* context)
-    : ConnectionHandler(context), bridge_(bridge), rpc_items_(kRpcPoolSize) {
+RpcConnectionHandler::RpcConnectionHandler(ConnectionBridge* bridge, IoContext* context,
+                                           const ServiceInterface::WriteOptions& write_opts,
+                                           std::shared_ptr<AdmissionQueue> admission)
+    : ConnectionHandler(context), bridge_(bridge), rpc_items_(kRpcPoolSize),
+      write_opts_(write_opts), admission_(std::move(admission)) {
   use_flusher_fiber_ = true;
 }
 
 RpcConnectionHandler::~RpcConnectionHandler() {
   bridge_->Join();
 
-  outgoing_buf_.clear_and_dispose([this](RpcItem* i) { rpc_items_.Release(i); });
+  for (const PendingRequest& req : pending_requests_) {
+    ReleaseItem(req.item);
+  }
+  outgoing_buf_.clear_and_dispose([this](RpcItem* i) { ReleaseItem(i); });
 }
 
 bool RpcConnectionHandler::FlushWrites() {
@@ -61,15 +73,80 @@ system::error_code RpcConnectionHandler::HandleRequest() {
 
   if (ec_)
     return ec_;
+  read_fiber_ = this_fiber::get_id();
+
+  if (pending_requests_.empty()) {
+    ReadFrame();
+    if (ec_ || pending_requests_.empty())  // pending_requests_ is empty after control frames.
+      return ec_;
+  }
+
+  PendingRequest req = pending_requests_.front();
+  pending_requests_.erase(pending_requests_.begin());
+  Dispatch(req);
+
+  if (ShouldFlush()) {
+    req_flushes_ += FlushWritesInternal();
+  }
+
+  return ec_;
+}
 
+void RpcConnectionHandler::ReadFrame() {
   rpc::Frame frame;
   ec_ = frame.Read(&socket_.value());
   if (ec_) {
-    return ec_;
+    credit_ec_.notifyAll();  // Wakes the streams waiting for credit.
+    return;
   }
 
   DCHECK_NE(-1, socket_->native_handle());
 
+  if (frame.type == Frame::HELLO) {
+    compression_ = SupportsCompression(frame.compression) ? frame.compression : Frame::NONE;
+    VLOG(1) << "Compression " << int(compression_) << " for " << socket_->native_handle();
+
+    uint8_t buf[Frame::kMaxByteSize];
+    size_t sz = Frame::Hello(compression_).Write(buf);
+    std::lock_guard<fibers::mutex> lk(wr_mu_);
+    asio::write(*socket_, asio::buffer(buf, sz), ec_);
+    if (ec_)
+      credit_ec_.notifyAll();
+    return;
+  }
+
+  if (frame.is_trace()) {
+    if (frame.rpc_id != trace_id_) {
+      trace_id_ = frame.rpc_id;
+      trace_ = TraceContext{};
+    }
+    if (frame.trace_part() == Frame::TRACE_ID)
+      trace_.trace_id = frame.trace_value();
+    else if (frame.trace_part() == Frame::TRACE_PARENT)
+      trace_.span_id = frame.trace_value();
+    return;
+  }
+
+  if (frame.is_deadline()) {
+    deadline_id_ = frame.rpc_id;
+    deadline_usec_ = base::GetMonotonicMicrosFast() + frame.letter_size * 1000ULL;
+    return;
+  }
+
+  if (frame.is_window_update()) {
+    VLOG(2) << "Window update " << frame.rpc_id << ": " << frame.credit();
+    auto it = windows_.find(frame.rpc_id);
+    if (frame.opens_window() && it == windows_.end()) {
+      it = windows_.emplace(frame.rpc_id, std::make_shared<StreamWindow>()).first;
+    }
+    if (it == windows_.end())  // The stream has finished.
+      return;
+
+    it->second->credit += frame.credit();
+    credit_ec_.notifyAll();
+    return;
+  }
+
   if (rpc_items_.empty() && !outgoing_buf_.empty()) {
     req_flushes_ += FlushWritesInternal();
   }
@@ -77,36 +154,134 @@ system::error_code RpcConnectionHandler::HandleRequest() {
   // We use item for reading the envelope.
   auto item_ptr = rpc_items_.make_unique();
 
-  Envelope* envelope = &item_ptr->envelope;
-  envelope->Resize(frame.header_size, frame.letter_size);
-  auto rbuf_seq = item_ptr->buf_seq();
-  asio::read(*socket_, rbuf_seq, ec_);
+  ec_ = ReadEnvelopeBody(frame, &socket_.value(), &item_ptr->envelope, &compressed_);
   if (ec_) {
     VLOG(1) << "async_read " << ec_ << " /" << socket_->native_handle();
-    return ec_;
+    credit_ec_.notifyAll();
+    return;
   }
   DCHECK_NE(-1, socket_->native_handle());
 
-  // To support streaming we have this writer that creq_flushes_an write multiple envelopes per
+  uint64_t deadline = frame.rpc_id == deadline_id_ ? deadline_usec_ : 0;
+  TraceContext trace = frame.rpc_id == trace_id_ ? trace_ : TraceContext{};
+  pending_requests_.push_back(PendingRequest{frame, item_ptr.release(), deadline, trace});
+}
+
+void RpcConnectionHandler::Dispatch(const PendingRequest& req) {
+  // The client has given up on the call, so we do not start it.
+  if (req.deadline_usec && base::GetMonotonicMicrosFast() >= req.deadline_usec) {
+    rpc_expired_calls.Inc();
+    ReleaseItem(req.item);
+    return;
+  }
+
+  WindowPtr window;
+  auto it = windows_.find(req.frame.rpc_id);
+  if (it != windows_.end()) {
+    window = it->second;
+    window->dispatched = true;
+  }
+
+  AdmissionQueue::Ticket ticket;
+  if (admission_ && !window) {
+    ticket = admission_->Admit(bridge_->Priority(req.item->envelope), req.deadline_usec);
+    if (!ticket) {
+      rpc_rejected_calls.Inc();
+      ReleaseItem(req.item);
+      return;
+    }
+  }
+
+  // Shared by the copies of the writer, the call finishes and its arena is released once
+  // the bridge destroys them.
+  auto call = std::make_shared<CallState>();
+  call->ticket = std::move(ticket);
+
+  // To support streaming we have this writer that can write multiple envelopes per
   // single rpc request. We pass captures by value to allow asynchronous invocation
   // of ConnectionBridge::HandleEnvelope. We move writer object into HandleEnvelope,
   // thus it will be responsible to own it until the handler finishes.
   // Please note that writer changes the value of 'item' field (it's mutable),
   // so only for the first outgoing envelope it uses the same RpcItem used for reading the data
-  // to reduce allocations.
-  auto writer = [rpc_id = frame.rpc_id, item = item_ptr.release(), this](Envelope&& env) mutable {
+  // to reduce allocations. Flow controlled streams block in the writer until they have credit.
+  auto writer = [rpc_id = req.frame.rpc_id, item = req.item, window, this,
+                 deadline = req.deadline_usec, call](Envelope&& env) mutable {
     RpcItem* next = item ? item : rpc_items_.Get();
+    item = nullptr;
 
-    next->envelope = std::move(env);
+    if (deadline && base::GetMonotonicMicrosFast() >= deadline) {
+      rpc_expired_calls.Inc();
+      ReleaseItem(next);  // The client does not wait for it anymore.
+      return;
+    }
+
+    if (window && !AcquireCredit(window.get())) {
+      ReleaseItem(next);  // The connection broke, nobody would read it.
+      return;
+    }
+
+    // The buffers that the item had go to the pool for the next responses.
+    if (&env != &next->envelope) {
+      next->envelope = std::move(env);
+      EnvelopePool::Recycle(&env);
+    }
     next->id = rpc_id;
+    if (outgoing_buf_.empty())
+      oldest_outgoing_usec_ = base::GetMonotonicMicrosFast();
+    outgoing_bytes_ += next->envelope.header.size() + next->envelope.letter.size();
     outgoing_buf_.push_back(*next);
-    item = nullptr;
   };
 
-  // Might by asynchronous, depends on the bridge_.
-  bridge_->HandleEnvelope(frame.rpc_id, envelope, std::move(writer));
+  // Might by asynchronous, depends on the bridge_. The span of an asynchronous bridge covers
+  // only the dispatch.
+  TraceScope trace_scope("rpc-server", TraceSpan::SERVER, req.trace, false);
+  bridge_->deadline_usec_ = req.deadline_usec;
+  bridge_->memory_resource_ = call->arena.resource();
+  bridge_->HandleEnvelope(req.frame.rpc_id, &req.item->envelope, std::move(writer));
+
+  // The windows are owned by the writers of their streams, once those are gone,
+  // the streams have finished.
+  window.reset();
+  for (auto wit = windows_.begin(); wit != windows_.end();) {
+    auto cur = wit++;
+    if (cur->second->dispatched && cur->second.use_count() == 1)
+      windows_.erase(cur);
+  }
+}
 
-  return ec_;
+bool RpcConnectionHandler::AcquireCredit(StreamWindow* window) {
+  if (window->credit == 0) {
+    if (this_fiber::get_id() == read_fiber_) {
+      // The bridge runs the stream in the connection fiber, so the window updates are read here.
+      // Requests that arrive meanwhile wait in pending_requests_.
+      while (window->credit == 0 && !ec_) {
+        FlushWritesInternal();  // The client grants credit for the envelopes it has received.
+        ReadFrame();
+      }
+    } else {
+      credit_ec_.await([&] { return window->credit > 0 || ec_; });
+    }
+  }
+
+  if (ec_)
+    return false;
+  --window->credit;
+  return true;
+}
+
+void RpcConnectionHandler::ReleaseItem(RpcItem* item) {
+  // rpc_items_ deletes the items it allocated on the heap, their buffers are still good.
+  if (!rpc_items_.IsFrom(item))
+    EnvelopePool::Recycle(&item->envelope);
+  rpc_items_.Release(item);
+}
+
+bool RpcConnectionHandler::ShouldFlush() const {
+  if (outgoing_buf_.empty())
+    return false;
+  if (outgoing_bytes_ >= write_opts_.flush_bytes)
+    return true;
+  return base::GetMonotonicMicrosFast() - oldest_outgoing_usec_ >= write_opts_.flush_usec;
 }
 
 bool RpcConnectionHandler::FlushWritesInternal() {
@@ -124,7 +299,14 @@ bool RpcConnectionHandler::FlushWritesInternal() {
   ItemList tmp;
   size_t item_index = 0;
   for (RpcItem& item : outgoing_buf_) {  // iterate over intrusive list.
+    // The items are released after the write, so the compressed letter can replace the raw one.
+    BufferType compressed;
+    bool compress = CompressLetter(compression_, item.envelope.letter, &compressed);
+    if (compress)
+      item.envelope.letter.swap(compressed);
+
     Frame f(item.id, item.envelope.header.size(), item.envelope.letter.size());
+    f.compression = compress ? compression_ : Frame::NONE;
 
     uint8_t* buf = frame_buf_[item_index].data();
     size_t frame_sz = f.Write(buf);
@@ -134,11 +316,12 @@ bool RpcConnectionHandler::FlushWritesInternal() {
     ++item_index;
   }
   tmp.swap(outgoing_buf_);
+  outgoing_bytes_ = 0;
 
   size_t write_sz = asio::write(*socket_, write_seq_, ec_);
 
   // We should use clear_and_dispose to delete items safely while unlinking them from tmp.
-  tmp.clear_and_dispose([this](RpcItem* i) { rpc_items_.Release(i); });
+  tmp.clear_and_dispose([this](RpcItem* i) { ReleaseItem(i); });
 
   VLOG(2) << "Wrote " << count << " requests with " << write_sz << " bytes";
   return true;
@@ -4,10 +4,14 @@
 
 #pragma once
 
+#include "absl/container/flat_hash_map.h"
 #include "base/object_pool.h"
 
 #include "util/asio/io_context.h"
 #include "util/asio/connection_handler.h"
+#include "util/asio/request_arena.h"
+#include "util/asio/request_trace.h"
+#include "util/fibers/event_count.h"
 #include "util/rpc/frame_format.h"
 #include "util/rpc/rpc_connection.h"
 
@@ -23,7 +27,10 @@ class RpcConnectionHandler : public ConnectionHandler {
  public:
   // bridge is owned by RpcConnectionHandler instance.
   // RpcConnectionHandler is created in acceptor thread and not in the socket thread.
-  RpcConnectionHandler(ConnectionBridge* bridge, IoContext* context);
+  // admission is shared by the connections of the service, null if it is not bounded.
+  RpcConnectionHandler(ConnectionBridge* bridge, IoContext* context,
+                       const ServiceInterface::WriteOptions& write_opts = {},
+                       std::shared_ptr<AdmissionQueue> admission = nullptr);
   ~RpcConnectionHandler();
 
   system::error_code HandleRequest() final override;
@@ -35,6 +42,9 @@ class RpcConnectionHandler : public ConnectionHandler {
   // Returns true if the flush ocurred.
   bool FlushWritesInternal();
 
+  // Whether the connection fiber should write the buffered responses, see WriteOptions.
+  bool ShouldFlush() const;
+
   // The following methods are run in the socket thread (thread that calls HandleRequest.)
   void OnOpenSocket() final;
   void OnCloseSocket() final;
@@ -55,14 +65,73 @@ class RpcConnectionHandler : public ConnectionHandler {
   };
   using ItemList = intrusive::slist<RpcItem, intrusive::cache_last<true>>;
 
+  // Credit that the client granted to a stream with WINDOW_UPDATE frames.
+  struct StreamWindow {
+    uint32_t credit = 0;
+    bool dispatched = false;
+  };
+  using WindowPtr = std::shared_ptr<StreamWindow>;
+
+  // Lives while the bridge holds the writer of a call.
+  struct CallState {
+    AdmissionQueue::Ticket ticket;  // Empty unless the service has admission control.
+    RequestArena arena;
+  };
+
+  // A request that was read but was not passed to the bridge yet.
+  struct PendingRequest {
+    Frame frame;
+    RpcItem* item;
+    uint64_t deadline_usec;  // 0 if the client did not send a deadline.
+    TraceContext trace;      // Empty if the client did not send TRACE frames.
+  };
+
+  // Reads a frame. Applies window updates and appends requests to pending_requests_.
+  // Sets ec_ on errors.
+  void ReadFrame();
+  void Dispatch(const PendingRequest& req);
+
+  // Returns the item to rpc_items_ and its buffers to EnvelopePool if it came from the heap.
+  void ReleaseItem(RpcItem* item);
+
+  // Blocks the calling fiber until the stream has credit and takes it.
+  // Returns false if the connection broke meanwhile.
+  bool AcquireCredit(StreamWindow* window);
+
   system::error_code ec_;
   base::ObjectPool<RpcItem> rpc_items_;
   ItemList outgoing_buf_;
+  size_t outgoing_bytes_ = 0;
+  uint64_t oldest_outgoing_usec_ = 0;
+  ServiceInterface::WriteOptions write_opts_;
+  std::shared_ptr<AdmissionQueue> admission_;
 
   fibers::mutex wr_mu_;
   std::vector<asio::const_buffer> write_seq_;
   base::PODArray<std::array<uint8_t, rpc::Frame::kMaxByteSize>> frame_buf_;
   uint64_t req_flushes_ = 0;
+
+  // The last DEADLINE frame, it precedes the request of deadline_id_.
+  RpcId deadline_id_ = 0;
+  uint64_t deadline_usec_ = 0;
+
+  // The last TRACE frames, they precede the request of trace_id_.
+  RpcId trace_id_ = 0;
+  TraceContext trace_;
+
+  // Negotiated with the HELLO frame of the client.
+  Frame::Compression compression_ = Frame::NONE;
+  BufferType compressed_;
+
+  // Streams that the client granted credit to, see Channel::SendAndReadStream.
+  // Other streams are not flow controlled.
+  absl::flat_hash_map<RpcId, WindowPtr> windows_;
+  fibers_ext::EventCount credit_ec_;
+
+  // Requests read while a stream waited for credit in the connection fiber.
+  // A vector because it rarely holds more than one request and does not allocate once grown.
+  std::vector<PendingRequest> pending_requests_;
+  fibers::fiber::id read_fiber_;
 };
 
 }  // namespace rpc
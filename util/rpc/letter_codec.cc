@@ -0,0 +1,148 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/letter_codec.h"
+
+#include "base/endian.h"
+#include "base/flags.h"
+#include "base/logging.h"
+#include "file/compressors.h"
+#include "file/file_util.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_string(rpc_compression, "",
+              "Compression of the rpc letters: lz4, zstd or zstd_dict. Channels negotiate it "
+              "with the server when they connect");
+DEFINE_uint32(rpc_compress_min_size, 4096, "Letters smaller than that are sent raw");
+DEFINE_string(rpc_zstd_dict, "",
+              "Dictionary file for zstd_dict, the clients and the servers must use the same one");
+
+DEFINE_VARZ(VarzMapCount, rpc_compression);
+
+namespace util {
+namespace rpc {
+
+using namespace file::list_file;
+
+namespace {
+
+constexpr int kZstdLevel = 3;
+
+// Letters are limited by their 32bit size in the frame.
+constexpr uint32_t kMaxLetterSize = 1U << 31;
+
+struct Codec {
+  file::CompressFunction compress;
+  file::UncompressFunction uncompress;
+  file::CompressBoundFunction bound;
+};
+
+class Codecs {
+ public:
+  Codecs();
+
+  const Codec* Get(Frame::Compression c) const {
+    return codec_[c].uncompress ? &codec_[c] : nullptr;
+  }
+
+ private:
+  Codec codec_[4];
+};
+
+Codecs::Codecs() {
+  codec_[Frame::LZ4] =
+      Codec{file::GetCompress(kCompressionLZ4), file::GetUncompress(kCompressionLZ4),
+            file::GetCompressBound(kCompressionLZ4)};
+  codec_[Frame::ZSTD] =
+      Codec{file::GetCompress(kCompressionZstd), file::GetUncompress(kCompressionZstd),
+            file::GetCompressBound(kCompressionZstd)};
+
+  if (!FLAGS_rpc_zstd_dict.empty()) {
+    std::string dict;
+    file_util::ReadFileToStringOrDie(FLAGS_rpc_zstd_dict, &dict);
+    codec_[Frame::ZSTD_DICT] =
+        Codec{file::GetZstdDictCompress(dict, kZstdLevel), file::GetZstdDictUncompress(dict),
+              file::GetCompressBound(kCompressionZstd)};
+  }
+}
+
+const Codecs& GetCodecs() {
+  static Codecs codecs;
+  return codecs;
+}
+
+}  // namespace
+
+Frame::Compression ConfiguredCompression() {
+  const std::string& c = FLAGS_rpc_compression;
+  if (c.empty())
+    return Frame::NONE;
+  if (c == "lz4")
+    return Frame::LZ4;
+  if (c == "zstd")
+    return Frame::ZSTD;
+  if (c == "zstd_dict") {
+    CHECK(!FLAGS_rpc_zstd_dict.empty()) << "zstd_dict requires --rpc_zstd_dict";
+    return Frame::ZSTD_DICT;
+  }
+  LOG(FATAL) << "Unknown --rpc_compression " << c;
+  return Frame::NONE;
+}
+
+bool SupportsCompression(Frame::Compression c) {
+  return GetCodecs().Get(c) != nullptr;
+}
+
+bool CompressLetter(Frame::Compression c, const BufferType& letter, BufferType* dest) {
+  const Codec* codec = GetCodecs().Get(c);
+  if (!codec || letter.size() < FLAGS_rpc_compress_min_size)
+    return false;
+
+  size_t compress_size = codec->bound(letter.size());
+  dest->resize(4 + compress_size);
+  Status st = codec->compress(kZstdLevel, letter.data(), letter.size(), dest->data() + 4,
+                              &compress_size);
+  if (!st.ok()) {
+    LOG(WARNING) << "Could not compress the letter: " << st;
+    return false;
+  }
+
+  // Incompressible letters are sent raw.
+  if (compress_size + 4 >= letter.size())
+    return false;
+
+  LittleEndian::Store32(dest->data(), letter.size());
+  dest->resize(4 + compress_size);
+
+  rpc_compression.IncBy("raw_out", letter.size());
+  rpc_compression.IncBy("compressed_out", dest->size());
+  return true;
+}
+
+Status UncompressLetter(Frame::Compression c, const uint8_t* src, size_t len,
+                        BufferType* letter) {
+  const Codec* codec = GetCodecs().Get(c);
+  if (!codec)
+    return Status(StatusCode::INVALID_ARGUMENT, "Unsupported compression");
+  if (len < 4)
+    return Status(StatusCode::INTERNAL_ERROR, "Truncated letter");
+
+  uint32_t raw_size = LittleEndian::Load32(src);
+  if (raw_size > kMaxLetterSize)
+    return Status(StatusCode::INTERNAL_ERROR, "Bad letter size");
+
+  letter->resize(raw_size);
+  size_t uncompress_size = raw_size;
+  Status st = codec->uncompress(src + 4, len - 4, letter->data(), &uncompress_size);
+  if (!st.ok())
+    return st;
+  if (uncompress_size != raw_size)
+    return Status(StatusCode::INTERNAL_ERROR, "Corrupted letter");
+
+  rpc_compression.IncBy("compressed_in", len);
+  rpc_compression.IncBy("raw_in", raw_size);
+  return Status::OK;
+}
+
+}  // namespace rpc
+}  // namespace util
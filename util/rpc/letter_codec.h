@@ -0,0 +1,59 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/asio/read.hpp>
+
+#include "util/asio/error.h"
+#include "util/rpc/frame_format.h"
+#include "util/rpc/rpc_envelope.h"
+#include "util/status.h"
+
+namespace util {
+namespace rpc {
+
+// Compression of the envelope letters. The connections negotiate the method with HELLO
+// frames and compress the letters of at least --rpc_compress_min_size bytes.
+// A compressed letter starts with the LE32 size of the raw letter.
+
+// The compression selected by --rpc_compression.
+Frame::Compression ConfiguredCompression();
+
+// Whether this process can uncompress c. ZSTD_DICT requires --rpc_zstd_dict.
+bool SupportsCompression(Frame::Compression c);
+
+// Compresses letter into dest. Returns false if the letter should be sent raw because it is
+// small or did not compress.
+bool CompressLetter(Frame::Compression c, const BufferType& letter, BufferType* dest);
+
+Status UncompressLetter(Frame::Compression c, const uint8_t* src, size_t len,
+                        BufferType* letter);
+
+// Reads the BLOB of the DATA frame into env. scratch holds the compressed letter.
+template <typename SyncReadStream>
+::boost::system::error_code ReadEnvelopeBody(const Frame& frame, SyncReadStream* input,
+                                             Envelope* env, BufferType* scratch) {
+  namespace asio = ::boost::asio;
+  ::boost::system::error_code ec;
+
+  if (frame.compression == Frame::NONE) {
+    env->Resize(frame.header_size, frame.letter_size);
+    asio::read(*input, env->buf_seq(), ec);
+    return ec;
+  }
+
+  env->header.resize(frame.header_size);
+  scratch->resize(frame.letter_size);
+  asio::read(*input, make_buffer_seq(env->header, *scratch), ec);
+  if (ec)
+    return ec;
+
+  Status st = UncompressLetter(frame.compression, scratch->data(), scratch->size(), &env->letter);
+  if (!st.ok())
+    ec = make_error_code(gaia_error::bad_letter);
+  return ec;
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,59 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/method_stats.h"
+
+#include <atomic>
+
+namespace util {
+namespace rpc {
+
+namespace {
+
+std::atomic_uint32_t next_shard{0};
+
+// Threads get the shards round-robin, so up to kNumShards threads have a shard each.
+unsigned ThreadShard() {
+  static thread_local unsigned shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+  return shard;
+}
+
+}  // namespace
+
+void MethodStats::Snapshot::Add(const Call& call) {
+  ++calls;
+  errors += call.error;
+  queue_usec.Add(call.queue_usec);
+  handler_usec.Add(call.handler_usec);
+  flush_usec.Add(call.flush_usec);
+  request_bytes.Add(call.request_bytes);
+  response_bytes.Add(call.response_bytes);
+}
+
+void MethodStats::Snapshot::Merge(const Snapshot& other) {
+  calls += other.calls;
+  errors += other.errors;
+  queue_usec.Merge(other.queue_usec);
+  handler_usec.Merge(other.handler_usec);
+  flush_usec.Merge(other.flush_usec);
+  request_bytes.Merge(other.request_bytes);
+  response_bytes.Merge(other.response_bytes);
+}
+
+void MethodStats::Record(const Call& call) {
+  Shard& shard = shards_[ThreadShard() % kNumShards];
+  std::lock_guard<std::mutex> lk(shard.mu);
+  shard.data.Add(call);
+}
+
+auto MethodStats::Read() const -> Snapshot {
+  Snapshot res;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lk(shard.mu);
+    res.Merge(shard.data);
+  }
+  return res;
+}
+
+}  // namespace rpc
+}  // namespace util
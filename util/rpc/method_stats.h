@@ -0,0 +1,51 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <mutex>
+
+#include "base/histogram.h"
+
+namespace util {
+namespace rpc {
+
+// Call counters and latency/size histograms of a single rpc method.
+// Record() updates the shard of the calling thread, so the IO threads do not contend on
+// the same lock, and Read() merges the shards. The stats accumulate for the lifetime of
+// the process.
+class MethodStats {
+ public:
+  struct Call {
+    uint64_t queue_usec = 0;    // From reading the request until the handler started.
+    uint64_t handler_usec = 0;
+    uint64_t flush_usec = 0;    // From the handler returning until the response was written.
+    size_t request_bytes = 0, response_bytes = 0;
+    bool error = false;
+  };
+
+  struct Snapshot {
+    uint64_t calls = 0, errors = 0;
+    base::Histogram queue_usec, handler_usec, flush_usec, request_bytes, response_bytes;
+
+    void Add(const Call& call);
+    void Merge(const Snapshot& other);
+  };
+
+  void Record(const Call& call);
+
+  Snapshot Read() const;
+
+ private:
+  enum { kNumShards = 8 };
+
+  struct alignas(64) Shard {
+    mutable std::mutex mu;
+    Snapshot data;
+  };
+
+  Shard shards_[kNumShards];
+};
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,289 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+// Rpc micro-benchmarks over the asio and uring transports. Run with
+//   rpc_bench --bench --benchmark_format=json
+// and pass --rpc_compression, --rpc_stream_window etc. to compare wire changes.
+
+#include <deque>
+
+#include <boost/fiber/future.hpp>
+#include <boost/fiber/operations.hpp>
+
+#include "absl/strings/str_cat.h"
+#include "base/gtest.h"
+#include "base/histogram.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+
+#include "util/asio/accept_server.h"
+#include "util/rpc/channel.h"
+#include "util/rpc/rpc_test_utils.h"
+#include "util/rpc/uring_channel.h"
+#include "util/rpc/uring_service.h"
+#include "util/uring/accept_server.h"
+#include "util/uring/proactor_pool.h"
+
+namespace util {
+namespace rpc {
+
+using namespace std;
+using namespace boost;
+
+namespace {
+
+class UringBenchInterface final : public UringServiceInterface {
+ public:
+  ConnectionBridge* CreateConnectionBridge() override {
+    return new TestBridge{false};
+  }
+};
+
+// Runs a TestInterface server and a Channel to it.
+class AsioTransport {
+ public:
+  using ChannelType = Channel;
+
+  AsioTransport() : pool_(2) {
+    pool_.Run();
+    server_.reset(new AcceptServer(&pool_));
+    uint16_t port = server_->AddListener(0, &service_);
+    server_->Run();
+
+    cntx_ = &pool_.GetNextContext();
+    channel_.reset(new Channel("localhost", to_string(port), cntx_));
+    auto ec = channel_->Connect(1000);
+    CHECK(!ec) << ec.message();
+  }
+
+  ~AsioTransport() {
+    channel_.reset();
+    server_->Stop(true);
+    pool_.Stop();
+  }
+
+  Channel* channel() { return channel_.get(); }
+
+  // Runs f in the thread of the channel.
+  template <typename Func> void Run(Func&& f) {
+    cntx_->AwaitSafe(std::forward<Func>(f));
+  }
+
+ private:
+  IoContextPool pool_;
+  TestInterface service_;
+  std::unique_ptr<AcceptServer> server_;
+  std::unique_ptr<Channel> channel_;
+  IoContext* cntx_ = nullptr;
+};
+
+// Runs a UringServiceInterface server and a UringChannel to it.
+class UringTransport {
+ public:
+  using ChannelType = UringChannel;
+
+  UringTransport() : pp_(2) {
+    pp_.Run();
+    server_.reset(new uring::AcceptServer(&pp_));
+    uint16_t port = server_->AddListener(0, new UringBenchInterface);
+    server_->Run();
+
+    asio::ip::tcp::endpoint ep{asio::ip::make_address("127.0.0.1"), port};
+    proactor_ = pp_.GetNextProactor();
+    channel_.reset(new UringChannel(ep, proactor_));
+    auto ec = channel_->Connect(1000);
+    CHECK(!ec) << ec.message();
+  }
+
+  ~UringTransport() {
+    channel_.reset();
+    server_->Stop(true);
+    pp_.Stop();
+  }
+
+  UringChannel* channel() { return channel_.get(); }
+
+  template <typename Func> void Run(Func&& f) {
+    proactor_->AwaitBlocking(std::forward<Func>(f));
+  }
+
+ private:
+  uring::ProactorPool pp_;
+  std::unique_ptr<uring::AcceptServer> server_;
+  std::unique_ptr<UringChannel> channel_;
+  uring::Proactor* proactor_ = nullptr;
+};
+
+void SetLatencyCounters(const base::Histogram& hist, benchmark::State* state) {
+  state->counters["p50_usec"] = hist.Median();
+  state->counters["p99_usec"] = hist.Percentile(99);
+  state->counters["p999_usec"] = hist.Percentile(99.9);
+  state->counters["max_usec"] = hist.max();
+}
+
+// Args: payload size, the number of the calls in flight.
+// Sends the batch of calls together and waits for all of them, concurrency 1 measures the
+// round trip of a single call.
+template <typename Transport> void BM_Unary(benchmark::State& state) {
+  Transport transport;
+  using Future = typename Transport::ChannelType::future_code_t;
+
+  size_t payload = state.range(0);
+  unsigned concurrency = state.range(1);
+  vector<Envelope> envelopes(concurrency);
+  vector<Future> futures(concurrency);
+  base::Histogram latency;
+
+  transport.Run([&] {
+    while (state.KeepRunning()) {
+      uint64_t start = base::GetMonotonicMicrosFast();
+      for (unsigned i = 0; i < concurrency; ++i) {
+        envelopes[i].letter.resize_fill(payload, 'a');
+        futures[i] = transport.channel()->Send(1000, &envelopes[i]);
+      }
+      for (auto& f : futures) {
+        system::error_code ec = f.get();
+        CHECK(!ec) << ec.message();
+      }
+      latency.Add(base::GetMonotonicMicrosFast() - start);
+    }
+  });
+
+  state.SetItemsProcessed(state.iterations() * concurrency);
+  state.SetBytesProcessed(state.iterations() * concurrency * payload * 2);
+  SetLatencyCounters(latency, &state);
+}
+
+// Args: payload size, calls per second.
+// Open loop: the calls are sent on schedule regardless of the responses, the latency is
+// measured from the scheduled time so that a stall is not hidden by the calls it delays.
+template <typename Transport> void BM_FixedQps(benchmark::State& state) {
+  Transport transport;
+  using Future = typename Transport::ChannelType::future_code_t;
+
+  struct Call {
+    Envelope envelope;
+    Future future;
+    uint64_t scheduled;
+  };
+
+  size_t payload = state.range(0);
+  uint64_t interval_usec = 1000000 / state.range(1);
+  base::Histogram latency;
+
+  transport.Run([&] {
+    // std::deque keeps the envelopes in place while the calls are in flight.
+    deque<Call> calls;
+    fibers::mutex mu;
+    fibers::condition_variable cv;
+    bool done = false;
+
+    fibers::fiber collector([&] {
+      std::unique_lock<fibers::mutex> lk(mu);
+      while (true) {
+        cv.wait(lk, [&] { return !calls.empty() || done; });
+        if (calls.empty())
+          break;
+
+        Call& call = calls.front();
+        lk.unlock();
+        system::error_code ec = call.future.get();
+        CHECK(!ec) << ec.message();
+        latency.Add(base::GetMonotonicMicrosFast() - call.scheduled);
+        lk.lock();
+        calls.pop_front();
+      }
+    });
+
+    uint64_t next = base::GetMonotonicMicrosFast();
+    while (state.KeepRunning()) {
+      uint64_t now = base::GetMonotonicMicrosFast();
+      if (next > now)
+        this_fiber::sleep_for(chrono::microseconds(next - now));
+
+      std::lock_guard<fibers::mutex> lk(mu);
+      calls.emplace_back();
+      Call& call = calls.back();
+      call.envelope.letter.resize_fill(payload, 'a');
+      call.scheduled = next;
+      call.future = transport.channel()->Send(1000, &call.envelope);
+      cv.notify_one();
+      next += interval_usec;
+    }
+
+    {
+      std::lock_guard<fibers::mutex> lk(mu);
+      done = true;
+      cv.notify_one();
+    }
+    collector.join();
+  });
+
+  state.SetItemsProcessed(state.iterations());
+  SetLatencyCounters(latency, &state);
+}
+
+// Args: payload size, the number of the stream messages.
+template <typename Transport> void BM_Stream(benchmark::State& state) {
+  Transport transport;
+
+  size_t payload = state.range(0);
+  unsigned messages = state.range(1);
+  string header = absl::StrCat("repeat", messages);
+
+  transport.Run([&] {
+    Envelope envelope;
+    while (state.KeepRunning()) {
+      Copy(header, &envelope.header);
+      envelope.letter.resize_fill(payload, 'a');
+      unsigned received = 0;
+      auto cb = [&](Envelope&) -> system::error_code {
+        return ++received < messages ? system::error_code{} : asio::error::eof;
+      };
+      system::error_code ec = transport.channel()->SendAndReadStream(&envelope, cb);
+      CHECK(!ec) << ec.message();
+    }
+  });
+
+  state.SetItemsProcessed(state.iterations() * messages);
+  state.SetBytesProcessed(state.iterations() * messages * payload);
+}
+
+void UnaryArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"payload", "concurrency"});
+  for (int payload : {64, 4096, 1 << 16}) {
+    for (int concurrency : {1, 16, 128}) {
+      b->Args({payload, concurrency});
+    }
+  }
+}
+
+void FixedQpsArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"payload", "qps"});
+  for (int payload : {64, 4096}) {
+    for (int qps : {1000, 10000}) {
+      b->Args({payload, qps});
+    }
+  }
+  b->Iterations(5000);
+}
+
+void StreamArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"payload", "messages"});
+  for (int payload : {64, 4096, 1 << 16}) {
+    b->Args({payload, 100});
+  }
+}
+
+}  // namespace
+
+#define RPC_BENCHMARKS(Transport)                                  \
+  BENCHMARK_TEMPLATE(BM_Unary, Transport)->Apply(UnaryArgs);       \
+  BENCHMARK_TEMPLATE(BM_FixedQps, Transport)->Apply(FixedQpsArgs); \
+  BENCHMARK_TEMPLATE(BM_Stream, Transport)->Apply(StreamArgs)
+
+RPC_BENCHMARKS(AsioTransport);
+RPC_BENCHMARKS(UringTransport);
+
+}  // namespace rpc
+}  // namespace util
@@ -12,7 +12,7 @@ namespace rpc {
 
 ConnectionHandler* ServiceInterface::NewConnection(IoContext& context) {
   ConnectionBridge* bridge = CreateConnectionBridge();
-  return new RpcConnectionHandler(bridge, &context);
+  return new RpcConnectionHandler(bridge, &context, write_opts_, admission_);
 }
 
 }  // namespace rpc
@@ -7,7 +7,8 @@
 
 #include "util/asio/connection_handler.h"
 
-#include "util/rpc/rpc_envelope.h"
+#include "util/rpc/admission_queue.h"
+#include "util/rpc/connection_bridge.h"
 #include "strings/stringpiece.h"
 
 namespace util {
@@ -16,49 +17,49 @@ namespace util {
 
 namespace rpc {
 
-// Also defined in frame_format.h. Seems to work.
-typedef uint64_t RpcId;
-
-// ConnectionBridge is responsible to abstract higher level server-app logic and to provide
-// an interface that allows to map Envelope to ServiceInterface methods.
-// ConnectionBridge is a single-fiber creature, so currently only one caller fiber can
-// use it simultaneusly.
-// ConnectionBridge can be asynchronous, i.e. it's main calling function HandleEnvelope
-// can exit before it finishes writing to EnvelopeWriter.
-class ConnectionBridge {
- public:
-  typedef std::function<void(Envelope&&)> EnvelopeWriter;
-
-  virtual ~ConnectionBridge() {}
-
-  // Is called once from the connection thread before HandleEnvelope is being called.
-  // Is intended to finalize the setup for the bridge inside its intended thread.
-  virtual void InitInThread() {}
-
-  // Main entry function that handles the input envelope and is responsible for
-  // writing the results via writer.
-  // HandleEnvelope first reads the input and if everything is parsed fine, it writes
-  // back one or more envelopes via the writer. Specifics of the protocol are defined
-  // in the derived class. Since HandleEnvelope can be asynchronous,
-  // the caller should make sure the writer is valid through the call.
-  virtual void HandleEnvelope(RpcId rpc_id, Envelope* input,
-                              EnvelopeWriter writer) = 0;
-
-  // In case HandleEnvelope is asynchronous, waits for all the issued calls to finish.
-  // HandleEnvelope should not be called after calling Join().
-  virtual void Join() {};
-};
-
 class ServiceInterface : public ListenerInterface {
  public:
+  // How the connections coalesce responses into socket writes. The flusher fiber writes
+  // the buffered responses every few hundred microseconds. The connection fiber writes them
+  // right after a request once they reach flush_bytes or the oldest one waited flush_usec.
+  // The defaults favor throughput, Latency() writes after every request.
+  struct WriteOptions {
+    size_t flush_bytes = 1 << 16;
+    uint32_t flush_usec = 300;
+
+    static WriteOptions Latency() {
+      return WriteOptions{0, 0};
+    }
+  };
+
   virtual ~ServiceInterface() {}
 
+  // Applies to the connections accepted afterwards.
+  void set_write_options(const WriteOptions& opts) {
+    write_opts_ = opts;
+  }
+
+  // Bounds the calls of all the connections that run at once, the others wait in the queue
+  // of their ConnectionBridge::Priority(). A call runs until the bridge destroys its writer,
+  // so asynchronous bridges are bounded too. Flow controlled streams are not bounded, since
+  // they might wait for the credit that the connection fiber reads while it waits for
+  // admission. Applies to the connections accepted afterwards.
+  void set_admission(std::string name, const AdmissionQueue::Options& opts) {
+    admission_ = std::make_shared<AdmissionQueue>(std::move(name), opts);
+  }
+
+  const AdmissionQueue* admission() const { return admission_.get(); }
+
  protected:
   // A factory method creating a handler that handles requests for a single connection.
   // The ownership over handler is passed to the caller.
   virtual ConnectionBridge* CreateConnectionBridge() = 0;
 
   ConnectionHandler* NewConnection(IoContext& context) final;
+
+ private:
+  WriteOptions write_opts_;
+  std::shared_ptr<AdmissionQueue> admission_;
 };
 
 }  // namespace rpc
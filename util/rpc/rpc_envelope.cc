@@ -0,0 +1,61 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/rpc_envelope.h"
+
+#include <vector>
+
+#include "base/memory_account.h"
+
+namespace util {
+namespace rpc {
+
+namespace {
+
+constexpr size_t kMaxFree = 256;
+
+// Larger buffers are freed so that a burst of large calls does not pin the memory.
+constexpr size_t kMaxRecycledSize = 1 << 16;
+
+// Memory idle in the free lists.
+base::MemoryAccount pool_account("rpc_envelope_pool");
+
+size_t AllocatedSize(const Envelope& env) {
+  return env.header.allocated_size() + env.letter.allocated_size();
+}
+
+struct FreeList : public std::vector<Envelope> {
+  ~FreeList() {
+    for (const Envelope& env : *this)
+      pool_account.Credit(AllocatedSize(env));
+  }
+};
+
+thread_local FreeList free_envelopes;
+
+}  // namespace
+
+Envelope EnvelopePool::Get() {
+  if (free_envelopes.empty())
+    return Envelope{};
+
+  Envelope res = std::move(free_envelopes.back());
+  free_envelopes.pop_back();
+  pool_account.Credit(AllocatedSize(res));
+  return res;
+}
+
+void EnvelopePool::Recycle(Envelope* env) {
+  size_t sz = AllocatedSize(*env);
+  if (sz == 0 || sz > kMaxRecycledSize || free_envelopes.size() >= kMaxFree) {
+    Envelope tmp(std::move(*env));  // Frees the buffers.
+    return;
+  }
+
+  env->Clear();
+  free_envelopes.push_back(std::move(*env));
+  pool_account.Charge(sz);
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -50,6 +50,19 @@ class Envelope {
   }
 };
 
+// Per-thread free list of envelope buffers. The rpc server recycles the buffers of the
+// envelopes it sent here, so handlers that build their responses from Get() reuse them
+// instead of allocating for every call.
+class EnvelopePool {
+ public:
+  // Returns an empty envelope, whose buffers come from the free list of the calling thread
+  // if it has any.
+  static Envelope Get();
+
+  // Keeps the buffers of env in the free list of the calling thread and leaves env empty.
+  static void Recycle(Envelope* env);
+};
+
 }  // namespace rpc
 }  // namespace util
 
@@ -3,9 +3,14 @@
 //
 #include <chrono>
 #include <memory>
+#include <thread>
 
+#include <gmock/gmock.h>
+
+#include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/strip.h"
 
@@ -15,11 +20,22 @@
 
 #include "util/asio/accept_server.h"
 #include "util/asio/asio_utils.h"
+#include "util/asio/request_trace.h"
 #include "util/asio/yield.h"
 
+#include "util/rpc/admission_queue.h"
 #include "util/rpc/channel.h"
+#include "util/rpc/channel_pool.h"
 #include "util/rpc/frame_format.h"
+#include "util/rpc/method_stats.h"
 #include "util/rpc/rpc_test_utils.h"
+#include "util/rpc/shm_stream.h"
+
+DECLARE_uint32(rpc_stream_window);
+DECLARE_string(rpc_compression);
+DECLARE_bool(rpc_send_deadline);
+DECLARE_bool(rpc_send_trace);
+DECLARE_double(trace_sample_rate);
 
 namespace util {
 namespace rpc {
@@ -145,6 +161,160 @@ TEST_F(RpcTest, Repeat) {
   });
 }
 
+TEST_F(RpcTest, StreamWindow) {
+  const char kPayload[] = "World!!!";
+  string header("repeat5"), message(kPayload);
+  frame_.header_size = header.size();
+  frame_.letter_size = message.size();
+
+  IoContext& io_cntx = sock2_->context();
+  io_cntx.AwaitSafe([&] {
+    uint8_t wbuf[Frame::kMaxByteSize];
+    size_t wsz = Frame::WindowUpdate(frame_.rpc_id, 2, true).Write(wbuf);
+    asio::write(*sock2_, make_buffer_seq(asio::buffer(wbuf, wsz), FrameBuffer(), header, message),
+                ec_);
+    ASSERT_FALSE(ec_);
+
+    auto read_envelopes = [&](unsigned count) {
+      for (unsigned i = 0; i < count; ++i) {
+        ec_ = frame_.Read(sock2_.get());
+        ASSERT_FALSE(ec_);
+        header.resize(frame_.header_size);
+        ASSERT_EQ(frame_.letter_size, message.size());
+        asio::read(*sock2_, make_buffer_seq(header, message), ec_);
+        ASSERT_FALSE(ec_);
+      }
+    };
+
+    read_envelopes(2);
+    EXPECT_EQ("cont:1", header);
+
+    // The server waits for credit.
+    this_fiber::sleep_for(20ms);
+    char c;
+    EXPECT_EQ(-1, recv(sock2_->native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT));
+
+    wsz = Frame::WindowUpdate(frame_.rpc_id, 3, false).Write(wbuf);
+    asio::write(*sock2_, asio::buffer(wbuf, wsz), ec_);
+    ASSERT_FALSE(ec_);
+
+    read_envelopes(3);
+    EXPECT_EQ("cont:0", header);
+    EXPECT_EQ(kPayload, message);
+  });
+}
+
+TEST_F(RpcTest, StreamFlowControl) {
+  FLAGS_rpc_stream_window = 2;
+
+  Envelope envelope;
+  Copy(string("repeat20"), &envelope.header);
+  envelope.letter.resize_fill(42, 2);
+
+  int times = 0;
+  auto cb = [&](Envelope& env) -> system::error_code {
+    ++times;
+    absl::string_view header(strings::charptr(env.header.data()), env.header.size());
+    return absl::EndsWith(header, "1") ? system::error_code{} : asio::error::eof;
+  };
+  system::error_code ec = channel_->SendAndReadStream(&envelope, cb);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(20, times);
+
+  // The connection keeps serving the requests.
+  envelope.header.clear();
+  ec = channel_->SendSync(100, &envelope);
+  EXPECT_FALSE(ec) << ec.message();
+
+  FLAGS_rpc_stream_window = 0;
+}
+
+TEST_F(RpcTest, Compression) {
+  string letter;
+  for (unsigned i = 0; i < 10000; ++i) {
+    absl::StrAppend(&letter, "letter ", i % 100, ";");
+  }
+
+  for (const char* method : {"lz4", "zstd"}) {
+    FLAGS_rpc_compression = method;
+    Channel channel("localhost", std::to_string(port_), &pool_->GetNextContext());
+    ASSERT_FALSE(channel.Connect(1000));
+
+    for (unsigned i = 0; i < 2; ++i) {
+      Envelope envelope;
+      Copy(letter, &envelope.letter);
+      system::error_code ec = channel.SendSync(1000, &envelope);
+      ASSERT_FALSE(ec) << method << " " << ec.message();
+      EXPECT_EQ(letter, string(strings::charptr(envelope.letter.data()), envelope.letter.size()));
+    }
+  }
+  FLAGS_rpc_compression.clear();
+}
+
+TEST_F(RpcTest, ChannelPool) {
+  // Nothing listens on port 1, so its channels never connect.
+  vector<string> endpoints{absl::StrCat("localhost:", port_), "localhost:1"};
+  IoContext& cntx = pool_->GetNextContext();
+
+  for (ChannelPool::Policy policy : {ChannelPool::LEAST_OUTSTANDING, ChannelPool::POWER_OF_TWO}) {
+    ChannelPool::Options opts;
+    opts.policy = policy;
+    opts.connect_msec = 100;
+
+    cntx.AwaitSafe([&] {
+      ChannelPool channels(endpoints, opts, &cntx);
+      ASSERT_FALSE(channels.Connect());
+      EXPECT_EQ(1, channels.healthy_endpoints());
+
+      for (unsigned i = 0; i < 20; ++i) {
+        Envelope envelope;
+        envelope.letter.resize_fill(42, 2);
+        system::error_code ec = channels.SendSync(100, &envelope);
+        ASSERT_FALSE(ec) << ec.message();
+      }
+    });
+  }
+}
+
+TEST_F(RpcTest, HedgedCalls) {
+  vector<string> endpoints(2, absl::StrCat("localhost:", port_));
+  IoContext& cntx = pool_->GetNextContext();
+
+  ChannelPool::Options opts;
+  opts.hedge = true;
+  opts.hedge_window = 10;
+
+  cntx.AwaitSafe([&] {
+    ChannelPool channels(endpoints, opts, &cntx);
+    ASSERT_FALSE(channels.Connect());
+
+    // The first calls measure the latency, the slow ones are hedged after that.
+    for (unsigned i = 0; i < 20; ++i) {
+      Envelope envelope;
+      if (i >= 10)
+        Copy(string("sleep5"), &envelope.header);
+      envelope.letter.resize_fill(42, 2);
+      system::error_code ec = channels.SendSync(100, &envelope);
+      ASSERT_FALSE(ec) << ec.message();
+      EXPECT_EQ(42, envelope.letter.size());
+    }
+  });
+}
+
+TEST_F(RpcTest, LatencyWrites) {
+  service_->set_write_options(ServiceInterface::WriteOptions::Latency());
+
+  Channel channel("localhost", std::to_string(port_), &pool_->GetNextContext());
+  ASSERT_FALSE(channel.Connect(1000));
+
+  for (unsigned i = 0; i < 10; ++i) {
+    Envelope envelope;
+    envelope.letter.resize_fill(42, 2);
+    system::error_code ec = channel.SendSync(100, &envelope);
+    ASSERT_FALSE(ec) << ec.message();
+  }
+}
+
 TEST_F(RpcTest, SendOk) {
   Envelope envelope;
   envelope.header.resize_fill(14, 1);
@@ -210,6 +380,265 @@ TEST_F(RpcTest, Sleep) {
   ASSERT_FALSE(ec) << ec.message();  // expect normal execution.
 }
 
+TEST_F(RpcTest, SendDeadline) {
+  FLAGS_rpc_send_deadline = true;
+
+  Envelope envelope;
+  Copy(string("sleep20"), &envelope.header);
+  envelope.letter.resize_fill(42, 2);
+
+  // The server drops the late response instead of writing it.
+  system::error_code ec = channel_->SendSync(5, &envelope);
+  ASSERT_EQ(asio::error::timed_out, ec) << ec.message();
+
+  envelope.header.clear();
+  ec = channel_->SendSync(80, &envelope);
+  ASSERT_FALSE(ec) << ec.message();
+  FLAGS_rpc_send_deadline = false;
+}
+
+TEST_F(RpcTest, SendTrace) {
+  FLAGS_rpc_send_trace = true;
+  FLAGS_trace_sample_rate = 1;
+
+  TraceContext root_ctx;
+  {
+    TraceScope root("test", TraceSpan::LOCAL, TraceContext{}, true);
+    root_ctx = root.span().context();
+
+    Envelope envelope;
+    Copy(string("foo"), &envelope.header);
+    system::error_code ec = channel_->SendSync(100, &envelope);
+    ASSERT_FALSE(ec) << ec.message();
+  }
+  FLAGS_rpc_send_trace = false;
+  FLAGS_trace_sample_rate = 0;
+
+  // The spans of the server and the client end in the IO threads.
+  vector<trace::SpanRecord> spans;
+  for (unsigned i = 0; i < 100 && spans.size() < 3; ++i) {
+    this_thread::sleep_for(1ms);
+    spans = trace::CollectSpans(root_ctx.trace_id);
+  }
+  ASSERT_EQ(3, spans.size());
+
+  auto find = [&](const char* name) {
+    for (const auto& span : spans) {
+      if (strcmp(span.name, name) == 0)
+        return span;
+    }
+    return trace::SpanRecord{};
+  };
+  trace::SpanRecord client = find("rpc-client"), server = find("rpc-server");
+  EXPECT_EQ(root_ctx.span_id, client.parent_id);
+  EXPECT_EQ(client.span_id, server.parent_id);
+  EXPECT_EQ(TraceSpan::SERVER, server.kind);
+}
+
+TEST_F(RpcTest, Admission) {
+  AdmissionQueue::Options opts;
+  opts.max_concurrency = 1;
+  service_->set_admission("test", opts);
+
+  // The connections accepted afterwards share the queue, their calls run one at a time.
+  vector<unique_ptr<Channel>> channels;
+  for (unsigned i = 0; i < 3; ++i) {
+    channels.emplace_back(new Channel("localhost", std::to_string(port_),
+                                      &pool_->GetNextContext()));
+    ASSERT_FALSE(channels.back()->Connect(1000));
+  }
+
+  vector<Envelope> envelopes(channels.size());
+  vector<Channel::future_code_t> calls;
+  for (size_t i = 0; i < channels.size(); ++i) {
+    Copy(string("sleep10"), &envelopes[i].header);
+    calls.push_back(channels[i]->Send(1000, &envelopes[i]));
+  }
+  for (auto& call : calls) {
+    EXPECT_FALSE(call.get());
+  }
+
+  // The last call has waited for the other two.
+  AdmissionQueue::Stats stats = service_->admission()->GetStats();
+  EXPECT_EQ(3, stats.admitted);
+  EXPECT_EQ(2, stats.queue_usec[AdmissionQueue::NORMAL].count());
+  channels.clear();
+}
+
+class AdmissionQueueTest : public testing::Test {
+ protected:
+  // The queue times and the deadlines are measured with the jiffies clock.
+  static void SetUpTestCase() { base::SetupJiffiesTimer(); }
+};
+
+TEST_F(AdmissionQueueTest, Priorities) {
+  AdmissionQueue::Options opts;
+  opts.max_concurrency = 1;
+  AdmissionQueue q("priorities", opts);
+
+  AdmissionQueue::Ticket running = q.Admit(AdmissionQueue::BULK, 0);
+  ASSERT_TRUE(running);
+
+  vector<unsigned> order;
+  vector<fibers::fiber> fibers;
+  for (unsigned prio : {AdmissionQueue::BULK, AdmissionQueue::NORMAL, AdmissionQueue::HIGH}) {
+    fibers.emplace_back([&, prio] {
+      AdmissionQueue::Ticket ticket = q.Admit(prio, 0);
+      EXPECT_TRUE(ticket);
+      order.push_back(prio);
+    });
+    this_fiber::yield();
+  }
+  EXPECT_EQ(3, q.GetStats().queued);
+
+  running = AdmissionQueue::Ticket{};
+  for (auto& fb : fibers)
+    fb.join();
+
+  EXPECT_THAT(order, testing::ElementsAre(AdmissionQueue::HIGH, AdmissionQueue::NORMAL,
+                                          AdmissionQueue::BULK));
+  AdmissionQueue::Stats stats = q.GetStats();
+  EXPECT_EQ(4, stats.admitted);
+  EXPECT_EQ(0, stats.running);
+  EXPECT_EQ(1, stats.queue_usec[AdmissionQueue::HIGH].count());
+}
+
+TEST_F(AdmissionQueueTest, LifoUnderOverload) {
+  AdmissionQueue::Options opts;
+  opts.max_concurrency = 1;
+  opts.lifo_after_usec = 1000;
+  AdmissionQueue q("lifo", opts);
+
+  AdmissionQueue::Ticket running = q.Admit(AdmissionQueue::NORMAL, 0);
+  vector<unsigned> order;
+  vector<fibers::fiber> fibers;
+  for (unsigned i = 0; i < 3; ++i) {
+    fibers.emplace_back([&, i] {
+      AdmissionQueue::Ticket ticket = q.Admit(AdmissionQueue::NORMAL, 0);
+      order.push_back(i);
+    });
+    this_fiber::yield();
+  }
+
+  // The oldest call has waited too long, so the newest ones go first.
+  this_fiber::sleep_for(10ms);
+  running = AdmissionQueue::Ticket{};
+  for (auto& fb : fibers)
+    fb.join();
+  EXPECT_THAT(order, testing::ElementsAre(2, 1, 0));
+}
+
+TEST_F(AdmissionQueueTest, RejectAndExpire) {
+  AdmissionQueue::Options opts;
+  opts.max_concurrency = 1;
+  opts.max_queued = 1;
+  AdmissionQueue q("reject", opts);
+
+  AdmissionQueue::Ticket running = q.Admit(AdmissionQueue::NORMAL, 0);
+  bool admitted = true;
+  fibers::fiber waiter([&] {
+    admitted = bool(q.Admit(AdmissionQueue::NORMAL, base::GetMonotonicMicrosFast() + 1000));
+  });
+  this_fiber::yield();
+
+  // The queue is full.
+  EXPECT_FALSE(q.Admit(AdmissionQueue::HIGH, 0));
+
+  this_fiber::sleep_for(10ms);
+  running = AdmissionQueue::Ticket{};
+  waiter.join();
+  EXPECT_FALSE(admitted);
+
+  AdmissionQueue::Stats stats = q.GetStats();
+  EXPECT_EQ(1, stats.rejected);
+  EXPECT_EQ(1, stats.expired);
+  EXPECT_EQ(0, stats.running);
+  EXPECT_TRUE(q.Admit(AdmissionQueue::NORMAL, 0));
+}
+
+TEST(EnvelopePoolTest, Recycle) {
+  Envelope envelope = EnvelopePool::Get();
+  envelope.letter.resize(100);
+  const uint8_t* data = envelope.letter.data();
+  EnvelopePool::Recycle(&envelope);
+  EXPECT_EQ(0, envelope.letter.allocated_size());
+
+  envelope = EnvelopePool::Get();
+  EXPECT_EQ(0, envelope.letter.size());
+  envelope.letter.resize(100);
+  EXPECT_EQ(data, envelope.letter.data());
+
+  // Large buffers are not kept.
+  envelope.letter.resize(1 << 20);
+  EnvelopePool::Recycle(&envelope);
+  EXPECT_EQ(0, EnvelopePool::Get().letter.allocated_size());
+}
+
+TEST(MethodStatsTest, MergeShards) {
+  MethodStats stats;
+  auto record = [&](bool error) {
+    for (unsigned i = 0; i < 100; ++i) {
+      MethodStats::Call call;
+      call.handler_usec = i + 1;
+      call.request_bytes = 10;
+      call.error = error;
+      stats.Record(call);
+    }
+  };
+
+  std::thread other(record, true);
+  record(false);
+  other.join();
+
+  MethodStats::Snapshot snapshot = stats.Read();
+  EXPECT_EQ(200, snapshot.calls);
+  EXPECT_EQ(100, snapshot.errors);
+  EXPECT_EQ(100, snapshot.handler_usec.max());
+  EXPECT_EQ(10, snapshot.request_bytes.Average());
+}
+
+TEST(ShmStreamTest, ReadWrite) {
+  IoContextPool pool(1);
+  pool.Run();
+  IoContext& cntx = pool.GetNextContext();
+
+  ShmStream::Descriptors fds[2];
+  ASSERT_FALSE(ShmStream::CreatePair(4096, &fds[0], &fds[1]));
+
+  cntx.AwaitSafe([&] {
+    ShmStream writer(&cntx), reader(&cntx);
+    ASSERT_FALSE(writer.Open(fds[0]));
+    ASSERT_FALSE(reader.Open(fds[1]));
+
+    // The messages do not fit into the ring together, so both sides block on each other.
+    constexpr unsigned kNum = 100;
+    fibers::fiber write_fb([&] {
+      string msg(1000, 'a');
+      for (unsigned i = 0; i < kNum; ++i) {
+        msg[0] = 'a' + i % 26;
+        system::error_code ec;
+        asio::write(writer, asio::buffer(msg), ec);
+        ASSERT_FALSE(ec) << ec.message();
+      }
+      writer.Shutdown();
+    });
+
+    string msg(1000, 0);
+    for (unsigned i = 0; i < kNum; ++i) {
+      system::error_code ec;
+      asio::read(reader, asio::buffer(&msg[0], msg.size()), ec);
+      ASSERT_FALSE(ec) << ec.message();
+      EXPECT_EQ('a' + i % 26, msg[0]);
+    }
+    write_fb.join();
+
+    system::error_code ec;
+    EXPECT_EQ(0, reader.read_some(asio::buffer(&msg[0], msg.size()), ec));
+    EXPECT_EQ(asio::error::eof, ec);
+  });
+  pool.Stop();
+}
+
 static void BM_ChannelConnection(benchmark::State& state) {
   IoContextPool pool(1);
   pool.Run();
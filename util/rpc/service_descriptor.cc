@@ -3,16 +3,149 @@
 //
 #include "util/rpc/service_descriptor.h"
 
+#include <algorithm>
+#include <mutex>
+
+#include <google/protobuf/arena.h>
+
+#include "util/stats/varz_stats.h"
+
 namespace util {
 
 // RPC-Server side part.
 
 namespace rpc {
 
+namespace {
+
+std::mutex& DescriptorsMutex() {
+  static std::mutex mu;
+  return mu;
+}
+
+// Live service descriptors, guarded by DescriptorsMutex().
+std::vector<const ServiceDescriptor*>& Descriptors() {
+  static std::vector<const ServiceDescriptor*> descriptors;
+  return descriptors;
+}
+
+VarzValue::Map MethodsVarz() {
+  VarzValue::Map res;
+  auto add = [](const char* name, double val, VarzValue::Map* dest) {
+    dest->emplace_back(name, VarzValue::FromDouble(val));
+  };
+
+  std::lock_guard<std::mutex> lk(DescriptorsMutex());
+  for (const ServiceDescriptor* sd : Descriptors()) {
+    for (size_t i = 0; i < sd->size(); ++i) {
+      const ServiceDescriptor::Method& method = sd->method(i);
+      MethodStats::Snapshot snapshot = method.stats->Read();
+      if (!snapshot.calls)
+        continue;
+
+      VarzValue::Map items;
+      items.emplace_back("calls", VarzValue::FromInt(snapshot.calls));
+      items.emplace_back("errors", VarzValue::FromInt(snapshot.errors));
+      add("queue_p50_usec", snapshot.queue_usec.Median(), &items);
+      add("queue_p99_usec", snapshot.queue_usec.Percentile(99), &items);
+      add("handler_p50_usec", snapshot.handler_usec.Median(), &items);
+      add("handler_p99_usec", snapshot.handler_usec.Percentile(99), &items);
+      add("handler_max_usec", snapshot.handler_usec.max(), &items);
+      add("flush_p99_usec", snapshot.flush_usec.Percentile(99), &items);
+      add("request_avg_bytes", snapshot.request_bytes.Average(), &items);
+      add("request_p99_bytes", snapshot.request_bytes.Percentile(99), &items);
+      add("response_avg_bytes", snapshot.response_bytes.Average(), &items);
+      add("response_p99_bytes", snapshot.response_bytes.Percentile(99), &items);
+      res.emplace_back(method.name, VarzValue(std::move(items)));
+    }
+  }
+  return res;
+}
+
+VarzFunction rpc_methods("rpc_methods", &MethodsVarz);
+
+}  // namespace
+
+// Derived classes fill methods_ right after, services are expected to be created before
+// anybody reads the varz.
 ServiceDescriptor::ServiceDescriptor() {
+  std::lock_guard<std::mutex> lk(DescriptorsMutex());
+  Descriptors().push_back(this);
 }
 
 ServiceDescriptor::~ServiceDescriptor() {
+  std::lock_guard<std::mutex> lk(DescriptorsMutex());
+  auto& descriptors = Descriptors();
+  descriptors.erase(std::find(descriptors.begin(), descriptors.end(), this));
+}
+
+// Arenas start with a block of their own that survives Reset(), so the calls that fit into it
+// do not allocate at all.
+struct ServiceDescriptor::CallMessages::PooledArena {
+  static constexpr size_t kBlockSize = 8192;
+
+  char block[kBlockSize];
+  google::protobuf::Arena arena;
+
+  PooledArena() : arena(Options(block)) {
+  }
+
+  static google::protobuf::ArenaOptions Options(char* block) {
+    google::protobuf::ArenaOptions opts;
+    opts.initial_block = block;
+    opts.initial_block_size = kBlockSize;
+    return opts;
+  }
+
+  // Takes an arena from the pool of the calling thread.
+  static PooledArena* Get();
+
+  // Frees the messages and returns the arena to the pool of the calling thread.
+  static void Return(PooledArena* pa);
+
+  static constexpr size_t kMaxFree = 16;
+  static thread_local std::vector<std::unique_ptr<PooledArena>> free_arenas;
+};
+
+thread_local std::vector<std::unique_ptr<ServiceDescriptor::CallMessages::PooledArena>>
+    ServiceDescriptor::CallMessages::PooledArena::free_arenas;
+
+auto ServiceDescriptor::CallMessages::PooledArena::Get() -> PooledArena* {
+  if (free_arenas.empty())
+    return new PooledArena;
+
+  PooledArena* res = free_arenas.back().release();
+  free_arenas.pop_back();
+  return res;
+}
+
+void ServiceDescriptor::CallMessages::PooledArena::Return(PooledArena* pa) {
+  pa->arena.Reset();
+  if (free_arenas.size() < kMaxFree)
+    free_arenas.emplace_back(pa);
+  else
+    delete pa;
+}
+
+ServiceDescriptor::CallMessages::CallMessages(const Method& method) {
+  google::protobuf::Arena* arena = nullptr;
+  if (method.options.use_arena) {
+    arena_ = PooledArena::Get();
+    arena = &arena_->arena;
+  }
+
+  request_ = method.default_req->New(arena);
+  if (method.default_resp)
+    response_ = method.default_resp->New(arena);
+}
+
+ServiceDescriptor::CallMessages::~CallMessages() {
+  if (arena_) {
+    PooledArena::Return(arena_);
+  } else {
+    delete request_;
+    delete response_;
+  }
 }
 
 void ServiceDescriptor::SetOptions(size_t index, const MethodOptions& opts) {
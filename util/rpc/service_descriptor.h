@@ -4,10 +4,12 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 
 #include <google/protobuf/message.h>
 
 #include "absl/strings/string_view.h"
+#include "util/rpc/method_stats.h"
 #include "util/status.h"
 
 namespace util {
@@ -21,6 +23,9 @@ class ServiceDescriptor {
   struct MethodOptions {
     // Must be power of 2. If not - will be quietly rounded up to power of 2.
     uint32_t async_level = 0;
+
+    // Allocates the request and the response on an arena, see CallMessages.
+    bool use_arena = false;
   };
 
   using Message = ::google::protobuf::Message;
@@ -56,17 +61,24 @@ class ServiceDescriptor {
     const Message* default_req = nullptr;
     const Message* default_resp = nullptr;
 
+    // Filled by the dispatching code, exported via "rpc_methods" varz.
+    std::shared_ptr<MethodStats> stats;
+
     // Simple RPC
     Method(std::string n, RpcMethodCb c, const Message& dreq, const Message& dresp)
         : name(std::move(n)),
           single_rpc_method(std::move(c)),
           default_req(&dreq),
-          default_resp(&dresp) {
+          default_resp(&dresp),
+          stats(std::make_shared<MethodStats>()) {
     }
 
     // Streaming RPC.
     Method(std::string n, RpcStreamMethodCb c, const Message& dreq)
-        : name(std::move(n)), stream_rpc_method(std::move(c)), default_req(&dreq) {
+        : name(std::move(n)),
+          stream_rpc_method(std::move(c)),
+          default_req(&dreq),
+          stats(std::make_shared<MethodStats>()) {
     }
   };
 
@@ -74,6 +86,31 @@ class ServiceDescriptor {
     return methods_[i];
   }
 
+  // The request and the response of a single call, created from the method prototypes.
+  // With MethodOptions::use_arena they live on an arena from a per-thread pool, so nested
+  // messages are freed at once when CallMessages is destroyed and the arena goes back to the
+  // pool of the destroying thread.
+  class CallMessages {
+   public:
+    explicit CallMessages(const Method& method);
+    ~CallMessages();
+
+    CallMessages(const CallMessages&) = delete;
+    void operator=(const CallMessages&) = delete;
+
+    Message* request() { return request_; }
+
+    // Null for streaming methods.
+    Message* response() { return response_; }
+
+   private:
+    struct PooledArena;
+
+    PooledArena* arena_ = nullptr;
+    Message* request_ = nullptr;
+    Message* response_ = nullptr;
+  };
+
  protected:
   std::vector<Method> methods_;  // Generated classes derive from this class and fill this field.
 };
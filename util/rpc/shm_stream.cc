@@ -0,0 +1,310 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/shm_stream.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+
+#include "base/bits.h"
+#include "base/logging.h"
+#include "util/asio/yield.h"
+
+namespace util {
+namespace rpc {
+
+using namespace boost;
+using namespace std;
+
+namespace {
+
+inline system::error_code LastError() {
+  return system::error_code(errno, system::system_category());
+}
+
+}  // namespace
+
+struct ShmRing::Header {
+  alignas(64) std::atomic_uint64_t head;  // The number of the written bytes.
+  alignas(64) std::atomic_uint64_t tail;  // The number of the read bytes.
+  alignas(64) std::atomic_uint32_t reader_waiting;
+  std::atomic_uint32_t writer_waiting, closed;
+  uint64_t capacity;
+};
+
+// The peers run in different processes, the atomics must not rely on process-local locks.
+static_assert(std::atomic_uint64_t::is_always_lock_free, "");
+static_assert(std::atomic_uint32_t::is_always_lock_free, "");
+
+constexpr size_t kHeaderSize = 256;
+
+ShmRing::~ShmRing() {
+  if (header_) {
+    munmap(header_, kHeaderSize + capacity());
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+auto ShmRing::Create(size_t capacity) -> error_code {
+  static_assert(sizeof(Header) <= kHeaderSize, "");
+  CHECK(!header_);
+  capacity = Bits::RoundUp64(std::max<uint64_t>(capacity, 4096));
+
+  fd_ = memfd_create("rpc_shm_ring", MFD_CLOEXEC);
+  if (fd_ < 0)
+    return LastError();
+  if (ftruncate(fd_, kHeaderSize + capacity) != 0)
+    return LastError();
+
+  void* ptr = mmap(nullptr, kHeaderSize + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (ptr == MAP_FAILED)
+    return LastError();
+
+  // The mapping of a new memfd is zeroed, so that the atomics start at 0.
+  header_ = reinterpret_cast<Header*>(ptr);
+  header_->capacity = capacity;
+  data_ = reinterpret_cast<uint8_t*>(ptr) + kHeaderSize;
+  mask_ = capacity - 1;
+
+  return error_code{};
+}
+
+auto ShmRing::Attach(int fd) -> error_code {
+  CHECK(!header_);
+  fd_ = fd;
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0)
+    return LastError();
+  if (size_t(st.st_size) <= kHeaderSize)
+    return system::errc::make_error_code(system::errc::invalid_argument);
+
+  size_t capacity = st.st_size - kHeaderSize;
+  void* ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (ptr == MAP_FAILED)
+    return LastError();
+
+  header_ = reinterpret_cast<Header*>(ptr);
+  data_ = reinterpret_cast<uint8_t*>(ptr) + kHeaderSize;
+  mask_ = capacity - 1;
+  if (header_->capacity != capacity || (capacity & mask_) != 0)
+    return system::errc::make_error_code(system::errc::invalid_argument);
+
+  return error_code{};
+}
+
+size_t ShmRing::Write(const void* src, size_t len) {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_acquire);
+  size_t n = std::min(len, capacity() - (head - tail));
+  if (n == 0)
+    return 0;
+
+  size_t offset = head & mask_;
+  size_t first = std::min(n, capacity() - offset);
+  memcpy(data_ + offset, src, first);
+  memcpy(data_, reinterpret_cast<const uint8_t*>(src) + first, n - first);
+  header_->head.store(head + n, std::memory_order_release);
+
+  return n;
+}
+
+size_t ShmRing::Read(void* dest, size_t len) {
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  size_t n = std::min<uint64_t>(len, head - tail);
+  if (n == 0)
+    return 0;
+
+  size_t offset = tail & mask_;
+  size_t first = std::min(n, capacity() - offset);
+  memcpy(dest, data_ + offset, first);
+  memcpy(reinterpret_cast<uint8_t*>(dest) + first, data_, n - first);
+  header_->tail.store(tail + n, std::memory_order_release);
+
+  return n;
+}
+
+bool ShmRing::empty() const {
+  return header_->head.load(std::memory_order_acquire) == header_->tail.load(std::memory_order_acquire);
+}
+
+bool ShmRing::full() const {
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  return head - header_->tail.load(std::memory_order_acquire) == capacity();
+}
+
+// seq_cst orders the flag stores before the ring re-checks of the waiting side and the index
+// stores before the flag loads of the notifying side.
+void ShmRing::SetReaderWaiting() {
+  header_->reader_waiting.store(1);
+}
+
+bool ShmRing::ClearReaderWaiting() {
+  return header_->reader_waiting.load() && header_->reader_waiting.exchange(0);
+}
+
+void ShmRing::SetWriterWaiting() {
+  header_->writer_waiting.store(1);
+}
+
+bool ShmRing::ClearWriterWaiting() {
+  return header_->writer_waiting.load() && header_->writer_waiting.exchange(0);
+}
+
+void ShmRing::Close() {
+  header_->closed.store(1);
+}
+
+bool ShmRing::closed() const {
+  return header_->closed.load(std::memory_order_acquire);
+}
+
+auto ShmStream::CreatePair(size_t capacity, Descriptors* mine, Descriptors* peer) -> error_code {
+  ShmRing rings[2];
+  for (ShmRing& ring : rings) {
+    error_code ec = ring.Create(capacity);
+    if (ec)
+      return ec;
+  }
+
+  int events[2];
+  for (int& event : events) {
+    event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0)
+      return LastError();
+  }
+
+  *mine = Descriptors{dup(rings[0].fd()), dup(rings[1].fd()), events[0], events[1]};
+  *peer = Descriptors{dup(rings[1].fd()), dup(rings[0].fd()), dup(events[1]), dup(events[0])};
+
+  return error_code{};
+}
+
+ShmStream::ShmStream(IoContext* cntx) : cntx_(*cntx), wait_event_(cntx->raw_context()) {
+}
+
+ShmStream::~ShmStream() {
+  if (open_) {
+    Shutdown();
+  }
+  if (notify_event_ >= 0) {
+    close(notify_event_);
+  }
+}
+
+auto ShmStream::Open(const Descriptors& fds) -> error_code {
+  CHECK(!open_);
+
+  error_code ec;
+  wait_event_.assign(fds.wait_event, ec);
+  notify_event_ = fds.notify_event;
+  if (!ec)
+    ec = tx_.Attach(fds.tx);
+  if (!ec)
+    ec = rx_.Attach(fds.rx);
+
+  open_ = !ec;
+  return ec;
+}
+
+size_t ShmStream::ReadOnce(void* dest, size_t len, error_code& ec) {
+  DCHECK(cntx_.InContextThread());
+
+  while (true) {
+    size_t n = rx_.Read(dest, len);
+    if (n) {
+      if (rx_.ClearWriterWaiting())
+        NotifyPeer();
+      return n;
+    }
+
+    if (rx_.closed()) {
+      n = rx_.Read(dest, len);  // The peer could write right before closing.
+      if (n)
+        return n;
+      ec = asio::error::eof;
+      return 0;
+    }
+
+    rx_.SetReaderWaiting();
+    if (!rx_.empty() || rx_.closed()) {
+      rx_.ClearReaderWaiting();
+      continue;
+    }
+
+    ec = Wait();
+    if (ec)
+      return 0;
+  }
+}
+
+size_t ShmStream::WriteOnce(const void* src, size_t len, error_code& ec) {
+  DCHECK(cntx_.InContextThread());
+
+  while (true) {
+    if (tx_.closed()) {
+      ec = asio::error::broken_pipe;
+      return 0;
+    }
+
+    size_t n = tx_.Write(src, len);
+    if (n) {
+      if (tx_.ClearReaderWaiting())
+        NotifyPeer();
+      return n;
+    }
+
+    tx_.SetWriterWaiting();
+    if (!tx_.full() || tx_.closed()) {
+      tx_.ClearWriterWaiting();
+      continue;
+    }
+
+    ec = Wait();
+    if (ec)
+      return 0;
+  }
+}
+
+auto ShmStream::Wait() -> error_code {
+  error_code ec;
+  wait_event_.async_wait(asio::posix::descriptor_base::wait_read, fibers_ext::yield[ec]);
+  if (ec)
+    return ec;
+
+  uint64_t counter;
+  ssize_t res = read(wait_event_.native_handle(), &counter, sizeof(counter));
+  (void)res;  // The peer may be notified several times, EAGAIN just means it was read before.
+
+  return error_code{};
+}
+
+void ShmStream::NotifyPeer() {
+  uint64_t one = 1;
+  ssize_t res = write(notify_event_, &one, sizeof(one));
+  DCHECK_EQ(sizeof(one), size_t(res));
+}
+
+void ShmStream::Shutdown() {
+  if (!open_)
+    return;
+
+  open_ = false;
+  tx_.Close();
+  rx_.Close();
+  NotifyPeer();
+
+  error_code ec;
+  wait_event_.close(ec);
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,133 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "util/asio/io_context.h"
+
+namespace util {
+namespace rpc {
+
+// Single-producer single-consumer byte ring in a memfd mapping. Both processes that hold the
+// descriptor map the same memory; the producer advances only head and the consumer only tail.
+// The waiting flags let each side skip the notification while its peer is not blocked.
+class ShmRing {
+ public:
+  using error_code = ::boost::system::error_code;
+
+  ShmRing() = default;
+  ShmRing(const ShmRing&) = delete;
+  ~ShmRing();
+
+  void operator=(const ShmRing&) = delete;
+
+  // capacity is rounded up to a power of 2.
+  error_code Create(size_t capacity);
+
+  // Maps the ring that was created by Create(), takes ownership of fd.
+  error_code Attach(int fd);
+
+  int fd() const { return fd_; }
+  size_t capacity() const { return mask_ + 1; }
+
+  // Producer side. Copies up to len bytes and returns how many were copied.
+  size_t Write(const void* src, size_t len);
+
+  // Consumer side. Copies up to len bytes and returns how many were copied.
+  size_t Read(void* dest, size_t len);
+
+  bool empty() const;
+  bool full() const;
+
+  // A side that is about to block sets its flag and checks the ring again. The peer that
+  // clears the flag after changing the ring must notify it.
+  void SetReaderWaiting();
+  bool ClearReaderWaiting();
+  void SetWriterWaiting();
+  bool ClearWriterWaiting();
+
+  void Close();
+  bool closed() const;
+
+ private:
+  struct Header;
+
+  Header* header_ = nullptr;
+  uint8_t* data_ = nullptr;
+  size_t mask_ = 0;
+  int fd_ = -1;
+};
+
+// Fiber stream over a pair of shared rings, one per direction, for rpc peers on the same host.
+// Implements the same SyncReadStream/SyncWriteStream interface as FiberSyncSocket, so the rpc
+// frames are read and written with the same code. Every side blocks on its own eventfd that
+// the peer signals when it fills the rx ring or drains the tx ring of that side.
+// IoContext specific: must be used from the fibers of its IoContext.
+class ShmStream {
+ public:
+  using error_code = ::boost::system::error_code;
+
+  struct Descriptors {
+    int tx = -1, rx = -1;
+    int wait_event = -1, notify_event = -1;
+  };
+
+  // Creates the rings and the eventfds of a connection. peer gets duplicates of the same
+  // descriptors with the directions swapped, to be passed to the other process.
+  static error_code CreatePair(size_t capacity, Descriptors* mine, Descriptors* peer);
+
+  explicit ShmStream(IoContext* cntx);
+  ~ShmStream();
+
+  // Takes ownership of the descriptors.
+  error_code Open(const Descriptors& fds);
+
+  template <typename MBS> size_t read_some(const MBS& bufs, error_code& ec);
+  template <typename BS> size_t write_some(const BS& bufs, error_code& ec);
+
+  // Closes both rings and wakes up the peer, its reads return eof after draining rx.
+  void Shutdown();
+
+  bool is_open() const { return open_; }
+
+  IoContext& context() { return cntx_; }
+
+ private:
+  size_t ReadOnce(void* dest, size_t len, error_code& ec);
+  size_t WriteOnce(const void* src, size_t len, error_code& ec);
+
+  error_code Wait();
+  void NotifyPeer();
+
+  IoContext& cntx_;
+  ShmRing tx_, rx_;
+  ::boost::asio::posix::stream_descriptor wait_event_;
+  int notify_event_ = -1;
+  bool open_ = false;
+};
+
+template <typename MBS> size_t ShmStream::read_some(const MBS& bufs, error_code& ec) {
+  for (auto it = ::boost::asio::buffer_sequence_begin(bufs);
+       it != ::boost::asio::buffer_sequence_end(bufs); ++it) {
+    ::boost::asio::mutable_buffer buf(*it);
+    if (buf.size())
+      return ReadOnce(buf.data(), buf.size(), ec);
+  }
+  return 0;
+}
+
+template <typename BS> size_t ShmStream::write_some(const BS& bufs, error_code& ec) {
+  for (auto it = ::boost::asio::buffer_sequence_begin(bufs);
+       it != ::boost::asio::buffer_sequence_end(bufs); ++it) {
+    ::boost::asio::const_buffer buf(*it);
+    if (buf.size())
+      return WriteOnce(buf.data(), buf.size(), ec);
+  }
+  return 0;
+}
+
+}  // namespace rpc
+}  // namespace util
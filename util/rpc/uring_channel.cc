@@ -0,0 +1,348 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/uring_channel.h"
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+
+#include "base/logging.h"
+#include "util/asio_stream_adapter.h"
+#include "util/uring/proactor.h"
+#include "util/uring/uring_fiber_algo.h"
+
+namespace util {
+namespace rpc {
+
+DECLARE_uint32(rpc_client_pending_limit);
+
+using namespace boost;
+using namespace std;
+using uring::FiberSocket;
+namespace error = asio::error;
+
+namespace {
+
+bool IsExpectedFinish(system::error_code ec) {
+  return ec == error::eof || ec == error::operation_aborted || FiberSocket::IsConnClosed(ec);
+}
+
+constexpr uint32_t kTickPrecision = 3;  // 3ms per timer tick.
+
+}  // namespace
+
+UringChannel::~UringChannel() {
+  Shutdown();
+}
+
+void UringChannel::Shutdown() {
+  proactor_->AwaitBlocking([this] {
+    if (!shutting_down_) {
+      shutting_down_ = true;
+      if (socket_.IsOpen()) {
+        auto ec = socket_.Shutdown(SHUT_RDWR);
+        VLOG_IF(1, ec) << "Shutdown " << ec;
+      }
+      send_cv_.notify_all();
+      expiry_cv_.notify_all();
+    }
+
+    for (fibers::fiber* fb : {&read_fiber_, &flush_fiber_, &expiry_fiber_}) {
+      if (fb->joinable())
+        fb->join();
+    }
+
+    if (socket_.IsOpen()) {
+      auto ec = socket_.Close();
+      VLOG_IF(1, ec) << "Close " << ec;
+    }
+  });
+}
+
+auto UringChannel::Connect(uint32_t ms) -> error_code {
+  CHECK(!read_fiber_.joinable());
+
+  return proactor_->AwaitBlocking([&] {
+    socket_.set_proactor(proactor_);
+    FiberSocket::error_code ec =
+        socket_.Connect(ep_, FiberSocket::deadline_t::clock::now() + chrono::milliseconds(ms));
+    if (ec) {
+      status_ = error_code(ec.value(), system::system_category());
+      return status_;
+    }
+
+    read_fiber_ = fibers::fiber(&UringChannel::ReadFiber, this);
+    flush_fiber_ = fibers::fiber(&UringChannel::FlushFiber, this);
+    expiry_fiber_ = fibers::fiber(&UringChannel::ExpiryFiber, this);
+
+    return error_code{};
+  });
+}
+
+auto UringChannel::PresendChecks() -> error_code {
+  DCHECK(proactor_->InMyThread()) << "UringChannel must be used from its proactor thread";
+
+  if (shutting_down_ || !socket_.IsOpen()) {
+    return error::shut_down;
+  }
+
+  if (status_) {
+    return status_;
+  }
+
+  if (pending_calls_.size() + outgoing_buf_.size() >= FLAGS_rpc_client_pending_limit) {
+    return error::no_buffer_space;
+  }
+
+  return error_code{};
+}
+
+auto UringChannel::Send(uint32 deadline_msec, Envelope* envelope) -> future_code_t {
+  DCHECK(read_fiber_.joinable()) << "Call UringChannel::Connect(), stupid.";
+  DCHECK_GT(deadline_msec, 0);
+
+  fibers::promise<error_code> p;
+  fibers::future<error_code> res = p.get_future();
+  error_code ec = PresendChecks();
+
+  if (ec) {
+    p.set_value(ec);
+    return res;
+  }
+
+  uint32_t ticks = (deadline_msec + kTickPrecision - 1) / kTickPrecision;
+  std::unique_ptr<ExpiryEvent> ev(new ExpiryEvent(this));
+
+  RpcId id = next_send_rpc_id_++;
+
+  ev->set_id(id);
+  base::Tick at = expire_timer_.schedule(ev.get(), ticks);
+  DVLOG(2) << "Scheduled expiry at " << at << " for rpcid " << id;
+
+  outgoing_buf_.emplace_back(SendItem(id, PendingCall{std::move(p), envelope}));
+  outgoing_buf_.back().second.expiry_event = std::move(ev);
+  send_cv_.notify_one();
+
+  return res;
+}
+
+auto UringChannel::SendAndReadStream(Envelope* msg, MessageCallback cb) -> error_code {
+  DCHECK(read_fiber_.joinable());
+
+  error_code ec = PresendChecks();
+  if (ec) {
+    return ec;
+  }
+
+  fibers::promise<error_code> p;
+  fibers::future<error_code> future = p.get_future();
+
+  RpcId id = next_send_rpc_id_++;
+
+  outgoing_buf_.emplace_back(SendItem(id, PendingCall{std::move(p), msg, std::move(cb)}));
+  send_cv_.notify_one();
+
+  return future.get();
+}
+
+void UringChannel::ReadFiber() {
+  this_fiber::properties<uring::UringFiberProps>().set_name("RpcRead");
+  VLOG(1) << "Start ReadFiber on socket " << socket_.native_handle();
+
+  error_code ec;
+  while (!shutting_down_) {
+    ec = ReadEnvelope();
+    if (ec) {
+      LOG_IF(WARNING, !shutting_down_ && !IsExpectedFinish(ec))
+          << "Error reading envelope " << ec << " " << ec.message();
+      break;
+    }
+  }
+
+  // FiberSocket does not reconnect, so the channel stays broken.
+  status_ = shutting_down_ ? error::shut_down : ec;
+  CancelPendingCalls(status_);
+  send_cv_.notify_all();
+
+  VLOG(1) << "Finish ReadFiber on socket " << socket_.native_handle();
+}
+
+void UringChannel::FlushFiber() {
+  this_fiber::properties<uring::UringFiberProps>().set_name("RpcFlush");
+
+  while (true) {
+    {
+      std::unique_lock<fibers::mutex> lk(send_mu_);
+      send_cv_.wait(lk, [this] { return !outgoing_buf_.empty() || shutting_down_ || status_; });
+    }
+
+    if (shutting_down_ || status_)
+      break;
+
+    error_code ec = FlushSends();
+    if (ec) {
+      LOG_IF(WARNING, !IsExpectedFinish(ec)) << "Error sending " << ec << " " << ec.message();
+      status_ = ec;
+      CancelPendingCalls(ec);
+      break;
+    }
+  }
+
+  // Fail the calls that were queued but not sent.
+  std::vector<SendItem> tmp;
+  tmp.swap(outgoing_buf_);
+  for (auto& item : tmp) {
+    item.second.promise.set_value(status_ ? status_ : error_code(error::shut_down));
+  }
+}
+
+void UringChannel::ExpiryFiber() {
+  this_fiber::properties<uring::UringFiberProps>().set_name("RpcExpiry");
+  auto last = chrono::steady_clock::now();
+
+  std::unique_lock<fibers::mutex> lk(send_mu_);
+  while (!shutting_down_) {
+    expiry_cv_.wait_for(lk, chrono::milliseconds(kTickPrecision));
+
+    auto now = chrono::steady_clock::now();
+    auto ticks = chrono::duration_cast<chrono::milliseconds>(now - last).count() / kTickPrecision;
+    if (ticks > 0) {
+      last += chrono::milliseconds(ticks * kTickPrecision);
+      expire_timer_.advance(ticks);
+    }
+  }
+}
+
+auto UringChannel::FlushSends() -> error_code {
+  // The following section is CPU-only - No IO blocks.
+  size_t count = outgoing_buf_.size();
+  write_seq_.resize(count * 3);
+  frame_buf_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto& p = outgoing_buf_[i];
+    Frame f(p.first, p.second.envelope->header.size(), p.second.envelope->letter.size());
+    size_t sz = f.Write(frame_buf_[i].data());
+
+    write_seq_[3 * i] = asio::buffer(frame_buf_[i].data(), sz);
+    write_seq_[3 * i + 1] = asio::buffer(p.second.envelope->header);
+    write_seq_[3 * i + 2] = asio::buffer(p.second.envelope->letter);
+  }
+
+  // Fill the pending calls before the write because ReadFiber might receive the responses
+  // before the writing fiber resumes.
+  for (size_t i = 0; i < count; ++i) {
+    auto& item = outgoing_buf_[i];
+    auto emplace_res = pending_calls_.emplace(item.first, std::move(item.second));
+    CHECK(emplace_res.second);
+  }
+  outgoing_buf_.clear();
+
+  // Interrupt point during which outgoing_buf_ could grow. Only FlushFiber writes into
+  // the socket.
+  error_code ec;
+  AsioStreamAdapter<FiberSocket> asa(socket_);
+  asio::write(asa, write_seq_, ec);
+
+  return ec;
+}
+
+void UringChannel::ExpirePending(RpcId id) {
+  DVLOG(1) << "Expire rpc id " << id;
+
+  auto it = pending_calls_.find(id);
+  if (it == pending_calls_.end()) {
+    return;
+  }
+
+  // The order is important to eliminate interrupts.
+  EcPromise pr = std::move(it->second.promise);
+  pending_calls_.erase(it);
+  pr.set_value(error::timed_out);
+}
+
+auto UringChannel::ReadEnvelope() -> error_code {
+  AsioStreamAdapter<FiberSocket> asa(socket_);
+  Frame f;
+  error_code ec = f.Read(&asa);
+  if (ec)
+    return ec;
+
+  VLOG(2) << "Got rpc_id " << f.rpc_id << " from socket " << socket_.native_handle();
+
+  auto it = pending_calls_.find(f.rpc_id);
+  if (it == pending_calls_.end()) {
+    // The rpc has expired and the envelope reached us afterwards. We just consume it.
+    VLOG(1) << "Unknown id " << f.rpc_id;
+
+    Envelope envelope(f.header_size, f.letter_size);
+    asio::read(asa, envelope.buf_seq(), ec);
+    return ec;
+  }
+
+  // -- NO interrupt section begin
+  PendingCall& call = it->second;
+  Envelope* env = call.envelope;
+  env->Resize(f.header_size, f.letter_size);
+  bool is_stream = static_cast<bool>(call.cb);
+
+  if (is_stream) {
+    VLOG(1) << "Processing stream";
+    asio::read(asa, env->buf_seq(), ec);
+    if (!ec) {
+      HandleStreamResponse(f.rpc_id);
+    }
+
+    return ec;
+  }
+
+  fibers::promise<error_code> promise = std::move(call.promise);
+
+  // We erase before reading from the socket because pending_calls_ might change when we resume
+  // after IO and 'it' will be invalidated.
+  pending_calls_.erase(it);
+  // -- NO interrupt section end
+
+  asio::read(asa, env->buf_seq(), ec);
+  promise.set_value(ec);
+
+  return ec;
+}
+
+void UringChannel::HandleStreamResponse(RpcId rpc_id) {
+  auto it = pending_calls_.find(rpc_id);
+  if (it == pending_calls_.end()) {
+    return;  // Might happen if pending_calls_ was cancelled when we read the envelope.
+  }
+  PendingCall& call = it->second;
+  error_code ec = call.cb(*call.envelope);
+  if (!ec)
+    return;
+
+  // eof - means successful finish of stream receival.
+  if (ec == error::eof) {
+    ec = system::error_code{};
+  }
+
+  // Keep the promise on the stack and erase from pending_calls_ first because
+  // set_value might context switch and invalidate 'it'.
+  auto promise = std::move(call.promise);
+  pending_calls_.erase(it);
+  promise.set_value(ec);
+}
+
+void UringChannel::CancelPendingCalls(error_code ec) {
+  if (pending_calls_.empty())
+    return;
+
+  // promise might interrupt so we swap into local variable to allow stable iteration.
+  PendingMap tmp;
+  tmp.swap(pending_calls_);
+
+  for (auto& c : tmp) {
+    c.second.promise.set_value(ec);
+  }
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,142 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <boost/fiber/condition_variable.hpp>
+#include <boost/fiber/future.hpp>
+
+#include "absl/container/flat_hash_map.h"
+#include "base/wheel_timer.h"
+#include "util/rpc/frame_format.h"
+#include "util/rpc/rpc_envelope.h"
+#include "util/uring/fiber_socket.h"
+
+namespace util {
+namespace uring {
+class Proactor;
+}  // namespace uring
+
+namespace rpc {
+
+// Fiber-safe rpc client over uring::FiberSocket, the counterpart of Channel for the services
+// that run on ProactorPool. Unlike Channel, UringChannel must be used from the proactor
+// thread it was created with; other threads should call it via Proactor::AwaitBlocking.
+// Its background fibers run on the same proactor, so a client needs no other event loop.
+class UringChannel {
+ public:
+  using error_code = ::boost::system::error_code;
+  using future_code_t = boost::fibers::future<error_code>;
+  using endpoint_type = uring::FiberSocket::endpoint_type;
+
+  // Returns boost::asio::error::eof if the Stream has been finished,
+  // if bool(error_code) returns true, aborts receiving the stream and returns the error.
+  using MessageCallback = std::function<error_code(Envelope&)>;
+
+  UringChannel(const endpoint_type& ep, uring::Proactor* p) : ep_(ep), proactor_(p) {
+  }
+
+  ~UringChannel();
+
+  // Blocks at least for 'ms' milliseconds to connect to the host.
+  // Should be called once during the initialization phase before sending the requests.
+  // Can be called from any thread.
+  error_code Connect(uint32_t ms);
+
+  // Sends the envelope and returns the future to the response status code.
+  // Future is realized when response is received and serialized into the same envelope.
+  future_code_t Send(uint32_t deadline_msec, Envelope* envelope);
+
+  // Fiber-blocking call. Sends and waits until the response is back.
+  // Similarly to Send, the response is written into the same envelope.
+  error_code SendSync(uint32_t deadline_msec, Envelope* envelope) {
+    return Send(deadline_msec, envelope).get();
+  }
+
+  // Sends a msg and waits to receive a stream of envelopes.
+  // For each envelope MessageCallback is called, see MessageCallback for the stream end.
+  error_code SendAndReadStream(Envelope* msg, MessageCallback cb);
+
+  // Blocks the calling fiber until all the background processes finish.
+  // Can be called from any thread.
+  void Shutdown();
+
+ private:
+  void ReadFiber();
+  void FlushFiber();
+  void ExpiryFiber();
+
+  error_code ReadEnvelope();
+  error_code PresendChecks();
+  error_code FlushSends();
+  void CancelPendingCalls(error_code ec);
+  void ExpirePending(RpcId id);
+  void HandleStreamResponse(RpcId rpc_id);
+
+  class ExpiryEvent : public base::TimerEventInterface {
+   public:
+    explicit ExpiryEvent(UringChannel* me) : me_(me) {
+    }
+
+    // ExpiryEvent can not be moved because its address is registered inside TimerWheel.
+    void execute() final {
+      me_->ExpirePending(id_);
+    }
+
+    void set_id(RpcId i) {
+      id_ = i;
+    }
+
+   private:
+    UringChannel* me_;
+    RpcId id_ = 0;
+  };
+
+  typedef boost::fibers::promise<error_code> EcPromise;
+
+  struct PendingCall {
+    EcPromise promise;
+    Envelope* envelope;
+
+    MessageCallback cb;  // for Stream response.
+
+    PendingCall(EcPromise p, Envelope* env, MessageCallback mcb = MessageCallback{})
+        : promise(std::move(p)), envelope(env), cb(std::move(mcb)) {
+    }
+
+    std::unique_ptr<ExpiryEvent> expiry_event;
+  };
+
+  // Send fibers enqueue requests into outgoing_buf_ and wake up FlushFiber, which writes
+  // all the queued requests with a single write. ReadFiber receives envelopes and realizes
+  // the futures of their calls.
+  typedef std::pair<RpcId, PendingCall> SendItem;
+
+  endpoint_type ep_;
+  uring::Proactor* proactor_;
+  uring::FiberSocket socket_;
+
+  RpcId next_send_rpc_id_ = 1;
+  bool shutting_down_ = false;
+  error_code status_;
+
+  std::vector<SendItem> outgoing_buf_;
+  boost::fibers::mutex send_mu_;
+  boost::fibers::condition_variable send_cv_;
+
+  boost::fibers::fiber read_fiber_, flush_fiber_, expiry_fiber_;
+
+  // Used in FlushSends to flush buffers efficiently.
+  std::vector<boost::asio::const_buffer> write_seq_;
+  base::PODArray<std::array<uint8_t, rpc::Frame::kMaxByteSize>> frame_buf_;
+
+  typedef absl::flat_hash_map<RpcId, PendingCall> PendingMap;
+  PendingMap pending_calls_;
+
+  // Handles expiration flow.
+  base::TimerWheel expire_timer_;
+  boost::fibers::condition_variable expiry_cv_;
+};
+
+}  // namespace rpc
+}  // namespace util
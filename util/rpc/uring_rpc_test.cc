@@ -0,0 +1,144 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "absl/strings/numbers.h"
+#include "absl/strings/strip.h"
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/rpc/rpc_test_utils.h"
+#include "util/rpc/uring_channel.h"
+#include "util/rpc/uring_service.h"
+#include "util/uring/proactor_pool.h"
+
+namespace util {
+namespace rpc {
+
+using namespace std;
+using namespace boost;
+
+class UringTestInterface final : public UringServiceInterface {
+ public:
+  ConnectionBridge* CreateConnectionBridge() override {
+    return new TestBridge{false};
+  }
+};
+
+class UringRpcTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    pp_.reset(new uring::ProactorPool(2));
+    pp_->Run();
+
+    server_.reset(new uring::AcceptServer(pp_.get()));
+    uint16_t port = server_->AddListener(0, new UringTestInterface);
+    server_->Run();
+
+    asio::ip::tcp::endpoint ep{asio::ip::make_address("127.0.0.1"), port};
+    proactor_ = pp_->GetNextProactor();
+    channel_.reset(new UringChannel(ep, proactor_));
+    auto ec = channel_->Connect(1000);
+    CHECK(!ec) << ec.message();
+  }
+
+  void TearDown() override {
+    channel_.reset();
+    server_->Stop(true);
+    pp_->Stop();
+  }
+
+  // Runs f in the proactor thread of the channel.
+  template <typename Func> void Run(Func&& f) {
+    proactor_->AwaitBlocking(std::forward<Func>(f));
+  }
+
+  std::unique_ptr<uring::ProactorPool> pp_;
+  std::unique_ptr<uring::AcceptServer> server_;
+  std::unique_ptr<UringChannel> channel_;
+  uring::Proactor* proactor_ = nullptr;
+};
+
+TEST_F(UringRpcTest, SendOk) {
+  Envelope envelope;
+  envelope.header.resize_fill(14, 1);
+  envelope.letter.resize_fill(42, 2);
+
+  Run([&] {
+    UringChannel::future_code_t fc = channel_->Send(20, &envelope);
+    EXPECT_FALSE(fc.get());
+  });
+  EXPECT_EQ(14, envelope.header.size());
+  EXPECT_EQ(42, envelope.letter.size());
+}
+
+TEST_F(UringRpcTest, Batch) {
+  constexpr unsigned kNumCalls = 100;
+  vector<Envelope> envelopes(kNumCalls);
+
+  Run([&] {
+    vector<UringChannel::future_code_t> futures;
+    for (unsigned i = 0; i < kNumCalls; ++i) {
+      Copy(to_string(i), &envelopes[i].letter);
+      futures.push_back(channel_->Send(1000, &envelopes[i]));
+    }
+    for (auto& fc : futures) {
+      EXPECT_FALSE(fc.get());
+    }
+  });
+
+  for (unsigned i = 0; i < kNumCalls; ++i) {
+    EXPECT_EQ(to_string(i), string(strings::charptr(envelopes[i].letter.data()),
+                                   envelopes[i].letter.size()));
+  }
+}
+
+TEST_F(UringRpcTest, Stream) {
+  string header("repeat3");
+
+  Envelope envelope;
+  Copy(header, &envelope.header);
+  envelope.letter.resize_fill(42, 2);
+
+  int times = 0;
+  auto cb = [&](Envelope& env) -> system::error_code {
+    ++times;
+    absl::string_view header(strings::charptr(env.header.data()), env.header.size());
+    if (absl::ConsumePrefix(&header, "cont:")) {
+      uint32_t cont = 0;
+      CHECK(absl::SimpleAtoi(header, &cont));
+      return cont ? system::error_code{} : asio::error::eof;
+    }
+    return system::errc::make_error_code(system::errc::invalid_argument);
+  };
+
+  system::error_code ec;
+  Run([&] { ec = channel_->SendAndReadStream(&envelope, cb); });
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(3, times);
+}
+
+TEST_F(UringRpcTest, Sleep) {
+  string header("sleep20");
+
+  Envelope envelope;
+  Copy(header, &envelope.header);
+  envelope.letter.resize_fill(42, 2);
+
+  Run([&] {
+    system::error_code ec = channel_->SendSync(1, &envelope);
+    ASSERT_EQ(asio::error::timed_out, ec) << ec.message();  // expect timeout.
+
+    envelope.header.clear();
+    ec = channel_->SendSync(80, &envelope);
+    ASSERT_FALSE(ec) << ec.message();  // expect normal execution.
+  });
+}
+
+TEST_F(UringRpcTest, Shutdown) {
+  channel_->Shutdown();
+
+  Envelope envelope;
+  Run([&] { EXPECT_EQ(asio::error::shut_down, channel_->SendSync(20, &envelope)); });
+}
+
+}  // namespace rpc
+}  // namespace util
@@ -0,0 +1,154 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/rpc/uring_service.h"
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "base/logging.h"
+#include "util/asio_stream_adapter.h"
+#include "util/rpc/frame_format.h"
+#include "util/uring/proactor.h"
+
+namespace util {
+namespace rpc {
+
+using namespace boost;
+using namespace std;
+using uring::FiberSocket;
+
+namespace {
+
+bool IsExpectedFinish(system::error_code ec) {
+  return ec == asio::error::eof || FiberSocket::IsConnClosed(ec);
+}
+
+class UringRpcConnection : public uring::Connection {
+ public:
+  explicit UringRpcConnection(ConnectionBridge* bridge) : bridge_(bridge) {
+  }
+
+ protected:
+  void HandleRequests() final;
+
+ private:
+  using error_code = system::error_code;
+
+  error_code ReadEnvelope(AsioStreamAdapter<FiberSocket>* asa, Frame* frame, Envelope* env);
+  void WriteEnvelope(RpcId rpc_id, Envelope&& env);
+  error_code FlushOutgoing();
+
+  std::unique_ptr<ConnectionBridge> bridge_;
+
+  // Envelopes that the bridge wrote while another fiber was flushing. The flushing fiber
+  // sends them with its next write.
+  std::vector<std::pair<RpcId, Envelope>> outgoing_, sending_;
+  std::vector<asio::const_buffer> write_seq_;
+  base::PODArray<std::array<uint8_t, Frame::kMaxByteSize>> frame_buf_;
+  bool flushing_ = false;
+  error_code write_ec_;
+};
+
+void UringRpcConnection::HandleRequests() {
+  CHECK(socket_.IsOpen());
+
+  bridge_->InitInThread();
+  AsioStreamAdapter<FiberSocket> asa(socket_);
+
+  while (true) {
+    Frame frame;
+    Envelope envelope;
+    error_code ec = ReadEnvelope(&asa, &frame, &envelope);
+    if (ec) {
+      LOG_IF(WARNING, !IsExpectedFinish(ec))
+          << "Error reading envelope " << ec << " " << ec.message();
+      break;
+    }
+    if (write_ec_)
+      break;
+
+    // Streams are not flow controlled and HELLO is not answered, so the letters stay raw.
+    if (frame.type != Frame::DATA)
+      continue;
+
+    RpcId id = frame.rpc_id;
+    bridge_->HandleEnvelope(id, &envelope, [this, id](Envelope&& env) {
+      WriteEnvelope(id, std::move(env));
+    });
+  }
+
+  bridge_->Join();
+  VLOG(1) << "UringRpcConnection exit";
+}
+
+auto UringRpcConnection::ReadEnvelope(AsioStreamAdapter<FiberSocket>* asa, Frame* frame,
+                                      Envelope* env) -> error_code {
+  error_code ec = frame->Read(asa);
+  if (ec)
+    return ec;
+
+  VLOG(2) << "Got rpc_id " << frame->rpc_id << " from socket " << socket_.native_handle();
+  if (frame->type != Frame::DATA)
+    return ec;
+
+  env->Resize(frame->header_size, frame->letter_size);
+  asio::read(*asa, env->buf_seq(), ec);
+
+  return ec;
+}
+
+void UringRpcConnection::WriteEnvelope(RpcId rpc_id, Envelope&& env) {
+  DCHECK(socket_.proactor()->InMyThread());
+
+  if (write_ec_)
+    return;
+
+  outgoing_.emplace_back(rpc_id, std::move(env));
+
+  // Group commit: the fiber that writes takes all the envelopes that were queued meanwhile.
+  if (flushing_)
+    return;
+
+  flushing_ = true;
+  while (!outgoing_.empty() && !write_ec_) {
+    write_ec_ = FlushOutgoing();
+  }
+  flushing_ = false;
+
+  LOG_IF(WARNING, write_ec_ && !IsExpectedFinish(write_ec_))
+      << "Error writing envelope " << write_ec_ << " " << write_ec_.message();
+}
+
+auto UringRpcConnection::FlushOutgoing() -> error_code {
+  sending_.swap(outgoing_);
+
+  size_t count = sending_.size();
+  write_seq_.resize(count * 3);
+  frame_buf_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    Envelope& env = sending_[i].second;
+    Frame f(sending_[i].first, env.header.size(), env.letter.size());
+    size_t sz = f.Write(frame_buf_[i].data());
+
+    write_seq_[3 * i] = asio::buffer(frame_buf_[i].data(), sz);
+    write_seq_[3 * i + 1] = asio::buffer(env.header);
+    write_seq_[3 * i + 2] = asio::buffer(env.letter);
+  }
+
+  error_code ec;
+  AsioStreamAdapter<FiberSocket> asa(socket_);
+  asio::write(asa, write_seq_, ec);
+  sending_.clear();
+
+  return ec;
+}
+
+}  // namespace
+
+uring::Connection* UringServiceInterface::NewConnection(uring::Proactor* context) {
+  return new UringRpcConnection(CreateConnectionBridge());
+}
+
+}  // namespace rpc
+}  // namespace util
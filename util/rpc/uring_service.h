@@ -0,0 +1,28 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include "util/rpc/connection_bridge.h"
+#include "util/uring/accept_server.h"
+
+namespace util {
+namespace rpc {
+
+// RPC-Server side part over the io_uring stack. Speaks the same frame format as
+// ServiceInterface, so Channel and UringChannel may talk to either.
+// The connections run in the proactor threads of the AcceptServer, one fiber per connection.
+class UringServiceInterface : public uring::ListenerInterface {
+ public:
+  virtual ~UringServiceInterface() {}
+
+ protected:
+  // A factory method creating a handler that handles requests for a single connection.
+  // The ownership over handler is passed to the caller.
+  virtual ConnectionBridge* CreateConnectionBridge() = 0;
+
+  uring::Connection* NewConnection(uring::Proactor* context) final;
+};
+
+}  // namespace rpc
+}  // namespace util
@@ -6,7 +6,9 @@
 #include <boost/beast/http/write.hpp>  // For serializing req/resp to ostream
 #include <cstring>
 
+#include "absl/container/flat_hash_map.h"
 #include "base/logging.h"
+#include "base/walltime.h"
 #include <glog/raw_logging.h>
 
 #include "strings/strcat.h"
@@ -14,6 +16,8 @@
 #include "util/http/http_client.h"
 
 DEFINE_string(sentry_dsn, "", "Sentry DSN in the format <pivatekey>@hostname/<project_id>");
+DEFINE_uint32(sentry_events_per_minute, 10, "Maximal number of events sent per minute from "
+              "every log site (file:line). The rest are counted and dropped");
 
 namespace util {
 using namespace ::boost;
@@ -21,6 +25,10 @@ using namespace ::std;
 
 namespace {
 
+constexpr size_t kQueueSize = 256;
+constexpr size_t kMaxBatch = 32;
+constexpr uint64_t kRateWindowUsec = 60 * 1000000ULL;
+
 struct Dsn {
   string public_key;
   string secret_key;
@@ -32,6 +40,8 @@ class SentrySink : public GlogAsioSink {
  public:
   explicit SentrySink(Dsn dsn, IoContext* io_context);
 
+  SentryStats GetStats() const;
+
  protected:
   void HandleItem(const Item& item) final;
 
@@ -46,13 +56,38 @@ class SentrySink : public GlogAsioSink {
   }
 
  private:
-  string GenSentryBody(const Item& item);
+  // glog passes __FILE__ literals, hence the pointer identifies the file.
+  using SiteKey = std::pair<const char*, int>;
+
+  struct Site {
+    uint64_t window_start = 0;
+    unsigned count = 0;       // Events sent in the current window.
+    unsigned suppressed = 0;  // Events dropped since the last sent one.
+  };
+
+  // May stand for several identical messages.
+  struct Event {
+    Item item;
+    unsigned repeated;
+    unsigned suppressed;  // Dropped by the rate limit before this one.
+  };
+
+  void Add(Item item, uint64_t now);
+  void Send(const Event& event);
+  string GenSentryBody(const Event& event);
 
   http::Client client_;
   Dsn dsn_;
   string port_;
+
+  std::vector<Event> batch_;
+  absl::flat_hash_map<SiteKey, Site> sites_;  // Bounded by the number of log sites.
+
+  std::atomic<uint64_t> sent_{0}, rate_limited_{0}, send_failed_{0};
 };
 
+std::atomic<SentrySink*> sentry_sink{nullptr};
+
 /* The structure is as follows:
 
 curl  -H 'X-Sentry-Auth: Sentry sentry_version=6, sentry_key=<private-key>' -i
@@ -62,7 +97,8 @@ curl  -H 'X-Sentry-Auth: Sentry sentry_version=6, sentry_key=<private-key>' -i
 
 */
 
-SentrySink::SentrySink(Dsn dsn, IoContext* io_context) : client_(io_context), dsn_(std::move(dsn)) {
+SentrySink::SentrySink(Dsn dsn, IoContext* io_context)
+    : GlogAsioSink(kQueueSize), client_(io_context), dsn_(std::move(dsn)) {
   size_t pos = dsn_.hostname.find(':');
   if (pos != string::npos) {
     port_ = dsn_.hostname.substr(pos + 1);
@@ -82,28 +118,102 @@ SentrySink::SentrySink(Dsn dsn, IoContext* io_context) : client_(io_context), ds
   dsn_.url = absl::StrCat("/api", dsn_.url, "/store/");
 }
 
+SentryStats SentrySink::GetStats() const {
+  SentryStats res;
+  res.sent = sent_.load(std::memory_order_relaxed);
+  res.queue_full = dropped();
+  res.rate_limited = rate_limited_.load(std::memory_order_relaxed);
+  res.send_failed = send_failed_.load(std::memory_order_relaxed);
+  return res;
+}
+
 void SentrySink::HandleItem(const Item& item) {
   RAW_VLOG(2, "SentrySink::HandleItem");
 
-  auto ec = client_.Connect(dsn_.hostname, port_);
-  if (ec) {
-    auto msg = ec.message();
-    RAW_VLOG(1, "Could not connect %s", msg.c_str());
-    ++lost_messages_;
+  // Takes whatever accumulated in the queue while we were sending, so that during an error
+  // storm the duplicates are coalesced and the rate limit is applied before the network.
+  uint64_t now = GetMonotonicMicros();
+  batch_.clear();
+  Add(item, now);
+
+  Item next;
+  for (size_t i = 0; i < kQueueSize && batch_.size() < kMaxBatch; ++i) {
+    if (msg_q_.try_pop(next) != fibers::channel_op_status::success)
+      break;
+    Add(std::move(next), now);
+  }
+
+  for (const Event& event : batch_) {
+    Send(event);
+  }
+}
+
+void SentrySink::Add(Item item, uint64_t now) {
+  for (Event& event : batch_) {
+    if (event.item.full_filename == item.full_filename && event.item.line == item.line &&
+        event.item.message == item.message) {
+      ++event.repeated;
+      return;
+    }
+  }
+
+  Site& site = sites_[SiteKey{item.full_filename, item.line}];
+  if (site.count == 0 || now - site.window_start >= kRateWindowUsec) {
+    site.window_start = now;
+    site.count = 0;
+  }
+  if (site.count >= FLAGS_sentry_events_per_minute) {
+    ++site.suppressed;
+    rate_limited_.fetch_add(1, std::memory_order_relaxed);
     return;
   }
 
+  ++site.count;
+  batch_.push_back(Event{std::move(item), 1, site.suppressed});
+  site.suppressed = 0;
+}
+
+void SentrySink::Send(const Event& event) {
+  string body = GenSentryBody(event);
   http::Client::Response resp;
-  string body = GenSentryBody(item);
-  ec = client_.Send(http::Client::Verb::post, dsn_.url, body, &resp);
 
-  if (ec) {
-    RAW_VLOG(1, "Could not send ");
-    ++lost_messages_;
+  auto connect_and_send = [&] {
+    system::error_code ec = client_.Connect(dsn_.hostname, port_);
+    if (ec) {
+      RAW_VLOG(1, "Could not connect %s", ec.message().c_str());
+      return ec;
+    }
+    return client_.Send(http::Client::Verb::post, dsn_.url, body, &resp);
+  };
+
+  system::error_code ec;
+  if (client_.IsConnected()) {
+    ec = client_.Send(http::Client::Verb::post, dsn_.url, body, &resp);
+
+    // The server may have closed the idle connection.
+    if (ec) {
+      client_.Shutdown();
+      resp = http::Client::Response{};
+      ec = connect_and_send();
+    }
+  } else {
+    ec = connect_and_send();
+  }
+
+  if (ec || resp.result() != beast::http::status::ok) {
+    RAW_VLOG(1, "Could not send, status %d", int(resp.result()));
+    client_.Shutdown();
+    send_failed_.fetch_add(event.repeated, std::memory_order_relaxed);
+    return;
   }
+
+  if (!resp.keep_alive())
+    client_.Shutdown();
+  sent_.fetch_add(event.repeated, std::memory_order_relaxed);
 }
 
-string SentrySink::GenSentryBody(const Item& item) {
+string SentrySink::GenSentryBody(const Event& event) {
+  const Item& item = event.item;
   string res = absl::StrCat(R"({"culprit":")", item.base_filename, ":", item.line,
                             R"(", "server_name":"TBD")");
 
@@ -115,8 +225,12 @@ string SentrySink::GenSentryBody(const Item& item) {
                   "version": "1.0.0"}, "timestamp":")");
   absl::StrAppend(&res, 1900 + item.tm_time.tm_year, "-", item.tm_time.tm_mon + 1, "-",
                   item.tm_time.tm_mday, "T", item.tm_time.tm_hour, ":", item.tm_time.tm_min, ":",
-                  item.tm_time.tm_sec);
-  absl::StrAppend(&res, R"("})");
+                  item.tm_time.tm_sec, "\"");
+  if (event.repeated > 1 || event.suppressed > 0) {
+    absl::StrAppend(&res, R"(, "extra": {"repeated":)", event.repeated, R"(, "rate_limited":)",
+                    event.suppressed, "}");
+  }
+  absl::StrAppend(&res, "}");
 
   return res;
 }
@@ -179,7 +293,12 @@ void EnableSentry(IoContext* context) {
   auto ptr = std::make_unique<SentrySink>(std::move(dsn), context);
   context->AttachCancellable(ptr.get());
   ptr->WaitTillRun();
-  ptr.release();
+  sentry_sink.store(ptr.release(), std::memory_order_release);
+}
+
+SentryStats GetSentryStats() {
+  SentrySink* sink = sentry_sink.load(std::memory_order_acquire);
+  return sink ? sink->GetStats() : SentryStats{};
 }
 
 }  // namespace util
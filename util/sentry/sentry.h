@@ -8,6 +8,19 @@
 
 namespace util {
 
+struct SentryStats {
+  uint64_t sent = 0;          // Events delivered to sentry, including the coalesced repeats.
+  uint64_t queue_full = 0;    // Dropped by the logging threads since the queue was full.
+  uint64_t rate_limited = 0;  // Dropped by the per log-site rate limit.
+  uint64_t send_failed = 0;   // Lost due to connection or http errors.
+};
+
+// Reports LOG(ERROR) and above to sentry if --sentry_dsn or SENTRY_LOG_URI is set.
+// The logging threads never block on sentry: the events are pushed into a bounded queue
+// and sent by a fiber in context. Events that do not fit into the queue are dropped.
 void EnableSentry(IoContext* context);
 
+// Returns zeros if sentry is not enabled. Thread-safe.
+SentryStats GetSentryStats();
+
 }  // namespace util
@@ -47,6 +47,24 @@ TEST_F(SentryTest, Basic) {
   done.Wait();
 
   EXPECT_EQ(1, req_);
+
+  // An error storm from a single log site is rate limited.
+  for (unsigned i = 0; i < 30; ++i) {
+    LOG(ERROR) << "Storm " << i;
+  }
+
+  SentryStats stats;
+  for (unsigned i = 0; i < 100; ++i) {
+    stats = GetSentryStats();
+    if (stats.sent + stats.rate_limited + stats.send_failed + stats.queue_full == 31)
+      break;
+    this_fiber::sleep_for(10ms);
+  }
+  EXPECT_EQ(0, stats.queue_full);
+  EXPECT_EQ(0, stats.send_failed);
+  EXPECT_EQ(11, stats.sent);
+  EXPECT_EQ(20, stats.rate_limited);
+  EXPECT_EQ(11, req_);
 }
 
 
@@ -3,6 +3,9 @@
 //
 
 #include "util/sinksource.h"
+
+#include <algorithm>
+
 #include "base/logging.h"
 #include "base/port.h"
 
@@ -14,6 +17,13 @@ Sink::WritableBuffer Sink::GetAppendBuffer(size_t min_capacity, WritableBuffer s
   return scratch;
 }
 
+Status Sink::AppendV(const strings::ByteRange* slices, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    RETURN_IF_ERROR(Append(slices[i]));
+  }
+  return Status::OK;
+}
+
 Status Sink::Flush() { return Status::OK; }
 
 StatusObject<size_t> Source::Read(const strings::MutableByteRange& range) {
@@ -38,7 +48,13 @@ StatusObject<size_t> Source::Read(const strings::MutableByteRange& range) {
     DCHECK_LT(read, range.size());
 
   }
-  if (eof_)
+  if (!peeked_.empty() && read < range.size()) {
+    size_t len = std::min(peeked_.size(), range.size() - read);
+    memcpy(range.begin() + read, peeked_.begin(), len);
+    peeked_.advance(len);
+    read += len;
+  }
+  if (eof_ || read == range.size())
     return read;
 
   auto lrange = range.subpiece(read);
@@ -56,6 +72,45 @@ StatusObject<size_t> Source::Read(const strings::MutableByteRange& range) {
   return read;
 }
 
+StatusObject<strings::MutableByteRange> Source::Peek(size_t max_size) {
+  CHECK_GT(max_size, 0);
+
+  if (!prepend_buf_.empty()) {
+    // The prepended bytes precede the rest of the last view. They are moved aside so that
+    // Consume() does not shift the memory of the view.
+    prepend_buf_.insert(peeked_.begin(), peeked_.end());
+    prepend_view_buf_.swap(prepend_buf_);
+    prepend_buf_.clear();
+    peeked_.reset(prepend_view_buf_.begin(), prepend_view_buf_.size());
+  }
+
+  if (peeked_.empty() && !eof_) {
+    auto res = PeekInternal(max_size);
+    if (!res.ok())
+      return res;
+    peeked_ = res.obj;
+    eof_ = peeked_.empty();
+  }
+  return peeked_.subpiece(0, max_size);
+}
+
+void Source::Consume(size_t n) {
+  CHECK_LE(n, peeked_.size());
+  peeked_.advance(n);
+}
+
+StatusObject<strings::MutableByteRange> Source::PeekInternal(size_t max_size) {
+  if (peek_buf_size_ < max_size) {
+    peek_buf_.reset(new uint8[max_size]);
+    peek_buf_size_ = max_size;
+  }
+
+  auto res = ReadInternal(strings::MutableByteRange(peek_buf_.get(), max_size));
+  if (!res.ok())
+    return res.status;
+  return strings::MutableByteRange(peek_buf_.get(), res.obj);
+}
+
 StatusObject<size_t> StringSource::ReadInternal(const strings::MutableByteRange& range) {
   size_t to_fill = std::min<size_t>({range.size(), block_size_, input_.size()});
   memcpy(range.begin(), input_.begin(), to_fill);
@@ -5,6 +5,7 @@
 #ifndef UTIL_SINKSOURCE_H
 #define UTIL_SINKSOURCE_H
 
+#include <functional>
 #include <memory>
 #include <string>
 #include "base/integral_types.h"
@@ -31,6 +32,10 @@ class Sink {
   // Appends slice to sink.
   virtual Status Append(const strings::ByteRange& slice) = 0;
 
+  // Appends count slices in order. The default implementation appends them one by one,
+  // sinks that write into files override it to write them with fewer system calls.
+  virtual Status AppendV(const strings::ByteRange* slices, size_t count);
+
   // Returns a writable buffer for appending .
   // Guarantees that result.capacity >=min_capacity.
   // May return a pointer to the caller-owned scratch buffer which must have capacity >=min_capacity.
@@ -92,6 +97,19 @@ public:
   const std::string& contents() const { return contents_; }
 };
 
+// Passes the appended slices to a callback, for example to consume a stream chunk by chunk.
+class CallbackSink : public Sink {
+ public:
+  using Callback = std::function<Status(const strings::ByteRange&)>;
+
+  explicit CallbackSink(Callback cb) : cb_(std::move(cb)) {}
+
+  Status Append(const strings::ByteRange& slice) override { return cb_(slice); }
+
+ private:
+  Callback cb_;
+};
+
 
 
 // Source classes. Allow synchronous reads from an abstract source.
@@ -109,6 +127,21 @@ class Source {
    */
   StatusObject<size_t> Read(const strings::MutableByteRange& range);
 
+  /**
+   * @brief Zero-copy alternative to Read().
+   *
+   * Returns a view of upto max_size next bytes of the source, an empty view at EOF.
+   * Sources that keep the data in their own buffers return views into them, otherwise the
+   * data is read into a buffer of the Source. The caller may modify the bytes of the view.
+   * The view is valid until the next call to Peek() or Read(). The returned bytes are not
+   * consumed, the next Peek() returns them again unless Consume() is called.
+   */
+  StatusObject<strings::MutableByteRange> Peek(size_t max_size);
+
+  //! Consumes n <= view.size() bytes of the last view returned by Peek(). Does not invalidate
+  //! the view.
+  void Consume(size_t n);
+
   void Prepend(const strings::ByteRange& range) {
     prepend_buf_.insert(prepend_buf_.begin(), range.begin(), range.end());
   }
@@ -119,12 +152,24 @@ class Source {
   //! if possible.
   virtual StatusObject<size_t> ReadInternal(const strings::MutableByteRange& range) = 0;
 
+  //! Returns the next upto max_size bytes, empty at EOF. The returned bytes are considered
+  //! read and must stay valid until the next call to PeekInternal or ReadInternal.
+  //! The default implementation reads them into a buffer of the Source by ReadInternal.
+  virtual StatusObject<strings::MutableByteRange> PeekInternal(size_t max_size);
+
  private:
 
   DISALLOW_COPY_AND_ASSIGN(Source);
 
   base::PODArray<uint8> prepend_buf_;
   bool eof_ = false;
+
+  // Not consumed part of the last view, points into prepend_view_buf_ or to the result of
+  // PeekInternal.
+  strings::MutableByteRange peeked_;
+  base::PODArray<uint8> prepend_view_buf_;
+  std::unique_ptr<uint8[]> peek_buf_;
+  size_t peek_buf_size_ = 0;
 };
 
 class StringSource : public Source {
@@ -155,6 +155,68 @@ TEST_F(SourceTest, MultipleStreams) {
   EXPECT_EQ(original_.size() * 2, read);
 }
 
+TEST_F(SourceTest, Peek) {
+  StringSource src(original_, 1000);
+  string actual;
+
+  auto res = src.Peek(10);
+  ASSERT_TRUE(res.ok());
+  ASSERT_EQ(10, res.obj.size());
+  src.Consume(4);
+  actual.append(reinterpret_cast<const char*>(res.obj.begin()), 4);
+
+  // Not consumed bytes are returned again, the prepended ones come first.
+  src.Prepend(res.obj.subpiece(4, 2));
+  src.Consume(0);
+  res = src.Peek(8000);
+  ASSERT_TRUE(res.ok());
+  EXPECT_EQ(8, res.obj.size());
+  src.Consume(2);
+  actual.append(reinterpret_cast<const char*>(res.obj.begin()), 2);
+
+  uint8_t buf[3];
+  ASSERT_EQ(3, src.Read(strings::MutableByteRange(buf, 3)).obj);
+  actual.append(reinterpret_cast<const char*>(buf), 3);
+  while (true) {
+    res = src.Peek(700);
+    ASSERT_TRUE(res.ok());
+    if (res.obj.empty())
+      break;
+    ASSERT_LE(res.obj.size(), 700);
+    actual.append(reinterpret_cast<const char*>(res.obj.begin()), res.obj.size());
+    src.Consume(res.obj.size());
+  }
+  EXPECT_EQ(string(original_, 0, 6) + string(original_, 4), actual);
+
+  // Zlib inflates directly from the views of its sub source.
+  ZlibSource zsrc(new StringSource(compressed_, 100));
+  actual.clear();
+  while (true) {
+    res = zsrc.Peek(1 << 14);
+    ASSERT_TRUE(res.ok());
+    if (res.obj.empty())
+      break;
+    actual.append(reinterpret_cast<const char*>(res.obj.begin()), res.obj.size());
+    zsrc.Consume(res.obj.size());
+  }
+  EXPECT_TRUE(actual == original_);
+}
+
+TEST(CallbackSinkTest, Append) {
+  std::string res;
+  CallbackSink sink([&](const ByteRange& slice) {
+    if (slice.empty())
+      return Status(StatusCode::IO_ERROR, "empty");
+    res.append(charptr(slice.data()), slice.size());
+    return Status::OK;
+  });
+
+  EXPECT_TRUE(sink.Append(ToByteRange("foo")).ok());
+  EXPECT_TRUE(sink.Append(ToByteRange("bar")).ok());
+  EXPECT_FALSE(sink.Append(ByteRange()).ok());
+  EXPECT_EQ("foobar", res);
+}
+
 class ZstdSourceTest : public testing::Test {};
 
 TEST_F(ZstdSourceTest, Basic) {
@@ -185,4 +247,61 @@ TEST_F(ZstdSourceTest, Basic) {
   }
 }
 
+TEST_F(ZstdSourceTest, Parallel) {
+  StringSink* compressed = new StringSink;
+  ZStdSink zstd_compress(compressed);
+  string buf;
+
+  // Every flush ends a frame, the frames are compressed by the zstd workers.
+  ASSERT_TRUE(zstd_compress.Init(3, 2).ok());
+  for (unsigned i = 0; i < 1000; ++i) {
+    buf.assign(1000, 'a' + (i % 32));
+    ASSERT_TRUE(zstd_compress.Append(ToByteRange(buf)).ok());
+    if (i % 100 == 99) {
+      ASSERT_TRUE(zstd_compress.Flush().ok());
+    }
+  }
+
+  StringSource* src = new StringSource(compressed->contents(), 256);
+  ZStdSource zstd_src(src, 3);
+
+  buf.resize(1000);
+  for (unsigned i = 0; i < 1000; ++i) {
+    auto result = zstd_src.Read(AsMutableByteRange(buf));
+    ASSERT_TRUE(result.ok()) << result.status;
+    ASSERT_EQ(buf.size(), result.obj);
+    ASSERT_TRUE(is_rep_char(buf, 'a' + (i % 32))) << i;
+  }
+  auto result = zstd_src.Read(AsMutableByteRange(buf));
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(0, result.obj);
+
+  // The views point into the decompressed frames.
+  ZStdSource view_src(new StringSource(compressed->contents(), 256), 3);
+  size_t total = 0;
+  while (true) {
+    auto view = view_src.Peek(1 << 20);
+    ASSERT_TRUE(view.ok()) << view.status;
+    if (view.obj.empty())
+      break;
+    EXPECT_EQ(100000, view.obj.size());
+    total += view.obj.size();
+    view_src.Consume(view.obj.size());
+  }
+  EXPECT_EQ(1000000, total);
+
+  // Corrupted frames are reported.
+  string corrupted = compressed->contents();
+  corrupted.resize(corrupted.size() - 3);
+  ZStdSource corrupted_src(new StringSource(corrupted), 2);
+  Status status;
+  while (status.ok()) {
+    result = corrupted_src.Read(AsMutableByteRange(buf));
+    status = result.status;
+    if (result.obj < buf.size())
+      break;
+  }
+  EXPECT_FALSE(status.ok());
+}
+
 }  // namespace util
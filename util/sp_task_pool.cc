@@ -14,6 +14,9 @@ namespace util {
 
 namespace detail {
 
+// How many times an idle worker polls its queue before it parks.
+constexpr unsigned kIdleSpinCount = 2000;
+
 void SingleProducerTaskPoolBase::ThreadInfo::Join() {
   if (d.thread_id) {
     pthread_cancel(d.thread_id);
@@ -96,14 +99,51 @@ unsigned SingleProducerTaskPoolBase::FindMostFreeThread() const {
 }
 
 
-void SingleProducerTaskPoolBase::WaitForTasksToComplete() {
-  // We assuming that producer thread stopped enqueing tasks.
+bool SingleProducerTaskPoolBase::TrySteal(unsigned thief) {
+  unsigned victim = thief;
+  unsigned max_size = 0;
   for (unsigned i = 0; i < thread_count_; ++i) {
-    const ThreadLocalInterface* tli = thread_interfaces_[i].get();
-    ThreadInfo::Data& d = thread_info_[i].d;
+    unsigned size = thread_interfaces_[i]->QueueSize();
+    if (i != thief && size > max_size) {
+      victim = i;
+      max_size = size;
+    }
+  }
+  if (victim == thief)
+    return false;
+
+  return thread_interfaces_[thief]->StealTask(thread_interfaces_[victim].get());
+}
 
-    d.ev_task_finished.await([tli, &d] { return tli->IsQueueEmpty() && !d.has_tasks; });
+bool SingleProducerTaskPoolBase::HasStealableTasks(unsigned thief) const {
+  for (unsigned i = 0; i < thread_count_; ++i) {
+    if (i != thief && !thread_interfaces_[i]->IsQueueEmpty())
+      return true;
   }
+  return false;
+}
+
+bool SingleProducerTaskPoolBase::AllIdle() const {
+  for (unsigned i = 0; i < thread_count_; ++i) {
+    if (!thread_interfaces_[i]->IsQueueEmpty() || thread_info_[i].d.has_tasks)
+      return false;
+  }
+  return true;
+}
+
+void SingleProducerTaskPoolBase::WaitForTasksToComplete() {
+  // We assuming that producer thread stopped enqueing tasks.
+  do {
+    for (unsigned i = 0; i < thread_count_; ++i) {
+      const ThreadLocalInterface* tli = thread_interfaces_[i].get();
+      ThreadInfo::Data& d = thread_info_[i].d;
+
+      d.ev_task_finished.await([tli, &d] { return tli->IsQueueEmpty() && !d.has_tasks; });
+    }
+
+    // A thread that we have already passed could steal a task from a thread that we check
+    // later. The thief sets has_tasks before it steals, so the second pass catches it.
+  } while (work_stealing_ && !AllIdle());
   VLOG(1) << "WaitForTasksToComplete finished";
 }
 
@@ -115,6 +155,22 @@ unsigned SingleProducerTaskPoolBase::QueueSize() const {
   return res;
 }
 
+uint64 SingleProducerTaskPoolBase::TaskCount() const {
+  uint64 res = 0;
+  for (unsigned i = 0; i < thread_count_; ++i) {
+    res += thread_info_[i].d.task_count.load(std::memory_order_relaxed);
+  }
+  return res;
+}
+
+uint64 SingleProducerTaskPoolBase::StolenTaskCount() const {
+  uint64 res = 0;
+  for (unsigned i = 0; i < thread_count_; ++i) {
+    res += thread_info_[i].d.stolen_count.load(std::memory_order_relaxed);
+  }
+  return res;
+}
+
 #ifdef DEBUG_ROMAN
 uint64 SingleProducerTaskPoolBase::AverageDelayUsec() const {
   uint64 jiffies = 0;
@@ -132,33 +188,44 @@ uint64 SingleProducerTaskPoolBase::AverageDelayUsec() const {
 void* SingleProducerTaskPoolBase::ThreadRoutine(void* arg) {
   RoutineConfig* config = (RoutineConfig*)arg;
   SingleProducerTaskPoolBase* me = config->me;
-  ThreadInfo::Data& ti = me->thread_info_[config->thread_index].d;
+  const unsigned index = config->thread_index;
+  ThreadInfo::Data& ti = me->thread_info_[index].d;
 
-  ThreadLocalInterface* thread_interface = me->thread_interfaces_[config->thread_index].get();
+  ThreadLocalInterface* thread_interface = me->thread_interfaces_[index].get();
 
   delete config;
   config = nullptr;
-  auto await_check = [me, thread_interface]() {
-    return me->start_cancel_ || !thread_interface->IsQueueEmpty();
+  auto await_check = [me, thread_interface, index]() {
+    return me->start_cancel_ || !thread_interface->IsQueueEmpty() ||
+           (me->work_stealing_ && me->HasStealableTasks(index));
   };
 
-  unsigned num_yields = 0;
   while (!me->start_cancel_) {
     ti.has_tasks.store(true, std::memory_order_release);
-    while (thread_interface->RunTask()) {
-      num_yields = 0;
+    uint64 tasks = 0, stolen = 0;
+    while (true) {
+      while (thread_interface->RunTask()) {
+        ++tasks;
+      }
+      if (!me->work_stealing_ || !me->TrySteal(index))
+        break;
+      ++stolen;
+    }
+    ti.task_count.store(ti.task_count.load(std::memory_order_relaxed) + tasks + stolen,
+                        std::memory_order_relaxed);
+    if (stolen) {
+      ti.stolen_count.store(ti.stolen_count.load(std::memory_order_relaxed) + stolen,
+                            std::memory_order_relaxed);
     }
     ti.has_tasks.store(false, std::memory_order_release);
 
-    if (++num_yields > 100) {
-      // We iterate 1000 times before even bother to sleep.
+    if (thread_interface->IsQueueEmpty()) {
+      VLOG(2) << "ti.empty_q_cv.notify";
 
-      if (thread_interface->IsQueueEmpty()) {
-        VLOG(2) << "ti.empty_q_cv.notify";
+      ti.ev_task_finished.notify();
 
-        ti.ev_task_finished.notify();
-        ti.ev_non_empty.await(await_check);
-      }
+      // A busy producer refills the queue while we spin, so neither side issues a futex call.
+      ti.ev_non_empty.spinAwait(await_check, kIdleSpinCount);
     }
   }
   char buf[30] = {0};
@@ -98,6 +98,20 @@ class SingleProducerTaskPoolBase {
   // Returns the currently maximal queue size of all threads.
   unsigned QueueSize() const;
 
+  // Opt-in, must be called before Launch. A worker that runs out of tasks takes queued tasks
+  // of the other workers before it goes idle. Useful when task durations vary, since tasks
+  // are routed at submit time. A stolen task runs with the task object of the worker that
+  // stole it, hence thread-local data of the tasks is still accessed by a single thread.
+  void EnableWorkStealing() {
+    work_stealing_ = true;
+  }
+
+  // Number of tasks run by the worker threads, RunInline calls are not counted.
+  uint64 TaskCount() const;
+
+  // How many of TaskCount() were stolen.
+  uint64 StolenTaskCount() const;
+
 #ifdef DEBUG_ROMAN
   // Returns average queue delay of this taskpool in micro seconds.
   uint64 AverageDelayUsec() const;
@@ -114,10 +128,18 @@ class SingleProducerTaskPoolBase {
 
   unsigned FindMostFreeThread() const;
 
+  // Runs a task from the longest queue of the other threads. Returns false if none was found.
+  bool TrySteal(unsigned thief);
+  bool HasStealableTasks(unsigned thief) const;
+  bool AllIdle() const;
+
   // We use this Interface in order to separate work pool base code from c++ template wrapping
   // logic.
   struct ThreadLocalInterface {
     virtual bool RunTask() = 0;
+
+    // Runs a task from victim's queue.
+    virtual bool StealTask(ThreadLocalInterface* victim) = 0;
     virtual bool IsQueueEmpty() const = 0;
     virtual unsigned QueueSize() const = 0;
     virtual ~ThreadLocalInterface();
@@ -126,6 +148,7 @@ class SingleProducerTaskPoolBase {
   std::string base_name_;
   std::atomic_bool start_cancel_;
   unsigned per_thread_capacity_, thread_count_;
+  bool work_stealing_ = false;
 
   struct ThreadInfo {
     ThreadInfo() {
@@ -143,6 +166,9 @@ class SingleProducerTaskPoolBase {
       folly::EventCount ev_non_empty, ev_task_finished;
 
       std::atomic_bool has_tasks;
+
+      // Written only by the worker.
+      std::atomic<uint64> task_count{0}, stolen_count{0};
     } d;
 
     // Eliminate false sharing.
@@ -191,18 +217,28 @@ class SingleProducerTaskPool : public detail::SingleProducerTaskPoolBase {
     SharedTuple& shared_data_;
     Task task_;
 
+    // With work stealing the queue has several consumers, which take turns under read_lock_.
+    bool steal_;
+    std::atomic_flag read_lock_ = ATOMIC_FLAG_INIT;
+
     friend class SingleProducerTaskPool;
 
-   public:
-    template <typename... Args>
-    QueueTaskImpl(unsigned size, SharedTuple& shared, Args&&... task_args)
-        : queue_(size), shared_data_(shared), task_(std::forward<Args>(task_args)...) {
-      InitShared(task_, shared);
+    bool Read(CallItem* item) {
+      if (!steal_)
+        return queue_.read(*item);
+
+      while (read_lock_.test_and_set(std::memory_order_acquire)) {
+        asm volatile("pause");
+      }
+      bool res = queue_.read(*item);
+      read_lock_.clear(std::memory_order_release);
+      return res;
     }
 
-    virtual bool RunTask() override {
+    // Runs the next task from src's queue with our task.
+    bool RunFrom(QueueTaskImpl* src) {
       CallItem item;
-      if (!queue_.read(item))
+      if (!src->Read(&item))
         return false;
 
       // queue_delay_jiffies += (base::GetMonotonicJiffies() - item.ts);
@@ -215,6 +251,22 @@ class SingleProducerTaskPool : public detail::SingleProducerTaskPoolBase {
       return true;
     }
 
+   public:
+    template <typename... Args>
+    QueueTaskImpl(unsigned size, bool steal, SharedTuple& shared, Args&&... task_args)
+        : queue_(size), shared_data_(shared), task_(std::forward<Args>(task_args)...),
+          steal_(steal) {
+      InitShared(task_, shared);
+    }
+
+    bool RunTask() override {
+      return RunFrom(this);
+    }
+
+    bool StealTask(ThreadLocalInterface* victim) override {
+      return RunFrom(static_cast<QueueTaskImpl*>(victim));
+    }
+
     bool IsQueueEmpty() const override {
       return queue_.isEmpty();
     };
@@ -280,7 +332,8 @@ class SingleProducerTaskPool : public detail::SingleProducerTaskPoolBase {
 
     thread_interfaces_.resize(thread_count());
     for (auto& ti : thread_interfaces_) {
-      ti.reset(new QueueTaskImpl(per_thread_capacity_, shared_data_, std::forward<Args>(args)...));
+      ti.reset(new QueueTaskImpl(per_thread_capacity_, work_stealing_, shared_data_,
+                                 std::forward<Args>(args)...));
     }
     LaunchThreads();
   }
@@ -182,6 +182,45 @@ TEST_F(SPTaskPoolTest, Finalize) {
   EXPECT_GT(count, 0);
 }
 
+struct StealTask {
+  typedef std::atomic_uint* SharedData;
+  SharedData done = nullptr;
+  pthread_t thread_id = 0;
+
+  void operator()(unsigned sleep_usec) {
+    // The task object is used only by its thread, stolen tasks included.
+    if (thread_id == 0)
+      thread_id = pthread_self();
+    CHECK(pthread_equal(thread_id, pthread_self()));
+
+    if (sleep_usec)
+      base::SleepMicros(sleep_usec);
+    done->fetch_add(1);
+  }
+
+  void InitShared(const SharedData& s) {
+    done = s;
+  }
+};
+
+TEST_F(SPTaskPoolTest, WorkStealing) {
+  SingleProducerTaskPool<StealTask> pool("steal", 64, 2);
+  std::atomic_uint done{0};
+  pool.SetSharedData(&done);
+  pool.EnableWorkStealing();
+  pool.Launch();
+
+  // The short tasks are queued behind the long ones as well and the idle worker takes them.
+  for (unsigned i = 0; i < 40; ++i) {
+    pool.RunTask(i % 10 == 0 ? 20000 : 100);
+  }
+  pool.WaitForTasksToComplete();
+
+  EXPECT_EQ(40, done);
+  EXPECT_EQ(40, pool.TaskCount());
+  EXPECT_GT(pool.StolenTaskCount(), 0);
+}
+
 struct NoOpTask {
   void operator()(int ) {
   }
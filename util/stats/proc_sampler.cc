@@ -0,0 +1,237 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/stats/proc_sampler.h"
+
+#include <algorithm>
+
+#include "absl/strings/str_cat.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_uint32(proc_stats_sample_ms, 0, "If positive, samples the process stats from /proc "
+                                       "with this interval, see the proc-stats varz");
+
+namespace util {
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned kTopThreads = 8;
+
+ProcStatsSampler* global_sampler = nullptr;
+
+inline double PerSec(uint64 prev, uint64 next, uint64 delta_ms) {
+  return next > prev ? (next - prev) * 1000.0 / delta_ms : 0;
+}
+
+void AppendRates(const ProcStatsSampler::Rates& r, VarzValue::Map* dest) {
+  auto add = [dest](const char* name, double val) {
+    dest->emplace_back(name, VarzValue::FromDouble(val));
+  };
+  add("user_cpu", r.user_cpu);
+  add("system_cpu", r.system_cpu);
+  add("steal_cpu", r.steal_cpu);
+  add("voluntary_ctx_switches", r.voluntary_ctx_switches);
+  add("involuntary_ctx_switches", r.involuntary_ctx_switches);
+  add("minor_faults", r.minor_faults);
+  add("major_faults", r.major_faults);
+  add("io_read_bytes", r.io_read_bytes);
+  add("io_write_bytes", r.io_write_bytes);
+}
+
+VarzValue::Map GetSamplerStats() {
+  return global_sampler ? global_sampler->GetStats() : VarzValue::Map{};
+}
+
+VarzFunction proc_stats_varz("proc-stats", GetSamplerStats);
+
+}  // namespace
+
+auto ProcStatsSampler::Rates::Between(const Sample& prev, const Sample& next) -> Rates {
+  Rates r;
+  if (next.time_ms <= prev.time_ms)
+    return r;
+
+  uint64 delta_ms = next.time_ms - prev.time_ms;
+  const ProcessStats& p = prev.proc;
+  const ProcessStats& n = next.proc;
+
+  // ms of cpu per second of wall time are tenths of a percent.
+  r.user_cpu = PerSec(p.user_cpu_ms, n.user_cpu_ms, delta_ms) / 10;
+  r.system_cpu = PerSec(p.system_cpu_ms, n.system_cpu_ms, delta_ms) / 10;
+  if (next.cpu.total_ms > prev.cpu.total_ms) {
+    r.steal_cpu = (next.cpu.steal_ms - prev.cpu.steal_ms) * 100.0 /
+                  (next.cpu.total_ms - prev.cpu.total_ms);
+  }
+  r.voluntary_ctx_switches =
+      PerSec(p.voluntary_ctx_switches, n.voluntary_ctx_switches, delta_ms);
+  r.involuntary_ctx_switches =
+      PerSec(p.involuntary_ctx_switches, n.involuntary_ctx_switches, delta_ms);
+  r.minor_faults = PerSec(p.minor_faults, n.minor_faults, delta_ms);
+  r.major_faults = PerSec(p.major_faults, n.major_faults, delta_ms);
+  r.io_read_bytes = PerSec(p.io_read_bytes, n.io_read_bytes, delta_ms);
+  r.io_write_bytes = PerSec(p.io_write_bytes, n.io_write_bytes, delta_ms);
+
+  return r;
+}
+
+ProcStatsSampler::ProcStatsSampler(unsigned interval_ms, unsigned capacity)
+    : interval_ms_(interval_ms), capacity_(capacity) {
+  CHECK_GT(interval_ms, 0);
+  CHECK_GT(capacity, 1);
+  ring_.reserve(capacity);
+}
+
+ProcStatsSampler::~ProcStatsSampler() {
+  Stop();
+}
+
+void ProcStatsSampler::Start() {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!stopped_)
+    return;
+  stopped_ = false;
+  thread_ = std::thread(&ProcStatsSampler::Run, this);
+}
+
+void ProcStatsSampler::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void ProcStatsSampler::Run() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stopped_) {
+    lk.unlock();
+    SampleOnce();
+    lk.lock();
+    cv_.wait_for(lk, std::chrono::milliseconds(interval_ms_), [this] { return stopped_; });
+  }
+}
+
+void ProcStatsSampler::SampleOnce() {
+  // /proc is read outside of the lock, the readers of varz do not wait for it.
+  Sample sample;
+  sample.proc = ProcessStats::Read();
+  sys::ReadCpuTimes(&sample.cpu);
+  uint64 now = GetMonotonicMicros() / 1000;
+  sample.time_ms = now;
+
+  vector<ThreadStats> threads;
+  ThreadStats::ReadAll(0, &threads);
+
+  std::lock_guard<std::mutex> lk(mu_);
+
+  if (ring_.size() < capacity_) {
+    ring_.push_back(std::move(sample));
+  } else {
+    ring_[next_] = std::move(sample);
+  }
+  next_ = (next_ + 1) % capacity_;
+
+  // The threads that exited since the previous sample are dropped.
+  unordered_map<int, ThreadPrev> prev;
+  prev.swap(thread_prev_);
+  thread_cpu_.clear();
+  for (ThreadStats& ts : threads) {
+    uint64 cpu_ms = ts.user_cpu_ms + ts.system_cpu_ms;
+    auto it = prev.find(ts.tid);
+    if (it != prev.end() && now > it->second.time_ms) {
+      double cpu = PerSec(it->second.cpu_ms, cpu_ms, now - it->second.time_ms) / 10;
+      thread_cpu_.push_back(ThreadCpu{ts.tid, std::move(ts.name), cpu});
+    }
+    thread_prev_.emplace(ts.tid, ThreadPrev{cpu_ms, now});
+  }
+  std::sort(thread_cpu_.begin(), thread_cpu_.end(),
+            [](const ThreadCpu& a, const ThreadCpu& b) { return a.cpu > b.cpu; });
+}
+
+auto ProcStatsSampler::GetSamples() const -> vector<Sample> {
+  std::lock_guard<std::mutex> lk(mu_);
+  vector<Sample> res;
+  res.reserve(ring_.size());
+  if (ring_.size() == capacity_) {
+    res.insert(res.end(), ring_.begin() + next_, ring_.end());
+    res.insert(res.end(), ring_.begin(), ring_.begin() + next_);
+  } else {
+    res = ring_;
+  }
+  return res;
+}
+
+auto ProcStatsSampler::GetThreadCpu() const -> vector<ThreadCpu> {
+  std::lock_guard<std::mutex> lk(mu_);
+  return thread_cpu_;
+}
+
+VarzValue::Map ProcStatsSampler::GetStats() const {
+  vector<Sample> samples = GetSamples();
+  vector<ThreadCpu> threads = GetThreadCpu();
+
+  VarzValue::Map res;
+  if (samples.empty())
+    return res;
+
+  const ProcessStats& last = samples.back().proc;
+  res.emplace_back("vm_rss_kb", VarzValue::FromInt(last.vm_rss));
+  res.emplace_back("num_threads", VarzValue::FromInt(last.num_threads));
+  if (samples.size() < 2)
+    return res;
+
+  Rates max_rates;
+  Rates rates;
+  for (size_t i = 1; i < samples.size(); ++i) {
+    rates = Rates::Between(samples[i - 1], samples[i]);
+    for (auto field : {&Rates::user_cpu, &Rates::system_cpu, &Rates::steal_cpu,
+                       &Rates::voluntary_ctx_switches, &Rates::involuntary_ctx_switches,
+                       &Rates::minor_faults, &Rates::major_faults, &Rates::io_read_bytes,
+                       &Rates::io_write_bytes}) {
+      max_rates.*field = std::max(max_rates.*field, rates.*field);
+    }
+  }
+
+  // rates holds the last interval now.
+  VarzValue::Map last_map, max_map;
+  AppendRates(rates, &last_map);
+  AppendRates(max_rates, &max_map);
+  res.emplace_back("last", std::move(last_map));
+  res.emplace_back("max", std::move(max_map));
+  res.emplace_back("window_sec",
+                   VarzValue::FromInt((samples.back().time_ms - samples.front().time_ms) / 1000));
+
+  VarzValue::Map thread_map;
+  for (size_t i = 0; i < std::min<size_t>(threads.size(), kTopThreads); ++i) {
+    thread_map.emplace_back(absl::StrCat(threads[i].name, "-", threads[i].tid),
+                            VarzValue::FromDouble(threads[i].cpu));
+  }
+  res.emplace_back("thread_cpu", std::move(thread_map));
+
+  return res;
+}
+
+ProcStatsSampler* ProcStatsSampler::global() {
+  return global_sampler;
+}
+
+}  // namespace util
+
+REGISTER_MODULE_INITIALIZER(proc_stats_sampler, {
+  if (FLAGS_proc_stats_sample_ms > 0) {
+    util::global_sampler = new util::ProcStatsSampler(FLAGS_proc_stats_sample_ms);
+    util::global_sampler->Start();
+  }
+});
+
+REGISTER_MODULE_DESTRUCTOR(proc_stats_sampler, {
+  delete util::global_sampler;
+  util::global_sampler = nullptr;
+});
@@ -0,0 +1,95 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "util/proc_stats.h"
+#include "util/stats/varz_value.h"
+
+namespace util {
+
+/* Samples the stats of this process from /proc every interval_ms in a background thread and
+   keeps the ring of the recent samples. The rates between the samples are exported under
+   the proc-stats varz, so the latency spikes can be matched with page faults, context
+   switches or cpu steal without an external agent. The process-wide sampler is started by
+   MainInitGuard when --proc_stats_sample_ms is positive.
+*/
+class ProcStatsSampler {
+ public:
+  struct Sample {
+    uint64 time_ms = 0;  // Monotonic.
+    ProcessStats proc;
+    sys::CpuTimes cpu;
+  };
+
+  // Per second rates between two samples, cpu usage in percents of a single cpu.
+  struct Rates {
+    double user_cpu = 0, system_cpu = 0;
+    double steal_cpu = 0;  // Of all the cpus of the host.
+    double voluntary_ctx_switches = 0, involuntary_ctx_switches = 0;
+    double minor_faults = 0, major_faults = 0;
+    double io_read_bytes = 0, io_write_bytes = 0;
+
+    // Between the samples prev and next, next taken later.
+    static Rates Between(const Sample& prev, const Sample& next);
+  };
+
+  struct ThreadCpu {
+    int tid;
+    std::string name;
+    double cpu;  // Percents over the last interval.
+  };
+
+  explicit ProcStatsSampler(unsigned interval_ms, unsigned capacity = 300);
+  ~ProcStatsSampler();
+
+  void Start();
+  void Stop();
+
+  // Takes a sample in the calling thread. Called by the sampler thread every interval_ms.
+  void SampleOnce();
+
+  // Oldest first.
+  std::vector<Sample> GetSamples() const;
+
+  // The busiest threads over the last interval first.
+  std::vector<ThreadCpu> GetThreadCpu() const;
+
+  // Rates over the last interval and their maxima over the window of the ring.
+  VarzValue::Map GetStats() const;
+
+  // The sampler started by --proc_stats_sample_ms, null if it's disabled.
+  static ProcStatsSampler* global();
+
+ private:
+  void Run();
+
+  const unsigned interval_ms_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  bool stopped_ = true;
+  std::thread thread_;
+
+  std::vector<Sample> ring_;  // Guarded by mu_.
+  unsigned capacity_;
+  unsigned next_ = 0;
+
+  struct ThreadPrev {
+    uint64 cpu_ms;
+    uint64 time_ms;
+  };
+  std::unordered_map<int, ThreadPrev> thread_prev_;  // Guarded by mu_.
+  std::vector<ThreadCpu> thread_cpu_;                // Guarded by mu_.
+
+  ProcStatsSampler(const ProcStatsSampler&) = delete;
+  void operator=(const ProcStatsSampler&) = delete;
+};
+
+}  // namespace util
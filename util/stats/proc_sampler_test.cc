@@ -0,0 +1,84 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/stats/proc_sampler.h"
+
+#include <pthread.h>
+
+#include <atomic>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+
+namespace util {
+
+class ProcStatsSamplerTest : public testing::Test {
+};
+
+TEST_F(ProcStatsSamplerTest, ProcessStats) {
+  SleepForMilliseconds(1);  // Switches the context at least once.
+  ProcessStats stats = ProcessStats::Read();
+  EXPECT_GT(stats.vm_rss, 0);
+  EXPECT_LE(stats.vm_rss, stats.vm_size);
+  EXPECT_GT(stats.voluntary_ctx_switches + stats.involuntary_ctx_switches, 0);
+  EXPECT_GT(stats.minor_faults, 0);
+  EXPECT_GE(stats.num_threads, 1);
+
+  sys::CpuTimes cpu;
+  ASSERT_TRUE(sys::ReadCpuTimes(&cpu));
+  EXPECT_GT(cpu.total_ms, 0);
+  EXPECT_LE(cpu.steal_ms, cpu.total_ms);
+}
+
+TEST_F(ProcStatsSamplerTest, Sample) {
+  std::atomic_bool done{false};
+  std::thread spinner([&] {
+    pthread_setname_np(pthread_self(), "spinner");
+    while (!done.load(std::memory_order_relaxed)) {
+    }
+  });
+
+  ProcStatsSampler sampler(10, 4);
+  sampler.SampleOnce();
+  SleepForMilliseconds(100);
+  sampler.SampleOnce();
+
+  std::vector<ThreadStats> threads;
+  ThreadStats::ReadAll(0, &threads);
+  ASSERT_GE(threads.size(), 2);
+
+  std::vector<ProcStatsSampler::ThreadCpu> thread_cpu = sampler.GetThreadCpu();
+  ASSERT_GE(thread_cpu.size(), 2);
+  EXPECT_EQ("spinner", thread_cpu[0].name);
+  EXPECT_GT(thread_cpu[0].cpu, 10);
+
+  auto samples = sampler.GetSamples();
+  ASSERT_EQ(2, samples.size());
+  auto rates = ProcStatsSampler::Rates::Between(samples[0], samples[1]);
+  EXPECT_GT(rates.user_cpu + rates.system_cpu, 10);
+
+  done = true;
+  spinner.join();
+
+  // The ring keeps the last 4 samples, oldest first.
+  for (unsigned i = 0; i < 5; ++i)
+    sampler.SampleOnce();
+  samples = sampler.GetSamples();
+  ASSERT_EQ(4, samples.size());
+  for (unsigned i = 1; i < samples.size(); ++i)
+    EXPECT_LE(samples[i - 1].time_ms, samples[i].time_ms);
+
+  VarzValue::Map stats = sampler.GetStats();
+  ASSERT_EQ(6, stats.size());
+  EXPECT_EQ("last", stats[2].first);
+  EXPECT_EQ("thread_cpu", stats[5].first);
+
+  sampler.Start();
+  SleepForMilliseconds(50);
+  sampler.Stop();
+  EXPECT_EQ(4, sampler.GetSamples().size());
+}
+
+}  // namespace util
@@ -0,0 +1,153 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/stats/sharded_counter.h"
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace util {
+namespace detail {
+
+namespace {
+
+constexpr size_t kCacheLine = 64;
+
+struct Registry {
+  std::mutex mu;
+  std::vector<ThreadSlab*> slabs;       // All the slabs, never freed.
+  std::vector<ThreadSlab*> free_slabs;  // Slabs of the exited threads.
+
+  unsigned next_id = 0;
+  std::map<unsigned, std::vector<unsigned>> free_ids;  // By the number of slots.
+};
+
+// Function static, so that counters may be defined in any translation unit.
+Registry& GetRegistry() {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+}  // namespace
+
+thread_local ThreadSlab* ThreadSlab::tls_slab_ = nullptr;
+
+ThreadSlab::ThreadSlab() {
+  for (auto& c : chunks_)
+    c.store(nullptr, std::memory_order_relaxed);
+}
+
+ThreadSlab* ThreadSlab::Acquire() {
+  // Returns the slab upon the thread exit.
+  struct Releaser {
+    ~Releaser() {
+      Registry& r = GetRegistry();
+      std::lock_guard<std::mutex> lk(r.mu);
+      r.free_slabs.push_back(tls_slab_);
+      tls_slab_ = nullptr;
+    }
+  };
+
+  Registry& r = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lk(r.mu);
+    if (r.free_slabs.empty()) {
+      r.slabs.push_back(new ThreadSlab);
+      tls_slab_ = r.slabs.back();
+    } else {
+      tls_slab_ = r.free_slabs.back();
+      r.free_slabs.pop_back();
+    }
+  }
+  static thread_local Releaser releaser;
+  (void)releaser;
+
+  return tls_slab_;
+}
+
+std::atomic<int64_t>* ThreadSlab::AllocChunk(unsigned index) {
+  CHECK_LT(index, kMaxChunks);
+
+  constexpr size_t kBytes = sizeof(std::atomic<int64_t>) * kChunkSize;
+  void* ptr = aligned_alloc(kCacheLine, kBytes);
+  CHECK(ptr);
+
+  std::atomic<int64_t>* chunk = static_cast<std::atomic<int64_t>*>(ptr);
+  for (unsigned i = 0; i < kChunkSize; ++i)
+    new (chunk + i) std::atomic<int64_t>(0);
+
+  // Readers may look at the chunk as soon as it is published.
+  chunks_[index].store(chunk, std::memory_order_release);
+  return chunk;
+}
+
+unsigned ThreadSlab::AllocSlots(unsigned n) {
+  CHECK(n > 0 && n <= kChunkSize);
+
+  Registry& r = GetRegistry();
+  unsigned id;
+  {
+    std::lock_guard<std::mutex> lk(r.mu);
+    auto it = r.free_ids.find(n);
+    if (it != r.free_ids.end() && !it->second.empty()) {
+      id = it->second.back();
+      it->second.pop_back();
+    } else {
+      // The slots of an id range never cross a chunk.
+      unsigned offset = r.next_id & (kChunkSize - 1);
+      if (offset + n > kChunkSize)
+        r.next_id += kChunkSize - offset;
+      id = r.next_id;
+      r.next_id += n;
+      CHECK_LE(r.next_id, kChunkSize * kMaxChunks);
+    }
+  }
+
+  // Recycled slots keep the values of their previous owner.
+  ZeroSlots(id, n);
+  return id;
+}
+
+void ThreadSlab::FreeSlots(unsigned id, unsigned n) {
+  Registry& r = GetRegistry();
+  std::lock_guard<std::mutex> lk(r.mu);
+  r.free_ids[n].push_back(id);
+}
+
+void ThreadSlab::ZeroSlots(unsigned id, unsigned n) {
+  Registry& r = GetRegistry();
+  std::lock_guard<std::mutex> lk(r.mu);
+  for (ThreadSlab* slab : r.slabs) {
+    std::atomic<int64_t>* chunk = slab->chunks_[id >> kChunkShift].load(std::memory_order_acquire);
+    if (!chunk)
+      continue;
+    for (unsigned i = 0; i < n; ++i)
+      chunk[(id & (kChunkSize - 1)) + i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void ThreadSlab::Visit(void (*cb)(const ThreadSlab*, void*), void* arg) {
+  Registry& r = GetRegistry();
+  std::lock_guard<std::mutex> lk(r.mu);
+  for (const ThreadSlab* slab : r.slabs) {
+    cb(slab, arg);
+  }
+}
+
+}  // namespace detail
+
+int64_t ShardedCounter::Get() const {
+  int64_t res = 0;
+  detail::ThreadSlab::ForEach(id_, [&res](const std::atomic<int64_t>* slot) {
+    if (slot)
+      res += slot->load(std::memory_order_relaxed);
+  });
+  return res;
+}
+
+}  // namespace util
@@ -0,0 +1,106 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace util {
+
+namespace detail {
+
+/* Every thread has a slab of int64 slots, a slot is written only by the thread that owns the
+   slab. The writes are relaxed load+store pairs, i.e. plain moves without a lock prefix, and
+   the readers sum the slot over all slabs. The slabs are never freed: a slab of an exited
+   thread passes with its values to the next new thread, so the sums do not change when
+   threads come and go.
+*/
+class ThreadSlab {
+ public:
+  static constexpr unsigned kChunkShift = 8;
+  static constexpr unsigned kChunkSize = 1u << kChunkShift;
+  static constexpr unsigned kMaxChunks = 1024;
+
+  // Slot id of the calling thread.
+  static std::atomic<int64_t>* Local(unsigned id) {
+    ThreadSlab* slab = tls_slab_ ? tls_slab_ : Acquire();
+    std::atomic<int64_t>* chunk = slab->chunks_[id >> kChunkShift].load(std::memory_order_relaxed);
+    if (!chunk)
+      chunk = slab->AllocChunk(id >> kChunkShift);
+    return chunk + (id & (kChunkSize - 1));
+  }
+
+  // Returns ids of n consecutive slots, zeroed in all the slabs. n <= kChunkSize.
+  static unsigned AllocSlots(unsigned n);
+  static void FreeSlots(unsigned id, unsigned n);
+
+  // Zeroes the n slots in all the slabs. Not atomic with respect to their writers.
+  static void ZeroSlots(unsigned id, unsigned n);
+
+  // Calls f(slots) for every slab, slots points to the n consecutive slots or is null if the
+  // slab has never written them.
+  template <typename F> static void ForEach(unsigned id, F&& f);
+
+ private:
+  ThreadSlab();
+
+  static ThreadSlab* Acquire();
+  std::atomic<int64_t>* AllocChunk(unsigned index);
+
+  const std::atomic<int64_t>* Find(unsigned id) const {
+    const std::atomic<int64_t>* chunk =
+        chunks_[id >> kChunkShift].load(std::memory_order_acquire);
+    return chunk ? chunk + (id & (kChunkSize - 1)) : nullptr;
+  }
+
+  // Locks the registry and calls cb for every slab.
+  static void Visit(void (*cb)(const ThreadSlab*, void*), void* arg);
+
+  static thread_local ThreadSlab* tls_slab_;
+
+  std::atomic<std::atomic<int64_t>*> chunks_[kMaxChunks];
+};
+
+template <typename F> void ThreadSlab::ForEach(unsigned id, F&& f) {
+  struct Arg {
+    unsigned id;
+    F* f;
+  } arg{id, &f};
+
+  Visit([](const ThreadSlab* slab, void* p) {
+    Arg* a = static_cast<Arg*>(p);
+    (*a->f)(slab->Find(a->id));
+  }, &arg);
+}
+
+}  // namespace detail
+
+// Counter sharded by threads. IncBy() is a couple of plain instructions on a slot of the
+// calling thread, Get() sums the slots of all threads and is consistent up to the concurrent
+// increments. Use it for the counters that are incremented much more often than read.
+class ShardedCounter {
+ public:
+  ShardedCounter() : id_(detail::ThreadSlab::AllocSlots(1)) {}
+  ~ShardedCounter() { detail::ThreadSlab::FreeSlots(id_, 1); }
+
+  void IncBy(int64_t delta) {
+    std::atomic<int64_t>* slot = detail::ThreadSlab::Local(id_);
+    slot->store(slot->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  void Inc() { IncBy(1); }
+
+  int64_t Get() const;
+
+  // Not atomic with respect to the concurrent increments.
+  void Set(int64_t value) { IncBy(value - Get()); }
+
+ private:
+  unsigned id_;
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  void operator=(const ShardedCounter&) = delete;
+};
+
+}  // namespace util
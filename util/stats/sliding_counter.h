@@ -4,12 +4,14 @@
 #ifndef _UTIL_SLIDING_COUNTER_H
 #define _UTIL_SLIDING_COUNTER_H
 
+#include <algorithm>
 #include <atomic>
 #include <vector>
 
 #include "base/atomic_wrapper.h"
 #include "base/integral_types.h"
 #include "base/logging.h"
+#include "util/stats/sharded_counter.h"
 
 namespace util {
 
@@ -93,6 +95,43 @@ public:
 template<unsigned NUM, unsigned PRECISION> using SlidingSecondCounter =
     SlidingSecondCounterT<uint32, NUM, PRECISION>;
 
+// SlidingSecondCounterT sharded by threads like ShardedCounter. Every thread has its own
+// window and IncBy() touches only the slots of the calling thread, without atomic
+// read-modify-write operations. Sum() and SumLast() add up the windows of all the threads.
+template<unsigned NUM, unsigned PRECISION> class ShardedSlidingCounter
+    : public SlidingSecondBase {
+  // The time of the latest bin of the thread followed by NUM bins.
+  unsigned id_;
+
+ public:
+  static constexpr unsigned SIZE = NUM;
+  static constexpr unsigned SPAN = PRECISION*NUM;
+
+  ShardedSlidingCounter() : id_(detail::ThreadSlab::AllocSlots(NUM + 1)) {
+    static_assert(NUM > 1, "Invalid window size");
+  }
+
+  ~ShardedSlidingCounter() {
+    detail::ThreadSlab::FreeSlots(id_, NUM + 1);
+  }
+
+  void Inc() { IncBy(1); }
+
+  void IncBy(int32 delta);
+
+  // Same as SlidingSecondCounterT::SumLast.
+  int64_t SumLast(unsigned offset, unsigned count = unsigned(-1)) const;
+
+  int64_t Sum() const { return SumLast(0, NUM); }
+
+  // Not atomic with respect to the concurrent increments.
+  void Reset() { detail::ThreadSlab::ZeroSlots(id_, NUM + 1); }
+
+ private:
+  ShardedSlidingCounter(const ShardedSlidingCounter&) = delete;
+  void operator=(const ShardedSlidingCounter&) = delete;
+};
+
 class QPSCount {
   // We store 1s resolution in 10 cells window.
   // This way we can reliable read 9 already finished counts when we have another 1
@@ -102,7 +141,7 @@ public:
   static constexpr unsigned kPrecision = 1;
 
 private:
-  SlidingSecondCounter<kNum, kPrecision> window_;
+  ShardedSlidingCounter<kNum, kPrecision> window_;
 
 public:
   void Reset() { window_.Reset(); }
@@ -111,6 +150,10 @@ public:
     window_.Inc();
   }
 
+  void IncBy(int32 delta) {
+    window_.IncBy(delta);
+  }
+
   uint32 Get() const;
 };
 
@@ -160,6 +203,56 @@ T SlidingSecondCounterT<T, NUM, PRECISION>::SumLast(unsigned offset, unsigned co
   return sum;
 }
 
+template<unsigned NUM, unsigned PRECISION>
+void ShardedSlidingCounter<NUM, PRECISION>::IncBy(int32 delta) {
+  std::atomic<int64_t>* slots = detail::ThreadSlab::Local(id_);
+  int64_t current_time = CurrentTime() / PRECISION;
+  int64_t last_ts = slots[0].load(std::memory_order_relaxed);
+
+  // Only this thread writes the slots, hence no compare-exchange.
+  if (last_ts != current_time) {
+    if (current_time < last_ts || last_ts + NUM <= current_time) {
+      for (unsigned i = 0; i < NUM; ++i) {
+        slots[1 + i].store(0, std::memory_order_relaxed);
+      }
+    } else {
+      for (int64_t i = last_ts + 1; i <= current_time; ++i) {
+        slots[1 + i % NUM].store(0, std::memory_order_relaxed);
+      }
+    }
+    slots[0].store(current_time, std::memory_order_relaxed);
+  }
+
+  std::atomic<int64_t>& bin = slots[1 + current_time % NUM];
+  bin.store(bin.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+template<unsigned NUM, unsigned PRECISION>
+int64_t ShardedSlidingCounter<NUM, PRECISION>::SumLast(unsigned offset, unsigned count) const {
+  if (count > NUM - offset) {
+    count = NUM - offset;
+  }
+
+  // Sums the bins of the times in (low, high].
+  int64_t high = int64_t(CurrentTime() / PRECISION) - offset;
+  int64_t low = high - count;
+  int64_t sum = 0;
+
+  detail::ThreadSlab::ForEach(id_, [&](const std::atomic<int64_t>* slots) {
+    if (!slots)
+      return;
+
+    // The thread has the bins of (last_ts - NUM, last_ts].
+    int64_t last_ts = slots[0].load(std::memory_order_relaxed);
+    int64_t from = std::max<int64_t>({low, last_ts - NUM, -1});
+    int64_t to = std::min(high, last_ts);
+    for (int64_t i = from + 1; i <= to; ++i) {
+      sum += slots[1 + i % NUM].load(std::memory_order_relaxed);
+    }
+  });
+  return sum;
+}
+
 }  // namespace util
 
 #endif  // _UTIL_SLIDING_COUNTER_H
@@ -3,8 +3,15 @@
 //
 #include "util/stats/sliding_counter.h"
 
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+
 #include "base/gtest.h"
 #include "base/logging.h"
+#include "util/stats/varz_stats.h"
 
 namespace util {
 
@@ -39,5 +46,128 @@ TEST_F(SlidingSecondCounterTest, Basic) {
   EXPECT_LE(sizeof(SlidingSecondCounter<10,1>), 44);
 }
 
+TEST_F(SlidingSecondCounterTest, Sharded) {
+  SlidingSecondBase::SetCurrentTime_Test(1);
+  ShardedSlidingCounter<10, 1> counter;
+  counter.Inc();
+  counter.Inc();
+  EXPECT_EQ(2, counter.Sum());
+  SlidingSecondBase::SetCurrentTime_Test(2);
+  EXPECT_EQ(2, counter.Sum());
+  EXPECT_EQ(0, counter.SumLast(0, 1));
+  EXPECT_EQ(2, counter.SumLast(1, 1));
+  EXPECT_EQ(0, counter.SumLast(2, 1));
+
+  std::thread([&] { counter.IncBy(5); }).join();
+  counter.Inc();
+  EXPECT_EQ(6, counter.SumLast(0, 1));
+  EXPECT_EQ(8, counter.Sum());
+
+  SlidingSecondBase::SetCurrentTime_Test(11);
+  EXPECT_EQ(6, counter.Sum());
+  SlidingSecondBase::SetCurrentTime_Test(12);
+  EXPECT_EQ(0, counter.Sum());
+
+  counter.Inc();
+  EXPECT_EQ(1, counter.Sum());
+  counter.Reset();
+  EXPECT_EQ(0, counter.Sum());
+  SlidingSecondBase::SetCurrentTime_Test(kuint32max);
+}
+
+TEST_F(SlidingCounterTest, ShardedCounter) {
+  ShardedCounter counter;
+  counter.IncBy(5);
+  EXPECT_EQ(5, counter.Get());
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < 8; ++i) {
+    threads.emplace_back([&] {
+      for (unsigned j = 0; j < 10000; ++j)
+        counter.Inc();
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  // The slabs of the exited threads keep their values.
+  EXPECT_EQ(80005, counter.Get());
+  std::thread([&] { counter.IncBy(-5); }).join();
+  EXPECT_EQ(80000, counter.Get());
+
+  counter.Set(7);
+  EXPECT_EQ(7, counter.Get());
+
+  // Recycled slots start from zero.
+  for (unsigned i = 0; i < 3; ++i) {
+    std::unique_ptr<ShardedCounter> tmp(new ShardedCounter);
+    EXPECT_EQ(0, tmp->Get());
+    tmp->IncBy(100);
+  }
+}
+
+TEST_F(SlidingCounterTest, VarzMapHistogram) {
+  VarzMapHistogram hist("test-latency");
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (uint64_t j = 1; j <= 1000; ++j) {
+        hist.Add("get", j);
+        if (j % 100 == 0)
+          hist.Add("put", 1ULL << 40);  // Does not fit int32.
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  base::HdrHistogram::Snapshot get = hist.Read("get");
+  EXPECT_EQ(4000, get.count());
+  EXPECT_NEAR(950, get.Percentile(95), 950 / 32);
+  EXPECT_EQ(1000, get.max());
+  EXPECT_EQ(1ULL << 40, hist.Read("put").Percentile(50));
+  EXPECT_EQ(0, hist.Read("none").count());
+
+  std::string data;
+  VarzListNode::IterateValues([&](const std::string& name, const std::string& val) {
+    if (name == "test-latency")
+      data = val;
+  });
+  EXPECT_THAT(data, testing::HasSubstr("\"get\""));
+  EXPECT_THAT(data, testing::HasSubstr("\"p99\""));
+  EXPECT_THAT(data, testing::HasSubstr("4000"));
+}
+
+static void BM_SlidingCounter(benchmark::State& state) {
+  static SlidingSecondCounter<10, 1> counter;
+  while (state.KeepRunning()) {
+    counter.Inc();
+  }
+}
+BENCHMARK(BM_SlidingCounter)->ThreadRange(1, 8);
+
+static void BM_ShardedSlidingCounter(benchmark::State& state) {
+  static ShardedSlidingCounter<10, 1> counter;
+  while (state.KeepRunning()) {
+    counter.Inc();
+  }
+}
+BENCHMARK(BM_ShardedSlidingCounter)->ThreadRange(1, 8);
+
+static void BM_AtomicCounter(benchmark::State& state) {
+  static std::atomic_long counter{0};
+  while (state.KeepRunning()) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+BENCHMARK(BM_AtomicCounter)->ThreadRange(1, 8);
+
+static void BM_ShardedCounter(benchmark::State& state) {
+  static ShardedCounter counter;
+  while (state.KeepRunning()) {
+    counter.Inc();
+  }
+}
+BENCHMARK(BM_ShardedCounter)->ThreadRange(1, 8);
 
 }  // namespace util
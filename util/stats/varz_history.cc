@@ -0,0 +1,340 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/stats/varz_history.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "base/walltime.h"
+#include "util/coding/pfor_codec.h"
+#include "util/stats/varz_stats.h"
+
+DEFINE_uint32(varz_history_sec, 0, "If positive, snapshots the numeric varz with this interval "
+                                   "and keeps their last hour, see /varzh");
+DEFINE_uint32(varz_history_max_series, 5000, "The maximal number of series in the varz history");
+
+namespace util {
+
+using namespace std;
+
+namespace {
+
+constexpr char kVarzName[] = "varz-history";
+
+VarzHistory* global_history = nullptr;
+
+struct Leaf {
+  string name;
+  int64_t value;
+  bool is_double;
+};
+
+inline uint64_t ZigZag(int64_t v) {
+  return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+  return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+void CollectLeaves(string name, const VarzValue& av, vector<Leaf>* dest) {
+  switch (av.type) {
+    case VarzValue::NUM:
+      dest->push_back(Leaf{std::move(name), av.num, false});
+      break;
+    case VarzValue::DOUBLE:
+      // The scaled doubles beyond 2^62 are too large to be a varz worth a trend.
+      if (std::isfinite(av.dbl) && std::abs(av.dbl) * VarzHistory::kDoubleScale < 0x1p62) {
+        dest->push_back(Leaf{std::move(name), llround(av.dbl * VarzHistory::kDoubleScale), true});
+      }
+      break;
+    case VarzValue::MAP:
+      for (const auto& k_v : av.key_value_array) {
+        CollectLeaves(absl::StrCat(name, "/", k_v.first), k_v.second, dest);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+VarzValue::Map GetHistoryStats() {
+  VarzValue::Map res;
+  if (!global_history)
+    return res;
+
+  VarzHistory::Stats stats = global_history->GetStats();
+  res.emplace_back("series", VarzValue::FromInt(stats.series));
+  res.emplace_back("blocks", VarzValue::FromInt(stats.blocks));
+  res.emplace_back("bytes", VarzValue::FromInt(stats.bytes));
+  res.emplace_back("samples", VarzValue::FromInt(stats.samples));
+  res.emplace_back("dropped", VarzValue::FromInt(stats.dropped));
+  return res;
+}
+
+VarzFunction varz_history_varz(kVarzName, GetHistoryStats);
+
+}  // namespace
+
+double VarzHistory::Series::Rate(unsigned window_sec) const {
+  if (values.size() < 2)
+    return 0;
+
+  size_t last = values.size() - 1;
+  uint64_t min_time = time_ms[last] - std::min<uint64_t>(window_sec * 1000ULL, time_ms[last]);
+  size_t first = last;
+  while (first > 0 && time_ms[first - 1] >= min_time)
+    --first;
+
+  // A window shorter than the interval is the change between the last two samples.
+  if (first == last)
+    --first;
+  if (time_ms[last] <= time_ms[first])
+    return 0;
+  return (values[last] - values[first]) * 1000 / (time_ms[last] - time_ms[first]);
+}
+
+uint64_t VarzHistory::SeriesData::size() const {
+  uint64_t res = open_count;
+  for (const Block& b : blocks)
+    res += b.count;
+  return res;
+}
+
+VarzHistory::VarzHistory(unsigned interval_sec, unsigned window_sec)
+    : interval_sec_(interval_sec), window_sec_(window_sec),
+      capacity_(window_sec / std::max(interval_sec, 1u) + 1) {
+  CHECK_GT(interval_sec, 0);
+  CHECK_GE(window_sec, interval_sec);
+}
+
+VarzHistory::~VarzHistory() {
+  Stop();
+}
+
+void VarzHistory::Start() {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!stopped_)
+    return;
+  stopped_ = false;
+  thread_ = std::thread(&VarzHistory::Run, this);
+}
+
+void VarzHistory::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void VarzHistory::Run() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stopped_) {
+    lk.unlock();
+    SampleOnce();
+    lk.lock();
+    cv_.wait_for(lk, std::chrono::seconds(interval_sec_), [this] { return stopped_; });
+  }
+}
+
+void VarzHistory::SampleOnce() {
+  SampleOnce(GetCurrentTimeMicros() / 1000);
+}
+
+void VarzHistory::SampleOnce(uint64_t time_ms) {
+  // The varz are read outside of the lock, the queries do not wait for them.
+  vector<Leaf> leaves;
+  VarzListNode::Iterate([&](const char* name, VarzValue&& av) {
+    if (strcmp(name, kVarzName) != 0)
+      CollectLeaves(name, av, &leaves);
+  });
+
+  std::lock_guard<std::mutex> lk(mu_);
+  uint64_t seq = next_seq_++;
+  time_ms_.push_back(time_ms);
+  while (time_ms_.size() > capacity_ + kBlockSamples) {
+    time_ms_.pop_front();
+    ++time_seq_;
+  }
+
+  for (Leaf& leaf : leaves) {
+    auto it = series_.find(leaf.name);
+    if (it == series_.end()) {
+      if (series_.size() >= FLAGS_varz_history_max_series) {
+        ++dropped_;
+        continue;
+      }
+      it = series_.emplace(std::move(leaf.name), SeriesData{}).first;
+      it->second.first_seq = seq;
+      it->second.is_double = leaf.is_double;
+    } else if (it->second.last_seen_seq == seq) {
+      continue;  // The same name reported twice.
+    }
+    it->second.last_seen_seq = seq;
+    Append(seq, leaf.value, &it->second);
+  }
+
+  // The series that were not reported keep their last value, until they miss the whole window.
+  for (auto it = series_.begin(); it != series_.end();) {
+    auto cur = it++;
+    SeriesData& sd = cur->second;
+    if (sd.last_seen_seq == seq)
+      continue;
+    if (seq - sd.last_seen_seq >= capacity_) {
+      series_.erase(cur);
+    } else {
+      Append(seq, sd.last, &sd);
+    }
+  }
+}
+
+void VarzHistory::Append(uint64_t seq, int64_t value, SeriesData* sd) {
+  DCHECK_EQ(seq, sd->first_seq + sd->size());
+
+  // The deltas wrap around, so the decoding sums restore any pair of values.
+  uint64_t delta = ZigZag(int64_t(uint64_t(value) - uint64_t(sd->last)));
+  if (sd->open_count > 0 && delta > UINT32_MAX)
+    Seal(sd);
+
+  if (sd->open_count == 0) {
+    sd->open_base = value;
+    sd->open_count = 1;
+  } else {
+    sd->open_deltas.push_back(delta);
+    if (++sd->open_count == kBlockSamples)
+      Seal(sd);
+  }
+  sd->last = value;
+
+  while (!sd->blocks.empty() && sd->size() - sd->blocks.front().count >= capacity_) {
+    sd->first_seq += sd->blocks.front().count;
+    sd->blocks.pop_front();
+  }
+}
+
+void VarzHistory::Seal(SeriesData* sd) {
+  if (sd->open_count == 0)
+    return;
+
+  Block block;
+  block.base = sd->open_base;
+  block.count = sd->open_count;
+  if (!sd->open_deltas.empty()) {
+    size_t cnt = sd->open_deltas.size();
+    block.deltas.resize(pfor::MaxEncodedSize(cnt));
+    uint8_t* dest = reinterpret_cast<uint8_t*>(&block.deltas[0]);
+    block.deltas.resize(pfor::Encode(sd->open_deltas.data(), cnt, dest));
+    block.deltas.shrink_to_fit();
+  }
+  sd->blocks.push_back(std::move(block));
+
+  sd->open_count = 0;
+  sd->open_deltas.clear();
+}
+
+void VarzHistory::Decode(const SeriesData& sd, uint64_t from_seq, vector<double>* dest) const {
+  double scale = sd.is_double ? kDoubleScale : 1;
+  uint64_t seq = sd.first_seq;
+  vector<uint32_t> deltas;
+
+  auto decode = [&](int64_t base, uint32_t count, const uint32_t* delta) {
+    if (seq + count <= from_seq) {
+      seq += count;
+      return;
+    }
+    uint64_t value = base;
+    for (uint32_t i = 0; i < count; ++i, ++seq) {
+      if (i)
+        value += UnZigZag(delta[i - 1]);
+      if (seq >= from_seq)
+        dest->push_back(int64_t(value) / scale);
+    }
+  };
+
+  for (const Block& b : sd.blocks) {
+    deltas.resize(b.count - 1);
+    if (b.count > 1 && seq + b.count > from_seq) {
+      const uint8_t* src = reinterpret_cast<const uint8_t*>(b.deltas.data());
+      CHECK_EQ(int64_t(b.count) - 1, pfor::DecodedCount(src, b.deltas.size()));
+      CHECK(pfor::Decode(src, b.deltas.size(), deltas.data()));
+    }
+    decode(b.base, b.count, deltas.data());
+  }
+  decode(sd.open_base, sd.open_count, sd.open_deltas.data());
+}
+
+auto VarzHistory::Query(absl::string_view prefix, unsigned window_sec) const -> vector<Series> {
+  vector<Series> res;
+  std::lock_guard<std::mutex> lk(mu_);
+  if (time_ms_.empty())
+    return res;
+
+  uint64_t last_time = time_ms_.back();
+  uint64_t min_time = last_time - std::min<uint64_t>(window_sec * 1000ULL, last_time);
+  size_t first = time_ms_.size() - 1;
+  while (first > 0 && time_ms_[first - 1] >= min_time)
+    --first;
+  uint64_t from_seq = time_seq_ + first;
+
+  for (const auto& k_v : series_) {
+    if (!absl::StartsWith(k_v.first, prefix))
+      continue;
+    const SeriesData& sd = k_v.second;
+    Series series;
+    series.name = k_v.first;
+    uint64_t start = std::max(from_seq, sd.first_seq);
+    for (uint64_t seq = start; seq < next_seq_; ++seq)
+      series.time_ms.push_back(time_ms_[seq - time_seq_]);
+    Decode(sd, start, &series.values);
+    DCHECK_EQ(series.time_ms.size(), series.values.size());
+    res.push_back(std::move(series));
+  }
+
+  std::sort(res.begin(), res.end(),
+            [](const Series& a, const Series& b) { return a.name < b.name; });
+  return res;
+}
+
+auto VarzHistory::GetStats() const -> Stats {
+  Stats res;
+  std::lock_guard<std::mutex> lk(mu_);
+  res.series = series_.size();
+  res.samples = next_seq_;
+  res.dropped = dropped_;
+  res.bytes = time_ms_.size() * sizeof(uint64_t);
+  for (const auto& k_v : series_) {
+    const SeriesData& sd = k_v.second;
+    res.blocks += sd.blocks.size();
+    res.bytes += sizeof(k_v) + k_v.first.capacity() + sd.open_deltas.capacity() * sizeof(uint32_t);
+    for (const Block& b : sd.blocks)
+      res.bytes += sizeof(Block) + b.deltas.capacity();
+  }
+  return res;
+}
+
+VarzHistory* VarzHistory::global() {
+  return global_history;
+}
+
+}  // namespace util
+
+REGISTER_MODULE_INITIALIZER(varz_history, {
+  if (FLAGS_varz_history_sec > 0) {
+    util::global_history = new util::VarzHistory(FLAGS_varz_history_sec);
+    util::global_history->Start();
+  }
+});
+
+REGISTER_MODULE_DESTRUCTOR(varz_history, {
+  delete util::global_history;
+  util::global_history = nullptr;
+});
@@ -0,0 +1,135 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "util/stats/varz_value.h"
+
+namespace util {
+
+/* Keeps the recent history of the numeric varz, so the rates and the trends can be queried on
+   the box without an external scraper. A background thread snapshots all the varz every
+   interval_sec, the values of the maps become the series "name/key". Histograms and strings
+   are skipped. The doubles are kept with kDoubleScale precision.
+
+   Each series is a ring of blocks of kBlockSamples values: the first value of a block is kept
+   as is and the others as zigzag deltas packed by util/coding/pfor_codec.h, which codes the
+   nearly constant deltas of steady counters in a few bits. A delta that does not fit
+   32 bits starts a new block. The last block is open and keeps its deltas unpacked.
+   The blocks that are older than window_sec are dropped.
+
+   The snapshot reads the varz without holding the history lock. The counters are read as
+   usual, i.e. ShardedCounter sums their thread slots and does not block the writers.
+   At most --varz_history_max_series series are kept, the new ones beyond are dropped.
+   The process-wide history is started by MainInitGuard when --varz_history_sec is positive,
+   /varzh on the status page serves it and the "varz-history" varz describes its size.
+*/
+class VarzHistory {
+ public:
+  static constexpr double kDoubleScale = 1000;
+
+  // The deltas of a block fill exactly one block of the pfor codec.
+  static constexpr unsigned kBlockSamples = 129;
+
+  struct Series {
+    std::string name;
+    std::vector<uint64_t> time_ms;  // Since the Epoch.
+    std::vector<double> values;
+
+    // Per second change over the last window_sec, 0 without two samples within the window.
+    double Rate(unsigned window_sec) const;
+  };
+
+  struct Stats {
+    size_t series = 0, blocks = 0, bytes = 0;
+    uint64_t samples = 0;
+    uint64_t dropped = 0;  // The values of the series beyond the limit.
+  };
+
+  VarzHistory(unsigned interval_sec, unsigned window_sec = 3600);
+  ~VarzHistory();
+
+  void Start();
+  void Stop();
+
+  // Snapshots the varz in the calling thread. Called by the history thread every interval_sec.
+  void SampleOnce();
+
+  // time_ms is the time of the snapshot since the Epoch.
+  void SampleOnce(uint64_t time_ms);
+
+  // The series whose names start with prefix, sorted by name, with their values over the last
+  // window_sec, oldest first.
+  std::vector<Series> Query(absl::string_view prefix, unsigned window_sec) const;
+
+  Stats GetStats() const;
+
+  unsigned interval_sec() const { return interval_sec_; }
+  unsigned window_sec() const { return window_sec_; }
+
+  // The history started by --varz_history_sec, null if it's disabled.
+  static VarzHistory* global();
+
+ private:
+  struct Block {
+    int64_t base;
+    uint32_t count;      // Including the base.
+    std::string deltas;  // pfor coded.
+  };
+
+  struct SeriesData {
+    bool is_double = false;
+    uint64_t first_seq = 0;  // The sequence number of the first value of the first block.
+    uint64_t last_seen_seq = 0;
+    int64_t last = 0;
+
+    std::deque<Block> blocks;
+
+    // The open block.
+    int64_t open_base = 0;
+    uint32_t open_count = 0;
+    std::vector<uint32_t> open_deltas;  // zigzag coded.
+
+    uint64_t size() const;
+  };
+
+  void Run();
+
+  // Requires mu_.
+  void Append(uint64_t seq, int64_t value, SeriesData* sd);
+  void Seal(SeriesData* sd);
+
+  // Appends the values of sd from the sequence number from_seq on to dest.
+  void Decode(const SeriesData& sd, uint64_t from_seq, std::vector<double>* dest) const;
+
+  const unsigned interval_sec_, window_sec_;
+
+  // The number of the samples that cover the window.
+  const unsigned capacity_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  bool stopped_ = true;
+  std::thread thread_;
+
+  // Guarded by mu_.
+  absl::flat_hash_map<std::string, SeriesData> series_;
+  std::deque<uint64_t> time_ms_;  // Of the samples from time_seq_ on.
+  uint64_t time_seq_ = 0;
+  uint64_t next_seq_ = 0;
+  uint64_t dropped_ = 0;
+
+  VarzHistory(const VarzHistory&) = delete;
+  void operator=(const VarzHistory&) = delete;
+};
+
+}  // namespace util
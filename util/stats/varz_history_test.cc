@@ -0,0 +1,124 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/stats/varz_history.h"
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/stats/varz_stats.h"
+
+namespace util {
+
+using namespace std;
+
+class VarzHistoryTest : public testing::Test {
+ protected:
+  static constexpr uint64_t kStartMs = 1000000;
+
+  // The single series named name.
+  static VarzHistory::Series Get(const VarzHistory& history, const char* name,
+                                 unsigned window_sec) {
+    vector<VarzHistory::Series> res = history.Query(name, window_sec);
+    CHECK_EQ(1, res.size()) << name;
+    return res.front();
+  }
+};
+
+TEST_F(VarzHistoryTest, Counters) {
+  VarzCount count("vh-count");
+  VarzMapCount map("vh-map");
+  VarzHistory history(10, 60);
+
+  for (unsigned i = 0; i < 20; ++i) {
+    count.IncBy(5);
+    map.IncBy("a", i);
+    history.SampleOnce(kStartMs + i * 10000);
+  }
+
+  // 60 seconds hold 7 samples.
+  VarzHistory::Series s = Get(history, "vh-count", 60);
+  ASSERT_EQ(7, s.values.size());
+  ASSERT_EQ(7, s.time_ms.size());
+  for (unsigned i = 0; i < 7; ++i) {
+    EXPECT_EQ(5 * (14 + i), s.values[i]);
+    EXPECT_EQ(kStartMs + (13 + i) * 10000, s.time_ms[i]);
+  }
+  EXPECT_DOUBLE_EQ(0.5, s.Rate(60));
+  EXPECT_DOUBLE_EQ(0.5, s.Rate(1));
+
+  s = Get(history, "vh-count", 20);
+  EXPECT_EQ(3, s.values.size());
+
+  s = Get(history, "vh-map/", 60);
+  EXPECT_EQ("vh-map/a", s.name);
+  EXPECT_EQ(190, s.values.back());
+  EXPECT_EQ(190 - 19 - 18, s.values[s.values.size() - 3]);
+
+  EXPECT_TRUE(history.Query("vh-none", 60).empty());
+}
+
+TEST_F(VarzHistoryTest, Blocks) {
+  int64_t big = 0;
+  double dbl = 0;
+  VarzFunction func("vh-func", [&] {
+    VarzValue::Map res;
+    res.emplace_back("big", VarzValue::FromInt(big));
+    res.emplace_back("dbl", VarzValue::FromDouble(dbl));
+    return res;
+  });
+
+  VarzHistory history(1, 300);
+  vector<int64_t> bigs;
+  vector<double> dbls;
+  for (unsigned i = 0; i < 1000; ++i) {
+    // Mostly steady deltas with the jumps that do not fit 32 bits.
+    big += i % 100 == 7 ? (1LL << 40) : int64_t(i % 3) - 1;
+    if (i % 250 == 0)
+      big = -big;
+    dbl = i * 0.25 - 100;
+    bigs.push_back(big);
+    dbls.push_back(dbl);
+    history.SampleOnce(kStartMs + i * 1000);
+  }
+
+  VarzHistory::Series s = Get(history, "vh-func/big", 300);
+  ASSERT_EQ(301, s.values.size());
+  for (unsigned i = 0; i < s.values.size(); ++i) {
+    ASSERT_EQ(bigs[699 + i], s.values[i]) << i;
+  }
+
+  s = Get(history, "vh-func/dbl", 300);
+  ASSERT_EQ(301, s.values.size());
+  for (unsigned i = 0; i < s.values.size(); ++i) {
+    ASSERT_DOUBLE_EQ(dbls[699 + i], s.values[i]) << i;
+  }
+  EXPECT_DOUBLE_EQ(0.25, s.Rate(300));
+
+  // The blocks older than the window are dropped.
+  VarzHistory::Stats stats = history.GetStats();
+  EXPECT_EQ(1000, stats.samples);
+  EXPECT_LE(stats.blocks, stats.series * (300 / VarzHistory::kBlockSamples + 6));
+}
+
+TEST_F(VarzHistoryTest, Missing) {
+  VarzHistory history(1, 10);
+  {
+    VarzCount count("vh-gone");
+    count.IncBy(3);
+    history.SampleOnce(kStartMs);
+  }
+
+  // The series keeps its last value until it misses the whole window.
+  for (unsigned i = 1; i < 11; ++i) {
+    history.SampleOnce(kStartMs + i * 1000);
+  }
+  VarzHistory::Series s = Get(history, "vh-gone", 10);
+  EXPECT_EQ(11, s.values.size());
+  EXPECT_EQ(3, s.values.back());
+  EXPECT_EQ(0, s.Rate(10));
+
+  history.SampleOnce(kStartMs + 11000);
+  EXPECT_TRUE(history.Query("vh-gone", 10).empty());
+}
+
+}  // namespace util
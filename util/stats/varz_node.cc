@@ -3,6 +3,10 @@
 //
 
 #include "util/stats/varz_node.h"
+
+#include <algorithm>
+
+#include "absl/strings/ascii.h"
 #include "strings/strcat.h"
 
 namespace util {
@@ -10,6 +14,109 @@ namespace util {
 using namespace std;
 using absl::StrAppend;
 
+namespace {
+
+// Prometheus names are [a-zA-Z_:][a-zA-Z0-9_:]*, the rest of the characters become '_'.
+void AppendName(absl::string_view name, bool leading, string* dest) {
+  for (char c : name) {
+    bool valid = absl::ascii_isalpha(c) || c == '_' || c == ':' ||
+                 (!leading && absl::ascii_isdigit(c));
+    dest->push_back(valid ? c : '_');
+    leading = false;
+  }
+}
+
+void AppendFamily(absl::string_view name, absl::string_view suffix, string* dest) {
+  AppendName(name, true, dest);
+  AppendName(suffix, false, dest);
+}
+
+void AppendLabelValue(absl::string_view val, string* dest) {
+  for (char c : val) {
+    switch (c) {
+      case '\\':
+        dest->append("\\\\");
+        break;
+      case '"':
+        dest->append("\\\"");
+        break;
+      case '\n':
+        dest->append("\\n");
+        break;
+      default:
+        dest->push_back(c);
+    }
+  }
+}
+
+// {key="...",extra="..."} or nothing if both are empty.
+void AppendLabels(absl::string_view key, absl::string_view extra_name,
+                  absl::string_view extra_val, string* dest) {
+  if (key.empty() && extra_name.empty())
+    return;
+  dest->push_back('{');
+  if (!key.empty()) {
+    dest->append("key=\"");
+    AppendLabelValue(key, dest);
+    dest->push_back('"');
+  }
+  if (!extra_name.empty()) {
+    if (!key.empty())
+      dest->push_back(',');
+    StrAppend(dest, extra_name, "=\"");
+    AppendLabelValue(extra_val, dest);
+    dest->push_back('"');
+  }
+  dest->push_back('}');
+}
+
+// A scalar of the varz value tree with the path that leads to it.
+struct Leaf {
+  string suffix;          // "_a_b" for the nested keys a, b.
+  absl::string_view key;  // The key of the top-level map.
+  const VarzValue* value;
+};
+
+void CollectLeaves(const VarzValue& av, absl::string_view key, const string& suffix,
+                   unsigned depth, vector<Leaf>* dest) {
+  if (av.type != VarzValue::MAP) {
+    dest->push_back(Leaf{suffix, key, &av});
+    return;
+  }
+
+  for (const auto& k_v : av.key_value_array) {
+    if (depth == 0) {
+      CollectLeaves(k_v.second, k_v.first, suffix, depth + 1, dest);
+    } else {
+      CollectLeaves(k_v.second, key, absl::StrCat(suffix, "_", k_v.first), depth + 1, dest);
+    }
+  }
+}
+
+void AppendHistogram(absl::string_view name, absl::string_view suffix, absl::string_view key,
+                     const base::Histogram& hist, string* dest) {
+  uint64_t cumulative = 0;
+  string bucket_suffix = absl::StrCat(suffix, "_bucket");
+  hist.ForEachBucket([&](double limit, uint64_t count) {
+    cumulative += count;
+    AppendFamily(name, bucket_suffix, dest);
+    AppendLabels(key, "le", absl::StrCat(limit), dest);
+    StrAppend(dest, " ", cumulative, "\n");
+  });
+  AppendFamily(name, bucket_suffix, dest);
+  AppendLabels(key, "le", "+Inf", dest);
+  StrAppend(dest, " ", hist.count(), "\n");
+
+  AppendFamily(name, absl::StrCat(suffix, "_sum"), dest);
+  AppendLabels(key, {}, {}, dest);
+  StrAppend(dest, " ", hist.sum(), "\n");
+  AppendFamily(name, absl::StrCat(suffix, "_count"), dest);
+  AppendLabels(key, {}, {}, dest);
+  StrAppend(dest, " ", hist.count(), "\n");
+}
+
+}  // namespace
+
 folly::RWSpinLock VarzListNode::g_varz_lock;
 
 VarzListNode::VarzListNode(const char* name) : name_(name), prev_(nullptr) {
@@ -50,6 +157,10 @@ string VarzListNode::Format(const AnyValue& av) {
     case VarzValue::DOUBLE:
       StrAppend(&result, av.dbl);
       break;
+    case VarzValue::HISTOGRAM:
+      StrAppend(&result, "{ \"count\": ", av.hist->count(), ", \"p50\": ", av.hist->Median(),
+                ", \"p99\": ", av.hist->Percentile(99), ", \"max\": ", av.hist->max(), " }");
+      break;
     case VarzValue::MAP:
       result.append("{ ");
       for (const auto& k_v : av.key_value_array) {
@@ -77,4 +188,80 @@ void VarzListNode::Iterate(std::function<void(const char*, AnyValue&&)> f) {
   }
 }
 
+void VarzListNode::FormatPrometheus(std::string* dest) {
+  folly::RWSpinLock::ReadHolder guard(g_varz_lock);
+
+  for (VarzListNode* node = global_list(); node != nullptr; node = node->next_) {
+    if (node->name_ != nullptr) {
+      node->AppendPrometheus(dest);
+    }
+  }
+}
+
+void VarzListNode::AppendPrometheus(std::string* dest) const {
+  AppendPrometheusValue(name_, "gauge", GetData(), dest);
+}
+
+void VarzListNode::AppendPrometheusValue(const char* name, const char* type, const AnyValue& av,
+                                         std::string* dest) {
+  // Reused by the varz of the thread, the samples of a family must form a single group.
+  static thread_local vector<Leaf> leaves;
+  leaves.clear();
+  CollectLeaves(av, {}, string{}, 0, &leaves);
+  std::stable_sort(leaves.begin(), leaves.end(),
+                   [](const Leaf& l, const Leaf& r) { return l.suffix < r.suffix; });
+
+  for (size_t i = 0; i < leaves.size(); ++i) {
+    const Leaf& leaf = leaves[i];
+    const VarzValue& v = *leaf.value;
+    bool first = i == 0 || leaves[i - 1].suffix != leaf.suffix;
+
+    switch (v.type) {
+      case VarzValue::NUM:
+      case VarzValue::TIME:
+        if (first)
+          AppendPrometheusType(name, leaf.suffix, type, dest);
+        AppendPrometheusSample(name, leaf.suffix, leaf.key, v.num, dest);
+        break;
+      case VarzValue::DOUBLE:
+        if (first)
+          AppendPrometheusType(name, leaf.suffix, type, dest);
+        AppendPrometheusSample(name, leaf.suffix, leaf.key, v.dbl, dest);
+        break;
+      case VarzValue::STRING: {
+        string info = absl::StrCat(leaf.suffix, "_info");
+        if (first)
+          AppendPrometheusType(name, info, "gauge", dest);
+        AppendFamily(name, info, dest);
+        AppendLabels(leaf.key, "value", v.str, dest);
+        dest->append(" 1\n");
+        break;
+      }
+      case VarzValue::HISTOGRAM:
+        if (first)
+          AppendPrometheusType(name, leaf.suffix, "histogram", dest);
+        AppendHistogram(name, leaf.suffix, leaf.key, *v.hist, dest);
+        break;
+      case VarzValue::MAP:  // An empty map.
+        break;
+    }
+  }
+  leaves.clear();
+}
+
+void VarzListNode::AppendPrometheusType(absl::string_view name, absl::string_view suffix,
+                                        const char* type, std::string* dest) {
+  dest->append("# TYPE ");
+  AppendFamily(name, suffix, dest);
+  StrAppend(dest, " ", type, "\n");
+}
+
+void VarzListNode::AppendPrometheusSample(absl::string_view name, absl::string_view suffix,
+                                          absl::string_view key, const absl::AlphaNum& value,
+                                          std::string* dest) {
+  AppendFamily(name, suffix, dest);
+  AppendLabels(key, {}, {}, dest);
+  StrAppend(dest, " ", value, "\n");
+}
+
 }  // namespace util
@@ -6,6 +6,8 @@
 #include <functional>
 #include <string>
 
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "base/RWSpinLock.h"
 #include "util/stats/varz_value.h"
 
@@ -27,9 +29,30 @@ class VarzListNode {
     Iterate([&](const char* name, AnyValue&& av) { cb(name, Format(av)); });
   }
 
+  // Appends all the varz to dest in Prometheus text exposition format.
+  static void FormatPrometheus(std::string* dest);
+
  protected:
   virtual AnyValue GetData() const = 0;
 
+  // Appends the metric families of the node in Prometheus text format. By default exposes
+  // GetData() as gauges, see AppendPrometheusValue.
+  virtual void AppendPrometheus(std::string* dest) const;
+
+  // The keys of the map become "key" label, the keys of the nested maps the suffixes of the
+  // family name. Strings are exposed as name_info{value="..."} 1.
+  static void AppendPrometheusValue(const char* name, const char* type, const AnyValue& av,
+                                    std::string* dest);
+
+  // "# TYPE" line of the family name + suffix.
+  static void AppendPrometheusType(absl::string_view name, absl::string_view suffix,
+                                   const char* type, std::string* dest);
+
+  // A sample of the family name + suffix, key is the value of "key" label if not empty.
+  static void AppendPrometheusSample(absl::string_view name, absl::string_view suffix,
+                                     absl::string_view key, const absl::AlphaNum& value,
+                                     std::string* dest);
+
   const char* name_;
 
   static std::string Format(const AnyValue& av);
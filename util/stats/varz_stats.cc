@@ -4,6 +4,9 @@
 
 #include "util/stats/varz_stats.h"
 
+#include <algorithm>
+
+#include "base/memory_account.h"
 #include "base/walltime.h"
 #include "strings/strcat.h"
 #include "strings/stringprintf.h"
@@ -14,16 +17,20 @@ using strings::AsString;
 namespace util {
 
 auto VarzMapCount::ReadLockAndFindOrInsert(StringPiece key) -> Map::iterator {
-  rw_spinlock_.lock_shared();
+  rw_lock_.lock_shared();
   auto it = map_counts_.find(key);
   if (it != map_counts_.end())
     return it;
 
-  rw_spinlock_.unlock_shared();
+  rw_lock_.unlock_shared();
 
-  rw_spinlock_.lock();
-  auto res = map_counts_.emplace(key, base::atomic_wrapper<long>(0));
-  rw_spinlock_.unlock_and_lock_shared();
+  rw_lock_.lock();
+  auto res = map_counts_.emplace(key, nullptr);
+  if (res.second) {
+    counters_.emplace_back();
+    res.first->second = &counters_.back();
+  }
+  rw_lock_.unlock_and_lock_shared();
   return res.first;
 }
 
@@ -38,8 +45,8 @@ void VarzMapCount::IncBy(StringPiece key, int32 delta) {
   }
 
   auto it = ReadLockAndFindOrInsert(key);
-  it->second.fetch_add(delta, std::memory_order_relaxed);
-  rw_spinlock_.unlock_shared();
+  it->second->IncBy(delta);
+  rw_lock_.unlock_shared();
 }
 
 void VarzMapCount::Set(StringPiece key, int32 value) {
@@ -49,44 +56,91 @@ void VarzMapCount::Set(StringPiece key, int32 value) {
   }
 
   auto it = ReadLockAndFindOrInsert(key);
-  it->second.store(value, std::memory_order_relaxed);
-  rw_spinlock_.unlock_shared();
+  it->second->Set(value);
+  rw_lock_.unlock_shared();
+}
+
+auto VarzMapCount::GetHandle(StringPiece key) -> Handle {
+  CHECK(!key.empty());
+
+  auto it = ReadLockAndFindOrInsert(key);
+  Handle res(it->second);
+  rw_lock_.unlock_shared();
+  return res;
+}
+
+void VarzMapCount::TakeSnapshot(Snapshot* dest) const {
+  dest->clear();
+  rw_lock_.lock_shared();
+  for (const auto& k_v : map_counts_) {
+    dest->emplace_back(k_v.first, k_v.second->Get());
+  }
+  rw_lock_.unlock_shared();
+
+  std::sort(dest->begin(), dest->end());
 }
 
 VarzValue VarzMapCount::GetData() const {
+  Snapshot snapshot;
+  TakeSnapshot(&snapshot);
+
   AnyValue::Map result;
-  rw_spinlock_.lock_shared();
-  for (const auto& k_v : map_counts_) {
+  result.reserve(snapshot.size());
+  for (const auto& k_v : snapshot) {
     result.emplace_back(AsString(k_v.first), VarzValue::FromInt(k_v.second));
   }
-  rw_spinlock_.unlock_shared();
-  typedef AnyValue::Map::value_type vt;
-  std::sort(result.begin(), result.end(),
-            [](const vt& l, const vt& r) { return l.first < r.first; });
 
   return AnyValue{std::move(result)};
 }
 
-VarzValue VarzMapAverage5m::GetData() const {
+void VarzMapCount::AppendPrometheus(std::string* dest) const {
+  static thread_local Snapshot snapshot;
+  TakeSnapshot(&snapshot);
+
+  AppendPrometheusType(name_, {}, "counter", dest);
+  for (const auto& k_v : snapshot) {
+    AppendPrometheusSample(name_, {}, k_v.first, k_v.second, dest);
+  }
+}
+
+void VarzMapAverage5m::TakeSnapshot(std::vector<Item>* dest) const {
+  dest->clear();
   std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& k_v : avg_) {
+    dest->push_back(Item{k_v.first, k_v.second.first.Sum(), k_v.second.second.Sum()});
+  }
+}
+
+VarzValue VarzMapAverage5m::GetData() const {
+  std::vector<Item> snapshot;
+  TakeSnapshot(&snapshot);
   AnyValue::Map result;
 
-  for (const auto& k_v : avg_) {
+  for (const Item& item : snapshot) {
     AnyValue::Map items;
-    int64 count = k_v.second.second.Sum();
-    int64 sum = k_v.second.first.Sum();
-    items.emplace_back("count", VarzValue::FromInt(count));
-    items.emplace_back("sum", VarzValue::FromInt(sum));
+    items.emplace_back("count", VarzValue::FromInt(item.count));
+    items.emplace_back("sum", VarzValue::FromInt(item.sum));
 
-    double avg = count > 0 ? double(sum) / count : 0;
+    double avg = item.count > 0 ? double(item.sum) / item.count : 0;
     items.emplace_back("average", VarzValue::FromDouble(avg));
 
-    result.emplace_back(AsString(k_v.first), AnyValue(items));
+    result.emplace_back(AsString(item.key), AnyValue(items));
   }
 
   return AnyValue{std::move(result)};
 }
 
+void VarzMapAverage5m::AppendPrometheus(std::string* dest) const {
+  static thread_local std::vector<Item> snapshot;
+  TakeSnapshot(&snapshot);
+
+  AppendPrometheusType(name_, {}, "summary", dest);
+  for (const Item& item : snapshot) {
+    AppendPrometheusSample(name_, "_sum", item.key, item.sum, dest);
+    AppendPrometheusSample(name_, "_count", item.key, item.count, dest);
+  }
+}
+
 void VarzMapAverage5m::IncBy(StringPiece key, int32 delta) {
   std::lock_guard<std::mutex> lock(mutex_);
   auto& val = avg_[key];
@@ -95,7 +149,126 @@ void VarzMapAverage5m::IncBy(StringPiece key, int32 delta) {
 }
 
 VarzValue VarzCount::GetData() const {
-  return VarzValue::FromInt(val_.load());
+  return VarzValue::FromInt(val_.Get());
+}
+
+void VarzCount::AppendPrometheus(std::string* dest) const {
+  AppendPrometheusType(name_, {}, "counter", dest);
+  AppendPrometheusSample(name_, {}, {}, val_.Get(), dest);
+}
+
+VarzValue VarzHistogram::GetData() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return VarzValue::FromHistogram(hist_);
+}
+
+VarzValue VarzLatency::GetData() const {
+  base::HdrHistogram::Snapshot snap = hist_.Read();
+
+  AnyValue::Map result;
+  result.emplace_back("count", VarzValue::FromInt(snap.count()));
+  result.emplace_back("mean", VarzValue::FromDouble(snap.Mean()));
+  result.emplace_back("p50", VarzValue::FromInt(snap.Percentile(50)));
+  result.emplace_back("p90", VarzValue::FromInt(snap.Percentile(90)));
+  result.emplace_back("p99", VarzValue::FromInt(snap.Percentile(99)));
+  result.emplace_back("p999", VarzValue::FromInt(snap.Percentile(99.9)));
+  result.emplace_back("max", VarzValue::FromInt(snap.max()));
+
+  return AnyValue{std::move(result)};
+}
+
+VarzMapHistogram::VarzMapHistogram(const char* varname, unsigned window_sec)
+    : VarzListNode(varname), window_sec_(window_sec) {
+  CHECK_GT(window_sec, 0);
+  map_.set_empty_key(StringPiece());
+}
+
+auto VarzMapHistogram::ReadLockAndFindOrInsert(StringPiece key) -> Map::iterator {
+  rw_lock_.lock_shared();
+  auto it = map_.find(key);
+  if (it != map_.end())
+    return it;
+
+  rw_lock_.unlock_shared();
+
+  rw_lock_.lock();
+  auto res = map_.emplace(key, nullptr);
+  if (res.second) {
+    entries_.emplace_back();
+    entries_.back().created_sec = GetMonotonicMicros() / 1000000;
+    res.first->second = &entries_.back();
+  }
+  rw_lock_.unlock_and_lock_shared();
+  return res.first;
+}
+
+void VarzMapHistogram::Add(StringPiece key, uint64_t value) {
+  if (key.empty()) {
+    LOG(DFATAL) << "Empty varz key";
+    return;
+  }
+
+  auto it = ReadLockAndFindOrInsert(key);
+  it->second->hist.Add(value);
+  rw_lock_.unlock_shared();
+}
+
+base::HdrHistogram::Snapshot VarzMapHistogram::Read(StringPiece key) const {
+  base::DistributedRWLock::ReadHolder lk(rw_lock_);
+  auto it = map_.find(key);
+  return it == map_.end() ? base::HdrHistogram::Snapshot{} : it->second->hist.Read();
+}
+
+VarzValue VarzMapHistogram::GetData() const {
+  // Snapshots are taken a few times per window, so the window slides in these steps.
+  constexpr unsigned kSnapshotsPerWindow = 4;
+  uint64_t now = GetMonotonicMicros() / 1000000;
+  uint64_t step = std::max(1u, window_sec_ / kSnapshotsPerWindow);
+
+  std::vector<std::pair<StringPiece, Entry*>> entries;
+  rw_lock_.lock_shared();
+  for (const auto& k_v : map_) {
+    entries.emplace_back(k_v.first, k_v.second);
+  }
+  rw_lock_.unlock_shared();
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  AnyValue::Map result;
+  std::lock_guard<std::mutex> lk(read_mu_);
+  for (const auto& k_v : entries) {
+    auto& history = k_v.second->history;
+    base::HdrHistogram::Snapshot snap = k_v.second->hist.Read();
+
+    // The base is the newest snapshot that is at least window_sec_ old. Without it, all the
+    // values since the key was created are reported.
+    while (history.size() > 1 && history[1].first + window_sec_ <= now) {
+      history.pop_front();
+    }
+    base::HdrHistogram::Snapshot delta = snap;
+    uint64_t start = k_v.second->created_sec;
+    if (!history.empty() && history.front().first + window_sec_ <= now) {
+      delta.Subtract(history.front().second);
+      start = history.front().first;
+    }
+
+    if (history.empty() || history.back().first + step <= now) {
+      history.emplace_back(now, std::move(snap));
+    }
+
+    AnyValue::Map items;
+    items.emplace_back("count", VarzValue::FromInt(delta.count()));
+    items.emplace_back("mean", VarzValue::FromDouble(delta.Mean()));
+    items.emplace_back("p50", VarzValue::FromInt(delta.Percentile(50)));
+    items.emplace_back("p95", VarzValue::FromInt(delta.Percentile(95)));
+    items.emplace_back("p99", VarzValue::FromInt(delta.Percentile(99)));
+    items.emplace_back("max", VarzValue::FromInt(delta.max()));
+    items.emplace_back("window_sec", VarzValue::FromInt(now - start));
+
+    result.emplace_back(AsString(k_v.first), AnyValue(std::move(items)));
+  }
+
+  return AnyValue{std::move(result)};
 }
 
 VarzValue VarzQps::GetData() const {
@@ -107,4 +280,20 @@ VarzValue VarzFunction::GetData() const {
   return AnyValue(result);
 }
 
+static VarzValue::Map MemoryAccounts() {
+  VarzValue::Map result;
+  base::MemoryAccount::ForEach([&](const base::MemoryAccount& account) {
+    VarzValue::Map entry;
+    entry.emplace_back("bytes", VarzValue::FromInt(account.bytes()));
+    entry.emplace_back("peak", VarzValue::FromInt(account.peak()));
+    entry.emplace_back("allocations", VarzValue::FromInt(account.allocations()));
+    result.emplace_back(account.name(), VarzValue(std::move(entry)));
+  });
+  std::sort(result.begin(), result.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+  return result;
+}
+
+static VarzFunction memory_accounts("memory_accounts", MemoryAccounts);
+
 }  // namespace util
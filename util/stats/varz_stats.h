@@ -4,14 +4,19 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <mutex>
 
 #include "absl/strings/str_cat.h"   // for absl::AlphaNum
 #include "base/atomic_wrapper.h"
+#include "base/distributed_rwlock.h"
+#include "base/hdr_histogram.h"
+#include "base/histogram.h"
 #include "base/integral_types.h"
 #include "strings/stringpiece.h"
 #include "strings/unique_strings.h"
+#include "util/stats/sharded_counter.h"
 #include "util/stats/sliding_counter.h"
 #include "util/stats/varz_node.h"
 
@@ -21,11 +26,31 @@ namespace util {
 
 /**
   Represents a family (map) of counters. Each counter has its own key name.
+  The counters are sharded by threads, see ShardedCounter.
 **/
 class VarzMapCount : public VarzListNode {
-  typedef StringPieceDenseMap<base::atomic_wrapper<long>> Map;
+  typedef StringPieceDenseMap<ShardedCounter*> Map;
 
  public:
+  // Counter of a single key, incremented without the lookup. Valid while the map lives.
+  class Handle {
+   public:
+    Handle() = default;
+
+    void IncBy(int32 delta) {
+      counter_->IncBy(delta);
+    }
+    void Inc() {
+      IncBy(1);
+    }
+
+   private:
+    friend class VarzMapCount;
+    explicit Handle(ShardedCounter* counter) : counter_(counter) {}
+
+    ShardedCounter* counter_ = nullptr;
+  };
+
   explicit VarzMapCount(const char* varname) : VarzListNode(varname) {
     map_counts_.set_empty_key(StringPiece());
   }
@@ -38,12 +63,25 @@ class VarzMapCount : public VarzListNode {
   }
   void Set(StringPiece key, int32 value);
 
+  // Creates the key if needed.
+  Handle GetHandle(StringPiece key);
+
  private:
+  using Snapshot = std::vector<std::pair<StringPiece, long>>;
+
   virtual AnyValue GetData() const override;
+  void AppendPrometheus(std::string* dest) const override;
+
+  // Copies the counters under the lock, the keys are never erased so the snapshot may refer
+  // to them after it is released. Sorted by key.
+  void TakeSnapshot(Snapshot* dest) const;
+
   Map::iterator ReadLockAndFindOrInsert(StringPiece key);
 
-  mutable folly::RWSpinLock rw_spinlock_;
-  StringPieceDenseMap<base::atomic_wrapper<long>> map_counts_;
+  // Read-mostly, every IncBy() takes the shared lock.
+  mutable base::DistributedRWLock rw_lock_;
+  Map map_counts_;
+  std::deque<ShardedCounter> counters_;  // Guarded by the exclusive lock.
 };
 
 // represents a family of averages over 5min period.
@@ -56,8 +94,17 @@ class VarzMapAverage5m : public VarzListNode {
   void IncBy(StringPiece key, int32 delta);
 
  private:
+  struct Item {
+    StringPiece key;
+    int64 sum, count;
+  };
+
   virtual AnyValue GetData() const override;
 
+  // Exposed as a summary without quantiles.
+  void AppendPrometheus(std::string* dest) const override;
+  void TakeSnapshot(std::vector<Item>* dest) const;
+
   mutable std::mutex mutex_;
 
   typedef util::SlidingSecondCounterT<int64, 5, 60> Counter;
@@ -66,11 +113,11 @@ class VarzMapAverage5m : public VarzListNode {
 
 class VarzCount : public VarzListNode {
  public:
-  explicit VarzCount(const char* varname) : VarzListNode(varname), val_(0) {
+  explicit VarzCount(const char* varname) : VarzListNode(varname) {
   }
 
   void IncBy(int32 delta) {
-    val_ += delta;
+    val_.IncBy(delta);
   }
   void Inc() {
     IncBy(1);
@@ -78,8 +125,91 @@ class VarzCount : public VarzListNode {
 
  private:
   virtual AnyValue GetData() const override;
+  void AppendPrometheus(std::string* dest) const override;
+
+  ShardedCounter val_;
+};
+
+// Distribution of the added values, exported as a native Prometheus histogram.
+class VarzHistogram : public VarzListNode {
+ public:
+  explicit VarzHistogram(const char* varname) : VarzListNode(varname) {
+  }
+
+  void Add(double value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hist_.Add(value);
+  }
+
+ private:
+  virtual AnyValue GetData() const override;
+
+  mutable std::mutex mutex_;
+  base::Histogram hist_;
+};
+
+// Lock-free latency distribution, exposes the count, the mean and the main percentiles.
+// Prefer it over VarzHistogram for integer values recorded by many threads.
+class VarzLatency : public VarzListNode {
+ public:
+  explicit VarzLatency(const char* varname) : VarzListNode(varname) {
+  }
+
+  void Add(uint64_t value) {
+    hist_.Add(value);
+  }
+
+  base::HdrHistogram::Snapshot Read() const {
+    return hist_.Read();
+  }
+
+ private:
+  virtual AnyValue GetData() const override;
+
+  base::HdrHistogram hist_;
+};
+
+/**
+  Family of latency distributions over a sliding window, exposes the count, the mean and the
+  main percentiles of every key. Add() records into a lock-free HdrHistogram of the key under
+  the shared lock of the key lookup.
+
+  The window is formed by the reads: they keep snapshots of the cumulative histograms, a few
+  per window, and report the difference from the newest snapshot that is at least window_sec
+  old. If the histogram is read less often than every window_sec, the values since the
+  previous read are reported.
+**/
+class VarzMapHistogram : public VarzListNode {
+  struct Entry {
+    base::HdrHistogram hist;
+    uint64_t created_sec = 0;  // Monotonic.
+
+    // Cumulative snapshots taken by the reads with their monotonic time, oldest first.
+    // Guarded by read_mu_.
+    std::deque<std::pair<uint64_t, base::HdrHistogram::Snapshot>> history;
+  };
+  typedef StringPieceDenseMap<Entry*> Map;
+
+ public:
+  explicit VarzMapHistogram(const char* varname, unsigned window_sec = 60);
+
+  void Add(StringPiece key, uint64_t value);
+
+  // All the values of the key, not limited to the window.
+  base::HdrHistogram::Snapshot Read(StringPiece key) const;
+
+ private:
+  virtual AnyValue GetData() const override;
+
+  Map::iterator ReadLockAndFindOrInsert(StringPiece key);
+
+  const unsigned window_sec_;
 
-  std::atomic_long val_;
+  mutable base::DistributedRWLock rw_lock_;
+  Map map_;
+  std::deque<Entry> entries_;  // Guarded by the exclusive lock.
+
+  mutable std::mutex read_mu_;  // Serializes the reads that update the snapshots.
 };
 
 class VarzQps : public VarzListNode {
@@ -91,6 +221,10 @@ class VarzQps : public VarzListNode {
     val_.Inc();
   }
 
+  void IncBy(int32 delta) {
+    val_.IncBy(delta);
+  }
+
  private:
   virtual AnyValue GetData() const override;
 
@@ -135,6 +269,12 @@ template <int N> class FastVarMapCounter {
     strcpy(suffix_, suffix);
     map_count_.IncBy(buf_, val);
   }
+
+  // Resolve the hot keys once and increment them through the handles.
+  VarzMapCount::Handle GetHandle(const char* suffix) {
+    strcpy(suffix_, suffix);
+    return map_count_.GetHandle(buf_);
+  }
 };
 
 }  // namespace util
@@ -3,9 +3,12 @@
 //
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "base/histogram.h"
+
 namespace util {
 
 class VarzValue {
@@ -18,8 +21,9 @@ class VarzValue {
   double dbl;
   Map key_value_array;
   std::string str;
+  std::shared_ptr<const base::Histogram> hist;
 
-  enum Type { NUM, STRING, MAP, DOUBLE, TIME } type;
+  enum Type { NUM, STRING, MAP, DOUBLE, TIME, HISTOGRAM } type;
 
   VarzValue(std::string s) : str(std::move(s)), type(STRING) {
   }
@@ -43,9 +47,15 @@ class VarzValue {
     return VarzValue{n, NUM};
   }
 
+  // Exported as a native histogram by /metrics and as its percentiles by the status page.
+  static VarzValue FromHistogram(base::Histogram h) {
+    return VarzValue{std::make_shared<const base::Histogram>(std::move(h))};
+  }
+
  private:
   VarzValue(int64_t n, Type t) : num(n), type(t) {}
   VarzValue(double d) : dbl(d), type(DOUBLE) {}
+  VarzValue(std::shared_ptr<const base::Histogram> h) : hist(std::move(h)), type(HISTOGRAM) {}
 };
 
 }  // namespace util
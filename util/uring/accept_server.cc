@@ -4,9 +4,12 @@
 
 #include "util/uring/accept_server.h"
 
+#include <linux/filter.h>
+
 #include <boost/fiber/operations.hpp>
 
 #include "base/logging.h"
+#include "base/numa.h"
 #include "util/uring/fiber_socket.h"
 #include "util/uring/proactor_pool.h"
 #include "util/uring/uring_fiber_algo.h"
@@ -24,6 +27,25 @@ using ListType =
     intrusive::slist<Connection, Connection::member_hook_t, intrusive::constant_time_size<true>,
                      intrusive::cache_last<false>>;
 
+namespace {
+
+// Directs the connections of a SO_REUSEPORT group to the socket with the index of the
+// receiving CPU modulo the group size.
+void AttachCpuSteering(int fd, unsigned num_socks) {
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU)},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_socks},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog = {.len = arraysize(code), .filter = code};
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+    LOG(WARNING) << "Could not attach the reuseport steering program: " << strerror(errno);
+  }
+}
+
+}  // namespace
+
 struct ListenerInterface::SafeConnList {
   ListType list;
   fibers::mutex mu;
@@ -113,6 +135,9 @@ unsigned short AcceptServer::AddListener(unsigned short port, ListenerInterface*
 
   FiberSocket fs;
   uint32_t sock_opt_mask = lii->GetSockOptMask();
+  if (reuse_port_)
+    sock_opt_mask |= 1 << SO_REUSEPORT;
+
   auto ec = fs.Listen(port, backlog_, sock_opt_mask);
   CHECK(!ec) << "Could not open port " << port << " " << ec << "/" << ec.message();
 
@@ -120,6 +145,20 @@ unsigned short AcceptServer::AddListener(unsigned short port, ListenerInterface*
   lii->RegisterPool(pool_);
 
   Proactor* next = pool_->GetNextProactor();
+  if (reuse_port_) {
+    // The i-th socket of the group belongs to the i-th proactor.
+    next = &pool_->at(0);
+    for (unsigned i = 1; i < pool_->size(); ++i) {
+      FiberSocket rs;
+      ec = rs.Listen(ep.port(), backlog_, sock_opt_mask);
+      CHECK(!ec) << "Could not open port " << ep.port() << " " << ec << "/" << ec.message();
+      rs.set_proactor(&pool_->at(i));
+      lii->reuse_port_listeners_.push_back(std::move(rs));
+    }
+
+    if (steer_by_cpu_)
+      AttachCpuSteering(fs.native_handle(), pool_->size());
+  }
   fs.set_proactor(next);
   lii->listener_ = std::move(fs);
 
@@ -132,6 +171,10 @@ void AcceptServer::BreakListeners() {
   for (auto& lw : list_interface_) {
     auto* proactor = lw->listener_.proactor();
     proactor->AsyncBrief([sock = &lw->listener_] { sock->Shutdown(SHUT_RDWR); });
+
+    for (auto& rs : lw->reuse_port_listeners_) {
+      rs.proactor()->AsyncBrief([sock = &rs] { sock->Shutdown(SHUT_RDWR); });
+    }
   }
   VLOG(1) << "AcceptServer::BreakListeners finished";
 }
@@ -147,9 +190,48 @@ void ListenerInterface::RunAcceptLoop() {
 
   PreAcceptLoop(listener_.proactor());
 
+  if (reuse_port_listeners_.empty()) {
+    AcceptLoop(&listener_, false, &safe_list);
+  } else {
+    fibers_ext::BlockingCounter bc(reuse_port_listeners_.size());
+    for (auto& rs : reuse_port_listeners_) {
+      rs.proactor()->AsyncFiber([this, sock = &rs, &safe_list, bc]() mutable {
+        this_fiber::properties<UringFiberProps>().set_name("AcceptLoop");
+        AcceptLoop(sock, true, &safe_list);
+        bc.Dec();
+      });
+    }
+    AcceptLoop(&listener_, true, &safe_list);
+    bc.Wait();
+  }
+
+  PreShutdown();
+
+  safe_list.mu.lock();
+  unsigned cnt = 0;
+  for (auto& val : safe_list.list) {
+    val.socket_.Shutdown(SHUT_RDWR);
+    DVSOCK(1, val.socket_) << "Shutdown";
+    ++cnt;
+  }
+
+  safe_list.mu.unlock();
+
+  VLOG(1) << "Waiting for " << cnt << " connections to close";
+  safe_list.AwaitEmpty();
+
+  PostShutdown();
+
+  LOG(INFO) << "Listener stopped for port " << ep.port();
+}
+
+
+void ListenerInterface::AcceptLoop(FiberSocket* sock, bool local, SafeConnList* list) {
+  MultishotAcceptor acceptor(sock);
+
   while (true) {
     FiberSocket peer;
-    std::error_code ec = listener_.Accept(&peer);
+    std::error_code ec = acceptor.Accept(&peer);
     if (ec == errc::connection_aborted)
       break;
 
@@ -158,43 +240,45 @@ void ListenerInterface::RunAcceptLoop() {
       break;
     }
     VLOG(2) << "Accepted " << peer.native_handle() << ": " << peer.LocalEndpoint();
-    Proactor* next = pool_->GetNextProactor();  // Could be for another thread.
+
+    // Could be for another thread unless the connection is served locally.
+    Proactor* next = local ? sock->proactor() : NextProactor(peer);
 
     peer.set_proactor(next);
+    peer.set_recv_timeout(idle_timeout_ms_);
     Connection* conn = NewConnection(next);
     conn->SetSocket(std::move(peer));
-    safe_list.Link(conn);
+    list->Link(conn);
+
+    if (local) {
+      fibers::fiber(&RunSingleConnection, conn, list).detach();
+      continue;
+    }
 
     // mutable because we move peer.
-    auto cb = [conn, next, &safe_list]() mutable {
-      next->AsyncFiber(&RunSingleConnection, conn, &safe_list);
+    auto cb = [conn, next, list]() mutable {
+      next->AsyncFiber(&RunSingleConnection, conn, list);
     };
 
     // Run cb in its Proactor thread.
     next->AsyncFiber(std::move(cb));
   }
+}
 
-  PreShutdown();
-
-  safe_list.mu.lock();
-  unsigned cnt = 0;
-  for (auto& val : safe_list.list) {
-    val.socket_.Shutdown(SHUT_RDWR);
-    DVSOCK(1, val.socket_) << "Shutdown";
-    ++cnt;
-  }
-
-  safe_list.mu.unlock();
-
-  VLOG(1) << "Waiting for " << cnt << " connections to close";
-  safe_list.AwaitEmpty();
+Proactor* ListenerInterface::NextProactor(const FiberSocket& peer) {
+  if (!pool_->numa_aware())
+    return pool_->GetNextProactor();
 
-  PostShutdown();
+  // The cpu that processed the packets of the connection, which is served by the NIC queue
+  // whose interrupts are bound to it. Its node holds the receive buffers.
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  if (getsockopt(peer.native_handle(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0 || cpu < 0)
+    return pool_->GetNextProactor();
 
-  LOG(INFO) << "Listener stopped for port " << ep.port();
+  return pool_->GetNextProactor(base::NumaTopology::Get().NodeOfCpu(cpu));
 }
 
-
 ListenerInterface::~ListenerInterface() {
   VLOG(1) << "Destroying ListenerInterface " << this;
 }
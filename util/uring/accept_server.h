@@ -43,6 +43,16 @@ class AcceptServer {
     backlog_ = backlog;
   }
 
+  //! Applies to the listeners added afterwards. With reuse_port, AddListener binds a
+  //! SO_REUSEPORT socket per proactor and each proactor accepts and serves its connections
+  //! locally instead of handing them off from a single accept loop. With steer_by_cpu,
+  //! a BPF program directs a connection to the listener of the CPU that received it, which
+  //! matches the proactor pinned to that CPU when the pool has a thread per CPU.
+  void set_reuse_port(bool reuse_port, bool steer_by_cpu = false) {
+    reuse_port_ = reuse_port;
+    steer_by_cpu_ = steer_by_cpu;
+  }
+
  private:
 
   void BreakListeners();
@@ -57,6 +67,8 @@ class AcceptServer {
 
   bool was_run_ = false;
   bool break_ = false;
+  bool reuse_port_ = false;
+  bool steer_by_cpu_ = false;
 
   uint16_t backlog_ = 128;
 };
@@ -90,6 +102,13 @@ class ListenerInterface {
 
   virtual uint32_t GetSockOptMask() const { return 1 << SO_REUSEADDR; }
 
+  //! Closes the connections that do not receive data for ms milliseconds: their sockets fail
+  //! Recv with std::errc::timed_out. The timers live in the proactor wheels, so idle
+  //! connections cost no SQEs. 0 disables the timeout. Must be set before AcceptServer::Run.
+  void set_idle_timeout(uint32_t ms) {
+    idle_timeout_ms_ = ms;
+  }
+
  protected:
   ProactorPool* pool() {
     return pool_;
@@ -101,11 +120,22 @@ class ListenerInterface {
   struct SafeConnList;
 
   void RunAcceptLoop();
+
+  // If local is true, the connections are served by the proactor of sock.
+  void AcceptLoop(FiberSocket* sock, bool local, SafeConnList* list);
   static void RunSingleConnection(Connection* conn, SafeConnList* list);
 
+  // Picks the proactor to serve peer. Prefers the NUMA node that receives its packets when the
+  // pool spans several nodes.
+  Proactor* NextProactor(const FiberSocket& peer);
+
   FiberSocket listener_;
 
+  // The listeners of the other proactors in SO_REUSEPORT mode.
+  std::vector<FiberSocket> reuse_port_listeners_;
+
   ProactorPool* pool_ = nullptr;
+  uint32_t idle_timeout_ms_ = 0;
   friend class AcceptServer;
 };
 
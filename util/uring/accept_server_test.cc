@@ -33,7 +33,7 @@ void TestConnection::HandleRequests() {
 
   while (true) {
     asa.read_some(asio::buffer(buf), ec);
-    if (ec == std::errc::connection_aborted)
+    if (ec == std::errc::connection_aborted || ec == std::errc::timed_out)
       break;
 
     CHECK(!ec) << ec << "/" << ec.message();
@@ -117,6 +117,158 @@ TEST_F(AcceptServerTest, Basic) {
   bc.Wait();
 }
 
+TEST_F(AcceptServerTest, RecvProvided) {
+  client_sock_.proactor()->AwaitBlocking([&] {
+    auto send_res = client_sock_.Send(asio::buffer("foo", 3));
+    ASSERT_TRUE(send_res) << send_res.error();
+
+    // TestConnection echoes its whole read buffer.
+    string echo;
+    while (echo.size() < 3) {
+      auto recv_res = client_sock_.RecvProvided();
+      ASSERT_TRUE(recv_res) << recv_res.error();
+      echo.append(reinterpret_cast<char*>(recv_res->data), recv_res->size);
+      client_sock_.ReturnProvided(*recv_res);
+    }
+    EXPECT_EQ("foo", echo.substr(0, 3));
+  });
+}
+
+TEST_F(AcceptServerTest, MultishotRecv) {
+  client_sock_.proactor()->AwaitBlocking([&] {
+    MultishotReceiver receiver(&client_sock_);
+    string echo;
+
+    // TestConnection echoes its whole read buffer of 128 bytes per request.
+    for (const char* msg : {"foo", "bar"}) {
+      auto send_res = client_sock_.Send(asio::buffer(msg, 3));
+      ASSERT_TRUE(send_res) << send_res.error();
+
+      size_t expected = echo.size() + 128;
+      while (echo.size() < expected) {
+        auto recv_res = receiver.Recv();
+        ASSERT_TRUE(recv_res) << recv_res.error();
+        echo.append(reinterpret_cast<char*>(recv_res->data), recv_res->size);
+        client_sock_.ReturnProvided(*recv_res);
+      }
+    }
+    EXPECT_EQ("foo", echo.substr(0, 3));
+    EXPECT_EQ("bar", echo.substr(128, 3));
+  });
+}
+
+TEST_F(AcceptServerTest, SendZc) {
+  client_sock_.proactor()->AwaitBlocking([&] {
+    string data(1 << 16, 'a');
+    fibers_ext::Done released;
+    iovec v{&data[0], data.size()};
+    auto send_res = client_sock_.SendZc(&v, 1, [released]() mutable { released.Notify(); });
+    ASSERT_TRUE(send_res) << send_res.error();
+    EXPECT_GT(*send_res, 0);
+    released.Wait();
+
+    char buf[16];
+    auto recv_res = client_sock_.Recv(asio::buffer(buf));
+    ASSERT_TRUE(recv_res) << recv_res.error();
+    EXPECT_EQ('a', buf[0]);
+  });
+}
+
+TEST_F(AcceptServerTest, Deadline) {
+  client_sock_.proactor()->AwaitBlocking([&] {
+    char buf[16];
+    iovec v{buf, sizeof(buf)};
+    auto start = chrono::steady_clock::now();
+
+    // The server sends nothing until it receives.
+    auto recv_res = client_sock_.Recv(&v, 1, start + 10ms);
+    ASSERT_FALSE(recv_res);
+    EXPECT_EQ(std::errc::timed_out, recv_res.error());
+    EXPECT_GE(chrono::steady_clock::now() - start, 10ms);
+
+    iovec sv{const_cast<char*>("foo"), 3};
+    auto send_res = client_sock_.Send(&sv, 1, chrono::steady_clock::now() + 1s);
+    ASSERT_TRUE(send_res) << send_res.error();
+
+    recv_res = client_sock_.Recv(&v, 1, chrono::steady_clock::now() + 1s);
+    ASSERT_TRUE(recv_res) << recv_res.error();
+    EXPECT_EQ('f', buf[0]);
+  });
+}
+
+TEST_F(AcceptServerTest, ReusePort) {
+  constexpr unsigned kNumClients = 8;
+
+  AcceptServer server(pp_.get(), false);
+  server.set_reuse_port(true, true);
+  uint16_t port = server.AddListener(0, new TestListener);
+  server.Run();
+
+  asio::ip::tcp::endpoint ep{asio::ip::make_address("127.0.0.1"), port};
+  BlockingCounter bc(kNumClients);
+  for (unsigned i = 0; i < kNumClients; ++i) {
+    Proactor* p = pp_->GetNextProactor();
+    p->AsyncFiber([&, p] {
+      FiberSocket fs;
+      fs.set_proactor(p);
+      ASSERT_FALSE(fs.Connect(ep));
+
+      auto send_res = fs.Send(asio::buffer("foo", 3));
+      ASSERT_TRUE(send_res) << send_res.error();
+
+      char buf[8];
+      iovec v{buf, sizeof(buf)};
+      auto recv_res = fs.Recv(&v, 1);
+      ASSERT_TRUE(recv_res) << recv_res.error();
+      EXPECT_EQ('f', buf[0]);
+      ASSERT_FALSE(fs.Close());
+      bc.Dec();
+    });
+  }
+  bc.Wait();
+
+  server.Stop(true);
+}
+
+TEST_F(AcceptServerTest, IdleTimeout) {
+  AcceptServer server(pp_.get(), false);
+  TestListener* listener = new TestListener;
+  listener->set_idle_timeout(20);
+  uint16_t port = server.AddListener(0, listener);
+  server.Run();
+
+  asio::ip::tcp::endpoint ep{asio::ip::make_address("127.0.0.1"), port};
+  Proactor* p = pp_->GetNextProactor();
+  p->AwaitBlocking([&] {
+    FiberSocket fs;
+    fs.set_proactor(p);
+    ASSERT_FALSE(fs.Connect(ep));
+
+    // An active connection is kept.
+    for (unsigned i = 0; i < 3; ++i) {
+      this_fiber::sleep_for(10ms);
+      auto send_res = fs.Send(asio::buffer("foo", 3));
+      ASSERT_TRUE(send_res) << send_res.error();
+
+      char buf[8];
+      iovec v{buf, sizeof(buf)};
+      auto recv_res = fs.Recv(&v, 1);
+      ASSERT_TRUE(recv_res) << recv_res.error();
+    }
+
+    // The server closes the idle one.
+    auto start = chrono::steady_clock::now();
+    char buf[8];
+    iovec v{buf, sizeof(buf)};
+    auto recv_res = fs.Recv(&v, 1, start + 1s);
+    ASSERT_FALSE(recv_res);
+    EXPECT_TRUE(FiberSocket::IsConnClosed(recv_res.error())) << recv_res.error();
+    EXPECT_LT(chrono::steady_clock::now() - start, 1s);
+  });
+
+  server.Stop(true);
+}
+
 TEST_F(AcceptServerTest, Break) {
   usleep(1000);
   as_->Stop(true);
@@ -0,0 +1,127 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <boost/fiber/context.hpp>
+#include <vector>
+
+#include "base/logging.h"
+#include "util/uring/proactor.h"
+
+namespace util {
+namespace uring {
+
+// Submits a single SQE from the calling fiber and suspends the fiber in Get() until
+// the completion arrives. Must be used within the proactor thread.
+class FiberCall {
+  SubmitEntry se_;
+  ::boost::fibers::context* me_;
+  Proactor::IoResult io_res_;
+  uint32_t flags_ = 0;
+  uint64_t user_data_;
+  bool completed_ = false;
+
+ public:
+  FiberCall(Proactor* proactor) : me_(::boost::fibers::context::active()), io_res_(0) {
+    auto waker = [this](Proactor::IoResult res, int32_t, Proactor* mgr) {
+      io_res_ = res;
+      flags_ = mgr->cqe_flags();
+      completed_ = true;
+      ::boost::fibers::context::active()->schedule(me_);
+    };
+    se_ = proactor->GetSubmitEntry(std::move(waker), 0);
+    user_data_ = se_.sqe()->user_data;
+  }
+
+  ~FiberCall() {
+    CHECK(!me_) << "Get was not called!";
+  }
+
+  SubmitEntry* operator->() {
+    return &se_;
+  }
+
+  Proactor::IoResult Get() {
+    me_->suspend();
+    me_ = nullptr;
+
+    return io_res_;
+  }
+
+  // The flags of the completion, valid after Get().
+  uint32_t flags() const {
+    return flags_;
+  }
+
+  // Identifies the request for Proactor::CancelRequest() until it completes.
+  uint64_t user_data() const {
+    return user_data_;
+  }
+
+  bool completed() const {
+    return completed_;
+  }
+};
+
+// Submits a batch of SQEs from the calling fiber with a single completion entry and suspends
+// the fiber once in Get() until all of them complete. If link is true, the SQEs are chained
+// with IOSQE_IO_LINK in their order, so a failure cancels the rest of the chain.
+// Must be used within the proactor thread.
+class FiberBatch {
+  ::boost::fibers::context* me_;
+  std::vector<SubmitEntry> entries_;
+  std::vector<Proactor::IoResult> results_;
+  unsigned pending_;
+  bool link_;
+
+ public:
+  FiberBatch(Proactor* proactor, unsigned count, bool link = false)
+      : me_(::boost::fibers::context::active()), entries_(count), results_(count),
+        pending_(count), link_(link) {
+    auto waker = [this](Proactor::IoResult res, int64_t pos, Proactor*) {
+      results_[pos] = res;
+      if (--pending_ == 0)
+        ::boost::fibers::context::active()->schedule(me_);
+    };
+    proactor->GetSubmitEntries(count, std::move(waker), entries_.data());
+  }
+
+  ~FiberBatch() {
+    CHECK(!me_) << "Get was not called!";
+  }
+
+  unsigned size() const {
+    return entries_.size();
+  }
+
+  SubmitEntry& operator[](unsigned i) {
+    return entries_[i];
+  }
+
+  // Suspends until all the SQEs complete. Returns the first negative result or 0.
+  Proactor::IoResult Get() {
+    if (link_) {
+      for (unsigned i = 0; i + 1 < entries_.size(); ++i) {
+        entries_[i].sqe()->flags |= IOSQE_IO_LINK;
+      }
+    }
+    me_->suspend();
+    me_ = nullptr;
+
+    for (Proactor::IoResult res : results_) {
+      if (res < 0)
+        return res;
+    }
+    return 0;
+  }
+
+  // The result of the i-th SQE, valid after Get().
+  Proactor::IoResult result(unsigned i) const {
+    return results_[i];
+  }
+};
+
+}  // namespace uring
+}  // namespace util
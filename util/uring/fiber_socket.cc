@@ -4,14 +4,23 @@
 
 #include "util/uring/fiber_socket.h"
 
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/poll.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <boost/fiber/context.hpp>
+#include <memory>
 
+#include "absl/types/optional.h"
 #include "base/logging.h"
 #include "base/stl_util.h"
-#include "util/uring/proactor.h"
+#include "util/fibers/fibers_ext.h"
+#include "util/uring/fiber_call.h"
+
+DEFINE_uint32(uring_send_zc_threshold, 0, "If positive, FiberSocket::Send sends the buffers "
+                                          "of that many bytes or more with zero-copy");
 
 #define VSOCK(verbosity) VLOG(verbosity) << "sock[" << native_handle() << "] "
 #define DVSOCK(verbosity) DVLOG(verbosity) << "sock[" << native_handle() << "] "
@@ -25,44 +34,63 @@ using IoResult = Proactor::IoResult;
 
 namespace {
 
-class FiberCall {
-  SubmitEntry se_;
-  fibers::context* me_;
-  IoResult io_res_;
-
- public:
-  FiberCall(Proactor* proactor) : me_(fibers::context::active()), io_res_(0) {
-    auto waker = [this](IoResult res, int32_t, Proactor* mgr) {
-      io_res_ = res;
-      fibers::context::active()->schedule(me_);
-    };
-    se_ = proactor->GetSubmitEntry(std::move(waker), 0);
-  }
+constexpr int kSplicePipeSize = 1 << 20;
 
-  ~FiberCall() {
-    CHECK(!me_) << "Get was not called!";
+inline ssize_t posix_err_wrap(ssize_t res, FiberSocket::error_code* ec) {
+  if (res == -1) {
+    *ec = FiberSocket::error_code(errno, std::system_category());
+  } else if (res < 0) {
+    LOG(WARNING) << "Bad posix error " << res;
   }
+  return res;
+}
 
-  SubmitEntry* operator->() {
-    return &se_;
+// Cancels the request of a FiberCall once the deadline expires. Must be destroyed before
+// the FiberCall.
+class DeadlineTimer : public base::TimerEventInterface {
+ public:
+  DeadlineTimer(Proactor* p, const FiberCall* fc, FiberSocket::deadline_t deadline)
+      : p_(p), fc_(fc) {
+    auto left = deadline - chrono::steady_clock::now();
+    int64_t ms = (chrono::duration_cast<chrono::microseconds>(left).count() + 999) / 1000;
+    p->AddTimer(this, ms > 0 ? ms : 0);
   }
 
-  IoResult Get() {
-    me_->suspend();
-    me_ = nullptr;
+ private:
+  void execute() final {
+    if (fc_->completed())
+      return;
 
-    return io_res_;
+    // Retry on the next tick if the submission queue is full.
+    if (!p_->CancelRequest(fc_->user_data()))
+      p_->AddTimer(this, 1);
   }
+
+  Proactor* p_;
+  const FiberCall* fc_;
 };
 
-inline ssize_t posix_err_wrap(ssize_t res, FiberSocket::error_code* ec) {
-  if (res == -1) {
-    *ec = FiberSocket::error_code(errno, std::system_category());
-  } else if (res < 0) {
-    LOG(WARNING) << "Bad posix error " << res;
+// Used by RecvProvided when the buffer ring is not available.
+constexpr size_t kHeapRecvSize = 8192;
+
+// Cleared once a kernel rejects SENDMSG_ZC.
+std::atomic_bool zc_supported{true};
+
+struct ZcState {
+  std::function<void()> on_release;
+  fibers::context* waiter = nullptr;
+  IoResult res = 0;
+  unsigned pending_notifs = 0;
+  bool finished = false;
+
+  void MaybeRelease() {
+    if (finished && pending_notifs == 0 && on_release) {
+      auto f = std::move(on_release);
+      on_release = nullptr;
+      f();
+    }
   }
-  return res;
-}
+};
 
 }  // namespace
 
@@ -80,6 +108,8 @@ FiberSocket& FiberSocket::operator=(FiberSocket&& other) noexcept {
   DCHECK_EQ(-1, fd_);
 
   swap(fd_, other.fd_);
+  swap(fixed_fd_, other.fixed_fd_);
+  recv_timeout_ms_ = other.recv_timeout_ms_;
   p_ = other.p_;
   other.p_ = nullptr;
 
@@ -106,12 +136,44 @@ auto FiberSocket::Close() -> error_code {
   if (fd_ > 0) {
     DVSOCK(1) << "Closing socket";
 
+    // The fixed-file table holds a reference to the socket, without unregistering
+    // close would not release it.
+    UnregisterFixedFd();
     posix_err_wrap(::close(fd_ & FD_MASK), &ec);
     fd_ = -1;
   }
   return ec;
 }
 
+void FiberSocket::Detach() {
+  UnregisterFixedFd();
+  fd_ = -1;
+}
+
+void FiberSocket::set_proactor(Proactor* p) {
+  DCHECK(fixed_fd_ < 0 || p == p_) << "The socket is registered with another proactor";
+  p_ = p;
+}
+
+int FiberSocket::SubmitFd(bool* fixed) {
+  DCHECK(p_->InMyThread());
+
+  if (fixed_fd_ < 0)
+    fixed_fd_ = p_->RegisterFd(fd_ & FD_MASK);
+
+  *fixed = fixed_fd_ >= 0;
+  return *fixed ? fixed_fd_ : fd_ & FD_MASK;
+}
+
+void FiberSocket::UnregisterFixedFd() {
+  if (fixed_fd_ < 0)
+    return;
+
+  unsigned index = fixed_fd_;
+  fixed_fd_ = -1;
+  p_->UnregisterFd(index);
+}
+
 auto FiberSocket::Listen(unsigned port, unsigned backlog, uint32_t sock_opts_mask) -> error_code {
   CHECK_EQ(fd_, -1) << "Close socket before!";
 
@@ -178,6 +240,14 @@ auto FiberSocket::Accept(FiberSocket* peer) -> error_code {
 }
 
 auto FiberSocket::Connect(const endpoint_type& ep) -> error_code {
+  return ConnectImpl(ep, nullptr);
+}
+
+auto FiberSocket::Connect(const endpoint_type& ep, deadline_t deadline) -> error_code {
+  return ConnectImpl(ep, &deadline);
+}
+
+auto FiberSocket::ConnectImpl(const endpoint_type& ep, const deadline_t* deadline) -> error_code {
   CHECK_EQ(fd_, -1);
   CHECK(p_ && p_->InMyThread());
 
@@ -190,13 +260,21 @@ auto FiberSocket::Connect(const endpoint_type& ep) -> error_code {
   FiberCall fc(p_);
   fc->PrepConnect(fd_, ep.data(), ep.size());
 
+  absl::optional<DeadlineTimer> timer;
+  if (deadline)
+    timer.emplace(p_, &fc, *deadline);
+
   IoResult io_res = fc.Get();
   if (io_res < 0) {  // In that case connect returns -errno.
     if (close(fd_) < 0) {
       LOG(WARNING) << "Could not close fd " << strerror(errno);
     }
     fd_ = -1;
-    ec = error_code(-io_res, system::system_category());
+    if (deadline && io_res == -ECANCELED) {
+      ec = std::make_error_code(std::errc::timed_out);
+    } else {
+      ec = error_code(-io_res, system::system_category());
+    }
   }
   return ec;
 }
@@ -229,11 +307,38 @@ auto FiberSocket::RemoteEndpoint() const -> endpoint_type {
 }
 
 auto FiberSocket::Send(const iovec* ptr, size_t len) -> expected_size_t {
+  if (FLAGS_uring_send_zc_threshold) {
+    size_t total = 0;
+    for (size_t i = 0; i < len; ++i)
+      total += ptr[i].iov_len;
+
+    if (total >= FLAGS_uring_send_zc_threshold) {
+      fibers_ext::Done released;
+      expected_size_t res = SendZc(ptr, len, [released]() mutable { released.Notify(); });
+      released.Wait();
+      return res;
+    }
+  }
+  return SendMsg(ptr, len, nullptr);
+}
+
+auto FiberSocket::Send(const iovec* ptr, size_t len, deadline_t deadline) -> expected_size_t {
+  return SendMsg(ptr, len, &deadline);
+}
+
+auto FiberSocket::SendZc(const iovec* ptr, size_t len, std::function<void()> on_release)
+    -> expected_size_t {
   CHECK(p_);
   CHECK_GT(len, 0);
   CHECK_GE(fd_, 0);
 
+  if (!zc_supported.load(std::memory_order_relaxed)) {
+    expected_size_t res = SendMsg(ptr, len, nullptr);
+    on_release();
+    return res;
+  }
   if (fd_ & IS_SHUTDOWN) {
+    on_release();
     return nonstd::make_unexpected(std::make_error_code(std::errc::connection_aborted));
   }
 
@@ -242,12 +347,108 @@ auto FiberSocket::Send(const iovec* ptr, size_t len) -> expected_size_t {
   msg.msg_iov = const_cast<iovec*>(ptr);
   msg.msg_iovlen = len;
 
+  bool fixed;
+  int fd = SubmitFd(&fixed);
+
+  // A retried send may still wait for the notification of the failed one, therefore
+  // on_release is called only when all of them arrived.
+  auto state = std::make_shared<ZcState>();
+  state->on_release = std::move(on_release);
+
+  auto cb = [state](IoResult res, int64_t, Proactor* p) {
+    uint32_t flags = p->cqe_flags();
+    if (flags & IORING_CQE_F_NOTIF) {
+      --state->pending_notifs;
+      state->MaybeRelease();
+      return;
+    }
+    state->res = res;
+    if (flags & IORING_CQE_F_MORE)
+      ++state->pending_notifs;
+    fibers::context::active()->schedule(std::exchange(state->waiter, nullptr));
+  };
+
   ssize_t res;
-  int fd = fd_ & FD_MASK;
+  while (true) {
+    SubmitEntry se = p_->GetSubmitEntry(cb, 0);
+    se.PrepSendMsgZc(fd, &msg, 0);
+    if (fixed)
+      se.SetFixedFile();
+
+    state->waiter = fibers::context::active();
+    state->waiter->suspend();  // Interrupt point
+    res = state->res;
+    if (res >= 0)
+      break;
+
+    DVSOCK(1) << "Got " << res;
+    res = -res;
+    if (res == EAGAIN || res == EBUSY)
+      continue;
+
+    if (res == EINVAL || res == EOPNOTSUPP) {
+      LOG_FIRST_N(INFO, 1) << "Zero-copy send is not supported: " << strerror(res);
+      zc_supported.store(false, std::memory_order_relaxed);
+      expected_size_t send_res = SendMsg(ptr, len, nullptr);
+      state->finished = true;
+      state->MaybeRelease();
+      return send_res;
+    }
+
+    state->finished = true;
+    state->MaybeRelease();
+
+    if (base::_in(res, {ECONNABORTED, EPIPE, ECONNRESET})) {
+      if (res == EPIPE)
+        res = ECONNABORTED;
+      std::error_code ec(res, std::generic_category());
+      VSOCK(1) << "Error " << ec << " on " << RemoteEndpoint();
+      return nonstd::make_unexpected(std::move(ec));
+    }
+
+    LOG(FATAL) << "Unexpected error " << res << "/" << strerror(res);
+  }
+
+  state->finished = true;
+  state->MaybeRelease();
+  return res;
+}
+
+auto FiberSocket::SendMsg(const iovec* ptr, size_t len, const deadline_t* deadline)
+    -> expected_size_t {
+  CHECK(p_);
+  CHECK_GT(len, 0);
+  CHECK_GE(fd_, 0);
+
+  if (fd_ & IS_SHUTDOWN) {
+    return nonstd::make_unexpected(std::make_error_code(std::errc::connection_aborted));
+  }
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<iovec*>(ptr);
+  msg.msg_iovlen = len;
+
+  ssize_t res;
+  bool fixed;
+  int fd = SubmitFd(&fixed);
+
+  // A single buffer from the registered memory is sent without pinning its pages.
+  int buf_index = len == 1 ? p_->FindRegisteredBuffer(ptr->iov_base, ptr->iov_len) : -1;
 
   while (true) {
     FiberCall fc(p_);
-    fc->PrepSendMsg(fd, &msg, 0);
+    if (buf_index >= 0) {
+      fc->PrepWriteFixed(fd, ptr->iov_base, ptr->iov_len, 0, buf_index);
+    } else {
+      fc->PrepSendMsg(fd, &msg, 0);
+    }
+    if (fixed)
+      fc->SetFixedFile();
+
+    absl::optional<DeadlineTimer> timer;
+    if (deadline)
+      timer.emplace(p_, &fc, *deadline);
     res = fc.Get();  // Interrupt point
     if (res >= 0) {
       return res;  // Fastpath
@@ -257,6 +458,11 @@ auto FiberSocket::Send(const iovec* ptr, size_t len) -> expected_size_t {
     if (res == EAGAIN || res == EBUSY)
       continue;
 
+    if (deadline && res == ECANCELED) {
+      res = ETIMEDOUT;
+      break;
+    }
+
     if (base::_in(res, {ECONNABORTED, EPIPE, ECONNRESET})) {
       if (res == EPIPE)  // We do not care about EPIPE that can happen when we shutdown our socket.
         res = ECONNABORTED;
@@ -271,7 +477,81 @@ auto FiberSocket::Send(const iovec* ptr, size_t len) -> expected_size_t {
   return nonstd::make_unexpected(std::move(ec));
 }
 
+auto FiberSocket::SendFile(int fd, uint64_t offset, size_t length) -> error_code {
+  CHECK(p_);
+  CHECK_GE(fd_, 0);
+
+  if (fd_ & IS_SHUTDOWN) {
+    return std::make_error_code(std::errc::connection_aborted);
+  }
+
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) < 0) {
+    return error_code(errno, std::system_category());
+  }
+
+  // A larger pipe takes more pages per splice, the default one holds 64KB.
+  int pipe_size = fcntl(pipefd[1], F_SETPIPE_SZ, kSplicePipeSize);
+  size_t chunk = pipe_size > 0 ? pipe_size : 1 << 16;
+
+  auto splice = [this](int in, int64_t off_in, int out, size_t len) {
+    FiberCall fc(p_);
+    fc->PrepSplice(in, off_in, out, -1, len, SPLICE_F_MOVE);
+    return fc.Get();  // Interrupt point
+  };
+
+  int sock = native_handle();
+  int res = 0;
+  while (length && !res) {
+    IoResult in = splice(fd, offset, pipefd[1], std::min(length, chunk));
+    if (in <= 0) {
+      res = in < 0 ? -in : EIO;  // 0 means the file is shorter than expected.
+      break;
+    }
+    offset += in;
+    length -= in;
+
+    while (in > 0) {
+      IoResult out = splice(pipefd[0], -1, sock, in);
+      if (out > 0) {
+        in -= out;
+        continue;
+      }
+      res = out < 0 ? -out : ECONNABORTED;
+      if (res == EAGAIN) {
+        res = 0;
+        continue;
+      }
+      if (base::_in(res, {EPIPE, ECONNRESET}))
+        res = ECONNABORTED;
+      break;
+    }
+  }
+
+  close(pipefd[0]);
+  close(pipefd[1]);
+
+  if (!res)
+    return error_code{};
+
+  error_code ec(res, std::generic_category());
+  VSOCK(1) << "SendFile error " << ec << " on " << RemoteEndpoint();
+  return ec;
+}
+
 auto FiberSocket::Recv(iovec* ptr, size_t len) -> expected_size_t {
+  if (recv_timeout_ms_) {
+    deadline_t deadline = chrono::steady_clock::now() + chrono::milliseconds(recv_timeout_ms_);
+    return RecvMsg(ptr, len, &deadline);
+  }
+  return RecvMsg(ptr, len, nullptr);
+}
+
+auto FiberSocket::Recv(iovec* ptr, size_t len, deadline_t deadline) -> expected_size_t {
+  return RecvMsg(ptr, len, &deadline);
+}
+
+auto FiberSocket::RecvMsg(iovec* ptr, size_t len, const deadline_t* deadline) -> expected_size_t {
   CHECK_GT(len, 0);
   CHECK(p_);
   CHECK_GE(fd_, 0);
@@ -284,24 +564,52 @@ auto FiberSocket::Recv(iovec* ptr, size_t len) -> expected_size_t {
   memset(&msg, 0, sizeof(msg));
   msg.msg_iov = const_cast<iovec*>(ptr);
   msg.msg_iovlen = len;
-  int fd = fd_ & FD_MASK;
+  bool fixed;
+  int fd = SubmitFd(&fixed);
+  int buf_index = len == 1 ? p_->FindRegisteredBuffer(ptr->iov_base, ptr->iov_len) : -1;
+
+  ssize_t res;
+
+  // Old kernels without fast-poll need a poll linked before the receive. We wait for it
+  // separately when there is a deadline, cancelling the receive would not cover the poll.
+  bool link_poll = !p_->HasFastPoll();
+  if (link_poll && deadline) {
+    FiberCall fc(p_);
+    fc->PrepPollAdd(fd, POLLIN);
+    if (fixed)
+      fc->SetFixedFile();
+
+    DeadlineTimer timer(p_, &fc, *deadline);
+    res = fc.Get();
+    if (res == -ECANCELED) {
+      return nonstd::make_unexpected(std::make_error_code(std::errc::timed_out));
+    }
+    link_poll = false;
+  }
 
-  // There is a possible data-race bug since GetSubmitEntry can preempt inside
-  // FiberCall, thus introducing a chain with random SQE not from here.
-  //
-  // The bug is not really interesting in this context here since we handle the use-case of old
-  // kernels without fast-poll, however it's problematic for transactions that require SQE chains.
-  // Added TODO to proactor.h
-  if (!p_->HasFastPoll()) {
+  // AwaitSubmitSpace makes sure that the linked entries are allocated without preemption.
+  p_->AwaitSubmitSpace(1 + link_poll);
+  if (link_poll) {
     SubmitEntry se = p_->GetSubmitEntry(nullptr, 0);
     se.PrepPollAdd(fd, POLLIN);
     se.sqe()->flags = IOSQE_IO_LINK;
+    if (fixed)
+      se.SetFixedFile();
   }
 
-  ssize_t res;
   while (true) {
     FiberCall fc(p_);
-    fc->PrepRecvMsg(fd, &msg, 0);
+    if (buf_index >= 0) {
+      fc->PrepReadFixed(fd, ptr->iov_base, ptr->iov_len, 0, buf_index);
+    } else {
+      fc->PrepRecvMsg(fd, &msg, 0);
+    }
+    if (fixed)
+      fc->SetFixedFile();
+
+    absl::optional<DeadlineTimer> timer;
+    if (deadline)
+      timer.emplace(p_, &fc, *deadline);
     res = fc.Get();
 
     if (res > 0) {
@@ -313,6 +621,11 @@ auto FiberSocket::Recv(iovec* ptr, size_t len) -> expected_size_t {
     if (res == EAGAIN || res == EBUSY)
       continue;
 
+    if (deadline && res == ECANCELED) {
+      res = ETIMEDOUT;
+      break;
+    }
+
     if (res == 0)
       res = ECONNABORTED;
 
@@ -330,5 +643,269 @@ auto FiberSocket::Recv(iovec* ptr, size_t len) -> expected_size_t {
   return nonstd::make_unexpected(std::move(ec));
 }
 
+auto FiberSocket::RecvProvided() -> expected_buffer_t {
+  CHECK(p_);
+  CHECK_GE(fd_, 0);
+
+  if (fd_ & IS_SHUTDOWN) {
+    return nonstd::make_unexpected(std::make_error_code(std::errc::connection_aborted));
+  }
+
+  bool fixed;
+  int fd = SubmitFd(&fixed);
+  bool use_ring = p_->HasRecvBufRing();
+  ProvidedBuffer buf;
+  ssize_t res;
+
+  while (true) {
+    if (!use_ring && !buf.data) {
+      // Without the ring we allocate the buffer only once the data arrives.
+      FiberCall fc(p_);
+      fc->PrepPollAdd(fd, POLLIN);
+      if (fixed)
+        fc->SetFixedFile();
+      res = fc.Get();
+      if (res >= 0) {
+        buf.data = new uint8_t[kHeapRecvSize];
+        continue;
+      }
+    } else {
+      FiberCall fc(p_);
+      if (use_ring) {
+        fc->PrepRecv(fd, nullptr, p_->recv_buffer_size(), 0);
+        fc->SetBufferSelect(Proactor::kRecvBufGroup);
+      } else {
+        fc->PrepRecv(fd, buf.data, kHeapRecvSize, 0);
+      }
+      if (fixed)
+        fc->SetFixedFile();
+      res = fc.Get();
+
+      if (fc.flags() & IORING_CQE_F_BUFFER) {
+        buf.bid = fc.flags() >> IORING_CQE_BUFFER_SHIFT;
+        buf.data = p_->GetRecvBuffer(buf.bid);
+      }
+      if (res > 0) {
+        buf.size = res;
+        return buf;
+      }
+      ReturnProvided(buf);
+      buf = ProvidedBuffer{};
+    }
+    DVSOCK(1) << "Got " << res;
+
+    res = -res;
+    if (res == ENOBUFS) {  // The ring is exhausted.
+      use_ring = false;
+      continue;
+    }
+    if (res == EAGAIN || res == EBUSY)
+      continue;
+
+    if (res == 0)
+      res = ECONNABORTED;
+
+    if (base::_in(res, {ECONNABORTED, EPIPE, ECONNRESET})) {
+      break;
+    }
+
+    LOG(FATAL) << "Unexpected error " << res << "/" << strerror(res);
+  }
+  std::error_code ec(res, std::generic_category());
+  VSOCK(1) << "Error " << ec << " on " << RemoteEndpoint();
+
+  return nonstd::make_unexpected(std::move(ec));
+}
+
+void FiberSocket::ReturnProvided(const ProvidedBuffer& buf) {
+  if (buf.bid >= 0) {
+    p_->ReturnRecvBuffer(buf.bid);
+  } else {
+    delete[] buf.data;
+  }
+}
+
+MultishotAcceptor::~MultishotAcceptor() {
+  if (armed_) {
+    SubmitEntry se = listener_->p_->GetSubmitEntry(nullptr, 0);
+    se.PrepCancel(user_data_);
+    while (armed_)
+      Wait();
+  }
+
+  for (int fd : accepted_) {
+    close(fd);
+  }
+}
+
+auto MultishotAcceptor::Accept(FiberSocket* peer) -> std::error_code {
+  DCHECK(listener_->p_->InMyThread());
+
+  while (supported_) {
+    if (!accepted_.empty()) {
+      *peer = FiberSocket{accepted_.front()};
+      accepted_.pop_front();
+      return std::error_code{};
+    }
+
+    if (!listener_->IsOpen())
+      return std::make_error_code(std::errc::connection_aborted);
+
+    if (armed_) {
+      Wait();
+      continue;
+    }
+
+    // The multishot request stopped, we rearm it unless it failed.
+    int err = -last_res_;
+    if (err == EINVAL && num_accepted_ == 0) {
+      LOG_FIRST_N(INFO, 1) << "Multishot accept is not supported, falling back to accept4";
+      supported_ = false;
+      break;
+    }
+
+    if (err > 0 && !base::_in(err, {ECONNABORTED, EAGAIN, EINTR})) {
+      return std::error_code(err, std::system_category());
+    }
+    Arm();
+  }
+
+  return listener_->Accept(peer);
+}
+
+void MultishotAcceptor::Arm() {
+  Proactor* p = listener_->p_;
+
+  auto cb = [this](IoResult res, int64_t, Proactor* p) {
+    if (res >= 0) {
+      accepted_.push_back(res);
+      ++num_accepted_;
+    } else {
+      last_res_ = res;
+    }
+
+    if ((p->cqe_flags() & IORING_CQE_F_MORE) == 0)
+      armed_ = false;
+
+    if (waiter_) {
+      fibers::context::active()->schedule(std::exchange(waiter_, nullptr));
+    }
+  };
+
+  SubmitEntry se = p->GetSubmitEntry(std::move(cb), 0);
+  se.PrepAccept(listener_->native_handle(), SOCK_NONBLOCK | SOCK_CLOEXEC, true);
+  user_data_ = se.sqe()->user_data;
+  last_res_ = 0;
+  armed_ = true;
+}
+
+void MultishotAcceptor::Wait() {
+  waiter_ = fibers::context::active();
+  waiter_->suspend();
+}
+
+MultishotReceiver::~MultishotReceiver() {
+  if (armed_) {
+    SubmitEntry se = sock_->p_->GetSubmitEntry(nullptr, 0);
+    se.PrepCancel(user_data_);
+    while (armed_)
+      Wait();
+  }
+
+  for (const Completion& c : completions_) {
+    if (c.flags & IORING_CQE_F_BUFFER)
+      sock_->p_->ReturnRecvBuffer(c.flags >> IORING_CQE_BUFFER_SHIFT);
+  }
+}
+
+auto MultishotReceiver::Recv() -> FiberSocket::expected_buffer_t {
+  Proactor* p = sock_->p_;
+  DCHECK(p->InMyThread());
+
+  while (supported_) {
+    if (!completions_.empty()) {
+      Completion c = completions_.front();
+      completions_.pop_front();
+
+      if (c.res > 0) {
+        DCHECK(c.flags & IORING_CQE_F_BUFFER);
+        ++num_received_;
+        FiberSocket::ProvidedBuffer buf;
+        buf.bid = c.flags >> IORING_CQE_BUFFER_SHIFT;
+        buf.data = p->GetRecvBuffer(buf.bid);
+        buf.size = c.res;
+        return buf;
+      }
+
+      if (c.res == 0)
+        return nonstd::make_unexpected(std::make_error_code(std::errc::connection_aborted));
+
+      int err = -c.res;
+      if (err == EINVAL && num_received_ == 0) {
+        LOG_FIRST_N(INFO, 1) << "Multishot recv is not supported, falling back to recv";
+        supported_ = false;
+        break;
+      }
+
+      // The ring is exhausted, this chunk of data goes into a heap buffer and the request
+      // is rearmed by the next call.
+      if (err == ENOBUFS)
+        return sock_->RecvProvided();
+
+      if (base::_in(err, {ECANCELED, EAGAIN, EINTR}))
+        continue;
+
+      if (base::_in(err, {ECONNABORTED, EPIPE, ECONNRESET}))
+        err = ECONNABORTED;
+      return nonstd::make_unexpected(std::error_code(err, std::generic_category()));
+    }
+
+    if (!sock_->IsOpen())
+      return nonstd::make_unexpected(std::make_error_code(std::errc::connection_aborted));
+
+    if (armed_) {
+      Wait();
+      continue;
+    }
+
+    if (!p->HasRecvBufRing()) {
+      supported_ = false;
+      break;
+    }
+    Arm();
+  }
+
+  return sock_->RecvProvided();
+}
+
+void MultishotReceiver::Arm() {
+  Proactor* p = sock_->p_;
+
+  auto cb = [this](IoResult res, int64_t, Proactor* p) {
+    completions_.push_back(Completion{res, p->cqe_flags()});
+
+    if ((p->cqe_flags() & IORING_CQE_F_MORE) == 0)
+      armed_ = false;
+
+    if (waiter_) {
+      fibers::context::active()->schedule(std::exchange(waiter_, nullptr));
+    }
+  };
+
+  bool fixed;
+  int fd = sock_->SubmitFd(&fixed);
+  SubmitEntry se = p->GetSubmitEntry(std::move(cb), 0);
+  se.PrepRecvMultishot(fd, Proactor::kRecvBufGroup);
+  if (fixed)
+    se.SetFixedFile();
+  user_data_ = se.sqe()->user_data;
+  armed_ = true;
+}
+
+void MultishotReceiver::Wait() {
+  waiter_ = fibers::context::active();
+  waiter_->suspend();
+}
+
 }  // namespace uring
 }  // namespace util
@@ -6,9 +6,15 @@
 
 #include <liburing/io_uring.h>
 
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <functional>
+
 // for tcp::endpoint. Consider introducing our own.
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/fiber/context.hpp>
 
 #include "absl/base/attributes.h"
 #include "util/sync_stream_interface.h"
@@ -17,6 +23,7 @@ namespace util {
 namespace uring {
 
 class Proactor;
+class SubmitEntry;
 
 class FiberSocket : public SyncStreamInterface {
   FiberSocket(const FiberSocket&) = delete;
@@ -31,11 +38,18 @@ class FiberSocket : public SyncStreamInterface {
   using error_code = std::error_code;
   using expected_size_t = nonstd::expected<size_t, error_code>;
 
+  // The deadline variants of Connect, Send and Recv arm a timer of the proactor that cancels
+  // their requests and fail with std::errc::timed_out once it expires.
+  using deadline_t = std::chrono::steady_clock::time_point;
+
   FiberSocket() : fd_(-1), p_(nullptr) {
   }
 
-  FiberSocket(FiberSocket&& other) noexcept : fd_(other.fd_), p_(other.p_) {
+  FiberSocket(FiberSocket&& other) noexcept
+      : fd_(other.fd_), fixed_fd_(other.fixed_fd_), recv_timeout_ms_(other.recv_timeout_ms_),
+        p_(other.p_) {
     other.fd_ = -1;
+    other.fixed_fd_ = -1;
     other.p_ = nullptr;
   }
 
@@ -51,13 +65,28 @@ class FiberSocket : public SyncStreamInterface {
   ABSL_MUST_USE_RESULT error_code Accept(FiberSocket* peer);
 
   ABSL_MUST_USE_RESULT error_code Connect(const endpoint_type& ep);
+  ABSL_MUST_USE_RESULT error_code Connect(const endpoint_type& ep, deadline_t deadline);
 
   ABSL_MUST_USE_RESULT error_code Shutdown(int how);
 
   ABSL_MUST_USE_RESULT error_code Close();
 
   // Really need here expected.
+  // Buffers of at least --uring_send_zc_threshold bytes are sent with SendZc, Send returns
+  // once the kernel released them.
   expected_size_t Send(const iovec* ptr, size_t len) override;
+  expected_size_t Send(const iovec* ptr, size_t len, deadline_t deadline);
+
+  //! Zero-copy send: the kernel transmits from the pages of the buffers instead of copying
+  //! them into the socket buffers. Returns once the data was queued, but the buffers must stay
+  //! unchanged until on_release is called in the proactor thread, which for TCP happens
+  //! after the peer acknowledged the data. Falls back to the regular send on kernels
+  //! without SENDMSG_ZC, then on_release is called before SendZc returns.
+  expected_size_t SendZc(const iovec* ptr, size_t len, std::function<void()> on_release);
+
+  //! Sends length bytes of the file fd starting at offset. The file pages are spliced into
+  //! the socket through a pipe, so the data never passes through userspace buffers.
+  error_code SendFile(int fd, uint64_t offset, size_t length);
 
   expected_size_t Send(const boost::asio::const_buffer& b) {
     iovec v{const_cast<void*>(b.data()), b.size()};
@@ -65,20 +94,42 @@ class FiberSocket : public SyncStreamInterface {
   }
 
   expected_size_t Recv(iovec* ptr, size_t len) override;
+  expected_size_t Recv(iovec* ptr, size_t len, deadline_t deadline);
+
+  //! Like SO_RCVTIMEO: Recv without a deadline fails with std::errc::timed_out if no data
+  //! arrives within ms milliseconds, 0 disables the timeout.
+  void set_recv_timeout(uint32_t ms) {
+    recv_timeout_ms_ = ms;
+  }
 
   expected_size_t Recv(const boost::asio::mutable_buffer& mb) {
     iovec v{mb.data(), mb.size()};
     return Recv(&v, 1);
   }
 
+  //! A buffer with the received data that the socket does not own.
+  struct ProvidedBuffer {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    int32_t bid = -1;  // Index in the buffer ring of the proactor, -1 for a heap buffer.
+  };
+  using expected_buffer_t = nonstd::expected<ProvidedBuffer, error_code>;
+
+  //! Receives into a buffer that the kernel picks from the buffer ring of the proactor once
+  //! the data arrives, so an idle connection holds no receive buffer. Waits for the data and
+  //! receives into a heap buffer if the kernel does not support buffer rings or the ring is
+  //! exhausted. The buffer must be given back with ReturnProvided() in the proactor thread.
+  expected_buffer_t RecvProvided();
+
+  void ReturnProvided(const ProvidedBuffer& buf);
+
   native_handle_type native_handle() const {
     return fd_ & FD_MASK;
   }
 
   //! Removes the ownership over file descriptor. Use with caution.
-  void Detach() {
-    fd_ = -1;
-  }
+  //! The descriptor is removed from the fixed-file table of the proactor before.
+  void Detach();
 
   endpoint_type LocalEndpoint() const;
   endpoint_type RemoteEndpoint() const;
@@ -89,7 +140,7 @@ class FiberSocket : public SyncStreamInterface {
     return fd_ >= 0 && (fd_ & IS_SHUTDOWN) == 0;
   }
 
-  void set_proactor(Proactor* p) { p_ = p;}
+  void set_proactor(Proactor* p);
 
   Proactor* proactor() { return p_; }
 
@@ -102,11 +153,103 @@ class FiberSocket : public SyncStreamInterface {
   enum { FD_MASK = 0x1fffffff };
   enum { IS_SHUTDOWN = 0x20000000 };
 
+  // The fd to submit to the ring of p_. Registers the socket in the fixed-file table on
+  // the first call and sets *fixed if it succeeded.
+  int SubmitFd(bool* fixed);
+
+  // deadline is null for the operations without a deadline.
+  error_code ConnectImpl(const endpoint_type& ep, const deadline_t* deadline);
+  expected_size_t SendMsg(const iovec* ptr, size_t len, const deadline_t* deadline);
+  expected_size_t RecvMsg(iovec* ptr, size_t len, const deadline_t* deadline);
+
+  void UnregisterFixedFd();
+
   int32_t fd_;
 
+  // Index of the socket in the fixed-file table of p_ or -1.
+  int32_t fixed_fd_ = -1;
+  uint32_t recv_timeout_ms_ = 0;
+
   // We must reference proactor in each socket so that we could support write_some/read_some
   // with predefined interfance and be compliant with SyncWriteStream/SyncReadStream concepts.
   Proactor* p_;
+
+  friend class MultishotAcceptor;
+  friend class MultishotReceiver;
+};
+
+/**
+ * @brief Accepts the connections of a listening socket with a single multishot
+ *        IORING_OP_ACCEPT that posts a completion per client.
+ *
+ * Falls back to FiberSocket::Accept on the kernels without multishot accept (before 5.19).
+ * Must be used in the proactor thread of the listener.
+ */
+class MultishotAcceptor {
+  MultishotAcceptor(const MultishotAcceptor&) = delete;
+  void operator=(const MultishotAcceptor&) = delete;
+
+ public:
+  explicit MultishotAcceptor(FiberSocket* listener) : listener_(listener) {
+  }
+
+  ~MultishotAcceptor();
+
+  //! Returns connection_aborted once the listener is shut down.
+  ABSL_MUST_USE_RESULT std::error_code Accept(FiberSocket* peer);
+
+ private:
+  void Arm();
+  void Wait();
+
+  FiberSocket* listener_;
+  std::deque<int> accepted_;
+  uint64_t user_data_ = 0;
+  uint64_t num_accepted_ = 0;
+  int last_res_ = 0;
+  bool armed_ = false;
+  bool supported_ = true;
+  ::boost::fibers::context* waiter_ = nullptr;
+};
+
+/**
+ * @brief Receives the data of a socket with a single multishot IORING_OP_RECV that posts a
+ *        completion per chunk of data into the buffer ring of the proactor.
+ *
+ * Saves the submission of a request per Recv on busy connections. Falls back to
+ * FiberSocket::RecvProvided on the kernels without multishot recv (before 6.0) or without the
+ * buffer ring. Must be used in the proactor thread of the socket.
+ */
+class MultishotReceiver {
+  MultishotReceiver(const MultishotReceiver&) = delete;
+  void operator=(const MultishotReceiver&) = delete;
+
+ public:
+  explicit MultishotReceiver(FiberSocket* sock) : sock_(sock) {
+  }
+
+  ~MultishotReceiver();
+
+  //! The buffer must be given back with FiberSocket::ReturnProvided().
+  //! Returns connection_aborted once the peer closed the connection.
+  FiberSocket::expected_buffer_t Recv();
+
+ private:
+  struct Completion {
+    int32_t res;
+    uint32_t flags;
+  };
+
+  void Arm();
+  void Wait();
+
+  FiberSocket* sock_;
+  std::deque<Completion> completions_;
+  uint64_t user_data_ = 0;
+  uint64_t num_received_ = 0;
+  bool armed_ = false;
+  bool supported_ = true;
+  ::boost::fibers::context* waiter_ = nullptr;
 };
 
 }  // namespace uring
@@ -19,6 +19,8 @@ namespace uring {
 
 namespace {
 
+constexpr size_t kPipelineBatchSize = 1 << 14;
+
 void FilezHandler(const QueryArgs& args, HttpContext* send) {
   StringPiece file_name;
   for (const auto& k_v : args) {
@@ -49,6 +51,30 @@ void FilezHandler(const QueryArgs& args, HttpContext* send) {
 
 }  // namespace
 
+void HttpContext::Invoke(FileResponse&& msg) {
+  if (!file_socket_) {
+    return Invoke<h2::file_body>(std::move(msg));
+  }
+
+  uint64_t offset, length;
+  PrepareFileResponse(range_, &msg, &offset, &length);
+
+  // The batched responses and the header go out before the file.
+  string header;
+  string* dest = batch_ ? batch_ : &header;
+  detail::StringWriteStream sws{dest};
+  system::error_code ec;
+  h2::response_serializer<h2::file_body> sr{msg};
+  h2::write_header(sws, sr, ec);
+  asio::write(asa_, asio::buffer(*dest), ec);
+  dest->clear();
+
+  if (!ec && length) {
+    std::error_code fec = file_socket_->SendFile(msg.body().file().native_handle(), offset, length);
+    VLOG_IF(1, fec) << "SendFile error " << fec.message();
+  }
+}
+
 HttpListenerBase::HttpListenerBase() {
   favicon_ =
       "https://rawcdn.githack.com/romange/gaia/master/util/http/"
@@ -79,6 +105,11 @@ bool HttpListenerBase::HandleRoot(const RequestType& request,
     return true;
   }
 
+  if (path == "/metrics") {
+    cntx->Invoke(BuildMetricsPage());
+    return true;
+  }
+
   if (path == "/flagz") {
     h2::response<h2::string_body> resp(h2::status::ok, request.version());
     cntx->Invoke(ParseFlagz(args));
@@ -97,6 +128,10 @@ bool HttpListenerBase::HandleRoot(const RequestType& request,
   return false;
 }
 
+void HttpListenerBase::PreAcceptLoop(Proactor* owner) {
+  loop_varz_.Init(pool());
+}
+
 bool HttpListenerBase::RegisterCb(StringPiece path, RequestCb cb) {
   CbInfo cb_info{.cb = cb};
 
@@ -115,14 +150,39 @@ void HttpHandler2::HandleRequests() {
   system::error_code ec;
   AsioStreamAdapter<> asa(socket_);
 
+  string batch;
+
   while (true) {
+    // The parser appends to the message, so it is cleared but keeps its capacity.
+    request.clear();
+    request.body().clear();
     h2::read(asa, buffer, request, ec);
     if (ec) {
       break;
     }
-    HttpContext cntx(asa);
+
+    // buffer holds the requests that the client has already pipelined after this one.
+    bool batched = base_->pipelined_ && (buffer.size() > 0 || !batch.empty());
+    HttpContext cntx(asa, batched ? &batch : nullptr);
+    if (base_->compress_min_size_) {
+      auto it = request.find(h2::field::accept_encoding);
+      if (it != request.end()) {
+        cntx.EnableCompression(ParseAcceptEncoding(as_absl(it->value())),
+                               base_->compress_min_size_);
+      }
+    }
+    auto range_it = request.find(h2::field::range);
+    cntx.EnableSendFile(&socket_, range_it != request.end() ? as_absl(range_it->value())
+                                                           : absl::string_view{});
     VLOG(1) << "Full Url: " << request.target();
     HandleOne(request, &cntx);
+
+    if (!batch.empty() && (buffer.size() == 0 || batch.size() >= kPipelineBatchSize)) {
+      asio::write(asa, asio::buffer(batch), ec);
+      batch.clear();
+      if (ec)
+        break;
+    }
   }
   VLOG(1) << "HttpHandler2 exit";
 }
@@ -10,23 +10,72 @@
 #include "util/uring/accept_server.h"
 #include "strings/unique_strings.h"
 #include "util/http/http_common.h"
+#include "util/uring/varz.h"
 
 namespace util {
 namespace uring {
 
+namespace detail {
+
+// SyncWriteStream that appends to a string, batches the responses to pipelined requests.
+struct StringWriteStream {
+  std::string* dest;
+
+  template <typename BS> size_t write_some(const BS& bufs, ::boost::system::error_code& ec) {
+    size_t sz = ::boost::asio::buffer_size(bufs);
+    size_t pos = dest->size();
+    dest->resize(pos + sz);
+    ::boost::asio::buffer_copy(::boost::asio::buffer(&(*dest)[pos], sz), bufs);
+    ec.clear();
+    return sz;
+  }
+
+  template <typename BS> size_t write_some(const BS& bufs) {
+    ::boost::system::error_code ec;
+    return write_some(bufs, ec);
+  }
+};
+
+}  // namespace detail
+
 class HttpContext {
   template <typename Body>
   using Response = ::boost::beast::http::response<Body>;
   using error_code = ::boost::system::error_code;
 
   AsioStreamAdapter<>& asa_;
+  std::string* batch_;
+  unsigned encodings_ = 0;
+  size_t compress_min_size_ = 0;
+  FiberSocket* file_socket_ = nullptr;
+  absl::string_view range_;
 
 public:
-  explicit HttpContext(AsioStreamAdapter<>& asa) : asa_(asa) {}
+  // If batch is set, the responses are appended to it instead of being written to asa.
+  explicit HttpContext(AsioStreamAdapter<>& asa, std::string* batch = nullptr)
+      : asa_(asa), batch_(batch) {}
+
+  // The string responses of at least min_size bytes are compressed with one of encodings.
+  void EnableCompression(unsigned encodings, size_t min_size) {
+    encodings_ = encodings;
+    compress_min_size_ = min_size;
+  }
+
+  // File responses are spliced from the file into socket, asa must write to it. range is the
+  // value of Range header of the request and must outlive the call.
+  void EnableSendFile(FiberSocket* socket, absl::string_view range) {
+    file_socket_ = socket;
+    range_ = range;
+  }
+
+  void Invoke(http::FileResponse&& msg);
 
   template <typename Body> void Invoke(Response<Body>&& msg) {
     // Determine if we should close the connection after
     // close_ = msg.need_eof();
+    if (encodings_) {
+      http::CompressResponse(encodings_, compress_min_size_, &msg);
+    }
 
     // We need the serializer here because the serializer requires
     // a non-const file_body, and the message oriented version of
@@ -35,7 +84,12 @@ public:
     ::boost::beast::http::response_serializer<Body> sr{msg};
 
     ::boost::system::error_code ec;
-    ::boost::beast::http::write(asa_, sr, ec);
+    if (batch_) {
+      detail::StringWriteStream sws{batch_};
+      ::boost::beast::http::write(sws, sr, ec);
+    } else {
+      ::boost::beast::http::write(asa_, sr, ec);
+    }
   }
 };
 
@@ -57,8 +111,19 @@ class HttpListenerBase : public ListenerInterface {
   bool RegisterCb(StringPiece path, RequestCb cb);
 
   void set_resource_prefix(const char* prefix) { resource_prefix_ = prefix; }
+
+  // In pipelined mode the responses to the requests that a client sent back-to-back are
+  // coalesced into a single socket write.
+  void set_pipelined(bool flag) { pipelined_ = flag; }
   void set_favicon(const char* favicon) { favicon_ = favicon;}
 
+  // String responses of at least min_size bytes are compressed for the clients that accept
+  // gzip or zstd. 0 disables the compression.
+  void set_compress_min_size(size_t min_size) { compress_min_size_ = min_size; }
+
+  // Exports the event-loop stats of the proactors on the status page.
+  void PreAcceptLoop(Proactor* owner) override;
+
  private:
   bool HandleRoot(const RequestType& rt, HttpContext* cntx) const;
 
@@ -69,6 +134,9 @@ class HttpListenerBase : public ListenerInterface {
 
   const char* favicon_;
   const char* resource_prefix_;
+  bool pipelined_ = false;
+  size_t compress_min_size_ = 4096;
+  VarzProactorLoop loop_varz_{"proactor-loop"};
 };
 
 class HttpHandler2 : public Connection {
@@ -7,6 +7,9 @@
 #include <liburing.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <sys/poll.h>
 
 #include <boost/fiber/operations.hpp>
@@ -15,8 +18,21 @@
 #include "absl/base/attributes.h"
 #include "base/logging.h"
 #include "base/macros.h"
+#include "base/walltime.h"
+#include "util/fibers/fiberqueue_threadpool.h"
+#include "util/mimalloc_resource.h"
 #include "util/uring/uring_fiber_algo.h"
 
+DEFINE_uint32(proactor_fixed_files, 1024, "Size of the fixed-file table of each io_uring, "
+                                          "0 disables the fixed files");
+DEFINE_uint32(proactor_recv_buffers, 256, "Number of the kernel-provided receive buffers of each "
+                                          "io_uring, must be a power of 2. 0 disables them");
+DEFINE_uint32(proactor_recv_buffer_size, 8192, "Size of the kernel-provided receive buffers");
+DEFINE_uint32(proactor_offload_threads, 2, "Number of the threads that run "
+                                           "Proactor::AwaitOffload calls");
+DEFINE_uint32(proactor_offload_max_threads, 64, "The offload pool grows up to that many threads "
+                                                "while the calls wait");
+
 #define URING_CHECK(x)                                                           \
   do {                                                                           \
     int __res_val = (x);                                                         \
@@ -31,6 +47,10 @@
 #define __NR_io_uring_enter 426
 #endif
 
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
 using namespace boost;
 namespace ctx = boost::context;
 
@@ -39,6 +59,25 @@ namespace uring {
 
 namespace {
 
+// Provided buffer rings appeared in 5.19, we keep our own copies of their structs so that
+// the code builds with the older kernel headers.
+constexpr unsigned kRegisterPbufRing = 22;  // IORING_REGISTER_PBUF_RING
+
+struct BufRingEntry {  // io_uring_buf
+  uint64_t addr;
+  uint32_t len;
+  uint16_t bid;
+  uint16_t resv;  // The tail of the ring in the first entry.
+};
+
+struct BufRingReg {  // io_uring_buf_reg
+  uint64_t ring_addr;
+  uint32_t ring_entries;
+  uint16_t bgid;
+  uint16_t flags;
+  uint64_t resv[3];
+};
+
 inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
                               sigset_t* sig) {
   return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, sig, _NSIG / 8);
@@ -112,9 +151,33 @@ unsigned IoRingPeek(const io_uring& ring, io_uring_cqe* cqes, unsigned count) {
 
 constexpr uint64_t kIgnoreIndex = 0;
 constexpr uint64_t kWakeIndex = 1;
+constexpr uint64_t kTimerIndex = 2;
 constexpr uint64_t kUserDataCbIndex = 1024;
 constexpr uint32_t kSpinLimit = 200;
 
+struct OffloadPool {
+  fibers_ext::FiberQueueThreadPool pool;
+  std::atomic<uint64_t> calls{0};
+  std::atomic_uint32_t pending{0};
+
+  std::mutex mu;
+  base::Histogram latency_usec;  // Guarded by mu.
+
+  explicit OffloadPool(const fibers_ext::FiberQueueThreadPool::Options& opts) : pool(opts) {}
+};
+
+// Created on the first call and never destroyed, since the calls may come from the threads
+// that outlive the proactors.
+OffloadPool* GetOffloadPool() {
+  static OffloadPool* offload = [] {
+    fibers_ext::FiberQueueThreadPool::Options opts;
+    opts.num_threads = std::max(1U, FLAGS_proactor_offload_threads);
+    opts.max_threads = FLAGS_proactor_offload_max_threads;
+    return new OffloadPool(opts);
+  }();
+  return offload;
+}
+
 }  // namespace
 
 thread_local Proactor::TLInfo Proactor::tl_info_;
@@ -148,9 +211,10 @@ void Proactor::Stop() {
   VLOG(1) << "Proactor::StopFinish";
 }
 
-void Proactor::Run(unsigned ring_depth, int wq_fd) {
+void Proactor::Run(const Options& opts) {
   VLOG(1) << "Proactor::Run";
-  Init(ring_depth, wq_fd);
+  Init(opts);
+  InitThreadHeap();
 
   main_loop_ctx_ = fibers::context::active();
   fibers::scheduler* sched = main_loop_ctx_->get_scheduler();
@@ -160,15 +224,35 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
   this_fiber::properties<UringFiberProps>().set_name("ioloop");
 
   is_stopped_ = false;
+  timer_base_ms_ = GetClockNanos() / 1000000;
 
   constexpr size_t kBatchSize = 64;
   struct io_uring_cqe cqes[kBatchSize];
   uint32_t tq_seq = 0;
-  uint32_t num_stalls = 0;
   uint32_t spin_loops = 0, num_task_runs = 0;
+  const uint64_t busy_poll_ns = uint64_t(opts.busy_poll_usec) * 1000;
+  uint64_t busy_start = 0;
+  uint64_t iter_start = 0;
+  bool busy_iter = false;
   Tasklet task;
 
   while (true) {
+    uint64_t now = GetClockNanos();
+    if (busy_iter) {
+      ++loop_stats_.iterations;
+      loop_stats_.iteration_usec.Add((now - iter_start) / 1000);
+    }
+    iter_start = now;
+
+    // Before the submit, so that the cancellations that timers issue go out right away.
+    AdvanceTimers(now);
+
+    // io_uring_submit enters the kernel in SQPOLL mode only to wake up the SQ thread.
+    if (sqpoll_f_ && io_uring_sq_ready(&ring_) &&
+        (__atomic_load_n(ring_.sq.kflags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)) {
+      sq_wakeups_.fetch_add(1, std::memory_order_relaxed);
+      DVLOG(2) << "Waking up the SQ thread";
+    }
     int num_submitted = io_uring_submit(&ring_);
 
     if (num_submitted >= 0) {
@@ -203,6 +287,8 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
     if (num_task_runs) {
       // Should we put 'notify' inside the loop? It might improve the latency.
       task_queue_avail_.notifyAll();
+      loop_stats_.tasks += num_task_runs;
+      loop_stats_.tasks_per_iteration.Add(num_task_runs);
     }
 
     uint32_t cqe_count = IoRingPeek(ring_, cqes, kBatchSize);
@@ -212,8 +298,14 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
       DVLOG(2) << "Fetched " << cqe_count << " cqes";
       DispatchCompletions(cqes, cqe_count);
       sqe_avail_.notifyAll();
+      loop_stats_.cqes += cqe_count;
+      loop_stats_.cqes_per_wake.Add(cqe_count);
     }
 
+    busy_iter = cqe_count || num_task_runs;
+    if (busy_iter)
+      busy_start = 0;
+
     if (tq_seq & 1) {   // We allow dispatch fiber to run.
       tq_seq_.fetch_and(~1, std::memory_order_relaxed);
       this_fiber::yield();
@@ -228,6 +320,8 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
       sched->suspend();
 
       DVLOG(2) << "Resume ioloop";
+      loop_stats_.fiber_usec += (GetClockNanos() - tl_info_.monotonic_time) / 1000;
+      busy_iter = true;
       continue;
     }
 
@@ -240,7 +334,21 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
       continue;
     }
 
+    // Optionally keep spinning for the configured time before we sleep.
+    if (busy_poll_ns && !is_stopped_) {
+      uint64_t now = GetClockNanos();
+      if (busy_start == 0)
+        busy_start = now;
+      if (now < busy_start + busy_poll_ns)
+        continue;
+    }
+
     spin_loops = 0;  // Reset the spinning.
+    busy_start = 0;
+
+    // The timeout is submitted with the next iteration.
+    if (ArmTimerWakeup())
+      continue;
 
     /**
      * If tq_seq_ has changed since it was cached into tq_seq, then
@@ -253,24 +361,67 @@ void Proactor::Run(unsigned ring_depth, int wq_fd) {
       if (is_stopped_)
         break;
       DVLOG(1) << "wait_for_cqe";
+      uint64_t wait_start = GetClockNanos();
       int res = wait_for_cqe(&ring_);
       DVLOG(1) << "Woke up " << res << "/" << tq_seq_.load(std::memory_order_acquire);
 
+      loop_stats_.wait_usec += (GetClockNanos() - wait_start) / 1000;
       tq_seq = 0;
-      ++num_stalls;
+      ++loop_stats_.stalls;
 
       // Reset all except the LSB bit that signals that we need to switch to dispatch fiber.
       tq_seq_.fetch_and(1, std::memory_order_release);
     }
   }
 
-  VLOG(1) << "wakeups/stalls: " << tq_wakeups_.load() << "/" << num_stalls;
+  VLOG(1) << "wakeups/stalls: " << tq_wakeups_.load() << "/" << loop_stats_.stalls;
+  LOG_IF(INFO, sqpoll_f_) << "SQ thread was woken up " << sq_wakeups_.load() << " times";
 
   VLOG(1) << "centries size: " << centries_.size();
   centries_.clear();
+  DestroyThreadHeap();
+}
+
+auto Proactor::GetLoopStats() const -> LoopStats {
+  DCHECK(InMyThread());
+
+  LoopStats res = loop_stats_;
+  res.task_queue_full = tq_full_.load(std::memory_order_relaxed);
+  res.task_queue_waits = tq_waits_.load(std::memory_order_relaxed);
+
+  return res;
+}
+
+void Proactor::RunOffloaded(fu2::function_view<void()> task) {
+  OffloadPool* offload = GetOffloadPool();
+  offload->pending.fetch_add(1, std::memory_order_relaxed);
+  uint64_t start = GetMonotonicMicros();
+
+  offload->pool.Await([&task] { task(); });
+
+  uint64_t usec = GetMonotonicMicros() - start;
+  offload->pending.fetch_sub(1, std::memory_order_relaxed);
+  offload->calls.fetch_add(1, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lk(offload->mu);
+  offload->latency_usec.Add(usec);
 }
 
-void Proactor::Init(size_t ring_size, int wq_fd) {
+auto Proactor::GetOffloadStats() -> OffloadStats {
+  OffloadPool* offload = GetOffloadPool();
+  OffloadStats res;
+  res.calls = offload->calls.load(std::memory_order_relaxed);
+  res.pending = offload->pending.load(std::memory_order_relaxed);
+  res.threads = offload->pool.thread_count();
+
+  std::lock_guard<std::mutex> lk(offload->mu);
+  res.latency_usec = offload->latency_usec;
+
+  return res;
+}
+
+void Proactor::Init(const Options& opts) {
+  size_t ring_size = opts.ring_depth;
   CHECK_EQ(0, ring_size & (ring_size - 1));
   CHECK_GE(ring_size, 8);
   CHECK_EQ(0, thread_id_) << "Init was already called";
@@ -279,16 +430,32 @@ void Proactor::Init(size_t ring_size, int wq_fd) {
   memset(&params, 0, sizeof(params));
 
   // Optionally reuse the already created work-queue from another uring.
-  if (wq_fd > 0) {
+  if (opts.wq_fd > 0) {
     params.flags |= IORING_SETUP_ATTACH_WQ;
-    params.wq_fd = wq_fd;
+    params.wq_fd = opts.wq_fd;
   }
 
-  // it seems that SQPOLL requires registering each fd, including sockets fds.
-  // need to check if its worth pursuing.
-  // For sure not in short-term.
-  // params.flags = IORING_SETUP_SQPOLL;
-  URING_CHECK(io_uring_queue_init_params(ring_size, &ring_, &params));
+  // Kernels before 5.11 allow SQPOLL only to privileged processes.
+  sqpoll_f_ = 0;
+  if (opts.sqpoll) {
+    io_uring_params sq_params = params;
+    sq_params.flags |= IORING_SETUP_SQPOLL;
+    sq_params.sq_thread_idle = opts.sq_thread_idle_ms;
+    if (opts.sq_thread_cpu >= 0) {
+      sq_params.flags |= IORING_SETUP_SQ_AFF;
+      sq_params.sq_thread_cpu = opts.sq_thread_cpu;
+    }
+    int res = io_uring_queue_init_params(ring_size, &ring_, &sq_params);
+    if (res == 0) {
+      sqpoll_f_ = 1;
+      params = sq_params;
+    } else {
+      LOG_FIRST_N(WARNING, 1) << "Could not setup SQPOLL: " << strerror(-res);
+    }
+  }
+  if (!sqpoll_f_) {
+    URING_CHECK(io_uring_queue_init_params(ring_size, &ring_, &params));
+  }
   fast_poll_f_ = (params.features & IORING_FEAT_FAST_POLL) != 0;
   if (!fast_poll_f_) {
     LOG_FIRST_N(INFO, 1) << "IORING_FEAT_FAST_POLL feature is not present in the kernel";
@@ -317,10 +484,160 @@ void Proactor::Init(size_t ring_size, int wq_fd) {
     centries_[i].val = i + 1;
   }
 
+  // A sparse table of -1 entries that RegisterFd fills. Older kernels reject it and we
+  // fall back to the regular fds.
+  if (FLAGS_proactor_fixed_files) {
+    std::vector<int> fds(FLAGS_proactor_fixed_files, -1);
+    int res = io_uring_register_files(&ring_, fds.data(), fds.size());
+    if (res < 0) {
+      LOG_FIRST_N(INFO, 1) << "Fixed files are not supported: " << strerror(-res);
+    } else {
+      free_fixed_fds_.resize(fds.size());
+      for (size_t i = 0; i < fds.size(); ++i) {
+        free_fixed_fds_[i] = fds.size() - 1 - i;
+      }
+    }
+  }
+
+  InitRecvBufRing();
+
   thread_id_ = pthread_self();
   tl_info_.is_proactor_thread = true;
 }
 
+int Proactor::RegisterFd(int fd) {
+  std::lock_guard<std::mutex> lk(fixed_mu_);
+  if (free_fixed_fds_.empty())
+    return -1;
+
+  unsigned index = free_fixed_fds_.back();
+  int res = io_uring_register_files_update(&ring_, index, &fd, 1);
+  if (res < 1) {
+    LOG_FIRST_N(WARNING, 1) << "Could not register fd " << fd << ": " << strerror(-res);
+    return -1;
+  }
+  free_fixed_fds_.pop_back();
+
+  return index;
+}
+
+void Proactor::UnregisterFd(unsigned fixed_fd) {
+  std::lock_guard<std::mutex> lk(fixed_mu_);
+  int fd = -1;
+  int res = io_uring_register_files_update(&ring_, fixed_fd, &fd, 1);
+  CHECK_EQ(1, res) << "Could not unregister " << fixed_fd << ": " << strerror(-res);
+  free_fixed_fds_.push_back(fixed_fd);
+}
+
+struct Proactor::RecvBufRing {
+  BufRingEntry* entries = nullptr;
+  size_t ring_bytes = 0;
+  std::unique_ptr<uint8_t[]> mem;
+  uint32_t count = 0, buf_size = 0;
+  uint16_t tail = 0;
+
+  ~RecvBufRing() {
+    if (entries)
+      munmap(entries, ring_bytes);
+  }
+
+  void Add(uint16_t bid) {
+    BufRingEntry& e = entries[tail & (count - 1)];
+    e.addr = reinterpret_cast<uint64_t>(mem.get() + size_t(bid) * buf_size);
+    e.len = buf_size;
+    e.bid = bid;
+  }
+
+  void Publish(uint16_t new_tail) {
+    tail = new_tail;
+    __atomic_store_n(&entries[0].resv, tail, __ATOMIC_RELEASE);
+  }
+};
+
+void Proactor::InitRecvBufRing() {
+  uint32_t count = FLAGS_proactor_recv_buffers;
+  if (count == 0)
+    return;
+  CHECK_EQ(0, count & (count - 1)) << "--proactor_recv_buffers must be a power of 2";
+  CHECK_LE(count, 1U << 15);
+
+  std::unique_ptr<RecvBufRing> ring(new RecvBufRing);
+  ring->ring_bytes = count * sizeof(BufRingEntry);
+  void* ptr = mmap(nullptr, ring->ring_bytes, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  CHECK(ptr != MAP_FAILED);
+  ring->entries = reinterpret_cast<BufRingEntry*>(ptr);
+
+  BufRingReg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ptr);
+  reg.ring_entries = count;
+  reg.bgid = kRecvBufGroup;
+
+  int res = syscall(__NR_io_uring_register, ring_.ring_fd, kRegisterPbufRing, &reg, 1);
+  if (res < 0) {
+    LOG_FIRST_N(INFO, 1) << "Provided buffer rings are not supported: " << strerror(errno);
+    return;
+  }
+
+  ring->count = count;
+  ring->buf_size = FLAGS_proactor_recv_buffer_size;
+  ring->mem.reset(new uint8_t[size_t(count) * ring->buf_size]);
+  for (uint32_t i = 0; i < count; ++i) {
+    ring->Add(i);
+    ++ring->tail;
+  }
+  ring->Publish(ring->tail);
+  recv_ring_ = std::move(ring);
+}
+
+size_t Proactor::recv_buffer_size() const {
+  return recv_ring_ ? recv_ring_->buf_size : 0;
+}
+
+uint8_t* Proactor::GetRecvBuffer(uint16_t bid) {
+  DCHECK_LT(bid, recv_ring_->count);
+  return recv_ring_->mem.get() + size_t(bid) * recv_ring_->buf_size;
+}
+
+void Proactor::ReturnRecvBuffer(uint16_t bid) {
+  DCHECK(InMyThread());
+  DCHECK_LT(bid, recv_ring_->count);
+
+  recv_ring_->Add(bid);
+  recv_ring_->Publish(recv_ring_->tail + 1);
+}
+
+int Proactor::RegisterBuffers(const iovec* iov, unsigned count) {
+  DCHECK(InMyThread());
+
+  UnregisterBuffers();
+  int res = io_uring_register_buffers(&ring_, iov, count);
+  if (res == 0) {
+    registered_bufs_.assign(iov, iov + count);
+  }
+  return res;
+}
+
+void Proactor::UnregisterBuffers() {
+  DCHECK(InMyThread());
+
+  if (!registered_bufs_.empty()) {
+    URING_CHECK(io_uring_unregister_buffers(&ring_));
+    registered_bufs_.clear();
+  }
+}
+
+int Proactor::FindRegisteredBuffer(const void* buf, size_t len) const {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(buf);
+  for (size_t i = 0; i < registered_bufs_.size(); ++i) {
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(registered_bufs_[i].iov_base);
+    if (ptr >= base && ptr + len <= base + registered_bufs_[i].iov_len)
+      return i;
+  }
+  return -1;
+}
+
 void Proactor::WakeRing() {
   DVLOG(1) << "Wake ring " << tq_seq_.load(std::memory_order_relaxed);
 
@@ -337,14 +654,30 @@ void Proactor::DispatchCompletions(io_uring_cqe* cqes, unsigned count) {
     // I allocate range of 1024 reserved values for the internal Proactor use.
 
     if (cqe.user_data >= kUserDataCbIndex) {  // our heap range surely starts higher than 1k.
-      size_t index = cqe.user_data - kUserDataCbIndex;
+      // The upper half of user_data holds the position of a batch SQE.
+      size_t index = uint32_t(cqe.user_data) - kUserDataCbIndex;
       DCHECK_LT(index, centries_.size());
       auto& e = centries_[index];
       DCHECK(e.cb) << index;
 
       CbType func;
-      auto payload = e.val;
+      int64_t payload = e.val;
       func.swap(e.cb);
+      cqe_flags_ = cqe.flags;
+
+      bool more = cqe.flags & IORING_CQE_F_MORE;
+      if (e.pending > 0) {
+        payload = cqe.user_data >> 32;
+        more |= --e.pending > 0;
+      }
+
+      // Multishot requests and batches keep their entry until the last completion.
+      // The callback may regrow centries_, therefore we do not call it by reference.
+      if (more) {
+        func(cqe.res, payload, this);
+        centries_[index].cb = std::move(func);
+        continue;
+      }
 
       e.val = next_free_;
       next_free_ = index;
@@ -356,6 +689,11 @@ void Proactor::DispatchCompletions(io_uring_cqe* cqes, unsigned count) {
     if (cqe.user_data == kIgnoreIndex)
       continue;
 
+    if (cqe.user_data == kTimerIndex) {
+      timer_armed_ms_ = 0;
+      continue;
+    }
+
     if (cqe.user_data == kWakeIndex) {
       // We were woken up. Need to rearm wake_fd_ poller.
       DCHECK_GE(cqe.res, 0);
@@ -387,22 +725,7 @@ SubmitEntry Proactor::GetSubmitEntry(CbType cb, int64_t payload) {
   }
 
   if (cb) {
-    if (next_free_ < 0) {
-      RegrowCentries();
-      DCHECK_GT(next_free_, 0);
-    }
-
-    res->user_data = next_free_ + kUserDataCbIndex;
-    DCHECK_LT(next_free_, centries_.size());
-
-    auto& e = centries_[next_free_];
-    DCHECK(!e.cb);  // cb is undefined.
-    DVLOG(1) << "GetSubmitEntry: index: " << next_free_ << ", socket: " << payload;
-
-    next_free_ = e.val;
-    e.cb = std::move(cb);
-    e.val = payload;
-    e.opcode = -1;
+    res->user_data = AllocCompletionEntry(std::move(cb), payload) + kUserDataCbIndex;
   } else {
     res->user_data = kIgnoreIndex;
   }
@@ -410,6 +733,106 @@ SubmitEntry Proactor::GetSubmitEntry(CbType cb, int64_t payload) {
   return SubmitEntry{res};
 }
 
+void Proactor::GetSubmitEntries(unsigned count, CbType cb, SubmitEntry* dest) {
+  DCHECK_GT(count, 0);
+  DCHECK(cb);
+
+  AwaitSubmitSpace(count);
+
+  uint32_t index = AllocCompletionEntry(std::move(cb), 0);
+  centries_[index].pending = count;
+
+  for (unsigned i = 0; i < count; ++i) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    CHECK(sqe);
+    sqe->user_data = (uint64_t(i) << 32) | (index + kUserDataCbIndex);
+    dest[i] = SubmitEntry{sqe};
+  }
+}
+
+uint32_t Proactor::AllocCompletionEntry(CbType cb, int64_t payload) {
+  if (next_free_ < 0) {
+    RegrowCentries();
+    DCHECK_GT(next_free_, 0);
+  }
+  DCHECK_LT(next_free_, centries_.size());
+
+  uint32_t index = next_free_;
+  auto& e = centries_[index];
+  DCHECK(!e.cb);  // cb is undefined.
+  DVLOG(1) << "GetSubmitEntry: index: " << index << ", socket: " << payload;
+
+  next_free_ = e.val;
+  e.cb = std::move(cb);
+  e.val = payload;
+  e.pending = 0;
+
+  return index;
+}
+
+bool Proactor::CancelRequest(uint64_t user_data) {
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (!sqe)
+    return false;
+
+  SubmitEntry se{sqe};
+  se.PrepCancel(user_data);
+  sqe->user_data = kIgnoreIndex;
+  return true;
+}
+
+void Proactor::AddTimer(base::TimerEventInterface* event, uint32_t delay_ms) {
+  DCHECK(InMyThread());
+
+  // The wheel lags behind the clock while the fibers run.
+  uint64_t now_ms = GetClockNanos() / 1000000 - timer_base_ms_;
+  base::Tick lag = now_ms > timer_wheel_.now() ? now_ms - timer_wheel_.now() : 0;
+  timer_wheel_.schedule(event, std::max(delay_ms, 1U) + lag);
+}
+
+void Proactor::AdvanceTimers(uint64_t now_ns) {
+  uint64_t now_ms = now_ns / 1000000 - timer_base_ms_;
+  if (now_ms > timer_wheel_.now()) {
+    timer_wheel_.advance(now_ms - timer_wheel_.now());
+  }
+}
+
+bool Proactor::ArmTimerWakeup() {
+  constexpr base::Tick kNoEvents = base::Tick(-1);
+
+  base::Tick ticks = timer_wheel_.ticks_to_next_event(kNoEvents);
+  if (ticks == kNoEvents)
+    return false;
+
+  uint64_t expiry_ms = timer_base_ms_ + timer_wheel_.now() + std::max<base::Tick>(ticks, 1);
+  if (timer_armed_ms_ && timer_armed_ms_ <= expiry_ms)
+    return false;
+
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (!sqe)
+    return false;
+
+  timer_ts_.tv_sec = expiry_ms / 1000;
+  timer_ts_.tv_nsec = (expiry_ms % 1000) * 1000000;
+
+  SubmitEntry se{sqe};
+  se.PrepTimeout(&timer_ts_);
+  sqe->user_data = kTimerIndex;
+  timer_armed_ms_ = expiry_ms;
+
+  return true;
+}
+
+void Proactor::AwaitSubmitSpace(unsigned count) {
+  DCHECK_LE(count, *ring_.sq.kring_entries);
+
+  if (io_uring_sq_space_left(&ring_) >= count)
+    return;
+
+  CHECK(fibers::context::active() != main_loop_ctx_) << "SQE overflow in the main context";
+  sqe_avail_.await([this, count] { return io_uring_sq_space_left(&ring_) >= count; });
+}
+
 void Proactor::RegisterSignal(std::initializer_list<uint16_t> l, std::function<void(int)> cb) {
   auto* state = get_signal_state();
 
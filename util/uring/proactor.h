@@ -9,11 +9,17 @@
 
 #include <boost/fiber/fiber.hpp>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "base/function2.hpp"
+#include "base/histogram.h"
 #include "base/mpmc_bounded_queue.h"
+#include "base/wheel_timer.h"
 #include "util/fibers/event_count.h"
 #include "util/fibers/fibers_ext.h"
+#include "util/fibers/pooled_stack.h"
 #include "util/uring/submit_entry.h"
 
 namespace util {
@@ -30,8 +36,33 @@ class Proactor {
   Proactor();
   ~Proactor();
 
+  struct Options {
+    unsigned ring_depth = 512;
+
+    // Reuses the work-queue of another ring if non-negative.
+    int wq_fd = -1;
+
+    // If true, a kernel thread polls the submission queue and the loop submits without
+    // syscalls. The thread sleeps after sq_thread_idle_ms of inactivity (0 for the kernel
+    // default) and runs on sq_thread_cpu if it is non-negative. Falls back to the regular
+    // ring if the kernel refuses SQPOLL.
+    bool sqpoll = false;
+    unsigned sq_thread_idle_ms = 0;
+    int sq_thread_cpu = -1;
+
+    // The loop busy-polls for that long before it sleeps in io_uring_enter.
+    unsigned busy_poll_usec = 0;
+  };
+
   // Runs the poll-loop. Stalls the calling thread which will become the "Proactor" thread.
-  void Run(unsigned ring_depth = 512, int wq_fd = -1);
+  void Run(const Options& opts);
+
+  void Run(unsigned ring_depth = 512, int wq_fd = -1) {
+    Options opts;
+    opts.ring_depth = ring_depth;
+    opts.wq_fd = wq_fd;
+    Run(opts);
+  }
 
   //! Signals proactor to stop. Does not wait for it.
   void Stop();
@@ -60,6 +91,38 @@ class Proactor {
    */
   SubmitEntry GetSubmitEntry(CbType cb, int64_t payload);
 
+  /**
+   * @brief Reserves count SQEs that share a single completion entry.
+   *
+   * cb is called for each of their completions with the position of the SQE in dest as its
+   * payload, the entry is released after the last one. Suspends the calling fiber once until
+   * the submission queue has room for all of them, therefore the entries can be chained with
+   * IOSQE_IO_LINK. count must not exceed the ring depth.
+   */
+  void GetSubmitEntries(unsigned count, CbType cb, SubmitEntry* dest);
+
+  //! Submits an IORING_OP_ASYNC_CANCEL for the request with user_data, the request then fails
+  //! with -ECANCELED. Does not block and can be called from the loop context, returns false
+  //! if the submission queue is full.
+  bool CancelRequest(uint64_t user_data);
+
+  /**
+   *  Timers. The proactor advances its hierarchical base::TimerWheel with 1ms ticks on each
+   *  loop iteration and wakes up for the nearest timer, so adding and cancelling a timer costs
+   *  O(1) without SQEs or fibers. event->execute() runs in the loop context, it must not block
+   *  but it may wake up fibers. The event must stay valid until it runs or is cancelled,
+   *  destroying it cancels it. Must be called in the proactor thread.
+   * */
+  void AddTimer(base::TimerEventInterface* event, uint32_t delay_ms);
+
+  void CancelTimer(base::TimerEventInterface* event) {
+    event->cancel();
+  }
+
+  //! Blocks the calling fiber until the submission queue has room for count entries. The
+  //! following count GetSubmitEntry calls do not preempt, as linked requests require.
+  void AwaitSubmitSpace(unsigned count);
+
   /**
    * @brief Returns true if the called is running in this Proactor thread.
    *
@@ -100,6 +163,81 @@ class Proactor {
     return fast_poll_f_;
   }
 
+  bool HasSqPoll() const {
+    return sqpoll_f_;
+  }
+
+  //! How many times the loop had to wake up the sleeping SQ thread in SQPOLL mode.
+  uint64_t sq_thread_wakeups() const {
+    return sq_wakeups_.load(std::memory_order_relaxed);
+  }
+
+  //! Where the loop spends its time. Only the iterations that dispatched completions, ran
+  //! tasks or fibers are sampled into the histograms.
+  struct LoopStats {
+    uint64_t iterations = 0;  // busy iterations.
+    uint64_t cqes = 0, tasks = 0;
+    uint64_t fiber_usec = 0;  // running the fibers.
+    uint64_t wait_usec = 0;   // sleeping in io_uring_enter.
+    uint64_t stalls = 0;
+
+    // AsyncBrief calls that found the task queue full and the waits they did until it
+    // had room.
+    uint64_t task_queue_full = 0, task_queue_waits = 0;
+
+    base::Histogram iteration_usec, cqes_per_wake, tasks_per_iteration;
+  };
+
+  //! Must be called in the proactor thread.
+  LoopStats GetLoopStats() const;
+
+  /**
+   *  Registered resources. Registered files and buffers spare the kernel the lookup of the file
+   *  and the pinning of the user pages on each operation. RegisterFd and UnregisterFd are
+   *  thread-safe, the buffer functions must be called in the proactor thread.
+   * */
+
+  //! Registers fd in the fixed-file table of the ring, the table size is set by
+  //! --proactor_fixed_files. Returns the index to pass with IOSQE_FIXED_FILE or -1 if
+  //! the kernel does not support fixed files or the table is full. The table holds a reference
+  //! to the file, it must be unregistered before the fd is closed.
+  int RegisterFd(int fd);
+
+  void UnregisterFd(unsigned fixed_fd);
+
+  //! Registers the buffers with the ring, replacing the previously registered ones.
+  //! Returns 0 or -errno. The memory must stay valid until UnregisterBuffers() or the proactor
+  //! is destroyed.
+  int RegisterBuffers(const iovec* iov, unsigned count);
+
+  void UnregisterBuffers();
+
+  //! Returns the index of the registered buffer that contains [buf, buf + len) or -1.
+  int FindRegisteredBuffer(const void* buf, size_t len) const;
+
+  //! Buffer group of the receive buffers that the kernel provides to the requests submitted
+  //! with IOSQE_BUFFER_SELECT. The ring of --proactor_recv_buffers buffers is registered in
+  //! Init, kernels before 5.19 do not support it.
+  enum { kRecvBufGroup = 0 };
+
+  bool HasRecvBufRing() const {
+    return bool(recv_ring_);
+  }
+
+  size_t recv_buffer_size() const;
+
+  //! Returns the buffer that the kernel picked for a completion with IORING_CQE_F_BUFFER.
+  uint8_t* GetRecvBuffer(uint16_t bid);
+
+  //! Gives the buffer back to the kernel once its data was consumed.
+  void ReturnRecvBuffer(uint16_t bid);
+
+  //! The flags of the completion whose callback is running. IORING_CQE_F_MORE denotes that
+  //! a multishot request posts more completions to the same callback.
+  uint32_t cqe_flags() const {
+    return cqe_flags_;
+  }
+
   /**
    *  Message passing functions.
    * */
@@ -119,7 +257,9 @@ class Proactor {
     // So I just copy them into capture.
     // We forward captured variables so we need lambda to be mutable.
     AsyncBrief([f = std::forward<Func>(f), args...]() mutable {
-      ::boost::fibers::fiber(std::forward<Func>(f), std::forward<Args>(args)...).detach();
+      ::boost::fibers::fiber(std::allocator_arg, fibers_ext::PooledStackAllocator(),
+                             std::forward<Func>(f), std::forward<Args>(args)...)
+          .detach();
     });
   }
 
@@ -129,7 +269,10 @@ class Proactor {
     ::boost::fibers::fiber fb;
 
     // It's safe to use & capture since we await before returning.
-    AwaitBrief([&] { fb = boost::fibers::fiber(std::forward<Args>(args)...); });
+    AwaitBrief([&] {
+      fb = boost::fibers::fiber(std::allocator_arg, fibers_ext::PooledStackAllocator(),
+                                std::forward<Args>(args)...);
+    });
     return fb;
   }
 
@@ -140,6 +283,21 @@ class Proactor {
   // To summarize: 'f' may not block its thread, but allowed to block its fiber.
   template <typename Func> auto AwaitBlocking(Func&& f) -> decltype(f());
 
+  // Runs 'f' on the offload pool that is shared by all the proactors and suspends only the
+  // calling fiber until it returns. Unlike AwaitBlocking, 'f' may block its thread, thus it
+  // fits syscalls like getaddrinfo or fsync. The pool has --proactor_offload_threads threads
+  // and grows up to --proactor_offload_max_threads while the calls wait.
+  template <typename Func> static auto AwaitOffload(Func&& f) -> decltype(f());
+
+  struct OffloadStats {
+    uint64_t calls = 0;
+    uint32_t pending = 0;  // Submitted or running.
+    uint32_t threads = 0;
+    base::Histogram latency_usec;  // From the submission till the return of a call.
+  };
+
+  static OffloadStats GetOffloadStats();
+
   void RegisterSignal(std::initializer_list<uint16_t> l, std::function<void(int)> cb);
 
   void ClearSignal(std::initializer_list<uint16_t> l) {
@@ -151,7 +309,7 @@ class Proactor {
  private:
   enum { WAIT_SECTION_STATE = 1UL << 31 };
 
-  void Init(size_t ring_size, int wq_fd = -1);
+  void Init(const Options& opts);
 
   void WakeRing();
 
@@ -164,6 +322,8 @@ class Proactor {
 
   void DispatchCompletions(io_uring_cqe* cqes, unsigned count);
 
+  static void RunOffloaded(fu2::function_view<void()> task);
+
   template <typename Func> bool EmplaceTaskQueue(Func&& f) {
     if (task_queue_.try_enqueue(std::forward<Func>(f))) {
       WakeupIfNeeded();
@@ -174,6 +334,10 @@ class Proactor {
   }
 
   void RegrowCentries();
+  void AdvanceTimers(uint64_t now_ns);
+  bool ArmTimerWakeup();
+  uint32_t AllocCompletionEntry(CbType cb, int64_t payload);
+  void InitRecvBufRing();
 
   io_uring ring_;
   pthread_t thread_id_ = 0U;
@@ -181,7 +345,8 @@ class Proactor {
   int wake_fd_;
   bool is_stopped_ = true;
   uint8_t fast_poll_f_ : 1;
-  uint8_t reseved_f_ : 7;
+  uint8_t sqpoll_f_ : 1;
+  uint8_t reseved_f_ : 6;
 
   // We use fu2 function to allow moveable semantics.
   using Tasklet =
@@ -195,6 +360,13 @@ class Proactor {
 
   FuncQ task_queue_;
   std::atomic_uint32_t tq_seq_{0}, tq_wakeups_{0};
+  std::atomic_uint64_t sq_wakeups_{0}, tq_full_{0}, tq_waits_{0};
+  LoopStats loop_stats_;
+
+  base::TimerWheel timer_wheel_;
+  uint64_t timer_base_ms_ = 0;   // The time of the tick 0 of timer_wheel_.
+  uint64_t timer_armed_ms_ = 0;  // The expiry of the pending wakeup timeout or 0.
+  timespec timer_ts_;
   EventCount task_queue_avail_, sqe_avail_;
   ::boost::fibers::context* main_loop_ctx_ = nullptr;
 
@@ -206,13 +378,24 @@ class Proactor {
     // serves for linked list management when unused. Also can store an additional payload
     // field when in flight.
     int32_t val = -1;
-    int32_t opcode = -1;  // For debugging. TODO: to remove later.
+
+    // The completions that a batch entry still expects, 0 for the single entries.
+    int32_t pending = 0;
   };
   static_assert(sizeof(CompletionEntry) == 40, "");
 
   std::vector<CompletionEntry> centries_;
   int32_t next_free_ = -1;
 
+  // Free indices of the fixed-file table, empty if fixed files are not supported.
+  std::mutex fixed_mu_;
+  std::vector<unsigned> free_fixed_fds_;
+  std::vector<iovec> registered_bufs_;
+
+  struct RecvBufRing;
+  std::unique_ptr<RecvBufRing> recv_ring_;
+  uint32_t cqe_flags_ = 0;
+
   struct TLInfo {
     bool is_proactor_thread = false;
     uint32_t proactor_index = 0;
@@ -230,12 +413,14 @@ template <typename Func> void Proactor::AsyncBrief(Func&& f) {
   if (EmplaceTaskQueue(std::forward<Func>(f)))
     return;
 
+  tq_full_.fetch_add(1, std::memory_order_relaxed);
   while (true) {
     EventCount::Key key = task_queue_avail_.prepareWait();
 
     if (EmplaceTaskQueue(std::forward<Func>(f))) {
       break;
     }
+    tq_waits_.fetch_add(1, std::memory_order_relaxed);
     task_queue_avail_.wait(key.epoch());
   }
 }
@@ -280,5 +465,13 @@ template <typename Func> auto Proactor::AwaitBlocking(Func&& f) -> decltype(f())
   return std::move(mover).get();
 }
 
+template <typename Func> auto Proactor::AwaitOffload(Func&& f) -> decltype(f()) {
+  using ResultType = decltype(f());
+  detail::ResultMover<ResultType> mover;
+  RunOffloaded([&] { mover.Apply(std::forward<Func>(f)); });
+
+  return std::move(mover).get();
+}
+
 }  // namespace uring
 }  // namespace util
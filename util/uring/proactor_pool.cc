@@ -5,11 +5,14 @@
 #include "util/uring/proactor_pool.h"
 
 #include "base/logging.h"
+#include "base/numa.h"
 #include "base/pthread_utils.h"
 
 DEFINE_uint32(proactor_threads, 0, "Number of io threads in the pool");
 DEFINE_bool(proactor_reuse_wq, true, "If true reuses the same work-queue for all io_urings "
                                      "in the pool");
+DEFINE_bool(proactor_numa, false, "If true, spreads the proactor threads evenly over the NUMA "
+                                  "nodes and allocates their memory on the local node");
 
 using namespace std;
 
@@ -23,6 +26,25 @@ ProactorPool::ProactorPool(std::size_t pool_size) {
   }
   pool_size_ = pool_size;
   proactor_.reset(new Proactor[pool_size]);
+
+  const base::NumaTopology& topology = base::NumaTopology::Get();
+  if (FLAGS_proactor_numa) {
+    cpus_ = topology.SpreadThreads(pool_size);
+  } else {
+    for (size_t i = 0; i < pool_size; ++i)
+      cpus_.push_back(i % thread::hardware_concurrency());
+  }
+
+  for (size_t i = 0; i < pool_size; ++i) {
+    unsigned node = FLAGS_proactor_numa ? topology.NodeOfCpu(cpus_[i]) : 0;
+    numa_node_.push_back(node);
+    if (node >= node_proactors_.size())
+      node_proactors_.resize(node + 1);
+    node_proactors_[node].push_back(i);
+  }
+  node_next_.reset(new std::atomic_uint32_t[node_proactors_.size()]);
+  for (size_t i = 0; i < node_proactors_.size(); ++i)
+    node_next_[i].store(0, std::memory_order_relaxed);
 }
 
 ProactorPool::~ProactorPool() {
@@ -34,21 +56,37 @@ void ProactorPool::CheckRunningState() {
 }
 
 void ProactorPool::Run(uint32_t ring_depth) {
+  Proactor::Options opts;
+  opts.ring_depth = ring_depth;
+  Run(opts);
+}
+
+void ProactorPool::Run(const Proactor::Options& opts) {
   CHECK_EQ(STOPPED, state_);
 
   char buf[32];
 
-  auto init_proactor = [this, ring_depth, &buf](int i, int wq_fd) mutable {
+  auto init_proactor = [this, &opts, &buf](int i, int wq_fd) mutable {
     snprintf(buf, sizeof(buf), "Proactor%u", i);
-    auto cb = [ptr = &proactor_[i], ring_depth]() { ptr->Run(ring_depth); };
-    pthread_t tid = base::StartThread(buf, cb);
-    cpu_set_t cps;
-    CPU_ZERO(&cps);
-    CPU_SET(i % thread::hardware_concurrency(), &cps);
-
-    int rc = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &cps);
-    LOG_IF(WARNING, rc) << "Error calling pthread_setaffinity_np: "
-                        << strerror(rc) << "\n";
+    Proactor::Options popts = opts;
+    if (opts.sq_thread_cpu >= 0)
+      popts.sq_thread_cpu = (opts.sq_thread_cpu + i) % thread::hardware_concurrency();
+    // The thread pins itself before it sets up the ring, so that the ring, the fiber stacks
+    // and the buffers of the proactor are allocated by its own cpu.
+    auto cb = [ptr = &proactor_[i], popts, cpu = cpus_[i], node = numa_node_[i]]() {
+      cpu_set_t cps;
+      CPU_ZERO(&cps);
+      CPU_SET(cpu, &cps);
+
+      int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cps);
+      LOG_IF(WARNING, rc) << "Error calling pthread_setaffinity_np: "
+                          << strerror(rc) << "\n";
+      if (FLAGS_proactor_numa)
+        base::PreferLocalMemory(node);
+
+      ptr->Run(popts);
+    };
+    base::StartThread(buf, cb);
   };
   init_proactor(0, -1);
   int wq_fd = FLAGS_proactor_reuse_wq ? proactor_[0].ring_fd() : -1;
@@ -97,6 +135,20 @@ Proactor* ProactorPool::GetNextProactor() {
   return &proactor;
 }
 
+Proactor* ProactorPool::GetNextProactor(unsigned numa_node) {
+  if (numa_node >= node_proactors_.size() || node_proactors_[numa_node].empty())
+    return GetNextProactor();
+
+  // Same non-transactional round-robin as above.
+  const auto& indices = node_proactors_[numa_node];
+  uint32_t pos = node_next_[numa_node].load(std::memory_order_relaxed);
+  if (pos >= indices.size())
+    pos = 0;
+  node_next_[numa_node].store(pos + 1, std::memory_order_relaxed);
+
+  return &at(indices[pos]);
+}
+
 absl::string_view ProactorPool::GetString(absl::string_view source) {
   if (source.empty()) {
     return source;
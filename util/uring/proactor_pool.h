@@ -18,6 +18,9 @@
 namespace util {
 namespace uring {
 
+// Pools of at least kBroadcastTreeMin proactors pass the OnAll calls along a tree: the caller
+// posts to proactor 0 and each proactor posts to its kBroadcastFanout children before it runs
+// the task. The calls of a caller still reach each proactor in the order they were made.
 class ProactorPool {
   template <typename Func, typename... Args>
   using AcceptArgsCheck =
@@ -25,6 +28,9 @@ class ProactorPool {
                               int>::type;
 
  public:
+  static constexpr unsigned kBroadcastTreeMin = 16;
+  static constexpr unsigned kBroadcastFanout = 4;
+
   ProactorPool(const ProactorPool&) = delete;
   void operator=(const ProactorPool&) = delete;
 
@@ -39,6 +45,10 @@ class ProactorPool {
   //! Blocks until all the proactors up and spinning.
   void Run(uint32_t ring_depth = 256);
 
+  //! Runs the proactors with opts. If opts.sq_thread_cpu is non-negative, the SQ thread of
+  //! proactor i runs on cpu (sq_thread_cpu + i) modulo the number of cores.
+  void Run(const Proactor::Options& opts);
+
   /*! @brief Stops all io_context objects in the pool.
    *
    *  Waits for all the threads to finish. Requires that Run has been called.
@@ -49,6 +59,20 @@ class ProactorPool {
   //! Get a Proactor to use. Thread-safe.
   Proactor* GetNextProactor();
 
+  //! Like GetNextProactor but prefers the proactors on numa_node. Thread-safe.
+  Proactor* GetNextProactor(unsigned numa_node);
+
+  //! The NUMA node that proactor i runs on. All the proactors run on node 0 unless
+  //! --proactor_numa is set.
+  unsigned numa_node(size_t i) const {
+    return numa_node_[i];
+  }
+
+  //! True if the proactors are spread over more than one NUMA node.
+  bool numa_aware() const {
+    return node_proactors_.size() > 1;
+  }
+
   Proactor& operator[](size_t i) {
     return at(i);
   }
@@ -69,13 +93,9 @@ class ProactorPool {
    */
   template <typename Func, AcceptArgsCheck<Func, Proactor*> = 0>
   void AsyncOnAll(Func&& func) {
-    CheckRunningState();
-    for (unsigned i = 0; i < size(); ++i) {
-      Proactor& context = proactor_[i];
-      // func must be copied, it can not be moved, because we dsitribute it into
-      // multiple Proactors.
-      context.AsyncBrief([&context, func]() mutable { func(&context); });
-    }
+    AsyncOnAll([func = std::forward<Func>(func)](unsigned, Proactor* context) mutable {
+      func(context);
+    });
   }
 
   /*! @brief Runs func in all IO threads asynchronously.
@@ -88,9 +108,14 @@ class ProactorPool {
   template <typename Func, AcceptArgsCheck<Func, unsigned, Proactor*> = 0>
   void AsyncOnAll(Func&& func) {
     CheckRunningState();
+    if (size() >= kBroadcastTreeMin) {
+      PostSubtree(0, std::forward<Func>(func));
+      return;
+    }
     for (unsigned i = 0; i < size(); ++i) {
       Proactor& context = proactor_[i];
-      // Copy func on purpose, see above.
+      // func must be copied, it can not be moved, because we dsitribute it into
+      // multiple Proactors.
       context.AsyncBrief([&context, i, func]() mutable { func(i, &context); });
     }
   }
@@ -208,11 +233,30 @@ class ProactorPool {
   absl::string_view GetString(absl::string_view source);
 
  private:
+  // Runs func in proactor i after forwarding its copies to the children of i. The tree has no
+  // cycles, so the proactors waiting for a full task queue of a child do not deadlock.
+  template <typename Func> void PostSubtree(unsigned i, Func func) {
+    proactor_[i].AsyncBrief([this, i, func = std::move(func)]() mutable {
+      unsigned end = std::min<size_t>(size(), (i + 1) * kBroadcastFanout + 1);
+      for (unsigned child = i * kBroadcastFanout + 1; child < end; ++child) {
+        PostSubtree(child, func);
+      }
+      func(i, &proactor_[i]);
+    });
+  }
+
   void WrapLoop(size_t index, fibers_ext::BlockingCounter* bc);
   void CheckRunningState();
 
   std::unique_ptr<Proactor[]> proactor_;
 
+  std::vector<size_t> cpus_;  // The cpu of each proactor thread.
+  std::vector<unsigned> numa_node_;
+
+  // Indices of the proactors per NUMA node and the round-robin positions within them.
+  std::vector<std::vector<uint32_t>> node_proactors_;
+  std::unique_ptr<std::atomic_uint32_t[]> node_next_;
+
   /// The next io_context to use for a connection.
   std::atomic_uint_fast32_t next_io_context_{0};
   uint32_t pool_size_;
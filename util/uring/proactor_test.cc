@@ -14,11 +14,14 @@
 #include "base/logging.h"
 #include "util/fibers/fibers_ext.h"
 #include "util/uring/accept_server.h"
+#include "util/uring/fiber_call.h"
 #include "util/uring/uring_fiber_algo.h"
 #include "util/uring/proactor_pool.h"
 #include "util/uring/sliding_counter.h"
 #include "util/uring/varz.h"
 
+DECLARE_bool(uring_fiber_stealing);
+
 using namespace boost;
 using namespace std;
 using testing::Pair;
@@ -77,6 +80,38 @@ TEST_F(ProactorTest, Sleep) {
   });
 }
 
+TEST_F(ProactorTest, Offload) {
+  Proactor::OffloadStats before = Proactor::GetOffloadStats();
+
+  // The proactor keeps running its fibers while the offloaded calls block their threads.
+  unsigned ticks = 0, ticks_during = 0;
+  pthread_t offload_tid = 0;
+  int res = proactor_->AwaitBlocking([&] {
+    fibers::fiber ticker([&] {
+      for (unsigned i = 0; i < 5; ++i, ++ticks)
+        this_fiber::sleep_for(1ms);
+    });
+    int val = Proactor::AwaitOffload([&] {
+      offload_tid = pthread_self();
+      usleep(20000);
+      return 42;
+    });
+    ticks_during = ticks;
+    ticker.join();
+    return val;
+  });
+  EXPECT_EQ(42, res);
+  EXPECT_GT(ticks_during, 0);
+  EXPECT_EQ(5, ticks);
+  EXPECT_NE(0, offload_tid);
+  EXPECT_FALSE(pthread_equal(offload_tid, proactor_->thread_id()));
+
+  Proactor::OffloadStats after = Proactor::GetOffloadStats();
+  EXPECT_EQ(before.calls + 1, after.calls);
+  EXPECT_EQ(0, after.pending);
+  EXPECT_GE(after.latency_usec.max(), 20000);
+}
+
 TEST_F(ProactorTest, SqeOverflow) {
   size_t unique_id = 0;
   char buf[128];
@@ -103,6 +138,40 @@ TEST_F(ProactorTest, SqeOverflow) {
   close(fd);
 }
 
+TEST_F(ProactorTest, SubmitBatch) {
+  constexpr unsigned kNumReads = 16;
+  char buf[kNumReads][64], expected[kNumReads][64];
+
+  int fd = open(google::GetArgv0(), O_RDONLY | O_CLOEXEC);
+  CHECK_GT(fd, 0);
+  for (unsigned i = 0; i < kNumReads; ++i) {
+    ASSERT_EQ(64, pread(fd, expected[i], 64, i * 1000));
+  }
+
+  proactor_->AwaitBlocking([&] {
+    FiberBatch batch(proactor_.get(), kNumReads);
+    for (unsigned i = 0; i < kNumReads; ++i) {
+      batch[i].PrepRead(fd, buf[i], 64, i * 1000);
+    }
+    EXPECT_EQ(0, batch.Get());
+    for (unsigned i = 0; i < kNumReads; ++i) {
+      EXPECT_EQ(64, batch.result(i));
+    }
+
+    // A failed link cancels the rest of the chain.
+    FiberBatch linked(proactor_.get(), 2, true);
+    linked[0].PrepRead(-1, buf[0], 64, 0);
+    linked[1].PrepRead(fd, buf[1], 64, 0);
+    EXPECT_EQ(-EBADF, linked.Get());
+    EXPECT_EQ(-ECANCELED, linked.result(1));
+  });
+  close(fd);
+
+  for (unsigned i = 0; i < kNumReads; ++i) {
+    EXPECT_EQ(0, memcmp(expected[i], buf[i], 64));
+  }
+}
+
 TEST_F(ProactorTest, AsyncEvent) {
   fibers_ext::Done done;
 
@@ -117,6 +186,55 @@ TEST_F(ProactorTest, AsyncEvent) {
   done.Wait();
 }
 
+TEST_F(ProactorTest, FixedFile) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  proactor_->AwaitBlocking([&] {
+    int fixed = proactor_->RegisterFd(fds[0]);
+    if (fixed < 0) {
+      LOG(INFO) << "Fixed files are not supported";
+      return;
+    }
+    ASSERT_EQ(3, write(fds[1], "foo", 3));
+
+    char buf[8];
+    FiberCall fc(proactor_.get());
+    fc->PrepRead(fixed, buf, sizeof(buf), 0);
+    fc->SetFixedFile();
+    EXPECT_EQ(3, fc.Get());
+    EXPECT_EQ("foo", string(buf, 3));
+    proactor_->UnregisterFd(fixed);
+  });
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(ProactorTest, SqPoll) {
+  Proactor::Options opts;
+  opts.ring_depth = kRingDepth;
+  opts.sqpoll = true;
+  opts.sq_thread_idle_ms = 1;
+  opts.busy_poll_usec = 100;
+
+  Proactor proactor;
+  std::thread t([&] { proactor.Run(opts); });
+
+  proactor.AwaitBlocking([&] {
+    for (unsigned i = 0; i < 10; ++i) {
+      FiberCall fc(&proactor);
+      fc->PrepNOP();
+      EXPECT_EQ(0, fc.Get());
+      this_fiber::sleep_for(2ms);  // Lets the SQ thread go to sleep.
+    }
+  });
+  LOG(INFO) << "SQPOLL: " << proactor.HasSqPoll() << ", SQ thread wakeups "
+            << proactor.sq_thread_wakeups();
+
+  proactor.Stop();
+  t.join();
+}
+
 TEST_F(ProactorTest, Pool) {
   std::atomic_int val{0};
   ProactorPool pool{2};
@@ -127,6 +245,69 @@ TEST_F(ProactorTest, Pool) {
   pool.Stop();
 }
 
+TEST_F(ProactorTest, Stealing) {
+  constexpr unsigned kNumFibers = 16;
+
+  FLAGS_uring_fiber_stealing = true;
+  ProactorPool pool{2};
+  pool.Run();
+
+  std::atomic_uint ran_elsewhere{0};
+  fibers_ext::BlockingCounter bc(kNumFibers);
+  pool[0].AwaitBrief([&] {
+    for (unsigned i = 0; i < kNumFibers; ++i) {
+      pool[0].LaunchFiber([&] {
+        this_fiber::properties<UringFiberProps>().set_migratable(true);
+        for (unsigned j = 0; j < 100; ++j) {
+          if (!pool[0].InMyThread())
+            ++ran_elsewhere;
+          this_fiber::yield();
+        }
+        bc.Dec();
+      }).detach();
+    }
+  });
+  bc.Wait();
+
+  // Stealing depends on timing so we only check that all the fibers have finished.
+  LOG(INFO) << "Iterations on other proactors: " << ran_elsewhere;
+  pool.Stop();
+  FLAGS_uring_fiber_stealing = false;
+}
+
+TEST_F(ProactorTest, LoopStats) {
+  for (unsigned i = 0; i < 10; ++i) {
+    proactor_->AwaitBrief([] {});
+  }
+  fibers_ext::Done done;
+  auto cb = [done](IoResult, int64_t payload, Proactor* p) mutable { done.Notify(); };
+  proactor_->AsyncBrief([&] {
+    SubmitEntry se = proactor_->GetSubmitEntry(std::move(cb), 1);
+    se.sqe()->opcode = IORING_OP_NOP;
+  });
+  done.Wait();
+
+  Proactor::LoopStats stats = proactor_->AwaitBrief([&] { return proactor_->GetLoopStats(); });
+  EXPECT_GE(stats.tasks, 10);
+  EXPECT_GE(stats.cqes, 1);
+  EXPECT_GT(stats.iterations, 0);
+  EXPECT_GT(stats.tasks_per_iteration.count(), 0);
+
+  ProactorPool pool{2};
+  pool.Run();
+  VarzProactorLoop loop_varz("test-loop");
+  loop_varz.Init(&pool);
+
+  vector<string> names;
+  VarzListNode::Iterate([&](const char* name, VarzValue&& v) {
+    if (strcmp(name, "test-loop") == 0) {
+      for (const auto& k_v : v.key_value_array)
+        names.push_back(k_v.first);
+    }
+  });
+  EXPECT_THAT(names, ElementsAre("proactor0", "proactor1"));
+}
+
 TEST_F(ProactorTest, DispatchTest) {
   fibers::condition_variable cnd1, cnd2;
   fibers::mutex mu;
@@ -189,6 +370,31 @@ TEST_F(ProactorTest, Varz) {
   EXPECT_THAT(vals, ElementsAre(Pair("test1", 0)));
 }
 
+TEST_F(ProactorTest, Timer) {
+  struct Event : public base::TimerEventInterface {
+    fibers_ext::Done done;
+    unsigned fired = 0;
+
+    void execute() final {
+      ++fired;
+      done.Notify();
+    }
+  };
+
+  Event ev1, ev2;
+  auto start = chrono::steady_clock::now();
+  proactor_->AwaitBrief([&] {
+    proactor_->AddTimer(&ev1, 10);
+    proactor_->AddTimer(&ev2, 5);
+    proactor_->CancelTimer(&ev2);
+  });
+  ev1.done.Wait();
+  EXPECT_GE(chrono::steady_clock::now() - start, 9ms);
+
+  // ev2 was due earlier.
+  EXPECT_EQ(1, proactor_->AwaitBrief([&] { return ev1.fired + ev2.fired; }));
+}
+
 
 void BM_AsyncCall(benchmark::State& state) {
   Proactor proactor;
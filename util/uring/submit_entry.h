@@ -6,6 +6,31 @@
 
 #include <liburing/io_uring.h>
 
+// Flags of the kernels newer than our headers.
+#ifndef IORING_CQE_F_BUFFER
+#define IORING_CQE_F_BUFFER (1U << 0)
+#endif
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+#ifndef IORING_CQE_BUFFER_SHIFT
+#define IORING_CQE_BUFFER_SHIFT 16
+#endif
+
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT (1U << 0)
+#endif
+
+#ifndef IORING_RECV_MULTISHOT
+#define IORING_RECV_MULTISHOT (1U << 1)
+#endif
+
+#ifndef IORING_CQE_F_NOTIF
+#define IORING_CQE_F_NOTIF (1U << 3)
+#endif
+
 namespace util {
 namespace uring {
 
@@ -31,6 +56,36 @@ class SubmitEntry {
     sqe_->msg_flags = flags;
   }
 
+  void PrepRecv(int fd, void* buf, unsigned size, unsigned flags) {
+    PrepFd(IORING_OP_RECV, fd);
+    sqe_->addr = (unsigned long)buf;
+    sqe_->len = size;
+    sqe_->msg_flags = flags;
+  }
+
+  // Posts a completion per chunk of the received data, each one in a buffer of the group
+  // (see SetBufferSelect), flagged with IORING_CQE_F_MORE until the last one.
+  void PrepRecvMultishot(int fd, uint16_t group) {
+    PrepRecv(fd, nullptr, 0, 0);
+    sqe_->ioprio |= IORING_RECV_MULTISHOT;
+    SetBufferSelect(group);
+  }
+
+  // With multishot the request posts a completion per accepted socket, flagged with
+  // IORING_CQE_F_MORE until the last one.
+  void PrepAccept(int fd, unsigned flags, bool multishot) {
+    PrepFd(IORING_OP_ACCEPT, fd);
+    sqe_->accept_flags = flags;
+    if (multishot)
+      sqe_->ioprio |= IORING_ACCEPT_MULTISHOT;
+  }
+
+  // Cancels the request submitted with user_data.
+  void PrepCancel(uint64_t user_data) {
+    PrepFd(IORING_OP_ASYNC_CANCEL, -1);
+    sqe_->addr = user_data;
+  }
+
   void PrepRead(int fd, void* buf, unsigned size, size_t offset) {
     PrepFd(IORING_OP_READ, fd);
     sqe_->addr = (unsigned long)buf;
@@ -38,6 +93,27 @@ class SubmitEntry {
     sqe_->off = offset;
   }
 
+  void PrepWrite(int fd, const void* buf, unsigned size, size_t offset) {
+    PrepFd(IORING_OP_WRITE, fd);
+    sqe_->addr = (unsigned long)buf;
+    sqe_->len = size;
+    sqe_->off = offset;
+  }
+
+  // buf must lie in the registered buffer buf_index. See Proactor::RegisterBuffers.
+  void PrepReadFixed(int fd, void* buf, unsigned size, size_t offset, unsigned buf_index) {
+    PrepRead(fd, buf, size, offset);
+    sqe_->opcode = IORING_OP_READ_FIXED;
+    sqe_->buf_index = buf_index;
+  }
+
+  void PrepWriteFixed(int fd, const void* buf, unsigned size, size_t offset,
+                      unsigned buf_index) {
+    PrepWrite(fd, buf, size, offset);
+    sqe_->opcode = IORING_OP_WRITE_FIXED;
+    sqe_->buf_index = buf_index;
+  }
+
   void PrepSendMsg(int fd, const struct msghdr* msg, unsigned flags) {
     PrepFd(IORING_OP_SENDMSG, fd);
     sqe_->addr = (unsigned long)msg;
@@ -45,6 +121,25 @@ class SubmitEntry {
     sqe_->msg_flags = flags;
   }
 
+  // Zero-copy sendmsg (since 6.1). The completion of the send is flagged with IORING_CQE_F_MORE
+  // if a notification with IORING_CQE_F_NOTIF follows once the kernel released the buffers.
+  void PrepSendMsgZc(int fd, const struct msghdr* msg, unsigned flags) {
+    PrepSendMsg(fd, msg, flags);
+    sqe_->opcode = kOpSendMsgZc;
+  }
+
+  // Moves len bytes from fd_in to fd_out, one of them must be a pipe. -1 offsets mean the
+  // current position, pipes require them.
+  void PrepSplice(int fd_in, int64_t off_in, int fd_out, int64_t off_out, unsigned len,
+                  unsigned flags) {
+    PrepFd(IORING_OP_SPLICE, fd_out);
+    sqe_->len = len;
+    sqe_->off = off_out;
+    sqe_->splice_off_in = off_in;
+    sqe_->splice_fd_in = fd_in;
+    sqe_->splice_flags = flags;
+  }
+
   void PrepConnect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
     PrepFd(IORING_OP_CONNECT, fd);
     sqe_->addr = (unsigned long)addr;
@@ -59,6 +154,28 @@ class SubmitEntry {
     sqe_->timeout_flags = IORING_TIMEOUT_ABS;
   }
 
+  // Marks the fd of the prepared entry as an index in the fixed-file table.
+  // See Proactor::RegisterFd.
+  void SetFixedFile() {
+    sqe_->flags |= IOSQE_FIXED_FILE;
+  }
+
+  // The kernel picks the buffer of the request from the buffer group when the data arrives.
+  // See Proactor::kRecvBufGroup.
+  void SetBufferSelect(uint16_t group) {
+    sqe_->flags |= IOSQE_BUFFER_SELECT;
+    sqe_->buf_group = group;
+  }
+
+  // Cancels the preceding request of the link if it does not complete until the absolute
+  // CLOCK_MONOTONIC time ts. The request then fails with -ECANCELED.
+  void PrepLinkTimeout(const timespec* ts) {
+    PrepFd(IORING_OP_LINK_TIMEOUT, -1);
+    sqe_->addr = (unsigned long)ts;
+    sqe_->len = 1;
+    sqe_->timeout_flags = IORING_TIMEOUT_ABS;
+  }
+
   // TODO: To remove this accessor.
   io_uring_sqe* sqe() {
     return sqe_;
@@ -69,6 +186,8 @@ class SubmitEntry {
   }
 
  private:
+  enum { kOpSendMsgZc = 48 };  // IORING_OP_SENDMSG_ZC is missing in our headers.
+
   explicit SubmitEntry(io_uring_sqe* sqe) : sqe_(sqe) {
   }
 
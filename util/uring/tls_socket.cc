@@ -0,0 +1,316 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/uring/tls_socket.h"
+
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+
+#include "base/logging.h"
+#include "util/uring/fiber_call.h"
+
+DEFINE_bool(uring_ktls, true, "If true, TlsSocket lets the kernel encrypt the records it sends "
+                              "when both OpenSSL and the kernel support kTLS");
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+// OpenSSL 3 configures kTLS through BIO controls that only its internal bio.h defines.
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define URING_TLS_KTLS 1
+#define BIO_CTRL_SET_KTLS 72
+#define BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG 74
+#define BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG 75
+#endif
+
+namespace util {
+namespace uring {
+
+using namespace std;
+
+namespace {
+
+inline TlsSocket* GetSocket(BIO* bio) {
+  return static_cast<TlsSocket*>(BIO_get_data(bio));
+}
+
+int BioCreate(BIO* bio) {
+  BIO_set_init(bio, 1);
+  return 1;
+}
+
+}  // namespace
+
+struct TlsSocket::BioMethods {
+  BIO_METHOD* method;
+
+  BioMethods() {
+    method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "uring_socket");
+    CHECK(method);
+    BIO_meth_set_write(method, &TlsSocket::BioWrite);
+    BIO_meth_set_read(method, &TlsSocket::BioRead);
+    BIO_meth_set_ctrl(method, &TlsSocket::BioCtrl);
+    BIO_meth_set_create(method, &BioCreate);
+  }
+};
+
+TlsSocket::TlsSocket(FiberSocket* next, SSL_CTX* ctx) : next_(next), ssl_(SSL_new(ctx)) {
+  CHECK(ssl_);
+  static BioMethods methods;
+
+  BIO* bio = BIO_new(methods.method);
+  CHECK(bio);
+  BIO_set_data(bio, this);
+  SSL_set_bio(ssl_, bio, bio);
+
+  // Receives whatever the socket has instead of a record header at a time.
+  SSL_set_read_ahead(ssl_, 1);
+  SSL_set_mode(ssl_, SSL_MODE_RELEASE_BUFFERS);
+
+#ifdef URING_TLS_KTLS
+  if (FLAGS_uring_ktls)
+    SSL_set_options(ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+TlsSocket::~TlsSocket() {
+  SSL_free(ssl_);
+}
+
+auto TlsSocket::Accept() -> error_code {
+  return Handshake(&SSL_accept);
+}
+
+auto TlsSocket::Connect() -> error_code {
+  return Handshake(&SSL_connect);
+}
+
+auto TlsSocket::Handshake(int (*op)(SSL*)) -> error_code {
+  CHECK(next_->proactor() && next_->proactor()->InMyThread());
+
+  ERR_clear_error();
+  io_ec_.clear();
+  int res = op(ssl_);
+  if (res != 1)
+    return MapError(res);
+
+  VLOG(1) << "TLS handshake done with " << SSL_get_cipher_name(ssl_) << ", ktls send "
+          << ktls_tx_;
+  return error_code{};
+}
+
+auto TlsSocket::Shutdown() -> error_code {
+  ERR_clear_error();
+  io_ec_.clear();
+
+  // Does not wait for the close_notify of the peer.
+  error_code ec;
+  int res = SSL_shutdown(ssl_);
+  if (res < 0)
+    ec = MapError(res);
+
+  error_code ec2 = next_->Shutdown(SHUT_RDWR);
+  return ec ? ec : ec2;
+}
+
+auto TlsSocket::Send(const iovec* ptr, size_t len) -> expected_size_t {
+  if (ktls_tx_)
+    return next_->Send(ptr, len);
+
+  size_t total = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (ptr[i].iov_len == 0)
+      continue;
+
+    ERR_clear_error();
+    io_ec_.clear();
+    int chunk = std::min<size_t>(ptr[i].iov_len, INT_MAX);
+    int res = SSL_write(ssl_, ptr[i].iov_base, chunk);
+    if (res <= 0) {
+      if (total)
+        break;
+      return nonstd::make_unexpected(MapError(res));
+    }
+    total += res;
+    if (size_t(res) < ptr[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+auto TlsSocket::Recv(iovec* ptr, size_t len) -> expected_size_t {
+  size_t total = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (ptr[i].iov_len == 0)
+      continue;
+
+    // Does not block once some data was received.
+    if (total && SSL_pending(ssl_) == 0)
+      break;
+
+    ERR_clear_error();
+    io_ec_.clear();
+    int chunk = std::min<size_t>(ptr[i].iov_len, INT_MAX);
+    int res = SSL_read(ssl_, ptr[i].iov_base, chunk);
+    if (res <= 0) {
+      if (total)
+        break;
+      return nonstd::make_unexpected(MapError(res));
+    }
+    total += res;
+    if (size_t(res) < ptr[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+auto TlsSocket::MapError(int res) -> error_code {
+  int err = SSL_get_error(ssl_, res);
+  if (err == SSL_ERROR_ZERO_RETURN)
+    return make_error_code(errc::connection_aborted);
+
+  // The socket failed underneath.
+  if ((err == SSL_ERROR_SYSCALL || err == SSL_ERROR_SSL) && io_ec_)
+    return io_ec_;
+
+  char buf[256];
+  ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+  VLOG(1) << "TLS error " << err << ": " << buf;
+  ERR_clear_error();
+
+  return make_error_code(errc::protocol_error);
+}
+
+int TlsSocket::BioWrite(BIO* bio, const char* data, int len) {
+  TlsSocket* me = GetSocket(bio);
+  BIO_clear_retry_flags(bio);
+
+  if (me->record_type_)
+    return me->SendControlRecord(data, len);
+
+  iovec v{const_cast<char*>(data), size_t(len)};
+  auto res = me->next_->Send(&v, 1);
+  if (!res) {
+    me->io_ec_ = res.error();
+    return -1;
+  }
+  return res.value();
+}
+
+int TlsSocket::BioRead(BIO* bio, char* data, int len) {
+  TlsSocket* me = GetSocket(bio);
+  BIO_clear_retry_flags(bio);
+
+  iovec v{data, size_t(len)};
+  auto res = me->next_->Recv(&v, 1);
+  if (!res) {
+    me->io_ec_ = res.error();
+    return -1;
+  }
+  return res.value();
+}
+
+long TlsSocket::BioCtrl(BIO* bio, int cmd, long larg, void* parg) {
+  TlsSocket* me = GetSocket(bio);
+
+  switch (cmd) {
+    case BIO_CTRL_FLUSH:  // The writes are not buffered.
+    case BIO_CTRL_DUP:
+      return 1;
+#ifdef URING_TLS_KTLS
+    // Only the transmit direction is offloaded: the kernel would deliver the control records
+    // that it receives as ancillary data that is unavailable through FiberSocket::Recv.
+    case BIO_CTRL_SET_KTLS:
+      return larg ? me->EnableKtlsTx(parg) : 0;
+    case BIO_CTRL_GET_KTLS_SEND:
+      return me->ktls_tx_;
+    case BIO_CTRL_GET_KTLS_RECV:
+      return 0;
+    case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+      me->record_type_ = larg;
+      return 0;
+    case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+      me->record_type_ = 0;
+      return 0;
+#endif
+    default:
+      return 0;
+  }
+}
+
+bool TlsSocket::EnableKtlsTx(const void* crypto_info) {
+  // OpenSSL passes a union of the crypto_info structs, its cipher type tells the size.
+  const tls_crypto_info* info = static_cast<const tls_crypto_info*>(crypto_info);
+  socklen_t info_len;
+
+  switch (info->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+      info_len = sizeof(tls12_crypto_info_aes_gcm_128);
+      break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case TLS_CIPHER_AES_GCM_256:
+      info_len = sizeof(tls12_crypto_info_aes_gcm_256);
+      break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case TLS_CIPHER_CHACHA20_POLY1305:
+      info_len = sizeof(tls12_crypto_info_chacha20_poly1305);
+      break;
+#endif
+    default:
+      return false;
+  }
+
+  int fd = next_->native_handle();
+  if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 ||
+      setsockopt(fd, SOL_TLS, TLS_TX, info, info_len) < 0) {
+    VLOG(1) << "kTLS is not available: " << strerror(errno);
+    return false;
+  }
+
+  ktls_tx_ = true;
+  return true;
+}
+
+int TlsSocket::SendControlRecord(const char* data, int len) {
+  // Alerts and post-handshake messages are rare and short, they are sent directly.
+  char cbuf[CMSG_SPACE(sizeof(uint8_t))];
+  iovec v{const_cast<char*>(data), size_t(len)};
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &v;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_TLS;
+  cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+  *CMSG_DATA(cmsg) = record_type_;
+
+  int fd = next_->native_handle();
+  while (true) {
+    ssize_t res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (res >= 0)
+      return res;
+
+    if (errno != EAGAIN) {
+      io_ec_ = error_code(errno, system_category());
+      return -1;
+    }
+
+    FiberCall fc(next_->proactor());
+    fc->PrepPollAdd(fd, POLLOUT);
+    fc.Get();
+  }
+}
+
+}  // namespace uring
+}  // namespace util
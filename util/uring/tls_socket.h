@@ -0,0 +1,90 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include <openssl/ssl.h>
+
+#include "util/uring/fiber_socket.h"
+
+namespace util {
+namespace uring {
+
+/**
+ * @brief TLS over a connected FiberSocket.
+ *
+ * OpenSSL runs on top of a BIO that sends and receives through the socket, so the handshake
+ * and the userspace records fiber-block like the socket itself. With --uring_ktls and an
+ * OpenSSL built with kTLS (3.0+), OpenSSL hands the transmit keys to the kernel once the
+ * handshake completes: Send() then passes the plaintext to FiberSocket::Send and the records
+ * are encrypted by the kernel or the NIC. The receive path always decrypts in userspace.
+ * Without kTLS everything falls back to userspace encryption.
+ *
+ * Must be used in the proactor thread of the socket, which must outlive the TlsSocket.
+ */
+class TlsSocket : public SyncStreamInterface {
+  TlsSocket(const TlsSocket&) = delete;
+  void operator=(const TlsSocket&) = delete;
+
+ public:
+  using error_code = std::error_code;
+
+  TlsSocket(FiberSocket* next, SSL_CTX* ctx);
+  ~TlsSocket();
+
+  //! Runs the server side of the handshake.
+  ABSL_MUST_USE_RESULT error_code Accept();
+
+  //! Runs the client side of the handshake.
+  ABSL_MUST_USE_RESULT error_code Connect();
+
+  //! Sends close_notify and shuts down the socket.
+  ABSL_MUST_USE_RESULT error_code Shutdown();
+
+  expected_size_t Send(const iovec* ptr, size_t len) override;
+
+  //! Returns connection_aborted once the peer closed the session.
+  expected_size_t Recv(iovec* ptr, size_t len) override;
+
+  //! True if the kernel encrypts the records that Send() transmits.
+  bool ktls_send() const {
+    return ktls_tx_;
+  }
+
+  SSL* native_handle() {
+    return ssl_;
+  }
+
+  FiberSocket* next_layer() {
+    return next_;
+  }
+
+ private:
+  struct BioMethods;
+
+  error_code Handshake(int (*op)(SSL*));
+
+  // Maps the result of an SSL call that failed.
+  error_code MapError(int res);
+
+  static int BioWrite(BIO* bio, const char* data, int len);
+  static int BioRead(BIO* bio, char* data, int len);
+  static long BioCtrl(BIO* bio, int cmd, long larg, void* parg);
+
+  // Sends a control record once kTLS transmits, the kernel wraps it with record_type_.
+  int SendControlRecord(const char* data, int len);
+  bool EnableKtlsTx(const void* crypto_info);
+
+  FiberSocket* next_;
+  SSL* ssl_;
+
+  // The socket error that failed the last BIO call.
+  error_code io_ec_;
+
+  bool ktls_tx_ = false;
+  uint8_t record_type_ = 0;  // Set by OpenSSL before it writes a non-data record.
+};
+
+}  // namespace uring
+}  // namespace util
@@ -0,0 +1,157 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/uring/tls_socket.h"
+
+#include <openssl/x509.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/fibers/fibers_ext.h"
+#include "util/uring/proactor.h"
+
+DECLARE_bool(uring_ktls);
+
+using namespace boost;
+using namespace std;
+
+namespace util {
+namespace uring {
+
+class TlsSocketTest : public testing::Test {
+ protected:
+  void SetUp() override;
+  void TearDown() override;
+
+  // Runs a TLS echo of msg over a loopback connection in the proactor thread.
+  void RunEcho(const string& msg, bool* ktls_send);
+
+  unique_ptr<Proactor> proactor_;
+  thread proactor_thread_;
+  SSL_CTX* server_ctx_ = nullptr;
+  SSL_CTX* client_ctx_ = nullptr;
+};
+
+// A self-signed certificate for localhost.
+static void SetCertificate(SSL_CTX* ctx) {
+  EVP_PKEY* pkey = nullptr;
+  EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  CHECK_EQ(1, EVP_PKEY_keygen_init(pctx));
+  CHECK_EQ(1, EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1));
+  CHECK_EQ(1, EVP_PKEY_keygen(pctx, &pkey));
+  EVP_PKEY_CTX_free(pctx);
+
+  X509* x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_get_notBefore(x509), 0);
+  X509_gmtime_adj(X509_get_notAfter(x509), 3600);
+  X509_set_pubkey(x509, pkey);
+
+  X509_NAME* name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  CHECK_GT(X509_sign(x509, pkey, EVP_sha256()), 0);
+
+  CHECK_EQ(1, SSL_CTX_use_certificate(ctx, x509));
+  CHECK_EQ(1, SSL_CTX_use_PrivateKey(ctx, pkey));
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+}
+
+void TlsSocketTest::SetUp() {
+  proactor_ = std::make_unique<Proactor>();
+  proactor_thread_ = thread{[this] { proactor_->Run(); }};
+
+  server_ctx_ = SSL_CTX_new(TLS_server_method());
+  SetCertificate(server_ctx_);
+
+  client_ctx_ = SSL_CTX_new(TLS_client_method());
+  SSL_CTX_set_verify(client_ctx_, SSL_VERIFY_NONE, nullptr);
+}
+
+void TlsSocketTest::TearDown() {
+  proactor_->Stop();
+  proactor_thread_.join();
+  proactor_.reset();
+
+  SSL_CTX_free(server_ctx_);
+  SSL_CTX_free(client_ctx_);
+}
+
+void TlsSocketTest::RunEcho(const string& msg, bool* ktls_send) {
+  proactor_->AwaitBlocking([&] {
+    FiberSocket listener;
+    listener.set_proactor(proactor_.get());
+    ASSERT_FALSE(listener.Listen(0, 16));
+    FiberSocket::endpoint_type ep{asio::ip::make_address("127.0.0.1"),
+                                  listener.LocalEndpoint().port()};
+
+    // The server echoes until the client closes the session.
+    fibers::fiber server([&] {
+      FiberSocket peer;
+      ASSERT_FALSE(listener.Accept(&peer));
+      peer.set_proactor(proactor_.get());
+
+      TlsSocket tls(&peer, server_ctx_);
+      ASSERT_FALSE(tls.Accept());
+      *ktls_send = tls.ktls_send();
+
+      string buf(4096, '\0');
+      while (true) {
+        iovec v{&buf[0], buf.size()};
+        auto res = tls.Recv(&v, 1);
+        if (!res) {
+          EXPECT_EQ(errc::connection_aborted, res.error());
+          break;
+        }
+        iovec sv{&buf[0], res.value()};
+        auto send_res = tls.Send(&sv, 1);
+        ASSERT_TRUE(send_res) << send_res.error();
+      }
+    });
+
+    FiberSocket sock;
+    sock.set_proactor(proactor_.get());
+    ASSERT_FALSE(sock.Connect(ep));
+
+    TlsSocket tls(&sock, client_ctx_);
+    ASSERT_FALSE(tls.Connect());
+
+    iovec sv{const_cast<char*>(msg.data()), msg.size()};
+    auto send_res = tls.Send(&sv, 1);
+    ASSERT_TRUE(send_res) << send_res.error();
+    EXPECT_EQ(msg.size(), send_res.value());
+
+    string echo(msg.size(), '\0');
+    size_t received = 0;
+    while (received < echo.size()) {
+      iovec v{&echo[received], echo.size() - received};
+      auto res = tls.Recv(&v, 1);
+      ASSERT_TRUE(res) << res.error();
+      received += res.value();
+    }
+    EXPECT_EQ(msg, echo);
+
+    ASSERT_FALSE(tls.Shutdown());
+    server.join();
+  });
+}
+
+TEST_F(TlsSocketTest, Echo) {
+  bool ktls_send = false;
+  RunEcho(string(100000, 'a'), &ktls_send);
+  LOG(INFO) << "ktls send: " << ktls_send;
+}
+
+TEST_F(TlsSocketTest, Userspace) {
+  FLAGS_uring_ktls = false;
+  bool ktls_send = true;
+  RunEcho("hello", &ktls_send);
+  EXPECT_FALSE(ktls_send);
+  FLAGS_uring_ktls = true;
+}
+
+}  // namespace uring
+}  // namespace util
@@ -4,9 +4,18 @@
 
 #include "util/uring/uring_fiber_algo.h"
 
+#include <boost/fiber/detail/context_spmc_queue.hpp>
+#include <boost/fiber/detail/cpu_relax.hpp>
+#include <mutex>
+
+#include "absl/strings/str_cat.h"
 #include "base/logging.h"
+#include "util/stats/varz_stats.h"
 #include "util/uring/proactor.h"
 
+DEFINE_bool(uring_fiber_stealing, false, "If true, idle proactors run the ready fibers of "
+                                         "the busy ones that were marked migratable");
+
 // TODO: We should replace DVLOG macros with RAW_VLOG if we do glog sync integration.
 
 namespace util {
@@ -14,12 +23,81 @@ namespace uring {
 using namespace boost;
 using namespace std;
 
+// The ready queue of the migratable fibers of a proactor. Its owner pushes and pops at one
+// end, the others steal from the other one.
+struct UringFiberAlgo::StealSlot {
+  std::atomic<UringFiberAlgo*> algo{nullptr};
+
+  // Number of the threads that dereference algo.
+  std::atomic_uint32_t users{0};
+  std::atomic_uint64_t steals{0}, stolen{0};
+  fibers::detail::context_spmc_queue queue;
+};
+
+namespace {
+
+using StealSlot = UringFiberAlgo::StealSlot;
+constexpr unsigned kMaxStealSlots = 256;
+
+// Slots are never deleted since the thieves access them without locks. The slot of a destroyed
+// algorithm is reused once its queue is empty.
+std::atomic<StealSlot*> steal_slots[kMaxStealSlots];
+std::atomic_uint32_t num_steal_slots{0};
+std::mutex steal_slots_mu;
+
+StealSlot* RegisterSlot(UringFiberAlgo* algo) {
+  std::lock_guard<std::mutex> lk(steal_slots_mu);
+  unsigned num = num_steal_slots.load(std::memory_order_relaxed);
+  for (unsigned i = 0; i < num; ++i) {
+    StealSlot* slot = steal_slots[i].load(std::memory_order_relaxed);
+    if (!slot->algo.load(std::memory_order_relaxed) && slot->queue.empty()) {
+      slot->algo.store(algo);
+      return slot;
+    }
+  }
+  CHECK_LT(num, kMaxStealSlots);
+
+  StealSlot* slot = new StealSlot;
+  slot->algo.store(algo);
+  steal_slots[num].store(slot, std::memory_order_release);
+  num_steal_slots.store(num + 1, std::memory_order_release);
+  return slot;
+}
+
+util::VarzValue::Map GetStealStats() {
+  util::VarzValue::Map res;
+  unsigned num = num_steal_slots.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < num; ++i) {
+    StealSlot* slot = steal_slots[i].load(std::memory_order_acquire);
+    util::VarzValue::Map slot_stats;
+    slot_stats.emplace_back("steals", util::VarzValue::FromInt(slot->steals.load()));
+    slot_stats.emplace_back("stolen", util::VarzValue::FromInt(slot->stolen.load()));
+    res.emplace_back(absl::StrCat("slot", i), std::move(slot_stats));
+  }
+  return res;
+}
+
+util::VarzFunction steal_varz("uring-fiber-stealing", GetStealStats);
+
+}  // namespace
+
 UringFiberAlgo::UringFiberAlgo(Proactor* proactor) : proactor_(proactor) {
   main_cntx_ = fibers::context::active();
   CHECK(main_cntx_->is_context(fibers::type::main_context));
+
+  if (FLAGS_uring_fiber_stealing) {
+    slot_ = RegisterSlot(this);
+  }
 }
 
 UringFiberAlgo::~UringFiberAlgo() {
+  if (slot_) {
+    // The fibers that are left in the queue will be stolen by the other proactors.
+    slot_->algo.store(nullptr);
+    while (slot_->users.load() > 0) {
+      cpu_relax();
+    }
+  }
 }
 
 void UringFiberAlgo::awakened(FiberContext* ctx, UringFiberProps& props) noexcept {
@@ -30,6 +108,16 @@ void UringFiberAlgo::awakened(FiberContext* ctx, UringFiberProps& props) noexcep
   } else {
     DVLOG(2) << "Awakened " << props.name();
 
+    if (slot_ && props.migratable() && !ctx->is_context(fibers::type::pinned_context)) {
+      bool backlog = !slot_->queue.empty();
+
+      ctx->detach();
+      slot_->queue.push(ctx);
+      if (backlog)
+        WakeIdlePeer();
+      return;
+    }
+
     ++ready_cnt_;  // increase the number of awakened/ready fibers.
   }
 
@@ -39,8 +127,19 @@ void UringFiberAlgo::awakened(FiberContext* ctx, UringFiberProps& props) noexcep
 auto UringFiberAlgo::pick_next() noexcept -> FiberContext* {
   DVLOG(2) << "pick_next: " << ready_cnt_ << "/" << rqueue_.size();
 
-  if (rqueue_.empty())
-    return nullptr;
+  if (rqueue_.empty()) {
+    if (!slot_)
+      return nullptr;
+
+    FiberContext* ctx = slot_->queue.pop();
+    if (!ctx)
+      ctx = Steal();
+    if (ctx) {
+      fibers::context::active()->attach(ctx);
+      DVLOG(1) << "Switching to migratable " << ((UringFiberProps*)ctx->get_properties())->name();
+    }
+    return ctx;
+  }
 
   FiberContext* ctx = &rqueue_.front();
   rqueue_.pop_front();
@@ -73,7 +172,61 @@ void UringFiberAlgo::property_change(FiberContext* ctx, UringFiberProps& props)
 }
 
 bool UringFiberAlgo::has_ready_fibers() const noexcept {
-  return ready_cnt_ > 0;
+  if (ready_cnt_ > 0)
+    return true;
+  if (!slot_)
+    return false;
+
+  // Lets the dispatcher run when there is something to steal.
+  unsigned num = num_steal_slots.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < num; ++i) {
+    if (!steal_slots[i].load(std::memory_order_acquire)->queue.empty())
+      return true;
+  }
+  return false;
+}
+
+auto UringFiberAlgo::Steal() noexcept -> FiberContext* {
+  unsigned num = num_steal_slots.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < num; ++i) {
+    StealSlot* victim = steal_slots[(next_victim_ + i) % num].load(std::memory_order_acquire);
+    if (victim == slot_)
+      continue;
+
+    FiberContext* ctx = victim->queue.steal();
+    if (ctx) {
+      next_victim_ += i;
+      victim->stolen.fetch_add(1, std::memory_order_relaxed);
+      slot_->steals.fetch_add(1, std::memory_order_relaxed);
+      return ctx;
+    }
+  }
+  ++next_victim_;
+  return nullptr;
+}
+
+void UringFiberAlgo::WakeIdlePeer() noexcept {
+  unsigned num = num_steal_slots.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < num; ++i) {
+    StealSlot* peer = steal_slots[i].load(std::memory_order_acquire);
+    if (peer == slot_)
+      continue;
+
+    // users protects the peer algorithm from being destroyed while we notify it.
+    peer->users.fetch_add(1);
+    UringFiberAlgo* algo = peer->algo.load();
+    bool woken = algo && algo->NotifyIfSleeping();
+    peer->users.fetch_sub(1);
+    if (woken)
+      return;
+  }
+}
+
+bool UringFiberAlgo::NotifyIfSleeping() noexcept {
+  if (proactor_->tq_seq_.load(std::memory_order_relaxed) != Proactor::WAIT_SECTION_STATE)
+    return false;
+  notify();
+  return true;
 }
 
 // suspend_until halts the thread in case there are no active fibers to run on it.
@@ -21,8 +21,23 @@ class UringFiberProps : public ::boost::fibers::fiber_properties {
     return name_;
   }
 
+  //! With --uring_fiber_stealing, the idle proactors may run the migratable fibers that are
+  //! ready on the busy ones. Such fibers must not hold proactor-local state, i.e. sockets,
+  //! files or FiberCall and thread-local data.
+  void set_migratable(bool migratable) {
+    if (migratable_ != migratable) {
+      migratable_ = migratable;
+      notify();
+    }
+  }
+
+  bool migratable() const {
+    return migratable_;
+  }
+
  private:
   std::string name_;
+  bool migratable_ = false;
 };
 
 class UringFiberAlgo : public ::boost::fibers::algo::algorithm_with_properties<UringFiberProps> {
@@ -52,12 +67,24 @@ class UringFiberAlgo : public ::boost::fibers::algo::algorithm_with_properties<U
   // In our case, "sleeping" means - might stuck the wait function waiting for completion events.
   void notify() noexcept final;
 
+  struct StealSlot;
+
  private:
+  FiberContext* Steal() noexcept;
+
+  // Wakes up a sleeping proactor that could steal from us.
+  void WakeIdlePeer() noexcept;
+  bool NotifyIfSleeping() noexcept;
+
   ready_queue_type rqueue_;
   Proactor* proactor_;
   FiberContext* main_cntx_;
   timespec ts_;
   uint32_t ready_cnt_ = 0;
+
+  // The queue of our migratable ready fibers or null if the stealing is disabled.
+  StealSlot* slot_ = nullptr;
+  unsigned next_victim_ = 0;
 };
 
 }  // namespace uring
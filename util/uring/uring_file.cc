@@ -0,0 +1,357 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/uring/uring_file.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "util/uring/fiber_call.h"
+
+namespace util {
+namespace uring {
+
+using namespace boost;
+using namespace std;
+using file::ReadonlyFile;
+using file::WriteFile;
+using IoResult = Proactor::IoResult;
+
+namespace {
+
+inline Status IoError(IoResult res) {
+  return Status(StatusCode::IO_ERROR, std::error_code(-res, std::system_category()).message());
+}
+
+class UringReadFile final : public ReadonlyFile {
+ public:
+  UringReadFile(int fd, size_t sz, Proactor* proactor, const UringReadOptions& opts)
+      : fd_(fd), file_size_(sz), proactor_(proactor), opts_(opts) {
+    posix_fadvise(fd_, 0, 0, opts.sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+    fixed_fd_ = proactor_->RegisterFd(fd_);
+  }
+
+  ~UringReadFile() {
+    Close();
+  }
+
+  Status Close() final;
+
+  StatusObject<size_t> Read(size_t offset, const strings::MutableByteRange& range) final;
+
+  size_t Size() const final { return file_size_; }
+
+  int Handle() const final { return fd_; };
+
+ private:
+  struct Prefetch {
+    std::unique_ptr<uint8[]> buf;
+    size_t offset = 0, size = 0;
+    size_t consumed = 0;
+    IoResult res = 0;
+    bool pending = false;
+    fibers::context* waiter = nullptr;
+  };
+
+  // Reads into dest until it's full or the file ends.
+  StatusObject<size_t> ReadDirect(size_t offset, uint8* dest, size_t len);
+
+  // Submits the prefetch reads that follow offset.
+  void StartPrefetch(size_t offset);
+  void Submit(std::unique_ptr<Prefetch> pf);
+
+  void Wait(Prefetch* pf);
+
+  // Waits for the outstanding prefetch reads and drops their data.
+  void DrainPrefetch();
+
+  int fd_;
+  int fixed_fd_;  // Index in the fixed-file table of the proactor or -1.
+  const size_t file_size_;
+  Proactor* proactor_;
+  UringReadOptions opts_;
+
+  // The prefetch reads in the order of their offsets. The data of the first one was not
+  // consumed fully.
+  std::deque<std::unique_ptr<Prefetch>> prefetch_;
+  std::vector<std::unique_ptr<Prefetch>> free_prefetch_;
+  size_t next_prefetch_offset_ = 0;
+};
+
+class UringWriteFile final : public WriteFile {
+ public:
+  UringWriteFile(StringPiece name, Proactor* proactor, const file::OpenOptions& opts)
+      : WriteFile(name), proactor_(proactor), opts_(opts) {}
+
+  bool Open() final;
+  bool Close() final;
+
+  Status Write(const uint8* buffer, uint64 length) final;
+
+ private:
+  Proactor* proactor_;
+  file::OpenOptions opts_;
+  int fd_ = -1;
+  int fixed_fd_ = -1;
+  size_t offset_ = 0;
+};
+
+// Uses the fixed file and the buffers registered with the proactor when they are available.
+void PrepIo(Proactor* proactor, bool write, int fd, int fixed_fd, const uint8* buf, size_t len,
+            size_t offset, SubmitEntry* se) {
+  int buf_index = proactor->FindRegisteredBuffer(buf, len);
+  int submit_fd = fixed_fd >= 0 ? fixed_fd : fd;
+  uint8* dest = const_cast<uint8*>(buf);
+
+  if (buf_index >= 0) {
+    if (write)
+      se->PrepWriteFixed(submit_fd, buf, len, offset, buf_index);
+    else
+      se->PrepReadFixed(submit_fd, dest, len, offset, buf_index);
+  } else {
+    if (write)
+      se->PrepWrite(submit_fd, buf, len, offset);
+    else
+      se->PrepRead(submit_fd, dest, len, offset);
+  }
+  if (fixed_fd >= 0)
+    se->SetFixedFile();
+}
+
+
+Status UringReadFile::Close() {
+  DrainPrefetch();
+  if (fd_) {
+    if (fixed_fd_ >= 0) {
+      proactor_->UnregisterFd(fixed_fd_);
+      fixed_fd_ = -1;
+    }
+    if (opts_.drop_cache_on_close)
+      posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd_);
+    fd_ = 0;
+  }
+  return Status::OK;
+}
+
+StatusObject<size_t> UringReadFile::Read(size_t offset, const strings::MutableByteRange& range) {
+  DCHECK(proactor_->InMyThread());
+
+  if (range.empty())
+    return 0;
+
+  if (offset > file_size_) {
+    return Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+  }
+
+  if (opts_.prefetch_size == 0)
+    return ReadDirect(offset, range.begin(), range.size());
+
+  if (!prefetch_.empty() && prefetch_.front()->offset + prefetch_.front()->consumed != offset) {
+    DrainPrefetch();
+  }
+  if (prefetch_.empty()) {
+    StartPrefetch(offset);
+  }
+
+  size_t done = 0;
+  while (done < range.size() && !prefetch_.empty()) {
+    Prefetch* pf = prefetch_.front().get();
+    Wait(pf);
+    if (pf->res < 0) {
+      Status st = IoError(pf->res);
+      DrainPrefetch();
+      return st;
+    }
+
+    size_t len = std::min<size_t>(pf->res - pf->consumed, range.size() - done);
+    memcpy(range.begin() + done, pf->buf.get() + pf->consumed, len);
+    pf->consumed += len;
+    done += len;
+
+    if (pf->consumed < size_t(pf->res))
+      break;  // The range is full.
+
+    // A short read before the end of the file breaks the sequence of the following prefetch
+    // reads, we restart them.
+    bool restart = size_t(pf->res) < pf->size;
+    free_prefetch_.push_back(std::move(prefetch_.front()));
+    prefetch_.pop_front();
+
+    if (restart) {
+      size_t next = offset + done;
+      DrainPrefetch();
+      if (pf->res == 0)
+        break;  // The file was truncated.
+      StartPrefetch(next);
+    } else if (next_prefetch_offset_ < file_size_) {
+      std::unique_ptr<Prefetch> next = std::move(free_prefetch_.back());
+      free_prefetch_.pop_back();
+      Submit(std::move(next));
+    }
+  }
+
+  return done;
+}
+
+StatusObject<size_t> UringReadFile::ReadDirect(size_t offset, uint8* dest, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    FiberCall fc(proactor_);
+    PrepIo(proactor_, false, fd_, fixed_fd_, dest + done, len - done, offset + done,
+           fc.operator->());
+    IoResult res = fc.Get();
+    if (res < 0)
+      return IoError(res);
+    if (res == 0)
+      break;
+    done += res;
+  }
+  return done;
+}
+
+void UringReadFile::StartPrefetch(size_t offset) {
+  next_prefetch_offset_ = offset;
+
+  while (prefetch_.size() < std::max(1U, opts_.prefetch_depth) &&
+         next_prefetch_offset_ < file_size_) {
+    std::unique_ptr<Prefetch> pf;
+    if (free_prefetch_.empty()) {
+      pf.reset(new Prefetch);
+      pf->buf.reset(new uint8[opts_.prefetch_size]);
+    } else {
+      pf = std::move(free_prefetch_.back());
+      free_prefetch_.pop_back();
+    }
+    Submit(std::move(pf));
+  }
+}
+
+void UringReadFile::Submit(std::unique_ptr<Prefetch> pf) {
+  pf->offset = next_prefetch_offset_;
+  pf->size = std::min(opts_.prefetch_size, file_size_ - pf->offset);
+  pf->consumed = 0;
+  pf->res = 0;
+  pf->pending = true;
+  next_prefetch_offset_ += pf->size;
+
+  Prefetch* ptr = pf.get();
+  auto cb = [ptr](IoResult res, int64_t, Proactor*) {
+    ptr->res = res;
+    ptr->pending = false;
+    if (ptr->waiter) {
+      fibers::context::active()->schedule(std::exchange(ptr->waiter, nullptr));
+    }
+  };
+  SubmitEntry se = proactor_->GetSubmitEntry(std::move(cb), 0);
+  PrepIo(proactor_, false, fd_, fixed_fd_, ptr->buf.get(), ptr->size, ptr->offset, &se);
+  prefetch_.push_back(std::move(pf));
+}
+
+void UringReadFile::Wait(Prefetch* pf) {
+  while (pf->pending) {
+    pf->waiter = fibers::context::active();
+    pf->waiter->suspend();
+  }
+}
+
+void UringReadFile::DrainPrefetch() {
+  // The kernel writes into the buffers until the reads complete.
+  for (auto& pf : prefetch_) {
+    Wait(pf.get());
+    free_prefetch_.push_back(std::move(pf));
+  }
+  prefetch_.clear();
+}
+
+bool UringWriteFile::Open() {
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (opts_.append ? 0 : O_TRUNC);
+  fd_ = open(create_file_name_.c_str(), flags, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Could not open " << create_file_name_ << ": " << strerror(errno);
+    return false;
+  }
+
+  if (opts_.append) {
+    // We write with explicit offsets, O_APPEND would ignore them.
+    struct stat sb;
+    if (fstat(fd_, &sb) < 0) {
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+    offset_ = sb.st_size;
+  }
+  fixed_fd_ = proactor_->RegisterFd(fd_);
+  return true;
+}
+
+bool UringWriteFile::Close() {
+  bool res = true;
+  if (fd_ >= 0) {
+    if (fixed_fd_ >= 0)
+      proactor_->UnregisterFd(fixed_fd_);
+    res = close(fd_) == 0;
+  }
+  delete this;
+  return res;
+}
+
+Status UringWriteFile::Write(const uint8* buffer, uint64 length) {
+  DCHECK(proactor_->InMyThread());
+
+  while (length > 0) {
+    FiberCall fc(proactor_);
+    PrepIo(proactor_, true, fd_, fixed_fd_, buffer, std::min<uint64>(length, 1U << 30), offset_,
+           fc.operator->());
+    IoResult res = fc.Get();
+    if (res < 0)
+      return IoError(res);
+
+    buffer += res;
+    length -= res;
+    offset_ += res;
+  }
+  return Status::OK;
+}
+
+}  // namespace
+
+StatusObject<ReadonlyFile*> OpenUringReadFile(StringPiece name, Proactor* proactor,
+                                              const UringReadOptions& opts) {
+  int fd = open(name.data(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return file::StatusFileError();
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) < 0) {
+    Status st = file::StatusFileError();
+    close(fd);
+    return st;
+  }
+  return new UringReadFile(fd, sb.st_size, proactor, opts);
+}
+
+StatusObject<WriteFile*> OpenUringWriteFile(StringPiece name, Proactor* proactor,
+                                            const file::OpenOptions& opts) {
+  UringWriteFile* wf = new UringWriteFile(name, proactor, opts);
+  if (!wf->Open()) {
+    Status st(StatusCode::IO_ERROR, "Can not open " + strings::AsString(name));
+    wf->Close();
+    return st;
+  }
+  return wf;
+}
+
+}  // namespace uring
+}  // namespace util
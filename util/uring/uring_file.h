@@ -0,0 +1,35 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#pragma once
+
+#include "file/file.h"
+
+namespace util {
+namespace uring {
+
+class Proactor;
+
+// Files that run their I/O on io_uring of a proactor. Read and Write submit SQEs from the
+// calling fiber and suspend it until completion, without helper threads.
+// The files must be used from fibers that run in the thread of the proactor.
+struct UringReadOptions : public file::ReadonlyFile::Options {
+  // If positive, sequential reads are served from prefetch reads of that size that are
+  // submitted ahead of the reader. Random access drops the prefetched data.
+  size_t prefetch_size = 0;
+
+  // Number of the outstanding prefetch reads.
+  unsigned prefetch_depth = 2;
+};
+
+StatusObject<file::ReadonlyFile*> OpenUringReadFile(
+    StringPiece name, Proactor* proactor,
+    const UringReadOptions& opts = UringReadOptions{}) MUST_USE_RESULT;
+
+StatusObject<file::WriteFile*> OpenUringWriteFile(
+    StringPiece name, Proactor* proactor,
+    const file::OpenOptions& opts = file::OpenOptions{}) MUST_USE_RESULT;
+
+}  // namespace uring
+}  // namespace util
@@ -0,0 +1,147 @@
+// Copyright 2020, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+
+#include "util/uring/uring_file.h"
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/uring/proactor.h"
+
+using namespace std;
+
+namespace util {
+namespace uring {
+
+class UringFileTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    proactor_ = std::make_unique<Proactor>();
+    proactor_thread_ = thread{[this] { proactor_->Run(16); }};
+  }
+
+  void TearDown() {
+    proactor_->Stop();
+    proactor_thread_.join();
+    proactor_.reset();
+  }
+
+  // Reads the file sequentially in chunks of the given size.
+  static string ReadAll(file::ReadonlyFile* file, size_t chunk) {
+    string res;
+    std::unique_ptr<uint8[]> buf(new uint8[chunk]);
+    while (true) {
+      auto st = file->Read(res.size(), strings::MutableByteRange(buf.get(), chunk));
+      CHECK_STATUS(st.status);
+      if (st.obj == 0)
+        break;
+      res.append(reinterpret_cast<const char*>(buf.get()), st.obj);
+    }
+    return res;
+  }
+
+  std::unique_ptr<Proactor> proactor_;
+  std::thread proactor_thread_;
+};
+
+TEST_F(UringFileTest, WriteRead) {
+  string path = base::GetTestTempPath("uring_file.bin");
+  string data = base::RandStr((3 << 18) + 17);
+
+  proactor_->AwaitBlocking([&] {
+    auto wres = OpenUringWriteFile(path, proactor_.get());
+    ASSERT_TRUE(wres.ok()) << wres.status;
+    ASSERT_TRUE(wres.obj->Write(absl::string_view(data).substr(0, 1000)).ok());
+    ASSERT_TRUE(wres.obj->Write(absl::string_view(data).substr(1000)).ok());
+    ASSERT_TRUE(wres.obj->Close());
+
+    for (size_t prefetch_size : {0, 1 << 16}) {
+      UringReadOptions opts;
+      opts.prefetch_size = prefetch_size;
+      opts.prefetch_depth = 3;
+
+      auto rres = OpenUringReadFile(path, proactor_.get(), opts);
+      ASSERT_TRUE(rres.ok()) << rres.status;
+      std::unique_ptr<file::ReadonlyFile> file(rres.obj);
+      ASSERT_EQ(data.size(), file->Size());
+
+      EXPECT_TRUE(data == ReadAll(file.get(), 10000)) << prefetch_size;
+
+      // Random access.
+      uint8 buf[100];
+      auto st = file->Read(5000, strings::MutableByteRange(buf, sizeof(buf)));
+      ASSERT_TRUE(st.ok());
+      ASSERT_EQ(sizeof(buf), st.obj);
+      EXPECT_EQ(data.substr(5000, sizeof(buf)), string(reinterpret_cast<char*>(buf), st.obj));
+      ASSERT_TRUE(file->Close().ok());
+    }
+  });
+}
+
+TEST_F(UringFileTest, Append) {
+  string path = base::GetTestTempPath("uring_append.txt");
+  file::Delete(path);
+
+  proactor_->AwaitBlocking([&] {
+    for (const char* str : {"foo", "bar"}) {
+      file::OpenOptions opts;
+      opts.append = true;
+      auto wres = OpenUringWriteFile(path, proactor_.get(), opts);
+      ASSERT_TRUE(wres.ok()) << wres.status;
+      ASSERT_TRUE(wres.obj->Write(str).ok());
+      ASSERT_TRUE(wres.obj->Close());
+    }
+
+    auto rres = OpenUringReadFile(path, proactor_.get());
+    ASSERT_TRUE(rres.ok()) << rres.status;
+    std::unique_ptr<file::ReadonlyFile> file(rres.obj);
+    EXPECT_EQ("foobar", ReadAll(file.get(), 4));
+  });
+}
+
+TEST_F(UringFileTest, RegisteredBuffers) {
+  string path = base::GetTestTempPath("uring_fixed.bin");
+  string data = base::RandStr(1 << 16);
+  std::unique_ptr<uint8[]> mem(new uint8[2 << 16]);
+  memcpy(mem.get(), data.data(), data.size());
+
+  proactor_->AwaitBlocking([&] {
+    iovec iov{mem.get(), 2 << 16};
+    ASSERT_EQ(0, proactor_->RegisterBuffers(&iov, 1));
+    EXPECT_EQ(0, proactor_->FindRegisteredBuffer(mem.get() + 10, 100));
+    EXPECT_EQ(-1, proactor_->FindRegisteredBuffer(mem.get() + 10, 2 << 16));
+
+    auto wres = OpenUringWriteFile(path, proactor_.get());
+    ASSERT_TRUE(wres.ok()) << wres.status;
+    ASSERT_TRUE(wres.obj->Write(mem.get(), data.size()).ok());
+    ASSERT_TRUE(wres.obj->Close());
+
+    auto rres = OpenUringReadFile(path, proactor_.get());
+    ASSERT_TRUE(rres.ok()) << rres.status;
+    std::unique_ptr<file::ReadonlyFile> file(rres.obj);
+    uint8* dest = mem.get() + data.size();
+    auto st = file->Read(0, strings::MutableByteRange(dest, data.size()));
+    ASSERT_TRUE(st.ok()) << st.status;
+    ASSERT_EQ(data.size(), st.obj);
+    EXPECT_EQ(0, memcmp(data.data(), dest, data.size()));
+    ASSERT_TRUE(file->Close().ok());
+
+    proactor_->UnregisterBuffers();
+    EXPECT_EQ(-1, proactor_->FindRegisteredBuffer(mem.get(), 1));
+  });
+}
+
+TEST_F(UringFileTest, NotFound) {
+  proactor_->AwaitBlocking([&] {
+    auto rres = OpenUringReadFile("/non_existing_dir/file", proactor_.get());
+    EXPECT_FALSE(rres.ok());
+  });
+}
+
+}  // namespace uring
+}  // namespace util
@@ -4,6 +4,8 @@
 
 #include "util/uring/varz.h"
 
+#include "absl/strings/str_cat.h"
+
 using namespace boost;
 
 namespace util {
@@ -72,5 +74,57 @@ VarzValue VarzMapAverage::GetData() const {
   return result;
 }
 
+VarzValue VarzProactorLoop::GetData() const {
+  AnyValue::Map result;
+  if (!pp_)
+    return result;
+
+  std::vector<Proactor::LoopStats> stats(pp_->size());
+  pp_->AwaitOnAll([&](unsigned index, Proactor* p) { stats[index] = p->GetLoopStats(); });
+
+  for (unsigned i = 0; i < stats.size(); ++i) {
+    const Proactor::LoopStats& ls = stats[i];
+    AnyValue::Map items;
+    items.emplace_back("iterations", VarzValue::FromInt(ls.iterations));
+    items.emplace_back("cqes", VarzValue::FromInt(ls.cqes));
+    items.emplace_back("tasks", VarzValue::FromInt(ls.tasks));
+    items.emplace_back("fiber_usec", VarzValue::FromInt(ls.fiber_usec));
+    items.emplace_back("wait_usec", VarzValue::FromInt(ls.wait_usec));
+    items.emplace_back("stalls", VarzValue::FromInt(ls.stalls));
+    items.emplace_back("task_queue_full", VarzValue::FromInt(ls.task_queue_full));
+    items.emplace_back("task_queue_waits", VarzValue::FromInt(ls.task_queue_waits));
+    if (ls.iteration_usec.count()) {
+      items.emplace_back("iteration_usec_p50",
+                         VarzValue::FromDouble(ls.iteration_usec.Percentile(50)));
+      items.emplace_back("iteration_usec_p99",
+                         VarzValue::FromDouble(ls.iteration_usec.Percentile(99)));
+      items.emplace_back("iteration_usec_max", VarzValue::FromDouble(ls.iteration_usec.max()));
+    }
+    if (ls.cqes_per_wake.count()) {
+      items.emplace_back("cqes_per_wake", VarzValue::FromDouble(ls.cqes_per_wake.Average()));
+    }
+    if (ls.tasks_per_iteration.count()) {
+      items.emplace_back("tasks_per_iteration",
+                         VarzValue::FromDouble(ls.tasks_per_iteration.Average()));
+    }
+    result.emplace_back(absl::StrCat("proactor", i), std::move(items));
+  }
+
+  Proactor::OffloadStats offload = Proactor::GetOffloadStats();
+  AnyValue::Map items;
+  items.emplace_back("calls", VarzValue::FromInt(offload.calls));
+  items.emplace_back("pending", VarzValue::FromInt(offload.pending));
+  items.emplace_back("threads", VarzValue::FromInt(offload.threads));
+  if (offload.latency_usec.count()) {
+    items.emplace_back("latency_usec_p50",
+                       VarzValue::FromDouble(offload.latency_usec.Percentile(50)));
+    items.emplace_back("latency_usec_p99",
+                       VarzValue::FromDouble(offload.latency_usec.Percentile(99)));
+  }
+  result.emplace_back("offload", std::move(items));
+
+  return result;
+}
+
 }
 }  // namespace util
@@ -71,5 +71,21 @@ class VarzMapAverage : public VarzListNode {
   std::unique_ptr<Map[]> avg_map_;
 };
 
+// Exports Proactor::LoopStats of each proactor in the pool and the stats of the offload pool.
+class VarzProactorLoop : public VarzListNode {
+ public:
+  explicit VarzProactorLoop(const char* varname) : VarzListNode(varname) {
+  }
+
+  void Init(ProactorPool* pp) {
+    pp_ = pp;
+  }
+
+ private:
+  virtual AnyValue GetData() const override;
+
+  ProactorPool* pp_ = nullptr;
+};
+
 }  // namespace uring
 }  // namespace util
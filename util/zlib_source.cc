@@ -53,7 +53,6 @@ static constexpr size_t kBufSize = 8192;
 ZlibSource::ZlibSource(Source* sub_stream, Format format)
     : sub_stream_(sub_stream), format_(format) {
   InitCtx(&zcontext_);
-  buf_.reset(new uint8_t[kBufSize]);
 }
 
 ZlibSource::~ZlibSource() {
@@ -90,17 +89,20 @@ StatusObject<size_t> ZlibSource::ReadInternal(const strings::MutableByteRange& r
       DCHECK_EQ(0, zcontext_.avail_in);
     }
 
-    auto res = sub_stream_->Read(strings::MutableByteRange(buf_.get(), kBufSize));
+    // Inflates directly from the buffers of the sub stream. The view stays valid until
+    // the next Peek() since avail_in is zero only then.
+    auto res = sub_stream_->Peek(kBufSize);
     if (!res.ok())
-      return res;
+      return res.status;
 
-    if (res.obj == 0)
+    if (res.obj.empty())
       break;
 
-    DVLOG(1) << "Read " << res.obj << " bytes";
+    DVLOG(1) << "Read " << res.obj.size() << " bytes";
 
-    zcontext_.next_in = buf_.get();
-    zcontext_.avail_in = res.obj;
+    sub_stream_->Consume(res.obj.size());
+    zcontext_.next_in = res.obj.begin();
+    zcontext_.avail_in = res.obj.size();
     if (!zcontext_.state) {
       int reset = internalInflateInit2(format_, &zcontext_);
       CHECK_EQ(Z_OK, reset);
@@ -170,4 +172,12 @@ Status ZlibSink::Flush() {
   return sub_->Flush();
 }
 
+void ZlibSink::Reset() {
+  int zerror = deflateReset(&zcontext_);
+  CHECK_EQ(Z_OK, zerror);
+
+  zcontext_.next_out = buf_.get();
+  zcontext_.avail_out = buf_size_;
+}
+
 }  // namespace util
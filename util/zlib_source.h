@@ -40,7 +40,6 @@ class ZlibSource : public Source {
 
   Format format_;
   z_stream zcontext_;
-  std::unique_ptr<uint8_t[]> buf_;
 
   int Inflate();
 
@@ -58,6 +57,10 @@ class ZlibSink : public Sink {
   Status Append(const strings::ByteRange& slice) final;
   Status Flush() final;
 
+  // Starts a new gzip stream with the same deflate state, so the sink can compress
+  // another input after Flush() without reallocating its window.
+  void Reset();
+
  private:
   std::unique_ptr<Sink> sub_;
   std::unique_ptr<uint8_t[]> buf_;
@@ -4,6 +4,13 @@
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include <zstd.h>
+#include <zstd_errors.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "util/zstd_sinksource.h"
 
@@ -37,8 +44,12 @@ ZStdSink::~ZStdSink() {
 }
 
 
-Status ZStdSink::Init(int level) {
-  size_t const res = ZSTD_initCStream_srcSize(HANDLE, level, 0);
+Status ZStdSink::Init(int level, unsigned num_workers) {
+  size_t res = ZSTD_CCtx_reset(HANDLE, ZSTD_reset_session_only);
+  if (!ZSTD_isError(res))
+    res = ZSTD_CCtx_setParameter(HANDLE, ZSTD_c_compressionLevel, level);
+  if (!ZSTD_isError(res))
+    res = ZSTD_CCtx_setParameter(HANDLE, ZSTD_c_nbWorkers, num_workers);
   if (ZSTD_isError(res)) {
     return ZstdStatus(res);
   }
@@ -50,30 +61,35 @@ Status ZStdSink::Append(const strings::ByteRange& slice) {
   ZSTD_inBuffer input = { slice.data(), slice.size(), 0 };
   while (input.pos < input.size) {
     ZSTD_outBuffer out_buf{ buf_.get(), buf_sz_, 0};
-    size_t res = ZSTD_compressStream(HANDLE, &out_buf , &input);
+    size_t res = ZSTD_compressStream2(HANDLE, &out_buf, &input, ZSTD_e_continue);
     if (ZSTD_isError(res)) {
       return ZstdStatus(res);
     }
-    RETURN_IF_ERROR(upstream_->Append(strings::ByteRange(buf_.get(), out_buf.pos)));
+    if (out_buf.pos) {
+      RETURN_IF_ERROR(upstream_->Append(strings::ByteRange(buf_.get(), out_buf.pos)));
+    }
   }
   return Status::OK;
 }
 
 Status ZStdSink::Flush() {
-  ZSTD_outBuffer out_buf{buf_.get(), buf_sz_, 0};
+  ZSTD_inBuffer input{nullptr, 0, 0};
+  size_t res;
 
-  size_t res = ZSTD_endStream(HANDLE, &out_buf);
-  if (ZSTD_isError(res)) {
-    return ZstdStatus(res);
-  }
-  CHECK_EQ(0, res);
-  if (out_buf.pos) {
-    RETURN_IF_ERROR(upstream_->Append(strings::ByteRange(buf_.get(), out_buf.pos)));
-  }
+  // With workers, the frame is completed by multiple calls.
+  do {
+    ZSTD_outBuffer out_buf{buf_.get(), buf_sz_, 0};
+    res = ZSTD_compressStream2(HANDLE, &out_buf, &input, ZSTD_e_end);
+    if (ZSTD_isError(res)) {
+      return ZstdStatus(res);
+    }
+    if (out_buf.pos) {
+      RETURN_IF_ERROR(upstream_->Append(strings::ByteRange(buf_.get(), out_buf.pos)));
+    }
+  } while (res);
   return upstream_->Flush();
 }
 
-
 #define DC_HANDLE reinterpret_cast<ZSTD_DStream*>(zstd_handle_)
 
 bool ZStdSource::HasValidHeader(Source* upstream) {
@@ -89,13 +105,229 @@ bool ZStdSource::HasValidHeader(Source* upstream) {
 
 const unsigned kReadBuf = 1 << 12;
 
-ZStdSource::ZStdSource(Source* upstream)
+// Splits the input into frames and decompresses them by the worker threads. Returns the data
+// of the frames in order.
+class ZStdSource::FrameDecoder {
+ public:
+  FrameDecoder(Source* upstream, unsigned num_workers);
+  ~FrameDecoder();
+
+  // Returns less than range.size() at eof or if a large frame was reached.
+  StatusObject<size_t> Read(const strings::MutableByteRange& range);
+
+  // Returns a view into the data of the current frame, empty like Read() returns 0.
+  StatusObject<strings::MutableByteRange> Peek(size_t max_size);
+
+  // The compressed data starting from the large frame, once the frames before it were read.
+  const std::string* large_frame() const {
+    return large_frame_ && frames_.empty() && cur_pos_ == cur_.size() ? &in_ : nullptr;
+  }
+
+ private:
+  static constexpr size_t kMaxFrameSize = 1 << 26;
+
+  struct Frame {
+    std::string src, dest;
+    Status status;
+    bool done = false;  // Guarded by mu_.
+  };
+
+  // Switches to the next decompressed frame if the current one was read.
+  Status NextData();
+
+  // Submits frames while the window allows.
+  Status Refill();
+
+  // Moves the next complete frame into src. src stays empty at eof or at a large frame.
+  Status NextFrame(std::string* src);
+
+  void Run();
+  static Status Decompress(ZSTD_DCtx* dctx, Frame* frame);
+
+  Source* upstream_;
+  const size_t window_;
+
+  std::string in_;  // Compressed data that is not split into frames yet.
+  bool eof_ = false, large_frame_ = false;
+
+  std::deque<std::unique_ptr<Frame>> frames_;  // Submitted frames in the input order.
+  std::string cur_;  // Data of the current frame.
+  size_t cur_pos_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable work_cv_, done_cv_;
+  std::deque<Frame*> pending_;  // Frames that are not picked by the workers yet.
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+ZStdSource::FrameDecoder::FrameDecoder(Source* upstream, unsigned num_workers)
+    : upstream_(upstream), window_(num_workers * 2) {
+  for (unsigned i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&FrameDecoder::Run, this);
+  }
+}
+
+ZStdSource::FrameDecoder::~FrameDecoder() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& t : workers_) {
+    t.join();
+  }
+}
+
+StatusObject<size_t> ZStdSource::FrameDecoder::Read(const strings::MutableByteRange& range) {
+  size_t read = 0;
+  while (read < range.size()) {
+    RETURN_IF_ERROR(NextData());
+    if (cur_pos_ == cur_.size())
+      break;
+
+    size_t sz = std::min(range.size() - read, cur_.size() - cur_pos_);
+    memcpy(range.begin() + read, cur_.data() + cur_pos_, sz);
+    read += sz;
+    cur_pos_ += sz;
+  }
+  return read;
+}
+
+StatusObject<strings::MutableByteRange> ZStdSource::FrameDecoder::Peek(size_t max_size) {
+  RETURN_IF_ERROR(NextData());
+
+  size_t sz = std::min(max_size, cur_.size() - cur_pos_);
+  strings::MutableByteRange res(reinterpret_cast<uint8_t*>(&cur_[0]) + cur_pos_, sz);
+  cur_pos_ += sz;
+  return res;
+}
+
+Status ZStdSource::FrameDecoder::NextData() {
+  while (cur_pos_ == cur_.size()) {
+    RETURN_IF_ERROR(Refill());
+    if (frames_.empty())
+      break;
+
+    std::unique_ptr<Frame> frame = std::move(frames_.front());
+    frames_.pop_front();
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      done_cv_.wait(lk, [&] { return frame->done; });
+    }
+    if (!frame->status.ok())
+      return frame->status;
+    cur_.swap(frame->dest);
+    cur_pos_ = 0;
+  }
+  return Status::OK;
+}
+
+Status ZStdSource::FrameDecoder::Refill() {
+  while (frames_.size() < window_ && !large_frame_) {
+    std::unique_ptr<Frame> frame(new Frame);
+    RETURN_IF_ERROR(NextFrame(&frame->src));
+    if (frame->src.empty())
+      break;
+
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      pending_.push_back(frame.get());
+    }
+    work_cv_.notify_one();
+    frames_.push_back(std::move(frame));
+  }
+  return Status::OK;
+}
+
+Status ZStdSource::FrameDecoder::NextFrame(std::string* src) {
+  while (true) {
+    if (!in_.empty()) {
+      size_t sz = ZSTD_findFrameCompressedSize(in_.data(), in_.size());
+      if (!ZSTD_isError(sz)) {
+        src->assign(in_, 0, sz);
+        in_.erase(0, sz);
+        return Status::OK;
+      }
+      if (eof_ || ZSTD_getErrorCode(sz) != ZSTD_error_srcSize_wrong)
+        return ZstdStatus(sz);
+      if (in_.size() > kMaxFrameSize) {
+        large_frame_ = true;
+        return Status::OK;
+      }
+    } else if (eof_) {
+      return Status::OK;
+    }
+
+    // Grows geometrically, the frame is searched again after every read.
+    size_t old_size = in_.size();
+    size_t to_read = std::max<size_t>(1 << 16, old_size);
+    in_.resize(old_size + to_read);
+    auto res = upstream_->Read(
+        strings::MutableByteRange(reinterpret_cast<uint8_t*>(&in_[old_size]), to_read));
+    if (!res.ok())
+      return res.status;
+    in_.resize(old_size + res.obj);
+    eof_ = res.obj < to_read;
+  }
+}
+
+void ZStdSource::FrameDecoder::Run() {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  std::unique_lock<std::mutex> lk(mu_);
+  while (true) {
+    work_cv_.wait(lk, [this] { return stop_ || !pending_.empty(); });
+    if (stop_)
+      break;
+
+    Frame* frame = pending_.front();
+    pending_.pop_front();
+    lk.unlock();
+
+    frame->status = Decompress(dctx, frame);
+    std::string().swap(frame->src);
+
+    lk.lock();
+    frame->done = true;
+    done_cv_.notify_all();
+  }
+  ZSTD_freeDCtx(dctx);
+}
+
+Status ZStdSource::FrameDecoder::Decompress(ZSTD_DCtx* dctx, Frame* frame) {
+  const std::string& src = frame->src;
+  std::string& dest = frame->dest;
+  unsigned long long content_size = ZSTD_getFrameContentSize(src.data(), src.size());
+  dest.resize(content_size < ZSTD_CONTENTSIZE_ERROR ? content_size : src.size() * 4);
+
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  ZSTD_inBuffer input{src.data(), src.size(), 0};
+  size_t used = 0, res = 1;
+  while (res) {
+    if (used == dest.size())
+      dest.resize(std::max<size_t>(used * 2, ZSTD_DStreamOutSize()));
+
+    ZSTD_outBuffer output{&dest[0], dest.size(), used};
+    res = ZSTD_decompressStream(dctx, &output, &input);
+    if (ZSTD_isError(res)) {
+      return ZstdStatus(res);
+    }
+    used = output.pos;
+    if (res && input.pos == input.size && used < dest.size())
+      return Status(StatusCode::IO_ERROR, "Truncated zstd frame");
+  }
+  dest.resize(used);
+  return Status::OK;
+}
+
+ZStdSource::ZStdSource(Source* upstream, unsigned num_workers)
     : sub_stream_(upstream) {
   CHECK(upstream);
   zstd_handle_ = ZSTD_createDStream();
   size_t const res = ZSTD_initDStream(DC_HANDLE);
   CHECK(!ZSTD_isError(res)) << ZSTD_getErrorName(res);
-  buf_.reset(new uint8_t[kReadBuf]);
+  if (num_workers)
+    decoder_.reset(new FrameDecoder(upstream, num_workers));
 }
 
 ZStdSource::~ZStdSource() {
@@ -104,31 +336,55 @@ ZStdSource::~ZStdSource() {
 
 
 StatusObject<size_t> ZStdSource::ReadInternal(const strings::MutableByteRange& range) {
+  if (decoder_) {
+    auto res = decoder_->Read(range);
+    if (!res.ok() || !ResetLargeFrame())
+      return res;
+    if (res.obj)
+      return res;
+  }
+
   ZSTD_outBuffer output = { range.begin(), range.size(), 0 };
   do {
-    if (buf_range_.empty()) {
-      auto res = sub_stream_->Read(strings::MutableByteRange(buf_.get(), kReadBuf));
-      if (!res.ok())
-        return res;
-      if (res.obj == 0)
-        break;
-      buf_range_.reset(buf_.get(), res.obj);
-    }
+    // Decompresses directly from the buffers of the upstream.
+    auto res = sub_stream_->Peek(kReadBuf);
+    if (!res.ok())
+      return res.status;
+    if (res.obj.empty())
+      break;
 
-    ZSTD_inBuffer input{buf_range_.begin(), buf_range_.size(), 0 };
+    ZSTD_inBuffer input{res.obj.begin(), res.obj.size(), 0 };
 
     size_t to_read = ZSTD_decompressStream(DC_HANDLE, &output , &input);
     if (ZSTD_isError(to_read)) {
       return ZstdStatus(to_read);
     }
 
-    buf_range_.advance(input.pos);
-    if (input.pos < input.size) {
-      CHECK_EQ(output.pos, output.size);
-      break;
-    }
+    // Stops at the end of every frame, the rest of the view is decompressed by the next
+    // iteration.
+    sub_stream_->Consume(input.pos);
   } while (output.pos < output.size);
   return output.pos;
 }
 
+StatusObject<strings::MutableByteRange> ZStdSource::PeekInternal(size_t max_size) {
+  if (decoder_) {
+    auto res = decoder_->Peek(max_size);
+    if (!res.ok() || !res.obj.empty() || !ResetLargeFrame())
+      return res;
+  }
+  return Source::PeekInternal(max_size);
+}
+
+bool ZStdSource::ResetLargeFrame() {
+  const std::string* rest = decoder_->large_frame();
+  if (!rest)
+    return false;
+
+  // Continues with the streaming decompression from the large frame.
+  sub_stream_->Prepend(strings::ToByteRange(*rest));
+  decoder_.reset();
+  return true;
+}
+
 }  // namespace util
@@ -14,7 +14,10 @@ class ZStdSink : public Sink {
   ZStdSink(Sink* upstream);
   ~ZStdSink();
 
-  Status Init(int level);
+  // Can be called again after Flush() to start a new frame with the same context.
+  // If num_workers > 0, the frame is compressed by num_workers zstd threads while Append()
+  // only passes the data to them. Fails if zstd was built without multi-threading support.
+  Status Init(int level, unsigned num_workers = 0);
   Status Append(const strings::ByteRange& slice) override;
   Status Flush() override;
   static size_t CompressBound(size_t src_size);
@@ -28,17 +31,29 @@ class ZStdSink : public Sink {
 
 class ZStdSource : public Source {
  public:
-  explicit ZStdSource(Source* upstream);
+  // If num_workers > 0, the frames of the input are decompressed concurrently by num_workers
+  // threads, up to 2 * num_workers frames ahead of the reader. Whole frames are kept in memory,
+  // hence it suits the inputs that consist of many frames. A frame larger than 64MB and
+  // the rest of the input after it are decompressed by the calling thread.
+  explicit ZStdSource(Source* upstream, unsigned num_workers = 0);
   ~ZStdSource();
   static bool HasValidHeader(Source* upstream);
 
  private:
+  class FrameDecoder;
+
   StatusObject<size_t> ReadInternal(const strings::MutableByteRange& range) override;
 
+  // Returns views into the frames decompressed by the workers.
+  StatusObject<strings::MutableByteRange> PeekInternal(size_t max_size) override;
+
+  // Switches to the streaming decompression once the decoder has reached a large frame.
+  // Returns false if it has not.
+  bool ResetLargeFrame();
+
   std::unique_ptr<Source> sub_stream_;
+  std::unique_ptr<FrameDecoder> decoder_;
   void* zstd_handle_;
-  std::unique_ptr<uint8_t[]> buf_;
-  strings::MutableByteRange buf_range_;
 };
 
 